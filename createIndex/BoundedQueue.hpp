@@ -0,0 +1,284 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+
+#include "ConcurrentQueue.hpp"
+
+/**
+ * A queue for passing things between threads without locks, which holds at
+ * most a fixed number of things. Writers that find it full wait for readers to
+ * catch up, so a fast producer can't fill up memory.
+ *
+ * Like ConcurrentQueue, it can track writers: it is told how many there are,
+ * each calls close() when done, and readers find out when everything has been
+ * read and nothing more can come. Any number of readers and writers may use it
+ * at once.
+ *
+ * Waiting is done by spinning briefly, then yielding, then sleeping for longer
+ * and longer up to a limit, since there is no condition variable to wait on.
+ *
+ * Implemented as a ring buffer of cells that each carry a sequence number
+ * saying whose turn it is to use them, after Dmitry Vyukov's bounded MPMC
+ * queue.
+ */
+template <typename T>
+class BoundedQueue {
+
+public:
+
+    /**
+     * Make a new BoundedQueue holding at most about the given number of items
+     * (rounded up to a power of 2), which expects the given number of writers
+     * to eventually call close().
+     */
+    BoundedQueue(size_t capacity, size_t numWriters): cells(), mask(0),
+        enqueuePos(0), dequeuePos(0), numWriters(numWriters),
+        totalThroughput(0) {
+
+        // Round up to a power of 2 so positions can wrap with a mask.
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+
+        cells = std::vector<Cell>(size);
+        for(size_t i = 0; i < size; i++) {
+            // Each cell is ready to be written on the first time around.
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Add something to the end of the queue, waiting for room if the queue is
+     * full. Must not be called by a writer that has called close().
+     */
+    void enqueue(T value) {
+        for(size_t tries = 0; !tryEnqueue(value); tries++) {
+            // Wait for a reader to make room.
+            backOff(tries);
+        }
+    }
+
+    /**
+     * Add something to the end of the queue if there is room. Returns true if
+     * it was added, in which case the value has been moved from, and false if
+     * the queue was full.
+     */
+    bool tryEnqueue(T& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+            if(sequence == pos) {
+                // The cell is free for this position. Try to claim it.
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) {
+
+                    cell.value = std::move(value);
+                    // Say the cell is ready to be read.
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+                // Otherwise pos was updated to where another writer got to.
+            } else if(sequence < pos) {
+                // The cell still holds the value from a lap ago, so the queue
+                // is full.
+                return false;
+            } else {
+                // Another writer got this position. Look again.
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Remove the first thing in the queue and put it in out, waiting for
+     * something to come if the queue is empty. Returns true if something was
+     * dequeued, and false if the queue is empty and all the writers have
+     * closed it, so nothing ever will be.
+     */
+    bool dequeue(T& out) {
+        for(size_t tries = 0; !tryDequeue(out); tries++) {
+            if(numWriters.load(std::memory_order_acquire) == 0) {
+                // Everything that will ever be written has been. Look one last
+                // time, in case it came in before the last writer closed.
+                return tryDequeue(out);
+            }
+
+            // Wait for a writer to write something.
+            backOff(tries);
+        }
+        return true;
+    }
+
+    /**
+     * Remove the first thing in the queue and put it in out, if there is
+     * anything. Returns true if something was dequeued, and false if the queue
+     * was empty.
+     */
+    bool tryDequeue(T& out) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+            if(sequence == pos + 1) {
+                // The cell has been written for this position. Try to claim
+                // it.
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed)) {
+
+                    out = std::move(cell.value);
+
+                    // Count that an item (or a batch of items) has passed
+                    // through the queue.
+                    totalThroughput.fetch_add(countQueueItems(out),
+                        std::memory_order_relaxed);
+
+                    // Say the cell is ready to be written on the next lap.
+                    cell.sequence.store(pos + mask + 1,
+                        std::memory_order_release);
+                    return true;
+                }
+                // Otherwise pos was updated to where another reader got to.
+            } else if(sequence < pos + 1) {
+                // Nothing has been written here yet, so the queue is empty.
+                return false;
+            } else {
+                // Another reader got this position. Look again.
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Close the queue. Should be called exactly once by each writer the queue
+     * was told about in the constructor, after which that writer may not write
+     * to the queue anymore.
+     */
+    void close() {
+        numWriters.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    /**
+     * Get the total throughput of the queue, which is the total number of items
+     * that have been dequeued, as counted by countQueueItems().
+     */
+    size_t getThroughput() const {
+        return totalThroughput.load(std::memory_order_relaxed);
+    }
+
+protected:
+
+    /**
+     * Wait a bit, for longer the more tries have already been made.
+     */
+    static void backOff(size_t tries) {
+        if(tries < SPIN_TRIES) {
+            // Just try again.
+            return;
+        } else if(tries < SPIN_TRIES + YIELD_TRIES) {
+            // Let someone else run.
+            std::this_thread::yield();
+        } else {
+            // Sleep, doubling each time, up to the limit.
+            size_t doublings = std::min(tries - SPIN_TRIES - YIELD_TRIES,
+                (size_t) 10);
+            std::this_thread::sleep_for(std::chrono::microseconds(
+                std::min((size_t) 1 << doublings, MAX_SLEEP_MICROSECONDS)));
+        }
+    }
+
+    /**
+     * One slot in the ring buffer.
+     */
+    struct Cell {
+        /**
+         * Says who can use the cell next: a writer at position p when it is
+         * p, and a reader at position p when it is p + 1.
+         */
+        std::atomic<size_t> sequence;
+
+        /**
+         * Holds the value, when there is one.
+         */
+        T value;
+
+        /**
+         * Cells need to be made in a vector, even though atomics can't be
+         * copied or moved. They are only ever made empty.
+         */
+        Cell(): sequence(0), value() {
+        }
+
+        Cell(const Cell& other): sequence(0), value() {
+        }
+
+        Cell& operator=(const Cell& other) {
+            return *this;
+        }
+    };
+
+    // How many times should we try without waiting?
+    static const size_t SPIN_TRIES = 64;
+
+    // And how many times should we yield before sleeping?
+    static const size_t YIELD_TRIES = 64;
+
+    // And what's the longest we should sleep at once?
+    static const size_t MAX_SLEEP_MICROSECONDS = 1000;
+
+    // Holds the ring buffer.
+    std::vector<Cell> cells;
+
+    // Holds the ring buffer size minus 1, for wrapping positions.
+    size_t mask;
+
+    // Where will the next item be written? Readers and writers each get their
+    // own cache line, so they don't slow each other down.
+    alignas(64) std::atomic<size_t> enqueuePos;
+
+    // Where will the next item be read from?
+    alignas(64) std::atomic<size_t> dequeuePos;
+
+    // How many writers are writing to the queue still?
+    alignas(64) std::atomic<size_t> numWriters;
+
+    // How many items have passed through the queue (i.e. been dequeued) since
+    // it was created?
+    std::atomic<size_t> totalThroughput;
+
+private:
+
+    /**
+     * No copy constructor is allowed.
+     */
+    BoundedQueue(const BoundedQueue<T>& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    BoundedQueue<T>& operator=(const BoundedQueue<T>& other) = delete;
+
+};
+
+// The waiting constants get used by reference (in std::min), so they need
+// definitions as well as their in-class initializers.
+template <typename T>
+const size_t BoundedQueue<T>::SPIN_TRIES;
+
+template <typename T>
+const size_t BoundedQueue<T>::YIELD_TRIES;
+
+template <typename T>
+const size_t BoundedQueue<T>::MAX_SLEEP_MICROSECONDS;
+
+#endif
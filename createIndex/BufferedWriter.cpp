@@ -0,0 +1,162 @@
+#include "BufferedWriter.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include <zlib.h>
+
+BufferedWriter::BufferedWriter(const std::string& filename, size_t threads):
+    compressed(filename.size() >= 3 &&
+    filename.compare(filename.size() - 3, 3, ".gz") == 0), chunk(),
+    file(filename.c_str(), std::ios::binary),
+    pending(std::max(threads, (size_t) 1) + 1, 1), error(), writer() {
+
+    if(!file) {
+        throw std::runtime_error("Could not open " + filename + " to write");
+    }
+
+    chunk.reserve(CHUNK_SIZE + BGZF_BLOCK_SIZE);
+
+    // Start the thread that writes to the file.
+    writer = std::thread(&BufferedWriter::run, this);
+}
+
+BufferedWriter::~BufferedWriter() {
+    if(writer.joinable()) {
+        try {
+            close();
+        } catch(...) {
+            // Nothing we can do about it now.
+        }
+    }
+}
+
+void BufferedWriter::close() {
+    if(!writer.joinable()) {
+        // Already closed.
+        return;
+    }
+
+    if(!chunk.empty()) {
+        sendChunk();
+    }
+
+    // Say there's nothing more, and wait for everything to be written.
+    pending.close();
+    writer.join();
+
+    if(compressed) {
+        // End with the empty block that marks the end of a BGZF file.
+        static const char eofBlock[] = "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00"
+            "\xff\x06\x00\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00\x00"
+            "\x00\x00\x00";
+        file.write(eofBlock, sizeof(eofBlock) - 1);
+    }
+
+    file.close();
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    if(!file) {
+        throw std::runtime_error("Could not finish writing file");
+    }
+}
+
+void BufferedWriter::sendChunk() {
+    std::future<std::string> ready;
+    if(compressed) {
+        // Compress it on its own thread.
+        ready = std::async(std::launch::async, &BufferedWriter::compress,
+            std::move(chunk));
+    } else {
+        // It's ready to write as is.
+        std::promise<std::string> promise;
+        promise.set_value(std::move(chunk));
+        ready = promise.get_future();
+    }
+
+    // Wait for room, so we don't pile up chunks faster than they can go out.
+    pending.enqueue(std::move(ready));
+
+    chunk = std::string();
+    chunk.reserve(CHUNK_SIZE + BGZF_BLOCK_SIZE);
+}
+
+void BufferedWriter::run() {
+    std::future<std::string> next;
+    while(pending.dequeue(next)) {
+        try {
+            std::string data = next.get();
+            file.write(data.data(), data.size());
+        } catch(...) {
+            // Remember the first thing that went wrong, but keep taking chunks
+            // so the producer doesn't wait forever.
+            if(!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+std::string BufferedWriter::compress(const std::string& text) {
+    std::string compressed;
+
+    for(size_t start = 0; start < text.size(); start += BGZF_BLOCK_SIZE) {
+        // Each block is a complete gzip member with the block size in an
+        // extra field.
+        size_t length = std::min(BGZF_BLOCK_SIZE, text.size() - start);
+        const Bytef* input = (const Bytef*) text.data() + start;
+
+        // Leave room for the header, and a block of at most 64 KB.
+        static const size_t HEADER_SIZE = 18;
+        static const size_t FOOTER_SIZE = 8;
+        static const size_t MAX_BLOCK_SIZE = 1 << 16;
+        unsigned char block[MAX_BLOCK_SIZE];
+
+        z_stream stream;
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        // Use a raw deflate stream, since we write the gzip wrapper ourselves.
+        if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+
+            throw std::runtime_error("Could not start compressing");
+        }
+        stream.next_in = (Bytef*) input;
+        stream.avail_in = length;
+        stream.next_out = block + HEADER_SIZE;
+        stream.avail_out = MAX_BLOCK_SIZE - HEADER_SIZE - FOOTER_SIZE;
+        int status = deflate(&stream, Z_FINISH);
+        size_t deflated = stream.total_out;
+        deflateEnd(&stream);
+
+        if(status != Z_STREAM_END) {
+            throw std::runtime_error("Could not compress block into BGZF");
+        }
+
+        size_t blockSize = HEADER_SIZE + deflated + FOOTER_SIZE;
+
+        // Fill in the header: gzip magic, deflate, extra field flag, no time,
+        // unknown OS, and a 6-byte extra field holding the block size - 1.
+        static const unsigned char header[] = {0x1f, 0x8b, 0x08, 0x04, 0, 0,
+            0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0};
+        std::copy(header, header + sizeof(header), block);
+        block[16] = (blockSize - 1) & 0xff;
+        block[17] = (blockSize - 1) >> 8;
+
+        // And the footer: the CRC and length of the uncompressed data, little-
+        // endian.
+        uint32_t crc = crc32(crc32(0, Z_NULL, 0), input, length);
+        unsigned char* footer = block + HEADER_SIZE + deflated;
+        for(size_t i = 0; i < 4; i++) {
+            footer[i] = (crc >> (8 * i)) & 0xff;
+            footer[4 + i] = (length >> (8 * i)) & 0xff;
+        }
+
+        compressed.append((const char*) block, blockSize);
+    }
+
+    return compressed;
+}
@@ -0,0 +1,196 @@
+#ifndef BUFFEREDWRITER_HPP
+#define BUFFEREDWRITER_HPP
+
+#include <string>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <exception>
+#include <type_traits>
+#include <cstdint>
+
+#include "BoundedQueue.hpp"
+
+/**
+ * Writes text to a file in large chunks, without flushing per line. Whoever
+ * produces the text formats it into a chunk, and full chunks are handed off to
+ * a thread that writes them to disk, so producing the next chunk overlaps with
+ * writing the last.
+ *
+ * If the filename ends in ".gz", the output is compressed as BGZF (blocked
+ * gzip, as made by bgzip), which any gzip reader can also read. Chunks are
+ * compressed on up to the given number of threads at once, and written out in
+ * order.
+ *
+ * Integers are formatted directly into the chunk, rather than through a stream.
+ */
+class BufferedWriter {
+
+public:
+
+    /**
+     * Open the given file for writing, compressing on up to the given number
+     * of threads if it is to be compressed. Throws a std::runtime_error if the
+     * file can't be opened.
+     */
+    BufferedWriter(const std::string& filename, size_t threads =
+        std::thread::hardware_concurrency());
+
+    /**
+     * Finish writing, if close() hasn't been called yet. Errors are ignored;
+     * call close() to find out about them.
+     */
+    ~BufferedWriter();
+
+    /**
+     * Write the given number of characters.
+     */
+    inline void write(const char* data, size_t length) {
+        chunk.append(data, length);
+        if(chunk.size() >= CHUNK_SIZE) {
+            sendChunk();
+        }
+    }
+
+    /**
+     * Write a string.
+     */
+    inline BufferedWriter& operator<<(const std::string& text) {
+        write(text.data(), text.size());
+        return *this;
+    }
+
+    /**
+     * Write a C string.
+     */
+    inline BufferedWriter& operator<<(const char* text) {
+        write(text, std::char_traits<char>::length(text));
+        return *this;
+    }
+
+    /**
+     * Write a single character.
+     */
+    inline BufferedWriter& operator<<(char character) {
+        chunk.push_back(character);
+        if(chunk.size() >= CHUNK_SIZE) {
+            sendChunk();
+        }
+        return *this;
+    }
+
+    /**
+     * Write an integer in decimal. Bools come out as 0 or 1, as they do on a
+     * stream.
+     */
+    template<typename Integer, typename std::enable_if<
+        std::is_integral<Integer>::value && !std::is_same<Integer,
+        char>::value, int>::type = 0>
+    inline BufferedWriter& operator<<(Integer value) {
+        appendInteger(chunk, value);
+        if(chunk.size() >= CHUNK_SIZE) {
+            sendChunk();
+        }
+        return *this;
+    }
+
+    /**
+     * Append an integer in decimal to the given string, the same way it would
+     * be written, so text can be formatted ahead of time without a stream.
+     */
+    template<typename Integer, typename std::enable_if<
+        std::is_integral<Integer>::value && !std::is_same<Integer,
+        char>::value, int>::type = 0>
+    static inline void appendInteger(std::string& text, Integer value) {
+        // Fill in digits from the end of a buffer big enough for any 64-bit
+        // number and a sign.
+        char digits[21];
+        char* start = digits + sizeof(digits);
+
+        bool negative = value < 0;
+        // Work with the magnitude unsigned, so the most negative value works.
+        uint64_t magnitude = negative ? -(uint64_t) value : (uint64_t) value;
+
+        do {
+            *(--start) = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while(magnitude != 0);
+
+        if(negative) {
+            *(--start) = '-';
+        }
+
+        text.append(start, digits + sizeof(digits) - start);
+    }
+
+    /**
+     * Write out everything written so far, and close the file. Throws a
+     * std::runtime_error if anything couldn't be written.
+     */
+    void close();
+
+    /**
+     * How many characters do we collect before handing them off?
+     */
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    /**
+     * How many uncompressed bytes go in each BGZF block? This is what bgzip
+     * uses, and leaves room for incompressible data to fit in a block.
+     */
+    static const size_t BGZF_BLOCK_SIZE = 0xff00;
+
+protected:
+
+    /**
+     * Hand off the current chunk to be compressed if necessary and written,
+     * and start a new one.
+     */
+    void sendChunk();
+
+    /**
+     * Write chunks to the file in order as they are ready, until there are no
+     * more.
+     */
+    void run();
+
+    /**
+     * Compress the given text as a series of BGZF blocks.
+     */
+    static std::string compress(const std::string& text);
+
+    // Are we compressing?
+    bool compressed;
+
+    // Holds the text not yet handed off.
+    std::string chunk;
+
+    // Holds the file we write to.
+    std::ofstream file;
+
+    // Holds the chunks waiting to be written, in order, each of which may
+    // still be being compressed. Since it is bounded, the producer waits when
+    // too many chunks are pending.
+    BoundedQueue<std::future<std::string>> pending;
+
+    // Holds the error, if any, from writing.
+    std::exception_ptr error;
+
+    // Holds the thread that writes chunks out.
+    std::thread writer;
+
+private:
+
+    /**
+     * No copy constructor is allowed.
+     */
+    BufferedWriter(const BufferedWriter& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    BufferedWriter& operator=(const BufferedWriter& other) = delete;
+
+};
+
+#endif
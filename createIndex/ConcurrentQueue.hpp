@@ -2,10 +2,61 @@
 #define CONCURRENTQUEUE_HPP
 
 #include <queue>
+#include <deque>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
 #include <thread>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 
+#include <Log.hpp>
+
+/**
+ * How many items does the given queue entry count for in a ConcurrentQueue's
+ * throughput? Usually just 1, but types that stand for more than one thing can
+ * provide their own overload.
+ */
+template <typename T>
+size_t countQueueItems(const T& entry) {
+    return 1;
+}
+
+/**
+ * A vector is a batch, and counts for all the items in it.
+ */
+template <typename T>
+size_t countQueueItems(const std::vector<T>& batch) {
+    size_t total = 0;
+    for(const T& entry : batch) {
+        total += countQueueItems(entry);
+    }
+    return total;
+}
+
+/**
+ * Write a queue entry to a spill file, so a ConcurrentQueue can hold it on disk
+ * instead of in memory. Types that can be spilled provide their own overload;
+ * everything else can't be spilled.
+ */
+template <typename T>
+void spillQueueEntry(std::ostream& out, const T& entry) {
+    throw std::runtime_error("Queue entries of this type can't be spilled");
+}
+
+/**
+ * Read back a queue entry written by spillQueueEntry(), replacing the given
+ * entry. Types that can be spilled provide their own overload.
+ */
+template <typename T>
+void unspillQueueEntry(std::istream& in, T& entry) {
+    throw std::runtime_error("Queue entries of this type can't be spilled");
+}
+
 /**
  * A queue which comes with a lock for controlling access from multiple threads.
  * C++11 only.
@@ -28,7 +79,8 @@ public:
      * one).
      */
     ConcurrentQueue(): queue(), mutex(), nonempty(), numWriters(0),
-        totalThroughput(0) {
+        totalThroughput(0), totalEnqueued(0), depth(0), spillAfter(0),
+        nextSegment(0), writerEntries(0), readerEntries(0), spilled(0) {
     }
     
     /**
@@ -38,10 +90,42 @@ public:
      * out and not block on data from a queue that nobody will ever write to.
      */
     ConcurrentQueue(size_t numWriters): queue(), mutex(), nonempty(), 
-        numWriters(numWriters), totalThroughput(0) {
+        numWriters(numWriters), totalThroughput(0), totalEnqueued(0),
+        depth(0), spillAfter(0), nextSegment(0), writerEntries(0),
+        readerEntries(0), spilled(0) {
     
     }
     
+    /**
+     * Get rid of the queue, and any spill files it still has on disk.
+     */
+    ~ConcurrentQueue() {
+        spillWriter.close();
+        spillReader.close();
+        if(!writerFile.empty()) {
+            std::remove(writerFile.c_str());
+        }
+        if(!readerFile.empty()) {
+            std::remove(readerFile.c_str());
+        }
+        for(auto& segment : spillSegments) {
+            std::remove(segment.first.c_str());
+        }
+    }
+    
+    /**
+     * Once the given number of entries are waiting in memory, spill further
+     * entries to scratch files named with the given prefix, and read them back
+     * in order when everything before them has been dequeued. Writers then
+     * never wait, and the memory the queue holds stays bounded however far the
+     * reader falls behind. Needs spillQueueEntry() and unspillQueueEntry()
+     * overloads for the entry type. Must be called before the queue is used.
+     */
+    void spillTo(const std::string& prefix, size_t maxInMemory) {
+        spillPrefix = prefix;
+        spillAfter = maxInMemory;
+    }
+    
     /**
      * Lock the queue so it can be safely read or written to. Caller must not
      * already hold a lock on the queue.
@@ -58,14 +142,15 @@ public:
      * TODO: would it be faster to hold onto the lock and check again for stuff?
      */
     T dequeue(Lock& callerLock) {
-        // Grab the first element.
-        T toReturn = queue.front();
-        
-        // Remove it form our queue.
-        queue.pop();
+        // Grab the first element, from memory if it's there and otherwise from
+        // the oldest spill file (since we only spill when entries are waiting
+        // in memory).
+        T toReturn = queue.empty() ? unspill() : takeFront();
+        depth--;
         
-        // Count that an item has passed through the queue.
-        totalThroughput++;
+        // Count that an item (or a batch of items) has passed through the
+        // queue.
+        totalThroughput += countQueueItems(toReturn);
         
         // Unlock the caller's lock.
         callerLock.unlock();
@@ -82,8 +167,40 @@ public:
      * that data is available.
      */
     void enqueue(const T& value, Lock& callerLock) {
+        // Count what's coming in.
+        totalEnqueued += countQueueItems(value);
+        depth++;
+    
         // Put the element at the end of the queue.
-        queue.push(value);
+        if(shouldSpill()) {
+            spill(value);
+        } else {
+            queue.push(value);
+        }
+        
+        // Release the caller's lock
+        callerLock.unlock();
+        
+        // Tell anyone who is waiting.
+        nonempty.notify_one();
+    }
+    
+    /**
+     * Add something to the end of the queue by moving it in, so a batch of
+     * items can be handed off without copying. Otherwise the same as the
+     * copying enqueue.
+     */
+    void enqueue(T&& value, Lock& callerLock) {
+        // Count what's coming in, before we lose it.
+        totalEnqueued += countQueueItems(value);
+        depth++;
+    
+        // Put the element at the end of the queue.
+        if(shouldSpill()) {
+            spill(value);
+        } else {
+            queue.push(std::move(value));
+        }
         
         // Release the caller's lock
         callerLock.unlock();
@@ -97,7 +214,7 @@ public:
      * a lock on the queue, but it is not released.
      */
     bool isEmpty(Lock& callerLock) {
-        return queue.empty();
+        return queue.empty() && spilled == 0;
     }
     
     /**
@@ -167,13 +284,45 @@ public:
     
     /**
      * Get the total throughput of the queue, which is the total number of items
-     * that have been dequeued. Requires a lock from the caller, which is
-     * released.
+     * that have been dequeued, as counted by countQueueItems(). Requires a lock
+     * from the caller, which is released.
      */
     size_t getThroughput(Lock& callerLock) {
         return totalThroughput;
     }
     
+    /**
+     * Get the total number of items that have been dequeued, without a lock,
+     * so it can be watched from another thread. May be slightly out of date.
+     */
+    size_t getDequeuedItems() const {
+        return totalThroughput.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the total number of items that have been enqueued, as counted by
+     * countQueueItems(), without a lock. May be slightly out of date.
+     */
+    size_t getEnqueuedItems() const {
+        return totalEnqueued.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of entries (not items) waiting in the queue, without a
+     * lock. May be slightly out of date.
+     */
+    size_t getDepth() const {
+        return depth.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of waiting entries that are spilled to disk, without a
+     * lock. May be slightly out of date.
+     */
+    size_t getSpilled() const {
+        return spilled.load(std::memory_order_relaxed);
+    }
+    
     /**
      * Ask for the default move assignment operator.
      */
@@ -197,15 +346,153 @@ protected:
     std::condition_variable nonempty;
     
     // We would have a condition for non-full, but instead we let our queue grow
-    // indefinitely. Don't fill up memory.
+    // indefinitely. Use spillTo() if that might fill up memory.
     
     // How many writers are writing to the queue still (if writer counting is
     // enabled).
     size_t numWriters;
     
     // How many items have passed through the queue (i.e. been dequeued) since
-    // it was created?
-    size_t totalThroughput;
+    // it was created? Only changed under the lock, but atomic so it can be
+    // watched without it.
+    std::atomic<size_t> totalThroughput;
+    
+    // How many items have been put into the queue since it was created?
+    std::atomic<size_t> totalEnqueued;
+    
+    // How many entries are in the queue right now?
+    std::atomic<size_t> depth;
+    
+    // What do spill file names start with?
+    std::string spillPrefix;
+    
+    // How many entries can wait in memory before we spill? 0 for no limit.
+    size_t spillAfter;
+    
+    // What number will the next spill file get?
+    size_t nextSegment;
+    
+    // Holds the spill file being written, if any, and its name.
+    std::ofstream spillWriter;
+    std::string writerFile;
+    
+    // How many entries are in the spill file being written?
+    size_t writerEntries;
+    
+    // Spill files that are done being written and haven't been read yet, with
+    // their entry counts, oldest first.
+    std::deque<std::pair<std::string, size_t>> spillSegments;
+    
+    // Holds the spill file being read, if any, and its name.
+    std::ifstream spillReader;
+    std::string readerFile;
+    
+    // How many entries are left to read in that file?
+    size_t readerEntries;
+    
+    // How many entries are waiting on disk? Only changed under the lock.
+    std::atomic<size_t> spilled;
+    
+    /**
+     * Should the next entry enqueued go to disk? Once anything is spilled,
+     * everything after it has to be too, to keep the queue in order. Caller
+     * must hold the lock.
+     */
+    bool shouldSpill() const {
+        return spillAfter > 0 && (spilled > 0 || queue.size() >= spillAfter);
+    }
+    
+    /**
+     * Pop and return the first entry in memory. Caller must hold the lock.
+     */
+    T takeFront() {
+        // It's about to be popped, so we can steal it.
+        T toReturn = std::move(queue.front());
+        queue.pop();
+        return toReturn;
+    }
+    
+    /**
+     * Write an entry to the end of the spill file being written, starting a
+     * new one if needed. Caller must hold the lock.
+     */
+    void spill(const T& value) {
+        if(!spillWriter.is_open()) {
+            writerFile = spillPrefix + "." + std::to_string(nextSegment++) +
+                ".spill";
+            spillWriter.open(writerFile.c_str(), std::ios::binary);
+            if(!spillWriter) {
+                throw std::runtime_error("Could not open " + writerFile +
+                    " to spill queue to");
+            }
+        }
+        
+        spillQueueEntry(spillWriter, value);
+        if(!spillWriter) {
+            throw std::runtime_error("Could not spill queue to " + writerFile);
+        }
+        writerEntries++;
+        spilled++;
+        
+        if(writerEntries >= spillAfter) {
+            // Keep each file about as big as what we hold in memory, so the
+            // disk used goes away a file at a time as the reader catches up.
+            finishSpillFile();
+        }
+    }
+    
+    /**
+     * Finish the spill file being written, and put it in line to be read.
+     * Caller must hold the lock.
+     */
+    void finishSpillFile() {
+        spillWriter.close();
+        if(!spillWriter) {
+            throw std::runtime_error("Could not spill queue to " + writerFile);
+        }
+        spillWriter.clear();
+        spillSegments.emplace_back(std::move(writerFile), writerEntries);
+        writerFile.clear();
+        writerEntries = 0;
+    }
+    
+    /**
+     * Read and return the oldest spilled entry. There must be one. Caller must
+     * hold the lock.
+     */
+    T unspill() {
+        if(readerEntries == 0) {
+            if(spillSegments.empty()) {
+                // The oldest entries are in the file still being written, so
+                // finish it off and read it.
+                finishSpillFile();
+            }
+            
+            readerFile = std::move(spillSegments.front().first);
+            readerEntries = spillSegments.front().second;
+            spillSegments.pop_front();
+            spillReader.open(readerFile.c_str(), std::ios::binary);
+        }
+        
+        T toReturn;
+        unspillQueueEntry(spillReader, toReturn);
+        if(!spillReader) {
+            throw std::runtime_error("Could not read back queue spilled to " +
+                readerFile);
+        }
+        readerEntries--;
+        spilled--;
+        
+        if(readerEntries == 0) {
+            // Done with this file, so free up the disk.
+            spillReader.close();
+            spillReader.clear();
+            std::remove(readerFile.c_str());
+            readerFile.clear();
+        }
+        
+        return toReturn;
+    }
     
 private:
     
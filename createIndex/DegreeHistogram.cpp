@@ -0,0 +1,77 @@
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+#include <Log.hpp>
+
+#include "DegreeHistogram.hpp"
+
+DegreeHistogram::DegreeHistogram(size_t contigs): byContig(contigs),
+    total() {
+
+    // Nothing to do
+}
+
+void DegreeHistogram::update(stPinchThreadSet* threadSet,
+    const std::vector<size_t>& contigs) {
+
+    for(size_t contig : contigs) {
+        // Take out what we had counted for this contig.
+        for(auto& kv : byContig[contig]) {
+            total[kv.first] -= kv.second;
+            if(total[kv.first] == 0) {
+                total.erase(kv.first);
+            }
+        }
+        byContig[contig].clear();
+
+        stPinchThread* thread = stPinchThreadSet_getThread(threadSet, contig);
+        if(thread == NULL) {
+            throw std::runtime_error("No thread for contig " +
+                std::to_string(contig));
+        }
+
+        // Go through all its segments in order, counting each block at its
+        // first segment.
+        for(stPinchSegment* segment = stPinchThread_getFirst(thread);
+            segment != NULL; segment = stPinchSegment_get3Prime(segment)) {
+
+            stPinchBlock* block = stPinchSegment_getBlock(segment);
+            if(block != NULL) {
+                if(stPinchBlock_getFirst(block) == segment) {
+                    byContig[contig][stPinchBlock_getDegree(block)]++;
+                }
+            } else {
+                // A bare segment is attached to whatever is on each end.
+                size_t degree = (stPinchSegment_get3Prime(segment) != NULL) +
+                    (stPinchSegment_get5Prime(segment) != NULL);
+                byContig[contig][degree]++;
+            }
+        }
+
+        // Put the new counts in.
+        for(auto& kv : byContig[contig]) {
+            total[kv.first] += kv.second;
+        }
+    }
+}
+
+void DegreeHistogram::updateAll(stPinchThreadSet* threadSet) {
+    std::vector<size_t> contigs(byContig.size());
+    std::iota(contigs.begin(), contigs.end(), 0);
+    update(threadSet, contigs);
+}
+
+void DegreeHistogram::write(const std::string& filename) const {
+    Log::info() << "Saving pinch graph degrees to " << filename << std::endl;
+
+    std::ofstream degrees(filename.c_str());
+
+    for(auto& kv : total) {
+        for(size_t i = 0; i < kv.second; i++) {
+            degrees << kv.first << std::endl;
+        }
+    }
+
+    degrees.close();
+}
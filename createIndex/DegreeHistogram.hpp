@@ -0,0 +1,64 @@
+#ifndef DEGREEHISTOGRAM_HPP
+#define DEGREEHISTOGRAM_HPP
+
+#include <map>
+#include <vector>
+#include <string>
+
+#include <stPinchGraphs.h>
+
+/**
+ * Keeps a histogram of the degrees of the nodes of a pinch graph (blocks, and
+ * segments without blocks) up to date as the graph is merged, so that it is
+ * ready as soon as the merge is done.
+ *
+ * Each node is counted on one contig: a block on the contig of its first
+ * segment, and a bare segment on its own contig. After merges are applied and
+ * trivial boundaries joined, only the contigs the merges affected (as given by
+ * MergeApplier::getAffectedContigs()) need to be recounted, since every block
+ * that changed has all its segments on those contigs.
+ */
+class DegreeHistogram {
+
+public:
+    /**
+     * Make a new DegreeHistogram for a graph with the given number of threads,
+     * which are named 0 to contigs - 1. Nothing is counted until update() is
+     * called.
+     */
+    DegreeHistogram(size_t contigs);
+
+    /**
+     * Recount the nodes on the given contigs of the given pinch graph.
+     */
+    void update(stPinchThreadSet* threadSet,
+        const std::vector<size_t>& contigs);
+
+    /**
+     * Recount the nodes on all contigs of the given pinch graph.
+     */
+    void updateAll(stPinchThreadSet* threadSet);
+
+    /**
+     * Get the number of nodes of each degree.
+     */
+    inline const std::map<size_t, size_t>& getHistogram() const {
+        return total;
+    }
+
+    /**
+     * Write the degree of each node to the given file, one per line, in order
+     * of increasing degree.
+     */
+    void write(const std::string& filename) const;
+
+protected:
+    // Holds the number of nodes of each degree counted on each contig.
+    std::vector<std::map<size_t, size_t>> byContig;
+
+    // Holds the sum of all of those.
+    std::map<size_t, size_t> total;
+
+};
+
+#endif
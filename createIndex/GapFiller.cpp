@@ -0,0 +1,167 @@
+#include "GapFiller.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <util.hpp>
+
+GapFiller::GapFiller(const FMDIndex& index, size_t maxGap,
+    double maxDivergence): index(index), maxGap(maxGap),
+    maxDivergence(maxDivergence) {
+
+    if(maxDivergence < 0 || maxDivergence >= 1) {
+        throw std::runtime_error("Gap divergence must be in [0, 1)");
+    }
+}
+
+size_t GapFiller::fill(const std::string& query,
+    const std::vector<std::pair<size_t, TextPosition>>& anchors,
+    const std::function<void(size_t, TextPosition)>& callback) const {
+
+    size_t filled = 0;
+    std::vector<std::pair<size_t, size_t>> matches;
+
+    for(size_t i = 1; i < anchors.size(); i++) {
+        const auto& left = anchors[i - 1];
+        const auto& right = anchors[i];
+
+        if(left.second.getText() != right.second.getText() ||
+            right.second.getOffset() <= left.second.getOffset()) {
+            // The mappings on either side don't agree.
+            continue;
+        }
+
+        // How many bases are in the gap on each side?
+        size_t queryGap = right.first - left.first - 1;
+        size_t referenceGap = right.second.getOffset() -
+            left.second.getOffset() - 1;
+        if(queryGap == 0 || referenceGap == 0 || queryGap > maxGap ||
+            referenceGap > maxGap) {
+
+            // Nothing to fill, or too much.
+            continue;
+        }
+
+        size_t maxEdits = (size_t) std::floor(maxDivergence *
+            std::max(queryGap, referenceGap));
+        if(std::max(queryGap, referenceGap) -
+            std::min(queryGap, referenceGap) > maxEdits) {
+
+            // The lengths alone are too different.
+            continue;
+        }
+
+        std::string reference = getTextSubstring(left.second.getText(),
+            left.second.getOffset() + 1, referenceGap);
+        if(!align(query.substr(left.first + 1, queryGap), reference, maxEdits,
+            matches)) {
+
+            continue;
+        }
+
+        for(const auto& match : matches) {
+            callback(left.first + 1 + match.first,
+                TextPosition(left.second.getText(),
+                left.second.getOffset() + 1 + match.second));
+        }
+        filled += matches.size();
+    }
+
+    return filled;
+}
+
+bool GapFiller::align(const std::string& a, const std::string& b,
+    size_t maxEdits, std::vector<std::pair<size_t, size_t>>& matches) {
+
+    matches.clear();
+
+    size_t n = a.size();
+    size_t m = b.size();
+    if(std::max(n, m) - std::min(n, m) > maxEdits) {
+        return false;
+    }
+
+    // Only cells within maxEdits of the main diagonal can be on an alignment
+    // with that few edits. Row i holds columns i - maxEdits to i + maxEdits,
+    // and anything outside the band or the matrix costs too much.
+    size_t width = 2 * maxEdits + 1;
+    const uint32_t tooMuch = std::numeric_limits<uint32_t>::max() / 2;
+    std::vector<uint32_t> cost((n + 1) * width, tooMuch);
+    auto cell = [&](size_t i, size_t j) -> uint32_t& {
+        return cost[i * width + (j + maxEdits - i)];
+    };
+
+    for(size_t j = 0; j <= std::min(m, maxEdits); j++) {
+        cell(0, j) = j;
+    }
+    for(size_t i = 1; i <= n; i++) {
+        size_t first = i > maxEdits ? i - maxEdits : 0;
+        size_t last = std::min(m, i + maxEdits);
+        uint32_t best = tooMuch;
+        for(size_t j = first; j <= last; j++) {
+            uint32_t value;
+            if(j == 0) {
+                value = i;
+            } else {
+                value = cell(i - 1, j - 1) + (a[i - 1] != b[j - 1]);
+                if(j > first) {
+                    value = std::min(value, cell(i, j - 1) + 1);
+                }
+            }
+            if(j <= i - 1 + maxEdits) {
+                // The cell above is in the band.
+                value = std::min(value, cell(i - 1, j) + 1);
+            }
+            cell(i, j) = value;
+            best = std::min(best, value);
+        }
+        if(best > maxEdits) {
+            // Every alignment already has too many edits.
+            return false;
+        }
+    }
+
+    if(cell(n, m) > maxEdits) {
+        return false;
+    }
+
+    // Trace back, preferring to go diagonally.
+    size_t i = n;
+    size_t j = m;
+    while(i > 0 || j > 0) {
+        if(i > 0 && j > 0 && cell(i, j) == cell(i - 1, j - 1) +
+            (a[i - 1] != b[j - 1])) {
+
+            if(a[i - 1] == b[j - 1]) {
+                matches.emplace_back(i - 1, j - 1);
+            }
+            i--;
+            j--;
+        } else if(i > 0 && j <= i - 1 + maxEdits &&
+            cell(i, j) == cell(i - 1, j) + 1) {
+
+            i--;
+        } else {
+            j--;
+        }
+    }
+    std::reverse(matches.begin(), matches.end());
+
+    return true;
+}
+
+std::string GapFiller::getTextSubstring(size_t text, size_t start,
+    size_t length) const {
+
+    size_t contig = text / 2;
+    auto sequence = index.displayContigCached(contig);
+    if(text % 2 == 0) {
+        return sequence->substr(start, length);
+    }
+
+    // Reverse strand texts run backward along the contig.
+    return reverseComplement(sequence->substr(sequence->size() - start - length,
+        length));
+}
@@ -0,0 +1,71 @@
+#ifndef GAPFILLER_HPP
+#define GAPFILLER_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+#include <FMDIndex.hpp>
+#include <TextPosition.hpp>
+
+/**
+ * Recovers merges for short runs of query bases that didn't map, but sit
+ * between two bases that mapped consistently: to the same text, in order, with
+ * a short gap between them there too. The query and reference bases in each
+ * such gap are aligned globally with a banded edit distance alignment, and
+ * query bases aligned to matching reference bases are reported as if they had
+ * mapped.
+ *
+ * Gaps are only filled if they align with few enough edits, so this recovers
+ * coverage lost to substitutions and small indels without lowering the context
+ * needed to map anywhere else.
+ */
+class GapFiller {
+
+public:
+    /**
+     * Make a GapFiller that aligns gaps of up to maxGap bases on each side
+     * against the given index, and fills them if they align with at most
+     * maxDivergence edits per base of the longer side.
+     */
+    GapFiller(const FMDIndex& index, size_t maxGap, double maxDivergence);
+
+    /**
+     * Fill the gaps between the given mappings of bases of the given query, as
+     * (base, position) pairs sorted by base. Calls the callback with each base
+     * of a gap that aligns to a matching reference base, and the position it
+     * aligns to. Returns the number of bases filled.
+     */
+    size_t fill(const std::string& query,
+        const std::vector<std::pair<size_t, TextPosition>>& anchors,
+        const std::function<void(size_t, TextPosition)>& callback) const;
+
+    /**
+     * Align two strings end to end with at most maxEdits unit-cost edits. If
+     * they can be, fills matches with the (index in a, index in b) pairs of
+     * identical characters aligned to each other, in order, and returns true.
+     * Otherwise returns false.
+     */
+    static bool align(const std::string& a, const std::string& b,
+        size_t maxEdits, std::vector<std::pair<size_t, size_t>>& matches);
+
+protected:
+    // What index are we aligning to?
+    const FMDIndex& index;
+
+    // How long can a gap be on either side?
+    size_t maxGap;
+
+    // How many edits per base can a gap's alignment have?
+    double maxDivergence;
+
+    /**
+     * Get the given number of characters from the given offset on the given
+     * text.
+     */
+    std::string getTextSubstring(size_t text, size_t start,
+        size_t length) const;
+};
+
+#endif
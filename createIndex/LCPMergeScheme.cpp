@@ -0,0 +1,221 @@
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+#include <Log.hpp>
+
+#include "LCPMergeScheme.hpp"
+
+const size_t LCPMergeScheme::MAX_THREADS = 32;
+const size_t LCPMergeScheme::BATCH_SIZE = 4096;
+const size_t LCPMergeScheme::CHUNK_ROWS = 1 << 20;
+
+LCPMergeScheme::LCPMergeScheme(const FMDIndex& index): MergeScheme(index),
+    tasks(), queue(NULL), nextChunk(0), groupsFound(0) {
+    
+    // Nothing to do
+
+}
+
+LCPMergeScheme::~LCPMergeScheme() {
+    
+    join(); // Wait for our tasks
+    
+    if(queue != NULL) {
+        // Get rid of the queue if we made one.
+        delete queue;
+        queue = NULL;
+    }
+
+}
+
+ConcurrentQueue<MergeBatch>& LCPMergeScheme::run() {
+    
+    if(queue != NULL) {
+        // Don't let people call this twice.
+        throw std::runtime_error("Called run() twice on an LCPMergeScheme.");
+    }
+    
+    // How many chunks of rows are there to scan?
+    size_t chunks = (index.getBWTLength() + CHUNK_ROWS - 1) / CHUNK_ROWS;
+    
+    // Don't start more tasks than we have chunks, but start at least one, so
+    // the queue gets closed.
+    size_t numThreads = std::max(std::min(maxThreads, chunks), (size_t) 1);
+    
+    Log::info() << "Running LCP merge on " << numThreads << " tasks" <<
+        std::endl;
+    
+    // Make the queue of merges
+    queue = makeQueue(numThreads);
+    
+    for(size_t threadID = 0; threadID < numThreads; threadID++) {
+        tasks.run([this]() {
+            try {
+                generateMerges();
+            } catch(...) {
+                // Still say we're done writing, so whatever is applying the
+                // merges doesn't wait forever.
+                auto lock = queue->lock();
+                queue->close(lock);
+                throw;
+            }
+        });
+    }
+    
+    // Return a reference to the queue of merges, for our caller to do something
+    // with.
+    return *queue;
+
+}
+
+void LCPMergeScheme::join() {
+    // Wait for all the tasks, helping out with them. Throws if any of them
+    // did.
+    tasks.join();
+}
+
+void LCPMergeScheme::sendBatch(MergeBatch& batch) const {
+    if(batch.empty()) {
+        // Don't bother the queue or the applier.
+        return;
+    }
+    
+    // Lock the queue.
+    auto lock = queue->lock();
+    // Spend our lock to move the whole batch into it.
+    queue->enqueue(std::move(batch), lock);
+    
+    // Start again with nothing, since a moved-from vector could be anything.
+    batch.clear();
+    batch.reserve(BATCH_SIZE);
+}
+
+bool LCPMergeScheme::isUniquePerGenome(size_t start, size_t end) const {
+    // Every row has to be in some genome, and no genome can have two.
+    size_t rowsInGenomes = 0;
+    for(auto& genomeAndCount : index.getGenomesInRange(start, end)) {
+        if(genomeAndCount.second > 1) {
+            return false;
+        }
+        rowsInGenomes += genomeAndCount.second;
+    }
+    return rowsInGenomes == end - start;
+}
+
+void LCPMergeScheme::generateMerges() {
+    
+    // How many chunks are there?
+    size_t length = index.getBWTLength();
+    size_t chunks = (length + CHUNK_ROWS - 1) / CHUNK_ROWS;
+    
+    for(size_t chunk = nextChunk++; chunk < chunks; chunk = nextChunk++) {
+        // Scan each chunk we can get.
+        generateSomeMerges(chunk * CHUNK_ROWS,
+            std::min((chunk + 1) * CHUNK_ROWS, length));
+    }
+    
+    // Close the output queue to say we're done.
+    auto lock = queue->lock();
+    queue->close(lock);
+
+}
+
+void LCPMergeScheme::generateSomeMerges(size_t start, size_t end) {
+    
+    // How long is the whole BWT?
+    size_t length = index.getBWTLength();
+    
+    // No interval can have more rows than there are genomes.
+    size_t maxRows = index.getNumberOfGenomes();
+    
+    // The root interval, of depth 0, is never unique.
+    size_t minDepth = std::max(minContext, (size_t) 1);
+    
+    // Collect the merges here, so the queue is only locked once per batch.
+    MergeBatch batch;
+    batch.reserve(BATCH_SIZE);
+    
+    // Hold the rows of a group and where they are.
+    std::vector<int64_t> rows;
+    std::vector<TextPosition> positions;
+    
+    // How many groups did we find?
+    size_t groups = 0;
+    
+    size_t row = start;
+    while(row < end) {
+        // Find the biggest unique enough interval [groupStart, groupEnd]
+        // containing this row, starting from the row by itself.
+        size_t groupStart = row;
+        size_t groupEnd = row;
+        
+        while(true) {
+            // How deep is the parent interval? LCP values are between each row
+            // and the one before it.
+            size_t depth = std::max(
+                groupStart > 0 ? index.getLCP(groupStart) : 0,
+                groupEnd + 1 < length ? index.getLCP(groupEnd + 1) : 0);
+            if(depth < minDepth) {
+                // The parent is too shallow to be a context.
+                break;
+            }
+            
+            // Widen out to the parent, but give up once it is too big to be
+            // unique anyway.
+            size_t parentStart = groupStart;
+            size_t parentEnd = groupEnd;
+            while(parentStart > 0 && index.getLCP(parentStart) >= depth &&
+                parentEnd - parentStart < maxRows) {
+                
+                parentStart--;
+            }
+            while(parentEnd + 1 < length &&
+                index.getLCP(parentEnd + 1) >= depth &&
+                parentEnd - parentStart < maxRows) {
+                
+                parentEnd++;
+            }
+            
+            if(parentEnd - parentStart >= maxRows ||
+                !isUniquePerGenome(parentStart, parentEnd + 1)) {
+                
+                // Some genome has this context more than once, and so will it
+                // have all shorter ones.
+                break;
+            }
+            
+            // Otherwise the parent will do, so try its parent.
+            groupStart = parentStart;
+            groupEnd = parentEnd;
+        }
+        
+        if(groupStart < groupEnd && groupStart >= start) {
+            // This is a group of rows from different genomes, and we are the
+            // ones who found its first row. Find where they all are.
+            rows.clear();
+            for(size_t i = groupStart; i <= groupEnd; i++) {
+                rows.push_back(i);
+            }
+            positions.resize(rows.size());
+            index.locateBatch(&rows[0], rows.size(), &positions[0]);
+            
+            // Merge the first base of each with that of the first.
+            for(size_t i = 1; i < positions.size(); i++) {
+                if(batch.size() >= BATCH_SIZE) {
+                    sendBatch(batch);
+                }
+                batch.push_back(Merge(positions[0], positions[i]));
+            }
+            groups++;
+        }
+        
+        // All the other rows of the group are in the same group, so skip them.
+        row = groupEnd + 1;
+    }
+    
+    // Send off whatever is left over from the chunk.
+    sendBatch(batch);
+    
+    groupsFound += groups;
+}
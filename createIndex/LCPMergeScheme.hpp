@@ -0,0 +1,134 @@
+#ifndef LCPMERGESCHEME_HPP
+#define LCPMERGESCHEME_HPP
+
+#include <vector>
+#include <atomic>
+
+#include "MergeScheme.hpp"
+#include <TaskPool.hpp>
+
+/**
+ * Represents the LCP merging scheme, which merges all the genomes at once
+ * without mapping anything. It makes one parallel scan over the BWT and its
+ * LCP array, and for each BWT row finds the biggest LCP interval containing it
+ * (the shortest context it starts) that has no more than one row from any
+ * genome, and is at least minContext bases deep. If that interval has rows from
+ * more than one genome, the first bases of all its rows are merged together,
+ * since each genome has that context in exactly one place.
+ *
+ * Every row is in at most one such interval, so each group of rows is found
+ * once, by whichever task scans the row it starts at. The merges are single
+ * bases, in BWT order rather than along the contigs, so they are worth sorting
+ * before they are applied. Each base is merged once for the context after it,
+ * from its row on its own strand, and once for the context before it, from its
+ * row on the other strand, and unlike with the mapping schemes nothing makes
+ * the two agree on its partner in a genome.
+ */
+class LCPMergeScheme: public MergeScheme {
+
+public:
+
+    /**
+     * Make a new LCPMergeScheme, which merges all the genomes in the given
+     * index.
+     */
+    LCPMergeScheme(const FMDIndex& index);
+    
+    /**
+     * Get rid of an LCPMergeScheme (and delete its queue, if it has one).
+     * If tasks are running, blocks until they finish.
+     */
+    virtual ~LCPMergeScheme();
+    
+    /**
+     * Create and return a queue of merges, and start feeding merges into it
+     * from tasks on the shared TaskPool. The writers on the queue will be
+     * known to it, so that the queue will know when all merges have been
+     * written.
+     *
+     * May only be called once.
+     *
+     * Returns a reference to the queue, which will live as long as this object
+     * does.
+     */
+    virtual ConcurrentQueue<MergeBatch>& run() override;
+    
+    /**
+     * Wait for all the merge-producing tasks to finish, and rethrow anything
+     * they threw. Obviously you shouldn't call this unless you've finished
+     * reading the queue from run and know no more merges will be generated.
+     */
+    virtual void join() override;
+    
+    /**
+     * Get the number of groups of rows that have been found to merge so far.
+     * Safe to call from any thread while the merge runs.
+     */
+    inline size_t getGroupsFound() const {
+        return groupsFound.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * How deep does an LCP interval have to be to merge its rows? Values below
+     * 1 are treated as 1. Must be set before run() is called.
+     */
+    size_t minContext = 1;
+    
+    /**
+     * How many tasks should be used to scan, at most? No more run at once
+     * than the shared TaskPool has workers.
+     */
+    size_t maxThreads = MAX_THREADS;
+
+protected:
+
+    // How many worker tasks should be started, maximum, by default?
+    static const size_t MAX_THREADS;
+    
+    // How many merges should a task collect before handing them off to the
+    // queue all at once?
+    static const size_t BATCH_SIZE;
+    
+    // How many BWT rows does a task scan at a time?
+    static const size_t CHUNK_ROWS;
+    
+    // Holds all the tasks that are generating merges, running on the shared
+    // TaskPool.
+    TaskGroup tasks;
+    
+    // Holds a pointer to a ConcurrentQueue, so we can create one and then
+    // destroy it only when we get destroyed.
+    ConcurrentQueue<MergeBatch>* queue;
+    
+    // Which chunk of rows should be scanned next?
+    std::atomic<size_t> nextChunk;
+    
+    // How many groups of rows have been merged?
+    std::atomic<size_t> groupsFound;
+    
+    /**
+     * Send the given batch of merges, if it has any, to the queue, and leave it
+     * empty.
+     */
+    void sendBatch(MergeBatch& batch) const;
+    
+    /**
+     * Return true if the BWT rows in [start, end) are all from different
+     * genomes.
+     */
+    bool isUniquePerGenome(size_t start, size_t end) const;
+    
+    /**
+     * Run as a task. Takes chunks of rows to scan until there are none left,
+     * and then closes the queue.
+     */
+    void generateMerges();
+    
+    /**
+     * Generate merges for all the groups of rows that start in [start, end).
+     */
+    void generateSomeMerges(size_t start, size_t end);
+
+};
+
+#endif
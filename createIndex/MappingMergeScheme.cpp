@@ -1,16 +1,29 @@
 #include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 
 #include <Log.hpp>
 #include <util.hpp>
+#include <NaturalMappingScheme.hpp>
+#include <ZipMappingScheme.hpp>
 
 #include "MappingMergeScheme.hpp"
+#include "RemoteMapping.hpp"
+#include "MergeCache.hpp"
+#include "GapFiller.hpp"
+#include "SpeculativeMerges.hpp"
 
 const size_t MappingMergeScheme::MAX_THREADS = 32;
+const size_t MappingMergeScheme::BATCH_SIZE = 4096;
 
 MappingMergeScheme::MappingMergeScheme(const FMDIndex& index,
     const MappingScheme* mappingScheme, size_t genome): MergeScheme(index),
-    index(index), genome(genome), mappingScheme(mappingScheme), threads(),
-    queue(NULL), contigsToMerge(NULL) {
+    index(index), genome(genome), mappingScheme(mappingScheme), tasks(),
+    queue(NULL), contigsToMerge(NULL), basesToMap(0), basesDone(0),
+    basesMapped(0) {
     
     // Nothing to do
     
@@ -18,7 +31,7 @@ MappingMergeScheme::MappingMergeScheme(const FMDIndex& index,
 
 MappingMergeScheme::~MappingMergeScheme() {
     
-    join(); // Join our threads
+    join(); // Wait for our tasks
 
     if(queue != NULL) {
         // Get rid of the queue if we made one.
@@ -34,7 +47,7 @@ MappingMergeScheme::~MappingMergeScheme() {
     
 }
 
-ConcurrentQueue<Merge>& MappingMergeScheme::run() {
+ConcurrentQueue<MergeBatch>& MappingMergeScheme::run() {
     
     if(queue != NULL) {
         // Don't let people call this twice.
@@ -42,31 +55,110 @@ ConcurrentQueue<Merge>& MappingMergeScheme::run() {
             "Called run() twice on a MappingMergeScheme.");
     }
     
-    // Grab the limits of the contig range belonging to this genome.
-    auto genomeContigs = index.getGenomeContigs(genome);
+    // Cut up all the contigs into windows, and group them, with how many bases
+    // each group has.
+    std::vector<std::pair<size_t, std::vector<ContigWindow>>> groups;
+    auto genomeScaffolds = index.getGenomeScaffolds(genome);
+    for(size_t scaffold = genomeScaffolds.first;
+        scaffold < genomeScaffolds.second; scaffold++) {
+        
+        // Short contigs on the scaffold share a group, up to about a window's
+        // worth of bases, or the whole scaffold if windows are unlimited.
+        std::pair<size_t, std::vector<ContigWindow>> group(0, {});
+        
+        auto scaffoldContigs = index.getScaffoldContigs(scaffold);
+        for(size_t contig = scaffoldContigs.first;
+            contig < scaffoldContigs.second; contig++) {
+            
+            size_t length = index.getContigLength(contig);
+            basesToMap += length;
+            
+            if(cache != nullptr && cache->isCached(contig)) {
+                // We already know what this contig merges with.
+                basesDone += length;
+                continue;
+            }
+            
+            std::vector<ContigWindow> windows = getContigWindows(contig);
+            bool split = windows.size() > 1;
+            
+            if(speculation != nullptr) {
+                // Windows whose merges were worked out ahead of time don't
+                // need mapping.
+                std::vector<ContigWindow> unknown;
+                for(const ContigWindow& window : windows) {
+                    if(speculation->isKept(window)) {
+                        basesDone += window.end - window.start;
+                    } else {
+                        unknown.push_back(window);
+                    }
+                }
+                windows = std::move(unknown);
+            }
+            
+            if(split) {
+                // Long contigs get a group per window.
+                for(const ContigWindow& window : windows) {
+                    groups.emplace_back(window.end - window.start,
+                        std::vector<ContigWindow>{window});
+                }
+                continue;
+            }
+            if(windows.empty()) {
+                continue;
+            }
+            
+            group.first += length;
+            group.second.push_back(windows.front());
+            if(windowLength != 0 && group.first >= windowLength) {
+                // This group is full.
+                groups.push_back(std::move(group));
+                group = std::make_pair(0, std::vector<ContigWindow>());
+            }
+        }
+        
+        if(!group.second.empty()) {
+            groups.push_back(std::move(group));
+        }
+    }
     
-    // Don't start more threads than we have contigs.
-    size_t numThreads = std::min(MAX_THREADS, genomeContigs.second - 
-        genomeContigs.first);
+    // Hand out the longest groups first, so the last ones to start are short
+    // and no thread is left mapping a big contig by itself at the end.
+    std::stable_sort(groups.begin(), groups.end(),
+        [](const std::pair<size_t, std::vector<ContigWindow>>& a,
+        const std::pair<size_t, std::vector<ContigWindow>>& b) {
+        
+        return a.first > b.first;
+    });
+    
+    // Don't start more threads than we have groups.
+    size_t numThreads = std::min(std::max(maxThreads, (size_t) 1),
+        groups.size());
     
-    Log::info() << "Running Mapping merge on " << numThreads << " threads" <<
+    Log::info() << "Running Mapping merge on " << numThreads << " tasks" <<
         std::endl;
     
-    // Make the queue of merges    
-    queue = new ConcurrentQueue<Merge>(numThreads);
+    if(!workers.empty()) {
+        Log::info() << "Also mapping on " << workers.size() <<
+            " worker processes" << std::endl;
+    }
+    
+    // Are we going to send cached merges too?
+    bool replaying = cache != nullptr && cache->getCachedContigs() > 0;
     
-    // And one for the contigs to merge
-    contigsToMerge = new ConcurrentQueue<size_t>(1);
+    // Make the queue of merges, written by each task and each worker, and by
+    // whatever sends the cached and speculative merges.
+    queue = makeQueue(numThreads + workers.size() +
+        (replaying || speculation != nullptr ? 1 : 0));
     
-    // Say we need to do every contig in this genome.
+    // And one for the contig windows to merge
+    contigsToMerge = new ConcurrentQueue<std::vector<ContigWindow>>(1);
     
-    for(size_t contig = genomeContigs.first; contig < genomeContigs.second; 
-        contig++) {
-      
-        // Put each contig in the genome into the queue of work to do.
-        // TODO: Can we just use an imaginary queue of numbers in a range?
+    // Say we need to do every window of every contig in this genome.
+    for(auto& group : groups) {
+        // Put each group into the queue of work to do.
         auto lock = contigsToMerge->lock();
-        contigsToMerge->enqueue(contig, lock);
+        contigsToMerge->enqueue(std::move(group.second), lock);
     }
     
     // Say we are done writing to the queue. Good thing it doesn't have a max
@@ -74,14 +166,51 @@ ConcurrentQueue<Merge>& MappingMergeScheme::run() {
     auto lock = contigsToMerge->lock();
     contigsToMerge->close(lock);
 
-    // Start up a reasonable number of threads to do the work.
+    // Start up a reasonable number of tasks on the shared pool to do the work.
+    // The window queue is already closed, so they never sit waiting on it.
     for(size_t threadID = 0; threadID < numThreads; threadID++) {
         // All the mapTypes can use the same method here, since there's lots of
         // work scheduling and setup logic in common.
-        
-        // Start up a thread.
-        threads.push_back(Thread(&MappingMergeScheme::generateMerges,
-            this, contigsToMerge));
+        tasks.run([this]() {
+            try {
+                generateMerges(contigsToMerge);
+            } catch(...) {
+                // Still say we're done writing, so whatever is applying the
+                // merges doesn't wait forever.
+                auto lock = queue->lock();
+                queue->close(lock);
+                throw;
+            }
+        });
+    }
+
+    if(replaying || speculation != nullptr) {
+        tasks.run([this, replaying]() {
+            try {
+                if(replaying) {
+                    cache->replay([this](MergeBatch& batch) {
+                        sendBatch(batch);
+                    });
+                }
+                if(speculation != nullptr) {
+                    speculation->replay([this](MergeBatch& batch) {
+                        sendBatch(batch);
+                    });
+                }
+            } catch(...) {
+                auto lock = queue->lock();
+                queue->close(lock);
+                throw;
+            }
+            auto lock = queue->lock();
+            queue->close(lock);
+        });
+    }
+    
+    for(auto& worker : workers) {
+        // Talk to each worker from a thread of its own.
+        workerThreads.push_back(Thread(
+            &MappingMergeScheme::generateRemoteMerges, this, worker));
     }
 
     // Return a reference to the queue of merges, for our caller to do something
@@ -90,18 +219,33 @@ ConcurrentQueue<Merge>& MappingMergeScheme::run() {
     
 }
 
+std::vector<MappingMergeScheme::ContigWindow>
+MappingMergeScheme::getContigWindows(size_t contig) const {
+    
+    // Split long contigs as evenly as we can.
+    size_t length = index.getContigLength(contig);
+    size_t pieces = windowLength == 0 ? 1 :
+        std::max((length + windowLength - 1) / windowLength, (size_t) 1);
+    
+    std::vector<ContigWindow> windows;
+    for(size_t i = 0; i < pieces; i++) {
+        windows.push_back(ContigWindow{contig, length * i / pieces,
+            length * (i + 1) / pieces});
+    }
+    return windows;
+}
+
 void MappingMergeScheme::join() {
 
-    for(auto i = threads.begin(); 
-        i != threads.end(); ++i) {
+    // Wait for all the tasks, helping out with them. Throws if any of them
+    // did.
+    tasks.join();
     
-        // Join each thread.
-        (*i).join();    
-        
+    for(Thread& thread : workerThreads) {
+        // And for everything the workers were doing.
+        thread.join();
     }
-    
-    // Probably not a good idea to join the same threads twice.
-    threads.clear();
+    workerThreads.clear();
     
     if(contigsToMerge != NULL) {
         auto lock = contigsToMerge->lock();
@@ -121,7 +265,8 @@ void MappingMergeScheme::join() {
 }
 
 void MappingMergeScheme::generateMerge(size_t queryContig, size_t queryBase, 
-    size_t referenceContig, size_t referenceBase, bool orientation) const {
+    size_t referenceContig, size_t referenceBase, bool orientation,
+    MergeBatch& batch, const std::function<void(MergeBatch&)>& send) const {
         
     // Where in the query do we want to come from? Always on the forward strand.
     // Correct offset to 0-based.
@@ -150,29 +295,66 @@ void MappingMergeScheme::generateMerge(size_t queryContig, size_t queryBase,
     
     } else {
     
-        Merge merge(queryPos, referencePos);
+        if(!batch.empty() && batch.back().isContinuedBy(queryPos,
+            referencePos)) {
             
-        // Send that merge to the queue.
-        // Lock the queue.
-        auto lock = queue->lock();
-        // Spend our lock to add something to it.
-        queue->enqueue(merge, lock);
+            // This base just continues the last run along its diagonal, so
+            // make that run one longer and pinch it all at once.
+            batch.back().length++;
+            return;
+        }
+        
+        if(batch.size() >= BATCH_SIZE) {
+            // Hand off the full batch before starting a new run.
+            send(batch);
+        }
+        
+        // Start a new run with just this base.
+        batch.push_back(Merge(queryPos, referencePos));
         
     }
     
 }
 
+void MappingMergeScheme::sendBatch(MergeBatch& batch) const {
+    if(batch.empty()) {
+        // Don't bother the queue or the applier.
+        return;
+    }
+    
+    if(cache != nullptr) {
+        // Remember it for next time.
+        cache->record(batch);
+    }
+    
+    // Lock the queue.
+    auto lock = queue->lock();
+    // Spend our lock to move the whole batch into it.
+    queue->enqueue(std::move(batch), lock);
+    
+    // Start again with nothing, since a moved-from vector could be anything.
+    batch.clear();
+    batch.reserve(BATCH_SIZE);
+}
+
 void MappingMergeScheme::generateMerges(
-    ConcurrentQueue<size_t>* contigs) const {
+    ConcurrentQueue<std::vector<ContigWindow>>* contigs) const {
+    
+    // Batches from here go right into the queue.
+    auto send = [this](MergeBatch& batch) {
+        sendBatch(batch);
+    };
     
-    // Wait for a contig, or for there to be no more.
+    // Wait for a group of contig windows, or for there to be no more.
     auto contigLock = contigs->waitForNonemptyOrEnd();
     
     while(!contigs->isEmpty(contigLock)) {
-        // We got a contig to do. Dequeue it and unlock.
-        size_t queryContig = contigs->dequeue(contigLock);
+        // We got some windows to do. Dequeue them and unlock.
+        std::vector<ContigWindow> windows = contigs->dequeue(contigLock);
         
-        generateSomeMerges(queryContig);
+        for(const ContigWindow& window : windows) {
+            generateSomeMerges(window, send);
+        }
         
         // Now wait for a new task, or for there to be no more contigs.
         contigLock = contigs->waitForNonemptyOrEnd();
@@ -190,36 +372,275 @@ void MappingMergeScheme::generateMerges(
     
 }
 
-void MappingMergeScheme::generateSomeMerges(size_t queryContig) const {
+void MappingMergeScheme::generateRemoteMerges(
+    std::shared_ptr<MappingConnection> worker) {
     
+    // Holds the groups sent to the worker that it hasn't finished, by ID.
+    std::map<uint64_t, std::vector<ContigWindow>> outstanding;
+    std::mutex outstandingMutex;
+    // Lets the sending thread wait for the worker to finish some groups.
+    std::condition_variable finished;
+    
+    // Keep one group more than the worker can map at once waiting there, so it
+    // doesn't sit idle while we send it another.
+    size_t maxOutstanding = worker->getSlots() + 1;
+    
+    std::unique_ptr<Thread> sender;
+    
+    try {
+        worker->sendLevel(genome, selfQuery, windowOverlap, levelFile);
+        
+        // Send groups from another thread, so this one can keep reading
+        // merges.
+        sender.reset(new Thread([&]() {
+            try {
+                for(uint64_t id = 0; ; id++) {
+                    std::unique_lock<std::mutex> lock(outstandingMutex);
+                    finished.wait(lock, [&]() {
+                        return outstanding.size() < maxOutstanding ||
+                            worker->isFailed();
+                    });
+                    if(worker->isFailed()) {
+                        return;
+                    }
+                    
+                    // The window queue is closed, so this never waits.
+                    auto contigLock = contigsToMerge->waitForNonemptyOrEnd();
+                    if(contigsToMerge->isEmpty(contigLock)) {
+                        break;
+                    }
+                    std::vector<ContigWindow> group = contigsToMerge->dequeue(
+                        contigLock);
+                    outstanding[id] = group;
+                    
+                    lock.unlock();
+                    worker->sendGroup(id, group);
+                }
+                worker->sendEnd();
+            } catch(std::runtime_error& e) {
+                // The reading side will notice and clean up.
+                worker->fail();
+            }
+        }));
+        
+        MappingConnection::Message message;
+        while(worker->receive(message) != MappingConnection::GENOME_DONE) {
+            if(message.type == MappingConnection::BATCH) {
+                sendBatch(message.batch);
+            } else if(message.type == MappingConnection::DONE) {
+                std::lock_guard<std::mutex> lock(outstandingMutex);
+                auto group = outstanding.find(message.id);
+                if(group == outstanding.end()) {
+                    throw std::runtime_error("Worker finished unknown group");
+                }
+                for(const ContigWindow& window : group->second) {
+                    basesDone += window.end - window.start;
+                }
+                basesMapped += message.mapped;
+                outstanding.erase(group);
+                finished.notify_one();
+            } else if(message.type == MappingConnection::CLOSED) {
+                throw std::runtime_error("Worker hung up");
+            } else {
+                throw std::runtime_error("Unexpected message from worker");
+            }
+        }
+        
+        sender->join();
+    } catch(std::runtime_error& e) {
+        Log::error() << "Lost mapping worker " << worker->getName() << ": " <<
+            e.what() << std::endl;
+        
+        // Make sure the sender stops too.
+        worker->fail();
+        {
+            std::lock_guard<std::mutex> lock(outstandingMutex);
+            finished.notify_one();
+        }
+        if(sender) {
+            sender->join();
+        }
+        
+        // Map whatever the worker didn't finish here instead. Merges it already
+        // sent for those groups get made again, which is harmless, since
+        // pinching things that are already pinched does nothing.
+        auto send = [this](MergeBatch& batch) {
+            sendBatch(batch);
+        };
+        for(auto& group : outstanding) {
+            for(const ContigWindow& window : group.second) {
+                generateSomeMerges(window, send);
+            }
+        }
+    }
+    
+    // Say this worker is done writing merges.
+    auto lock = queue->lock();
+    queue->close(lock);
+}
+
+size_t MappingMergeScheme::mapWindows(const std::vector<ContigWindow>& windows,
+    const std::function<void(MergeBatch&)>& send) const {
+    
+    size_t mapped = 0;
+    for(const ContigWindow& window : windows) {
+        mapped += generateSomeMerges(window, send);
+    }
+    return mapped;
+}
+
+size_t MappingMergeScheme::generateSomeMerges(const ContigWindow& window,
+    const std::function<void(MergeBatch&)>& send) const {
+    
+    size_t queryContig = window.contig;
     
     // Set our task name to something descriptive.
     std::string taskName = "T" + std::to_string(genome) + "." + 
-        std::to_string(queryContig);
+        std::to_string(queryContig) + ":" + std::to_string(window.start) + "-" +
+        std::to_string(window.end);
         
-    // Grab the contig as a string
-    std::string contig = index.displayContig(queryContig);
+    // Grab the window, with its flanking context, as a string.
+    size_t contextStart = window.start - std::min(window.start, windowOverlap);
+    size_t contextEnd = std::min(window.end + windowOverlap,
+        index.getContigLength(queryContig));
+    // Windows of a contig are handed out together, so they can share the
+    // extracted contig through the cache.
+    std::string contig = index.displayContigCached(queryContig)->substr(
+        contextStart, contextEnd - contextStart);
     
     // How many bases are we trying to mapping?
-    Log::info() << taskName << " mapping " << contig.size() << " bases." <<
-        std::endl;
+    Log::info() << taskName << " mapping " << window.end - window.start <<
+        " bases." << std::endl;
     
     // How many bases will we map?
     size_t mappedBases = 0;    
     
-    // Go make all the mappings
-    mappingScheme->map(contig, [&](size_t base, TextPosition mappedTo) {
+    // Collect the merges here, so the queue is only locked once per batch.
+    MergeBatch batch;
+    batch.reserve(BATCH_SIZE);
+    
+    // Holds every mapping, including those in the flanks, if we need to fill
+    // the gaps between them.
+    std::vector<std::pair<size_t, TextPosition>> anchors;
+    
+    // This is what we do with each base that mapped or was aligned
+    auto merge = [&](size_t base, TextPosition mappedTo) {
+        // Bases come in relative to the start of the flanking context.
+        base += contextStart;
+        
+        if(base < window.start || base >= window.end) {
+            // The flanks belong to other windows.
+            return;
+        }
+        
         // Count each mapping
         mappedBases++;
         
         // Make the actual merge. Remember that position arguments need to be
         // 1-based.
         generateMerge(queryContig, base + 1, mappedTo.getContigNumber(),
-            index.getContigOffset(mappedTo), mappedTo.getStrand());
-    });
+            index.getContigOffset(mappedTo), mappedTo.getStrand(), batch,
+            send);
+    };
+    
+    // This is what we do with each mapping
+    auto sink = [&](size_t base, TextPosition mappedTo) {
+        if(gapFiller != nullptr) {
+            anchors.emplace_back(base, mappedTo);
+        }
+        merge(base, mappedTo);
+    };
+    
+    // The contig is in the index, so if the index knows how long each base's
+    // shortest unique strings are, the schemes can use them. They are read
+    // only for the scheme that uses them.
+    const MinUniqueTable* uniqueTable = index.getMinUniqueTable();
+    std::vector<size_t> leftLengths;
+    std::vector<size_t> rightLengths;
+    auto getLengths = [&](bool left) {
+        if(left) {
+            leftLengths.resize(contig.size());
+            uniqueTable->getLeftLengths(queryContig, contextStart, contextEnd,
+                leftLengths.data());
+        }
+        rightLengths.resize(contig.size());
+        uniqueTable->getRightLengths(queryContig, contextStart, contextEnd,
+            rightLengths.data());
+    };
+    
+    // Go make all the mappings. If we know the concrete scheme, call its
+    // template map so the sink gets inlined instead of going through a
+    // std::function for every base.
+    if(auto zip = dynamic_cast<const ZipMappingScheme<FMDPositionGroup>*>(
+        mappingScheme)) {
+        
+        if(uniqueTable != NULL) {
+            getLengths(true);
+            zip->map(contig, sink, leftLengths.data(), rightLengths.data());
+        } else {
+            zip->map(contig, sink);
+        }
+    } else if(auto zip = dynamic_cast<const ZipMappingScheme<FMDPosition>*>(
+        mappingScheme)) {
+        
+        if(uniqueTable != NULL) {
+            getLengths(true);
+            zip->map(contig, sink, leftLengths.data(), rightLengths.data());
+        } else {
+            zip->map(contig, sink);
+        }
+    } else if(auto natural = dynamic_cast<const NaturalMappingScheme*>(
+        mappingScheme)) {
+        
+        if(selfQuery) {
+            // The window is in the index, so find its bases' own rows and
+            // start the searches from them.
+            std::vector<int64_t> rows(contig.size());
+            index.getContigRows(queryContig, contextStart, contextEnd,
+                rows.data());
+            if(uniqueTable != NULL) {
+                getLengths(false);
+            }
+            natural->map(contig, sink, rows.data(),
+                uniqueTable != NULL ? rightLengths.data() : nullptr);
+        } else if(uniqueTable != NULL) {
+            getLengths(false);
+            natural->map(contig, sink, nullptr, rightLengths.data());
+        } else {
+            natural->map(contig, sink);
+        }
+    } else {
+        mappingScheme->map(contig, sink);
+    }
+    
+    if(gapFiller != nullptr) {
+        // Merge what can be aligned between the mappings too. They may not
+        // have come in order.
+        std::sort(anchors.begin(), anchors.end(),
+            [](const std::pair<size_t, TextPosition>& a,
+            const std::pair<size_t, TextPosition>& b) {
+            
+            return a.first < b.first;
+        });
+        size_t mappedBefore = mappedBases;
+        gapFiller->fill(contig, anchors, merge);
+        Log::debug() << taskName << " filled " << mappedBases - mappedBefore <<
+            " bases in gaps." << std::endl;
+    }
+    
+    // Send off whatever is left over from the window.
+    if(!batch.empty()) {
+        send(batch);
+    }
+    
+    // Count the window as done, for anyone watching.
+    basesMapped += mappedBases;
+    basesDone += window.end - window.start;
     
     Log::info() << taskName << " mapped " << mappedBases << "/" << 
-        contig.size() << " bases." << std::endl;
+        window.end - window.start << " bases." << std::endl;
+    
+    return mappedBases;
 }
 
 
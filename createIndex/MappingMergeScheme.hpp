@@ -1,13 +1,23 @@
 #ifndef MAPPINGMERGESCHEME_HPP
 #define MAPPINGMERGESCHEME_HPP
 
-#include "Thread.hpp"
 #include <vector>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string>
 
 #include "MergeScheme.hpp"
 #include <GenericBitVector.hpp>
 #include <MappingScheme.hpp>
+#include <TaskPool.hpp>
+
+#include "Thread.hpp"
 
+class MappingConnection;
+class MergeCache;
+class SpeculativeMerges;
+class GapFiller;
 
 /**
  * Represents the "Mapping Merging Scheme", a component of the greedy merging
@@ -18,43 +28,182 @@ class MappingMergeScheme: public MergeScheme {
    
 public:
     
+    /**
+     * Represents a range of bases on a contig to be mapped as one piece of
+     * work.
+     */
+    struct ContigWindow {
+        // Which contig is it on?
+        size_t contig;
+        // Where does it start, 0-based?
+        size_t start;
+        // Where does it end (exclusive)?
+        size_t end;
+    };
+
     /**
      * Make a new MappingMergeScheme, which maps the given genome from the given
-     * index using the given mapping scheme.
+     * index using the given mapping scheme. The mapping scheme must map to a
+     * view of the same index. If the index has a MinUniqueTable, the natural
+     * and zip mapping schemes use it to cut short their searches for the
+     * shortest unique contexts.
      */
     MappingMergeScheme(const FMDIndex& index,
         const MappingScheme* mappingScheme, size_t genome);
     
     /**
      * Get rid of a MappingMergeScheme (and delete its queue, if it has one).
-     * If threads are running, blocks until they finish.
+     * If tasks are running, blocks until they finish.
      */
     virtual ~MappingMergeScheme();
     
     /**
      * Create and return a queue of merges, and start feeding merges into it
-     * from some other thread(s). The writers on the queue will be known to it,
-     * so that the queue will know when all merges have been written.
+     * from tasks on the shared TaskPool. The writers on the queue will be
+     * known to it, so that the queue will know when all merges have been
+     * written.
      *
      * May only be called once.
      * 
      * Returns a reference to the queue, which will live as long as this object
      * does.
      */
-    virtual ConcurrentQueue<Merge>& run() override;
+    virtual ConcurrentQueue<MergeBatch>& run() override;
     
     /**
-     * Wait for all the merge-producing threads to finish. Obviously you
+     * Wait for all the merge-producing tasks to finish, and rethrow anything
+     * they threw. Obviously you
      * shouldn't call this unless you've finished reading the queue from run and
      * know no more merges will be generated.
      */
     virtual void join() override;
     
+    /**
+     * Get the number of query bases in the genome being mapped. Known once
+     * run() has been called.
+     */
+    inline size_t getBasesToMap() const {
+        return basesToMap.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of query bases in windows that have finished mapping so
+     * far. Safe to call from any thread while the merge runs.
+     */
+    inline size_t getBasesDone() const {
+        return basesDone.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of query bases that mapped, in windows that have
+     * finished so far. Safe to call from any thread while the merge runs.
+     */
+    inline size_t getBasesMapped() const {
+        return basesMapped.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of the genome being mapped.
+     */
+    inline size_t getGenome() const {
+        return genome;
+    }
+    
+    /**
+     * Cut the given contig into the windows it is mapped in, in order along
+     * it, according to windowLength.
+     */
+    std::vector<ContigWindow> getContigWindows(size_t contig) const;
+    
+    /**
+     * If nonzero, contigs longer than this are split into about this long
+     * windows, which are mapped independently so that long contigs can be
+     * spread across threads. Each window is mapped with windowOverlap bases of
+     * flanking context on each side, but mappings that depend on context
+     * farther away than that may come out differently than they would have
+     * when mapping the whole contig. Must be set before run() is called.
+     */
+    size_t windowLength = 0;
+    
+    /**
+     * How many bases of flanking context should each window be mapped with?
+     */
+    size_t windowOverlap = 10000;
+    
+    /**
+     * How many tasks should be used to map, at most? No more tasks are
+     * started than there are windows to map, and no more run at once than the
+     * shared TaskPool has workers.
+     */
+    size_t maxThreads = MAX_THREADS;
+    
+    /**
+     * Should contigs be mapped from their own BWT rows, since they are in the
+     * index already? Then the natural mapping scheme finds each base's
+     * contexts by retracting the base's row up the LCP array, instead of by
+     * backward search. The rows are found by LF-mapping back along each
+     * window, from an inverse suffix array sample if the index has them, and
+     * from the end of the contig otherwise. Other mapping schemes search as
+     * usual. Must be set before run() is called.
+     */
+    bool selfQuery = false;
+    
+    /**
+     * Worker processes to hand contig windows out to alongside the local
+     * tasks. Each is sent levelFile, a saved level index of the view being
+     * mapped to, and then groups of windows to map, and sends back merges. If
+     * a worker is lost, the groups it hadn't finished are mapped here instead.
+     * Must be set before run() is called.
+     */
+    std::vector<std::shared_ptr<MappingConnection>> workers;
+    
+    /**
+     * Where is the level index to send to workers?
+     */
+    std::string levelFile;
+    
+    /**
+     * If set, contigs with merges cached against the view being mapped to
+     * aren't mapped, and their cached merges are sent instead. Everything
+     * that goes in the queue is recorded in the cache. The cache must already
+     * be started on the genome. Must be set before run() is called.
+     */
+    MergeCache* cache = nullptr;
+    
+    /**
+     * If set, windows with merges kept by the speculation aren't mapped, and
+     * their merges are sent instead. The speculation must have mapped this
+     * genome with the same windows, and been validated against the view being
+     * mapped to. Cached contigs are still taken from the cache. Must be set
+     * before run() is called.
+     */
+    const SpeculativeMerges* speculation = nullptr;
+    
+    /**
+     * If set, short gaps between bases that mapped consistently are aligned by
+     * the gap filler, and query bases it aligns to matching reference bases
+     * are merged as if they had mapped. Must be set before run() is called.
+     */
+    const GapFiller* gapFiller = nullptr;
+    
+    /**
+     * Map the given windows on the calling thread, handing each batch of merges
+     * to the given function, which must leave the batch empty, instead of to
+     * the queue. Returns the number of bases that mapped. Lets a worker process
+     * map windows for a MappingMergeScheme running on another machine.
+     */
+    size_t mapWindows(const std::vector<ContigWindow>& windows,
+        const std::function<void(MergeBatch&)>& send) const;
+    
 protected:
 
     // How many worker threads should be started, maximum, to produce merges
-    // from contigs? TODO: Magically know a good answer for all systems.
+    // from contigs, by default?
     static const size_t MAX_THREADS;
+    
+    // How many runs of merged bases should a thread collect before handing them
+    // off to the queue all at once?
+    static const size_t BATCH_SIZE;
 
     // Keep the index so we can pull the contigs from it.
     const FMDIndex& index;
@@ -62,40 +211,77 @@ protected:
     // Holds the number of the genome we are going to map.
     size_t genome;
     
-    // Holds a ConcurrentQueue of all the contig IDs that need to be processed.
-    // We fill this up with contig IDs, and our merge threads read from it, so
-    // we can pool them instead of spawning about a thousand of them. It will
-    // have one writer, which is done pretty much as soon as the queue starts
-    // getting used.
-    ConcurrentQueue<size_t>* contigsToMerge;
+    // Holds a ConcurrentQueue of all the groups of contig windows that need to
+    // be processed, longest first. Each group is a single window of a long
+    // contig, or short contigs from the same scaffold, so draft assemblies
+    // with many N gaps don't need a queue entry per contig. We fill this up
+    // with groups, and our merge threads read from it, so we can pool them
+    // instead of spawning about a thousand of them. It will have one writer,
+    // which is done pretty much as soon as the queue starts getting used.
+    ConcurrentQueue<std::vector<ContigWindow>>* contigsToMerge;
 
-    // Holds all the threads that are generating merges.
-    std::vector<Thread> threads;
+    // Holds all the tasks that are generating merges, running on the shared
+    // TaskPool.
+    TaskGroup tasks;
+    
+    // Holds the threads talking to worker processes, which spend most of their
+    // time waiting on the network and so don't belong on the pool.
+    std::vector<Thread> workerThreads;
     
     // Holds a pointer to a ConcurrentQueue, so we can create one and then
     // destroy it only when we get destroyed.
-    ConcurrentQueue<Merge>* queue;
+    ConcurrentQueue<MergeBatch>* queue;
     
     // Holds the mapping scheme we will use to map.
     const MappingScheme* mappingScheme;
+    
+    // How many bases are in all the windows to map?
+    std::atomic<size_t> basesToMap;
+    
+    // How many bases are in the windows that are done? Updated by the mapping
+    // threads as each window finishes.
+    mutable std::atomic<size_t> basesDone;
+    
+    // How many of those bases mapped?
+    mutable std::atomic<size_t> basesMapped;
 
     /**
-     * Create a Merge between two positions and enqueue it. Positions are
-     * 1-based.
+     * Merge two positions by adding them to the given batch, either by
+     * extending the batch's last Merge if they continue its run, or by starting
+     * a new Merge and sending the batch off with the given function first if it
+     * is full. Positions are 1-based.
      */
     void generateMerge(size_t queryContig, size_t queryBase, 
-        size_t referenceContig, size_t referenceBase, bool orientation) const;
+        size_t referenceContig, size_t referenceBase, bool orientation,
+        MergeBatch& batch, const std::function<void(MergeBatch&)>& send) const;
+    
+    /**
+     * Send the given batch of merges, if it has any, to the queue, and leave it
+     * empty.
+     */
+    void sendBatch(MergeBatch& batch) const;
     
     /**
      * Run as a thread. Generates merges by mapping a query contig to the target
      * genome; left-right contexts
      */
-    virtual void generateMerges(ConcurrentQueue<size_t>* contigs) const;
+    virtual void generateMerges(
+        ConcurrentQueue<std::vector<ContigWindow>>* contigs) const;
+    
+    /**
+     * Generate left-right merges from one particular window of a contig,
+     * sending batches of them off with the given function. Returns the number
+     * of bases that mapped.
+     */
+    virtual size_t generateSomeMerges(const ContigWindow& window,
+        const std::function<void(MergeBatch&)>& send) const;
     
     /**
-     * Generate left-right merges from one particular contig.
+     * Run as a thread. Hands groups of contig windows out to the given worker
+     * process and puts the merges it sends back in the queue, until there are
+     * no more groups.
      */
-    virtual void generateSomeMerges(size_t queryContig) const;
+    void generateRemoteMerges(std::shared_ptr<MappingConnection> worker);
 
 };
 
@@ -1,13 +1,74 @@
 #ifndef MERGE_HPP
 #define MERGE_HPP
 
-#include <utility>
+#include <vector>
+#include <iosfwd>
 
 #include <TextPosition.hpp>
 
 /**
- * Type to represent a merge between two bases in a reference structure.
+ * Type to represent a merge between two runs of bases in a reference
+ * structure. The run starting at first is merged base for base with the run of
+ * the same length starting at second, with both runs going forward along their
+ * texts. A merge of a single base has a length of 1.
  */
-typedef std::pair<TextPosition, TextPosition> Merge;
+struct Merge {
+    /**
+     * Make a new Merge between the given number of bases starting at each of
+     * the two given positions.
+     */
+    inline Merge(const TextPosition& first, const TextPosition& second,
+        size_t length = 1): first(first), second(second), length(length) {
+    }
+
+    /**
+     * Return true if merging the two given positions would just continue this
+     * merge by one more base, along the same diagonal.
+     */
+    inline bool isContinuedBy(const TextPosition& nextFirst,
+        const TextPosition& nextSecond) const {
+
+        return nextFirst.getText() == first.getText() &&
+            nextFirst.getOffset() == first.getOffset() + length &&
+            nextSecond.getText() == second.getText() &&
+            nextSecond.getOffset() == second.getOffset() + length;
+    }
+
+    // Where does the first run start?
+    TextPosition first;
+    // Where does the second run start?
+    TextPosition second;
+    // How many bases are in each run?
+    size_t length;
+};
+
+/**
+ * A Merge counts for all the bases it merges when it passes through a
+ * ConcurrentQueue.
+ */
+inline size_t countQueueItems(const Merge& merge) {
+    return merge.length;
+}
+
+/**
+ * Type to represent a batch of merges that are handed off between threads all
+ * at once, so that the queue carrying them is locked once per batch instead of
+ * once per base.
+ */
+typedef std::vector<Merge> MergeBatch;
+
+/**
+ * Write a batch of merges to a stream, in the format used by MergeRecorder, so
+ * a ConcurrentQueue of batches can spill them to disk.
+ */
+void spillQueueEntry(std::ostream& out, const MergeBatch& batch);
+
+/**
+ * Read back a batch of merges written by spillQueueEntry(), replacing the
+ * given batch. Leaves the stream failed if the batch isn't all there, or says
+ * it has more than the given number of merges.
+ */
+void unspillQueueEntry(std::istream& in, MergeBatch& batch,
+    uint64_t maxCount = (uint64_t) -1);
 
 #endif
@@ -1,12 +1,27 @@
 #include <iostream>
+#include <unordered_set>
+#include <set>
+#include <algorithm>
+#include <chrono>
 
 #include <Log.hpp>
 
 #include "MergeApplier.hpp"
+#include "unixUtil.hpp"
 
 MergeApplier::MergeApplier(const FMDIndex& index,
-    ConcurrentQueue<Merge>& source, stPinchThreadSet* target): index(index), 
-    source(source), target(target), thread(&MergeApplier::run, this) {
+    ConcurrentQueue<MergeBatch>& source, stPinchThreadSet* target,
+    std::mutex* graphLock, size_t sortWindow, size_t compactThreshold,
+    MergeRecorder* recorder, size_t applyThreads): index(index),
+    source(source), target(target), threads(getThreadsByName(target)),
+    graphLock(graphLock), sortWindow(sortWindow),
+    compactThreshold(compactThreshold), recorder(recorder),
+    applyThreads(std::max(applyThreads, (size_t) 1)), components(),
+    joiningPinches(0), pinched(),
+    pinchCount(0), pinchedBases(0), pinchSeconds(0), uncompacted(),
+    compactions(0), compactSeconds(0), stats(),
+    mergeApplicationPhase(stats.phase("mergeApplication")),
+    thread(&MergeApplier::run, this) {
     
     // Already started running. See <http://stackoverflow.com/a/10673671/402891>
     
@@ -16,9 +31,70 @@ void MergeApplier::join() {
     thread.join();
 }
 
+bool MergeApplier::pin(size_t cpu) {
+    return pinThread(thread, cpu);
+}
+
+std::vector<size_t> MergeApplier::getAffectedContigs() const {
+    // Collect the contigs here.
+    std::set<size_t> contigs;
+    
+    // Don't go through any block more than once.
+    std::unordered_set<stPinchBlock*> seen;
+    
+    for(const PinchedRange& range : pinched) {
+        // Start a segment before the range and go to a segment past it, since
+        // the range's ends may have split blocks there too.
+        stPinchSegment* segment = stPinchThread_getSegment(
+            threads[range.contig], range.start);
+        if(segment != NULL && stPinchSegment_get5Prime(segment) != NULL) {
+            segment = stPinchSegment_get5Prime(segment);
+        }
+        
+        while(segment != NULL) {
+            stPinchBlock* block = stPinchSegment_getBlock(segment);
+            
+            if(block == NULL) {
+                // The segment is by itself.
+                contigs.insert(stPinchSegment_getName(segment));
+            } else if(!seen.count(block)) {
+                // Take the contigs of everything in the block.
+                seen.insert(block);
+                
+                stPinchBlockIt iterator = stPinchBlock_getSegmentIterator(
+                    block);
+                stPinchSegment* other;
+                while((other = stPinchBlockIt_getNext(&iterator)) != NULL) {
+                    contigs.insert(stPinchSegment_getName(other));
+                }
+            }
+            
+            if(stPinchSegment_getStart(segment) >=
+                (int64_t) (range.start + range.length)) {
+                
+                // This was the segment past the range.
+                break;
+            }
+            
+            segment = stPinchSegment_get3Prime(segment);
+        }
+    }
+    
+    return std::vector<size_t>(contigs.begin(), contigs.end());
+}
+
 void MergeApplier::run() {
     // OK, do the actual merging.
     
+    if(applyThreads > 1) {
+        // Work out what can be pinched at the same time. Nobody can be pinching
+        // our part of the graph yet.
+        findComponents();
+    }
+    
+    // If we're sorting, collect merges here until we have enough.
+    MergeBatch window;
+    
     while(true) {
         // Lock the queue when either there's something in it or all its writers
         // have closed it. If neither happens we just wait here forever.
@@ -30,54 +106,269 @@ void MergeApplier::run() {
             // Unlock the queue, even though nobody will use it again.
             lock.unlock();
             
-            return;
+            break;
         }
         
-        // If we get here, there's actual work to do. Trade our lock for a value
-        // to work on.
-        Merge merge = source.dequeue(lock);
-        
-        // Now actually apply the merge.
+        // If we get here, there's actual work to do. Trade our lock for a batch
+        // of merges to work on.
+        MergeBatch batch = source.dequeue(lock);
         
-        // Unpack the first TextPosition to be merged
-        size_t firstContigNumber = index.getContigNumber(merge.first);
-        size_t firstStrand = index.getStrand(merge.first);
-        size_t firstOffset = index.getContigOffset(merge.first);
-        
-        // And the second
-        size_t secondContigNumber = index.getContigNumber(merge.second);
-        size_t secondStrand = index.getStrand(merge.second);
-        size_t secondOffset = index.getContigOffset(merge.second);
+        if(sortWindow == 0) {
+            // Apply the merges as they come.
+            applyMerges(batch);
+            continue;
+        }
         
-        // What orientation should we use for the second strand, given that we
-        // are pinching against the first strand in orientation 1 (reverse)?
-        bool orientation = firstStrand == secondStrand;
+        window.insert(window.end(), batch.begin(), batch.end());
         
-        // Grab the first pinch thread
-        stPinchThread* firstThread = stPinchThreadSet_getThread(target,
-            firstContigNumber);
-            
-        // And the second
-        stPinchThread* secondThread = stPinchThreadSet_getThread(target,
-            secondContigNumber);
+        if(window.size() >= sortWindow) {
+            // We have enough to sort together.
+            applyMerges(window);
+            window.clear();
+        }
+    }
+    
+    // Apply whatever is left.
+    applyMerges(window);
+    
+    Log::output() << "Applied " << getPinchCount() << " pinches of " <<
+        getPinchedBases() << " bases in " << pinchSeconds << " seconds (" <<
+        (pinchSeconds > 0 ? getPinchCount() / pinchSeconds : 0) <<
+        " pinches/second)" << std::endl;
+    
+    if(compactions > 0) {
+        Log::output() << "Compacted pinched threads " << compactions <<
+            " times in " << compactSeconds << " seconds" << std::endl;
+    }
+    
+    if(applyThreads > 1) {
+        Log::output() << joiningPinches << " pinches joined components and "
+            "were made alone" << std::endl;
+    }
+}
+
+void MergeApplier::applyMerges(MergeBatch& merges) {
+    if(merges.empty()) {
+        return;
+    }
+    
+    if(sortWindow != 0) {
+        // Go in order along the pinch threads, so each pinch starts looking
+        // near where the last one left off.
+        std::sort(merges.begin(), merges.end(),
+            [](const Merge& a, const Merge& b) {
             
-        // Log the pinch if applicable.
-        Log::trace() << "\tPinching #" << firstContigNumber << ":" <<
-            firstOffset << " strand " << firstStrand << " and #" << 
-            secondContigNumber << ":" << secondOffset << " strand " << 
-            secondStrand << " (orientation: " << orientation << ")" <<
-            std::endl;
-        
-        // Perform the pinch
-        stPinchThread_pinch(firstThread, secondThread, firstOffset,
-            secondOffset, 1, orientation);
-        
+            return a.first < b.first;
+        });
+    }
+    
+    if(recorder != nullptr) {
+        // Save exactly what we are about to do.
+        recorder->write(merges);
+    }
+    
+    // Hold the graph while we change it, if anyone else might.
+    std::unique_lock<std::mutex> graphHold;
+    if(graphLock != nullptr) {
+        graphHold = std::unique_lock<std::mutex>(*graphLock);
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    StatTracker::ScopedPhase counting(mergeApplicationPhase);
+    
+    if(applyThreads > 1) {
+        // Pinch separate parts of the graph at once.
+        applyMergesSharded(merges);
+    } else {
+        for(const Merge& merge : merges) {
+            // Now actually apply each merge, with one pinch per run of bases.
+            applyMerge(merge, pinched, uncompacted);
+        }
+    }
+    
+    pinchSeconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    if(compactThreshold != 0 && uncompacted.size() / 2 >= compactThreshold) {
+        // We've made enough pinches that it's worth cleaning up after them,
+        // while we still have the graph.
+        compact();
+    }
+}
+
+void MergeApplier::compact() {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Do each thread only once.
+    std::sort(uncompacted.begin(), uncompacted.end());
+    uncompacted.erase(std::unique(uncompacted.begin(), uncompacted.end()),
+        uncompacted.end());
+    
+    for(size_t contig : uncompacted) {
+        // Join up whatever the pinches left trivial on this thread. Anything
+        // not on a pinched thread can't have changed.
+        stPinchThread_joinTrivialBoundaries(threads[contig]);
+    }
+    
+    LOG_DEBUG("Compacted " << uncompacted.size() << " threads" <<
+        std::endl);
+    
+    uncompacted.clear();
+    compactions++;
+    compactSeconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void MergeApplier::applyMergesSharded(const MergeBatch& merges) {
+    // Deal the merges within each component out to one lane, so no two lanes
+    // ever touch the same component, and keep the ones between components for
+    // last, in order.
+    std::vector<std::vector<const Merge*>> lanes(applyThreads);
+    std::vector<const Merge*> joining;
+    for(const Merge& merge : merges) {
+        size_t component = getComponent(index.getContigNumber(merge.first));
+        if(component == getComponent(index.getContigNumber(merge.second))) {
+            lanes[component % applyThreads].push_back(&merge);
+        } else {
+            joining.push_back(&merge);
+        }
+    }
+    
+    // Each lane remembers what it pinched separately.
+    std::vector<std::vector<PinchedRange>> lanePinched(applyThreads);
+    std::vector<std::vector<size_t>> laneUncompacted(applyThreads);
+    
+    auto applyLane = [&](size_t lane) {
+        for(const Merge* merge : lanes[lane]) {
+            applyMerge(*merge, lanePinched[lane], laneUncompacted[lane]);
+        }
+    };
+    
+    size_t busyLanes = std::count_if(lanes.begin(), lanes.end(),
+        [](const std::vector<const Merge*>& lane) {
         
+        return !lane.empty();
+    });
+    if(busyLanes > 1) {
+        // Pinch in all the lanes at once. They get threads of their own, since
+        // waiting on the shared TaskPool could have us run a whole mapping
+        // task while the merges pile up.
+        runThreads(applyThreads, applyLane);
+    } else {
+        // Everything is in one component, so starting threads won't help.
+        for(size_t lane = 0; lane < applyThreads; lane++) {
+            applyLane(lane);
+        }
+    }
+    
+    for(size_t lane = 0; lane < applyThreads; lane++) {
+        pinched.insert(pinched.end(), lanePinched[lane].begin(),
+            lanePinched[lane].end());
+        uncompacted.insert(uncompacted.end(), laneUncompacted[lane].begin(),
+            laneUncompacted[lane].end());
+    }
+    
+    for(const Merge* merge : joining) {
+        // Pinch the components together, and then count them as one.
+        applyMerge(*merge, pinched, uncompacted);
+        components[getComponent(index.getContigNumber(merge->second))] =
+            getComponent(index.getContigNumber(merge->first));
+    }
+    joiningPinches += joining.size();
+}
+
+void MergeApplier::findComponents() {
+    // Start with every contig by itself.
+    components.resize(threads.size());
+    for(size_t contig = 0; contig < components.size(); contig++) {
+        components[contig] = contig;
+    }
+    
+    for(stPinchThread* thread : threads) {
+        if(thread == NULL) {
+            continue;
+        }
         
+        stPinchSegment* segment = stPinchThread_getFirst(thread);
+        while(segment != NULL) {
+            stPinchBlock* block = stPinchSegment_getBlock(segment);
+            if(block != NULL) {
+                // Put this contig in with the block's first segment's contig.
+                components[getComponent(stPinchSegment_getName(segment))] =
+                    getComponent(stPinchSegment_getName(
+                    stPinchBlock_getFirst(block)));
+            }
+            segment = stPinchSegment_get3Prime(segment);
+        }
+    }
+}
+
+size_t MergeApplier::getComponent(size_t contig) {
+    while(components[contig] != contig) {
+        // Skip every other step on the way up, to keep the paths short.
+        components[contig] = components[components[contig]];
+        contig = components[contig];
+    }
+    return contig;
+}
+
+void MergeApplier::applyMerge(const Merge& merge,
+    std::vector<PinchedRange>& pinched, std::vector<size_t>& uncompacted) {
+    
+    // Unpack the first TextPosition to be merged
+    size_t firstContigNumber = index.getContigNumber(merge.first);
+    size_t firstStrand = index.getStrand(merge.first);
+    size_t firstOffset = index.getContigOffset(merge.first);
+    
+    // And the second
+    size_t secondContigNumber = index.getContigNumber(merge.second);
+    size_t secondStrand = index.getStrand(merge.second);
+    size_t secondOffset = index.getContigOffset(merge.second);
+    
+    // The pinch is given by where each run starts on the forward strand of its
+    // contig. A run going forward along a reverse strand text goes backward
+    // along the contig, so it starts where its last base is.
+    if(firstStrand) {
+        firstOffset -= merge.length - 1;
+    }
+    if(secondStrand) {
+        secondOffset -= merge.length - 1;
+    }
+    
+    // What orientation should we use for the second strand, given that we are
+    // pinching against the first strand in orientation 1 (reverse)?
+    bool orientation = firstStrand == secondStrand;
+    
+    // Grab the first pinch thread
+    stPinchThread* firstThread = threads[firstContigNumber];
         
+    // And the second
+    stPinchThread* secondThread = threads[secondContigNumber];
         
+    // Log the pinch if applicable.
+    LOG_TRACE("\tPinching " << merge.length << " bases at #" <<
+        firstContigNumber << ":" << firstOffset << " strand " << firstStrand <<
+        " and #" << secondContigNumber << ":" << secondOffset << " strand " <<
+        secondStrand << " (orientation: " << orientation << ")" << std::endl);
+    
+    // Remember what got pinched.
+    pinched.push_back(PinchedRange{firstContigNumber, firstOffset,
+        merge.length});
+    pinched.push_back(PinchedRange{secondContigNumber, secondOffset,
+        merge.length});
+    
+    if(compactThreshold != 0) {
+        // Remember to compact both threads later.
+        uncompacted.push_back(firstContigNumber);
+        uncompacted.push_back(secondContigNumber);
     }
     
+    // Perform the pinch for the whole run. If the orientation is reverse, the
+    // pinch pairs the first run's left end with the second run's right end,
+    // which is what we want.
+    stPinchThread_pinch(firstThread, secondThread, firstOffset, secondOffset,
+        merge.length, orientation);
+    
+    pinchCount.fetch_add(1, std::memory_order_relaxed);
+    pinchedBases.fetch_add(merge.length, std::memory_order_relaxed);
 }
-
-
@@ -1,17 +1,24 @@
 #ifndef MERGEAPPLIER_HPP
 #define MERGEAPPLIER_HPP
 
+#include <vector>
+#include <mutex>
+#include <atomic>
+
 #include <stPinchGraphs.h>
 
 #include <FMDIndex.hpp>
+#include <StatTracker.hpp>
 
 #include "ConcurrentQueue.hpp"
 #include "Merge.hpp"
+#include "MergeRecording.hpp"
 #include "Thread.hpp"
+#include "pinchGraphUtil.hpp"
 
 /**
- * A class which reads in from a ConcurrentQueue of Merges and applies them all
- * to an stPinchGraph.
+ * A class which reads in from a ConcurrentQueue of batches of Merges and
+ * applies them all to an stPinchGraph.
  */
 class MergeApplier {
 
@@ -20,26 +27,160 @@ public:
      * Make a new MergeApplier to, using the given index, apply merges from the
      * given queue to the given pinch graph. Automatically starts running. The
      * ConcurrentQueue must have been initialized with some number of writers.
+     *
+     * If a mutex is given, it is held while each batch of merges is applied,
+     * so that several MergeAppliers can share the same pinch graph.
+     *
+     * If sortWindow is nonzero, merges are collected until at least that many
+     * are waiting (or no more are coming), and then applied in order along the
+     * pinch threads, so that consecutive pinches touch nearby parts of the
+     * graph.
+     *
+     * If compactThreshold is nonzero, trivial boundaries are joined on the
+     * threads that were pinched every time at least that many pinches have
+     * been made since the last time, so the graph doesn't fill up with tiny
+     * segments that the next whole-graph join would get rid of anyway.
+     *
+     * If a MergeRecorder is given, each group of merges is recorded to it, in
+     * the order applied, just before it is applied. Replaying the recording
+     * with no sorting and the same compactThreshold makes the same graph.
+     *
+     * If applyThreads is more than 1, each group of merges is split up by the
+     * connected components of the pinch graph they fall in, and merges within
+     * different components are pinched on that many threads at once, since
+     * they can't touch the same segments or blocks.
+     * Merges that join two components are then pinched one at a time. The
+     * same pinches are made, so the same graph results, but not in the order
+     * recorded.
      */
-    MergeApplier(const FMDIndex& index, ConcurrentQueue<Merge>& source,
-        stPinchThreadSet* target);
+    MergeApplier(const FMDIndex& index, ConcurrentQueue<MergeBatch>& source,
+        stPinchThreadSet* target, std::mutex* graphLock = nullptr,
+        size_t sortWindow = 0, size_t compactThreshold = 0,
+        MergeRecorder* recorder = nullptr, size_t applyThreads = 1);
     
     /**
      * Wait for the merge applier to finish its work.
      */
     void join();
     
+    /**
+     * Pin the thread applying the merges to the given CPU. Returns true if it
+     * worked, and false otherwise.
+     */
+    bool pin(size_t cpu);
+    
+    /**
+     * Get the contigs, in order, with bases whose canonical positions may have
+     * changed because of the merges that were applied: the contigs with
+     * segments in every block that was pinched, or next to one that was. Must
+     * be called after join(), and looks at the graph as it is now. Since the
+     * blocks next to pinched ones are included, it can be called either before
+     * or after trivial boundaries are joined. Does not take the graph lock.
+     */
+    std::vector<size_t> getAffectedContigs() const;
+    
+    /**
+     * Get the stats collected while applying merges. Must be called after
+     * join().
+     */
+    inline const StatTracker& getStats() const {
+        return stats;
+    }
+    
+    /**
+     * Get the number of pinches made so far. Safe to call from any thread
+     * while merges are being applied.
+     */
+    inline size_t getPinchCount() const {
+        return pinchCount.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of bases pinched so far. Safe to call from any thread
+     * while merges are being applied.
+     */
+    inline size_t getPinchedBases() const {
+        return pinchedBases.load(std::memory_order_relaxed);
+    }
+    
 protected:
+    /**
+     * Represents a range of bases on a contig that was pinched.
+     */
+    struct PinchedRange {
+        // Which contig was pinched?
+        size_t contig;
+        // Where does the range start, 1-based?
+        size_t start;
+        // How many bases long is it?
+        size_t length;
+    };
+
     // Keep a reference to the index we'll use to turn TextPositions into
     // coordinates on the pinch graph.
     const FMDIndex& index;
     
     // Keep around the queue where merges come from.
-    ConcurrentQueue<Merge>& source;
+    ConcurrentQueue<MergeBatch>& source;
     
     // Keep around a pointer to the graph to apply the merges to.
     stPinchThreadSet* target;
     
+    // Keep the graph's threads by contig number, so we don't have to look each
+    // one up in the thread set's hash table for every merge.
+    std::vector<stPinchThread*> threads;
+    
+    // Keep around the lock on the graph, if it is shared.
+    std::mutex* graphLock;
+    
+    // How many merges should be sorted together before applying them, if any?
+    size_t sortWindow;
+    
+    // How many pinches should we make before compacting the threads we
+    // pinched, if we compact at all?
+    size_t compactThreshold;
+    
+    // Where should we record the merges we apply, if anywhere?
+    MergeRecorder* recorder;
+    
+    // On how many threads should merges in different components be pinched?
+    size_t applyThreads;
+    
+    // Holds the parent of each contig in a union-find forest of the pinch
+    // graph's connected components, if we are pinching on several threads.
+    std::vector<size_t> components;
+    
+    // How many pinches joined two components, and had to be made alone?
+    size_t joiningPinches;
+    
+    // Remember both sides of every pinch we did. This has to come before the
+    // thread, so it exists before the thread starts, as do the counters below.
+    std::vector<PinchedRange> pinched;
+    
+    // How many pinches have we made? Atomic so progress can be watched.
+    std::atomic<size_t> pinchCount;
+    
+    // How many bases were in them?
+    std::atomic<size_t> pinchedBases;
+    
+    // How many seconds have we spent pinching?
+    double pinchSeconds;
+    
+    // Which contigs have been pinched since we last compacted? May have
+    // duplicates.
+    std::vector<size_t> uncompacted;
+    
+    // How many times have we compacted?
+    size_t compactions;
+    
+    // How many seconds have we spent compacting?
+    double compactSeconds;
+    
+    // Keep stats on the merge application, including hardware counters if
+    // they are enabled.
+    StatTracker stats;
+    StatTracker::Phase mergeApplicationPhase;
+    
     // Keep around a thread that runs to do the actual applying.
     Thread thread;
     
@@ -49,6 +190,45 @@ protected:
      */
     void run();
     
+    /**
+     * Apply all the given merges to the target graph, holding the graph lock
+     * if there is one, and count the time spent. Sorts the merges first if
+     * merges are being sorted.
+     */
+    void applyMerges(MergeBatch& merges);
+    
+    /**
+     * Apply all the given merges to the target graph, pinching merges in
+     * different components of it at the same time. Must be called with the
+     * graph lock held, if there is one.
+     */
+    void applyMergesSharded(const MergeBatch& merges);
+    
+    /**
+     * Apply a single merge, which may cover a run of many bases, to the target
+     * graph as one pinch. Adds both sides of the pinch to the given pinched
+     * ranges, and, if compacting, both contigs to the given contigs to compact.
+     */
+    void applyMerge(const Merge& merge, std::vector<PinchedRange>& pinched,
+        std::vector<size_t>& uncompacted);
+    
+    /**
+     * Fill in the components forest with the connected components of the
+     * target graph as it is now.
+     */
+    void findComponents();
+    
+    /**
+     * Get the contig that represents the component the given contig is in.
+     */
+    size_t getComponent(size_t contig);
+    
+    /**
+     * Join trivial boundaries on all the threads pinched since the last time.
+     * Must be called with the graph lock held, if there is one.
+     */
+    void compact();
+    
 };
 
 #endif
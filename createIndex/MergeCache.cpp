@@ -0,0 +1,199 @@
+#include "MergeCache.hpp"
+
+#include <stdexcept>
+#include <cstdio>
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+
+#include <Log.hpp>
+#include <TaskPool.hpp>
+
+const uint64_t MergeCache::MAGIC;
+
+/**
+ * Checksum the given bytes, continuing the given CRC32 and Adler-32 sums.
+ */
+static void checksum(uint32_t& crc, uint32_t& adler, const void* data,
+    size_t length) {
+
+    crc = crc32(crc, (const Bytef*) data, length);
+    adler = adler32(adler, (const Bytef*) data, length);
+}
+
+MergeCache::MergeCache(const std::string& directory, const FMDIndex& index,
+    const std::string& optionsKey): directory(directory), index(index),
+    optionsKey(optionsKey), contigChecksums(index.getNumberOfContigs()),
+    genome(0), oldFile(), cachedContigs(), newFile(), partialFile(), stream(),
+    mutex() {
+
+    boost::filesystem::create_directories(directory);
+
+    Log::info() << "Checksumming " << contigChecksums.size() <<
+        " contigs for the merge cache" << std::endl;
+
+    // Do a few chunks of contigs per thread, since they vary in length.
+    size_t chunks = std::min(contigChecksums.size(),
+        TaskPool::global().getSize() * 4);
+    parallelFor(chunks, [&](size_t chunk) {
+        for(size_t contig = contigChecksums.size() * chunk / chunks;
+            contig < contigChecksums.size() * (chunk + 1) / chunks; contig++) {
+
+            std::string sequence = index.displayContig(contig);
+            uint32_t crc = crc32(0L, Z_NULL, 0);
+            uint32_t adler = adler32(0L, Z_NULL, 0);
+            checksum(crc, adler, sequence.data(), sequence.size());
+            contigChecksums[contig] = ((uint64_t) crc << 32) | adler;
+        }
+    });
+}
+
+MergeCache::~MergeCache() {
+    if(!partialFile.empty()) {
+        // Whatever we were recording didn't finish.
+        stream.close();
+        std::remove(partialFile.c_str());
+    }
+}
+
+std::string MergeCache::getViewFile(size_t genome) const {
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    uint32_t adler = adler32(0L, Z_NULL, 0);
+    checksum(crc, adler, optionsKey.data(), optionsKey.size());
+
+    for(size_t earlier = 0; earlier < genome; earlier++) {
+        // Put in every contig of every genome before this one.
+        auto contigs = index.getGenomeContigs(earlier);
+        checksum(crc, adler, contigChecksums.data() + contigs.first,
+            (contigs.second - contigs.first) * sizeof(uint64_t));
+
+        // Separate the genomes, so moving contigs between them changes the
+        // sums.
+        checksum(crc, adler, "\n", 1);
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%08x%08x", crc, adler);
+    return directory + "/" + hex + ".merges";
+}
+
+void MergeCache::startGenome(size_t genome) {
+    this->genome = genome;
+    cachedContigs.clear();
+
+    auto contigs = index.getGenomeContigs(genome);
+
+    newFile = getViewFile(genome);
+    oldFile.clear();
+
+    std::ifstream old(newFile.c_str(), std::ios::binary);
+    uint64_t header[3] = {0, 0, 0};
+    if(old.read((char*) header, sizeof(header)) && header[0] == MAGIC) {
+        // We mapped to this view before. Find the contigs we mapped then that
+        // are still here.
+        std::vector<uint64_t> oldChecksums(header[2]);
+        old.read((char*) oldChecksums.data(),
+            oldChecksums.size() * sizeof(uint64_t));
+
+        if(old) {
+            // Where was each checksum first seen? Identical contigs can all
+            // use the same one's merges.
+            std::unordered_map<uint64_t, size_t> oldContigs;
+            for(size_t i = 0; i < oldChecksums.size(); i++) {
+                oldContigs.emplace(oldChecksums[i], header[1] + i);
+            }
+
+            for(size_t contig = contigs.first; contig < contigs.second;
+                contig++) {
+
+                auto found = oldContigs.find(contigChecksums[contig]);
+                if(found != oldContigs.end()) {
+                    cachedContigs[contig] = found->second;
+                }
+            }
+            oldFile = newFile;
+        }
+    }
+
+    Log::info() << "Reusing cached merges for " << cachedContigs.size() <<
+        " of " << contigs.second - contigs.first << " contigs of genome " <<
+        genome << std::endl;
+
+    // Start recording the merges for this genome, to replace what we have.
+    partialFile = newFile + ".partial";
+    stream.open(partialFile.c_str(), std::ios::binary);
+    if(!stream) {
+        throw std::runtime_error("Could not open " + partialFile +
+            " to cache merges");
+    }
+    uint64_t newHeader[3] = {MAGIC, contigs.first,
+        contigs.second - contigs.first};
+    stream.write((const char*) newHeader, sizeof(newHeader));
+    stream.write((const char*) (contigChecksums.data() + contigs.first),
+        (contigs.second - contigs.first) * sizeof(uint64_t));
+}
+
+void MergeCache::replay(const std::function<void(MergeBatch&)>& send) const {
+    if(cachedContigs.empty()) {
+        // Nothing to do.
+        return;
+    }
+
+    // Which new contigs use each old contig's merges?
+    std::unordered_map<size_t, std::vector<size_t>> targets;
+    for(const auto& cached : cachedContigs) {
+        targets[cached.second].push_back(cached.first);
+    }
+
+    std::ifstream old(oldFile.c_str(), std::ios::binary);
+    uint64_t header[3] = {0, 0, 0};
+    old.read((char*) header, sizeof(header));
+    old.seekg(header[2] * sizeof(uint64_t), std::ios::cur);
+
+    MergeBatch batch;
+    MergeBatch renumbered;
+    while(old.peek() != EOF) {
+        unspillQueueEntry(old, batch);
+        if(!old) {
+            throw std::runtime_error("Cached merges in " + oldFile +
+                " are cut off");
+        }
+        if(batch.empty()) {
+            continue;
+        }
+
+        auto found = targets.find(batch.front().first.getContigNumber());
+        if(found == targets.end()) {
+            // That contig changed.
+            continue;
+        }
+
+        for(size_t contig : found->second) {
+            // Move the query side over to where the contig is now.
+            renumbered.clear();
+            for(const Merge& merge : batch) {
+                renumbered.push_back(Merge(TextPosition(contig * 2 +
+                    merge.first.getStrand(), merge.first.getOffset()),
+                    merge.second, merge.length));
+            }
+            send(renumbered);
+        }
+    }
+}
+
+void MergeCache::record(const MergeBatch& batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    spillQueueEntry(stream, batch);
+}
+
+void MergeCache::finishGenome() {
+    stream.close();
+    if(!stream) {
+        throw std::runtime_error("Could not cache merges in " + partialFile);
+    }
+    stream.clear();
+
+    // Swap it in for whatever we had.
+    boost::filesystem::rename(partialFile, newFile);
+    partialFile.clear();
+}
@@ -0,0 +1,139 @@
+#ifndef MERGECACHE_HPP
+#define MERGECACHE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+#include <FMDIndex.hpp>
+
+#include "Merge.hpp"
+
+/**
+ * Keeps the merges found by mapping each contig of each genome in the greedy
+ * merge, so a later run on an index that starts with the same genomes can
+ * reuse them instead of mapping again.
+ *
+ * The merges for a genome depend only on the genomes before it, which make up
+ * the view it is mapped to, and on its own contigs, which are mapped one by
+ * one. So the merges for each genome are kept in a file named for the view:
+ * a checksum of the mapping options and the contents of every contig of every
+ * earlier genome, in order. Within that file, each contig's merges are found by
+ * its content, so a genome with only some contigs changed only has to map
+ * those. Adding a genome at the end reuses everything before it, and changing
+ * one remaps only from there on.
+ *
+ * A cache file starts with a magic number, the number of the genome's first
+ * contig, its number of contigs, and the content checksum of each, and is
+ * followed by batches of merges in the format MergeRecorder uses, each of which
+ * comes from a single contig, all as 64-bit words in native byte order.
+ */
+class MergeCache {
+
+public:
+    /**
+     * Keep merges for the given index in the given directory, which is created
+     * if needed. The options key should describe every option that changes
+     * what mapping finds. Checksums every contig of the index in parallel.
+     */
+    MergeCache(const std::string& directory, const FMDIndex& index,
+        const std::string& optionsKey);
+
+    /**
+     * Get rid of the MergeCache, and any cache file left unfinished.
+     */
+    ~MergeCache();
+
+    /**
+     * Start merging in the given genome. Works out which of its contigs have
+     * merges cached against the view it is mapped to, and starts recording a
+     * new cache file for it.
+     */
+    void startGenome(size_t genome);
+
+    /**
+     * Are there cached merges for the given contig of the current genome?
+     */
+    inline bool isCached(size_t contig) const {
+        return cachedContigs.count(contig);
+    }
+
+    /**
+     * How many contigs of the current genome have cached merges?
+     */
+    inline size_t getCachedContigs() const {
+        return cachedContigs.size();
+    }
+
+    /**
+     * Send all the cached merges for the current genome to the given function,
+     * which must leave each batch empty, renumbered for where their contigs are
+     * now.
+     */
+    void replay(const std::function<void(MergeBatch&)>& send) const;
+
+    /**
+     * Record a batch of merges found for a single contig of the current
+     * genome, with the contig's merges as query positions. Safe to call from
+     * many threads at once.
+     */
+    void record(const MergeBatch& batch);
+
+    /**
+     * Finish the current genome, putting its cache file in place.
+     */
+    void finishGenome();
+
+    /**
+     * What do cache files start with?
+     */
+    static const uint64_t MAGIC = 0x3145484341434d4dull;
+
+protected:
+    // Where are cache files kept?
+    std::string directory;
+
+    // What index are we merging?
+    const FMDIndex& index;
+
+    // What options were the merges made with?
+    std::string optionsKey;
+
+    // Holds the content checksum of every contig.
+    std::vector<uint64_t> contigChecksums;
+
+    // What genome are we on?
+    size_t genome;
+
+    // Where is the cache file we are reusing, if any?
+    std::string oldFile;
+
+    // Holds, for each contig of the current genome that has cached merges, the
+    // number of the contig they were made for in the old cache file.
+    std::unordered_map<size_t, size_t> cachedContigs;
+
+    // Where is the new cache file going, and where is it being written first?
+    std::string newFile;
+    std::string partialFile;
+
+    // Holds the new cache file, under the mutex.
+    std::ofstream stream;
+    std::mutex mutex;
+
+    /**
+     * Work out the name of the cache file for the view the given genome is
+     * mapped to.
+     */
+    std::string getViewFile(size_t genome) const;
+
+private:
+    // MergeCaches own files, so they can't be copied.
+    MergeCache(const MergeCache& other) = delete;
+    MergeCache& operator=(const MergeCache& other) = delete;
+};
+
+#endif
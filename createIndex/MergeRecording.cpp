@@ -0,0 +1,98 @@
+#include "MergeRecording.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+
+const uint64_t MergeRecorder::MAGIC;
+
+MergeRecorder::MergeRecorder(const std::string& filename): filename(filename),
+    stream(filename.c_str(), std::ios::binary) {
+
+    if(!stream) {
+        throw std::runtime_error("Could not open " + filename +
+            " to record merges");
+    }
+
+    stream.write((const char*) &MAGIC, sizeof(MAGIC));
+}
+
+void MergeRecorder::write(const MergeBatch& batch) {
+    spillQueueEntry(stream, batch);
+}
+
+void MergeRecorder::close() {
+    stream.close();
+    if(!stream) {
+        throw std::runtime_error("Could not record merges to " + filename);
+    }
+}
+
+MergeReader::MergeReader(const std::string& filename): filename(filename),
+    stream(filename.c_str(), std::ios::binary) {
+
+    uint64_t magic = 0;
+    stream.read((char*) &magic, sizeof(magic));
+    if(!stream || magic != MergeRecorder::MAGIC) {
+        throw std::runtime_error(filename + " is not a merge recording");
+    }
+}
+
+bool MergeReader::next(MergeBatch& batch) {
+    if(stream.peek() == EOF) {
+        // That was the last batch.
+        batch.clear();
+        return false;
+    }
+
+    unspillQueueEntry(stream, batch);
+    if(!stream) {
+        throw std::runtime_error("Merge recording " + filename +
+            " is cut off");
+    }
+
+    return true;
+}
+
+void spillQueueEntry(std::ostream& out, const MergeBatch& batch) {
+    uint64_t count = batch.size();
+    out.write((const char*) &count, sizeof(count));
+
+    for(const Merge& merge : batch) {
+        // Packed positions are just words, like in checkpoints.
+        PackedTextPosition ends[2] = {PackedTextPosition(merge.first),
+            PackedTextPosition(merge.second)};
+        uint64_t length = merge.length;
+        out.write((const char*) ends, sizeof(ends));
+        out.write((const char*) &length, sizeof(length));
+    }
+}
+
+void unspillQueueEntry(std::istream& in, MergeBatch& batch,
+    uint64_t maxCount) {
+
+    batch.clear();
+
+    uint64_t count;
+    if(!in.read((char*) &count, sizeof(count))) {
+        return;
+    }
+    if(count > maxCount) {
+        in.setstate(std::ios::failbit);
+        return;
+    }
+
+    // Don't trust the count with more memory than a batch usually takes, in
+    // case the rest isn't there.
+    batch.reserve(std::min(count, (uint64_t) 4096));
+    for(uint64_t i = 0; i < count; i++) {
+        PackedTextPosition ends[2];
+        uint64_t length;
+        in.read((char*) ends, sizeof(ends));
+        in.read((char*) &length, sizeof(length));
+        if(!in) {
+            return;
+        }
+        batch.push_back(Merge(ends[0].unpack(), ends[1].unpack(), length));
+    }
+}
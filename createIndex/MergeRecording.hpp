@@ -0,0 +1,79 @@
+#ifndef MERGERECORDING_HPP
+#define MERGERECORDING_HPP
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "Merge.hpp"
+
+/**
+ * Records the stream of merge batches applied to a pinch graph to a file, so
+ * that it can be replayed later by a MergeReader without mapping anything.
+ *
+ * The file starts with a magic number, and then holds each batch as a 64-bit
+ * count of its merges followed by each merge as its two PackedTextPositions
+ * and its length, all as 64-bit words in native byte order. Merges are already
+ * run-length encoded, with each one covering a whole run of merged bases.
+ */
+class MergeRecorder {
+
+public:
+    /**
+     * Start recording to the given file. Throws a std::runtime_error if it
+     * can't be opened.
+     */
+    MergeRecorder(const std::string& filename);
+
+    /**
+     * Record a batch of merges, in order.
+     */
+    void write(const MergeBatch& batch);
+
+    /**
+     * Finish the recording. Throws a std::runtime_error if anything couldn't
+     * be written.
+     */
+    void close();
+
+    /**
+     * What do recordings start with?
+     */
+    static const uint64_t MAGIC = 0x3130534547524d4dull;
+
+protected:
+    // Where are we recording to?
+    std::string filename;
+
+    // Holds the open file.
+    std::ofstream stream;
+};
+
+/**
+ * Reads back the batches of merges recorded by a MergeRecorder, in order.
+ */
+class MergeReader {
+
+public:
+    /**
+     * Open the given recording. Throws a std::runtime_error if it can't be
+     * opened or isn't a recording of merges.
+     */
+    MergeReader(const std::string& filename);
+
+    /**
+     * Read the next batch into the given batch, replacing what was there.
+     * Returns false if there are no more batches. Throws a std::runtime_error
+     * if the recording is cut off.
+     */
+    bool next(MergeBatch& batch);
+
+protected:
+    // Where are we reading from?
+    std::string filename;
+
+    // Holds the open file.
+    std::ifstream stream;
+};
+
+#endif
@@ -3,3 +3,14 @@
 MergeScheme::MergeScheme(const FMDIndex& index): index(index) {
     // Already grabbed the index. Nothing to do.
 }
+
+ConcurrentQueue<MergeBatch>* MergeScheme::makeQueue(
+    size_t numWriters) const {
+    
+    ConcurrentQueue<MergeBatch>* queue = new ConcurrentQueue<MergeBatch>(
+        numWriters);
+    if(spillAfter > 0) {
+        queue->spillTo(spillPrefix, spillAfter);
+    }
+    return queue;
+}
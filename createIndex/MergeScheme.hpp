@@ -1,16 +1,18 @@
 #ifndef MERGESCHEME_HPP
 #define MERGESCHEME_HPP
 
+#include <string>
+
 #include <FMDIndex.hpp>
 
 #include "ConcurrentQueue.hpp"
 #include "Merge.hpp"
 
 /**
- * Represents a merging scheme which starts a bunch of threads and dumps Merges
- * into a ConcurrentQueue. Not all merging schemes will fit this base class;
- * some need to control the outer loop and build multiple indexes one after the
- * other.
+ * Represents a merging scheme which starts a bunch of threads and dumps batches
+ * of Merges into a ConcurrentQueue. Not all merging schemes will fit this base
+ * class; some need to control the outer loop and build multiple indexes one
+ * after the other.
  */
 class MergeScheme {
 
@@ -47,7 +49,7 @@ public:
      * Returns a reference to the queue, which will live as long as this object
      * does.
      */
-    virtual ConcurrentQueue<Merge>& run() = 0;
+    virtual ConcurrentQueue<MergeBatch>& run() = 0;
     
     /**
      * Wait for all the merge-producing threads to finish. Obviously you
@@ -56,8 +58,22 @@ public:
      */
     virtual void join() = 0;
     
+    // If nonzero, once this many batches of merges are waiting for whatever
+    // applies them, further batches are spilled to scratch files starting with
+    // spillPrefix until it catches up, instead of piling up in memory.
+    size_t spillAfter = 0;
+    
+    // What do the scratch files for spilled merges start with?
+    std::string spillPrefix;
+    
 protected:
 
+    /**
+     * Make a new queue for merges from the given number of writers, which
+     * spills as configured. The caller owns it.
+     */
+    ConcurrentQueue<MergeBatch>* makeQueue(size_t numWriters) const;
+
     // Holds the FMDIndex we're using to look at the low-level sequences.
     const FMDIndex& index;
     
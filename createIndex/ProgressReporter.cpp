@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+#include <Log.hpp>
+
+#include "ProgressReporter.hpp"
+
+ProgressReporter::ProgressReporter(double interval,
+    const std::string& metricsFilename): interval(interval),
+    metricsFilename(metricsFilename), mutex(), wakeup(), stopping(false),
+    scheme(nullptr), queue(nullptr), applier(nullptr), step(), first(),
+    last(), thread(&ProgressReporter::run, this) {
+
+    // Already started running.
+}
+
+ProgressReporter::~ProgressReporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+}
+
+void ProgressReporter::watch(const std::string& step,
+    const MappingMergeScheme& scheme, const ConcurrentQueue<MergeBatch>& queue,
+    const MergeApplier& applier) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+    this->step = step;
+    this->scheme = &scheme;
+    this->queue = &queue;
+    this->applier = &applier;
+    first = sample();
+    last = first;
+}
+
+void ProgressReporter::unwatch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(scheme == nullptr) {
+        return;
+    }
+    report();
+    scheme = nullptr;
+    queue = nullptr;
+    applier = nullptr;
+}
+
+ProgressReporter::Sample ProgressReporter::sample() const {
+    return Sample{std::chrono::steady_clock::now(), scheme->getBasesDone(),
+        scheme->getBasesMapped(), queue->getEnqueuedItems(),
+        applier->getPinchedBases()};
+}
+
+void ProgressReporter::report() {
+    Sample now = sample();
+
+    // Work out the rates since the last report.
+    double seconds = std::chrono::duration<double>(now.time -
+        last.time).count();
+    double basesPerSecond = 0;
+    double queuedPerSecond = 0;
+    double appliedPerSecond = 0;
+    if(seconds > 0) {
+        basesPerSecond = (now.basesDone - last.basesDone) / seconds;
+        queuedPerSecond = (now.mergesQueued - last.mergesQueued) / seconds;
+        appliedPerSecond = (now.mergesApplied - last.mergesApplied) / seconds;
+    }
+
+    // Estimate the time left from the rate over the whole step, which jumps
+    // around less.
+    size_t basesToMap = scheme->getBasesToMap();
+    double elapsed = std::chrono::duration<double>(now.time -
+        first.time).count();
+    double secondsLeft = std::numeric_limits<double>::quiet_NaN();
+    if(now.basesDone > first.basesDone && elapsed > 0) {
+        secondsLeft = (basesToMap - now.basesDone) /
+            ((now.basesDone - first.basesDone) / elapsed);
+    }
+
+    std::string timeLeft = "time left unknown";
+    if(secondsLeft == secondsLeft) {
+        timeLeft = "about " + std::to_string((size_t) secondsLeft) +
+            " s left";
+    }
+
+    Log::info() << "Progress on " << step << ": " << now.basesDone << "/" <<
+        basesToMap << " bases (" << (basesToMap > 0 ?
+        100.0 * now.basesDone / basesToMap : 100.0) << "%), " <<
+        basesPerSecond << " bases/s, " << now.basesMapped <<
+        " mapped; merged bases " << queuedPerSecond << "/s queued, " <<
+        appliedPerSecond << "/s applied; " << queue->getDepth() <<
+        " batches waiting (" << queue->getSpilled() << " on disk); " <<
+        timeLeft << std::endl;
+
+    if(!metricsFilename.empty()) {
+        writeMetrics(now, basesPerSecond, queuedPerSecond, appliedPerSecond,
+            secondsLeft);
+    }
+
+    last = now;
+}
+
+void ProgressReporter::writeMetrics(const Sample& now, double basesPerSecond,
+    double queuedPerSecond, double appliedPerSecond,
+    double secondsLeft) const {
+
+    // Write to a temporary file and move it into place.
+    std::string temporary = metricsFilename + ".tmp";
+    std::ofstream metrics(temporary.c_str());
+
+    // Every metric is labeled with the step.
+    std::string label = "{step=\"" + step + "\"}";
+
+    // Write out one metric with its help and type.
+    auto write = [&](const std::string& name, const std::string& type,
+        const std::string& help, double value) {
+
+        metrics << "# HELP createindex_" << name << " " << help << std::endl;
+        metrics << "# TYPE createindex_" << name << " " << type << std::endl;
+        metrics << "createindex_" << name << label << " ";
+        if(value == value) {
+            // Keep enough digits that counts come out exact.
+            metrics << std::setprecision(17) << value;
+        } else {
+            metrics << "NaN";
+        }
+        metrics << std::endl;
+    };
+
+    write("bases_to_map", "gauge", "Query bases in the step",
+        scheme->getBasesToMap());
+    write("bases_done_total", "counter", "Query bases done mapping",
+        now.basesDone);
+    write("bases_mapped_total", "counter", "Query bases that mapped",
+        now.basesMapped);
+    write("merged_bases_queued_total", "counter",
+        "Bases of merges queued to be applied", now.mergesQueued);
+    write("merged_bases_applied_total", "counter",
+        "Bases of merges applied to the graph", now.mergesApplied);
+    write("merge_queue_batches", "gauge", "Merge batches waiting",
+        queue->getDepth());
+    write("merge_queue_spilled_batches", "gauge",
+        "Merge batches waiting on disk", queue->getSpilled());
+    write("bases_per_second", "gauge", "Query bases mapped per second",
+        basesPerSecond);
+    write("merged_bases_queued_per_second", "gauge",
+        "Bases of merges queued per second", queuedPerSecond);
+    write("merged_bases_applied_per_second", "gauge",
+        "Bases of merges applied per second", appliedPerSecond);
+    write("seconds_left", "gauge", "Estimated seconds left in the step",
+        secondsLeft);
+
+    metrics.close();
+
+    if(!metrics || std::rename(temporary.c_str(),
+        metricsFilename.c_str()) != 0) {
+
+        // Don't stop the merge over it.
+        Log::warning() << "Could not write metrics to " << metricsFilename <<
+            std::endl;
+    }
+}
+
+void ProgressReporter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping) {
+        // Only report when the interval is really up, not when woken early.
+        if(wakeup.wait_for(lock, interval) == std::cv_status::timeout &&
+            !stopping && scheme != nullptr) {
+            
+            report();
+        }
+    }
+}
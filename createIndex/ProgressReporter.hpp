@@ -0,0 +1,148 @@
+#ifndef PROGRESSREPORTER_HPP
+#define PROGRESSREPORTER_HPP
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "ConcurrentQueue.hpp"
+#include "Merge.hpp"
+#include "MappingMergeScheme.hpp"
+#include "MergeApplier.hpp"
+
+/**
+ * Reports the progress of a long merge step from a thread of its own. Every so
+ * often it logs how fast bases are being mapped, how fast merges are being
+ * queued and applied, how many batches are waiting, and about how long the
+ * step has left. If given a metrics file, it also rewrites that file each time
+ * in the Prometheus text format, so something like node_exporter's textfile
+ * collector can pick it up.
+ *
+ * Everything it reports comes from atomic counters, so watching a merge never
+ * blocks it. Progress on mapping is only counted as each contig window
+ * finishes, so with no windowing it moves a contig at a time.
+ */
+class ProgressReporter {
+
+public:
+
+    /**
+     * Make a new ProgressReporter that reports every given number of seconds,
+     * and writes metrics to the given file if it isn't empty. Starts its
+     * thread right away, but reports nothing until watch() is called.
+     */
+    ProgressReporter(double interval, const std::string& metricsFilename = "");
+
+    /**
+     * Stop reporting and wait for the thread to finish.
+     */
+    ~ProgressReporter();
+
+    /**
+     * Start reporting on the given step, which maps with the given scheme into
+     * the given queue, which is drained by the given applier. All of them must
+     * stay alive until unwatch() is called.
+     */
+    void watch(const std::string& step, const MappingMergeScheme& scheme,
+        const ConcurrentQueue<MergeBatch>& queue, const MergeApplier& applier);
+
+    /**
+     * Make a last report on the step being watched, and stop watching it.
+     */
+    void unwatch();
+
+protected:
+
+    /**
+     * Holds one look at all the counters.
+     */
+    struct Sample {
+        // When was it taken?
+        std::chrono::steady_clock::time_point time;
+        // How many query bases are done mapping?
+        size_t basesDone;
+        // How many of them mapped?
+        size_t basesMapped;
+        // How many bases of merges have been queued?
+        size_t mergesQueued;
+        // How many bases of merges have been applied?
+        size_t mergesApplied;
+    };
+
+    /**
+     * Take a sample from the things being watched. Must be called with the
+     * lock held, while something is being watched.
+     */
+    Sample sample() const;
+
+    /**
+     * Log a report, and write the metrics file if we have one. Must be called
+     * with the lock held, while something is being watched.
+     */
+    void report();
+
+    /**
+     * Write out the metrics file for the given sample, the given rates per
+     * second, and the given estimated seconds left. Replaces the file all at
+     * once, so nobody reads half of it.
+     */
+    void writeMetrics(const Sample& now, double basesPerSecond,
+        double queuedPerSecond, double appliedPerSecond,
+        double secondsLeft) const;
+
+    /**
+     * Report every interval until told to stop.
+     */
+    void run();
+
+    // How long should we wait between reports?
+    std::chrono::duration<double> interval;
+
+    // Where should we write metrics, if anywhere?
+    std::string metricsFilename;
+
+    // Protects everything below.
+    std::mutex mutex;
+
+    // Rung to wake the thread up when it should stop.
+    std::condition_variable wakeup;
+
+    // Should the thread stop?
+    bool stopping;
+
+    // What are we watching? Null when nothing is.
+    const MappingMergeScheme* scheme;
+    const ConcurrentQueue<MergeBatch>* queue;
+    const MergeApplier* applier;
+
+    // What do we call the step being watched?
+    std::string step;
+
+    // Holds the sample from when we started watching, for estimating the time
+    // left.
+    Sample first;
+
+    // Holds the sample from the last report, for working out rates.
+    Sample last;
+
+    // Holds the thread that does the reporting. Comes last so everything is
+    // ready when it starts.
+    std::thread thread;
+
+private:
+
+    /**
+     * No copy constructor is allowed.
+     */
+    ProgressReporter(const ProgressReporter& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    ProgressReporter& operator=(const ProgressReporter& other) = delete;
+
+};
+
+#endif
@@ -0,0 +1,556 @@
+#include "RemoteMapping.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <boost/filesystem.hpp>
+
+#include <Log.hpp>
+#include <LevelIndex.hpp>
+#include <GenericBitVector.hpp>
+#include <TaskPool.hpp>
+
+const uint64_t MappingConnection::MAGIC;
+
+/**
+ * Append a word to a message being built.
+ */
+static void appendWord(std::ostringstream& message, uint64_t word) {
+    message.write((const char*) &word, sizeof(word));
+}
+
+SocketReadBuffer::SocketReadBuffer(int socket): socket(socket) {
+    // Start out empty.
+    setg(buffer, buffer, buffer);
+}
+
+SocketReadBuffer::int_type SocketReadBuffer::underflow() {
+    if(gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    ssize_t got;
+    do {
+        got = read(socket, buffer, sizeof(buffer));
+    } while(got < 0 && errno == EINTR);
+
+    if(got <= 0) {
+        // The other end hung up, or something broke.
+        return traits_type::eof();
+    }
+
+    setg(buffer, buffer, buffer + got);
+    return traits_type::to_int_type(*gptr());
+}
+
+MappingConnection::MappingConnection(int socket, const std::string& name):
+    socket(socket), name(name), slots(0), failed(false), sendMutex(),
+    buffer(socket), in(&buffer) {
+
+    // Little messages like DONE shouldn't wait around to be combined.
+    int yes = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+MappingConnection::~MappingConnection() {
+    close(socket);
+}
+
+void MappingConnection::sendHello(const FMDIndex& index, size_t slots) {
+    std::ostringstream message;
+    appendWord(message, MAGIC);
+    appendWord(message, index.getNumberOfContigs());
+    appendWord(message, index.getBWTLength());
+    appendWord(message, slots);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+void MappingConnection::receiveHello(const FMDIndex& index) {
+    if(readWord() != MAGIC) {
+        throw std::runtime_error(name + " is not a mapping worker");
+    }
+    uint64_t contigs = readWord();
+    uint64_t bwtLength = readWord();
+    if(contigs != index.getNumberOfContigs() ||
+        bwtLength != (uint64_t) index.getBWTLength()) {
+
+        throw std::runtime_error(name + " has a different index");
+    }
+    slots = std::max(readWord(), (uint64_t) 1);
+}
+
+void MappingConnection::sendLevel(size_t genome, bool selfQuery,
+    size_t windowOverlap, const std::string& levelFile) {
+
+    std::ifstream level(levelFile.c_str(), std::ios::binary);
+    if(!level) {
+        throw std::runtime_error("Could not open level index " + levelFile);
+    }
+    level.seekg(0, std::ios::end);
+    uint64_t bytes = level.tellg();
+    level.seekg(0);
+
+    std::ostringstream message;
+    appendWord(message, LEVEL);
+    appendWord(message, genome);
+    appendWord(message, selfQuery);
+    appendWord(message, windowOverlap);
+    appendWord(message, bytes);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+
+    // Then send the file a piece at a time.
+    std::vector<char> chunk(1 << 20);
+    while(bytes > 0) {
+        size_t length = std::min((uint64_t) chunk.size(), bytes);
+        if(!level.read(chunk.data(), length)) {
+            throw std::runtime_error("Could not read level index " +
+                levelFile);
+        }
+        send(std::string(chunk.data(), length));
+        bytes -= length;
+    }
+}
+
+void MappingConnection::receiveLevel(const Message& message,
+    const std::string& filename) {
+
+    std::ofstream level(filename.c_str(), std::ios::binary);
+
+    std::vector<char> chunk(1 << 20);
+    size_t bytes = message.levelBytes;
+    while(bytes > 0) {
+        size_t length = std::min(chunk.size(), bytes);
+        if(!in.read(chunk.data(), length)) {
+            throw std::runtime_error("Lost connection to " + name +
+                " while receiving level index");
+        }
+        level.write(chunk.data(), length);
+        bytes -= length;
+    }
+
+    level.close();
+    if(!level) {
+        throw std::runtime_error("Could not save level index to " + filename);
+    }
+}
+
+void MappingConnection::sendGroup(uint64_t id,
+    const std::vector<MappingMergeScheme::ContigWindow>& windows) {
+
+    std::ostringstream message;
+    appendWord(message, GROUP);
+    appendWord(message, id);
+    appendWord(message, windows.size());
+    for(const auto& window : windows) {
+        appendWord(message, window.contig);
+        appendWord(message, window.start);
+        appendWord(message, window.end);
+    }
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+void MappingConnection::sendEnd() {
+    std::ostringstream message;
+    appendWord(message, END);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+void MappingConnection::sendBatch(const MergeBatch& batch) {
+    if(batch.empty()) {
+        // Nothing to say.
+        return;
+    }
+
+    // Build the message before taking the lock, so other threads can send
+    // while we do.
+    std::ostringstream message;
+    appendWord(message, BATCH);
+    spillQueueEntry(message, batch);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+void MappingConnection::sendDone(uint64_t id, size_t mapped) {
+    std::ostringstream message;
+    appendWord(message, DONE);
+    appendWord(message, id);
+    appendWord(message, mapped);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+void MappingConnection::sendGenomeDone() {
+    std::ostringstream message;
+    appendWord(message, GENOME_DONE);
+
+    std::lock_guard<std::mutex> lock(sendMutex);
+    send(message.str());
+}
+
+MappingConnection::MessageType MappingConnection::receive(Message& message) {
+    if(in.peek() == EOF) {
+        // The other end hung up between messages.
+        message.type = CLOSED;
+        return message.type;
+    }
+
+    message.type = (MessageType) readWord();
+    switch(message.type) {
+    case LEVEL:
+        message.genome = readWord();
+        message.selfQuery = readWord();
+        message.windowOverlap = readWord();
+        message.levelBytes = readWord();
+        break;
+    case GROUP:
+        {
+            message.id = readWord();
+            uint64_t count = readWord();
+            if(count > MAX_MESSAGE_ITEMS) {
+                throw std::runtime_error("Got a group of " +
+                    std::to_string(count) + " windows from " + name);
+            }
+            // Only hold as many windows as have actually arrived.
+            message.windows.clear();
+            message.windows.reserve(std::min(count, (uint64_t) 1024));
+            for(uint64_t i = 0; i < count; i++) {
+                MappingMergeScheme::ContigWindow window;
+                window.contig = readWord();
+                window.start = readWord();
+                window.end = readWord();
+                message.windows.push_back(window);
+            }
+        }
+        break;
+    case BATCH:
+        unspillQueueEntry(in, message.batch, MAX_MESSAGE_ITEMS);
+        if(!in) {
+            throw std::runtime_error("Lost connection to " + name +
+                " partway through merges, or got too many");
+        }
+        break;
+    case DONE:
+        message.id = readWord();
+        message.mapped = readWord();
+        break;
+    case END:
+    case GENOME_DONE:
+        break;
+    default:
+        throw std::runtime_error("Got a message of unknown type from " + name);
+    }
+
+    return message.type;
+}
+
+void MappingConnection::fail() {
+    if(!failed.exchange(true)) {
+        // Wake up anything blocked on the socket, on this end and the other.
+        shutdown(socket, SHUT_RDWR);
+    }
+}
+
+void MappingConnection::send(const std::string& message) {
+    size_t written = 0;
+    while(written < message.size()) {
+        ssize_t result = write(socket, message.data() + written,
+            message.size() - written);
+        if(result < 0 && errno != EINTR) {
+            throw std::runtime_error("Could not send to " + name + ": " +
+                strerror(errno));
+        } else if(result > 0) {
+            written += result;
+        }
+    }
+}
+
+uint64_t MappingConnection::readWord() {
+    uint64_t word;
+    if(!in.read((char*) &word, sizeof(word))) {
+        throw std::runtime_error("Lost connection to " + name);
+    }
+    return word;
+}
+
+MappingServer::MappingServer(const FMDIndex& index, uint16_t port):
+    index(index), listener(-1), stopping(false), workers(), mutex(),
+    acceptor() {
+
+    // Workers that go away shouldn't take us with them.
+    signal(SIGPIPE, SIG_IGN);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses;
+    if(getaddrinfo(NULL, std::to_string(port).c_str(), &hints,
+        &addresses) != 0) {
+
+        throw std::runtime_error("Could not look up port " +
+            std::to_string(port));
+    }
+
+    for(addrinfo* address = addresses; address != NULL && listener < 0;
+        address = address->ai_next) {
+
+        // Listen on the first address that works.
+        listener = socket(address->ai_family, address->ai_socktype,
+            address->ai_protocol);
+        if(listener < 0) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if(bind(listener, address->ai_addr, address->ai_addrlen) != 0 ||
+            listen(listener, SOMAXCONN) != 0) {
+
+            close(listener);
+            listener = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if(listener < 0) {
+        throw std::runtime_error("Could not listen for workers on port " +
+            std::to_string(port) + ": " + strerror(errno));
+    }
+
+    Log::info() << "Listening for mapping workers on port " << port <<
+        std::endl;
+
+    acceptor.reset(new Thread(&MappingServer::acceptWorkers, this));
+}
+
+MappingServer::~MappingServer() {
+    // Wake up the acceptor and wait for it.
+    stopping = true;
+    shutdown(listener, SHUT_RDWR);
+    acceptor->join();
+    close(listener);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& worker : workers) {
+        // Hang up on everyone.
+        worker->fail();
+    }
+    workers.clear();
+}
+
+std::vector<std::shared_ptr<MappingConnection>> MappingServer::getWorkers() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Forget the ones that broke.
+    workers.erase(std::remove_if(workers.begin(), workers.end(),
+        [](const std::shared_ptr<MappingConnection>& worker) {
+        return worker->isFailed();
+    }), workers.end());
+
+    return workers;
+}
+
+void MappingServer::acceptWorkers() {
+    while(!stopping) {
+        sockaddr_storage address;
+        socklen_t addressLength = sizeof(address);
+        int client = accept(listener, (sockaddr*) &address, &addressLength);
+        if(client < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if(!stopping) {
+                Log::error() << "Could not accept mapping worker: " <<
+                    strerror(errno) << std::endl;
+            }
+            return;
+        }
+
+        // Name the worker after where it connected from.
+        char host[NI_MAXHOST];
+        char service[NI_MAXSERV];
+        std::string name = "worker";
+        if(getnameinfo((sockaddr*) &address, addressLength, host,
+            sizeof(host), service, sizeof(service),
+            NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+
+            name = std::string(host) + ":" + service;
+        }
+
+        auto worker = std::make_shared<MappingConnection>(client, name);
+        try {
+            worker->receiveHello(index);
+        } catch(std::runtime_error& e) {
+            Log::error() << "Rejected mapping worker: " << e.what() <<
+                std::endl;
+            continue;
+        }
+
+        Log::info() << "Mapping worker " << name << " connected with " <<
+            worker->getSlots() << " threads" << std::endl;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        workers.push_back(worker);
+    }
+}
+
+/**
+ * Connect to the given "host:port" address over TCP. Returns the socket.
+ * Throws a std::runtime_error if it can't connect.
+ */
+static int connectTo(const std::string& address) {
+    size_t colon = address.rfind(':');
+    if(colon == std::string::npos) {
+        throw std::runtime_error("Address " + address + " has no port");
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        throw std::runtime_error("Could not look up " + address);
+    }
+
+    int connection = -1;
+    for(addrinfo* candidate = addresses; candidate != NULL && connection < 0;
+        candidate = candidate->ai_next) {
+
+        // Use the first address that answers.
+        connection = socket(candidate->ai_family, candidate->ai_socktype,
+            candidate->ai_protocol);
+        if(connection >= 0 && connect(connection, candidate->ai_addr,
+            candidate->ai_addrlen) != 0) {
+
+            close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if(connection < 0) {
+        throw std::runtime_error("Could not connect to " + address + ": " +
+            strerror(errno));
+    }
+    return connection;
+}
+
+void mapForMaster(const std::string& address, const FMDIndex& index,
+    std::function<MappingScheme*(FMDIndexView&&)> mappingSchemeFactory,
+    const GapFiller* gapFiller) {
+
+    // If the master goes away, we want to hear about it as an error.
+    signal(SIGPIPE, SIG_IGN);
+
+    MappingConnection master(connectTo(address), address);
+    master.sendHello(index, TaskPool::global().getSize());
+
+    Log::info() << "Mapping for " << address << std::endl;
+
+    // These hold what we map to for the current genome. The mapping scheme
+    // uses the level and the mask, so it has to go first.
+    std::unique_ptr<LevelIndex> level;
+    std::unique_ptr<GenericBitVector> mask;
+    std::unique_ptr<MappingScheme> mappingScheme;
+    std::unique_ptr<MappingMergeScheme> scheme;
+
+    // Holds the groups being mapped.
+    TaskGroup tasks;
+
+    MappingConnection::Message message;
+    while(master.receive(message) != MappingConnection::CLOSED) {
+        switch(message.type) {
+        case MappingConnection::LEVEL:
+            {
+                scheme.reset();
+                mappingScheme.reset();
+                level.reset();
+                mask.reset();
+
+                Log::info() << "Mapping genome " << message.genome << " for " <<
+                    address << std::endl;
+
+                std::string levelFile = (
+                    boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path(
+                    "level-%%%%-%%%%-%%%%.lvl")).string();
+                master.receiveLevel(message, levelFile);
+                level.reset(new LevelIndex(levelFile));
+                // It's mapped now, so the file can go.
+                boost::filesystem::remove(levelFile);
+
+                // Everything in the genomes before this one has been merged,
+                // so that's what we can map to.
+                std::vector<const GenericBitVector*> genomeMasks;
+                for(size_t genome = 0; genome < message.genome; genome++) {
+                    genomeMasks.push_back(&index.getGenomeMask(genome));
+                }
+                mask.reset(GenericBitVector::createUnionOf(genomeMasks));
+
+                mappingScheme.reset(mappingSchemeFactory(
+                    FMDIndexView(index, mask.get(), *level)));
+                scheme.reset(new MappingMergeScheme(index,
+                    mappingScheme.get(), message.genome));
+                scheme->windowOverlap = message.windowOverlap;
+                scheme->selfQuery = message.selfQuery;
+                scheme->gapFiller = gapFiller;
+            }
+            break;
+        case MappingConnection::GROUP:
+            {
+                if(!scheme) {
+                    throw std::runtime_error(
+                        "Got windows to map before a level to map them to");
+                }
+
+                const MappingMergeScheme* mapper = scheme.get();
+                uint64_t id = message.id;
+                auto windows = std::move(message.windows);
+                tasks.run([&master, mapper, id, windows]() {
+                    size_t mapped = mapper->mapWindows(windows,
+                        [&](MergeBatch& batch) {
+
+                        master.sendBatch(batch);
+                        batch.clear();
+                    });
+                    master.sendDone(id, mapped);
+                });
+            }
+            break;
+        case MappingConnection::END:
+            // Finish everything, then say so.
+            tasks.join();
+            master.sendGenomeDone();
+            break;
+        default:
+            throw std::runtime_error("Unexpected message from " + address);
+        }
+    }
+
+    tasks.join();
+
+    Log::info() << "Done mapping for " << address << std::endl;
+}
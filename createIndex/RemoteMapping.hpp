@@ -0,0 +1,314 @@
+#ifndef REMOTEMAPPING_HPP
+#define REMOTEMAPPING_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <streambuf>
+#include <cstdint>
+
+#include <FMDIndex.hpp>
+#include <FMDIndexView.hpp>
+#include <MappingScheme.hpp>
+
+#include "Merge.hpp"
+#include "MappingMergeScheme.hpp"
+#include "Thread.hpp"
+
+/**
+ * A stream buffer that reads from a connected socket, so messages can be read
+ * with the same code that reads them from files.
+ */
+class SocketReadBuffer: public std::streambuf {
+
+public:
+    /**
+     * Read from the given socket, which is not taken over.
+     */
+    SocketReadBuffer(int socket);
+
+protected:
+    /**
+     * Refill the buffer from the socket.
+     */
+    virtual int_type underflow() override;
+
+    // What socket are we reading?
+    int socket;
+
+    // Holds what we have read but not used yet.
+    char buffer[1 << 16];
+};
+
+/**
+ * One end of a connection between a createIndex process merging a genome and a
+ * worker process mapping contig windows for it on another machine.
+ *
+ * For each genome, the master sends a LEVEL message with the level index of
+ * the view to map to, then a GROUP message for each group of windows to map,
+ * then an END message. The worker sends back a BATCH message for each batch of
+ * merges it finds and a DONE message as each group is finished, in whatever
+ * order they happen, and finally a GENOME_DONE message once everything is
+ * mapped. The master ends the session by closing the connection.
+ *
+ * Messages are 64-bit words in native byte order, with merge batches in the
+ * format MergeRecorder uses, so the master and workers have to run on the same
+ * kind of machine. Each message starts with its type. Both ends must have the
+ * same index, which is checked when a worker connects.
+ */
+class MappingConnection {
+
+public:
+    /**
+     * What kinds of message are there? CLOSED is not sent, but is what
+     * receive() returns when the other end closes the connection.
+     */
+    enum MessageType : uint64_t {
+        LEVEL = 1,
+        GROUP,
+        END,
+        BATCH,
+        DONE,
+        GENOME_DONE,
+        CLOSED
+    };
+
+    /**
+     * Holds a message that has been received. Only the fields for its type
+     * are filled in.
+     */
+    struct Message {
+        MessageType type;
+
+        // For LEVEL, what genome is being mapped, how, and how many bytes of
+        // level index are waiting to be read with receiveLevel()?
+        size_t genome;
+        bool selfQuery;
+        size_t windowOverlap;
+        size_t levelBytes;
+
+        // For GROUP and DONE, which group is it?
+        uint64_t id;
+        // For GROUP, what windows are in it?
+        std::vector<MappingMergeScheme::ContigWindow> windows;
+        // For DONE, how many bases mapped?
+        size_t mapped;
+
+        // For BATCH, the merges.
+        MergeBatch batch;
+    };
+
+    /**
+     * Talk over the given connected socket, which is taken over and closed
+     * when the MappingConnection goes away. The name says who is on the other
+     * end, for logging.
+     */
+    MappingConnection(int socket, const std::string& name);
+
+    /**
+     * Close the connection.
+     */
+    ~MappingConnection();
+
+    /**
+     * Introduce a worker to the master, saying what index it has and how many
+     * groups it can map at once.
+     */
+    void sendHello(const FMDIndex& index, size_t slots);
+
+    /**
+     * Read a worker's introduction. Throws a std::runtime_error if it isn't a
+     * worker or doesn't have the given index.
+     */
+    void receiveHello(const FMDIndex& index);
+
+    /**
+     * How many groups can the worker map at once?
+     */
+    inline size_t getSlots() const {
+        return slots;
+    }
+
+    /**
+     * Who is on the other end?
+     */
+    inline const std::string& getName() const {
+        return name;
+    }
+
+    /**
+     * Start a genome, sending the given saved level index along.
+     */
+    void sendLevel(size_t genome, bool selfQuery, size_t windowOverlap,
+        const std::string& levelFile);
+
+    /**
+     * Save the level index that came with a LEVEL message to the given file.
+     * Must be called right after the message is received.
+     */
+    void receiveLevel(const Message& message, const std::string& filename);
+
+    /**
+     * Send a group of windows to map.
+     */
+    void sendGroup(uint64_t id,
+        const std::vector<MappingMergeScheme::ContigWindow>& windows);
+
+    /**
+     * Say there are no more groups for this genome.
+     */
+    void sendEnd();
+
+    /**
+     * Send a batch of merges. Safe to call from many threads at once.
+     */
+    void sendBatch(const MergeBatch& batch);
+
+    /**
+     * Say a group is finished, and how many bases in it mapped. Safe to call
+     * from many threads at once.
+     */
+    void sendDone(uint64_t id, size_t mapped);
+
+    /**
+     * Say everything for this genome is finished.
+     */
+    void sendGenomeDone();
+
+    /**
+     * Wait for the next message and read it into the given message. Returns
+     * its type. Throws a std::runtime_error if the connection breaks partway
+     * through a message.
+     */
+    MessageType receive(Message& message);
+
+    /**
+     * Give up on the connection, so anything waiting to read or write on it
+     * stops.
+     */
+    void fail();
+
+    /**
+     * Has the connection been given up on?
+     */
+    inline bool isFailed() const {
+        return failed.load();
+    }
+
+    /**
+     * What does a worker's introduction start with?
+     */
+    static const uint64_t MAGIC = 0x31524b524f57444dull;
+
+    /**
+     * How many windows may a group, or merges a batch, have? Real ones have
+     * at most a few thousand, so anything past this means the other end is
+     * broken, and shouldn't make us try to allocate it.
+     */
+    static const uint64_t MAX_MESSAGE_ITEMS = 1 << 24;
+
+protected:
+    // What socket are we talking over?
+    int socket;
+
+    // Who is on the other end?
+    std::string name;
+
+    // How many groups can the worker map at once?
+    size_t slots;
+
+    // Has the connection been given up on?
+    std::atomic<bool> failed;
+
+    // Only one thread may write a message at a time.
+    std::mutex sendMutex;
+
+    // Reads come through here.
+    SocketReadBuffer buffer;
+    std::istream in;
+
+    /**
+     * Send a whole message. Caller must hold the send mutex.
+     */
+    void send(const std::string& message);
+
+    /**
+     * Read one word. Throws a std::runtime_error if it isn't there.
+     */
+    uint64_t readWord();
+
+private:
+    // MappingConnections own their sockets, so they can't be copied.
+    MappingConnection(const MappingConnection& other) = delete;
+    MappingConnection& operator=(const MappingConnection& other) = delete;
+};
+
+/**
+ * Accepts worker processes on a TCP port, in the background, so merges can map
+ * on them as well as locally. Workers that connect while a genome is being
+ * merged start helping with the next one.
+ */
+class MappingServer {
+
+public:
+    /**
+     * Listen on the given port for workers with the given index. Throws a
+     * std::runtime_error if the port can't be listened on.
+     */
+    MappingServer(const FMDIndex& index, uint16_t port);
+
+    /**
+     * Stop listening, and disconnect all the workers, which ends their
+     * sessions.
+     */
+    ~MappingServer();
+
+    /**
+     * Get all the workers that are connected and haven't failed.
+     */
+    std::vector<std::shared_ptr<MappingConnection>> getWorkers();
+
+protected:
+    // What index do workers need?
+    const FMDIndex& index;
+
+    // What socket are we listening on?
+    int listener;
+
+    // Are we shutting down?
+    std::atomic<bool> stopping;
+
+    // Holds the workers, under the mutex.
+    std::vector<std::shared_ptr<MappingConnection>> workers;
+    std::mutex mutex;
+
+    // Holds the thread accepting workers.
+    std::unique_ptr<Thread> acceptor;
+
+    /**
+     * Run as a thread. Accept workers until stopped.
+     */
+    void acceptWorkers();
+
+private:
+    // MappingServers can't be copied.
+    MappingServer(const MappingServer& other) = delete;
+    MappingServer& operator=(const MappingServer& other) = delete;
+};
+
+/**
+ * Connect to the createIndex process at the given "host:port" address, and map
+ * contig windows for it with mapping schemes made by the given factory, until
+ * it hangs up. Mapping runs on the shared TaskPool. The index must be the one
+ * the master has. If passed a GapFiller, gaps between mappings are filled with
+ * it, which should match what the master does.
+ */
+void mapForMaster(const std::string& address, const FMDIndex& index,
+    std::function<MappingScheme*(FMDIndexView&&)> mappingSchemeFactory,
+    const GapFiller* gapFiller = nullptr);
+
+#endif
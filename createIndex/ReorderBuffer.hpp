@@ -0,0 +1,139 @@
+#ifndef REORDERBUFFER_HPP
+#define REORDERBUFFER_HPP
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <utility>
+
+#include "BoundedQueue.hpp"
+
+/**
+ * Sits in front of a BoundedQueue, and puts things that are numbered 0, 1, 2,
+ * and so on into it in order, however out of order they come in. Things that
+ * come early wait in the buffer until everything before them has gone through.
+ *
+ * The buffer holds things numbered less than a fixed window past the next one
+ * due. A writer with something numbered further ahead than that waits for the
+ * buffer to catch up, so one slow item can't make everything after it pile up
+ * in memory. Every number must eventually be put in, by a writer that isn't
+ * itself waiting on a later number, or the writers waiting on the window never
+ * get to go.
+ *
+ * With a window of 0, things go straight into the queue in whatever order they
+ * come, and their numbers are ignored.
+ *
+ * Like the queue, it tracks writers: it is told how many there are, and each
+ * calls close() when done. When the last one does, the buffer closes the queue,
+ * which must have been made expecting only the buffer to write to it.
+ */
+template <typename T>
+class ReorderBuffer {
+
+public:
+
+    /**
+     * Make a new ReorderBuffer writing to the given queue, holding things up to
+     * the given number past the next one due, which expects the given number
+     * of writers to eventually call close().
+     */
+    ReorderBuffer(BoundedQueue<T>& queue, size_t window, size_t numWriters):
+        queue(queue), window(window), numWriters(numWriters), pending(),
+        next(0), mutex(), moved() {
+
+        // Nothing to do!
+    }
+
+    /**
+     * Put in the thing with the given number, waiting if it is too far ahead
+     * of the next one due. Each number may only be put in once. Must not be
+     * called by a writer that has called close().
+     */
+    void put(size_t number, T value) {
+        if(window == 0) {
+            // Order doesn't matter.
+            queue.enqueue(std::move(value));
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // Wait until there is room in the window for this one.
+        moved.wait(lock, [&]() {
+            return number < next + window;
+        });
+
+        if(number != next) {
+            // Something before this has yet to come. Hold it.
+            pending.emplace(number, std::move(value));
+            return;
+        }
+
+        // This one is due, so send it along with everything held right after
+        // it. Keep the lock while sending, so nothing gets ahead of it.
+        queue.enqueue(std::move(value));
+        next++;
+        for(auto found = pending.find(next); found != pending.end();
+            found = pending.find(next)) {
+
+            queue.enqueue(std::move(found->second));
+            pending.erase(found);
+            next++;
+        }
+
+        // The window moved, so writers waiting on it may be able to go.
+        lock.unlock();
+        moved.notify_all();
+    }
+
+    /**
+     * Close the buffer. Should be called exactly once by each writer the buffer
+     * was told about in the constructor, after which that writer may not put
+     * anything else in. The last writer to close it closes the queue.
+     */
+    void close() {
+        if(numWriters.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Everything has been put in, so it has all gone to the queue.
+            queue.close();
+        }
+    }
+
+protected:
+
+    // Where do things go when it's their turn?
+    BoundedQueue<T>& queue;
+
+    // How far past the next thing due can a thing be held?
+    size_t window;
+
+    // How many writers are writing to the buffer still?
+    std::atomic<size_t> numWriters;
+
+    // Holds the things that came before their turn, by number.
+    std::map<size_t, T> pending;
+
+    // What's the number of the next thing to go into the queue?
+    size_t next;
+
+    // Protects pending and next.
+    std::mutex mutex;
+
+    // Notified when next moves.
+    std::condition_variable moved;
+
+private:
+
+    /**
+     * No copy constructor is allowed.
+     */
+    ReorderBuffer(const ReorderBuffer<T>& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    ReorderBuffer<T>& operator=(const ReorderBuffer<T>& other) = delete;
+
+};
+
+#endif
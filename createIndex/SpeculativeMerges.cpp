@@ -0,0 +1,186 @@
+#include <algorithm>
+
+#include <Log.hpp>
+#include <TaskPool.hpp>
+
+#include "SpeculativeMerges.hpp"
+#include "pinchGraphUtil.hpp"
+
+SpeculativeMerges::SpeculativeMerges(const FMDIndex& index,
+    MappingMergeScheme* scheme, size_t threadCount): index(index),
+    scheme(scheme), windows(),
+    firstContig(index.getGenomeContigs(scheme->getGenome()).first),
+    firstWindows(), nextWindow(0), threads(),
+    errors(std::max(threadCount, (size_t) 1)) {
+
+    // Lay out all the windows up front, so the threads can fill them in
+    // without a lock.
+    auto contigs = index.getGenomeContigs(scheme->getGenome());
+    for(size_t contig = contigs.first; contig < contigs.second; contig++) {
+        firstWindows.push_back(windows.size());
+        for(const auto& window : scheme->getContigWindows(contig)) {
+            windows.push_back(WindowMerges{window, {}, 0, false});
+        }
+    }
+    firstWindows.push_back(windows.size());
+
+    Log::info() << "Speculatively mapping " << windows.size() <<
+        " windows of genome " << scheme->getGenome() << " on " <<
+        errors.size() << " threads" << std::endl;
+
+    for(size_t i = 0; i < errors.size(); i++) {
+        threads.push_back(Thread(&SpeculativeMerges::mapWindows, this, i));
+    }
+}
+
+SpeculativeMerges::~SpeculativeMerges() {
+    for(Thread& thread : threads) {
+        // Don't leave anything running on our windows.
+        thread.join();
+    }
+}
+
+void SpeculativeMerges::join() {
+    for(Thread& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    for(std::exception_ptr& error : errors) {
+        if(error) {
+            // Only throw it once.
+            std::exception_ptr thrown = error;
+            error = nullptr;
+            std::rethrow_exception(thrown);
+        }
+    }
+}
+
+void SpeculativeMerges::mapWindows(size_t thread) {
+    try {
+        for(size_t i = nextWindow++; i < windows.size(); i = nextWindow++) {
+            WindowMerges& merges = windows[i];
+            merges.merged = scheme->mapWindows({merges.window},
+                [&](MergeBatch& batch) {
+
+                // Hold on to the batch until we know if it is any good.
+                merges.batches.push_back(std::move(batch));
+                batch.clear();
+            });
+        }
+    } catch(...) {
+        errors[thread] = std::current_exception();
+    }
+}
+
+size_t SpeculativeMerges::validate(stPinchThreadSet* threadSet,
+    size_t threads) {
+
+    // Windows get handed out to tasks from here.
+    std::atomic<size_t> next(0);
+    // And the bases in the ones that are kept are counted here.
+    std::atomic<size_t> keptBases(0);
+
+    parallelFor(std::max(threads, (size_t) 1), [&](size_t) {
+        for(size_t i = next++; i < windows.size(); i = next++) {
+            WindowMerges& merges = windows[i];
+            size_t length = merges.window.end - merges.window.start;
+
+            // Bases that didn't merge might merge now.
+            merges.kept = merges.merged == length;
+            for(auto batch = merges.batches.begin(); merges.kept &&
+                batch != merges.batches.end(); ++batch) {
+
+                for(auto merge = batch->begin(); merges.kept &&
+                    merge != batch->end(); ++merge) {
+
+                    // Bases merged with things that have since been merged
+                    // into something else would merge differently now.
+                    merges.kept = isStillCanonical(threadSet, merge->second,
+                        merge->length);
+                }
+            }
+
+            if(merges.kept) {
+                keptBases += length;
+            } else {
+                // This window will be mapped again.
+                std::vector<MergeBatch>().swap(merges.batches);
+            }
+        }
+    });
+
+    Log::info() << "Kept speculative merges for " << keptBases <<
+        " bases of genome " << scheme->getGenome() << std::endl;
+
+    return keptBases;
+}
+
+bool SpeculativeMerges::isKept(
+    const MappingMergeScheme::ContigWindow& window) const {
+
+    if(window.contig < firstContig ||
+        window.contig - firstContig + 1 >= firstWindows.size()) {
+
+        // The contig isn't in our genome at all.
+        return false;
+    }
+
+    for(size_t i = firstWindows[window.contig - firstContig];
+        i < firstWindows[window.contig - firstContig + 1]; i++) {
+
+        if(windows[i].window.start == window.start &&
+            windows[i].window.end == window.end) {
+
+            return windows[i].kept;
+        }
+    }
+
+    // The window was cut differently.
+    return false;
+}
+
+void SpeculativeMerges::replay(
+    const std::function<void(MergeBatch&)>& send) const {
+
+    for(const WindowMerges& merges : windows) {
+        if(!merges.kept) {
+            continue;
+        }
+        for(const MergeBatch& batch : merges.batches) {
+            MergeBatch copy(batch);
+            send(copy);
+        }
+    }
+}
+
+bool SpeculativeMerges::isStillCanonical(stPinchThreadSet* threadSet,
+    const TextPosition& start, size_t length) const {
+
+    // Work out the 1-based offsets along the contig that the run covers, on
+    // whichever strand it is on.
+    size_t contig = start.getContigNumber();
+    TextPosition last(start.getText(), start.getOffset() + length - 1);
+    int64_t low = std::min(index.getContigOffset(start),
+        index.getContigOffset(last));
+    int64_t high = std::max(index.getContigOffset(start),
+        index.getContigOffset(last));
+
+    stPinchSegment* segment = stPinchThreadSet_getSegment(threadSet, contig,
+        low);
+    while(segment != NULL && stPinchSegment_getStart(segment) <= high) {
+        // All the bases in a segment have their canonical bases in the same
+        // segment, in the same order. So if one of the run's bases here is
+        // still its own canonical base, they all are.
+        int64_t offset = std::max(stPinchSegment_getStart(segment), low);
+        TextPosition base(start.getText(), start.getStrand() ?
+            index.getContigLength(contig) - offset : offset - 1);
+        if(!(canonicalize(index, threadSet, base) == base)) {
+            return false;
+        }
+
+        segment = stPinchSegment_get3Prime(segment);
+    }
+
+    return true;
+}
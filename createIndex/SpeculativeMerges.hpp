@@ -0,0 +1,146 @@
+#ifndef SPECULATIVEMERGES_HPP
+#define SPECULATIVEMERGES_HPP
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <functional>
+
+#include <stPinchGraphs.h>
+
+#include <FMDIndex.hpp>
+
+#include "MappingMergeScheme.hpp"
+#include "Thread.hpp"
+#include "Merge.hpp"
+
+/**
+ * Maps a genome ahead of time in the greedy merge, against the level the
+ * previous genome is being mapped to, while the previous genome's merges are
+ * still being applied. Once they are, validate() keeps only the windows whose
+ * merges would come out the same against the new level, and a
+ * MappingMergeScheme given the speculation sends their merges instead of
+ * mapping them again.
+ *
+ * A window is kept if every one of its bases merged, and every base it merged
+ * to is still the canonical base of its block. The previous genome's pinches
+ * can only change a window's mappings by adding new places for its contexts
+ * to land, which would have to show up as a base that didn't map, or by
+ * merging what its bases mapped to into something else, which would change
+ * that base's canonical position. The one exception is a context that mapped
+ * uniquely and is now also found in a copy of it from the previous genome
+ * that didn't merge with anything, which would make it ambiguous, but the
+ * previous genome's copy would then almost always have mapped too.
+ *
+ * All the merges found are kept in memory until the genome is merged.
+ */
+class SpeculativeMerges {
+
+public:
+    /**
+     * Start mapping every window of the given scheme's genome, on the given
+     * number of threads of our own. Takes ownership of the scheme, which must
+     * not be run otherwise, and which must be set up to map the genome the way
+     * it will be mapped for real. The mapping scheme it uses must last until
+     * join() has been called.
+     *
+     * The threads aren't on the shared TaskPool, so the work the merge is
+     * waiting on in the meantime never queues up behind them.
+     */
+    SpeculativeMerges(const FMDIndex& index, MappingMergeScheme* scheme,
+        size_t threads);
+
+    /**
+     * Wait for the mapping threads, if they are still running.
+     */
+    ~SpeculativeMerges();
+
+    /**
+     * Wait for all the windows to be mapped, and rethrow anything the mapping
+     * threads threw.
+     */
+    void join();
+
+    /**
+     * Throw out the windows whose merges may have been changed by the merges
+     * applied to the given pinch graph since mapping started, as described for
+     * the class, checking them on up to the given number of tasks on the
+     * shared TaskPool. Must be called after join(), and while the graph is not
+     * being changed. Returns the number of bases in windows that are kept.
+     */
+    size_t validate(stPinchThreadSet* threadSet, size_t threads);
+
+    /**
+     * Are the given window's merges known? Must be called after validate().
+     */
+    bool isKept(const MappingMergeScheme::ContigWindow& window) const;
+
+    /**
+     * Send the merges of all the kept windows to the given function, which
+     * must leave each batch empty. Must be called after validate().
+     */
+    void replay(const std::function<void(MergeBatch&)>& send) const;
+
+protected:
+    /**
+     * Represents what a window mapped to.
+     */
+    struct WindowMerges {
+        // Which window was it?
+        MappingMergeScheme::ContigWindow window;
+        // Holds the batches of merges it made.
+        std::vector<MergeBatch> batches;
+        // How many of its bases merged?
+        size_t merged;
+        // Are its merges still good?
+        bool kept;
+    };
+
+    /**
+     * Run as a thread with the given number. Maps windows until there are no
+     * more.
+     */
+    void mapWindows(size_t thread);
+
+    /**
+     * Is the given base, mapped to before the latest merges, still the
+     * canonical base for every base in the run of the given length that
+     * starts there?
+     */
+    bool isStillCanonical(stPinchThreadSet* threadSet,
+        const TextPosition& start, size_t length) const;
+
+    // What index is being merged?
+    const FMDIndex& index;
+
+    // Holds the scheme we map with.
+    std::unique_ptr<MappingMergeScheme> scheme;
+
+    // Holds the windows and what they mapped to, in the order the scheme cut
+    // them up, so each contig's windows are together and in order.
+    std::vector<WindowMerges> windows;
+
+    // What is the first contig of the genome?
+    size_t firstContig;
+
+    // Where does each contig's first window go? Indexed by contig number minus
+    // the genome's first contig, with an extra entry past the last contig.
+    std::vector<size_t> firstWindows;
+
+    // Which window is the next to be mapped?
+    std::atomic<size_t> nextWindow;
+
+    // Holds the mapping threads.
+    std::vector<Thread> threads;
+
+    // Holds anything each thread threw.
+    std::vector<std::exception_ptr> errors;
+
+private:
+    // Speculative merges own threads, so they can't be copied.
+    SpeculativeMerges(const SpeculativeMerges& other) = delete;
+    SpeculativeMerges& operator=(const SpeculativeMerges& other) = delete;
+};
+
+#endif
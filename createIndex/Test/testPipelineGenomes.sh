@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# testPipelineGenomes.sh: make sure merging with --pipelineGenomes uses the
+# merges it worked out ahead of time, and comes out with the same alignment as
+# merging one genome after another.
+set -e
+
+# Work from the createIndex directory, wherever we were run from.
+cd "$(dirname "$0")/.."
+
+WORK=$(mktemp -d)
+trap "rm -rf ${WORK}" EXIT
+
+# Use three genomes, so the third gets mapped ahead of time while the second
+# is merged in. The third is a copy of the first, so nearly all of it maps.
+cp ../libFMD/Test/haplotypes.fa ${WORK}/copy.fa
+FASTAS="../libFMD/Test/haplotypes.fa ../libFMD/Test/duplicated.fa \
+${WORK}/copy.fa"
+
+./createIndex ${WORK}/serial ${FASTAS} \
+    --alignment ${WORK}/serial.c2h > ${WORK}/serial.log 2>&1
+./createIndex ${WORK}/pipelined ${FASTAS} --pipelineGenomes \
+    --alignment ${WORK}/pipelined.c2h > ${WORK}/pipelined.log 2>&1
+
+if ! grep -q "Kept speculative merges for [1-9][0-9]* bases of genome 2" \
+    ${WORK}/pipelined.log; then
+    
+    echo "FAIL: no speculative merges were kept for genome 2"
+    exit 1
+fi
+
+# The merges get applied in whatever order the threads finish in, so compare
+# the alignment lines without caring about order.
+if ! cmp -s <(sort ${WORK}/serial.c2h) <(sort ${WORK}/pipelined.c2h); then
+    echo "FAIL: pipelined alignment differs from serial alignment"
+    diff <(sort ${WORK}/serial.c2h) <(sort ${WORK}/pipelined.c2h) | head -20
+    exit 1
+fi
+
+echo "OK: pipelined merge matches serial merge"
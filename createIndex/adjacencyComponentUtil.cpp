@@ -1,24 +1,33 @@
 #include "adjacencyComponentUtil.hpp"
 #include <Log.hpp>
+#include <TaskPool.hpp>
 
 // Pull in VFLib for graph matching, to deduplicate isomorphic components.
 #include <argraph.h>
 #include <argedit.h>
-#include <vf2_sub_state.h>
+#include <vf2_state.h>
+#include <match.h>
 
 #include <algorithm>
 #include <unordered_set>
+#include <unordered_map>
 #include <fstream>
+#include <tuple>
+#include <atomic>
+#include <mutex>
+#include <exception>
 
-std::vector<std::vector<stPinchEnd>> 
-getAdjacencyComponents(
+FlatAdjacencyComponents
+getFlatAdjacencyComponents(
     stPinchThreadSet* threadSet
 ) {
 
     Log::info() << "Making adjacency component list..." << std::endl;
 
-    // Make an empty vector of components to populate.
-    std::vector<std::vector<stPinchEnd>> toReturn;
+    // Make an empty set of components to populate. It starts with just the
+    // start of the (nonexistent) first component.
+    FlatAdjacencyComponents toReturn;
+    toReturn.starts.push_back(0);
     
     // Get all the adjacency components.
     stList* adjacencyComponents = stPinchThreadSet_getAdjacencyComponents(
@@ -32,9 +41,6 @@ getAdjacencyComponents(
     
     while(component != NULL) {
         
-        // Make a vector to hold the ends in the component.
-        std::vector<stPinchEnd> ends;
-        
         // Get an iterator over its contents
         stListIterator* endIterator = stList_getIterator(component);
         
@@ -44,16 +50,16 @@ getAdjacencyComponents(
         while(pinchEnd != NULL) {
             // For each pinch end in the component
             
-            Log::trace() << LOG_LAZY("Observed end " << pinchEnd << 
+            LOG_TRACE("Observed end " << pinchEnd << 
                 " of block " << stPinchEnd_getBlock(pinchEnd) << 
                 " of degree " << 
                 stPinchBlock_getDegree(stPinchEnd_getBlock(pinchEnd)) << 
                 std::endl);
             
-            // Put it in the vector that represents the component. Make sure to
+            // Put it after the ends of the components before. Make sure to
             // copy it since the actual ends pointed to here get destroyed when
             // the list we're iterating over does.
-            ends.push_back(*pinchEnd);
+            toReturn.ends.push_back(*pinchEnd);
         
             // Look at the next end
             pinchEnd = (stPinchEnd*) stList_getNext(endIterator);
@@ -62,8 +68,8 @@ getAdjacencyComponents(
         // Clean up the iterator
         stList_destructIterator(endIterator);
         
-        // Put this component in the vector of all components.
-        toReturn.push_back(std::move(ends));
+        // Close off this component.
+        toReturn.starts.push_back(toReturn.ends.size());
         
         // Look at the next component
         component = (stList*) stList_getNext(componentIterator);
@@ -75,6 +81,27 @@ getAdjacencyComponents(
     // And the entire list while we're at it
     stList_destruct(adjacencyComponents);
     
+    // Give back the flat data structure
+    return toReturn;
+
+}
+
+std::vector<std::vector<stPinchEnd>> 
+getAdjacencyComponents(
+    stPinchThreadSet* threadSet
+) {
+
+    // Get all the components together.
+    FlatAdjacencyComponents flat = getFlatAdjacencyComponents(threadSet);
+
+    // Split them out into their own vectors.
+    std::vector<std::vector<stPinchEnd>> toReturn;
+    toReturn.reserve(flat.size());
+    for(size_t i = 0; i < flat.size(); i++) {
+        toReturn.emplace_back(flat.getEnds(i),
+            flat.getEnds(i) + flat.getSize(i));
+    }
+    
     // Give back the converted data structure
     return toReturn;
 
@@ -137,7 +164,7 @@ getAllPaths(
     stPinchEnd* end
 ) {
     
-    Log::debug() << LOG_LAZY("Getting all paths from block " << 
+    LOG_DEBUG("Getting all paths from block " << 
         stPinchEnd_getBlock(start) << " orientation " << 
         stPinchEnd_getOrientation(start) << " to block " << 
         stPinchEnd_getBlock(end) << " orientation " << 
@@ -164,7 +191,7 @@ getAllPaths(
         // Keep track of the direction we are going. 0 is forwards.
         bool direction = stPinchEnd_getOrientation(start);
         
-        Log::trace() << LOG_LAZY("Starting direction " << direction <<
+        LOG_TRACE("Starting direction " << direction <<
             " from segment " << startSegment <<  " in block " << 
             stPinchEnd_getBlock(start) << std::endl);
         
@@ -195,7 +222,7 @@ getAllPaths(
             // We know segments are connected 5' to 3' along a whole thread, so
             // we never need to change direction.
             
-            Log::trace() << LOG_LAZY("Visiting segment " << segment << 
+            LOG_TRACE("Visiting segment " << segment << 
                 " orientation " << segmentOrientation << " in block " << 
                 stPinchSegment_getBlock(segment) << std::endl);
             
@@ -215,7 +242,7 @@ getAllPaths(
                 // Keep our path.
                 toReturn.push_back(path);
                 
-                Log::debug() << LOG_LAZY("Path finished successfully with " << 
+                LOG_DEBUG("Path finished successfully with " << 
                     path.size() << " segments" << std::endl);
                 
                 // Stop this path.
@@ -237,6 +264,331 @@ getAllPaths(
 
 }
 
+
+/**
+ * Work out the indel length for a size 2 adjacency component, if it is a simple
+ * indel. Returns true and sets length if it is, and false if it should be
+ * skipped.
+ */
+static bool
+getIndelLength(
+    stPinchEnd* component,
+    int64_t& length
+) {
+    
+    if(stPinchBlock_getDegree(stPinchEnd_getBlock(&component[0])) != 2 ||
+        stPinchBlock_getDegree(stPinchEnd_getBlock(&component[1])) != 2) {
+        // If there aren't exactly two segments on both ends, this isn't a
+        // nice simple indel/substitution. Skip it.
+        
+        Log::error() << "Skipping component; Degrees are " << 
+            stPinchBlock_getDegree(stPinchEnd_getBlock(&component[0])) << 
+            " and " << 
+            stPinchBlock_getDegree(stPinchEnd_getBlock(&component[1])) << 
+            std::endl;
+        return false;
+        
+        // TODO: account for ends of contigs lining up across from things
+        // and having no paths across.
+    }
+    
+    // Get two paths of 0 or more segments
+    std::vector<std::vector<stPinchSegment*>> paths = 
+        getAllPaths(&component[0], &component[1]);
+        
+    if(paths.size() != 2) {
+        // This isn't just an indel. It might be an indel within a
+        // duplication, or an indel for one out of a set of merged genomes,
+        // but without just 2 paths we can't really define indel length.
+        // TODO: Handle the case where all paths but one are one length, and
+        // one is another length.
+        Log::error() << "Skipping component; got " << paths.size() << 
+            " paths instead of 2" << std::endl;
+        return false;
+    }
+    
+    // Keep the length of the segments on each path. There will always be 2
+    // paths.
+    std::vector<int64_t> pathLengths;
+    
+    for(auto path : paths) {
+        // For each path, we want to track the length
+        int64_t pathLength = 0;
+        for(size_t i = 0; i < path.size(); i++) {
+            // Add in each segment
+            pathLength += stPinchSegment_getLength(path[i]);
+            
+            if(stPinchSegment_getLength(path[i]) > 100000000000000) {
+                // I saw some pretty wrong indel lengths.
+                throw std::runtime_error("Segment stupidly long");
+            }
+        }
+        
+        LOG_DEBUG("Path length: " << pathLength << std::endl);
+        
+        // Record the length of this path.
+        pathLengths.push_back(pathLength);
+    }
+    
+    if(pathLengths[0] < 0 || pathLengths[1] < 0) {
+        // Maybe wrong indel lengths are from negative path lengths?
+        throw std::runtime_error("Negative length path");
+    }
+    
+    if(pathLengths[0] > 100000000000000 || 
+        pathLengths[1] > 100000000000000) {
+        // Maybe wrong indel lengths are from huge path lengths?
+        throw std::runtime_error("Path stupidly long");
+    }
+    
+    if(pathLengths[0] > pathLengths[1]) {
+        // This is the way the indel goes
+        length = pathLengths[0] - pathLengths[1];
+    } else {
+        // It goes the other way around.
+        length = pathLengths[1] - pathLengths[0];
+    }
+    
+    return true;
+
+}
+
+/**
+ * Decide if the given adjacency component, with the given number of ends, is a
+ * tandem duplication: if two of its ends belong to the same block and are
+ * connected.
+ */
+static bool
+isTandemDuplication(
+    stPinchEnd* component,
+    size_t size
+) {
+
+    // Is this component a tandem duplication?
+    bool isTandem = false;
+
+    for(size_t i = 0; i < size; i++) {
+        // Go through all the ends
+        stPinchEnd end1 = component[i];
+        
+        LOG_DEBUG("End " << stPinchEnd_getOrientation(&end1) << 
+            " of block " << stPinchEnd_getBlock(&end1) << std::endl);
+        
+        for(size_t j = 0; j < i; j++) {
+            // And all the other ends
+            stPinchEnd end2 = component[j];
+            
+            if(stPinchEnd_getBlock(&end1) == stPinchEnd_getBlock(&end2)) {
+                // We have two ends that share a block.
+                
+                LOG_DEBUG("We have two ends of block " << 
+                    stPinchEnd_getBlock(&end1) << std::endl);
+                
+                // Get the ends attached to end 1
+                stSet* connectedEnds = 
+                    stPinchEnd_getConnectedPinchEnds(&end1);
+                    
+                // These ends are in there by address, so we have to scan
+                // for ours.
+                
+                // Get an iterator over the set.
+                stSetIterator* iterator = stSet_getIterator(connectedEnds);
+                
+                stPinchEnd* other = (stPinchEnd*) stSet_getNext(iterator);
+                while(other != NULL) {
+                    // Go through all the things attached to end1
+                    
+                    LOG_DEBUG("Connection to block " << 
+                        stPinchEnd_getBlock(other) << " end " << 
+                        stPinchEnd_getOrientation(other) << std::endl);
+                    
+                    if(stPinchEnd_getBlock(other) == 
+                        stPinchEnd_getBlock(&end2) && 
+                        stPinchEnd_getOrientation(other) == 
+                        stPinchEnd_getOrientation(&end2)) {
+                        
+                        LOG_DEBUG("...which counts!" << std::endl);
+                        
+                        // This end that the first end is connected to looks
+                        // exactly like the second end. Call this a tandem
+                        // duplication.
+                        isTandem = true;
+                        
+                        // TODO: Break out of like 3 loops now, so we don't
+                        // check all the other end pairs or somehow call two
+                        // tandem duplications in one component.
+                        
+                    } else {
+                        LOG_DEBUG("...which isn't block " << 
+                            stPinchEnd_getBlock(&end2) << " end " << 
+                            stPinchEnd_getOrientation(&end2) << std::endl);
+                    }
+                                            
+                    other = (stPinchEnd*) stSet_getNext(iterator);
+                }
+                
+                // Clean up the iterator
+                stSet_destructIterator(iterator);
+                    
+                // Clean up our connected ends set.
+                stSet_destruct(connectedEnds);
+            }
+        }
+    }
+    
+    return isTandem;
+
+}
+
+/**
+ * Report the blocks of an adjacency component that isn't a tandem duplication.
+ */
+static void
+reportNonTandemDuplication(
+    stPinchEnd* component,
+    size_t size
+) {
+
+    Log::output() << "Non-tandem-duplication: " << std::endl;
+    
+    for(size_t i = 0; i < size; i++) {
+        // Go through all the ends
+        stPinchEnd end1 = component[i];
+        
+        // Get the block for each
+        stPinchBlock* block = stPinchEnd_getBlock(&end1);
+        
+        // And a segment for the block
+        stPinchSegment* segment = stPinchBlock_getFirst(block);
+        
+        // Report the block (already done 1-based I think?)
+        Log::output() << "\t" << stPinchSegment_getStart(segment) <<
+            "-" << stPinchSegment_getStart(segment) + 
+            stPinchSegment_getLength(segment) - 1 << " thread #" << 
+            stPinchThread_getName(stPinchSegment_getThread(segment)) <<
+            std::endl;
+    }
+
+}
+
+/**
+ * Write the given adjacency component, with the given number of ends, to the
+ * given stream.
+ */
+static void
+writeAdjacencyComponent(
+    std::ostream& out,
+    stPinchEnd* component,
+    size_t size
+) {
+    out << "Component size " << size << ":" << std::endl;
+    
+    // Make a set of involved blocks.
+    std::unordered_set<stPinchBlock*> blocks;
+    
+    for(size_t i = 0; i < size; i++) {
+        stPinchEnd end = component[i];
+
+        // Get and store the block the end belongs to
+        auto block = stPinchEnd_getBlock(&end);
+        blocks.insert(block);
+        
+        // Get the segment the end belongs to
+        auto segment = stPinchBlock_getFirst(block);
+        
+        // Name it. Remember threads are already 1-based.
+        std::string segmentName =
+            std::to_string(stPinchSegment_getStart(segment)) +
+             "-" + std::to_string(stPinchSegment_getStart(segment) + 
+             stPinchSegment_getLength(segment) - 1);
+        
+        // And get which end we're on
+        char endName = stPinchEnd_getOrientation(&end) ? 'R' : 'L';
+        
+        // Report the coordinates of that end's block on the reference
+        out << "\t" << segmentName << " " << endName << " on thread #" << 
+            stPinchThread_getName(stPinchSegment_getThread(segment)) <<
+            std::endl;
+        
+    }
+    
+    // Do some graphviz
+    out << "\tgraph {" << std::endl;
+    
+    for(auto block : blocks) {
+        // Get the segment the end belongs to
+        auto segment = stPinchBlock_getFirst(block);
+        
+        // Go through all the segments in the block in total
+        stPinchBlockIt iterator = stPinchBlock_getSegmentIterator(block);
+        // And count up the number of them
+        size_t count = 0;
+        while(stPinchBlockIt_getNext(&iterator) != NULL) {
+            count++;
+        }
+        
+        // Make an edge with the info from the first segment, annotated with
+        // copy number
+        out << "\t\t{rank=same; n" <<
+            (stPinchSegment_getStart(segment)) << "L -- n" <<
+            std::to_string(stPinchSegment_getStart(segment) + 
+            stPinchSegment_getLength(segment)) << 
+            "R[color=blue,label=\"" << count << "\"];}" << std::endl;
+        
+    }
+    
+    for(size_t i = 0; i < size; i++) {
+        stPinchEnd end = component[i];
+
+        // Get the block and segment
+        auto block = stPinchEnd_getBlock(&end);
+        auto segment = stPinchBlock_getFirst(block);
+        
+        // Pick left end L or right end R to represent this end
+        std::string node = stPinchEnd_getOrientation(&end) ? 
+            std::to_string(stPinchSegment_getStart(segment)) + "L" :
+            std::to_string(stPinchSegment_getStart(segment) + 
+            stPinchSegment_getLength(segment) - 1) + "R";
+        
+        // Go through all the other ends and connect them to this one
+        stSet* otherEnds = stPinchEnd_getConnectedPinchEnds(&end);
+        
+        // Make an iterator to loop over all the other ends we connect to.
+        stSetIterator* iterator = stSet_getIterator(otherEnds); 
+        
+        stPinchEnd* otherEnd = (stPinchEnd*) stSet_getNext(iterator);
+        while(otherEnd != NULL) {
+            // For each other end
+            
+            // Get the block and segment
+            auto otherBlock = stPinchEnd_getBlock(otherEnd);
+            auto otherSegment = stPinchBlock_getFirst(otherBlock);
+            
+            // Pick left end L or right end R to represent this other end
+            std::string otherNode = stPinchEnd_getOrientation(otherEnd) ? 
+                std::to_string(stPinchSegment_getStart(otherSegment)) +
+                "L" : std::to_string(stPinchSegment_getStart(otherSegment) +
+                stPinchSegment_getLength(otherSegment) - 1) + "R";
+            
+            if(node < otherNode) {
+                // Only draw these edges going in one direction, so copy
+                // number represents actual copy number.
+                out << "\t\tn" << node << " -- n" << otherNode << 
+                    "[color=red];" << std::endl;
+            }
+            
+            otherEnd = (stPinchEnd*) stSet_getNext(iterator);
+        }
+
+
+        // Clean up sonLib stuff            
+        stSet_destructIterator(iterator);
+        stSet_destruct(otherEnds);
+    }
+    
+    out << "\t}" << std::endl;
+}
+
 std::vector<int64_t>
 getIndelLengths(
     const std::vector<std::vector<stPinchEnd>>& components
@@ -258,77 +610,10 @@ getIndelLengths(
                 std::to_string(component.size()) + " for an indel.");
         }
         
-        if(stPinchBlock_getDegree(stPinchEnd_getBlock(&component[0])) != 2 ||
-            stPinchBlock_getDegree(stPinchEnd_getBlock(&component[1])) != 2) {
-            // If there aren't exactly two segments on both ends, this isn't a
-            // nice simple indel/substitution. Skip it.
-            
-            Log::error() << "Skipping component; Degrees are " << 
-                stPinchBlock_getDegree(stPinchEnd_getBlock(&component[0])) << 
-                " and " << 
-                stPinchBlock_getDegree(stPinchEnd_getBlock(&component[1])) << 
-                std::endl;
-            continue;
-            
-            // TODO: account for ends of contigs lining up across from things
-            // and having no paths across.
-        }
-        
-        // Get two paths of 0 or more segments
-        std::vector<std::vector<stPinchSegment*>> paths = 
-            getAllPaths(&component[0], &component[1]);
-            
-        if(paths.size() != 2) {
-            // This isn't just an indel. It might be an indel within a
-            // duplication, or an indel for one out of a set of merged genomes,
-            // but without just 2 paths we can't really define indel length.
-            // TODO: Handle the case where all paths but one are one length, and
-            // one is another length.
-            Log::error() << "Skipping component; got " << paths.size() << 
-                " paths instead of 2" << std::endl;
-            continue;
-        }
-        
-        // Keep the length of the segments on each path. There will always be 2
-        // paths.
-        std::vector<int64_t> pathLengths;
-        
-        for(auto path : paths) {
-            // For each path, we want to track the length
-            int64_t pathLength = 0;
-            for(size_t i = 0; i < path.size(); i++) {
-                // Add in each segment
-                pathLength += stPinchSegment_getLength(path[i]);
-                
-                if(stPinchSegment_getLength(path[i]) > 100000000000000) {
-                    // I saw some pretty wrong indel lengths.
-                    throw std::runtime_error("Segment stupidly long");
-                }
-            }
-            
-            Log::debug() << "Path length: " << pathLength << std::endl;
-            
-            // Record the length of this path.
-            pathLengths.push_back(pathLength);
-        }
-        
-        if(pathLengths[0] < 0 || pathLengths[1] < 0) {
-            // Maybe wrong indel lengths are from negative path lengths?
-            throw std::runtime_error("Negative length path");
-        }
-        
-        if(pathLengths[0] > 100000000000000 || 
-            pathLengths[1] > 100000000000000) {
-            // Maybe wrong indel lengths are from huge path lengths?
-            throw std::runtime_error("Path stupidly long");
-        }
-        
-        if(pathLengths[0] > pathLengths[1]) {
-            // This is the way the indel goes
-            toReturn.push_back(pathLengths[0] - pathLengths[1]);
-        } else {
-            // It goes the other way around.
-            toReturn.push_back(pathLengths[1] - pathLengths[0]);
+        int64_t length;
+        if(getIndelLength(&component[0], length)) {
+            // It's a simple indel, so keep its length.
+            toReturn.push_back(length);
         }
     }
     
@@ -349,104 +634,13 @@ countTandemDuplications(
 
     for(auto component : components) {
         // Is this component a tandem duplication?
-        bool isTandem = false;
-    
-        for(size_t i = 0; i < component.size(); i++) {
-            // Go through all the ends
-            stPinchEnd end1 = component[i];
-            
-            Log::debug() << "End " << stPinchEnd_getOrientation(&end1) << 
-                " of block " << stPinchEnd_getBlock(&end1) << std::endl;
-            
-            for(size_t j = 0; j < i; j++) {
-                // And all the other ends
-                stPinchEnd end2 = component[j];
-                
-                if(stPinchEnd_getBlock(&end1) == stPinchEnd_getBlock(&end2)) {
-                    // We have two ends that share a block.
-                    
-                    Log::debug() << "We have two ends of block " << 
-                        stPinchEnd_getBlock(&end1) << std::endl;
-                    
-                    // Get the ends attached to end 1
-                    stSet* connectedEnds = 
-                        stPinchEnd_getConnectedPinchEnds(&end1);
-                        
-                    // These ends are in there by address, so we have to scan
-                    // for ours.
-                    
-                    // Get an iterator over the set.
-                    stSetIterator* iterator = stSet_getIterator(connectedEnds);
-                    
-                    stPinchEnd* other = (stPinchEnd*) stSet_getNext(iterator);
-                    while(other != NULL) {
-                        // Go through all the things attached to end1
-                        
-                        Log::debug() << "Connection to block " << 
-                            stPinchEnd_getBlock(other) << " end " << 
-                            stPinchEnd_getOrientation(other) << std::endl;
-                        
-                        if(stPinchEnd_getBlock(other) == 
-                            stPinchEnd_getBlock(&end2) && 
-                            stPinchEnd_getOrientation(other) == 
-                            stPinchEnd_getOrientation(&end2)) {
-                            
-                            Log::debug() << "...which counts!" << std::endl;
-                            
-                            // This end that the first end is connected to looks
-                            // exactly like the second end. Call this a tandem
-                            // duplication.
-                            isTandem = true;
-                            
-                            // TODO: Break out of like 3 loops now, so we don't
-                            // check all the other end pairs or somehow call two
-                            // tandem duplications in one component.
-                            
-                        } else {
-                            Log::debug() << "...which isn't block " << 
-                                stPinchEnd_getBlock(&end2) << " end " << 
-                                stPinchEnd_getOrientation(&end2) << std::endl;
-                        }
-                                                
-                        other = (stPinchEnd*) stSet_getNext(iterator);
-                    }
-                    
-                    // Clean up the iterator
-                    stSet_destructIterator(iterator);
-                        
-                    // Clean up our connected ends set.
-                    stSet_destruct(connectedEnds);
-                }
-            }
-        }
+        bool isTandem = isTandemDuplication(&component[0], component.size());
         
-        // Now we know if the component is a tandem duplication or not. Add to
-        // the sum if applicable.
+        // Add to the sum if applicable.
         tandemDuplications += isTandem;
         
         if(!isTandem) {
-            Log::output() << "Non-tandem-duplication: " << std::endl;
-            
-            for(size_t i = 0; i < component.size(); i++) {
-                // Go through all the ends
-                stPinchEnd end1 = component[i];
-                
-                // Get the block for each
-                stPinchBlock* block = stPinchEnd_getBlock(&end1);
-                
-                // And a segment for the block
-                stPinchSegment* segment = stPinchBlock_getFirst(block);
-                
-                // Report the block (already done 1-based I think?)
-                Log::output() << "\t" << stPinchSegment_getStart(segment) <<
-                    "-" << stPinchSegment_getStart(segment) + 
-                    stPinchSegment_getLength(segment) - 1 << " thread #" << 
-                    stPinchThread_getName(stPinchSegment_getThread(segment)) <<
-                    std::endl;
-                
-                
-            }
-            
+            reportNonTandemDuplication(&component[0], component.size());
         }
         
     }
@@ -468,217 +662,463 @@ writeAdjacencyComponents(
     std::ofstream out(filename);
 
     for(auto component: components) {
-        out << "Component size " << component.size() << ":" << std::endl;
-        
-        // For each component, make a set of involved blocks.
-        std::unordered_set<stPinchBlock*> blocks;
-        
-        for(auto end : component) {
-            // Get and store the block the end belongs to
-            auto block = stPinchEnd_getBlock(&end);
-            blocks.insert(block);
-            
-            // Get the segment the end belongs to
-            auto segment = stPinchBlock_getFirst(block);
-            
-            // Name it. Remember threads are already 1-based.
-            std::string segmentName =
-                std::to_string(stPinchSegment_getStart(segment)) +
-                 "-" + std::to_string(stPinchSegment_getStart(segment) + 
-                 stPinchSegment_getLength(segment) - 1);
-            
-            // And get which end we're on
-            char endName = stPinchEnd_getOrientation(&end) ? 'R' : 'L';
-            
-            // Report the coordinates of that end's block on the reference
-            out << "\t" << segmentName << " " << endName << " on thread #" << 
-                stPinchThread_getName(stPinchSegment_getThread(segment)) <<
-                std::endl;
+        writeAdjacencyComponent(out, &component[0], component.size());
+    }
+    
+    // Close up
+    out.close();
+}
+
+void
+writeAdjacencyComponents(
+    FlatAdjacencyComponents& components,
+    const std::vector<size_t>& which,
+    const std::string& filename
+) {
+    // Open file for writing
+    std::ofstream out(filename);
+
+    for(size_t component : which) {
+        writeAdjacencyComponent(out, components.getEnds(component),
+            components.getSize(component));
+    }
+    
+    // Close up
+    out.close();
+}
+
+AdjacencyAnalysis
+analyzeAdjacencyComponents(
+    stPinchThreadSet* threadSet,
+    bool spectrum,
+    bool indelLengths,
+    bool tandemDuplications,
+    bool nontrivial,
+    size_t threads
+) {
+
+    AdjacencyAnalysis toReturn;
+    toReturn.tandemDuplications = 0;
+    
+    // Pull out all the components once.
+    toReturn.components = getFlatAdjacencyComponents(threadSet);
+    FlatAdjacencyComponents& components = toReturn.components;
+    
+    Log::info() << "Analyzing " << components.size() << 
+        " adjacency components on " << threads << " threads..." << std::endl;
+    
+    /**
+     * Holds what we found out from one run of components.
+     */
+    struct Partial {
+        std::map<size_t, size_t> spectrum;
+        std::vector<int64_t> indelLengths;
+        size_t tandemDuplications = 0;
+        std::vector<size_t> nontrivial;
+        // Which size 4 components weren't tandem duplications?
+        std::vector<size_t> nonTandem;
+    };
+    
+    // Split the components into runs, to be handed out to threads as they are
+    // free. Since components vary a lot in how long they take to analyze, we
+    // want many more runs than threads. Results are kept per run so they can
+    // be put back together in order.
+    static const size_t RUN_LENGTH = 1024;
+    std::vector<Partial> partials((components.size() + RUN_LENGTH - 1) /
+        RUN_LENGTH);
+    std::atomic<size_t> nextRun(0);
+    
+    // Threads save the first thing that goes wrong.
+    std::exception_ptr error;
+    std::mutex errorLock;
+    
+    auto analyze = [&]() {
+        size_t run;
+        while((run = nextRun++) < partials.size()) {
+            Partial& partial = partials[run];
+            size_t end = std::min((run + 1) * RUN_LENGTH, components.size());
             
+            try {
+                for(size_t i = run * RUN_LENGTH; i < end; i++) {
+                    stPinchEnd* ends = components.getEnds(i);
+                    size_t size = components.getSize(i);
+                    
+                    if(spectrum) {
+                        partial.spectrum[size]++;
+                    }
+                    
+                    int64_t length;
+                    if(indelLengths && size == 2 &&
+                        getIndelLength(ends, length)) {
+                        
+                        partial.indelLengths.push_back(length);
+                    }
+                    
+                    if(tandemDuplications && size == 4) {
+                        if(isTandemDuplication(ends, size)) {
+                            partial.tandemDuplications++;
+                        } else {
+                            partial.nonTandem.push_back(i);
+                        }
+                    }
+                    
+                    if(nontrivial && size > 2) {
+                        partial.nontrivial.push_back(i);
+                    }
+                }
+            } catch(...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+    
+    parallelFor(std::max(threads, (size_t) 1), [&](size_t) {
+        analyze();
+    });
+    
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    
+    // Put the runs back together in order.
+    for(auto& partial : partials) {
+        for(auto& kv : partial.spectrum) {
+            toReturn.spectrum[kv.first] += kv.second;
         }
+        toReturn.indelLengths.insert(toReturn.indelLengths.end(),
+            partial.indelLengths.begin(), partial.indelLengths.end());
+        toReturn.tandemDuplications += partial.tandemDuplications;
+        toReturn.nontrivial.insert(toReturn.nontrivial.end(),
+            partial.nontrivial.begin(), partial.nontrivial.end());
         
-        // Do some graphviz
-        out << "\tgraph {" << std::endl;
+        for(size_t i : partial.nonTandem) {
+            // Report these here, so reports don't get mixed up between
+            // threads.
+            reportNonTandemDuplication(components.getEnds(i),
+                components.getSize(i));
+        }
+    }
+    
+    if(tandemDuplications) {
+        Log::info() << "Counted " << toReturn.tandemDuplications <<
+            " duplications" << std::endl;
+    }
+    
+    return toReturn;
+
+}
+
+/**
+ * Represents an adjacency component as a plain graph on the indexes of its
+ * ends, so it can be hashed and compared without touching the pinch graph.
+ */
+struct ComponentGraph {
+    // How many ends (nodes) are there?
+    size_t nodeCount;
+    // Holds each undirected edge once, as (lower node, higher node, type).
+    std::vector<std::tuple<size_t, size_t, int>> edges;
+};
+
+// Edges can be sequence edges between the two ends of a block, adjacency edges
+// between connected ends, or both at once. We put pointers to these on the
+// vflib graph edges.
+static int SEQUENCE_EDGE = 0;
+static int ADJACENCY_EDGE = 1;
+static int BOTH_EDGES = 2;
+
+/**
+ * Compare vflib edges by the type they point to.
+ */
+class EdgeTypeComparator: public AttrComparator {
+public:
+    virtual bool compatible(void* a, void* b) {
+        return *(int*) a == *(int*) b;
+    }
+};
+
+/**
+ * Get the edges of the given adjacency component.
+ */
+static ComponentGraph
+makeComponentGraph(
+    const std::vector<stPinchEnd>& component
+) {
+    
+    ComponentGraph graph;
+    graph.nodeCount = component.size();
+    
+    // We need this map to keep track of which indexes are used for which pinch
+    // ends. Pinch ends are pretty simple, so we make an inline lambda
+    // comparison function and pass it to our map constructor.
+    typedef std::map<stPinchEnd, size_t,
+        std::function<bool(const stPinchEnd&, const stPinchEnd&)>> EndMap;
+    EndMap endToIndex([](const stPinchEnd& a, const stPinchEnd& b) {
+        return a.block < b.block ||
+            (a.block == b.block && a.orientation < b.orientation);
+    });
+    for(size_t i = 0; i < component.size(); i++) {
+        endToIndex[component[i]] = i;
+    }
+    
+    // Collect edge types by node pair, so an edge that is both a sequence and
+    // an adjacency edge comes out once.
+    std::map<std::pair<size_t, size_t>, int> types;
+    auto addEdge = [&](size_t a, size_t b, int type) {
+        auto key = std::make_pair(std::min(a, b), std::max(a, b));
+        auto found = types.find(key);
+        if(found == types.end()) {
+            types[key] = type;
+        } else if(found->second != type) {
+            found->second = BOTH_EDGES;
+        }
+    };
+    
+    for(size_t i = 0; i < component.size(); i++) {
+        // The other end of this end's block is joined by a sequence edge, if
+        // it is in the component.
+        stPinchEnd otherSide = component[i];
+        otherSide.orientation = !otherSide.orientation;
+        auto found = endToIndex.find(otherSide);
+        if(found != endToIndex.end()) {
+            addEdge(i, found->second, SEQUENCE_EDGE);
+        }
         
-        for(auto block : blocks) {
-            // Get the segment the end belongs to
-            auto segment = stPinchBlock_getFirst(block);
-            
-            // Go through all the segments in the block in total
-            stPinchBlockIt iterator = stPinchBlock_getSegmentIterator(block);
-            // And count up the number of them
-            size_t count = 0;
-            while(stPinchBlockIt_getNext(&iterator) != NULL) {
-                count++;
+        // Go through all the other ends connected to this one. We need to pass
+        // a non-const pointer.
+        stPinchEnd endCopy = component[i];
+        stSet* otherEnds = stPinchEnd_getConnectedPinchEnds(&endCopy);
+        stSetIterator* iterator = stSet_getIterator(otherEnds); 
+        
+        stPinchEnd* otherEnd;
+        while((otherEnd = (stPinchEnd*) stSet_getNext(iterator)) != NULL) {
+            found = endToIndex.find(*otherEnd);
+            if(found != endToIndex.end()) {
+                addEdge(i, found->second, ADJACENCY_EDGE);
             }
-            
-            // Make an edge with the info from the first segment, annotated with
-            // copy number
-            out << "\t\t{rank=same; n" <<
-                (stPinchSegment_getStart(segment)) << "L -- n" <<
-                std::to_string(stPinchSegment_getStart(segment) + 
-                stPinchSegment_getLength(segment)) << 
-                "R[color=blue,label=\"" << count << "\"];}" << std::endl;
-            
         }
         
-        for(auto end : component) {
-            // Get the block and segment
-            auto block = stPinchEnd_getBlock(&end);
-            auto segment = stPinchBlock_getFirst(block);
-            
-            // Pick left end L or right end R to represent this end
-            std::string node = stPinchEnd_getOrientation(&end) ? 
-                std::to_string(stPinchSegment_getStart(segment)) + "L" :
-                std::to_string(stPinchSegment_getStart(segment) + 
-                stPinchSegment_getLength(segment) - 1) + "R";
-            
-            // Go through all the other ends and connect them to this one
-            stSet* otherEnds = stPinchEnd_getConnectedPinchEnds(&end);
-            
-            // Make an iterator to loop over all the other ends we connect to.
-            stSetIterator* iterator = stSet_getIterator(otherEnds); 
-            
-            stPinchEnd* otherEnd = (stPinchEnd*) stSet_getNext(iterator);
-            while(otherEnd != NULL) {
-                // For each other end
-                
-                // Get the block and segment
-                auto otherBlock = stPinchEnd_getBlock(otherEnd);
-                auto otherSegment = stPinchBlock_getFirst(otherBlock);
-                
-                // Pick left end L or right end R to represent this other end
-                std::string otherNode = stPinchEnd_getOrientation(otherEnd) ? 
-                    std::to_string(stPinchSegment_getStart(otherSegment)) +
-                    "L" : std::to_string(stPinchSegment_getStart(otherSegment) +
-                    stPinchSegment_getLength(otherSegment) - 1) + "R";
-                
-                if(node < otherNode) {
-                    // Only draw these edges going in one direction, so copy
-                    // number represents actual copy number.
-                    out << "\t\tn" << node << " -- n" << otherNode << 
-                        "[color=red];" << std::endl;
-                }
-                
-                otherEnd = (stPinchEnd*) stSet_getNext(iterator);
-            }
+        // Clean up sonLib stuff            
+        stSet_destructIterator(iterator);
+        stSet_destruct(otherEnds);
+    }
+    
+    for(auto& edge : types) {
+        graph.edges.push_back(std::make_tuple(edge.first.first,
+            edge.first.second, edge.second));
+    }
+    
+    return graph;
+}
+
+/**
+ * Mix a value into a hash.
+ */
+static inline size_t
+combineHash(
+    size_t hash,
+    size_t value
+) {
+    return hash ^ (std::hash<size_t>()(value) + 0x9e3779b97f4a7c15ULL +
+        (hash << 6) + (hash >> 2));
+}
+
+/**
+ * Compute a hash of the given graph that is the same for isomorphic graphs,
+ * by Weisfeiler-Lehman refinement: each node starts labeled with its edge
+ * types, and is relabeled with its neighbors' labels until that stops
+ * splitting any nodes apart.
+ */
+static size_t
+hashComponentGraph(
+    const ComponentGraph& graph
+) {
     
+    // Get the neighbors of each node, with the type of the edge to them.
+    std::vector<std::vector<std::pair<int, size_t>>> neighbors(
+        graph.nodeCount);
+    for(auto& edge : graph.edges) {
+        neighbors[std::get<0>(edge)].push_back(std::make_pair(
+            std::get<2>(edge), std::get<1>(edge)));
+        if(std::get<0>(edge) != std::get<1>(edge)) {
+            neighbors[std::get<1>(edge)].push_back(std::make_pair(
+                std::get<2>(edge), std::get<0>(edge)));
+        }
+    }
     
-            // Clean up sonLib stuff            
-            stSet_destructIterator(iterator);
-            stSet_destruct(otherEnds);
+    std::vector<size_t> labels(graph.nodeCount, 0);
+    size_t distinct = 0;
+    while(true) {
+        // Relabel every node with its label and the sorted labels of its
+        // neighbors.
+        std::vector<size_t> newLabels(graph.nodeCount);
+        for(size_t i = 0; i < graph.nodeCount; i++) {
+            std::vector<std::pair<int, size_t>> seen;
+            for(auto& neighbor : neighbors[i]) {
+                seen.push_back(std::make_pair(neighbor.first,
+                    labels[neighbor.second]));
+            }
+            std::sort(seen.begin(), seen.end());
+            
+            size_t hash = combineHash(labels[i], seen.size());
+            for(auto& neighbor : seen) {
+                hash = combineHash(combineHash(hash, neighbor.first),
+                    neighbor.second);
+            }
+            newLabels[i] = hash;
         }
+        labels = std::move(newLabels);
         
-        out << "\t}" << std::endl;
-        
+        // Stop when no more nodes were told apart.
+        size_t newDistinct = std::unordered_set<size_t>(labels.begin(),
+            labels.end()).size();
+        if(newDistinct <= distinct) {
+            break;
+        }
+        distinct = newDistinct;
+    }
+    
+    // Hash the sizes and the multiset of labels.
+    std::sort(labels.begin(), labels.end());
+    size_t hash = combineHash(graph.nodeCount, graph.edges.size());
+    for(size_t label : labels) {
+        hash = combineHash(hash, label);
     }
+    return hash;
+}
+
+/**
+ * Make a vflib graph for the given graph. Each undirected edge becomes a pair
+ * of directed edges. The caller owns the result.
+ */
+static ARGraph<void, int>*
+makeVFGraph(
+    const ComponentGraph& graph
+) {
     
+    // We need an ARGEdit to build up the graph.
+    ARGEdit builder;
     
+    for(size_t i = 0; i < graph.nodeCount; i++) {
+        // Nodes will be referenced by index.
+        builder.InsertNode(NULL);
+    }
     
-    // Close up
-    out.close();
+    for(auto& edge : graph.edges) {
+        int* type = std::get<2>(edge) == SEQUENCE_EDGE ? &SEQUENCE_EDGE :
+            std::get<2>(edge) == ADJACENCY_EDGE ? &ADJACENCY_EDGE :
+            &BOTH_EDGES;
+        builder.InsertEdge(std::get<0>(edge), std::get<1>(edge), type);
+        if(std::get<0>(edge) != std::get<1>(edge)) {
+            builder.InsertEdge(std::get<1>(edge), std::get<0>(edge), type);
+        }
+    }
+    
+    ARGraph<void, int>* vfGraph = new ARGraph<void, int>(&builder);
+    // Only match edges of the same type. The graph owns the comparator.
+    vfGraph->SetEdgeComparator(new EdgeTypeComparator());
+    return vfGraph;
 }
 
 std::vector<std::vector<stPinchEnd>>
 deduplicateIsomorphicAdjacencyComponents(
-    const std::vector<std::vector<stPinchEnd>>& components
+    const std::vector<std::vector<stPinchEnd>>& components,
+    size_t threads
 ) {
 
-    // We need these for tracking whether edges are sequence edges or adjacency
-    // edges. We put pointers to them on the vflib graph edges.
-    static const int SEQUENCE_EDGE = 0;
-    static const int ADJACENCY_EDGE = 1;
-    
-    // We need a vector of vflib graphs that we can go through in a dumb n^2
-    // deduplication way (since we can't really index them any better AFAIK). We
-    // also want to keep adjacency components associated with them.
-    std::vector<std::pair<ARGraph<void, int>*, std::vector<stPinchEnd>>>
-        uniqueSet;
-    
+    // Pull out the graphs from the pinch graph once, so comparisons don't have
+    // to walk it.
+    std::vector<ComponentGraph> graphs;
     for(auto& component : components) {
-        // For each adjacency component
-        
-        // Make it into a vflib graph with appropriate annotations
-        
-        // We need an ARGEdit to build up the graph.
-        ARGEdit builder;
-        
-        // We need this map to keep track of which indexes are used for which
-        // pinch ends. Pinch ends are pretty simple, so we make an inline lambda
-        // comparison function and pass it to our set constructor.
-        typedef std::map<stPinchEnd, size_t,
-            std::function<bool(const stPinchEnd&, const stPinchEnd&)>> EndMap;
-            
-        // Strangely, this doesn't work at all without the typedef.
-        // TODO: Figure out why.
-        EndMap endToIndex([](const stPinchEnd& a, const stPinchEnd& b) {
-            return a.block < b.block ||
-                (a.block == b.block && a.orientation < b.orientation);
+        graphs.push_back(makeComponentGraph(component));
+    }
+    
+    // Bucket the components by hash, in parallel, since only components with
+    // the same hash can possibly be isomorphic.
+    std::vector<size_t> hashes(graphs.size());
+    std::atomic<size_t> nextGraph(0);
+    auto runTasks = [&](const std::function<void()>& function) {
+        parallelFor(std::max(threads, (size_t) 1), [&](size_t) {
+            function();
         });
-        
-        for(size_t i = 0; i < component.size(); i++) {
-            // Add each end in the component as a node. Nodes will be referenced
-            // by index.
-            builder.InsertNode(NULL);
-            
-            // Record the index of the end, under the actual value of the
-            // stPinchEnd.
-            endToIndex[component[i]] = i;
+    };
+    runTasks([&]() {
+        size_t i;
+        while((i = nextGraph++) < graphs.size()) {
+            hashes[i] = hashComponentGraph(graphs[i]);
         }
-        
-        for(size_t i = 0; i < component.size(); i++) {
-            // Now we insert edgesfor each node to higher-valued nodes.
-            
-            // Go through all the other ends and connect them to this one.
-            // We need to pass a non-const pointer
-            stPinchEnd endCopy = component[i];
-            stSet* otherEnds = stPinchEnd_getConnectedPinchEnds(&endCopy);
-            
-            // Make an iterator to loop over all the other ends we connect to.
-            stSetIterator* iterator = stSet_getIterator(otherEnds); 
-            
-            // Start out with the first one
-            stPinchEnd* otherEnd = (stPinchEnd*) stSet_getNext(iterator);
+    });
+    
+    std::unordered_map<size_t, std::vector<size_t>> bucketsByHash;
+    for(size_t i = 0; i < graphs.size(); i++) {
+        bucketsByHash[hashes[i]].push_back(i);
+    }
+    std::vector<std::vector<size_t>> buckets;
+    for(auto& bucket : bucketsByHash) {
+        buckets.push_back(std::move(bucket.second));
+    }
+    
+    Log::info() << "Deduplicating " << graphs.size() << " components in " <<
+        buckets.size() << " hash buckets" << std::endl;
+    
+    // Within each bucket, compare each component to the unique ones found so
+    // far with vflib, keeping the first of each isomorphism class. Buckets are
+    // independent, so do them in parallel.
+    std::vector<std::vector<size_t>> kept(buckets.size());
+    std::atomic<size_t> nextBucket(0);
+    runTasks([&]() {
+        size_t b;
+        while((b = nextBucket++) < buckets.size()) {
+            std::vector<ARGraph<void, int>*> uniqueGraphs;
             
-            while(otherEnd != NULL) {
-                // For each other end we actually have...
+            for(size_t i : buckets[b]) {
+                ARGraph<void, int>* candidate = makeVFGraph(graphs[i]);
                 
-                // See if the edge is in the right direction, and add it.
+                bool duplicate = false;
+                for(ARGraph<void, int>* unique : uniqueGraphs) {
+                    // See if the graph is isomorphic to one we have.
+                    VF2State start(candidate, unique);
+                    int matched;
+                    std::vector<node_id> candidateNodes(graphs[i].nodeCount);
+                    std::vector<node_id> uniqueNodes(graphs[i].nodeCount);
+                    if(match(&start, &matched, candidateNodes.data(),
+                        uniqueNodes.data())) {
+                        
+                        duplicate = true;
+                        break;
+                    }
+                }
                 
-                // Advance to the next edge
-                otherEnd = (stPinchEnd*) stSet_getNext(iterator);
+                if(duplicate) {
+                    delete candidate;
+                } else {
+                    uniqueGraphs.push_back(candidate);
+                    kept[b].push_back(i);
+                }
             }
             
-            
+            for(ARGraph<void, int>* unique : uniqueGraphs) {
+                delete unique;
+            }
         }
-        
-        // See if that graph is isomorphic to any we have seen so far
-        
-        // If not, put the new graph and component on the list
+    });
+    
+    // Put the kept components back in their original order.
+    std::vector<size_t> keptIndexes;
+    for(auto& bucketKept : kept) {
+        keptIndexes.insert(keptIndexes.end(), bucketKept.begin(),
+            bucketKept.end());
     }
+    std::sort(keptIndexes.begin(), keptIndexes.end());
     
-    // What componsnts will we return?
     std::vector<std::vector<stPinchEnd>> toReturn;
-    // Hint to the vector how big it will get, because someone on StackOverflow
-    // somewhere said that that was smart.
-    // <http://stackoverflow.com/a/7671804/402891>
-    toReturn.reserve(uniqueSet.size());
-    
-    for(auto& pair : uniqueSet) {
-        // Go through the final deduplicated set
-        
-        // Kill all the Graphs left in the deduplicated set.
-        delete pair.first;
-        
-        // Move the component into the new vector, so we can return it.
-        toReturn.push_back(std::move(pair.second));
+    toReturn.reserve(keptIndexes.size());
+    for(size_t i : keptIndexes) {
+        toReturn.push_back(components[i]);
     }
     
     // Return the deduplicated components
     return toReturn;
-    
-     
-    
 }
-
-
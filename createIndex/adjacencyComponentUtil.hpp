@@ -25,6 +25,80 @@ getAdjacencyComponents(
     stPinchThreadSet* threadSet
 );
 
+/**
+ * Holds all the adjacency components of a pinch graph in one flat vector of
+ * ends, so they can be split up among threads without copying them around.
+ */
+struct FlatAdjacencyComponents {
+    // Holds the ends of every component, one component after another.
+    std::vector<stPinchEnd> ends;
+    // Holds where each component starts in ends, and then where the last one
+    // stops.
+    std::vector<size_t> starts;
+    
+    /**
+     * How many components are there?
+     */
+    inline size_t size() const {
+        return starts.size() - 1;
+    }
+    
+    /**
+     * How many ends does the given component have?
+     */
+    inline size_t getSize(size_t component) const {
+        return starts[component + 1] - starts[component];
+    }
+    
+    /**
+     * Get the first end of the given component.
+     */
+    inline stPinchEnd* getEnds(size_t component) {
+        return &ends[starts[component]];
+    }
+};
+
+/**
+ * Take a pinch thread set and get the adjacency components all together in one
+ * flat structure.
+ */
+FlatAdjacencyComponents
+getFlatAdjacencyComponents(
+    stPinchThreadSet* threadSet
+);
+
+/**
+ * Holds the results of analyzing all the adjacency components of a pinch
+ * graph at once.
+ */
+struct AdjacencyAnalysis {
+    // Holds the components themselves.
+    FlatAdjacencyComponents components;
+    // How many components are there of each size?
+    std::map<size_t, size_t> spectrum;
+    // What are the indel lengths of the simple size 2 components?
+    std::vector<int64_t> indelLengths;
+    // How many size 4 components are tandem duplications?
+    size_t tandemDuplications;
+    // Which components are larger than size 2, in order?
+    std::vector<size_t> nontrivial;
+};
+
+/**
+ * Extract the adjacency components of a pinch thread set once, and run all the
+ * requested analyses on them, splitting the components among the given number
+ * of threads. Results come out the same as running the analyses one at a time.
+ */
+AdjacencyAnalysis
+analyzeAdjacencyComponents(
+    stPinchThreadSet* threadSet,
+    bool spectrum,
+    bool indelLengths,
+    bool tandemDuplications,
+    bool nontrivial,
+    size_t threads = 1
+);
+
 /**
  * Take a vector of adjacency components and get the spectrum of adjacency
  * component sizes. Size 2 components are things like SNPs and indels, while
@@ -88,15 +162,31 @@ writeAdjacencyComponents(
     const std::string& filename
 );
 
+/**
+ * Save the given components, out of all the given adjacency components, to the
+ * given filename.
+ */
+void
+writeAdjacencyComponents(
+    FlatAdjacencyComponents& components,
+    const std::vector<size_t>& which,
+    const std::string& filename
+);
+
 /**
  * Given a vector of adjacency components (vectors of pinch ends), will keep
  * only one representative member of any set of isomorphic components. So if you
  * throw in 10 different 2-break rearrangement components with 4 nodes, 2
  * sequence edges, and 2 adjacency edges, you will only get one of them back.
+ *
+ * Components are first bucketed by a hash that isomorphic components always
+ * share, and only compared within buckets, on the given number of threads.
+ * Kept components stay in their original order.
  */
 std::vector<std::vector<stPinchEnd>>
 deduplicateIsomorphicAdjacencyComponents(
-    const std::vector<std::vector<stPinchEnd>>& components
+    const std::vector<std::vector<stPinchEnd>>& components,
+    size_t threads = 1
 );
 
 
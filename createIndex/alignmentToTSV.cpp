@@ -0,0 +1,149 @@
+// alignmentToTSV.cpp: program to convert a binary alignment saved by mapReads
+// into the TSV of one line per read base.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+
+#include <boost/program_options.hpp>
+
+#include <AlignmentFile.hpp>
+#include <Log.hpp>
+
+#include "unixUtil.hpp"
+#include "BufferedWriter.hpp"
+
+/**
+ * alignmentToTSV: command-line tool to convert binary alignments from mapReads
+ * --binaryAlignment to TSV. The TSV has a
+ * <reference>\t<position>\t<query>\t<position>\t<isBackwards> line for each
+ * mapped base and a <query>\t<position> line for each unmapped base, in order
+ * along each read, which is what mapReads writes by default and what
+ * scripts/sam2tsv.py makes from SAM.
+ */
+int 
+main(
+    int argc, 
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+    
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+    
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription = 
+        std::string("Convert a binary alignment from mapReads to TSV.\n") + 
+        "Usage: alignmentToTSV <alignment> <tsv>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options() 
+        ("help", "Print help messages") 
+        ("alignment", boost::program_options::value<std::string>()
+            ->required(), 
+            "Binary alignment file to read")
+        ("tsv", boost::program_options::value<std::string>()->required(), 
+            "File to save the TSV of mappings in");
+        
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("alignment", 1);
+    positionals.add("tsv", 1);
+    
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+    
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+            
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+            
+            // Don't do the actual program.
+            return 0; 
+        }
+        
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+            
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl; 
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl; 
+        
+        // Stop the program.
+        return -1; 
+    }
+    
+    // If we get here, we have the right arguments.
+    AlignmentFile alignment(options["alignment"].as<std::string>());
+    BufferedWriter tsv(options["tsv"].as<std::string>());
+    
+    const std::vector<std::string>& referenceNames =
+        alignment.getReferenceNames();
+    
+    // These hold each read as we go through them.
+    std::string name;
+    size_t length;
+    std::vector<AlignmentFile::Segment> segments;
+    
+    size_t totalReads = 0;
+    
+    while(alignment.next(name, length, segments)) {
+        // Go through the read base by base, and through its segments as we
+        // reach them.
+        auto segment = segments.begin();
+        for(size_t i = 0; i < length; i++) {
+            while(segment != segments.end() &&
+                segment->queryStart + segment->length <= i) {
+                
+                // We're past this segment.
+                ++segment;
+            }
+            
+            if(segment != segments.end() && segment->queryStart <= i) {
+                // This base is mapped. Work out where along the segment.
+                size_t along = i - segment->queryStart;
+                size_t offset = segment->backwards ?
+                    segment->referenceOffset - along :
+                    segment->referenceOffset + along;
+                    
+                tsv << referenceNames[segment->reference] << '\t' <<
+                    offset << '\t' << name << '\t' << i << '\t' <<
+                    (segment->backwards ? '1' : '0') << '\n';
+            } else {
+                // This base is unmapped.
+                tsv << name << '\t' << i << '\n';
+            }
+        }
+        
+        totalReads++;
+    }
+    
+    tsv.close();
+    
+    Log::info() << "Converted " << totalReads << " reads" << std::endl;
+    
+    return 0;
+}
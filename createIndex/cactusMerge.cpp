@@ -1,5 +1,11 @@
 #include <csignal>
 #include <unordered_set>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <tuple>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -8,7 +14,7 @@
 #include "unixUtil.hpp"
 #include "pinchGraphUtil.hpp"
 
-#include <Fasta.hpp>
+#include <MappedFasta.hpp>
 #include <Log.hpp>
 
 #include <string>
@@ -45,6 +51,225 @@ std::string unquote(const std::string& input) {
 
 }
 
+/**
+ * Represents a sequence read from a c2h file, already renamed.
+ */
+struct C2hSequence {
+    std::string eventName;
+    std::string sequenceName;
+    bool isBottom;
+    size_t length;
+};
+
+/**
+ * Represents everything read from one c2h file. Sequence numbers in merges are
+ * numbers of sequences in this file, until they are translated into thread
+ * numbers for all the files together.
+ */
+struct C2hFile {
+    // Holds the sequences in the file, in order.
+    std::vector<C2hSequence> sequences;
+    // Holds the renames applied to event and sequence names.
+    std::map<std::string, std::string> renames;
+    // Holds the renamed event names to keep in the output.
+    std::set<std::string> eventsToKeep;
+    // Holds the merges from top segments to the bottom segments they align
+    // to.
+    std::vector<C2hMerge> merges;
+};
+
+/**
+ * Read the c2h file with the given name, which is the given number in the list
+ * of files. Events other than mergeOn, and their sequences, are renamed with
+ * the given suffix, and bottom ones also with the file number.
+ */
+C2hFile readC2h(const std::string& filename, size_t fileIndex,
+    const std::string& mergeOn, const std::string& suffix) {
+    
+    Log::output() << "Reading alignment " << filename << std::endl;
+    
+    C2hFile file;
+    
+    // Open the file
+    std::ifstream c2h(filename);
+    if(!c2h) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    
+    // This maps block name to (sequence number, start location) pairs for
+    // this file. We use it to find what each top segment merges with.
+    std::unordered_map<size_t, std::pair<size_t, size_t>> nameMap;
+    
+    // Reuse the fields of each line.
+    std::vector<std::string> parts;
+    
+    for(std::string line; std::getline(c2h, line);) {
+        // Split up each line on \t.
+        boost::split(parts, line, boost::is_any_of("\t"));
+    
+        if(parts.size() < 1) {
+            // Skip lines that have nothing on them.
+            continue;
+        }
+    
+        if(parts[0] == "s") {
+            
+            // It's a sequence line. Start a new squence.
+            
+            if(parts.size() != 4) {
+                // Not the right number of fields.
+                throw std::runtime_error(
+                    std::string("Invalid field count in ") + line);
+            }
+            
+            // Grab the parts
+            std::string eventName = unquote(parts[1]);
+            std::string sequenceName = unquote(parts[2]);
+            bool bottomFlag = std::stoi(parts[3]);
+            
+            Log::info() << "Read sequence " << eventName << "." << 
+                sequenceName << (bottomFlag ? " (bottom)" : " (top)") << 
+                std::endl;
+            
+            if(eventName != mergeOn) {
+                // We aren't merging on this sequence, so we may have to apply
+                // a suffix.
+            
+                // We need to rename this event (possibly to the same thing)
+                file.renames[eventName] = eventName + suffix;
+                    
+                if(bottomFlag) {
+                    // All the bottom events (that aren't being merged on) need
+                    // to be renamed apart manually since the names may be
+                    // reused.
+                    file.renames[eventName] += "-" + std::to_string(fileIndex);
+                }
+                eventName = file.renames[eventName];
+                
+                if(!bottomFlag) {
+                    // Keep this event when we do our final output.
+                    file.eventsToKeep.insert(eventName);
+                }
+                
+                // And the sequence
+                file.renames[sequenceName] = sequenceName + suffix;
+                    
+                if(bottomFlag) {
+                    // All the bottom sequences (that aren't being merged on)
+                    // need to be renamed apart manually since the names may
+                    // be reused.
+                    file.renames[sequenceName] += "-" +
+                        std::to_string(fileIndex);
+                }
+                sequenceName = file.renames[sequenceName];
+                
+                Log::info() << "Canonical name: " << eventName << "." << 
+                    sequenceName << std::endl;
+                
+            } else {
+                // If we are going to merge on it, we keep its name the same
+                // and then later we just make one thread for that name. We do
+                // definitely need it in the output though.
+                file.eventsToKeep.insert(eventName);
+            }
+            
+            // Save the sequence, starting with a total length of 0.
+            file.sequences.push_back(C2hSequence{eventName, sequenceName,
+                bottomFlag, 0});
+            
+        } else if(parts[0] == "a") {
+            // This is an alignment block
+            
+            if(file.sequences.size() == 0) {
+                throw std::runtime_error(
+                    "Found alignmet block before sequence");
+            }
+            
+            // Which sequence are we working on?
+            size_t sequenceNumber = file.sequences.size() - 1;
+            C2hSequence& sequence = file.sequences.back();
+            
+            if(sequence.isBottom) {
+                // Parse it as a bottom block: "a" name start length
+                
+                if(parts.size() != 4) {
+                    // Not the right number of fields.
+                    throw std::runtime_error(
+                        std::string("Invalid field count in ") + line);
+                }
+                
+                size_t blockName = std::stoll(parts[1]);
+                size_t blockStart = std::stoll(parts[2]);
+                size_t blockLength = std::stoll(parts[3]);
+                
+                // We need to associate the block name with the sequence and
+                // the start location it specifies, for merging later.
+                nameMap[blockName] = std::make_pair(sequenceNumber,
+                    blockStart);
+                
+                LOG_DEBUG("Bottom block " << blockName << " is " << 
+                    blockStart << " on sequence " << sequenceNumber << 
+                    std::endl);
+                
+                // Also record the additional length on this sequence
+                sequence.length += blockLength;
+                
+            } else {
+                // Parse it as a top block: 
+                // "a" start length [name orientation]
+                
+                if(parts.size() < 3) {
+                    // Not the right number of fields.
+                    throw std::runtime_error(
+                        std::string("Invalid field count in ") + line);
+                }
+                
+                // Parse out the start and length
+                size_t segmentStart = std::stoll(parts[1]);
+                size_t segmentLength = std::stoll(parts[2]);
+                
+                // Add in the length
+                sequence.length += segmentLength;
+                
+                if(parts.size() == 5) {
+                    // If it has a name and orientation, remember a merge.
+                    
+                    size_t blockName = std::stoll(parts[3]);
+                    bool orientation = std::stoi(parts[4]);
+                    
+                    auto bottom = nameMap.find(blockName);
+                    if(bottom == nameMap.end()) {
+                        throw std::runtime_error("Top segment in " + line +
+                            " aligns to unknown block");
+                    }
+                    
+                    // Make a merge with everything we can get from this
+                    // segment and the bottom segment we are talking about
+                    // earlier in this file.
+                    C2hMerge merge;
+                    merge.sequence1 = sequenceNumber;
+                    merge.start1 = segmentStart;
+                    merge.length = segmentLength;
+                    // TODO: error-check length
+                    merge.orientation = orientation;
+                    merge.sequence2 = bottom->second.first;
+                    merge.start2 = bottom->second.second;
+                    
+                    LOG_DEBUG("Going to merge " << segmentStart << 
+                        " length " << segmentLength << " to " <<
+                        blockName << " orientation " << orientation << 
+                        std::endl);
+                    
+                    // Save the merge for doing later.
+                    file.merges.push_back(merge);
+                }
+            }
+        }
+    }
+    
+    return file;
+}
+
 /**
  * cactusMerge.cpp: merge two pairs of c2h and FASTA files into one pair. The
  * files must be star trees with the same root sequence.
@@ -86,7 +311,10 @@ main(
         ("c2hOut", boost::program_options::value<std::string>()->required(), 
             "File to save .c2h-format alignment in")
         ("fastaOut", boost::program_options::value<std::string>()->required(), 
-            "File in which to save FASTA records for building HAL from .c2h");
+            "File in which to save FASTA records for building HAL from .c2h")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(std::thread::hardware_concurrency()),
+            "Read up to this many c2h files at once");
         
         
         
@@ -172,14 +400,35 @@ main(
     std::vector<std::string> fastaFiles(
         options["fasta"].as<std::vector<std::string>>());
     
-    // This will hold all of the renames that have to happen for each file.
-    // These are generated when we go through the file by renaming top and
-    // bottom sequences with suffixes.
-    std::vector<std::map<std::string, std::string>> renames;
-    
-    for(size_t i = 0; i < c2hFiles.size(); i++) {
-        // Make sure it has an empty map of renames for each file.
-        renames.push_back(std::map<std::string, std::string>());
+    // Read all the c2h files at once, each on its own thread, taking the next
+    // file whenever one is done.
+    std::vector<C2hFile> files(c2hFiles.size());
+    std::vector<std::exception_ptr> errors(c2hFiles.size());
+    std::atomic<size_t> nextFile(0);
+    std::vector<std::thread> readers;
+    size_t readerCount = std::min(std::max(options["threads"].as<size_t>(),
+        (size_t) 1), c2hFiles.size());
+    for(size_t i = 0; i < readerCount; i++) {
+        readers.push_back(std::thread([&]() {
+            size_t fileIndex;
+            while((fileIndex = nextFile++) < c2hFiles.size()) {
+                try {
+                    files[fileIndex] = readC2h(c2hFiles[fileIndex], fileIndex,
+                        options["mergeOn"].as<std::string>(),
+                        suffixes[fileIndex]);
+                } catch(...) {
+                    errors[fileIndex] = std::current_exception();
+                }
+            }
+        }));
+    }
+    for(auto& reader : readers) {
+        reader.join();
+    }
+    for(auto& error : errors) {
+        if(error) {
+            std::rethrow_exception(error);
+        }
     }
     
     // This will hold the event names for the c2h files in order
@@ -188,9 +437,6 @@ main(
     // And this will hold the sequence names
     std::vector<std::string> sequenceNames;
     
-    // This will hold bottom (1) and top (0) flags for each sequence.
-    std::vector<bool> isBottom;
-    
     // And this will hold the sequence lengths
     std::vector<size_t> sequenceLengths;
     
@@ -205,228 +451,47 @@ main(
     // we are keeping.
     std::set<std::string> eventsToKeep;
     
-    for(size_t fileIndex = 0; fileIndex < c2hFiles.size(); fileIndex++) {
-        // Scan through the c2h files to get the event, sequence, and length of
-        // each thread, and to collect merges.
-        
-        Log::output() << "Reading alignment " << c2hFiles[fileIndex] << 
-            std::endl;
-        
-        // Open the file
-        std::ifstream c2h(c2hFiles[fileIndex]);
+    for(C2hFile& file : files) {
+        // Number the sequences from all the files in order.
         
-        // This maps block name to (sequence number, start location) pairs for
-        // this file. We use it to compose merges for our list in global
-        // sequence number space.
-        std::map<size_t, std::pair<size_t, size_t>> nameMap;
+        // What thread does each sequence in this file merge into?
+        std::vector<size_t> mergeSequenceNumbers;
         
-        for(std::string line; std::getline(c2h, line);) {
-            // This is a new sequence. Split it up on \t.
-            std::vector<std::string> parts;
-            boost::split(parts, line, boost::is_any_of("\t"));
-        
-            if(parts.size() < 1) {
-                // Skip lines that have nothing on them.
-                continue;
-            }
-        
-            // For each line
-            if(parts[0] == "s") {
-                
-                // It's a sequence line. Start a new squence.
-                
-                if(parts.size() != 4) {
-                    // Not the right number of fields.
-                    throw std::runtime_error(
-                        std::string("Invalid field count in ") + line);
-                }
-                
-                // Grab the parts
-                std::string eventName = unquote(parts[1]);
-                std::string sequenceName = unquote(parts[2]);
-                bool bottomFlag = std::stoi(parts[3]);
-                
-                Log::info() << "Read sequence " << eventName << "." << 
-                    sequenceName << (bottomFlag ? " (bottom)" : " (top)") << 
-                    std::endl;
-                
-                if(eventName != options["mergeOn"].as<std::string>()) {
-                    // We aren't merging on this sequence, so we may have to
-                    // apply a suffix.
-                
-                    // We need to rename this event (possibly to the same thing)
-                    renames[fileIndex][eventName] = eventName + 
-                        suffixes[fileIndex];
-                        
-                    if(bottomFlag) {
-                        // All the bottom events (that aren't being merged
-                        // on) need to be renamed apart manually since the names
-                        // may be reused.
-                        renames[fileIndex][eventName] += "-" + 
-                            std::to_string(fileIndex);
-                    }
-                    eventName = renames[fileIndex][eventName];
-                    
-                    if(!bottomFlag) {
-                        // Keep this event when we do our final output.
-                        eventsToKeep.insert(eventName);
-                    }
-                    
-                    // And the sequence
-                    renames[fileIndex][sequenceName] = sequenceName + 
-                        suffixes[fileIndex];
-                        
-                    if(bottomFlag) {
-                        // All the bottom sequences (that aren't being merged
-                        // on) need to be renamed apart manually since the names
-                        // may be reused.
-                        renames[fileIndex][sequenceName] += "-" + 
-                            std::to_string(fileIndex);
-                    }
-                    sequenceName = renames[fileIndex][sequenceName];
-                    
-                    Log::info() << "Canonical name: " << eventName << "." << 
-                        sequenceName << std::endl;
-                    
-                } else {
-                    // If we are going to merge on it, we keep its name the same
-                    // and then later we just make one thread for that name. We
-                    // do definitely need it in the output though.
-                    eventsToKeep.insert(eventName);
-                }
-                
-                
-                // Save the names
-                eventNames.push_back(eventName);
-                sequenceNames.push_back(sequenceName);
-                
-                // Save the bottomness flag.
-                isBottom.push_back(bottomFlag);
-                
-                // Initialize the total length to 0
-                sequenceLengths.push_back(0);
-                
-                
-                auto namePair = std::make_pair(eventName, sequenceName);
-                if(!firstSequenceNumber.count(namePair)) {
-                    // This is the first time we have seen a sequence
-                    // for this event and sequence name. Everything should
-                    // merge against this one thread and not make more
-                    // threads.
-                    
-                    // If this is the mergeOn event, we'll only make this
-                    // once across all the files.
-                    
-                    // Later instances of this event and sequence name should
-                    // redirect here.
-                    firstSequenceNumber[namePair] = sequenceNames.size() - 1;
-                    
-                    Log::info() << "This is the first time we have seen "
-                        "this sequence." << std::endl;
-                }
-                
-            } else if(parts[0] == "a") {
-                // This is an alignment block
+        for(const C2hSequence& sequence : file.sequences) {
+            eventNames.push_back(sequence.eventName);
+            sequenceNames.push_back(sequence.sequenceName);
+            sequenceLengths.push_back(sequence.length);
+            
+            auto namePair = std::make_pair(sequence.eventName,
+                sequence.sequenceName);
+            if(!firstSequenceNumber.count(namePair)) {
+                // This is the first time we have seen a sequence for this
+                // event and sequence name. Everything should merge against
+                // this one thread and not make more threads.
                 
-                if(sequenceNames.size() == 0) {
-                    throw std::runtime_error(
-                        "Found alignmet block before sequence");
-                }
+                // If this is the mergeOn event, we'll only make this once
+                // across all the files.
                 
-                // Which sequence are we working on?
-                size_t sequenceNumber = sequenceNames.size() - 1;
+                // Later instances of this event and sequence name should
+                // redirect here.
+                firstSequenceNumber[namePair] = sequenceNames.size() - 1;
                 
-                if(isBottom[sequenceNumber]) {
-                    // Parse it as a bottom block: "a" name start length
-                    
-                    if(parts.size() != 4) {
-                        // Not the right number of fields.
-                        throw std::runtime_error(
-                            std::string("Invalid field count in ") + line);
-                    }
-                    
-                    size_t blockName = std::stoll(parts[1]);
-                    size_t blockStart = std::stoll(parts[2]);
-                    size_t blockLength = std::stoll(parts[3]);
-                    
-                    // Look up the sequence number we actually want to merge
-                    // against when we come get this block.
-                    auto namePair = std::make_pair(eventNames[sequenceNumber], 
-                        sequenceNames[sequenceNumber]);
-                    size_t mergeSequenceNumber = firstSequenceNumber[namePair];
-                    
-                    // We need to associate the block name with the thread
-                    // number for the sequence we want it to merge into, and the
-                    // start location it specifies, for merging later.
-                    nameMap[blockName] = std::make_pair(mergeSequenceNumber,
-                        blockStart);
-                    
-                    Log::debug() << "Bottom block " << blockName << " is " << 
-                        blockStart << " on sequence " << mergeSequenceNumber << 
-                        std::endl;
-                    
-                    // Also record the additional length on this sequence
-                    sequenceLengths[sequenceNumber] += blockLength;
-                    
-                } else {
-                    // Parse it as a top block: 
-                    // "a" start length [name orientation]
-                    
-                    if(parts.size() < 3) {
-                        // Not the right number of fields.
-                        throw std::runtime_error(
-                            std::string("Invalid field count in ") + line);
-                    }
-                    
-                    // Parse out the start and length
-                    size_t segmentStart = std::stoll(parts[1]);
-                    size_t segmentLength = std::stoll(parts[2]);
-                    
-                    // Add in the length
-                    sequenceLengths[sequenceNumber] += segmentLength;
-                    
-                    if(parts.size() == 5) {
-                        // If it has a name and orientation, remember a merge.
-                        
-                        size_t blockName = std::stoll(parts[3]);
-                        bool orientation = std::stoi(parts[4]);
-                        
-                        // Get the sequence number that canonically represents
-                        // all sequences with this event/sequence name
-                        // combination.
-                        auto namePair = std::make_pair(
-                            eventNames[sequenceNumber], 
-                            sequenceNames[sequenceNumber]);
-                        size_t mergeSequenceNumber = firstSequenceNumber[
-                            namePair];
-                        
-                        // Make a merge and populate it with everything we can
-                        // get from this segment.
-                        C2hMerge merge;
-                        merge.sequence1 = mergeSequenceNumber;
-                        merge.start1 = segmentStart;
-                        merge.length = segmentLength;
-                        // TODO: error-check length
-                        merge.orientation = orientation;
-                        
-                        // Grab the info from the bottom segment we are talking
-                        // about earlier in this file.
-                        merge.sequence2 = nameMap[blockName].first;
-                        merge.start2 = nameMap[blockName].second;
-                        
-                        Log::debug() << "Going to merge " << segmentStart << 
-                            " length " << segmentLength << " to " <<
-                            blockName << " orientation " << orientation << 
-                            std::endl;
-                        
-                        // Save the merge for doing later.
-                        merges.push_back(merge);
-                        
-                    }
-                    
-                }
+                Log::info() << "First saw sequence " << sequence.eventName <<
+                    "." << sequence.sequenceName << std::endl;
             }
+            mergeSequenceNumbers.push_back(firstSequenceNumber[namePair]);
         }
+        
+        for(C2hMerge merge : file.merges) {
+            // Move the merges over to the threads they merge.
+            merge.sequence1 = mergeSequenceNumbers[merge.sequence1];
+            merge.sequence2 = mergeSequenceNumbers[merge.sequence2];
+            merges.push_back(merge);
+        }
+        file.merges.clear();
+        
+        eventsToKeep.insert(file.eventsToKeep.begin(),
+            file.eventsToKeep.end());
     }
     
     // Make a thread set with all those threads
@@ -450,7 +515,44 @@ main(
         stPinchThreadSet_addThread(threadSet, i, 1, sequenceLengths[i]); 
     }
     
-    for(auto merge : merges) {
+    // Apply the merges in order along the threads, so each pinch starts near
+    // where the last one was.
+    std::sort(merges.begin(), merges.end(),
+        [](const C2hMerge& a, const C2hMerge& b) {
+        
+        return std::tie(a.sequence1, a.start1) <
+            std::tie(b.sequence1, b.start1);
+    });
+    
+    // Join up merges that just continue each other, so each run of adjacent
+    // blocks gets one pinch.
+    std::vector<C2hMerge> runs;
+    for(const C2hMerge& merge : merges) {
+        if(!runs.empty()) {
+            C2hMerge& last = runs.back();
+            if(last.sequence1 == merge.sequence1 &&
+                last.sequence2 == merge.sequence2 &&
+                last.orientation == merge.orientation &&
+                last.start1 + last.length == merge.start1 &&
+                (merge.orientation ? last.start2 + last.length == merge.start2 :
+                merge.start2 + merge.length == last.start2)) {
+                
+                // Going backward, the run starts on the second thread where
+                // this merge does.
+                if(!merge.orientation) {
+                    last.start2 = merge.start2;
+                }
+                last.length += merge.length;
+                continue;
+            }
+        }
+        runs.push_back(merge);
+    }
+    
+    Log::info() << "Applying " << runs.size() << " pinches for " <<
+        merges.size() << " merges" << std::endl;
+    
+    for(auto merge : runs) {
         // Apply all the merges, converting merges to 1-based
         stPinchThread_pinch(
             stPinchThreadSet_getThread(threadSet, merge.sequence1),
@@ -458,11 +560,11 @@ main(
             merge.start1 + 1, merge.start2 + 1, merge.length, 
             merge.orientation);
             
-        Log::trace() << "Applied merge between threads " << merge.sequence1 << 
+        LOG_TRACE("Applied merge between threads " << merge.sequence1 << 
             ":" << merge.start1 << "-" << merge.start1 + merge.length << 
             " and " << merge.sequence2 << ":" << merge.start2 << "-" << 
             merge.start2 + merge.length << " orientation " << 
-            merge.orientation << std::endl;
+            merge.orientation << std::endl);
     }
     
     // Write out a new c2h file, with a new rootSeq.
@@ -493,36 +595,44 @@ main(
     
     for(size_t fileIndex = 0; fileIndex < fastaFiles.size(); fileIndex++) {
         // Open up the FASTA for reading
-        Fasta fasta(fastaFiles[fileIndex]);
+        MappedFasta fasta(fastaFiles[fileIndex]);
+        
+        // Holds sequences that have to be put back together from their lines.
+        std::string buffer;
         
         Log::info() << "Copying over FASTA records from " <<
             fastaFiles[fileIndex] << std::endl;
         
-        while(fasta.hasNext()) {
+        for(size_t record = 0; record < fasta.size(); record++) {
             // Go through all the FASTA records.
             // TODO: assumes FASTA headers have nothing but IDs.
-            std::pair<std::string, std::string> record = fasta.getNextRecord();
+            std::string id = fasta.getID(record);
             
-            if(renames[fileIndex].count(record.first)) {
+            if(files[fileIndex].renames.count(id)) {
                 // Rename them if necessary
-                record.first = renames[fileIndex][record.first];
+                id = files[fileIndex].renames[id];
             }
             
-            if(!eventsToKeep.count(record.first)) {
+            if(!eventsToKeep.count(id)) {
                 // This event wasn't on the list of events to actually output,
                 // so don't output it.
-                Log::info() << "Skipped event " << record.first << std::endl;
+                Log::info() << "Skipped event " << id << std::endl;
                 continue;
             }
             
-            if(!alreadyWritten.count(record.first)) {
+            if(!alreadyWritten.count(id)) {
             
-                // Save the record to the output FASTA file.
-                fastaOut << ">" << record.first << std::endl << record.second <<
-                    std::endl;
+                // Save the record to the output FASTA file, straight from the
+                // input file if it was all on one line.
+                size_t length;
+                const char* sequence = fasta.getSequence(record, length,
+                    buffer);
+                fastaOut << ">" << id << std::endl;
+                fastaOut.write(sequence, length);
+                fastaOut << std::endl;
                 
                 // Remember that we have written a record by this name.
-                alreadyWritten.insert(record.first);
+                alreadyWritten.insert(id);
             }
             
         }
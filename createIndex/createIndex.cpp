@@ -3,6 +3,7 @@
 #include <vector>
 #include <cstdlib>
 #include <sstream>
+#include <fstream>
 #include <unordered_set>
 #include <algorithm>
 #include <utility>
@@ -10,6 +11,14 @@
 #include <csignal>
 #include <iterator>
 #include <cstdint> 
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <set>
+#include <numeric>
+#include <mutex>
+#include <memory>
 
 
 #include <boost/filesystem.hpp>
@@ -26,11 +35,16 @@
 #include <TextPosition.hpp>
 #include <util.hpp>
 #include <Mapping.hpp>
-#include <SmallSide.hpp>
 #include <Log.hpp>
 #include <MappingScheme.hpp>
+#include <PerfCounters.hpp>
+#include <HugePages.hpp>
+#include <IndexPackage.hpp>
+#include <QueryTracer.hpp>
+#include <TaskPool.hpp>
 #include <NaturalMappingScheme.hpp>
 #include <ZipMappingScheme.hpp>
+#include <HybridMappingScheme.hpp>
 
 // Grab timers from libsuffixtools
 #include <Timer.h>
@@ -39,7 +53,15 @@
 #include "IDSource.hpp"
 #include "ConcurrentQueue.hpp"
 #include "MappingMergeScheme.hpp"
+#include "LCPMergeScheme.hpp"
 #include "MergeApplier.hpp"
+#include "MergeRecording.hpp"
+#include "DegreeHistogram.hpp"
+#include "ProgressReporter.hpp"
+#include "RemoteMapping.hpp"
+#include "MergeCache.hpp"
+#include "GapFiller.hpp"
+#include "SpeculativeMerges.hpp"
 
 #include "unixUtil.hpp"
 #include "adjacencyComponentUtil.hpp"
@@ -65,210 +87,178 @@ getArrow(
 }
 
 /**
- * Given a pinch thread set and a filename, write the degree of each pinch block
- * or segment without a block (always degree 2, except at the ends) to the file,
- * one per line.
- *
- * TODO: Maybe restructure as one pass through all blocks, and one scan through
- * threads ignoring any blocks? Then we could eliminate the seen set for blocks.
+ * Work out the merged level for the given fully merged pinch graph, and save it
+ * to the given file as a level index, so reads can be mapped to the merged
+ * level without merging again. Canonicalizes on the given number of threads.
  */
-void
-writeDegrees(
-    stPinchThreadSet* threadSet, 
-    std::string filename
+void saveLevelIndex(
+    stPinchThreadSet* threadSet,
+    const FMDIndex& index,
+    const std::string& filename,
+    size_t threads
 ) {
-
-    Log::info() << "Saving pinch graph degrees to " << filename << std::endl;
-
-    // Open up the file to write.
-    std::ofstream degrees(filename.c_str());
-
-    // We're going go through each thread one segment at a time, to make sure we
-    // catch all the single segments.
-    std::unordered_set<stPinchBlock*> seen;
     
-    // Make an iterator over pinch threads
-    stPinchThreadSetIt threadIterator = stPinchThreadSet_getIt(threadSet);
+    Log::info() << "Saving level index to " << filename << "..." << std::endl;
     
-    // And a pointer to hold the current thread
-    stPinchThread* thread;
-    while((thread = stPinchThreadSetIt_getNext(&threadIterator)) != NULL) {
-        // For each pinch thread
-        
-        // Go through all its pinch segments in order. There's no iterator so we
-        // have to keep looking 3'
-        
-        // Get the first segment in the thread.
-        stPinchSegment* segment = stPinchThread_getFirst(thread);
-        while(segment != NULL) {
-        
-            stPinchBlock* block;
-            if((block = stPinchSegment_getBlock(segment)) != NULL) {
-                // Look at its block if it has one
-                
-                if(seen.count(block) == 0) {
-                    // This is a new block we haven't reported the degree of
-                    // yet.
-                    
-                    // Report the degree.
-                    degrees << stPinchBlock_getDegree(block) << std::endl;
-                    
-                    // Remember we saw it.
-                    seen.insert(block);
-                }
-            } else {
-                // This is a bare segment; report degree depending on what it's
-                // attached to on each end.
-                
-                // How many neighbors do we have. TODO: track this as we scan,
-                // resulting in fewer queries.
-                int degree = (int)(stPinchSegment_get3Prime(segment) != NULL) +
-                    (int)(stPinchSegment_get5Prime(segment) != NULL);
-                    
-                degrees << degree << std::endl;
-                
-            }
-            
-            // Jump to the next 3' segment. This needs to return NULL if we go
-            // off the end.
-            segment = stPinchSegment_get3Prime(segment);
-        }
-        
-    }
+    // Everything is merged in by now, so canonicalize all the texts with
+    // nothing masked out.
+    std::vector<PackedTextPosition> canonicalized(index.getBWTLength());
+    std::vector<size_t> allTexts(index.getNumberOfContigs() * 2);
+    std::iota(allTexts.begin(), allTexts.end(), 0);
+    canonicalizeTexts(threadSet, index, NULL, allTexts, canonicalized,
+        threads);
     
-    // We wrote out all the degrees
-    degrees.flush();
-    degrees.close();
-
+    // Find the runs, and view the index through them.
+    auto mergedRuns = identifyMergedRuns(index, canonicalized, NULL, threads);
+    FMDIndexView view(index, nullptr, mergedRuns.first,
+        std::move(mergedRuns.second));
+    
+    // Save the ranges and positions, and the inverted positions too so they
+    // don't need to be worked out again on load.
+    view.saveLevelIndex(filename);
+    
+    delete mergedRuns.first;
 }
 
 /**
- * Canonicalize each contigous run of positions mapping to the same canonical
- * base and face.
- *
- * Takes a pinched thread set, and the index on which it is defined.
- *
- * If a mask bit vector is specified, only positions which have a 1 in the mask
- * will be able to break up ranges.
- *
- * Returns a GenericBitVector marking each such range with a 1 at the start, and
- * a vector of canonicalized TextPositions.
- *
- * All BWT positions must be represented in the pinch set.
- *
- * Scans through the entire BWT.
+ * Save the state of a greedy merge to the given directory, so it can pick up
+ * again by merging in the given genome next. Saves the pinch graph, the mask of
+ * included positions, the canonical position of every BWT row, and the merged
+ * run index. The checkpoint is written next to the directory and then moved
+ * into place, so an interrupted save leaves the last checkpoint alone.
  */
-std::pair<GenericBitVector*, std::vector<TextPosition>>
-identifyMergedRuns(
-    stPinchThreadSet* threadSet, 
+void
+saveCheckpoint(
+    const std::string& directory,
+    size_t nextGenome,
     const FMDIndex& index,
-    const GenericBitVector* mask = NULL
+    stPinchThreadSet* threadSet,
+    const GenericBitVector* includedPositions,
+    const std::vector<PackedTextPosition>& canonicalized,
+    const std::pair<GenericBitVector*, std::vector<TextPosition>>& mergedRuns
 ) {
     
-    // We need to make bit vector denoting ranges, which we encode with this
-    // encoder, which has 32 byte blocks.
-    GenericBitVector* encoder = new GenericBitVector();
+    Log::info() << "Checkpointing before genome " << nextGenome << "..." <<
+        std::endl;
     
-    // We also need to make a vector of canonical positions.
-    std::vector<TextPosition> mappings;
+    std::string temporary = directory + ".tmp";
+    if(boost::filesystem::exists(temporary)) {
+        boost::filesystem::remove_all(temporary);
+    }
+    boost::filesystem::create_directory(temporary);
     
-    Log::info() << "Building merged run index by scan..." << std::endl;
+    // Say where we are and what index we are on, so we can't resume on the
+    // wrong one.
+    std::ofstream stateStream((temporary + "/state.bin").c_str(),
+        std::ios::binary);
+    uint64_t state[] = {nextGenome, index.getNumberOfContigs(),
+        (uint64_t) index.getBWTLength()};
+    stateStream.write((const char*) state, sizeof(state));
+    stateStream.close();
     
-    // Do the thing where we locate each base and, when the canonical position
-    // changes, add a 1 to start a new range and add a mapping.
-
-    // Keep track of the ID and relative orientation for the last position we
-    // canonicalized.
-    TextPosition lastCanonicalized;
+    std::ofstream graphStream((temporary + "/graph.bin").c_str(),
+        std::ios::binary);
+    writeThreadSet(threadSet, graphStream);
+    graphStream.close();
     
-    for(int64_t j = index.getNumberOfContigs() * 2; j < index.getBWTLength();
-        j++) {
-        
-        // For each base in the BWT (skipping over the 2*contigs stop
-        // characters)... 
-        
-        // Note: stop characters aren't at the front in the last column, only
-        // the first.
-        
-        if(mask != NULL && !mask->isSet(j)) {
-            // This position is masked out. We don't allow it to break up
-            // ranges, so no range needs to start here. Skip it and pretend it
-            // doesn't exist.
-            continue;
-        }
-        
-        // Where is it located?
-        TextPosition base = index.locate(j);
-        
-        // Canonicalize it.
-        TextPosition canonicalized = canonicalize(index, threadSet, base);
-        
-        if(j == 0 || canonicalized != lastCanonicalized) {
-            // We need to start a new range here, because this BWT base maps to
-            // a different position than the last one.
-            
-            // Say this range is going to belong to the canonical base.
-            mappings.push_back(canonicalized);
-            
-            if(j >= index.getNumberOfContigs() * 2) {
-                // Record a 1 in the vector at the start of every range,
-                // including the first.
-                encoder->addBit(j);
-                Log::trace() << "Set bit " << j << std::endl;
-            }
-            
-            
-            // Remember what canonical base and face we're doing for this range.
-            lastCanonicalized = canonicalized;
-        }
-        // Otherwise we had the same canonical base, so we want this in the same
-        // range we already started.
+    std::ofstream includedStream((temporary + "/included.bin").c_str(),
+        std::ios::binary);
+    includedPositions->writeTo(includedStream);
+    includedStream.close();
+    
+    // The canonical positions are just words, so they can go out all at once.
+    std::ofstream canonicalStream((temporary + "/canonical.bin").c_str(),
+        std::ios::binary);
+    canonicalStream.write((const char*) canonicalized.data(),
+        canonicalized.size() * sizeof(PackedTextPosition));
+    canonicalStream.close();
+    
+    std::ofstream runsStream((temporary + "/runs.bin").c_str(),
+        std::ios::binary);
+    mergedRuns.first->writeTo(runsStream);
+    runsStream.close();
+    
+    std::ofstream representativeStream(
+        (temporary + "/representatives.bin").c_str(), std::ios::binary);
+    for(const TextPosition& position : mergedRuns.second) {
+        PackedTextPosition packed(position);
+        representativeStream.write((const char*) &packed, sizeof(packed));
     }
-            
-    // Set a bit after the end of the last range (i.e. at the end of the BWT).
-    encoder->addBit(index.getBWTLength());
+    representativeStream.close();
     
-    // Finish the vector at the right length, leaving room for that trailing
-    // bit.
-    encoder->finish(index.getBWTLength() + 1);
+    if(!stateStream || !graphStream || !includedStream || !canonicalStream ||
+        !runsStream || !representativeStream) {
+        
+        throw std::runtime_error("Could not write checkpoint to " + temporary);
+    }
     
-    // Return the bit vector and the canonicalized base vector
-    return std::make_pair(encoder, mappings);
+    // Swap the new checkpoint in for the old one.
+    if(boost::filesystem::exists(directory)) {
+        boost::filesystem::remove_all(directory);
+    }
+    boost::filesystem::rename(temporary, directory);
 }
 
 /**
- * Save both parts of the given level index to files in the given directory,
- * which must not yet exist. Does not delete the bit vector from the level
- * index, so it can be reused.
+ * Load the state of a greedy merge saved by saveCheckpoint() from the given
+ * directory, for the given index. Returns the number of the next genome to
+ * merge in, and fills in the pinch graph, the included positions mask (which
+ * the caller owns), the canonical positions, and the merged run index.
  */
-void saveLevelIndex(
-    std::pair<GenericBitVector*, std::vector<SmallSide> > levelIndex,
-    std::string directory
+size_t
+loadCheckpoint(
+    const std::string& directory,
+    const FMDIndex& index,
+    stPinchThreadSet*& threadSet,
+    const GenericBitVector*& includedPositions,
+    std::vector<PackedTextPosition>& canonicalized,
+    std::pair<GenericBitVector*, std::vector<TextPosition>>& mergedRuns
 ) {
     
-    Log::info() << "Saving index to disk..." << std::endl;
+    Log::info() << "Resuming from checkpoint in " << directory << "..." <<
+        std::endl;
     
-    // Make the directory
-    boost::filesystem::create_directory(directory);
+    std::ifstream stateStream((directory + "/state.bin").c_str(),
+        std::ios::binary);
+    uint64_t state[3] = {0, 0, 0};
+    stateStream.read((char*) state, sizeof(state));
+    if(!stateStream) {
+        throw std::runtime_error("No checkpoint to resume in " + directory);
+    }
+    if(state[1] != index.getNumberOfContigs() ||
+        state[2] != (uint64_t) index.getBWTLength()) {
+        
+        throw std::runtime_error("Checkpoint in " + directory +
+            " was made for a different index");
+    }
     
-    // Save the bit vector to a file.
-    std::ofstream vectorStream((directory + "/vector.bin").c_str(), 
+    std::ifstream graphStream((directory + "/graph.bin").c_str(),
         std::ios::binary);
-    levelIndex.first->writeTo(vectorStream);
-    vectorStream.close();
+    threadSet = readThreadSet(index, graphStream);
+    
+    includedPositions = new GenericBitVector(directory + "/included.bin");
     
-    // Open a file to save all the sides to
-    std::ofstream sideStream((directory + "/mappings.bin").c_str(), 
+    std::ifstream canonicalStream((directory + "/canonical.bin").c_str(),
         std::ios::binary);
-    for(std::vector<SmallSide>::iterator i = levelIndex.second.begin(); 
-        i != levelIndex.second.end(); ++i) {
-        
-        // For each side, write it. We can't write them all at once since we
-        // might have more than an int's worth of bytes.
-        (*i).write(sideStream);
+    canonicalized.resize(index.getBWTLength());
+    canonicalStream.read((char*) canonicalized.data(),
+        canonicalized.size() * sizeof(PackedTextPosition));
+    if(!canonicalStream) {
+        throw std::runtime_error("Checkpoint in " + directory +
+            " has truncated canonical positions");
+    }
+    
+    mergedRuns.first = new GenericBitVector(directory + "/runs.bin");
     
+    std::ifstream representativeStream(
+        (directory + "/representatives.bin").c_str(), std::ios::binary);
+    mergedRuns.second.clear();
+    PackedTextPosition packed;
+    while(representativeStream.read((char*) &packed, sizeof(packed))) {
+        mergedRuns.second.push_back(packed.unpack());
     }
-    sideStream.close();
+    
+    return state[0];
 }
 
 /**
@@ -282,52 +272,178 @@ void saveLevelIndex(
  * Takes a factory function that can allocate new MappingSchemes for an index
  * and the ranges and mask bitvectors.
  *
+ * If windowLength is nonzero, contigs are mapped in windows of about that many
+ * bases, each with windowOverlap bases of flanking context, so that long
+ * contigs can be spread across threads.
+ *
+ * Maps on up to the given number of threads. If cpus is not empty, the thread
+ * applying merges is pinned to the first CPU in it, and the workers of the
+ * shared TaskPool, which do the mapping, to the others in turn.
+ *
+ * If sortWindow is nonzero, merges are applied in sorted groups of at least
+ * that many, for locality in the pinch graph.
+ *
+ * If compactThreshold is nonzero, trivial boundaries are joined on the pinched
+ * threads whenever that many pinches have been made since the last time, to
+ * keep the pinch graph from growing too large before each genome's join.
+ *
+ * If applyThreads is more than 1, merges in different connected components of
+ * the pinch graph are pinched on that many threads at once.
+ *
+ * If checkpoint is not empty, the merge state is saved to that directory after
+ * each genome, and if resume is set, the merge picks up from the state saved
+ * there instead of starting over.
+ *
  * If passed a StatTracker, will add in stats from every MappingScheme.
+ *
+ * If passed a DegreeHistogram, keeps it up to date with the pinch graph as
+ * each genome is merged.
+ *
+ * If passed a memory reporting function, calls it after each genome is merged
+ * with a name for the step, the pinch graph, and the view that was mapped to.
+ *
+ * If passed a ProgressReporter, has it watch the merge of each genome.
+ *
+ * If recordDirectory is not empty, the merges applied for each genome are
+ * recorded there, in genome<number>.merges, for replayMerges to replay.
+ *
+ * If selfQuery is set, contigs are mapped from their own BWT rows, as
+ * described for MappingMergeScheme::selfQuery.
+ *
+ * If spillDirectory is not empty, once spillAfter batches of merges are waiting
+ * to be applied, further batches are spilled to scratch files there until the
+ * applier catches up, so mapping never waits and memory stays bounded.
+ *
+ * If passed a MappingServer, also hands contig windows out to the worker
+ * processes connected to it at the start of each genome.
+ *
+ * If passed a MergeCache, contigs with merges cached against the same view are
+ * not mapped again, and the merges for each genome are cached.
+ *
+ * If passed a GapFiller, short gaps between consistent mappings are aligned
+ * and merged too.
+ *
+ * If pipeline is set, each genome after the first is mapped ahead of time, on
+ * threads of its own, against the level the genome before it is mapped to,
+ * while that genome's merges are applied and the next level is built. Only
+ * the windows whose merges may have been changed by that genome's merges are
+ * mapped again against the new level, as described for SpeculativeMerges.
  */
 stPinchThreadSet*
 mergeGreedy(
     const FMDIndex& index,
     std::function<MappingScheme*(FMDIndexView&&)> mappingSchemeFactory,
-    StatTracker* stats = nullptr
+    size_t windowLength = 0,
+    size_t windowOverlap = 0,
+    size_t threads = 32,
+    const std::vector<size_t>& cpus = std::vector<size_t>(),
+    size_t sortWindow = 0,
+    size_t compactThreshold = 0,
+    size_t applyThreads = 1,
+    const std::string& checkpoint = "",
+    bool resume = false,
+    StatTracker* stats = nullptr,
+    DegreeHistogram* degrees = nullptr,
+    std::function<void(const std::string&, stPinchThreadSet*,
+        const FMDIndexView*)> reportMemory = nullptr,
+    ProgressReporter* progress = nullptr,
+    const std::string& recordDirectory = "",
+    bool selfQuery = false,
+    const std::string& spillDirectory = "",
+    size_t spillAfter = 1024,
+    MappingServer* server = nullptr,
+    MergeCache* cache = nullptr,
+    const GapFiller* gapFiller = nullptr,
+    bool pipeline = false
 ) {
 
-    Log::info() << "Creating initial pinch thread set" << std::endl;
-    
-    // Make a thread set from our index.
-    stPinchThreadSet* threadSet = makeThreadSet(index);
-    
     if(index.getNumberOfGenomes() == 0) {
         // Make sure we have at least 1 genome.
         throw std::runtime_error("Can't merge 0 genomes greedily!");
     }
     
+    // Work out what to call spill files, so other runs spilling to the same
+    // place can't step on them.
+    std::string spillPrefix;
+    if(!spillDirectory.empty()) {
+        boost::filesystem::create_directories(spillDirectory);
+        spillPrefix = (boost::filesystem::path(spillDirectory) /
+            boost::filesystem::unique_path("merges-%%%%-%%%%-%%%%")).string();
+    }
+    
+    // Pin the pool workers that do the mapping, leaving the first CPU for the
+    // merge applier if we have more than one.
+    if(!TaskPool::global().pin(cpus.size() > 1 ?
+        std::vector<size_t>(cpus.begin() + 1, cpus.end()) : cpus)) {
+        
+        Log::error() << "Could not pin task pool workers" << std::endl;
+    }
+    
+    // This holds the pinch graph.
+    stPinchThreadSet* threadSet;
+    
     // Keep around a bit vector of all the positions that are in. This will
     // start with the very first genome, which we know exists.
     const GenericBitVector* includedPositions = &index.getGenomeMask(0);
     
-    // Canonicalize everything, yielding a bitvector (pointer) of ranges and a
-    // vector of canonicalized positions. Make sure only the selected positions
-    // are included, because the graph mapping stuff doesn't work if you have
-    // positions breaking up ranges that aren't masked in.
-    auto mergedRuns = identifyMergedRuns(threadSet, index, includedPositions);
+    // Keep the canonical position of every BWT row so that later only the
+    // texts that changed need to be redone.
+    std::vector<PackedTextPosition> canonicalized;
     
-    for(size_t genome = 1; genome < index.getNumberOfGenomes(); genome++) {
-        // For each genome that we have to merge in...
+    // And the merged runs, as a bitvector (pointer) of ranges and a vector of
+    // canonicalized positions.
+    std::pair<GenericBitVector*, std::vector<TextPosition>> mergedRuns;
+    
+    // What genome do we merge in first?
+    size_t firstGenome = 1;
+    
+    if(resume) {
+        // Pick up where the checkpoint left off.
+        firstGenome = loadCheckpoint(checkpoint, index, threadSet,
+            includedPositions, canonicalized, mergedRuns);
+    } else {
+        Log::info() << "Creating initial pinch thread set" << std::endl;
         
-        // Make a map for all the merged positions, because that's what's
-        // required by the view. TODO: Do this conversion earlier, and filter
-        // out ranges that are just mapped to the expected places.
-        std::map<size_t, TextPosition> rangesToPositions;
-        for(size_t i = 0; i < mergedRuns.second.size(); i++) {
-            
-            // Enter every entry in the map. TODO: be selective, or just convert
-            // to a full vector representation always.
-            rangesToPositions[i] = mergedRuns.second[i];
-        }
+        // Make a thread set from our index.
+        threadSet = makeThreadSet(index);
         
-        // Make a new FMDIndexView, giving it the mask and ranges bitvectors.
+        // Canonicalize everything. Make sure only the selected positions are
+        // included, because the graph mapping stuff doesn't work if you have
+        // positions breaking up ranges that aren't masked in.
+        canonicalized.resize(index.getBWTLength());
+        std::vector<size_t> allTexts(index.getNumberOfContigs() * 2);
+        std::iota(allTexts.begin(), allTexts.end(), 0);
+        canonicalizeTexts(threadSet, index, includedPositions, allTexts,
+            canonicalized, threads);
+        
+        // Then find the runs.
+        mergedRuns = identifyMergedRuns(index, canonicalized, NULL, threads);
+    }
+    
+    if(degrees != nullptr) {
+        // Count up the degrees of everything we are starting with.
+        degrees->updateAll(threadSet);
+    }
+    
+    // Do we own the included positions bitvector, or did it come with the
+    // index?
+    bool ownIncludedPositions = firstGenome > 1;
+    
+    // If we are pipelining, this holds the merges for the genome we are on,
+    // worked out ahead of time while the one before it was merged in.
+    std::unique_ptr<SpeculativeMerges> speculation;
+    
+    for(size_t genome = firstGenome; genome < index.getNumberOfGenomes();
+        genome++) {
+        
+        // For each genome that we have to merge in...
+        
+        // Make a new FMDIndexView, giving it the mask and ranges bitvectors,
+        // and handing over the canonical position for every range. We
+        // recalculate the merged runs after the merge anyway, so there's no
+        // need to copy them.
         FMDIndexView view(index, includedPositions, mergedRuns.first,
-            rangesToPositions);
+            std::move(mergedRuns.second));
         
         // Allocate a new MappingScheme using the view. 
         MappingScheme* mappingScheme = mappingSchemeFactory(std::move(view));
@@ -338,17 +454,100 @@ mergeGreedy(
         // and also the bitmask of what bottom-level things to count. We also
         // need to tell it what genome to map the contigs of.
         MappingMergeScheme scheme(index, mappingScheme, genome);
+        scheme.windowLength = windowLength;
+        scheme.windowOverlap = windowOverlap;
+        scheme.maxThreads = threads;
+        scheme.selfQuery = selfQuery;
+        scheme.gapFiller = gapFiller;
+        scheme.speculation = speculation.get();
+        if(!spillPrefix.empty()) {
+            scheme.spillAfter = spillAfter;
+            scheme.spillPrefix = spillPrefix + "-genome" +
+                std::to_string(genome);
+        }
+        
+        if(cache != nullptr) {
+            // Use and keep cached merges.
+            cache->startGenome(genome);
+            scheme.cache = cache;
+        }
+        
+        // If there are workers, ship them the level we map to.
+        std::string levelFile;
+        if(server != nullptr) {
+            scheme.workers = server->getWorkers();
+            if(!scheme.workers.empty()) {
+                levelFile = (boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path(
+                    "level-%%%%-%%%%-%%%%.lvl")).string();
+                mappingScheme->getView().saveLevelIndex(levelFile);
+                scheme.levelFile = levelFile;
+            }
+        }
 
         // Set it running and grab the queue where its results come out.
-        ConcurrentQueue<Merge>& queue = scheme.run();
+        ConcurrentQueue<MergeBatch>& queue = scheme.run();
+        
+        // If we're recording, record what gets applied.
+        std::unique_ptr<MergeRecorder> recorder;
+        if(!recordDirectory.empty()) {
+            recorder.reset(new MergeRecorder(recordDirectory + "/genome" +
+                std::to_string(genome) + ".merges"));
+        }
         
         // Make a merge applier to apply all those merges, and plug it in.
-        MergeApplier applier(index, queue, threadSet);
+        MergeApplier applier(index, queue, threadSet, nullptr, sortWindow,
+            compactThreshold, recorder.get(), applyThreads);
+        if(!cpus.empty() && !applier.pin(cpus.front())) {
+            Log::error() << "Could not pin merge applier thread" << std::endl;
+        }
+        
+        if(progress != nullptr) {
+            // Keep an eye on how it's going.
+            progress->watch("genome " + std::to_string(genome), scheme, queue,
+                applier);
+        }
         
-        // Wait for these things to be done.
+        // Wait for the mapping to be done.
         scheme.join();
+        
+        // Whatever we knew ahead of time has all been sent now.
+        speculation.reset();
+        
+        // While the merges are applied and the next level is built, map the
+        // next genome to this level.
+        std::unique_ptr<SpeculativeMerges> nextSpeculation;
+        if(pipeline && genome + 1 < index.getNumberOfGenomes()) {
+            MappingMergeScheme* ahead = new MappingMergeScheme(index,
+                mappingScheme, genome + 1);
+            ahead->windowLength = windowLength;
+            ahead->windowOverlap = windowOverlap;
+            ahead->selfQuery = selfQuery;
+            ahead->gapFiller = gapFiller;
+            nextSpeculation.reset(new SpeculativeMerges(index, ahead,
+                threads));
+        }
+        
+        // Wait for the merges to all be applied.
         applier.join();
         
+        if(!levelFile.empty()) {
+            // The workers have their own copies.
+            boost::filesystem::remove(levelFile);
+        }
+        
+        if(cache != nullptr) {
+            cache->finishGenome();
+        }
+        
+        if(recorder) {
+            recorder->close();
+        }
+        
+        if(progress != nullptr) {
+            progress->unwatch();
+        }
+        
         // Compute and log some statistics about the coverage of the alignments
         // used in the merge.
         
@@ -378,40 +577,100 @@ mergeGreedy(
         if(stats != nullptr) {
             Log::info() << "Copying over stats after merge" << std::endl;
             // Save stats if applicable
-            *(stats) += mappingScheme->getStats();
+            *(stats) += applier.getStats();
         }
         
-        // Delete the mapping scheme, so we can delete the stuff it uses
-        delete mappingScheme;
+        if(reportMemory) {
+            // Say how big everything got, while we still have the view.
+            reportMemory("genome " + std::to_string(genome), threadSet,
+                &mappingScheme->getView());
+        }
         
         // Merge the new genome into includedPositions, replacing the old
         // bitvector.
         GenericBitVector* newIncludedPositions = includedPositions->createUnion(
             index.getGenomeMask(genome));
         
-        if(genome > 1) {
-            // If we already alocated a new GenericBitVector that wasn't the one
-            // that came when we loaded in the genomes, we need to delete it.
-            delete includedPositions;
+        // Once nothing maps to the level any more, delete the mapping scheme
+        // and the stuff its view uses. If the next genome is being mapped to it
+        // ahead of time, that's not until the new level is built.
+        const GenericBitVector* levelIncludedPositions = includedPositions;
+        bool ownLevelIncludedPositions = ownIncludedPositions;
+        GenericBitVector* levelRuns = mergedRuns.first;
+        auto deleteLevel = [&]() {
+            if(stats != nullptr) {
+                *(stats) += mappingScheme->getStats();
+            }
+            delete mappingScheme;
+            
+            if(ownLevelIncludedPositions) {
+                // If we already alocated a new GenericBitVector that wasn't
+                // the one that came when we loaded in the genomes, we need to
+                // delete it.
+                delete levelIncludedPositions;
+            }
+            delete levelRuns;
+        };
+        if(!nextSpeculation) {
+            deleteLevel();
         }
+        
         includedPositions = newIncludedPositions;
+        ownIncludedPositions = true;
         
-        // Delete the old merged runs bit vector and recalculate merged runs on
-        // the newly updated thread set. Make sure to specify the new mask of
-        // included positions, so that masked-out positions don't break ranges
-        // that would otherwise be merged.
-        delete mergedRuns.first;
-        mergedRuns = identifyMergedRuns(threadSet, index, includedPositions);
+        // Only bases in blocks that were pinched can have new canonical
+        // positions, along with the new genome's bases, which are now
+        // included. Re-canonicalize just the texts those are on, with the new
+        // mask of included positions, so that masked-out positions don't break
+        // ranges that would otherwise be merged.
+        std::set<size_t> changedContigs;
+        for(size_t contig : applier.getAffectedContigs()) {
+            changedContigs.insert(contig);
+        }
+        for(size_t contig = index.getGenomeContigs(genome).first;
+            contig < index.getGenomeContigs(genome).second; contig++) {
+            
+            changedContigs.insert(contig);
+        }
+        std::vector<size_t> changedTexts;
+        for(size_t contig : changedContigs) {
+            // Do both strands.
+            changedTexts.push_back(contig * 2);
+            changedTexts.push_back(contig * 2 + 1);
+        }
+        canonicalizeTexts(threadSet, index, includedPositions, changedTexts,
+            canonicalized, threads);
         
+        if(degrees != nullptr) {
+            // The same contigs are the only ones whose nodes can have changed.
+            degrees->update(threadSet, std::vector<size_t>(
+                changedContigs.begin(), changedContigs.end()));
+        }
         
+        // Recalculate merged runs from the updated canonical positions.
+        mergedRuns = identifyMergedRuns(index, canonicalized, NULL,
+            threads);
         
+        if(nextSpeculation) {
+            // Now see what of the next genome still maps the same.
+            nextSpeculation->join();
+            nextSpeculation->validate(threadSet, threads);
+            deleteLevel();
+        }
+        speculation = std::move(nextSpeculation);
         
+        if(!checkpoint.empty()) {
+            // Save everything, so a failure in a later genome doesn't lose
+            // this one.
+            saveCheckpoint(checkpoint, genome + 1, index, threadSet,
+                includedPositions, canonicalized, mergedRuns);
+        }
     }
     
     // Delete the final merged run vector
     delete mergedRuns.first;
     
-    if(index.getNumberOfGenomes() > 1) {
+    if(ownIncludedPositions) {
         // And, if we had to make any additional included position
         // GenericBitVectors, get the last one of those too.
         delete includedPositions;
@@ -422,6 +681,325 @@ mergeGreedy(
     return threadSet;
 }
 
+/**
+ * Create a new thread set from the given FMDIndex, and merge it down by the
+ * progressive merging scheme, in parallel. Returns the pinched thread set.
+ *
+ * The progressive merging scheme starts with each genome by itself, and in
+ * each round pairs up the merged groups of genomes, mapping every genome in the
+ * second group of each pair to the first group and merging at the mappings.
+ * The pairs in a round are merged at the same time, so all the genomes are
+ * merged in a number of rounds logarithmic in the number of genomes. Groups
+ * in different pairs never share any blocks, so they can share one pinch graph
+ * and one array of canonical positions, with each pair's merges applied under
+ * a lock.
+ *
+ * Takes a factory function that can allocate new MappingSchemes for an index
+ * and the ranges and mask bitvectors.
+ *
+ * Contigs are mapped in windows as in mergeGreedy(), and the given number of
+ * threads is split among the pairs in each round. Merges are applied in sorted
+ * groups as in mergeGreedy() if sortWindow is nonzero, and pinched threads are
+ * compacted as in mergeGreedy() if compactThreshold is nonzero.
+ *
+ * If passed a StatTracker, will add in stats from every MappingScheme.
+ *
+ * If passed a DegreeHistogram, keeps it up to date with the pinch graph after
+ * each round.
+ *
+ * If passed a memory reporting function, calls it after each pair in each
+ * round is merged, with a name for the step, the pinch graph, and the view
+ * that was mapped to. It is called with the pinch graph locked.
+ *
+ * If selfQuery is set, contigs are mapped from their own BWT rows, as in
+ * mergeGreedy().
+ *
+ * If passed a GapFiller, short gaps between consistent mappings are aligned
+ * and merged too.
+ */
+stPinchThreadSet*
+mergeProgressive(
+    const FMDIndex& index,
+    std::function<MappingScheme*(FMDIndexView&&)> mappingSchemeFactory,
+    size_t windowLength = 0,
+    size_t windowOverlap = 0,
+    size_t threads = 32,
+    size_t sortWindow = 0,
+    size_t compactThreshold = 0,
+    StatTracker* stats = nullptr,
+    DegreeHistogram* degrees = nullptr,
+    std::function<void(const std::string&, stPinchThreadSet*,
+        const FMDIndexView*)> reportMemory = nullptr,
+    bool selfQuery = false,
+    const GapFiller* gapFiller = nullptr
+) {
+
+    Log::info() << "Creating initial pinch thread set" << std::endl;
+    
+    // Make a thread set from our index.
+    stPinchThreadSet* threadSet = makeThreadSet(index);
+    
+    if(index.getNumberOfGenomes() == 0) {
+        // Make sure we have at least 1 genome.
+        throw std::runtime_error("Can't merge 0 genomes progressively!");
+    }
+    
+    // Canonicalize everything. Every genome is in some group, so nothing is
+    // masked out here; each pair's own group is masked in when its runs are
+    // found.
+    std::vector<PackedTextPosition> canonicalized(index.getBWTLength());
+    std::vector<size_t> allTexts(index.getNumberOfContigs() * 2);
+    std::iota(allTexts.begin(), allTexts.end(), 0);
+    canonicalizeTexts(threadSet, index, NULL, allTexts, canonicalized,
+        threads);
+    
+    if(degrees != nullptr) {
+        // Count up the degrees of everything we are starting with.
+        degrees->updateAll(threadSet);
+    }
+    
+    // Start with each genome in its own group.
+    std::vector<std::vector<size_t>> groups;
+    for(size_t genome = 0; genome < index.getNumberOfGenomes(); genome++) {
+        groups.push_back(std::vector<size_t>(1, genome));
+    }
+    
+    // This protects the pinch graph, and the stats and changed contigs, from
+    // the pairs being merged at the same time.
+    std::mutex graphLock;
+    
+    for(size_t round = 0; groups.size() > 1; round++) {
+        // How many pairs can we make?
+        size_t pairs = groups.size() / 2;
+        
+        Log::info() << "Progressive merge round " << round << ": " << pairs <<
+            " pairs of " << groups.size() << " groups" << std::endl;
+        
+        // Which contigs need to be re-canonicalized after this round?
+        std::set<size_t> changedContigs;
+        
+        // Split the threads among the pairs.
+        size_t pairThreads = std::max(threads / pairs, (size_t) 1);
+        
+        runThreads(pairs, [&](size_t pair) {
+            // Map the second group onto the first.
+            const std::vector<size_t>& target = groups[pair * 2];
+            const std::vector<size_t>& source = groups[pair * 2 + 1];
+            
+            // Mask in the whole first group.
+            std::vector<const GenericBitVector*> genomeMasks;
+            for(size_t genome : target) {
+                genomeMasks.push_back(&index.getGenomeMask(genome));
+            }
+            GenericBitVector* mask = GenericBitVector::createUnionOf(
+                genomeMasks);
+            
+            // Find the first group's merged runs, and make a MappingScheme
+            // for them.
+            auto mergedRuns = identifyMergedRuns(index, canonicalized, mask,
+                pairThreads);
+            FMDIndexView view(index, mask, mergedRuns.first,
+                std::move(mergedRuns.second));
+            MappingScheme* mappingScheme = mappingSchemeFactory(
+                std::move(view));
+            
+            for(size_t genome : source) {
+                // Map and merge each genome of the second group.
+                MappingMergeScheme scheme(index, mappingScheme, genome);
+                scheme.windowLength = windowLength;
+                scheme.windowOverlap = windowOverlap;
+                scheme.maxThreads = pairThreads;
+                scheme.selfQuery = selfQuery;
+                scheme.gapFiller = gapFiller;
+                
+                ConcurrentQueue<MergeBatch>& queue = scheme.run();
+                MergeApplier applier(index, queue, threadSet, &graphLock,
+                    sortWindow, compactThreshold);
+                scheme.join();
+                applier.join();
+                
+                // Work out what the merges touched while nobody else is
+                // changing the graph.
+                std::lock_guard<std::mutex> lock(graphLock);
+                for(size_t contig : applier.getAffectedContigs()) {
+                    changedContigs.insert(contig);
+                }
+                if(stats != nullptr) {
+                    *(stats) += applier.getStats();
+                }
+                
+                auto queueLock = queue.lock();
+                Log::output() << "Bases aligned from genome " << genome <<
+                    " in round " << round << ": " <<
+                    queue.getThroughput(queueLock) << std::endl;
+            }
+            
+            if(stats != nullptr) {
+                // Save stats if applicable
+                std::lock_guard<std::mutex> lock(graphLock);
+                *(stats) += mappingScheme->getStats();
+            }
+            
+            if(reportMemory) {
+                // Say how big everything got, while we still have the view.
+                std::lock_guard<std::mutex> lock(graphLock);
+                reportMemory("round " + std::to_string(round) + " pair " +
+                    std::to_string(pair), threadSet,
+                    &mappingScheme->getView());
+            }
+            
+            // Delete the mapping scheme, so we can delete the stuff it uses.
+            delete mappingScheme;
+            delete mergedRuns.first;
+            delete mask;
+        });
+        
+        // Join any trivial boundaries.
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        
+        // Re-canonicalize the texts on contigs the merges touched.
+        std::vector<size_t> changedTexts;
+        for(size_t contig : changedContigs) {
+            // Do both strands.
+            changedTexts.push_back(contig * 2);
+            changedTexts.push_back(contig * 2 + 1);
+        }
+        canonicalizeTexts(threadSet, index, NULL, changedTexts, canonicalized,
+            threads);
+        
+        if(degrees != nullptr) {
+            // Recount the nodes on those same contigs.
+            degrees->update(threadSet, std::vector<size_t>(
+                changedContigs.begin(), changedContigs.end()));
+        }
+        
+        // Put each pair's groups together, and carry over any group left
+        // without a partner.
+        std::vector<std::vector<size_t>> merged;
+        for(size_t pair = 0; pair < pairs; pair++) {
+            merged.push_back(groups[pair * 2]);
+            merged.back().insert(merged.back().end(),
+                groups[pair * 2 + 1].begin(), groups[pair * 2 + 1].end());
+        }
+        if(groups.size() % 2 == 1) {
+            merged.push_back(groups.back());
+        }
+        groups = std::move(merged);
+    }
+    
+    return threadSet;
+}
+
+/**
+ * Create a new thread set from the given FMDIndex, and merge it down by the
+ * LCP merging scheme, in parallel. Returns the pinched thread set.
+ *
+ * The LCP merging scheme maps nothing: it scans the LCP array of the index
+ * once, on the given number of threads, and merges the bases that start each
+ * context found exactly once in each of two or more genomes, as long as the
+ * context is at least minContext bases long. See LCPMergeScheme.
+ *
+ * Merges are applied in sorted groups as in mergeGreedy() if sortWindow is
+ * nonzero, pinched threads are compacted as in mergeGreedy() if
+ * compactThreshold is nonzero, and merges are pinched on applyThreads threads
+ * as in mergeGreedy().
+ *
+ * If passed a StatTracker, will add in stats from the merge applier.
+ *
+ * If passed a DegreeHistogram, fills it in from the merged pinch graph.
+ */
+stPinchThreadSet*
+mergeLCP(
+    const FMDIndex& index,
+    size_t minContext = 1,
+    size_t threads = 32,
+    size_t sortWindow = 0,
+    size_t compactThreshold = 0,
+    size_t applyThreads = 1,
+    StatTracker* stats = nullptr,
+    DegreeHistogram* degrees = nullptr
+) {
+    
+    Log::info() << "Creating initial pinch thread set" << std::endl;
+    
+    // Make a thread set from our index.
+    stPinchThreadSet* threadSet = makeThreadSet(index);
+    
+    // Set the scan going, and apply what it finds.
+    LCPMergeScheme scheme(index);
+    scheme.minContext = minContext;
+    scheme.maxThreads = threads;
+    ConcurrentQueue<MergeBatch>& queue = scheme.run();
+    MergeApplier applier(index, queue, threadSet, nullptr, sortWindow,
+        compactThreshold, nullptr, applyThreads);
+    scheme.join();
+    applier.join();
+    
+    // Join any trivial boundaries.
+    stPinchThreadSet_joinTrivialBoundaries(threadSet);
+    
+    if(stats != nullptr) {
+        *(stats) += applier.getStats();
+    }
+    
+    if(degrees != nullptr) {
+        // Everything may have changed, so count it all.
+        degrees->updateAll(threadSet);
+    }
+    
+    auto lock = queue.lock();
+    Log::output() << "Bases merged by LCP interval: " <<
+        queue.getThroughput(lock) << " in " << scheme.getGroupsFound() <<
+        " groups" << std::endl;
+    
+    return threadSet;
+}
+
+/**
+ * Write a breakdown of the memory used by the given index, the given view (if
+ * not null), and the given pinch graph (if not null) after the given merge
+ * step to the given stream, as <step>\t<structure>\t<part>\t<bytes> TSV
+ * lines. If HugePages are enabled, also says how many bytes they were asked
+ * for and how many of the process's bytes they back.
+ */
+void
+writeMemoryUsage(
+    std::ostream& stream,
+    const std::string& step,
+    const FMDIndex& index,
+    const FMDIndexView* view,
+    stPinchThreadSet* threadSet
+) {
+    
+    for(auto& kv : index.getMemoryUsage()) {
+        stream << step << "\tindex\t" << kv.first << "\t" << kv.second <<
+            std::endl;
+    }
+    
+    if(view != nullptr) {
+        for(auto& kv : view->getMemoryUsage()) {
+            stream << step << "\tview\t" << kv.first << "\t" << kv.second <<
+                std::endl;
+        }
+    }
+    
+    if(HugePages::isEnabled()) {
+        // Say how much memory huge pages were asked for, and how much of the
+        // whole process they actually back.
+        stream << step << "\thugePages\tadvised\t" <<
+            HugePages::getAdvisedBytes() << std::endl;
+        stream << step << "\thugePages\tbacked\t" <<
+            HugePages::getBackedBytes() << std::endl;
+    }
+    
+    if(threadSet != nullptr) {
+        for(auto& kv : getThreadSetMemoryUsage(threadSet)) {
+            stream << step << "\tpinchGraph\t" << kv.first << "\t" <<
+                kv.second << std::endl;
+        }
+    }
+}
+
 /**
  * Save an adjacency component spectrum to a file as a <size>\t<count> TSV.
  */
@@ -446,6 +1024,35 @@ writeAdjacencyComponentSpectrum(
 }
 
 
+/**
+ * Set the parameters of the given ZipMappingScheme, other than its mismatch
+ * tolerance, from the given command-line options, and have it offer slow
+ * queries to the given QueryTracer, if any.
+ */
+template<typename SearchType>
+void
+setZipParameters(
+    ZipMappingScheme<SearchType>& scheme,
+    const boost::program_options::variables_map& options,
+    QueryTracer* queryTracer
+) {
+    // Set the parameters from the arguments
+    scheme.minContextLength = options["context"].as<size_t>();
+    scheme.maxRangeCount = options["maxRangeCount"].as<size_t>();
+    scheme.maxExtendThrough = options["maxExtendThrough"].as<size_t>();
+    scheme.minUniqueStrings = options["minEditBound"].as<size_t>();
+    scheme.interpolationMargin = options["interpolationMargin"].as<size_t>();
+    scheme.maxRetractionTasks = options["maxRetractionTasks"].as<size_t>();
+    scheme.interleavedBases = options["interleavedBases"].as<size_t>();
+    
+    scheme.queryThreads = options["mapThreads"].as<size_t>();
+    scheme.queryMicroseconds = options["queryMicroseconds"].as<size_t>();
+    scheme.queryTracer = queryTracer;
+    
+    // Set up credit
+    scheme.credit.enabled = options.count("credit");
+    scheme.credit.maxMismatches = options["mismatches"].as<size_t>();
+}
 
 /**
  * createIndex: command-line tool to create a multi-level reference structure.
@@ -481,11 +1088,23 @@ main(
         ("help", "Print help messages") 
         ("noMerge", "Don't compute merged level, only make lowest-level index")
         ("alignment", boost::program_options::value<std::string>(), 
-            "File to save .c2h-format alignment in")
+            "File to save .c2h-format alignment in (bgzipped if it ends in "
+            ".gz)")
         ("alignmentFasta", boost::program_options::value<std::string>(), 
-            "File in which to save FASTA records for building HAL from .c2h")
+            "File in which to save FASTA records for building HAL from .c2h "
+            "(bgzipped if it ends in .gz)")
         ("lastGraph", boost::program_options::value<std::string>(),
             "File in which to dump the merged graph in LastGraph format")
+        ("graph", boost::program_options::value<std::string>(),
+            "File in which to save the merged graph in binary format")
+        ("package", boost::program_options::value<std::string>(),
+            "File in which to save the finished index directory as a single "
+            "compressed package, for mapReads --package")
+        ("graphAvro", boost::program_options::value<std::string>(),
+            "File in which to save the merged graph's segments as Avro, for "
+            "Spark")
+        ("levelIndex", boost::program_options::value<std::string>(),
+            "File in which to save the merged level, for mapReads")
         ("degrees", boost::program_options::value<std::string>(), 
             "File in which to save degrees of pinch graph nodes")
         ("spectrum", boost::program_options::value<std::string>(), 
@@ -499,22 +1118,72 @@ main(
             "File in which to dump nontrivial rearrangements")
         ("mapStats", boost::program_options::value<std::string>(),
             "File in which to save the mapping stats from merging all levels")
+        ("hugePages", "Back the large index arrays with transparent huge pages "
+            "where the kernel allows")
+        ("asyncLog", "Write log lines from a background thread, so threads "
+            "don't wait on the terminal")
+        ("dropLogLines", "With --asyncLog, drop log lines instead of waiting "
+            "when the log falls behind")
+        ("perfCounters", "Count cycles, instructions, cache misses, branch "
+            "misses and TLB misses for each mapping phase in the mapping stats")
+        ("slowQueries", boost::program_options::value<std::string>(),
+            "FASTA to save the slowest contig windows mapped while merging "
+            "to, with their mapping times, counters, and parameters")
+        ("slowQueryCount", boost::program_options::value<size_t>()
+            ->default_value(100),
+            "Number of slowest contig windows to save")
         ("sampleRate", boost::program_options::value<unsigned int>()
             ->default_value(64), 
             "Set the suffix array sample rate to use")
+        ("sampleRuns", "Sample the suffix array at BWT run boundaries instead")
+        ("buildMemoryMB", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Build the BWT in batches under this many megabytes (0 for all "
+            "at once)")
+        ("buildThreads", boost::program_options::value<size_t>()
+            ->default_value(1),
+            "Sort suffixes in this many threads, by parallel prefix doubling "
+            "if more than 1")
+        ("bwtAlgorithm", boost::program_options::value<std::string>()
+            ->default_value("sort"),
+            "Construct the BWT by suffix sorting (\"sort\"), or without a "
+            "suffix array (\"ropebwt\", or \"bcr\" if all contigs are "
+            "the same length)")
+        ("indexCache", boost::program_options::value<std::string>(),
+            "Directory of finished indexes to reuse when the same FASTAs are "
+            "indexed with the same options, and to add new indexes to")
+        ("append", "Add the FASTAs to the index already in the index "
+            "directory, instead of rebuilding it from scratch")
+        ("minUniqueTable", "Save the length of the shortest unique string "
+            "starting and ending at every base with the index")
+        ("kmerFilter", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Save a filter of all the k-mers of this length in the index, to "
+            "give up on hopeless extensions early")
+        ("packedSuffixArray", "Save a full suffix array, bit-packed, with the "
+            "index, to locate without LF-mapping")
+        ("contigCacheMB", boost::program_options::value<size_t>()
+            ->default_value(1024),
+            "Set how many megabytes of reconstructed contigs to keep around")
+        ("locateCacheEntries", boost::program_options::value<size_t>()
+            ->default_value(1 << 20),
+            "Set how many located BWT rows to remember, or 0 to remember none")
         ("indexDirectory", boost::program_options::value<std::string>()
             ->required(), 
-            "Directory to make the index in; will be deleted and replaced!")
+            "Directory to make the index in; its index will be replaced, or "
+            "resumed if it is an interrupted build of the same FASTAs")
         ("fastas", boost::program_options::value<std::vector<std::string> >()
             ->required()
             ->multitoken(),
-            "FASTA files to load")
+            "FASTA files to load; at most 134,217,727 contigs in all, each "
+            "under 2^36 bases")
         ("scheme", boost::program_options::value<std::string>()
             ->default_value("greedy"),
-            "Merging scheme (\"greedy\" only)")
+            "Merging scheme (\"greedy\", \"progressive\", or \"lcp\")")
         ("mapType", boost::program_options::value<std::string>()
             ->default_value("natural"),
-            "Merging scheme (\"natural\" or \"zip\")")
+            "Merging scheme (\"natural\", \"zip\", or \"hybrid\" to map "
+            "with zip exactly and then with mismatches where that fails)")
         ("context", boost::program_options::value<size_t>()
             ->default_value(0), 
             "Minimum required context length to map on")
@@ -537,7 +1206,106 @@ main(
             "Maximum number of merged ranges to visit in a mapping step")
         ("maxExtendThrough", boost::program_options::value<size_t>()
             ->default_value(100),
-            "Maximum number of bases to try to extend through");
+            "Maximum number of bases to try to extend through")
+        ("interpolationMargin", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Place bases with more than this much context on both sides "
+            "inside exact matches by offset from the last base (zip only)")
+        ("maxRetractionTasks", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Leave a base unmapped if it needs more than this many retraction "
+            "tasks, or 0 for no limit (zip only)")
+        ("interleavedBases", boost::program_options::value<size_t>()
+            ->default_value(1),
+            "Work on this many bases at once on each thread, prefetching for "
+            "each while the others run (zip only)")
+        ("hybridContext", boost::program_options::value<size_t>()
+            ->default_value(100),
+            "Search this many bases on each side of bases that don't map "
+            "exactly when mapping them with mismatches (hybrid only)")
+        ("queryMicroseconds", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Leave the rest of a contig unmapped once mapping it has taken "
+            "this long, or 0 for no limit")
+        ("mapThreads", boost::program_options::value<size_t>()
+            ->default_value(1),
+            "Map each long contig in this many threads, in windows")
+        ("mergeWindow", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Split contigs into windows this long to spread them across "
+            "merge threads (0 for whole contigs)")
+        ("mergeOverlap", boost::program_options::value<size_t>()
+            ->default_value(10000),
+            "Map each merge window with this much flanking context")
+        ("selfQuery", "Map contigs from their own BWT rows instead of by "
+            "searching (natural mapType only)")
+        ("fillGaps", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Align gaps of up to this many unmapped bases between consistent "
+            "mappings, and merge the bases that match (0 to not fill gaps)")
+        ("fillGapDivergence", boost::program_options::value<double>()
+            ->default_value(0.1),
+            "With --fillGaps, only fill gaps that align with at most this "
+            "many edits per base")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(32),
+            "Run parallel work on this many threads, and map up to this many "
+            "contigs or merge windows at once when merging")
+        ("affinity", boost::program_options::value<std::string>()
+            ->default_value("none"),
+            "Pin merging threads to CPUs: none, compact (fill each socket in "
+            "turn), or spread (alternate sockets)")
+        ("sortMerges", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Sort merges in groups of at least this many along the pinch "
+            "threads before applying them (0 to apply as they come)")
+        ("compactEvery", boost::program_options::value<size_t>()
+            ->default_value(1000000),
+            "Join trivial boundaries on pinched threads after this many "
+            "pinches, to bound the pinch graph's size during a merge (0 to "
+            "only join once per merge step)")
+        ("applyThreads", boost::program_options::value<size_t>()
+            ->default_value(1),
+            "Pinch merges in separate parts of the pinch graph on this many "
+            "threads at once (greedy and lcp only)")
+        ("pipelineGenomes", "Map each genome against the previous genome's "
+            "level while the previous genome is merged in, and map again "
+            "only what its merges changed (greedy only)")
+        ("progressInterval", boost::program_options::value<double>()
+            ->default_value(60),
+            "Report greedy merge progress every this many seconds (0 to not "
+            "report)")
+        ("progressMetrics", boost::program_options::value<std::string>(),
+            "File to keep greedy merge progress metrics in, in Prometheus "
+            "text format")
+        ("recordMerges", boost::program_options::value<std::string>(),
+            "Directory to record the merges applied for each genome in, for "
+            "replayMerges")
+        ("spillMerges", boost::program_options::value<std::string>(),
+            "Scratch directory to spill greedy merges to when they can't be "
+            "applied as fast as they are found")
+        ("spillAfter", boost::program_options::value<size_t>()
+            ->default_value(1024),
+            "With --spillMerges, spill once this many batches of merges are "
+            "waiting in memory")
+        ("distribute", boost::program_options::value<uint16_t>(),
+            "Listen on this TCP port for createIndex --mapFor workers to help "
+            "map each genome in the greedy merge")
+        ("mapFor", boost::program_options::value<std::string>(),
+            "Instead of merging, map for the createIndex listening at this "
+            "host:port, with the index already in the index directory and "
+            "the same mapping options")
+        ("mergeCache", boost::program_options::value<std::string>(),
+            "Directory to keep the greedy merge's merges for each contig in, "
+            "so later runs on indexes starting with the same genomes only map "
+            "what changed")
+        ("checkpoint", "Save the greedy merge state in the index directory "
+            "after each genome")
+        ("resume", "Load the index already in the index directory and resume "
+            "the greedy merge from its checkpoint")
+        ("memoryReport", boost::program_options::value<std::string>(),
+            "Write a TSV of the bytes used by each part of the index, view, "
+            "and pinch graph after each merge step to the given file");
         
     // And set up our positional arguments
     boost::program_options::positional_options_description positionals;
@@ -587,6 +1355,11 @@ main(
         return -1; 
     }
     
+    if(options.count("asyncLog")) {
+        // Start logging from the background before anything gets logged.
+        Log::startAsync(1 << 16, options.count("dropLogLines"));
+    }
+    
     // If we get here, we have the right arguments. Parse them.
     
     // This holds the directory for the reference structure to build.
@@ -609,24 +1382,115 @@ main(
     // Dump our hostname
     logHostname();
     
+    // Every parallel stage shares one pool of threads.
+    TaskPool::setGlobalSize(options["threads"].as<size_t>());
+    
+    if(options.count("indexCache")) {
+        // Reuse a cached index instead of building it, if there is one.
+        setIndexCache(options["indexCache"].as<std::string>());
+    }
+    
+    if(options.count("hugePages")) {
+        // Ask for huge pages before anything big gets loaded.
+        HugePages::enable();
+    }
+    
     // Index the bottom-level FASTAs. Use the
-    // sample rate the user specified.
-    FMDIndex* indexPointer = buildIndex(indexDirectory, fastas,
-        options["sampleRate"].as<unsigned int>());
+    // sample rate the user specified. If we're resuming a merge, the index was
+    // already built, so just load it.
+    FMDIndex* indexPointer = options.count("resume") ||
+        options.count("mapFor") ?
+        new FMDIndex(indexDirectory + "/index.basename") :
+        options.count("append") ?
+        appendIndex(indexDirectory, fastas,
+        options["sampleRate"].as<unsigned int>(), false, 0, false,
+        options.count("sampleRuns"), options["buildThreads"].as<size_t>()) :
+        buildIndex(indexDirectory, fastas,
+        options["sampleRate"].as<unsigned int>(), false, 0, false,
+        options.count("sampleRuns"),
+        options["buildMemoryMB"].as<size_t>() * 1024 * 1024,
+        options["buildThreads"].as<size_t>(),
+        FMDIndexBuilder::parseBWTAlgorithm(
+        options["bwtAlgorithm"].as<std::string>()));
         
     // Make a reference out of the index pointer because we're not letting it
     // out of our scope.
     FMDIndex& index = *indexPointer;
     
+    if(options.count("minUniqueTable")) {
+        // Work out the minimal unique lengths from the finished index, and save
+        // them so they get loaded with the index in the future.
+        MinUniqueTable* table = new MinUniqueTable(index);
+        table->save(indexDirectory + "/index.basename.mus");
+        
+        // Let the index we already have use them.
+        index.setMinUniqueTable(table);
+    }
+    
+    if(options["kmerFilter"].as<size_t>() > 0) {
+        // Collect the k-mers of the finished index, and save them so they get
+        // loaded with the index in the future.
+        KmerFilter* filter = new KmerFilter(index,
+            options["kmerFilter"].as<size_t>());
+        filter->save(indexDirectory + "/index.basename.kmf");
+        
+        // Let the index we already have use them.
+        index.setKmerFilter(filter);
+    }
+    
+    if(options.count("packedSuffixArray")) {
+        // Fill in the whole suffix array from the finished index, and save it
+        // so mapReads and later merges can locate with it.
+        PackedSuffixArray* array = new PackedSuffixArray(index);
+        array->save(indexDirectory + "/index.basename.psa");
+        
+        // Let the index we already have use it.
+        index.setPackedSuffixArray(array);
+    }
+    
+    if(options.count("package")) {
+        // Everything in the index directory is done now, so pack it up for
+        // shipping.
+        IndexPackage::pack(indexDirectory,
+            options["package"].as<std::string>());
+    }
+    
+    // Keep the contigs we reconstruct for mapping on credit within budget.
+    index.setContigCacheBudget(options["contigCacheMB"].as<size_t>() << 20);
+    
+    // Remember rows we locate, since merging locates the same ones a lot.
+    index.setLocateCacheEntries(options["locateCacheEntries"].as<size_t>());
+    
     // Log memory usage with no pinch graph stuff having yet happened.
     Log::output() << "Memory usage with no merging:" << std::endl;
     logMemory();
     
+    // If we want a breakdown of that by structure, keep a file to put it in.
+    std::ofstream memoryReport;
+    if(options.count("memoryReport")) {
+        memoryReport.open(options["memoryReport"].as<std::string>().c_str());
+        if(!memoryReport) {
+            throw std::runtime_error("Could not open memory report " +
+                options["memoryReport"].as<std::string>());
+        }
+        memoryReport << "step\tstructure\tpart\tbytes" << std::endl;
+        writeMemoryUsage(memoryReport, "start", index, nullptr, nullptr);
+    }
+    
     if(options.count("noMerge")) {
         // Skip merging any of the higher levels.
         return 0;
     }
     
+    if(index.getNumberOfContigs() * 2 >=
+        ((size_t) 1 << PackedTextPosition::TEXT_BITS) - 1) {
+        
+        // Merging stores positions packed, and they can't name this many
+        // texts.
+        throw std::runtime_error("Too many contigs to merge: " +
+            std::to_string(index.getNumberOfContigs()));
+    }
+    
     // Grab the context types we are going to use to merge
     std::string mapType = options["mapType"].as<std::string>();
     
@@ -642,97 +1506,279 @@ main(
     // We want to know the stats that the MappingScheme(s) make while we merge
     StatTracker stats;
     
+    if(options.count("perfCounters")) {
+        // Also count hardware events in each mapping phase, if the kernel will
+        // let us.
+        PerfCounters::enable();
+    }
+    
+    // If asked, keep the slowest windows mapped in any merge step.
+    std::unique_ptr<QueryTracer> queryTracer;
+    if(options.count("slowQueries")) {
+        queryTracer.reset(new QueryTracer(
+            options["slowQueryCount"].as<size_t>()));
+    }
+    
     // We want to flag whether we want mismatches
     
-    if(mergeScheme == "greedy") {
-        // Use the greedy merge instead.
-        threadSet = mergeGreedy(index, [&](FMDIndexView&& view) {
+    // This makes a new MappingScheme, set up from our options, for each
+    // merge step.
+    auto mappingSchemeFactory = [&](FMDIndexView&& view) -> MappingScheme* {
+    
+        // Make a new MappingScheme for this step and return a pointer to
+        // it. TODO: would it be better to just make one MappingScheme and
+        // let the ranges and mask be updated? Or passed to the map method?
         
-            // Make a new MappingScheme for this step and return a pointer to
-            // it. TODO: would it be better to just make one MappingScheme and
-            // let the ranges and mask be updated? Or passed to the map method?
+        // Hiding our parameters by sneaking an option struct into a closure
+        // seems a bit odd...
+    
+        if(options["mapType"].as<std::string>() == "natural") {
+            // We want a NaturalMappingScheme
+            NaturalMappingScheme* scheme = new NaturalMappingScheme(
+                std::move(view));
+                
+            // Populate it
+            scheme->credit = options.count("credit");
+            scheme->minContext = options["context"].as<size_t>();
+            scheme->z_max = options["mismatches"].as<size_t>();
+            scheme->ignoreMatchesBelow = options[
+                "ignoreMatchesBelow"].as<size_t>();
+            scheme->minHammingBound = options[
+                "minEditBound"].as<size_t>();
+            scheme->maxHammingDistance = options[
+                "maxEditDistance"].as<size_t>();
+            scheme->unstable = options.count("unstable");
+            scheme->queryThreads = options["mapThreads"].as<size_t>();
+            scheme->queryMicroseconds =
+                options["queryMicroseconds"].as<size_t>();
+            scheme->queryTracer = queryTracer.get();
             
-            // Hiding our parameters by sneaking an option struct into a closure
-            // seems a bit odd...
+            return (MappingScheme*) scheme;
+        } else if(options["mapType"].as<std::string>() == "zip" ||
+            options["mapType"].as<std::string>() == "hybrid") {
+            // Make a ZipMappingScheme, which can handle graphs. But we need
+            // the forward and reverse versions of merged ranges to agree on
+            // what positions they are assigned when merging, but the view
+            // takes care of that.
+            
+            bool hybrid = options["mapType"].as<std::string>() == "hybrid";
+            size_t maxEditDistance = options["maxEditDistance"].as<size_t>();
+            if(hybrid && maxEditDistance == 0) {
+                throw std::runtime_error(
+                    "Hybrid mapping needs a nonzero --maxEditDistance");
+            }
+            
+            ZipMappingScheme<FMDPosition>* exact = nullptr;
+            if(hybrid || maxEditDistance == 0) {
+                // Map exactly. The hybrid needs the view again for its
+                // fallback, so it gets a copy.
+                exact = new ZipMappingScheme<FMDPosition>(hybrid ?
+                    FMDIndexView(view) : std::move(view));
+                setZipParameters(*exact, options, queryTracer.get());
+                if(!hybrid) {
+                    return (MappingScheme*) exact;
+                }
+            }
+            
+            // Use mismatch tolerance
+            ZipMappingScheme<FMDPositionGroup>* tolerant =
+                new ZipMappingScheme<FMDPositionGroup>(std::move(view));
+            setZipParameters(*tolerant, options, queryTracer.get());
+            tolerant->mismatchTolerance = maxEditDistance;
+            if(!hybrid) {
+                return (MappingScheme*) tolerant;
+            }
+            
+            // Only search with mismatches where mapping exactly failed. The
+            // hybrid times whole queries itself.
+            exact->queryTracer = nullptr;
+            tolerant->queryTracer = nullptr;
+            HybridMappingScheme* scheme = new HybridMappingScheme(exact,
+                tolerant);
+            scheme->fallbackContext = options["hybridContext"].as<size_t>();
+            scheme->queryTracer = queryTracer.get();
+            return (MappingScheme*) scheme;
+        } else {
+            // They asked for a mapping scheme we don't have.
+            throw std::runtime_error("Invalid mapping scheme: " +
+                options["mapType"].as<std::string>());
+        }
+    };
+    
+    // If we want to fill in gaps between mappings, make something to do it.
+    std::unique_ptr<GapFiller> gapFiller;
+    if(options["fillGaps"].as<size_t>() > 0) {
+        gapFiller.reset(new GapFiller(index, options["fillGaps"].as<size_t>(),
+            options["fillGapDivergence"].as<double>()));
+    }
+    
+    if(options.count("mapFor")) {
+        // Help another createIndex with its merge instead.
+        mapForMaster(options["mapFor"].as<std::string>(), index,
+            mappingSchemeFactory, gapFiller.get());
+        return 0;
+    }
+    
+    // This writes out the memory breakdown after each merge step, if we want
+    // one.
+    std::function<void(const std::string&, stPinchThreadSet*,
+        const FMDIndexView*)> reportMemory = nullptr;
+    if(memoryReport.is_open()) {
+        reportMemory = [&](const std::string& step, stPinchThreadSet* graph,
+            const FMDIndexView* view) {
+            
+            writeMemoryUsage(memoryReport, step, index, view, graph);
+        };
+    }
+    
+    // If we want the pinch graph degrees, keep track of them as we merge, so
+    // we don't have to go through the whole graph again at the end.
+    DegreeHistogram* degrees = nullptr;
+    if(options.count("degrees")) {
+        degrees = new DegreeHistogram(index.getNumberOfContigs());
+    }
+    
+    // If we want to hear how the merge is going, start something to tell us.
+    std::unique_ptr<ProgressReporter> progress;
+    if(options["progressInterval"].as<double>() > 0) {
+        progress.reset(new ProgressReporter(
+            options["progressInterval"].as<double>(),
+            options.count("progressMetrics") ?
+            options["progressMetrics"].as<std::string>() : ""));
+    }
+    
+    // If we are going to reuse merges, set up the cache. It is keyed on all
+    // the options that change what mapping finds.
+    std::unique_ptr<MergeCache> mergeCache;
+    if(options.count("mergeCache")) {
+        if(mergeScheme != "greedy") {
+            throw std::runtime_error(
+                "Caching merges is only implemented for the greedy merge");
+        }
         
-            if(options["mapType"].as<std::string>() == "natural") {
-                // We want a NaturalMappingScheme
-                NaturalMappingScheme* scheme = new NaturalMappingScheme(
-                    std::move(view));
-                    
-                // Populate it
-                scheme->credit = options.count("credit");
-                scheme->minContext = options["context"].as<size_t>();
-                scheme->z_max = options["mismatches"].as<size_t>();
-                scheme->ignoreMatchesBelow = options[
-                    "ignoreMatchesBelow"].as<size_t>();
-                scheme->minHammingBound = options[
-                    "minEditBound"].as<size_t>();
-                scheme->maxHammingDistance = options[
-                    "maxEditDistance"].as<size_t>();
-                scheme->unstable = options.count("unstable");
-                
-                return (MappingScheme*) scheme;
-            } else if(options["mapType"].as<std::string>() == "zip") {
-                // Make a ZipMappingScheme, which can handle graphs. But we need
-                // the forward and reverse versions of merged ranges to agree on
-                // what positions they are assigned when merging, but the view
-                // takes care of that.
-                
-                if(options["maxEditDistance"].as<size_t>() > 0) {
-                
-                    // Use mismatch tolerance
-                    
-                    ZipMappingScheme<FMDPositionGroup>* scheme =
-                        new ZipMappingScheme<FMDPositionGroup>(std::move(view));
-                    
-                    // Set the parameters from the arguments
-                    scheme->minContextLength = options["context"].as<size_t>();
-                    scheme->maxRangeCount = 
-                        options["maxRangeCount"].as<size_t>();
-                    scheme->maxExtendThrough =
-                        options["maxExtendThrough"].as<size_t>();
-                    scheme->minUniqueStrings =
-                        options["minEditBound"].as<size_t>();
-                    scheme->mismatchTolerance =
-                        options["maxEditDistance"].as<size_t>();
-                    
-                    // Set up credit
-                    scheme->credit.enabled = options.count("credit");
-                    scheme->credit.maxMismatches =
-                        options["mismatches"].as<size_t>();
-                    
-                    return (MappingScheme*) scheme;
-                
-                } else {
-                
-                    // Use mismatch tolerance
-                    ZipMappingScheme<FMDPosition>* scheme =
-                        new ZipMappingScheme<FMDPosition>(std::move(view));
-                    
-                    // Set the parameters from the arguments
-                    scheme->minContextLength = options["context"].as<size_t>();
-                    scheme->maxRangeCount = 
-                        options["maxRangeCount"].as<size_t>();
-                    scheme->maxExtendThrough =
-                        options["maxExtendThrough"].as<size_t>();
-                    scheme->minUniqueStrings =
-                        options["minEditBound"].as<size_t>();
-                    
-                    // Set up credit
-                    scheme->credit.enabled = options.count("credit");
-                    scheme->credit.maxMismatches =
-                        options["mismatches"].as<size_t>();
+        std::ostringstream optionsKey;
+        for(const std::string& name : {"mapType", "context", "credit",
+            "mismatches", "ignoreMatchesBelow", "minEditBound",
+            "maxEditDistance", "unstable", "maxRangeCount", "maxExtendThrough",
+            "interpolationMargin", "interleavedBases", "hybridContext",
+            "queryMicroseconds", "mergeWindow", "mergeOverlap", "selfQuery",
+            "fillGaps", "fillGapDivergence", "pipelineGenomes"}) {
+            
+            optionsKey << name;
+            if(options.count(name)) {
+                const boost::any& value = options[name].value();
+                if(const size_t* number = boost::any_cast<size_t>(&value)) {
+                    optionsKey << "=" << *number;
+                } else if(const double* real =
+                    boost::any_cast<double>(&value)) {
                     
-                    return (MappingScheme*) scheme;
+                    optionsKey << "=" << *real;
+                } else if(const std::string* text =
+                    boost::any_cast<std::string>(&value)) {
                     
+                    optionsKey << "=" << *text;
                 }
             } else {
-                // They asked for a mapping scheme we don't have.
-                throw std::runtime_error("Invalid mapping scheme: " +
-                    options["mapType"].as<std::string>());
+                optionsKey << " unset";
             }
-        }, &stats);
+            optionsKey << ";";
+        }
+        mergeCache.reset(new MergeCache(options["mergeCache"].as<std::string>(),
+            index, optionsKey.str()));
+    }
+    
+    if(options.count("pipelineGenomes") && mergeScheme != "greedy") {
+        // Only the greedy merge maps one genome after another.
+        throw std::runtime_error(
+            "Pipelining genomes is only implemented for the greedy merge");
+    }
+    
+    // If we are going to have help mapping, start listening for it.
+    std::unique_ptr<MappingServer> server;
+    if(options.count("distribute")) {
+        if(mergeScheme != "greedy") {
+            throw std::runtime_error(
+                "Distributed mapping is only implemented for the greedy merge");
+        }
+        server.reset(new MappingServer(index,
+            options["distribute"].as<uint16_t>()));
+    }
+    
+    if(mergeScheme == "greedy") {
+        // Use the greedy merge instead.
+        if(options.count("recordMerges")) {
+            // Make somewhere to put the recordings.
+            boost::filesystem::create_directories(
+                options["recordMerges"].as<std::string>());
+        }
+        
+        threadSet = mergeGreedy(index, mappingSchemeFactory,
+            options["mergeWindow"].as<size_t>(),
+            options["mergeOverlap"].as<size_t>(),
+            options["threads"].as<size_t>(),
+            getCPUOrder(options["affinity"].as<std::string>()),
+            options["sortMerges"].as<size_t>(),
+            options["compactEvery"].as<size_t>(),
+            options["applyThreads"].as<size_t>(),
+            (options.count("checkpoint") || options.count("resume")) ?
+            indexDirectory + "/checkpoint" : "",
+            options.count("resume"), &stats, degrees, reportMemory,
+            progress.get(), options.count("recordMerges") ?
+            options["recordMerges"].as<std::string>() : "",
+            options.count("selfQuery"), options.count("spillMerges") ?
+            options["spillMerges"].as<std::string>() : "",
+            options["spillAfter"].as<size_t>(), server.get(),
+            mergeCache.get(), gapFiller.get(),
+            options.count("pipelineGenomes"));
+    } else if(mergeScheme == "progressive") {
+        if(options.count("checkpoint") || options.count("resume")) {
+            // Only the greedy merge knows how to save its progress.
+            throw std::runtime_error(
+                "Checkpointing is only implemented for the greedy merge");
+        }
+        if(options.count("recordMerges")) {
+            // Or record its merges in an order that can be replayed.
+            throw std::runtime_error(
+                "Recording merges is only implemented for the greedy merge");
+        }
+        
+        // Merge pairs of genomes, then pairs of those, and so on.
+        threadSet = mergeProgressive(index, mappingSchemeFactory,
+            options["mergeWindow"].as<size_t>(),
+            options["mergeOverlap"].as<size_t>(),
+            options["threads"].as<size_t>(),
+            options["sortMerges"].as<size_t>(),
+            options["compactEvery"].as<size_t>(), &stats, degrees,
+            reportMemory, options.count("selfQuery"), gapFiller.get());
+    } else if(mergeScheme == "lcp") {
+        if(options.count("checkpoint") || options.count("resume")) {
+            // Only the greedy merge knows how to save its progress.
+            throw std::runtime_error(
+                "Checkpointing is only implemented for the greedy merge");
+        }
+        if(options.count("recordMerges")) {
+            // Or record its merges in an order that can be replayed.
+            throw std::runtime_error(
+                "Recording merges is only implemented for the greedy merge");
+        }
+        if(gapFiller) {
+            // And there are no mappings to fill between.
+            throw std::runtime_error(
+                "Filling gaps is only implemented for mapping merges");
+        }
+        
+        // Merge everything at once, straight from the LCP array, using the
+        // minimum context length as the minimum interval depth.
+        threadSet = mergeLCP(index, options["context"].as<size_t>(),
+            options["threads"].as<size_t>(),
+            options["sortMerges"].as<size_t>(),
+            options["compactEvery"].as<size_t>(),
+            options["applyThreads"].as<size_t>(), &stats, degrees);
+        
+        if(reportMemory) {
+            // There's no view to report on.
+            reportMemory("lcp", threadSet, nullptr);
+        }
     } else {
         // Complain that's not a real merge scheme. TODO: Can we make the
         // options parser parse an enum or something instead of this?
@@ -742,11 +1788,18 @@ main(
     
     // Now the merge is done. Stop timing.
     delete mergeTimer;
+    
+    if(memoryReport.is_open()) {
+        // Report on the finished pinch graph too.
+        writeMemoryUsage(memoryReport, "merged", index, nullptr, threadSet);
+        memoryReport.close();
+    }
         
-    if(options.count("degrees")) {
+    if(degrees != nullptr) {
         // Save a dump of pinch graph node degrees (for both blocks and bare
         // segments).
-        writeDegrees(threadSet, options["degrees"].as<std::string>());
+        degrees->write(options["degrees"].as<std::string>());
+        delete degrees;
     }
     
     if(options.count("alignment")) {
@@ -772,57 +1825,71 @@ main(
         writeLastGraph(threadSet, options["lastGraph"].as<std::string>());
     }
     
+    if(options.count("graph")) {
+        // Save the graph in binary, for tools that want to load it directly.
+        writeBinaryGraph(threadSet, options["graph"].as<std::string>());
+    }
+    
+    if(options.count("graphAvro")) {
+        // And as Avro, for Spark jobs to read without parsing anything.
+        writeAvroGraph(threadSet, options["graphAvro"].as<std::string>());
+    }
+    
+    if(options.count("levelIndex")) {
+        // Save the merged level, so reads can be mapped to it later.
+        saveLevelIndex(threadSet, index,
+            options["levelIndex"].as<std::string>(),
+            options["threads"].as<size_t>());
+    }
+    
     // Make an IDSource to produce IDs not already claimed by contigs.
     IDSource<long long int> source(index.getTotalLength());
     
-    // This will hold the computed level index of the merged level.
-    std::pair<GenericBitVector*, std::vector<SmallSide> > levelIndex;
-    
     // Now, while we still have the threadSet, we can work out the adjacency
-    // components. 
-    auto components = getAdjacencyComponents(threadSet);
+    // components. They are pulled out once, and all the analyses we want are
+    // run on them together, in parallel.
+    AdjacencyAnalysis analysis = analyzeAdjacencyComponents(threadSet,
+        options.count("spectrum"), options.count("indelLengths"),
+        options.count("tandemDuplications"),
+        options.count("nontrivialRearrangements"),
+        options["threads"].as<size_t>());
     
     if(options.count("spectrum")) {
         // How many adjacency components are what size? Adjacency components of
         // size 2 are just SNPs or indels, while adjacency components of larger
         // sizes are generally more complex rearrangements.
-        auto spectrum = getAdjacencyComponentSpectrum(components);
     
         // Save a dump of pinch graph adjacency component sizes
-        writeAdjacencyComponentSpectrum(spectrum,
+        writeAdjacencyComponentSpectrum(analysis.spectrum,
             options["spectrum"].as<std::string>());
     }
     
     if(options.count("indelLengths")) {
-        // Get all the size-2 components, determine indel lengths for them, and
-        // save them to the file the user wanted them in.
-        writeColumn(getIndelLengths(filterComponentsBySize(components, 2)),
+        // Save the indel lengths of the size-2 components to the file the user
+        // wanted them in.
+        writeColumn(analysis.indelLengths,
             options["indelLengths"].as<std::string>()); 
     }
     
     if(options.count("tandemDuplications")) {
-        // Get all the size-4 components, and count tandem duplications.
-        size_t tandemDuplications = countTandemDuplications(
-            filterComponentsBySize(components, 4));
-          
-        // Hack the count into a 1-element vector and write it to the file.  
-        std::vector<size_t> tandemDupeVector {tandemDuplications};
+        // Hack the count of tandem duplications among the size-4 components
+        // into a 1-element vector and write it to the file.  
+        std::vector<size_t> tandemDupeVector {analysis.tandemDuplications};
         writeColumn(tandemDupeVector,
             options["tandemDuplications"].as<std::string>()); 
     }
     
     if(options.count("nontrivialRearrangements")) {
-        // Get all size>2 things and dump them.
-        writeAdjacencyComponents(filterComponentsBySize(components, 2, 
-            [](size_t a, size_t b) { return a > b; }), 
+        // Dump all the size>2 things.
+        writeAdjacencyComponents(analysis.components, analysis.nontrivial,
             options["nontrivialRearrangements"].as<std::string>());
     }
     
     // Clean up the thread set after we analyze everything about it.
     stPinchThreadSet_destruct(threadSet);
     
-    // Get rid of the range vector
-    delete levelIndex.first;
+    // Keep the locate cache's hit and miss counts with the mapping stats.
+    stats += index.getLocateCacheStats();
     
     // Get rid of the index itself. Invalidates the index reference.
     delete indexPointer;
@@ -834,6 +1901,12 @@ main(
             
         stats.save(options["mapStats"].as<std::string>());
     }
+    
+    if(queryTracer) {
+        Log::output() << "Saving slowest windows to " <<
+            options["slowQueries"].as<std::string>() << std::endl;
+        queryTracer->write(options["slowQueries"].as<std::string>());
+    }
 
     Log::output() << "Final memory usage:" << std::endl;
     logMemory();
@@ -12,7 +12,16 @@
 #include <csignal>
 #include <iterator>
 #include <cstdint>
-#include <regex>
+#include <cstring>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <functional>
+#include <map>
 
 
 #include <boost/filesystem.hpp>
@@ -31,9 +40,11 @@
 #include <Mapping.hpp>
 #include <SmallSide.hpp>
 #include <Log.hpp>
-#include <Fasta.hpp>
+#include <MappedFasta.hpp>
 #include <MappingScheme.hpp>
 #include <NaturalMappingScheme.hpp>
+#include <MatchingStatistics.hpp>
+#include <TaskPool.hpp>
 
 // Grab timers from libsuffixtools
 #include <Timer.h>
@@ -49,107 +60,383 @@
 #include "pinchGraphUtil.hpp"
 
 #include "indexUtil.hpp"
+#include "BufferedWriter.hpp"
 
-// TODO: Matching stuff basically copied out of NaturalMappingScheme. Is there a
-// good way to share it?
+/**
+ * How many bases of the reference should each thread evaluate at a time, by
+ * default?
+ */
+const size_t DEFAULT_WINDOW_SIZE = 1000000;
+
+/**
+ * How many bases of extra context should be evaluated on each side of each
+ * window, by default? Context lengths up to this long are exact.
+ */
+const size_t DEFAULT_HALO = 10000;
 
 /**
- * Find all of the minimal unique matchings between query string characters
- * and the reference, in descending order by left endpoint.
+ * How many windows should each thread have to work on before we stop and
+ * write them out?
  */
-std::vector<Matching>
-findMinMatchings(
-    const FMDIndexView& view,
-    const std::string& query
+const size_t WINDOWS_PER_THREAD = 4;
+
+/**
+ * Find the runs of bases that aren't N in the given scaffold of the given
+ * length, as [start, end) pairs in order.
+ */
+std::vector<std::pair<size_t, size_t>>
+findContigs(
+    const char* scaffold,
+    size_t length
 ) {
+    std::vector<std::pair<size_t, size_t>> contigs;
+    
+    size_t start = 0;
+    while(start < length) {
+        // Skip any Ns, then take everything up to the next N.
+        while(start < length && scaffold[start] == 'N') {
+            start++;
+        }
+        if(start == length) {
+            break;
+        }
+        const char* nextN = (const char*) memchr(scaffold + start, 'N',
+            length - start);
+        size_t end = nextN == NULL ? length : nextN - scaffold;
+        contigs.push_back(std::make_pair(start, end));
+        start = end;
+    }
+    
+    return contigs;
+}
 
-    // What matchings have we found?
-    std::vector<Matching> toReturn;
- 
-    // Start with everything selected.
-    FMDPosition results(view);
-    
-    // How many characters are currently searched?
-    size_t patternLength = 0;
+/**
+ * Work out the minimum context length needed to map each base of the given
+ * N-free piece of the reference, which has been indexed in the given index,
+ * when mapping requires the given number of non-overlapping minimal unique
+ * matches. Bases that can't map using only this piece get (size_t) -1.
+ */
+std::vector<size_t>
+evaluateContexts(
+    const FMDIndex& index,
+    const std::string& contig,
+    size_t minHammingBound
+) {
+    
+    LOG_TRACE("Contig: " << contig << std::endl);
+    
+    // Find the minimum unique substrings between theis contig and the
+    // whole reference.
+    std::vector<Matching> minMatchings = MatchingStatistics(
+        FMDIndexView(index), contig).getMinMatchings();
+        
+    // Flip them around to be in ascending order by left endpoint.
+    std::reverse(minMatchings.begin(), minMatchings.end());
 
-    // Flag that says whether we need to retract at least once before we can
-    // find another minimal unique match, since we just found one ending at a
-    // certain place. TODO: Find a cleaner way to do this.
-    bool mustRetract = false;
+    // We're going to fill in this vector of runs, which are [start,
+    // end) pairs, in ascending order by start position. All runs are
+    // right-minimal, and all left-minimal runs will be present.
+    std::vector<std::pair<size_t, size_t>> runs;
     
-    for(size_t i = query.size() - 1; i != (size_t) -1; i--) {
-        // For each position in the query from right to left, we're going to
-        // consider any minimal unique matches with left endpoints here.
+    // We're going to do a pretty dumb approach where we fill in this
+    // vector repeatedly until it holds the right min context length for
+    // each base. Fill it with the biggest size_t.
+    std::vector<size_t> minContextLengths(contig.size(), (size_t) -1);
+
+    for(size_t i = 0; i < minMatchings.size(); i++) {
+        // For each match, find the right-minimal run of matches we need
+        // to get sufficient alpha.
+        
+        LOG_DEBUG("Start at matching " << minMatchings[i].start <<
+            " + " << minMatchings[i].length << std::endl);
         
-        // Retract on the right until we can successfully extend on the left
-        // without running out of results.
+        // How many of them have we found? We start with 1.
+        size_t nonOverlappingFound = 1;
         
-        // We're going to extend backward with this new base.
-        FMDPosition extended = results;
-        extended.extendLeftOnly(view, query[i]);
+        // The last non-overlapping thing we found was this first one.
+        size_t last = i;
         
-        while(extended.isEmpty(view)) {
-            // If you can't extend, retract until you can. TODO: Assumes we
-            // can find at least one result for any character.
+        for(size_t j = i + 1; j < minMatchings.size() && 
+            nonOverlappingFound < minHammingBound; j++) {
             
-            // Retract the character
-            FMDPosition retracted = results;
-            // Make sure to drop characters from the total pattern length.
-            retracted.retractRightOnly(view, --patternLength);
-            mustRetract = false;
+            // For each subsequent matching until we run out or get
+            // enough, see if it overlaps the last one we grabbed.
             
-            // Try extending again
-            extended = retracted;
-            extended.extendLeftOnly(view, query[i]);
+            LOG_DEBUG("\tMatching " << minMatchings[j].start <<
+                " + " << minMatchings[j].length << std::endl);
             
-            // Say that last step we came from retracted.
-            results = retracted;
-        }
-        
-        // Extend on the left.
-        results = extended;
-        patternLength++;
-        
-        // Retract on the right until the next retraction would make us not
-        // unique, and report a minimal unique match starting at this position.
-        FMDPosition retracted = results;
-        retracted.retractRightOnly(view, patternLength - 1);
-        
-        while(retracted.getLength() == 1) {
-            // Retract until we would no longer be unique. Make sure to drop
-            // characters from the total pattern length.
-            results = retracted;
-            retracted.retractRightOnly(view, (--patternLength) - 1);
-            mustRetract = false;
+            if(minMatchings[j].start >= minMatchings[last].start +
+                minMatchings[last].length) {
+                
+                LOG_DEBUG("\t+++ Non-overlapping" << std::endl);
+            
+                // We know it has to start after the last one starts,
+                // and we can see the last one also ends before it
+                // starts. So it's non-overlapping.
+                
+                // Since min matches can't contain each other, if this
+                // is the first match that begins after our old match
+                // ends, it necessarily ends before any other such
+                // matches. So we can just take it and we automatically
+                // have the greedy activity selection algorithm.
+                
+                // Say this is now our last match.
+                last = j;
+                // And that we found another non-overlapping match.
+                nonOverlappingFound++;
+            } else {
+                LOG_DEBUG("\t--- Overlapping" << std::endl);
+            }
         }
         
-        if(results.getLength() == 1 && retracted.getLength() > 1 &&
-            !mustRetract) {
+        if(nonOverlappingFound >= minHammingBound) {
+            // We managed to find enough things for our run.
             
-            // We found a minimally unique match starting at this position and
-            // ending patternLength right from here.
-            toReturn.push_back(Matching(i, results.getTextPosition(view),
-                patternLength));
+            // Where does it start and end, in bases? Start inclusive,
+            // end exclusive.
+            size_t runStart = minMatchings[i].start;
+            size_t runEnd = minMatchings[last].start +
+                minMatchings[last].length;
+                
+            LOG_DEBUG("Successful run " << runStart << " - " <<
+                runEnd << std::endl);
                 
-            // We can't find another minimal match until we move the right
-            // endpoint.
-            mustRetract = true;
+            // Save this run.
+            runs.push_back(std::make_pair(runStart, runEnd));
         }
     }
     
-    // When we get here, we already know we retracted as much as we could for
-    // the leftmost extension, so there are no more results to report.
+    if(runs.size() == 0) {
+        // No bases can map at all, at least not within this piece.
+        return minContextLengths;
+    }
     
-    // This works: if there were a shorter unique match on the right starting at
-    // this position, we would have retracted to find it. And if there were a
-    // shorter unique match on the left ending at this position, we would have
-    // already reported it and not reported any more until we retracted.
+    for(auto run: runs) {
+        // For each run, put its length if it is the shortest thing
+        // overlapping a base.
+        
+        // How long is the run?
+        size_t runLength = run.second - run.first;
+        
+        for(size_t i = run.first; i < run.second; i++) {
+            // For each base in the run, put the run length if it hasn't
+            // gotten anything smaller.
+            minContextLengths[i] = std::min(minContextLengths[i],
+                runLength);
+        }
+    }
     
-    // Results will also come out in descending order by left endpoint.
+    // Now we need to scan from side to side for things that are off the
+    // ends of runs.
     
-    return toReturn;
+    // We can guarantee that the endpoints of runs in runs do not move
+    // backwards. For them to move backwards, an earlier run would have
+    // to completely contain a later run. But the first matching of the
+    // first run would have chained to whatever the first matching of
+    // the later run chained to in order to finish sooner, so that can
+    // never happen.
+    
+    // What run starts last and finishes before this base?
+    size_t latestStarting = 0;
+    for(size_t i = runs[0].second; i < minContextLengths.size(); i++) {
+    
+        // For each base after the end of the first run...
+        
+        while(latestStarting + 1 < runs.size() &&
+            // TODO: This one will always be true because runs don't
+            // share left min matches and min matches can't share
+            // endpoints.
+            runs[latestStarting + 1].first >
+            runs[latestStarting].first && 
+            runs[latestStarting + 1].second <= i) {
+            
+            // We can advance to a later-starting run that still doesn't
+            // cover this base. Do that.
+            latestStarting++;
+        }
+        
+        // How long a string do we need to get out to the left end of
+        // the latest starting range left of us?
+        size_t contextLength = i - runs[latestStarting].first + 1;
+        
+        LOG_DEBUG("Latest starting run before " << i << " is " <<
+            runs[latestStarting].first << " - " <<
+            runs[latestStarting].second << " with context length " <<
+            contextLength << " vs. " << minContextLengths[i] <<
+            std::endl);
+        
+        // Adopt this context length if it is minimal.
+        minContextLengths[i] = std::min(minContextLengths[i],
+                contextLength);
+    }
+    
+    // What run ends last and starts after this base?
+    size_t earliestEnding = runs.size() - 1;
+    for(size_t i = runs[runs.size() - 1].first - 1; i != (size_t) -1;
+        i--) {
+        
+        // For each base before the beginning of the last run...
+        
+        while(earliestEnding - 1 != (size_t) -1 &&
+            // TODO: this one will always be true because run endpoints
+            // are nondecreasing left to right.
+            runs[earliestEnding - 1].second <=
+            runs[earliestEnding].second &&
+            runs[earliestEnding - 1].first > i) {
+            
+            // We can move to a lefter run while still not overlapping
+            // base i. Do that.
+            earliestEnding--;
+        }
+        
+        // How long a string do we need to get out to the right end of
+        // the earliest ending range right of us?
+        size_t contextLength = runs[earliestEnding].second - i;
+        
+        LOG_DEBUG("Earliest ending run after " << i << " is " <<
+            runs[earliestEnding].first << " - " <<
+            runs[earliestEnding].second << " with context length " <<
+            contextLength << " vs. " << minContextLengths[i] <<
+            std::endl);
+        
+        // Adopt this context length if it is minimal.
+        minContextLengths[i] = std::min(minContextLengths[i],
+                contextLength);
+        
+    }
+    
+    return minContextLengths;
+}
+
+/**
+ * Work out the minimum context length needed to map each base in the given
+ * window of the given scaffold, as evaluateContexts() does. The window is given
+ * as a start and length in the scaffold, and must be inside the N-free contig
+ * with the given bounds. It is evaluated along with the given halo of extra
+ * bases on each side, as far as the contig goes, so context lengths up to the
+ * halo are exact. Longer ones are only upper bounds.
+ */
+std::vector<size_t>
+evaluateWindow(
+    const FMDIndex& index,
+    const std::string& scaffold,
+    const std::pair<size_t, size_t>& contig,
+    size_t start,
+    size_t length,
+    size_t halo,
+    size_t minHammingBound
+) {
+    // Where is the window with its halo?
+    size_t haloStart = std::max(contig.first, start > halo ? start - halo : 0);
+    size_t haloEnd = std::min(contig.second, start + length + halo);
+    
+    std::vector<size_t> lengths = evaluateContexts(index,
+        scaffold.substr(haloStart, haloEnd - haloStart), minHammingBound);
+        
+    // Keep just the part for the window itself.
+    lengths.erase(lengths.begin() + (start - haloStart + length),
+        lengths.end());
+    lengths.erase(lengths.begin(), lengths.begin() + (start - haloStart));
+    return lengths;
 }
 
+/**
+ * Writes out context lengths for consecutive bases as they are worked out, so
+ * they never all have to be in memory at once. Can write one length per line,
+ * runs of equal lengths as bedGraph, or just a histogram of lengths at the end.
+ */
+class ContextLengthWriter {
+public:
+    /**
+     * Make a new writer, writing to the given file in the given format:
+     * "lengths", "bedGraph", or "histogram".
+     */
+    ContextLengthWriter(const std::string& filename,
+        const std::string& format): out(filename), format(format), runName(),
+        runStart(0), runEnd(0), runLength(0), histogram() {
+        
+        if(format != "lengths" && format != "bedGraph" &&
+            format != "histogram") {
+            
+            throw std::runtime_error("Unknown output format: " + format);
+        }
+    }
+    
+    /**
+     * Write the context lengths for the bases of the given scaffold starting
+     * at the given 0-based offset. Must be called in order along each
+     * scaffold.
+     */
+    void write(const std::string& scaffold, size_t start,
+        const std::vector<size_t>& lengths) {
+        
+        if(format == "lengths") {
+            for(size_t length : lengths) {
+                // Output the length at each base, one per line.
+                out << length << '\n';
+            }
+        } else if(format == "bedGraph") {
+            // Only compare names once.
+            bool sameScaffold = scaffold == runName;
+            for(size_t i = 0; i < lengths.size(); i++) {
+                if(!sameScaffold || start + i != runEnd ||
+                    lengths[i] != runLength) {
+                    
+                    // This base doesn't continue the run we have.
+                    finishRun();
+                    runName = scaffold;
+                    sameScaffold = true;
+                    runStart = start + i;
+                    runLength = lengths[i];
+                }
+                runEnd = start + i + 1;
+            }
+        } else {
+            for(size_t length : lengths) {
+                histogram[length]++;
+            }
+        }
+    }
+    
+    /**
+     * Finish writing everything.
+     */
+    void close() {
+        finishRun();
+        for(auto& kv : histogram) {
+            // Write each length and how many bases need it.
+            out << kv.first << '\t' << kv.second << '\n';
+        }
+        out.close();
+    }
+    
+protected:
+    /**
+     * Write out the bedGraph run we have, if any.
+     */
+    void finishRun() {
+        if(runEnd > runStart) {
+            out << runName << '\t' << runStart << '\t' << runEnd << '\t' <<
+                runLength << '\n';
+        }
+        runStart = runEnd = 0;
+    }
+
+    // Where are we writing?
+    BufferedWriter out;
+    // And in what format?
+    std::string format;
+    
+    // For bedGraph, what run of equal lengths are we in the middle of?
+    std::string runName;
+    size_t runStart;
+    size_t runEnd;
+    size_t runLength;
+    
+    // For the histogram, how many bases need each context length?
+    std::map<size_t, size_t> histogram;
+};
+
 /**
  * evaluateMapability: command-line tool to evaluate how easy it is to map to
  * each base in a reference, in terms of minimum context length.
@@ -188,12 +475,34 @@ main(
         ("indexDirectory", boost::program_options::value<std::string>(), 
             "Directory to make the index in; will be deleted and replaced!")
         ("reference", boost::program_options::value<std::string>(),
-            "FASTA contining a single reference sequence to map to")
+            "FASTA of the reference sequences to evaluate")
         ("outputFile", boost::program_options::value<std::string>(),
             "File to save context lengths to, one per line")
         ("minEditBound", boost::program_options::value<size_t>()
             ->default_value(0), 
-            "Minimum edit distance lower bound on a maximum unique match");
+            "Minimum edit distance lower bound on a maximum unique match")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(std::thread::hardware_concurrency()),
+            "Number of threads to evaluate windows with")
+        ("window", boost::program_options::value<size_t>()
+            ->default_value(DEFAULT_WINDOW_SIZE),
+            "Number of bases for a thread to evaluate at a time")
+        ("halo", boost::program_options::value<size_t>()
+            ->default_value(DEFAULT_HALO),
+            "Extra bases to evaluate around each window; longer context "
+            "lengths are only upper bounds")
+        ("sample", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Evaluate only this many randomly chosen bases, and save their "
+            "positions too")
+        ("format", boost::program_options::value<std::string>()
+            ->default_value("lengths"),
+            "Output format when evaluating every base: \"lengths\" (one per "
+            "line), \"bedGraph\" (runs of equal lengths), or \"histogram\" "
+            "(length and number of bases)")
+        ("seed", boost::program_options::value<size_t>()
+            ->default_value(1),
+            "Random seed for choosing bases to sample");
             
         
     // And set up our positional arguments
@@ -235,6 +544,14 @@ main(
             // These are required.
             throw boost::program_options::error("Missing important arguments!");
         }
+        
+        std::string format = options["format"].as<std::string>();
+        if(format != "lengths" && format != "bedGraph" &&
+            format != "histogram") {
+            
+            // We can only write these formats.
+            throw boost::program_options::error("Unknown format: " + format);
+        }
             
     } catch(boost::program_options::error& error) {
         // Something is bad about our options. Complain on stderr
@@ -262,12 +579,17 @@ main(
     
     // This holds the filename to write to
     std::string outputFilename = options["outputFile"].as<std::string>();
-    // Open that file for writing.
-    std::ofstream outputFile(outputFilename.c_str());
     
-    // Read the reference contig. It must exist.
-    std::pair<std::string, std::string> referenceRecord = 
-        Fasta(reference).getNextRecord();
+    // How should we split up the work?
+    size_t windowSize = options["window"].as<size_t>();
+    size_t halo = options["halo"].as<size_t>();
+    size_t numThreads = options["threads"].as<size_t>();
+    
+    // Evaluate on the shared pool, sized to match.
+    TaskPool::setGlobalSize(numThreads);
+    
+    // How many bases should we sample, if not all of them?
+    size_t sampleSize = options["sample"].as<size_t>();
     
     // Make a vector of just the reference.
     std::vector<std::string> referenceOnly = { reference };
@@ -284,235 +606,175 @@ main(
     // All we have to do is load the reference, break it up on Ns, and for each
     // actual contig, find all the minimal unique matches. Then we need to do
     // another inchworm through each, counting up the minimum length required to
-    // hit the needed alpha. Then we dump our histogram.
+    // hit the needed alpha. Then we dump our histogram. Contigs are done in
+    // windows, in parallel.
     
-    // Make a Fasta to read the reference.
-    Fasta referenceReader(reference);
-    while(referenceReader.hasNext()) {
-        // Get records until we run out
-        std::string scaffold = referenceReader.getNext();
-            
-        // Make a regex, which has to outlive the iterator. We would look for
-        // runs of Ns, but apparently the C++11 regex engine is not guaranteed
-        // to be able to match "N+" to an arbitrarily long string of Ns without
-        // stack overflowing.
-        std::regex pattern("N");
-        
-        // Make an end iterator
-        std::sregex_token_iterator end;
-        
-        // And a start one
-        std::sregex_token_iterator start(scaffold.begin(),
-            scaffold.end(), pattern, -1);
-            
-        for(std::sregex_token_iterator it = start; it != end; ++it) {
-
-            const std::string& contig = *it;
-
-            if(contig.size() == 0) {
-                // We got the bit between Ns.
-                
-                continue;
-            }
-
-            // For every piece of sequence between runs of 1 or more N...
-            
-            Log::trace() << "Contig: " << contig << std::endl;
-            
-            // Find the minimum unique substrings between theis contig and the
-            // whole reference.
-            std::vector<Matching> minMatchings = findMinMatchings(index,
-                contig);
-                
-            // Flip them around to be in ascending order by left endpoint.
-            std::reverse(minMatchings.begin(), minMatchings.end());
-
-            // We're going to fill in this vector of runs, which are [start,
-            // end) pairs, in ascending order by start position. All runs are
-            // right-minimal, and all left-minimal runs will be present.
-            std::vector<std::pair<size_t, size_t>> runs;
+    if(sampleSize == 0) {
+        // Evaluate every base, a few windows per thread at a time, and write
+        // them out as we go.
+        ContextLengthWriter outputFile(outputFilename,
+            options["format"].as<std::string>());
+        size_t windowsAtOnce = numThreads * WINDOWS_PER_THREAD;
+        
+        MappedFasta referenceReader(reference);
+        for(size_t record = 0; record < referenceReader.size(); record++) {
+            // Go through all the records.
+            std::string name = referenceReader.getID(record);
+            const std::string scaffold = referenceReader.getSequence(record);
             
-            // We're going to do a pretty dumb approach where we fill in this
-            // vector repeatedly until it holds the right min context length for
-            // each base. Fill it with the biggest size_t.
-            std::vector<size_t> minContextLengths(contig.size(), (size_t) -1);
-
-            for(size_t i = 0; i < minMatchings.size(); i++) {
-                // For each match, find the right-minimal run of matches we need
-                // to get sufficient alpha.
-                
-                Log::debug() << "Start at matching " << minMatchings[i].start <<
-                    " + " << minMatchings[i].length << std::endl;
+            for(auto& bounds : findContigs(scaffold.data(), scaffold.size())) {
+                // For every piece of sequence between runs of 1 or more N...
+                size_t windowCount = (bounds.second - bounds.first +
+                    windowSize - 1) / windowSize;
                 
-                // How many of them have we found? We start with 1.
-                size_t nonOverlappingFound = 1;
+                // Count the bases that can map at all, and the ones where the
+                // halo wasn't enough to be sure.
+                size_t mappable = 0;
+                size_t overHalo = 0;
                 
-                // The last non-overlapping thing we found was this first one.
-                size_t last = i;
-                
-                for(size_t j = i + 1; j < minMatchings.size() && 
-                    nonOverlappingFound < minHammingBound; j++) {
-                    
-                    // For each subsequent matching until we run out or get
-                    // enough, see if it overlaps the last one we grabbed.
-                    
-                    Log::debug() << "\tMatching " << minMatchings[j].start <<
-                        " + " << minMatchings[j].length << std::endl;
+                for(size_t first = 0; first < windowCount;
+                    first += windowsAtOnce) {
                     
-                    if(minMatchings[j].start >= minMatchings[last].start +
-                        minMatchings[last].length) {
-                        
-                        Log::debug() << "\t+++ Non-overlapping" << std::endl;
+                    // Do the next few windows in parallel.
+                    std::vector<std::vector<size_t>> windows(std::min(
+                        windowsAtOnce, windowCount - first));
+                    parallelFor(windows.size(), [&](size_t i) {
+                        size_t start = bounds.first + (first + i) * windowSize;
+                        windows[i] = evaluateWindow(index, scaffold, bounds,
+                            start, std::min(windowSize, bounds.second - start),
+                            halo, minHammingBound);
+                    });
                     
-                        // We know it has to start after the last one starts,
-                        // and we can see the last one also ends before it
-                        // starts. So it's non-overlapping.
-                        
-                        // Since min matches can't contain each other, if this
-                        // is the first match that begins after our old match
-                        // ends, it necessarily ends before any other such
-                        // matches. So we can just take it and we automatically
-                        // have the greedy activity selection algorithm.
-                        
-                        // Say this is now our last match.
-                        last = j;
-                        // And that we found another non-overlapping match.
-                        nonOverlappingFound++;
-                    } else {
-                        Log::debug() << "\t--- Overlapping" << std::endl;
+                    for(size_t i = 0; i < windows.size(); i++) {
+                        // Then write them out in order.
+                        for(size_t length : windows[i]) {
+                            mappable += length != (size_t) -1;
+                            overHalo += length > halo;
+                        }
+                        outputFile.write(name, bounds.first +
+                            (first + i) * windowSize, windows[i]);
                     }
                 }
-                
-                if(nonOverlappingFound >= minHammingBound) {
-                    // We managed to find enough things for our run.
-                    
-                    // Where does it start and end, in bases? Start inclusive,
-                    // end exclusive.
-                    size_t runStart = minMatchings[i].start;
-                    size_t runEnd = minMatchings[last].start +
-                        minMatchings[last].length;
-                        
-                    Log::debug() << "Successful run " << runStart << " - " <<
-                        runEnd << std::endl;
-                        
-                    // Save this run.
-                    runs.push_back(std::make_pair(runStart, runEnd));
-                }
-            }
-            
-            if(runs.size() == 0) {
-                // Complain we found no runs.
-                throw std::runtime_error(
-                    "No valid runs found, so no bases can map at all");
-            }
-            
-            for(auto run: runs) {
-                // For each run, put its length if it is the shortest thing
-                // overlapping a base.
-                
-                // How long is the run?
-                size_t runLength = run.second - run.first;
-                
-                for(size_t i = run.first; i < run.second; i++) {
-                    // For each base in the run, put the run length if it hasn't
-                    // gotten anything smaller.
-                    minContextLengths[i] = std::min(minContextLengths[i],
-                        runLength);
-                }
-            }
-            
-            // Now we need to scan from side to side for things that are off the
-            // ends of runs.
-            
-            // We can guarantee that the endpoints of runs in runs do not move
-            // backwards. For them to move backwards, an earlier run would have
-            // to completely contain a later run. But the first matching of the
-            // first run would have chained to whatever the first matching of
-            // the later run chained to in order to finish sooner, so that can
-            // never happen.
-            
-            // What run starts last and finishes before this base?
-            size_t latestStarting = 0;
-            for(size_t i = runs[0].second; i < minContextLengths.size(); i++) {
-            
-                // For each base after the end of the first run...
-                
-                while(latestStarting + 1 < runs.size() &&
-                    // TODO: This one will always be true because runs don't
-                    // share left min matches and min matches can't share
-                    // endpoints.
-                    runs[latestStarting + 1].first >
-                    runs[latestStarting].first && 
-                    runs[latestStarting + 1].second <= i) {
                     
-                    // We can advance to a later-starting run that still doesn't
-                    // cover this base. Do that.
-                    latestStarting++;
+                if(mappable == 0) {
+                    // Complain we found no runs.
+                    throw std::runtime_error(
+                        "No valid runs found, so no bases can map at all");
                 }
                 
-                // How long a string do we need to get out to the left end of
-                // the latest starting range left of us?
-                size_t contextLength = i - runs[latestStarting].first + 1;
-                
-                Log::debug() << "Latest starting run before " << i << " is " <<
-                    runs[latestStarting].first << " - " <<
-                    runs[latestStarting].second << " with context length " <<
-                    contextLength << " vs. " << minContextLengths[i] <<
+                Log::output() << bounds.second - bounds.first <<
+                    " lengths, " << overHalo << " longer than the halo" <<
                     std::endl;
-                
-                // Adopt this context length if it is minimal.
-                minContextLengths[i] = std::min(minContextLengths[i],
-                        contextLength);
             }
+        }
+        
+        outputFile.close();
+    } else {
+        // Sampled bases are written one per line.
+        BufferedWriter outputFile(outputFilename);
+
+        // Evaluate a random sample of bases, with replacement. First count the
+        // bases we could pick.
+        size_t totalBases = 0;
+        MappedFasta referenceReader(reference);
+        std::string buffer;
+        for(size_t record = 0; record < referenceReader.size(); record++) {
+            // Look at the scaffolds in place where we can.
+            size_t length;
+            const char* scaffold = referenceReader.getSequence(record, length,
+                buffer);
+            for(auto& bounds : findContigs(scaffold, length)) {
+                totalBases += bounds.second - bounds.first;
+            }
+        }
+        
+        if(totalBases == 0) {
+            throw std::runtime_error("No bases to sample from");
+        }
+        
+        // Pick the bases by their number among all the non-N bases, in order.
+        std::mt19937_64 generator(options["seed"].as<size_t>());
+        std::uniform_int_distribution<size_t> distribution(0,
+            totalBases - 1);
+        std::vector<size_t> picked(sampleSize);
+        for(size_t& base : picked) {
+            base = distribution(generator);
+        }
+        std::sort(picked.begin(), picked.end());
+        
+        // Holds the sampled context lengths, in the order picked.
+        std::vector<size_t> sampled(sampleSize);
+        
+        // How many non-N bases came before the current contig?
+        size_t basesBefore = 0;
+        // Which picked base are we on?
+        size_t next = 0;
+        
+        for(size_t record = 0; record < referenceReader.size(); record++) {
+            std::string name = referenceReader.getID(record);
+            const std::string scaffold = referenceReader.getSequence(record);
             
-            // What run ends last and starts after this base?
-            size_t earliestEnding = runs.size() - 1;
-            for(size_t i = runs[runs.size() - 1].first - 1; i != (size_t) -1;
-                i--) {
+            for(auto& bounds : findContigs(scaffold.data(), scaffold.size())) {
+                size_t contigLength = bounds.second - bounds.first;
                 
-                // For each base before the beginning of the last run...
-                
-                while(earliestEnding - 1 != (size_t) -1 &&
-                    // TODO: this one will always be true because run endpoints
-                    // are nondecreasing left to right.
-                    runs[earliestEnding - 1].second <=
-                    runs[earliestEnding].second &&
-                    runs[earliestEnding - 1].first > i) {
-                    
-                    // We can move to a lefter run while still not overlapping
-                    // base i. Do that.
-                    earliestEnding--;
+                // Find the picked bases in this contig.
+                size_t first = next;
+                while(next < picked.size() &&
+                    picked[next] < basesBefore + contigLength) {
+                    next++;
                 }
                 
-                // How long a string do we need to get out to the right end of
-                // the earliest ending range right of us?
-                size_t contextLength = runs[earliestEnding].second - i;
+                // Evaluate each one in the middle of its own halo.
+                parallelFor(next - first, [&](size_t i) {
+                    size_t offset = bounds.first + picked[first + i] -
+                        basesBefore;
+                    sampled[first + i] = evaluateWindow(index, scaffold,
+                        bounds, offset, 1, halo, minHammingBound)[0];
+                });
                 
-                Log::debug() << "Earliest ending run after " << i << " is " <<
-                    runs[earliestEnding].first << " - " <<
-                    runs[earliestEnding].second << " with context length " <<
-                    contextLength << " vs. " << minContextLengths[i] <<
-                    std::endl;
-                
-                // Adopt this context length if it is minimal.
-                minContextLengths[i] = std::min(minContextLengths[i],
-                        contextLength);
+                for(size_t i = first; i < next; i++) {
+                    // Say where each sampled base is and what it needs.
+                    outputFile << name << '\t' << bounds.first +
+                        picked[i] - basesBefore << '\t' << sampled[i] << '\n';
+                }
                 
+                basesBefore += contigLength;
             }
-            
-            Log::output() << minContextLengths.size() << " lengths" <<
-                std::endl;
-            
-            for(size_t contextLength : minContextLengths) {
-                // Output the final length at each base, one per line.
-                outputFile << contextLength << std::endl;
+        }
+        
+        // Summarize the sample. Context lengths past the halo aren't exact, so
+        // report how many bases need more than that, and the mean context
+        // length of the others. Use normal approximations for 95% confidence
+        // intervals.
+        std::vector<size_t> withinHalo;
+        for(size_t length : sampled) {
+            if(length <= halo) {
+                withinHalo.push_back(length);
             }
+        }
         
+        double fraction = (double) withinHalo.size() / sampleSize;
+        double fractionMargin = 1.96 * sqrt(fraction * (1 - fraction) /
+            sampleSize);
+        Log::output() << "Fraction of bases mappable within " << halo <<
+            " bases: " << fraction << " +/- " << fractionMargin << std::endl;
+        
+        if(withinHalo.size() > 1) {
+            double mean = std::accumulate(withinHalo.begin(),
+                withinHalo.end(), 0.0) / withinHalo.size();
+            double squares = 0;
+            for(size_t length : withinHalo) {
+                squares += (length - mean) * (length - mean);
+            }
+            double meanMargin = 1.96 * sqrt(squares /
+                (withinHalo.size() - 1) / withinHalo.size());
+            Log::output() << "Mean context length of those bases: " << mean <<
+                " +/- " << meanMargin << std::endl;
         }
+        
+        outputFile.close();
     }
     
-    outputFile.close();
-    
     // Get rid of the index itself. Invalidates the index reference.
     delete indexPointer;
 
@@ -0,0 +1,522 @@
+// generateGenomes.cpp: program to make synthetic multi-genome collections for
+// benchmarking.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <cctype>
+#include <csignal>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include <Fasta.hpp>
+#include <Log.hpp>
+#include <TaskPool.hpp>
+#include <util.hpp>
+
+#include "unixUtil.hpp"
+
+/**
+ * Holds the rates and sizes of the changes each genome gets.
+ */
+struct MutationModel {
+    // What fraction of bases are substituted?
+    double substitutionRate;
+    // What fraction of bases start an insertion or deletion?
+    double indelRate;
+    // How long can an indel be?
+    size_t maxIndel;
+    // What fraction of bases start an inversion or a moved segment?
+    double rearrangementRate;
+    // How long can a rearranged segment be?
+    size_t maxRearrangement;
+    // What fraction of bases start a gap of Ns?
+    double gapRate;
+    // How long is each gap?
+    size_t gapLength;
+};
+
+/**
+ * Draw a random base.
+ */
+char randomBase(std::mt19937_64& random) {
+    return "ACGT"[random() % 4];
+}
+
+/**
+ * Draw a random base other than the given one.
+ */
+char changeBase(char base, std::mt19937_64& random) {
+    char changed;
+    do {
+        changed = randomBase(random);
+    } while(changed == base);
+    return changed;
+}
+
+/**
+ * Draw the number of events happening at the given rate per base over the
+ * given number of bases.
+ */
+size_t countEvents(double rate, size_t bases, std::mt19937_64& random) {
+    if(rate <= 0 || bases == 0) {
+        return 0;
+    }
+    return std::poisson_distribution<size_t>(rate * bases)(random);
+}
+
+/**
+ * Make a root sequence of the given length, from random bases or, if a
+ * reference FASTA is given, from its records' bases, ignoring Ns. A length of
+ * 0 takes the whole reference.
+ */
+std::string makeRoot(size_t length, const std::string& reference,
+    std::mt19937_64& random) {
+
+    std::string root;
+    if(reference.empty()) {
+        root.reserve(length);
+        while(root.size() < length) {
+            root.push_back(randomBase(random));
+        }
+        return root;
+    }
+
+    Fasta fasta(reference);
+    while(fasta.hasNext() && (length == 0 || root.size() < length)) {
+        for(char base : fasta.getNext()) {
+            base = toupper(base);
+            if(base == 'A' || base == 'C' || base == 'G' || base == 'T') {
+                root.push_back(base);
+            }
+        }
+    }
+
+    if(root.empty()) {
+        throw std::runtime_error("No bases in reference " + reference);
+    }
+    if(length != 0 && root.size() < length) {
+        Log::warning() << "Reference " << reference << " has only " <<
+            root.size() << " bases" << std::endl;
+    }
+    if(length != 0 && root.size() > length) {
+        root.resize(length);
+    }
+    return root;
+}
+
+/**
+ * Write copies of the given number of random repeat families into the given
+ * sequence, over whatever was there. Each copy is in a random place and
+ * orientation, with the given fraction of its bases substituted.
+ */
+void addRepeats(std::string& sequence, size_t families, size_t repeatLength,
+    size_t copies, double divergence, std::mt19937_64& random) {
+
+    if(repeatLength == 0 || repeatLength > sequence.size()) {
+        return;
+    }
+
+    std::bernoulli_distribution diverge(divergence);
+    for(size_t family = 0; family < families; family++) {
+        std::string consensus;
+        while(consensus.size() < repeatLength) {
+            consensus.push_back(randomBase(random));
+        }
+
+        for(size_t copy = 0; copy < copies; copy++) {
+            std::string instance = random() % 2 ?
+                reverseComplement(consensus) : consensus;
+            for(char& base : instance) {
+                if(diverge(random)) {
+                    base = changeBase(base, random);
+                }
+            }
+
+            size_t start = random() % (sequence.size() - repeatLength + 1);
+            sequence.replace(start, repeatLength, instance);
+        }
+    }
+}
+
+/**
+ * Represents a piece of a rearranged genome: a stretch of the root, which may
+ * be reverse complemented.
+ */
+struct Segment {
+    // Where does it start on the root?
+    size_t start;
+    // How long is it?
+    size_t length;
+    // Is it reverse complemented?
+    bool flipped;
+};
+
+/**
+ * Split the segments so one starts the given number of bases in, and return
+ * its index, or the number of segments if that is the end.
+ */
+size_t splitSegments(std::vector<Segment>& segments, size_t offset) {
+    size_t i = 0;
+    while(i < segments.size() && offset >= segments[i].length) {
+        offset -= segments[i].length;
+        i++;
+    }
+    if(i == segments.size() || offset == 0) {
+        return i;
+    }
+
+    // Cut this segment in two. A flipped segment reads its root stretch from
+    // the end.
+    Segment& segment = segments[i];
+    Segment first = segment;
+    Segment second = segment;
+    first.length = offset;
+    second.length = segment.length - offset;
+    if(segment.flipped) {
+        first.start = segment.start + second.length;
+    } else {
+        second.start = segment.start + offset;
+    }
+    segments[i] = first;
+    segments.insert(segments.begin() + i + 1, second);
+    return i + 1;
+}
+
+/**
+ * Reverse complement the given range of segments in place.
+ */
+void flipSegments(std::vector<Segment>& segments, size_t start, size_t end) {
+    std::reverse(segments.begin() + start, segments.begin() + end);
+    for(size_t i = start; i < end; i++) {
+        segments[i].flipped = !segments[i].flipped;
+    }
+}
+
+/**
+ * Derive a genome from the root under the given model. Rearrangements are
+ * applied first, then substitutions and indels in one pass, then N gaps.
+ */
+std::string deriveGenome(const std::string& root, const MutationModel& model,
+    std::mt19937_64& random) {
+
+    // Rearrange the root as a list of segments, so each rearrangement costs
+    // time in the number of rearrangements rather than the genome length.
+    std::vector<Segment> segments{{0, root.size(), false}};
+    size_t rearrangements = countEvents(model.rearrangementRate, root.size(),
+        random);
+    for(size_t i = 0; i < rearrangements && root.size() > 1; i++) {
+        // Pick a stretch, which can't be the whole sequence.
+        size_t length = 1 + random() % std::min(model.maxRearrangement,
+            root.size() - 1);
+        size_t start = random() % (root.size() - length + 1);
+        size_t first = splitSegments(segments, start);
+        size_t past = splitSegments(segments, start + length);
+
+        if(random() % 2) {
+            // Invert it in place.
+            flipSegments(segments, first, past);
+        } else {
+            // Move it somewhere else, maybe flipped.
+            std::vector<Segment> moved(segments.begin() + first,
+                segments.begin() + past);
+            segments.erase(segments.begin() + first, segments.begin() + past);
+            if(random() % 2) {
+                flipSegments(moved, 0, moved.size());
+            }
+            size_t destination = splitSegments(segments,
+                random() % (root.size() - length + 1));
+            segments.insert(segments.begin() + destination, moved.begin(),
+                moved.end());
+        }
+    }
+
+    std::string rearranged;
+    rearranged.reserve(root.size());
+    for(const Segment& segment : segments) {
+        std::string piece = root.substr(segment.start, segment.length);
+        rearranged += segment.flipped ? reverseComplement(piece) : piece;
+    }
+
+    // Walk along, skipping from one substitution or indel to the next.
+    std::string genome;
+    genome.reserve(rearranged.size());
+    double eventRate = model.substitutionRate + model.indelRate;
+    std::bernoulli_distribution substitute(eventRate > 0 ?
+        model.substitutionRate / eventRate : 0);
+    std::geometric_distribution<size_t> skip(eventRate > 0 ?
+        std::min(eventRate, 1.0) : 1.0);
+
+    size_t position = 0;
+    while(position < rearranged.size()) {
+        size_t next = eventRate > 0 ? position + skip(random) :
+            rearranged.size();
+        next = std::min(next, rearranged.size());
+        genome.append(rearranged, position, next - position);
+        position = next;
+        if(position == rearranged.size()) {
+            break;
+        }
+
+        if(substitute(random)) {
+            genome.push_back(changeBase(rearranged[position], random));
+            position++;
+        } else if(random() % 2) {
+            // Delete some bases.
+            position += 1 + random() % model.maxIndel;
+        } else {
+            // Insert some bases before this one.
+            size_t length = 1 + random() % model.maxIndel;
+            for(size_t i = 0; i < length; i++) {
+                genome.push_back(randomBase(random));
+            }
+            genome.push_back(rearranged[position]);
+            position++;
+        }
+    }
+
+    size_t gaps = countEvents(model.gapRate, genome.size(), random);
+    for(size_t i = 0; i < gaps && genome.size() > model.gapLength; i++) {
+        // Cover some bases with Ns, as in a draft assembly.
+        size_t start = random() % (genome.size() - model.gapLength + 1);
+        std::fill(genome.begin() + start,
+            genome.begin() + start + model.gapLength, 'N');
+    }
+
+    return genome;
+}
+
+/**
+ * Save a sequence as a FASTA with the given record name.
+ */
+void writeFasta(const std::string& filename, const std::string& name,
+    const std::string& sequence) {
+
+    std::ofstream fasta(filename.c_str());
+    fasta << '>' << name << '\n';
+    for(size_t i = 0; i < sequence.size(); i += 80) {
+        fasta.write(sequence.data() + i, std::min((size_t) 80,
+            sequence.size() - i));
+        fasta << '\n';
+    }
+    fasta.close();
+    if(!fasta) {
+        throw std::runtime_error("Could not write " + filename);
+    }
+}
+
+/**
+ * generateGenomes: command-line tool to make a reproducible collection of
+ * related genomes for benchmarking createIndex and mapReads at scale. A root
+ * sequence is drawn at random or taken from a reference, repeat families are
+ * scattered over it, and each genome is derived from it independently with
+ * its own substitutions, indels, rearrangements, and N gaps. Each genome's
+ * changes depend only on the seed and the genome's number, so collections
+ * with more genomes extend collections with fewer.
+ */
+int
+main(
+    int argc,
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription =
+        std::string("Generate synthetic genomes for benchmarking.\n") +
+        "Usage: generateGenomes <output directory>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options()
+        ("help", "Print help messages")
+        ("outputDirectory", boost::program_options::value<std::string>()
+            ->required(),
+            "Directory to save root.fa and genome<N>.fa files in")
+        ("genomes", boost::program_options::value<size_t>()
+            ->default_value(2),
+            "Number of genomes to generate")
+        ("length", boost::program_options::value<size_t>()
+            ->default_value(1000000),
+            "Length of the root sequence, or 0 for the whole reference")
+        ("reference", boost::program_options::value<std::string>(),
+            "FASTA to take the root sequence from instead of drawing it")
+        ("seed", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Seed for the random number generators")
+        ("substitutionRate", boost::program_options::value<double>()
+            ->default_value(0.01),
+            "Substitutions per base in each genome")
+        ("indelRate", boost::program_options::value<double>()
+            ->default_value(0.001),
+            "Insertions and deletions per base in each genome")
+        ("maxIndel", boost::program_options::value<size_t>()
+            ->default_value(10),
+            "Longest insertion or deletion")
+        ("rearrangementRate", boost::program_options::value<double>()
+            ->default_value(0.00001),
+            "Inversions and moved segments per base in each genome")
+        ("maxRearrangement", boost::program_options::value<size_t>()
+            ->default_value(10000),
+            "Longest inverted or moved segment")
+        ("repeatFamilies", boost::program_options::value<size_t>()
+            ->default_value(10),
+            "Number of repeat families to scatter over the root")
+        ("repeatLength", boost::program_options::value<size_t>()
+            ->default_value(300),
+            "Length of each repeat family")
+        ("repeatCopies", boost::program_options::value<size_t>()
+            ->default_value(20),
+            "Copies of each repeat family")
+        ("repeatDivergence", boost::program_options::value<double>()
+            ->default_value(0.05),
+            "Substitutions per base between repeat copies and their family")
+        ("gapRate", boost::program_options::value<double>()
+            ->default_value(0.00001),
+            "N gaps per base in each genome")
+        ("gapLength", boost::program_options::value<size_t>()
+            ->default_value(100),
+            "Length of each N gap")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(std::thread::hardware_concurrency()),
+            "Number of threads to generate genomes with");
+
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("outputDirectory", 1);
+
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+
+            // Don't do the actual program.
+            return 0;
+        }
+
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+
+        for(const char* rate : {"substitutionRate", "indelRate",
+            "rearrangementRate", "gapRate", "repeatDivergence"}) {
+
+            if(options[rate].as<double>() < 0 ||
+                options[rate].as<double>() > 1) {
+
+                throw boost::program_options::error(std::string(rate) +
+                    " must be between 0 and 1");
+            }
+        }
+
+        if(options["substitutionRate"].as<double>() +
+            options["indelRate"].as<double>() > 1) {
+
+            // We draw them as one kind of event.
+            throw boost::program_options::error(
+                "substitutionRate and indelRate must add up to at most 1");
+        }
+
+        if(options["maxIndel"].as<size_t>() == 0 ||
+            options["maxRearrangement"].as<size_t>() == 0) {
+
+            throw boost::program_options::error(
+                "maxIndel and maxRearrangement must be at least 1");
+        }
+
+        if(options["length"].as<size_t>() == 0 &&
+            !options.count("reference")) {
+
+            throw boost::program_options::error(
+                "length can only be 0 with a reference");
+        }
+
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl;
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl;
+
+        // Stop the program.
+        return -1;
+    }
+
+    // If we get here, we have the right arguments.
+    std::string outputDirectory = options["outputDirectory"].as<std::string>();
+    size_t numGenomes = options["genomes"].as<size_t>();
+    size_t seed = options["seed"].as<size_t>();
+
+    MutationModel model;
+    model.substitutionRate = options["substitutionRate"].as<double>();
+    model.indelRate = options["indelRate"].as<double>();
+    model.maxIndel = options["maxIndel"].as<size_t>();
+    model.rearrangementRate = options["rearrangementRate"].as<double>();
+    model.maxRearrangement = options["maxRearrangement"].as<size_t>();
+    model.gapRate = options["gapRate"].as<double>();
+    model.gapLength = options["gapLength"].as<size_t>();
+
+    // Generate on the shared pool, sized to match.
+    TaskPool::setGlobalSize(options["threads"].as<size_t>());
+
+    boost::filesystem::create_directories(outputDirectory);
+
+    // The root gets its own random numbers, so the genomes' don't depend on
+    // how many the root used.
+    std::seed_seq rootSeed{(uint64_t) seed, (uint64_t) 0};
+    std::mt19937_64 rootRandom(rootSeed);
+
+    std::string root = makeRoot(options["length"].as<size_t>(),
+        options.count("reference") ? options["reference"].as<std::string>() :
+        "", rootRandom);
+    addRepeats(root, options["repeatFamilies"].as<size_t>(),
+        options["repeatLength"].as<size_t>(),
+        options["repeatCopies"].as<size_t>(),
+        options["repeatDivergence"].as<double>(), rootRandom);
+    writeFasta(outputDirectory + "/root.fa", "root", root);
+
+    Log::info() << "Generating " << numGenomes << " genomes from a root of " <<
+        root.size() << " bases" << std::endl;
+
+    parallelFor(numGenomes, [&](size_t genome) {
+        std::seed_seq genomeSeed{(uint64_t) seed, (uint64_t) genome + 1};
+        std::mt19937_64 random(genomeSeed);
+
+        std::string name = "genome" + std::to_string(genome);
+        writeFasta(outputDirectory + "/" + name + ".fa", name,
+            deriveGenome(root, model, random));
+    });
+
+    Log::info() << "Saved genomes to " << outputDirectory << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+// indexStats.cpp: program to measure an index's BWT, samples, and LCP array,
+// and project what other index configurations would cost.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <csignal>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+#include <FMDIndex.hpp>
+#include <LCPArray.hpp>
+#include <Log.hpp>
+#include <TaskPool.hpp>
+#include <FMMarkers.h>
+#include <STCommon.h>
+
+#include "unixUtil.hpp"
+
+/**
+ * Holds the run statistics of part or all of a BWT.
+ */
+struct RunProfile {
+    /**
+     * Make an empty profile.
+     */
+    RunProfile(): runs(0), stopSymbols(0), stopRuns(0),
+        runLengths(65, 0) {
+        // Nothing to do
+    }
+
+    /**
+     * Add in the counts from another profile.
+     */
+    void add(const RunProfile& other) {
+        runs += other.runs;
+        stopSymbols += other.stopSymbols;
+        stopRuns += other.stopRuns;
+        for(size_t bucket = 0; bucket < runLengths.size(); bucket++) {
+            runLengths[bucket] += other.runLengths[bucket];
+        }
+    }
+
+    // How many maximal runs of one character are there? Long runs are split
+    // over several RLUnits, which are counted as one run here.
+    size_t runs;
+
+    // How many text stop characters are there, and in how many runs?
+    size_t stopSymbols;
+    size_t stopRuns;
+
+    // Holds the number of runs with lengths in [2^i, 2^(i + 1)) for each i.
+    std::vector<size_t> runLengths;
+};
+
+/**
+ * Get the power-of-2 bucket a nonzero value falls in: the position of its
+ * highest set bit.
+ */
+size_t getBucket(size_t value) {
+    size_t bucket = 0;
+    while(value >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * Profile the runs starting at RLUnits from start up to end in the given BWT.
+ * A run starting in the range is followed past its end.
+ */
+void profileRuns(const BWT& bwt, size_t start, size_t end,
+    RunProfile& profile) {
+
+    for(size_t unit = start; unit < end; unit++) {
+        char symbol = bwt.getRun(unit).getChar();
+        if(symbol == '$') {
+            profile.stopSymbols += bwt.getRun(unit).getCount();
+        }
+
+        if(unit > 0 && bwt.getRun(unit - 1).getChar() == symbol) {
+            // This continues a run started before.
+            continue;
+        }
+
+        size_t length = 0;
+        for(size_t next = unit; next < bwt.getNumRuns() &&
+            bwt.getRun(next).getChar() == symbol; next++) {
+
+            length += bwt.getRun(next).getCount();
+        }
+
+        profile.runs++;
+        if(symbol == '$') {
+            profile.stopRuns++;
+        }
+        profile.runLengths[getBucket(length)]++;
+    }
+}
+
+/**
+ * Write a statistic as a <section>\t<name>\t<value> line.
+ */
+template<typename Value>
+void writeStat(std::ostream& tsv, const std::string& section,
+    const std::string& name, const Value& value) {
+
+    tsv << section << '\t' << name << '\t' << value << '\n';
+}
+
+/**
+ * Parse a comma-separated list of sample rates.
+ */
+std::vector<size_t> parseRates(const std::string& list) {
+    std::vector<size_t> rates;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        size_t rate = std::stoul(item);
+        if(rate == 0) {
+            throw std::invalid_argument("Sample rates must be positive");
+        }
+        rates.push_back(rate);
+    }
+    return rates;
+}
+
+/**
+ * indexStats: command-line tool to report the size and repetitiveness of an
+ * index's BWT, the memory taken by its markers, samples, LCP array, and genome
+ * masks, and what those would take, and how fast locating would be, under
+ * other sample rates and encodings. Scans the BWT runs and LCP array in
+ * parallel passes.
+ */
+int
+main(
+    int argc,
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription =
+        std::string("Report statistics and projected costs for an index.\n") +
+        "Usage: indexStats <index directory> <tsv>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options()
+        ("help", "Print help messages")
+        ("indexDirectory", boost::program_options::value<std::string>()
+            ->required(),
+            "Directory the index was made in")
+        ("tsv", boost::program_options::value<std::string>()->required(),
+            "File to save <section>\\t<name>\\t<value> lines in")
+        ("sampleRates", boost::program_options::value<std::string>()
+            ->default_value("16,32,64,128,256"),
+            "Comma-separated suffix array sample rates to project")
+        ("markerRates", boost::program_options::value<std::string>()
+            ->default_value("32,64,128,256"),
+            "Comma-separated small occurrence marker rates to project")
+        ("lfSamples", boost::program_options::value<size_t>()
+            ->default_value(100000),
+            "Number of LF-mapping steps to time for locate projections")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(std::thread::hardware_concurrency()),
+            "Number of threads to scan with");
+
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("indexDirectory", 1);
+    positionals.add("tsv", 1);
+
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+
+    std::vector<size_t> sampleRates;
+    std::vector<size_t> markerRates;
+
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+
+            // Don't do the actual program.
+            return 0;
+        }
+
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+
+        try {
+            sampleRates = parseRates(options["sampleRates"].as<std::string>());
+            markerRates = parseRates(options["markerRates"].as<std::string>());
+        } catch(std::logic_error& error) {
+            throw boost::program_options::error(
+                "sample rates must be comma-separated positive numbers");
+        }
+
+        for(size_t rate : markerRates) {
+            if(rate > RLBWT::DEFAULT_SAMPLE_RATE_LARGE ||
+                (rate & (rate - 1)) != 0) {
+
+                // Small markers must be powers of 2 that fit between the
+                // large ones, or their 16-bit counts overflow.
+                throw boost::program_options::error(
+                    "marker rates must be powers of 2 up to " +
+                    std::to_string(RLBWT::DEFAULT_SAMPLE_RATE_LARGE));
+            }
+        }
+
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl;
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl;
+
+        // Stop the program.
+        return -1;
+    }
+
+    // If we get here, we have the right arguments.
+    size_t numThreads = options["threads"].as<size_t>();
+    size_t lfSamples = options["lfSamples"].as<size_t>();
+
+    // Scan on the shared pool, sized to match.
+    TaskPool::setGlobalSize(numThreads);
+
+    // Load the index, and map its LCP array directly to scan it.
+    std::string basename = options["indexDirectory"].as<std::string>() +
+        "/index.basename";
+    FMDIndex index(basename);
+    LCPArray lcp(basename + ".lcp");
+    const BWT& bwt = index.getBWT();
+
+    size_t numChunks = std::max(numThreads, (size_t) 1) * 4;
+    std::mutex totalMutex;
+
+    Log::info() << "Profiling " << bwt.getNumRuns() << " BWT run units" <<
+        std::endl;
+
+    RunProfile runs;
+    parallelFor(numChunks, [&](size_t chunk) {
+        RunProfile profile;
+        profileRuns(bwt, bwt.getNumRuns() * chunk / numChunks,
+            bwt.getNumRuns() * (chunk + 1) / numChunks, profile);
+
+        std::lock_guard<std::mutex> lock(totalMutex);
+        runs.add(profile);
+    });
+
+    Log::info() << "Profiling " << lcp.getSize() << " LCP values" <<
+        std::endl;
+
+    // Holds the number of LCP values in each power-of-2 bucket, with 0 in its
+    // own bucket first.
+    std::vector<size_t> lcpValues(66, 0);
+    // How many LCP values would overflow 8 and 16 bits?
+    size_t lcpOver8 = 0;
+    size_t lcpOver16 = 0;
+    size_t lcpMax = 0;
+    parallelFor(numChunks, [&](size_t chunk) {
+        std::vector<size_t> values(lcpValues.size(), 0);
+        size_t over8 = 0;
+        size_t over16 = 0;
+        size_t max = 0;
+        for(size_t i = lcp.getSize() * chunk / numChunks;
+            i < lcp.getSize() * (chunk + 1) / numChunks; i++) {
+
+            size_t value = lcp[i];
+            values[value == 0 ? 0 : getBucket(value) + 1]++;
+            // The byte array saves the all-ones byte to flag escapes.
+            over8 += value >= 255;
+            over16 += value > 65535;
+            max = std::max(max, value);
+        }
+
+        std::lock_guard<std::mutex> lock(totalMutex);
+        for(size_t bucket = 0; bucket < values.size(); bucket++) {
+            lcpValues[bucket] += values[bucket];
+        }
+        lcpOver8 += over8;
+        lcpOver16 += over16;
+        lcpMax = std::max(lcpMax, max);
+    });
+
+    // Time LF-mapping from random rows, since locating walks it back to a
+    // sample. It's a lookup of a character and a rank.
+    std::mt19937_64 random(0);
+    std::uniform_int_distribution<int64_t> rows(0, bwt.getBWLen() - 1);
+    std::vector<int64_t> starts(lfSamples);
+    for(auto& start : starts) {
+        start = rows(random);
+    }
+    int64_t checksum = 0;
+    auto timerStart = std::chrono::steady_clock::now();
+    for(int64_t start : starts) {
+        checksum += index.getLF(start);
+    }
+    double lfNanoseconds = lfSamples == 0 ? 0 :
+        std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - timerStart).count() / lfSamples;
+    Log::debug() << "LF checksum: " << checksum << std::endl;
+
+    std::ofstream tsv(options["tsv"].as<std::string>());
+
+    size_t n = bwt.getBWLen();
+    size_t texts = bwt.getNumStrings();
+    writeStat(tsv, "bwt", "length", n);
+    writeStat(tsv, "bwt", "texts", texts);
+    writeStat(tsv, "bwt", "runUnits", bwt.getNumRuns());
+    writeStat(tsv, "bwt", "runs", runs.runs);
+    writeStat(tsv, "bwt", "lengthPerRun", runs.runs == 0 ? 0.0 :
+        (double) n / runs.runs);
+    writeStat(tsv, "bwt", "stopRuns", runs.stopRuns);
+    for(size_t bucket = 0; bucket < runs.runLengths.size(); bucket++) {
+        if(runs.runLengths[bucket] > 0) {
+            // Name each bucket by its smallest length.
+            writeStat(tsv, "runLengths", std::to_string((size_t) 1 << bucket),
+                runs.runLengths[bucket]);
+        }
+    }
+
+    // The run encoding and a flat BWT, which packs 4 bits a base with counts
+    // every 128 bases, are alternatives for searching.
+    writeStat(tsv, "bwtEncoding", "runs", bwt.getRunBytes());
+    writeStat(tsv, "bwtEncoding", "flat", n / 2);
+
+    for(size_t rate : markerRates) {
+        // A small marker every rate bases, and a large one every 8192. Occ
+        // queries scan from the nearest marker, a quarter of the rate away on
+        // average.
+        size_t bytes = (n / rate + 2) * sizeof(SmallMarker) +
+            (n / RLBWT::DEFAULT_SAMPLE_RATE_LARGE + 2) * sizeof(LargeMarker);
+        std::string name = std::to_string(rate);
+        writeStat(tsv, "markerBytes", name, bytes);
+        writeStat(tsv, "markerUnitsScanned", name,
+            (double) bwt.getNumRuns() / n * rate / 4);
+    }
+
+    for(size_t rate : sampleRates) {
+        // A sample every rate rows, plus the start of every text. Locating
+        // takes about rate - 1 LF steps back to a sample.
+        size_t bytes = (n / rate + texts) * sizeof(SAElem);
+        std::string name = std::to_string(rate);
+        writeStat(tsv, "sampledSABytes", name, bytes);
+        writeStat(tsv, "sampledSALocateNanoseconds", name,
+            (rate - 1) * lfNanoseconds);
+    }
+
+    // A run-sampled suffix array keeps positions at both ends of every run,
+    // splitting runs at text boundaries, and finds a row's position by walking
+    // back to a row whose neighbor differs: about n / r steps.
+    size_t boundaries = runs.runs + runs.stopSymbols - runs.stopRuns;
+    writeStat(tsv, "runSampledSA", "boundaries", boundaries);
+    writeStat(tsv, "runSampledSA", "bytes", (4 * boundaries + texts) *
+        sizeof(uint64_t));
+    writeStat(tsv, "runSampledSA", "locateNanoseconds", runs.runs == 0 ? 0.0 :
+        (double) n / runs.runs * lfNanoseconds);
+    writeStat(tsv, "lf", "nanoseconds", lfNanoseconds);
+
+    for(size_t bucket = 0; bucket < lcpValues.size(); bucket++) {
+        if(lcpValues[bucket] > 0) {
+            // Name each bucket by its smallest value.
+            writeStat(tsv, "lcpValues", bucket == 0 ? std::string("0") :
+                std::to_string((size_t) 1 << (bucket - 1)), lcpValues[bucket]);
+        }
+    }
+    writeStat(tsv, "lcp", "max", lcpMax);
+    writeStat(tsv, "lcp", "over8Bits", lcpOver8);
+    writeStat(tsv, "lcp", "over16Bits", lcpOver16);
+    writeStat(tsv, "lcpEncoding", "bytes", lcp.getMemoryUsage());
+    // Bytes with (index, value) escapes for big values, or fixed widths.
+    writeStat(tsv, "lcpEncoding", "8Bit", lcp.getSize() +
+        lcpOver8 * 2 * sizeof(uint64_t));
+    writeStat(tsv, "lcpEncoding", "16Bit", lcp.getSize() * 2 +
+        lcpOver16 * 2 * sizeof(uint64_t));
+    writeStat(tsv, "lcpEncoding", "32Bit", lcp.getSize() * 4);
+
+    for(size_t genome = 0; genome < index.getNumberOfGenomes(); genome++) {
+        // Each contig in the genome has a row per base and a text stop, on
+        // each strand.
+        auto contigs = index.getGenomeContigs(genome);
+        size_t genomeRows = 0;
+        for(size_t contig = contigs.first; contig < contigs.second; contig++) {
+            genomeRows += 2 * (index.getContigLength(contig) + 1);
+        }
+        std::string name = std::to_string(genome);
+        writeStat(tsv, "genomeMaskDensity", name, (double) genomeRows / n);
+        writeStat(tsv, "genomeMaskBytes", name,
+            index.getGenomeMask(genome).getMemoryUsage());
+    }
+
+    for(const auto& usage : index.getMemoryUsage()) {
+        // Report what's loaded now, including the genome masks.
+        writeStat(tsv, "memory", usage.first, usage.second);
+    }
+
+    tsv.close();
+    if(!tsv) {
+        throw std::runtime_error("Could not write " +
+            options["tsv"].as<std::string>());
+    }
+
+    Log::info() << "BWT of " << n << " characters has " << runs.runs <<
+        " runs" << std::endl;
+
+    return 0;
+}
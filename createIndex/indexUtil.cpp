@@ -1,40 +1,298 @@
 #include "indexUtil.hpp"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
 #include <FMDIndexBuilder.hpp>
 
+// Where finished indexes are cached, or empty for no cache.
+static std::string indexCache;
+
+/**
+ * Compute a CRC32 and an Adler-32 of the contents of the given files, in order,
+ * and of the given description of the options used to index them. Returns them
+ * both in hex, which is long enough to name the index in a cache.
+ */
+static std::string
+checksumSource(
+    const std::vector<std::string>& fastas,
+    const std::string& options
+) {
+    
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    uint32_t adler = adler32(0L, Z_NULL, 0);
+    
+    // Read through each file a bufferful at a time.
+    std::vector<char> buffer(1 << 20);
+    for(const std::string& fasta : fastas) {
+        std::ifstream file(fasta.c_str(), std::ios::binary);
+        if(!file.good()) {
+            throw std::runtime_error("Could not read " + fasta);
+        }
+        
+        while(file) {
+            file.read(buffer.data(), buffer.size());
+            crc = crc32(crc, (const Bytef*) buffer.data(), file.gcount());
+            adler = adler32(adler, (const Bytef*) buffer.data(),
+                file.gcount());
+        }
+        
+        // Separate the files, so moving data between them changes the sums.
+        crc = crc32(crc, (const Bytef*) "\n", 1);
+        adler = adler32(adler, (const Bytef*) "\n", 1);
+    }
+    
+    crc = crc32(crc, (const Bytef*) options.data(), options.size());
+    adler = adler32(adler, (const Bytef*) options.data(), options.size());
+    
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%08x%08x", crc, adler);
+    return hex;
+}
+
+/**
+ * Get all the files in the given index directory that belong to its bottom
+ * level index, other than partly written ones.
+ */
+static std::vector<boost::filesystem::path>
+getIndexFiles(
+    const std::string& indexDirectory
+) {
+    
+    std::vector<boost::filesystem::path> files;
+    if(!boost::filesystem::exists(indexDirectory)) {
+        return files;
+    }
+    
+    for(boost::filesystem::directory_iterator i(indexDirectory);
+        i != boost::filesystem::directory_iterator(); ++i) {
+        
+        std::string name = i->path().filename().string();
+        if(boost::filesystem::is_regular_file(i->path()) &&
+            name.compare(0, 15, "index.basename.") == 0 &&
+            !boost::algorithm::ends_with(name, ".partial")) {
+            
+            files.push_back(i->path());
+        }
+    }
+    return files;
+}
+
+/**
+ * Hard-link the given file to the given new name, or copy it if it can't be
+ * linked there.
+ */
+static void
+linkOrCopy(
+    const boost::filesystem::path& from,
+    const boost::filesystem::path& to
+) {
+    
+    boost::system::error_code error;
+    boost::filesystem::create_hard_link(from, to, error);
+    if(error) {
+        // Probably the cache is on another filesystem.
+        boost::filesystem::copy_file(from, to);
+    }
+}
+
+void
+setIndexCache(
+    const std::string& cacheDirectory
+) {
+    indexCache = cacheDirectory;
+}
+
 FMDIndex*
 buildIndex(
     std::string indexDirectory,
     std::vector<std::string> fastas,
-    int sampleRate
+    int sampleRate,
+    bool useFlatBWT,
+    size_t kmerTableDepth,
+    bool savePackedText,
+    bool sampleRuns,
+    size_t memoryBudget,
+    size_t numThreads,
+    BWTAlgorithm bwtAlgorithm
 ) {
 
-    // Make sure an empty indexDirectory exists.
-    if(boost::filesystem::exists(indexDirectory)) {
-        // Get rid of it if it exists already.
-        boost::filesystem::remove_all(indexDirectory);
-    }
-    // Create it again.
-    boost::filesystem::create_directory(indexDirectory);
+    // Make sure the indexDirectory exists. Don't empty it out, so the builder
+    // can resume an interrupted build of the same index; it replaces anything
+    // it can't reuse.
+    boost::filesystem::create_directories(indexDirectory);
     
     // Build the bottom-level index.
     
     // Work out its basename
     std::string basename(indexDirectory + "/index.basename");
-
-    // Make a new builder
-    FMDIndexBuilder builder(basename, sampleRate);
-    for(std::vector<std::string>::iterator i = fastas.begin(); i < fastas.end();
-        ++i) {
-        
-        Log::info() << "Adding FASTA " << *i << std::endl;
+    
+    for(const auto& file : getIndexFiles(indexDirectory)) {
+        if(boost::filesystem::hard_link_count(file) > 1) {
+            // This is linked to a cached index, and the builder writes some
+            // files in place, so don't let it write through to the cache.
+            boost::filesystem::remove(file);
+        }
+    }
+    
+    // Work out where the index would be cached.
+    std::string cached;
+    if(!indexCache.empty()) {
+        std::stringstream options;
+        options << "sampleRate " << sampleRate << " kmerTable " <<
+            kmerTableDepth << " packedText " << savePackedText <<
+            " sampleRuns " << sampleRuns;
+        cached = indexCache + "/" + checksumSource(fastas, options.str());
         
-        // Add each FASTA file to the index.
-        builder.add(*i);
+        if(boost::filesystem::exists(cached)) {
+            // Replace whatever index is here with the cached one.
+            Log::info() << "Using cached index " << cached << std::endl;
+            for(const auto& file : getIndexFiles(indexDirectory)) {
+                boost::filesystem::remove(file);
+            }
+            for(const auto& file : getIndexFiles(cached)) {
+                linkOrCopy(file, indexDirectory / file.filename());
+            }
+            return new FMDIndex(basename, NULL, useFlatBWT);
+        }
     }
+
+    // Make a new builder
+    FMDIndexBuilder builder(basename, sampleRate, kmerTableDepth,
+        savePackedText, false, sampleRuns, memoryBudget, numThreads,
+        bwtAlgorithm);
+    // Add all the FASTA files to the index, parsing them in parallel.
+    builder.addAll(fastas);
     
     Log::info() << "Finishing index..." << std::endl;    
     
+    FMDIndex* index = builder.build(useFlatBWT);
+    
+    if(!cached.empty()) {
+        // Put the index in the cache, under a temporary name until all of it
+        // is there.
+        Log::info() << "Caching index as " << cached << std::endl;
+        boost::filesystem::create_directories(indexCache);
+        boost::filesystem::path staging = boost::filesystem::unique_path(
+            cached + ".%%%%-%%%%-%%%%");
+        boost::filesystem::create_directory(staging);
+        for(const auto& file : getIndexFiles(indexDirectory)) {
+            if(file.filename() != "index.basename.source") {
+                linkOrCopy(file, staging / file.filename());
+            }
+        }
+        
+        boost::system::error_code error;
+        boost::filesystem::rename(staging, cached, error);
+        if(error) {
+            // Another run cached the same index first, which is just as good.
+            boost::filesystem::remove_all(staging);
+        }
+    }
+    
     // Return the built index.
-    return builder.build();
+    return index;
+}
+
+FMDIndex*
+loadOrBuildIndex(
+    std::string indexDirectory,
+    std::vector<std::string> fastas,
+    int sampleRate,
+    bool useFlatBWT,
+    size_t kmerTableDepth,
+    bool savePackedText
+) {
+
+    std::string basename(indexDirectory + "/index.basename");
+    std::string sourceFile(basename + ".source");
+    
+    // Work out what the index ought to have been built from.
+    std::stringstream options;
+    options << "sampleRate " << sampleRate << " kmerTable " << kmerTableDepth <<
+        " packedText " << savePackedText;
+    std::string checksum = checksumSource(fastas, options.str());
+    
+    // See what it was built from, if it was finished.
+    std::ifstream source(sourceFile.c_str());
+    std::string oldChecksum;
+    if(source >> oldChecksum && oldChecksum == checksum) {
+        Log::info() << "Reusing existing index " << basename << std::endl;
+        return new FMDIndex(basename, NULL, useFlatBWT);
+    }
+    source.close();
+    
+    Log::info() << "No matching index in " << indexDirectory <<
+        "; building one" << std::endl;
+    
+    // Don't let an old record say a half-built index is finished.
+    boost::filesystem::remove(sourceFile);
+    
+    FMDIndex* index = buildIndex(indexDirectory, fastas, sampleRate,
+        useFlatBWT, kmerTableDepth, savePackedText);
+    
+    // Now say what it was built from.
+    std::ofstream newSource(sourceFile.c_str());
+    newSource << checksum << std::endl;
+    newSource.close();
+    if(!newSource) {
+        throw std::runtime_error("Could not write " + sourceFile);
+    }
+    
+    return index;
+}
+
+FMDIndex*
+appendIndex(
+    std::string indexDirectory,
+    std::vector<std::string> fastas,
+    int sampleRate,
+    bool useFlatBWT,
+    size_t kmerTableDepth,
+    bool savePackedText,
+    bool sampleRuns,
+    size_t numThreads
+) {
+
+    // Build the new index next to the existing one, since the builder can't
+    // overwrite the index it is reading, and so the existing one survives
+    // until the new one is finished.
+    std::string newDirectory(indexDirectory + ".new");
+    std::string oldDirectory(indexDirectory + ".old");
+    if(boost::filesystem::exists(oldDirectory)) {
+        // An earlier append was stopped while swapping the indexes in, and
+        // this may be the only good copy.
+        throw std::runtime_error(oldDirectory + " exists from an earlier "
+            "append; restore or remove it first");
+    }
+    // Anything here is left over from an append that never finished.
+    boost::filesystem::remove_all(newDirectory);
+    boost::filesystem::create_directory(newDirectory);
+    
+    // Make a new builder
+    FMDIndexBuilder builder(newDirectory + "/index.basename", sampleRate,
+        kmerTableDepth, savePackedText, false, sampleRuns, 0, numThreads);
+        
+    Log::info() << "Appending " << fastas.size() << " FASTAs..." << std::endl;
+    
+    // Merge the new genomes in.
+    delete builder.append(indexDirectory + "/index.basename", fastas,
+        useFlatBWT);
+    
+    // Swap the new index in. The index loads some of its parts on first use,
+    // so it has to be loaded again from where it ends up.
+    boost::filesystem::rename(indexDirectory, oldDirectory);
+    boost::filesystem::rename(newDirectory, indexDirectory);
+    boost::filesystem::remove_all(oldDirectory);
+    
+    FMDIndex* index = new FMDIndex(indexDirectory + "/index.basename", NULL,
+        useFlatBWT);
+    
+    return index;
 }
@@ -2,6 +2,7 @@
 #define INDEXUTIL_HPP
 
 #include <FMDIndex.hpp>
+#include <FMDIndexBuilder.hpp>
 #include <Log.hpp>
 
 #include <string>
@@ -12,15 +13,82 @@
 // indexUtil.hpp: Utility functions for working with FMDIndexes.
 
 /**
- * Start a new index in the given directory (by replacing it), and index the
+ * Keep finished bottom-level indexes in the given cache directory, keyed on the
+ * contents of the FASTAs they index and the options that change their files.
+ * buildIndex then hard-links a matching cached index into the index directory
+ * (or copies it, across filesystems) instead of building it, and adds the
+ * indexes it does build to the cache. Pass "" to stop using a cache.
+ */
+void
+setIndexCache(
+    const std::string& cacheDirectory
+);
+
+/**
+ * Start a new index in the given directory (by replacing the index there, or
+ * resuming it if it is an interrupted build of the same FASTAs), and index the
  * given FASTAs for the bottom level FMD index. Optionally takes a suffix array
- * sample rate to use. Returns the FMD index that gets created.
+ * sample rate to use, whether to search with a flat (non-run-length) BWT, and
+ * a depth for a k-mer table to skip the start of searches (0 for none),
+ * whether to save a packed copy of the contigs for fast random access,
+ * whether to sample the suffix array at BWT run boundaries instead of at the
+ * sample rate, for highly repetitive collections, a memory budget in bytes
+ * to build the BWT in batches under (0 to build it all in memory), a
+ * number of threads to sort suffixes with, and an algorithm to construct the
+ * BWT with. Uses the index cache, if one was set with setIndexCache(). Returns
+ * the FMD index that gets created.
  */
 FMDIndex*
 buildIndex(
     std::string indexDirectory,
     std::vector<std::string> fastas,
-    int sampleRate = 128
+    int sampleRate = 128,
+    bool useFlatBWT = false,
+    size_t kmerTableDepth = 0,
+    bool savePackedText = false,
+    bool sampleRuns = false,
+    size_t memoryBudget = 0,
+    size_t numThreads = 1,
+    BWTAlgorithm bwtAlgorithm = BWT_SUFFIX_SORT
+);
+
+/**
+ * Load the index in the given directory if it was built by this function from
+ * FASTAs with the same contents and with the same options, and otherwise build
+ * it as buildIndex does. The FASTAs' contents and the options are checksummed
+ * into <basename>.source, which is only written once the index is finished.
+ * Returns the FMD index that gets loaded or created.
+ */
+FMDIndex*
+loadOrBuildIndex(
+    std::string indexDirectory,
+    std::vector<std::string> fastas,
+    int sampleRate = 128,
+    bool useFlatBWT = false,
+    size_t kmerTableDepth = 0,
+    bool savePackedText = false
+);
+
+/**
+ * Add the given FASTAs, one genome each, to the bottom level FMD index already
+ * in the given directory, by merging their BWT into its BWT instead of
+ * indexing all the genomes again. Takes the same options as buildIndex, which
+ * apply to the whole new index. Returns the FMD index that gets created.
+ *
+ * The new index is built in a sibling ".new" directory and only replaces the
+ * existing one once it is finished. Throws a std::runtime_error if a ".old"
+ * directory is left over from an append stopped in the middle of the swap.
+ */
+FMDIndex*
+appendIndex(
+    std::string indexDirectory,
+    std::vector<std::string> fastas,
+    int sampleRate = 128,
+    bool useFlatBWT = false,
+    size_t kmerTableDepth = 0,
+    bool savePackedText = false,
+    bool sampleRuns = false,
+    size_t numThreads = 1
 );
 
 #endif
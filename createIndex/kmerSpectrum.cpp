@@ -0,0 +1,340 @@
+// kmerSpectrum.cpp: program to profile the repeat content of an indexed
+// reference, for tuning context lengths.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <csignal>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+#include <FMDIndex.hpp>
+#include <LCPArray.hpp>
+#include <Log.hpp>
+#include <TaskPool.hpp>
+
+#include "unixUtil.hpp"
+
+/**
+ * Holds the repeat profile of part or all of an index.
+ */
+struct RepeatProfile {
+    /**
+     * Make an empty profile for k-mer lengths from minK to maxK, counting
+     * k-mers that occur maxCount or more times together, and suffixes with
+     * minimal unique lengths of maxLength or more together.
+     */
+    RepeatProfile(size_t minK, size_t maxK, size_t maxCount,
+        size_t maxLength): minK(minK), maxK(maxK),
+        kmers(maxK - minK + 1, std::vector<size_t>(maxCount + 1, 0)),
+        repeatedOccurrences(maxK - minK + 1, 0),
+        minUniqueLengths(maxLength + 1, 0) {
+        // Nothing to do
+    }
+
+    /**
+     * Add in the counts from another profile with the same bounds.
+     */
+    void add(const RepeatProfile& other) {
+        for(size_t k = 0; k < kmers.size(); k++) {
+            for(size_t count = 0; count < kmers[k].size(); count++) {
+                kmers[k][count] += other.kmers[k][count];
+            }
+            repeatedOccurrences[k] += other.repeatedOccurrences[k];
+        }
+        for(size_t length = 0; length < minUniqueLengths.size(); length++) {
+            minUniqueLengths[length] += other.minUniqueLengths[length];
+        }
+    }
+
+    // What k-mer lengths are profiled?
+    size_t minK;
+    size_t maxK;
+
+    // Holds, for each k-mer length from minK, the number of distinct k-mers
+    // occurring each number of times. Only repeated k-mers are counted as we
+    // go, since unique ones are whatever is left.
+    std::vector<std::vector<size_t>> kmers;
+
+    // Holds, for each k-mer length from minK, the number of occurrences of
+    // repeated k-mers.
+    std::vector<size_t> repeatedOccurrences;
+
+    // Holds the number of suffixes with each minimal unique length.
+    std::vector<size_t> minUniqueLengths;
+};
+
+/**
+ * Profile the suffixes from start up to end in the given LCP array, where no
+ * k-mer being profiled spans either end: start and end are each 0, the end of
+ * the array, or a position with an LCP value less than the profile's minK.
+ *
+ * Works up the suffix tree, with a stack of the LCP intervals the current
+ * suffix is in. Each interval of depth d whose parent has depth p is the
+ * occurrences of one k-mer for each k in (p, d].
+ */
+void profileSuffixes(const LCPArray& lcp, size_t start, size_t end,
+    RepeatProfile& profile) {
+
+    size_t maxCount = profile.kmers[0].size() - 1;
+    size_t maxLength = profile.minUniqueLengths.size() - 1;
+
+    // Holds the depth and first suffix of each interval we are in. The bottom
+    // one is a stand-in for everything too shallow to count.
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.emplace_back(profile.minK - 1, start);
+
+    for(size_t i = start; i < end; i++) {
+        // A suffix is unique once it is longer than what it shares with
+        // either neighbor.
+        size_t before = i == 0 ? 0 : lcp[i];
+        size_t after = i + 1 == lcp.getSize() ? 0 : lcp[i + 1];
+        profile.minUniqueLengths[std::min(std::max(before, after) + 1,
+            maxLength)]++;
+
+        // Depths past maxK all look the same, and depths before minK all end
+        // every k-mer. Past the end, end everything.
+        size_t value = i + 1 == end ? profile.minK - 1 :
+            std::max(std::min(after, profile.maxK), profile.minK - 1);
+
+        // Where would an interval starting to share this value start?
+        size_t intervalStart = i;
+
+        while(value < stack.back().first) {
+            // This interval ends with this suffix.
+            size_t depth = stack.back().first;
+            size_t count = i + 1 - stack.back().second;
+            intervalStart = stack.back().second;
+            stack.pop_back();
+
+            for(size_t k = std::max(value, stack.back().first) + 1;
+                k <= depth; k++) {
+
+                // It's one k-mer of each length its parent is too short for.
+                profile.kmers[k - profile.minK][std::min(count, maxCount)]++;
+                profile.repeatedOccurrences[k - profile.minK] += count;
+            }
+        }
+
+        if(value > stack.back().first) {
+            // The next suffix starts sharing more with this one.
+            stack.emplace_back(value, intervalStart);
+        }
+    }
+}
+
+/**
+ * kmerSpectrum: command-line tool to find how many distinct k-mers of each
+ * length in a range occur each number of times in an index, and how long the
+ * minimal unique substrings starting at each position are, from the index's
+ * LCP array in one parallel pass. Both strands are indexed, so each k-mer's
+ * occurrences include those of its reverse complement.
+ */
+int
+main(
+    int argc,
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription =
+        std::string("Profile the repeat content of an index.\n") +
+        "Usage: kmerSpectrum <index directory> <tsv>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options()
+        ("help", "Print help messages")
+        ("indexDirectory", boost::program_options::value<std::string>()
+            ->required(),
+            "Directory the index was made in")
+        ("tsv", boost::program_options::value<std::string>()->required(),
+            "File to save <k>\\t<occurrences>\\t<distinct k-mers> lines in")
+        ("minK", boost::program_options::value<size_t>()
+            ->default_value(11),
+            "Shortest k-mers to count")
+        ("maxK", boost::program_options::value<size_t>()
+            ->default_value(100),
+            "Longest k-mers to count")
+        ("maxCount", boost::program_options::value<size_t>()
+            ->default_value(1000),
+            "Count k-mers occurring this many times or more together")
+        ("minUniqueLengths", boost::program_options::value<std::string>(),
+            "File to save <length>\\t<positions> lines of minimal unique "
+            "substring lengths in")
+        ("maxLength", boost::program_options::value<size_t>()
+            ->default_value(1000),
+            "Count minimal unique lengths this long or longer together")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(std::thread::hardware_concurrency()),
+            "Number of threads to profile with");
+
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("indexDirectory", 1);
+    positionals.add("tsv", 1);
+
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+
+            // Don't do the actual program.
+            return 0;
+        }
+
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+
+        if(options["minK"].as<size_t>() == 0 ||
+            options["minK"].as<size_t>() > options["maxK"].as<size_t>()) {
+
+            // We need some k-mers to count.
+            throw boost::program_options::error(
+                "minK must be at least 1 and at most maxK");
+        }
+
+        if(options["maxCount"].as<size_t>() < 2 ||
+            options["maxLength"].as<size_t>() < 1) {
+
+            // Unique k-mers and repeated ones need their own counts.
+            throw boost::program_options::error(
+                "maxCount must be at least 2 and maxLength at least 1");
+        }
+
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl;
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl;
+
+        // Stop the program.
+        return -1;
+    }
+
+    // If we get here, we have the right arguments.
+    size_t minK = options["minK"].as<size_t>();
+    size_t maxK = options["maxK"].as<size_t>();
+    size_t maxCount = options["maxCount"].as<size_t>();
+    size_t maxLength = options["maxLength"].as<size_t>();
+    size_t numThreads = options["threads"].as<size_t>();
+
+    // Profile on the shared pool, sized to match.
+    TaskPool::setGlobalSize(numThreads);
+
+    // Load the index for its contig lengths, and map its LCP array directly
+    // to scan it.
+    std::string basename = options["indexDirectory"].as<std::string>() +
+        "/index.basename";
+    FMDIndex index(basename);
+    LCPArray lcp(basename + ".lcp");
+
+    // Cut the suffixes into a few chunks per thread, moving each cut up to
+    // where no k-mer being counted spans it.
+    size_t numChunks = std::max(numThreads, (size_t) 1) * 4;
+    std::vector<size_t> cuts;
+    cuts.push_back(0);
+    for(size_t chunk = 1; chunk < numChunks; chunk++) {
+        size_t cut = std::max(lcp.getSize() * chunk / numChunks, cuts.back());
+        while(cut < lcp.getSize() && cut > 0 && lcp[cut] >= minK) {
+            cut++;
+        }
+        cuts.push_back(cut);
+    }
+    cuts.push_back(lcp.getSize());
+
+    Log::info() << "Profiling " << lcp.getSize() << " suffixes in " <<
+        numChunks << " chunks" << std::endl;
+
+    RepeatProfile total(minK, maxK, maxCount, maxLength);
+    std::mutex totalMutex;
+    parallelFor(numChunks, [&](size_t chunk) {
+        RepeatProfile profile(minK, maxK, maxCount, maxLength);
+        if(cuts[chunk] < cuts[chunk + 1]) {
+            profileSuffixes(lcp, cuts[chunk], cuts[chunk + 1], profile);
+        }
+
+        std::lock_guard<std::mutex> lock(totalMutex);
+        total.add(profile);
+    });
+
+    std::ofstream tsv(options["tsv"].as<std::string>());
+    for(size_t k = minK; k <= maxK; k++) {
+        // Every occurrence not in a repeated k-mer is a unique k-mer. Each
+        // contig has a text per strand, with a k-mer at each base but the
+        // last k - 1.
+        size_t occurrences = 0;
+        for(size_t contig = 0; contig < index.getNumberOfContigs(); contig++) {
+            size_t length = index.getContigLength(contig);
+            occurrences += length >= k ? 2 * (length - k + 1) : 0;
+        }
+        total.kmers[k - minK][1] = occurrences -
+            total.repeatedOccurrences[k - minK];
+
+        for(size_t count = 1; count <= maxCount; count++) {
+            if(total.kmers[k - minK][count] > 0) {
+                tsv << k << '\t' << count << '\t' <<
+                    total.kmers[k - minK][count] << '\n';
+            }
+        }
+    }
+    tsv.close();
+    if(!tsv) {
+        throw std::runtime_error("Could not write " +
+            options["tsv"].as<std::string>());
+    }
+
+    if(options.count("minUniqueLengths")) {
+        // Save the minimal unique lengths too. Lengths count the end of a
+        // text, so suffixes that are never unique come out a base longer
+        // than they are.
+        std::ofstream lengths(options["minUniqueLengths"].as<std::string>());
+        for(size_t length = 1; length <= maxLength; length++) {
+            if(total.minUniqueLengths[length] > 0) {
+                lengths << length << '\t' << total.minUniqueLengths[length] <<
+                    '\n';
+            }
+        }
+        lengths.close();
+        if(!lengths) {
+            throw std::runtime_error("Could not write " +
+                options["minUniqueLengths"].as<std::string>());
+        }
+    }
+
+    Log::info() << "Profiled k-mers of " << minK << " to " << maxK <<
+        " bases" << std::endl;
+
+    return 0;
+}
@@ -4,14 +4,27 @@
 #include <string>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <set>
+#include <map>
 #include <algorithm>
 #include <utility>
 #include <ctime>
 #include <csignal>
 #include <iterator>
 #include <cstdint> 
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <cerrno>
+
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 
 #include <boost/filesystem.hpp>
@@ -24,22 +37,36 @@
 #include <FMDIndex.hpp>
 #include <FMDIndexBuilder.hpp>
 #include <GenericBitVector.hpp>
+#include <LevelIndex.hpp>
 #include <FMDIndexIterator.hpp>
 #include <TextPosition.hpp>
 #include <util.hpp>
 #include <Mapping.hpp>
 #include <SmallSide.hpp>
 #include <Log.hpp>
-#include <Fasta.hpp>
 #include <MappingScheme.hpp>
+#include <PerfCounters.hpp>
+#include <HugePages.hpp>
+#include <IndexWarmer.hpp>
+#include <IndexPackage.hpp>
+#include <QueryTracer.hpp>
+#include <TaskPool.hpp>
 #include <NaturalMappingScheme.hpp>
+#include <ContextCache.hpp>
+#include <ReadResultCache.hpp>
+#include <MinimizerIndex.hpp>
+#include <AlignmentFile.hpp>
+#include <SortedAlignmentWriter.hpp>
+#include <AvroFile.hpp>
+#include <kseq.h>
 
 // Grab timers from libsuffixtools
 #include <Timer.h>
 
 
 #include "IDSource.hpp"
-#include "ConcurrentQueue.hpp"
+#include "BoundedQueue.hpp"
+#include "ReorderBuffer.hpp"
 #include "MappingMergeScheme.hpp"
 #include "MergeApplier.hpp"
 
@@ -48,206 +75,1028 @@
 #include "pinchGraphUtil.hpp"
 
 #include "indexUtil.hpp"
+#include "BufferedWriter.hpp"
+
+// Tell kseq what files are (zlib handles) and that you read them with gzread,
+// so gzipped (and bgzipped) FASTA and FASTQ files work too.
+KSEQ_INIT(gzFile, gzread)
+
+/**
+ * How many reads should be handed to a mapping thread at once?
+ */
+const size_t MAP_BATCH_SIZE = 16;
+
+/**
+ * How many batches of reads per mapping thread can be loaded ahead of the
+ * mapping threads?
+ */
+const size_t READ_QUEUE_BATCHES = 4;
+
+/**
+ * How many reads should be loaded between progress messages?
+ */
+const size_t READ_PROGRESS_INTERVAL = 100000;
+
+/**
+ * How big a buffer should zlib use when reading reads?
+ */
+const unsigned int READ_BUFFER_SIZE = 1 << 20;
+
+/**
+ * How many batches of reads can each server client have waiting to be mapped,
+ * before it stops reading more until it has sent back the first one's results?
+ */
+const size_t CLIENT_BATCHES_IN_FLIGHT = 16;
+
+/**
+ * Represents a batch of reads, as names and sequences, to be mapped together.
+ * If the batch came from a server client, the output for it is sent back
+ * through the reply promise, instead of to the shared output queue. Batches
+ * loaded from files are numbered in the order they were loaded.
+ */
+struct ReadBatch {
+    std::vector<std::string> names;
+    std::vector<std::string> sequences;
+    std::shared_ptr<std::promise<std::string>> reply;
+    size_t number = 0;
+};
+
+/**
+ * Says what output to make from mapped reads.
+ */
+struct OutputOptions {
+    // Should per-base mappings be made? If not, only summaries are.
+    bool alignment = true;
+    // Should per-base mappings be AlignmentFile records instead of TSV?
+    bool binary = false;
+    // If so, should they be sorted by reference position and indexed, instead
+    // of saved in the order the reads were mapped?
+    bool sorted = false;
+    // How many bytes of segments can be held in memory while sorting?
+    size_t sortMemory = 0;
+    // Or should they be blocks of Avro records, for Spark?
+    bool avro = false;
+    // What sync marker ends each block of an Avro file?
+    std::string avroSync;
+    // Should a summary line be made for each read?
+    bool summary = false;
+    // Are the reads interleaved pairs, with each read right after its mate?
+    bool paired = false;
+    // How long can the insert of a proper pair be?
+    size_t maxInsert = 0;
+    // Should output come out in the same order as the reads went in?
+    bool ordered = false;
+};
+
+/**
+ * Represents where a read was placed: the contig and strand that the most of
+ * its mapped bases went to, and the interval of the original reference
+ * sequence they cover there.
+ */
+struct ReadPlacement {
+    // What index contig is it on?
+    size_t contig = 0;
+    // Is it on the reverse strand?
+    bool backwards = false;
+    // How many mapped bases are placed there?
+    size_t placedBases = 0;
+    // What [start, end) interval of the reference sequence do they cover?
+    size_t start = 0;
+    size_t end = 0;
+};
 
 /**
- * Load reads from the given FASTAs and queue them up in the given queue.
- * Returns total reads processed. Skips any reads with Ns.
+ * How many batches of output per mapping thread can be waiting to be written
+ * before the mapping threads have to wait for the writer?
+ */
+const size_t OUTPUT_QUEUE_BATCHES = 4;
+
+/**
+ * When output is ordered, how many batches per mapping thread can be mapped
+ * ahead of the oldest batch still being mapped?
+ */
+const size_t REORDER_WINDOW_BATCHES = 4;
+
+/**
+ * Load reads from the given FASTA or FASTQ file, which may be gzipped, and
+ * queue them up in batches of MAP_BATCH_SIZE in the given queue. Counts the
+ * reads loaded in the given counter, which may be shared by several loading
+ * threads, and reports progress every READ_PROGRESS_INTERVAL reads. Numbers
+ * the batches from the given batch counter, which may also be shared. Returns
+ * total reads loaded from this file. Skips any reads with Ns.
+ *
+ * If paired is set, the reads are interleaved pairs. A pair is skipped if
+ * either mate has Ns, and pairs are never split between batches.
  */
 size_t
 loadReads(
-    const std::vector<std::string>& fastas,
-    ConcurrentQueue<std::pair<std::string, std::string>>* recordsOut
+    const std::string& filename,
+    BoundedQueue<ReadBatch>* batchesOut,
+    std::atomic<size_t>* loaded,
+    std::atomic<size_t>* batches,
+    bool paired
 ) {
 
     size_t totalReads = 0;
-
-    for(std::string readFasta : fastas) {
-        // Now go through all the read FASTAs
-        Fasta reader(readFasta);
-        while(reader.hasNext()) {
-            // Go through each FASTA record
-            std::pair<std::string, std::string> headerAndSequence = 
-                reader.getNextRecord();
-            
-            if(headerAndSequence.second.find('N') != std::string::npos) {
-                // Skip this read
-                Log::error() << "Skipping read with N: " << 
-                    headerAndSequence.second << std::endl;
-                continue;
+    
+    // Open the file for reading. This also reads uncompressed files.
+    gzFile file = gzopen(filename.c_str(), "r");
+    if(file == NULL) {
+        throw std::runtime_error("Failed to open reads " + filename);
+    }
+    // Read in big pieces.
+    gzbuffer(file, READ_BUFFER_SIZE);
+    
+    ReadBatch batch;
+    
+    // Add a read to the batch, and send the batch off when it fills up.
+    auto addRead = [&](std::string&& name, std::string&& sequence) {
+        batch.names.push_back(std::move(name));
+        batch.sequences.push_back(std::move(sequence));
+        
+        // Batches are an even number of reads, so a pair never gets split.
+        if(batch.sequences.size() >= MAP_BATCH_SIZE) {
+            // Send off the full batch, waiting if the mapping threads are too
+            // far behind.
+            batch.number = (*batches)++;
+            batchesOut->enqueue(std::move(batch));
+            batch = ReadBatch();
+        }
+        
+        totalReads++;
+        size_t loadedSoFar = ++*loaded;
+        if(loadedSoFar % READ_PROGRESS_INTERVAL == 0) {
+            Log::info() << "Loaded " << loadedSoFar << " reads" << std::endl;
+        }
+    };
+    
+    // When reading pairs, hold each first mate here until we have the second.
+    bool havePending = false;
+    bool pendingHasN = false;
+    std::string pendingName;
+    std::string pendingSequence;
+    
+    kseq_t* seq = kseq_init(file);
+    while(kseq_read(seq) >= 0) {
+        // Go through each record. FASTQ qualities are ignored.
+        
+        // kseq already cuts the name at whitespace. Cut it at a comma too, the
+        // way Fasta does.
+        std::string name(seq->name.s, strcspn(seq->name.s, ","));
+        std::string sequence(seq->seq.s, seq->seq.l);
+        bool hasN = memchr(seq->seq.s, 'N', seq->seq.l) != NULL;
+        
+        if(paired && !havePending) {
+            // Wait for the mate.
+            pendingName = std::move(name);
+            pendingSequence = std::move(sequence);
+            pendingHasN = hasN;
+            havePending = true;
+        } else if(paired) {
+            havePending = false;
+            if(hasN || pendingHasN) {
+                // Skip this pair
+                Log::error() << "Skipping pair with N: " << pendingName <<
+                    " and " << name << std::endl;
+            } else {
+                addRead(std::move(pendingName), std::move(pendingSequence));
+                addRead(std::move(name), std::move(sequence));
             }
-            
-            totalReads++;
-            Log::info() << "Mapping read " << totalReads << std::endl;
-            
-            // Put the read in the queue
-            auto lock = recordsOut->lock();
-            recordsOut->enqueue(headerAndSequence, lock);
+        } else if(hasN) {
+            // Skip this read
+            Log::error() << "Skipping read with N: " << name << std::endl;
+        } else {
+            addRead(std::move(name), std::move(sequence));
         }
     }
+    kseq_destroy(seq);
+    gzclose(file);
     
-    // Close the queue since we read everything.
-    auto lock = recordsOut->lock();
-    recordsOut->close(lock);
+    if(havePending) {
+        // There was an odd number of reads. Map the last one on its own.
+        Log::error() << "Read " << pendingName << " has no mate" << std::endl;
+        if(!pendingHasN) {
+            addRead(std::move(pendingName), std::move(pendingSequence));
+        }
+    }
+    
+    if(!batch.sequences.empty()) {
+        // Send off the last partial batch.
+        batch.number = (*batches)++;
+        batchesOut->enqueue(std::move(batch));
+    }
+    
+    // Close our end of the queue since we read everything.
+    batchesOut->close();
     
     return totalReads;
 }
 
 /**
- * Save each string in the queue to the given output stream. The strings already
- * have newlines.
+ * Load reads from each of the given files in turn, as loadReads() does, so all
+ * of one file's batches are numbered before the next file's.
+ */
+void
+loadReadsInOrder(
+    const std::vector<std::string>& filenames,
+    BoundedQueue<ReadBatch>* batchesOut,
+    std::atomic<size_t>* loaded,
+    std::atomic<size_t>* batches,
+    bool paired
+) {
+    for(const std::string& filename : filenames) {
+        // Each file closes the queue once, as if it had its own thread.
+        loadReads(filename, batchesOut, loaded, batches, paired);
+    }
+}
+
+/**
+ * Save each string in the queue to the given writer. The strings are batches of
+ * whole lines, with newlines.
  */
 void
 saveLines(
-    ConcurrentQueue<std::string>* linesIn, std::ofstream& out
+    BoundedQueue<std::string>* batchesIn, BufferedWriter& out
 ) {
-    // Lock the record queue so we can maybe get a record    
-    auto lineLock = linesIn->waitForNonemptyOrEnd();
-    while(!linesIn->isEmpty(lineLock)) {
-        
-        // Dequeue and write every line
-        out << linesIn->dequeue(lineLock);
+    std::string batch;
+    while(batchesIn->dequeue(batch)) {
+        // Dequeue and write every batch
+        out << batch;
+    }
+}
+
+/**
+ * Add the reads in each string of AlignmentFile read records in the queue to
+ * the given sorted alignment writer.
+ */
+void
+sortReads(
+    BoundedQueue<std::string>* batchesIn, SortedAlignmentWriter& out
+) {
+    std::string batch;
+    while(batchesIn->dequeue(batch)) {
+        out.addReads(batch);
+    }
+}
+
+/**
+ * Append a read's summary line, as described for mapSomeReads(), to the given
+ * string. Takes the read's name, length, number of mapped bases, and
+ * placement, the placement of its mate if it has one (or null), and the
+ * longest insert a proper pair can have.
+ */
+void
+appendSummary(
+    std::string& summary,
+    const FMDIndex& index,
+    const std::string& name,
+    size_t length,
+    size_t mappedBases,
+    const ReadPlacement& placement,
+    const ReadPlacement* mate,
+    size_t maxInsert
+) {
+    summary += name;
+    summary += '\t';
+    BufferedWriter::appendInteger(summary, length);
+    summary += '\t';
+    BufferedWriter::appendInteger(summary, mappedBases);
+    summary += '\t';
+    summary += placement.placedBases > 0 ?
+        index.getContigName(placement.contig) : "*";
+    summary += '\t';
+    BufferedWriter::appendInteger(summary, placement.start);
+    summary += '\t';
+    BufferedWriter::appendInteger(summary, placement.end);
+    summary += '\t';
+    summary += placement.backwards ? '1' : '0';
+    summary += '\t';
+    BufferedWriter::appendInteger(summary, placement.placedBases);
+    summary += '\t';
+    
+    if(mate == nullptr) {
+        summary += "single\t.\n";
+        return;
+    }
+    
+    if(placement.placedBases == 0 || mate->placedBases == 0) {
+        summary += "unplaced\t.\n";
+        return;
+    }
     
-        lineLock = linesIn->waitForNonemptyOrEnd();
+    if(index.getContigName(placement.contig) !=
+        index.getContigName(mate->contig)) {
+        
+        // They can't have an insert size.
+        summary += "discordant\t.\n";
+        return;
     }
+    
+    // Work out the span of the whole fragment.
+    size_t insert = std::max(placement.end, mate->end) -
+        std::min(placement.start, mate->start);
+        
+    // The forward mate has to start no later than the reverse one ends.
+    const ReadPlacement& forward = placement.backwards ? *mate : placement;
+    const ReadPlacement& reverse = placement.backwards ? placement : *mate;
+    bool proper = placement.backwards != mate->backwards &&
+        forward.start <= reverse.end && insert <= maxInsert;
+        
+    summary += proper ? "proper\t" : "discordant\t";
+    BufferedWriter::appendInteger(summary, insert);
+    summary += '\n';
 }
 
 /**
- * Read FASTA sequence names and sequences from the input queue, map them to the
- * reference in the given index, according to the given mapping scheme, and send
- * lines of mapping TSV output to the output queue.
+ * Read batches of sequence names and sequences from the input queue, map them
+ * to the reference in the given index, according to the given mapping scheme,
+ * and send lines of mapping TSV output to the output buffer. The lines for each
+ * batch are sent together, under the batch's number. If the output options ask
+ * for binary output, send AlignmentFile read records instead of TSV lines, with
+ * references numbered by index contig. If they ask for Avro output, send each
+ * batch's read records as one compressed Avro block, with references named. If
+ * they ask for summaries, send a summary line for each read to the summary
+ * buffer.
+ *
+ * Mapped bases are checked against the index's own text, and reported on the
+ * forward strand of the original reference sequence the contig came from.
+ *
+ * Batches with a reply promise get their output through it instead. The output
+ * buffer may be null if every batch will have one, or if per-base output isn't
+ * wanted. The summary buffer may be null if summaries aren't wanted.
+ *
+ * If a result cache is given, reads with the same sequence as a read mapped
+ * before, or as another read in the same batch, aren't mapped again, and just
+ * get its results.
+ *
+ * A summary line gives the read name, its length, the number of bases mapped,
+ * and the read's placement (see ReadPlacement): reference sequence name, start,
+ * end, whether it is backwards, and how many bases are placed there. Unplaced
+ * reads have "*" for the name and 0s after it. Then comes the pair status and
+ * insert size. For interleaved pairs the status is "proper" if the mates are
+ * placed on the same sequence, facing each other, with an insert no longer than
+ * the maximum; "discordant" if they are placed but not properly; and
+ * "unplaced" if either isn't placed. Insert size is only given for mates on the
+ * same sequence. Unpaired reads get "single". Missing values are ".".
  *
  * Returns the total mappings made.
  */
 size_t
 mapSomeReads(
-    ConcurrentQueue<std::pair<std::string, std::string>>* recordsIn, 
-    const std::pair<std::string, std::string>& referenceRecord,
+    BoundedQueue<ReadBatch>* batchesIn, 
     const FMDIndex& index,
     const MappingScheme* mappingScheme,
-    ConcurrentQueue<std::string>* linesOut
+    ReorderBuffer<std::string>* batchesOut,
+    ReorderBuffer<std::string>* summariesOut,
+    const OutputOptions& outputOptions,
+    const ReadResultCache* resultCache
 ) {
 
+    // We only need to make per-base output if someone will get it.
+    bool binary = outputOptions.binary;
+    bool avro = outputOptions.avro;
+    
+    // Avro records name their reference sequences, so have the names ready.
+    std::vector<std::string> contigNames;
+    if(avro) {
+        for(size_t i = 0; i < index.getNumberOfContigs(); i++) {
+            contigNames.push_back(index.getContigName(i));
+        }
+    }
+
     // We'll count all the mappings we make.
     size_t totalMappings = 0;
+    
+    // Reuse the same result storage for every batch, so mapping doesn't need
+    // to allocate per read.
+    MappingBatchResult results;
+    
+    // Format each batch's output lines here.
+    std::string output;
+    
+    // Encode each batch's Avro records here, before they are compressed into
+    // the output.
+    std::string records;
+    
+    // Collect each read's runs of mapped bases here, for binary or Avro
+    // output.
+    std::vector<AlignmentFile::Segment> segments;
+    
+    // Format each batch's summary lines here.
+    std::string summary;
+    
+    // Collect the places bases of each read went here, to find its placement.
+    std::vector<ReadPlacement> candidates;
+    
+    // And the placement and number of mapped bases for each read in the batch.
+    std::vector<ReadPlacement> placements;
+    std::vector<size_t> mappedBases;
 
-    // Lock the record queue so we can maybe get a record    
-    auto recordLock = recordsIn->waitForNonemptyOrEnd();
-    while(!recordsIn->isEmpty(recordLock)) {
-        // We got a record to do. Dequeue it and unlock.
-        std::pair<std::string, std::string> record = 
-            recordsIn->dequeue(recordLock);
-        
-        // Parse out the record.
-        std::string recordName = record.first;
-        std::string sequence = record.second;
+    // Wait for a batch, or for there to be no more.
+    ReadBatch batch;
+    while(batchesIn->dequeue(batch)) {
+        const std::vector<std::string>& recordNames = batch.names;
+        const std::vector<std::string>& sequences = batch.sequences;
         
-        // Map the sequence with the mapping scheme
-        
-        // Make a vector of mappings to populate.
-        std::vector<Mapping> mappings(sequence.size());
+        // Map the sequences with the mapping scheme, or get them from the
+        // cache. Keep the results packed, since there's one per base.
+        if(resultCache != nullptr) {
+            resultCache->mapBatch(*mappingScheme, sequences, results);
+        } else {
+            mappingScheme->mapBatch(sequences, results);
+        }
         
-        // Go and map
-        mappingScheme->map(sequence, [&](size_t base, TextPosition mappedTo) {
-            // For each TextPosition we get, make a Mapping
-            mappings[base] = Mapping(mappedTo);
-        });
+        // Make per-base output for this batch only if someone will get it.
+        bool perBase = batch.reply || (batchesOut != nullptr &&
+            outputOptions.alignment);
         
+        placements.assign(sequences.size(), ReadPlacement());
+        mappedBases.assign(sequences.size(), 0);
         
-        // Output each query base, noting which mapped and to where.
-        for(size_t i = 0; i < sequence.size(); i++) {
-            Mapping mapping = mappings[i];
-            
-            if(mapping.isMapped()) {
+        for(size_t record = 0; record < sequences.size(); record++) {
+            const std::string& recordName = recordNames[record];
+            const std::string& sequence = sequences[record];
             
-                // Did we map backwards or not?
-                bool backwards = false;
-            
-                if(mapping.getLocation().getText() != 0) {
-                    // Flip everything around to be on strand 0. Easy since
-                    // there's exactly one contig indexed.
-                    mapping = mapping.flip(index.getContigLength(0));
-                    backwards = true;
-                }
+            segments.clear();
+            candidates.clear();
+        
+            // Output each query base, noting which mapped and to where.
+            for(size_t i = 0; i < sequence.size(); i++) {
+                Mapping mapping = results.get(record, i).unpack();
                 
-                // Get the character being mapped
-                char mapped = sequence[i];
-                // Get the character it is mapped to, from the forward strand.
-                char mappedTo = referenceRecord.second[
-                    mapping.getLocation().getOffset()];
+                if(mapping.isMapped()) {
+                
+                    // Get the character being mapped
+                    char mapped = sequence[i];
+                    // Get the character it is mapped to, on whatever strand
+                    // it is mapped to, from the index.
+                    char mappedTo = index.displayCached(mapping.getLocation());
                     
-                if(backwards) {
-                    // If we're mapping backwards, we have to match the reverse
-                    // of that character.
-                    mappedTo = complement(mappedTo);
-                }
+                    // Which contig are we on?
+                    size_t contig = mapping.getLocation().getContigNumber();
                     
-                if(mapped != mappedTo) {
-                    // Throw out this mapping, since it's placing a
-                    // character on a character it doesn't match.
-                    mapping = Mapping();
+                    // Did we map backwards or not?
+                    bool backwards = mapping.getLocation().getStrand();
+                
+                    if(backwards) {
+                        // Flip everything around to be on the forward strand.
+                        mapping = mapping.flip(index.getContigLength(contig));
+                    }
                     
-                    Log::critical() << "Tried mapping " << recordName << ":" <<
-                        i << " (" << mapped << ") to " << 
-                        referenceRecord.first << ":" << 
-                        mapping.getLocation().getOffset() << "." << backwards <<
-                        " (" << mappedTo << ")" << std::endl;
+                    // Work out the offset in the original reference sequence.
+                    size_t offset = index.getContigStart(contig) +
+                        mapping.getLocation().getOffset();
+                        
+                    if(mapped != mappedTo) {
+                        // Complain, since it's placing a character on a
+                        // character it doesn't match.
+                        Log::critical() << "Tried mapping " << recordName <<
+                            ":" << i << " (" << mapped << ") to " << 
+                            index.getContigName(contig) << ":" << offset <<
+                            "." << backwards << " (" << mappedTo << ")" <<
+                            std::endl;
+                        
+                        throw std::runtime_error("Non-matching mapping!");
+                    }
                     
-                    throw std::runtime_error("Non-matching mapping!");
-                }
-                
-                
-                // Now do the output for this line, because this position
-                // mapped. Do it as reference, then query. And do it to this
-                // stringstream.
-                std::stringstream mappingStream;
-                mappingStream << referenceRecord.first << "\t" << 
-                    mapping.getLocation().getOffset() << "\t" << 
-                    recordName << "\t" << 
-                    i << "\t" << 
-                    backwards << std::endl;
-                
-                // Make a string of the output
-                std::string line(mappingStream.str());
-                
-                // Send it
-                auto lineLock = linesOut->lock();
-                linesOut->enqueue(line, lineLock);
                     
-                // Count that we had a mapping
-                totalMappings++;
-                
-            } else {
-                // Report this query base as unaligned (just its contig and
-                // base).
-                
-                std::stringstream mappingStream;
-                mappingStream << recordName << "\t" << i << std::endl;
-                
-                // Make a string of the output
-                std::string line(mappingStream.str());
-                
-                // Send it
-                auto lineLock = linesOut->lock();
-                linesOut->enqueue(line, lineLock);
+                    // Count that we had a mapping
+                    totalMappings++;
+                    mappedBases[record]++;
+                    
+                    if(summariesOut != nullptr) {
+                        // Count the base where it went.
+                        auto candidate = std::find_if(candidates.begin(),
+                            candidates.end(), [&](const ReadPlacement& c) {
+                            return c.contig == contig &&
+                                c.backwards == backwards;
+                        });
+                        if(candidate == candidates.end()) {
+                            ReadPlacement placement;
+                            placement.contig = contig;
+                            placement.backwards = backwards;
+                            placement.start = offset;
+                            placement.end = offset + 1;
+                            candidates.push_back(placement);
+                            candidate = candidates.end() - 1;
+                        }
+                        candidate->placedBases++;
+                        candidate->start = std::min(candidate->start, offset);
+                        candidate->end = std::max(candidate->end, offset + 1);
+                    }
+                    
+                    if(!perBase) {
+                        continue;
+                    }
+                    
+                    if(binary || avro) {
+                        // Extend the last run if this base continues it, or
+                        // start a new one.
+                        AlignmentFile::Segment* last = segments.empty() ?
+                            nullptr : &segments.back();
+                        size_t expected = last == nullptr ? 0 :
+                            last->backwards ?
+                            last->referenceOffset - last->length :
+                            last->referenceOffset + last->length;
+                        
+                        if(last != nullptr && last->reference == contig &&
+                            last->backwards == backwards &&
+                            last->queryStart + last->length == i &&
+                            expected == offset) {
+                            
+                            last->length++;
+                        } else {
+                            segments.push_back({i, contig, offset, backwards,
+                                1});
+                        }
+                        continue;
+                    }
+                    
+                    // Now do the output for this line, because this position
+                    // mapped. Do it as reference, then query.
+                    output += index.getContigName(contig);
+                    output += '\t';
+                    BufferedWriter::appendInteger(output, offset);
+                    output += '\t';
+                    output += recordName;
+                    output += '\t';
+                    BufferedWriter::appendInteger(output, i);
+                    output += '\t';
+                    output += backwards ? '1' : '0';
+                    output += '\n';
+                    
+                } else if(perBase && !binary && !avro) {
+                    // Report this query base as unaligned (just its contig and
+                    // base).
+                    
+                    output += recordName;
+                    output += '\t';
+                    BufferedWriter::appendInteger(output, i);
+                    output += '\n';
+                    
+                }
                 
             }
             
+            if(perBase && binary) {
+                // Write the whole read's record at once.
+                AlignmentFile::appendRead(output, recordName, sequence.size(),
+                    segments);
+            } else if(perBase && avro) {
+                // Collect the batch's records to compress together.
+                AlignmentFile::appendAvroRead(records, recordName,
+                    sequence.size(), segments, contigNames);
+            }
+            
+            for(const ReadPlacement& candidate : candidates) {
+                // The read is placed where the most bases went.
+                if(candidate.placedBases > placements[record].placedBases) {
+                    placements[record] = candidate;
+                }
+            }
         }
         
-        // Now wait for a new task, or for there to be no more records.
-        recordLock = recordsIn->waitForNonemptyOrEnd();
+        if(summariesOut != nullptr) {
+            for(size_t record = 0; record < sequences.size(); record++) {
+                // Which read is this one's mate, if any?
+                size_t mate = outputOptions.paired ? record ^ 1 : record;
+                if(mate >= sequences.size()) {
+                    // This read's mate never came.
+                    mate = record;
+                }
+                appendSummary(summary, index, recordNames[record],
+                    sequences[record].size(), mappedBases[record],
+                    placements[record], mate == record ? nullptr :
+                    &placements[mate], outputOptions.maxInsert);
+            }
+            
+            // Send all the summaries at once.
+            size_t size = summary.size();
+            summariesOut->put(batch.number, std::move(summary));
+            summary = std::string();
+            summary.reserve(size);
+        }
+        
+        if(perBase && avro) {
+            // Compress the batch's records into a single block.
+            AvroFile::appendBlock(output, sequences.size(), records,
+                outputOptions.avroSync);
+            records.clear();
+        }
         
+        if(perBase) {
+            // Send the whole batch's output at once, and start a new buffer
+            // about as big for the next batch.
+            size_t size = output.size();
+            if(batch.reply) {
+                batch.reply->set_value(std::move(output));
+            } else {
+                batchesOut->put(batch.number, std::move(output));
+            }
+            output = std::string();
+            output.reserve(size);
+        }
     }
     
-    // Close the output queue since we have run out of data.
-    auto lineLock = linesOut->lock();
-    linesOut->close(lineLock);
+    if(batchesOut != nullptr) {
+        // Close the output buffer since we have run out of data.
+        batchesOut->close();
+    }
+    
+    if(summariesOut != nullptr) {
+        // And the summary buffer.
+        summariesOut->close();
+    }
     
     // Give back the total mapping count.
     return totalMappings;
 
 }
 
+/**
+ * Map all the reads in the given FASTA or FASTQ files with the given index and
+ * mapping schemes, using the given number of mapping threads. The mapping
+ * threads take turns using each of the schemes, and if CPUs are given for each
+ * scheme, the threads using it are pinned to them. Save the alignment to the
+ * given file, either as TSV, in binary, sorted and indexed in binary, or as
+ * Avro, and the read summaries to the other given file, if the output options
+ * ask for them. If a result cache
+ * is given, duplicate reads are only mapped once.
+ *
+ * If the output options ask for ordered output, the files are loaded one at a
+ * time, and each output file gets its batches in the order they were loaded.
+ * Otherwise the files are loaded in parallel and output is written as it is
+ * made.
+ */
+void
+mapFiles(
+    const std::vector<std::string>& fastas,
+    const std::string& alignmentFilename,
+    const std::string& summaryFilename,
+    const OutputOptions& outputOptions,
+    const FMDIndex& index,
+    const std::vector<const MappingScheme*>& mappingSchemes,
+    const std::vector<std::vector<size_t>>& schemeCPUs,
+    size_t numThreads,
+    const ReadResultCache* resultCache
+) {
+    
+    // Open the output files for writing. They are written in large chunks, and
+    // compressed if their names end in ".gz". Sorted alignments are collected
+    // and only written at the end.
+    std::unique_ptr<BufferedWriter> alignment(outputOptions.alignment &&
+        !outputOptions.sorted ? new BufferedWriter(alignmentFilename) :
+        nullptr);
+    std::unique_ptr<BufferedWriter> summary(outputOptions.summary ?
+        new BufferedWriter(summaryFilename) : nullptr);
+    
+    // Binary alignments start with a header naming the reference sequence
+    // each contig came from.
+    std::vector<std::string> contigNames;
+    if(outputOptions.alignment && outputOptions.binary) {
+        for(size_t i = 0; i < index.getNumberOfContigs(); i++) {
+            contigNames.push_back(index.getContigName(i));
+        }
+    }
+    if(alignment && outputOptions.binary) {
+        *alignment << AlignmentFile::makeHeader(contigNames);
+    }
+    std::unique_ptr<SortedAlignmentWriter> sorted(outputOptions.alignment &&
+        outputOptions.sorted ? new SortedAlignmentWriter(alignmentFilename,
+        contigNames, outputOptions.sortMemory) : nullptr);
+    
+    // And Avro alignments start with the header of the container.
+    if(alignment && outputOptions.avro) {
+        *alignment << AvroFile::makeHeader(AlignmentFile::AVRO_SCHEMA,
+            outputOptions.avroSync);
+    }
+    
+    // Now set up the parallel system we are going to use to map.
+    
+    // This holds batches of reads waiting to be mapped. Each read file has its
+    // own loading thread writing to it, unless output is ordered. It's
+    // bounded, so the whole file doesn't get loaded into memory when the
+    // mapping threads can't keep up.
+    BoundedQueue<ReadBatch> readQueue(numThreads * READ_QUEUE_BATCHES,
+        fastas.size());
+    
+    // This counts reads loaded by all the loading threads.
+    std::atomic<size_t> readsLoaded(0);
+    
+    // And this numbers their batches.
+    std::atomic<size_t> batchesLoaded(0);
+    
+    // This holds batches of output lines waiting to be written. All the mapping
+    // threads write to it through a reorder buffer, which keeps the batches in
+    // order if we want that, and passes them straight through if we don't.
+    size_t window = outputOptions.ordered ?
+        numThreads * REORDER_WINDOW_BATCHES : 0;
+    BoundedQueue<std::string> batchQueue(numThreads * OUTPUT_QUEUE_BATCHES, 1);
+    ReorderBuffer<std::string> batchBuffer(batchQueue, window, numThreads);
+    
+    // And this holds batches of summary lines.
+    BoundedQueue<std::string> summaryQueue(numThreads * OUTPUT_QUEUE_BATCHES,
+        1);
+    ReorderBuffer<std::string> summaryBuffer(summaryQueue, window, numThreads);
+    
+    // This holds all our threads
+    std::vector<Thread> threads;
+    
+    if(outputOptions.ordered) {
+        // Load the files one after another, so their batches are numbered in
+        // order.
+        threads.push_back(Thread(&loadReadsInOrder, std::ref(fastas),
+            &readQueue, &readsLoaded, &batchesLoaded, outputOptions.paired));
+    } else {
+        for(const std::string& fasta : fastas) {
+            // Make a thread to load the reads from each file
+            threads.push_back(Thread(&loadReads, std::ref(fasta), &readQueue,
+                &readsLoaded, &batchesLoaded, outputOptions.paired));
+        }
+    }
+    
+    for(size_t i = 0; i < numThreads; i++) {
+        // Then some threads to process the reads, each with the index its
+        // scheme maps to.
+        const MappingScheme* scheme = mappingSchemes[i % mappingSchemes.size()];
+        threads.push_back(Thread(&mapSomeReads, &readQueue,
+            std::ref(scheme->getView().getIndex()), scheme,
+            outputOptions.alignment ? &batchBuffer : nullptr,
+            summary ? &summaryBuffer : nullptr, std::ref(outputOptions),
+            resultCache));
+        if(!schemeCPUs.empty()) {
+            pinThread(threads.back(), schemeCPUs[i % schemeCPUs.size()]);
+        }
+    }
+    
+    // Then threads to do the writing
+    if(alignment) {
+        threads.push_back(Thread(&saveLines, &batchQueue,
+            std::ref(*alignment)));
+    }
+    if(sorted) {
+        threads.push_back(Thread(&sortReads, &batchQueue, std::ref(*sorted)));
+    }
+    if(summary) {
+        threads.push_back(Thread(&saveLines, &summaryQueue,
+            std::ref(*summary)));
+    }
+    
+    for(Thread& thread : threads) {
+        // Wait for all the threads to be done
+        thread.join();
+    }
+    
+    // Write out the last of the output.
+    if(alignment) {
+        alignment->close();
+    }
+    if(sorted) {
+        // This is where the sorting really happens.
+        Log::info() << "Sorting alignment" << std::endl;
+        sorted->close();
+    }
+    if(summary) {
+        summary->close();
+    }
+    
+    Log::info() << "Mapped " << readsLoaded.load() << " reads" << std::endl;
+}
+
+/**
+ * Write all of the given data to the given file descriptor. Throws a
+ * std::runtime_error if it can't.
+ */
+void
+writeAll(
+    int fd,
+    const std::string& data
+) {
+    size_t written = 0;
+    while(written < data.size()) {
+        ssize_t result = write(fd, data.data() + written,
+            data.size() - written);
+        if(result < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("Could not write reply: ") +
+                strerror(errno));
+        } else if(result > 0) {
+            written += result;
+        }
+    }
+}
+
+/**
+ * Serve mapping requests from one client, reading them from the input file
+ * descriptor and writing the replies to the output file descriptor. Reads are
+ * mapped by whatever threads are reading the given work queue.
+ *
+ * A request is a series of "<name>\t<sequence>" lines, ended by an empty line
+ * or the end of the input. The reply is the TSV mapReads would write for those
+ * reads, in the same order, followed by an empty line. Reads with Ns are
+ * skipped, as they are when mapping files. A client can send any number of
+ * requests, and may send more before reading earlier replies.
+ *
+ * Closes the input file descriptor when the client is done. Errors talking to
+ * the client are logged, and just end the session.
+ */
+void
+serveClient(
+    int in,
+    int out,
+    BoundedQueue<ReadBatch>* work
+) {
+    FILE* input = fdopen(in, "r");
+    if(input == NULL) {
+        Log::error() << "Could not open client input: " << strerror(errno) <<
+            std::endl;
+        close(in);
+        return;
+    }
+    
+    // This holds the results for each batch we sent off, in order.
+    std::deque<std::future<std::string>> replies;
+    
+    // This holds the batch we're filling in.
+    ReadBatch batch;
+    
+    // Send off the batch being filled in, if it has anything in it.
+    auto sendBatch = [&]() {
+        if(batch.sequences.empty()) {
+            return;
+        }
+        batch.reply = std::make_shared<std::promise<std::string>>();
+        replies.push_back(batch.reply->get_future());
+        work->enqueue(std::move(batch));
+        batch = ReadBatch();
+    };
+    
+    // Wait for the first waiting reply and send it to the client.
+    auto sendReply = [&]() {
+        writeAll(out, replies.front().get());
+        replies.pop_front();
+    };
+    
+    size_t totalReads = 0;
+    
+    try {
+        char* line = NULL;
+        size_t capacity = 0;
+        ssize_t length;
+        // Are we partway through a request?
+        bool inRequest = false;
+        
+        do {
+            length = getline(&line, &capacity, input);
+            
+            // Drop the line ending.
+            while(length > 0 && (line[length - 1] == '\n' ||
+                line[length - 1] == '\r')) {
+                length--;
+            }
+            
+            if(length > 0) {
+                inRequest = true;
+                
+                char* tab = (char*) memchr(line, '\t', length);
+                if(tab == NULL) {
+                    Log::error() << "Skipping request line without a tab" <<
+                        std::endl;
+                } else if(memchr(tab, 'N', line + length - tab) != NULL) {
+                    Log::error() << "Skipping read with N: " <<
+                        std::string(line, tab) << std::endl;
+                } else {
+                    batch.names.emplace_back(line, tab);
+                    batch.sequences.emplace_back(tab + 1, line + length);
+                    totalReads++;
+                }
+                
+                if(batch.sequences.size() == MAP_BATCH_SIZE) {
+                    sendBatch();
+                }
+                
+                while(replies.size() > CLIENT_BATCHES_IN_FLIGHT) {
+                    // Don't let the client get too far ahead.
+                    sendReply();
+                }
+            } else if(inRequest || length == 0) {
+                // We hit the end of a request (or an empty request). Finish
+                // all the mapping for it, and then end the reply.
+                sendBatch();
+                while(!replies.empty()) {
+                    sendReply();
+                }
+                writeAll(out, "\n");
+                inRequest = false;
+            }
+        } while(length >= 0);
+        
+        free(line);
+    } catch(std::runtime_error& e) {
+        Log::error() << "Client session failed: " << e.what() << std::endl;
+    }
+    
+    fclose(input);
+    
+    Log::info() << "Client done after " << totalReads << " reads" <<
+        std::endl;
+}
+
+/**
+ * Map reads for clients, with the given mapping schemes, using the given
+ * number of mapping threads shared between all clients. Schemes are used and
+ * threads pinned the same way as in mapFiles(). If the address
+ * is "-", serve one client on standard input and output, and return when
+ * standard input ends. Otherwise, listen on a Unix socket at the given path,
+ * replacing any old socket there, and serve each client that connects on its
+ * own thread, forever. See serveClient() for the protocol. If a result cache
+ * is given, duplicate reads are only mapped once, across all clients.
+ */
+void
+serve(
+    const std::string& address,
+    const std::vector<const MappingScheme*>& mappingSchemes,
+    const std::vector<std::vector<size_t>>& schemeCPUs,
+    size_t numThreads,
+    const ReadResultCache* resultCache
+) {
+    // Clients that go away shouldn't take the server with them.
+    signal(SIGPIPE, SIG_IGN);
+    
+    // This holds batches of reads from all the clients, waiting to be mapped.
+    // Only one thing ever closes it: the standard input client, if we have it.
+    BoundedQueue<ReadBatch> work(numThreads * READ_QUEUE_BATCHES, 1);
+    
+    std::vector<Thread> workers;
+    for(size_t i = 0; i < numThreads; i++) {
+        // Make the threads to map everyone's reads. They reply directly to the
+        // client for each batch.
+        const MappingScheme* scheme = mappingSchemes[i % mappingSchemes.size()];
+        workers.push_back(Thread(&mapSomeReads, &work,
+            std::ref(scheme->getView().getIndex()), scheme,
+            (ReorderBuffer<std::string>*) nullptr,
+            (ReorderBuffer<std::string>*) nullptr, OutputOptions(),
+            resultCache));
+        if(!schemeCPUs.empty()) {
+            pinThread(workers.back(), schemeCPUs[i % schemeCPUs.size()]);
+        }
+    }
+    
+    if(address == "-") {
+        // Log messages go to standard output, so keep the real standard output
+        // for replies and send everything else to standard error.
+        std::cout.flush();
+        int replies = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        
+        // Serve the one client, then let the workers finish.
+        serveClient(STDIN_FILENO, replies, &work);
+        close(replies);
+        work.close();
+        for(Thread& worker : workers) {
+            worker.join();
+        }
+        return;
+    }
+    
+    sockaddr_un socketAddress;
+    memset(&socketAddress, 0, sizeof(socketAddress));
+    socketAddress.sun_family = AF_UNIX;
+    if(address.size() >= sizeof(socketAddress.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + address);
+    }
+    strcpy(socketAddress.sun_path, address.c_str());
+    
+    struct stat existing;
+    if(stat(address.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        // Get rid of the socket left by an old server.
+        unlink(address.c_str());
+    }
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0 || bind(listener, (sockaddr*) &socketAddress,
+        sizeof(socketAddress)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        
+        throw std::runtime_error("Could not listen on " + address + ": " +
+            strerror(errno));
+    }
+    
+    Log::info() << "Serving mappings on " << address << std::endl;
+    
+    while(true) {
+        int client = accept(listener, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Could not accept client: ") +
+                strerror(errno));
+        }
+        
+        // Give each client its own thread to read requests and send replies.
+        Thread(&serveClient, client, client, &work).detach();
+    }
+}
+
 /**
  * mapReads: command-line tool to map strings to a string, using a reference
  * structure.
@@ -270,7 +1119,7 @@ main(
 
     std::string appDescription = 
         std::string("Map strings to a string.\n") + 
-        "Usage: mapReads <index directory> <reference> [<fasta> [<fasta> ...]] "
+        "Usage: mapReads <index directory> <reference> [<reads> [<reads> ...]] "
         "--alignment <alignment>";
 
     // Make an options description for our program's options.
@@ -281,24 +1130,54 @@ main(
         ("sampleRate", boost::program_options::value<unsigned int>()
             ->default_value(64), 
             "Set the suffix array sample rate to use")
+        ("flatBWT", "Search with a flat BWT instead of a run-length encoded one")
+        ("kmerTable", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Save a table of k-mers up to this length to speed up searches")
+        ("packedText", "Save a packed copy of the reference for fast access")
         // These next three options should be ->required(), but that's not in
         // the Boost version I can convince our cluster admins to install. From
         // now on I shall work exclusively in Docker containers or something.
         ("indexDirectory", boost::program_options::value<std::string>(), 
             "Directory to make the index in; will be deleted and replaced!")
         ("reference", boost::program_options::value<std::string>(),
-            "FASTA contining a single N-free reference sequence to map to")
+            "FASTA of reference sequences to map to")
         ("fastas", boost::program_options::value<std::vector<std::string> >()
             ->multitoken(),
-            "FASTA files to map")
-        ("alignment", boost::program_options::value<std::string>()
-            ->required(), 
+            "FASTA or FASTQ files, optionally gzipped, to map")
+        ("alignment", boost::program_options::value<std::string>(),
             "File to save alignment in, as a TSV of mappings")
+        ("binaryAlignment", "Save the alignment in a compact binary format, "
+            "which alignmentToTSV can convert to TSV")
+        ("avroAlignment", "Save the alignment as an Avro container of one "
+            "record per read, which Spark jobs can read directly")
+        ("sortedAlignment", "Save the alignment in a binary format sorted by "
+            "reference position, with an index so queryAlignment can find the "
+            "reads in a region quickly")
+        ("sortMemory", boost::program_options::value<size_t>()
+            ->default_value(1024),
+            "Megabytes of mapped segments to hold in memory while sorting "
+            "before spilling them to disk")
         ("threads", boost::program_options::value<size_t>()
             ->default_value(16),
             "Number of mapping threads to run")
+        ("numa", boost::program_options::value<std::string>()
+            ->default_value("none"),
+            "Place the index across NUMA nodes: \"none\", \"interleave\" it "
+            "page by page over all of them, or \"replicate\" it on each, "
+            "with mapping threads pinned to each node using its own copy")
         ("stats", boost::program_options::value<std::string>(),
             "TSV file to save statistics to")
+        ("hugePages", "Back the large index arrays with transparent huge pages "
+            "where the kernel allows")
+        ("asyncLog", "Write log lines from a background thread, so threads "
+            "don't wait on the terminal")
+        ("dropLogLines", "With --asyncLog, drop log lines instead of waiting "
+            "when the log falls behind")
+        ("warmUp", "Read the memory-mapped index files into the page cache in "
+            "the background while mapping starts")
+        ("perfCounters", "Count cycles, instructions, cache misses, branch "
+            "misses and TLB misses for each mapping phase in the statistics")
         ("mapType", boost::program_options::value<std::string>()
             ->default_value("natural"),
             "Merging scheme (\"natural\" only)")
@@ -318,7 +1197,56 @@ main(
         ("maxEditDistance", boost::program_options::value<size_t>()
             ->default_value(0), 
             "Maximum *edit* distance from reference location")
-        ("unstable", "Allow unstable mapping for increased coverage");
+        ("unstable", "Allow unstable mapping for increased coverage")
+        ("repeatFilter", "Search for each whole read first, in batches, and "
+            "skip reads found in more than one place (natural mapType, "
+            "without --levelIndex only)")
+        ("contextCache", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Cache searches for k-mers of this length that reads end with")
+        ("dedup", boost::program_options::value<size_t>()->default_value(0),
+            "Map each distinct read sequence once, caching results for this "
+            "many sequences")
+        ("minimizerLength", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Skip reads sharing no minimizer of this k-mer length with the "
+            "reference, when the context length makes that safe")
+        ("minimizerWindow", boost::program_options::value<size_t>()
+            ->default_value(10),
+            "Number of k-mers in each minimizer window")
+        ("slowQueries", boost::program_options::value<std::string>(),
+            "FASTA to save the slowest reads to, with their mapping times, "
+            "counters, and parameters")
+        ("slowQueryCount", boost::program_options::value<size_t>()
+            ->default_value(100),
+            "Number of slowest reads to save")
+        ("levelIndex", boost::program_options::value<std::string>(),
+            "Map to the merged level saved here by createIndex, over the index "
+            "already in the index directory, which must start with the "
+            "reference")
+        ("indexCache", boost::program_options::value<std::string>(),
+            "Directory of finished indexes to reuse when the same FASTAs are "
+            "indexed with the same options, and to add new indexes to")
+        ("useExistingIndex", "Load the index in the index directory instead of "
+            "rebuilding it, if it was built from the same reference with the "
+            "same options")
+        ("package", boost::program_options::value<std::string>(),
+            "Unpack the index from this package made by createIndex into the "
+            "index directory, and load it instead of building one")
+        ("summary", boost::program_options::value<std::string>(),
+            "File to save a TSV line summarizing the placement of each read "
+            "in; --alignment can then be left out")
+        ("interleaved", "Treat the reads as interleaved pairs, and summarize "
+            "whether each pair is placed properly")
+        ("maxInsert", boost::program_options::value<size_t>()
+            ->default_value(1000),
+            "Longest insert for a proper pair")
+        ("ordered", "Write the alignment and summary in the order the reads "
+            "are in the FASTAs, loading the FASTAs one at a time")
+        ("serve", boost::program_options::value<std::string>(),
+            "Instead of mapping FASTAs, keep the index loaded and map reads "
+            "sent to a Unix socket at this path, or on standard input if "
+            "\"-\"");
         
     // And set up our positional arguments
     boost::program_options::positional_options_description positionals;
@@ -354,11 +1282,27 @@ main(
         }
         
         if(!options.count("indexDirectory") || !options.count("reference") ||
-            !options.count("fastas")) {
+            (!options.count("serve") && (!options.count("fastas") ||
+            (!options.count("alignment") && !options.count("summary"))))) {
             
-            // These are required.
+            // These are required, unless we're serving instead of mapping
+            // files.
             throw boost::program_options::error("Missing important arguments!");
         }
+        
+        if(options.count("serve") && (options.count("binaryAlignment") ||
+            options.count("avroAlignment") ||
+            options.count("sortedAlignment"))) {
+            // Replies are always TSV.
+            throw boost::program_options::error(
+                "Binary alignments can't be served!");
+        }
+        
+        if(options.count("binaryAlignment") + options.count("avroAlignment") +
+            options.count("sortedAlignment") > 1) {
+            throw boost::program_options::error(
+                "Can't save the alignment in two formats!");
+        }
             
     } catch(boost::program_options::error& error) {
         // Something is bad about our options. Complain on stderr
@@ -373,6 +1317,11 @@ main(
         return -1; 
     }
     
+    if(options.count("asyncLog")) {
+        // Start logging from the background before anything gets logged.
+        Log::startAsync(1 << 16, options.count("dropLogLines"));
+    }
+    
     // If we get here, we have the right arguments. Parse them.
     
     // This holds the directory for the reference structure to build.
@@ -381,109 +1330,304 @@ main(
     // This holds the reference
     std::string reference(options["reference"].as<std::string>());
     
-    // Read the reference contig. It must exist.
-    std::pair<std::string, std::string> referenceRecord = 
-        Fasta(reference).getNextRecord();
-    
     // This holds a list of FASTA filenames to load and index.
-    std::vector<std::string> fastas(options["fastas"]
-        .as<std::vector<std::string> >());
+    std::vector<std::string> fastas;
+    if(options.count("fastas")) {
+        fastas = options["fastas"].as<std::vector<std::string> >();
+    }
         
     // Make a vector of just the reference.
     std::vector<std::string> referenceOnly = { reference };
+    
+    // Work out how to place the index across NUMA nodes.
+    std::string numaPolicy = options["numa"].as<std::string>();
+    if(numaPolicy != "none" && numaPolicy != "interleave" &&
+        numaPolicy != "replicate") {
         
-    // Index the reference. Use the sample rate the user specified.
-    FMDIndex* indexPointer = buildIndex(indexDirectory, referenceOnly,
-        options["sampleRate"].as<unsigned int>());
+        throw std::runtime_error("Invalid NUMA policy: " + numaPolicy);
+    }
+    std::map<size_t, std::vector<size_t>> nodeCPUs;
+    if(numaPolicy != "none") {
+        nodeCPUs = getNumaNodeCPUs();
+        if(nodeCPUs.size() < 2) {
+            // With only one node there's nothing to spread out.
+            Log::info() << "Only " << nodeCPUs.size() << " NUMA nodes; not "
+                "placing the index" << std::endl;
+            numaPolicy = "none";
+            nodeCPUs.clear();
+        }
+    }
+    std::vector<size_t> nodes;
+    for(const auto& node : nodeCPUs) {
+        nodes.push_back(node.first);
+    }
+    
+    if(options.count("hugePages")) {
+        // Ask for huge pages before anything big gets loaded.
+        HugePages::enable();
+    }
+    
+    if(options.count("indexCache")) {
+        // Reuse a cached index instead of building it, if there is one.
+        setIndexCache(options["indexCache"].as<std::string>());
+    }
+    
+    if(options.count("package")) {
+        // Unpack the index we were shipped, in parallel, before loading it.
+        IndexPackage::unpack(options["package"].as<std::string>(),
+            indexDirectory);
+    }
+    
+    FMDIndex* indexPointer;
+    {
+        // Interleaving puts the whole index on all the nodes, and replicating
+        // puts this copy on the first node. Anything loaded here is touched
+        // first by this thread, so that's where it would all end up otherwise.
+        std::unique_ptr<ScopedMemoryPolicy> policy(numaPolicy == "none" ?
+            nullptr : new ScopedMemoryPolicy(numaPolicy == "interleave" ?
+            nodes : std::vector<size_t>(1, nodes.front()),
+            numaPolicy == "interleave"));
+    
+        // Index the reference, unless we are mapping to a merged level, which
+        // has to be over the index it was made for, or were given the index in
+        // a package. Use the sample rate the user specified. If asked, keep an
+        // index already built from the same reference with the same options.
+        indexPointer = options.count("levelIndex") ?
+            new FMDIndex(indexDirectory + "/index.basename") :
+            options.count("package") ?
+            new FMDIndex(indexDirectory + "/index.basename", NULL,
+            options.count("flatBWT")) :
+            options.count("useExistingIndex") ?
+            loadOrBuildIndex(indexDirectory, referenceOnly,
+            options["sampleRate"].as<unsigned int>(), options.count("flatBWT"),
+            options["kmerTable"].as<size_t>(), options.count("packedText")) :
+            buildIndex(indexDirectory, referenceOnly,
+            options["sampleRate"].as<unsigned int>(), options.count("flatBWT"),
+            options["kmerTable"].as<size_t>(), options.count("packedText"));
+    }
         
     // Make a reference out of the index pointer because we're not letting it
     // out of our scope.
     FMDIndex& index = *indexPointer;
     
-    // Make a vector that says every single position in the index is its own
-    // range for mapping to.
-    // TODO: Throw away when we make ranges properly optional.
-    GenericBitVector ranges;
-    for(size_t i = 0; i < index.getBWTLength(); i++) {
-        ranges.addBit(i);
+    // Holds the copy of the index for each node we map on, starting with the
+    // one we just loaded.
+    std::vector<FMDIndex*> replicas(1, indexPointer);
+    if(numaPolicy == "replicate") {
+        // Load the index again for each other node, all at once, on threads
+        // that place everything they load on their own node.
+        replicas.resize(nodes.size(), nullptr);
+        bool useFlatBWT = options.count("flatBWT") &&
+            !options.count("levelIndex");
+        std::vector<Thread> loaders;
+        for(size_t i = 1; i < nodes.size(); i++) {
+            loaders.push_back(Thread([&, i]() {
+                ScopedMemoryPolicy policy(std::vector<size_t>(1, nodes[i]),
+                    false);
+                replicas[i] = new FMDIndex(indexDirectory + "/index.basename",
+                    NULL, useFlatBWT);
+            }));
+        }
+        for(Thread& loader : loaders) {
+            loader.join();
+        }
+        Log::info() << "Replicated index on " << nodes.size() <<
+            " NUMA nodes" << std::endl;
+    }
+    
+    // If we have a saved merged level, load it. Its positions are used where
+    // they are in the file. Otherwise we map to a view with no ranges, where
+    // every BWT index is its own range.
+    LevelIndex* level = options.count("levelIndex") ?
+        new LevelIndex(options["levelIndex"].as<std::string>()) : nullptr;
+    
+    // If asked, start pulling the mapped files in from storage now, without
+    // waiting. The merged level is used for every search, so it goes first.
+    std::unique_ptr<IndexWarmer> warmer;
+    if(options.count("warmUp")) {
+        std::vector<std::string> warmFiles;
+        if(level != nullptr) {
+            warmFiles.push_back(options["levelIndex"].as<std::string>());
+        }
+        for(const std::string& filename : IndexWarmer::getIndexFiles(
+            indexDirectory + "/index.basename")) {
+            
+            warmFiles.push_back(filename);
+        }
+        warmer.reset(new IndexWarmer(warmFiles));
     }
-    ranges.finish(index.getBWTLength());
     
     // Parse the number of threads to use
     size_t numThreads = options["threads"].as<size_t>();
     
-    // Make a mapping scheme from the command-line options. TODO: unify with
-    // createIndex's code for this.
-    MappingScheme* mappingScheme;
+    // Size the shared pool that mapping schemes split queries up on to match.
+    TaskPool::setGlobalSize(numThreads);
     
-    if(options["mapType"].as<std::string>() == "natural") {
-        // We want a NaturalMappingScheme
-        NaturalMappingScheme* scheme = new NaturalMappingScheme(FMDIndexView(
-            index, nullptr, &ranges));
-            
-        // Populate it
-        scheme->credit = options.count("credit");
-        scheme->minContext = options["context"].as<size_t>();
-        scheme->z_max = options["mismatches"].as<size_t>();
-        scheme->ignoreMatchesBelow = options[
-            "ignoreMatchesBelow"].as<size_t>();
-        scheme->minHammingBound = options[
-            "minEditBound"].as<size_t>();
-        scheme->maxHammingDistance = options[
-            "maxEditDistance"].as<size_t>();
-        scheme->unstable = options.count("unstable");
-        
-        mappingScheme = (MappingScheme*) scheme;
-    } else {
-        // They asked for a mapping scheme we don't have.
-        throw std::runtime_error("Invalid mapping scheme: " +
-            options["mapType"].as<std::string>());
+    if(options.count("perfCounters")) {
+        // Also count hardware events in each mapping phase, if the kernel will
+        // let us.
+        PerfCounters::enable();
     }
     
-    // Open the alignment file for writing
-    std::ofstream alignment(options["alignment"].as<std::string>());
+    // If asked, make a cache of k-mer searches for all the mapping threads to
+    // share. All the replicas are the same index, so they can share it too.
+    ContextCache* contextCache = nullptr;
+    if(options["contextCache"].as<size_t>() > 0) {
+        contextCache = new ContextCache(options["contextCache"].as<size_t>());
+    }
     
-    // Now set up the parallel system we are going to use to map.
+    // If asked, remember what reads mapped to, so duplicate reads only get
+    // mapped once. All the mapping schemes are set up the same, so they can
+    // share it.
+    ReadResultCache* resultCache = nullptr;
+    if(options["dedup"].as<size_t>() > 0) {
+        resultCache = new ReadResultCache(options["dedup"].as<size_t>());
+    }
     
-    // This holds records waiting to be mapped. Only one thread writes to it.
-    ConcurrentQueue<std::pair<std::string, std::string>> recordQueue(1);
+    // If asked, collect the reference's minimizers, to throw out reads that
+    // can't map before searching for them.
+    MinimizerIndex* minimizerIndex = nullptr;
+    if(options["minimizerLength"].as<size_t>() > 0) {
+        minimizerIndex = new MinimizerIndex(index,
+            options["minimizerLength"].as<size_t>(),
+            options["minimizerWindow"].as<size_t>());
+        if(minimizerIndex->getSpan() > options["context"].as<size_t>()) {
+            // Skipping reads could lose mappings, so the schemes won't.
+            Log::warning() << "Minimizer windows span " <<
+                minimizerIndex->getSpan() << " bases, more than the context "
+                "length, so no reads will be skipped" << std::endl;
+        }
+    }
     
-    // This holds output lines waiting to be written. All the mapping threads
-    // write to it.
-    ConcurrentQueue<std::string> lineQueue(numThreads);
+    // If asked, keep the slowest reads to save.
+    QueryTracer* queryTracer = nullptr;
+    if(options.count("slowQueries")) {
+        queryTracer = new QueryTracer(options["slowQueryCount"].as<size_t>());
+    }
     
-    // This holds all our threads
-    std::vector<Thread> threads;
+    // Make a mapping scheme from the command-line options for each copy of the
+    // index. TODO: unify with createIndex's code for this.
+    std::vector<const MappingScheme*> mappingSchemes;
     
-    // Make a thread to load all the reads
-    threads.push_back(Thread(&loadReads, std::ref(fastas), &recordQueue));
+    for(FMDIndex* replica : replicas) {
+        MappingScheme* mappingScheme;
     
-    for(size_t i = 0; i < numThreads; i++) {
-        // Then some threads to process the reads
-        threads.push_back(Thread(&mapSomeReads, &recordQueue, referenceRecord,
-            std::ref(index), mappingScheme, &lineQueue));
+        if(options["mapType"].as<std::string>() == "natural") {
+            // We want a NaturalMappingScheme
+            NaturalMappingScheme* scheme = new NaturalMappingScheme(
+                level != nullptr ? FMDIndexView(*replica, nullptr, *level) :
+                FMDIndexView(*replica));
+                
+            // Populate it
+            scheme->credit = options.count("credit");
+            scheme->minContext = options["context"].as<size_t>();
+            scheme->z_max = options["mismatches"].as<size_t>();
+            scheme->ignoreMatchesBelow = options[
+                "ignoreMatchesBelow"].as<size_t>();
+            scheme->minHammingBound = options[
+                "minEditBound"].as<size_t>();
+            scheme->maxHammingDistance = options[
+                "maxEditDistance"].as<size_t>();
+            scheme->unstable = options.count("unstable");
+            scheme->minimizerIndex = minimizerIndex;
+            scheme->repeatFilter = options.count("repeatFilter");
+            
+            mappingScheme = (MappingScheme*) scheme;
+        } else {
+            // They asked for a mapping scheme we don't have.
+            throw std::runtime_error("Invalid mapping scheme: " +
+                options["mapType"].as<std::string>());
+        }
+        
+        mappingScheme->contextCache = contextCache;
+        mappingScheme->queryTracer = queryTracer;
+        mappingSchemes.push_back(mappingScheme);
     }
     
-    // Then a thread to do the writing
-    threads.push_back(Thread(&saveLines, &lineQueue, std::ref(alignment)));
+    // Threads using each replica stay on its node.
+    std::vector<std::vector<size_t>> schemeCPUs;
+    if(numaPolicy == "replicate") {
+        for(size_t node : nodes) {
+            schemeCPUs.push_back(nodeCPUs[node]);
+        }
+    }
     
-    for(Thread& thread : threads) {
-        // Wait for all the threads to be done
-        thread.join();
+    if(options.count("serve")) {
+        // Map reads sent by clients, instead of reads from files.
+        serve(options["serve"].as<std::string>(), mappingSchemes, schemeCPUs,
+            numThreads, resultCache);
+    } else {
+        // Work out what to write.
+        OutputOptions outputOptions;
+        outputOptions.alignment = options.count("alignment");
+        outputOptions.sorted = options.count("sortedAlignment");
+        outputOptions.binary = options.count("binaryAlignment") ||
+            outputOptions.sorted;
+        outputOptions.sortMemory = options["sortMemory"].as<size_t>() << 20;
+        outputOptions.avro = options.count("avroAlignment");
+        outputOptions.avroSync = AvroFile::makeSync();
+        outputOptions.summary = options.count("summary");
+        outputOptions.paired = options.count("interleaved");
+        outputOptions.maxInsert = options["maxInsert"].as<size_t>();
+        outputOptions.ordered = options.count("ordered");
+        
+        mapFiles(fastas, outputOptions.alignment ?
+            options["alignment"].as<std::string>() : "",
+            outputOptions.summary ? options["summary"].as<std::string>() : "",
+            outputOptions, index, mappingSchemes, schemeCPUs, numThreads,
+            resultCache);
     }
     
     if(options.count("stats")) {
         // Save statistics report to the specified file
         Log::info() << "Saving statistics to " <<
             options["stats"].as<std::string>() << std::endl;
-        mappingScheme->getStats().save(options["stats"].as<std::string>());
+        StatTracker stats;
+        for(const MappingScheme* mappingScheme : mappingSchemes) {
+            stats += mappingScheme->getStats();
+        }
+        if(contextCache != nullptr) {
+            // Report how the cache did too.
+            stats += contextCache->getStats();
+        }
+        if(resultCache != nullptr) {
+            // And how many reads were duplicates.
+            stats += resultCache->getStats();
+        }
+        stats.save(options["stats"].as<std::string>());
+    }
+    
+    if(queryTracer != nullptr) {
+        Log::info() << "Saving slowest reads to " <<
+            options["slowQueries"].as<std::string>() << std::endl;
+        queryTracer->write(options["slowQueries"].as<std::string>());
+    }
+    
+    // Get rid of the mapping schemes now that everyone is done with them.
+    for(const MappingScheme* mappingScheme : mappingSchemes) {
+        delete mappingScheme;
     }
     
-    // Get rid of the mapping scheme now that everyone is done with it.
-    delete mappingScheme;
+    // And the tracer it was using, if any.
+    delete queryTracer;
     
-    // Get rid of the index itself. Invalidates the index reference.
-    delete indexPointer;
+    // And the cache it was using, if any.
+    delete contextCache;
+    
+    // And the cache of read results, if any.
+    delete resultCache;
+    
+    // And the minimizers, if we collected them.
+    delete minimizerIndex;
+    
+    // And the merged level, if we loaded one.
+    delete level;
+    
+    // Get rid of the index itself, and any other copies. Invalidates the index
+    // reference.
+    for(FMDIndex* replica : replicas) {
+        delete replica;
+    }
 
     // Now we're done!
     return 0;
@@ -1,7 +1,16 @@
 #include "pinchGraphUtil.hpp"
 
 #include <Log.hpp>
+#include <GraphFile.hpp>
+#include <TaskPool.hpp>
 #include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <exception>
 
 
 stPinchThreadSet* 
@@ -21,14 +30,118 @@ makeThreadSet(
     return threadSet;
 }
 
-TextPosition
-canonicalize(
-    const FMDIndex& index, 
-    stPinchThreadSet* threadSet, 
+void
+writeThreadSet(
+    stPinchThreadSet* threadSet,
+    std::ostream& stream
+) {
+    // Write 64-bit words in native byte order.
+    auto writeWord = [&](uint64_t word) {
+        stream.write((const char*) &word, sizeof(word));
+    };
+    
+    stPinchThreadSetIt threadIterator = stPinchThreadSet_getIt(threadSet);
+    stPinchThread* thread;
+    while((thread = stPinchThreadSetIt_getNext(&threadIterator)) != NULL) {
+        // For each pinch thread, go through all its segments.
+        stPinchSegment* segment = stPinchThread_getFirst(thread);
+        while(segment != NULL) {
+            stPinchBlock* block = stPinchSegment_getBlock(segment);
+            
+            if(block != NULL && stPinchBlock_getFirst(block) == segment) {
+                // Save each block once, when we're at its first segment.
+                writeWord(stPinchBlock_getDegree(block));
+                writeWord(stPinchBlock_getLength(block));
+                
+                stPinchBlockIt iterator = stPinchBlock_getSegmentIterator(
+                    block);
+                stPinchSegment* member;
+                while((member = stPinchBlockIt_getNext(&iterator)) != NULL) {
+                    writeWord(stPinchSegment_getName(member));
+                    writeWord(stPinchSegment_getStart(member));
+                    writeWord(stPinchSegment_getBlockOrientation(member));
+                }
+            }
+            
+            segment = stPinchSegment_get3Prime(segment);
+        }
+    }
+    
+    if(!stream) {
+        throw std::runtime_error("Could not write pinch thread set");
+    }
+}
+
+stPinchThreadSet*
+readThreadSet(
+    const FMDIndex& index,
+    std::istream& stream
+) {
+    // Start with every contig unaligned.
+    stPinchThreadSet* threadSet = makeThreadSet(index);
+    
+    // Read 64-bit words in native byte order.
+    auto readWord = [&]() {
+        uint64_t word = 0;
+        stream.read((char*) &word, sizeof(word));
+        return word;
+    };
+    
+    while(stream.peek() != std::char_traits<char>::eof()) {
+        // For each saved block
+        uint64_t degree = readWord();
+        uint64_t length = readWord();
+        
+        // Pinch every other segment against the first one, in the right
+        // relative orientation.
+        uint64_t firstName = readWord();
+        uint64_t firstStart = readWord();
+        bool firstOrientation = readWord();
+        stPinchThread* firstThread = stPinchThreadSet_getThread(threadSet,
+            firstName);
+        
+        for(uint64_t i = 1; i < degree; i++) {
+            uint64_t name = readWord();
+            uint64_t start = readWord();
+            bool orientation = readWord();
+            
+            stPinchThread* thread = stPinchThreadSet_getThread(threadSet,
+                name);
+            
+            if(firstThread == NULL || thread == NULL) {
+                throw std::runtime_error("Saved block is on thread " +
+                    std::to_string(thread == NULL ? name : firstName) +
+                    " which isn't in the index");
+            }
+            
+            stPinchThread_pinch(firstThread, thread, firstStart, start,
+                length, firstOrientation == orientation);
+        }
+        
+        if(!stream) {
+            throw std::runtime_error("Saved pinch thread set is truncated");
+        }
+    }
+    
+    // Pinching in pieces can leave boundaries that don't separate anything.
+    stPinchThreadSet_joinTrivialBoundaries(threadSet);
+    
+    return threadSet;
+}
+
+/**
+ * Canonicalize the given TextPosition, using the given function to find the
+ * segment containing a 1-based offset on a contig.
+ */
+template<typename SegmentFinder>
+static TextPosition
+canonicalizeWith(
+    const FMDIndex& index,
+    SegmentFinder findSegment,
     TextPosition base
 ) {
     
-    Log::trace() << "Canonicalizing " << base << std::endl;
+    LOG_TRACE("Canonicalizing " << base << std::endl);
     
     // What contig corresponds to that text?
     size_t contigNumber = index.getContigNumber(base);
@@ -49,8 +162,8 @@ canonicalize(
             std::to_string(contigNumber));
     }
     
-    Log::trace() << "Canonicalizing " << contigNumber << ":" << offset << 
-        "." << strand << std::endl;
+    LOG_TRACE("Canonicalizing " << contigNumber << ":" << offset << 
+        "." << strand << std::endl);
         
     // Now we need to look up what the pinch set says is the canonical
     // position for this base, and what orientation it should be in. All the
@@ -58,8 +171,7 @@ canonicalize(
     // pointing to the canonical base's replacement.
     
     // Get the segment (using the 1-based position).
-    stPinchSegment* segment = stPinchThreadSet_getSegment(threadSet, 
-        contigNumber, offset);
+    stPinchSegment* segment = findSegment(contigNumber, offset);
         
     if(segment == NULL) {
         throw std::runtime_error("Found position in null segment!");
@@ -101,28 +213,28 @@ canonicalize(
             canonicalSegmentOffset - 1;
     }
     
-    Log::trace() << "Canonicalized segment offset " << segmentOffset << 
-        " to " << canonicalSegmentOffset << std::endl;
+    LOG_TRACE("Canonicalized segment offset " << segmentOffset << 
+        " to " << canonicalSegmentOffset << std::endl);
     
     // What's the offset into the canonical contig? 1-based because we add a
     // 0-based offset to a 1-based position.
     size_t canonicalOffset = stPinchSegment_getStart(firstSegment) + 
         canonicalSegmentOffset;
     
-    Log::trace() << "Canonicalized contig " << contigNumber << " offset " <<
+    LOG_TRACE("Canonicalized contig " << contigNumber << " offset " <<
         offset << " to contig " << canonicalContig << " offset " << 
-        canonicalOffset << std::endl;
+        canonicalOffset << std::endl);
     
     // What orientation should we use?  Well, we have the canonical position's
     // orientation within the block, our position's orientation within the
     // block, and the orientation that this context attaches to the position in.
     // Flipping any of those will flip the orientation in which we need to map,
     // so we need to xor them all together, which for bools is done with !=.
-    Log::trace() << "Canonical block orientation: " << canonicalOrientation << 
-            std::endl;
-    Log::trace() << "Segment orientation: " << segmentOrientation << 
-            std::endl;
-    Log::trace() << "Original strand: " << strand << std::endl;
+    LOG_TRACE("Canonical block orientation: " << canonicalOrientation << 
+            std::endl);
+    LOG_TRACE("Segment orientation: " << segmentOrientation << 
+            std::endl);
+    LOG_TRACE("Original strand: " << strand << std::endl);
     bool finalOrientation = (canonicalOrientation != segmentOrientation !=
         strand);
 
@@ -150,6 +262,262 @@ canonicalize(
     return canonicalizedPosition;
 }
 
+TextPosition
+canonicalize(
+    const FMDIndex& index, 
+    stPinchThreadSet* threadSet, 
+    TextPosition base
+) {
+    
+    return canonicalizeWith(index, [&](size_t contig, size_t offset) {
+        return stPinchThreadSet_getSegment(threadSet, contig, offset);
+    }, base);
+}
+
+std::vector<stPinchThread*>
+getThreadsByName(
+    stPinchThreadSet* threadSet
+) {
+    
+    std::vector<stPinchThread*> threads;
+    
+    stPinchThreadSetIt iterator = stPinchThreadSet_getIt(threadSet);
+    stPinchThread* thread;
+    while((thread = stPinchThreadSetIt_getNext(&iterator)) != NULL) {
+        // File each thread under its name, which for our thread sets is a
+        // contig number.
+        size_t name = stPinchThread_getName(thread);
+        if(name >= threads.size()) {
+            threads.resize(name + 1, NULL);
+        }
+        threads[name] = thread;
+    }
+    
+    return threads;
+}
+
+SegmentCursor::SegmentCursor(stPinchThread* thread): thread(thread),
+    segment(thread == NULL ? NULL : stPinchThread_getFirst(thread)) {
+    
+    // Nothing to do
+}
+
+stPinchSegment* SegmentCursor::seek(int64_t offset) {
+    if(segment == NULL || offset < stPinchThread_getStart(thread) ||
+        offset >= stPinchThread_getStart(thread) +
+        stPinchThread_getLength(thread)) {
+        
+        // The offset isn't on the thread at all.
+        return NULL;
+    }
+    
+    while(offset < stPinchSegment_getStart(segment)) {
+        // Walk back to the segment with the offset.
+        segment = stPinchSegment_get5Prime(segment);
+    }
+    while(offset >= stPinchSegment_getStart(segment) +
+        stPinchSegment_getLength(segment)) {
+        
+        // Or forward to it.
+        segment = stPinchSegment_get3Prime(segment);
+    }
+    
+    return segment;
+}
+
+TextPosition
+canonicalize(
+    const FMDIndex& index,
+    SegmentCursor& cursor,
+    TextPosition base
+) {
+    
+    return canonicalizeWith(index, [&](size_t, size_t offset) {
+        return cursor.seek(offset);
+    }, base);
+}
+
+void
+runThreads(
+    size_t threads,
+    const std::function<void(size_t)>& function
+) {
+    
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> running;
+    for(size_t i = 0; i < threads; i++) {
+        running.push_back(std::thread([&, i]() {
+            try {
+                function(i);
+            } catch(...) {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    for(auto& thread : running) {
+        thread.join();
+    }
+    for(auto& error : errors) {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void
+canonicalizeTexts(
+    stPinchThreadSet* threadSet, 
+    const FMDIndex& index,
+    const GenericBitVector* mask,
+    const std::vector<size_t>& texts,
+    std::vector<PackedTextPosition>& canonicalized,
+    size_t threads
+) {
+
+    Log::info() << "Canonicalizing " << texts.size() << " texts by LF walks "
+        "on " << threads << " threads..." << std::endl;
+        
+    threads = std::max(threads, (size_t) 1);
+    
+    // How many texts are there? Each has a stop character, and the first this
+    // many rows in the BWT have stop characters in the F column.
+    size_t numTexts = index.getNumberOfContigs() * 2;
+    
+    // Find the row for the suffix of each text that is just the stop
+    // character.
+    std::vector<int64_t> endRows(numTexts);
+    parallelFor(threads, [&](size_t thread) {
+        for(size_t i = numTexts * thread / threads;
+            i < numTexts * (thread + 1) / threads; i++) {
+            
+            endRows[index.locate(i).getText()] = i;
+        }
+    });
+    
+    // Find each contig's pinch thread without a hash lookup.
+    std::vector<stPinchThread*> pinchThreads = getThreadsByName(threadSet);
+    
+    // Texts get handed out to threads from here.
+    std::atomic<size_t> nextText(0);
+    
+    parallelFor(threads, [&](size_t thread) {
+        for(size_t i = nextText++; i < texts.size(); i = nextText++) {
+            size_t text = texts[i];
+        
+            // Start at the row for the suffix that is just the stop character.
+            int64_t row = endRows[text];
+            
+            // We go from the end of the contig back to the start, so the
+            // cursor never has to walk over a segment more than twice.
+            SegmentCursor cursor(pinchThreads.at(text / 2));
+            
+            size_t length = index.getContigLength(text / 2);
+            for(size_t offset = length - 1; offset != (size_t) -1; offset--) {
+                // LF-map to the row for the suffix starting one base further
+                // left.
+                row = index.getLF(row);
+                
+                if(mask != NULL && !mask->isSet(row)) {
+                    // This position is masked out. We don't allow it to break
+                    // up ranges, so pretend it doesn't exist.
+                    canonicalized[row] = PackedTextPosition();
+                    continue;
+                }
+                
+                // Canonicalize it.
+                canonicalized[row] = PackedTextPosition(canonicalize(index,
+                    cursor, TextPosition(text, offset)));
+            }
+        }
+    });
+}
+
+std::pair<GenericBitVector*, std::vector<TextPosition>>
+identifyMergedRuns(
+    const FMDIndex& index,
+    const std::vector<PackedTextPosition>& canonicalized,
+    const GenericBitVector* mask,
+    size_t threads
+) {
+    
+    Log::info() << "Building merged run index by scan..." << std::endl;
+    
+    threads = std::max(threads, (size_t) 1);
+    
+    // How many stop characters are at the front of the BWT?
+    size_t numTexts = index.getNumberOfContigs() * 2;
+    
+    // Now scan the BWT in pieces (skipping over the stop characters). Each
+    // piece finds where ranges start inside it, assuming one starts at its
+    // first unmasked row.
+    std::vector<std::vector<int64_t>> pieceStarts(threads);
+    
+    parallelFor(threads, [&](size_t thread) {
+        int64_t pieceStart = numTexts + (index.getBWTLength() - numTexts) *
+            thread / threads;
+        int64_t pieceEnd = numTexts + (index.getBWTLength() - numTexts) *
+            (thread + 1) / threads;
+        
+        // Keep track of the position for the last row we looked at.
+        PackedTextPosition last;
+        
+        for(int64_t j = pieceStart; j < pieceEnd; j++) {
+            if(!canonicalized[j].isSet() || (mask != NULL && !mask->isSet(j))) {
+                // Masked out.
+                continue;
+            }
+            
+            if(!last.isSet() || canonicalized[j] != last) {
+                // We need to start a new range here, because this BWT base
+                // maps to a different position than the last one.
+                pieceStarts[thread].push_back(j);
+                last = canonicalized[j];
+            }
+            // Otherwise we had the same canonical base, so we want this in the
+            // same range we already started.
+        }
+    });
+    
+    // We need to make bit vector denoting ranges, which we build all at once
+    // from the sorted places where ranges start.
+    std::vector<size_t> rangeStarts;
+    
+    // We also need to make a vector of canonical positions.
+    std::vector<TextPosition> mappings;
+    
+    // Keep track of the canonical position for the last range we started.
+    PackedTextPosition lastCanonicalized;
+    
+    for(const auto& starts : pieceStarts) {
+        for(int64_t j : starts) {
+            if(canonicalized[j] == lastCanonicalized) {
+                // This range was only started because it began a piece, but it
+                // just continues the range from the last piece.
+                continue;
+            }
+            
+            // Record a 1 in the vector at the start of every range, including
+            // the first, and say the range belongs to the canonical base.
+            rangeStarts.push_back(j);
+            mappings.push_back(canonicalized[j].unpack());
+            lastCanonicalized = canonicalized[j];
+            
+            LOG_TRACE("Set bit " << j << std::endl);
+        }
+    }
+            
+    // Set a bit after the end of the last range (i.e. at the end of the BWT).
+    rangeStarts.push_back(index.getBWTLength());
+    
+    // Make the vector at the right length, leaving room for that trailing
+    // bit.
+    GenericBitVector* encoder = GenericBitVector::fromSortedParallel(
+        rangeStarts, index.getBWTLength() + 1, threads);
+    
+    // Return the bit vector and the canonicalized base vector
+    return std::make_pair(encoder, mappings);
+}
+
 size_t
 writeAlignment(
     stPinchThreadSet* threadSet, 
@@ -163,14 +531,14 @@ writeAlignment(
     std::unordered_set<stPinchBlock*> seen;
     
     // Open up the file to write.
-    std::ofstream c2h(filename.c_str());
+    BufferedWriter c2h(filename);
     
     // First, make a hacked-up consensus reference sequence to be the root of
     // the tree. It just has all the pinch blocks in some order.
     
     // Write the root sequence line. It is a bottom sequence since it has bottom
     // segments.
-    c2h << "s\t'rootSeq'\t'rootSeq'\t1" << std::endl;
+    c2h << "s\t'rootSeq'\t'rootSeq'\t1" << '\n';
     
     // Keep track of the total root sequence space already used
     size_t nextBlockStart = 0;
@@ -202,7 +570,7 @@ writeAlignment(
                     // (number), start, and length.
                     c2h << "a\t" << (uintptr_t)block << "\t" << 
                         nextBlockStart << "\t" << 
-                        stPinchBlock_getLength(block) << std::endl;
+                        stPinchBlock_getLength(block) << '\n';
                         
                     // Advance nextBlockStart.
                     nextBlockStart += stPinchBlock_getLength(block);
@@ -224,9 +592,6 @@ writeAlignment(
     // scaffold, or "genome-<number>" if there are multiple scaffolds involved.
     std::map<std::string, std::string> eventNames;
     
-    // Keep track of the original source sequence
-    std::string sourceSequence;
-    
     // Go through contigs in order. The index spec requires them to be grouped
     // by original source sequence.
     for(size_t contig = 0; contig < index.getNumberOfContigs(); contig++) {
@@ -236,41 +601,32 @@ writeAlignment(
         if(eventNames.count(contigName) == 0) {
             // We need to figure out the event name for this contig.
             
-            // Start by naming the event after the contig.
-            eventNames[contigName] = contigName;
-            
             // What genome does it belong to?
             size_t genomeNumber = index.getContigGenome(contig);
             
-            // What contigs are in that genome?
-            auto genomeRange = index.getGenomeContigs(genomeNumber);
+            // What scaffolds are in that genome?
+            auto genomeScaffolds = index.getGenomeScaffolds(genomeNumber);
             
-            for(size_t i = genomeRange.first; i < genomeRange.second; i++) {
-                // For every contig in that genome
-                if(index.getContigName(i) != contigName) {
-                    // One of them doesn't match this contig's name; they are
-                    // not all from the same scaffold. Re-name the event with a
-                    // new generic name.
-                    
-                    eventNames[contigName] = "genome-" + 
-                        std::to_string(index.getContigGenome(contig));
-                        
-                    // Now we're done
-                    break;
-                }
+            if(genomeScaffolds.second - genomeScaffolds.first == 1) {
+                // The whole genome is this one scaffold, so name the event
+                // after it.
+                eventNames[contigName] = contigName;
+            } else {
+                // They are not all from the same scaffold. Give the event a
+                // generic name.
+                eventNames[contigName] = "genome-" + 
+                    std::to_string(genomeNumber);
             }
         }
         
-        if(contigName != sourceSequence || contig == 0) {
+        if(index.getScaffoldContigs(index.getContigScaffold(contig)).first ==
+            contig) {
             // This is a new scaffold, not the same as the one we were on last.
             
             // Start a new sequence with a sequence line. The sequence is a top
             // sequence, since it is only connected up.
             c2h << "s\t'" << eventNames[contigName] << "'\t'" << contigName <<
-                "'\t0" << std::endl;
-            
-            // Remember that we are on this sequence
-            sourceSequence = contigName;
+                "'\t0" << '\n';
         } else {
             // This is the same sequence as before, but we need an unaligned
             // segment to cover the distance from the last contig to the start
@@ -283,7 +639,7 @@ writeAlignment(
             // Unaligned top segments are "a <start> <length>" only. Leave as
             // 0-based.
             c2h << "a\t" << prevContigEnd << "\t" << 
-                index.getContigStart(contig) - prevContigEnd << std::endl;
+                index.getContigStart(contig) - prevContigEnd << '\n';
             
         }
         
@@ -323,19 +679,19 @@ writeAlignment(
                 // address of the block this segment belongs to.
                 c2h << "a\t" << segmentStart << "\t" << 
                     stPinchSegment_getLength(segment) << "\t" << 
-                    (uintptr_t)block << "\t" << orientation << std::endl;
+                    (uintptr_t)block << "\t" << orientation << '\n';
                     
-                Log::debug() << "Bottom segment orientation: " << 
-                    stPinchSegment_getBlockOrientation(segment) << std::endl;
+                LOG_DEBUG("Bottom segment orientation: " << 
+                    stPinchSegment_getBlockOrientation(segment) << std::endl);
                 
-                Log::debug() << "First segment orientation: " << 
+                LOG_DEBUG("First segment orientation: " << 
                     stPinchSegment_getBlockOrientation(
-                    stPinchBlock_getFirst(block)) << std::endl;
+                    stPinchBlock_getFirst(block)) << std::endl);
                         
             } else {
                 // Write a segment for the unaligned sequence.
                 c2h << "a\t" << segmentStart << "\t" << 
-                    stPinchSegment_getLength(segment) << std::endl;
+                    stPinchSegment_getLength(segment) << '\n';
             }
             
             // Jump to the next 3' segment. This needs to return NULL if we go
@@ -366,7 +722,7 @@ writeAlignmentWithReference(
         std::endl;
     
     // Open up the file to write.
-    std::ofstream c2h(filename.c_str());
+    BufferedWriter c2h(filename);
     
     // Keep a mapping from genome number to event name. Event name will be
     // either the contig scaffold name if all the contigs in the genome are from
@@ -432,7 +788,7 @@ writeAlignmentWithReference(
             // Start a new sequence for the reference with a sequence line. The
             // sequence is not a top sequence.
             c2h << "s\t'" << eventNames[referenceGenomeNumber] << "'\t'" << 
-                index.getContigName(i) << "'\t1" << std::endl;
+                index.getContigName(i) << "'\t1" << '\n';
             
             // Start over at 0 on a new scaffold
             lastContigName = index.getContigName(i);
@@ -460,7 +816,7 @@ writeAlignmentWithReference(
 
                 c2h << "a\t" << ((size_t)(uintptr_t) segment) - 1 << "\t" << 
                     lastSegmentEnd << "\t" << segmentStart - lastSegmentEnd <<
-                    std::endl;
+                    '\n';
                 
             }
             
@@ -478,7 +834,7 @@ writeAlignmentWithReference(
                     // start, and length.
                     c2h << "a\t" << (uintptr_t)block << "\t" << 
                         segmentStart << "\t" << 
-                        stPinchBlock_getLength(block) << std::endl;
+                        stPinchBlock_getLength(block) << '\n';
                         
                     // Record that we have seen this block now.
                     seen.insert(block);
@@ -501,7 +857,7 @@ writeAlignmentWithReference(
                 
                 c2h << "a\t" << (uintptr_t) segment << "\t" << 
                     segmentStart << "\t" << 
-                    stPinchSegment_getLength(segment) << std::endl;
+                    stPinchSegment_getLength(segment) << '\n';
             }
         
             // Keep track of where this segment ended
@@ -549,7 +905,7 @@ writeAlignmentWithReference(
                 // Start a new sequence with a sequence line. The sequence is a
                 // top sequence, since it is only connected up.
                 c2h << "s\t'" << eventNames[genome] << "'\t'" << 
-                    index.getContigName(i) << "'\t0" << std::endl;
+                    index.getContigName(i) << "'\t0" << '\n';
                     
                 // Remember not to make a sequence line for this scaffold again.
                 lastContigScaffold = index.getContigName(i);
@@ -580,7 +936,7 @@ writeAlignmentWithReference(
                 if(segmentStart > lastSegmentEnd) {
                     // We need an unaligned segment padding out to here.
                     c2h << "a\t" << lastSegmentEnd << "\t" << 
-                        segmentStart - lastSegmentEnd << std::endl;
+                        segmentStart - lastSegmentEnd << '\n';
                 }
                 
                 stPinchBlock* block = stPinchSegment_getBlock(segment);
@@ -601,15 +957,15 @@ writeAlignmentWithReference(
                         stPinchSegment_getBlockOrientation(
                         stPinchBlock_getFirst(block)));
                         
-                    Log::debug() << "Bottom segment (" << segment << 
+                    LOG_DEBUG("Bottom segment (" << segment << 
                         ") orientation: " << 
                         stPinchSegment_getBlockOrientation(segment) << 
-                        std::endl;
+                        std::endl);
                         
-                    Log::debug() << "First segment (" << 
+                    LOG_DEBUG("First segment (" << 
                         stPinchBlock_getFirst(block) << ") orientation: " <<
                         stPinchSegment_getBlockOrientation(
-                        stPinchBlock_getFirst(block)) << std::endl;
+                        stPinchBlock_getFirst(block)) << std::endl);
                 
                     // Write a top segment mapping to the segment named after
                     // the address of the block this segment belongs to. Fields
@@ -617,12 +973,12 @@ writeAlignmentWithReference(
                     // orientation.
                     c2h << "a\t" << segmentStart << "\t" << 
                         stPinchSegment_getLength(segment) << "\t" << 
-                        (uintptr_t) block << "\t" << orientation << std::endl;
+                        (uintptr_t) block << "\t" << orientation << '\n';
                         
                 } else {
                     // Write a segment for the unaligned sequence.
                     c2h << "a\t" << segmentStart << "\t" << 
-                        stPinchSegment_getLength(segment) << std::endl;
+                        stPinchSegment_getLength(segment) << '\n';
                 }
                 
                 // Keep track of where this segment ended
@@ -645,7 +1001,7 @@ writeAlignmentWithReference(
 
 void 
 writeBottomSegments(
-    std::ofstream& c2h, 
+    BufferedWriter& c2h, 
     stPinchThread* thread
 ) {
     // Get the first segment in the thread.
@@ -669,7 +1025,7 @@ writeBottomSegments(
             
         // Put a bottom segment in the c2h
         c2h << "a\t" << segmentName << "\t" << segmentStart << "\t" << 
-            stPinchSegment_getLength(segment) << std::endl;
+            stPinchSegment_getLength(segment) << '\n';
             
         if(block != NULL) {
             // Make sure these segments are first, so we can easily check the
@@ -686,7 +1042,7 @@ writeBottomSegments(
 
 void 
 writeTopSegments(
-    std::ofstream& c2h, 
+    BufferedWriter& c2h, 
     stPinchThread* thread
 ) {
     // Get the first segment in the thread.
@@ -717,16 +1073,16 @@ writeTopSegments(
             // Write the bit for aligning
             c2h << "\t" << (uintptr_t) block << "\t" << orientation;
                 
-            Log::debug() << "Bottom segment orientation: " << 
-                stPinchSegment_getBlockOrientation(segment) << std::endl;
+            LOG_DEBUG("Bottom segment orientation: " << 
+                stPinchSegment_getBlockOrientation(segment) << std::endl);
                 
-            Log::debug() << "First segment orientation: " << 
+            LOG_DEBUG("First segment orientation: " << 
                 stPinchSegment_getBlockOrientation(
-                stPinchBlock_getFirst(block)) << std::endl;
+                stPinchBlock_getFirst(block)) << std::endl);
         }
         
         // Finish the line
-        c2h << std::endl;
+        c2h << '\n';
         
         // Jump to the next 3' segment. This needs will return NULL if we go
         // off the end.
@@ -750,7 +1106,7 @@ writeAlignmentWithReference(
         std::endl;
     
     // Open up the file to write.
-    std::ofstream c2h(filename.c_str());
+    BufferedWriter c2h(filename);
     
     Log::info() << "Processing reference thread " << referenceThreadNumber <<
         std::endl;
@@ -768,7 +1124,7 @@ writeAlignmentWithReference(
     // Start a new sequence for the reference with a sequence line. The
     // sequence is not a top sequence.
     c2h << "s\t'" << threadEvents[referenceThreadNumber] << "'\t'" << 
-        threadNames[referenceThreadNumber] << "'\t1" << std::endl;
+        threadNames[referenceThreadNumber] << "'\t1" << '\n';
         
     // Write all the bottom segments for the reference.
     writeBottomSegments(c2h, reference);
@@ -797,7 +1153,7 @@ writeAlignmentWithReference(
         
         // Write the top sequence header
         c2h << "s\t'" << threadEvents[threadNumber] << "'\t'" << 
-            threadNames[threadNumber] << "'\t0" << std::endl;        
+            threadNames[threadNumber] << "'\t0" << '\n';        
         
         // Write the top segments for the thread
         writeTopSegments(c2h, stPinchThreadSet_getThread(threadSet,
@@ -824,14 +1180,14 @@ writeAlignment(
     std::unordered_set<stPinchBlock*> seen;
     
     // Open up the file to write.
-    std::ofstream c2h(filename.c_str());
+    BufferedWriter c2h(filename);
     
     // First, make a hacked-up consensus reference sequence to be the root of
     // the tree. It just has all the pinch blocks in some order.
     
     // Write the root sequence line. It is a bottom sequence since it has bottom
     // segments.
-    c2h << "s\t'rootSeq'\t'rootSeq'\t1" << std::endl;
+    c2h << "s\t'rootSeq'\t'rootSeq'\t1" << '\n';
     
     // Keep track of the total root sequence space already used
     size_t nextBlockStart = 0;
@@ -863,7 +1219,7 @@ writeAlignment(
                     // (number), start, and length.
                     c2h << "a\t" << (uintptr_t)block << "\t" << 
                         nextBlockStart << "\t" << 
-                        stPinchBlock_getLength(block) << std::endl;
+                        stPinchBlock_getLength(block) << '\n';
                         
                     // Advance nextBlockStart.
                     nextBlockStart += stPinchBlock_getLength(block);
@@ -908,7 +1264,7 @@ writeAlignment(
         
         // Write the top sequence header
         c2h << "s\t'" << threadEvents[threadNumber] << "'\t'" << 
-            threadNames[threadNumber] << "'\t0" << std::endl;        
+            threadNames[threadNumber] << "'\t0" << '\n';        
         
         // Write the top segments for the thread. We arbitrarily declare the
         // orientation in rootSeq to be that of the first segemnt in the block,
@@ -936,7 +1292,7 @@ writeAlignmentFasta(
 ) {
 
     // Open the FASTA to write
-    std::ofstream fasta(filename.c_str());
+    BufferedWriter fasta(filename);
     
     Log::info() << "Generating " << rootBases << 
         " bases of root node sequence." << std::endl;
@@ -945,13 +1301,22 @@ writeAlignmentFasta(
     if(rootBases >= 0) {
         // First we put the right number of Ns in a sequence named "rootSeq", if
         // the caller didn't ask to not have it.
-        fasta << ">rootSeq" << std::endl;
-        for(size_t i = 0; i < rootBases; i++) {
-            fasta << "N";
-            // Entire sequence must be on one line.
+        fasta << ">rootSeq" << '\n';
+        
+        // Entire sequence must be on one line. Write it a bufferful at a time.
+        const std::string ns(BufferedWriter::CHUNK_SIZE, 'N');
+        for(int64_t written = 0; written < rootBases; written += ns.size()) {
+            fasta.write(ns.data(), std::min((int64_t) ns.size(),
+                rootBases - written));
         }
     }
     
+    // Copy the input a bufferful at a time, so a long sequence all on one line
+    // never has to be in memory all at once. Use the same buffer for every
+    // file.
+    static const size_t COPY_BUFFER_SIZE = 1 << 20;
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    
     for(std::vector<std::string>::iterator i = inputFastas.begin(); 
         i != inputFastas.end(); ++i) {
         
@@ -960,33 +1325,63 @@ writeAlignmentFasta(
         // Then we just copy all the other FASTAs in order.
         
         // Open the input FASTA
-        std::ifstream inputFasta((*i).c_str());
+        std::ifstream inputFasta((*i).c_str(), std::ios::binary);
         
-        // Read it line by line. See <http://stackoverflow.com/a/7868998/402891>
-        std::string line;
-        while(std::getline(inputFasta, line)) {
-            // For each line (without trailing newline)
+        // Are we at the start of a line (so a blank line would be dropped, and
+        // a '>' starts a header)? And are we in a header line?
+        bool lineStart = true;
+        bool inHeader = false;
         
-            if(line.size() == 0) {
-                // Drop blank lines
-                continue;
-            }
+        while(inputFasta) {
+            inputFasta.read(buffer.data(), buffer.size());
+            const char* cursor = buffer.data();
+            const char* end = cursor + inputFasta.gcount();
             
-            if(line[0] == '>') {
-                // Make sure there are newlines before and after header lines.
-                fasta << std::endl << line << std::endl;
-            } else {
-                // Don't put any newlines.
-                fasta << line;
+            while(cursor < end) {
+                // Take the rest of the current line in this buffer.
+                const char* newline = (const char*) memchr(cursor, '\n',
+                    end - cursor);
+                const char* lineEnd = newline != NULL ? newline : end;
+                
+                if(lineEnd > cursor) {
+                    if(lineStart && *cursor == '>') {
+                        // Make sure there are newlines before and after header
+                        // lines.
+                        fasta << '\n';
+                        inHeader = true;
+                    }
+                    // Sequence lines get no newlines, so they all run
+                    // together.
+                    fasta.write(cursor, lineEnd - cursor);
+                    lineStart = false;
+                }
+                
+                if(newline != NULL) {
+                    if(inHeader) {
+                        fasta << '\n';
+                        inHeader = false;
+                    }
+                    // Anything after this that is also a newline is a blank
+                    // line, and gets dropped.
+                    lineStart = true;
+                    cursor = newline + 1;
+                } else {
+                    cursor = end;
+                }
             }
         }
+        
+        if(inHeader) {
+            // The file ended in the middle of a header line.
+            fasta << '\n';
+        }
             
         // Close up this input file and move to the next one.
         inputFasta.close();
     }
     
     // Insert a linebreak at the end of the file.
-    fasta << std::endl;
+    fasta << '\n';
     
     // Now we're done.
     fasta.close();
@@ -1176,3 +1571,153 @@ writeLastGraph(
     lastGraph.close();
 
 }
+
+/**
+ * Lay out the given pinch graph as GraphFile tables, with its threads in the
+ * order the thread set iterates over them, and blocks numbered in the order
+ * they are first seen along the threads.
+ */
+static void
+collectGraph(
+    stPinchThreadSet* threadSet,
+    std::vector<GraphFile::Thread>& threads,
+    std::vector<GraphFile::Segment>& segments,
+    std::vector<GraphFile::Block>& blocks,
+    std::vector<uint64_t>& members
+) {
+    
+    // Number the blocks as we find them, and keep their members until we know
+    // where each block's members start.
+    std::unordered_map<stPinchBlock*, uint64_t> blockNumbers;
+    std::vector<std::vector<uint64_t>> blockMembers;
+    
+    stPinchThreadSetIt threadIterator = stPinchThreadSet_getIt(threadSet);
+    stPinchThread* thread;
+    while((thread = stPinchThreadSetIt_getNext(&threadIterator)) != NULL) {
+        // For each pinch thread, save it with all its segments in order.
+        GraphFile::Thread saved = {(uint64_t) stPinchThread_getName(thread),
+            (uint64_t) stPinchThread_getLength(thread), segments.size(), 0};
+        
+        stPinchSegment* segment = stPinchThread_getFirst(thread);
+        while(segment != NULL) {
+            uint64_t blockNumber = GraphFile::NONE;
+            bool orientation = false;
+            
+            stPinchBlock* block = stPinchSegment_getBlock(segment);
+            if(block != NULL) {
+                auto found = blockNumbers.find(block);
+                if(found == blockNumbers.end()) {
+                    // This is a new block.
+                    found = blockNumbers.emplace(block, blocks.size()).first;
+                    blocks.push_back(GraphFile::Block{
+                        (uint64_t) stPinchBlock_getLength(block), 0, 0});
+                    blockMembers.emplace_back();
+                }
+                blockNumber = found->second;
+                blockMembers[blockNumber].push_back(segments.size());
+                
+                // Orientations are relative to the block's first segment, as
+                // in the c2h output.
+                orientation = stPinchSegment_getBlockOrientation(segment) !=
+                    stPinchSegment_getBlockOrientation(
+                    stPinchBlock_getFirst(block));
+            }
+            
+            segments.push_back(GraphFile::Segment{threads.size(),
+                (uint64_t) stPinchSegment_getStart(segment),
+                (uint64_t) stPinchSegment_getLength(segment), blockNumber,
+                orientation});
+            saved.segmentCount++;
+            
+            segment = stPinchSegment_get3Prime(segment);
+        }
+        
+        threads.push_back(saved);
+    }
+    
+    // Lay out all the block members together.
+    for(size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].firstMember = members.size();
+        blocks[i].degree = blockMembers[i].size();
+        members.insert(members.end(), blockMembers[i].begin(),
+            blockMembers[i].end());
+    }
+}
+
+void
+writeBinaryGraph(
+    stPinchThreadSet* threadSet,
+    const std::string& filename
+) {
+
+    Log::info() << "Saving binary graph to " << filename << std::endl;
+    
+    std::vector<GraphFile::Thread> threads;
+    std::vector<GraphFile::Segment> segments;
+    std::vector<GraphFile::Block> blocks;
+    std::vector<uint64_t> members;
+    collectGraph(threadSet, threads, segments, blocks, members);
+    
+    GraphFile::save(filename, threads, segments, blocks, members);
+}
+
+void
+writeAvroGraph(
+    stPinchThreadSet* threadSet,
+    const std::string& filename
+) {
+
+    Log::info() << "Saving Avro graph to " << filename << std::endl;
+    
+    std::vector<GraphFile::Thread> threads;
+    std::vector<GraphFile::Segment> segments;
+    std::vector<GraphFile::Block> blocks;
+    std::vector<uint64_t> members;
+    collectGraph(threadSet, threads, segments, blocks, members);
+    
+    GraphFile::saveAvro(filename, threads, segments);
+}
+
+std::map<std::string, size_t>
+getThreadSetMemoryUsage(
+    stPinchThreadSet* threadSet
+) {
+    // These are the approximate sizes of the pinch graph's own structs: a
+    // thread has a name, start, length, first segment, and sorted set of
+    // segments; a segment has a thread, its neighbors along the thread and in
+    // its block, its block, a start, a length, and an orientation; and a block
+    // has its first and last segments, a length, and a degree. Each segment
+    // also costs a node in its thread's sorted set.
+    static const size_t THREAD_BYTES = 48;
+    static const size_t SEGMENT_BYTES = 64;
+    static const size_t SET_NODE_BYTES = 40;
+    static const size_t BLOCK_BYTES = 32;
+
+    size_t threads = 0;
+    stPinchThreadSetIt threadIterator = stPinchThreadSet_getIt(threadSet);
+    while(stPinchThreadSetIt_getNext(&threadIterator) != NULL) {
+        threads++;
+    }
+    
+    // Count the segments, and count each block at its first segment.
+    size_t segments = 0;
+    size_t blocks = 0;
+    stPinchThreadSetSegmentIt segmentIterator = stPinchThreadSet_getSegmentIt(
+        threadSet);
+    stPinchSegment* segment;
+    while((segment = stPinchThreadSetSegmentIt_getNext(&segmentIterator)) !=
+        NULL) {
+        
+        segments++;
+        stPinchBlock* block = stPinchSegment_getBlock(segment);
+        if(block != NULL && stPinchBlock_getFirst(block) == segment) {
+            blocks++;
+        }
+    }
+    
+    std::map<std::string, size_t> usage;
+    usage["threads"] = threads * THREAD_BYTES;
+    usage["segments"] = segments * (SEGMENT_BYTES + SET_NODE_BYTES);
+    usage["blocks"] = blocks * BLOCK_BYTES;
+    return usage;
+}
@@ -8,9 +8,16 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <map>
+#include <istream>
+#include <ostream>
+#include <functional>
 
 #include <FMDIndex.hpp>
 #include <TextPosition.hpp>
+#include <GenericBitVector.hpp>
+
+#include "BufferedWriter.hpp"
 
 /**
  * pinchGraphUtil.hpp: utility functions for pinch graph.
@@ -26,6 +33,29 @@ makeThreadSet(
 );
 
 
+/**
+ * Save the blocks of the given thread set to the given binary stream, so that
+ * readThreadSet() can rebuild it over the same index. Each block is saved as
+ * its degree and length, followed by the thread name, start, and orientation of
+ * each of its segments, all as 64-bit words. Unaligned bases aren't saved,
+ * since they are just what's left over.
+ */
+void
+writeThreadSet(
+    stPinchThreadSet* threadSet,
+    std::ostream& stream
+);
+
+/**
+ * Make a thread set for the given index as makeThreadSet() does, and pinch it
+ * to have all the blocks saved in the given stream by writeThreadSet().
+ */
+stPinchThreadSet*
+readThreadSet(
+    const FMDIndex& index,
+    std::istream& stream
+);
+
 /**
  * Turn the given TextPosition into the TextPosition for the canonical base that
  * represents all the bases it has been pinched with.
@@ -37,6 +67,112 @@ canonicalize(
     TextPosition base
 );
 
+/**
+ * Get the threads of the given thread set in a vector indexed by thread name,
+ * so that finding the thread for a contig number doesn't need a hash lookup.
+ * Names that have no thread get NULL.
+ */
+std::vector<stPinchThread*>
+getThreadsByName(
+    stPinchThreadSet* threadSet
+);
+
+/**
+ * Finds the segments of a pinch thread that contain a series of offsets, by
+ * walking along the thread from the last segment it found. Looking up offsets
+ * in order along the thread, in either direction, takes amortized constant
+ * time per offset. Anything that splits or joins segments on the thread
+ * invalidates it.
+ */
+class SegmentCursor {
+public:
+    /**
+     * Make a cursor on the given thread, starting at its first segment.
+     */
+    SegmentCursor(stPinchThread* thread);
+    
+    /**
+     * Get the segment containing the given 1-based offset on the thread, or
+     * NULL if the offset isn't on the thread.
+     */
+    stPinchSegment* seek(int64_t offset);
+    
+protected:
+    // What thread are we on?
+    stPinchThread* thread;
+    // What segment did we find last?
+    stPinchSegment* segment;
+};
+
+/**
+ * Canonicalize the given TextPosition as canonicalize() on the whole thread set
+ * does, but find its segment with the given cursor, which must be on the thread
+ * for the TextPosition's contig.
+ */
+TextPosition
+canonicalize(
+    const FMDIndex& index,
+    SegmentCursor& cursor,
+    TextPosition base
+);
+
+/**
+ * Run the given function on the given number of threads, passing each its
+ * thread number, and rethrow an exception if any of them threw one.
+ *
+ * Starts threads of its own, so it is for work that spends its time waiting on
+ * other threads. Computation should use parallelFor() on the shared TaskPool
+ * instead.
+ */
+void
+runThreads(
+    size_t threads,
+    const std::function<void(size_t)>& function
+);
+
+/**
+ * Canonicalize every base of each of the given texts through the pinched
+ * thread set, and store the canonical position for each base at its BWT row in
+ * canonicalized, which must have an entry for every row. Rows for bases
+ * without a 1 in the mask, if a mask is given, are cleared instead.
+ *
+ * Walks each text once by LF mapping to find where its bases are in the BWT,
+ * instead of locating every row, with the texts split among the given number
+ * of threads.
+ */
+void
+canonicalizeTexts(
+    stPinchThreadSet* threadSet, 
+    const FMDIndex& index,
+    const GenericBitVector* mask,
+    const std::vector<size_t>& texts,
+    std::vector<PackedTextPosition>& canonicalized,
+    size_t threads
+);
+
+/**
+ * Canonicalize each contigous run of positions mapping to the same canonical
+ * base and face.
+ *
+ * Takes the index, and the canonical position for every BWT row, as filled in
+ * by canonicalizeTexts(). Rows with no canonical position are masked out, and
+ * can't break up ranges. If a mask bit vector is specified, rows without a 1 in
+ * it are masked out too.
+ *
+ * Returns a GenericBitVector marking each such range with a 1 at the start, and
+ * a vector of canonicalized TextPositions.
+ *
+ * Scans through the entire BWT, in as many pieces at once as there are
+ * threads.
+ */
+std::pair<GenericBitVector*, std::vector<TextPosition>>
+identifyMergedRuns(
+    const FMDIndex& index,
+    const std::vector<PackedTextPosition>& canonicalized,
+    const GenericBitVector* mask = NULL,
+    size_t threads = 1
+);
+
 /**
  * Write the given threadSet on the contigs in the given index out as a multiple
  * alignment. Produces a cactus2hal (.c2h) file as described in
@@ -102,7 +238,7 @@ writeAlignmentWithReference(
  */
 void 
 writeBottomSegments(
-    std::ofstream& c2h, 
+    BufferedWriter& c2h, 
     stPinchThread* thread
 );
 
@@ -111,7 +247,7 @@ writeBottomSegments(
  */
 void 
 writeTopSegments(
-    std::ofstream& c2h, 
+    BufferedWriter& c2h, 
     stPinchThread* thread
 );
 
@@ -211,4 +347,39 @@ writeLastGraph(
     const std::string& filename
 );
 
+/**
+ * Write the given pinch graph to the given file in the binary format that
+ * GraphFile can memory-map, with its threads in the order the thread set
+ * iterates over them, and blocks numbered in the order they are first seen
+ * along the threads.
+ */
+void
+writeBinaryGraph(
+    stPinchThreadSet* threadSet,
+    const std::string& filename
+);
+
+/**
+ * Write the segments of the given pinch graph to the given file as an Avro
+ * container of GraphSegment records (see GraphFile::saveAvro()), for Spark jobs
+ * to read. Threads and blocks are ordered and numbered as for
+ * writeBinaryGraph().
+ */
+void
+writeAvroGraph(
+    stPinchThreadSet* threadSet,
+    const std::string& filename
+);
+
+/**
+ * Estimate the number of bytes the given pinch graph takes up, split into its
+ * threads, segments, and blocks. The pinch graph structures are opaque, so
+ * this counts them and multiplies by their approximate sizes, including the
+ * sorted set each thread keeps of its segments.
+ */
+std::map<std::string, size_t>
+getThreadSetMemoryUsage(
+    stPinchThreadSet* threadSet
+);
+
 #endif
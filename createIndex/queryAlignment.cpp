@@ -0,0 +1,139 @@
+// queryAlignment.cpp: program to find the reads mapped to a region in a sorted
+// alignment saved by mapReads.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+
+#include <boost/program_options.hpp>
+
+#include <SortedAlignmentFile.hpp>
+#include <Log.hpp>
+
+#include "unixUtil.hpp"
+
+/**
+ * queryAlignment: command-line tool to find the mapped segments of reads that
+ * overlap a reference region in a sorted alignment from mapReads
+ * --sortedAlignment, using its index to read only the part of the file near
+ * the region. Prints a
+ * <reference>\t<start>\t<end>\t<query>\t<position>\t<isBackwards> line for
+ * each segment, with 0-based, half-open reference coordinates and the read
+ * base the segment starts at. Segments on each contig with the reference's name
+ * come out in order along it.
+ */
+int 
+main(
+    int argc, 
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+    
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+    
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription = 
+        std::string("Find reads mapped to a region of a sorted alignment.\n") + 
+        "Usage: queryAlignment <alignment> <reference> <start> <end>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options() 
+        ("help", "Print help messages") 
+        ("alignment", boost::program_options::value<std::string>()
+            ->required(), 
+            "Sorted alignment file to read")
+        ("reference", boost::program_options::value<std::string>()
+            ->required(), 
+            "Name of the reference sequence the region is on")
+        ("start", boost::program_options::value<size_t>()->required(), 
+            "First base of the region, 0-based")
+        ("end", boost::program_options::value<size_t>()->required(), 
+            "Base just past the end of the region, 0-based");
+        
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("alignment", 1);
+    positionals.add("reference", 1);
+    positionals.add("start", 1);
+    positionals.add("end", 1);
+    
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+    
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+            
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+            
+            // Don't do the actual program.
+            return 0; 
+        }
+        
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+            
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl; 
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl; 
+        
+        // Stop the program.
+        return -1; 
+    }
+    
+    // If we get here, we have the right arguments.
+    SortedAlignmentFile alignment(options["alignment"].as<std::string>());
+    std::string reference = options["reference"].as<std::string>();
+    size_t start = options["start"].as<size_t>();
+    size_t end = options["end"].as<size_t>();
+    
+    const std::vector<std::string>& referenceNames =
+        alignment.getReferenceNames();
+    
+    // A reference sequence may have been indexed as several contigs, which
+    // have the same name, so look in all of them.
+    std::vector<SortedAlignmentFile::Record> records;
+    size_t totalSegments = 0;
+    for(size_t i = 0; i < referenceNames.size(); i++) {
+        if(referenceNames[i] != reference) {
+            continue;
+        }
+        
+        alignment.query(i, start, end, records);
+        for(const SortedAlignmentFile::Record& record : records) {
+            std::cout << reference << '\t' << record.start << '\t' <<
+                record.getEnd() << '\t' << record.name << '\t' <<
+                record.queryStart << '\t' <<
+                (record.backwards ? '1' : '0') << '\n';
+        }
+        totalSegments += records.size();
+    }
+    std::cout.flush();
+    
+    Log::info() << "Found " << totalSegments << " segments" << std::endl;
+    
+    return 0;
+}
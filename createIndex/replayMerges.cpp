@@ -0,0 +1,260 @@
+// replayMerges.cpp: program to replay the merges recorded by createIndex
+// --recordMerges, so the pinch graph side of merging can be timed without
+// mapping anything.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <set>
+#include <chrono>
+#include <csignal>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+// Grab pinchesAndCacti dependency.
+#include <stPinchGraphs.h>
+
+#include <FMDIndex.hpp>
+#include <GenericBitVector.hpp>
+#include <TextPosition.hpp>
+#include <Log.hpp>
+
+#include "ConcurrentQueue.hpp"
+#include "Merge.hpp"
+#include "MergeApplier.hpp"
+#include "MergeRecording.hpp"
+#include "pinchGraphUtil.hpp"
+#include "unixUtil.hpp"
+
+/**
+ * Get the seconds since the given time.
+ */
+double
+secondsSince(
+    std::chrono::steady_clock::time_point start
+) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+        start).count();
+}
+
+/**
+ * replayMerges: command-line tool to replay recorded merges. Builds the pinch
+ * graph for the index in the index directory, and then for each genome after
+ * the first, in order, applies the merges recorded for it with a MergeApplier
+ * and redoes the canonicalization and merged run identification that
+ * createIndex's greedy merge does, timing each step.
+ *
+ * With no sorting and the same compaction threshold as the recorded run, the
+ * pinch graph comes out the same as it did in createIndex. Recordings from a
+ * run resumed from a checkpoint can't be replayed, since they start partway
+ * through.
+ */
+int
+main(
+    int argc,
+    char** argv
+) {
+
+    // Register ctrl+c handler. See
+    // <http://www.yolinux.com/TUTORIALS/C++Signals.html>
+    signal(SIGINT, stacktraceOnSignal);
+
+    // Register segfaults with the stack trace handler
+    signal(SIGSEGV, stacktraceOnSignal);
+
+    // Parse options with boost::programOptions. See
+    // <http://www.radmangames.com/programming/how-to-use-boost-program_options>
+
+    std::string appDescription =
+        std::string("Replay merges recorded by createIndex.\n") +
+        "Usage: replayMerges <index directory> <recording directory>";
+
+    // Make an options description for our program's options.
+    boost::program_options::options_description description("Options");
+    // Add all the options
+    description.add_options()
+        ("help", "Print help messages")
+        ("indexDirectory", boost::program_options::value<std::string>()
+            ->required(),
+            "Directory createIndex made the index in")
+        ("recordDirectory", boost::program_options::value<std::string>()
+            ->required(),
+            "Directory createIndex --recordMerges recorded merges in")
+        ("threads", boost::program_options::value<size_t>()
+            ->default_value(16),
+            "Number of threads to canonicalize and find merged runs on")
+        ("sortMerges", boost::program_options::value<size_t>()
+            ->default_value(0),
+            "Sort merges in groups of at least this many along the pinch "
+            "threads before applying them (0 to apply as recorded)")
+        ("compactEvery", boost::program_options::value<size_t>()
+            ->default_value(1000000),
+            "Join trivial boundaries on pinched threads after this many "
+            "pinches (0 to only join once per genome)");
+
+    // And set up our positional arguments
+    boost::program_options::positional_options_description positionals;
+    positionals.add("indexDirectory", 1);
+    positionals.add("recordDirectory", 1);
+
+    // Add a variables map to hold option variables.
+    boost::program_options::variables_map options;
+
+    try {
+        // Parse options into the variable map, or throw an error if there's
+        // something wring with them.
+        boost::program_options::store(
+            // Build the command line parser.
+            boost::program_options::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positionals)
+                .run(),
+            options);
+
+        if(options.count("help")) {
+            // The help option was given. Print program help.
+            std::cout << appDescription << std::endl;
+            std::cout << description << std::endl;
+
+            // Don't do the actual program.
+            return 0;
+        }
+
+        // Check the required options after handling help.
+        boost::program_options::notify(options);
+
+    } catch(boost::program_options::error& error) {
+        // Something is bad about our options. Complain on stderr
+        std::cerr << "Option parsing error: " << error.what() << std::endl;
+        std::cerr << std::endl;
+        // Talk about our app.
+        std::cerr << appDescription << std::endl;
+        // Show all the actually available options.
+        std::cerr << description << std::endl;
+
+        // Stop the program.
+        return -1;
+    }
+
+    // If we get here, we have the right arguments.
+    std::string recordDirectory = options["recordDirectory"].as<std::string>();
+    size_t threads = options["threads"].as<size_t>();
+    size_t sortWindow = options["sortMerges"].as<size_t>();
+    size_t compactThreshold = options["compactEvery"].as<size_t>();
+
+    FMDIndex index(options["indexDirectory"].as<std::string>() +
+        "/index.basename");
+
+    // Start the same way the greedy merge does: with an unpinched graph, and
+    // the canonical positions and merged runs for the first genome.
+    auto start = std::chrono::steady_clock::now();
+    stPinchThreadSet* threadSet = makeThreadSet(index);
+    const GenericBitVector* includedPositions = &index.getGenomeMask(0);
+    std::vector<PackedTextPosition> canonicalized(index.getBWTLength());
+    std::vector<size_t> allTexts(index.getNumberOfContigs() * 2);
+    std::iota(allTexts.begin(), allTexts.end(), 0);
+    canonicalizeTexts(threadSet, index, includedPositions, allTexts,
+        canonicalized, threads);
+    auto mergedRuns = identifyMergedRuns(index, canonicalized, NULL, threads);
+    Log::output() << "Set up in " << secondsSince(start) << " seconds" <<
+        std::endl;
+
+    // Add up the time for each step over all the genomes.
+    double applySeconds = 0;
+    double joinSeconds = 0;
+    double canonicalizeSeconds = 0;
+    double runSeconds = 0;
+    size_t totalMerges = 0;
+
+    for(size_t genome = 1; genome < index.getNumberOfGenomes(); genome++) {
+        std::string filename = recordDirectory + "/genome" +
+            std::to_string(genome) + ".merges";
+        if(!boost::filesystem::exists(filename)) {
+            throw std::runtime_error("No recorded merges for genome " +
+                std::to_string(genome) + " in " + recordDirectory);
+        }
+
+        // Load all the batches up front, so reading them isn't timed, and
+        // hand them to the applier as its only writer.
+        ConcurrentQueue<MergeBatch> queue(1);
+        MergeReader reader(filename);
+        MergeBatch batch;
+        size_t merges = 0;
+        while(reader.next(batch)) {
+            merges += batch.size();
+            auto lock = queue.lock();
+            queue.enqueue(std::move(batch), lock);
+        }
+        auto lock = queue.lock();
+        queue.close(lock);
+        totalMerges += merges;
+
+        start = std::chrono::steady_clock::now();
+        MergeApplier applier(index, queue, threadSet, nullptr, sortWindow,
+            compactThreshold);
+        applier.join();
+        double seconds = secondsSince(start);
+        applySeconds += seconds;
+        Log::output() << "Applied " << merges << " merges for genome " <<
+            genome << " in " << seconds << " seconds" << std::endl;
+
+        start = std::chrono::steady_clock::now();
+        stPinchThreadSet_joinTrivialBoundaries(threadSet);
+        joinSeconds += secondsSince(start);
+
+        // Include the new genome, and redo the texts the merges touched, like
+        // the greedy merge does.
+        GenericBitVector* newIncludedPositions = includedPositions->createUnion(
+            index.getGenomeMask(genome));
+        if(genome > 1) {
+            delete includedPositions;
+        }
+        includedPositions = newIncludedPositions;
+
+        start = std::chrono::steady_clock::now();
+        std::set<size_t> changedContigs;
+        for(size_t contig : applier.getAffectedContigs()) {
+            changedContigs.insert(contig);
+        }
+        for(size_t contig = index.getGenomeContigs(genome).first;
+            contig < index.getGenomeContigs(genome).second; contig++) {
+
+            changedContigs.insert(contig);
+        }
+        std::vector<size_t> changedTexts;
+        for(size_t contig : changedContigs) {
+            changedTexts.push_back(contig * 2);
+            changedTexts.push_back(contig * 2 + 1);
+        }
+        canonicalizeTexts(threadSet, index, includedPositions, changedTexts,
+            canonicalized, threads);
+        canonicalizeSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        delete mergedRuns.first;
+        mergedRuns = identifyMergedRuns(index, canonicalized, NULL, threads);
+        runSeconds += secondsSince(start);
+
+        Log::output() << "Genome " << genome << " leaves " <<
+            mergedRuns.second.size() << " merged runs" << std::endl;
+    }
+
+    Log::output() << "Replayed " << totalMerges << " merges" << std::endl;
+    Log::output() << "Applying merges: " << applySeconds << " seconds" <<
+        std::endl;
+    Log::output() << "Joining trivial boundaries: " << joinSeconds <<
+        " seconds" << std::endl;
+    Log::output() << "Canonicalizing: " << canonicalizeSeconds << " seconds" <<
+        std::endl;
+    Log::output() << "Identifying merged runs: " << runSeconds << " seconds" <<
+        std::endl;
+
+    delete mergedRuns.first;
+    if(index.getNumberOfGenomes() > 1) {
+        delete includedPositions;
+    }
+    stPinchThreadSet_destruct(threadSet);
+
+    return 0;
+}
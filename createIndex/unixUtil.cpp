@@ -11,8 +11,30 @@
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <cerrno>
 #include <unistd.h>
 #include <limits.h>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+#ifdef __linux__
+// Needed for CPU sets and pinning threads to them.
+#include <pthread.h>
+#include <sched.h>
+// Needed for setting memory policies without libnuma.
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+// These come from the kernel's mempolicy.h, which numaif.h would give us if we
+// wanted to depend on libnuma.
+#define POLICY_DEFAULT 0
+#define POLICY_BIND 2
+#define POLICY_INTERLEAVE 3
+// How many nodes can we give a policy for?
+#define POLICY_MAX_NODES 1024
+#endif
 
 // Shouls we try to demangle C++ function names in stack traces?
 #define DEMANGLE_NAMES
@@ -189,3 +211,215 @@ void stacktraceOnSignal(int signalNumber) {
     exit(signalNumber);
 }
 
+
+std::vector<size_t> getCPUOrder(const std::string& policy) {
+    if(policy != "none" && policy != "compact" && policy != "spread") {
+        throw std::runtime_error("Invalid affinity policy: " + policy);
+    }
+    
+    if(policy == "none") {
+        // Don't pin anything.
+        return std::vector<size_t>();
+    }
+    
+    // Holds the allowed CPUs, by the socket they are on.
+    std::map<size_t, std::vector<size_t>> socketCPUs;
+    
+#ifdef __linux__
+    // Which CPUs are we allowed to use?
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        Log::error() << "Could not get CPU affinity" << std::endl;
+        return std::vector<size_t>();
+    }
+    
+    for(size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        
+        // Find the socket from sysfs. If we can't, pretend everything is on
+        // socket 0.
+        size_t socket = 0;
+        std::ifstream socketStream("/sys/devices/system/cpu/cpu" +
+            std::to_string(cpu) + "/topology/physical_package_id");
+        socketStream >> socket;
+        
+        socketCPUs[socket].push_back(cpu);
+    }
+#endif
+    
+    std::vector<size_t> order;
+    
+    if(policy == "compact") {
+        for(const auto& socket : socketCPUs) {
+            // Go through each socket's CPUs in turn.
+            order.insert(order.end(), socket.second.begin(),
+                socket.second.end());
+        }
+    } else if(policy == "spread") {
+        for(size_t i = 0; ; i++) {
+            // Take the ith CPU from each socket that has one, until none do.
+            size_t taken = 0;
+            for(const auto& socket : socketCPUs) {
+                if(i < socket.second.size()) {
+                    order.push_back(socket.second[i]);
+                    taken++;
+                }
+            }
+            
+            if(taken == 0) {
+                break;
+            }
+        }
+    }
+    
+    Log::info() << "Pinning threads to " << order.size() << " CPUs on " <<
+        socketCPUs.size() << " sockets (" << policy << ")" << std::endl;
+    
+    return order;
+}
+
+bool pinThread(std::thread& thread, size_t cpu) {
+#ifdef __linux__
+    if(cpu >= CPU_SETSIZE) {
+        return false;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus),
+        &cpus) == 0;
+#else
+    // We don't know how to do it here.
+    return false;
+#endif
+}
+
+bool pinThread(std::thread& thread, const std::vector<size_t>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(size_t cpu : cpus) {
+        if(cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        CPU_SET(cpu, &set);
+    }
+    
+    return !cpus.empty() && pthread_setaffinity_np(thread.native_handle(),
+        sizeof(set), &set) == 0;
+#else
+    // We don't know how to do it here.
+    return false;
+#endif
+}
+
+/**
+ * Parse a Linux CPU or node list, like "0-3,8,10-11", into the numbers in it.
+ * Stops at anything that doesn't parse.
+ */
+static std::vector<size_t> parseList(const std::string& list) {
+    std::vector<size_t> numbers;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        size_t first;
+        size_t last;
+        char dash;
+        std::stringstream itemStream(item);
+        if(!(itemStream >> first)) {
+            break;
+        }
+        last = first;
+        if(itemStream >> dash && dash == '-' && !(itemStream >> last)) {
+            break;
+        }
+        for(size_t number = first; number <= last; number++) {
+            numbers.push_back(number);
+        }
+    }
+    return numbers;
+}
+
+std::map<size_t, std::vector<size_t>> getNumaNodeCPUs() {
+    std::map<size_t, std::vector<size_t>> nodeCPUs;
+    
+#ifdef __linux__
+    // Which CPUs are we allowed to use?
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        Log::error() << "Could not get CPU affinity" << std::endl;
+        return nodeCPUs;
+    }
+    
+    // Which nodes are there?
+    std::string nodeList;
+    std::ifstream nodeStream("/sys/devices/system/node/online");
+    std::getline(nodeStream, nodeList);
+    
+    for(size_t node : parseList(nodeList)) {
+        std::string cpuList;
+        std::ifstream cpuStream("/sys/devices/system/node/node" +
+            std::to_string(node) + "/cpulist");
+        std::getline(cpuStream, cpuList);
+        
+        for(size_t cpu : parseList(cpuList)) {
+            if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                nodeCPUs[node].push_back(cpu);
+            }
+        }
+    }
+    
+    if(nodeCPUs.empty()) {
+        // Pretend everything is on node 0.
+        for(size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &allowed)) {
+                nodeCPUs[0].push_back(cpu);
+            }
+        }
+    }
+#endif
+    
+    return nodeCPUs;
+}
+
+ScopedMemoryPolicy::ScopedMemoryPolicy(const std::vector<size_t>& nodes,
+    bool interleave): applied(false) {
+    
+#ifdef __linux__
+    unsigned long mask[POLICY_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+    for(size_t node : nodes) {
+        if(node >= POLICY_MAX_NODES) {
+            Log::error() << "Can't place memory on node " << node << std::endl;
+            return;
+        }
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node %
+            (8 * sizeof(unsigned long)));
+    }
+    
+    if(nodes.empty()) {
+        // Nothing to do.
+        return;
+    }
+    
+    applied = syscall(SYS_set_mempolicy, interleave ? POLICY_INTERLEAVE :
+        POLICY_BIND, mask, (unsigned long) POLICY_MAX_NODES) == 0;
+    if(!applied) {
+        Log::error() << "Could not set memory policy: " << strerror(errno) <<
+            std::endl;
+    }
+#endif
+}
+
+ScopedMemoryPolicy::~ScopedMemoryPolicy() {
+#ifdef __linux__
+    if(applied) {
+        syscall(SYS_set_mempolicy, POLICY_DEFAULT, nullptr, 0UL);
+    }
+#endif
+}
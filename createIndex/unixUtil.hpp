@@ -5,6 +5,8 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <thread>
+#include <map>
 
 /**
  * unixUtil.hpp: utility functions for doing useful things with Unix.
@@ -32,6 +34,80 @@ void exitOnSignal(int signalNumber);
  */
 void stacktraceOnSignal(int signalNumber);
 
+/**
+ * Get the CPUs this process is allowed to run on, in the order that threads
+ * should be pinned to them under the given affinity policy. Under "compact",
+ * each socket's CPUs are used up before the next socket's, to keep threads
+ * near each other's caches and memory. Under "spread", CPUs are taken from each
+ * socket in turn, to use all the sockets' memory bandwidth. Under "none", or if
+ * the CPUs can't be determined, returns an empty vector, meaning threads
+ * shouldn't be pinned. Throws std::runtime_error for an unknown policy.
+ */
+std::vector<size_t> getCPUOrder(const std::string& policy);
+
+/**
+ * Pin the given running thread to the given CPU. Returns true if it worked,
+ * and false otherwise (for example, if the platform doesn't support it).
+ */
+bool pinThread(std::thread& thread, size_t cpu);
+
+/**
+ * Pin the given running thread to the given set of CPUs, letting it move
+ * between them. Returns true if it worked, and false otherwise.
+ */
+bool pinThread(std::thread& thread, const std::vector<size_t>& cpus);
+
+/**
+ * Get the NUMA nodes that have CPUs this process is allowed to run on, with
+ * those CPUs. If the nodes can't be determined, all the allowed CPUs are put on
+ * node 0. Returns an empty map if even the allowed CPUs can't be determined.
+ */
+std::map<size_t, std::vector<size_t>> getNumaNodeCPUs();
+
+/**
+ * While it exists, places memory that the thread that made it touches for the
+ * first time on the given NUMA nodes: round-robin by page if interleave is
+ * set, and only on those nodes otherwise. Restores the default of placing
+ * memory on the node the thread is running on when it goes away. Does nothing
+ * where memory policies aren't supported.
+ *
+ * Memory that has already been touched, including pages of files already in
+ * the page cache, stays where it is.
+ */
+class ScopedMemoryPolicy {
+public:
+    /**
+     * Start placing memory on the given nodes.
+     */
+    ScopedMemoryPolicy(const std::vector<size_t>& nodes, bool interleave);
+    
+    /**
+     * Go back to placing memory locally.
+     */
+    ~ScopedMemoryPolicy();
+    
+    /**
+     * Did the policy actually get set?
+     */
+    inline bool isApplied() const {
+        return applied;
+    }
+    
+private:
+    // Was the policy set, so it needs to be undone?
+    bool applied;
+    
+    /**
+     * ScopedMemoryPolicies cannot be copied.
+     */
+    ScopedMemoryPolicy(const ScopedMemoryPolicy& other) = delete;
+    
+    /**
+     * ScopedMemoryPolicies cannot be assigned.
+     */
+    ScopedMemoryPolicy& operator=(const ScopedMemoryPolicy& other) = delete;
+};
+
 /**
  * Save a vector of numbers as a single-column TSV.
  * TODO: Is this UNIX-y enough? Or do we need another util file just for this?
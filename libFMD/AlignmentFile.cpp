@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "AlignmentFile.hpp"
+#include "AvroFile.hpp"
+
+// We read and write segments as they are in memory, so they had better be laid
+// out as whole words.
+static_assert(sizeof(AlignmentFile::Segment) == 5 * sizeof(uint64_t),
+    "Segments must be 5 words");
+
+const std::string AlignmentFile::AVRO_SCHEMA = "{\"type\": \"record\", "
+    "\"name\": \"ReadAlignment\", \"namespace\": \"edu.ucsc.genome\", "
+    "\"fields\": ["
+        "{\"name\": \"name\", \"type\": \"string\"}, "
+        "{\"name\": \"length\", \"type\": \"long\"}, "
+        "{\"name\": \"segments\", \"type\": {\"type\": \"array\", "
+            "\"items\": {\"type\": \"record\", "
+            "\"name\": \"AlignedSegment\", \"fields\": ["
+                "{\"name\": \"queryStart\", \"type\": \"long\"}, "
+                "{\"name\": \"reference\", \"type\": \"string\"}, "
+                "{\"name\": \"referenceOffset\", \"type\": \"long\"}, "
+                "{\"name\": \"backwards\", \"type\": \"boolean\"}, "
+                "{\"name\": \"length\", \"type\": \"long\"}"
+            "]}}}"
+    "]}";
+
+AlignmentFile::AlignmentFile(const std::string& filename):
+    file(filename.c_str(), std::ios::binary), referenceNames(),
+    filename(filename) {
+
+    // Pull out the header.
+    uint64_t magic;
+    uint64_t version;
+    uint64_t nameCount;
+    if(!readWord(magic) || magic != MAGIC || !readWord(version) ||
+        version != VERSION || !readWord(nameCount)) {
+
+        throw std::runtime_error("Bad alignment file " + filename);
+    }
+
+    referenceNames.resize(nameCount);
+    for(std::string& name : referenceNames) {
+        uint64_t nameLength;
+        if(!readWord(nameLength) || !readString(name, nameLength)) {
+            throw std::runtime_error("Bad alignment file " + filename);
+        }
+    }
+}
+
+bool AlignmentFile::next(std::string& name, size_t& length,
+    std::vector<Segment>& segments) {
+
+    uint64_t nameLength;
+    if(!readWord(nameLength)) {
+        // There are no more reads.
+        return false;
+    }
+
+    // Now everything else in the record has to be there.
+    std::string readName;
+    uint64_t readLength;
+    uint64_t segmentCount;
+    if(!readString(readName, nameLength) || !readWord(readLength) ||
+        !readWord(segmentCount)) {
+
+        throw std::runtime_error("Truncated alignment file " + filename);
+    }
+
+    segments.resize(segmentCount);
+    if(!file.read((char*) segments.data(), segmentCount * sizeof(Segment))) {
+        throw std::runtime_error("Truncated alignment file " + filename);
+    }
+
+    name = std::move(readName);
+    length = readLength;
+    return true;
+}
+
+std::string AlignmentFile::makeHeader(
+    const std::vector<std::string>& referenceNames) {
+
+    std::string header;
+    appendWord(header, MAGIC);
+    appendWord(header, VERSION);
+    appendWord(header, referenceNames.size());
+    for(const std::string& name : referenceNames) {
+        appendString(header, name);
+    }
+    return header;
+}
+
+void AlignmentFile::appendRead(std::string& out, const std::string& name,
+    size_t length, const std::vector<Segment>& segments) {
+
+    appendString(out, name);
+    appendWord(out, length);
+    appendWord(out, segments.size());
+    out.append((const char*) segments.data(),
+        segments.size() * sizeof(Segment));
+}
+
+bool AlignmentFile::parseRead(const std::string& data, size_t& cursor,
+    std::string& name, size_t& length, std::vector<Segment>& segments) {
+
+    if(cursor >= data.size()) {
+        // There are no more reads.
+        return false;
+    }
+
+    // Pull out a word, if there is one left.
+    size_t at = cursor;
+    auto takeWord = [&](uint64_t& word) {
+        if(data.size() - at < sizeof(word)) {
+            throw std::runtime_error("Truncated alignment record");
+        }
+        std::copy(data.data() + at, data.data() + at + sizeof(word),
+            (char*) &word);
+        at += sizeof(word);
+    };
+
+    uint64_t nameLength;
+    takeWord(nameLength);
+    if(data.size() - at < nameLength + getPadding(nameLength)) {
+        throw std::runtime_error("Truncated alignment record");
+    }
+    std::string readName(data, at, nameLength);
+    at += nameLength + getPadding(nameLength);
+
+    uint64_t readLength;
+    uint64_t segmentCount;
+    takeWord(readLength);
+    takeWord(segmentCount);
+    if((data.size() - at) / sizeof(Segment) < segmentCount) {
+        throw std::runtime_error("Truncated alignment record");
+    }
+    segments.resize(segmentCount);
+    std::copy(data.data() + at, data.data() + at +
+        segmentCount * sizeof(Segment), (char*) segments.data());
+    at += segmentCount * sizeof(Segment);
+
+    name = std::move(readName);
+    length = readLength;
+    cursor = at;
+    return true;
+}
+
+void AlignmentFile::appendAvroRead(std::string& out, const std::string& name,
+    size_t length, const std::vector<Segment>& segments,
+    const std::vector<std::string>& referenceNames) {
+
+    AvroFile::appendString(out, name);
+    AvroFile::appendLong(out, length);
+
+    // The segments are an array, which is a block of them and then an empty
+    // block to end it.
+    if(!segments.empty()) {
+        AvroFile::appendLong(out, segments.size());
+        for(const Segment& segment : segments) {
+            AvroFile::appendLong(out, segment.queryStart);
+            AvroFile::appendString(out, referenceNames[segment.reference]);
+            AvroFile::appendLong(out, segment.referenceOffset);
+            AvroFile::appendBoolean(out, segment.backwards);
+            AvroFile::appendLong(out, segment.length);
+        }
+    }
+    AvroFile::appendLong(out, 0);
+}
+
+void AlignmentFile::appendWord(std::string& out, uint64_t word) {
+    out.append((const char*) &word, sizeof(word));
+}
+
+void AlignmentFile::appendString(std::string& out, const std::string& text) {
+    appendWord(out, text.size());
+    out += text;
+    // Pad out to a word boundary.
+    out.append(getPadding(text.size()), '\0');
+}
+
+bool AlignmentFile::readWord(uint64_t& word) {
+    return (bool) file.read((char*) &word, sizeof(word));
+}
+
+bool AlignmentFile::readString(std::string& text, size_t length) {
+    text.assign(length, '\0');
+    char zeroes[sizeof(uint64_t)];
+    return file.read(&text[0], length) &&
+        file.read(zeroes, getPadding(length));
+}
@@ -0,0 +1,166 @@
+#ifndef ALIGNMENTFILE_HPP
+#define ALIGNMENTFILE_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+/**
+ * Reads alignments of reads to a reference saved by mapReads in its compact
+ * binary format, as an alternative to the TSV of one line per base.
+ *
+ * The file starts with a header: a magic number, a format version, the number
+ * of reference sequence names, and each name as a length and then its bytes.
+ * Names may repeat, since a reference sequence can be indexed as several
+ * contigs. After that comes a record for each read: its name as a length and
+ * then its bytes, its length in bases, the number of mapped segments, and then
+ * the segments themselves. A segment is a run of consecutive read bases mapped
+ * to consecutive reference bases: the first read base, the number of the
+ * reference name, the offset in that reference sequence the first read base
+ * maps to, whether the run is mapped backwards, and how many bases are in it.
+ * Going along a forward run, the
+ * reference offset goes up by one each base; going along a backward run it
+ * goes down by one. Read bases in no segment are unmapped. Segments are in
+ * order along the read and don't overlap.
+ *
+ * Everything is in 64-bit words in platform-native byte order. Strings are
+ * padded with 0s out to a whole number of words.
+ */
+class AlignmentFile {
+
+public:
+    /**
+     * Represents a run of read bases mapped to consecutive reference bases.
+     */
+    struct Segment {
+        // What read base does it start at, 0-based?
+        uint64_t queryStart;
+        // What is the number of the name of the reference sequence it is on?
+        uint64_t reference;
+        // What reference base, 0-based, does that first read base map to?
+        uint64_t referenceOffset;
+        // Is it mapped to the reverse strand (1) or not (0)?
+        uint64_t backwards;
+        // How many bases long is it?
+        uint64_t length;
+    };
+
+    /**
+     * Open the given alignment file for reading. Throws a std::runtime_error
+     * if it isn't an alignment file of this version.
+     */
+    AlignmentFile(const std::string& filename);
+
+    /**
+     * Get the names of the reference sequences the reads were mapped to, by
+     * number.
+     */
+    inline const std::vector<std::string>& getReferenceNames() const {
+        return referenceNames;
+    }
+
+    /**
+     * Read the next read's record, filling in its name, length, and mapped
+     * segments. Returns false, without touching them, if there are no more
+     * reads. Throws a std::runtime_error if the file is cut off in the middle
+     * of a record.
+     */
+    bool next(std::string& name, size_t& length,
+        std::vector<Segment>& segments);
+
+    /**
+     * Make the header for a file of alignments to reference sequences with the
+     * given names, which segments refer to by number.
+     */
+    static std::string makeHeader(
+        const std::vector<std::string>& referenceNames);
+
+    /**
+     * Append the record for a read with the given name and length, with the
+     * given mapped segments, to the given string, so many reads' records can be
+     * collected and written at once.
+     */
+    static void appendRead(std::string& out, const std::string& name,
+        size_t length, const std::vector<Segment>& segments);
+
+    /**
+     * Parse the record for a read saved by appendRead() out of the given
+     * string, starting at the given cursor, and advance the cursor past it,
+     * filling in the read's name, length, and mapped segments. Returns false, without
+     * touching them, if the cursor is at the end of the string. Throws a
+     * std::runtime_error if the string ends in the middle of a record.
+     */
+    static bool parseRead(const std::string& data, size_t& cursor,
+        std::string& name, size_t& length, std::vector<Segment>& segments);
+
+    /**
+     * Append an Avro record for a read, as described by AVRO_SCHEMA, to the
+     * given string, for saving in an AvroFile. Segments name their reference
+     * sequences, looked up by number in the given names, instead of numbering
+     * them, so each record stands on its own.
+     */
+    static void appendAvroRead(std::string& out, const std::string& name,
+        size_t length, const std::vector<Segment>& segments,
+        const std::vector<std::string>& referenceNames);
+
+    /**
+     * What Avro schema do read records have? It is ReadAlignment in
+     * src/main/avro/alignment.avdl.
+     */
+    static const std::string AVRO_SCHEMA;
+
+    /**
+     * What version of the format do we read and write?
+     */
+    static const uint64_t VERSION = 2;
+
+protected:
+    /**
+     * What word starts an alignment file?
+     */
+    static const uint64_t MAGIC = 0x314e474c41444d46ULL;
+
+    /**
+     * Append a word to the given string.
+     */
+    static void appendWord(std::string& out, uint64_t word);
+
+    /**
+     * Append a string, as its length and then its bytes padded out to a whole
+     * number of words, to the given string.
+     */
+    static void appendString(std::string& out, const std::string& text);
+
+    /**
+     * Read a word. Returns false if we're at the end of the file.
+     */
+    bool readWord(uint64_t& word);
+
+    /**
+     * How many bytes of padding come after a string of the given length?
+     */
+    static inline size_t getPadding(size_t length) {
+        return (sizeof(uint64_t) - length % sizeof(uint64_t)) %
+            sizeof(uint64_t);
+    }
+
+    /**
+     * Read the bytes and padding of a string of the given length saved by
+     * appendString(), after its length has been read. Returns false if the
+     * file ends before it is all there.
+     */
+    bool readString(std::string& text, size_t length);
+
+    // Holds the file we read from.
+    std::ifstream file;
+
+    // Holds the names of the reference sequences.
+    std::vector<std::string> referenceNames;
+
+    // Holds the name of the file, for error messages.
+    std::string filename;
+
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdexcept>
+#include <random>
+
+#include <zlib.h>
+
+#include "AvroFile.hpp"
+
+/**
+ * What bytes start a container file?
+ */
+static const std::string MAGIC("Obj\x01", 4);
+
+/**
+ * Compress the given data with raw deflate, as Avro's deflate codec wants.
+ */
+static std::string deflateRaw(const std::string& data) {
+    z_stream stream = z_stream();
+    // Negative window bits mean no zlib header or checksum.
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+        Z_DEFAULT_STRATEGY) != Z_OK) {
+
+        throw std::runtime_error("Could not start deflate");
+    }
+
+    std::string compressed(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = (Bytef*) data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*) &compressed[0];
+    stream.avail_out = compressed.size();
+
+    // The output is big enough to take it all in one go.
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    if(result != Z_STREAM_END) {
+        throw std::runtime_error("Could not deflate Avro block");
+    }
+    return compressed;
+}
+
+/**
+ * Decompress the given raw deflate data.
+ */
+static std::string inflateRaw(const std::string& data) {
+    z_stream stream = z_stream();
+    if(inflateInit2(&stream, -15) != Z_OK) {
+        throw std::runtime_error("Could not start inflate");
+    }
+
+    stream.next_in = (Bytef*) data.data();
+    stream.avail_in = data.size();
+
+    // We don't know how big it will be, so grow the output as we go.
+    std::string inflated(data.size() * 4 + 64, '\0');
+    int result = Z_OK;
+    while(result == Z_OK) {
+        if(stream.total_out == inflated.size()) {
+            inflated.resize(inflated.size() * 2);
+        }
+        stream.next_out = (Bytef*) &inflated[stream.total_out];
+        stream.avail_out = inflated.size() - stream.total_out;
+        result = inflate(&stream, Z_NO_FLUSH);
+    }
+    inflated.resize(stream.total_out);
+    inflateEnd(&stream);
+    if(result != Z_STREAM_END) {
+        throw std::runtime_error("Could not inflate Avro block");
+    }
+    return inflated;
+}
+
+AvroFile::AvroFile(const std::string& filename):
+    file(filename.c_str(), std::ios::binary), schema(), codec("null"),
+    sync(), filename(filename) {
+
+    std::string magic;
+    if(!readFileBytes(magic, MAGIC.size()) || magic != MAGIC) {
+        throw std::runtime_error("Bad Avro file " + filename);
+    }
+
+    // Read the metadata map, which is in blocks like an array. A negative
+    // count means the block's size in bytes comes next, which we don't need.
+    int64_t count;
+    do {
+        if(!readFileLong(count)) {
+            throw std::runtime_error("Bad Avro file " + filename);
+        }
+        if(count < 0) {
+            int64_t size;
+            if(!readFileLong(size)) {
+                throw std::runtime_error("Bad Avro file " + filename);
+            }
+            count = -count;
+        }
+        for(int64_t i = 0; i < count; i++) {
+            int64_t keyLength;
+            int64_t valueLength;
+            std::string key;
+            std::string value;
+            if(!readFileLong(keyLength) || !readFileBytes(key, keyLength) ||
+                !readFileLong(valueLength) ||
+                !readFileBytes(value, valueLength)) {
+
+                throw std::runtime_error("Bad Avro file " + filename);
+            }
+            if(key == "avro.schema") {
+                schema = value;
+            } else if(key == "avro.codec") {
+                codec = value;
+            }
+        }
+    } while(count != 0);
+
+    if(!readFileBytes(sync, SYNC_SIZE)) {
+        throw std::runtime_error("Bad Avro file " + filename);
+    }
+
+    if(codec != "null" && codec != "deflate") {
+        throw std::runtime_error("Unsupported Avro codec " + codec + " in " +
+            filename);
+    }
+}
+
+bool AvroFile::nextBlock(std::string& records, size_t& count) {
+    int64_t blockCount;
+    if(!readFileLong(blockCount)) {
+        // There are no more blocks.
+        return false;
+    }
+
+    // Now everything else in the block has to be there.
+    int64_t size;
+    std::string data;
+    std::string blockSync;
+    if(blockCount < 0 || !readFileLong(size) || size < 0 ||
+        !readFileBytes(data, size) || !readFileBytes(blockSync, SYNC_SIZE)) {
+
+        throw std::runtime_error("Truncated Avro file " + filename);
+    }
+    if(blockSync != sync) {
+        throw std::runtime_error("Bad sync marker in Avro file " + filename);
+    }
+
+    records = codec == "deflate" ? inflateRaw(data) : std::move(data);
+    count = blockCount;
+    return true;
+}
+
+std::string AvroFile::makeSync() {
+    std::random_device random;
+    std::string marker;
+    for(size_t i = 0; i < SYNC_SIZE; i++) {
+        marker.push_back((char) random());
+    }
+    return marker;
+}
+
+std::string AvroFile::makeHeader(const std::string& schema,
+    const std::string& sync, bool deflate) {
+
+    std::string header = MAGIC;
+    // The metadata map is a single block of two entries.
+    appendLong(header, 2);
+    appendString(header, "avro.schema");
+    appendString(header, schema);
+    appendString(header, "avro.codec");
+    appendString(header, deflate ? "deflate" : "null");
+    appendLong(header, 0);
+    header += sync;
+    return header;
+}
+
+void AvroFile::appendBlock(std::string& out, size_t count,
+    const std::string& records, const std::string& sync, bool deflate) {
+
+    if(count == 0) {
+        // Readers can cope with empty blocks, but there's no point.
+        return;
+    }
+
+    appendLong(out, count);
+    if(deflate) {
+        std::string compressed = deflateRaw(records);
+        appendString(out, compressed);
+    } else {
+        appendString(out, records);
+    }
+    out += sync;
+}
+
+void AvroFile::appendLong(std::string& out, int64_t value) {
+    // Zig-zag encode, so small negative numbers are small too.
+    uint64_t encoded = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    // Then send 7 bits at a time, low bits first, with the high bit set on all
+    // but the last byte.
+    while(encoded >= 0x80) {
+        out.push_back((char) ((encoded & 0x7F) | 0x80));
+        encoded >>= 7;
+    }
+    out.push_back((char) encoded);
+}
+
+void AvroFile::appendBoolean(std::string& out, bool value) {
+    out.push_back(value ? 1 : 0);
+}
+
+void AvroFile::appendString(std::string& out, const std::string& text) {
+    appendLong(out, text.size());
+    out += text;
+}
+
+int64_t AvroFile::readLong(const std::string& in, size_t& position) {
+    uint64_t encoded = 0;
+    for(size_t shift = 0; shift < 64; shift += 7) {
+        if(position >= in.size()) {
+            throw std::runtime_error("Avro data ends in a long");
+        }
+        uint8_t byte = in[position++];
+        encoded |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            // Undo the zig-zag.
+            return (int64_t) (encoded >> 1) ^ -(int64_t) (encoded & 1);
+        }
+    }
+    throw std::runtime_error("Avro long is too long");
+}
+
+bool AvroFile::readBoolean(const std::string& in, size_t& position) {
+    if(position >= in.size()) {
+        throw std::runtime_error("Avro data ends in a boolean");
+    }
+    return in[position++] != 0;
+}
+
+std::string AvroFile::readString(const std::string& in, size_t& position) {
+    int64_t length = readLong(in, position);
+    if(length < 0 || (size_t) length > in.size() - position) {
+        throw std::runtime_error("Avro data ends in a string");
+    }
+    std::string text = in.substr(position, length);
+    position += length;
+    return text;
+}
+
+bool AvroFile::readFileLong(int64_t& value) {
+    uint64_t encoded = 0;
+    for(size_t shift = 0; shift < 64; shift += 7) {
+        char byte;
+        if(!file.get(byte)) {
+            return false;
+        }
+        encoded |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            value = (int64_t) (encoded >> 1) ^ -(int64_t) (encoded & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AvroFile::readFileBytes(std::string& bytes, size_t length) {
+    bytes.assign(length, '\0');
+    return length == 0 || file.read(&bytes[0], length);
+}
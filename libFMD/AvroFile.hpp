@@ -0,0 +1,148 @@
+#ifndef AVROFILE_HPP
+#define AVROFILE_HPP
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+/**
+ * Reads and writes Avro object container files, so that the native tools can
+ * hand records straight to Spark jobs (which read them with the schemas in
+ * src/main/avro) without anyone parsing text.
+ *
+ * A container starts with a header: the bytes "Obj" and 1, a metadata map
+ * giving the writer's schema as JSON ("avro.schema") and the compression codec
+ * ("avro.codec"), and a 16-byte sync marker picked at random for the file.
+ * Then come blocks of records, each a count of records, the size in bytes of
+ * the (possibly compressed) records, the records themselves, and the sync
+ * marker again. We write the "deflate" codec (raw deflate, with no zlib
+ * header), or "null" for no compression, and read both.
+ *
+ * Records are encoded with Avro's binary encoding, which the static append and
+ * read functions here implement for the types we use: longs (and ints) are
+ * zig-zag variable-length integers, booleans are single bytes, strings are a
+ * long length and then their bytes, unions are the long index of the branch
+ * used and then its value, and arrays are blocks of items, each a long count
+ * and then the items, ended by a count of 0.
+ *
+ * Like AlignmentFile, writing is done by appending to strings, so threads can
+ * encode and compress whole blocks themselves, and one writer thread can save
+ * them in order.
+ */
+class AvroFile {
+
+public:
+    /**
+     * Open the given container file for reading. Throws a std::runtime_error
+     * if it isn't an Avro container, or uses a codec we don't know.
+     */
+    AvroFile(const std::string& filename);
+
+    /**
+     * Get the JSON schema the records were written with.
+     */
+    inline const std::string& getSchema() const {
+        return schema;
+    }
+
+    /**
+     * Get the name of the codec the blocks are compressed with.
+     */
+    inline const std::string& getCodec() const {
+        return codec;
+    }
+
+    /**
+     * Read the next block, filling in its uncompressed records and how many
+     * there are. Returns false, without touching them, if there are no more
+     * blocks. Throws a std::runtime_error if the file is cut off, or the block
+     * doesn't end with the file's sync marker.
+     */
+    bool nextBlock(std::string& records, size_t& count);
+
+    /**
+     * Make a new random sync marker for a file.
+     */
+    static std::string makeSync();
+
+    /**
+     * Make the header for a container of records with the given JSON schema,
+     * with the given sync marker, and blocks compressed with deflate or not.
+     */
+    static std::string makeHeader(const std::string& schema,
+        const std::string& sync, bool deflate = true);
+
+    /**
+     * Append a block holding the given number of encoded records to the given
+     * string, compressing them with deflate if asked, and ending it with the
+     * given sync marker. Does nothing if there are no records.
+     */
+    static void appendBlock(std::string& out, size_t count,
+        const std::string& records, const std::string& sync,
+        bool deflate = true);
+
+    /**
+     * Append a long (or int) to the given string.
+     */
+    static void appendLong(std::string& out, int64_t value);
+
+    /**
+     * Append a boolean to the given string.
+     */
+    static void appendBoolean(std::string& out, bool value);
+
+    /**
+     * Append a string (or bytes) to the given string.
+     */
+    static void appendString(std::string& out, const std::string& text);
+
+    /**
+     * Read a long from the given encoded data at the given position, and move
+     * the position past it. Throws a std::runtime_error if the data runs out.
+     */
+    static int64_t readLong(const std::string& in, size_t& position);
+
+    /**
+     * Read a boolean, like readLong().
+     */
+    static bool readBoolean(const std::string& in, size_t& position);
+
+    /**
+     * Read a string, like readLong().
+     */
+    static std::string readString(const std::string& in, size_t& position);
+
+    /**
+     * How many bytes are in a sync marker?
+     */
+    static const size_t SYNC_SIZE = 16;
+
+protected:
+    /**
+     * Read a long straight from the file. Returns false if the file ends
+     * before it does.
+     */
+    bool readFileLong(int64_t& value);
+
+    /**
+     * Read the given number of bytes straight from the file. Returns false if
+     * the file ends first.
+     */
+    bool readFileBytes(std::string& bytes, size_t length);
+
+    // Holds the file we read from.
+    std::ifstream file;
+
+    // Holds the schema and codec from the header.
+    std::string schema;
+    std::string codec;
+
+    // Holds the sync marker that ends every block.
+    std::string sync;
+
+    // Holds the name of the file, for error messages.
+    std::string filename;
+
+};
+
+#endif
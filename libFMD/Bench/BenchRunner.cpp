@@ -0,0 +1,374 @@
+// BenchRunner.cpp: Micro-benchmarks for the FMD index primitives. Builds an
+// index over the FASTAs given on the command line, and another over a
+// synthetic repetitive text, and times each primitive over random queries,
+// reporting nanoseconds and (where the kernel lets us count them) last-level
+// cache misses per operation.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndex.hpp"
+#include "../FMDIndexBuilder.hpp"
+#include "../GenericBitVector.hpp"
+#include "../IntervalIndex.hpp"
+#include "../util.hpp"
+
+/**
+ * How many random queries should each benchmark run?
+ */
+static const size_t QUERIES = 1000000;
+
+/**
+ * How many patterns should the search benchmarks search for?
+ */
+static const size_t PATTERNS = 100000;
+
+/**
+ * How long is each search pattern?
+ */
+static const size_t PATTERN_LENGTH = 20;
+
+/**
+ * How long is the unit that the synthetic text repeats?
+ */
+static const size_t REPEAT_UNIT = 10000;
+
+/**
+ * How many mutated copies of the unit make up the synthetic text?
+ */
+static const size_t REPEAT_COPIES = 200;
+
+/**
+ * Counts hardware cache misses on the calling thread, if the kernel will let
+ * us. Counting isn't allowed in many containers and VMs, in which case
+ * isAvailable() is false and nothing is counted.
+ */
+class CacheMissCounter {
+public:
+    CacheMissCounter(): fd(-1) {
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        fd = syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+    }
+
+    ~CacheMissCounter() {
+        if(fd != -1) {
+            close(fd);
+        }
+    }
+
+    bool isAvailable() const {
+        return fd != -1;
+    }
+
+    void start() {
+        if(fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    /**
+     * Stop counting and return the number of misses since start().
+     */
+    uint64_t stop() {
+        uint64_t count = 0;
+        if(fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if(read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+// Everything we compute gets added in here, so the compiler can't throw any
+// of the work away.
+static volatile size_t sink = 0;
+
+/**
+ * Run the given operation on each number from 0 to count - 1, and report the
+ * time and cache misses per operation under the given name.
+ */
+static void bench(const std::string& name, size_t count,
+    const std::function<size_t(size_t)>& operation) {
+
+    static CacheMissCounter misses;
+
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    misses.start();
+    for(size_t i = 0; i < count; i++) {
+        checksum += operation(i);
+    }
+    uint64_t missCount = misses.stop();
+    auto end = std::chrono::steady_clock::now();
+    sink += checksum;
+
+    double nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end - start).count();
+
+    std::cout << std::left << std::setw(40) << name << std::right <<
+        std::fixed << std::setprecision(1) << std::setw(12) <<
+        nanoseconds / count << " ns/op";
+    if(misses.isAvailable()) {
+        std::cout << std::setw(12) << std::setprecision(3) <<
+            (double) missCount / count << " misses/op";
+    } else {
+        std::cout << std::setw(12) << "-" << " misses/op";
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Write a synthetic repetitive genome to the given FASTA: mutated copies of
+ * one random unit, so most of it is in long inexact repeats.
+ */
+static void writeRepetitiveText(const std::string& filename) {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<size_t> base(0, 3);
+    std::uniform_int_distribution<size_t> mutate(0, 99);
+
+    std::string unit(REPEAT_UNIT, 'A');
+    for(char& c : unit) {
+        c = "ACGT"[base(random)];
+    }
+
+    std::ofstream fasta(filename);
+    fasta << ">repetitive" << std::endl;
+    for(size_t copy = 0; copy < REPEAT_COPIES; copy++) {
+        std::string mutated = unit;
+        for(char& c : mutated) {
+            if(mutate(random) == 0) {
+                // Change 1% of bases in each copy.
+                c = "ACGT"[base(random)];
+            }
+        }
+        fasta << mutated << std::endl;
+    }
+}
+
+/**
+ * Run all the index benchmarks against the given index, labeling them with the
+ * given name.
+ */
+static void benchIndex(const std::string& label, const FMDIndex& index) {
+    std::cout << "Index " << label << ": " << index.getTotalLength() <<
+        " bases, " << index.getNumberOfContigs() << " contigs" << std::endl;
+
+    std::mt19937 random(2);
+
+    // Pick random BWT positions to look at.
+    std::uniform_int_distribution<int64_t> bwtIndex(0,
+        index.getBWTLength() - 1);
+    std::vector<int64_t> positions(QUERIES);
+    for(auto& position : positions) {
+        position = bwtIndex(random);
+    }
+
+    // Pull out patterns that occur in the index, from random contigs and
+    // offsets. Contigs shorter than a pattern are skipped.
+    std::vector<std::string> patterns;
+    std::uniform_int_distribution<size_t> contigIndex(0,
+        index.getNumberOfContigs() - 1);
+    for(size_t tries = 0; patterns.size() < PATTERNS &&
+        tries < PATTERNS * 10; tries++) {
+
+        size_t contig = contigIndex(random);
+        size_t length = index.getContigLength(contig);
+        if(length < PATTERN_LENGTH) {
+            continue;
+        }
+        size_t offset = std::uniform_int_distribution<size_t>(0,
+            length - PATTERN_LENGTH)(random);
+        std::string pattern;
+        for(size_t i = 0; i < PATTERN_LENGTH; i++) {
+            pattern.push_back(index.display(contig, offset + i));
+        }
+        patterns.push_back(pattern);
+    }
+
+    if(patterns.empty()) {
+        std::cout << "No contigs long enough to search" << std::endl;
+    } else {
+        // Do a whole backward search per pattern, and count each extension as
+        // one operation.
+        bench(label + " extendFast", patterns.size(), [&](size_t i) {
+            const std::string& pattern = patterns[i];
+            FMDPosition range = index.getCharPosition(pattern.back());
+            for(size_t j = pattern.size() - 1; j-- > 0;) {
+                index.extendFast(range, pattern[j], true);
+            }
+            return range.getLength();
+        });
+
+        bench(label + " extend", patterns.size(), [&](size_t i) {
+            const std::string& pattern = patterns[i];
+            FMDPosition range = index.getCharPosition(pattern.back());
+            for(size_t j = pattern.size() - 1; j-- > 0;) {
+                range = index.extend(range, pattern[j], true);
+            }
+            return range.getLength();
+        });
+
+        // Search everything once, and then time retracting each back to its
+        // parent suffix tree node.
+        std::vector<FMDPosition> found;
+        for(const std::string& pattern : patterns) {
+            FMDPosition range = index.getCharPosition(pattern.back());
+            for(size_t j = pattern.size() - 1; j-- > 0;) {
+                index.extendFast(range, pattern[j], true);
+            }
+            found.push_back(range);
+        }
+        bench(label + " retractRightOnly", found.size(), [&](size_t i) {
+            FMDPosition range = found[i];
+            return index.retractRightOnly(range);
+        });
+    }
+
+    bench(label + " locate", positions.size(), [&](size_t i) {
+        return index.locate(positions[i]).getOffset();
+    });
+
+    bench(label + " display", positions.size(), [&](size_t i) {
+        return (size_t) index.display(positions[i]);
+    });
+
+    bench(label + " getLF", positions.size(), [&](size_t i) {
+        return (size_t) index.getLF(positions[i]);
+    });
+
+    bench(label + " getLCPPSV", positions.size(), [&](size_t i) {
+        return index.getLCPPSV(positions[i]);
+    });
+
+    bench(label + " getLCPNSV", positions.size(), [&](size_t i) {
+        return index.getLCPNSV(positions[i]);
+    });
+}
+
+/**
+ * Benchmark the standalone structures: GenericBitVector and IntervalIndex.
+ */
+static void benchStructures() {
+    std::mt19937 random(3);
+
+    // Make a bitvector with about 1 bit in 8 set, like a sampled suffix array.
+    const size_t bits = QUERIES * 16;
+    GenericBitVector bitvector;
+    size_t ones = 0;
+    for(size_t i = 0; i < bits; i++) {
+        if(random() % 8 == 0) {
+            bitvector.addBit(i);
+            ones++;
+        }
+    }
+    bitvector.finish(bits);
+
+    std::vector<size_t> indices(QUERIES);
+    std::vector<size_t> ranks(QUERIES);
+    for(size_t i = 0; i < QUERIES; i++) {
+        indices[i] = random() % bits;
+        ranks[i] = random() % ones;
+    }
+
+    bench("GenericBitVector rank", QUERIES, [&](size_t i) {
+        return bitvector.rank(indices[i]);
+    });
+
+    bench("GenericBitVector select", QUERIES, [&](size_t i) {
+        return bitvector.select(ranks[i]);
+    });
+
+    // Make an IntervalIndex of back-to-back intervals of random lengths, like
+    // the merged ranges of a level.
+    std::vector<std::pair<std::pair<size_t, size_t>, size_t>> intervals;
+    size_t start = 0;
+    for(size_t i = 0; i < QUERIES; i++) {
+        size_t length = random() % 32 + 1;
+        intervals.push_back({{start, length}, i});
+        start += length;
+    }
+    IntervalIndex<size_t> intervalIndex(intervals);
+
+    for(auto& index : indices) {
+        index = index % start;
+    }
+
+    bench("IntervalIndex getStartingBefore", QUERIES, [&](size_t i) {
+        return intervalIndex.getStartingBefore(indices[i]).second;
+    });
+
+    bench("IntervalIndex getEndingAfter", QUERIES, [&](size_t i) {
+        return intervalIndex.hasEndingAfter(indices[i]) ?
+            intervalIndex.getEndingAfter(indices[i]).second : 0;
+    });
+}
+
+/**
+ * Build an index over the given FASTAs in the given directory, and load it
+ * back without the full suffix array, the way it would be used.
+ */
+static FMDIndex* buildIndex(const std::string& basename,
+    const std::vector<std::string>& fastas) {
+
+    FMDIndexBuilder builder(basename);
+    builder.addAll(fastas);
+    delete builder.build();
+    return new FMDIndex(basename);
+}
+
+/**
+ * Main function: build the indexes and run all the benchmarks. Takes the
+ * FASTAs to index as arguments.
+ */
+int main(int argc, char** argv) {
+    std::vector<std::string> fastas(argv + 1, argv + argc);
+
+    // Keep the indexes in a temporary directory.
+    std::string tempDir = make_tempdir();
+
+    if(!fastas.empty()) {
+        FMDIndex* index = buildIndex(tempDir + "/given", fastas);
+        benchIndex("given", *index);
+        delete index;
+    }
+
+    writeRepetitiveText(tempDir + "/repetitive.fa");
+    FMDIndex* index = buildIndex(tempDir + "/repetitive",
+        {tempDir + "/repetitive.fa"});
+    benchIndex("repetitive", *index);
+    delete index;
+
+    benchStructures();
+
+    boost::filesystem::remove_all(tempDir);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+// MappingBench.cpp: End-to-end mapping throughput benchmark. Indexes the
+// reference FASTAs given on the command line, shreds them into a fixed set of
+// mutated reads, and maps the reads with each mapping scheme configuration at
+// each thread count. Results go to a JSON file that
+// scripts/compareBenchmarks.py can compare between commits.
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndex.hpp"
+#include "../FMDIndexBuilder.hpp"
+#include "../FMDIndexView.hpp"
+#include "../FMDPositionGroup.hpp"
+#include "../NaturalMappingScheme.hpp"
+#include "../ZipMappingScheme.hpp"
+#include "../util.hpp"
+
+/**
+ * How many reads should we map?
+ */
+static const size_t READS = 2000;
+
+/**
+ * How long is each read?
+ */
+static const size_t READ_LENGTH = 150;
+
+/**
+ * One in how many read bases should be changed, so credit and mismatch
+ * tolerance have something to do?
+ */
+static const size_t MUTATION_RATE = 100;
+
+/**
+ * Describes one way of mapping to benchmark.
+ */
+struct BenchScheme {
+    // What is it called in the results?
+    std::string name;
+    // How do we make it for an index?
+    std::function<MappingScheme*(const FMDIndex&)> make;
+};
+
+/**
+ * Shred the indexed contigs into the benchmark's reads, with a fixed seed so
+ * every run maps the same reads.
+ */
+static std::vector<std::string> makeReads(const FMDIndex& index) {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<size_t> contigIndex(0,
+        index.getNumberOfContigs() - 1);
+    std::uniform_int_distribution<size_t> mutate(0, MUTATION_RATE - 1);
+    std::uniform_int_distribution<size_t> base(0, 3);
+
+    std::vector<std::string> reads;
+    for(size_t tries = 0; reads.size() < READS && tries < READS * 10;
+        tries++) {
+
+        size_t contig = contigIndex(random);
+        size_t length = index.getContigLength(contig);
+        if(length < READ_LENGTH) {
+            continue;
+        }
+        size_t offset = std::uniform_int_distribution<size_t>(0,
+            length - READ_LENGTH)(random);
+
+        std::string read;
+        for(size_t i = 0; i < READ_LENGTH; i++) {
+            char c = index.display(contig, offset + i);
+            if(mutate(random) == 0) {
+                c = "ACGT"[base(random)];
+            }
+            read.push_back(c);
+        }
+        reads.push_back(read);
+    }
+    return reads;
+}
+
+/**
+ * Make all the scheme configurations to benchmark: each scheme with and
+ * without credit, and the zip scheme with mismatch tolerance.
+ */
+static std::vector<BenchScheme> makeSchemes() {
+    std::vector<BenchScheme> schemes;
+
+    for(bool credit : {false, true}) {
+        std::string suffix = credit ? "-credit" : "";
+
+        schemes.push_back({"zip" + suffix, [credit](const FMDIndex& index) {
+            auto scheme = new ZipMappingScheme<FMDPosition>(
+                FMDIndexView(index));
+            scheme->credit.enabled = credit;
+            scheme->credit.maxMismatches = 1;
+            return (MappingScheme*) scheme;
+        }});
+
+        schemes.push_back({"zipMismatch" + suffix,
+            [credit](const FMDIndex& index) {
+
+            auto scheme = new ZipMappingScheme<FMDPositionGroup>(
+                FMDIndexView(index));
+            scheme->mismatchTolerance = 1;
+            scheme->credit.enabled = credit;
+            scheme->credit.maxMismatches = 1;
+            return (MappingScheme*) scheme;
+        }});
+
+        schemes.push_back({"natural" + suffix,
+            [credit](const FMDIndex& index) {
+
+            auto scheme = new NaturalMappingScheme(FMDIndexView(index));
+            scheme->credit = credit;
+            scheme->z_max = 1;
+            return (MappingScheme*) scheme;
+        }});
+    }
+
+    return schemes;
+}
+
+/**
+ * Map all the reads with the given scheme on the given number of threads.
+ * Returns the number of bases mapped, and puts the elapsed seconds in the
+ * given variable.
+ */
+static size_t mapAll(const MappingScheme& scheme,
+    const std::vector<std::string>& reads, size_t numThreads,
+    double& seconds) {
+
+    std::atomic<size_t> nextRead(0);
+    std::atomic<size_t> mappedBases(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < numThreads; i++) {
+        threads.emplace_back([&]() {
+            size_t mapped = 0;
+            for(size_t read = nextRead++; read < reads.size();
+                read = nextRead++) {
+
+                scheme.map(reads[read], [&](size_t, TextPosition) {
+                    mapped++;
+                });
+            }
+            mappedBases += mapped;
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    return mappedBases.load();
+}
+
+/**
+ * Get the peak resident set size of the process so far, in kilobytes.
+ */
+static size_t getPeakRSS() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * Main function: takes the JSON file to write and then the reference FASTAs.
+ */
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " results.json reference.fa "
+            "[reference.fa...]" << std::endl;
+        return 1;
+    }
+
+    std::string resultsFilename = argv[1];
+    std::vector<std::string> fastas(argv + 2, argv + argc);
+
+    // Build the index in a temporary directory, and load it back without the
+    // full suffix array.
+    std::string tempDir = make_tempdir();
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.addAll(fastas);
+    delete builder.build();
+    FMDIndex index(tempDir + "/index.basename");
+
+    std::vector<std::string> reads = makeReads(index);
+    size_t totalBases = reads.size() * READ_LENGTH;
+
+    // Use 1 thread, then double up to all the cores.
+    std::vector<size_t> threadCounts;
+    size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    for(size_t threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::ofstream results(resultsFilename);
+    results << "{" << std::endl;
+    results << "  \"reads\": " << reads.size() << "," << std::endl;
+    results << "  \"readLength\": " << READ_LENGTH << "," << std::endl;
+    results << "  \"referenceBases\": " << index.getTotalLength() << "," <<
+        std::endl;
+    results << "  \"runs\": [" << std::endl;
+
+    bool first = true;
+    for(const BenchScheme& benchScheme : makeSchemes()) {
+        std::unique_ptr<MappingScheme> scheme(benchScheme.make(index));
+
+        double baseline = 0;
+        for(size_t threads : threadCounts) {
+            double seconds;
+            size_t mapped = mapAll(*scheme, reads, threads, seconds);
+            double basesPerSecond = totalBases / seconds;
+            if(threads == 1) {
+                baseline = basesPerSecond;
+            }
+            // How close to linear is the speedup?
+            double efficiency = basesPerSecond / (baseline * threads);
+
+            std::cout << benchScheme.name << "\t" << threads << " threads\t" <<
+                (size_t) basesPerSecond << " bases/s\t" << efficiency <<
+                " efficiency\t" << mapped << "/" << totalBases <<
+                " mapped" << std::endl;
+
+            results << (first ? "" : ",\n") << "    {\"scheme\": \"" <<
+                benchScheme.name << "\", \"threads\": " << threads <<
+                ", \"basesPerSecond\": " << basesPerSecond <<
+                ", \"efficiency\": " << efficiency <<
+                ", \"mappedBases\": " << mapped <<
+                ", \"peakRSSKB\": " << getPeakRSS() << "}";
+            first = false;
+        }
+    }
+
+    results << std::endl << "  ]" << std::endl << "}" << std::endl;
+    results.close();
+
+    boost::filesystem::remove_all(tempDir);
+
+    return 0;
+}
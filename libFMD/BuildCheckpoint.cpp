@@ -0,0 +1,186 @@
+#include "BuildCheckpoint.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+
+#include "Log.hpp"
+
+BuildCheckpoint::BuildCheckpoint(const std::string& basename):
+    manifestName(basename + ".manifest"), fingerprint(crc32(0L, Z_NULL, 0)),
+    stages(), checked(0) {
+    
+    // Nothing to do
+}
+
+void BuildCheckpoint::addInput(const std::string& description) {
+    // End each description so "ab" + "c" differs from "a" + "bc".
+    std::string terminated = description + '\n';
+    fingerprint = crc32(fingerprint, (const Bytef*) terminated.data(),
+        terminated.size());
+}
+
+void BuildCheckpoint::addInputFile(const std::string& filename) {
+    std::stringstream description;
+    description << "file " << filename;
+    if(boost::filesystem::exists(filename)) {
+        description << " " << boost::filesystem::file_size(filename) << " " <<
+            boost::filesystem::last_write_time(filename);
+    }
+    addInput(description.str());
+}
+
+void BuildCheckpoint::load() {
+    stages.clear();
+    checked = 0;
+    
+    std::ifstream manifest(manifestName.c_str());
+    if(!manifest.good()) {
+        // No earlier run got anywhere.
+        return;
+    }
+    
+    // The manifest starts with "fingerprint <crc>", and then has a "stage
+    // <name> <file count>" line for each stage, followed by a "<size> <crc>
+    // <name>" line for each of its files.
+    std::string keyword;
+    uint32_t oldFingerprint;
+    if(!(manifest >> keyword >> oldFingerprint) || keyword != "fingerprint" ||
+        oldFingerprint != fingerprint) {
+        
+        Log::info() << "Not resuming from " << manifestName <<
+            ": inputs or options have changed" << std::endl;
+        return;
+    }
+    
+    Stage stage;
+    size_t fileCount;
+    while(manifest >> keyword >> stage.name >> fileCount &&
+        keyword == "stage") {
+        
+        bool intact = true;
+        stage.files.clear();
+        for(size_t i = 0; i < fileCount; i++) {
+            File file;
+            if(!(manifest >> file.size >> file.crc) ||
+                !std::getline(manifest >> std::ws, file.name)) {
+                
+                // The manifest is cut off.
+                intact = false;
+                break;
+            }
+            
+            // Make sure the file is still what the stage left.
+            uint64_t size;
+            if(!boost::filesystem::exists(file.name) ||
+                checksum(file.name, size) != file.crc || size != file.size) {
+                
+                Log::info() << "Not resuming from " << file.name <<
+                    ": file is missing or changed" << std::endl;
+                intact = false;
+                break;
+            }
+            stage.files.push_back(file);
+        }
+        
+        if(!intact) {
+            // Later stages may depend on this one, so stop here.
+            break;
+        }
+        
+        Log::info() << "Stage " << stage.name << " already done" << std::endl;
+        stages.push_back(stage);
+    }
+}
+
+void BuildCheckpoint::clear() {
+    stages.clear();
+    checked = 0;
+    save();
+}
+
+bool BuildCheckpoint::isDone(const std::string& stage) {
+    for(size_t i = 0; i < checked; i++) {
+        if(stages[i].name == stage) {
+            // We already said this one was done.
+            return true;
+        }
+    }
+    
+    if(checked < stages.size() && stages[checked].name == stage) {
+        // This is the next stage we had finished.
+        checked++;
+        return true;
+    }
+    
+    // This stage needs to run, so forget it and everything after it.
+    if(stages.size() > checked) {
+        stages.resize(checked);
+        save();
+    }
+    return false;
+}
+
+std::string BuildCheckpoint::partial(const std::string& filename) {
+    return filename + ".partial";
+}
+
+void BuildCheckpoint::commit(const std::string& stage,
+    const std::vector<std::string>& filenames) {
+    
+    Stage finished;
+    finished.name = stage;
+    for(const std::string& filename : filenames) {
+        // Move each file into place.
+        boost::filesystem::rename(partial(filename), filename);
+        
+        File file;
+        file.name = filename;
+        file.crc = checksum(filename, file.size);
+        finished.files.push_back(file);
+    }
+    
+    stages.push_back(finished);
+    checked = stages.size();
+    save();
+}
+
+uint32_t BuildCheckpoint::checksum(const std::string& filename,
+    uint64_t& size) {
+    
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if(!file.good()) {
+        throw std::runtime_error("Could not read " + filename);
+    }
+    
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    size = 0;
+    std::vector<char> buffer(1 << 20);
+    while(file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+        crc = crc32(crc, (const Bytef*) buffer.data(), file.gcount());
+        size += file.gcount();
+    }
+    return crc;
+}
+
+void BuildCheckpoint::save() const {
+    // Write the whole manifest aside and then swap it in, so it is never half
+    // written.
+    std::string tempName = partial(manifestName);
+    std::ofstream manifest(tempName.c_str());
+    manifest << "fingerprint " << fingerprint << std::endl;
+    for(const Stage& stage : stages) {
+        manifest << "stage " << stage.name << " " << stage.files.size() <<
+            std::endl;
+        for(const File& file : stage.files) {
+            manifest << file.size << " " << file.crc << " " << file.name <<
+                std::endl;
+        }
+    }
+    manifest.close();
+    
+    boost::filesystem::rename(tempName, manifestName);
+}
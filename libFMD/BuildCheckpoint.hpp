@@ -0,0 +1,120 @@
+#ifndef BUILDCHECKPOINT_HPP
+#define BUILDCHECKPOINT_HPP
+// BuildCheckpoint.hpp: Defines a class for resuming interrupted index builds.
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Keeps track of which stages of an index build have finished, in a manifest
+ * file next to the index, so a rerun of the same build can skip them.
+ *
+ * Each stage writes its files under partial names, and commits them by renaming
+ * them into place and recording their sizes and CRC32s in the manifest, which
+ * is itself replaced atomically. A fingerprint of the build's inputs and
+ * options heads the manifest; if it doesn't match, nothing is resumed.
+ *
+ * Stages must be checked with isDone() in the order they run. Once a stage is
+ * found not done, it and every stage after it are forgotten, since they may
+ * depend on it.
+ */
+class BuildCheckpoint {
+public:
+    /**
+     * Make a checkpoint for the index with the given basename, with an empty
+     * fingerprint.
+     */
+    BuildCheckpoint(const std::string& basename);
+    
+    /**
+     * Fold something that affects the build's output, like an option value or
+     * an input file, into the fingerprint.
+     */
+    void addInput(const std::string& description);
+    
+    /**
+     * Fold an input file into the fingerprint, by name, size and modification
+     * time.
+     */
+    void addInputFile(const std::string& filename);
+    
+    /**
+     * Read the manifest, if there is one with a matching fingerprint, and keep
+     * the stages at the start of it whose files are all still intact.
+     */
+    void load();
+    
+    /**
+     * Forget all finished stages, and start a fresh manifest.
+     */
+    void clear();
+    
+    /**
+     * Return true if the given stage finished in an earlier run (or this one).
+     * If it didn't, it and all later stages are forgotten.
+     */
+    bool isDone(const std::string& stage);
+    
+    /**
+     * Get the name to write the given file under until its stage is committed.
+     */
+    static std::string partial(const std::string& filename);
+    
+    /**
+     * Finish a stage, by moving the partial versions of its files into place
+     * and recording them in the manifest.
+     */
+    void commit(const std::string& stage,
+        const std::vector<std::string>& filenames);
+    
+private:
+    /**
+     * A finished file, and what it should look like.
+     */
+    struct File {
+        std::string name;
+        uint64_t size;
+        uint32_t crc;
+    };
+    
+    /**
+     * A finished stage and its files.
+     */
+    struct Stage {
+        std::string name;
+        std::vector<File> files;
+    };
+    
+    /**
+     * Compute the CRC32 of a file's contents, and get its size.
+     */
+    static uint32_t checksum(const std::string& filename, uint64_t& size);
+    
+    /**
+     * Write out the manifest with all the stages we know are done.
+     */
+    void save() const;
+    
+    /**
+     * Where is the manifest?
+     */
+    std::string manifestName;
+    
+    /**
+     * Holds the CRC32 of everything fed to addInput().
+     */
+    uint32_t fingerprint;
+    
+    /**
+     * Holds the finished stages, in the order they finished.
+     */
+    std::vector<Stage> stages;
+    
+    /**
+     * How many of the stages have been checked and found done by isDone()?
+     */
+    size_t checked;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "BuildProfiler.hpp"
+
+#include <fstream>
+#include <sstream>
+
+BuildProfiler::BuildProfiler(): stages(), running(false), current(),
+    startRSS(0), timer("build stage", true) {
+    
+    // Nothing to do
+}
+
+void BuildProfiler::start(const std::string& stage) {
+    // Finish whatever was going on before.
+    stop();
+    
+    current.name = stage;
+    current.bytesRead = getIOCount("rchar");
+    current.bytesWritten = getIOCount("wchar");
+    
+    // Make the peak start from here, so we see this stage's own peak.
+    resetPeakRSS();
+    startRSS = getStatusBytes("VmRSS");
+    
+    running = true;
+    timer.reset();
+}
+
+void BuildProfiler::stop() {
+    if(!running) {
+        return;
+    }
+    
+    current.wallSeconds = timer.getElapsedWallTime();
+    current.cpuSeconds = timer.getElapsedCPUTime();
+    
+    size_t peakRSS = getStatusBytes("VmHWM");
+    current.peakRSSDelta = (peakRSS > startRSS) ? peakRSS - startRSS : 0;
+    
+    // Turn the counters into differences.
+    current.bytesRead = getIOCount("rchar") - current.bytesRead;
+    current.bytesWritten = getIOCount("wchar") - current.bytesWritten;
+    
+    stages.push_back(current);
+    running = false;
+}
+
+void BuildProfiler::save(const std::string& basename) const {
+    std::ofstream tsv((basename + ".profile.tsv").c_str());
+    tsv << "stage\twall_seconds\tcpu_seconds\tpeak_rss_delta_bytes\t"
+        "bytes_read\tbytes_written" << std::endl;
+    for(const Stage& stage : stages) {
+        tsv << stage.name << "\t" << stage.wallSeconds << "\t" <<
+            stage.cpuSeconds << "\t" << stage.peakRSSDelta << "\t" <<
+            stage.bytesRead << "\t" << stage.bytesWritten << std::endl;
+    }
+    tsv.close();
+    
+    std::ofstream json((basename + ".profile.json").c_str());
+    json << "[" << std::endl;
+    for(size_t i = 0; i < stages.size(); i++) {
+        const Stage& stage = stages[i];
+        // Stage names can have filenames in them, so escape them.
+        std::string name;
+        for(char c : stage.name) {
+            if(c == '"' || c == '\\') {
+                name.push_back('\\');
+            }
+            name.push_back(c);
+        }
+        
+        json << "  {\"stage\": \"" << name << "\", " <<
+            "\"wall_seconds\": " << stage.wallSeconds << ", " <<
+            "\"cpu_seconds\": " << stage.cpuSeconds << ", " <<
+            "\"peak_rss_delta_bytes\": " << stage.peakRSSDelta << ", " <<
+            "\"bytes_read\": " << stage.bytesRead << ", " <<
+            "\"bytes_written\": " << stage.bytesWritten << "}" <<
+            (i + 1 < stages.size() ? "," : "") << std::endl;
+    }
+    json << "]" << std::endl;
+    json.close();
+}
+
+size_t BuildProfiler::getStatusBytes(const std::string& field) {
+    // Lines look like "VmRSS:     1234 kB"
+    std::ifstream statusStream("/proc/self/status");
+    std::string line;
+    while(std::getline(statusStream, line)) {
+        if(line.compare(0, field.size() + 1, field + ":") == 0) {
+            std::istringstream values(line.substr(field.size() + 1));
+            size_t kilobytes = 0;
+            values >> kilobytes;
+            return kilobytes * 1024;
+        }
+    }
+    return 0;
+}
+
+size_t BuildProfiler::getIOCount(const std::string& field) {
+    // Lines look like "rchar: 1234"
+    std::ifstream ioStream("/proc/self/io");
+    std::string line;
+    while(std::getline(ioStream, line)) {
+        if(line.compare(0, field.size() + 1, field + ":") == 0) {
+            std::istringstream values(line.substr(field.size() + 1));
+            size_t count = 0;
+            values >> count;
+            return count;
+        }
+    }
+    return 0;
+}
+
+void BuildProfiler::resetPeakRSS() {
+    // Writing 5 here resets VmHWM on Linux 4.0 and up. On older kernels the
+    // peak is just the process-wide one.
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5" << std::endl;
+}
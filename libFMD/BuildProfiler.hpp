@@ -0,0 +1,95 @@
+#ifndef BUILDPROFILER_HPP
+#define BUILDPROFILER_HPP
+// BuildProfiler.hpp: Defines a class for timing and measuring the stages of an
+// index build.
+
+#include <string>
+#include <vector>
+
+#include <Timer.h>
+
+/**
+ * Measures the stages of an FMDIndexBuilder run one at a time: wall time, CPU
+ * time (over all threads), how far the stage pushed peak resident memory above
+ * what was resident when it started, and how many bytes it read and wrote.
+ * Memory and I/O come from /proc/self, and read as 0 where that isn't
+ * available.
+ */
+class BuildProfiler {
+public:
+    /**
+     * Make a new BuildProfiler with no stages measured.
+     */
+    BuildProfiler();
+    
+    /**
+     * Start measuring a stage with the given name, finishing any stage that
+     * is still running first.
+     */
+    void start(const std::string& stage);
+    
+    /**
+     * Finish measuring the running stage, if there is one.
+     */
+    void stop();
+    
+    /**
+     * Save the measured stages, one per line, as a TSV with a header to
+     * <basename>.profile.tsv, and as a JSON array of objects to
+     * <basename>.profile.json. Any running stage is not included.
+     */
+    void save(const std::string& basename) const;
+    
+private:
+    /**
+     * Everything we measure about one stage.
+     */
+    struct Stage {
+        std::string name;
+        double wallSeconds;
+        double cpuSeconds;
+        // Bytes of peak RSS above the RSS when the stage started.
+        size_t peakRSSDelta;
+        size_t bytesRead;
+        size_t bytesWritten;
+    };
+    
+    /**
+     * Get a field (like "VmRSS") from /proc/self/status, in bytes.
+     */
+    static size_t getStatusBytes(const std::string& field);
+    
+    /**
+     * Get a field (like "rchar") from /proc/self/io.
+     */
+    static size_t getIOCount(const std::string& field);
+    
+    /**
+     * Reset the process's peak RSS to its current RSS, if the kernel lets us.
+     */
+    static void resetPeakRSS();
+    
+    /**
+     * Holds all the finished stages, in order.
+     */
+    std::vector<Stage> stages;
+    
+    /**
+     * Is a stage running?
+     */
+    bool running;
+    
+    /**
+     * Holds what we knew when the running stage started. Its name and counter
+     * values live in a Stage, and get replaced by differences on stop().
+     */
+    Stage current;
+    size_t startRSS;
+    
+    /**
+     * Times the running stage.
+     */
+    Timer timer;
+};
+
+#endif
@@ -7,6 +7,10 @@
 #include <iostream>
 #include <climits>
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 namespace CSA {
 
 // Stuff that used to be in RLCSA's definitions.h
@@ -38,6 +42,8 @@ const size_t MEGABYTE = 1048576;
 const size_t MILLION  = 1000000;
 const size_t WORD_BITS = CHAR_BIT * sizeof(size_t);
 const size_t WORD_MAX = ~((size_t)0);
+// The stop bit of every nibble in a word.
+const size_t NIBBLE_STOPS = 0x8888888888888888ull;
 
 // Previous GET was broken when BITS == WORD_BITS
 // Current version works for size_ts and less
@@ -162,7 +168,28 @@ class ReadBuffer
     }
 
     // Nibble code for positive integers.
+    // Codes that end in the current word are read in one go, by finding the
+    // first stop bit with a count of leading zeros.
     inline size_t readNibbleCode()
+    {
+      size_t stops = GET(this->data[this->pos], this->bits) & NIBBLE_STOPS;
+      if(stops == 0) { return this->readNibbleCodeSlowly(); }
+
+      // The first stop bit is the highest one left. Everything from there
+      // up to the read position is the code.
+      size_t end = WORD_BITS - 1 - __builtin_clzl(stops) - 3;
+      size_t count = (this->bits - end) / 4;
+      size_t code = GET(LOWER(this->data[this->pos], end), this->bits - end);
+
+      this->bits = end;
+      if(this->bits == 0) { this->pos++; this->bits = WORD_BITS; }
+
+      return gatherNibbles(code, count) + 1;
+    }
+
+    // Nibble code that may continue into the next word, read a nibble at a
+    // time.
+    inline size_t readNibbleCodeSlowly()
     {
       size_t temp, value = 0, shift = 0;
       do
@@ -176,6 +203,26 @@ class ReadBuffer
       return value + 1;
     }
 
+    // Packs the low 3 bits of each of the count nibbles in code together, with
+    // the last nibble's highest and the first nibble's lowest.
+    inline static size_t gatherNibbles(size_t code, size_t count)
+    {
+#ifdef __BMI2__
+      // Put the first nibble lowest and pull all the payloads out at once.
+      code = __builtin_bswap64(code << (WORD_BITS - 4 * count));
+      code = ((code & 0x0F0F0F0F0F0F0F0Full) << 4) |
+        ((code >> 4) & 0x0F0F0F0F0F0F0F0Full);
+      return _pext_u64(code, 0x7777777777777777ull);
+#else
+      size_t value = 0;
+      for(size_t i = 0; i < count; i++)
+      {
+        value |= ((code >> (4 * (count - 1 - i))) & 0x7) << (3 * i);
+      }
+      return value;
+#endif
+    }
+
     // This version reads the code only if value <= limit.
     inline size_t readNibbleCode(size_t limit)
     {
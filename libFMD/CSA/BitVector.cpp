@@ -1,6 +1,10 @@
 #include <cstdlib>
 
 #include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
 
 #include "BitVector.hpp"
 
@@ -35,39 +39,180 @@ BitVector::reportSize() const
   return bytes;
 }
 
+namespace
+{
+
+/*
+  Walks the runs of 1s in a BitVector in order, presenting each as a half-open
+  interval. Runs may come out split across block boundaries, but never
+  overlapping.
+*/
+class RunReader
+{
+  public:
+    explicit RunReader(const BitVector& vector) :
+      iterator(vector), remaining(vector.getNumberOfItems()), start(0), end(0),
+      done(false)
+    {
+      if(this->remaining == 0) { this->done = true; return; }
+      this->take(this->iterator.selectRun(0, this->remaining));
+    }
+
+    // Is there a current run, or have we run out?
+    inline bool hasRun() const { return !this->done; }
+
+    // Where does the current run start, and where is it past the end of?
+    inline size_t getStart() const { return this->start; }
+    inline size_t getEnd() const { return this->end; }
+
+    // Advance to the next run.
+    inline void next()
+    {
+      if(this->remaining == 0) { this->done = true; return; }
+      this->take(this->iterator.selectNextRun(this->remaining));
+    }
+
+  private:
+    // Adopt a (first position, extra length) result from the iterator.
+    inline void take(pair_type run)
+    {
+      this->start = run.first;
+      this->end = run.first + run.second + 1;
+      this->remaining -= run.second + 1;
+    }
+
+    BitVectorIterator iterator;
+    // How many 1s have we not yet returned in a run?
+    size_t remaining;
+    size_t start, end;
+    bool done;
+};
+
+}
+
 BitVector* 
 BitVector::createUnion(const BitVector& other) const
 {
-  // Make iterators to actually look at the vectors
-  BitVectorIterator us(*this);
-  BitVectorIterator them(other);
+  return createUnion(std::vector<const BitVector*>{this, &other});
+}
+
+BitVector*
+BitVector::createIntersection(const BitVector& other) const
+{
+  RunReader us(*this);
+  RunReader them(other);
 
-  // How many bits are in the longer BitVector? That's how long we will need to
-  // make the union.
+  // Keep the universe of the longer vector, like createUnion does.
   size_t newSize = std::max(getSize(), other.getSize());
-  
-  // We need an encoder to encode it.
-  BitVectorEncoder encoder(block_size);
+
+  // Keep our block size. The encoder wants it in bytes.
+  BitVectorEncoder encoder(this->block_size * sizeof(size_t));
   
   // How many ones are we putting in?
   size_t ones = 0;
-  
-  for(size_t i = 0; i < newSize; i++)
+
+  while(us.hasRun() && them.hasRun())
+  {
+    // Emit wherever the two current runs overlap.
+    size_t start = std::max(us.getStart(), them.getStart());
+    size_t end = std::min(us.getEnd(), them.getEnd());
+    if(start < end)
+    {
+      encoder.addRun(start, end - start);
+      ones += end - start;
+    }
+
+    // Then drop whichever run finishes first, since nothing else can overlap
+    // it.
+    if(us.getEnd() < them.getEnd()) { us.next(); } else { them.next(); }
+  }
+
+  if(ones == 0)
+  {
+    throw std::runtime_error("BitVector: Intersection has no 1-bits!");
+  }
+
+  // Finish encoding.
+  encoder.flush();
+
+  // Build and return the BitVector. Caller is responsible for it.
+  return new BitVector(encoder, newSize);
+}
+
+BitVector*
+BitVector::createUnion(const std::vector<const BitVector*>& vectors)
+{
+  if(vectors.empty())
   {
-    // OR each bit
-    if(us.isSet(i) || them.isSet(i)) {
-        // If the bit is true, add a bit at this position.
-        encoder.addBit(i);
-        ones++;
+    throw std::runtime_error("BitVector: Cannot take union of no vectors!");
+  }
+
+  // How many bits are in the longest BitVector? That's how long we will need
+  // to make the union.
+  size_t newSize = 0;
+
+  // Make a run reader for each vector, and queue them up by where their
+  // current runs start.
+  std::vector<std::unique_ptr<RunReader>> readers;
+  std::priority_queue<pair_type, std::vector<pair_type>,
+    std::greater<pair_type>> queue;
+  for(size_t i = 0; i < vectors.size(); i++)
+  {
+    newSize = std::max(newSize, vectors[i]->getSize());
+    readers.emplace_back(new RunReader(*(vectors[i])));
+    if(readers.back()->hasRun())
+    {
+      queue.push(pair_type(readers.back()->getStart(), i));
     }
   }
+
+  // We need an encoder to encode it, with the block size of the first vector.
+  BitVectorEncoder encoder(vectors[0]->getBlockSize() * sizeof(size_t));
+
+  // Track the run we are building up, which we can only emit once nothing
+  // else overlaps or abuts it.
+  bool haveRun = false;
+  size_t runStart = 0, runEnd = 0;
+
+  while(!queue.empty())
+  {
+    size_t index = queue.top().second;
+    queue.pop();
+    RunReader& reader = *(readers[index]);
+
+    if(haveRun && reader.getStart() <= runEnd)
+    {
+      // Extend the current run.
+      runEnd = std::max(runEnd, reader.getEnd());
+    }
+    else
+    {
+      if(haveRun)
+      {
+        encoder.addRun(runStart, runEnd - runStart);
+      }
+      runStart = reader.getStart();
+      runEnd = reader.getEnd();
+      haveRun = true;
+    }
+
+    reader.next();
+    if(reader.hasRun())
+    {
+      queue.push(pair_type(reader.getStart(), index));
+    }
+  }
+
+  if(haveRun)
+  {
+    encoder.addRun(runStart, runEnd - runStart);
+  }
   
   // Finish encoding.
   encoder.flush();
   
   // Build and return the BitVector. Caller is responsible for it.
-  return new BitVector(encoder, newSize);;
-  
+  return new BitVector(encoder, newSize);
 }
 
 //--------------------------------------------------------------------------
@@ -128,6 +273,12 @@ BitVector::Iterator::select(size_t index)
     this->cur -= this->run;
     this->val -= this->run;
   }
+  else
+  {
+    // We landed on the last 1 of a run (or the sample), so there's nothing
+    // left in it for selectRun() or selectNext() to use.
+    this->run = 0;
+  }
 
   return this->val;
 }
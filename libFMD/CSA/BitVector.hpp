@@ -2,6 +2,7 @@
 #define CSA_BITVECTOR_HPP
 
 #include <fstream>
+#include <vector>
 
 #include "BitVectorBase.hpp"
 
@@ -71,6 +72,23 @@ class BitVector : public BitVectorBase
      */
     BitVector* createUnion(const BitVector& other) const;
     
+    /**
+     * Intersect the 1s in this bit vector with those in that one (bitwise
+     * AND), allocating a new BitVector on the heap. The caller is responsible
+     * for deleting it. Since a BitVector must have at least one 1-bit, throws
+     * std::runtime_error if the two vectors have no 1s in common.
+     */
+    BitVector* createIntersection(const BitVector& other) const;
+    
+    /**
+     * Union all the 1s in all the given bit vectors, allocating a new
+     * BitVector on the heap as long as the longest of them. The caller is
+     * responsible for deleting it. Works on runs of 1s rather than on bits,
+     * so it takes time proportional to the total number of runs, and only
+     * builds the result once no matter how many vectors are merged.
+     */
+    static BitVector* createUnion(const std::vector<const BitVector*>& vectors);
+    
 //--------------------------------------------------------------------------
 
     class Iterator : public BitVectorBase::Iterator
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <functional>
+
+#include "ContextCache.hpp"
+
+ContextCache::ContextCache(size_t kmerLength, size_t maxEntries,
+    size_t numShards): kmerLength(kmerLength), shardEntries(0), shards(),
+    stats(), hitsStat(stats.counter("contextCacheHits")),
+    missesStat(stats.counter("contextCacheMisses")) {
+
+    numShards = std::max(numShards, (size_t) 1);
+    for(size_t i = 0; i < numShards; i++) {
+        // Make all the shards
+        shards.emplace_back(new Shard());
+    }
+
+    // Each shard gets an even share of the entries, and always at least one.
+    shardEntries = std::max(maxEntries / numShards, (size_t) 1);
+}
+
+std::shared_ptr<const std::vector<FMDPosition>> ContextCache::get(
+    const FMDIndexView& view, const std::string& query, size_t start) const {
+
+    std::string kmer = query.substr(start, kmerLength);
+
+    // Go to the k-mer's shard.
+    Shard& shard = *shards[std::hash<std::string>()(kmer) % shards.size()];
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto entry = shard.entries.find(kmer);
+        if(entry != shard.entries.end()) {
+            // Move it to the front of the list, since it was just used.
+            shard.recent.splice(shard.recent.begin(), shard.recent,
+                entry->second);
+            hitsStat.add(1);
+            return entry->second->second;
+        }
+    }
+
+    // Search without holding the lock, so other threads can keep using the
+    // shard.
+    std::shared_ptr<const std::vector<FMDPosition>> found(
+        new std::vector<FMDPosition>(search(view, kmer)));
+    missesStat.add(1);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = shard.entries.find(kmer);
+    if(entry != shard.entries.end()) {
+        // Someone else searched for it while we were. Use theirs.
+        shard.recent.splice(shard.recent.begin(), shard.recent,
+            entry->second);
+        return entry->second->second;
+    }
+
+    // Put ours in at the front, and throw out the least recently used k-mer
+    // if we're over. Anyone still using it keeps their own reference.
+    shard.recent.emplace_front(kmer, found);
+    shard.entries[kmer] = shard.recent.begin();
+    if(shard.recent.size() > shardEntries) {
+        shard.entries.erase(shard.recent.back().first);
+        shard.recent.pop_back();
+    }
+
+    return found;
+}
+
+StatTracker ContextCache::getStats() const {
+    return stats;
+}
+
+std::vector<FMDPosition> ContextCache::search(const FMDIndexView& view,
+    const std::string& kmer) {
+
+    std::vector<FMDPosition> searches(kmer.size());
+
+    // Extend from right to left, filling in each suffix's search.
+    FMDPosition search = view.getIndex().getCoveringPosition();
+    for(size_t i = kmer.size() - 1; i != (size_t) -1; i--) {
+        view.getIndex().extendLeftOnly(search, kmer[i]);
+
+        if(search.isEmpty(view)) {
+            // The k-mer doesn't occur.
+            return std::vector<FMDPosition>();
+        }
+
+        searches[i] = search;
+    }
+
+    return searches;
+}
@@ -0,0 +1,144 @@
+#ifndef CONTEXTCACHE_HPP
+#define CONTEXTCACHE_HPP
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+#include "FMDIndexView.hpp"
+#include "FMDPosition.hpp"
+#include "StatTracker.hpp"
+
+/**
+ * Defines a bounded cache of k-mer searches, shared across queries, for the
+ * k-mers that queries end with. Reads from high-coverage read sets keep
+ * ending in the same reference k-mers, so the left-only extension that starts
+ * every right-to-left sweep over a query can be looked up instead of redone.
+ *
+ * For each k-mer, the searches for all of its suffixes are kept, since those
+ * are the right contexts of the k-mer's bases when the k-mer occurs at all.
+ * K-mers that don't occur are cached too, so they won't be searched again.
+ *
+ * K-mers are spread over a number of shards, each with its own lock and its
+ * own least-recently-used list, like in ContigCache.
+ *
+ * Searches are only valid for the index they were made in, so a ContextCache
+ * must only ever be used with one FMDIndex.
+ */
+class ContextCache {
+
+public:
+    /**
+     * Make a new ContextCache for k-mers of the given length, holding at most
+     * about the given number of k-mers, spread across the given number of
+     * shards.
+     */
+    ContextCache(size_t kmerLength, size_t maxEntries = DEFAULT_MAX_ENTRIES,
+        size_t numShards = DEFAULT_SHARDS);
+
+    /**
+     * Get the searches for every suffix of the k-mer at the given start
+     * position in the given query, with the search for the whole k-mer first,
+     * as produced by left-only extension in the given view's index. If the
+     * k-mer doesn't occur in the view, returns an empty vector. Searches the
+     * index if the k-mer isn't cached. Thread safe.
+     */
+    std::shared_ptr<const std::vector<FMDPosition>> get(
+        const FMDIndexView& view, const std::string& query, size_t start) const;
+
+    /**
+     * Get the length of the k-mers cached.
+     */
+    inline size_t getKmerLength() const {
+        return kmerLength;
+    }
+
+    /**
+     * Get a snapshot of the "contextCacheHits" and "contextCacheMisses"
+     * stats.
+     */
+    StatTracker getStats() const;
+
+    /**
+     * By default, how many k-mers can be cached?
+     */
+    static const size_t DEFAULT_MAX_ENTRIES = 1 << 16;
+
+    /**
+     * By default, how many shards should there be?
+     */
+    static const size_t DEFAULT_SHARDS = 16;
+
+protected:
+    /**
+     * One independently locked part of the cache.
+     */
+    struct Shard {
+        /**
+         * Holds a lock on everything else in the shard.
+         */
+        std::mutex mutex;
+
+        /**
+         * Holds the cached k-mers and their searches, most recently used
+         * first.
+         */
+        std::list<std::pair<std::string,
+            std::shared_ptr<const std::vector<FMDPosition>>>> recent;
+
+        /**
+         * Finds the entries in the recent list by k-mer.
+         */
+        std::unordered_map<std::string, decltype(recent)::iterator> entries;
+    };
+
+    /**
+     * Do the left-only searches for all the suffixes of the given k-mer.
+     */
+    static std::vector<FMDPosition> search(const FMDIndexView& view,
+        const std::string& kmer);
+
+    /**
+     * How long are the k-mers?
+     */
+    size_t kmerLength;
+
+    /**
+     * How many k-mers can each shard hold?
+     */
+    size_t shardEntries;
+
+    /**
+     * Holds all the shards. Shards aren't movable, so they are held by
+     * pointer.
+     */
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    /**
+     * Counts hits and misses.
+     */
+    mutable StatTracker stats;
+
+    /**
+     * Counters for hits and misses in stats, gotten up front.
+     */
+    StatTracker::Counter hitsStat;
+    StatTracker::Counter missesStat;
+
+private:
+    /**
+     * ContextCaches can't be copied, since the shards can't be.
+     */
+    ContextCache(const ContextCache& other) = delete;
+
+    /**
+     * Or assigned.
+     */
+    ContextCache& operator=(const ContextCache& other) = delete;
+
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "ContigCache.hpp"
+
+std::atomic<uint64_t> ContigCache::nextId(1);
+
+/**
+ * Each thread remembers the last contig it got from any ContigCache, by the
+ * cache's ID. The contig is held weakly so that eviction and cache destruction
+ * still free it.
+ */
+struct LastContig {
+    uint64_t cacheId = 0;
+    size_t contig = 0;
+    std::weak_ptr<const std::string> contents;
+};
+static thread_local LastContig lastContig;
+
+ContigCache::ContigCache(size_t byteBudget, size_t numShards):
+    byteBudget(byteBudget), shards(), id(nextId++) {
+    
+    for(size_t i = 0; i < std::max(numShards, (size_t) 1); i++) {
+        // Make all the shards
+        shards.emplace_back(new Shard());
+    }
+}
+
+std::shared_ptr<const std::string> ContigCache::get(size_t contig,
+    const std::function<std::string(size_t)>& load) const {
+    
+    if(lastContig.cacheId == id && lastContig.contig == contig) {
+        // This thread just used this contig. See if it's still around.
+        std::shared_ptr<const std::string> found = lastContig.contents.lock();
+        if(found) {
+            return found;
+        }
+    }
+    
+    // Otherwise we have to go to the contig's shard.
+    Shard& shard = *shards[contig % shards.size()];
+    std::shared_ptr<const std::string> found;
+    
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        
+        auto entry = shard.entries.find(contig);
+        if(entry != shard.entries.end()) {
+            // Move it to the front of the list, since it was just used.
+            shard.recent.splice(shard.recent.begin(), shard.recent,
+                entry->second);
+            found = entry->second->second;
+        }
+    }
+    
+    if(!found) {
+        // Reconstruct it without holding the lock, so other threads can keep
+        // using the shard. Don't use make_shared, so the weak pointers in
+        // other threads only keep the control block and not the bases alive.
+        found = std::shared_ptr<const std::string>(
+            new std::string(load(contig)));
+        
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        
+        auto entry = shard.entries.find(contig);
+        if(entry != shard.entries.end()) {
+            // Someone else loaded it while we were. Use theirs.
+            shard.recent.splice(shard.recent.begin(), shard.recent,
+                entry->second);
+            found = entry->second->second;
+        } else {
+            // Put ours in at the front and make room for it.
+            shard.recent.emplace_front(contig, found);
+            shard.entries[contig] = shard.recent.begin();
+            shard.bytes += found->size();
+            evict(shard);
+        }
+    }
+    
+    // Remember it for next time.
+    lastContig.cacheId = id;
+    lastContig.contig = contig;
+    lastContig.contents = found;
+    
+    return found;
+}
+
+void ContigCache::setByteBudget(size_t newBudget) {
+    byteBudget = newBudget;
+    
+    for(auto& shard : shards) {
+        // Get every shard under the new budget.
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        evict(*shard);
+    }
+}
+
+size_t ContigCache::getCachedBytes() const {
+    size_t total = 0;
+    for(auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->bytes;
+    }
+    return total;
+}
+
+void ContigCache::clearThreadLocal() const {
+    if(lastContig.cacheId == id) {
+        // Forget about our contig.
+        lastContig = LastContig();
+    }
+}
+
+void ContigCache::evict(Shard& shard) const {
+    // Each shard gets an even share of the budget.
+    size_t shardBudget = byteBudget / shards.size();
+    
+    while(shard.bytes > shardBudget && shard.recent.size() > 1) {
+        // Throw out the least recently used contig. Anyone still using it
+        // keeps their own reference.
+        shard.bytes -= shard.recent.back().second->size();
+        shard.entries.erase(shard.recent.back().first);
+        shard.recent.pop_back();
+    }
+}
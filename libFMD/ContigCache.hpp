@@ -0,0 +1,151 @@
+#ifndef CONTIGCACHE_HPP
+#define CONTIGCACHE_HPP
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+/**
+ * Defines a bounded cache of reconstructed contig strings, for FMDIndex to use
+ * when it has to pull contigs out of the BWT.
+ *
+ * Contigs are spread over a number of shards, each with its own lock and its
+ * own least-recently-used list, and each shard is kept within its share of a
+ * total byte budget. Each thread also remembers the last contig it got from
+ * any cache, without locking, since callers tend to read many bases from one
+ * contig in a row.
+ *
+ * Contigs are handed out as shared pointers, so a contig that is evicted stays
+ * valid for as long as someone is still using it.
+ */
+class ContigCache {
+
+public:
+    /**
+     * Make a new ContigCache that holds at most about the given number of
+     * bytes of contig bases, spread across the given number of shards. At
+     * least one contig per shard is always kept, even if it is over budget.
+     */
+    ContigCache(size_t byteBudget = DEFAULT_BYTE_BUDGET,
+        size_t numShards = DEFAULT_SHARDS);
+    
+    /**
+     * Get the contig with the given number, using the given function to
+     * produce it if it isn't cached. Thread safe.
+     */
+    std::shared_ptr<const std::string> get(size_t contig,
+        const std::function<std::string(size_t)>& load) const;
+    
+    /**
+     * Change the byte budget, evicting contigs as needed to get under it.
+     * Thread safe.
+     */
+    void setByteBudget(size_t byteBudget);
+    
+    /**
+     * Get the current byte budget.
+     */
+    inline size_t getByteBudget() const {
+        return byteBudget.load();
+    }
+    
+    /**
+     * Get the number of bytes of contigs currently cached. Thread safe.
+     */
+    size_t getCachedBytes() const;
+    
+    /**
+     * Forget the calling thread's remembered contig, if it came from this
+     * cache. Other threads' memories of this cache can never be mistaken for
+     * another cache's, and don't keep any contigs alive, so this never has to
+     * be done for correctness.
+     */
+    void clearThreadLocal() const;
+    
+    /**
+     * By default, how many bytes can be cached?
+     */
+    static const size_t DEFAULT_BYTE_BUDGET = (size_t) 1 << 30;
+    
+    /**
+     * By default, how many shards should there be?
+     */
+    static const size_t DEFAULT_SHARDS = 16;
+    
+protected:
+    /**
+     * One independently locked part of the cache.
+     */
+    struct Shard {
+        /**
+         * Holds a lock on everything else in the shard.
+         */
+        std::mutex mutex;
+        
+        /**
+         * Holds the cached contigs, most recently used first.
+         */
+        std::list<std::pair<size_t, std::shared_ptr<const std::string>>>
+            recent;
+        
+        /**
+         * Finds the entries in the recent list by contig number.
+         */
+        std::unordered_map<size_t, decltype(recent)::iterator> entries;
+        
+        /**
+         * Holds the total size of the cached contigs.
+         */
+        size_t bytes = 0;
+    };
+    
+    /**
+     * Evict contigs from the end of the given shard's list until it is under
+     * the per-shard budget, or only has one contig. The shard must be locked.
+     */
+    void evict(Shard& shard) const;
+    
+    /**
+     * How many bytes of contigs are we allowed?
+     */
+    std::atomic<size_t> byteBudget;
+    
+    /**
+     * Holds all the shards. Shards aren't movable, so they are held by
+     * pointer.
+     */
+    std::vector<std::unique_ptr<Shard>> shards;
+    
+    /**
+     * Holds a number identifying this cache, never reused, so thread-local
+     * memories of other caches (including dead ones at the same address) are
+     * never used.
+     */
+    uint64_t id;
+    
+    /**
+     * Counts up to produce cache IDs.
+     */
+    static std::atomic<uint64_t> nextId;
+    
+private:
+    /**
+     * ContigCaches can't be copied, since that would confuse the thread-local
+     * memories.
+     */
+    ContigCache(const ContigCache& other) = delete;
+    
+    /**
+     * Or assigned.
+     */
+    ContigCache& operator=(const ContigCache& other) = delete;
+    
+};
+
+#endif
@@ -18,7 +18,12 @@ void CreditStrategy::applyCredit(const std::string& query,
     }
 
     // Scan the mappings from left to right to find pairs of mapped positions
-    // bordering runs of unmapped positions.
+    // bordering runs of unmapped positions, and give credit in all of them in
+    // this one pass.
+    
+    // Keep these around to collect credit from each side of each run.
+    std::vector<Mapping> leftMappings;
+    std::vector<Mapping> rightMappings;
     
     // What is the last mapped position you saw?
     size_t leftAnchor = (size_t) -1;
@@ -30,16 +35,16 @@ void CreditStrategy::applyCredit(const std::string& query,
         // Look at every base and observe where we change from mapped to
         // unmapped or visa versa.
         
-        Log::debug() << "Checking position " << i << " (mapped: " <<
+        LOG_DEBUG("Checking position " << i << " (mapped: " <<
             toUpdate[i].isMapped() << ", last: " << lastWasMapped << ")" <<
-            std::endl;
+            std::endl);
     
         if(!toUpdate[i].isMapped() && lastWasMapped && i != 0) {
             // We have just entered a run of unmapped bases. We have to set the
             // left anchor to the position before here.
             leftAnchor = i - 1;
             
-            Log::debug() << "No longer mapped" << std::endl;
+            LOG_DEBUG("No longer mapped" << std::endl);
             
         } else if(toUpdate[i].isMapped() && !lastWasMapped &&
             leftAnchor != (size_t) -1) {
@@ -47,15 +52,14 @@ void CreditStrategy::applyCredit(const std::string& query,
             // We have just finished a run of unmapped bases. We need to run the
             // searches.
             
-            Log::debug() << "Newly mapped" << std::endl;
+            LOG_DEBUG("Newly mapped" << std::endl);
             
             // We should use this base as the right anchor of the credit.
             size_t rightAnchor = i;
             
             // Actually go and apply the credit between those mapped bases.
-            applyCreditBetween(query.substr(leftAnchor,
-                rightAnchor - leftAnchor + 1), leftAnchor, toUpdate, leftAnchor,
-                rightAnchor);
+            applyCreditBetween(query, toUpdate, leftAnchor, rightAnchor,
+                leftMappings, rightMappings);
         }
         
         // Remember the state of the last base we saw.        
@@ -63,63 +67,74 @@ void CreditStrategy::applyCredit(const std::string& query,
     }
 }
 
-void CreditStrategy::applyCreditBetween(const std::string& querySubstring, 
-    size_t queryOffset, std::vector<Mapping>& toUpdate, size_t leftAnchor,
+void CreditStrategy::applyCreditBetween(const std::string& query,
+    std::vector<Mapping>& toUpdate, size_t leftAnchor,
     size_t rightAnchor) const {
     
+    if(rightAnchor >= query.size() || leftAnchor >= rightAnchor) {
+        // Complain we didn't get anchors in the query.
+        throw std::runtime_error("Credit anchors must be in order and in the "
+            "query.");
+    }
+    
+    // Make scratch vectors to collect credit in.
+    std::vector<Mapping> leftMappings;
+    std::vector<Mapping> rightMappings;
+    
+    applyCreditBetween(query, toUpdate, leftAnchor, rightAnchor, leftMappings,
+        rightMappings);
+}
+
+void CreditStrategy::applyCreditBetween(const std::string& query,
+    std::vector<Mapping>& toUpdate, size_t leftAnchor, size_t rightAnchor,
+    std::vector<Mapping>& leftMappings,
+    std::vector<Mapping>& rightMappings) const {
+    
     Log::info() << "Applying credit between " << leftAnchor << " and " << 
         rightAnchor << std::endl;
     
     // How many bases do we want to give credit to?
     size_t unmappedRegionSize = rightAnchor - leftAnchor - 1; 
     
-    if(querySubstring.size() != unmappedRegionSize + 2) {
-        // Complain we didn't get the right query substring.
-        throw std::runtime_error("Query substring must include the whole "
-            "bubble and two anchor bases.");
-    }
-    
-    // Make a vector of unmapped mappings for credit from the left.
-    std::vector<Mapping> leftMappings(unmappedRegionSize, Mapping());
+    // Reset the unmapped mappings for credit from the left.
+    leftMappings.assign(unmappedRegionSize, Mapping());
     // And from the right
-    std::vector<Mapping> rightMappings(unmappedRegionSize, Mapping());
+    rightMappings.assign(unmappedRegionSize, Mapping());
     
     // Run a search in from each end, to the depth of the other end or until you
     // find too many mismatches.
     
     // Do the right-side search
-    breadthFirstSearch(querySubstring, querySubstring.size() - 1, 
-        toUpdate[rightAnchor].getLocation(), unmappedRegionSize, 
-        [&](size_t index, TextPosition mappedTo) {
+    breadthFirstSearch(query, false, rightAnchor,
+        toUpdate[rightAnchor].getLocation(),
+        unmappedRegionSize, [&](size_t index, TextPosition mappedTo) {
         
         // Save every mapping as coming from the right-side search. Convert from
-        // query substring coordinates to bubble coordinates.
-        rightMappings[index - 1] = Mapping(mappedTo);
+        // query coordinates to bubble coordinates.
+        rightMappings[index - leftAnchor - 1] = Mapping(mappedTo);
     
     });
     
-    // Flip the query around. TODO: do this efficiently by using a special DNA
-    // string type or soemthing.
-    std::string rcQuery = reverseComplement(querySubstring);
-    
     // Get the left starting position, flipped around.
     TextPosition leftFlipped = toUpdate[leftAnchor].getLocation();
     // TODO: We need the contig length to flip it, and it is hard to get.
     leftFlipped.flip(view.getIndex().getContigLength(
         leftFlipped.getContigNumber()));
     
-    // Do the left-side search
-    breadthFirstSearch(rcQuery, rcQuery.size() - 1, leftFlipped, 
-        unmappedRegionSize, [&](size_t index, TextPosition mappedTo) {
+    // Do the left-side search, from the left anchor's place in the flipped
+    // query.
+    breadthFirstSearch(query, true, query.size() - leftAnchor - 1,
+        leftFlipped, unmappedRegionSize,
+        [&](size_t index, TextPosition mappedTo) {
         
         // Flip around again
-        index = rcQuery.size() - index - 1;
+        index = query.size() - index - 1;
         mappedTo.flip(view.getIndex().getContigLength(
             mappedTo.getContigNumber()));
         
         // Save every mapping as coming from the left-side search. Make sure to
-        // convert from query substring to bubble-local coordinates.
-        leftMappings[index - 1] = Mapping(mappedTo);
+        // convert from query to bubble-local coordinates.
+        leftMappings[index - leftAnchor - 1] = Mapping(mappedTo);
     
     });
     
@@ -144,8 +159,9 @@ void CreditStrategy::applyCreditBetween(const std::string& querySubstring,
 }
 
 void CreditStrategy::breadthFirstSearch(const std::string& query,
-    size_t queryStart, const TextPosition& referenceStart, size_t maxDepth, 
-    std::function<void(size_t, TextPosition)> callback) const {
+    bool reverse, size_t queryStart, const TextPosition& referenceStart,
+    size_t maxDepth,
+    const std::function<void(size_t, TextPosition)>& callback) const {
 
     // See where the reference starts and turn that into range numbers
     auto ranges = view.textPositionToRanges(referenceStart);
@@ -159,16 +175,22 @@ void CreditStrategy::breadthFirstSearch(const std::string& query,
         startPositions.emplace_back(startAndLength.first, 0,
             ((int64_t) startAndLength.second) - 1);
         
-        Log::debug() << "Got range " << startAndLength.first << "-" <<
+        LOG_DEBUG("Got range " << startAndLength.first << "-" <<
             startAndLength.first + startAndLength.second << " as #" << range <<
-            std::endl;
+            std::endl);
     }
 
     // Make the FMDPositionGroup holding them all
     FMDPositionGroup search(startPositions);
     
-    Log::trace() << "Applying credit from " << queryStart - 1 << " to " << 
-        queryStart - maxDepth << std::endl;
+    LOG_TRACE("Applying credit from " << queryStart - 1 << " to " << 
+        queryStart - maxDepth << std::endl);
+    
+    // If the index has a k-mer filter, keep the code of the k-mer at the left
+    // end of what we've searched, and how many bases we have in a row.
+    const KmerFilter* filter = view.getIndex().getKmerFilter();
+    uint64_t kmer = 0;
+    size_t run = 0;
     
     for(size_t queryIndex = queryStart - 1; 
         (queryIndex >= queryStart - maxDepth) && 
@@ -178,9 +200,30 @@ void CreditStrategy::breadthFirstSearch(const std::string& query,
         // While it is not empty, and we haven't hit our depth limit (or run off
         // the left edge of the string)
     
+        // Get the character at this index along the strand we're reading.
+        char character = reverse ? complement(query[query.size() - 1 -
+            queryIndex]) : query[queryIndex];
+    
+        // If nothing has needed a mismatch yet, we have been searching for
+        // just the query, and can't find the correct character if that makes
+        // a k-mer the index doesn't have.
+        bool exactPossible = true;
+        if(filter != NULL) {
+            uint8_t code = EncodedQuery::encode(character);
+            if(code == EncodedQuery::NOT_A_BASE) {
+                run = 0;
+            } else {
+                kmer = (kmer >> 2) |
+                    ((uint64_t) code << (2 * (filter->getK() - 1)));
+                run++;
+                exactPossible = run < filter->getK() ||
+                    search.mismatchesUsed() > 0 || filter->mayContain(kmer);
+            }
+        }
+    
         // Try extending with a character. Remember if we found that character or not.
-        bool correctCharacter = search.extendGreedy(view, query[queryIndex],
-            maxMismatches);
+        bool correctCharacter = search.extendGreedy(view, character,
+            maxMismatches, exactPossible);
         
         if(correctCharacter && search.isUnique(view)) {
             // If we have a unique result, and we actually found the base we
@@ -20,18 +20,20 @@ public:
     
     /**
      * Apply credit for mapping the given string, by updating mappings in the
-     * given vector of mappings.
+     * given vector of mappings. Handles every unmapped run of the query in one
+     * pass.
      */
     void applyCredit(const std::string& query, 
         std::vector<Mapping>& toUpdate) const;
     
     /**
-     * Apply credit for mapping the given substring of the query, at the given
-     * offset, by updating mappings in the given vector of mappings between the
-     * specified mapped positions flanking an unmapped region.
+     * Apply credit for mapping the given query, by updating mappings in the
+     * given vector of mappings between the specified mapped positions flanking
+     * an unmapped region. Only the part of the query from leftAnchor to
+     * rightAnchor, inclusive, is looked at.
      */
-    void applyCreditBetween(const std::string& querySubstring,
-        size_t queryOffest, std::vector<Mapping>& toUpdate, size_t leftAnchor,
+    void applyCreditBetween(const std::string& query,
+        std::vector<Mapping>& toUpdate, size_t leftAnchor,
         size_t rightAnchor) const;
         
     /**
@@ -53,10 +55,24 @@ protected:
      * the graph, and search to the left until maxDepth characters are searched,
      * or you run out of results. For every unique mapping between a query index
      * and a TextPosition, call the callback.
+     *
+     * If reverse is set, the query is read as its reverse complement, without
+     * making a copy, and indexes are along the reverse complement.
      */
-    void breadthFirstSearch(const std::string& query, size_t queryStart,
-        const TextPosition& referenceStart, size_t maxDepth, 
-        std::function<void(size_t, TextPosition)> callback) const;
+    void breadthFirstSearch(const std::string& query, bool reverse,
+        size_t queryStart, const TextPosition& referenceStart, size_t maxDepth,
+        const std::function<void(size_t, TextPosition)>& callback) const;
+    
+    /**
+     * Apply credit between the given flanking mapped positions, working in
+     * coordinates on the whole query. Takes scratch vectors to collect the
+     * credit from each side in, so they can be shared across all the unmapped
+     * runs of a query.
+     */
+    void applyCreditBetween(const std::string& query,
+        std::vector<Mapping>& toUpdate, size_t leftAnchor, size_t rightAnchor,
+        std::vector<Mapping>& leftMappings,
+        std::vector<Mapping>& rightMappings) const;
 
     /**
      * Keep the view of the index that we are working with.
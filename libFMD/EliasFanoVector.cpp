@@ -0,0 +1,137 @@
+#include <stdexcept>
+
+#include "EliasFanoVector.hpp"
+
+EliasFanoVector::EliasFanoVector(): count(0), lowBitCount(0), zeroCount(1),
+    lowBits(), highBits(1, 0), oneSamples(), zeroSamples(1, 0) {
+    
+    // Even an empty vector has a 0 to end its high bits.
+}
+
+EliasFanoVector::EliasFanoVector(const std::vector<size_t>& values):
+    count(values.size()), lowBitCount(0), zeroCount(0), lowBits(),
+    highBits(), oneSamples(), zeroSamples() {
+    
+    // How big is the universe?
+    size_t universe = values.empty() ? 1 : values.back() + 1;
+    
+    while(count > 0 && lowBitCount < 63 &&
+        (universe >> (lowBitCount + 1)) >= count) {
+        // Store as many low bits as we can while still having about as many
+        // high buckets as values.
+        lowBitCount++;
+    }
+    
+    // Make room for everything.
+    lowBits.resize((count * lowBitCount + 63) / 64 + 1, 0);
+    zeroCount = (universe >> lowBitCount) + 1;
+    size_t highLength = count + zeroCount;
+    highBits.resize((highLength + 63) / 64 + 1, 0);
+    
+    for(size_t i = 0; i < count; i++) {
+        if(i > 0 && values[i] < values[i - 1]) {
+            throw std::runtime_error("Elias-Fano values must not decrease");
+        }
+        
+        if(lowBitCount > 0) {
+            // Store the low bits, maybe across two words.
+            uint64_t low = values[i] & (((uint64_t) 1 << lowBitCount) - 1);
+            size_t bit = i * lowBitCount;
+            lowBits[bit / 64] |= low << (bit % 64);
+            if(bit % 64 + lowBitCount > 64) {
+                lowBits[bit / 64 + 1] |= low >> (64 - bit % 64);
+            }
+        }
+        
+        // And the high bits in unary.
+        size_t position = (values[i] >> lowBitCount) + i;
+        highBits[position / 64] |= (uint64_t) 1 << (position % 64);
+    }
+    
+    // Sample the positions of the 1s and 0s.
+    size_t ones = 0;
+    size_t zeros = 0;
+    for(size_t position = 0; position < highLength; position++) {
+        if(getHigh(position)) {
+            if(ones % SAMPLE_RATE == 0) {
+                oneSamples.push_back(position);
+            }
+            ones++;
+        } else {
+            if(zeros % SAMPLE_RATE == 0) {
+                zeroSamples.push_back(position);
+            }
+            zeros++;
+        }
+    }
+}
+
+size_t EliasFanoVector::selectOne(size_t rank) const {
+    // Start at the sample before it, and scan the rest of the way.
+    size_t position = oneSamples[rank / SAMPLE_RATE];
+    size_t left = rank % SAMPLE_RATE;
+    
+    // Finish out the first word bit by bit.
+    uint64_t word = highBits[position / 64] >> (position % 64);
+    size_t wordStart = position;
+    while(true) {
+        size_t ones = __builtin_popcountll(word);
+        if(ones > left) {
+            // It's in this word. Knock off the 1s before it.
+            for(size_t i = 0; i < left; i++) {
+                word &= word - 1;
+            }
+            return wordStart + __builtin_ctzll(word);
+        }
+        left -= ones;
+        
+        // Move on to the next whole word.
+        wordStart = (wordStart / 64 + 1) * 64;
+        word = highBits[wordStart / 64];
+    }
+}
+
+size_t EliasFanoVector::selectZero(size_t rank) const {
+    // The same, on the inverted bits.
+    size_t position = zeroSamples[rank / SAMPLE_RATE];
+    size_t left = rank % SAMPLE_RATE;
+    
+    uint64_t word = ~highBits[position / 64] >> (position % 64);
+    size_t wordStart = position;
+    while(true) {
+        size_t zeros = __builtin_popcountll(word);
+        if(zeros > left) {
+            for(size_t i = 0; i < left; i++) {
+                word &= word - 1;
+            }
+            return wordStart + __builtin_ctzll(word);
+        }
+        left -= zeros;
+        
+        wordStart = (wordStart / 64 + 1) * 64;
+        word = ~highBits[wordStart / 64];
+    }
+}
+
+size_t EliasFanoVector::rank(size_t value) const {
+    size_t high = value >> lowBitCount;
+    
+    if(high >= zeroCount) {
+        // Bigger than everything.
+        return count;
+    }
+    
+    // Everything with smaller or equal high bits comes before the 0 that ends
+    // this value's bucket.
+    size_t position = selectZero(high);
+    size_t index = position - high;
+    
+    // Back off over the values in this bucket that are too big.
+    size_t low = value & (((uint64_t) 1 << lowBitCount) - 1);
+    while(index > 0 && getHigh(position - 1) && getLow(index - 1) > low) {
+        index--;
+        position--;
+    }
+    
+    return index;
+}
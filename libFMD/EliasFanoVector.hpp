@@ -0,0 +1,126 @@
+#ifndef ELIASFANOVECTOR_HPP
+#define ELIASFANOVECTOR_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Defines an Elias-Fano encoding of a non-decreasing sequence of integers,
+ * with constant-time access to any element and fast predecessor counting.
+ *
+ * Each value is split into its low bits, stored packed, and its high bits,
+ * stored in unary in a bit vector as a 1 at position (high bits + index).
+ * Sampled positions of every SAMPLE_RATE-th 1 and 0 in that bit vector let us
+ * get to any element or to any high-bits bucket with a short scan. Takes about
+ * 2 + log(universe / count) bits per element.
+ */
+class EliasFanoVector {
+
+public:
+    /**
+     * Make an empty EliasFanoVector.
+     */
+    EliasFanoVector();
+    
+    /**
+     * Encode the given non-decreasing values. Throws a std::runtime_error if
+     * they decrease anywhere.
+     */
+    EliasFanoVector(const std::vector<size_t>& values);
+    
+    /**
+     * Get the number of values stored.
+     */
+    inline size_t size() const {
+        return count;
+    }
+    
+    /**
+     * Get the number of bytes the encoded values take up.
+     */
+    inline size_t getMemoryUsage() const {
+        return (lowBits.capacity() + highBits.capacity()) * sizeof(uint64_t) +
+            (oneSamples.capacity() + zeroSamples.capacity()) * sizeof(size_t);
+    }
+    
+    /**
+     * Get the value at the given index.
+     */
+    inline size_t operator[](size_t index) const {
+        return ((selectOne(index) - index) << lowBitCount) | getLow(index);
+    }
+    
+    /**
+     * Count the stored values that are less than or equal to the given value.
+     */
+    size_t rank(size_t value) const;
+    
+protected:
+    /**
+     * How often do we sample the positions of 1s and 0s in the high bits?
+     */
+    static const size_t SAMPLE_RATE = 256;
+    
+    /**
+     * Get the low bits of the value at the given index.
+     */
+    inline size_t getLow(size_t index) const {
+        if(lowBitCount == 0) {
+            return 0;
+        }
+        size_t bit = index * lowBitCount;
+        size_t word = bit / 64;
+        size_t offset = bit % 64;
+        uint64_t low = lowBits[word] >> offset;
+        if(offset + lowBitCount > 64) {
+            // The value spills into the next word.
+            low |= lowBits[word + 1] << (64 - offset);
+        }
+        return low & (((uint64_t) 1 << lowBitCount) - 1);
+    }
+    
+    /**
+     * Is the given bit of the high bits set?
+     */
+    inline bool getHigh(size_t bit) const {
+        return (highBits[bit / 64] >> (bit % 64)) & 1;
+    }
+    
+    /**
+     * Find the position of the 1 in the high bits with the given 0-based
+     * rank.
+     */
+    size_t selectOne(size_t rank) const;
+    
+    /**
+     * Find the position of the 0 in the high bits with the given 0-based
+     * rank.
+     */
+    size_t selectZero(size_t rank) const;
+    
+    // How many values are there?
+    size_t count;
+    
+    // How many low bits does each value have stored explicitly? Always less
+    // than 64.
+    size_t lowBitCount;
+    
+    // How many 0s are in the high bits? One more than the largest high part.
+    size_t zeroCount;
+    
+    // Packed low bits of all the values
+    std::vector<uint64_t> lowBits;
+    
+    // Unary-coded high bits of all the values
+    std::vector<uint64_t> highBits;
+    
+    // Positions of every SAMPLE_RATE-th 1 in the high bits
+    std::vector<size_t> oneSamples;
+    
+    // Positions of every SAMPLE_RATE-th 0 in the high bits
+    std::vector<size_t> zeroSamples;
+    
+};
+
+#endif
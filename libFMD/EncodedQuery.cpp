@@ -0,0 +1,30 @@
+#include "EncodedQuery.hpp"
+
+EncodedQuery::EncodedQuery(const std::string& query): codes(query.size()) {
+    // This loop has no branches or table lookups, so the compiler can turn it
+    // into vector instructions and encode many bases at once.
+    for(size_t i = 0; i < query.size(); i++) {
+        codes[i] = encode(query[i]);
+    }
+}
+
+EncodedQuery::View EncodedQuery::View::substr(size_t index,
+    size_t count) const {
+
+    // Work out where the stretch starts on the forward strand, which is from
+    // the other end if we're reading backward.
+    size_t newStart = reverse ? start + length - index - count : start + index;
+    return View(codes, newStart, count, reverse);
+}
+
+EncodedQuery::View EncodedQuery::View::reverseComplement() const {
+    return View(codes, start, length, !reverse);
+}
+
+std::string EncodedQuery::View::toString() const {
+    std::string toReturn(length, 'N');
+    for(size_t i = 0; i < length; i++) {
+        toReturn[i] = getBase(i);
+    }
+    return toReturn;
+}
@@ -0,0 +1,159 @@
+#ifndef ENCODEDQUERY_HPP
+#define ENCODEDQUERY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/**
+ * Defines a query encoded once into 2-bit base codes (0, 1, 2 and 3 for A, C,
+ * G and T, in either case), which can be read along either strand without
+ * making reverse complement or substring copies. Anything that isn't a base
+ * gets the code NOT_A_BASE, which is its own complement.
+ */
+class EncodedQuery {
+
+public:
+    /**
+     * Code given to characters that aren't bases.
+     */
+    static const uint8_t NOT_A_BASE = 4;
+
+    /**
+     * A read-only window onto a stretch of an EncodedQuery along one strand.
+     * Only valid as long as the EncodedQuery it came from.
+     */
+    class View {
+    public:
+        /**
+         * Get the number of bases in the view.
+         */
+        inline size_t size() const {
+            return length;
+        }
+
+        /**
+         * Get the code of the base at the given index along the view.
+         */
+        inline uint8_t operator[](size_t index) const {
+            if(reverse) {
+                // Read the forward strand backward, complementing everything
+                // that is a base.
+                uint8_t code = codes[start + length - 1 - index];
+                return code == NOT_A_BASE ? code : 3 - code;
+            }
+            return codes[start + index];
+        }
+
+        /**
+         * Get the upper-case character for the base at the given index along
+         * the view, or 'N' if it isn't a base.
+         */
+        inline char getBase(size_t index) const {
+            return "ACGTN"[(*this)[index]];
+        }
+
+        /**
+         * Get a view of the given number of bases starting at the given index
+         * along this view, on the same strand.
+         */
+        View substr(size_t index, size_t count) const;
+
+        /**
+         * Get a view of the same bases on the other strand.
+         */
+        View reverseComplement() const;
+
+        /**
+         * Decode the view back into an upper-case string.
+         */
+        std::string toString() const;
+
+    protected:
+        friend class EncodedQuery;
+
+        /**
+         * Make a view of the given stretch of the forward strand codes, read
+         * along the given strand.
+         */
+        inline View(const uint8_t* codes, size_t start, size_t length,
+            bool reverse): codes(codes), start(start), length(length),
+            reverse(reverse) {
+        }
+
+        /**
+         * Points to the forward strand codes for the whole query.
+         */
+        const uint8_t* codes;
+
+        /**
+         * Where does the stretch we look at start on the forward strand?
+         */
+        size_t start;
+
+        /**
+         * How long is it?
+         */
+        size_t length;
+
+        /**
+         * Do we read it as its reverse complement?
+         */
+        bool reverse;
+    };
+
+    /**
+     * Get the code for the given character, which is NOT_A_BASE if it isn't
+     * A, C, G or T in either case. Has no branches or table lookups, so loops
+     * calling it can be turned into vector instructions.
+     */
+    static inline uint8_t encode(char character) {
+        uint8_t c = character;
+
+        // Xoring A, C, G and T (in either case) shifted right by 1 with
+        // themselves shifted right by 2 leaves 0, 1, 2 and 3 in the low bits.
+        uint8_t code = ((c >> 1) ^ (c >> 2)) & 3;
+
+        // Fold to upper case to make sure it really was one of them.
+        uint8_t upper = c & 0xDF;
+        uint8_t isBase = (upper == 'A') | (upper == 'C') | (upper == 'G') |
+            (upper == 'T');
+
+        return isBase ? code : NOT_A_BASE;
+    }
+
+    /**
+     * Encode the given query.
+     */
+    EncodedQuery(const std::string& query);
+
+    /**
+     * Get the number of bases in the query.
+     */
+    inline size_t size() const {
+        return codes.size();
+    }
+
+    /**
+     * Get a view of the whole query along its forward strand.
+     */
+    inline View forward() const {
+        return View(codes.data(), 0, codes.size(), false);
+    }
+
+    /**
+     * Get a view of the whole query along its reverse strand.
+     */
+    inline View reverseComplement() const {
+        return View(codes.data(), 0, codes.size(), true);
+    }
+
+protected:
+    /**
+     * Holds the code for each base of the query, along its forward strand.
+     */
+    std::vector<uint8_t> codes;
+
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "EytzingerIndex.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+EytzingerIndex::EytzingerIndex(): count(0), keys(1), ranks(1) {
+    // Nothing to do. Entry 0 is always unused.
+}
+
+EytzingerIndex::EytzingerIndex(const std::vector<size_t>& sortedKeys):
+    count(sortedKeys.size()), keys(sortedKeys.size() + 1),
+    ranks(sortedKeys.size() + 1) {
+
+    if(!std::is_sorted(sortedKeys.begin(), sortedKeys.end())) {
+        throw std::runtime_error("Keys for an EytzingerIndex must be sorted");
+    }
+    
+    // An in-order walk of the tree visits the nodes in sorted order.
+    fill(sortedKeys, 0, 1);
+}
+
+size_t EytzingerIndex::fill(const std::vector<size_t>& sortedKeys,
+    size_t index, size_t k) {
+
+    if(k <= count) {
+        // Everything smaller goes on the left
+        index = fill(sortedKeys, index, 2 * k);
+        
+        // Then this node
+        keys[k] = sortedKeys[index];
+        ranks[k] = index;
+        index++;
+        
+        // Then everything larger on the right.
+        index = fill(sortedKeys, index, 2 * k + 1);
+    }
+    
+    return index;
+}
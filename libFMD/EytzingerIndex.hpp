@@ -0,0 +1,106 @@
+#ifndef EYTZINGERINDEX_HPP
+#define EYTZINGERINDEX_HPP
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Defines a static search structure over a sorted list of size_t keys, laid
+ * out in Eytzinger (breadth-first binary tree) order. Node k has children 2k
+ * and 2k + 1, so the first few levels of every search share the same few
+ * cache lines, and the next levels can be prefetched before they are needed.
+ * That beats binary search over a sorted array, and the rank/select chain of
+ * a bit vector, when the keys don't all fit in cache.
+ *
+ * Each node also remembers its key's rank in sorted order, so answers come out
+ * as counts that can index into any arrays kept in sorted order alongside.
+ */
+class EytzingerIndex {
+
+public:
+    /**
+     * Make an empty EytzingerIndex.
+     */
+    EytzingerIndex();
+    
+    /**
+     * Index the given keys, which must be sorted in ascending order. Throws a
+     * std::runtime_error if they are not.
+     */
+    EytzingerIndex(const std::vector<size_t>& sortedKeys);
+    
+    /**
+     * Get the number of keys stored.
+     */
+    inline size_t size() const {
+        return count;
+    }
+    
+    /**
+     * Count the keys less than or equal to the given value. This is the index
+     * in sorted order of the first key greater than the value.
+     */
+    inline size_t countAtMost(size_t value) const {
+        size_t k = 1;
+        while(k <= count) {
+            prefetch(k);
+            // Go right if this key is also at most the value.
+            k = 2 * k + (keys[k] <= value);
+        }
+        
+        // The answer is the last node where we went right. Drop the trailing
+        // left turns and that right turn.
+        k >>= __builtin_ffsll(k);
+        
+        return k == 0 ? 0 : ranks[k] + 1;
+    }
+    
+    /**
+     * Count the keys strictly less than the given value. This is the index in
+     * sorted order of the first key at least the value.
+     */
+    inline size_t countLess(size_t value) const {
+        size_t k = 1;
+        while(k <= count) {
+            prefetch(k);
+            // Go right if this key is also less than the value.
+            k = 2 * k + (keys[k] < value);
+        }
+        
+        // The answer is the last node where we went left. Drop the trailing
+        // right turns and that left turn.
+        k >>= __builtin_ffsll(~k);
+        
+        return k == 0 ? count : ranks[k];
+    }
+
+protected:
+    /**
+     * Fill in the subtree rooted at node k from the sorted keys, starting at
+     * the given sorted index. Returns the sorted index after the subtree.
+     */
+    size_t fill(const std::vector<size_t>& sortedKeys, size_t index, size_t k);
+    
+    /**
+     * Prefetch the node 4 levels below node k, which is where the search
+     * will be in 4 steps, give or take which of its 16 descendants it is.
+     * They are all next to each other.
+     */
+    inline void prefetch(size_t k) const {
+        if(16 * k <= count) {
+            __builtin_prefetch(keys.data() + 16 * k);
+        }
+    }
+
+    // How many keys are stored?
+    size_t count;
+    
+    // Holds the keys in Eytzinger order, 1-based, so entry 0 is unused.
+    std::vector<size_t> keys;
+    
+    // Holds the sorted-order index of each key, in the same order.
+    std::vector<size_t> ranks;
+
+};
+
+#endif
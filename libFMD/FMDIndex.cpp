@@ -4,21 +4,34 @@
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
+#include <set>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <exception>
 
 #include <Util.h>
 
 #include "FMDIndex.hpp"
 #include "util.hpp"
 #include "Log.hpp"
-
-thread_local std::map<const FMDIndex*, std::map<size_t,
-    std::map<size_t, std::string>::iterator>> FMDIndex::threadContigCache;
-
-FMDIndex::FMDIndex(std::string basename, SuffixArray* fullSuffixArray): names(),
-    starts(), lengths(), cumulativeLengths(), genomeAssignments(), endIndices(),
-    genomeRanges(), genomeMasks(), bwt(basename + ".bwt"),
-    suffixArray(basename + ".ssa"), fullSuffixArray(fullSuffixArray),
-    lcpArray(basename + ".lcp"), contigCache(), contigCacheMutex() {
+#include "TaskPool.hpp"
+#include "HugePages.hpp"
+
+FMDIndex::FMDIndex(std::string basename, SuffixArray* fullSuffixArray,
+    bool useFlatBWT): scaffoldNames(), scaffoldStarts(), starts(), lengths(),
+    cumulativeLengths(),
+    genomeAssignments(), endIndices(), genomeRanges(), genomeMasks(),
+    genomeMasksLoaded(false), bwt(basename + ".bwt"),
+    flatBWT(useFlatBWT ? new FlatBWT(bwt) : NULL),
+    kmerTable(NULL), minUniqueTable(NULL), kmerFilter(NULL),
+    suffixArray(basename + ".ssa"),
+    fullSuffixArray(fullSuffixArray), packedSuffixArray(NULL),
+    inverseSuffixArray(NULL), runSampledSuffixArray(NULL), packedText(NULL),
+    genomeMatrix(NULL),
+    lcpArray(NULL), loadMutex(), basename(basename), contigCache(),
+    locateCache() {
     
     // TODO: Too many initializers
 
@@ -27,156 +40,256 @@ FMDIndex::FMDIndex(std::string basename, SuffixArray* fullSuffixArray): names(),
     // We already loaded the index itself in the initializer. Go load the
     // length/order metadata.
     
-    // Open the contig name/start/length/genome file for reading. Temporary
-    // string survives until the end of the full expression.
-    std::ifstream contigFile((basename + ".contigs").c_str());
+    // Collect where each contig starts among all the bases, before encoding.
+    std::vector<size_t> cumulative;
     
-    // Keep a cumulative length sum
-    size_t lengthSum = 0;
+    // Contigs are added in order, and start a new scaffold unless they have
+    // the same name and genome as the contig before.
+    auto addContigName = [&](size_t contig, const char* name, size_t length) {
+        if(contig == 0 || genomeAssignments[contig] !=
+            genomeAssignments[contig - 1] || scaffoldNames.back().compare(0,
+            std::string::npos, name, length) != 0) {
+            
+            scaffoldStarts.push_back(contig);
+            scaffoldNames.emplace_back(name, length);
+        }
+    };
     
-    // Have a string to hold each line in turn.
-    std::string line;
-    while(std::getline(contigFile, line)) {
-        // For each <contig>\t<start>\t<length>\t<genome> line...
+    if(std::ifstream(basename + ".contigs.bin").good()) {
+        // We have the binary version of the metadata, which we can take in
+        // with one mapping instead of parsing.
+        MappedFile contigData(basename + ".contigs.bin");
         
-        // Make a stringstream we can read out of.
-        std::stringstream lineData(line);
+        // It's the number of contigs and the size of the name pool, then the
+        // numContigs + 1 name offsets into the pool, the starts, the lengths,
+        // and the genomes, all as 8-byte words, and then the name pool.
+        const size_t* words = (const size_t*) contigData.getData();
+        size_t wordCount = contigData.getSize() / sizeof(size_t);
         
-        // Read in the name of the contig
-        std::string contigName;
-        lineData >> contigName;
+        if(wordCount < 2 || wordCount < 3 + 4 * words[0] ||
+            contigData.getSize() < (3 + 4 * words[0]) * sizeof(size_t) +
+            words[1]) {
+            throw std::runtime_error("Truncated contig metadata for " +
+                basename);
+        }
         
-        // Add it to the vector of names in number order.
-        names.push_back(contigName);
+        size_t numContigs = words[0];
+        const size_t* nameOffsets = words + 2;
+        const size_t* startData = nameOffsets + numContigs + 1;
+        const size_t* lengthData = startData + numContigs;
+        const size_t* genomeData = lengthData + numContigs;
+        const char* namePool = (const char*) (genomeData + numContigs);
         
-        // Read in the contig start position on its scaffold
-        size_t startNumber;
-        lineData >> startNumber;
+        // Copy the fixed-width arrays in bulk.
+        starts.assign(startData, startData + numContigs);
+        lengths.assign(lengthData, lengthData + numContigs);
+        genomeAssignments.assign(genomeData, genomeData + numContigs);
         
-        // Add it to the vector of starts in number order.
-        starts.push_back(startNumber);
+        cumulative.reserve(numContigs);
+        size_t lengthSum = 0;
+        for(size_t i = 0; i < numContigs; i++) {
+            // Pull out each name and work out the cumulative length.
+            addContigName(i, namePool + nameOffsets[i],
+                nameOffsets[i + 1] - nameOffsets[i]);
+            cumulative.push_back(lengthSum);
+            lengthSum += lengths[i];
+        }
+    } else {
+        // Parse the tab-separated version.
+    
+        // Open the contig name/start/length/genome file for reading. Temporary
+        // string survives until the end of the full expression.
+        std::ifstream contigFile((basename + ".contigs").c_str());
+    
+        // Keep a cumulative length sum
+        size_t lengthSum = 0;
+    
+        // Have a string to hold each line in turn.
+        std::string line;
+        while(std::getline(contigFile, line)) {
+            // For each <contig>\t<start>\t<length>\t<genome> line...
         
-        // Read in the contig's length
-        size_t lengthNumber;
-        lineData >> lengthNumber;
+            // Make a stringstream we can read out of.
+            std::stringstream lineData(line);
         
-        // Add it to the vector of sizes in number order
-        lengths.push_back(lengthNumber);
+            // Read in the name of the contig
+            std::string contigName;
+            lineData >> contigName;
         
-        // And to the vector of cumulative lengths
-        cumulativeLengths.push_back(lengthSum);
-        lengthSum += lengthNumber;
+            // Read in the contig start position on its scaffold
+            size_t startNumber;
+            lineData >> startNumber;
         
-        // Read in the number of the genome that the contig belongs to.
-        size_t genomeNumber;
-        lineData >> genomeNumber;
+            // Add it to the vector of starts in number order.
+            starts.push_back(startNumber);
         
-        // Add it to the vector of genome assignments in number order
-        genomeAssignments.push_back(genomeNumber);
-    }
+            // Read in the contig's length
+            size_t lengthNumber;
+            lineData >> lengthNumber;
         
+            // Add it to the vector of sizes in number order
+            lengths.push_back(lengthNumber);
         
-    // Close up the contig file. We read our contig metadata.
-    contigFile.close();
-    
-    // Now read the genome bit masks.
-    
-    // What file are they in? Make sure to hold onto it while we construct the
-    // stream with its c_str pointer.
-    std::string genomeMaskFile = basename + ".msk";
-    
-    // Open the file where they live.
-    std::ifstream genomeMaskStream(genomeMaskFile.c_str(), std::ios::binary);
-    
-    while(genomeMaskStream.peek() != EOF && !genomeMaskStream.eof()) {
-        // As long as there is data left to read
+            // And to the vector of cumulative lengths
+            cumulative.push_back(lengthSum);
+            lengthSum += lengthNumber;
         
-        // Read a new GenericBitVector from the stream and put it in our list.
-        genomeMasks.push_back(new GenericBitVector(genomeMaskStream));
+            // Read in the number of the genome that the contig belongs to.
+            size_t genomeNumber;
+            lineData >> genomeNumber;
+        
+            // Add it to the vector of genome assignments in number order
+            genomeAssignments.push_back(genomeNumber);
+            
+            // Now we can tell if the contig starts a new scaffold.
+            addContigName(starts.size() - 1, contigName.data(),
+                contigName.size());
+        }
         
-        // This lets us autodetect how many genomes there are.
+        
+        // Close up the contig file. We read our contig metadata.
+        contigFile.close();
     }
     
-    // Now invert the contig-to-genome index to make the genome-to-contig-range
-    // index.
-    
-    // How many genomes are there?
-    size_t numGenomes = genomeMasks.size();
-    
-    // Make the genome range vector big enough. Fill it with empty ranges for
-    // genomes that somehow have no contigs.
-    genomeRanges.resize(numGenomes, std::make_pair(0, 0));
+    // Cap off the scaffolds.
+    scaffoldStarts.push_back(starts.size());
     
-    // Start out the first range.
-    std::pair<size_t, size_t> currentRange = std::make_pair(0, 0);
+    // Encode the cumulative lengths so we can go from base IDs to contigs.
+    cumulativeLengths = EliasFanoVector(cumulative);
     
-    // Which genome are we on?
-    size_t currentGenome;
+    // First make sure the vector is big enough for them.
+    endIndices.resize(getNumberOfContigs());
     
-    for(std::vector<size_t>::iterator i = genomeAssignments.begin(); 
-        i != genomeAssignments.end(); ++i) {
+    // The builder saves them, so try loading them first.
+    std::ifstream endFile((basename + ".end").c_str(), std::ios::binary);
+    size_t endCount = 0;
+    if(endFile.good()) {
+        // Read the number of contigs in platform-native byte order.
+        endFile.read((char*) &endCount, sizeof(size_t));
+    }
     
-        if(i == genomeAssignments.begin()) {
-            // We're starting. Grab this genome as our current genome (since the
-            // file may not start with genome 0).
-            // TODO: Maybe just require that?
-            currentGenome = *i;
-        }
+    if(endFile.good() && endCount == getNumberOfContigs()) {
+        // Read them all in at once.
+        endFile.read((char*) endIndices.data(), endCount * sizeof(int64_t));
         
-        if(*i == currentGenome) {
-            // This is the same genome as the last one. Extend the range.
-            currentRange.second++;
-        } else {
-            // This is now a different genome. Save the range.
-            genomeRanges[currentGenome] = currentRange;
-            
-            // Make a new range that comes after it, with length 1, since we
-            // include this contig.
-            currentRange = std::make_pair(currentRange.second,
-                currentRange.second + 1);
+        if(!endFile.good()) {
+            throw std::runtime_error("Truncated contig end file for " +
+                basename);
+        }
+    } else {
+        // Otherwise we have to find them ourselves, which takes a locate for
+        // every contig.
+        for(int64_t i = 0; i < getNumberOfContigs() * 2; i++) {
+            // The first #-of-texts rows in the BWT table have a '$' in the F
+            // column, so the L column (what our BWT string actually is) will
+            // have the last real character in some text.
             
-            // Remember what new genome we're looking at.
-            currentGenome = *i;
+            // Locate it to a text and offset
+            TextPosition position = locate(i);
             
-            if(currentGenome >= numGenomes) {
-                // Complain if we have a genome number higher than the number of
-                // masks we loaded.
-                throw std::runtime_error(
-                    "Got a contig for a genome with no mask!");
+            if(position.getText() % 2 == 0) {
+                // This is a forward strand. Save the index of the last real
+                // character in the forward strand of the contig.
+                endIndices[position.getText() / 2] = i;
             }
+            
         }
+    }
     
+    if(std::ifstream(basename + ".kmi").good()) {
+        // We have a k-mer table saved. Load it too.
+        kmerTable = new KmerTable(basename + ".kmi");
     }
     
-    // Save the last range
-    genomeRanges[currentGenome] = currentRange;
+    if(std::ifstream(basename + ".mus").good()) {
+        // We have minimal unique substring lengths saved. Map them too.
+        minUniqueTable = new MinUniqueTable(basename + ".mus");
+        
+        if(minUniqueTable->getNumberOfTexts() != getNumberOfContigs() * 2) {
+            // Make sure it actually goes with this index.
+            throw std::runtime_error("Minimal unique length table in " +
+                basename + " has the wrong number of texts");
+        }
+    }
     
-    // First make sure the vector is big enough for them.
-    endIndices.resize(getNumberOfContigs());
+    if(std::ifstream(basename + ".kmf").good()) {
+        // We have a filter of the index's k-mers. Map it too.
+        kmerFilter = new KmerFilter(basename + ".kmf");
+    }
     
-    for(int64_t i = 0; i < getNumberOfContigs() * 2; i++) {
-        // The first #-of-texts rows in the BWT table have a '$' in the F
-        // column, so the L column (what our BWT string actually is) will have
-        // the last real character in some text.
+    if(std::ifstream(basename + ".isa").good()) {
+        // We have a sampled inverse suffix array for random access to contigs.
+        // Older indexes don't, and have to walk from contig ends instead.
+        inverseSuffixArray = new SampledInverseSuffixArray(basename + ".isa");
         
-        // Locate it to a text and offset
-        TextPosition position = locate(i);
+        if(inverseSuffixArray->getSampleRate() == 0) {
+            // Don't go dividing by 0 later.
+            throw std::runtime_error("Inverse suffix array in " + basename +
+                " has no sample rate");
+        }
+    }
+    
+    if(std::ifstream(basename + ".rsa").good()) {
+        // We have a suffix array sampled at BWT run boundaries, so the regular
+        // one may be hardly sampled at all.
+        runSampledSuffixArray = new RunSampledSuffixArray(basename + ".rsa");
+    }
+    
+    if(std::ifstream(basename + ".psa").good()) {
+        // We have a packed full suffix array, so we can locate without
+        // walking.
+        packedSuffixArray = new PackedSuffixArray(basename + ".psa");
         
-        if(position.getText() % 2 == 0) {
-            // This is a forward strand. Save the index of the last real
-            // character in the forward strand of the contig.
-            endIndices[position.getText() / 2] = i;
+        if(packedSuffixArray->getSize() != (size_t) getBWTLength() ||
+            packedSuffixArray->getNumberOfTexts() !=
+            getNumberOfContigs() * 2) {
+            
+            // Make sure it actually goes with this index.
+            throw std::runtime_error("Packed suffix array in " + basename +
+                " has the wrong number of rows or texts");
         }
+    }
+    
+    if(std::ifstream(basename + ".txt").good()) {
+        // We have a packed copy of the contigs to display bases from.
+        packedText = new PackedText(basename + ".txt");
         
+        if(packedText->getNumberOfContigs() != getNumberOfContigs()) {
+            // Make sure it actually goes with this index.
+            throw std::runtime_error("Packed text in " + basename +
+                " has the wrong number of contigs");
+        }
+    }
+    
+    if(std::ifstream(basename + ".gwm").good()) {
+        // We have a wavelet matrix for counting genomes in ranges.
+        genomeMatrix = new WaveletMatrix(basename + ".gwm");
+        
+        if(!genomeAssignments.empty() && genomeMatrix->getAlphabetSize() <=
+            *std::max_element(genomeAssignments.begin(),
+            genomeAssignments.end())) {
+            
+            // Make sure it actually goes with this index. We check it against
+            // the number of masks when they get loaded.
+            throw std::runtime_error("Genome matrix in " + basename +
+                " has the wrong number of genomes");
+        }
     }
     
-    Log::info() << "Loaded " << names.size() << " contigs in " << numGenomes <<
-        " genomes" << std::endl;
+    if(HugePages::isEnabled()) {
+        // Back the big arrays we read into memory with huge pages. The mapped
+        // ones, like the LCP array, already asked for them.
+        HugePages::countAdvised(bwt.adviseHugePages() +
+            suffixArray.adviseHugePages());
+    }
+    
+    Log::info() << "Loaded " << starts.size() << " contigs on " <<
+        scaffoldNames.size() << " scaffolds" << std::endl;
 }
 
 FMDIndex::~FMDIndex() {
-    // Drop any entries for this object from the thread-local static cache
-    // (which is supposed to be simulating thread-local members).
+    // Drop this thread's reference into our contig cache. Other threads'
+    // references just expire.
     clearThreadLocalCache();
 
     if(fullSuffixArray != NULL) {
@@ -184,12 +297,192 @@ FMDIndex::~FMDIndex() {
         delete fullSuffixArray;
     }
     
+    if(packedSuffixArray != NULL) {
+        // Or a packed one.
+        delete packedSuffixArray;
+    }
+    
+    if(flatBWT != NULL) {
+        // Same for the flat BWT copy.
+        delete flatBWT;
+    }
+    
+    if(kmerTable != NULL) {
+        // And the k-mer table
+        delete kmerTable;
+    }
+    
+    if(minUniqueTable != NULL) {
+        // And the minimal unique length table
+        delete minUniqueTable;
+    }
+    
+    if(kmerFilter != NULL) {
+        // And the k-mer filter
+        delete kmerFilter;
+    }
+    
+    if(inverseSuffixArray != NULL) {
+        // And the inverse suffix array samples
+        delete inverseSuffixArray;
+    }
+    
+    if(runSampledSuffixArray != NULL) {
+        // And the run boundary suffix array samples
+        delete runSampledSuffixArray;
+    }
+    
+    if(packedText != NULL) {
+        // And the packed contigs
+        delete packedText;
+    }
+    
+    if(genomeMatrix != NULL) {
+        // And the genome wavelet matrix
+        delete genomeMatrix;
+    }
+    
     for(std::vector<GenericBitVector*>::iterator i = genomeMasks.begin(); 
         i != genomeMasks.end(); ++i) {
         
         // Also delete all the genome masks we loaded.
         delete (*i);
     }
+    
+    // And the LCP array, if we loaded it.
+    delete lcpArray.load();
+}
+
+const std::vector<GenericBitVector*>& FMDIndex::getGenomeMasks() const {
+    if(genomeMasksLoaded.load(std::memory_order_acquire)) {
+        // They're already loaded.
+        return genomeMasks;
+    }
+    
+    std::lock_guard<std::mutex> lock(loadMutex);
+    if(genomeMasksLoaded.load(std::memory_order_relaxed)) {
+        // Another thread loaded them while we waited.
+        return genomeMasks;
+    }
+    
+    // Load into these, so a failure doesn't leave anything half-loaded.
+    std::vector<GenericBitVector*> masks;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    
+    try {
+        // What file are they in? Make sure to hold onto it while we construct
+        // the stream with its c_str pointer.
+        std::string genomeMaskFile = basename + ".msk";
+        
+        // Open the file where they live.
+        std::ifstream genomeMaskStream(genomeMaskFile.c_str(),
+            std::ios::binary);
+        
+        while(genomeMaskStream.peek() != EOF && !genomeMaskStream.eof()) {
+            // As long as there is data left to read
+            
+            // Read a new GenericBitVector from the stream and put it in our
+            // list.
+            masks.push_back(new GenericBitVector(genomeMaskStream));
+            
+            // This lets us autodetect how many genomes there are.
+        }
+        
+        // Now invert the contig-to-genome index to make the
+        // genome-to-contig-range index.
+        
+        // How many genomes are there?
+        size_t numGenomes = masks.size();
+        
+        if(genomeMatrix != NULL &&
+            genomeMatrix->getAlphabetSize() != numGenomes) {
+            
+            // Make sure the genome matrix actually goes with this index.
+            throw std::runtime_error("Genome matrix in " + basename +
+                " has the wrong number of genomes");
+        }
+        
+        // Make the genome range vector big enough. Fill it with empty ranges
+        // for genomes that somehow have no contigs.
+        ranges.resize(numGenomes, std::make_pair(0, 0));
+        
+        // Start out the first range.
+        std::pair<size_t, size_t> currentRange = std::make_pair(0, 0);
+        
+        // Which genome are we on?
+        size_t currentGenome;
+        
+        for(std::vector<size_t>::const_iterator i = genomeAssignments.begin();
+            i != genomeAssignments.end(); ++i) {
+        
+            if(i == genomeAssignments.begin()) {
+                // We're starting. Grab this genome as our current genome
+                // (since the file may not start with genome 0).
+                // TODO: Maybe just require that?
+                currentGenome = *i;
+            }
+            
+            if(*i == currentGenome) {
+                // This is the same genome as the last one. Extend the range.
+                currentRange.second++;
+            } else {
+                // This is now a different genome. Save the range.
+                ranges[currentGenome] = currentRange;
+                
+                // Make a new range that comes after it, with length 1, since
+                // we include this contig.
+                currentRange = std::make_pair(currentRange.second,
+                    currentRange.second + 1);
+                
+                // Remember what new genome we're looking at.
+                currentGenome = *i;
+                
+                if(currentGenome >= numGenomes) {
+                    // Complain if we have a genome number higher than the
+                    // number of masks we loaded.
+                    throw std::runtime_error(
+                        "Got a contig for a genome with no mask!");
+                }
+            }
+        
+        }
+        
+        if(!genomeAssignments.empty()) {
+            // Save the last range
+            ranges[currentGenome] = currentRange;
+        }
+    } catch(...) {
+        for(GenericBitVector* mask : masks) {
+            delete mask;
+        }
+        throw;
+    }
+    
+    genomeMasks = std::move(masks);
+    genomeRanges = std::move(ranges);
+    genomeMasksLoaded.store(true, std::memory_order_release);
+    
+    Log::info() << "Loaded " << genomeMasks.size() << " genome masks from " <<
+        basename << std::endl;
+    
+    return genomeMasks;
+}
+
+const LCPArray& FMDIndex::getLCPArray() const {
+    LCPArray* loaded = lcpArray.load(std::memory_order_acquire);
+    if(loaded != NULL) {
+        // It's already loaded.
+        return *loaded;
+    }
+    
+    std::lock_guard<std::mutex> lock(loadMutex);
+    loaded = lcpArray.load(std::memory_order_relaxed);
+    if(loaded == NULL) {
+        // Nobody loaded it while we waited, so load it ourselves.
+        loaded = new LCPArray(basename + ".lcp");
+        lcpArray.store(loaded, std::memory_order_release);
+    }
+    return *loaded;
 }
 
 size_t FMDIndex::getContigNumber(TextPosition base) const {
@@ -238,14 +531,22 @@ size_t FMDIndex::getBaseID(TextPosition base) const {
     return total + getContigOffset(base) - 1;
 }
 
+std::pair<size_t, size_t> FMDIndex::getContigAndOffset(size_t baseID) const {
+    // The contig is the last one starting at or before the base.
+    size_t contig = cumulativeLengths.rank(baseID) - 1;
+    
+    // Convert to a 1-based offset in that contig.
+    return std::make_pair(contig, baseID - cumulativeLengths[contig] + 1);
+}
+
 size_t FMDIndex::getNumberOfContigs() const {
     // How many contigs do we know about?
-    return names.size();
+    return starts.size();
 }
     
 const std::string& FMDIndex::getContigName(size_t index) const {
-    // Get the name of that contig.
-    return names[index];
+    // Contigs share the name of their scaffold.
+    return scaffoldNames[getContigScaffold(index)];
 }
 
 size_t FMDIndex::getContigStart(size_t index) const {
@@ -266,11 +567,13 @@ size_t FMDIndex::getContigGenome(size_t index) const {
 size_t FMDIndex::getNumberOfGenomes() const {
     // Get the number of genomes that are in the index.
     // TODO: Several things are this length. There should only be one.
-    return genomeMasks.size();
+    return getGenomeMasks().size();
 }
     
 std::pair<size_t, size_t> FMDIndex::getGenomeContigs(size_t genome) const {
-    // Get the range of contigs belonging to the given genome.
+    // Get the range of contigs belonging to the given genome, which are worked
+    // out along with the masks.
+    getGenomeMasks();
     return genomeRanges[genome];
 }
 
@@ -282,12 +585,105 @@ size_t FMDIndex::getGenomeLength(size_t genome) {
     return getContigStart(lastContig) + getContigLength(lastContig);
 }
 
+size_t FMDIndex::getNumberOfScaffolds() const {
+    return scaffoldNames.size();
+}
+
+size_t FMDIndex::getContigScaffold(size_t index) const {
+    // Find the last scaffold starting at or before the contig.
+    return std::upper_bound(scaffoldStarts.begin(), scaffoldStarts.end(),
+        index) - scaffoldStarts.begin() - 1;
+}
+
+std::pair<size_t, size_t> FMDIndex::getScaffoldContigs(size_t scaffold) const {
+    return std::make_pair(scaffoldStarts[scaffold],
+        scaffoldStarts[scaffold + 1]);
+}
+
+std::pair<size_t, size_t> FMDIndex::getGenomeScaffolds(size_t genome) const {
+    auto contigs = getGenomeContigs(genome);
+    if(contigs.first == contigs.second) {
+        // A genome with no contigs has no scaffolds either.
+        return std::make_pair(0, 0);
+    }
+    
+    // Scaffolds don't cross genomes, so they line up with the contigs.
+    return std::make_pair(getContigScaffold(contigs.first),
+        getContigScaffold(contigs.second - 1) + 1);
+}
+
 bool FMDIndex::isInGenome(int64_t bwtIndex, size_t genome) const {
-    return genomeMasks[genome]->isSet(bwtIndex);
+    return getGenomeMasks()[genome]->isSet(bwtIndex);
+}
+
+bool FMDIndex::hasGenomeMatrix() const {
+    return genomeMatrix != NULL;
+}
+
+size_t FMDIndex::countInGenome(int64_t start, int64_t end,
+    size_t genome) const {
+    
+    if(start >= end) {
+        return 0;
+    }
+    
+    if(genomeMatrix != NULL) {
+        // Ask the wavelet matrix.
+        return genomeMatrix->rank(genome, start, end);
+    }
+    
+    // Otherwise take ranks in the genome's mask, which count 1s up to and
+    // including the given index.
+    const GenericBitVector& mask = *getGenomeMasks()[genome];
+    return mask.rank(end - 1) - (start > 0 ? mask.rank(start - 1) : 0);
+}
+
+size_t FMDIndex::countInGenomes(int64_t start, int64_t end,
+    const std::vector<size_t>& genomes) const {
+    
+    if(start >= end) {
+        return 0;
+    }
+    
+    if(genomeMatrix != NULL) {
+        // The wavelet matrix can do them all at once.
+        return genomeMatrix->rank(genomes, start, end);
+    }
+    
+    // Otherwise add up each genome, once each.
+    std::set<size_t> unique(genomes.begin(), genomes.end());
+    size_t total = 0;
+    for(size_t genome : unique) {
+        total += countInGenome(start, end, genome);
+    }
+    return total;
+}
+
+std::vector<std::pair<size_t, size_t>> FMDIndex::getGenomesInRange(
+    int64_t start, int64_t end) const {
+    
+    if(start >= end) {
+        return std::vector<std::pair<size_t, size_t>>();
+    }
+    
+    if(genomeMatrix != NULL) {
+        // The wavelet matrix only visits genomes that are there.
+        return genomeMatrix->distinct(start, end);
+    }
+    
+    // Otherwise try every genome.
+    std::vector<std::pair<size_t, size_t>> found;
+    for(size_t genome = 0; genome < getNumberOfGenomes(); genome++) {
+        size_t count = countInGenome(start, end, genome);
+        if(count > 0) {
+            found.push_back(std::make_pair(genome, count));
+        }
+    }
+    return found;
 }
 
 const GenericBitVector& FMDIndex::getGenomeMask(size_t genome) const {
-    return *genomeMasks[genome];
+    return *getGenomeMasks()[genome];
 }
 
 TextPosition FMDIndex::getTextPosition(
@@ -314,14 +710,75 @@ TextPosition FMDIndex::getTextPosition(
 
 int64_t FMDIndex::getTotalLength() const {
     // Sum all the contig lengths and double (to make it be for both strands).
-    // See <http://stackoverflow.com/a/3221813/402891>
-    return std::accumulate(lengths.begin(), lengths.end(), 0) * 2;
+    // See <http://stackoverflow.com/a/3221813/402891>. Sum as the right type,
+    // so big genomes don't overflow an int.
+    return std::accumulate(lengths.begin(), lengths.end(), (int64_t) 0) * 2;
 }
 
 int64_t FMDIndex::getBWTLength() const {
     return bwt.getBWLen();
 }
 
+std::map<std::string, size_t> FMDIndex::getMemoryUsage() const {
+    std::map<std::string, size_t> usage;
+    
+    // Count up all the per-contig metadata together.
+    size_t contigBytes = scaffoldNames.capacity() * sizeof(std::string);
+    for(const std::string& name : scaffoldNames) {
+        contigBytes += name.capacity();
+    }
+    contigBytes += (scaffoldStarts.capacity() + starts.capacity() +
+        lengths.capacity() + genomeAssignments.capacity()) * sizeof(size_t) +
+        endIndices.capacity() * sizeof(int64_t) +
+        cumulativeLengths.getMemoryUsage();
+    if(genomeMasksLoaded.load(std::memory_order_acquire)) {
+        // The genome ranges only exist once the masks are loaded.
+        contigBytes += genomeRanges.capacity() *
+            sizeof(std::pair<size_t, size_t>);
+    }
+    usage["contigs"] = contigBytes;
+    
+    usage["bwtRuns"] = bwt.getRunBytes();
+    usage["bwtMarkers"] = bwt.getMarkerBytes();
+    usage["flatBWT"] = flatBWT != NULL ? flatBWT->getMemoryUsage() : 0;
+    usage["kmerTable"] = kmerTable != NULL ? kmerTable->getMemoryUsage() : 0;
+    usage["minUniqueTable"] = minUniqueTable != NULL ?
+        minUniqueTable->getMemoryUsage() : 0;
+    usage["kmerFilter"] = kmerFilter != NULL ?
+        kmerFilter->getMemoryUsage() : 0;
+    
+    usage["suffixArray"] = suffixArray.getMemoryUsage();
+    usage["fullSuffixArray"] = fullSuffixArray != NULL ?
+        fullSuffixArray->getSize() * sizeof(SAElem) : 0;
+    usage["packedSuffixArray"] = packedSuffixArray != NULL ?
+        packedSuffixArray->getMemoryUsage() : 0;
+    usage["inverseSuffixArray"] = inverseSuffixArray != NULL ?
+        inverseSuffixArray->getMemoryUsage() : 0;
+    usage["runSampledSuffixArray"] = runSampledSuffixArray != NULL ?
+        runSampledSuffixArray->getMemoryUsage() : 0;
+    usage["packedText"] = packedText != NULL ? packedText->getMemoryUsage() :
+        0;
+    
+    // Only count the masks and LCP array if something has loaded them.
+    size_t maskBytes = 0;
+    if(genomeMasksLoaded.load(std::memory_order_acquire)) {
+        maskBytes = genomeMasks.capacity() * sizeof(GenericBitVector*);
+        for(GenericBitVector* mask : genomeMasks) {
+            maskBytes += mask->getMemoryUsage();
+        }
+    }
+    usage["genomeMasks"] = maskBytes;
+    usage["genomeMatrix"] = genomeMatrix != NULL ?
+        genomeMatrix->getMemoryUsage() : 0;
+    
+    const LCPArray* loadedLCP = lcpArray.load(std::memory_order_acquire);
+    usage["lcpArray"] = loadedLCP != NULL ? loadedLCP->getMemoryUsage() : 0;
+    usage["contigCache"] = contigCache.getCachedBytes();
+    usage["locateCache"] = locateCache.getMemoryUsage();
+    
+    return usage;
+}
+
 FMDPosition FMDIndex::getCoveringPosition() const {
     // We want an FMDPosition that covers the entire BWT.
     
@@ -342,7 +799,7 @@ FMDPosition FMDIndex::getCharPosition(char c) const {
     int64_t reverseStart = bwt.getPC(complement(c));
     
     // Get the offset to the end of the first interval (as well as the second).
-    int64_t offset = bwt.getOcc(c, bwt.getBWLen() - 1) - 1;
+    int64_t offset = getOcc(c, bwt.getBWLen() - 1) - 1;
 
     // Make the FMDPosition.
     return FMDPosition(forwardStart, reverseStart, offset);
@@ -355,63 +812,37 @@ void FMDIndex::extendFast(FMDPosition& range, char c, bool backward) const {
     
     // Skip any sort of argument validation.
     
-    if(!backward) {
-        // Flip the arguments around so we can work on the reverse strand.
-        c = complement(c);
-        range.flipInPlace();
+    // Hand off to the kernel for the right direction, which works on whichever
+    // strand's interval it needs to without flipping anything.
+    uint8_t code = DNA_ALPHABET::getBaseRank(c);
+    if(backward) {
+        extendLeft(range, code);
+    } else {
+        extendRight(range, code);
     }
     
-    // Read occurrences of everything from the BWT
-    
-    // What rank among occurrences is the first instance of every character in
-    // the BWT range?
-    AlphaCount64 startRanks = bwt.getFullOcc(range.getForwardStart() - 1);
-    
-    // And the last? If endOffset() is 0, this will be 1 character later than
-    // the call for startRanks, which is what we want.
-    AlphaCount64 endRanks = bwt.getFullOcc(range.getForwardStart() + 
-        range.getEndOffset());
-        
-    // Get the number of suffixes that had '$' (end of text) next. TODO: should
-    // this be '\0' instead?
-    range.setReverseStart(range.getReverseStart() + 
-        (endRanks.get('$') - startRanks.get('$')));
-        
-    for(size_t base = 0; base < NUM_BASES; base++) {
-        // For each base in alphabetical order by reverse complement
-        
-        // Work out the length of the interval this base gets.
-        size_t intervalLength = endRanks.get(BASES[base]) - 
-            startRanks.get(BASES[base]);
-        
-        if(BASES[base] == c) {
-            // This is the base we're looking for. Finish up and break out of
-            // the loop.
-            
-            // Range reverse start is already set.
-            
-            // Set the range forward start.
-            range.setForwardStart(bwt.getPC(c) + startRanks.get(c));
-            
-            // Set the range length.
-            range.setEndOffset((int64_t)intervalLength - 1);
-            
-            // Now we've put together the range.
-            break;
+}
+   
+void FMDIndex::extendBatch(std::vector<FMDPosition>& ranges,
+    const char* chars, bool backward) const {
+    
+    for(size_t i = 0; i < ranges.size(); i++) {
+        // First pass: ask for the occurrence markers every range is going to
+        // need. extendFast works on the forward interval when going backward,
+        // and on the reverse interval (after flipping) when going forward.
+        int64_t start = backward ? ranges[i].getForwardStart() :
+            ranges[i].getReverseStart();
             
-        } else {
-            // This is not the base we're looking for. Budge the reverse strand
-            // interval over by the length of the interval, to account for the
-            // bit this base took up.
-            range.setReverseStart(range.getReverseStart() + intervalLength);
-        }
+        // Prefetch for the two getFullOcc calls extendFast will make.
+        prefetchOcc(start - 1);
+        prefetchOcc(start + ranges[i].getEndOffset());
     }
     
-    if(!backward) {
-        // Flip the result since we were working on the opposite strand.
-        range.flipInPlace();
+    for(size_t i = 0; i < ranges.size(); i++) {
+        // Second pass: actually do the extensions. By now the markers for the
+        // earlier ranges should be in cache.
+        extendFast(ranges[i], chars[i], backward);
     }
-    
 }
    
 FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
@@ -443,8 +874,8 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
         throw std::runtime_error(errorMessage);
     }
 
-    Log::trace() << "Extending " << range << " backwards with " << c <<
-        std::endl;
+    LOG_TRACE("Extending " << range << " backwards with " << c <<
+        std::endl);
 
     // We have an array of FMDPositions, one per base, that we will fill in by a
     // tiny dynamic programming.
@@ -453,21 +884,21 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
     for(size_t base = 0; base < NUM_BASES; base++) {
         // Go through the bases in arbitrary order.
 
-        Log::trace() << "\tThinking about base " << base << "(" << 
-            BASES[base] << ")" << std::endl;
+        LOG_TRACE("\tThinking about base " << base << "(" << 
+            BASES[base] << ")" << std::endl);
 
         // Count up the number of characters < this base.
         int64_t start = bwt.getPC(c);
 
-        Log::trace() << "\t\tstart = " << start << std::endl;
+        LOG_TRACE("\t\tstart = " << start << std::endl);
 
         // Get the rank among occurrences of the first instance of this base in
         // this slice.
-        int64_t forwardStartRank = bwt.getOcc(BASES[base], 
+        int64_t forwardStartRank = getOcc(BASES[base], 
             range.getForwardStart() - 1);
         
         // Get the same rank for the last instance. TODO: Is the -1 right here?
-        int64_t forwardEndRank = bwt.getOcc(BASES[base], 
+        int64_t forwardEndRank = getOcc(BASES[base], 
             range.getForwardStart() + range.getEndOffset()) - 1;
 
         // Fill in the forward-strand start position and range end offset for
@@ -475,7 +906,7 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
         answers[base].setForwardStart(start + forwardStartRank);
         answers[base].setEndOffset(forwardEndRank - forwardStartRank);
 
-        Log::trace() << "\t\tWould go to: " << answers[base] << std::endl;
+        LOG_TRACE("\t\tWould go to: " << answers[base] << std::endl);
     }
 
     // Since we don't keep an FMDPosition for the non-base end-of-text
@@ -495,19 +926,19 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
     }
 
 
-    Log::trace() << "\tendOfTextLength = " << endOfTextLength << std::endl;
+    LOG_TRACE("\tendOfTextLength = " << endOfTextLength << std::endl);
 
     // The endOfText character is the very first character we need to account
     // for when subdividing the reverse range and picking which subdivision to
     // take.
-    Log::trace() << "\tendOfText reverse_start would be " << 
-        range.getReverseStart() << std::endl;
+    LOG_TRACE("\tendOfText reverse_start would be " << 
+        range.getReverseStart() << std::endl);
 
     // Next, allocate the range for the base that comes first in alphabetical
     // order by reverse complement.
     answers[0].setReverseStart(range.getReverseStart() + endOfTextLength);
-    Log::trace() << "\t" << BASES[0] << " reverse_start is " << 
-        answers[0].getReverseStart() << std::endl;
+    LOG_TRACE("\t" << BASES[0] << " reverse_start is " << 
+        answers[0].getReverseStart() << std::endl);
 
     for(size_t base = 1; base < NUM_BASES; base++)
     {
@@ -516,8 +947,8 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
 
         answers[base].setReverseStart(answers[base - 1].getReverseStart() + 
             answers[base - 1].getLength());
-        Log::trace() << "\t" << BASES[base] << " reverse_start is " << 
-        answers[base].getReverseStart() << std::endl;
+        LOG_TRACE("\t" << BASES[base] << " reverse_start is " << 
+        answers[base].getReverseStart() << std::endl);
     }
 
     // Now all the per-base answers are filled in.
@@ -530,8 +961,8 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
             // This is the base we're actually supposed to be extending with. Return
             // its answer.
             
-            Log::trace() << "Moving " << range << " to " << answers[base] << 
-                " on " << BASES[base] << std::endl;
+            LOG_TRACE("Moving " << range << " to " << answers[base] << 
+                " on " << BASES[base] << std::endl);
             
             return answers[base];
         }
@@ -542,6 +973,76 @@ FMDPosition FMDIndex::extend(FMDPosition range, char c, bool backward) const {
     throw std::runtime_error("Unrecognized base");
 }
 
+void FMDIndex::extendAll(const FMDPosition& range, bool backward,
+    FMDPosition out[NUM_BASES]) const {
+    
+    // Work on a copy, flipped if we need to go forward so we can do backward
+    // search on the reverse strand like extendFast does.
+    FMDPosition toExtend = range;
+    if(!backward) {
+        toExtend.flipInPlace();
+    }
+    
+    // Do the only two occurrence lookups we need, just like extendFast.
+    AlphaCount64 startRanks;
+    AlphaCount64 endRanks;
+    getFullOccPair(toExtend.getForwardStart() - 1, toExtend.getForwardStart() +
+        toExtend.getEndOffset(), startRanks, endRanks);
+        
+    // Keep track of where the next base's reverse interval starts. Things
+    // followed by '$' come first.
+    int64_t reverseStart = toExtend.getReverseStart() + 
+        (endRanks.get('$') - startRanks.get('$'));
+        
+    // Holds the backward extension by each base, in BASES order.
+    FMDPosition backwardAnswers[NUM_BASES];
+        
+    for(size_t base = 0; base < NUM_BASES; base++) {
+        // For each base in alphabetical order by reverse complement, carve its
+        // piece off the front of what's left of the reverse interval.
+        char c = BASES[base];
+        size_t intervalLength = endRanks.get(c) - startRanks.get(c);
+        
+        backwardAnswers[base] = FMDPosition(bwt.getPC(c) + startRanks.get(c),
+            reverseStart, (int64_t)intervalLength - 1);
+            
+        reverseStart += intervalLength;
+    }
+    
+    for(size_t base = 0; base < NUM_BASES; base++) {
+        if(backward) {
+            // We did exactly what was asked.
+            out[base] = backwardAnswers[base];
+        } else {
+            // Extending forward with a base is extending the flipped interval
+            // backward with its complement, and then flipping back.
+            out[base] = backwardAnswers[BASES.find(complement(BASES[base]))];
+            out[base].flipInPlace();
+        }
+    }
+}
+
+void FMDIndex::extendLeftOnlyAll(const FMDPosition& range,
+    FMDPosition out[NUM_BASES]) const {
+    
+    // Get the occurrences of everything before and in the range.
+    AlphaCount64 startRanks;
+    AlphaCount64 endRanks;
+    getFullOccPair(range.getForwardStart() - 1, range.getForwardStart() +
+        range.getEndOffset(), startRanks, endRanks);
+        
+    for(size_t base = 0; base < NUM_BASES; base++) {
+        // Each base gets the forward interval extendLeftOnly would give it.
+        char c = BASES[base];
+        out[base] = range;
+        out[base].setForwardStart(bwt.getPC(c) + startRanks.get(c));
+        out[base].setEndOffset((int64_t)(endRanks.get(c) - startRanks.get(c)) -
+            1);
+        
+        // Leave the reverse interval alone
+    }
+}
+
 void FMDIndex::extendLeftOnly(FMDPosition& range, char c) const {
 
     // Extend the search with this character in an optimized way. We work on our
@@ -557,10 +1058,10 @@ void FMDIndex::extendLeftOnly(FMDPosition& range, char c) const {
     
     // Get the rank among occurrences of the first instance of this base in
     // this slice.
-    int64_t forwardStartRank = bwt.getOcc(c, range.getForwardStart() - 1);
+    int64_t forwardStartRank = getOcc(c, range.getForwardStart() - 1);
     
     // Get the same rank for the last instance.
-    int64_t forwardEndRank = bwt.getOcc(c, range.getForwardStart() + 
+    int64_t forwardEndRank = getOcc(c, range.getForwardStart() + 
         range.getEndOffset()) - 1;
 
     // Fill in the forward-strand start position and range end offset for
@@ -584,8 +1085,8 @@ void FMDIndex::retractRightOnly(FMDPosition& range,
     size_t rangeStart = range.getForwardStart();
     size_t rangeEnd = range.getForwardStart() + range.getEndOffset() + 1;
     
-    Log::trace() << "Retracting from [" << rangeStart << ", " << rangeEnd << 
-        ")" << std::endl;
+    LOG_TRACE("Retracting from [" << rangeStart << ", " << rangeEnd << 
+        ")" << std::endl);
     
     // rangeEnd may be actually past the end of the LCP array now. That is OK,
     // we just get 0 and an LCP NSV of the same position in that case.
@@ -606,8 +1107,8 @@ void FMDIndex::retractRightOnly(FMDPosition& range,
     // Now lcpIndex is guaranteed to be a real index in the LCP array, not off
     // the end.
     
-    Log::trace() << "Parent node string depth: " << lcp << " at " << lcpIndex <<
-        std::endl;
+    LOG_TRACE("Parent node string depth: " << lcp << " at " << lcpIndex <<
+        std::endl);
     
     // The larger LCP value cuts down to the string depth of the parent.
     
@@ -654,8 +1155,8 @@ size_t FMDIndex::retractRightOnly(FMDPosition& range) const {
     size_t rangeStart = range.getForwardStart();
     size_t rangeEnd = range.getForwardStart() + range.getEndOffset() + 1;
     
-    Log::trace() << "Retracting from [" << rangeStart << ", " << rangeEnd << 
-        ")" << std::endl;
+    LOG_TRACE("Retracting from [" << rangeStart << ", " << rangeEnd << 
+        ")" << std::endl);
     
     // rangeEnd may be actually past the end of the LCP array now. That is OK,
     // we just get 0 and an LCP NSV of the same position in that case.
@@ -676,8 +1177,8 @@ size_t FMDIndex::retractRightOnly(FMDPosition& range) const {
     // Now lcpIndex is guaranteed to be a real index in the LCP array, not off
     // the end.
     
-    Log::trace() << "Parent node string depth: " << lcp << " at " << lcpIndex <<
-        std::endl;
+    LOG_TRACE("Parent node string depth: " << lcp << " at " << lcpIndex <<
+        std::endl);
     
     // The larger LCP value cuts down to the string depth of the parent.
     
@@ -707,11 +1208,14 @@ FMDPosition FMDIndex::count(std::string pattern) const {
         return getCoveringPosition();
     }
     
-
-    // Start at the end and select the first character.
-    FMDPosition position = getCharPosition(pattern[pattern.size() - 1]);
+    // Holds the search results so far
+    FMDPosition position;
+    
+    // Look up as much of the end of the pattern as we can all at once.
+    size_t jump = startCount(pattern, position);
     
-    for(int i = pattern.size() - 2; position.getLength() > 0 && i >= 0; i--) {
+    for(int i = pattern.size() - jump - 1; position.getLength() > 0 && i >= 0;
+        i--) {
         // Extend backwards with each character
         extendFast(position, pattern[i], true);
     }
@@ -721,13 +1225,144 @@ FMDPosition FMDIndex::count(std::string pattern) const {
 
 }
 
+void FMDIndex::countBatch(const std::vector<std::string>& patterns,
+    std::vector<FMDPosition>& results) const {
+    
+    results.resize(patterns.size());
+    
+    // Which pattern is each lane working on?
+    size_t lanePatterns[COUNT_BATCH_SIZE];
+    // How many characters of it are left to search?
+    size_t laneRemaining[COUNT_BATCH_SIZE];
+    // And where has its search got to?
+    FMDPosition lanePositions[COUNT_BATCH_SIZE];
+    
+    // How many lanes are busy? They are always the first ones.
+    size_t busy = 0;
+    // Which pattern is next to start?
+    size_t next = 0;
+    
+    while(busy > 0 || next < patterns.size()) {
+        while(busy < COUNT_BATCH_SIZE && next < patterns.size()) {
+            // Fill up any free lanes with new patterns.
+            const std::string& pattern = patterns[next];
+            
+            if(pattern.size() == 0) {
+                // This one matches everything and needs no lane.
+                results[next] = getCoveringPosition();
+            } else {
+                lanePatterns[busy] = next;
+                laneRemaining[busy] = pattern.size() - startCount(pattern,
+                    lanePositions[busy]);
+                busy++;
+            }
+            next++;
+        }
+        
+        for(size_t lane = 0; lane < busy; lane++) {
+            // Ask for the occurrence markers every search is going to need.
+            if(laneRemaining[lane] > 0 &&
+                lanePositions[lane].getLength() > 0) {
+                
+                prefetchOcc(lanePositions[lane].getForwardStart() - 1);
+                prefetchOcc(lanePositions[lane].getForwardStart() +
+                    lanePositions[lane].getEndOffset());
+            }
+        }
+        
+        for(size_t lane = 0; lane < busy;) {
+            if(laneRemaining[lane] > 0 &&
+                lanePositions[lane].getLength() > 0) {
+                
+                // Extend backwards with the next character.
+                laneRemaining[lane]--;
+                extendFast(lanePositions[lane],
+                    patterns[lanePatterns[lane]][laneRemaining[lane]], true);
+                lane++;
+            } else {
+                // This search ran out of matching locations or finished the
+                // pattern. Save its result and move the last busy lane here.
+                results[lanePatterns[lane]] = lanePositions[lane];
+                busy--;
+                lanePatterns[lane] = lanePatterns[busy];
+                laneRemaining[lane] = laneRemaining[busy];
+                lanePositions[lane] = lanePositions[busy];
+            }
+        }
+    }
+}
+
+size_t FMDIndex::startCount(const std::string& pattern,
+    FMDPosition& position) const {
+    
+    // How much of the end of the pattern can we look up all at once?
+    size_t jump = std::min(getKmerTableDepth(), pattern.size());
+    
+    if(jump == 0 || !lookupKmer(pattern, pattern.size() - jump, jump,
+        position)) {
+        
+        // Start at the end and select the first character.
+        position = getCharPosition(pattern[pattern.size() - 1]);
+        jump = 1;
+    }
+    
+    return jump;
+}
+
+bool FMDIndex::lookupKmer(const std::string& pattern, size_t start,
+    size_t length, FMDPosition& result) const {
+    
+    if(kmerTable == NULL) {
+        // We have nowhere to look it up.
+        return false;
+    }
+    
+    return kmerTable->lookup(pattern, start, length, result);
+}
+
+size_t FMDIndex::getKmerTableDepth() const {
+    return kmerTable == NULL ? 0 : kmerTable->getDepth();
+}
+
+void FMDIndex::setKmerTable(KmerTable* table) {
+    if(kmerTable != NULL) {
+        // Throw out the old one.
+        delete kmerTable;
+    }
+    kmerTable = table;
+}
+
+void FMDIndex::setMinUniqueTable(MinUniqueTable* table) {
+    if(minUniqueTable != NULL) {
+        // Throw out the old one.
+        delete minUniqueTable;
+    }
+    minUniqueTable = table;
+}
+
+void FMDIndex::setKmerFilter(KmerFilter* filter) {
+    if(kmerFilter != NULL) {
+        // Throw out the old one.
+        delete kmerFilter;
+    }
+    kmerFilter = filter;
+}
+
+void FMDIndex::setPackedSuffixArray(PackedSuffixArray* array) {
+    if(packedSuffixArray != NULL) {
+        // Throw out the old one.
+        delete packedSuffixArray;
+    }
+    packedSuffixArray = array;
+}
+
 size_t FMDIndex::getLCP(size_t index) const {
     if(index >= getBWTLength()) {
         throw std::runtime_error("Looking at out-of-bounds LCP value!");
     }
 
     // Go get the longest common prefix length from the array.
-    return lcpArray[index];
+    return getLCPArray()[index];
 }
     
 size_t FMDIndex::getLCPPSV(size_t index) const {
@@ -738,7 +1373,7 @@ size_t FMDIndex::getLCPPSV(size_t index) const {
     
     // Go get the previous smaller value's index in the LCP array. Will
     // automatically handle if there isn't anything smaller.
-    return lcpArray.getPSV(index);
+    return getLCPArray().getPSV(index);
 }
     
 size_t FMDIndex::getLCPNSV(size_t index) const {
@@ -749,7 +1384,14 @@ size_t FMDIndex::getLCPNSV(size_t index) const {
 
     // Go get the next smaller value's index in the LCP array. Will
     // automatically handle if there isn't anything smaller.
-    return lcpArray.getNSV(index);
+    return getLCPArray().getNSV(index);
+}
+
+void FMDIndex::forEachLCPInterval(
+    const std::function<void(const LCPInterval&)>& callback) const {
+
+    // Just scan our LCP array.
+    getLCPArray().forEachInterval(callback);
 }
 
 TextPosition FMDIndex::locate(int64_t index) const {
@@ -763,43 +1405,245 @@ TextPosition FMDIndex::locate(int64_t index) const {
         // We can just look at the full suffix array cheat sheet.
         bitfield = fullSuffixArray->get(index);
         
+    } else if(packedSuffixArray != NULL) {
+        // Or at the packed copy of it.
+        return packedSuffixArray->get(index);
+        
     } else {
-        // We need to use the sampled suffix array.
+        // We'll have to walk, unless we did this row recently.
+        TextPosition found;
+        if(locateCache.get(index, found)) {
+            return found;
+        }
         
-        // Run the libsuffixtools locate. 
-        bitfield = suffixArray.calcSA(index, &bwt); 
+        if(runSampledSuffixArray != NULL) {
+            // Walk back to a BWT run boundary. Rows that aren't boundaries
+            // never have a '$' character, so we have to get to one eventually.
+            int64_t row = index;
+            size_t steps = 0;
+            while(!runSampledSuffixArray->getSample(row, found)) {
+                char c = display(row);
+                row = bwt.getPC(c) + getOcc(c, row - 1);
+                steps++;
+            }
+            
+            // Account for the steps we took.
+            found.setOffset(found.getOffset() + steps);
+            
+        } else {
+            // We need to use the sampled suffix array.
+            
+            // Run the libsuffixtools locate. 
+            bitfield = suffixArray.calcSA(index, &bwt);
+            found = TextPosition(bitfield.getID(), bitfield.getPos());
+        }
         
+        locateCache.put(index, found);
+        return found;
     }
     
     // Unpack it and convert to our own format.
     return TextPosition(bitfield.getID(), bitfield.getPos());
 }
 
+void FMDIndex::locateBatch(const int64_t* indices, size_t count,
+    TextPosition* out) const {
+    
+    if(fullSuffixArray != NULL) {
+        // We can just look at the full suffix array cheat sheet.
+        for(size_t i = 0; i < count; i++) {
+            SAElem bitfield = fullSuffixArray->get(indices[i]);
+            out[i] = TextPosition(bitfield.getID(), bitfield.getPos());
+        }
+        return;
+    }
+    
+    if(packedSuffixArray != NULL) {
+        // Or the packed one.
+        for(size_t i = 0; i < count; i++) {
+            out[i] = packedSuffixArray->get(indices[i]);
+        }
+        return;
+    }
+    
+    // We keep the state for each walk in progress: where it is now in the BWT,
+    // how many steps it has taken, and which answer it is for. These are
+    // small, so they can live on the stack.
+    int64_t rows[LOCATE_BATCH_SIZE];
+    size_t steps[LOCATE_BATCH_SIZE];
+    size_t answers[LOCATE_BATCH_SIZE];
+    
+    for(size_t batchStart = 0; batchStart < count;
+        batchStart += LOCATE_BATCH_SIZE) {
+        
+        // Start up a batch of walks.
+        size_t active = std::min((size_t) LOCATE_BATCH_SIZE,
+            count - batchStart);
+        for(size_t i = 0; i < active; i++) {
+            rows[i] = indices[batchStart + i];
+            steps[i] = 0;
+            answers[i] = batchStart + i;
+            prefetchOcc(rows[i] - 1);
+        }
+        
+        while(active > 0) {
+            // Advance every walk that's still going by one step. By the time
+            // we get back around to a walk, what we prefetched for it should
+            // be in cache.
+            
+            for(size_t i = 0; i < active;) {
+                SAElem found;
+                bool done;
+                
+                if(runSampledSuffixArray != NULL) {
+                    // Look for a run boundary sample instead. We never hit a
+                    // '$' without one.
+                    TextPosition sample;
+                    done = runSampledSuffixArray->getSample(rows[i], sample);
+                    found.setID(sample.getText());
+                    found.setPos(sample.getOffset());
+                } else {
+                    done = suffixArray.getSample(rows[i], found);
+                }
+                
+                if(!done) {
+                    // Do a backtracking step, the same way calcSA does.
+                    char c = display(rows[i]);
+                    int64_t next = bwt.getPC(c) + getOcc(c, rows[i] - 1);
+                    
+                    if(c == '$') {
+                        // We hit the start of a text, and the lexicographic
+                        // index knows which text it is.
+                        found.setID(suffixArray.lookupLexoRank(next));
+                        found.setPos(0);
+                        done = true;
+                    } else {
+                        // Keep walking next time around.
+                        rows[i] = next;
+                        steps[i]++;
+                        prefetchOcc(next - 1);
+                    }
+                }
+                
+                if(done) {
+                    // Fill in the answer, accounting for the steps we took.
+                    out[answers[i]] = TextPosition(found.getID(),
+                        found.getPos() + steps[i]);
+                    
+                    // Replace this walk with the last one still going, and
+                    // look at that one next.
+                    active--;
+                    rows[i] = rows[active];
+                    steps[i] = steps[active];
+                    answers[i] = answers[active];
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+}
+
+void FMDIndex::locatePhi(int64_t start, size_t count,
+    TextPosition* out) const {
+    
+    if(count == 0) {
+        return;
+    }
+    
+    // Get a toehold at the bottom of the range.
+    out[count - 1] = locate(start + count - 1);
+    
+    for(size_t i = count - 1; i > 0; i--) {
+        // Each position is phi of the one below it.
+        out[i - 1] = runSampledSuffixArray->phi(out[i]);
+    }
+}
+
+bool FMDIndex::hasRunSampledSuffixArray() const {
+    return runSampledSuffixArray != NULL;
+}
+
 int64_t FMDIndex::getContigEndIndex(size_t contig) const {
     // Looks a bit like the metadata functions from earlier. Actually pulls info
     // from the same file.
     return endIndices[contig];
 }
 
+void FMDIndex::getContigRows(size_t contig, size_t start, size_t end,
+    int64_t* out) const {
+    
+    // Start at the contig's end, where the suffix is just '$'.
+    size_t knownOffset = getContigLength(contig);
+    int64_t bwtIndex = getContigEndIndex(contig);
+    
+    if(inverseSuffixArray != NULL) {
+        // See if there's a sample closer than the end.
+        size_t sampleRate = inverseSuffixArray->getSampleRate();
+        
+        // Which is the first sample at or after the end of the range?
+        size_t sample = (end + sampleRate - 1) / sampleRate;
+        
+        if(sample < inverseSuffixArray->getSampleCount(contig)) {
+            // Start there instead.
+            knownOffset = sample * sampleRate;
+            bwtIndex = inverseSuffixArray->getSample(contig, sample);
+        }
+    }
+    
+    while(true) {
+        if(knownOffset < end) {
+            // This is one of the suffixes we want.
+            out[knownOffset - start] = bwtIndex;
+        }
+        if(knownOffset == start) {
+            break;
+        }
+        
+        // Go left to the suffix starting one base earlier.
+        bwtIndex = getLF(bwtIndex);
+        knownOffset--;
+    }
+}
+
 char FMDIndex::display(int64_t index) const {
     // Just pull straight from the BWT string.
-    return bwt.getChar(index);
+    return flatBWT != NULL ? flatBWT->getChar(index) : bwt.getChar(index);
 }
 
 char FMDIndex::display(size_t contig, size_t offset) const {
-    // We need to loop through the contig from the back end until we get to the
-    // right position.
+    if(packedText != NULL) {
+        // We can just look it up. Convert to a 0-based offset.
+        return packedText->get(contig, offset - 1);
+    }
     
-    // How far from the back do we need to be?
-    size_t backOffset = getContigLength(contig) - offset - 1;
+    // The character we want is in the last column of the BWT row for the
+    // suffix starting just after it, which starts at 0-based offset (1-based
+    // offset). We need to find a known BWT row at or after that suffix, and LF-
+    // map back from there.
     
-    // Where are we in the BWT?
+    // Start at the contig's end, where the suffix is just '$'.
+    size_t knownOffset = getContigLength(contig);
     int64_t bwtIndex = getContigEndIndex(contig);
     
-    while(backOffset != (size_t) -1) {
+    if(inverseSuffixArray != NULL) {
+        // See if there's a sample closer than the end.
+        size_t sampleRate = inverseSuffixArray->getSampleRate();
+        
+        // Which is the first sample at or after the suffix we want?
+        size_t sample = (offset + sampleRate - 1) / sampleRate;
+        
+        if(sample < inverseSuffixArray->getSampleCount(contig)) {
+            // Start there instead.
+            knownOffset = sample * sampleRate;
+            bwtIndex = inverseSuffixArray->getSample(contig, sample);
+        }
+    }
+    
+    while(knownOffset > offset) {
         // Go left until we find the right letter.
         bwtIndex = getLF(bwtIndex);
-        backOffset--;
+        knownOffset--;
     }
     
     return display(bwtIndex);
@@ -807,9 +1651,24 @@ char FMDIndex::display(size_t contig, size_t offset) const {
 
 char FMDIndex::displayCached(const TextPosition& position) const {
     
+    if(packedText != NULL) {
+        // Skip the cache and read the base directly.
+        size_t contig = position.getContigNumber();
+        size_t offset = position.getOffset();
+        
+        if(position.getStrand()) {
+            // Count from the other end and complement the base.
+            return complement(packedText->get(contig,
+                packedText->getContigLength(contig) - offset - 1));
+        } else {
+            return packedText->get(contig, offset);
+        }
+    }
+    
     // Grab the reference contig in the cache
-    const std::string& referenceContig = displayContigCached(
+    std::shared_ptr<const std::string> cached = displayContigCached(
         position.getContigNumber());
+    const std::string& referenceContig = *cached;
         
     // Grab the text-local offset
     size_t offset = position.getOffset();
@@ -829,6 +1688,11 @@ char FMDIndex::displayFirst(int64_t index) const {
 }
 
 std::string FMDIndex::displayContig(size_t index) const {
+    if(packedText != NULL) {
+        // Just unpack it.
+        return packedText->getContig(index);
+    }
+    
     // We can't efficiently un-locate, so we just use a vector of the last BWT
     // index in every contig. This works since there are no 0-length contigs.
     int64_t bwtIndex = getContigEndIndex(index);
@@ -854,40 +1718,30 @@ std::string FMDIndex::displayContig(size_t index) const {
     
 }
 
-const std::string& FMDIndex::displayContigCached(size_t index) const {
-    // Try to find the thing we are looking for
-    auto found = threadContigCache[this].find(index);
-    
-    if(found == threadContigCache[this].end()) {
-        // If we don't have a copy thread-local, we'll need to go to the all-
-        // threads cache for this FMDIndex, so we need to synchronize.
-        
-        // Lock the cache
-        std::unique_lock<std::mutex> lock(contigCacheMutex);
-        
-        // Look in it
-        auto globalFound = contigCache.find(index);
-        
-        if(globalFound == contigCache.end()) {
-            // Go get it and insert it, updating the iterator for finding it.
-            globalFound = contigCache.insert({index,
-                displayContig(index)}).first;
-        }
-        
-        // Insert the iterator in the global cache into the local cache.
-        found = threadContigCache[this].insert({index, globalFound}).first;
-    }
+std::shared_ptr<const std::string> FMDIndex::displayContigCached(
+    size_t index) const {
     
-    // Return a reference to the globally cached copy, which means we have to
-    // dereference twice.
-    return found->second->second;
+    // Look in the cache, pulling the contig out of the index if it isn't there.
+    return contigCache.get(index, [&](size_t contig) {
+        return displayContig(contig);
+    });
+}
+
+void FMDIndex::setContigCacheBudget(size_t bytes) {
+    contigCache.setByteBudget(bytes);
+}
+
+void FMDIndex::setLocateCacheEntries(size_t entries) {
+    locateCache.resize(entries);
+}
+
+const StatTracker& FMDIndex::getLocateCacheStats() const {
+    return locateCache.getStats();
 }
 
 void FMDIndex::clearThreadLocalCache() const {
-    // Remove the entry for this object in the global-scope thread-local cache,
-    // in case we later have to work with a different object at the same
-    // address.
-    threadContigCache.erase(this);
+    // Forget this thread's remembered contig if it is one of ours.
+    contigCache.clearThreadLocal();
 }
 
 int64_t FMDIndex::getLF(int64_t index) const {
@@ -901,7 +1755,7 @@ int64_t FMDIndex::getLF(int64_t index) const {
     // Find the rank of that instance of that character among instances of the
     // same character in the last column. Subtract 1 from occurrences since the
     // first copy should be rank 0.
-    int64_t instanceRank = bwt.getOcc(toFind, index) - 1;
+    int64_t instanceRank = getOcc(toFind, index) - 1;
     
     // Add that to the start position to produce the LF mapping.
     return charBlockStart + instanceRank;
@@ -917,3 +1771,137 @@ FMDIndex::iterator FMDIndex::end(size_t depth, bool reportDeadEnds) const {
     // Make a new suffix tree iterator that is just a 1-past-the-end sentinel.
     return FMDIndex::iterator(*this, depth, true, reportDeadEnds);
 }
+
+void FMDIndex::forEachNode(size_t depth,
+    const std::function<void(const std::string&, const FMDPosition&)>& callback,
+    size_t threads) const {
+    
+    if(depth == 0) {
+        // The only node is the root.
+        callback("", getCoveringPosition());
+        return;
+    }
+    
+    threads = std::max(threads, (size_t) 1);
+    
+    // Each thread has a deque of nodes still to expand. It works depth-first
+    // off the back of its own deque, and steals from the front of the others,
+    // where the shallowest and so biggest subtrees are, when it runs out.
+    struct NodeDeque {
+        std::mutex mutex;
+        std::deque<std::pair<std::string, FMDPosition>> nodes;
+    };
+    std::vector<std::unique_ptr<NodeDeque>> deques;
+    for(size_t i = 0; i < threads; i++) {
+        deques.emplace_back(new NodeDeque());
+    }
+    
+    // Deal the children of the root out to the threads.
+    for(size_t i = 0; i < NUM_BASES; i++) {
+        FMDPosition child = getCharPosition(BASES[i]);
+        if(child.getLength() > 0) {
+            deques[i % threads]->nodes.emplace_back(std::string(1, BASES[i]),
+                child);
+        }
+    }
+    
+    // How many nodes are queued or being expanded? Children are counted before
+    // their parents are finished, so this only hits 0 when we are done.
+    std::atomic<size_t> pending(0);
+    for(auto& nodeDeque : deques) {
+        pending += nodeDeque->nodes.size();
+    }
+    
+    // Set if any thread threw, so the others can stop.
+    std::atomic<bool> failed(false);
+    
+    // Hold an exception from each thread, if it throws.
+    std::vector<std::exception_ptr> errors(threads);
+    
+    auto work = [&](size_t self) {
+        try {
+            // Holds the children of the node being expanded.
+            FMDPosition children[NUM_BASES];
+            
+            while(!failed) {
+                std::pair<std::string, FMDPosition> node;
+                bool found = false;
+                
+                for(size_t i = 0; i < threads && !found; i++) {
+                    // Look in our own deque, and then everyone else's.
+                    NodeDeque& nodeDeque = *deques[(self + i) % threads];
+                    std::lock_guard<std::mutex> lock(nodeDeque.mutex);
+                    if(!nodeDeque.nodes.empty()) {
+                        if(i == 0) {
+                            node = std::move(nodeDeque.nodes.back());
+                            nodeDeque.nodes.pop_back();
+                        } else {
+                            node = std::move(nodeDeque.nodes.front());
+                            nodeDeque.nodes.pop_front();
+                        }
+                        found = true;
+                    }
+                }
+                
+                if(!found) {
+                    if(pending == 0) {
+                        // Nobody has anything left to expand.
+                        return;
+                    }
+                    // Someone is still expanding something. Wait for it.
+                    std::this_thread::yield();
+                    continue;
+                }
+                
+                if(node.first.size() == depth) {
+                    // Only happens for depth 1.
+                    callback(node.first, node.second);
+                    pending--;
+                    continue;
+                }
+                
+                // Get all the children at once by appending each base.
+                extendAll(node.second, false, children);
+                
+                for(size_t i = 0; i < NUM_BASES; i++) {
+                    if(children[i].getLength() == 0) {
+                        // This would be a suffix that doesn't appear.
+                        continue;
+                    }
+                    
+                    node.first.push_back(BASES[i]);
+                    if(node.first.size() == depth) {
+                        // Report children at the bottom right away, instead of
+                        // queueing them.
+                        callback(node.first, children[i]);
+                    } else {
+                        pending++;
+                        std::lock_guard<std::mutex> lock(deques[self]->mutex);
+                        deques[self]->nodes.emplace_back(node.first,
+                            children[i]);
+                    }
+                    node.first.pop_back();
+                }
+                
+                // Now we're done with this node.
+                pending--;
+            }
+        } catch(...) {
+            errors[self] = std::current_exception();
+            failed = true;
+        }
+    };
+    
+    if(threads == 1) {
+        // Don't bother with a thread.
+        work(0);
+    } else {
+        parallelFor(threads, work);
+    }
+    
+    for(auto& error : errors) {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -7,6 +7,9 @@
 #include <map>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <functional>
 
 #include "BWT.h"
 #include "SampledSuffixArray.h"
@@ -17,6 +20,19 @@
 #include "GenericBitVector.hpp"
 #include "Mapping.hpp"
 #include "LCPArray.hpp"
+#include "FlatBWT.hpp"
+#include "KmerTable.hpp"
+#include "MinUniqueTable.hpp"
+#include "KmerFilter.hpp"
+#include "PackedSuffixArray.hpp"
+#include "SampledInverseSuffixArray.hpp"
+#include "RunSampledSuffixArray.hpp"
+#include "PackedText.hpp"
+#include "ContigCache.hpp"
+#include "LocateCache.hpp"
+#include "EliasFanoVector.hpp"
+#include "WaveletMatrix.hpp"
+#include "util.hpp"
 
 // State that the test cases class exists, even though we can't see it.
 class FMDIndexTests;
@@ -38,11 +54,22 @@ class FMDIndex {
 
 public:
     /**
-     * Load an FMD and metadata from the given basename. Optionally, specify a
+     * Load an FMD and metadata from the given basename. If a k-mer table was
+     * saved along with the index, it is loaded too. Optionally, specify a
      * complete suffix array that the index can use. The index takes ownership
      * of that suffix array, and will free it on destruction.
+     *
+     * If useFlatBWT is set, search queries are answered from a FlatBWT instead of
+     * the run-length encoded BWT. This trades memory (4 bits per base) for
+     * much faster occurrence queries, which is a good deal when the indexed
+     * sequences aren't very repetitive.
+     *
+     * The genome masks and the LCP array aren't loaded until something first
+     * uses them, so tools that never look at them don't pay for them. The
+     * index files must stay in place until then.
      */
-    FMDIndex(std::string basename, SuffixArray* fullSuffixArray = NULL);
+    FMDIndex(std::string basename, SuffixArray* fullSuffixArray = NULL,
+        bool useFlatBWT = false);
     
     ~FMDIndex();
     
@@ -80,6 +107,13 @@ public:
      */
     size_t getBaseID(TextPosition base) const;
     
+    /**
+     * Given the index of a base out of all bases on all contigs, as produced by
+     * getBaseID, get the contig it is on and its 1-based offset from the left
+     * of that contig.
+     */
+    std::pair<size_t, size_t> getContigAndOffset(size_t baseID) const;
+    
     /**
      * Convert a (contig, base, face) to a TextPosition.
      */
@@ -98,6 +132,22 @@ public:
      */
     int64_t getBWTLength() const;
     
+    /**
+     * Get the number of bytes taken up by each of the structures making up the
+     * index, in memory or mapped, by name. Optional structures the index
+     * doesn't have are reported as taking up 0 bytes, so every index reports
+     * the same names.
+     */
+    std::map<std::string, size_t> getMemoryUsage() const;
+    
+    /**
+     * Get the run-length encoded BWT the index is built on, so its runs can be
+     * examined directly.
+     */
+    inline const BWT& getBWT() const {
+        return bwt;
+    }
+    
     /** 
      * Get the total number of contigs in the index.
      */
@@ -139,6 +189,32 @@ public:
      */
     std::pair<size_t, size_t> getGenomeContigs(size_t genome) const;
     
+    /**
+     * Get the total number of scaffolds in the index. A scaffold is a run of
+     * consecutive contigs in the same genome with the same name, as the
+     * builder makes from the runs of not-N in one FASTA record. The N gaps
+     * between a scaffold's contigs are given by the contigs' starts and
+     * lengths.
+     */
+    size_t getNumberOfScaffolds() const;
+    
+    /**
+     * Get the number of the scaffold that the contig at the given index is on.
+     */
+    size_t getContigScaffold(size_t index) const;
+    
+    /**
+     * Get the range of contig numbers [start, end) that are on the given
+     * scaffold.
+     */
+    std::pair<size_t, size_t> getScaffoldContigs(size_t scaffold) const;
+    
+    /**
+     * Get the range of scaffold numbers [start, end) that belong to the given
+     * genome.
+     */
+    std::pair<size_t, size_t> getGenomeScaffolds(size_t genome) const;
+    
     /**
      * Get the minimum length that the genome can be while holding all its
      * contigs. TODO: Assumes 1-scaffold genomes
@@ -155,6 +231,32 @@ public:
      */
     const GenericBitVector& getGenomeMask(size_t genome) const;
     
+    /**
+     * Return whether the index has a wavelet matrix of the genome of every BWT
+     * position, which makes the genome counting functions below take
+     * O(log genomes) time instead of O(genomes).
+     */
+    bool hasGenomeMatrix() const;
+    
+    /**
+     * Count the BWT positions in [start, end) that are in the given genome.
+     */
+    size_t countInGenome(int64_t start, int64_t end, size_t genome) const;
+    
+    /**
+     * Count the BWT positions in [start, end) that are in any of the given
+     * genomes.
+     */
+    size_t countInGenomes(int64_t start, int64_t end,
+        const std::vector<size_t>& genomes) const;
+    
+    /**
+     * Get the genomes that have any BWT positions in [start, end), in order,
+     * with how many positions each has there.
+     */
+    std::vector<std::pair<size_t, size_t>> getGenomesInRange(int64_t start,
+        int64_t end) const;
+    
     /***************************************************************************
      * Search Functions
      **************************************************************************/
@@ -181,6 +283,96 @@ public:
      * extended version.
      */
     void extendFast(FMDPosition& range, char c, bool backward) const;
+
+    /**
+     * Extend a search on the left by a base known at compile time. Modifies
+     * the range in place, exactly as extendFast would when going backward, but
+     * works the new intervals out straight from the occurrence counts, without
+     * looping over the alphabet to find the base.
+     */
+    template<char Base>
+    inline void extendLeft(FMDPosition& range) const {
+        extendLeft(range, baseCode(Base));
+    }
+
+    /**
+     * Extend a search on the right by a base known at compile time. Modifies
+     * the range in place, exactly as extendFast would when going forward, but
+     * works on the reverse interval directly instead of flipping the range
+     * around and back.
+     */
+    template<char Base>
+    inline void extendRight(FMDPosition& range) const {
+        extendRight(range, baseCode(Base));
+    }
+
+    /**
+     * Extend a search on the left by the base with the given 2-bit code (0, 1,
+     * 2 and 3 for A, C, G and T). Modifies the range in place.
+     */
+    inline void extendLeft(FMDPosition& range, uint8_t code) const {
+        int64_t forwardStart = range.getForwardStart();
+        int64_t reverseStart = range.getReverseStart();
+        int64_t endOffset = range.getEndOffset();
+
+        // Base ranks in the BWT are 1 more than the codes, to leave room for
+        // '$'.
+        extendKernel(code + 1, forwardStart, reverseStart, endOffset);
+
+        range.setForwardStart(forwardStart);
+        range.setReverseStart(reverseStart);
+        range.setEndOffset(endOffset);
+    }
+
+    /**
+     * Extend a search on the right by the base with the given 2-bit code (0,
+     * 1, 2 and 3 for A, C, G and T). Modifies the range in place.
+     */
+    inline void extendRight(FMDPosition& range, uint8_t code) const {
+        int64_t forwardStart = range.getForwardStart();
+        int64_t reverseStart = range.getReverseStart();
+        int64_t endOffset = range.getEndOffset();
+
+        // Going right on the forward strand is going left by the complement on
+        // the reverse strand. The complement of code c is 3 - c, which has BWT
+        // rank 4 - c.
+        extendKernel(4 - code, reverseStart, forwardStart, endOffset);
+
+        range.setForwardStart(forwardStart);
+        range.setReverseStart(reverseStart);
+        range.setEndOffset(endOffset);
+    }
+
+    /**
+     * Extend many independent searches at once, each by its own character,
+     * all in the same direction. ranges[i] is extended by chars[i], in place,
+     * exactly as extendFast would do it. Prefetches the BWT occurrence markers
+     * for every range before doing any of the extensions, so the cache misses
+     * for the different ranges overlap instead of happening one after the
+     * other.
+     *
+     * chars must have at least ranges.size() characters in it.
+     */
+    void extendBatch(std::vector<FMDPosition>& ranges, const char* chars,
+        bool backward) const;
+    
+    /**
+     * Extend a search by each of the bases at once, either backward or
+     * forward. Fills in out with the extension by each base, in the order the
+     * bases appear in BASES. Costs the same two occurrence lookups as a single
+     * extendFast call.
+     */
+    void extendAll(const FMDPosition& range, bool backward,
+        FMDPosition out[NUM_BASES]) const;
+    
+    /**
+     * Extend a search by each of the bases at once on the left, in a
+     * backwards-search-only extension, the way extendLeftOnly would. Fills in
+     * out with the extension by each base, in the order the bases appear in
+     * BASES. Reverse intervals are left alone.
+     */
+    void extendLeftOnlyAll(const FMDPosition& range,
+        FMDPosition out[NUM_BASES]) const;
     
     /**
      * Extend a search by a character on the left in a backwards-search-only
@@ -214,6 +406,84 @@ public:
      */
     FMDPosition count(std::string pattern) const;
     
+    /**
+     * Count all of the given patterns, filling in results with what count
+     * would give for each. Runs up to COUNT_BATCH_SIZE backward searches in
+     * lockstep, prefetching the occurrence markers for every search before
+     * extending any of them, so their cache misses overlap. As each search
+     * finishes, the next pattern takes its place.
+     */
+    void countBatch(const std::vector<std::string>& patterns,
+        std::vector<FMDPosition>& results) const;
+    
+    /**
+     * Look up the search result for the given length of the given pattern,
+     * starting at the given position, in the k-mer table, if one is loaded.
+     * Returns true and sets result if the lookup could be done. Returns false
+     * and leaves result alone if there is no table, or the k-mer is too long
+     * or not made of bases.
+     */
+    bool lookupKmer(const std::string& pattern, size_t start, size_t length,
+        FMDPosition& result) const;
+    
+    /**
+     * Get the length of the longest k-mers in the k-mer table, or 0 if no
+     * table is loaded.
+     */
+    size_t getKmerTableDepth() const;
+    
+    /**
+     * Start using the given k-mer table, which must have been built for this
+     * index, to skip the first steps of searches. Takes ownership of it.
+     * Replaces (and deletes) any existing table.
+     */
+    void setKmerTable(KmerTable* table);
+    
+    /**
+     * Get the table of minimal unique substring lengths at every position in
+     * the index's texts, or NULL if none is loaded.
+     */
+    inline const MinUniqueTable* getMinUniqueTable() const {
+        return minUniqueTable;
+    }
+    
+    /**
+     * Start using the given minimal unique length table, which must have been
+     * built for this index. Takes ownership of it. Replaces (and deletes) any
+     * existing table.
+     */
+    void setMinUniqueTable(MinUniqueTable* table);
+    
+    /**
+     * Get the filter of k-mers that occur in the index, or NULL if none is
+     * loaded.
+     */
+    inline const KmerFilter* getKmerFilter() const {
+        return kmerFilter;
+    }
+    
+    /**
+     * Start using the given k-mer filter, which must have been built for this
+     * index. Takes ownership of it. Replaces (and deletes) any existing
+     * filter.
+     */
+    void setKmerFilter(KmerFilter* filter);
+    
+    /**
+     * Get the packed full suffix array used to locate rows without LF-mapping,
+     * or NULL if none is loaded.
+     */
+    inline const PackedSuffixArray* getPackedSuffixArray() const {
+        return packedSuffixArray;
+    }
+    
+    /**
+     * Start using the given packed full suffix array, which must have been
+     * built for this index, for locate queries. Takes ownership of it.
+     * Replaces (and deletes) any existing one.
+     */
+    void setPackedSuffixArray(PackedSuffixArray* array);
+    
     /***************************************************************************
      * Longest Common Prefix (LCP) functions
      **************************************************************************/
@@ -240,16 +510,96 @@ public:
      */
     size_t getLCPNSV(size_t index) const;
     
+    /**
+     * Call the given function with every internal node of the suffix tree, as
+     * an LCP interval of BWT positions with its string depth and children,
+     * bottom-up, in one linear scan of the LCP array.
+     */
+    void forEachLCPInterval(
+        const std::function<void(const LCPInterval&)>& callback) const;
+    
     
     /***************************************************************************
      * Location/Sampled Suffix Array Functions
      **************************************************************************/
  
     /**
-     * Find the (text, offset) position for an index in the BWT.
+     * Find the (text, offset) position for an index in the BWT. If the index
+     * has a run-sampled suffix array, walks to the nearest BWT run boundary
+     * instead of to the nearest regular suffix array sample. Rows that have to
+     * be walked are checked against, and then saved in, the locate cache.
      */
     TextPosition locate(int64_t index) const;
     
+    /**
+     * Make room in the locate cache for about the given number of located
+     * rows, throwing out anything already cached. 0 turns the cache off, which
+     * is the default. Not thread safe: nothing can be locating while this runs.
+     */
+    void setLocateCacheEntries(size_t entries);
+    
+    /**
+     * Get the locate cache's "locateCache:hits" and "locateCache:misses"
+     * stats.
+     */
+    const StatTracker& getLocateCacheStats() const;
+    
+    /**
+     * Find the (text, offset) positions for the given number of BWT indices,
+     * writing them to the corresponding places in out.
+     *
+     * Instead of one LF walk after another, like calling locate() in a loop,
+     * advances the walks for a batch of indices in lockstep, prefetching the
+     * BWT data each one needs next while the others step. Each walk stops as
+     * soon as it reaches a suffix array sample or the start of a text.
+     */
+    void locateBatch(const int64_t* indices, size_t count,
+        TextPosition* out) const;
+    
+    /**
+     * Find the (text, offset) positions for all the BWT indices in [start,
+     * start + length), in BWT order, and write them to the given output
+     * iterator. Returns the output iterator after the last write. Works a
+     * batch at a time, so no scratch space is allocated. If the index has a
+     * run-sampled suffix array, only the last index in each batch is walked to
+     * a sample, and the rest are found from it with the phi function.
+     */
+    template<typename OutputIt>
+    OutputIt locateRange(int64_t start, int64_t length, OutputIt out) const {
+        int64_t indices[LOCATE_BATCH_SIZE];
+        TextPosition positions[LOCATE_BATCH_SIZE];
+        
+        for(int64_t batchStart = start; batchStart < start + length;
+            batchStart += LOCATE_BATCH_SIZE) {
+            
+            // Locate the next batch of indices.
+            size_t count = std::min((int64_t) LOCATE_BATCH_SIZE,
+                start + length - batchStart);
+            if(runSampledSuffixArray != NULL && fullSuffixArray == NULL &&
+                packedSuffixArray == NULL) {
+                
+                // Walk from the bottom of the batch up.
+                locatePhi(batchStart, count, positions);
+            } else {
+                for(size_t i = 0; i < count; i++) {
+                    indices[i] = batchStart + i;
+                }
+                locateBatch(indices, count, positions);
+            }
+            
+            // And send them out.
+            out = std::copy(positions, positions + count, out);
+        }
+        
+        return out;
+    }
+    
+    /**
+     * Does this index have a suffix array sampled at BWT run boundaries, for
+     * highly repetitive collections?
+     */
+    bool hasRunSampledSuffixArray() const;
+    
     // Unfortunately, unlocate cannot be efficiently implemented with
     // libsuffixtools's SampledSuffixArray.
     
@@ -258,6 +608,16 @@ public:
      */
     int64_t getContigEndIndex(size_t contig) const;
     
+    /**
+     * Find the BWT rows of the suffixes of the given contig's forward strand
+     * that start at each 0-based offset in [start, end), and write them to
+     * out in order. LF-maps back from the first inverse suffix array sample
+     * at or after end, if the index has a sampled inverse suffix array, and
+     * from the end of the contig otherwise.
+     */
+    void getContigRows(size_t contig, size_t start, size_t end,
+        int64_t* out) const;
+    
     /***************************************************************************
      * Retrieval Functions
      **************************************************************************/
@@ -269,13 +629,17 @@ public:
     
     /**
      * Get the character at a given offset into the given contig. Offset is
-     * 1-based. TODO: this is not very efficient at all.
+     * 1-based. Takes constant time if the index has a packed text, fewer LF
+     * steps than the inverse suffix array sample rate if the index has a
+     * sampled inverse suffix array, and time proportional to the distance from
+     * the end of the contig otherwise.
      */
-    char display(size_t offset, size_t contig) const;
+    char display(size_t contig, size_t offset) const;
     
     /**
-     * Get the character at a given TextPosition. Efficient if characters are
-     * accessed with locality.
+     * Get the character at a given TextPosition. Takes constant time if the
+     * index has a packed text, and is efficient if characters are accessed with
+     * locality otherwise.
      */
     char displayCached(const TextPosition& position) const;  
     
@@ -291,19 +655,24 @@ public:
     
     /**
      * Memoized interface to displayContig that pulls out texts when needed,
-     * using a volatile cache. Thread safe.
+     * using a cache bounded by the contig cache budget. The contig stays valid
+     * for as long as the returned pointer is kept, even if it is evicted.
+     * Thread safe.
      */
-    const std::string& displayContigCached(size_t index) const;
+    std::shared_ptr<const std::string> displayContigCached(size_t index) const;
     
     /**
-     * Remove any entries for this object in the global thread-local contig
-     * cache. This prevents a new object at the same memory address from picking
-     * up cache entries from an old, destructed object at that address.
-     *
-     * A hack since the destructor can't go talk to all the threads.
-     *
-     * Should be called whenever a thread is done with an index, and might use
-     * another. Automatically called by the destructor.
+     * Set the number of bytes of contigs that displayContigCached is allowed to
+     * keep around, evicting least recently used contigs if necessary. Thread
+     * safe.
+     */
+    void setContigCacheBudget(size_t bytes);
+    
+    /**
+     * Drop the calling thread's lock-free reference into the contig cache, if
+     * it is for this index. Never needed for correctness, since references
+     * can't be confused between indexes and don't keep contigs alive.
+     * Automatically called by the destructor.
      */
     void clearThreadLocalCache() const;
     
@@ -314,6 +683,18 @@ public:
      */
     int64_t getLF(int64_t index) const;
     
+    /**
+     * Prefetch whatever the backend we are using needs for a getFullOcc or
+     * getOcc call at the given index.
+     */
+    inline void prefetchOcc(int64_t index) const {
+        if(flatBWT != NULL) {
+            flatBWT->prefetchOcc(index);
+        } else {
+            bwt.prefetchOcc(index);
+        }
+    }
+    
     /***************************************************************************
      * Iteration Functions
      **************************************************************************/
@@ -344,12 +725,32 @@ public:
      */
     iterator end(size_t depth, bool reportDeadEnds = false) const;
     
+    /**
+     * Call the given function with every string of the given length that
+     * occurs in the index, and its FMDPosition, the way an iterator at that
+     * depth would yield them but in no particular order. Work is split across
+     * the given number of threads by subtree, with idle threads stealing
+     * shallow subtrees from busy ones, so the function must be thread-safe.
+     * If the function throws, the traversal stops and one of the exceptions is
+     * rethrown after all the threads finish.
+     *
+     * Depth 0 just reports the empty string, covering everything.
+     */
+    void forEachNode(size_t depth, const std::function<void(const std::string&,
+        const FMDPosition&)>& callback, size_t threads = 1) const;
+    
 protected:
     
     /**
-     * Holds the sequence names of all the contigs.
+     * Holds the sequence name of each scaffold, which all its contigs share.
      */
-    std::vector<std::string> names;
+    std::vector<std::string> scaffoldNames;
+    
+    /**
+     * Holds the number of the first contig on each scaffold, and then the
+     * number of contigs.
+     */
+    std::vector<size_t> scaffoldStarts;
     
     /**
      * Holds the starts of all the contigs, in the same order.
@@ -363,9 +764,10 @@ protected:
     
     /**
      * Holds the partial sums of contig lengths, or the ID of the first base in
-     * each contig.
+     * each contig. Elias-Fano encoded, so we can also count how many contigs
+     * start at or before a base ID to find the contig it is on.
      */
-    std::vector<size_t> cumulativeLengths;
+    EliasFanoVector cumulativeLengths;
     
     /**
      * Holds the genome index to which each contig belongs.
@@ -384,7 +786,7 @@ protected:
      * Holds, for each genome, a [start, end) range of contig numbers that
      * belong to it.
      */
-    std::vector<std::pair<size_t, size_t>> genomeRanges;
+    mutable std::vector<std::pair<size_t, size_t>> genomeRanges;
     
     /**
      * Holds the bit vector masks for the BWT positions belonging to each
@@ -396,13 +798,60 @@ protected:
      * a vector. So we put pointers in a vector.
      * TODO: We have C++11 now. Fix this.
      */
-    std::vector<GenericBitVector*> genomeMasks;
+    mutable std::vector<GenericBitVector*> genomeMasks;
+    
+    /**
+     * Set once genomeMasks and genomeRanges have been loaded.
+     */
+    mutable std::atomic<bool> genomeMasksLoaded;
     
     /**
      * Holds the actual underlying index.
      */
     BWT bwt;
     
+    /**
+     * Holds a flat, non-run-length-encoded copy of the BWT to use for search
+     * queries instead, if we were asked to use one. Owned by this object, if
+     * not null.
+     */
+    FlatBWT* flatBWT;
+    
+    /**
+     * Holds a k-mer table for jumping searches ahead, if we have one. Owned by
+     * this object, if not null.
+     */
+    KmerTable* kmerTable;
+    
+    /**
+     * Holds a table of minimal unique substring lengths, if we have one. Owned
+     * by this object, if not null.
+     */
+    MinUniqueTable* minUniqueTable;
+    
+    /**
+     * Holds a filter of the k-mers in the index, if we have one. Owned by this
+     * object, if not null.
+     */
+    KmerFilter* kmerFilter;
+    
+    /**
+     * How many LF walks should locateBatch run in lockstep at a time?
+     */
+    static const size_t LOCATE_BATCH_SIZE = 64;
+    
+    /**
+     * How many searches should countBatch run in lockstep at a time?
+     */
+    static const size_t COUNT_BATCH_SIZE = 16;
+    
+    /**
+     * Start a backward search for the given nonempty pattern, with the k-mer
+     * table if possible or else with its last character. Returns how many
+     * characters off the end of the pattern have been searched.
+     */
+    size_t startCount(const std::string& pattern, FMDPosition& position) const;
+    
     /**
      * Holds the sampled suffix array we use for locate queries.
      */
@@ -415,31 +864,160 @@ protected:
     SuffixArray* fullSuffixArray;
     
     /**
-     * Holds the longest common prefix array.
+     * Holds a packed full suffix array that we can use for locate queries
+     * instead, if the index has one. Owned by this object, if not null.
+     */
+    PackedSuffixArray* packedSuffixArray;
+    
+    /**
+     * Holds the sampled inverse suffix array we use to get to arbitrary
+     * positions in contigs, if the index has one. Owned by this object, if not
+     * null.
+     */
+    SampledInverseSuffixArray* inverseSuffixArray;
+    
+    /**
+     * Holds the suffix array sampled at BWT run boundaries that we use for
+     * locate queries instead of the regularly sampled one, if the index has
+     * one. Owned by this object, if not null.
+     */
+    RunSampledSuffixArray* runSampledSuffixArray;
+    
+    /**
+     * Holds a packed copy of the contigs' forward strands, if the index has
+     * one, so we can display bases without going through the BWT. Owned by
+     * this object, if not null.
+     */
+    PackedText* packedText;
+    
+    /**
+     * Holds a wavelet matrix of the genome of each BWT position, if the index
+     * has one. Owned by this object, if not null.
+     */
+    WaveletMatrix* genomeMatrix;
+    
+    /**
+     * Holds the longest common prefix array, once something has used it. Owned
+     * by this object, if not null.
+     */
+    mutable std::atomic<LCPArray*> lcpArray;
+    
+    /**
+     * Held while loading the genome masks or the LCP array, so only one thread
+     * loads each.
+     */
+    mutable std::mutex loadMutex;
+    
+    /**
+     * Holds the basename the index was loaded from, so the parts we load
+     * when they are first used can be found.
      */
-    LCPArray lcpArray;
+    std::string basename;
     
     /**
-     * Holds a cache of contig strings we have had to reconstruct for mapping on
-     * credit. TODO: throw these out eventually somehow.
+     * Holds a bounded cache of contig strings we have had to reconstruct for
+     * mapping on credit.
      */
-    mutable std::map<size_t, std::string> contigCache;
+    ContigCache contigCache;
     
     /**
-     * Holds a mutex on contigCache so we don't break it trying to save contigs
-     * on multiple threads.
+     * Holds the positions of recently located rows, so rows that are located
+     * again don't have to be walked again.
      */
-    mutable std::mutex contigCacheMutex;
+    LocateCache locateCache;
+        
+    /**
+     * Count the occurrences of every character in bwt[0, index], using
+     * whichever BWT backend we are using.
+     */
+    inline AlphaCount64 getFullOcc(int64_t index) const {
+        return flatBWT != NULL ? flatBWT->getFullOcc(index) :
+            bwt.getFullOcc(index);
+    }
+    
+    /**
+     * Count the occurrences of every character in bwt[0, start] and in
+     * bwt[0, end], using whichever BWT backend we are using. The run-length
+     * BWT can share its work between the two when they are close together.
+     */
+    inline void getFullOccPair(int64_t start, int64_t end,
+        AlphaCount64& startOcc, AlphaCount64& endOcc) const {
+        
+        if(flatBWT != NULL) {
+            startOcc = flatBWT->getFullOcc(start);
+            endOcc = flatBWT->getFullOcc(end);
+        } else {
+            bwt.getFullOccPair(start, end, startOcc, endOcc);
+        }
+    }
     
     /**
-     * A thread-local mirror of contigCache, so each thread can look for a local
-     * copy before locking the global cache. Holds iterators to entries in the
-     * global cache.
+     * Count the occurrences of the given character in bwt[0, index], using
+     * whichever BWT backend we are using.
+     */
+    inline int64_t getOcc(char c, int64_t index) const {
+        return flatBWT != NULL ? flatBWT->getOcc(c, index) :
+            bwt.getOcc(c, index);
+    }
+    
+    /**
+     * Get the 2-bit code (0, 1, 2 or 3) for the given base (A, C, G or T).
+     */
+    static constexpr uint8_t baseCode(char base) {
+        return base == 'A' ? 0 : base == 'C' ? 1 : base == 'G' ? 2 : 3;
+    }
+
+    /**
+     * Extend an interval on one strand on the left by the character with the
+     * given BWT rank (1 through 4 for A through T), and budge the matching
+     * interval on the other strand over to keep up. Both starts and the shared
+     * end offset are updated in place.
      *
-     * TODO: how to evict things from deallocated FMDIndexes?
+     * On the other strand, the new interval comes after the intervals for '$'
+     * and for every character ranked after this one, since their complements
+     * sort before this character's complement. So we can add those up from the
+     * occurrence counts with masks, instead of looking for our character.
+     */
+    inline void extendKernel(size_t rank, int64_t& ownStart,
+        int64_t& otherStart, int64_t& endOffset) const {
+
+        AlphaCount64 startRanks;
+        AlphaCount64 endRanks;
+        getFullOccPair(ownStart - 1, ownStart + endOffset, startRanks,
+            endRanks);
+
+        int64_t before = 0;
+        for(size_t i = 0; i < ALPHABET_SIZE; i++) {
+            int64_t count = (int64_t)(endRanks.getByIdx(i) -
+                startRanks.getByIdx(i));
+            before += count & -(int64_t)(i == 0 || i > rank);
+        }
+
+        otherStart += before;
+        ownStart = bwt.getPC(RANK_ALPHABET[rank]) + startRanks.getByIdx(rank);
+        endOffset = (int64_t)(endRanks.getByIdx(rank) -
+            startRanks.getByIdx(rank)) - 1;
+    }
+
+    /**
+     * Locate the given number of consecutive BWT indices starting at start,
+     * using the run-sampled suffix array, which must exist. Walks the last one
+     * to a BWT run boundary, and then uses the phi function to get each of the
+     * ones above it from the one below.
+     */
+    void locatePhi(int64_t start, size_t count, TextPosition* out) const;
+    
+    /**
+     * Get the genome masks, loading them and working out each genome's range
+     * of contigs the first time. Safe to call from many threads at once.
+     */
+    const std::vector<GenericBitVector*>& getGenomeMasks() const;
+    
+    /**
+     * Get the LCP array, loading it the first time. Safe to call from many
+     * threads at once.
      */
-    static thread_local std::map<const FMDIndex*, std::map<size_t,
-        std::map<size_t, std::string>::iterator>> threadContigCache;
+    const LCPArray& getLCPArray() const;
         
 private:
     
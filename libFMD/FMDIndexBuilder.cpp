@@ -3,24 +3,41 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <map>
 
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <SampledSuffixArray.h>
 #include <SuffixArray.h>
+#include <SACAPrefixDoubling.h>
 #include <ReadInfoTable.h>
 #include <ReadTable.h>
 #include <BWT.h>
+#include <BWTDiskConstruction.h>
+#include <BWTCARopebwt.h>
+#include <BWTCABauerCoxRosone.h>
+#include <SeqReader.h>
+#include <BWTReader.h>
+#include <BWTWriter.h>
+#include <GapArray.h>
 
 #include "kseq.h"
 #include "util.hpp"
 #include "Log.hpp"
 #include "LCPArray.hpp"
+#include "SampledInverseSuffixArray.hpp"
+#include "RunSampledSuffixArray.hpp"
+#include "WaveletMatrix.hpp"
+#include "TaskPool.hpp"
 
 #include "FMDIndexBuilder.hpp"
 
@@ -42,143 +59,730 @@ void report_error(const std::string message) {
     
 }
 
-// Tell kseq what files are (handle numbers) and that you read them with read.
-// Don't hook in .gz support. See <http://stackoverflow.com/a/19390915/402891>
-KSEQ_INIT(int, read)
+// Tell kseq what files are (zlib handles) and that you read them with gzread,
+// so gzipped FASTAs work too.
+KSEQ_INIT(gzFile, gzread)
 
-FMDIndexBuilder::FMDIndexBuilder(const std::string& basename, int sampleRate):
-    basename(basename), tempDir(make_tempdir()), 
-    tempFastaName(tempDir + "/temp.fa"), tempFasta(tempFastaName.c_str()), 
-    contigFile((basename + ".contigs").c_str()), genomeAssignments(),
-    sampleRate(sampleRate) {
+/**
+ * One VCF record, placed on a reference FASTA record.
+ */
+struct HaplotypeVariant {
+    // Which reference record it is on
+    size_t record;
+    // Where its REF starts there, 0-based
+    size_t position;
+    // How long its REF is
+    size_t length;
+    // The upper-cased REF and then ALT alleles, by allele number
+    std::vector<std::string> alleles;
+};
+
+/**
+ * A haplotype's call of a non-reference allele: the variant's index and the
+ * allele number.
+ */
+typedef std::pair<uint32_t, uint32_t> HaplotypeCall;
+
+FMDIndexBuilder::FMDIndexBuilder(const std::string& basename, int sampleRate,
+    size_t kmerTableDepth, bool savePackedText, bool saveGenomeMatrix,
+    bool sampleRuns, size_t memoryBudget, size_t numThreads,
+    BWTAlgorithm bwtAlgorithm):
+    basename(basename),
+    tempDir(make_tempdir()), tempFastaName(tempDir + "/temp.fa"),
+    tempFasta(tempFastaName.c_str()), 
+    contigFile((basename + ".contigs").c_str()), contigNames(),
+    contigStarts(), contigLengths(), genomeAssignments(),
+    sampleRate(sampleRate), kmerTableDepth(kmerTableDepth),
+    savePackedText(savePackedText), packedText(),
+    saveGenomeMatrix(saveGenomeMatrix), sampleRuns(sampleRuns),
+    memoryBudget(memoryBudget), numThreads(numThreads),
+    bwtAlgorithm(bwtAlgorithm), profiler(), checkpoint(basename),
+    texts(memoryBudget == 0 && bwtAlgorithm == BWT_SUFFIX_SORT ?
+        new ReadTable() : NULL), textInfo() {
 
-    // Nothing to do, already made everything.
+    // Only resume a build that had the same options affecting the files the
+    // checkpointed stages make.
+    checkpoint.addInput("options " + std::to_string(sampleRate) + " " +
+        std::to_string(saveGenomeMatrix) + " " + std::to_string(sampleRuns) +
+        " " + std::to_string(bwtAlgorithm));
     
 }
 
-void FMDIndexBuilder::add(const std::string& filename) {
+FMDIndexBuilder::~FMDIndexBuilder() {
+    if(texts != NULL) {
+        // We never got to sort them.
+        delete texts;
+    }
+}
+
+BWTAlgorithm FMDIndexBuilder::parseBWTAlgorithm(const std::string& name) {
+    if(name == "sort") {
+        return BWT_SUFFIX_SORT;
+    } else if(name == "ropebwt") {
+        return BWT_ROPEBWT;
+    } else if(name == "bcr") {
+        return BWT_BCR;
+    }
+    throw std::runtime_error("Unknown BWT algorithm: " + name);
+}
+
+size_t FMDIndexBuilder::getTextsPerBatch() const {
+    // How many bases are there in all the texts? Each contig is two texts.
+    size_t totalLength = 0;
+    for(size_t length : contigLengths) {
+        totalLength += 2 * length;
+    }
+    
+    if(totalLength == 0) {
+        // Everything fits.
+        return 1;
+    }
+    
+    // How many bytes does the average text need to be sorted in memory?
+    size_t textCount = 2 * contigLengths.size();
+    size_t bytesPerText = std::max((size_t) 1,
+        totalLength / textCount * BYTES_PER_BASE);
+    
+    // Always do at least one text at a time.
+    return std::max((size_t) 1, memoryBudget / bytesPerText);
+}
+
+SuffixArray* FMDIndexBuilder::sortSuffixes(const ReadTable* readTable) const {
+    if(numThreads > 1) {
+        // Sort in parallel, by prefix doubling.
+        SuffixArray* suffixArray = new SuffixArray();
+        saca_prefix_doubling(suffixArray, readTable, numThreads, true);
+        return suffixArray;
+    }
+    
+    // Otherwise use induced copying, which needs less memory.
+    return new SuffixArray(readTable, INDUCED_COPYING_THREADS, true);
+}
+
+void FMDIndexBuilder::findRuns(std::string& sequence,
+    std::vector<std::pair<size_t, size_t>>& runs) {
+    
+    // Work a word of 8 characters at a time. Every byte of these has the same
+    // value.
+    const uint64_t ONES = 0x0101010101010101ULL;
+    const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+    const uint64_t LOW_BITS = 0x7F7F7F7F7F7F7F7FULL;
+    
+    // Where does the next run of not-N characters start?
+    size_t runStart = 0;
+    
+    size_t i = 0;
+    for(; i + 8 <= sequence.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, &sequence[i], sizeof(word));
+        
+        // Find the ASCII lower-case letters: at least 'a' and at most 'z',
+        // without the high bit. Adding to the low 7 bits never carries between
+        // bytes.
+        uint64_t low = word & LOW_BITS;
+        uint64_t atLeastA = low + ONES * (0x80 - 'a');
+        uint64_t pastZ = low + ONES * (0x80 - 'z' - 1);
+        uint64_t lower = atLeastA & ~pastZ & ~word & HIGH_BITS;
+        
+        // Clear their 0x20 bits to upper-case them.
+        word ^= lower >> 2;
+        memcpy(&sequence[i], &word, sizeof(word));
+        
+        // Find the 'N's as the zero bytes of the word XORed with all 'N's.
+        uint64_t difference = word ^ (ONES * 'N');
+        uint64_t ns = ~(((difference & LOW_BITS) + LOW_BITS) | difference) &
+            HIGH_BITS;
+        
+        while(ns != 0) {
+            // Bytes are in memory order in the little-endian word, so the
+            // lowest set bit is the first N.
+            size_t position = i + __builtin_ctzll(ns) / 8;
+            if(position > runStart) {
+                runs.push_back(std::make_pair(runStart, position));
+            }
+            runStart = position + 1;
+            ns &= ns - 1;
+        }
+    }
+    
+    for(; i < sequence.size(); i++) {
+        // Do the last few characters one at a time.
+        if(sequence[i] >= 'a' && sequence[i] <= 'z') {
+            sequence[i] -= 'a' - 'A';
+        }
+        if(sequence[i] == 'N') {
+            if(i > runStart) {
+                runs.push_back(std::make_pair(runStart, i));
+            }
+            runStart = i + 1;
+        }
+    }
+    
+    if(sequence.size() > runStart) {
+        // The last run goes to the end.
+        runs.push_back(std::make_pair(runStart, sequence.size()));
+    }
+}
+
+std::vector<FMDIndexBuilder::ParsedContig> FMDIndexBuilder::parse(
+    const std::string& filename) {
     
-    // Open the FASTA for reading.
-    FILE* fasta = fopen(filename.c_str(), "r");
+    // Open the FASTA for reading. This also reads uncompressed files.
+    gzFile fasta = gzopen(filename.c_str(), "r");
     
     if(fasta == NULL) {
         report_error("Failed to open FASTA " + filename);
     }
     
-    // Work out what genome number this file gets. Either 0, or 1 more than the
-    // last one used.
-    size_t genomeNumber = (genomeAssignments.size() == 0) ? 0 : 
-        genomeAssignments.back() + 1;
-        
+    std::vector<ParsedContig> contigs;
+    
     // Start up the parser
-    int fileNumber = fileno(fasta);
-    kseq_t* seq = kseq_init(fileNumber); 
+    kseq_t* seq = kseq_init(fasta); 
     while (kseq_read(seq) >= 0) { // Read sequences until we run out.
         // Stringify the sequence name
         std::string name(seq->name.s);
         
         // And the sequence sequence
-        std::string sequence(seq->seq.s);
+        std::string sequence(seq->seq.s, seq->seq.l);
+        
+        split(name, sequence, contigs);
+    }  
+    kseq_destroy(seq); // Close down the parser.
+    gzclose(fasta);
+    
+    return contigs;
+}
+
+void FMDIndexBuilder::split(const std::string& name, std::string& sequence,
+    std::vector<ParsedContig>& contigs) {
+    
+    // Upper-case all the letters, and find the contiguous runs of not-N.
+    // TODO: complain now if any not-base characters are in the string.
+    std::vector<std::pair<size_t, size_t>> runs;
+    findRuns(sequence, runs);
+    
+    for(const auto& run : runs) {
+        // Pull out each run, and its reverse strand.
+        ParsedContig contig;
+        contig.name = name;
+        contig.start = run.first;
+        contig.forward = sequence.substr(run.first, run.second - run.first);
+        contig.reverse = reverseComplement(contig.forward);
+        contigs.push_back(std::move(contig));
+    }
+}
+
+void FMDIndexBuilder::add(std::vector<ParsedContig>& contigs) {
+    // Work out what genome number this file gets. Either 0, or 1 more than the
+    // last one used.
+    size_t genomeNumber = (genomeAssignments.size() == 0) ? 0 : 
+        genomeAssignments.back() + 1;
+    
+    addToGenome(contigs, genomeNumber);
+}
+
+void FMDIndexBuilder::addToGenome(std::vector<ParsedContig>& contigs,
+    size_t genomeNumber) {
+    
+    for(ParsedContig& contig : contigs) {
+        // Name the forward and reverse strands.
+        std::string textName = contig.name + "-" +
+            std::to_string(contig.start);
+        size_t length = contig.forward.size();
+        
+        if(savePackedText) {
+            // Keep a packed copy of the forward strand too.
+            packedText.add(contig.forward);
+        }
+        
+        // Add the contig to the contig file (where we store FASTA record name,
+        // start, length, and genome). All contigs will be ordered by FASTA
+        // record they are from, and FASTA records from the same genome all
+        // appear together.
+        contigFile << contig.name << "\t" << contig.start << "\t" <<
+            length << "\t" << genomeNumber << std::endl;
+        
+        // Keep the same info for the binary contig file.
+        contigNames.push_back(contig.name);
+        contigStarts.push_back(contig.start);
+        contigLengths.push_back(length);
+        
+        // Record that this sequence belongs to this genome.
+        genomeAssignments.push_back(genomeNumber);
+        
+        // Remember how long the texts are.
+        textInfo.addReadInfo(textName + "F", length);
+        textInfo.addReadInfo(textName + "R", length);
         
-        // Upper-case all the letters. TODO: complain now if any not-base
-        // characters are in the string.
-        boost::to_upper(sequence);
+        if(texts != NULL) {
+            // Keep both strands in memory for the suffix sort.
+            SeqItem forward;
+            forward.id = textName + "F";
+            forward.seq = contig.forward;
+            texts->addRead(forward);
+            
+            SeqItem reverse;
+            reverse.id = textName + "R";
+            reverse.seq = contig.reverse;
+            texts->addRead(reverse);
+        } else {
+            // Add the forward strand to the contig FASTA
+            tempFasta << ">" << textName << "F" << std::endl;
+            tempFasta << contig.forward << std::endl;
+            
+            // And the reverse strand    
+            tempFasta << ">" << textName << "R" << std::endl;
+            tempFasta << contig.reverse << std::endl;
+        }
+        
+        // Don't hold the strings any longer than we have to.
+        std::string().swap(contig.forward);
+        std::string().swap(contig.reverse);
+    }
+}
+
+void FMDIndexBuilder::add(const std::string& filename) {
+    profiler.start("add " + filename);
+    checkpoint.addInputFile(filename);
+    
+    std::vector<ParsedContig> contigs = parse(filename);
+    add(contigs);
+    
+    profiler.stop();
+}
 
-        // Where does the next run of not-N characters start?        
-        size_t runStart = 0;
-        // Iterate over contiguous runs of not-N
-        for(size_t i = 0; i <= sequence.size(); i++) {
-            if(i == sequence.size() || sequence[i] == 'N') {
-                // This position is after the end of a run of not-N characters.
+void FMDIndexBuilder::addAll(const std::vector<std::string>& filenames) {
+    profiler.start("add " + std::to_string(filenames.size()) + " FASTAs");
+    
+    // Parse as many files at a time as we have threads, and then add them in
+    // order, so contigs and genomes get the same numbers as adding the files
+    // one by one.
+    size_t batchSize = std::max((size_t) 1, numThreads);
+    for(size_t first = 0; first < filenames.size(); first += batchSize) {
+        size_t last = std::min(filenames.size(), first + batchSize);
+        
+        std::vector<std::vector<ParsedContig>> parsed(last - first);
+        parallelFor(last - first, [&](size_t i) {
+            parsed[i] = parse(filenames[first + i]);
+        });
+        
+        for(size_t i = first; i < last; i++) {
+            Log::info() << "Adding FASTA " << filenames[i] << std::endl;
+            checkpoint.addInputFile(filenames[i]);
+            add(parsed[i - first]);
+        }
+    }
+    
+    profiler.stop();
+}
+
+void FMDIndexBuilder::addHaplotypes(const std::string& reference,
+    const std::string& vcf) {
+    
+    profiler.start("add haplotypes " + vcf);
+    checkpoint.addInputFile(reference);
+    checkpoint.addInputFile(vcf);
+    
+    // Every haplotype is made from the whole reference, so hold onto it.
+    std::vector<std::string> names;
+    std::vector<std::string> sequences;
+    std::map<std::string, size_t> recordNumbers;
+    
+    gzFile fasta = gzopen(reference.c_str(), "r");
+    if(fasta == NULL) {
+        report_error("Failed to open FASTA " + reference);
+    }
+    kseq_t* seq = kseq_init(fasta);
+    while(kseq_read(seq) >= 0) {
+        recordNumbers[seq->name.s] = names.size();
+        names.push_back(seq->name.s);
+        sequences.push_back(std::string(seq->seq.s, seq->seq.l));
+        boost::to_upper(sequences.back());
+    }
+    kseq_destroy(seq);
+    gzclose(fasta);
+    
+    // Read all the variants, and which non-reference alleles each haplotype
+    // has. Haplotypes are numbered in sample order.
+    gzFile vcfFile = gzopen(vcf.c_str(), "r");
+    if(vcfFile == NULL) {
+        report_error("Failed to open VCF " + vcf);
+    }
+    
+    std::vector<std::string> samples;
+    // Where each sample's haplotypes start, and one past the last sample's.
+    std::vector<size_t> firstHaplotypes;
+    std::vector<HaplotypeVariant> variants;
+    std::vector<std::vector<HaplotypeCall>> calls;
+    
+    kstream_t* stream = ks_init(vcfFile);
+    kstring_t buffer = {0, 0, NULL};
+    std::vector<std::string> fields;
+    std::vector<std::string> alleles;
+    while(ks_getuntil(stream, '\n', &buffer, 0) >= 0) {
+        std::string line(buffer.s == NULL ? "" : buffer.s, buffer.l);
+        if(line.empty() || line.compare(0, 2, "##") == 0) {
+            // Skip meta-information.
+            continue;
+        }
+        
+        boost::split(fields, line, boost::is_any_of("\t"));
+        if(line[0] == '#') {
+            // This is the header, which names the samples.
+            samples.assign(fields.begin() + std::min(fields.size(),
+                (size_t) 9), fields.end());
+            continue;
+        }
+        if(fields.size() != 9 + samples.size() || samples.empty() ||
+            fields[8].compare(0, 2, "GT") != 0) {
+            
+            throw std::runtime_error("VCF record without genotypes: " + line);
+        }
+        
+        auto found = recordNumbers.find(fields[0]);
+        if(found == recordNumbers.end()) {
+            throw std::runtime_error("VCF contig " + fields[0] +
+                " is not in " + reference);
+        }
+        
+        HaplotypeVariant variant;
+        variant.record = found->second;
+        variant.position = std::stoull(fields[1]) - 1;
+        variant.alleles.push_back(boost::to_upper_copy(fields[3]));
+        variant.length = variant.alleles[0].size();
+        const std::string& bases = sequences[variant.record];
+        if(variant.position > bases.size() || bases.compare(variant.position,
+            variant.length, variant.alleles[0]) != 0) {
+            
+            throw std::runtime_error("VCF REF does not match reference at " +
+                fields[0] + ":" + fields[1]);
+        }
+        boost::split(alleles, fields[4], boost::is_any_of(","));
+        for(const std::string& allele : alleles) {
+            variant.alleles.push_back(boost::to_upper_copy(allele));
+        }
+        
+        if(firstHaplotypes.empty()) {
+            // Each sample has as many haplotypes as its first genotype has
+            // alleles.
+            firstHaplotypes.push_back(0);
+            for(size_t sample = 0; sample < samples.size(); sample++) {
+                const std::string& genotype = fields[9 + sample];
+                firstHaplotypes.push_back(firstHaplotypes.back() + 1 +
+                    std::count_if(genotype.begin(), std::find(genotype.begin(),
+                    genotype.end(), ':'), [](char c) {
+                        return c == '|' || c == '/';
+                    }));
+            }
+            calls.resize(firstHaplotypes.back());
+        }
+        
+        if(variants.size() == std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Too many variants in " + vcf);
+        }
+        uint32_t variantNumber = variants.size();
+        
+        for(size_t sample = 0; sample < samples.size(); sample++) {
+            const std::string& field = fields[9 + sample];
+            std::string genotype = field.substr(0, field.find(':'));
+            boost::split(alleles, genotype, boost::is_any_of("|/"));
+            
+            if(alleles.size() > firstHaplotypes[sample + 1] -
+                firstHaplotypes[sample]) {
                 
-                if(i > runStart) {
-                    // That run is nonempty. Process it.
-                    
-                    // Pull it out
-                    std::string run = sequence.substr(runStart, i - runStart);
-                    
-                    // Add the forward strand to the contig FASTA
-                    tempFasta << ">" << name << "-" << runStart << "F" <<
-                        std::endl;
-                    tempFasta << run << std::endl;
-                    
-                    // And the reverse strand    
-                    tempFasta << ">" << name << "-" << runStart << "R" <<
-                        std::endl;
-                    std::string reverseStrand = reverseComplement(run);
-                    tempFasta << reverseStrand << std::endl;
-                    
-                    // Add the contig to the contig file (where we store FASTA
-                    // record name, start, length, and genome). All contigs will
-                    // be ordered by FASTA record they are from, and FASTA
-                    // records from the same genome all appear together.
-                    contigFile << name << "\t" << runStart << "\t" <<
-                        (i - runStart) << "\t" << genomeNumber << std::endl;
-                    
-                    // Record that this sequence belongs to this genome.
-                    genomeAssignments.push_back(genomeNumber);
+                throw std::runtime_error("Too many alleles for sample " +
+                    samples[sample] + " at " + fields[0] + ":" + fields[1]);
+            }
+            if(genotype.find('/') != std::string::npos &&
+                std::count(alleles.begin(), alleles.end(), alleles[0]) !=
+                (ptrdiff_t) alleles.size()) {
+                
+                throw std::runtime_error("Unphased genotype for sample " +
+                    samples[sample] + " at " + fields[0] + ":" + fields[1]);
+            }
+            
+            for(size_t copy = 0; copy < alleles.size(); copy++) {
+                if(alleles[copy] == "." || alleles[copy] == "0") {
+                    // Missing calls get the reference too.
+                    continue;
+                }
+                size_t allele = std::stoul(alleles[copy]);
+                if(allele >= variant.alleles.size()) {
+                    throw std::runtime_error("No allele " + alleles[copy] +
+                        " at " + fields[0] + ":" + fields[1]);
+                }
+                const std::string& bases = variant.alleles[allele];
+                if(bases.find_first_of("<>[]*.") != std::string::npos) {
+                    // Symbolic alleles don't say what the bases are.
+                    continue;
+                }
+                calls[firstHaplotypes[sample] + copy].push_back(
+                    std::make_pair(variantNumber, (uint32_t) allele));
+            }
+        }
+        
+        variants.push_back(std::move(variant));
+    }
+    free(buffer.s);
+    ks_destroy(stream);
+    gzclose(vcfFile);
+    
+    // The VCF's contigs may not be in the reference's order, so put the
+    // variants in reference order, and each haplotype's calls to match.
+    std::vector<uint32_t> order(variants.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return std::make_pair(variants[a].record, variants[a].position) <
+            std::make_pair(variants[b].record, variants[b].position);
+    });
+    std::vector<uint32_t> ranks(variants.size());
+    std::vector<HaplotypeVariant> sorted(variants.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        ranks[order[i]] = i;
+        sorted[i] = std::move(variants[order[i]]);
+    }
+    variants.swap(sorted);
+    for(std::vector<HaplotypeCall>& haplotypeCalls : calls) {
+        for(HaplotypeCall& call : haplotypeCalls) {
+            call.first = ranks[call.first];
+        }
+        std::sort(haplotypeCalls.begin(), haplotypeCalls.end());
+    }
+    
+    for(size_t sample = 0; sample < samples.size(); sample++) {
+        for(size_t haplotype = firstHaplotypes[sample];
+            haplotype < firstHaplotypes[sample + 1]; haplotype++) {
+            
+            // Each haplotype is a new genome.
+            size_t genomeNumber = (genomeAssignments.size() == 0) ? 0 : 
+                genomeAssignments.back() + 1;
+            Log::info() << "Adding haplotype " << samples[sample] << ":" <<
+                haplotype - firstHaplotypes[sample] << " as genome " <<
+                genomeNumber << std::endl;
+            
+            auto call = calls[haplotype].begin();
+            for(size_t record = 0; record < sequences.size(); record++) {
+                // Make this record's sequence in this haplotype.
+                const std::string& bases = sequences[record];
+                std::string sequence;
+                sequence.reserve(bases.size());
+                
+                // Reference bases before here have been copied or replaced.
+                size_t copied = 0;
+                for(; call != calls[haplotype].end() &&
+                    variants[call->first].record == record; ++call) {
                     
+                    const HaplotypeVariant& variant = variants[call->first];
+                    if(variant.position < copied) {
+                        // It overlaps a variant we already applied.
+                        continue;
+                    }
+                    sequence.append(bases, copied, variant.position - copied);
+                    sequence.append(variant.alleles[call->second]);
+                    copied = variant.position + variant.length;
                 }
+                sequence.append(bases, copied, std::string::npos);
                 
-                // The next run must start after here (or later).
-                runStart = i + 1;
+                std::vector<ParsedContig> contigs;
+                split(names[record], sequence, contigs);
+                addToGenome(contigs, genomeNumber);
             }
+            
+            // We're done with this haplotype's calls.
+            std::vector<HaplotypeCall>().swap(calls[haplotype]);
         }
-    }  
-    kseq_destroy(seq); // Close down the parser.
+    }
+    
+    profiler.stop();
 }
 
-FMDIndex* FMDIndexBuilder::build() {
-    // TODO: Quiet this procedure down, or get logging down into this library or
-    // something.
-
+void FMDIndexBuilder::writeContigs() {
+    profiler.start("contig metadata");
+    
     // Close up the temp file
     tempFasta.close();
     
     // And the contig sizes file
     contigFile.close();
     
-    // Compute what we want to save: BWT, sampled suffix array, per-genome
-    // BitVector masks, and longest common prefix array.
-    std::string bwtFile = basename + ".bwt";
-    std::string ssaFile = basename + ".ssa";
-    std::string bitmaskFile = basename + ".msk";
-    std::string lcpFile = basename + ".lcp";
-
-    // Produce the index of the temp file
-    // Load all the sequences into memory (again).
-    // TODO: Just keep them there
-    ReadTable* readTable = new ReadTable(tempFastaName);
+    // That's kept as an easy-to-read export, but the index loads the binary
+    // version: the number of contigs and the size of the name pool, then
+    // numContigs + 1 offsets into the name pool, the starts, the lengths, and
+    // the genomes, all as 8-byte words, and then the name pool.
+    std::ofstream binaryContigFile((basename + ".contigs.bin").c_str(),
+        std::ios::binary);
     
-    Log::info() << "Computing index of " << tempFastaName << std::endl;
+    std::vector<size_t> nameOffsets(1, 0);
+    for(const std::string& name : contigNames) {
+        nameOffsets.push_back(nameOffsets.back() + name.size());
+    }
+    size_t header[2] = {contigNames.size(), nameOffsets.back()};
+    binaryContigFile.write((const char*) header, sizeof(header));
     
-    // Compute the suffix array (which computes the BWT)
-    SuffixArray* suffixArray = new SuffixArray(readTable, NUM_THREADS, true);
+    for(const std::vector<size_t>* array : {&nameOffsets, &contigStarts,
+        &contigLengths, &genomeAssignments}) {
+        
+        binaryContigFile.write((const char*) array->data(),
+            array->size() * sizeof(size_t));
+    }
+    for(const std::string& name : contigNames) {
+        binaryContigFile.write(name.data(), name.size());
+    }
+    binaryContigFile.close();
+}
+
+FMDIndex* FMDIndexBuilder::build(bool useFlatBWT) {
+    // TODO: Quiet this procedure down, or get logging down into this library or
+    // something.
+
+    // Close up the temp files and save the contig metadata.
+    writeContigs();
     
-    Log::info() << "Saving BWT to " << bwtFile << std::endl;
+    // See what an earlier run of this same build already finished.
+    checkpoint.load();
     
-    // Write the BWT to disk
-    suffixArray->writeBWT(bwtFile, readTable);
+    // Compute what we want to save: BWT, sampled suffix array, sampled inverse
+    // suffix array, contig end indices, per-genome BitVector masks, and longest
+    // common prefix array.
+    std::string bwtFile = basename + ".bwt";
+    std::string lcpFile = basename + ".lcp";
+
+    // We may or may not have a full suffix array to work from.
+    SuffixArray* suffixArray = NULL;
     
-    Log::info() << "Indexing Longest Common Prefixes..." << std::endl;
+    // If we build the BWT in memory we keep it, instead of loading it back.
+    std::unique_ptr<BWT> builtBWT;
     
-    // Build an LCP array from the suffix array and the read table.
-    LCPArray* lcpArray = new LCPArray(*suffixArray, *readTable);
+    // Every stage writes its files under partial names, and they get moved
+    // into place when the stage finishes.
+    std::string partialBWTFile = BuildCheckpoint::partial(bwtFile);
     
-    // Delete the read table since we no longer need it. Keep the suffix array
-    // around because the FMDIndex we return can cheat off it.
-    delete readTable;
+    if(bwtAlgorithm == BWT_BCR && !checkpoint.isDone("bwt")) {
+        for(size_t length : contigLengths) {
+            // BCR inserts all the texts a column at a time, and the
+            // implementation we have exits the whole program unless they are
+            // all the same length, and more than a base long. Refuse first.
+            if(length != contigLengths.front() || length < 2) {
+                throw std::runtime_error("BCR needs all contigs to be the "
+                    "same length, of at least 2 bases");
+            }
+        }
+    }
     
-    // Save the LCP
-    Log::info() << "Saving LCP to " << lcpFile << std::endl;
-    lcpArray->save(lcpFile);
+    if(checkpoint.isDone("bwt")) {
+        // Use the BWT we already have, and make everything else from it.
+        Log::info() << "Using existing BWT " << bwtFile << std::endl;
+        if(texts != NULL) {
+            delete texts;
+            texts = NULL;
+        }
+    } else if(bwtAlgorithm == BWT_ROPEBWT) {
+        // Insert the texts from the temp FASTA into a rope, in order, so
+        // their '$'s still come in text order at the top of the BWT.
+        Log::info() << "Computing BWT of " << tempFastaName <<
+            " with ropebwt" << std::endl;
+        profiler.start("bwt construction");
+        BWTCA::runRopebwt(tempFastaName, partialBWTFile, numThreads > 1,
+            false);
+    } else if(bwtAlgorithm == BWT_BCR && memoryBudget == 0) {
+        // Load the texts in the compact form BCR works on, and insert them
+        // all at once.
+        profiler.start("bwt construction");
+        DNAEncodedStringVector sequences;
+        SeqReader reader(tempFastaName);
+        SeqRecord record;
+        while(reader.get(record)) {
+            sequences.push_back(record.seq.toString());
+        }
+        
+        Log::info() << "Computing BWT of " << sequences.size() <<
+            " texts with BCR" << std::endl;
+        
+        // We only want the BWT. The text index BCR makes along the way we can
+        // reconstruct from the BWT.
+        BWTCA::runBauerCoxRosone(&sequences, partialBWTFile,
+            tempDir + "/temp.sai");
+    } else if(memoryBudget == 0) {
+        // Produce the index of the texts add() kept in memory. We own them
+        // now.
+        ReadTable* readTable = texts;
+        texts = NULL;
+        
+        Log::info() << "Computing index of " << readTable->getCount() <<
+            " texts" << std::endl;
+        
+        // Compute the suffix array (which computes the BWT)
+        profiler.start("suffix sort");
+        suffixArray = sortSuffixes(readTable);
+        
+        // Make the BWT from the suffix array, and hang on to it.
+        profiler.start("bwt construction");
+        builtBWT.reset(new BWT(suffixArray, readTable, numThreads));
+        
+        Log::info() << "Saving BWT to " << bwtFile << std::endl;
+        
+        // Write the BWT to disk
+        profiler.start("bwt write");
+        builtBWT->write(partialBWTFile);
+        
+        // Delete the read table since we no longer need it: the LCP comes
+        // from the BWT. Keep the suffix array around because the FMDIndex we
+        // return can cheat off it.
+        delete readTable;
+    } else {
+        // Build the BWT in batches that fit in the memory budget, and merge
+        // them on disk.
+        BWTDiskParameters parameters;
+        parameters.inFile = tempFastaName;
+        parameters.outPrefix = basename;
+        parameters.bwtExtension = BuildCheckpoint::partial(".bwt");
+        parameters.saiExtension = ".sai";
+        parameters.numReadsPerBatch = getTextsPerBatch();
+        parameters.numThreads = numThreads;
+        parameters.storageLevel = GAP_ARRAY_STORAGE;
+        parameters.bBuildReverse = false;
+        parameters.bUseBCR = (bwtAlgorithm == BWT_BCR);
+        
+        Log::info() << "Computing BWT of " << tempFastaName << " in batches of "
+            << parameters.numReadsPerBatch << " texts" << std::endl;
+        profiler.start("bwt construction");
+        buildBWTDisk(parameters);
+        
+        // We only want the BWT. The text index it made along the way we can
+        // reconstruct from the BWT.
+        boost::filesystem::remove(basename + ".sai");
+    }
     
-    // Delete it so we don't need to keep two copies of it when we create the
-    // actual FMDIndex.
-    delete lcpArray;
+    if(!checkpoint.isDone("bwt")) {
+        // Whichever way we built it, the BWT is done now.
+        checkpoint.commit("bwt", {bwtFile});
+    }
     
+    if(!builtBWT) {
+        Log::info() << "Re-loading BWT..." << std::endl;
+        
+        // Load the BWT back in (instead of re-calculating it).
+        profiler.start("bwt reload");
+        builtBWT.reset(new BWT(bwtFile, BWT::DEFAULT_SAMPLE_RATE_SMALL,
+            numThreads));
+    }
+    const BWT& bwt = *builtBWT;
     
+    Log::info() << "Indexing Longest Common Prefixes from BWT..." <<
+        std::endl;
     
+    // Build the LCP from the BWT alone, which is faster than comparing
+    // suffixes and doesn't need the texts or the suffix array. Save it, and
+    // get rid of it so we don't need to keep two copies of it when we create
+    // the actual FMDIndex.
+    if(!checkpoint.isDone("lcp")) {
+        Log::info() << "Saving LCP to " << lcpFile << std::endl;
+        profiler.start("lcp");
+        LCPArray(bwt, numThreads).save(BuildCheckpoint::partial(lcpFile));
+        checkpoint.commit("lcp", {lcpFile});
+    }
     
     // How many genomes are there?
     size_t numGenomes = (genomeAssignments.size() == 0) ? 0 :
@@ -186,106 +790,555 @@ FMDIndex* FMDIndexBuilder::build() {
         
     Log::info() << "Creating " << numGenomes << " genome bitmasks..." <<
         std::endl;
+    profiler.start("genome masks");
     
-    // Holds a bit vector for each genome. TODO: Make this a C++11
-    // vector with emplace_back to work around non-copy-constructability.
-    GenericBitVector** encoders = new GenericBitVector*[numGenomes];
-    for(size_t i = 0; i < numGenomes; i++) {
+    // If the masks are already saved, leave the encoders empty.
+    bool masksDone = checkpoint.isDone("masks");
+    
+    // Holds a bit vector for each genome.
+    std::vector<GenericBitVector*> encoders;
+    for(size_t i = 0; i < numGenomes && !masksDone; i++) {
         // Make each of the individual encoders.
-        encoders[i] = new GenericBitVector();
+        encoders.push_back(new GenericBitVector());
     }
     
-    for(size_t i = 0; i < suffixArray->getSize(); i++) {
-        // Scan the suffix array, and make a 1 in the correct place in each bit
-        // vector for each genome.
+    // If we want a genome wavelet matrix, we need the genome of every row.
+    std::vector<WaveletMatrix::Value> rowGenomes;
+    if(saveGenomeMatrix && !masksDone) {
+        rowGenomes.resize(bwt.getBWLen());
+    }
     
-        // For each place in the SA
+    if(masksDone) {
+        Log::info() << "Using existing genome bitmasks" << std::endl;
+    } else if(suffixArray != NULL) {
+        // Scan the suffix array in a run of rows per thread, and sort each
+        // row into its genome's list of rows for that run.
+        size_t rowCount = suffixArray->getSize();
+        size_t threads = std::max((size_t) 1, std::min((size_t) numThreads,
+            rowCount));
+        std::vector<std::vector<std::vector<size_t>>> runRows(threads,
+            std::vector<std::vector<size_t>>(numGenomes));
         
-        // Get the SA element which stores text and offset.
-        SAElem element = suffixArray->get(i);
+        parallelFor(threads, [&](size_t thread) {
+            size_t end = rowCount * (thread + 1) / threads;
+            for(size_t i = rowCount * thread / threads; i < end; i++) {
+                // Get the text ID from the SA element, and from that the
+                // contig, since each contig has exactly 2 texts.
+                size_t contig = suffixArray->get(i).getID() / 2;
+                size_t genome = genomeAssignments[contig];
+                
+                runRows[thread][genome].push_back(i);
+                
+                if(saveGenomeMatrix) {
+                    rowGenomes[i] = genome;
+                }
+            }
+        });
+        
+        parallelFor(numGenomes, [&](size_t genome) {
+            for(size_t thread = 0; thread < threads; thread++) {
+                // The runs come in order, so add each genome's rows run by
+                // run, and let go of them as we go.
+                std::vector<size_t>& rows = runRows[thread][genome];
+                encoders[genome]->addSorted(rows.begin(), rows.end());
+                std::vector<size_t>().swap(rows);
+            }
+        });
+    
+    } else {
+        for(size_t genome = 0; genome < numGenomes; genome++) {
+            // Find the rows for each genome by walking all its texts back from
+            // their '$'s, which come in text order at the top of the BWT.
+            std::vector<bool> rows(bwt.getBWLen(), false);
+            
+            for(size_t contig = 0; contig < genomeAssignments.size();
+                contig++) {
+                
+                if(genomeAssignments[contig] != genome) {
+                    continue;
+                }
+                
+                for(int64_t index : {2 * contig, 2 * contig + 1}) {
+                    while(true) {
+                        rows[index] = true;
+                        if(saveGenomeMatrix) {
+                            rowGenomes[index] = genome;
+                        }
+                        
+                        char c = bwt.getChar(index);
+                        if(c == '$') {
+                            // We got to the start of the text.
+                            break;
+                        }
+                        index = bwt.getPC(c) + bwt.getOcc(c, index - 1);
+                    }
+                }
+            }
+            
+            for(size_t i = 0; i < rows.size(); i++) {
+                // Encode the rows in order.
+                if(rows[i]) {
+                    encoders[genome]->addBit(i);
+                }
+            }
+        }
+    }
+    
+    // Save everything else and make the index.
+    return finish(suffixArray, bwt, textInfo, encoders, rowGenomes,
+        useFlatBWT);
+    
+}
+
+FMDIndex* FMDIndexBuilder::append(const std::string& existingBasename,
+    const std::vector<std::string>& newFastas, bool useFlatBWT) {
+    
+    if(existingBasename == basename) {
+        // We would be overwriting the files we need to read.
+        throw std::runtime_error("Can't append to " + existingBasename +
+            " in place");
+    }
+    
+    if(contigNames.size() > 0) {
+        // The existing contigs have to come first.
+        throw std::runtime_error(
+            "Can't append to an index after adding contigs");
+    }
+    
+    // Appending doesn't resume, so forget anything an earlier build with this
+    // basename finished.
+    checkpoint.clear();
+    
+    Log::info() << "Loading existing index " << existingBasename << std::endl;
+    
+    profiler.start("existing index load");
+    FMDIndex* existing = new FMDIndex(existingBasename);
+    
+    for(size_t i = 0; i < existing->getNumberOfContigs(); i++) {
+        // Carry over all the existing contigs, in the same order, so they keep
+        // their text numbers.
+        contigFile << existing->getContigName(i) << "\t" <<
+            existing->getContigStart(i) << "\t" <<
+            existing->getContigLength(i) << "\t" <<
+            existing->getContigGenome(i) << std::endl;
         
-        // Get the text ID
-        size_t text = element.getID();
+        contigNames.push_back(existing->getContigName(i));
+        contigStarts.push_back(existing->getContigStart(i));
+        contigLengths.push_back(existing->getContigLength(i));
+        genomeAssignments.push_back(existing->getContigGenome(i));
         
-        // Compute the contig from the text. Easy since each contig has exactly
-        // 2 texts.
-        size_t contig = text / 2;
+        if(savePackedText) {
+            // Keep a packed copy of the forward strand too.
+            packedText.add(existing->displayContig(i));
+        }
+    }
+    
+    // Copy the existing genome masks, so we can move their bits to the rows
+    // of the merged BWT.
+    std::vector<GenericBitVector*> oldMasks;
+    for(size_t i = 0; i < existing->getNumberOfGenomes(); i++) {
+        oldMasks.push_back(new GenericBitVector(existing->getGenomeMask(i)));
+    }
+    
+    // Don't keep the existing index in memory along with the BWT we merge.
+    delete existing;
+    
+    size_t oldContigs = contigNames.size();
+    size_t oldGenomes = oldMasks.size();
+    
+    // Add the new genomes. Only they go into the temp FASTA.
+    addAll(newFastas);
+    
+    if(contigNames.size() == oldContigs) {
+        for(GenericBitVector* mask : oldMasks) {
+            delete mask;
+        }
+        throw std::runtime_error("No new contigs to append to " +
+            existingBasename);
+    }
+    
+    // Close up the temp files and save the contig metadata for everything.
+    writeContigs();
+    
+    std::string bwtFile = basename + ".bwt";
+    std::string newBWTFile = tempDir + "/new.bwt";
+    
+    // Sort the suffixes of only the new texts, which add() either kept in
+    // memory or wrote to the temp FASTA.
+    ReadTable* readTable = (texts != NULL) ? texts :
+        new ReadTable(tempFastaName);
+    texts = NULL;
+    
+    Log::info() << "Computing index of " << readTable->getCount() <<
+        " new texts" << std::endl;
+    
+    profiler.start("suffix sort");
+    SuffixArray* newSuffixArray = sortSuffixes(readTable);
+    profiler.start("bwt write");
+    newSuffixArray->writeBWT(newBWTFile, readTable);
+    
+    Log::info() << "Loading existing BWT..." << std::endl;
+    
+    profiler.start("existing bwt load");
+    BWT* oldBWT = new BWT(existingBasename + ".bwt",
+        BWT::DEFAULT_SAMPLE_RATE_SMALL, numThreads);
+    
+    Log::info() << "Ranking new suffixes in existing BWT..." << std::endl;
+    profiler.start("gap array");
+    
+    // The gap array counts how many new suffixes sort before each suffix of
+    // the existing BWT (or after them all, in the last slot).
+    GapArray* gaps = createGapArray(GAP_ARRAY_STORAGE);
+    gaps->resize(oldBWT->getBWLen() + 1);
+    
+    for(size_t text = 0; text < readTable->getCount(); text++) {
+        // Walk each new text backwards through the existing BWT, counting the
+        // rank of each of its suffixes. The new texts come after all the
+        // existing ones, so their '$'s sort after all the existing '$'s.
+        const DNAString& sequence = readTable->getRead(text).seq;
+        int64_t rank = oldBWT->getNumStrings();
         
-        // Look up the genome, and set this bit in the appropriate encoder.
-        encoders[genomeAssignments[contig]]->addBit(i);
+        for(int64_t i = sequence.length(); i >= 0; i--) {
+            if(i < (int64_t) sequence.length()) {
+                // LF-map the rank of the suffix after this one.
+                char c = sequence.get(i);
+                rank = oldBWT->getPC(c) + oldBWT->getOcc(c, rank - 1);
+            }
+            
+            if(!gaps->attemptBaseIncrement(rank)) {
+                // The count is too big for the small storage.
+                gaps->incrementOverflowSerial(rank);
+            }
+        }
     }
     
-    // Open the bitmask file
-    std::ofstream bitmaskStream(bitmaskFile.c_str(), std::ios::binary);
+    Log::info() << "Merging BWTs into " << bwtFile << std::endl;
+    profiler.start("bwt merge");
     
+    IBWTReader* newReader = BWTReader::createReader(newBWTFile);
+    size_t newStrings;
+    size_t newSymbols;
+    BWFlag flag;
+    newReader->readHeader(newStrings, newSymbols, flag);
+    
+    IBWTWriter* writer = BWTWriter::createWriter(bwtFile);
+    writer->writeHeader(oldBWT->getNumStrings() + newStrings,
+        oldBWT->getBWLen() + newSymbols, BWF_NOFMI);
+    
+    // Make the bit vectors for the merged index. New genomes get their bits
+    // as we merge, and existing genomes get theirs moved over after.
+    size_t numGenomes = genomeAssignments.back() + 1;
+    std::vector<GenericBitVector*> encoders;
     for(size_t i = 0; i < numGenomes; i++) {
-        // Save all the bit vectors to the bitmask file.
-        
-        // Finish encoding to an actual BitVector
-        encoders[i]->finish(suffixArray->getSize() + 1);
+        encoders.push_back(new GenericBitVector());
+    }
+    
+    std::vector<WaveletMatrix::Value> rowGenomes;
+    if(saveGenomeMatrix) {
+        rowGenomes.resize(oldBWT->getBWLen() + newSymbols);
+    }
+    
+    // Mark which merged rows came from the existing BWT.
+    GenericBitVector oldRows;
+    
+    // Where are we in the merged BWT, and in the new one?
+    size_t mergedRow = 0;
+    size_t newRow = 0;
+    
+    for(size_t i = 0; i < gaps->size(); i++) {
+        for(size_t j = 0; j < gaps->get(i); j++) {
+            // Put in the new rows that go before this existing one. They come
+            // in the same order as in the new BWT.
+            writer->writeBWChar(newReader->readBWChar());
+            
+            // Their genomes we can get from the new suffix array.
+            size_t contig = oldContigs +
+                newSuffixArray->get(newRow).getID() / 2;
+            encoders[genomeAssignments[contig]]->addBit(mergedRow);
+            if(saveGenomeMatrix) {
+                rowGenomes[mergedRow] = genomeAssignments[contig];
+            }
+            
+            newRow++;
+            mergedRow++;
+        }
         
-        // Save the BitVector
-        encoders[i]->writeTo(bitmaskStream);
+        if(i < oldBWT->getBWLen()) {
+            // Then put in the existing row.
+            writer->writeBWChar(oldBWT->getChar(i));
+            oldRows.addBit(mergedRow);
+            mergedRow++;
+        }
+    }
+    
+    writer->finalize();
+    delete writer;
+    delete newReader;
+    delete gaps;
+    oldRows.finish(mergedRow);
+    
+    for(size_t genome = 0; genome < oldGenomes; genome++) {
+        // Move each existing genome's rows to where they ended up in the merged
+        // BWT.
+        GenericBitVector& mask = *oldMasks[genome];
+        size_t ones = mask.rank(mask.getSize());
         
-        // All the bitvectors can go in the same file. When reading them just
-        // see if there are any bytes left. TODO: This is probably true.
+        // Each row can be found on its own, so find them on all our threads.
+        // They come out in order, since both selects only go up.
+        std::vector<size_t> rows(ones);
+        size_t pieces = std::max(std::min(numThreads, ones), (size_t) 1);
+        parallelFor(pieces, [&](size_t piece) {
+            for(size_t k = ones * piece / pieces;
+                k < ones * (piece + 1) / pieces; k++) {
+                
+                rows[k] = oldRows.select(mask.select(k));
+                if(saveGenomeMatrix) {
+                    rowGenomes[rows[k]] = genome;
+                }
+            }
+        });
+        encoders[genome]->addSorted(rows.begin(), rows.end());
         
-        // Delete the encoder, sicne we've already encoded with it.
-        delete encoders[i];
+        delete oldMasks[genome];
     }
-
-    // Delete the encoders array altogether.
-    delete[] encoders;
     
-    // Finish up the bitmask file.
-    bitmaskStream.flush();
-    bitmaskStream.close();
+    // We're done with the pieces.
+    delete oldBWT;
+    delete newSuffixArray;
+    delete readTable;
     
     Log::info() << "Re-loading BWT..." << std::endl;
     
-    // Load the BWT back in (instead of re-calculating it).
-    // TODO: Add ability to save a calculated BWT object with a BWTWriter.
-    BWT bwt(bwtFile);
+    profiler.start("bwt reload");
+    BWT bwt(bwtFile, BWT::DEFAULT_SAMPLE_RATE_SMALL, numThreads);
     
-    // Load all the sequence lengths from the original file.
-    // TODO: just store these as we write the file.
-    ReadInfoTable infoTable(tempFastaName);
+    // Every contig has a forward and a reverse text.
+    ReadInfoTable infoTable;
+    for(size_t i = 0; i < contigNames.size(); i++) {
+        std::string prefix = contigNames[i] + "-" +
+            std::to_string(contigStarts[i]);
+        infoTable.addReadInfo(prefix + "F", contigLengths[i]);
+        infoTable.addReadInfo(prefix + "R", contigLengths[i]);
+    }
     
-    Log::info() << "Sampling suffix array..." << std::endl;
+    // LCPs between existing and new suffixes aren't in either LCP array, so
+    // compute the LCP over again from the merged BWT.
+    Log::info() << "Indexing Longest Common Prefixes from BWT..." <<
+        std::endl;
+    Log::info() << "Saving LCP to " << basename + ".lcp" << std::endl;
+    profiler.start("lcp");
+    LCPArray(bwt, numThreads).save(basename + ".lcp");
+    
+    // Save everything else and make the index.
+    return finish(NULL, bwt, infoTable, encoders, rowGenomes, useFlatBWT);
+}
+
+FMDIndex* FMDIndexBuilder::finish(SuffixArray* suffixArray, const BWT& bwt,
+    const ReadInfoTable& infoTable, std::vector<GenericBitVector*>& encoders,
+    const std::vector<WaveletMatrix::Value>& rowGenomes, bool useFlatBWT) {
+    
+    std::string ssaFile = basename + ".ssa";
+    std::string bitmaskFile = basename + ".msk";
+    std::string isaFile = basename + ".isa";
+    std::string endFile = basename + ".end";
     
-    // Make a sampled suffix array
-    SampledSuffixArray sampled;
+    size_t numGenomes = encoders.size();
     
-    // Build it from the BWT and read info, with the specified sample rate
-    sampled.build(&bwt, &infoTable, sampleRate);
+    if(!saveGenomeMatrix) {
+        // Don't let an old one get loaded with this index.
+        boost::filesystem::remove(basename + ".gwm");
+    }
     
-    Log::info() << "Saving sampled suffix array to " << ssaFile << std::endl;
-
-    // Save it to disk    
-    sampled.writeSSA(ssaFile);
+    if(!checkpoint.isDone("masks")) {
+        std::vector<std::string> maskFiles = {bitmaskFile};
+        
+        if(saveGenomeMatrix) {
+            // Save all the row genomes in one structure.
+            profiler.start("genome matrix");
+            Log::info() << "Saving genome wavelet matrix to " <<
+                basename + ".gwm" << std::endl;
+            WaveletMatrix(rowGenomes, numGenomes).save(
+                BuildCheckpoint::partial(basename + ".gwm"));
+            maskFiles.push_back(basename + ".gwm");
+        }
+        
+        // Open the bitmask file
+        profiler.start("genome mask save");
+        std::ofstream bitmaskStream(
+            BuildCheckpoint::partial(bitmaskFile).c_str(), std::ios::binary);
+        
+        for(size_t i = 0; i < numGenomes; i++) {
+            // Save all the bit vectors to the bitmask file.
+            
+            // Finish encoding to an actual BitVector
+            encoders[i]->finish(bwt.getBWLen() + 1);
+            
+            // Save the BitVector
+            encoders[i]->writeTo(bitmaskStream);
+            
+            // All the bitvectors can go in the same file. When reading them
+            // just see if there are any bytes left. TODO: This is probably
+            // true.
+            
+            // Delete the encoder, sicne we've already encoded with it.
+            delete encoders[i];
+        }
+        encoders.clear();
+        
+        // Finish up the bitmask file.
+        bitmaskStream.flush();
+        bitmaskStream.close();
+        
+        checkpoint.commit("masks", maskFiles);
+    }
+    
+    if(!checkpoint.isDone("ssa")) {
+        Log::info() << "Sampling suffix array..." << std::endl;
+        profiler.start("ssa sampling");
+        
+        // Make a sampled suffix array
+        SampledSuffixArray sampled;
+        
+        // If we're sampling runs, use a sample rate so big that it only keeps
+        // the lexicographic index of text starts. Locate queries will use the
+        // run boundary samples instead.
+        int ssaSampleRate = sampleRuns ? std::numeric_limits<int>::max() :
+            sampleRate;
+        
+        if(suffixArray != NULL) {
+            // Pick the samples straight out of the full suffix array, instead
+            // of walking every text back through the BWT.
+            sampled.build(suffixArray, &infoTable, ssaSampleRate, numThreads);
+        } else {
+            // Build it from the BWT and read info.
+            sampled.build(&bwt, &infoTable, ssaSampleRate, numThreads);
+        }
+        
+        Log::info() << "Saving sampled suffix array to " << ssaFile <<
+            std::endl;
+        
+        // Save it to disk    
+        sampled.writeSSA(BuildCheckpoint::partial(ssaFile));
+        checkpoint.commit("ssa", {ssaFile});
+    }
+    
+    if(!sampleRuns) {
+        // Don't let an old one get loaded with this index.
+        boost::filesystem::remove(basename + ".rsa");
+    } else if(!checkpoint.isDone("rsa")) {
+        Log::info() << "Sampling suffix array at BWT run boundaries..." <<
+            std::endl;
+        profiler.start("rsa sampling");
+        
+        // Sample from the full suffix array if we still have it, and
+        // otherwise by walking the texts through the BWT.
+        RunSampledSuffixArray* runSampled = (suffixArray != NULL) ?
+            new RunSampledSuffixArray(*suffixArray, bwt, infoTable) :
+            new RunSampledSuffixArray(bwt, infoTable);
+        
+        Log::info() << "Saving " << runSampled->getSampleCount() <<
+            " run boundary samples to " << basename + ".rsa" << std::endl;
+        
+        runSampled->save(BuildCheckpoint::partial(basename + ".rsa"));
+        delete runSampled;
+        checkpoint.commit("rsa", {basename + ".rsa"});
+    }
+    
+    if(!checkpoint.isDone("isa")) {
+        Log::info() << "Sampling inverse suffix array..." << std::endl;
+        profiler.start("isa sampling");
+        
+        // Sample the inverse suffix array at the same rate, from the full
+        // suffix array if we still have it, and otherwise by walking the
+        // contigs through the BWT.
+        SampledInverseSuffixArray* inverseSampled = (suffixArray != NULL) ?
+            new SampledInverseSuffixArray(*suffixArray, infoTable,
+            sampleRate, numThreads) :
+            new SampledInverseSuffixArray(bwt, infoTable, sampleRate);
+        
+        Log::info() << "Saving sampled inverse suffix array to " << isaFile <<
+            std::endl;
+        
+        inverseSampled->save(BuildCheckpoint::partial(isaFile));
+        delete inverseSampled;
+        checkpoint.commit("isa", {isaFile});
+    }
+    
+    Log::info() << "Saving contig end indices to " << endFile << std::endl;
+    profiler.start("contig end indices");
+    
+    // The first rows of the BWT are the '$' suffixes of every text. Save the
+    // row for each contig's forward strand, so loading the index doesn't have
+    // to locate them all.
+    std::vector<int64_t> endIndices(infoTable.getCount() / 2);
+    for(size_t i = 0; i < infoTable.getCount(); i++) {
+        if(suffixArray == NULL) {
+            // They come in text order, so text i is in row i.
+            if(i % 2 == 0) {
+                endIndices[i / 2] = i;
+            }
+            continue;
+        }
+        
+        SAElem element = suffixArray->get(i);
+        if(element.getID() % 2 == 0) {
+            endIndices[element.getID() / 2] = i;
+        }
+    }
+    
+    std::ofstream endStream(endFile.c_str(), std::ios::binary);
+    size_t endCount = endIndices.size();
+    endStream.write((const char*) &endCount, sizeof(size_t));
+    endStream.write((const char*) endIndices.data(),
+        endCount * sizeof(int64_t));
+    endStream.close();
     
     // Get rid of the temporary FASTA directory
     boost::filesystem::remove_all(tempDir);
     
+    // Get rid of any k-mer table, minimal unique length table, packed suffix
+    // array, or k-mer filter left over from an old index with this basename,
+    // so they don't get loaded with this one.
+    boost::filesystem::remove(basename + ".kmi");
+    boost::filesystem::remove(basename + ".mus");
+    boost::filesystem::remove(basename + ".psa");
+    boost::filesystem::remove(basename + ".kmf");
+    
+    if(savePackedText) {
+        // Save the packed contigs so the index can read bases directly.
+        Log::info() << "Saving packed text to " << basename + ".txt" <<
+            std::endl;
+        profiler.start("packed text");
+        packedText.save(basename + ".txt");
+    } else {
+        // Don't let an old packed text get loaded with this index.
+        boost::filesystem::remove(basename + ".txt");
+    }
+    
     // Hand our SuffixArray off to an FMDIndex.
-    return new FMDIndex(basename, suffixArray);
+    profiler.start("index load");
+    FMDIndex* index = new FMDIndex(basename, suffixArray, useFlatBWT);
+    
+    if(kmerTableDepth > 0) {
+        // Make a k-mer table from the finished index, and save it so it gets
+        // loaded with the index in the future.
+        profiler.start("kmer table");
+        KmerTable* kmerTable = new KmerTable(*index, kmerTableDepth);
+        
+        Log::info() << "Saving k-mer table to " << basename + ".kmi" <<
+            std::endl;
+        kmerTable->save(basename + ".kmi");
+        
+        // Let the index we already have use it.
+        index->setKmerTable(kmerTable);
+    }
+    
+    // Save how long everything took, next to the index.
+    profiler.stop();
+    Log::info() << "Saving build profile to " << basename + ".profile.tsv" <<
+        std::endl;
+    profiler.save(basename);
+    
+    return index;
     
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
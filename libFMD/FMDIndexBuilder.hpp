@@ -4,8 +4,31 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+
+#include <ReadInfoTable.h>
+#include <ReadTable.h>
+#include <SuffixArray.h>
 
 #include "FMDIndex.hpp"
+#include "GenericBitVector.hpp"
+#include "WaveletMatrix.hpp"
+#include "PackedText.hpp"
+#include "BuildProfiler.hpp"
+#include "BuildCheckpoint.hpp"
+
+/**
+ * Ways the FMDIndexBuilder can construct the BWT.
+ */
+enum BWTAlgorithm {
+    // Sort every suffix, and keep the suffix array.
+    BWT_SUFFIX_SORT,
+    // Insert the texts into ropebwt's run-length encoded rope.
+    BWT_ROPEBWT,
+    // Insert the texts column by column with Bauer, Cox and Rosone's BCR.
+    // Only works when all the contigs are the same length.
+    BWT_BCR
+};
 
 /**
  * A class for building an FMD Index with libsuffixtools. Every index has a
@@ -18,28 +41,207 @@ class FMDIndexBuilder {
         /**
          * Create a new FMDIndexBuilder using the specified basename for its
          * index. If an index with that basename already exists, it will be
-         * replaced. Optionally, you can specify a suffix array sample rate.
+         * replaced, except that if it was an interrupted build of the same
+         * FASTAs with the same options, the stages it finished (BWT, LCP,
+         * genome masks, and sampled suffix arrays) are reused after checking
+         * them against its <basename>.manifest. Optionally, you can specify a suffix array sample rate,
+         * a depth to which to save a k-mer table for skipping the start of
+         * searches (or 0 for no table), whether to save a packed copy of
+         * the contig text for fast random access, whether to save a
+         * wavelet matrix of the genome each BWT row belongs to, whether to
+         * sample the suffix array at BWT run boundaries instead of at the
+         * sample rate, for highly repetitive collections, a memory budget in
+         * bytes, a number of threads to sort suffixes with, and an algorithm
+         * to construct the BWT with.
+         *
+         * With a memory budget of 0, the whole suffix array is built in memory,
+         * and the built index keeps it. Otherwise, the BWT is built from
+         * batches of contigs that fit in about that much memory, merged on
+         * disk, and everything else is made from the BWT, so the full suffix
+         * array is never held.
+         *
+         * With a memory budget of 0, the texts are kept in memory as they are
+         * added, and sorted from there. Otherwise, they are written to a
+         * temporary FASTA for the batched BWT build to read.
+         *
+         * With more than one thread, suffixes are sorted by parallel prefix
+         * doubling, which takes about 24 bytes per base while it runs, instead
+         * of by induced copying, which is mostly sequential.
+         *
+         * The time, memory and I/O of each build stage are saved to
+         * <basename>.profile.tsv and <basename>.profile.json.
+         *
+         * With BWT_ROPEBWT or BWT_BCR, the BWT is built incrementally from the
+         * temporary FASTA without a suffix array, which needs far less memory
+         * for collections of many similar haplotypes. Everything else is then
+         * made from the BWT. Ropebwt ignores the memory budget, and BCR uses
+         * it to build batches that get merged on disk. BCR needs every contig
+         * to be the same length, and build() throws a std::runtime_error if
+         * they aren't.
+         */
+        FMDIndexBuilder(const std::string& basename, int sampleRate = 64,
+            size_t kmerTableDepth = 0, bool savePackedText = false,
+            bool saveGenomeMatrix = false, bool sampleRuns = false,
+            size_t memoryBudget = 0, size_t numThreads = 1,
+            BWTAlgorithm bwtAlgorithm = BWT_SUFFIX_SORT);
+        
+        /**
+         * Get rid of an FMDIndexBuilder, and any texts it is still holding.
          */
-        FMDIndexBuilder(const std::string& basename, int sampleRate = 64);
+        ~FMDIndexBuilder();
         
         /**
          * Add the contents of the given FASTA file to the index, both forwards
          * and in reverse complement. All the sequences in the file are taken to
-         * constitute a genome.
+         * constitute a genome. The file may be gzipped.
          */
         void add(const std::string& filename);
         
+        /**
+         * Add the contents of each of the given FASTA files, as one genome per
+         * file, just as if add() were called on them in order. Files are parsed
+         * (and decompressed, if gzipped) in parallel, with one thread per file
+         * up to the builder's thread count, so that many of their contigs can
+         * be held in memory at once.
+         */
+        void addAll(const std::vector<std::string>& filenames);
+        
+        /**
+         * Add the haplotypes in the given phased VCF, which may be gzipped, as
+         * one genome per haplotype of each sample, in sample order. Each
+         * haplotype is made from the records of the given reference FASTA one
+         * record at a time, and added straight to the index, so no haplotype
+         * FASTAs need to be written out.
+         *
+         * Every variant's REF must match the reference. Symbolic ALT alleles
+         * are treated as the reference, and a variant that overlaps one
+         * already applied to a haplotype is skipped for that haplotype. Throws
+         * std::runtime_error on an unphased heterozygous genotype.
+         */
+        void addHaplotypes(const std::string& reference,
+            const std::string& vcf);
+        
         /**
          * Build the final index, close all files, sync to disk, and shut down
          * the FMDIndexBuilder. Must be called before the index can be read.
          * After this is called, no other method on the same object may be
          * called.
          *
-         * Returns the built FMDIndex.
+         * Returns the built FMDIndex. If useFlatBWT is set, the returned index
+         * answers search queries from a FlatBWT.
+         */
+        FMDIndex* build(bool useFlatBWT = false);
+        
+        /**
+         * Build an index of all the genomes in the existing index with the
+         * given basename, plus the genomes in the given FASTA files, one genome
+         * per file, without sorting the suffixes of the existing genomes again.
+         * Instead, only the new genomes' suffixes are sorted, and the resulting
+         * BWT is merged into the existing one. The existing index is not
+         * modified, and must have a different basename from this builder's.
+         *
+         * The existing contigs and genomes keep their numbers, and the new ones
+         * are numbered after them. Like build(), this must be the last method
+         * called, and may not be used after add().
+         *
+         * Returns the built FMDIndex. If useFlatBWT is set, the returned index
+         * answers search queries from a FlatBWT.
+         */
+        FMDIndex* append(const std::string& existingBasename,
+            const std::vector<std::string>& newFastas, bool useFlatBWT = false);
+        
+        /**
+         * Get the BWTAlgorithm with the given name ("sort", "ropebwt" or
+         * "bcr"). Throws std::runtime_error if there isn't one.
          */
-        FMDIndex* build();
+        static BWTAlgorithm parseBWTAlgorithm(const std::string& name);
         
     protected:
+        /**
+         * One run of not-N characters from a FASTA record, ready to index.
+         */
+        struct ParsedContig {
+            // The FASTA record name
+            std::string name;
+            // Where the run starts in the record
+            size_t start;
+            // The upper-cased run
+            std::string forward;
+            // And its reverse complement
+            std::string reverse;
+        };
+        
+        /**
+         * Upper-case all the ASCII letters in the given sequence, and append
+         * the [start, end) bounds of each maximal run of not-N characters to
+         * runs. Works on 8 characters at a time.
+         */
+        static void findRuns(std::string& sequence,
+            std::vector<std::pair<size_t, size_t>>& runs);
+        
+        /**
+         * Append a ParsedContig for each run of not-N characters in the given
+         * sequence from the FASTA record with the given name. Upper-cases the
+         * sequence.
+         */
+        static void split(const std::string& name, std::string& sequence,
+            std::vector<ParsedContig>& contigs);
+        
+        /**
+         * Read the given FASTA file, which may be gzipped, and get all its runs
+         * of not-N characters. Touches no builder state, so several files can
+         * be parsed at once.
+         */
+        static std::vector<ParsedContig> parse(const std::string& filename);
+        
+        /**
+         * Add the given parsed contigs to the index as a new genome. Empties
+         * out their strings as it goes.
+         */
+        void add(std::vector<ParsedContig>& contigs);
+        
+        /**
+         * Add the given parsed contigs to the index as part of the genome with
+         * the given number, which must be the last genome or a new one after
+         * it. Empties out their strings as it goes.
+         */
+        void addToGenome(std::vector<ParsedContig>& contigs,
+            size_t genomeNumber);
+        
+        /**
+         * Close the temp FASTA and the contig file, and save the binary contig
+         * metadata.
+         */
+        void writeContigs();
+        
+        /**
+         * Save everything in the index besides the BWT, LCP, and contig
+         * metadata, given the finished BWT, the lengths of all its texts, and
+         * unfinished genome masks, which get finished and deleted. If we need a
+         * genome wavelet matrix, rowGenomes must have the genome of every BWT
+         * row. The full suffix array may be null, and if it isn't, the returned
+         * FMDIndex takes ownership of it.
+         */
+        FMDIndex* finish(SuffixArray* suffixArray, const BWT& bwt,
+            const ReadInfoTable& infoTable,
+            std::vector<GenericBitVector*>& encoders,
+            const std::vector<WaveletMatrix::Value>& rowGenomes,
+            bool useFlatBWT);
+        
+        /**
+         * Work out how many texts to put in each batch of an external-memory
+         * BWT build, to stay in the memory budget.
+         */
+        size_t getTextsPerBatch() const;
+        
+        /**
+         * Sort the suffixes of all the texts in the given table, by prefix
+         * doubling on however many threads we were asked to use, or by
+         * induced copying if we were asked for only one. The caller owns the
+         * result.
+         */
+        SuffixArray* sortSuffixes(const ReadTable* readTable) const;
+        
         /**
          * Keep track of our index basename.
          */
@@ -65,6 +267,14 @@ class FMDIndexBuilder {
          */
         std::ofstream contigFile;
         
+        /**
+         * Keep the name, start, and length of each contig, so we can write the
+         * binary version of the contig file.
+         */
+        std::vector<std::string> contigNames;
+        std::vector<size_t> contigStarts;
+        std::vector<size_t> contigLengths;
+        
         /**
          * Keep a vector mapping from contig number to the genome it belongs to.
          * TODO: Use a better index here that also plugs into contigFile.
@@ -78,9 +288,92 @@ class FMDIndexBuilder {
         int sampleRate;
         
         /**
-         * How many threads should we use when building the index?
+         * Keep track of how long the k-mers in the k-mer table should be, or 0
+         * if we aren't making one.
+         */
+        size_t kmerTableDepth;
+        
+        /**
+         * Keep track of whether we are saving a packed copy of the contigs.
+         */
+        bool savePackedText;
+        
+        /**
+         * Holds the packed copy of the contigs, if we are saving one.
+         */
+        PackedText packedText;
+        
+        /**
+         * Keep track of whether we are saving a genome wavelet matrix.
+         */
+        bool saveGenomeMatrix;
+        
+        /**
+         * Keep track of whether we are sampling the suffix array at BWT run
+         * boundaries.
+         */
+        bool sampleRuns;
+        
+        /**
+         * Keep track of how many bytes of memory to build the BWT in, or 0 to
+         * build it all at once in memory.
+         */
+        size_t memoryBudget;
+        
+        /**
+         * Keep track of how many threads to use when building the index.
+         */
+        size_t numThreads;
+        
+        /**
+         * Keep track of how to construct the BWT.
+         */
+        BWTAlgorithm bwtAlgorithm;
+        
+        /**
+         * Measures each stage of the build.
+         */
+        BuildProfiler profiler;
+        
+        /**
+         * Records which stages are done, so an interrupted build can resume.
+         */
+        BuildCheckpoint checkpoint;
+        
+        /**
+         * Holds the texts (both strands of every contig) in memory, if we are
+         * sorting all their suffixes at once and so aren't writing them to the
+         * temp FASTA. Owned by this object, if not
+         * null.
+         */
+        ReadTable* texts;
+        
+        /**
+         * Keep the name and length of every text we have added, so we don't
+         * need to read them back in.
+         */
+        ReadInfoTable textInfo;
+        
+        /**
+         * About how many bytes of memory does sorting the suffixes of a batch
+         * of texts take per base? The suffix array itself takes 8, and the
+         * texts and the sort's working space take the rest.
+         */
+        static const size_t BYTES_PER_BASE = 16;
+        
+        /**
+         * What gap array storage level should we use when merging BWTs in an
+         * external-memory build? SGA's default keeps 4 bits per BWT position,
+         * and spills bigger counts into a hash table.
+         */
+        static const int GAP_ARRAY_STORAGE = 4;
+        
+        /**
+         * How many threads should induced copying use to sort its sampled
+         * suffixes? This is what the builder always used before prefix
+         * doubling was added, and a single-threaded build still uses it.
          */
-        static const size_t NUM_THREADS = 100;
+        static const size_t INDUCED_COPYING_THREADS = 100;
 };
 
 #endif
@@ -11,7 +11,7 @@
 FMDIndexIterator::FMDIndexIterator(const FMDIndex& parent, size_t depth,
     bool beEnd, bool reportDeadEnds): 
     parent(parent), depth(depth), reportDeadEnds(reportDeadEnds), stack(),
-    pattern() {
+    children(), pattern() {
     
     // By default we start out with empty everything, which is what we should
     // have at the end.
@@ -25,7 +25,7 @@ FMDIndexIterator::FMDIndexIterator(const FMDIndex& parent, size_t depth,
 FMDIndexIterator::FMDIndexIterator(const FMDIndexIterator& toCopy): 
     parent(toCopy.parent), depth(toCopy.depth), 
     reportDeadEnds(toCopy.reportDeadEnds), stack(toCopy.stack),
-    pattern(toCopy.pattern) {
+    children(toCopy.children), pattern(toCopy.pattern) {
     
     // Already made a duplicate stack. Nothing to do.
 }
@@ -158,20 +158,27 @@ bool FMDIndexIterator::recurse(size_t baseNumber) {
         return false;
     }
 
-    // What will we extend to?
-    FMDPosition extension;
-
-    if(stack.size() == 0) {
-        // Our "extension" is just starting with this base.
-        extension = parent.getCharPosition(ALPHABETICAL_BASES[baseNumber]);
-    }
-    else {
-        // Work out what we would select if we extended forwards with this
-        // letter (i.e. appended it to the suffix).
-        extension = stack.back().first;
-        parent.extendFast(extension, ALPHABETICAL_BASES[baseNumber], false);
+    if(children.size() <= stack.size()) {
+        // We haven't worked out the children of the node we're at yet.
+        children.emplace_back(NUM_BASES);
+        
+        if(stack.size() == 0) {
+            // Our "extensions" are just starting with each base.
+            for(size_t i = 0; i < NUM_BASES; i++) {
+                children.back()[i] = parent.getCharPosition(BASES[i]);
+            }
+        } else {
+            // Work out what we would select if we extended forwards with each
+            // letter (i.e. appended it to the suffix), all at once.
+            parent.extendAll(stack.back().first, false,
+                children.back().data());
+        }
     }
 
+    // What will we extend to?
+    FMDPosition extension = children[stack.size()][
+        BASES.find(ALPHABETICAL_BASES[baseNumber])];
+
 
 
     if(extension.getLength() == 0) {
@@ -224,7 +231,7 @@ bool FMDIndexIterator::tryRecurseToDepth(size_t baseNumber) {
                 // of the first base, and should always work when there is some
                 // of the first base, but I'm not sure it won't break.
                 FMDPosition extension = stack.back().first;
-                parent.extendFast(extension, ALPHABETICAL_BASES[0], false);
+                parent.extendRight<'A'>(extension);
 
                 if(extension.getForwardStart() != 
                     stack.back().first.getForwardStart()) {
@@ -296,6 +303,11 @@ std::pair<FMDPosition, size_t> FMDIndexIterator::pop() {
 
     // Drop it from the stack.
     stack.pop_back();
+    
+    // Forget the children of the node we just left, if we had them.
+    if(children.size() > stack.size() + 1) {
+        children.pop_back();
+    }
 
     // Return it
     return toReturn;
@@ -3,6 +3,7 @@
 
 #include <utility>
 #include <deque>
+#include <vector>
 
 #include "FMDPosition.hpp"
 
@@ -97,6 +98,15 @@ private:
      */
     std::deque<std::pair<FMDPosition, size_t> > stack;
     
+    /**
+     * Holds, for each node on the current search path (starting with the
+     * root), the children of that node under all the bases, in BASES order,
+     * once they have been computed. This lets us get all the children with one
+     * extendAll call instead of re-extending for each base. It may be shorter
+     * than the path, but never longer than stack.size() + 1.
+     */
+    std::deque<std::vector<FMDPosition> > children;
+    
     /**
      * Holds the string corresponding to the current FMDPosition on top of the
      * stack.
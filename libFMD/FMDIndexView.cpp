@@ -1,57 +1,200 @@
 #include "FMDIndexView.hpp"
 
+#include <algorithm>
+
+std::atomic<uint64_t> FMDIndexView::nextId(1);
+
+/**
+ * How many ranks does each thread remember? Must be a power of 2.
+ */
+static const size_t RANK_CACHE_SIZE = 256;
+
+/**
+ * Each thread remembers recent ranks in FMDIndexView bitvectors, by view ID,
+ * bitvector, and index. View ID 0 is never used, so empty entries never match.
+ */
+struct CachedRank {
+    uint64_t viewId = 0;
+    const GenericBitVector* vector = nullptr;
+    size_t index = 0;
+    size_t rank = 0;
+};
+static thread_local CachedRank rankCache[RANK_CACHE_SIZE];
+
+/**
+ * Each thread collects range numbers here when finding the TextPositions an
+ * interval selects, so that doesn't allocate once it has seen a big interval.
+ */
+static thread_local std::vector<size_t> rangeScratch;
+
 FMDIndexView::FMDIndexView(const FMDIndex& index, const GenericBitVector* mask,
     const GenericBitVector* ranges,
-    const std::map<size_t, TextPosition> positions): index(index), mask(mask),
-    ranges(ranges), positions(std::move(positions)), invertedPositions() {
+    const std::map<size_t, TextPosition>& positions): index(index), mask(mask),
+    ranges(ranges), positions(nullptr), positionCount(0), ownedPositions(),
+    assigned(), invertedPositions(nullptr), invertedCount(0),
+    ownedInvertedPositions(), id(nextId++) {
+    
+    if(!positions.empty()) {
+        // Lay the map out flat, remembering which ranges actually had entries.
+        size_t rangeCount = positions.rbegin()->first + 1;
+        ownedPositions.resize(rangeCount);
+        assigned.resize(rangeCount, false);
+        
+        for(const auto& kv : positions) {
+            ownedPositions[kv.first] = kv.second;
+            assigned[kv.first] = true;
+        }
+    }
+    this->positions = ownedPositions.data();
+    positionCount = ownedPositions.size();
+    
+    invertPositions();
+}
+
+FMDIndexView::FMDIndexView(const FMDIndex& index, const GenericBitVector* mask,
+    const GenericBitVector* ranges, std::vector<TextPosition>&& positions):
+    index(index), mask(mask), ranges(ranges), positions(positions.data()),
+    positionCount(positions.size()), ownedPositions(std::move(positions)),
+    assigned(), invertedPositions(nullptr), invertedCount(0),
+    ownedInvertedPositions(), id(nextId++) {
+    
+    // Moving the vector in keeps its data where it was, so positions still
+    // points at it.
+    invertPositions();
+}
+
+FMDIndexView::FMDIndexView(const FMDIndex& index, const GenericBitVector* mask,
+    const LevelIndex& level): index(index), mask(mask),
+    ranges(&level.getRanges()), positions(level.getPositions()),
+    positionCount(level.getPositionCount()), ownedPositions(), assigned(),
+    invertedPositions(level.getInvertedPositions()),
+    invertedCount(level.getInvertedCount()), ownedInvertedPositions(),
+    id(nextId++) {
+    
+    if(level.getBWTLength() != (size_t) index.getBWTLength()) {
+        // The ranges would be nonsense for this index.
+        throw std::runtime_error("Level index is for a BWT of length " +
+            std::to_string(level.getBWTLength()) + " but index has length " +
+            std::to_string(index.getBWTLength()));
+    }
+    
+    if(!level.hasInvertedPositions()) {
+        // We have to work them out ourselves.
+        invertPositions();
+    }
+}
+
+FMDIndexView::FMDIndexView(const FMDIndexView& other): index(other.index),
+    mask(other.mask), ranges(other.ranges), positions(other.positions),
+    positionCount(other.positionCount),
+    ownedPositions(other.ownedPositions), assigned(other.assigned),
+    invertedPositions(other.invertedPositions),
+    invertedCount(other.invertedCount),
+    ownedInvertedPositions(other.ownedInvertedPositions), id(other.id) {
     
-    if(ranges != nullptr) {
-        // We have to deal with ranges.
+    // Point at our own copies of anything the other view owned, rather than
+    // at its copies.
+    if(other.positions == other.ownedPositions.data()) {
+        positions = ownedPositions.data();
+    }
+    if(other.invertedPositions == other.ownedInvertedPositions.data()) {
+        invertedPositions = ownedInvertedPositions.data();
+    }
+}
+
+void FMDIndexView::saveLevelIndex(const std::string& filename,
+    bool inverse) const {
+    
+    if(ranges == nullptr) {
+        throw std::runtime_error("Can't save a level index without ranges");
+    }
+    
+    // Fill in positions for any ranges without explicit assignments, so every
+    // range in the file has one.
+    std::vector<TextPosition> filled;
+    const TextPosition* toSave = positions;
+    if(!assigned.empty()) {
+        filled.reserve(positionCount);
+        for(size_t i = 0; i < positionCount; i++) {
+            filled.push_back(rangeToTextPosition(i));
+        }
+        toSave = filled.data();
+    }
+    
+    LevelIndex::save(filename, index.getBWTLength(), *ranges, toSave,
+        positionCount, inverse ? invertedPositions : nullptr,
+        inverse ? invertedCount : 0);
+}
+
+std::map<std::string, size_t> FMDIndexView::getMemoryUsage() const {
+    std::map<std::string, size_t> usage;
+    
+    usage["ranges"] = ranges != nullptr ? ranges->getMemoryUsage() : 0;
+    // A vector<bool> packs its bits.
+    usage["positions"] = positionCount * sizeof(TextPosition) +
+        assigned.capacity() / 8;
+    usage["invertedPositions"] = invertedCount *
+        sizeof(std::pair<TextPosition, size_t>);
+    
+    return usage;
+}
+
+void FMDIndexView::invertPositions() {
+    if(ranges == nullptr) {
+        // No ranges means no assigned positions to invert.
+        return;
+    }
+
+    // We have to deal with ranges.
     
-        for(size_t i = 0; i < ranges->rank(ranges->getSize()); i++) {
-            // For each 1 in the ranges bitvector
+    for(size_t i = 0; i < ranges->rank(ranges->getSize()); i++) {
+        // For each 1 in the ranges bitvector
+        
+        if(hasAssignedPosition(i)) {
+            // This particular range is marked as owned.
             
-            if(positions.count(i) != 0) {
-                // This particular range is marked as owned.
-                
-                // Put in an inverted entry from the owning TextPosition to this
-                // range number.
-                invertedPositions.emplace(positions.at(i), i);
-                
-                Log::trace() << "Range " << i << " explicitly owned by " <<
-                    positions.at(i) << std::endl;
-                
-            } else {
-                // We will use the first index's TextPosition as the owner.
-                
-                // TODO: maybe we can use an inverted sampled suffix array or
-                // something here instead of the full inverted index.
-                
-                // Where does this range start?
-                int64_t rangeStart = ranges->select(i);
-                
-                if(rangeStart >= index.getBWTLength()) {
-                    // Sometimes we put trailing 1s. TODO: figure out where we
-                    // do that and stop it.
-                    
-                    // We know there are no more ranges.
-                    break;
-                }
-                
-                // And what TextPosition is there?
-                TextPosition owner = index.locate(rangeStart);
-                
-                invertedPositions.emplace(owner, i);
+            // Put in an inverted entry from the owning TextPosition to this
+            // range number.
+            ownedInvertedPositions.emplace_back(positions[i], i);
+            
+            LOG_TRACE("Range " << i << " explicitly owned by " <<
+                positions[i] << std::endl);
+            
+        } else {
+            // We will use the first index's TextPosition as the owner.
+            
+            // TODO: maybe we can use an inverted sampled suffix array or
+            // something here instead of the full inverted index.
+            
+            // Where does this range start?
+            int64_t rangeStart = ranges->select(i);
+            
+            if(rangeStart >= index.getBWTLength()) {
+                // Sometimes we put trailing 1s. TODO: figure out where we
+                // do that and stop it.
                 
-                Log::trace() << "Range " << i << " implicitly owned by " <<
-                    owner << std::endl;
+                // We know there are no more ranges.
+                break;
             }
-        }
-    
-        Log::debug() << "Made " << invertedPositions.size() <<
-            " inverted positions entries" << std::endl;
             
+            // And what TextPosition is there?
+            TextPosition owner = index.locate(rangeStart);
+            
+            ownedInvertedPositions.emplace_back(owner, i);
+            
+            LOG_TRACE("Range " << i << " implicitly owned by " <<
+                owner << std::endl);
+        }
     }
+    
+    // Sort so we can binary search for the ranges of a TextPosition. Ranges
+    // for the same TextPosition stay in range number order.
+    std::sort(ownedInvertedPositions.begin(), ownedInvertedPositions.end());
+    invertedPositions = ownedInvertedPositions.data();
+    invertedCount = ownedInvertedPositions.size();
+
+    LOG_DEBUG("Made " << invertedCount <<
+        " inverted positions entries" << std::endl);
 }
 
 int64_t FMDIndexView::getRangeNumber(size_t start, size_t length) const {
@@ -127,10 +270,10 @@ int64_t FMDIndexView::getRangeNumber(size_t start, size_t length) const {
         // Merged ranges are actually defined.
     
         // Look up the range that the forward starting position is in
-        int64_t start_range = getRanges()->rank(interval_start) - 1;
+        int64_t start_range = cachedRank(getRanges(), interval_start) - 1;
 
         // And the range the forward end is in
-        int64_t end_range = getRanges()->rank(interval_end) - 1;
+        int64_t end_range = cachedRank(getRanges(), interval_end) - 1;
         
         if(start_range == end_range) {
             // Both ends of the interval are in the same range.
@@ -154,6 +297,11 @@ int64_t FMDIndexView::getRangeNumber(size_t start, size_t length) const {
 std::pair<size_t, size_t> FMDIndexView::getRangeByNumber(
     size_t rangeNumber) const {
     
+    if(getRanges() == nullptr) {
+        // Every BWT index is its own range.
+        return std::make_pair(rangeNumber, (size_t) 1);
+    }
+    
     // Select the 1 at the start of the range
     auto start = getRanges()->select(rangeNumber);
     // Select the 1 after the end of the range, and then move back 1 to be
@@ -168,12 +316,18 @@ std::pair<size_t, size_t> FMDIndexView::getRangeByNumber(
 std::vector<size_t> FMDIndexView::getRangeNumbers(size_t start,
     size_t length) const {
     
-    // TODO: make this use callbacks or something. TODO: Be able to go from
-    // TextPosition to reverse complement to range number somehow?
-
     // We'll populate this with the number of every range for which we overlap a
     // 1 in the mask, each of which will appear once.
     std::vector<size_t> toReturn;
+    appendRangeNumbers(start, length, toReturn);
+    return toReturn;
+}
+
+void FMDIndexView::appendRangeNumbers(size_t start, size_t length,
+    std::vector<size_t>& toReturn) const {
+    
+    // TODO: make this use callbacks or something. TODO: Be able to go from
+    // TextPosition to reverse complement to range number somehow?
 
     if(length == 0) {
         // Special case the empty interval so we don't have to deal with that
@@ -196,16 +350,16 @@ std::vector<size_t> FMDIndexView::getRangeNumbers(size_t start,
     
         // Look up the range that the starting position is in. We have to
         // subtract 1 because the 0th range begins with a 1.
-        int64_t startRange = getRanges()->rank(start) - 1;
+        int64_t startRange = cachedRank(getRanges(), start) - 1;
 
         // And the range the end is in
-        int64_t endRange = getRanges()->rank(start + length - 1) - 1;
+        int64_t endRange = cachedRank(getRanges(), start + length - 1) - 1;
             
-        Log::trace() << "Looking for ranges between " << start << 
+        LOG_TRACE("Looking for ranges between " << start << 
             " in range " << startRange << " which starts at " << 
             getRanges()->select(startRange) << " and " << start + length - 1 <<
             " in range " << endRange << " which starts at " << 
-            getRanges()->select(endRange) << std::endl;
+            getRanges()->select(endRange) << std::endl);
     
         
         if(endRange < startRange) {
@@ -272,7 +426,8 @@ std::vector<size_t> FMDIndexView::getRangeNumbers(size_t start,
                 // This masked-in position is within this FMDPosition. We should
                 // count its range. Go look at what range that BWT position is
                 // in and grab it. Make sure to make it 0-based.
-                toReturn.push_back(getRanges()->rank(nextPosition.first) - 1);
+                toReturn.push_back(cachedRank(getRanges(),
+                    nextPosition.first) - 1);
                 
                 // Find the next 1 in the ranges vector after this masked-in
                 // position (exclusive), indicating the start of the next range.
@@ -301,8 +456,6 @@ std::vector<size_t> FMDIndexView::getRangeNumbers(size_t start,
             "Impossible combination of range vector and mask vector");
     }
     
-    // Return the occupied ranges.
-    return toReturn;
 }
 
 std::vector<size_t> FMDIndexView::getNewRangeNumbers(size_t oldStart,
@@ -333,22 +486,138 @@ std::vector<size_t> FMDIndexView::getNewRangeNumbers(size_t oldStart,
     return ranges;
 }
 
+void FMDIndexView::appendNewRangeNumbers(size_t oldStart, size_t oldLength,
+    size_t newStart, size_t newLength, std::vector<size_t>& out) const {
+    
+    // Do the new part on the left and then the new part on the right.
+    appendRangeNumbers(newStart, oldStart - newStart, out);
+    appendRangeNumbers(oldStart + oldLength,
+        newStart + newLength - oldStart - oldLength, out);
+}
+
+void FMDIndexView::appendRangeTextPositions(
+    const std::vector<size_t>& rangeNumbers,
+    std::vector<TextPosition>& out) const {
+    
+    if(getRanges() == nullptr) {
+        // The range numbers are just BWT indices, so locate them in batches,
+        // through a buffer on the stack.
+        const size_t BATCH = 64;
+        int64_t indices[BATCH];
+        
+        size_t first = out.size();
+        out.resize(first + rangeNumbers.size());
+        
+        for(size_t i = 0; i < rangeNumbers.size(); i += BATCH) {
+            size_t count = std::min(BATCH, rangeNumbers.size() - i);
+            for(size_t j = 0; j < count; j++) {
+                indices[j] = rangeNumbers[i + j];
+            }
+            getIndex().locateBatch(indices, count, &out[first + i]);
+        }
+    } else {
+        for(const auto& rangeNumber : rangeNumbers) {
+            out.push_back(rangeToTextPosition(rangeNumber));
+        }
+    }
+}
+
+void FMDIndexView::appendTextPositions(size_t start, size_t length,
+    std::vector<size_t>& ranges, std::vector<TextPosition>& out) const {
+    
+    ranges.clear();
+    appendRangeNumbers(start, length, ranges);
+    appendRangeTextPositions(ranges, out);
+}
+
+void FMDIndexView::appendNewTextPositions(size_t oldStart, size_t oldLength,
+    size_t newStart, size_t newLength, std::vector<size_t>& ranges,
+    std::vector<TextPosition>& out) const {
+    
+    ranges.clear();
+    appendNewRangeNumbers(oldStart, oldLength, newStart, newLength, ranges);
+    appendRangeTextPositions(ranges, out);
+}
+
+TextPositionSet FMDIndexView::getTextPositions(size_t start,
+    size_t length) const {
+    
+    // Get all the range numbers we have masked-in positions in, and convert
+    // them.
+    rangeScratch.clear();
+    appendRangeNumbers(start, length, rangeScratch);
+    return rangesToTextPositions(rangeScratch);
+}
+
+TextPositionSet FMDIndexView::getNewTextPositions(size_t oldStart,
+    size_t oldLength, size_t newStart, size_t newLength) const {
+    
+    // Get all the range numbers we found new stuff in, and convert them.
+    rangeScratch.clear();
+    appendNewRangeNumbers(oldStart, oldLength, newStart, newLength,
+        rangeScratch);
+    return rangesToTextPositions(rangeScratch);
+}
+
+TextPositionSet FMDIndexView::rangesToTextPositions(
+    const std::vector<size_t>& rangeNumbers) const {
+    
+    // We'll convert the range numbers to text positions and populate this.
+    TextPositionSet toReturn;
+    
+    if(getRanges() == nullptr) {
+        // The range numbers are just BWT indices, so locate them in batches,
+        // through buffers on the stack.
+        const size_t BATCH = 64;
+        int64_t indices[BATCH];
+        TextPosition located[BATCH];
+        
+        for(size_t i = 0; i < rangeNumbers.size(); i += BATCH) {
+            size_t count = std::min(BATCH, rangeNumbers.size() - i);
+            for(size_t j = 0; j < count; j++) {
+                indices[j] = rangeNumbers[i + j];
+            }
+            getIndex().locateBatch(indices, count, located);
+            toReturn.insert(located, located + count);
+        }
+    } else {
+        for(const auto& rangeNumber : rangeNumbers) {
+            // Map the range-number-to-text-position over the range numbers,
+            // putting the results in the set.
+            toReturn.insert(rangeToTextPosition(rangeNumber));
+        }
+    }
+    
+    // Return the results.
+    return toReturn;
+}
+
 std::vector<size_t> FMDIndexView::textPositionToRanges(
     const TextPosition& textPosition) const {
+    
+    if(getRanges() == nullptr) {
+        // We would need to find the BWT index of the position, and we have no
+        // inverted positions to look it up in.
+        throw std::runtime_error(
+            "Can't find ranges for a position in a view without ranges");
+    }
         
-    // Find the bounding iterators of the range of range numbers belonging to
-    // this position.
-    auto bounds = invertedPositions.equal_range(textPosition);
+    // Find where the range numbers belonging to this position start. Range
+    // number 0 sorts before any other entry for the same TextPosition.
+    auto found = std::lower_bound(invertedPositions,
+        invertedPositions + invertedCount,
+        std::make_pair(textPosition, (size_t) 0));
     
     // We're going to fill up this vector with the results.
     std::vector<size_t> toReturn;
     
-    for(auto kvIterator = bounds.first; kvIterator != bounds.second;
-        ++kvIterator) {
+    for(; found != invertedPositions + invertedCount &&
+        found->first == textPosition;
+        ++found) {
     
         // For every TextPosition, range number pair that has the key we asked
         // for, put the range number in the vector.
-        toReturn.push_back((*kvIterator).second);
+        toReturn.push_back(found->second);
     }
     
     // Return the result.
@@ -366,10 +635,10 @@ size_t FMDIndexView::getApproximateNumberOfRanges(
         
         // Look up the range that the starting position is in. We have to
         // subtract 1 because the 0th range begins with a 1.
-        int64_t startRange = getRanges()->rank(start) - 1;
+        int64_t startRange = cachedRank(getRanges(), start) - 1;
 
         // And the range the end is in
-        int64_t endRange = getRanges()->rank(start + length - 1) - 1;
+        int64_t endRange = cachedRank(getRanges(), start + length - 1) - 1;
             
         // Return the total number of ranges we overlap
         return endRange - startRange + 1;
@@ -382,10 +651,10 @@ size_t FMDIndexView::getApproximateNumberOfRanges(
             // Count only masked-in positions
             
             // How many masked-in positions exist before we start?
-            int64_t startMask = getMask()->rank(start);
+            int64_t startMask = cachedRank(getMask(), start);
             
             // And how many exist before we end?            
-            int64_t endMask = getMask()->rank(start + length - 1);
+            int64_t endMask = cachedRank(getMask(), start + length - 1);
                 
             // Cound how many we touch because of that. TODO: Unit test this!
             return endMask - startMask + 1;
@@ -416,9 +685,91 @@ size_t FMDIndexView::getApproximateNumberOfNewRanges(size_t oldStart,
 
 }
 
+size_t FMDIndexView::countRangesUpTo(size_t start, size_t length,
+    size_t limit) const {
+    
+    if(length == 0) {
+        // Nothing is selected.
+        return 0;
+    }
+    
+    // Where's the last position that's in the BWT range?
+    size_t end = start + length - 1;
+    
+    if(getRanges() != nullptr && getMask() == nullptr) {
+        // Every range we touch counts, and we can count them directly.
+        return std::min(cachedRank(getRanges(), end) -
+            cachedRank(getRanges(), start) + 1, limit + 1);
+    } else if(getRanges() == nullptr && getMask() == nullptr) {
+        // Every position is its own range.
+        return std::min(length, limit + 1);
+    } else if(getRanges() == nullptr) {
+        // Every masked-in position is its own range, so count the 1s in the
+        // mask between the endpoints, the way isEmpty does.
+        return std::min(cachedRank(getMask(), end) + 1 -
+            getMask()->rank(start, true), limit + 1);
+    }
+    
+    // Otherwise we have ranges and a mask, and only ranges with masked-in
+    // positions count. Jump from one to the next like appendRangeNumbers does,
+    // but stop when we have seen too many.
+    size_t count = 0;
+    size_t left = start;
+    while(left <= end && count <= limit) {
+        // Find the next masked-in position.
+        auto nextPosition = getMask()->valueAfter(left);
+        if(nextPosition.first > end) {
+            // It's not in the interval.
+            break;
+        }
+        
+        // Its range counts.
+        count++;
+        
+        // Skip to the start of the next range.
+        auto nextRange = getRanges()->valueAfter(nextPosition.first + 1);
+        if(nextRange.first <= left) {
+            // We wrapped around because we ran out of ranges.
+            break;
+        }
+        left = nextRange.first;
+    }
+    
+    return std::min(count, limit + 1);
+}
 
+size_t FMDIndexView::countNewRangesUpTo(size_t oldStart, size_t oldLength,
+    size_t newStart, size_t newLength, size_t limit) const {
+    
+    // Count on the left.
+    size_t count = countRangesUpTo(newStart, oldStart - newStart, limit);
+    
+    if(count > limit) {
+        // Don't bother with the right.
+        return count;
+    }
+    
+    // Then count on the right, with whatever is left of the limit.
+    return count + countRangesUpTo(oldStart + oldLength,
+        newStart + newLength - oldStart - oldLength, limit - count);
+}
 
-
-
-
-
+size_t FMDIndexView::cachedRank(const GenericBitVector* vector,
+    size_t index) const {
+    
+    // Pick a slot by mixing up the index, and the bitvector so the mask and
+    // ranges don't fight over the same slots.
+    size_t slot = (((uint64_t) index * 0x9E3779B97F4A7C15ULL) >> 32 ^
+        (vector == mask)) & (RANK_CACHE_SIZE - 1);
+    CachedRank& entry = rankCache[slot];
+    
+    if(entry.viewId != id || entry.vector != vector || entry.index != index) {
+        // We don't have this one. Look it up and replace whatever was there.
+        entry.viewId = id;
+        entry.vector = vector;
+        entry.index = index;
+        entry.rank = vector->rank(index);
+    }
+    
+    return entry.rank;
+}
@@ -4,8 +4,15 @@
 #include "FMDIndex.hpp"
 #include "GenericBitVector.hpp"
 #include "TextPosition.hpp"
+#include "TextPositionSet.hpp"
+#include "LevelIndex.hpp"
 
 #include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <atomic>
+#include <cstdint>
 
 /**
  * Represents an FMDIndex taken together with a graph structure merging
@@ -23,8 +30,59 @@ public:
      */
     FMDIndexView(const FMDIndex& index, const GenericBitVector* mask = nullptr,
         const GenericBitVector* ranges = nullptr,
-        const std::map<size_t, TextPosition> positions =
+        const std::map<size_t, TextPosition>& positions =
         std::map<size_t, TextPosition>());
+        
+    /**
+     * Make a new FMDIndexView for the given FMDIndex, with the given mask, the
+     * given bitvector of merged ranges, and a vector giving the assigned
+     * position for every range in order. The vector is moved in, so no copy
+     * of it is made, and range lookups are just indexing into it.
+     *
+     * All pointers must be to objects that will outlive this FMDIndexView. No
+     * ownership is taken.
+     */
+    FMDIndexView(const FMDIndex& index, const GenericBitVector* mask,
+        const GenericBitVector* ranges, std::vector<TextPosition>&& positions);
+    
+    /**
+     * Make a new FMDIndexView for the given FMDIndex, with the given mask,
+     * using the merged ranges and positions of a saved level index. The
+     * positions, and the inverted positions if the level index has them, are
+     * used in place in the level index's mapped file rather than copied. Throws
+     * a std::runtime_error if the level index was made for an index with a
+     * different BWT length.
+     *
+     * The mask and the level index must outlive this FMDIndexView.
+     */
+    FMDIndexView(const FMDIndex& index, const GenericBitVector* mask,
+        const LevelIndex& level);
+    
+    /**
+     * Copy an FMDIndexView. Positions it owns are copied, and positions in a
+     * level index are shared.
+     */
+    FMDIndexView(const FMDIndexView& other);
+    
+    /**
+     * Move an FMDIndexView.
+     */
+    FMDIndexView(FMDIndexView&& other) = default;
+    
+    /**
+     * Save the merged ranges and range positions of this view as a level
+     * index, which can be loaded and viewed again without recomputing them. If
+     * inverse is set, the inverted positions are saved too, so they needn't be
+     * rebuilt on load.
+     */
+    void saveLevelIndex(const std::string& filename, bool inverse = true) const;
+    
+    /**
+     * Get the number of bytes taken up by each of the structures the view
+     * keeps on top of its index, by name, whether it owns them or they are in
+     * a mapped level index. The index and its masks are not included.
+     */
+    std::map<std::string, size_t> getMemoryUsage() const;
     
     /**
      * Get the FMDIndex this is a view of.
@@ -49,11 +107,20 @@ public:
     }
     
     /**
-     * Get a reference to the range-number-to-position-and-orientation map that
-     * this view uses.
+     * Return true if the given range has a position explicitly assigned to
+     * it, and false if it belongs to the position of its first BWT position.
      */
-    const inline std::map<size_t, TextPosition>& getPositions() const {
-        return positions;    
+    inline bool hasAssignedPosition(size_t rangeNumber) const {
+        return rangeNumber < positionCount &&
+            (assigned.empty() || assigned[rangeNumber]);
+    }
+    
+    /**
+     * Get the position explicitly assigned to the given range, which must have
+     * one.
+     */
+    inline const TextPosition& getAssignedPosition(size_t rangeNumber) const {
+        return positions[rangeNumber];
     }
     
     /***************************************************************************
@@ -124,7 +191,7 @@ public:
      */
     inline TextPosition rangeToTextPosition(size_t rangeNumber) const {
         
-        if(getPositions().count(rangeNumber) == 0) {
+        if(!hasAssignedPosition(rangeNumber)) {
             // This range has no assigned position, so it must belong to the
             // TextPosition you get if you locate its first masked in BWT
             // position.
@@ -159,21 +226,30 @@ public:
                 // Find the TextPosition for the selected BWT position.
                 auto pos = getIndex().locate(bwtIndex);
                 
-                Log::trace() << "Range " << rangeNumber <<
-                    " is TextPosition " << pos << std::endl;
+                LOG_TRACE("Range " << rangeNumber <<
+                    " is TextPosition " << pos << std::endl);
                 return pos;
             }
             
         } else {
             // Go look up the right TextPosition for this range and use that.
-            return getPositions().at(rangeNumber);
+            return getAssignedPosition(rangeNumber);
         }
         
     }
     
+    /**
+     * Convert a bunch of range numbers to the set of TextPositions they belong
+     * to. If ranges aren't merged, the range numbers are BWT indices, and they
+     * get located all together in batches.
+     */
+    TextPositionSet rangesToTextPositions(
+        const std::vector<size_t>& rangeNumbers) const;
+    
     /**
      * Given a TextPosition (that is actually used to represent a merged
-     * position), find all the range numbers assigned to it.
+     * position), find all the range numbers assigned to it. The view must have
+     * ranges.
      */
     std::vector<size_t> textPositionToRanges(
         const TextPosition& textPosition) const;
@@ -193,56 +269,40 @@ public:
     /**
      * Get all of the TextPositions that this BWT interval selects.
      * Automatically de-duplicates those that might be included through multiple
-     * ranges.
+     * ranges. Allocates nothing if there are few of them.
      */
-    inline std::set<TextPosition> getTextPositions(size_t start,
-        size_t length) const {
-        
-        // Get all the range numbers we have masked-in positions in.
-        std::vector<size_t> rangeNumbers = getRangeNumbers(start, length);
-        
-        // We'll convert the range numbers to text positions and populate this.
-        std::set<TextPosition> toReturn;
-        
-        for(const auto& rangeNumber : rangeNumbers) {
-            // Map the range-number-to-text-position over the range numbers,
-            // putting the results in the set.
-            toReturn.insert(rangeToTextPosition(rangeNumber));
-        }
-        
-        // Return the results.
-        return toReturn;
-    }
+    TextPositionSet getTextPositions(size_t start, size_t length) const;
     
     /**
      * Find TextPositions for all the BWT positions which were not selected in
      * the old BWT interval but which are selected in the wider one. Note that
      * some of the returned TextPositions may be ones that were already selected
      * in the old range (if new BWT positions merged into the same TextPositions
-     * are selected).
+     * are selected). Allocates nothing if there are few of them.
      *
      * The wider interval must contain the old interval.
      */
-    inline std::set<TextPosition> getNewTextPositions(size_t oldStart,
-        size_t oldLength, size_t newStart, size_t newLength) const {
-        
-        // Get all the range numbers we found new stuff in.
-        std::vector<size_t> rangeNumbers = getNewRangeNumbers(oldStart,
-            oldLength, newStart, newLength);
-        
-        // We'll convert the range numbers to text positions and populate this.
-        std::set<TextPosition> toReturn;
-        
-        for(const auto& rangeNumber : rangeNumbers) {
-            // Map the range-number-to-text-position over the range numbers,
-            // putting the results in the set.
-            toReturn.insert(rangeToTextPosition(rangeNumber));
-        }
-        
-        // Return the results.
-        return toReturn;
-        
-    }
+    TextPositionSet getNewTextPositions(size_t oldStart, size_t oldLength,
+        size_t newStart, size_t newLength) const;
+    
+    /**
+     * Append all of the TextPositions that this BWT interval selects to the
+     * given vector, using the given vector of range numbers as scratch space.
+     * Does not sort or de-duplicate. Allocates nothing once the vectors are
+     * big enough.
+     */
+    void appendTextPositions(size_t start, size_t length,
+        std::vector<size_t>& ranges, std::vector<TextPosition>& out) const;
+    
+    /**
+     * Append TextPositions for the BWT positions which were not selected in the
+     * old BWT interval but which are selected in the wider one, like
+     * getNewTextPositions(), to the given vector. Uses the given vector of
+     * range numbers as scratch space. Does not sort or de-duplicate.
+     */
+    void appendNewTextPositions(size_t oldStart, size_t oldLength,
+        size_t newStart, size_t newLength, std::vector<size_t>& ranges,
+        std::vector<TextPosition>& out) const;
     
     /**
      * Find (approximately) the number of merged ranges selected by a BWT
@@ -258,6 +318,25 @@ public:
      */
     size_t getApproximateNumberOfNewRanges(size_t oldStart, size_t oldLength,
         size_t newStart, size_t newLength) const;
+    
+    /**
+     * Count the merged ranges that a BWT interval has masked-in positions in,
+     * exactly, but stop and return limit + 1 as soon as there are more than
+     * limit of them. Takes O(limit) jumps at worst, instead of time in the
+     * size of the interval, so a hugely ambiguous interval can be given up on
+     * quickly.
+     */
+    size_t countRangesUpTo(size_t start, size_t length, size_t limit) const;
+    
+    /**
+     * Count the merged ranges that a wider BWT interval has masked-in
+     * positions in, outside the old interval, like countRangesUpTo(). Ranges
+     * that stick out on both sides are counted twice.
+     *
+     * The wider interval must contain the old interval.
+     */
+    size_t countNewRangesUpTo(size_t oldStart, size_t oldLength,
+        size_t newStart, size_t newLength, size_t limit) const;
         
     /**
      * Return the index of the range that the forward-strand interval of this
@@ -268,7 +347,8 @@ public:
     
     /**
      * Make a BWT interval covering the range with the given number. Returns
-     * (start, length).
+     * (start, length). If ranges aren't merged, the range number is a BWT
+     * index, and the interval is just that index.
      */
     std::pair<size_t, size_t> getRangeByNumber(size_t rangeNumber) const;
     
@@ -280,6 +360,13 @@ protected:
      */
     std::vector<size_t> getRangeNumbers(size_t start, size_t length) const;
     
+    /**
+     * Append the indices of all of the ranges that the forward-strand interval
+     * of this BWT interval has masked-in positions in to the given vector.
+     */
+    void appendRangeNumbers(size_t start, size_t length,
+        std::vector<size_t>& out) const;
+    
     /**
      * Return the indices of all of the ranges that the forward-strand interval
      * of the wider BWT interval has masked-in positions in, in the part of it
@@ -289,6 +376,28 @@ protected:
      */
     std::vector<size_t> getNewRangeNumbers(size_t oldStart, size_t oldLength,
         size_t newStart, size_t newLength) const;
+    
+    /**
+     * Append the indices of all of the ranges that the wider BWT interval has
+     * masked-in positions in, outside the old interval, to the given vector.
+     */
+    void appendNewRangeNumbers(size_t oldStart, size_t oldLength,
+        size_t newStart, size_t newLength, std::vector<size_t>& out) const;
+    
+    /**
+     * Append the TextPositions for the given range numbers to the given vector,
+     * without de-duplicating them.
+     */
+    void appendRangeTextPositions(const std::vector<size_t>& rangeNumbers,
+        std::vector<TextPosition>& out) const;
+    
+    /**
+     * Get the rank of the given index in the given bitvector, which must be
+     * this view's mask or ranges vector. Each thread remembers recent ranks in
+     * a small direct-mapped cache, since retractions keep asking about the
+     * same interval endpoints.
+     */
+    size_t cachedRank(const GenericBitVector* vector, size_t index) const;
 
     /**
      * What FMDIndex are we a view of? It must of course outlive us.
@@ -317,31 +426,79 @@ protected:
     
     /**
      * What is the position and orientation that each merged range belongs to?
-     * This map stores, by range number, a TextPosition representing the
+     * This array stores, by range number, a TextPosition representing the
      * position that each merged range belongs to, and the orientation of the
      * position that the range is associated with. If ranges is null, this will
-     * be empty. If an entry does not exist for a range, that range belongs to
-     * the position and orientation associated with its lowest BWT position.
+     * be empty. If an entry does not exist for a range (because it is past the
+     * end, or because its bit in assigned is unset), that range belongs to the
+     * position and orientation associated with its lowest BWT position.
      * (Thus, single-item ranges do not need entries here.)
      *
      * This is the structure that ties multiple merged ranges that ought to
      * belong to the same position together. It also ties forward and reverse-
      * complement ranges together.
      *
+     * Points either into ownedPositions or into a level index's mapped file.
      * If ranges is null, this must be empty.
      */
-    const std::map<size_t, TextPosition> positions;
+    const TextPosition* positions;
+    
+    /**
+     * How many entries are in positions?
+     */
+    size_t positionCount;
+    
+    /**
+     * Holds the positions, when they weren't loaded in a level index.
+     */
+    std::vector<TextPosition> ownedPositions;
+    
+    /**
+     * Which entries in positions are real assignments, when we were given a
+     * sparse map of them. If this is empty, all of them are.
+     */
+    std::vector<bool> assigned;
     
     /**
      * An inverted version of positions above, for finding the list of ranges
-     * associated with any particular TextPosition.
-     *
-     * If ranges is null, this must be empty.
+     * associated with any particular TextPosition. Holds a (TextPosition,
+     * range number) pair for every range, sorted, so all the ranges for a
+     * TextPosition can be found by binary search.
      *
-     * TODO: Use some sort of compressible thing that doesn't end up storing an
-     * entire BWT's worth or more of info.
+     * Points either into ownedInvertedPositions or into a level index's mapped
+     * file. If ranges is null, this must be empty.
+     */
+    const std::pair<TextPosition, size_t>* invertedPositions;
+    
+    /**
+     * How many entries are in invertedPositions?
+     */
+    size_t invertedCount;
+    
+    /**
+     * Holds the inverted positions, when they weren't loaded in a level index.
+     */
+    std::vector<std::pair<TextPosition, size_t>> ownedInvertedPositions;
+    
+    /**
+     * Fill in ownedInvertedPositions from positions, locating the first BWT
+     * position of each range that has no assigned position, and point
+     * invertedPositions at them.
+     */
+    void invertPositions();
+    
+    /**
+     * Holds a number identifying this view's mask and ranges, never reused,
+     * so thread-local cached ranks for other views (including dead ones with
+     * vectors at the same addresses) are never used. Copies of a view share
+     * it, since they share the vectors.
+     */
+    uint64_t id;
+    
+    /**
+     * Counts up to produce view IDs.
      */
-    std::multimap<TextPosition, size_t> invertedPositions;
+    static std::atomic<uint64_t> nextId;
 };
 
 #endif
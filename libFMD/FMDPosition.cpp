@@ -63,6 +63,13 @@ size_t FMDPosition::retractRightOnly(const FMDIndexView& view) {
     return view.getIndex().retractRightOnly(*this);
 }
 
+void FMDPosition::prefetch(const FMDIndexView& view) const {
+    // Extending looks at the occurrences just before and at the end of our
+    // forward interval.
+    view.getIndex().prefetchOcc(forward_start - 1);
+    view.getIndex().prefetchOcc(forward_start + end_offset);
+}
+
 bool FMDPosition::isEmpty(const FMDIndexView& view) const {
     // Get our forward interval and see if it's empty.
     return view.isEmpty(getForwardStart(), getLength());
@@ -98,14 +105,29 @@ size_t FMDPosition::getApproximateNumberOfNewRanges(const FMDIndexView& view,
         old.getLength(), getForwardStart(), getLength());
 }
     
-std::set<TextPosition> FMDPosition::getTextPositions(
+size_t FMDPosition::countRangesUpTo(const FMDIndexView& view,
+    size_t limit) const {
+    
+    // Count the ranges in our interval.
+    return view.countRangesUpTo(getForwardStart(), getLength(), limit);
+}
+
+size_t FMDPosition::countNewRangesUpTo(const FMDIndexView& view,
+    const FMDPosition& old, size_t limit) const {
+    
+    // Count the ranges in our interval outside the old position's interval.
+    return view.countNewRangesUpTo(old.getForwardStart(), old.getLength(),
+        getForwardStart(), getLength(), limit);
+}
+    
+TextPositionSet FMDPosition::getTextPositions(
     const FMDIndexView& view) const {
     
     // Get our text positions from our interval
     return view.getTextPositions(getForwardStart(), getLength());
 }
 
-std::set<TextPosition> FMDPosition::getNewTextPositions(
+TextPositionSet FMDPosition::getNewTextPositions(
     const FMDIndexView& view, const FMDPosition& old) const {
     
     // Get our new text positions from our interval and the old position's
@@ -113,3 +135,17 @@ std::set<TextPosition> FMDPosition::getNewTextPositions(
     return view.getNewTextPositions(old.getForwardStart(),
         old.getLength(), getForwardStart(), getLength());
 }
+
+void FMDPosition::appendTextPositions(const FMDIndexView& view,
+    std::vector<size_t>& ranges, std::vector<TextPosition>& out) const {
+    
+    view.appendTextPositions(getForwardStart(), getLength(), ranges, out);
+}
+
+void FMDPosition::appendNewTextPositions(const FMDIndexView& view,
+    const FMDPosition& old, std::vector<size_t>& ranges,
+    std::vector<TextPosition>& out) const {
+    
+    view.appendNewTextPositions(old.getForwardStart(), old.getLength(),
+        getForwardStart(), getLength(), ranges, out);
+}
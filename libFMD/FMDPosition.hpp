@@ -8,6 +8,7 @@
 
 #include "GenericBitVector.hpp"
 #include "TextPosition.hpp"
+#include "TextPositionSet.hpp"
 #include "Log.hpp"
 
 // Forward declaration of FMDPosition
@@ -149,6 +150,12 @@ public:
      */
     size_t retractRightOnly(const FMDIndexView& view);
 
+    /**
+     * Prefetch what the index needs to extend this FMDPosition, so that the
+     * memory reads can overlap with other work.
+     */
+    void prefetch(const FMDIndexView& view) const;
+
     /**
      * Is nothing selected under the given view?
      */
@@ -182,19 +189,50 @@ public:
      */
     size_t getApproximateNumberOfNewRanges(const FMDIndexView& view,
         const FMDPosition& old);
+    
+    /**
+     * Count the ranges selected under the given view, stopping at limit + 1
+     * if there are more than limit.
+     */
+    size_t countRangesUpTo(const FMDIndexView& view, size_t limit) const;
+    
+    /**
+     * Count the new ranges selected under the given view, relative to the
+     * given old FMDPosition, stopping at limit + 1 if there are more than
+     * limit.
+     */
+    size_t countNewRangesUpTo(const FMDIndexView& view, const FMDPosition& old,
+        size_t limit) const;
         
     /**
      * Get the TextPositions selected under the given view.
      */
-    std::set<TextPosition> getTextPositions(const FMDIndexView& view) const;
+    TextPositionSet getTextPositions(const FMDIndexView& view) const;
     
     /**
      * Get the new TextPositions selected under the given view, relative to the
      * given old FMDPosition. Some of them may have already been selected in the
      * old FMDPosition.s
      */
-    std::set<TextPosition> getNewTextPositions(const FMDIndexView& view,
+    TextPositionSet getNewTextPositions(const FMDIndexView& view,
         const FMDPosition& old) const;
+        
+    /**
+     * Append the TextPositions selected under the given view to the given
+     * vector, without sorting or de-duplicating, using the given range number
+     * vector as scratch space.
+     */
+    void appendTextPositions(const FMDIndexView& view,
+        std::vector<size_t>& ranges, std::vector<TextPosition>& out) const;
+        
+    /**
+     * Append the new TextPositions selected under the given view, relative to
+     * the given old FMDPosition, to the given vector, without sorting or
+     * de-duplicating, using the given range number vector as scratch space.
+     */
+    void appendNewTextPositions(const FMDIndexView& view,
+        const FMDPosition& old, std::vector<size_t>& ranges,
+        std::vector<TextPosition>& out) const;
 
 protected:
     int64_t forward_start;
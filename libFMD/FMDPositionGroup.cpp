@@ -2,6 +2,8 @@
 
 #include "util.hpp"
 
+#include <algorithm>
+
 FMDPositionGroup::FMDPositionGroup(): positions() {
     // Nothing to do!
 }
@@ -11,27 +13,34 @@ FMDPositionGroup::FMDPositionGroup(
     
     for(const auto& position : startPositions) {
         // We need to tag all the positions with empty annotations
-        positions.emplace(position);
+        positions.emplace_back(position);
     }
+    makeSet(positions);
 }
 
 FMDPositionGroup::FMDPositionGroup(
-    std::set<AnnotatedFMDPosition>&& startPositions):
+    std::vector<AnnotatedFMDPosition>&& startPositions):
     positions(std::move(startPositions)) {
     
-    // Nothing to do!
+    makeSet(positions);
+}
+
+void FMDPositionGroup::makeSet(std::vector<AnnotatedFMDPosition>& positions) {
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+        positions.end());
 }
 
 FMDPositionGroup::FMDPositionGroup(
     const FMDIndexView& view): FMDPositionGroup() {
     
     // Start with just one FMDPosition, covering the whole thing.
-    positions.emplace(view);
+    positions.emplace_back(view);
     
 }
 
 bool FMDPositionGroup::extendGreedy(const FMDIndexView& view, 
-    char correctCharacter, size_t maxMismatches) {
+    char correctCharacter, size_t maxMismatches, bool exactPossible) {
 
     // This will hold all the extensions we find that aren't empty
     decltype(positions) nonemptyExtensions;
@@ -42,7 +51,10 @@ bool FMDPositionGroup::extendGreedy(const FMDIndexView& view,
     bool exactMatch;
     
     for(const auto& annotated : positions) {
-        // For each existing FMDPosition
+        // For each existing FMDPosition, unless we know we won't find anything
+        if(!exactPossible) {
+            break;
+        }
         
         // Pull it out
         FMDPosition toExtend = annotated.position;
@@ -53,59 +65,64 @@ bool FMDPositionGroup::extendGreedy(const FMDIndexView& view,
         if(!toExtend.isEmpty(view)) {
             // If we got anything, keep the range (and don't increment the
             // mismatches)
-            nonemptyExtensions.emplace(toExtend, annotated, false);
+            nonemptyExtensions.emplace_back(toExtend, annotated, false);
         }
     }
     
     if(nonemptyExtensions.size() == 0) {
         // If they are all empty, extend with all the mismatch characters and
         // charge a mismatch each.
+        
+        if(maxMismatches > MAX_MISMATCHES) {
+            throw std::runtime_error("Too many mismatches allowed");
+        }
     
         // We have to use mismatches, if we can find anything at all.
         exactMatch = false;
     
-        for(char base : BASES) {
-            if(base == correctCharacter) {
-                // Don't even try the right base, we just did.
+        for(const auto& annotated : positions) {
+            // Try each position we have as a starting point.
+            
+            if(annotated.mismatches >= maxMismatches) {
+                // We can't afford another mismatch on this one.
                 continue;
             }
             
-            for(const auto& annotated : positions) {
-                // Try each position we have as a starting point.
-                
-                if(annotated.mismatches >= maxMismatches) {
-                    // We can't afford another mismatch on this one.
+            // Extend it with all the bases at once
+            FMDPosition extensions[NUM_BASES];
+            view.getIndex().extendLeftOnlyAll(annotated.position,
+                extensions);
+            
+            for(size_t base = 0; base < NUM_BASES; base++) {
+                if(BASES[base] == correctCharacter) {
+                    // Don't even try the right base, we just did.
                     continue;
                 }
                 
-                // Pull it out
-                FMDPosition toExtend = annotated.position;
-                
-                // Extend it
-                toExtend.extendLeftOnly(view, base);
-                
-                if(!toExtend.isEmpty(view)) {
+                if(!extensions[base].isEmpty(view)) {
                     // If we got anything, keep the range (and charge a
                     // mismatch)
-                    nonemptyExtensions.emplace(toExtend, annotated, true);
+                    nonemptyExtensions.emplace_back(extensions[base], annotated,
+                        true);
                 }
             }
             
         }
         
-        Log::debug() << "Extended with all but " << correctCharacter <<
-            std::endl;
+        LOG_DEBUG("Extended with all but " << correctCharacter <<
+            std::endl);
         
     } else {
         // We managed to extend with an exact match.
         exactMatch = true;
-        Log::debug() << "Extended with " << correctCharacter << std::endl;
+        LOG_DEBUG("Extended with " << correctCharacter << std::endl);
     }
     
     // Replace our FMDPositions with the new extended ones.
+    makeSet(nonemptyExtensions);
     positions = std::move(nonemptyExtensions);
     
-    Log::debug() << "Have " << positions.size() << " ranges" << std::endl;
+    LOG_DEBUG("Have " << positions.size() << " ranges" << std::endl);
     
     // Let the caller know if we found the base they wanted or not.
     return exactMatch;
@@ -118,24 +135,39 @@ FMDPositionGroup FMDPositionGroup::extendFull(const FMDIndexView& view,
     // This will hold all the extensions we find that aren't empty
     decltype(positions) nonemptyExtensions;
     
+    // And this will hold the nonempty ones that needed a mismatch, until we
+    // have counted the exact ones.
+    decltype(positions) mismatchExtensions;
+    
     // Set this to true if we found an exact match, false if we had to use a
     // mismatch here (and thus, even if we are unique, we shouldn't produce a
     // mapping).
     bool exactMatch;
     
+    if(maxMismatches > MAX_MISMATCHES) {
+        throw std::runtime_error("Too many mismatches allowed");
+    }
+    
     for(const auto& annotated : positions) {
-        // For each existing FMDPosition
-        
-        // Pull it out
-        FMDPosition toExtend = annotated.position;
-        
-        // Extend it
-        view.getIndex().extendLeftOnly(toExtend, correctCharacter);
+        // For each existing FMDPosition, extend it with all the bases at once.
+        FMDPosition extensions[NUM_BASES];
+        view.getIndex().extendLeftOnlyAll(annotated.position, extensions);
         
-        if(!toExtend.isEmpty(view)) {
-            // If we got anything, keep the range (and don't increment the
-            // mismatches)
-            nonemptyExtensions.emplace(toExtend, annotated, false);
+        for(size_t base = 0; base < NUM_BASES; base++) {
+            if(extensions[base].isEmpty(view)) {
+                // Nothing there
+                continue;
+            }
+            
+            if(BASES[base] == correctCharacter) {
+                // If we got anything, keep the range (and don't increment the
+                // mismatches)
+                nonemptyExtensions.emplace_back(extensions[base], annotated, false);
+            } else if(annotated.mismatches < maxMismatches) {
+                // We can afford a mismatch here, so keep the range (and charge
+                // a mismatch)
+                mismatchExtensions.emplace_back(extensions[base], annotated, true);
+            }
         }
     }
     
@@ -144,58 +176,34 @@ FMDPositionGroup FMDPositionGroup::extendFull(const FMDIndexView& view,
     exactMatch = (nonemptyExtensions.size() != 0);
     
     if(exactMatch) {
-        Log::debug() << "Extended with " << correctCharacter << std::endl;
+        LOG_DEBUG("Extended with " << correctCharacter << std::endl);
     } else {
-        Log::debug() << "Failed to extend with " << correctCharacter << 
-            std::endl;
+        LOG_DEBUG("Failed to extend with " << correctCharacter << 
+            std::endl);
     }
     
     // How many exact matches do we have?
+    makeSet(nonemptyExtensions);
     size_t exactMatchCount = nonemptyExtensions.size();
-        
     
-    for(char base : BASES) {
-        if(base == correctCharacter) {
-            // Don't even try the right base, we just did.
-            continue;
-        }
-        
-        for(const auto& annotated : positions) {
-            // Try each position we have as a starting point.
-            
-            if(annotated.mismatches >= maxMismatches) {
-                // We can't afford another mismatch on this one.
-                continue;
-            }
-            
-            // Pull it out
-            FMDPosition toExtend = annotated.position;
-            
-            // Extend it
-            toExtend.extendLeftOnly(view, base);
-            
-            if(!toExtend.isEmpty(view)) {
-                // If we got anything, keep the range (and charge a
-                // mismatch)
-                nonemptyExtensions.emplace(toExtend, annotated, true);
-            }
-        }
-        
-    }
+    // Now add in the mismatch results. They can't duplicate any exact ones,
+    // since they come from different characters.
+    nonemptyExtensions.insert(nonemptyExtensions.end(),
+        mismatchExtensions.begin(), mismatchExtensions.end());
     
     if(nonemptyExtensions.size() > exactMatchCount) {
         // We found some mismatch results
-        Log::debug() << "Extended with all but " << correctCharacter <<
-            std::endl;
+        LOG_DEBUG("Extended with all but " << correctCharacter <<
+            std::endl);
     } else {
         // We didn't find any mismatch results
-        Log::debug() << "Failed to extend with anything besides " <<
-            correctCharacter << std::endl;
+        LOG_DEBUG("Failed to extend with anything besides " <<
+            correctCharacter << std::endl);
     }
     
     
-    Log::debug() << "Have " << nonemptyExtensions.size() << " ranges" <<
-        std::endl;
+    LOG_DEBUG("Have " << nonemptyExtensions.size() << " ranges" <<
+        std::endl);
     
     // Wrap the set up and move it out
     return FMDPositionGroup(std::move(nonemptyExtensions));
@@ -219,19 +227,19 @@ FMDPositionGroup FMDPositionGroup::extendExact(const FMDIndexView& view,
         if(!toExtend.isEmpty(view)) {
             // If we got anything, keep the range (and don't increment the
             // mismatches)
-            nonemptyExtensions.emplace(toExtend, annotated, false);
+            nonemptyExtensions.emplace_back(toExtend, annotated, false);
         }
     }
     
     if(nonemptyExtensions.size() != 0) {
-        Log::debug() << "Extended with " << correctCharacter << std::endl;
+        LOG_DEBUG("Extended with " << correctCharacter << std::endl);
     } else {
-        Log::debug() << "Failed to extend with " << correctCharacter << 
-            std::endl;
+        LOG_DEBUG("Failed to extend with " << correctCharacter << 
+            std::endl);
     }
     
-    Log::debug() << "Have " << nonemptyExtensions.size() << " ranges" <<
-        std::endl;
+    LOG_DEBUG("Have " << nonemptyExtensions.size() << " ranges" <<
+        std::endl);
     
     // Wrap the set up and move it out
     return FMDPositionGroup(std::move(nonemptyExtensions));
@@ -244,20 +252,14 @@ void FMDPositionGroup::dropMismatchesHere() {
     for(const auto& annotated : positions) {
         // For each existing FMDPosition
         
-        // Sum up the offsets between mismatches. If there is a mismatch at the
-        // most recent character, this will equal the search length.
-        size_t lastMismatchIndex = std::accumulate(
-            annotated.mismatchOffsets.begin(), annotated.mismatchOffsets.end(),
-            0);
-        
-        if(lastMismatchIndex == annotated.searchedCharacters) {
+        if(annotated.isMismatchHere()) {
             // There's a mismatch at the most recent character. Drop this range.
-            Log::debug() << "Dropping " << annotated.position << 
-                " due to mismatch" << std::endl;
+            LOG_DEBUG("Dropping " << annotated.position << 
+                " due to mismatch" << std::endl);
         } else {
             // Keep the range
-            Log::debug() << "Keeping " << annotated.position << std::endl;
-            matchHere.insert(annotated);
+            LOG_DEBUG("Keeping " << annotated.position << std::endl);
+            matchHere.push_back(annotated);
         }
     }
     
@@ -283,11 +285,12 @@ void FMDPositionGroup::extendLeftOnly(const FMDIndexView& view,
         if(!toExtend.isEmpty(view)) {
             // If we got anything, keep the range (and don't increment the
             // mismatches)
-            nonemptyExtensions.emplace(toExtend, annotated, false);
+            nonemptyExtensions.emplace_back(toExtend, annotated, false);
         }
     }
     
     // Replace our FMDPositions with the new extended ones.
+    makeSet(nonemptyExtensions);
     positions = std::move(nonemptyExtensions);
     
 }
@@ -309,10 +312,11 @@ void FMDPositionGroup::retractRightOnly(const FMDIndexView& view,
         
         // Call the retraction constructor with the number of bases we
         // retracted to, and stick in this new retracted range.
-        retractions.emplace(toRetract, annotated, newLength);
+        retractions.emplace_back(toRetract, annotated, newLength);
     }
     
     // Replace our FMDPositions with the new extended ones.
+    makeSet(retractions);
     positions = std::move(retractions);
 }
 
@@ -333,7 +337,7 @@ FMDPositionGroup FMDPositionGroup::retract(const FMDIndexView& view,
         
         // Call the retraction constructor with the number of bases we
         // retracted to, and stick in this new retracted range.
-        retractions.emplace(toRetract, annotated, newLength);
+        retractions.emplace_back(toRetract, annotated, newLength);
     }
     
     // Replace our FMDPositions with the new extended ones.
@@ -376,12 +380,19 @@ size_t FMDPositionGroup::mismatchesUsed() const {
     for(const auto& annotated : positions) {
         // Look through all the FMDPositions and get the max number of
         // mismatches.
-        used = std::max(used, annotated.mismatches);
+        used = std::max(used, (size_t) annotated.mismatches);
     }
     
     return used;
 }
 
+void FMDPositionGroup::prefetch(const FMDIndexView& view) const {
+    for(const auto& annotated : positions) {
+        // Prefetch for each interval we contain
+        annotated.position.prefetch(view);
+    }
+}
+
 bool FMDPositionGroup::isEmpty(const FMDIndexView& view) const {
     for(const auto& annotated : positions) {
         // For each interval we contain
@@ -521,7 +532,7 @@ size_t FMDPositionGroup::getApproximateNumberOfNewRanges(
     // Index the parents
     std::map<size_t, FMDPosition> oldPositions;
     
-    for(auto parentAnnotated : old.positions) {
+    for(const auto& parentAnnotated : old.positions) {
         // For each position in the old group, pull it out.
         const auto& parent = parentAnnotated.position;
         
@@ -530,7 +541,7 @@ size_t FMDPositionGroup::getApproximateNumberOfNewRanges(
         oldPositions[parent.getForwardStart()] = parent;
     }
     
-    for(auto newAnnotated : positions) {
+    for(const auto& newAnnotated : positions) {
         // For each new position, find the old position that started at or after
         // this one's start.
         auto parentIterator = oldPositions.lower_bound(
@@ -554,28 +565,83 @@ size_t FMDPositionGroup::getApproximateNumberOfNewRanges(
 
 }
     
-std::set<TextPosition> FMDPositionGroup::getTextPositions(
+size_t FMDPositionGroup::countRangesUpTo(const FMDIndexView& view,
+    size_t limit) const {
+    
+    size_t total = 0;
+    
+    for(const auto& annotated : positions) {
+        // Count each interval with whatever is left of the limit.
+        total += annotated.position.countRangesUpTo(view, limit - total);
+        
+        if(total > limit) {
+            // We already know there are too many.
+            return total;
+        }
+    }
+    
+    return total;
+}
+
+size_t FMDPositionGroup::countNewRangesUpTo(const FMDIndexView& view,
+    const FMDPositionGroup& old, size_t limit) const {
+    
+    // Sort the old intervals by start, so we can find the parent starting at
+    // or after the start of each widened interval.
+    std::vector<std::pair<size_t, const FMDPosition*>> oldPositions;
+    for(const auto& parentAnnotated : old.positions) {
+        oldPositions.emplace_back(parentAnnotated.position.getForwardStart(),
+            &parentAnnotated.position);
+    }
+    std::sort(oldPositions.begin(), oldPositions.end());
+    
+    size_t total = 0;
+    
+    for(const auto& newAnnotated : positions) {
+        auto parent = std::lower_bound(oldPositions.begin(),
+            oldPositions.end(), std::make_pair(
+            (size_t) newAnnotated.position.getForwardStart(),
+            (const FMDPosition*) nullptr));
+            
+        if(parent == oldPositions.end()) {
+            // Complain if we can't find where a range came from.
+            throw std::runtime_error(
+                "Could not find parent for expanded interval");
+        }
+        
+        // Count what's new relative to the parent, with whatever is left of
+        // the limit.
+        total += newAnnotated.position.countNewRangesUpTo(view,
+            *parent->second, limit - total);
+        
+        if(total > limit) {
+            // We already know there are too many.
+            return total;
+        }
+    }
+    
+    return total;
+}
+    
+TextPositionSet FMDPositionGroup::getTextPositions(
     const FMDIndexView& view) const {
 
     // Just loop over all the positions in the group and collect in here.
-    std::set<TextPosition> toReturn;
+    TextPositionSet toReturn;
     
     for(const auto& annotated : positions) {
         // Grab the resulkts from everything in the group.
-        std::set<TextPosition> found = annotated.position.getTextPositions(
+        TextPositionSet found = annotated.position.getTextPositions(
             view);
             
-        // And stick them in the set. See
-        // <http://bytes.com/topic/c/answers/718481-better-prettier-way-copy-
-        // one-set-another> if you are like me and don't know how to STL at all.
-        std::copy(found.begin(), found.end(), std::inserter(toReturn,
-            toReturn.begin()));
+        // And stick them in the set.
+        toReturn.insert(found.begin(), found.end());
     }
     
     return toReturn;
 }
 
-std::set<TextPosition> FMDPositionGroup::getNewTextPositions(
+TextPositionSet FMDPositionGroup::getNewTextPositions(
     const FMDIndexView& view, const FMDPositionGroup& old) const {
     
     // We know intervals won't overlap in either group.
@@ -584,12 +650,12 @@ std::set<TextPosition> FMDPositionGroup::getNewTextPositions(
     // widened interval, using map::lowert_bound.
     
     // Just loop over all the positions in the group and collect in here.
-    std::set<TextPosition> toReturn;
+    TextPositionSet toReturn;
 
     // Index the parents
     std::map<size_t, FMDPosition> oldPositions;
     
-    for(auto parentAnnotated : old.positions) {
+    for(const auto& parentAnnotated : old.positions) {
         // For each position in the old group, pull it out.
         const auto& parent = parentAnnotated.position;
         
@@ -598,7 +664,7 @@ std::set<TextPosition> FMDPositionGroup::getNewTextPositions(
         oldPositions[parent.getForwardStart()] = parent;
     }
     
-    for(auto newAnnotated : positions) {
+    for(const auto& newAnnotated : positions) {
         // For each new position, find the old position that started at or after
         // this one's start.
         auto parentIterator = oldPositions.lower_bound(
@@ -613,21 +679,58 @@ std::set<TextPosition> FMDPositionGroup::getNewTextPositions(
         // Go work what new ranges this expanded range has on top of
         // this parent. TODO: there may be some inaccuracy if it had multiple
         // parents. Handle that case and provide a tighter estimate.
-        std::set<TextPosition> found = 
+        TextPositionSet found = 
             newAnnotated.position.getNewTextPositions(view,
                 (*parentIterator).second);
             
-        // And stick them in the set. See
-        // <http://bytes.com/topic/c/answers/718481-better-prettier-way-copy-
-        // one-set-another> if you are like me and don't know how to STL at all.
-        std::copy(found.begin(), found.end(), std::inserter(toReturn,
-            toReturn.begin()));
+        // And stick them in the set.
+        toReturn.insert(found.begin(), found.end());
     }
     
     return toReturn;
     
 }
 
+void FMDPositionGroup::appendTextPositions(const FMDIndexView& view,
+    std::vector<size_t>& ranges, std::vector<TextPosition>& out) const {
+    
+    for(const auto& annotated : positions) {
+        // Grab the results from everything in the group.
+        annotated.position.appendTextPositions(view, ranges, out);
+    }
+}
+
+void FMDPositionGroup::appendNewTextPositions(const FMDIndexView& view,
+    const FMDPositionGroup& old, std::vector<size_t>& ranges,
+    std::vector<TextPosition>& out) const {
+    
+    for(const auto& newAnnotated : positions) {
+        // For each new position, find the old position that starts soonest at
+        // or after this one's start, like getNewTextPositions() does. Groups
+        // are small, so just scan instead of building an index.
+        const FMDPosition* parent = nullptr;
+        for(const auto& oldAnnotated : old.positions) {
+            const FMDPosition& candidate = oldAnnotated.position;
+            if(candidate.getForwardStart() >=
+                newAnnotated.position.getForwardStart() &&
+                (parent == nullptr || candidate.getForwardStart() <
+                parent->getForwardStart())) {
+                
+                parent = &candidate;
+            }
+        }
+        
+        if(parent == nullptr) {
+            // Complain if we can't find where a range came from.
+            throw std::runtime_error(
+                "Could not find parent for expanded interval");
+        }
+        
+        newAnnotated.position.appendNewTextPositions(view, *parent, ranges,
+            out);
+    }
+}
+
 std::ostream& operator<< (std::ostream& o, FMDPositionGroup const& group) {
     if(group.positions.size() == 0) {
         return o << "<empty group>";
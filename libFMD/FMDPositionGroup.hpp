@@ -6,7 +6,8 @@
 #include "FMDIndexView.hpp"
 #include <vector>
 #include <set>
-#include <deque>
+#include <stdexcept>
+#include <cstdint>
 
 /**
  * Represents a collection of FMDPositions participating in some kind of
@@ -57,11 +58,15 @@ public:
      * takes the match, even if that would lead it down a path with, overall,
      * more mismatches.
      *
+     * If exactPossible is false, the caller already knows that extending with
+     * the correct character can't find anything (say, from a KmerFilter), and
+     * only the mismatching characters are tried.
+     *
      * Returns true if an exact match exists anywhere, and false if a mismatch
      * had to be used.
      */
     bool extendGreedy(const FMDIndexView& view, char correctCharacter,
-        size_t maxMismatches);
+        size_t maxMismatches, bool exactPossible = true);
         
     /**
      * Extend all FMDPositions left, using the given view. Explores all possible
@@ -114,6 +119,12 @@ public:
      */
     size_t mismatchesUsed() const;
     
+    /**
+     * Prefetch what the index needs to extend all the FMDPositions in the
+     * group, so that the memory reads can overlap with other work.
+     */
+    void prefetch(const FMDIndexView& view) const;
+
     /**
      * Is nothing selected under the given view?
      */
@@ -149,11 +160,27 @@ public:
      */
     size_t getApproximateNumberOfNewRanges(const FMDIndexView& view,
         const FMDPositionGroup& old);
+    
+    /**
+     * Count the ranges selected under the given view, summed over the
+     * intervals in the group, stopping at limit + 1 as soon as there are more
+     * than limit.
+     */
+    size_t countRangesUpTo(const FMDIndexView& view, size_t limit) const;
+    
+    /**
+     * Count the new ranges selected under the given view, relative to the
+     * given old FMDPositionGroup, like countRangesUpTo().
+     *
+     * Neither FMDPositionGroup may contain overlapping intervals.
+     */
+    size_t countNewRangesUpTo(const FMDIndexView& view,
+        const FMDPositionGroup& old, size_t limit) const;
         
     /**
      * Get the TextPositions selected under the given view.
      */
-    std::set<TextPosition> getTextPositions(const FMDIndexView& view) const;
+    TextPositionSet getTextPositions(const FMDIndexView& view) const;
     
     /**
      * Get the new TextPositions selected under the given view, relative to the
@@ -162,9 +189,28 @@ public:
      *
      * Neither FMDPositionGroup may contain overlapping intervals.
      */
-    std::set<TextPosition> getNewTextPositions(const FMDIndexView& view,
+    TextPositionSet getNewTextPositions(const FMDIndexView& view,
         const FMDPositionGroup& old) const;
         
+    /**
+     * Append the TextPositions selected under the given view to the given
+     * vector, without sorting or de-duplicating, using the given range number
+     * vector as scratch space.
+     */
+    void appendTextPositions(const FMDIndexView& view,
+        std::vector<size_t>& ranges, std::vector<TextPosition>& out) const;
+        
+    /**
+     * Append the new TextPositions selected under the given view, relative to
+     * the given old FMDPositionGroup, to the given vector, without sorting or
+     * de-duplicating, using the given range number vector as scratch space.
+     *
+     * Neither FMDPositionGroup may contain overlapping intervals.
+     */
+    void appendNewTextPositions(const FMDIndexView& view,
+        const FMDPositionGroup& old, std::vector<size_t>& ranges,
+        std::vector<TextPosition>& out) const;
+        
     /**
      * Provide pretty-printing for FMDPositionGroups. See
      * <http://www.parashift.com/c++-faq/output-operator.html>
@@ -175,7 +221,15 @@ public:
 protected:
 
     /**
-     * Keep track of an FMDPosition with its mismatch information.
+     * How many mismatches can any one FMDPosition in a group carry? Extending
+     * with a higher mismatch limit than this is an error.
+     */
+    static const size_t MAX_MISMATCHES = 16;
+
+    /**
+     * Keep track of an FMDPosition with its mismatch information. Holds
+     * everything inline, so groups can keep these in a flat vector and copy
+     * them around without allocating.
      */
     struct AnnotatedFMDPosition {
         /**
@@ -184,29 +238,45 @@ protected:
         FMDPosition position;
         
         /**
-         * How many mismatches were used searching it?
-         * TODO: Redundant with mismatch offset queue length.
+         * How many mismatches were used searching it? This is also how many
+         * entries in the mismatch ring buffer are in use.
          */
-        size_t mismatches;
+        uint32_t mismatches;
         
         /**
          * How many characters are searched (extended and not retracted)?
          */
-        size_t searchedCharacters;
+        uint32_t searchedCharacters;
+        
+        /**
+         * How many characters have ever been extended with, including those
+         * since retracted? Numbers the characters, so the first character
+         * extended with is 1 and the most recent is extendedCharacters.
+         */
+        uint32_t extendedCharacters;
         
         /**
-         * Stores first the distance from the retractable (right) end of the
-         * searched string to the first mismatch, followed by the distance from
-         * that mismatch to the next, and so on.
+         * Where in the ring buffer is the oldest (rightmost) mismatch that
+         * hasn't been retracted away?
          */
-        std::deque<size_t> mismatchOffsets;
+        uint32_t mismatchHead;
+        
+        /**
+         * Ring buffer of the numbers (as in extendedCharacters) of the
+         * characters that were mismatches, from right to left. The rightmost
+         * ones are dropped first on retraction.
+         *
+         * These counters are all 32 bits, so that the ring buffer doesn't
+         * dominate the size of each of the many positions a group holds.
+         */
+        uint32_t mismatchAt[MAX_MISMATCHES];
         
         /**
          * Constructor to wrap up an FMDPosition.
          */
         inline AnnotatedFMDPosition(const FMDPosition& position):
             position(position), mismatches(0), searchedCharacters(0),
-            mismatchOffsets() {
+            extendedCharacters(0), mismatchHead(0) {
             
             // Nothing to do!
         }
@@ -216,39 +286,30 @@ protected:
          */
         inline AnnotatedFMDPosition(const FMDPosition& position,
             const AnnotatedFMDPosition& parent,
-            bool isMismatch): position(position), 
-            mismatches(parent.mismatches + isMismatch), 
-            searchedCharacters(parent.searchedCharacters + 1), 
-            mismatchOffsets(parent.mismatchOffsets) {
+            bool isMismatch): AnnotatedFMDPosition(parent) {
+            
+            if(extendedCharacters == UINT32_MAX) {
+                throw std::runtime_error(
+                    "Too many characters for an FMDPositionGroup");
+            }
+            
+            this->position = position;
+            searchedCharacters++;
+            extendedCharacters++;
             
             if(isMismatch) {
                 // We added a mismatch at the left.
-                if(mismatchOffsets.size() > 0) { 
-                    // We come after a mismatch that's already there.
-                    
-                    // Where is it in the space of the search string? TODO: Make
-                    // this not do an O(n) scan every time we add a mismatch.
-                    // Maybe move back to the absolute-positions-and-offset
-                    // model?
-                    size_t lastMismatchIndex = std::accumulate(
-                        mismatchOffsets.begin(), mismatchOffsets.end(), 0);
-                    
-                    // After removing it, how many more characters would we need
-                    // to retract to remove this one?
-                    mismatchOffsets.push_back(searchedCharacters - 
-                        lastMismatchIndex);
-                        
-                    Log::trace() << "Inserting mismatch at offset " << 
-                        searchedCharacters - lastMismatchIndex << std::endl;
-                        
-                } else {
-                    // There are no mismatches before this new one. How many
-                    // characters would we have to retract to remove it?
-                    mismatchOffsets.push_back(searchedCharacters);
-                    
-                    Log::trace() << "Inserting first mismatch at offset " << 
-                        searchedCharacters << std::endl;
+                if(mismatches == MAX_MISMATCHES) {
+                    throw std::runtime_error(
+                        "Too many mismatches for an FMDPositionGroup");
                 }
+                
+                mismatchAt[(mismatchHead + mismatches) % MAX_MISMATCHES] =
+                    extendedCharacters;
+                mismatches++;
+                
+                LOG_TRACE("Inserting mismatch at character " << 
+                    extendedCharacters << std::endl);
             }
             
         }
@@ -258,71 +319,78 @@ protected:
          */
         inline AnnotatedFMDPosition(const FMDPosition& position,
             const AnnotatedFMDPosition& parent, size_t newLength): 
-            position(position), mismatches(parent.mismatches), 
-            searchedCharacters(newLength), 
-            mismatchOffsets(parent.mismatchOffsets) {
+            AnnotatedFMDPosition(parent) {
+            
+            this->position = position;
+            searchedCharacters = newLength;
             
-            // How many characters were retracted?
-            size_t droppedLength = parent.searchedCharacters -
-                searchedCharacters;
+            // Every character numbered this or lower has been retracted.
+            size_t lastDropped = extendedCharacters - searchedCharacters;
             
-            while(mismatches > 0 && droppedLength > 0) {
+            while(mismatches > 0 && mismatchAt[mismatchHead] <= lastDropped) {
             
-                Log::trace() << "Mismatches: " << mismatches <<
-                    ", droppedLength: " << droppedLength << 
-                    ", mismatchOffsets.front(): " << mismatchOffsets.front() <<
-                    std::endl;
+                LOG_TRACE("Dropping mismatch at character " <<
+                    mismatchAt[mismatchHead] << std::endl);
                     
-                if(mismatchOffsets.front() > droppedLength) {
-                    // If there were more than this many characters left to the
-                    // next mismatch, just charge for them.
-                    mismatchOffsets.front() -= droppedLength;
-                } else {
-                    // If there were fewer, delete that mismatch and then see if
-                    // we get the next one too.
-                    droppedLength -= mismatchOffsets.front();
-                    mismatchOffsets.pop_front();
-                    mismatches--;
-                }
+                // Drop the rightmost mismatch.
+                mismatchHead = (mismatchHead + 1) % MAX_MISMATCHES;
+                mismatches--;
             }
             
         }
         
         /**
-         * Equality comparison so this can go in a set.
+         * Is the most recently extended character a mismatch?
+         */
+        inline bool isMismatchHere() const {
+            return mismatches > 0 && searchedCharacters > 0 && mismatchAt[
+                (mismatchHead + mismatches - 1) % MAX_MISMATCHES] ==
+                extendedCharacters;
+        }
+        
+        /**
+         * Equality comparison for de-duplicating.
          */
         inline bool operator==(const AnnotatedFMDPosition& other) const {
             return position == other.position &&
                 mismatches == other.mismatches &&
                 searchedCharacters == other.searchedCharacters;
-            // We don't have to check the offset lists because they are
+            // We don't have to check the mismatch buffers because they are
             // determined by our other parameters, assuming we have a consistent
             // history for the group in terms of what was searched.
         }
         
         /**
-         * Order comparison so this can go in a set.
+         * Order comparison for sorting.
          */
         inline bool operator<(const AnnotatedFMDPosition& other) const {
             return position < other.position || 
                 (position == other.position && (mismatches < other.mismatches ||
                 (mismatches == other.mismatches && searchedCharacters <
                 other.searchedCharacters)));
-            // We don't have to check the offset lists because they are
+            // We don't have to check the mismatch buffers because they are
             // determined by our other parameters, assuming we have a consistent
             // history for the group in terms of what was searched.
         }
     };
 
     /**
-     * Create a new FMDPositionGroup from a set of annotated positions.
+     * Create a new FMDPositionGroup from a vector of annotated positions, which
+     * need not be sorted or de-duplicated.
+     */
+    FMDPositionGroup(std::vector<AnnotatedFMDPosition>&& startPositions);
+    
+    /**
+     * Sort and de-duplicate a vector of annotated positions in place, so it
+     * can be used as a group's positions.
      */
-    FMDPositionGroup(std::set<AnnotatedFMDPosition>&& startPositions);
+    static void makeSet(std::vector<AnnotatedFMDPosition>& positions);
 
     /**
-     * Holds all the FMDPositions and their mismatch counts.
+     * Holds all the FMDPositions and their mismatch counts, sorted and without
+     * duplicates.
      */
-    std::set<AnnotatedFMDPosition> positions;
+    std::vector<AnnotatedFMDPosition> positions;
 };
 
 #endif
@@ -0,0 +1,106 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "FlatBWT.hpp"
+#include "Log.hpp"
+
+FlatBWT::FlatBWT(const RLBWT& source): blocks(NULL), numBlocks(0),
+    superblocks(), predCount(), length(source.getBWLen()) {
+
+    // Always have a spare block at the end, for queries right at the end.
+    numBlocks = length / BLOCK_SIZE + 1;
+    
+    // Allocate the blocks on cache line boundaries, which std::vector won't do
+    // for us in C++11.
+    void* memory;
+    if(posix_memalign(&memory, sizeof(Block), numBlocks * sizeof(Block)) != 0) {
+        throw std::runtime_error("Could not allocate FlatBWT blocks");
+    }
+    blocks = (Block*) memory;
+    
+    // Fill the planes with all 1s, so the padding at the end has code 7 and
+    // never matches any real symbol.
+    memset(blocks, 0xFF, numBlocks * sizeof(Block));
+    
+    // Make space for the superblock counts
+    superblocks.resize(length / SUPERBLOCK_SIZE + 1);
+    
+    // Copy over the C array
+    for(size_t i = 0; i < ALPHABET_SIZE; i++) {
+        predCount.setByIdx(i, source.getPC(RANK_ALPHABET[i]));
+    }
+    
+    // Keep a running count of everything we have seen so far.
+    AlphaCount64 running;
+    
+    // And which symbol we are on.
+    size_t position = 0;
+    
+    for(size_t run = 0; run < source.getNumRuns(); run++) {
+        // Decode each run
+        const RLUnit& unit = source.getRun(run);
+        char symbol = unit.getChar();
+        uint8_t code = BWT_ALPHABET::getRank(symbol);
+        
+        for(size_t i = 0; i < unit.getCount(); i++, position++) {
+            // Store each symbol in the run
+            Block& block = blocks[position / BLOCK_SIZE];
+            size_t within = position % BLOCK_SIZE;
+            
+            if(within == 0) {
+                // We're starting a block.
+                
+                if(position % SUPERBLOCK_SIZE == 0) {
+                    // And a superblock.
+                    superblocks[position / SUPERBLOCK_SIZE] = running;
+                }
+                
+                // Save the counts relative to the superblock.
+                const AlphaCount64& super = 
+                    superblocks[position / SUPERBLOCK_SIZE];
+                for(size_t base = 1; base < ALPHABET_SIZE; base++) {
+                    block.counts[base - 1] = running.getByIdx(base) - 
+                        super.getByIdx(base);
+                }
+            }
+            
+            for(size_t plane = 0; plane < NUM_PLANES; plane++) {
+                // Set the bits for this symbol's code.
+                uint64_t mask = (uint64_t) 1 << (within % 64);
+                if((code >> plane) & 1) {
+                    block.planes[plane][within / 64] |= mask;
+                } else {
+                    block.planes[plane][within / 64] &= ~mask;
+                }
+            }
+            
+            running.increment(symbol);
+        }
+    }
+    
+    if(position != length) {
+        // The runs have to add up.
+        throw std::runtime_error("RLBWT runs don't cover the BWT");
+    }
+    
+    if(position % BLOCK_SIZE == 0) {
+        // The spare block never got started, so fill in its counts now.
+        if(position % SUPERBLOCK_SIZE == 0) {
+            superblocks[position / SUPERBLOCK_SIZE] = running;
+        }
+        const AlphaCount64& super = superblocks[position / SUPERBLOCK_SIZE];
+        for(size_t base = 1; base < ALPHABET_SIZE; base++) {
+            blocks[position / BLOCK_SIZE].counts[base - 1] = 
+                running.getByIdx(base) - super.getByIdx(base);
+        }
+    }
+    
+    Log::info() << "Built flat BWT of " << length << " symbols in " << 
+        numBlocks << " blocks" << std::endl;
+}
+
+FlatBWT::~FlatBWT() {
+    // Blocks came from posix_memalign, so they go back with free.
+    free(blocks);
+}
@@ -0,0 +1,246 @@
+#ifndef FLATBWT_HPP
+#define FLATBWT_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Depend on the libsuffixtools stuff.
+#include <Alphabet.h>
+#include <RLBWT.h>
+
+/**
+ * Defines a non-run-length-encoded BWT, for use instead of the RLBWT when the
+ * BWT isn't repetitive enough for run-length encoding to pay for itself.
+ *
+ * The BWT is cut into blocks of BLOCK_SIZE symbols. Each block is exactly one
+ * 64-byte cache line, holding the number of occurrences of each base before
+ * the block (relative to its superblock) and the block's symbols, stored as
+ * three bit planes of their 3-bit rank codes ('$' = 0, 'A' = 1, ... 'T' = 4).
+ * An occurrence query is then one cache miss (the superblock counts are tiny
+ * and stay in cache) and a few popcounts, instead of a decode of run-length
+ * units out from the nearest marker.
+ *
+ * Provides the subset of the RLBWT interface that FMDIndex uses. Takes 4 bits
+ * per symbol.
+ */
+class FlatBWT {
+
+public:
+    /**
+     * Make a new FlatBWT with the same contents as the given RLBWT. The RLBWT
+     * is not needed after the constructor returns.
+     */
+    FlatBWT(const RLBWT& source);
+
+    /**
+     * Get rid of a FlatBWT and its blocks.
+     */
+    ~FlatBWT();
+
+    /**
+     * Get the number of characters in the BWT that sort before the given one.
+     */
+    inline BaseCount getPC(char b) const {
+        return predCount.get(b);
+    }
+
+    /**
+     * Return the number of times each symbol in the alphabet appears in
+     * bwt[0, idx]. idx may be -1 (as a size_t), for an empty prefix.
+     */
+    inline AlphaCount64 getFullOcc(size_t idx) const {
+        // Work with an exclusive end, which turns -1 into 0.
+        size_t end = idx + 1;
+        const Block& block = blocks[end / BLOCK_SIZE];
+        const AlphaCount64& super = superblocks[end / SUPERBLOCK_SIZE];
+        size_t within = end % BLOCK_SIZE;
+
+        AlphaCount64 counts;
+        BaseCount total = 0;
+        for(uint8_t code = 1; code < ALPHABET_SIZE; code++) {
+            // Fill in the counts for the actual bases.
+            BaseCount count = super.getByIdx(code) + block.counts[code - 1] +
+                countInBlock(block, code, within);
+            counts.setByIdx(code, count);
+            total += count;
+        }
+
+        // Whatever is left over before the end must be '$'.
+        counts.setByIdx(0, end - total);
+        return counts;
+    }
+
+    /**
+     * Return the number of times the given character appears in bwt[0, idx].
+     * idx may be -1 (as a size_t), for an empty prefix.
+     */
+    inline BaseCount getOcc(char b, size_t idx) const {
+        size_t end = idx + 1;
+        uint8_t code = BWT_ALPHABET::getRank(b);
+
+        if(code == 0) {
+            // '$' is not counted explicitly, so count everything else.
+            return getFullOcc(idx).get(b);
+        }
+
+        const Block& block = blocks[end / BLOCK_SIZE];
+        return superblocks[end / SUPERBLOCK_SIZE].getByIdx(code) +
+            block.counts[code - 1] + countInBlock(block, code, end % BLOCK_SIZE);
+    }
+
+    /**
+     * Get the character at the given position in the BWT.
+     */
+    inline char getChar(size_t idx) const {
+        const Block& block = blocks[idx / BLOCK_SIZE];
+        size_t within = idx % BLOCK_SIZE;
+        size_t word = within / 64;
+        size_t bit = within % 64;
+
+        uint8_t code = 0;
+        for(size_t plane = 0; plane < NUM_PLANES; plane++) {
+            // Pull the bit out of each plane.
+            code |= ((block.planes[plane][word] >> bit) & 1) << plane;
+        }
+        return RANK_ALPHABET[code];
+    }
+
+    /**
+     * Get the first character of the suffix at the given BWT position.
+     */
+    inline char getF(size_t idx) const {
+        size_t ci = 0;
+        while(ci < ALPHABET_SIZE && predCount.getByIdx(ci) <= idx) {
+            ci++;
+        }
+        return RANK_ALPHABET[ci - 1];
+    }
+
+    /**
+     * Get the total length of the BWT.
+     */
+    inline size_t getBWLen() const {
+        return length;
+    }
+
+    /**
+     * Get the number of bytes the blocks and superblocks take up.
+     */
+    inline size_t getMemoryUsage() const {
+        return numBlocks * sizeof(Block) +
+            superblocks.capacity() * sizeof(AlphaCount64);
+    }
+
+    /**
+     * Prefetch the block that a getFullOcc(idx) or getOcc(b, idx) call would
+     * read.
+     */
+    inline void prefetchOcc(size_t idx) const {
+        __builtin_prefetch(&blocks[(idx + 1) / BLOCK_SIZE]);
+    }
+
+protected:
+
+    /**
+     * How many bit planes do we need to store a symbol code?
+     */
+    static const size_t NUM_PLANES = 3;
+
+    /**
+     * How many symbols go in a block?
+     */
+    static const size_t BLOCK_SIZE = 128;
+
+    /**
+     * How many symbols go in a superblock? Block counts are 32-bit and
+     * relative to the superblock, so this has to fit in 32 bits.
+     */
+    static const size_t SUPERBLOCK_SIZE = (size_t) 1 << 31;
+
+    /**
+     * A cache line's worth of BWT.
+     */
+    struct alignas(64) Block {
+        /**
+         * Occurrences of each base ('A' through 'T') before this block in its
+         * superblock.
+         */
+        uint32_t counts[DNA_ALPHABET_SIZE];
+
+        /**
+         * Bit planes for the codes of the symbols in the block. Bit i of plane
+         * p holds bit p of the code for symbol i.
+         */
+        uint64_t planes[NUM_PLANES][BLOCK_SIZE / 64];
+    };
+
+    /**
+     * Count the occurrences of the symbol with the given code among the first
+     * within symbols of the given block.
+     */
+    inline static size_t countInBlock(const Block& block, uint8_t code,
+        size_t within) {
+
+        size_t total = 0;
+        for(size_t word = 0; word < BLOCK_SIZE / 64 && within > word * 64;
+            word++) {
+
+            // Find the symbols in this word with the code we want.
+            uint64_t matches = ~(uint64_t) 0;
+            for(size_t plane = 0; plane < NUM_PLANES; plane++) {
+                uint64_t bits = block.planes[plane][word];
+                matches &= ((code >> plane) & 1) ? bits : ~bits;
+            }
+
+            // Only count the ones before the end.
+            size_t used = within - word * 64;
+            if(used < 64) {
+                matches &= ((uint64_t) 1 << used) - 1;
+            }
+            total += __builtin_popcountll(matches);
+        }
+        return total;
+    }
+
+    /**
+     * Holds the blocks, aligned to cache lines. There is always one more block
+     * than we need to hold the symbols, so that queries at the very end of the
+     * BWT have somewhere to look.
+     */
+    Block* blocks;
+
+    /**
+     * Holds the number of blocks we have.
+     */
+    size_t numBlocks;
+
+    /**
+     * Holds the counts of all the characters before each superblock.
+     */
+    std::vector<AlphaCount64> superblocks;
+
+    /**
+     * Holds the C(a) array.
+     */
+    AlphaCount64 predCount;
+
+    /**
+     * Holds the total number of symbols.
+     */
+    size_t length;
+
+private:
+    /**
+     * FlatBWTs cannot be copied.
+     */
+    FlatBWT(const FlatBWT& other) = delete;
+
+    /**
+     * FlatBWTs cannot be assigned.
+     */
+    FlatBWT& operator=(const FlatBWT& other) = delete;
+
+};
+
+#endif
@@ -1,13 +1,31 @@
 #include "GenericBitVector.hpp"
+#include "TaskPool.hpp"
 #include <stdexcept>
 #include <thread>
+#include <algorithm>
 
 #ifdef BITVECTOR_CSA
 GenericBitVector::GenericBitVector(std::ifstream& stream): encoder(NULL), 
-    bitvector(new BitVector(stream)), size(bitvector->getSize()), 
-    iterator(new BitVectorIterator(*bitvector)), iteratorMutex() {
+    bitvector(NULL), plain(NULL), size(0) {
     
-    // Nothing to do, loaded from the stream.
+    load(stream);
+}
+
+void GenericBitVector::load(std::ifstream& stream) {
+    // See if the bitvector was saved plain.
+    size_t tag;
+    stream.read((char*) &tag, sizeof(tag));
+    
+    if(stream && tag == PLAIN_TAG) {
+        plain = new PlainBitVector(stream);
+        size = plain->getSize();
+    } else {
+        // It's a CSA BitVector, and that was its size. Go back and load it.
+        stream.clear();
+        stream.seekg(-(std::streamoff) sizeof(tag), std::ios::cur);
+        bitvector = new BitVector(stream);
+        size = bitvector->getSize();
+    }
 }
 #endif
 
@@ -32,10 +50,9 @@ GenericBitVector::GenericBitVector(std::ifstream& stream): bitvector(),
 
 #ifdef BITVECTOR_CSA
 GenericBitVector::GenericBitVector(std::ifstream&& stream): encoder(NULL), 
-    bitvector(new BitVector(stream)), size(bitvector->getSize()), 
-    iterator(new BitVectorIterator(*bitvector)), iteratorMutex() {
+    bitvector(NULL), plain(NULL), size(0) {
     
-    // Nothing to do, loaded from the stream.
+    load(stream);
 }
 #endif
 
@@ -65,8 +82,7 @@ GenericBitVector::GenericBitVector(const std::string& filename):
 
 #ifdef BITVECTOR_CSA
 GenericBitVector::GenericBitVector(size_t sizeHint, size_t offsetHint): 
-    encoder(new BitVectorEncoder(32)), bitvector(NULL), size(0), iterator(NULL),
-    iteratorMutex() {
+    encoder(new BitVectorEncoder(32)), bitvector(NULL), plain(NULL), size(0) {
 
     // Nothing to do, already made the encoder.
     // TODO: actually use the size and offset hints.
@@ -82,6 +98,33 @@ GenericBitVector::GenericBitVector(size_t sizeHint, size_t offsetHint):
 }
 #endif
 
+#ifdef BITVECTOR_CSA
+GenericBitVector::GenericBitVector(const GenericBitVector& other): 
+    encoder(NULL), bitvector(NULL), plain(NULL), size(other.size) {
+    
+    if(other.plain != NULL) {
+        // Copy the words.
+        plain = new PlainBitVector(*other.plain);
+    } else {
+        // The union of just one vector copies its runs.
+        bitvector = BitVector::createUnion(
+            std::vector<const BitVector*>{other.bitvector});
+    }
+}
+#endif
+
+#ifdef BITVECTOR_SDSL
+GenericBitVector::GenericBitVector(const GenericBitVector& other):
+    bitvector(other.bitvector), offset(other.offset), rankSupport(NULL),
+    selectSupport(NULL) {
+    
+    // We copied the bits a word at a time. Make the supports for rank and
+    // select on our copy.
+    rankSupport = new sdsl::rank_support_v5<>(&(bitvector));
+    selectSupport = new sdsl::select_support_mcl<>(&(bitvector));
+}
+#endif
+
 #ifdef BITVECTOR_CSA
 GenericBitVector::~GenericBitVector() {
     // We own all our fields, and we can't be assigned or anything silly. Clean
@@ -95,8 +138,8 @@ GenericBitVector::~GenericBitVector() {
         delete bitvector;
     }
     
-    if(iterator != NULL) {
-        delete iterator;
+    if(plain != NULL) {
+        delete plain;
     }
 }
 #endif
@@ -126,11 +169,39 @@ void GenericBitVector::finish(size_t length) {
     encoder->flush();
     // Make the BitVector
     bitvector = new BitVector(*encoder, length);
-    // And an iterator for it
-    iterator = new BitVectorIterator(*bitvector);
     
     // Set our size
-    size = length;    
+    size = length;
+    
+    // Store it plain instead if it's dense.
+    chooseEncoding();
+}
+
+void GenericBitVector::chooseEncoding() {
+    if(PlainBitVector::estimateMemoryUsage(size,
+        bitvector->getNumberOfItems()) <= bitvector->reportSize()) {
+        
+        plain = new PlainBitVector(*bitvector);
+        delete bitvector;
+        bitvector = NULL;
+    }
+}
+
+std::vector<const BitVector*> GenericBitVector::getBitVectors(
+    const std::vector<const GenericBitVector*>& vectors,
+    std::vector<std::unique_ptr<BitVector>>& converted) {
+    
+    std::vector<const BitVector*> bitvectors;
+    for(const GenericBitVector* vector : vectors) {
+        if(vector->plain != NULL) {
+            // Run-length encode it for the set operation.
+            converted.emplace_back(vector->plain->toBitVector());
+            bitvectors.push_back(converted.back().get());
+        } else {
+            bitvectors.push_back(vector->bitvector);
+        }
+    }
+    return bitvectors;
 }
 #endif
 
@@ -162,7 +233,14 @@ void GenericBitVector::finish(size_t length) {
 
 #ifdef BITVECTOR_CSA
 void GenericBitVector::writeTo(std::ofstream& stream) const {
-    bitvector->writeTo(stream);
+    if(plain != NULL) {
+        // Tag it so we know to load it plain.
+        size_t tag = PLAIN_TAG;
+        stream.write((char*) &tag, sizeof(tag));
+        plain->writeTo(stream);
+    } else {
+        bitvector->writeTo(stream);
+    }
 }
 #endif
 
@@ -178,82 +256,254 @@ void GenericBitVector::writeTo(std::ofstream& stream) const {
 }
 #endif
 
+#ifdef BITVECTOR_CSA
+size_t GenericBitVector::getMemoryUsage() const {
+    return sizeof(*this) + (bitvector != NULL ? bitvector->reportSize() : 0) +
+        (plain != NULL ? plain->getMemoryUsage() : 0);
+}
+#endif
+
+#ifdef BITVECTOR_SDSL
+size_t GenericBitVector::getMemoryUsage() const {
+    size_t bytes = sizeof(*this) + sdsl::size_in_bytes(bitvector);
+    if(rankSupport != NULL) {
+        bytes += sdsl::size_in_bytes(*rankSupport);
+    }
+    if(selectSupport != NULL) {
+        bytes += sdsl::size_in_bytes(*selectSupport);
+    }
+    return bytes;
+}
+#endif
+
 #ifdef BITVECTOR_CSA
 GenericBitVector* GenericBitVector::createUnion(
     const GenericBitVector& other) const {
+    
+    return createUnionOf(std::vector<const GenericBitVector*>{this, &other});
+}
+
+GenericBitVector* GenericBitVector::createIntersection(
+    const GenericBitVector& other) const {
 
     // We need to hack a BitVector into a GenericBitVector.
     
-    // Make one to populate.
+    // Make one to populate. It comes with an encoder we don't need.
     GenericBitVector* toReturn = new GenericBitVector();
+    delete toReturn->encoder;
+    toReturn->encoder = NULL;
+    
+    try {
+        // Intersect the runs
+        std::vector<std::unique_ptr<BitVector>> converted;
+        auto bitvectors = getBitVectors({this, &other}, converted);
+        toReturn->bitvector = bitvectors[0]->createIntersection(
+            *(bitvectors[1]));
+    } catch(...) {
+        delete toReturn;
+        throw;
+    }
+    // Populate the size
+    toReturn->size = toReturn->bitvector->getSize();
+    // And store it plain if it's dense.
+    toReturn->chooseEncoding();
     
-    // make the bitvector to put in
-    BitVector* unionBitvector = bitvector->createUnion(*(other.bitvector));
+    // Return the new GenericBitVector holding the BitVector we made.
+    return toReturn;
+}
+
+GenericBitVector* GenericBitVector::createUnionOf(
+    const std::vector<const GenericBitVector*>& vectors) {
     
-    // Put it in
-    toReturn->bitvector = unionBitvector;
+    if(vectors.empty()) {
+        throw std::runtime_error("Can't take the union of no bitvectors!");
+    }
+    
+    // Pull out all the underlying BitVectors.
+    std::vector<std::unique_ptr<BitVector>> converted;
+    auto bitvectors = getBitVectors(vectors, converted);
+    
+    // Make a GenericBitVector to populate. It comes with an encoder we don't
+    // need.
+    GenericBitVector* toReturn = new GenericBitVector();
+    delete toReturn->encoder;
+    toReturn->encoder = NULL;
+    
+    // Merge the runs of all the vectors at once.
+    toReturn->bitvector = BitVector::createUnion(bitvectors);
     // Populate the size
-    toReturn->size = unionBitvector->getSize();
-    // And fill in the iterator
-    toReturn->iterator = new BitVectorIterator(*unionBitvector);
+    toReturn->size = toReturn->bitvector->getSize();
+    // And store it plain if it's dense.
+    toReturn->chooseEncoding();
     
     // Return the new GenericBitVector holding the BitVector we made.
     return toReturn;
-    
 }
 #endif
 
 #ifdef BITVECTOR_SDSL
 GenericBitVector* GenericBitVector::createUnion(
     const GenericBitVector& other) const {
+    
+    return createUnionOf(std::vector<const GenericBitVector*>{this, &other});
+}
+
+GenericBitVector* GenericBitVector::createIntersection(
+    const GenericBitVector& other) const {
 
-    if(getSize() > other.getSize()) {
-        // Make sure we are the shorter bitvector.
-        return other.createUnion(*this);
+    // Only bits past both offsets can be set in both.
+    size_t start = std::max(offset, other.offset);
+    size_t end = std::max(getSize(), other.getSize());
+
+    GenericBitVector* toReturn = new GenericBitVector(end, start);
+    
+    for(size_t i = start; i < end; i += 64) {
+        // AND a word at a time.
+        size_t width = std::min((size_t) 64, end - i);
+        toReturn->bitvector.set_int(i - start,
+            getWord(i, width) & other.getWord(i, width), width);
     }
+    
+    // Make the supports for rank and select
+    toReturn->rankSupport = new sdsl::rank_support_v5<>(
+        &(toReturn->bitvector));
+    toReturn->selectSupport = new sdsl::select_support_mcl<>(
+        &(toReturn->bitvector));
+    return toReturn;
+}
 
-    // We need to hack a BitVector into a GenericBitVector.
+GenericBitVector* GenericBitVector::createUnionOf(
+    const std::vector<const GenericBitVector*>& vectors) {
     
-    // Make one to populate.
-    GenericBitVector* toReturn = new GenericBitVector();
+    if(vectors.empty()) {
+        throw std::runtime_error("Can't take the union of no bitvectors!");
+    }
     
-    for(size_t i = 0; i < getSize(); i++) {
-        // OR all the bits we both have
-        if(isSet(i) || other.isSet(i)) {
-            toReturn->addBit(i);
-        }
+    // Keep the smallest offset and the longest length.
+    size_t start = vectors[0]->offset;
+    size_t end = 0;
+    for(const GenericBitVector* vector : vectors) {
+        start = std::min(start, vector->offset);
+        end = std::max(end, vector->getSize());
     }
+
+    GenericBitVector* toReturn = new GenericBitVector(end, start);
     
-    for(size_t i = getSize(); i < other.getSize(); i++) {
-        // And add in extra bits that only the other has.
-        if(other.isSet(i)) {
-            toReturn->addBit(i);
+    for(size_t i = start; i < end; i += 64) {
+        // OR a word at a time across all the inputs.
+        size_t width = std::min((size_t) 64, end - i);
+        uint64_t word = 0;
+        for(const GenericBitVector* vector : vectors) {
+            word |= vector->getWord(i, width);
         }
+        toReturn->bitvector.set_int(i - start, word, width);
     }
-
-    // Finish it to the longer length.
-    toReturn->finish(other.getSize());
     
-    // Return the new GenericBitVector we made.
+    // Make the supports for rank and select
+    toReturn->rankSupport = new sdsl::rank_support_v5<>(
+        &(toReturn->bitvector));
+    toReturn->selectSupport = new sdsl::select_support_mcl<>(
+        &(toReturn->bitvector));
     return toReturn;
-    
 }
 #endif
 
+/**
+ * Below how many indices per thread isn't it worth building a bitvector in
+ * parallel?
+ */
+static const size_t MIN_PARALLEL_INDICES = 1 << 16;
+
+/**
+ * Work out which indices each of the given number of pieces of a bitvector of
+ * the given length should hold, splitting it into equal stretches on 64-bit
+ * word boundaries so no two pieces touch the same word. Gives back the
+ * positions in the indices where each piece starts, plus the end.
+ */
+static std::vector<size_t> splitSorted(const std::vector<size_t>& indices,
+    size_t length, size_t pieces) {
+    
+    std::vector<size_t> bounds;
+    size_t words = (length + 63) / 64;
+    for(size_t piece = 0; piece < pieces; piece++) {
+        size_t start = words * piece / pieces * 64;
+        bounds.push_back(std::lower_bound(indices.begin(), indices.end(),
+            start) - indices.begin());
+    }
+    bounds.push_back(indices.size());
+    return bounds;
+}
 
+#ifdef BITVECTOR_CSA
+GenericBitVector* GenericBitVector::fromSortedParallel(
+    const std::vector<size_t>& indices, size_t length, size_t threads) {
+    
+    threads = std::min(threads, indices.size() / MIN_PARALLEL_INDICES);
+    if(threads <= 1) {
+        // Not worth it.
+        return fromSorted(indices.begin(), indices.end(), length);
+    }
+    
+    // Encode each piece on its own, as a whole-length BitVector.
+    std::vector<size_t> bounds = splitSorted(indices, length, threads);
+    std::vector<std::unique_ptr<BitVector>> pieces(threads);
+    parallelFor(threads, [&](size_t piece) {
+        if(bounds[piece] == bounds[piece + 1]) {
+            // CSA can't encode an empty piece, but we don't need it anyway.
+            return;
+        }
+        
+        GenericBitVector encoded;
+        encoded.addSorted(indices.begin() + bounds[piece],
+            indices.begin() + bounds[piece + 1]);
+        encoded.encoder->flush();
+        pieces[piece].reset(new BitVector(*encoded.encoder, length));
+    });
+    
+    std::vector<const BitVector*> bitvectors;
+    for(const auto& piece : pieces) {
+        if(piece) {
+            bitvectors.push_back(piece.get());
+        }
+    }
+    
+    // Make a GenericBitVector to populate. It comes with an encoder we don't
+    // need.
+    GenericBitVector* toReturn = new GenericBitVector();
+    delete toReturn->encoder;
+    toReturn->encoder = NULL;
+    
+    // Merging the runs stitches the pieces together, joining up runs that
+    // were split between them.
+    toReturn->bitvector = BitVector::createUnion(bitvectors);
+    toReturn->size = length;
+    // And store it plain if it's dense.
+    toReturn->chooseEncoding();
+    return toReturn;
+}
+#endif
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+#ifdef BITVECTOR_SDSL
+GenericBitVector* GenericBitVector::fromSortedParallel(
+    const std::vector<size_t>& indices, size_t length, size_t threads) {
+    
+    threads = std::min(threads, indices.size() / MIN_PARALLEL_INDICES);
+    if(threads <= 1) {
+        // Not worth it.
+        return fromSorted(indices.begin(), indices.end(), length);
+    }
+    
+    // Make the whole vector of 0s, and then have each thread set the words in
+    // its own stretch of it.
+    GenericBitVector* toReturn = new GenericBitVector(length);
+    std::vector<size_t> bounds = splitSorted(indices, length, threads);
+    parallelFor(threads, [&](size_t piece) {
+        toReturn->addSorted(indices.begin() + bounds[piece],
+            indices.begin() + bounds[piece + 1]);
+    });
+    
+    // Then make the rank and select supports over all of it.
+    toReturn->finish(length);
+    return toReturn;
+}
+#endif
@@ -6,12 +6,17 @@
 #include <istream>
 #include <ostream>
 #include <utility>
-#include <mutex>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 
 #define BITVECTOR_CSA
 #ifdef BITVECTOR_CSA
-    // Using CSA bitvectors
+    // Using CSA bitvectors, or plain ones when they are dense
     #include "BitVector.hpp"
+    #include "PlainBitVector.hpp"
 #endif
 #ifdef BITVECTOR_SDSL
     // Using SDSL bitvectors
@@ -22,9 +27,19 @@
  * Represents a bit vector that bastracts out its underlying implementation in
  * favor of a simple interface. Right now we're going to define it over RLCSA.
  *
+ * On CSA, each bit vector picks its encoding when it is finished. Sparse ones
+ * stay delta-coded, but ones where an uncompressed PlainBitVector would take
+ * up no more space are stored that way instead, since it is faster to query.
+ * Saved plain bit vectors start with PLAIN_TAG, which can't be the start of a
+ * saved CSA BitVector.
+ *
  * Needs to support O(1) rank and select with a small constant factor.
  *
- * Needs to support multi-threaded rank/select access.
+ * Needs to support multi-threaded rank/select access. On CSA, every query
+ * makes its own short-lived iterator on the stack rather than sharing one
+ * behind a lock, so concurrent readers never contend. A CSA iterator is just
+ * a few words pointing into the shared, read-only bit vector, and each random
+ * query re-seeks from a sample anyway, so nothing is lost by not keeping one.
  */
 class GenericBitVector {
 public:
@@ -56,26 +71,13 @@ public:
     GenericBitVector(size_t sizeHint = 0, size_t offsetHint = 0);
     
     /**
-     * Create a bitvector by scanning the other one and marking all its 1
-     * postions. O(n) in the number of bits.
+     * Create a bitvector holding the same bits as the other one. Copies runs
+     * of 1s (or whole words, on SDSL) rather than scanning bit by bit.
      *
      * Note that the source GenericBitVector must have had finish() called on
      * it.
      */
-    inline explicit GenericBitVector(const GenericBitVector& other):
-        GenericBitVector() {
-        
-        for(size_t i = 0; i < other.getSize(); i++) {
-            // Check each bit of the source
-            if(other.isSet(i)) {
-                // And add the 1s in ourselves.
-                addBit(i);
-            }
-        }
-        
-        // Finish ourselves to the correct size.
-        finish(other.getSize());
-    }
+    explicit GenericBitVector(const GenericBitVector& other);
     
     /**
      * Destroy a generic bitvector.
@@ -140,16 +142,29 @@ public:
     }
     #endif
     
+    /**
+     * Add 1 bits at all the indices from begin to end, which must be sorted,
+     * with no duplicates, and after any bits already added. Adds runs of 1s at
+     * once on CSA, and whole words at once on SDSL. Cannot be run on a
+     * bitvector that has been loaded or finished.
+     */
+    template<typename Iterator>
+    void addSorted(Iterator begin, Iterator end);
+    
     /**
      * Returns true if the given index is set, or false otherwise. Must be
      * thread-safe.
      */
     #ifdef BITVECTOR_CSA
     inline bool isSet(size_t index) const {
-        // Grab the iterator
-        std::lock_guard<std::mutex> lock(iteratorMutex);
+        if(plain != NULL) {
+            return plain->isSet(index);
+        }
         
-        return iterator->isSet(index);
+        // Make our own iterator
+        BitVectorIterator iterator(*bitvector);
+        
+        return iterator.isSet(index);
     }
     #endif
     #ifdef BITVECTOR_SDSL
@@ -170,24 +185,66 @@ public:
      */
     void finish(size_t length);
     
+    /**
+     * Make a finished bitvector of the given length with 1 bits at all the
+     * indices from begin to end, which must be sorted and have no duplicates.
+     * The caller owns the result.
+     */
+    template<typename Iterator>
+    static GenericBitVector* fromSorted(Iterator begin, Iterator end,
+        size_t length);
+    
+    /**
+     * Make a finished bitvector of the given length with 1 bits at all the
+     * given sorted, unique indices, building disjoint pieces of it on the
+     * given number of threads and then stitching them together. The caller
+     * owns the result.
+     */
+    static GenericBitVector* fromSortedParallel(
+        const std::vector<size_t>& indices, size_t length, size_t threads);
+    
     /**
      * Save the BitVector to the given stream. It hust have already been
      * finished.
      */
     void writeTo(std::ofstream& stream) const;
     
+    /**
+     * Get the number of bytes the bitvector and its supports take up. Must
+     * have been finished first.
+     */
+    size_t getMemoryUsage() const;
+    
+    /**
+     * Returns true if the bitvector is stored uncompressed. Must have been
+     * finished first.
+     */
+    #ifdef BITVECTOR_CSA
+    inline bool isPlain() const {
+        return plain != NULL;
+    }
+    #endif
+    #ifdef BITVECTOR_SDSL
+    inline bool isPlain() const {
+        return true;
+    }
+    #endif
+    
     /**
      * Get the number of 1s occurring before the given index. Must be thread-
      * safe.
      */
     #ifdef BITVECTOR_CSA
     inline size_t rank(size_t index) const {
+        if(plain != NULL) {
+            return plain->rank(index);
+        }
 
-        // Grab the iterator
-        std::lock_guard<std::mutex> lock(iteratorMutex);
+        // Make our own iterator
+        BitVectorIterator iterator(*bitvector);
         
         // Take the rank of a position (not in at_least mode)
-        return iterator->rank(index, false);
+        return iterator.rank(index, false);
     }
     #endif
     #ifdef BITVECTOR_SDSL
@@ -232,11 +289,15 @@ public:
      */
     #ifdef BITVECTOR_CSA
     inline size_t select(size_t one) const {
-        // Grab the iterator
-        std::lock_guard<std::mutex> lock(iteratorMutex);
+        if(plain != NULL) {
+            return plain->select(one);
+        }
+        
+        // Make our own iterator
+        BitVectorIterator iterator(*bitvector);
         
         // Go select the right position.
-        return iterator->select(one);
+        return iterator.select(one);
     }
     #endif
 
@@ -253,6 +314,21 @@ public:
      */
     GenericBitVector* createUnion(const GenericBitVector& other) const;
     
+    /**
+     * AND two bitvectors together. On CSA, the two must have at least one 1 in
+     * common, since an empty CSA bitvector can't be represented.
+     */
+    GenericBitVector* createIntersection(const GenericBitVector& other) const;
+    
+    /**
+     * OR any number of bitvectors together, making the result only once. Takes
+     * time proportional to the total number of runs of 1s on CSA, or words on
+     * SDSL, rather than the number of bits. The result is as long as the
+     * longest input. There must be at least one input.
+     */
+    static GenericBitVector* createUnionOf(
+        const std::vector<const GenericBitVector*>& vectors);
+    
     /**
      * Given an index, return the index of the last 1 at or before that
      * position, paired with its rank. Wraps around if no such value is found.
@@ -334,11 +410,34 @@ public:
     }
     #endif
     
+    #ifdef BITVECTOR_CSA
+    // Move construction OK, but we have to take ownership of the other
+    // vector's encoder and bitvector.
+    inline GenericBitVector(GenericBitVector&& other): encoder(other.encoder),
+        bitvector(other.bitvector), plain(other.plain), size(other.size) {
+        
+        other.encoder = NULL;
+        other.bitvector = NULL;
+        other.plain = NULL;
+        other.size = 0;
+    }
+    
+    // Move assignment OK too.
+    inline GenericBitVector& operator=(GenericBitVector&& other) {
+        std::swap(encoder, other.encoder);
+        std::swap(bitvector, other.bitvector);
+        std::swap(plain, other.plain);
+        std::swap(size, other.size);
+        return *this;
+    }
+    #endif
+    #ifdef BITVECTOR_SDSL
     // Move construction OK
     GenericBitVector(GenericBitVector&& other) = default;
     
     // Move assignment OK
     GenericBitVector& operator=(GenericBitVector&& other) = default; 
+    #endif
     
 private:
     
@@ -351,12 +450,37 @@ private:
         BitVectorEncoder* encoder;
         // And we need a place to put the vector when done.
         BitVector* bitvector;
+        // Or, if it turned out to be dense, the uncompressed version instead.
+        PlainBitVector* plain;
         // And we need to remember how far along we are in our encoding.
         size_t size;
-        // And we need an iterator to query the BitVector when done.
-        BitVectorIterator* iterator;
-        // And a lock to protect that
-        mutable std::mutex iteratorMutex;
+        // Queries make their own iterators over the bitvector, so there's no
+        // shared iterator state to lock.
+        
+        /**
+         * What do saved plain bitvectors start with? CSA BitVectors start with
+         * their size, which can't be this big.
+         */
+        static const size_t PLAIN_TAG = (size_t) -1;
+        
+        /**
+         * Load a bitvector in either encoding from the given stream.
+         */
+        void load(std::ifstream& stream);
+        
+        /**
+         * Switch from the delta-coded bitvector we have to a plain one, if the
+         * plain one would be no bigger.
+         */
+        void chooseEncoding();
+        
+        /**
+         * Get CSA BitVectors for all the given GenericBitVectors, converting
+         * any plain ones into new BitVectors kept in the given vector.
+         */
+        static std::vector<const BitVector*> getBitVectors(
+            const std::vector<const GenericBitVector*>& vectors,
+            std::vector<std::unique_ptr<BitVector>>& converted);
     #endif
     #ifdef BITVECTOR_SDSL
         // Actual implementation on SDSL.
@@ -374,10 +498,120 @@ private:
         sdsl::rank_support_v5<>* rankSupport;
         // And select
         sdsl::select_support_mcl<>* selectSupport;        
+        
+        /**
+         * Get the given number of bits (at most 64) starting at the given
+         * index, as a word with the first bit lowest. Bits in the leading 0s
+         * or past the end come out as 0.
+         */
+        inline uint64_t getWord(size_t index, size_t width) const {
+            size_t low = std::max(index, offset);
+            size_t high = std::min(index + width, offset + bitvector.size());
+            if(low >= high) {
+                return 0;
+            }
+            return bitvector.get_int(low - offset, high - low) << (low - index);
+        }
+        
+        /**
+         * OR the given word into the bits starting at the given word-aligned
+         * index past the offset, growing the bitvector with 0s to hold the
+         * bit at last (also past the offset) if needed.
+         */
+        inline void orWord(size_t start, uint64_t word, size_t last) {
+            size_t oldSize = bitvector.size();
+            if(last >= oldSize) {
+                bitvector.resize(last + 1);
+                for(size_t i = oldSize; i <= last; i += 64 - i % 64) {
+                    // Make sure all the bits we just added in are 0s.
+                    bitvector.set_int(i, 0, std::min(64 - i % 64,
+                        last + 1 - i));
+                }
+            }
+            size_t width = std::min((size_t) 64, bitvector.size() - start);
+            bitvector.set_int(start, bitvector.get_int(start, width) | word,
+                width);
+        }
     #endif
     
 };
 
+#ifdef BITVECTOR_CSA
+template<typename Iterator>
+void GenericBitVector::addSorted(Iterator begin, Iterator end) {
+    if(encoder == NULL) {
+        throw std::runtime_error("Can't add to a vector we didn't create!");
+    }
+    
+    while(begin != end) {
+        // Find how many indices in a row follow this one, and add them all.
+        size_t start = *begin;
+        size_t runLength = 1;
+        for(++begin; begin != end && (size_t) *begin == start + runLength;
+            ++begin) {
+            
+            runLength++;
+        }
+        encoder->addRun(start, runLength);
+    }
+}
+#endif
+#ifdef BITVECTOR_SDSL
+template<typename Iterator>
+void GenericBitVector::addSorted(Iterator begin, Iterator end) {
+    if(rankSupport != NULL || selectSupport != NULL) {
+        throw std::runtime_error("Can't add to a finished/loaded vector!");
+    }
+    
+    // Gather up the bits for one word at a time, past the offset.
+    bool haveWord = false;
+    size_t wordStart = 0;
+    uint64_t word = 0;
+    size_t last = 0;
+    
+    for(; begin != end; ++begin) {
+        size_t index = *begin;
+        if(index < offset) {
+            throw std::runtime_error("Can't set bit in the leading 0s");
+        }
+        size_t relative = index - offset;
+        
+        if(haveWord && relative >= wordStart + 64) {
+            // This goes in a later word, so set the one we have.
+            orWord(wordStart, word, last);
+            haveWord = false;
+        }
+        if(!haveWord) {
+            wordStart = relative - relative % 64;
+            word = 0;
+            haveWord = true;
+        }
+        
+        word |= (uint64_t) 1 << (relative - wordStart);
+        last = relative;
+    }
+    
+    if(haveWord) {
+        // Set the last word.
+        orWord(wordStart, word, last);
+    }
+}
+#endif
 
+template<typename Iterator>
+GenericBitVector* GenericBitVector::fromSorted(Iterator begin, Iterator end,
+    size_t length) {
+    
+    // Hint the full length, so SDSL doesn't have to keep growing the vector.
+    GenericBitVector* toReturn = new GenericBitVector(length);
+    try {
+        toReturn->addSorted(begin, end);
+        toReturn->finish(length);
+    } catch(...) {
+        delete toReturn;
+        throw;
+    }
+    return toReturn;
+}
 
 #endif
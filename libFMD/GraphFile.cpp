@@ -0,0 +1,124 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "GraphFile.hpp"
+#include "AvroFile.hpp"
+
+const std::string GraphFile::AVRO_SCHEMA = "{\"type\": \"record\", "
+    "\"name\": \"GraphSegment\", \"namespace\": \"edu.ucsc.genome\", "
+    "\"fields\": ["
+        "{\"name\": \"thread\", \"type\": \"long\"}, "
+        "{\"name\": \"start\", \"type\": \"long\"}, "
+        "{\"name\": \"length\", \"type\": \"long\"}, "
+        "{\"name\": \"block\", \"type\": [\"null\", \"long\"], "
+            "\"default\": null}, "
+        "{\"name\": \"backwards\", \"type\": \"boolean\"}"
+    "]}";
+
+GraphFile::GraphFile(const std::string& filename):
+    mapping(new MappedFile(filename)), numThreads(0), numSegments(0),
+    numBlocks(0), numMembers(0), threadData(NULL), segmentData(NULL),
+    blockData(NULL), memberData(NULL) {
+
+    // Everything in the file is 8-byte words, and the mapping is page-aligned,
+    // so the tables can all be used in place. We have the magic number and
+    // the counts of threads, segments, blocks, and block members, and then
+    // each of those tables.
+    const uint64_t* words = (const uint64_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(uint64_t);
+
+    if(wordCount < 5 || words[0] != MAGIC || wordCount != 5 +
+        words[1] * (sizeof(Thread) / sizeof(uint64_t)) +
+        words[2] * (sizeof(Segment) / sizeof(uint64_t)) +
+        words[3] * (sizeof(Block) / sizeof(uint64_t)) + words[4]) {
+
+        // Don't go reading off the end of a truncated or foreign file.
+        delete mapping;
+        throw std::runtime_error("Bad graph file " + filename);
+    }
+
+    numThreads = words[1];
+    numSegments = words[2];
+    numBlocks = words[3];
+    numMembers = words[4];
+    threadData = (const Thread*) (words + 5);
+    segmentData = (const Segment*) (threadData + numThreads);
+    blockData = (const Block*) (segmentData + numSegments);
+    memberData = (const uint64_t*) (blockData + numBlocks);
+}
+
+GraphFile::~GraphFile() {
+    // Unmap the file we were using.
+    delete mapping;
+}
+
+void GraphFile::save(const std::string& filename,
+    const std::vector<Thread>& threads, const std::vector<Segment>& segments,
+    const std::vector<Block>& blocks, const std::vector<uint64_t>& members) {
+
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    // Save the header words in platform-native byte order.
+    uint64_t header[5] = {MAGIC, threads.size(), segments.size(),
+        blocks.size(), members.size()};
+    file.write((const char*) header, sizeof(header));
+
+    // Then all the tables, as they are in memory.
+    file.write((const char*) threads.data(), threads.size() * sizeof(Thread));
+    file.write((const char*) segments.data(),
+        segments.size() * sizeof(Segment));
+    file.write((const char*) blocks.data(), blocks.size() * sizeof(Block));
+    file.write((const char*) members.data(),
+        members.size() * sizeof(uint64_t));
+
+    // Close up the file
+    file.close();
+
+    if(!file) {
+        throw std::runtime_error("Could not write graph file " + filename);
+    }
+}
+
+void GraphFile::saveAvro(const std::string& filename,
+    const std::vector<Thread>& threads, const std::vector<Segment>& segments) {
+
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    std::string sync = AvroFile::makeSync();
+    file << AvroFile::makeHeader(AVRO_SCHEMA, sync);
+
+    // Encode a block's worth of segments at a time, and then compress and
+    // save them together.
+    std::string records;
+    std::string block;
+    for(size_t i = 0; i < segments.size(); i++) {
+        const Segment& segment = segments[i];
+        AvroFile::appendLong(records, threads[segment.thread].name);
+        AvroFile::appendLong(records, segment.start);
+        AvroFile::appendLong(records, segment.length);
+        if(segment.block == NONE) {
+            // Take the null branch of the union.
+            AvroFile::appendLong(records, 0);
+        } else {
+            AvroFile::appendLong(records, 1);
+            AvroFile::appendLong(records, segment.block);
+        }
+        AvroFile::appendBoolean(records, segment.orientation);
+
+        if((i + 1) % AVRO_BLOCK_SEGMENTS == 0 || i + 1 == segments.size()) {
+            AvroFile::appendBlock(block, (i % AVRO_BLOCK_SEGMENTS) + 1,
+                records, sync);
+            file << block;
+            records.clear();
+            block.clear();
+        }
+    }
+
+    file.close();
+
+    if(!file) {
+        throw std::runtime_error("Could not write Avro graph file " +
+            filename);
+    }
+}
@@ -0,0 +1,221 @@
+#ifndef GRAPHFILE_HPP
+#define GRAPHFILE_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "MappedFile.hpp"
+
+/**
+ * Defines a merged (pinch) graph saved in a compact binary format, which is
+ * memory-mapped and used in place rather than parsed, so that tools consuming
+ * a merged graph don't have to re-read it from c2h or LastGraph text.
+ *
+ * The graph consists of threads (one per contig), each cut into segments that
+ * cover it from end to end, and blocks of aligned segments. A segment has a
+ * thread, a 1-based start, a length, and, if it is aligned, a block and an
+ * orientation relative to the block. The segments of each thread are stored
+ * together in order along the thread, so a segment's adjacencies are just the
+ * segments before and after it on its thread. The members of each block are
+ * also stored together.
+ *
+ * Everything is in 64-bit words in platform-native byte order.
+ */
+class GraphFile {
+
+public:
+    /**
+     * What index means there isn't anything there, such as the block of an
+     * unaligned segment or the segment past the end of a thread?
+     */
+    static const uint64_t NONE = ~(uint64_t) 0;
+
+    /**
+     * Represents a thread, with its segments.
+     */
+    struct Thread {
+        // What is the thread's name (contig number)?
+        uint64_t name;
+        // How many bases long is it?
+        uint64_t length;
+        // What is the index of its first segment?
+        uint64_t firstSegment;
+        // And how many segments does it have?
+        uint64_t segmentCount;
+    };
+
+    /**
+     * Represents a segment of a thread.
+     */
+    struct Segment {
+        // What is the index of the thread it is on?
+        uint64_t thread;
+        // Where does it start, 1-based?
+        uint64_t start;
+        // How many bases long is it?
+        uint64_t length;
+        // What is the index of the block it is in, or NONE if it is
+        // unaligned?
+        uint64_t block;
+        // Is it backward relative to its block?
+        uint64_t orientation;
+    };
+
+    /**
+     * Represents a block of aligned segments.
+     */
+    struct Block {
+        // How many bases long is each of its segments?
+        uint64_t length;
+        // Where are its members in the member list?
+        uint64_t firstMember;
+        // And how many does it have?
+        uint64_t degree;
+    };
+
+    /**
+     * Load a GraphFile from the given file. The file is memory-mapped rather
+     * than read, and must not be modified while the GraphFile exists. Throws a
+     * std::runtime_error if the file isn't a graph file.
+     */
+    GraphFile(const std::string& filename);
+
+    /**
+     * Get rid of a GraphFile, unmapping its file.
+     */
+    ~GraphFile();
+
+    /**
+     * Save a graph to the given file. Each thread's segments must be in order
+     * at the thread's firstSegment, and each block's members (indices of
+     * segments) at its firstMember.
+     */
+    static void save(const std::string& filename,
+        const std::vector<Thread>& threads,
+        const std::vector<Segment>& segments,
+        const std::vector<Block>& blocks,
+        const std::vector<uint64_t>& members);
+
+    /**
+     * Save the segments of a graph, laid out as for save(), to the given file
+     * as an Avro container of records described by AVRO_SCHEMA, so Spark jobs
+     * can read the merged graph directly. There is one record per segment,
+     * giving its thread's name, its start and length, and its block and
+     * orientation if it is aligned. Segments are in order along each thread,
+     * so each is adjacent to the ones before and after it on its thread.
+     */
+    static void saveAvro(const std::string& filename,
+        const std::vector<Thread>& threads,
+        const std::vector<Segment>& segments);
+
+    /**
+     * What Avro schema do saved segments have? It is GraphSegment in
+     * src/main/avro/alignment.avdl.
+     */
+    static const std::string AVRO_SCHEMA;
+
+    /**
+     * How many threads are there?
+     */
+    inline size_t getNumberOfThreads() const {
+        return numThreads;
+    }
+
+    /**
+     * How many segments are there?
+     */
+    inline size_t getNumberOfSegments() const {
+        return numSegments;
+    }
+
+    /**
+     * How many blocks are there?
+     */
+    inline size_t getNumberOfBlocks() const {
+        return numBlocks;
+    }
+
+    /**
+     * Get the thread at the given index.
+     */
+    inline const Thread& getThread(size_t index) const {
+        return threadData[index];
+    }
+
+    /**
+     * Get the segment at the given index.
+     */
+    inline const Segment& getSegment(size_t index) const {
+        return segmentData[index];
+    }
+
+    /**
+     * Get the block at the given index.
+     */
+    inline const Block& getBlock(size_t index) const {
+        return blockData[index];
+    }
+
+    /**
+     * Get the index of the given member of the given block.
+     */
+    inline uint64_t getMember(size_t block, size_t member) const {
+        return memberData[blockData[block].firstMember + member];
+    }
+
+    /**
+     * Get the index of the segment after the given one on its thread, or NONE
+     * if it is the last one.
+     */
+    inline uint64_t getNextSegment(size_t index) const {
+        const Thread& thread = threadData[segmentData[index].thread];
+        return index + 1 < thread.firstSegment + thread.segmentCount ?
+            index + 1 : NONE;
+    }
+
+    /**
+     * Get the index of the segment before the given one on its thread, or
+     * NONE if it is the first one.
+     */
+    inline uint64_t getPreviousSegment(size_t index) const {
+        const Thread& thread = threadData[segmentData[index].thread];
+        return index > thread.firstSegment ? index - 1 : NONE;
+    }
+
+protected:
+    /**
+     * How many segments go in each block of an Avro file?
+     */
+    static const size_t AVRO_BLOCK_SEGMENTS = 100000;
+
+    /**
+     * What word starts a saved graph?
+     */
+    static const uint64_t MAGIC = 0x3148504152474753ULL;
+
+    // Holds the mapped file we were loaded from.
+    MappedFile* mapping;
+
+    // How many of each thing are there?
+    size_t numThreads;
+    size_t numSegments;
+    size_t numBlocks;
+    size_t numMembers;
+
+    // Point to the tables in the mapped file.
+    const Thread* threadData;
+    const Segment* segmentData;
+    const Block* blockData;
+    const uint64_t* memberData;
+
+private:
+    // GraphFiles can't be copied, since they own a mapping.
+    GraphFile(const GraphFile& other) = delete;
+
+    // Or assigned.
+    GraphFile& operator=(const GraphFile& other) = delete;
+
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "HierarchyMapper.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "MatchingStatistics.hpp"
+
+HierarchyMapper::HierarchyMapper(const FMDIndex& index,
+    const std::vector<std::string>& levelFilenames): index(index),
+    levelIndexes(), views(), minContext(0) {
+
+    try {
+        for(const std::string& filename : levelFilenames) {
+            // Load each merged level, if it isn't the bottom one.
+            levelIndexes.push_back(filename.empty() ? nullptr :
+                new LevelIndex(filename));
+        }
+    } catch(...) {
+        // Don't leak the levels we did load.
+        for(LevelIndex* level : levelIndexes) {
+            delete level;
+        }
+        throw;
+    }
+
+    for(LevelIndex* level : levelIndexes) {
+        // View each level, with nothing masked out.
+        views.push_back(level != nullptr ?
+            FMDIndexView(index, nullptr, *level) : FMDIndexView(index));
+    }
+}
+
+HierarchyMapper::~HierarchyMapper() {
+    // The views use the levels, so they have to go first.
+    views.clear();
+    for(LevelIndex* level : levelIndexes) {
+        delete level;
+    }
+}
+
+size_t HierarchyMapper::getNumberOfLevels() const {
+    return views.size();
+}
+
+void HierarchyMapper::setMinContext(size_t minContext) {
+    this->minContext = minContext;
+}
+
+size_t HierarchyMapper::mapSides(const std::string& query, long long* sides,
+    size_t length) const {
+
+    if(length / std::max(views.size(), (size_t) 1) < query.size()) {
+        throw std::runtime_error("No room for " +
+            std::to_string(query.size()) + " sides on each of " +
+            std::to_string(views.size()) + " levels in " +
+            std::to_string(length));
+    }
+
+    std::vector<const FMDIndexView*> levels;
+    for(const FMDIndexView& view : views) {
+        levels.push_back(&view);
+    }
+
+    size_t mapped = 0;
+    auto mappings = mapHierarchy(query, levels, minContext);
+    for(size_t level = 0; level < mappings.size(); level++) {
+        for(size_t i = 0; i < query.size(); i++) {
+            long long& side = sides[level * query.size() + i];
+            if(mappings[level][i].isMapped()) {
+                // Pack the base ID and the face together.
+                TextPosition base = mappings[level][i].getLocation();
+                side = ((long long) index.getBaseID(base) << 1) |
+                    (index.getStrand(base) ? 1 : 0);
+                mapped++;
+            } else {
+                side = -1;
+            }
+        }
+    }
+
+    return mapped;
+}
+
+std::vector<std::vector<Mapping>> HierarchyMapper::mapHierarchy(
+    const std::string& query, const std::vector<const FMDIndexView*>& levels,
+    size_t minContext) {
+
+    // Everything starts out unmapped.
+    std::vector<std::vector<Mapping>> mappings(levels.size(),
+        std::vector<Mapping>(query.size()));
+
+    if(levels.empty() || query.empty()) {
+        return mappings;
+    }
+
+    for(const FMDIndexView* level : levels) {
+        if(&level->getIndex() != &levels[0]->getIndex() ||
+            level->getMask() != levels[0]->getMask()) {
+
+            // The searches would come out differently.
+            throw std::runtime_error(
+                "Hierarchy levels must view the same index with the same mask");
+        }
+    }
+
+    // Do the one search, keeping every base's right context. Emptiness only
+    // depends on the mask, so it doesn't matter which level we search in.
+    MatchingStatistics statistics(*levels[0], query, true, false);
+    const auto& contexts = statistics.getContexts();
+
+    for(size_t i = 0; i < query.size(); i++) {
+        const FMDPosition& context = contexts[i].first;
+        size_t contextLength = contexts[i].second;
+
+        if(contextLength < minContext) {
+            // Not enough context to map on any level.
+            continue;
+        }
+
+        for(size_t level = 0; level < levels.size(); level++) {
+            // Project the context onto each level's ranges.
+            if(context.isUnique(*levels[level])) {
+                mappings[level][i] = Mapping(
+                    context.getTextPosition(*levels[level]), 0, contextLength);
+            }
+        }
+    }
+
+    return mappings;
+}
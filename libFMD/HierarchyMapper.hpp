@@ -0,0 +1,103 @@
+#ifndef HIERARCHYMAPPER_HPP
+#define HIERARCHYMAPPER_HPP
+
+#include <string>
+#include <vector>
+
+#include "FMDIndex.hpp"
+#include "FMDIndexView.hpp"
+#include "LevelIndex.hpp"
+#include "Mapping.hpp"
+
+/**
+ * Maps whole queries against every level of a reference hierarchy in one call.
+ * All the levels are views of the same FMDIndex with the same mask, and differ
+ * only in their merged ranges and the positions assigned to them, so the search
+ * for each base's context comes out the same on every level. It is done once,
+ * and the BWT interval it finds is then checked against each level's ranges.
+ *
+ * A base maps on a level if its right context, the longest string starting at
+ * it that occurs in the index, selects a single merged position on that level,
+ * and is at least the minimum context long. Since a shorter context selects
+ * more, a base that doesn't map on its longest context can't map on any other.
+ *
+ * Like LevelMapper, which maps to a single level with the natural mapping
+ * scheme, a HierarchyMapper can hand results back to Java as packed Sides.
+ */
+class HierarchyMapper {
+
+public:
+    /**
+     * Make a new HierarchyMapper for the given index, mapping to a level for
+     * each of the given filenames: the merged level saved in the file, or the
+     * bottom level for an empty filename. The index must outlive the
+     * HierarchyMapper.
+     */
+    HierarchyMapper(const FMDIndex& index,
+        const std::vector<std::string>& levelFilenames);
+
+    /**
+     * Get rid of a HierarchyMapper, and the levels it loaded.
+     */
+    ~HierarchyMapper();
+
+    /**
+     * Get the number of levels mapped to.
+     */
+    size_t getNumberOfLevels() const;
+
+    /**
+     * Set the minimum number of bases of context a base needs to map.
+     */
+    void setMinContext(size_t minContext);
+
+    /**
+     * Map the given query to every level, and fill in the packed Side for
+     * each of its bases on each level in sides, which must have room for the
+     * query's length times the number of levels of them. Sides are packed as
+     * by LevelMapper, and come level by level, so the Side for base i on level
+     * l is at l * query.size() + i. Throws a std::runtime_error if there isn't
+     * room. Returns the number of bases that mapped, summed over the levels.
+     */
+    size_t mapSides(const std::string& query, long long* sides,
+        size_t length) const;
+
+    /**
+     * Map the given query to all the given levels, searching for each base's
+     * context only once, and return the Mappings for each level in the same
+     * order. Mappings come with the length of the context used as their right
+     * context. Throws a std::runtime_error if the levels aren't views of the
+     * same index with the same mask, or if some base of the query isn't in the
+     * index at all.
+     */
+    static std::vector<std::vector<Mapping>> mapHierarchy(
+        const std::string& query,
+        const std::vector<const FMDIndexView*>& levels,
+        size_t minContext = 0);
+
+protected:
+    // What index are we mapping to?
+    const FMDIndex& index;
+
+    // Holds the merged levels we loaded, with null for the bottom level.
+    std::vector<LevelIndex*> levelIndexes;
+
+    // Holds the view of each level.
+    std::vector<FMDIndexView> views;
+
+    // How much context does a base need to map?
+    size_t minContext;
+
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    HierarchyMapper(const HierarchyMapper& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    HierarchyMapper& operator=(const HierarchyMapper& other) = delete;
+};
+
+#endif
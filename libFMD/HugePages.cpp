@@ -0,0 +1,48 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <Util.h>
+
+#include "HugePages.hpp"
+
+std::atomic<bool> HugePages::enabled(false);
+std::atomic<size_t> HugePages::advisedBytes(0);
+
+void HugePages::enable() {
+    enabled.store(true);
+}
+
+size_t HugePages::advise(const void* data, size_t bytes) {
+    if(!isEnabled()) {
+        return 0;
+    }
+    
+    size_t advised = adviseHugePages(data, bytes);
+    countAdvised(advised);
+    return advised;
+}
+
+void HugePages::countAdvised(size_t bytes) {
+    advisedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+size_t HugePages::getBackedBytes() {
+    // The rollup adds up all our mappings, in kB. Anonymous memory and mapped
+    // files each have their own line.
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    
+    size_t backed = 0;
+    std::string line;
+    while(std::getline(rollup, line)) {
+        std::stringstream lineStream(line);
+        std::string name;
+        size_t kilobytes;
+        if(lineStream >> name >> kilobytes && (name == "AnonHugePages:" ||
+            name == "FilePmdMapped:")) {
+            
+            backed += kilobytes * 1024;
+        }
+    }
+    return backed;
+}
@@ -0,0 +1,65 @@
+#ifndef HUGEPAGES_HPP
+#define HUGEPAGES_HPP
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Controls backing the large arrays of loaded indexes (BWT runs and markers,
+ * suffix array samples, and memory-mapped files like the LCP array) with
+ * transparent huge pages, so random access into them misses the TLB less.
+ * This is off until enable() is called. Where the kernel can't give us huge
+ * pages, asking for them does nothing, and everything works the same.
+ */
+class HugePages {
+
+public:
+    /**
+     * Back indexes loaded from now on with huge pages.
+     */
+    static void enable();
+    
+    /**
+     * Should indexes be backed with huge pages?
+     */
+    static inline bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * If huge pages are enabled, ask for the whole huge pages inside the given
+     * memory to be backed by them. Returns the number of bytes advised.
+     */
+    static size_t advise(const void* data, size_t bytes);
+    
+    /**
+     * Count bytes that were advised some other way, such as by the
+     * libsuffixtools structures themselves.
+     */
+    static void countAdvised(size_t bytes);
+    
+    /**
+     * Get the total number of bytes that have been advised to use huge pages.
+     */
+    static inline size_t getAdvisedBytes() {
+        return advisedBytes.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of bytes of this process's memory actually backed by huge
+     * pages right now, or 0 if the kernel won't say.
+     */
+    static size_t getBackedBytes();
+    
+private:
+    // Are huge pages on?
+    static std::atomic<bool> enabled;
+    
+    // How many bytes have been advised?
+    static std::atomic<size_t> advisedBytes;
+    
+    // Don't ever let anyone make a HugePages object.
+    HugePages();
+};
+
+#endif
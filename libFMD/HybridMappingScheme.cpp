@@ -0,0 +1,107 @@
+#include "HybridMappingScheme.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+HybridMappingScheme::HybridMappingScheme(MappingScheme* exact,
+    MappingScheme* fallback): MappingScheme(FMDIndexView(firstView(exact))),
+    exact(exact), fallback(fallback) {
+
+    if(fallback == nullptr) {
+        throw std::runtime_error("Hybrid mapping needs a fallback scheme");
+    }
+}
+
+const FMDIndexView& HybridMappingScheme::firstView(
+    const MappingScheme* exact) {
+
+    if(exact == nullptr) {
+        throw std::runtime_error("Hybrid mapping needs an exact scheme");
+    }
+    return exact->getView();
+}
+
+void HybridMappingScheme::map(const std::string& query,
+    std::function<void(size_t, TextPosition)> callback) const {
+
+    QueryTimer timer(*this, query, queryNanosecondsStat);
+
+    // Holds where each base mapped, and whether it did.
+    std::vector<TextPosition> locations(query.size());
+    std::vector<char> mapped(query.size(), false);
+
+    exact->map(query, [&](size_t i, TextPosition mappedTo) {
+        locations[i] = mappedTo;
+        mapped[i] = true;
+    });
+
+    size_t exactMapped = std::count(mapped.begin(), mapped.end(), true);
+    size_t fallbackMapped = 0;
+    size_t fallbackBases = 0;
+
+    // Go through the windows around runs of unmapped bases, and map each with
+    // the fallback scheme.
+    size_t next = 0;
+    while(next < query.size()) {
+        // Find the next unmapped base.
+        size_t runStart = std::find(mapped.begin() + next, mapped.end(),
+            false) - mapped.begin();
+        if(runStart == query.size()) {
+            break;
+        }
+
+        // Take in any later runs close enough that their windows would
+        // overlap, so we find the last unmapped base in the window.
+        size_t runEnd = runStart + 1;
+        size_t scan = runStart + 1;
+        while(scan < query.size() && (!mapped[scan] ||
+            scan - runEnd < 2 * fallbackContext)) {
+
+            if(!mapped[scan]) {
+                runEnd = scan + 1;
+            }
+            scan++;
+        }
+
+        // Give the fallback scheme context on both sides.
+        size_t windowStart = runStart - std::min(runStart, fallbackContext);
+        size_t windowEnd = std::min(query.size(), runEnd + fallbackContext);
+
+        fallback->map(query.substr(windowStart, windowEnd - windowStart),
+            [&](size_t i, TextPosition mappedTo) {
+
+            if(!mapped[windowStart + i]) {
+                // Only fill in what the exact scheme left unmapped. Bases
+                // aren't shared between windows, so nothing else can set this.
+                locations[windowStart + i] = mappedTo;
+                mapped[windowStart + i] = true;
+                fallbackMapped++;
+            }
+        });
+        fallbackBases += windowEnd - windowStart;
+
+        // Everything up to where we stopped scanning is mapped or done.
+        next = scan;
+    }
+
+    for(size_t i = 0; i < query.size(); i++) {
+        if(mapped[i]) {
+            callback(i, locations[i]);
+        }
+    }
+
+    mappedStat.add(exactMapped + fallbackMapped);
+    unmappedStat.add(query.size() - exactMapped - fallbackMapped);
+    exactMappedStat.add(exactMapped);
+    fallbackMappedStat.add(fallbackMapped);
+    fallbackBasesStat.add(fallbackBases);
+    timer.count("fallbackBases", fallbackBases);
+}
+
+std::vector<std::pair<std::string, std::string>>
+    HybridMappingScheme::getParameters() const {
+
+    auto parameters = MappingScheme::getParameters();
+    parameters.push_back({"fallbackContext", std::to_string(fallbackContext)});
+    return parameters;
+}
@@ -0,0 +1,98 @@
+#ifndef HYBRIDMAPPINGSCHEME_HPP
+#define HYBRIDMAPPINGSCHEME_HPP
+
+#include "MappingScheme.hpp"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Mapping scheme that maps each query with a fast scheme first, and only runs
+ * a slower, more tolerant scheme on the parts of the query the fast one left
+ * unmapped. The usual pairing is an exact ZipMappingScheme<FMDPosition> with a
+ * mismatch-tolerant ZipMappingScheme<FMDPositionGroup>: most bases map exactly,
+ * so tolerating mismatches costs about as much as mapping exactly, except on
+ * queries that don't map.
+ *
+ * Every base the fast scheme maps keeps that mapping. The bases it leaves
+ * unmapped, because their exact contexts never become unique or because they
+ * conflict, are given to the fallback scheme in windows that reach
+ * fallbackContext bases past each run of them on both sides, and whatever the
+ * fallback scheme maps them to is used instead. Windows that would overlap are
+ * mapped together, so no base is searched twice.
+ *
+ * The fast and fallback schemes keep their own stats. This scheme counts
+ * "mapped" and "unmapped" bases overall, how many bases each scheme mapped in
+ * "exactMapped" and "fallbackMapped", and how many bases the fallback scheme
+ * had to search in "fallbackBases".
+ */
+class HybridMappingScheme: public MappingScheme {
+
+public:
+    /**
+     * Make a new HybridMappingScheme that maps with the first scheme given, and
+     * then with the second where the first doesn't map. Takes ownership of
+     * both, which must map to the same index. Throws a std::runtime_error if
+     * either is null.
+     */
+    HybridMappingScheme(MappingScheme* exact, MappingScheme* fallback);
+
+    /**
+     * Map the given query string with the fast scheme, and then the fallback
+     * scheme around the bases that didn't map. When a mapping is found, the
+     * callback function will be called with the query base index, and the
+     * TextPosition to which it maps in the forward direction.
+     */
+    virtual void map(const std::string& query,
+        std::function<void(size_t, TextPosition)> callback) const override;
+
+    /**
+     * Get the parameters for mapping, including the fallback context.
+     */
+    virtual std::vector<std::pair<std::string, std::string>>
+        getParameters() const override;
+
+    /**
+     * Get the scheme that maps first.
+     */
+    inline const MappingScheme& getExact() const {
+        return *exact;
+    }
+
+    /**
+     * Get the scheme that maps the bases the first one doesn't.
+     */
+    inline const MappingScheme& getFallback() const {
+        return *fallback;
+    }
+
+    /**
+     * How many bases of the query on each side of a run of unmapped bases
+     * should the fallback scheme search as context?
+     */
+    size_t fallbackContext = 100;
+
+protected:
+    /**
+     * Get the view of the given scheme, to be the view for the whole scheme.
+     * Throws a std::runtime_error if there's no scheme.
+     */
+    static const FMDIndexView& firstView(const MappingScheme* exact);
+
+    // Holds the scheme to map with first.
+    std::unique_ptr<MappingScheme> exact;
+
+    // Holds the scheme to map with where that one doesn't.
+    std::unique_ptr<MappingScheme> fallback;
+
+    // Counters for the stats we update while mapping.
+    StatTracker::Counter mappedStat = stats.counter("mapped");
+    StatTracker::Counter unmappedStat = stats.counter("unmapped");
+    StatTracker::Counter exactMappedStat = stats.counter("exactMapped");
+    StatTracker::Counter fallbackMappedStat = stats.counter("fallbackMapped");
+    StatTracker::Counter fallbackBasesStat = stats.counter("fallbackBases");
+    StatTracker::Histogram queryNanosecondsStat =
+        stats.histogram("queryNanoseconds");
+};
+
+#endif
@@ -0,0 +1,435 @@
+#include "IndexPackage.hpp"
+#include "TaskPool.hpp"
+#include "Log.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+
+/**
+ * Read exactly the given number of bytes at the given offset in the given
+ * file. Returns false if the file ends first or the read fails.
+ */
+static bool readAt(int file, char* data, size_t length, uint64_t offset) {
+    while(length > 0) {
+        ssize_t result = pread(file, data, length, offset);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            return false;
+        }
+        data += result;
+        length -= result;
+        offset += result;
+    }
+    return true;
+}
+
+/**
+ * Write all the given bytes at the given offset in the given file. Returns
+ * false if the write fails.
+ */
+static bool writeAt(int file, const char* data, size_t length,
+    uint64_t offset) {
+
+    while(length > 0) {
+        ssize_t result = pwrite(file, data, length, offset);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            return false;
+        }
+        data += result;
+        length -= result;
+        offset += result;
+    }
+    return true;
+}
+
+/**
+ * Append a word to the given string.
+ */
+static void appendWord(std::string& out, uint64_t word) {
+    out.append((const char*) &word, sizeof(word));
+}
+
+/**
+ * Get the CRC32 of the given bytes.
+ */
+static uint64_t checksum(const std::string& data) {
+    return crc32(crc32(0, Z_NULL, 0), (const Bytef*) data.data(),
+        data.size());
+}
+
+void IndexPackage::pack(const std::string& directory,
+    const std::string& filename) {
+
+    // Find the files, in a consistent order.
+    std::vector<std::string> names;
+    for(boost::filesystem::directory_iterator i(directory);
+        i != boost::filesystem::directory_iterator(); ++i) {
+
+        if(boost::filesystem::is_regular_file(i->status()) &&
+            !(boost::filesystem::exists(filename) &&
+            boost::filesystem::equivalent(i->path(), filename))) {
+
+            // Take everything but an old copy of the package itself.
+            names.push_back(i->path().filename().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+
+    int package = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(package == -1) {
+        throw std::runtime_error("Could not create index package " + filename +
+            ": " + strerror(errno));
+    }
+
+    std::string header;
+    appendWord(header, MAGIC);
+    appendWord(header, VERSION);
+    appendWord(header, BLOCK_SIZE);
+    uint64_t offset = 0;
+    bool written = writeAt(package, header.data(), header.size(), offset);
+    offset += header.size();
+
+    std::vector<Entry> entries;
+    for(const std::string& name : names) {
+        std::string path = directory + "/" + name;
+        int file = open(path.c_str(), O_RDONLY);
+        struct stat fileStats;
+        if(file == -1 || fstat(file, &fileStats) != 0) {
+            if(file != -1) {
+                close(file);
+            }
+            close(package);
+            throw std::runtime_error("Could not read " + path +
+                " to package it");
+        }
+
+        Entry entry;
+        entry.name = name;
+        entry.size = fileStats.st_size;
+        size_t blockCount = (entry.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        for(size_t start = 0; start < blockCount && written;
+            start += WINDOW_BLOCKS) {
+
+            // Read and compress a window of blocks in parallel, then write
+            // them out in order.
+            size_t count = std::min((size_t) WINDOW_BLOCKS,
+                blockCount - start);
+            std::vector<std::string> stored(count);
+            std::vector<Block> blocks(count);
+
+            auto compressBlock = [&](size_t i) {
+                uint64_t blockStart = (start + i) * BLOCK_SIZE;
+                std::string data(std::min((uint64_t) BLOCK_SIZE,
+                    entry.size - blockStart), '\0');
+                if(!readAt(file, &data[0], data.size(), blockStart)) {
+                    throw std::runtime_error("Could not read " + path +
+                        " to package it");
+                }
+                blocks[i].checksum = checksum(data);
+
+                uLongf compressedSize = compressBound(data.size());
+                std::string compressed(compressedSize, '\0');
+                int result = compress2((Bytef*) &compressed[0],
+                    &compressedSize, (const Bytef*) data.data(), data.size(),
+                    COMPRESSION_LEVEL);
+
+                // Keep it compressed only if that saves at least an eighth;
+                // otherwise it's not worth inflating later.
+                if(result == Z_OK &&
+                    compressedSize < data.size() - data.size() / 8) {
+
+                    compressed.resize(compressedSize);
+                    stored[i] = std::move(compressed);
+                    blocks[i].raw = 0;
+                } else {
+                    stored[i] = std::move(data);
+                    blocks[i].raw = 1;
+                }
+                blocks[i].storedSize = stored[i].size();
+            };
+
+            try {
+                parallelFor(count, compressBlock);
+            } catch(...) {
+                close(file);
+                close(package);
+                throw;
+            }
+
+            for(size_t i = 0; i < count && written; i++) {
+                blocks[i].offset = offset;
+                written = writeAt(package, stored[i].data(), stored[i].size(),
+                    offset);
+                offset += stored[i].size();
+                entry.blocks.push_back(blocks[i]);
+            }
+        }
+        close(file);
+
+        entries.push_back(std::move(entry));
+    }
+
+    // Now write the table of contents, and where to find it.
+    std::string table;
+    appendWord(table, entries.size());
+    for(const Entry& entry : entries) {
+        appendWord(table, entry.name.size());
+        table += entry.name;
+        appendWord(table, entry.size);
+        appendWord(table, entry.blocks.size());
+        for(const Block& block : entry.blocks) {
+            appendWord(table, block.offset);
+            appendWord(table, block.storedSize);
+            appendWord(table, block.raw);
+            appendWord(table, block.checksum);
+        }
+    }
+    appendWord(table, offset);
+    appendWord(table, MAGIC);
+    written = written && writeAt(package, table.data(), table.size(), offset);
+    offset += table.size();
+
+    if(close(package) != 0 || !written) {
+        throw std::runtime_error("Could not write index package " + filename);
+    }
+
+    uint64_t totalSize = 0;
+    for(const Entry& entry : entries) {
+        totalSize += entry.size;
+    }
+    Log::info() << "Packed " << entries.size() << " files of " <<
+        (totalSize >> 20) << " MB into " << (offset >> 20) << " MB in " <<
+        filename << std::endl;
+}
+
+void IndexPackage::unpack(const std::string& filename,
+    const std::string& directory) {
+
+    int package = open(filename.c_str(), O_RDONLY);
+    if(package == -1) {
+        throw std::runtime_error("Could not open index package " + filename);
+    }
+
+    std::vector<Entry> entries;
+    try {
+        entries = readTable(package, filename);
+    } catch(...) {
+        close(package);
+        throw;
+    }
+
+    boost::filesystem::create_directories(directory);
+
+    // Make all the files at their full sizes, so blocks can be written to
+    // them in any order.
+    std::vector<int> files;
+    std::vector<std::pair<size_t, size_t>> blocks;
+    uint64_t totalSize = 0;
+    for(size_t i = 0; i < entries.size(); i++) {
+        std::string path = directory + "/" + entries[i].name;
+        int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(file == -1 || ftruncate(file, entries[i].size) != 0) {
+            if(file != -1) {
+                close(file);
+            }
+            for(int other : files) {
+                close(other);
+            }
+            close(package);
+            throw std::runtime_error("Could not unpack " + path);
+        }
+        files.push_back(file);
+
+        for(size_t j = 0; j < entries[i].blocks.size(); j++) {
+            blocks.emplace_back(i, j);
+        }
+        totalSize += entries[i].size;
+    }
+
+    Log::info() << "Unpacking " << entries.size() << " files of " <<
+        (totalSize >> 20) << " MB from " << filename << std::endl;
+
+    std::exception_ptr error;
+    try {
+        parallelFor(blocks.size(), [&](size_t i) {
+            const Entry& entry = entries[blocks[i].first];
+            const Block& block = entry.blocks[blocks[i].second];
+            uint64_t blockStart = blocks[i].second * (uint64_t) BLOCK_SIZE;
+            size_t blockSize = std::min((uint64_t) BLOCK_SIZE,
+                entry.size - blockStart);
+
+            std::string stored(block.storedSize, '\0');
+            if(!readAt(package, &stored[0], stored.size(), block.offset)) {
+                throw std::runtime_error("Truncated index package " +
+                    filename);
+            }
+
+            std::string data;
+            if(block.raw) {
+                data = std::move(stored);
+            } else {
+                data.assign(blockSize, '\0');
+                uLongf inflatedSize = blockSize;
+                if(uncompress((Bytef*) &data[0], &inflatedSize,
+                    (const Bytef*) stored.data(), stored.size()) != Z_OK) {
+
+                    throw std::runtime_error("Damaged block of " +
+                        entry.name + " in index package " + filename);
+                }
+                data.resize(inflatedSize);
+            }
+
+            if(data.size() != blockSize || checksum(data) != block.checksum) {
+                throw std::runtime_error("Damaged block of " + entry.name +
+                    " in index package " + filename);
+            }
+
+            if(!writeAt(files[blocks[i].first], data.data(), data.size(),
+                blockStart)) {
+
+                throw std::runtime_error("Could not unpack " + directory +
+                    "/" + entry.name);
+            }
+        });
+    } catch(...) {
+        error = std::current_exception();
+    }
+
+    bool closed = true;
+    for(int file : files) {
+        closed &= close(file) == 0;
+    }
+    close(package);
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    if(!closed) {
+        throw std::runtime_error("Could not unpack index package " +
+            filename + " into " + directory);
+    }
+}
+
+std::vector<std::string> IndexPackage::list(const std::string& filename) {
+    int package = open(filename.c_str(), O_RDONLY);
+    if(package == -1) {
+        throw std::runtime_error("Could not open index package " + filename);
+    }
+
+    std::vector<Entry> entries;
+    try {
+        entries = readTable(package, filename);
+    } catch(...) {
+        close(package);
+        throw;
+    }
+    close(package);
+
+    std::vector<std::string> names;
+    for(const Entry& entry : entries) {
+        names.push_back(entry.name);
+    }
+    return names;
+}
+
+std::vector<IndexPackage::Entry> IndexPackage::readTable(int file,
+    const std::string& filename) {
+
+    // Check the header and the trailer.
+    struct stat fileStats;
+    uint64_t header[3];
+    uint64_t trailer[2];
+    if(fstat(file, &fileStats) != 0 ||
+        (uint64_t) fileStats.st_size < sizeof(header) + sizeof(trailer) ||
+        !readAt(file, (char*) header, sizeof(header), 0) ||
+        !readAt(file, (char*) trailer, sizeof(trailer),
+        fileStats.st_size - sizeof(trailer)) ||
+        header[0] != MAGIC || trailer[1] != MAGIC) {
+
+        throw std::runtime_error("Bad index package " + filename);
+    }
+    if(header[1] != VERSION || header[2] != BLOCK_SIZE) {
+        throw std::runtime_error("Index package " + filename +
+            " is from an incompatible version");
+    }
+
+    uint64_t tableEnd = fileStats.st_size - sizeof(trailer);
+    if(trailer[0] < sizeof(header) || trailer[0] > tableEnd) {
+        throw std::runtime_error("Bad index package " + filename);
+    }
+    std::string table(tableEnd - trailer[0], '\0');
+    if(!readAt(file, &table[0], table.size(), trailer[0])) {
+        throw std::runtime_error("Bad index package " + filename);
+    }
+
+    // Parse the table, making sure not to run off the end of it.
+    size_t position = 0;
+    auto readWord = [&]() {
+        if(table.size() - position < sizeof(uint64_t)) {
+            throw std::runtime_error("Bad index package " + filename);
+        }
+        uint64_t word;
+        memcpy(&word, table.data() + position, sizeof(word));
+        position += sizeof(word);
+        return word;
+    };
+
+    // Every entry takes at least 4 words, so don't believe in more than fit.
+    uint64_t entryCount = readWord();
+    if(entryCount > table.size() / (4 * sizeof(uint64_t))) {
+        throw std::runtime_error("Bad index package " + filename);
+    }
+    std::vector<Entry> entries(entryCount);
+    for(Entry& entry : entries) {
+        uint64_t nameLength = readWord();
+        if(table.size() - position < nameLength) {
+            throw std::runtime_error("Bad index package " + filename);
+        }
+        entry.name = table.substr(position, nameLength);
+        position += nameLength;
+
+        if(entry.name.empty() || entry.name == "." || entry.name == ".." ||
+            entry.name.find('/') != std::string::npos) {
+            // Don't let a package write outside its directory.
+            throw std::runtime_error("Bad file name in index package " +
+                filename);
+        }
+
+        entry.size = readWord();
+        uint64_t blockCount = readWord();
+        if(blockCount != (entry.size + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+            blockCount > table.size() / (4 * sizeof(uint64_t))) {
+
+            throw std::runtime_error("Bad index package " + filename);
+        }
+        entry.blocks.resize(blockCount);
+        for(Block& block : entry.blocks) {
+            block.offset = readWord();
+            block.storedSize = readWord();
+            block.raw = readWord();
+            block.checksum = readWord();
+            if(block.offset > trailer[0] ||
+                block.storedSize > trailer[0] - block.offset) {
+
+                throw std::runtime_error("Bad index package " + filename);
+            }
+        }
+    }
+    return entries;
+}
@@ -0,0 +1,117 @@
+#ifndef INDEXPACKAGE_HPP
+#define INDEXPACKAGE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Packs the files of an index directory into a single file for shipping to
+ * the machines that will map against it, and unpacks them again there.
+ *
+ * Each file is cut into blocks of BLOCK_SIZE bytes, which are compressed
+ * independently with fast deflate and checksummed with CRC32, so packing and
+ * unpacking can both use every thread in the global TaskPool. Blocks that
+ * don't compress well, like those of the run-length encoded BWT, are stored
+ * raw, and cost only a copy to unpack.
+ *
+ * The package starts with a magic number, the format version, and the block
+ * size. Then come the stored blocks, one file after another. Then comes the
+ * table of contents: the number of files, and for each its name length, name
+ * bytes, size, and number of blocks, and for each block its offset in the
+ * package, stored size, whether it is raw, and its checksum. Last is the
+ * offset of the table of contents and the magic number again, so the table
+ * can be written after the blocks are. Numbers are 64-bit words in
+ * platform-native byte order.
+ *
+ * Unpacked files are ordinary files that the index loads (and memory-maps) as
+ * usual.
+ */
+class IndexPackage {
+
+public:
+    /**
+     * Pack all the regular files directly in the given directory into a
+     * package with the given filename. Subdirectories, like checkpoints, are
+     * left out. Throws a std::runtime_error if anything can't be read or
+     * written.
+     */
+    static void pack(const std::string& directory,
+        const std::string& filename);
+
+    /**
+     * Unpack the package with the given filename into the given directory,
+     * which is created if needed, replacing any files already there with the
+     * same names. Throws a std::runtime_error if the package is not a package,
+     * or is damaged, or anything can't be written.
+     */
+    static void unpack(const std::string& filename,
+        const std::string& directory);
+
+    /**
+     * Get the names of the files in the given package, in order. Throws a
+     * std::runtime_error if it is not a package.
+     */
+    static std::vector<std::string> list(const std::string& filename);
+
+    /**
+     * How many bytes of each file go in a block?
+     */
+    static const size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * What version of the format do we read and write?
+     */
+    static const uint64_t VERSION = 1;
+
+protected:
+    /**
+     * Represents a stored block of a file.
+     */
+    struct Block {
+        // Where in the package is it?
+        uint64_t offset;
+        // How many bytes does it take up there?
+        uint64_t storedSize;
+        // Is it stored raw (1), or compressed (0)?
+        uint64_t raw;
+        // What is the CRC32 of its uncompressed bytes?
+        uint64_t checksum;
+    };
+
+    /**
+     * Represents a packed file.
+     */
+    struct Entry {
+        // What is it called in its directory?
+        std::string name;
+        // How big is it?
+        uint64_t size;
+        // Where are its blocks?
+        std::vector<Block> blocks;
+    };
+
+    /**
+     * Read the table of contents of the package open as the given file
+     * descriptor, which has the given filename, for error messages.
+     */
+    static std::vector<Entry> readTable(int file, const std::string& filename);
+
+    /**
+     * What word starts and ends a package?
+     */
+    static const uint64_t MAGIC = 0x314b4341504d4446ULL;
+
+    /**
+     * How many blocks are compressed at once, before being written out?
+     */
+    static const size_t WINDOW_BLOCKS = 64;
+
+    /**
+     * What deflate level do we compress with? Low levels are much faster,
+     * for not much less compression.
+     */
+    static const int COMPRESSION_LEVEL = 1;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "IndexWarmer.hpp"
+#include "Log.hpp"
+
+#include <fstream>
+#include <chrono>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+IndexWarmer::IndexWarmer(const std::vector<std::string>& filenames):
+    filenames(filenames), totalBytes(0), warmedBytes(0), stopping(false),
+    done(false), thread(&IndexWarmer::run, this) {
+    
+    // Nothing to do!
+}
+
+IndexWarmer::~IndexWarmer() {
+    stop();
+    join();
+}
+
+std::vector<std::string> IndexWarmer::getIndexFiles(
+    const std::string& basename) {
+    
+    // Minimal unique lengths and the k-mer table are looked at for almost every
+    // search, then locating needs the packed or run-sampled suffix array, and
+    // displaying bases needs the inverse suffix array or packed text. The LCP
+    // array and genome matrix only get used by some kinds of queries.
+    std::vector<std::string> filenames;
+    for(const char* extension : {".mus", ".kmi", ".psa", ".rsa", ".isa",
+        ".txt", ".lcp", ".gwm"}) {
+        
+        std::string filename = basename + extension;
+        if(std::ifstream(filename).good()) {
+            filenames.push_back(filename);
+        }
+    }
+    return filenames;
+}
+
+void IndexWarmer::stop() {
+    stopping.store(true);
+}
+
+void IndexWarmer::join() {
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+
+void IndexWarmer::run() {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Open everything and tell the kernel it's all wanted, so it can start on
+    // the later files while we read the earlier ones.
+    std::vector<int> files;
+    for(const std::string& filename : filenames) {
+        int file = open(filename.c_str(), O_RDONLY);
+        if(file == -1) {
+            Log::warning() << "Could not open " << filename << " to warm up" <<
+                std::endl;
+            continue;
+        }
+        
+        struct stat fileStats;
+        if(fstat(file, &fileStats) == 0) {
+            totalBytes.fetch_add(fileStats.st_size);
+        }
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+        files.push_back(file);
+    }
+    
+    Log::info() << "Warming up " << (getTotalBytes() >> 20) << " MB of index "
+        "in " << files.size() << " files" << std::endl;
+    
+    // Then actually read them in order, so the first ones are ready first no
+    // matter what the kernel does with the advice.
+    std::vector<char> buffer(READ_SIZE);
+    size_t nextReport = REPORT_INTERVAL;
+    for(int file : files) {
+        ssize_t bytesRead;
+        while(!stopping.load() &&
+            (bytesRead = read(file, buffer.data(), buffer.size())) > 0) {
+            
+            size_t warmed = warmedBytes.fetch_add(bytesRead) + bytesRead;
+            if(warmed >= nextReport) {
+                Log::info() << "Warmed up " << (warmed >> 20) << " of " <<
+                    (getTotalBytes() >> 20) << " MB of index" << std::endl;
+                nextReport += REPORT_INTERVAL;
+            }
+        }
+        close(file);
+    }
+    
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    Log::info() << (stopping.load() ? "Stopped warming up" :
+        "Finished warming up") << " after " << (getWarmedBytes() >> 20) <<
+        " MB in " << seconds << " seconds" << std::endl;
+    
+    done.store(true);
+}
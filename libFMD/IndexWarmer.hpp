@@ -0,0 +1,120 @@
+#ifndef INDEXWARMER_HPP
+#define INDEXWARMER_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+/**
+ * Streams the memory-mapped files of an index into the page cache from a
+ * background thread, so mapping can start right away instead of waiting for
+ * its first searches to fault pages in one at a time from slow storage. Files
+ * are read in order, with large sequential reads, after telling the kernel
+ * they will all be needed. Progress is logged as it goes, and can be checked
+ * at any time.
+ *
+ * The BWT and suffix array samples are read into memory when the index is
+ * loaded, so they are already warm; this is for everything that is mapped.
+ */
+class IndexWarmer {
+
+public:
+    /**
+     * Start warming up the given files, in order. Files that can't be opened
+     * are skipped.
+     */
+    IndexWarmer(const std::vector<std::string>& filenames);
+    
+    /**
+     * Stop warming up, if not done already, and wait for the thread.
+     */
+    ~IndexWarmer();
+    
+    /**
+     * Get the mapped files of the index with the given basename that exist, in
+     * the order they should be warmed up: the ones every search step uses
+     * first, and the ones only some queries touch last.
+     */
+    static std::vector<std::string> getIndexFiles(const std::string& basename);
+    
+    /**
+     * Stop warming up as soon as possible.
+     */
+    void stop();
+    
+    /**
+     * Wait for warming up to finish or stop.
+     */
+    void join();
+    
+    /**
+     * Get the total number of bytes to warm up. Files are measured as they
+     * are reached, so this can grow while warming up.
+     */
+    inline size_t getTotalBytes() const {
+        return totalBytes.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Get the number of bytes warmed up so far.
+     */
+    inline size_t getWarmedBytes() const {
+        return warmedBytes.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Is warming up done?
+     */
+    inline bool isDone() const {
+        return done.load();
+    }
+    
+    /**
+     * How many bytes are read at a time?
+     */
+    static const size_t READ_SIZE = 8 * 1024 * 1024;
+    
+    /**
+     * How many bytes are warmed up between progress messages?
+     */
+    static const size_t REPORT_INTERVAL = (size_t) 1024 * 1024 * 1024;
+    
+protected:
+    /**
+     * Read through all the files. Runs on the thread.
+     */
+    void run();
+    
+    // Holds the files to warm up, in order.
+    std::vector<std::string> filenames;
+    
+    // How big are the files we know about?
+    std::atomic<size_t> totalBytes;
+    
+    // How much have we read?
+    std::atomic<size_t> warmedBytes;
+    
+    // Should we stop?
+    std::atomic<bool> stopping;
+    
+    // Are we done?
+    std::atomic<bool> done;
+    
+    // Holds the thread doing the reading. Comes last so everything else is
+    // ready when it starts.
+    std::thread thread;
+    
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    IndexWarmer(const IndexWarmer& other) = delete;
+    
+    /**
+     * No assignment operator either.
+     */
+    IndexWarmer& operator=(const IndexWarmer& other) = delete;
+};
+
+#endif
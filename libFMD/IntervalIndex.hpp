@@ -1,7 +1,7 @@
 #ifndef INTERVALINDEX_HPP
 #define INTERVALINDEX_HPP
 
-#include "GenericBitVector.hpp"
+#include "EytzingerIndex.hpp"
 #include "Log.hpp"
 
 #include <vector>
@@ -9,6 +9,8 @@
 #include <utility>
 #include <memory>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 /**
  * Represents a container for (start, length) intervals of size_ts, with an
@@ -22,6 +24,16 @@
  * would not be visible from the left (as they would not start/end after 0, and
  * -1 is not passable as a size_t).
  *
+ * Single queries are answered by searching sorted arrays of the distinct start
+ * and end positions, optionally through Eytzinger-order trees. Sorted batches
+ * of queries can instead be answered in one pass over those arrays.
+ *
+ * Indexes are often built for a few dozen intervals at a time, once or more
+ * per query, so the arrays share one allocation, the scratch space used to sort
+ * ends is kept per thread and reused, and indexes smaller than
+ * EYTZINGER_MIN_SIZE intervals skip the trees and use a branch-free binary
+ * search, which is just as fast when everything fits in a few cache lines.
+ *
  * The Allocator type parameter is just to let us accept vectors of any
  * allocator in the constructor. TODO: Is there a way to get it to infer
  * properly from the allocator of whatever vector is passed to the constructor?
@@ -56,7 +68,7 @@ public:
     /**
      * Create a new empty IntervalIndex.
      */
-    IntervalIndex(): startBits(NULL), endBits(NULL) {
+    IntervalIndex(): numStarts(0), numEnds(0), useEytzinger(false) {
         // Nothing to do!
     }
     
@@ -64,192 +76,43 @@ public:
      * Create a new interval index given the possibly unsorted vector of
      * intervals and their associated values.
      *
-     * Must contain at least one interval.
-     *
      * Takes O(n) time if intervals are already sorted by both start and end
-     * coordinates, and O(n log n) time otherwise (assuming bit vector
-     * construction is O(number of ones)).
+     * coordinates, and O(n log n) time otherwise.
+     *
+     * If useEytzinger is set, single queries search the interval start and
+     * end positions in Eytzinger order, which takes more memory but has much
+     * better cache behavior for large indexes than binary search over the
+     * sorted positions.
      */
-    IntervalIndex(const std::vector<value_type, Allocator>& intervals): 
-        records(intervals) {
-    
-        if(intervals.size() == 0) {
-            // Just make an empty IntervalIndex with no bit vectors.
-            startBits = NULL;
-            endBits = NULL;
-            return;
-        }
-    
-        if(!std::is_sorted(records.begin(), records.end())) {
-            // If not already sorted (check is O(n), sort is O(n log n))...
-            // Sort records by start, length (and then value)
-            std::sort(records.begin(), records.end());
-        }
-        
-        // What's the past-the-end position for the last interval?
-        size_t totalLength = 0;
-        if(records.size() > 0) {
-            // If we have a last interval, work that out. Grab the key and find
-            // the after-the-end position.
-            const key_type& lastKey = records[records.size() - 1].first;
-            totalLength =  lastKey.first + lastKey.second;
-        }
-        
-        // We're going to make a 1 in this bit vector at every place an interval
-        // starts. We give it a hint about how long to be.
-        startBits = new GenericBitVector(totalLength);
-        
-        for(size_t i = 0; i < records.size(); i++) {
-            // For each record
-            
-            if(i > 0 && records[i].first.first == records[i - 1].first.first) {
-                // This interval starts at the same place as the other interval,
-                // so we can ignore it in our index.
-                continue;
-            }
-            
-            // Note that this is an interval starting at this position.
-            startBits->addBit(records[i].first.first);
-            startRecords.push_back(i);
-        }
-        
-        // We're done marking start positions.
-        startBits->finish(totalLength);
-        
-        // We're going to make a similar index of end positions facing the other
-        // way, so  we need this list of end positions and interval numbers,
-        // sorted by end.
-        std::vector<std::pair<size_t, size_t>> ends;
-        
-        for(size_t i = 0; i < records.size(); i++) {
-            // Make an entry with each interval's number under its end position.
-            ends.push_back(std::make_pair(
-                records[i].first.first + records[i].first.second - 1, i));
-        }
-        
-        if(!std::is_sorted(ends.begin(), ends.end())) {
-            // Sort the interval indices by end position, if they aren't in
-            // order already.
-            std::sort(ends.begin(), ends.end());
-        }
-        
-        // We keep them in ascending order because it's not all that hard to get
-        // the rank in either direction.
-        
-        // Make the bit vector for indexing the end positions. Hint to it how
-        // long it should be.
-        endBits = new GenericBitVector(totalLength);
-        
-        for(size_t i = 0; i < ends.size(); i++) {
-            // For each end, record number pair
-            
-            if(i > 0 && ends[i].first == ends[i - 1].first) {
-                // This interval ends at the same place as the other interval,
-                // so we can ignore it in our index.
-                continue;
-            }
-            
-            // Note that this points to an interval ending at this position.
-            endBits->addBit(ends[i].first);
-            endRecords.push_back(ends[i].second);
-        }
-        
-        // Finish off the bit vector with the total length of the region we care
-        // about.
-        endBits->finish(totalLength);
-        
-    }
+    IntervalIndex(const std::vector<value_type, Allocator>& intervals,
+        bool useEytzinger = true): records(intervals.begin(), intervals.end()),
+        numStarts(0), numEnds(0), useEytzinger(useEytzinger) {
     
-    /**
-     * Clean up an IntervalIndex.
-     */
-    ~IntervalIndex() {
-        // Delete our dynamically-allocated memory.
-        if(startBits != NULL) {
-            delete startBits;
-        }
-        
-        if(endBits != NULL) {
-            delete endBits;
-        }
-    }
-
-    /**
-     * Copy an IntervalIndex.
-     */
-    IntervalIndex(const IntervalIndex& other): records(other.records),
-        startBits(other.startBist == NULL ? NULL : 
-        new GenericBitVector(*(other.startBits))),
-        startRecords(other.startRecords), 
-        endBits(other.endBits == NULL ? NULL : 
-        new GenericBitVector(*(other.endBits))), 
-        endRecords(other.endRecords) {
-        
-        // This isn't the most efficient operation, but we don't want to not
-        // allow it.
-        Log::warning() << "Copying an IntervalIndex" << std::endl;
+        build();
     }
     
     /**
-     * Move an IntervalIndex.
+     * Create a new interval index as above, taking over the given vector of
+     * intervals instead of copying it.
      */
-    IntervalIndex(IntervalIndex&& other): records(std::move(other.records)),
-        startBits(other.startBits), startRecords(std::move(other.startRecords)),
-        endBits(other.endBits), endRecords(std::move(other.endRecords)) {
+    IntervalIndex(std::vector<value_type>&& intervals,
+        bool useEytzinger = true): records(std::move(intervals)),
+        numStarts(0), numEnds(0), useEytzinger(useEytzinger) {
         
-        // Empty the moved object
-        other.startBits = NULL;
-        other.endBits = NULL;
-        other.records.clear();
-        other.startRecords.clear();
-        other.endRecords.clear();
+        build();
     }
     
     /**
-     * Replace an IntervalIndex with a copy of another.
+     * Indexes with fewer intervals than this don't build Eytzinger trees,
+     * even if asked to.
      */
-    IntervalIndex& operator=(const IntervalIndex& other) {
-        // This isn't the most efficient operation, but we don't want to not
-        // allow it.
-        Log::warning() << "Copy-assigning an IntervalIndex" << std::endl;
+    static const size_t EYTZINGER_MIN_SIZE = 256;
     
-        // Delete our dynamically-allocated memory.
-        if(startBits != NULL) {
-            delete startBits;
-        }
-        
-        if(endBits != NULL) {
-            delete endBits;
-        }
-        
-        // Copy the data
-        records = other.records;
-        startBits = other.startBist == NULL ? NULL : 
-            new GenericBitVector(*(other.startBits));
-        startRecords = other.startRecords;
-        endBits = other.endBits == NULL ? NULL : 
-            new GenericBitVector(*(other.endBits));
-        endRecords = other.endRecords;
-    }
-    
-    /**
-     * Move an IntervalIndex. Leaves the moved index in an empty state.
-     */
-    IntervalIndex& operator=(IntervalIndex&& other) {
-        // Steal their data
-        records = std::move(other.records);
-        startBits = other.startBits;
-        startRecords = std::move(other.startRecords);
-        endBits = other.endBits;
-        endRecords = std::move(other.endRecords);
-        
-        // Empty the moved object
-        other.startBits = NULL;
-        other.endBits = NULL;
-        other.records.clear();
-        other.startRecords.clear();
-        other.endRecords.clear();
-    }
+    // Everything is held by value now, so copying and moving are both fine.
+    IntervalIndex(const IntervalIndex& other) = default;
+    IntervalIndex(IntervalIndex&& other) = default;
+    IntervalIndex& operator=(const IntervalIndex& other) = default;
+    IntervalIndex& operator=(IntervalIndex&& other) = default;
     
     /**
      * How many intervals are in this IntervalIndex?
@@ -287,17 +150,8 @@ public:
      * position, and false otherwise.
      */
     bool hasStartingBefore(size_t index) const {
-        if(startBits == NULL) {
-            // Nothing is in an empty index.
-            return false;
-        }
-    
-        if(index >= startBits->getSize()) {
-            // Going too far off the end.
-            return hasStartingBefore(startBits->getSize() - 1);
-        } else {
-            return startBits->rank(index, false);
-        }
+        return countAtMost(getStartPositions(), numStarts, startTree,
+            index) > 0;
     }
     
     /**
@@ -306,14 +160,10 @@ public:
      */
     const value_type& getStartingBefore(size_t index) const {
     
-        if(index >= startBits->getSize()) {
-            // Going too far off the end.
-            return getStartingBefore(startBits->getSize() - 1);
-        }
-    
         // How many positions where intervals start are before or at that
         // position?
-        size_t rank = startBits->rank(index, false);
+        size_t rank = countAtMost(getStartPositions(), numStarts, startTree,
+            index);
         
         if(rank == 0) {
             // No interval starts before or at the given position.
@@ -322,7 +172,7 @@ public:
         }
         
         // We know we have a result, so get the record for that rank.
-        return records[startRecords[rank - 1]];
+        return records[getStartRecords()[rank - 1]];
     }
     
     /**
@@ -330,17 +180,7 @@ public:
      * and false otherwise.
      */
     bool hasEndingBefore(size_t index) const {
-        if(endBits == NULL) {
-            // Nothing is in an empty index.
-            return false;
-        }
-    
-        if(index >= endBits->getSize()) {
-            // Going too far off the end.
-            return hasEndingBefore(endBits->getSize() - 1);
-        } else {
-            return endBits->rank(index, false);
-        }
+        return countAtMost(getEndPositions(), numEnds, endTree, index) > 0;
     }
     
     /**
@@ -349,14 +189,9 @@ public:
      */
     const value_type& getEndingBefore(size_t index) const {
     
-        if(index >= endBits->getSize()) {
-            // Going too far off the end.
-            return getEndingBefore(endBits->getSize() - 1);
-        }
-    
         // How many positions where intervals end are before or at that
         // position?
-        size_t rank = endBits->rank(index, false);
+        size_t rank = countAtMost(getEndPositions(), numEnds, endTree, index);
         
         if(rank == 0) {
             // No interval ends before or at the given position.
@@ -365,7 +200,7 @@ public:
         }
         
         // We know we have a result, so get the record for that rank.
-        return records[endRecords[rank - 1]];
+        return records[getEndRecords()[rank - 1]];
     }
     
     /**
@@ -373,20 +208,9 @@ public:
      * and false otherwise.
      */
     bool hasEndingAfter(size_t index) const {
-        if(endBits == NULL) {
-            // Nothing is in an empty index.
-            return false;
-        }
-    
         // There is an interval ending at or after the given index if all of the
         // interval endpoints aren't already before the position.
-        if(index >= endBits->getSize()) {
-            // Nothing ends at or after the past-the-end position.
-            return false;
-        } else {
-            
-            return endBits->rank(index, true) - 1 < endRecords.size();
-        }
+        return countLess(getEndPositions(), numEnds, endTree, index) < numEnds;
     }
     
     /**
@@ -397,10 +221,16 @@ public:
         // How many interval ending positions are before this index? If this is
         // 0, the soonest-ending interval ending here or later will be the
         // first-ending interval, and we count up from there.
-        size_t rank = endBits->rank(index, true) - 1;
+        size_t rank = countLess(getEndPositions(), numEnds, endTree, index);
+        
+        if(rank == numEnds) {
+            // No interval ends at or after the given position.
+            throw std::runtime_error("No interval ending at or after " +
+                std::to_string(index));
+        }
         
         // Go get and return that interval.
-        return records[endRecords[rank]];
+        return records[getEndRecords()[rank]];
     }
     
     /**
@@ -408,20 +238,10 @@ public:
      * position, and false otherwise.
      */
     bool hasStartingAfter(size_t index) const {
-        if(startBits == NULL) {
-            // Nothing is in an empty index.
-            return false;
-        }
-    
         // There is an interval starting at or after the given index if all of
         // the interval start points aren't already before the position.
-        if(index >= startBits->getSize()) {
-            // Nothing starts at or after the past-the-end position.
-            return false;
-        } else {
-            
-            return startBits->rank(index, true) - 1 < startRecords.size();
-        }
+        return countLess(getStartPositions(), numStarts, startTree, index) <
+            numStarts;
     }
     
     /**
@@ -432,13 +252,295 @@ public:
         // How many interval starting positions are before this index? If this
         // is 0, the soonest-starting interval starting here or later will be
         // the first-starting interval, and we count up from there.
-        size_t rank = startBits->rank(index, true) - 1;
+        size_t rank = countLess(getStartPositions(), numStarts, startTree,
+            index);
+        
+        if(rank == numStarts) {
+            // No interval starts at or after the given position.
+            throw std::runtime_error("No interval starting at or after " +
+                std::to_string(index));
+        }
         
         // Go get and return that interval.
-        return records[startRecords[rank]];
+        return records[getStartRecords()[rank]];
+    }
+    
+    /***************************************************************************
+     * Batch queries
+     **************************************************************************/
+     
+    // These answer a whole batch of queries, which must be sorted in ascending
+    // order, in one merge-like pass over the sorted interval positions, with
+    // no searching at all. Each returns a vector with a pointer to the answer
+    // for each query, or NULL where there is no answer. Each throws a
+    // std::runtime_error if the queries are not sorted.
+    
+    /**
+     * Get the latest starting interval that starts at or before each of the
+     * given sorted indices.
+     */
+    std::vector<const value_type*> getStartingBefore(
+        const std::vector<size_t>& indices) const {
+        
+        return sweep(getStartPositions(), getStartRecords(), numStarts,
+            indices, false);
+    }
+    
+    /**
+     * Get the latest ending interval that ends at or before each of the given
+     * sorted indices.
+     */
+    std::vector<const value_type*> getEndingBefore(
+        const std::vector<size_t>& indices) const {
+        
+        return sweep(getEndPositions(), getEndRecords(), numEnds, indices,
+            false);
+    }
+    
+    /**
+     * Get the earliest starting interval that starts at or after each of the
+     * given sorted indices.
+     */
+    std::vector<const value_type*> getStartingAfter(
+        const std::vector<size_t>& indices) const {
+        
+        return sweep(getStartPositions(), getStartRecords(), numStarts,
+            indices, true);
+    }
+    
+    /**
+     * Get the earliest ending interval that ends at or after each of the given
+     * sorted indices.
+     */
+    std::vector<const value_type*> getEndingAfter(
+        const std::vector<size_t>& indices) const {
+        
+        return sweep(getEndPositions(), getEndRecords(), numEnds, indices,
+            true);
     }
      
 private:
+    /**
+     * Sort the records if needed, and fill in the table of distinct start and
+     * end positions, and the trees if we want them.
+     */
+    void build() {
+        if(records.size() == 0) {
+            // Just make an empty IntervalIndex.
+            useEytzinger = false;
+            return;
+        }
+    
+        if(!std::is_sorted(records.begin(), records.end())) {
+            // If not already sorted (check is O(n), sort is O(n log n))...
+            // Sort records by start, length (and then value)
+            std::sort(records.begin(), records.end());
+        }
+        
+        // Room for the start and end positions and record numbers, which we
+        // will trim once we know how many are distinct.
+        table.resize(records.size() * 4);
+        
+        for(size_t i = 0; i < records.size(); i++) {
+            // For each record
+            
+            if(i > 0 && records[i].first.first == records[i - 1].first.first) {
+                // This interval starts at the same place as the other interval,
+                // so we can ignore it in our index.
+                continue;
+            }
+            
+            // Note that this is an interval starting at this position.
+            table[numStarts] = records[i].first.first;
+            table[records.size() + numStarts] = i;
+            numStarts++;
+        }
+        
+        // We're going to make a similar index of end positions facing the other
+        // way, so we need this list of end positions and interval numbers,
+        // sorted by end. It's scratch space, so each thread keeps its own
+        // around between indexes.
+        static thread_local std::vector<std::pair<size_t, size_t>> ends;
+        ends.clear();
+        
+        for(size_t i = 0; i < records.size(); i++) {
+            // Make an entry with each interval's number under its end position.
+            ends.push_back(std::make_pair(
+                records[i].first.first + records[i].first.second - 1, i));
+        }
+        
+        if(!std::is_sorted(ends.begin(), ends.end())) {
+            // Sort the interval indices by end position, if they aren't in
+            // order already.
+            std::sort(ends.begin(), ends.end());
+        }
+        
+        // We keep them in ascending order because it's not all that hard to
+        // search in either direction.
+        
+        for(size_t i = 0; i < ends.size(); i++) {
+            // For each end, record number pair
+            
+            if(i > 0 && ends[i].first == ends[i - 1].first) {
+                // This interval ends at the same place as the other interval,
+                // so we can ignore it in our index.
+                continue;
+            }
+            
+            // Note that this points to an interval ending at this position.
+            table[records.size() * 2 + numEnds] = ends[i].first;
+            table[records.size() * 3 + numEnds] = ends[i].second;
+            numEnds++;
+        }
+        
+        // Pack the four arrays together, moving each down from where we left
+        // room for it.
+        auto pack = [&](size_t from, size_t to, size_t count) {
+            if(from != to) {
+                std::copy(table.begin() + from, table.begin() + from + count,
+                    table.begin() + to);
+            }
+        };
+        pack(records.size(), numStarts, numStarts);
+        pack(records.size() * 2, numStarts * 2, numEnds);
+        pack(records.size() * 3, numStarts * 2 + numEnds, numEnds);
+        table.resize(numStarts * 2 + numEnds * 2);
+        
+        if(records.size() < EYTZINGER_MIN_SIZE) {
+            // Binary search is fine at this size.
+            useEytzinger = false;
+        }
+        
+        if(useEytzinger) {
+            // Lay out the positions for searching.
+            startTree = EytzingerIndex(std::vector<size_t>(getStartPositions(),
+                getStartPositions() + numStarts));
+            endTree = EytzingerIndex(std::vector<size_t>(getEndPositions(),
+                getEndPositions() + numEnds));
+        }
+    }
+    
+    /**
+     * Get the distinct positions intervals start at, in order.
+     */
+    inline const size_t* getStartPositions() const {
+        return table.data();
+    }
+    
+    /**
+     * Get the number of some interval starting at each start position.
+     */
+    inline const size_t* getStartRecords() const {
+        return table.data() + numStarts;
+    }
+    
+    /**
+     * Get the distinct positions intervals end at (inclusive), in order.
+     */
+    inline const size_t* getEndPositions() const {
+        return table.data() + numStarts * 2;
+    }
+    
+    /**
+     * Get the number of some interval ending at each end position.
+     */
+    inline const size_t* getEndRecords() const {
+        return table.data() + numStarts * 2 + numEnds;
+    }
+    
+    /**
+     * Count the given number of sorted positions at or before the given index,
+     * using the given Eytzinger tree over them if we made trees.
+     */
+    inline size_t countAtMost(const size_t* positions, size_t count,
+        const EytzingerIndex& tree, size_t index) const {
+        
+        if(useEytzinger) {
+            return tree.countAtMost(index);
+        }
+        
+        if(count == 0) {
+            return 0;
+        }
+        // Binary search, with the comparison turned into a conditional move
+        // instead of a branch the CPU would mispredict half the time.
+        const size_t* base = positions;
+        while(count > 1) {
+            size_t half = count / 2;
+            base = base[half] <= index ? base + half : base;
+            count -= half;
+        }
+        return (base - positions) + (*base <= index);
+    }
+    
+    /**
+     * Count the given number of sorted positions strictly before the given
+     * index, using the given Eytzinger tree over them if we made trees.
+     */
+    inline size_t countLess(const size_t* positions, size_t count,
+        const EytzingerIndex& tree, size_t index) const {
+        
+        if(useEytzinger) {
+            return tree.countLess(index);
+        }
+        
+        if(count == 0) {
+            return 0;
+        }
+        // Binary search without branches, as above.
+        const size_t* base = positions;
+        while(count > 1) {
+            size_t half = count / 2;
+            base = base[half] < index ? base + half : base;
+            count -= half;
+        }
+        return (base - positions) + (*base < index);
+    }
+    
+    /**
+     * Answer a sorted batch of queries against the given number of sorted
+     * positions and the record numbers that go with them. If after is false,
+     * finds the last position at or before each query. If after is true, finds
+     * the first position at or after each query.
+     */
+    std::vector<const value_type*> sweep(const size_t* positions,
+        const size_t* positionRecords, size_t count,
+        const std::vector<size_t>& indices, bool after) const {
+        
+        std::vector<const value_type*> toReturn;
+        toReturn.reserve(indices.size());
+        
+        // How many positions are before (or, for after, strictly before) the
+        // current query? This only ever goes up.
+        size_t passed = 0;
+        
+        for(size_t i = 0; i < indices.size(); i++) {
+            if(i > 0 && indices[i] < indices[i - 1]) {
+                throw std::runtime_error("Batch queries must be sorted");
+            }
+            
+            while(passed < count && (after ?
+                positions[passed] < indices[i] :
+                positions[passed] <= indices[i])) {
+                
+                // Walk up to the query.
+                passed++;
+            }
+            
+            if(after) {
+                // Use the first position we didn't pass, if any.
+                toReturn.push_back(passed < count ?
+                    &records[positionRecords[passed]] : NULL);
+            } else {
+                // Use the last position we did pass, if any.
+                toReturn.push_back(passed > 0 ?
+                    &records[positionRecords[passed - 1]] : NULL);
+            }
+        }
+        
+        return toReturn;
+    }
+
     /**
      * Holds all the intervals and their annotations, defining a size_t index
      * for each.
@@ -446,28 +548,31 @@ private:
     std::vector<value_type> records;
     
     /**
-     * Holds a 1 at each position at which an interval starts. NULL means the
-     * IntervalIndex is empty.
+     * Holds, one after the other, each distinct position at which an interval
+     * starts, in order; the index of some interval starting at each; each
+     * distinct position at which an interval ends (inclusive), in order; and
+     * the index of some interval ending at each. Keeping them in one block
+     * saves allocations when building small indexes.
      */
-    GenericBitVector* startBits;
+    std::vector<size_t> table;
     
     /**
-     * Holds the index of some interval that starts at a position, by the
-     * position's bit rank in startBits.
+     * How many distinct start and end positions are there?
      */
-    std::vector<size_t> startRecords;
+    size_t numStarts;
+    size_t numEnds;
     
     /**
-     * Holds a 1 at each position at shich an interval ends. NULL means the
-     * IntervalIndex is empty.
+     * Should single queries use the Eytzinger trees instead of binary search?
      */
-    GenericBitVector* endBits;
+    bool useEytzinger;
     
     /**
-     * Holds the index of some interval that ends at a position, by the
-     * position's bit rank in endBits.
+     * Eytzinger-order search trees over the start and end positions, if
+     * useEytzinger is set.
      */
-    std::vector<size_t> endRecords;
+    EytzingerIndex startTree;
+    EytzingerIndex endTree;
     
 // Make friends with the output operator.
 template<typename FAnnotation, typename FAllocator>
@@ -493,31 +598,17 @@ inline std::ostream& operator<<(std::ostream& out,
     
     out << std::endl;
     
-    out << "Start and end bits:" << std::endl;
-    if(index.startBits != NULL && index.endBits != NULL) {
-        // The bit vectors are defined, because the index isn't empty.
-        
-        for(size_t i = 0; i < std::max(index.startBits->getSize(),
-            index.endBits->getSize()); i++) {
-            
-            // Dump one line per position a range could be at.
-            
-            out << i << ": ";
-            if(i < index.startBits->getSize()) {
-                out << index.startBits->isSet(i) << " ";
-            } else {
-                out << "# ";
-            }
-            
-            if(i < index.endBits->getSize()) {
-                out << index.endBits->isSet(i) << " ";
-            } else {
-                out << "# ";
-            }
-            
-            out << std::endl;
-        }
+    out << "Start positions:";
+    for(size_t i = 0; i < index.numStarts; i++) {
+        out << " " << index.getStartPositions()[i];
     }
+    out << std::endl;
+    
+    out << "End positions:";
+    for(size_t i = 0; i < index.numEnds; i++) {
+        out << " " << index.getEndPositions()[i];
+    }
+    out << std::endl;
     
     return out;
 }
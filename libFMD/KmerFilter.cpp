@@ -0,0 +1,192 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "KmerFilter.hpp"
+#include "FMDIndex.hpp"
+#include "Log.hpp"
+
+/**
+ * Get the mask with the low 2k bits set.
+ */
+static uint64_t kmerMask(size_t k) {
+    return k >= 32 ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * k)) - 1;
+}
+
+KmerFilter::KmerFilter(const FMDIndex& index, size_t k): k(k),
+    mask(kmerMask(k)), numWords(0), words(), mapping(NULL), wordData(NULL) {
+
+    if(k == 0 || k > 32) {
+        throw std::runtime_error("K-mer filter length " + std::to_string(k) +
+            " is not between 1 and 32");
+    }
+
+    if(k <= EXACT_MAX_K) {
+        // One bit per possible k-mer, at least one word.
+        numWords = std::max(((size_t) 1 << (2 * k)) / 64, (size_t) 1);
+    } else {
+        // Enough whole blocks for all the k-mers there could be, counting
+        // one strand since we only store the smaller code of each k-mer.
+        size_t kmers = 0;
+        for(size_t contig = 0; contig < index.getNumberOfContigs();
+            contig++) {
+            kmers += index.getContigLength(contig);
+        }
+        size_t blocks = std::max(kmers * BLOOM_BITS_PER_KMER /
+            (BLOCK_WORDS * 64), (size_t) 1);
+        numWords = blocks * BLOCK_WORDS;
+    }
+    words.resize(numWords, 0);
+    wordData = words.data();
+
+    Log::info() << "Building " << (k <= EXACT_MAX_K ? "exact" : "Bloom") <<
+        " filter of " << k << "-mers in " << numWords * 8 << " bytes" <<
+        std::endl;
+
+    for(size_t contig = 0; contig < index.getNumberOfContigs(); contig++) {
+        // Add every k-mer of every contig, skipping anything that isn't a
+        // base.
+        std::string sequence = index.displayContig(contig);
+        EncodedQuery encoded(sequence);
+        EncodedQuery::View view = encoded.forward();
+
+        uint64_t code = 0;
+        size_t run = 0;
+        for(size_t i = 0; i < view.size(); i++) {
+            if(view[i] == EncodedQuery::NOT_A_BASE) {
+                run = 0;
+                continue;
+            }
+            code = ((code << 2) | view[i]) & mask;
+            if(++run >= k) {
+                insert(code);
+            }
+        }
+    }
+}
+
+KmerFilter::KmerFilter(const std::string& filename): k(0), mask(0),
+    numWords(0), words(), mapping(new MappedFile(filename)), wordData(NULL) {
+
+    // The file is the magic number, k, and the word count, then the words,
+    // which can be used in place since the mapping is page-aligned.
+    const size_t* header = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+
+    if(wordCount < 3 || header[0] != MAGIC || header[1] == 0 ||
+        header[1] > 32 || header[2] == 0 || wordCount < 3 + header[2]) {
+
+        // Don't go reading off the end of a truncated or foreign file.
+        delete mapping;
+        throw std::runtime_error("Bad k-mer filter " + filename);
+    }
+
+    k = header[1];
+    mask = kmerMask(k);
+    numWords = header[2];
+    wordData = (const uint64_t*) (header + 3);
+}
+
+KmerFilter::~KmerFilter() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void KmerFilter::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    // Save the header words in platform-native byte order.
+    size_t header[3] = {MAGIC, k, numWords};
+    file.write((const char*) header, sizeof(header));
+
+    // Then the bits.
+    file.write((const char*) wordData, numWords * sizeof(uint64_t));
+
+    // Close up the file
+    file.close();
+}
+
+bool KmerFilter::mayContain(uint64_t code) const {
+    // Both strands are in the index, so look up whichever code is smaller.
+    code = std::min(code, reverseComplement(code));
+
+    if(k <= EXACT_MAX_K) {
+        return (wordData[code / 64] >> (code % 64)) & 1;
+    }
+
+    // Look in the block for the hash, at bits picked by its low bits, 9 at a
+    // time.
+    uint64_t hashed = hash(code);
+    const uint64_t* block = wordData + getBlock(hashed) * BLOCK_WORDS;
+    for(size_t i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (hashed >> (9 * i)) & 511;
+        if(!((block[bit / 64] >> (bit % 64)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KmerFilter::mayContainAll(const EncodedQuery::View& query) const {
+    uint64_t code = 0;
+    size_t run = 0;
+    for(size_t i = 0; i < query.size(); i++) {
+        uint8_t base = query[i];
+        if(base == EncodedQuery::NOT_A_BASE) {
+            run = 0;
+            continue;
+        }
+        code = ((code << 2) | base) & mask;
+        if(++run >= k && !mayContain(code)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t KmerFilter::reverseComplement(uint64_t code) const {
+    // Complement all the bases, then reverse the order of the 2-bit groups,
+    // and shift the k-mer back down to the bottom.
+    code = ~code;
+    code = ((code >> 2) & 0x3333333333333333ULL) |
+        ((code & 0x3333333333333333ULL) << 2);
+    code = ((code >> 4) & 0x0F0F0F0F0F0F0F0FULL) |
+        ((code & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    code = __builtin_bswap64(code);
+    return code >> (64 - 2 * k);
+}
+
+uint64_t KmerFilter::hash(uint64_t code) {
+    // This is the splitmix64 finalizer.
+    code ^= code >> 30;
+    code *= 0xbf58476d1ce4e5b9ULL;
+    code ^= code >> 27;
+    code *= 0x94d049bb133111ebULL;
+    code ^= code >> 31;
+    return code;
+}
+
+size_t KmerFilter::getBlock(uint64_t hashed) const {
+    // Scale the hash down to the number of blocks, which mostly uses its high
+    // bits, leaving the low bits to pick bits in the block.
+    return (size_t) (((unsigned __int128) hashed *
+        (numWords / BLOCK_WORDS)) >> 64);
+}
+
+void KmerFilter::insert(uint64_t code) {
+    code = std::min(code, reverseComplement(code));
+
+    if(k <= EXACT_MAX_K) {
+        words[code / 64] |= (uint64_t) 1 << (code % 64);
+        return;
+    }
+
+    uint64_t hashed = hash(code);
+    uint64_t* block = words.data() + getBlock(hashed) * BLOCK_WORDS;
+    for(size_t i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (hashed >> (9 * i)) & 511;
+        block[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
@@ -0,0 +1,179 @@
+#ifndef KMERFILTER_HPP
+#define KMERFILTER_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "EncodedQuery.hpp"
+#include "MappedFile.hpp"
+
+// Forward declaration for circular dependencies
+class FMDIndex;
+
+/**
+ * Defines a compact set of all the k-mers in an index, on both strands, that
+ * can say for sure that a k-mer doesn't occur, without any searching. A search
+ * whose pattern contains a k-mer that doesn't occur will come up empty, so
+ * extensions can be given up on, or charged a mismatch, early.
+ *
+ * For k of at most EXACT_MAX_K, there is one bit for every possible k-mer and
+ * the answers are exact. Otherwise the filter is a blocked Bloom filter, with
+ * all the bits for a k-mer in the same cache line, which can say a k-mer
+ * might occur when it doesn't, but never the other way around.
+ *
+ * K-mers are 2-bit codes (0, 1, 2 and 3 for A, C, G and T, as in
+ * EncodedQuery) with the first base in the highest bits. A saved filter is
+ * memory-mapped and used in place.
+ */
+class KmerFilter {
+
+public:
+    /**
+     * Build a new KmerFilter for all the k-mers of the given length in the
+     * given index, by walking all its contigs. Throws a std::runtime_error if
+     * k isn't between 1 and 32.
+     */
+    KmerFilter(const FMDIndex& index, size_t k);
+
+    /**
+     * Load a KmerFilter from the given file. Uses platform-dependent byte
+     * order and size_t size. The file is memory-mapped rather than read, and
+     * must not be modified while the KmerFilter exists.
+     */
+    KmerFilter(const std::string& filename);
+
+    /**
+     * Get rid of a KmerFilter, unmapping its file if it was loaded from one.
+     */
+    ~KmerFilter();
+
+    /**
+     * Save a KmerFilter to the given file. Uses platform-dependent byte order
+     * and size_t size.
+     */
+    void save(const std::string& filename) const;
+
+    /**
+     * Get the length of the k-mers in the filter.
+     */
+    inline size_t getK() const {
+        return k;
+    }
+
+    /**
+     * Might the k-mer with the given code occur in the index, on either
+     * strand? False means it definitely doesn't.
+     */
+    bool mayContain(uint64_t code) const;
+
+    /**
+     * Might every k-mer in the given view of a query occur in the index? False
+     * means a search for the whole view would come up empty. K-mers with
+     * anything other than bases in them aren't checked.
+     */
+    bool mayContainAll(const EncodedQuery::View& query) const;
+
+    /**
+     * Get the number of bytes the filter takes up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return words.capacity() * sizeof(uint64_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
+    }
+
+    /**
+     * What is the longest k that gets a bit for every possible k-mer? That
+     * takes 4^k bits, or 8 MB at 13.
+     */
+    static const size_t EXACT_MAX_K = 13;
+
+protected:
+    /**
+     * What word starts a saved filter?
+     */
+    static const size_t MAGIC = 0x31544c4652454d4bULL;
+
+    /**
+     * How many bits should a Bloom filter have per k-mer?
+     */
+    static const size_t BLOOM_BITS_PER_KMER = 16;
+
+    /**
+     * How many bits does a Bloom filter set for each k-mer?
+     */
+    static const size_t BLOOM_HASHES = 5;
+
+    /**
+     * How many 64-bit words are in a Bloom filter block? Blocks are a cache
+     * line.
+     */
+    static const size_t BLOCK_WORDS = 8;
+
+    /**
+     * Get the code for the reverse complement of the k-mer with the given
+     * code.
+     */
+    uint64_t reverseComplement(uint64_t code) const;
+
+    /**
+     * Mix the bits of the given canonical k-mer code to pick a block and bits
+     * in a Bloom filter.
+     */
+    static uint64_t hash(uint64_t code);
+
+    /**
+     * Get the number of the Bloom filter block for the given hash.
+     */
+    size_t getBlock(uint64_t hashed) const;
+
+    /**
+     * Add the k-mer with the given code.
+     */
+    void insert(uint64_t code);
+
+    /**
+     * How long are the k-mers?
+     */
+    size_t k;
+
+    /**
+     * Holds the mask with the low 2k bits set.
+     */
+    uint64_t mask;
+
+    /**
+     * How many words of bits are there?
+     */
+    size_t numWords;
+
+    /**
+     * Holds the bits, if we built the filter ourselves.
+     */
+    std::vector<uint64_t> words;
+
+    /**
+     * Holds the mapped file we were loaded from, if any. Owned by this
+     * object, if not null.
+     */
+    MappedFile* mapping;
+
+    /**
+     * Points to the bits, either in the vector or in the mapped file.
+     */
+    const uint64_t* wordData;
+
+private:
+    /**
+     * KmerFilters can't be copied, since they may own a mapping.
+     */
+    KmerFilter(const KmerFilter& other) = delete;
+
+    /**
+     * Or assigned.
+     */
+    KmerFilter& operator=(const KmerFilter& other) = delete;
+
+};
+
+#endif
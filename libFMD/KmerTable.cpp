@@ -0,0 +1,145 @@
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+
+#include "KmerTable.hpp"
+#include "FMDIndex.hpp"
+#include "util.hpp"
+#include "Log.hpp"
+
+/**
+ * Get the number of a base in the table's encoding (A = 0 through T = 3), or
+ * -1 if it isn't a base.
+ */
+static inline int kmerBaseNumber(char base) {
+    switch(base) {
+    case 'A':
+        return 0;
+    case 'C':
+        return 1;
+    case 'G':
+        return 2;
+    case 'T':
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+KmerTable::KmerTable(const FMDIndex& index, size_t depth): depth(depth),
+    positions(getLevelStart(depth + 1)) {
+
+    Log::info() << "Building k-mer table to depth " << depth << std::endl;
+
+    for(size_t length = 1; length <= depth; length++) {
+        // Fill in each level from the one before it.
+
+        // How many k-mers were at the last level?
+        size_t parentCount = (size_t) 1 << (2 * (length - 1));
+
+        for(size_t parent = 0; parent < parentCount; parent++) {
+            // For each k-mer one shorter, with its code...
+
+            // Work out what all the k-mers made by putting a base on its left
+            // select.
+            FMDPosition children[NUM_BASES];
+            if(length == 1) {
+                // There's nothing to extend; just look up the bases.
+                for(size_t base = 0; base < NUM_BASES; base++) {
+                    children[base] = index.getCharPosition(BASES[base]);
+                }
+            } else {
+                index.extendAll(positions[getLevelStart(length - 1) + parent],
+                    true, children);
+            }
+
+            for(size_t base = 0; base < NUM_BASES; base++) {
+                // The new base goes in front, so it is the most significant
+                // digit.
+                size_t child = parent + (kmerBaseNumber(BASES[base]) *
+                    parentCount);
+                positions[getLevelStart(length) + child] = children[base];
+            }
+        }
+    }
+}
+
+KmerTable::KmerTable(const std::string& filename): depth(0), positions() {
+    // Make a binary input stream.
+    std::ifstream file(filename, std::ifstream::binary);
+
+    if(!file.good()) {
+        throw std::runtime_error("Could not open k-mer table " + filename);
+    }
+
+    // Read the depth in platform-native byte order.
+    file.read((char*) &depth, sizeof(size_t));
+
+    // Make room for all the entries
+    positions.resize(getLevelStart(depth + 1));
+
+    for(auto& position : positions) {
+        // Read each entry as its three fields.
+        int64_t fields[3];
+        file.read((char*) fields, sizeof(fields));
+        position = FMDPosition(fields[0], fields[1], fields[2]);
+    }
+
+    if(!file.good()) {
+        throw std::runtime_error("Truncated k-mer table " + filename);
+    }
+
+    // Close up the file.
+    file.close();
+}
+
+void KmerTable::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    // Save the depth in platform-native byte order.
+    file.write((const char*) &depth, sizeof(size_t));
+
+    for(const auto& position : positions) {
+        // Write each entry as its three fields.
+        int64_t fields[3] = {position.getForwardStart(),
+            position.getReverseStart(), position.getEndOffset()};
+        file.write((const char*) fields, sizeof(fields));
+    }
+
+    // Close up the file
+    file.close();
+}
+
+bool KmerTable::lookup(const std::string& pattern, size_t start,
+    size_t length, FMDPosition& result) const {
+
+    if(length == 0 || length > depth || start + length > pattern.size()) {
+        // We don't have this length in the table.
+        return false;
+    }
+
+    // Work out the k-mer's code
+    size_t code = 0;
+    for(size_t i = start; i < start + length; i++) {
+        int baseNumber = kmerBaseNumber(pattern[i]);
+        if(baseNumber == -1) {
+            // Not something we store.
+            return false;
+        }
+        code = (code << 2) | baseNumber;
+    }
+
+    // Go get the entry.
+    result = positions[getLevelStart(length) + code];
+    return true;
+}
+
+size_t KmerTable::getLevelStart(size_t length) {
+    // There are 4 + 16 + ... + 4^(length - 1) entries in the shorter levels,
+    // which is (4^length - 4) / 3.
+    if(length == 0) {
+        return 0;
+    }
+    return ((((size_t) 1) << (2 * length)) - 4) / 3;
+}
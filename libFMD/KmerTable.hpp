@@ -0,0 +1,92 @@
+#ifndef KMERTABLE_HPP
+#define KMERTABLE_HPP
+
+#include <vector>
+#include <string>
+
+#include "FMDPosition.hpp"
+
+// Forward declaration for circular dependencies
+class FMDIndex;
+
+/**
+ * Defines a lookup table holding the full bidirectional FMDPosition for every
+ * k-mer of every length from 1 up to some maximum depth, so that searches can
+ * skip straight to that depth instead of doing one extension per base. This is
+ * like libsuffixtools' BWTIntervalCache, but for the FMDIndex.
+ *
+ * Entries for k-mers that don't occur in the index are empty, but their
+ * forward and reverse starts are unspecified.
+ *
+ * Uses 4^depth * 4 / 3 entries of 24 bytes each, so depth should be kept to at
+ * most 10 or so.
+ */
+class KmerTable {
+
+public:
+    /**
+     * Build a new KmerTable for all the k-mers in the given index of length up
+     * to and including the given depth.
+     */
+    KmerTable(const FMDIndex& index, size_t depth);
+
+    /**
+     * Load a KmerTable from the given file. Uses platform-dependent byte order
+     * and size_t size.
+     */
+    KmerTable(const std::string& filename);
+
+    /**
+     * Save a KmerTable to the given file. Uses platform-dependent byte order
+     * and size_t size.
+     */
+    void save(const std::string& filename) const;
+
+    /**
+     * Get the length of the longest k-mers in the table.
+     */
+    inline size_t getDepth() const {
+        return depth;
+    }
+
+    /**
+     * Get the number of bytes the table takes up.
+     */
+    inline size_t getMemoryUsage() const {
+        return positions.capacity() * sizeof(FMDPosition);
+    }
+
+    /**
+     * Look up the k-mer of the given length starting at the given position in
+     * the given string, and store its FMDPosition in result. Returns true if
+     * the k-mer was found in the table, or false if it was too long or
+     * contained something other than A, C, G, or T (in which case result is
+     * not modified).
+     */
+    bool lookup(const std::string& pattern, size_t start, size_t length,
+        FMDPosition& result) const;
+
+protected:
+
+    /**
+     * Get the index in positions at which the k-mers of the given length
+     * start.
+     */
+    static size_t getLevelStart(size_t length);
+
+    /**
+     * How long are the longest k-mers stored?
+     */
+    size_t depth;
+
+    /**
+     * Holds the FMDPosition for each k-mer. The k-mers of each length are
+     * stored together, from shortest to longest. Within each length, a k-mer
+     * is stored at the index obtained by reading it as a base-4 number, with
+     * its first character most significant and A = 0, C = 1, G = 2, T = 3.
+     */
+    std::vector<FMDPosition> positions;
+
+};
+
+#endif
@@ -4,16 +4,26 @@
 #include <STCommon.h>
 
 #include "Log.hpp"
+#include "util.hpp"
+#include "TaskPool.hpp"
 
 #include <iterator>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
+#include <atomic>
 
-LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings): values(), 
-    psvs(), nsvs() {
+LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings):
+    bytes(), overflowIndices(), overflowValues(), tree(), mapping(NULL),
+    length(0), numOverflows(0), numLeaves(0), byteData(NULL),
+    overflowIndexData(NULL), overflowValueData(NULL), treeData(NULL) {
+
+    // We compute into a full array of values, and then compress it.
+    std::vector<size_t> values;
 
     if(suffixArray.getSize() == 0) {
         // Just have a 0-length LCP if there are absolutely no suffixes.
+        build(values);
         return;    
     }
     
@@ -48,8 +58,8 @@ LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings): va
         // Grab the suffix as a local.
         SAElem currentSuffix = entry.first;
         
-        Log::trace() << currentSuffix << " at rank " << entry.second <<
-            std::endl;
+        LOG_TRACE(currentSuffix << " at rank " << entry.second <<
+            std::endl);
         
         if(entry.second == 0) {
             // Skip the very first because it has no predecessor
@@ -60,12 +70,12 @@ LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings): va
         // Get the suffix before this one
         SAElem prevSuffix = suffixArray.get(entry.second - 1);
         
-        Log::trace() << "LCP of " << currentSuffix << " @ " << entry.second << 
+        LOG_TRACE("LCP of " << currentSuffix << " @ " << entry.second << 
             " and " << prevSuffix <<  " @ " << entry.second - 1 << " is: " <<
-            std::endl;
+            std::endl);
         
-        Log::trace() << getFromSuffix(currentSuffix, 0, strings) << 
-            " vs. " << getFromSuffix(prevSuffix, 0, strings) << std::endl;
+        LOG_TRACE(getFromSuffix(currentSuffix, 0, strings) << 
+            " vs. " << getFromSuffix(prevSuffix, 0, strings) << std::endl);
         
         while(getFromSuffix(currentSuffix, height, strings) == 
             getFromSuffix(prevSuffix, height, strings) && 
@@ -79,16 +89,16 @@ LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings): va
             // Advance the height by 1 since we matched.
             height++;
             
-            Log::trace() << getFromSuffix(currentSuffix, height, strings) << 
+            LOG_TRACE(getFromSuffix(currentSuffix, height, strings) << 
                 " vs. " << getFromSuffix(prevSuffix, height, strings) << 
-                std::endl;
+                std::endl);
             
         }
         
         // Store the LCP value
         values[entry.second] = height;
         
-        Log::trace() << "LCP[" << entry.second << "]=" << height << std::endl;
+        LOG_TRACE("LCP[" << entry.second << "]=" << height << std::endl);
         
         if(height > 0) {
             // If height isn't 0, dial it back. Not really sure how that
@@ -102,100 +112,448 @@ LCPArray::LCPArray(const SuffixArray& suffixArray, const ReadTable& strings): va
     // Now we should have calculated the whole LCP. Reclaim some memory.
     ranks.clear(); 
     
-    Log::info() << "Scanning for PSVs" << std::endl;
+    Log::info() << "Compressing LCP and indexing block minima" << std::endl;
     
-    // OK, now we need to construct the PSV/NSV indexes. The easiest way is with
-    // scans.
-    for(size_t i = 0; i < values.size(); i++) {
-        // For each suffix. TODO: iterators?
-        
-        // What's the position of the most recent smaller value? If none is
-        // found, we'll just use 0.
-        size_t psv = 0;
+    // Make the succinct version, which can find PSVs and NSVs itself.
+    build(values);
+    
+}
+
+LCPArray::LCPArray(const BWT& bwt, size_t numThreads): bytes(),
+    overflowIndices(), overflowValues(), tree(), mapping(NULL),
+    length(bwt.getBWLen()), numOverflows(0), numLeaves(0), byteData(NULL),
+    overflowIndexData(NULL), overflowValueData(NULL), treeData(NULL) {
+    
+    // We work by breadth-first search over the BWT intervals of all the
+    // strings in the texts, shortest first. Whenever extending an interval on
+    // the left by a character produces an interval whose past-the-end row
+    // hasn't had its LCP set yet, that row's LCP is the length of the string
+    // we extended: it's the first place where rows stop sharing that string.
+    // If the past-the-end row was already set, a shorter string's interval
+    // ends in the same place, and every extension of ours would end where one
+    // of its extensions did, so we don't need to look any further.
+    //
+    // Different strings of the same length have disjoint intervals, so no two
+    // intervals in a level ever try to set the same row. That means the
+    // intervals in a level can be split up among threads, and the result is
+    // the same no matter which thread gets to a row first.
+    
+    if(numThreads < 1) {
+        numThreads = 1;
+    }
+    
+    bytes.assign(length, 0);
+    
+    // Which rows have their LCP set? The first row's is always 0. Threads set
+    // bits with atomic ors, so they can share words.
+    std::vector<std::atomic<uint64_t>> known((length + 63) / 64);
+    for(auto& word : known) {
+        word = 0;
+    }
+    if(length > 0) {
+        known[0] = 1;
+    }
+    
+    // Holds the (index, value) pairs that don't fit in a byte, for each
+    // thread, in the order it finds them.
+    std::vector<std::vector<std::pair<size_t, size_t>>> overflows(numThreads);
+    
+    // Set the LCP of the given row from the given thread, unless it's past the
+    // end or already set. Returns true if we set it.
+    auto setValue = [&](int64_t row, size_t value, size_t thread) -> bool {
+        if(row >= (int64_t) length) {
+            return false;
+        }
+        uint64_t bit = (uint64_t) 1 << (row % 64);
+        if(known[row / 64].fetch_or(bit) & bit) {
+            // It was already set.
+            return false;
+        }
+        if(value < ESCAPE) {
+            bytes[row] = value;
+        } else {
+            bytes[row] = ESCAPE;
+            overflows[thread].push_back(std::make_pair(row, value));
+        }
+        return true;
+    };
+    
+    // Each text ends with its own distinct '$', so the first rows, which are
+    // just '$' for each text, each get their own interval.
+    int64_t numTexts = bwt.getPC('A');
+    
+    // Holds the intervals of all the strings of the current length, and the
+    // ones for the next length up that each thread finds.
+    std::vector<std::pair<int64_t, int64_t>> level;
+    std::vector<std::vector<std::pair<int64_t, int64_t>>> nextLevels(
+        numThreads);
+    
+    if(length > 0) {
+        // Start with the empty string, which is everything. Extend it by each
+        // text's '$' now, since nothing else can be extended by '$'.
+        level.push_back(std::make_pair(0, length - 1));
+        for(int64_t text = 0; text < numTexts; text++) {
+            if(setValue(text + 1, 0, 0)) {
+                nextLevels[0].push_back(std::make_pair(text, text));
+            }
+        }
+    }
+    
+    // Extend the intervals in part of the current level by each base.
+    auto extendLevel = [&](size_t thread, size_t first, size_t last,
+        size_t stringLength) {
         
-        for(size_t j = i - 1; j != (size_t) -1; j--) {
-            // For each position before i in descending order (stopping on
-            // underflow)...
-            
-            if(values[j] < values[i]) {
-                // We found a smaller value.
-                psv = j;
-                break;
+        for(size_t i = first; i < last; i++) {
+            for(char base : ALPHABETICAL_BASES) {
+                int64_t start = bwt.getPC(base) +
+                    bwt.getOcc(base, level[i].first - 1);
+                int64_t end = bwt.getPC(base) +
+                    bwt.getOcc(base, level[i].second) - 1;
+                
+                if(start <= end && setValue(end + 1, stringLength, thread)) {
+                    nextLevels[thread].push_back(std::make_pair(start, end));
+                }
             }
         }
+    };
+    
+    for(size_t stringLength = 0; !level.empty(); stringLength++) {
+        // Small levels aren't worth starting threads for.
+        size_t threads = std::min(numThreads,
+            1 + level.size() / MIN_INTERVALS_PER_THREAD);
+        
+        if(threads == 1) {
+            extendLevel(0, 0, level.size(), stringLength);
+        } else {
+            parallelFor(threads, [&](size_t t) {
+                // Give each task an even share of the intervals.
+                extendLevel(t, level.size() * t / threads,
+                    level.size() * (t + 1) / threads, stringLength);
+            });
+        }
         
-        // Stick in the PSV pointer
-        psvs.push_back(psv);
+        LOG_DEBUG("Found LCPs for " << level.size() <<
+            " intervals of length " << stringLength << std::endl);
+        
+        // Move on to the next length up.
+        level.clear();
+        for(auto& nextLevel : nextLevels) {
+            level.insert(level.end(), nextLevel.begin(), nextLevel.end());
+            nextLevel.clear();
+        }
     }
     
-    // TODO: Just 1 scan?
+    // Put the overflow table in order.
+    std::vector<std::pair<size_t, size_t>> allOverflows;
+    for(const auto& threadOverflows : overflows) {
+        allOverflows.insert(allOverflows.end(), threadOverflows.begin(),
+            threadOverflows.end());
+    }
+    std::sort(allOverflows.begin(), allOverflows.end());
+    for(const auto& overflow : allOverflows) {
+        overflowIndices.push_back(overflow.first);
+        overflowValues.push_back(overflow.second);
+    }
+    numOverflows = overflowIndices.size();
     
-    Log::info() << "Scanning for NSVs" << std::endl;
+    Log::info() << "Indexing LCP block minima" << std::endl;
     
-    // Now the same for the NSV
-    for(size_t i = 0; i < values.size(); i++) {
-        // For each suffix
-        
-        // What's the position of the next smaller value? If none is found,
-        // we'll just use 1 past the end.
-        size_t nsv = values.size();
+    buildTree();
+}
+
+LCPArray::LCPArray(const std::vector<size_t>& values): bytes(),
+    overflowIndices(), overflowValues(), tree(), mapping(NULL), length(0),
+    numOverflows(0), numLeaves(0), byteData(NULL), overflowIndexData(NULL),
+    overflowValueData(NULL), treeData(NULL) {
+    
+    build(values);
+}
+
+LCPArray::LCPArray(const std::string& filename) : bytes(), overflowIndices(),
+    overflowValues(), tree(), mapping(new MappedFile(filename)), length(0),
+    numOverflows(0), numLeaves(0), byteData(NULL), overflowIndexData(NULL),
+    overflowValueData(NULL), treeData(NULL) {
+    
+    // Everything in the file is 8-byte words, except for the bytes at the end.
+    // Since the mapping is page-aligned, the words can all be used in place.
+    const size_t* words = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+    
+    if(wordCount >= 1 && words[0] == MAGIC) {
+        // This is the succinct format: the magic number, the entry count, the
+        // overflow count, and the min-tree leaf count, then the min-tree, the
+        // overflow indices, the overflow values, and the bytes.
         
-        for(size_t j = i + 1; j < values.size(); j++) {
-            // For each position after i in ascending order.
+        if(wordCount < 4 || wordCount < 4 + 2 * words[3] + 2 * words[2] ||
+            mapping->getSize() < (4 + 2 * words[3] + 2 * words[2]) *
+            sizeof(size_t) + words[1]) {
             
-            if(values[j] < values[i]) {
-                // We found a smaller value
-                nsv = j;
-                break;
-            }            
+            // Don't go reading off the end of a truncated file.
+            delete mapping;
+            throw std::runtime_error("Truncated LCP array " + filename);
         }
         
-        // Stick in the NSV pointer
-        nsvs.push_back(nsv);
+        length = words[1];
+        numOverflows = words[2];
+        numLeaves = words[3];
+        treeData = words + 4;
+        overflowIndexData = treeData + 2 * numLeaves;
+        overflowValueData = overflowIndexData + numOverflows;
+        byteData = (const uint8_t*) (overflowValueData + numOverflows);
+        
+    } else {
+        // This is the old format: the number of items, and then each of the
+        // value, PSV, and NSV arrays.
         
+        if(wordCount < 1 || wordCount < 1 + 3 * words[0]) {
+            // Don't go reading off the end of a truncated file.
+            delete mapping;
+            throw std::runtime_error("Truncated LCP array " + filename);
+        }
+        
+        // Compress the values and forget the file.
+        build(std::vector<size_t>(words + 1, words + 1 + words[0]));
+        delete mapping;
+        mapping = NULL;
+    }
+}
+
+LCPArray::~LCPArray() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void LCPArray::build(const std::vector<size_t>& values) {
+    length = values.size();
+    
+    // Make the byte array, escaping out anything that's too big.
+    bytes.resize(length);
+    for(size_t i = 0; i < length; i++) {
+        if(values[i] < ESCAPE) {
+            bytes[i] = values[i];
+        } else {
+            bytes[i] = ESCAPE;
+            overflowIndices.push_back(i);
+            overflowValues.push_back(values[i]);
+        }
+    }
+    numOverflows = overflowIndices.size();
+    
+    buildTree();
+}
+
+void LCPArray::buildTree() {
+    // Point at the values so we can read them back.
+    useVectors();
+    
+    // Make the min-tree, with a power-of-2 number of leaves.
+    size_t numBlocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    numLeaves = 1;
+    while(numLeaves < numBlocks) {
+        numLeaves *= 2;
+    }
+    tree.assign(2 * numLeaves, (size_t) -1);
+    
+    for(size_t i = 0; i < length; i++) {
+        // Min each value into its block's leaf.
+        size_t& leaf = tree[numLeaves + i / BLOCK_SIZE];
+        leaf = std::min(leaf, (*this)[i]);
+    }
+    
+    for(size_t node = numLeaves - 1; node > 0; node--) {
+        // Fill in the internal nodes from the bottom up.
+        tree[node] = std::min(tree[2 * node], tree[2 * node + 1]);
+    }
+    
+    // Queries should look in the vectors.
+    useVectors();
+}
+
+void LCPArray::useVectors() {
+    byteData = bytes.data();
+    overflowIndexData = overflowIndices.data();
+    overflowValueData = overflowValues.data();
+    treeData = tree.data();
+}
+
+size_t LCPArray::findBlockBefore(size_t block, size_t value) const {
+    // Climb the tree from the block. Whenever we are a right child, our left
+    // sibling covers the blocks just before the ones we have looked at.
+    size_t node = numLeaves + block;
+    while(node > 1) {
+        if((node & 1) && treeData[node - 1] < value) {
+            // The nearest smaller value is under the left sibling. Go down to
+            // it, preferring the rightmost child that has one.
+            node--;
+            while(node < numLeaves) {
+                node = treeData[2 * node + 1] < value ? 2 * node + 1 : 2 * node;
+            }
+            return node - numLeaves;
+        }
+        node /= 2;
+    }
+    
+    // Nothing before here is smaller.
+    return (size_t) -1;
+}
+
+size_t LCPArray::findBlockAfter(size_t block, size_t value) const {
+    // The same, but mirrored.
+    size_t node = numLeaves + block;
+    while(node > 1) {
+        if(!(node & 1) && treeData[node + 1] < value) {
+            node++;
+            while(node < numLeaves) {
+                node = treeData[2 * node] < value ? 2 * node : 2 * node + 1;
+            }
+            return node - numLeaves;
+        }
+        node /= 2;
+    }
+    
+    return (size_t) -1;
+}
+
+size_t LCPArray::getPSV(size_t index) const {
+    size_t value = (*this)[index];
+    
+    // Scan back through the rest of this block.
+    size_t blockStart = index - index % BLOCK_SIZE;
+    for(size_t j = index; j > blockStart; j--) {
+        if((*this)[j - 1] < value) {
+            return j - 1;
+        }
+    }
+    
+    if(value == 0) {
+        // Nothing can be smaller, so don't bother with the tree.
+        return 0;
+    }
+    
+    // Otherwise find the nearest block that has something smaller.
+    size_t block = findBlockBefore(index / BLOCK_SIZE, value);
+    if(block == (size_t) -1) {
+        // If no smaller value is found, we use 0.
+        return 0;
+    }
+    
+    // Scan it from the back for the smaller value.
+    for(size_t j = (block + 1) * BLOCK_SIZE; j > block * BLOCK_SIZE; j--) {
+        if((*this)[j - 1] < value) {
+            return j - 1;
+        }
+    }
+    
+    throw std::runtime_error("LCP min-tree is inconsistent");
+}
+
+size_t LCPArray::getNSV(size_t index) const {
+    size_t value = (*this)[index];
+    
+    // Scan forward through the rest of this block.
+    size_t blockEnd = std::min(index - index % BLOCK_SIZE + BLOCK_SIZE, length);
+    for(size_t j = index + 1; j < blockEnd; j++) {
+        if((*this)[j] < value) {
+            return j;
+        }
+    }
+    
+    if(value == 0) {
+        // Nothing can be smaller.
+        return length;
+    }
+    
+    size_t block = findBlockAfter(index / BLOCK_SIZE, value);
+    if(block == (size_t) -1) {
+        // If no smaller value is found, we use 1 past the end.
+        return length;
+    }
+    
+    // Scan it from the front. Blocks after ours can only run off the end of
+    // the array if they hold nothing, and then we wouldn't have found them.
+    for(size_t j = block * BLOCK_SIZE; j < std::min((block + 1) * BLOCK_SIZE,
+        length); j++) {
         
+        if((*this)[j] < value) {
+            return j;
+        }
     }
     
+    throw std::runtime_error("LCP min-tree is inconsistent");
 }
 
-LCPArray::LCPArray(const std::string& filename) : values(), psvs(), nsvs() {
-    // Make a binary input stream.
-    std::ifstream file(filename, std::ifstream::binary);
+void LCPArray::forEachInterval(
+    const std::function<void(const LCPInterval&)>& callback) const {
     
-    // This is going to hold how many items should be in each vector.
-    size_t arrayLength;
+    if(length == 0) {
+        // There isn't even a root.
+        return;
+    }
     
-    // Read the number of items in platform-native byte order.
-    file.read((char*) &arrayLength, sizeof(size_t));
+    // Keep a stack of the intervals we are inside, with their child starts
+    // so far. The end of each is the last suffix before a smaller value. The
+    // root goes at the bottom.
+    std::vector<LCPInterval> stack;
+    stack.push_back(LCPInterval{0, 0, 0, {0}});
     
-    // Resize all the vectors
-    values.resize(arrayLength);
-    psvs.resize(arrayLength);
-    nsvs.resize(arrayLength);
+    // We scan in order, so we can walk along the overflow table instead of
+    // searching it.
+    size_t nextOverflow = byteData[0] == ESCAPE ? 1 : 0;
     
-    // Read in that many elements for each vector
-    file.read((char*) &values[0], arrayLength * sizeof(size_t));
-    file.read((char*) &psvs[0], arrayLength * sizeof(size_t));
-    file.read((char*) &nsvs[0], arrayLength * sizeof(size_t));
+    for(size_t i = 1; i <= length; i++) {
+        // Get the value shared with the previous suffix. Past the end, pretend
+        // there is a 0, so everything but the root gets finished.
+        size_t value = 0;
+        if(i < length) {
+            value = byteData[i];
+            if(value == ESCAPE) {
+                value = overflowValueData[nextOverflow++];
+            }
+        }
+        
+        // Where would an interval that starts to share this value start?
+        size_t start = i - 1;
+        
+        while(value < stack.back().depth) {
+            // Everything deeper than this ends with the previous suffix.
+            stack.back().end = i - 1;
+            callback(stack.back());
+            start = stack.back().start;
+            stack.pop_back();
+        }
+        
+        if(value > stack.back().depth) {
+            // A new interval starts where the last one we finished, if any,
+            // started, and this suffix starts its second child.
+            stack.push_back(LCPInterval{value, start, 0, {start, i}});
+        } else if(i < length) {
+            // This suffix starts another child of the interval we're in.
+            stack.back().childStarts.push_back(i);
+        }
+    }
     
-    // Close up the file.
-    file.close();
+    // Now only the root is left.
+    stack.back().end = length - 1;
+    callback(stack.back());
 }
 
 void LCPArray::save(const std::string& filename) const {
     // Make a binary output stream.
     std::ofstream file(filename, std::ios::out | std::ofstream::binary);
     
-    // Grab the array length as a local
-    size_t arrayLength = values.size();
+    // Save the header words in platform-native byte order.
+    size_t header[4] = {MAGIC, length, numOverflows, numLeaves};
+    file.write((const char*) header, sizeof(header));
     
-    // Save the array length in platform-native byte order.
-    file.write((char*) &arrayLength, sizeof(size_t));
+    // Then the min-tree and overflow table.
+    file.write((const char*) treeData, 2 * numLeaves * sizeof(size_t));
+    file.write((const char*) overflowIndexData, numOverflows * sizeof(size_t));
+    file.write((const char*) overflowValueData, numOverflows * sizeof(size_t));
     
-    // Read in that many elements for each vector
-    file.write((char*) &values[0], arrayLength * sizeof(size_t));
-    file.write((char*) &psvs[0], arrayLength * sizeof(size_t));
-    file.write((char*) &nsvs[0], arrayLength * sizeof(size_t));
+    // And finally the bytes.
+    file.write((const char*) byteData, length);
     
     // Close up the file
     file.close();
@@ -3,12 +3,46 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
 
 // Depend on the libsuffixtools stuff.
 #include <ReadTable.h>
 #include <SuffixArray.h>
+#include <BWT.h>
 
 #include "Log.hpp"
+#include "MappedFile.hpp"
+
+/**
+ * Describes an LCP interval: a run of suffixes that all share a prefix of a
+ * certain length, and that can't be made longer without sharing less. These
+ * are the internal nodes of the suffix tree.
+ */
+struct LCPInterval {
+    /**
+     * The string depth of the node: the length of the shared prefix.
+     */
+    size_t depth;
+    
+    /**
+     * The first suffix in the interval.
+     */
+    size_t start;
+    
+    /**
+     * The last suffix in the interval, inclusive.
+     */
+    size_t end;
+    
+    /**
+     * Where each child interval starts, in order, starting with start. Each
+     * child runs up to just before the next one, and the last child runs to
+     * end. Children of a single suffix are leaves.
+     */
+    std::vector<size_t> childStarts;
+};
 
 /**
  * Defines an array suitable for holding Longest Common Prefix information
@@ -16,8 +50,17 @@
  * queries for the position of the next or previous smaller value from any
  * position.
  *
- * This particular implementation stores a full index, and so will use an
- * inordinately large amount of space.
+ * Values are stored one byte each, with the rare values that don't fit in a
+ * byte kept in a sorted overflow table. Previous and next smaller values are
+ * found by scanning the query's block of BLOCK_SIZE values, and otherwise by
+ * using a min-tree over the block minima to find the nearest block holding a
+ * smaller value, in O(BLOCK_SIZE + log n) time. Altogether that's about 1.25
+ * bytes per position, instead of the 24 it takes to store the PSV and NSV
+ * arrays outright.
+ *
+ * A saved LCPArray is memory-mapped and used in place. Files in the old
+ * format, with full value, PSV, and NSV arrays, can still be loaded, but get
+ * converted in memory.
  */
 class LCPArray {
 
@@ -31,12 +74,37 @@ public:
      */
     LCPArray(const SuffixArray& suffixArray, const ReadTable& strings);
     
+    /**
+     * Create a new LCPArray by building it from the given BWT alone, using
+     * the algorithm of Beller et al. 2013: "Computing the longest common
+     * prefix array based on the Burrows-Wheeler transform". Needs neither the
+     * suffix array nor the texts, just a byte and a bit per BWT position, and
+     * the intervals of one LCP value at a time.
+     *
+     * The intervals for each LCP value are split up among the given number of
+     * threads.
+     *
+     * The BWT is not needed after the constructor returns.
+     */
+    LCPArray(const BWT& bwt, size_t numThreads = 1);
+    
+    /**
+     * Create a new LCPArray holding the given LCP values.
+     */
+    LCPArray(const std::vector<size_t>& values);
+    
     /**
      * Load an LCPArray from the given file. Uses platform-dependent byte
-     * order and size_t size.
+     * order and size_t size. The file is memory-mapped rather than read, and
+     * must not be modified while the LCPArray exists.
      */
     LCPArray(const std::string& filename);
     
+    /**
+     * Get rid of an LCPArray, unmapping its file if it was loaded from one.
+     */
+    ~LCPArray();
+    
     /**
      * Save an LCPArray to the given file. Uses platform-dependent byte order
      * and size_t size.
@@ -44,27 +112,81 @@ public:
     void save(const std::string& filename) const;
     
     /**
-     * Get the longest common prefix value at a given index.
+     * Get the number of entries in the LCP array.
      */
-    inline size_t operator[](size_t index) const {
-        return values[index];
+    inline size_t getSize() const {
+        return length;
     }
     
     /**
-     * Get the index of the previous smaller value before the given index.
+     * Get the number of bytes the LCP array takes up, in memory or mapped.
      */
-    inline size_t getPSV(size_t index) const {
-        return psvs[index];
+    inline size_t getMemoryUsage() const {
+        return bytes.capacity() + (overflowIndices.capacity() +
+            overflowValues.capacity() + tree.capacity()) * sizeof(size_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
     }
     
     /**
-     * Get the index of the next smaller value after the given index.
+     * Get the longest common prefix value at a given index.
      */
-    inline size_t getNSV(size_t index) const {
-        return nsvs[index];
+    inline size_t operator[](size_t index) const {
+        uint8_t small = byteData[index];
+        if(small != ESCAPE) {
+            return small;
+        }
+        
+        // Otherwise it's in the overflow table, sorted by index.
+        const size_t* found = std::lower_bound(overflowIndexData,
+            overflowIndexData + numOverflows, index);
+        return overflowValueData[found - overflowIndexData];
     }
+    
+    /**
+     * Get the index of the previous smaller value before the given index, or 0
+     * if there is no smaller value before it.
+     */
+    size_t getPSV(size_t index) const;
+    
+    /**
+     * Get the index of the next smaller value after the given index, or the
+     * size of the array if there is no smaller value after it.
+     */
+    size_t getNSV(size_t index) const;
+    
+    /**
+     * Call the given function with every LCP interval, bottom-up, so each
+     * interval comes after all of the intervals inside it. Takes one linear
+     * scan with a stack, instead of a search down from the top for each
+     * node. The last interval is always the root, covering everything at depth
+     * 0.
+     */
+    void forEachInterval(
+        const std::function<void(const LCPInterval&)>& callback) const;
 
 protected:
+    /**
+     * How many values go in each block of the min-tree?
+     */
+    static const size_t BLOCK_SIZE = 64;
+    
+    /**
+     * What byte value says an entry is in the overflow table?
+     */
+    static const uint8_t ESCAPE = 255;
+    
+    /**
+     * How many intervals should each thread get, at least, when building from
+     * a BWT?
+     */
+    static const size_t MIN_INTERVALS_PER_THREAD = 1024;
+    
+    /**
+     * What word starts a file in the succinct format? Never a plausible entry
+     * count for a file in the old format.
+     */
+    static const size_t MAGIC = 0x31435543535043ULL;
+    
     // TODO: Should these helpers go on the increasingly inaccurately named
     // ReadTable?
 
@@ -97,14 +219,76 @@ protected:
         
     }
     
-    // Store all the LCP array entries.
-    std::vector<size_t> values;
+    /**
+     * Fill in the byte array, overflow table, and min-tree from the given full
+     * array of values.
+     */
+    void build(const std::vector<size_t>& values);
+    
+    /**
+     * Fill in the min-tree from the byte array and overflow table, once they
+     * have been filled in.
+     */
+    void buildTree();
+    
+    /**
+     * Point the data pointers at the vectors, once they have been filled in.
+     */
+    void useVectors();
+    
+    /**
+     * Find the last block before the given block with a value less than the
+     * given value, or -1 if there isn't one.
+     */
+    size_t findBlockBefore(size_t block, size_t value) const;
+    
+    /**
+     * Find the first block after the given block with a value less than the
+     * given value, or -1 if there isn't one.
+     */
+    size_t findBlockAfter(size_t block, size_t value) const;
+    
+    // Store the LCP values of at most 254 as bytes, if we built them
+    // ourselves. Larger values are replaced with ESCAPE.
+    std::vector<uint8_t> bytes;
+    
+    // Store the indices of the values that didn't fit, in order.
+    std::vector<size_t> overflowIndices;
+    
+    // And the values themselves.
+    std::vector<size_t> overflowValues;
+    
+    // Store a min-tree over block minima. Node 1 is the root, node i has
+    // children 2i and 2i + 1, and the leaves start at numLeaves. Leaves past
+    // the last block hold the largest possible value.
+    std::vector<size_t> tree;
+    
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+    
+    // How many entries are there?
+    size_t length;
+    
+    // How many values are in the overflow table?
+    size_t numOverflows;
+    
+    // How many leaves does the min-tree have? Always a power of 2.
+    size_t numLeaves;
+    
+    // Point to the bytes, overflow table, and min-tree, either in the vectors
+    // or in the mapped file.
+    const uint8_t* byteData;
+    const size_t* overflowIndexData;
+    const size_t* overflowValueData;
+    const size_t* treeData;
     
-    // Store the index of the previous smaller value for each position.
-    std::vector<size_t> psvs;
+private:
+    // LCPArrays can't be copied, since they may own a mapping.
+    LCPArray(const LCPArray& other) = delete;
     
-    // Store the index of the next smaller value for each position.
-    std::vector<size_t> nsvs;
+    // Or assigned.
+    LCPArray& operator=(const LCPArray& other) = delete;
     
 };
 
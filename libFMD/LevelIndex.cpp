@@ -0,0 +1,131 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "LevelIndex.hpp"
+
+// We use positions and inverted positions in place in the file, so they had
+// better be laid out as whole words.
+static_assert(sizeof(TextPosition) == 2 * sizeof(uint64_t),
+    "TextPosition must be a (text, offset) pair of words");
+static_assert(sizeof(std::pair<TextPosition, size_t>) ==
+    3 * sizeof(uint64_t),
+    "Inverted positions must be (text, offset, range) triples of words");
+
+/**
+ * Pad the given stream with 0s up to the next section boundary.
+ */
+static void padToSection(std::ofstream& file) {
+    size_t position = file.tellp();
+    while(position % LevelIndex::SECTION_ALIGNMENT != 0) {
+        file.put(0);
+        position++;
+    }
+}
+
+LevelIndex::LevelIndex(const std::string& filename):
+    mapping(new MappedFile(filename)), ranges(NULL), bwtLength(0),
+    positions(NULL), positionCount(0), invertedPositions(NULL),
+    invertedCount(0) {
+
+    const uint64_t* header = (const uint64_t*) mapping->getData();
+    size_t size = mapping->getSize();
+
+    // Pull out the header, if there is one.
+    bool good = size >= HEADER_WORDS * sizeof(uint64_t) &&
+        header[0] == MAGIC && header[1] == VERSION;
+    size_t rangesOffset = good ? header[5] : 0;
+    size_t positionsOffset = good ? header[6] : 0;
+    size_t invertedOffset = good ? header[7] : 0;
+
+    if(good) {
+        bwtLength = header[2];
+        positionCount = header[3];
+        invertedCount = header[4];
+
+        // Make sure all the sections are where they should be, so we don't go
+        // reading off the end of a truncated file.
+        good = rangesOffset >= HEADER_WORDS * sizeof(uint64_t) &&
+            positionsOffset % SECTION_ALIGNMENT == 0 &&
+            invertedOffset % SECTION_ALIGNMENT == 0 &&
+            rangesOffset < positionsOffset &&
+            positionsOffset + positionCount * sizeof(TextPosition) <=
+            invertedOffset &&
+            invertedOffset + invertedCount *
+            sizeof(std::pair<TextPosition, size_t>) == size;
+    }
+
+    if(!good) {
+        delete mapping;
+        throw std::runtime_error("Bad level index " + filename);
+    }
+
+    positions = (const TextPosition*) (mapping->getData() + positionsOffset);
+    invertedPositions = (const std::pair<TextPosition, size_t>*)
+        (mapping->getData() + invertedOffset);
+
+    // Read the range bitvector out of its section.
+    std::ifstream stream(filename.c_str(), std::ios::binary);
+    stream.seekg(rangesOffset);
+    ranges = new GenericBitVector(stream);
+
+    if(!stream) {
+        delete ranges;
+        delete mapping;
+        throw std::runtime_error("Could not read ranges from level index " +
+            filename);
+    }
+}
+
+LevelIndex::~LevelIndex() {
+    // Get rid of the bitvector and unmap the file.
+    delete ranges;
+    delete mapping;
+}
+
+void LevelIndex::save(const std::string& filename, size_t bwtLength,
+    const GenericBitVector& ranges, const TextPosition* positions,
+    size_t positionCount,
+    const std::pair<TextPosition, size_t>* invertedPositions,
+    size_t invertedCount) {
+
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    if(invertedPositions == nullptr) {
+        // There are no inverted positions to save.
+        invertedCount = 0;
+    }
+
+    // Leave room for the header, which we fill in once we know where
+    // everything went.
+    uint64_t header[HEADER_WORDS] = {MAGIC, VERSION, bwtLength, positionCount,
+        invertedCount, 0, 0, 0};
+    file.write((const char*) header, sizeof(header));
+
+    // Save the ranges.
+    padToSection(file);
+    header[5] = file.tellp();
+    ranges.writeTo(file);
+
+    // Then the positions, as they are in memory.
+    padToSection(file);
+    header[6] = file.tellp();
+    file.write((const char*) positions, positionCount * sizeof(TextPosition));
+
+    // And the inverted positions, if any.
+    padToSection(file);
+    header[7] = file.tellp();
+    file.write((const char*) invertedPositions,
+        invertedCount * sizeof(std::pair<TextPosition, size_t>));
+
+    // Go back and fill in the header.
+    file.seekp(0);
+    file.write((const char*) header, sizeof(header));
+
+    // Close up the file
+    file.close();
+
+    if(!file) {
+        throw std::runtime_error("Could not write level index " + filename);
+    }
+}
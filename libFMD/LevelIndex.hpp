@@ -0,0 +1,154 @@
+#ifndef LEVELINDEX_HPP
+#define LEVELINDEX_HPP
+
+#include <string>
+#include <utility>
+#include <cstdint>
+
+#include "GenericBitVector.hpp"
+#include "TextPosition.hpp"
+#include "MappedFile.hpp"
+
+/**
+ * Represents a merged level of an FMDIndex saved to disk: the bitvector of
+ * merged range starts in BWT order, the position each range is merged into,
+ * and, optionally, the inverse of that, sorted by position. An FMDIndexView
+ * can be made directly over a loaded LevelIndex, so a merged level can be
+ * mapped to without recomputing it.
+ *
+ * The file is memory-mapped, and the position arrays are used in place. Only
+ * the range bitvector is read into memory, since it is small.
+ *
+ * The file starts with a header of 64-bit words in platform-native byte order:
+ * a magic number, a format version, the BWT length the level is for, the
+ * numbers of positions and inverted positions, and the byte offsets of the
+ * range bitvector, position array, and inverted position array. Each section
+ * starts on a SECTION_ALIGNMENT boundary. Positions are (text, offset) word
+ * pairs, and inverted positions are (text, offset, range number) word
+ * triples.
+ */
+class LevelIndex {
+
+public:
+    /**
+     * Load a LevelIndex from the given file. The file is memory-mapped rather
+     * than read, and must not be modified while the LevelIndex exists. Throws a
+     * std::runtime_error if the file isn't a level index of this version.
+     */
+    LevelIndex(const std::string& filename);
+
+    /**
+     * Get rid of a LevelIndex, unmapping its file.
+     */
+    ~LevelIndex();
+
+    /**
+     * Save a level index to the given file, for an index with the given BWT
+     * length. Takes the ranges bitvector, which must be finished, the position
+     * for each range, and optionally the sorted inverted positions (which may
+     * be null if there are none).
+     */
+    static void save(const std::string& filename, size_t bwtLength,
+        const GenericBitVector& ranges, const TextPosition* positions,
+        size_t positionCount,
+        const std::pair<TextPosition, size_t>* invertedPositions,
+        size_t invertedCount);
+
+    /**
+     * What BWT length was the level made for?
+     */
+    inline size_t getBWTLength() const {
+        return bwtLength;
+    }
+
+    /**
+     * Get the bitvector with 1s at the starts of merged ranges.
+     */
+    inline const GenericBitVector& getRanges() const {
+        return *ranges;
+    }
+
+    /**
+     * Get the positions assigned to ranges, in range number order.
+     */
+    inline const TextPosition* getPositions() const {
+        return positions;
+    }
+
+    /**
+     * How many ranges have assigned positions?
+     */
+    inline size_t getPositionCount() const {
+        return positionCount;
+    }
+
+    /**
+     * Were inverted positions saved?
+     */
+    inline bool hasInvertedPositions() const {
+        return invertedCount != 0;
+    }
+
+    /**
+     * Get the (position, range number) pairs for all the ranges, sorted, if
+     * they were saved.
+     */
+    inline const std::pair<TextPosition, size_t>* getInvertedPositions()
+        const {
+
+        return invertedPositions;
+    }
+
+    /**
+     * How many inverted positions are there?
+     */
+    inline size_t getInvertedCount() const {
+        return invertedCount;
+    }
+
+    /**
+     * What version of the format do we read and write?
+     */
+    static const uint64_t VERSION = 1;
+
+    /**
+     * What byte boundary does each section start on? One cache line.
+     */
+    static const size_t SECTION_ALIGNMENT = 64;
+
+protected:
+    /**
+     * What word starts a saved level index?
+     */
+    static const uint64_t MAGIC = 0x314c56454c444d46ULL;
+
+    /**
+     * How many words are in the header?
+     */
+    static const size_t HEADER_WORDS = 8;
+
+    // Holds the mapped file we were loaded from.
+    MappedFile* mapping;
+
+    // Holds the range bitvector, read from the file.
+    GenericBitVector* ranges;
+
+    // What BWT length is the level for?
+    size_t bwtLength;
+
+    // Point to the position arrays in the mapped file.
+    const TextPosition* positions;
+    size_t positionCount;
+    const std::pair<TextPosition, size_t>* invertedPositions;
+    size_t invertedCount;
+
+private:
+    // LevelIndexes can't be copied, since they own a mapping.
+    LevelIndex(const LevelIndex& other) = delete;
+
+    // Or assigned.
+    LevelIndex& operator=(const LevelIndex& other) = delete;
+
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "LevelMapper.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "TaskPool.hpp"
+
+LevelMapper::LevelMapper(const FMDIndex& index,
+    const std::string& levelFilename): index(index),
+    level(levelFilename.empty() ? nullptr : new LevelIndex(levelFilename)),
+    scheme(nullptr) {
+    
+    scheme = new NaturalMappingScheme(level != nullptr ?
+        FMDIndexView(index, nullptr, *level) : FMDIndexView(index));
+}
+
+LevelMapper::~LevelMapper() {
+    // The scheme's view uses the level, so it has to go first.
+    delete scheme;
+    delete level;
+}
+
+LevelMapper& LevelMapper::open(const std::string& basename,
+    const std::string& levelFilename) {
+    
+    // Everything opened so far, by basename and level. These are never freed,
+    // so they can't go away at exit while some other thread is still mapping.
+    static std::mutex mutex;
+    static auto* opened = new std::map<std::pair<std::string, std::string>,
+        LevelMapper*>();
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    auto key = std::make_pair(basename, levelFilename);
+    auto found = opened->find(key);
+    if(found != opened->end()) {
+        return *found->second;
+    }
+    
+    // Load the index for good, and make a mapper for it. If the mapper can't
+    // be made, don't keep the index.
+    std::unique_ptr<FMDIndex> index(new FMDIndex(basename));
+    LevelMapper* mapper = new LevelMapper(*index, levelFilename);
+    index.release();
+    (*opened)[key] = mapper;
+    
+    return *mapper;
+}
+
+void LevelMapper::setMinContext(size_t minContext) {
+    scheme->minContext = minContext;
+}
+
+void LevelMapper::setMismatches(size_t mismatches) {
+    scheme->z_max = mismatches;
+}
+
+void LevelMapper::setCredit(bool credit) {
+    scheme->credit = credit;
+}
+
+size_t LevelMapper::mapSides(const std::string& query, long long* sides,
+    size_t length) const {
+    
+    if(length < query.size()) {
+        throw std::runtime_error("No room for " +
+            std::to_string(query.size()) + " sides in " +
+            std::to_string(length));
+    }
+    
+    return mapInto(query, sides);
+}
+
+size_t LevelMapper::mapBatch(const char* bases, size_t basesLength,
+    const long long* offsets, size_t offsetsLength, long long* sides,
+    size_t sidesLength) const {
+    
+    if(offsetsLength == 0) {
+        // There's not even an end.
+        return 0;
+    }
+    
+    for(size_t i = 0; i < offsetsLength; i++) {
+        if(offsets[i] < (i == 0 ? 0 : offsets[i - 1]) ||
+            (size_t) offsets[i] > std::min(basesLength, sidesLength)) {
+            
+            throw std::runtime_error("Bad query offset " +
+                std::to_string(offsets[i]) + " at " + std::to_string(i));
+        }
+    }
+    
+    // Split the queries evenly among the workers.
+    size_t queries = offsetsLength - 1;
+    size_t pieces = std::max(std::min(queries, TaskPool::global().getSize()),
+        (size_t) 1);
+    std::atomic<size_t> mapped(0);
+    parallelFor(pieces, [&](size_t piece) {
+        for(size_t i = queries * piece / pieces;
+            i < queries * (piece + 1) / pieces; i++) {
+            
+            std::string query(bases + offsets[i], offsets[i + 1] - offsets[i]);
+            mapped += mapInto(query, sides + offsets[i]);
+        }
+    });
+    
+    return mapped;
+}
+
+size_t LevelMapper::mapInto(const std::string& query, long long* sides) const {
+    std::fill(sides, sides + query.size(), -1);
+    
+    size_t mapped = 0;
+    scheme->map(query, [&](size_t i, TextPosition base) {
+        // Pack the base ID and the face together.
+        sides[i] = ((long long) index.getBaseID(base) << 1) |
+            (index.getStrand(base) ? 1 : 0);
+        mapped++;
+    });
+    
+    return mapped;
+}
@@ -0,0 +1,121 @@
+#ifndef LEVELMAPPER_HPP
+#define LEVELMAPPER_HPP
+
+#include <string>
+
+#include "FMDIndex.hpp"
+#include "LevelIndex.hpp"
+#include "NaturalMappingScheme.hpp"
+
+/**
+ * Maps whole queries against the bottom level of an FMDIndex, or a merged level
+ * saved by createIndex, in one call. Meant for the Java bindings: results come
+ * back in a plain array of integers instead of one wrapped object per base, so
+ * a query only crosses into native code once.
+ *
+ * Each base's result is packed the way createIndex packs Sides: the ID of the
+ * base it mapped to (as from FMDIndex::getBaseID()) shifted left one, with the
+ * low bit set if it mapped to the reverse strand, which is the right face. A
+ * base that doesn't map gets -1.
+ */
+class LevelMapper {
+
+public:
+    /**
+     * Make a new LevelMapper for the given index, mapping to the merged level
+     * saved in the given file, or to the bottom level if no file is given. The
+     * index must outlive the LevelMapper.
+     */
+    LevelMapper(const FMDIndex& index, const std::string& levelFilename = "");
+    
+    /**
+     * Get rid of a LevelMapper, and the level it loaded.
+     */
+    ~LevelMapper();
+    
+    /**
+     * Get the LevelMapper shared by the whole process for the index with the
+     * given basename, mapping to the merged level in the given file, or to the
+     * bottom level if no file is given. The first call for each index and
+     * level loads them, and later calls from any thread get the same
+     * LevelMapper, so a process only ever holds one copy. Shared LevelMappers
+     * last until the process exits.
+     *
+     * Mapping doesn't lock, so parameters of a shared LevelMapper should only
+     * be set before it is used from more than one thread.
+     */
+    static LevelMapper& open(const std::string& basename,
+        const std::string& levelFilename = "");
+    
+    /**
+     * Set the minimum number of bases of context a base needs to map.
+     */
+    void setMinContext(size_t minContext);
+    
+    /**
+     * Set the number of mismatches to tolerate in each maximal match.
+     */
+    void setMismatches(size_t mismatches);
+    
+    /**
+     * Set whether bases that don't map on their own may map on credit from
+     * their neighbors.
+     */
+    void setCredit(bool credit);
+    
+    /**
+     * Map the given query, and fill in the packed Side for each of its bases in
+     * sides, which must have room for at least length of them. Throws a
+     * std::runtime_error if it doesn't have room for the whole query. Returns
+     * the number of bases that mapped.
+     */
+    size_t mapSides(const std::string& query, long long* sides,
+        size_t length) const;
+    
+    /**
+     * Map a batch of queries, given as ASCII bases all run together, with
+     * offsets giving where each query starts and then where the last one ends.
+     * Fills in the packed Side for each base at the same place in sides, which
+     * must be at least as long as the bases used. Queries are mapped in
+     * parallel on the shared TaskPool. Throws a std::runtime_error if the
+     * offsets go backward or past the end of bases or sides. Returns the
+     * number of bases that mapped.
+     *
+     * From Java, all three are direct NIO buffers (ByteBuffer, LongBuffer, and
+     * LongBuffer), used in place, so a whole partition of reads can be mapped
+     * without copying it. The LongBuffers must be in native byte order.
+     */
+    size_t mapBatch(const char* bases, size_t basesLength,
+        const long long* offsets, size_t offsetsLength, long long* sides,
+        size_t sidesLength) const;
+    
+protected:
+    /**
+     * Map the given query and put its packed Sides at the given place, which
+     * must have room for all of them. Returns the number of bases that
+     * mapped.
+     */
+    size_t mapInto(const std::string& query, long long* sides) const;
+    
+    // What index are we mapping to?
+    const FMDIndex& index;
+    
+    // Holds the merged level we loaded, if any.
+    LevelIndex* level;
+    
+    // Holds the scheme we map with.
+    NaturalMappingScheme* scheme;
+    
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    LevelMapper(const LevelMapper& other) = delete;
+    
+    /**
+     * No assignment operator either.
+     */
+    LevelMapper& operator=(const LevelMapper& other) = delete;
+};
+
+#endif
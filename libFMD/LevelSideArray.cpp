@@ -0,0 +1,25 @@
+#include "LevelSideArray.hpp"
+
+#include <stdexcept>
+
+LevelSideArray::LevelSideArray(const FMDIndex& index,
+    const std::string& levelFilename): index(index), level(levelFilename) {
+    
+    if(level.getBWTLength() != (size_t) index.getBWTLength()) {
+        throw std::runtime_error("Level in " + levelFilename +
+            " is not for an index with BWT length " +
+            std::to_string(index.getBWTLength()));
+    }
+}
+
+long long LevelSideArray::get(size_t range) const {
+    if(range >= level.getPositionCount()) {
+        throw std::out_of_range("Range " + std::to_string(range) +
+            " beyond level with " + std::to_string(level.getPositionCount()) +
+            " ranges");
+    }
+    
+    TextPosition base = level.getPositions()[range];
+    return ((long long) index.getBaseID(base) << 1) |
+        (index.getStrand(base) ? 1 : 0);
+}
@@ -0,0 +1,61 @@
+#ifndef LEVELSIDEARRAY_HPP
+#define LEVELSIDEARRAY_HPP
+
+#include <string>
+
+#include "FMDIndex.hpp"
+#include "LevelIndex.hpp"
+
+/**
+ * Looks up the Side each range of a saved merged level is merged into, for the
+ * Java bindings. The level index file is memory-mapped, so a lookup is a
+ * bounds check and a read from the position array in place, instead of a seek
+ * and a read on a file.
+ *
+ * Sides come packed the way createIndex packs them: the ID of the base (as from
+ * FMDIndex::getBaseID()) shifted left one, with the low bit set for the right
+ * face, which is the reverse strand.
+ */
+class LevelSideArray {
+
+public:
+    /**
+     * Load the merged level saved in the given file, for the given index,
+     * which must outlive the LevelSideArray. Throws a std::runtime_error if the
+     * level isn't a level index for an index with the same BWT length.
+     */
+    LevelSideArray(const FMDIndex& index, const std::string& levelFilename);
+    
+    /**
+     * Get the number of ranges in the level.
+     */
+    inline size_t getLength() const {
+        return level.getPositionCount();
+    }
+    
+    /**
+     * Get the packed Side for the range with the given 0-based number. Throws
+     * a std::out_of_range if there is no such range.
+     */
+    long long get(size_t range) const;
+    
+protected:
+    // What index is the level over?
+    const FMDIndex& index;
+    
+    // Holds the level itself, mapped in.
+    LevelIndex level;
+    
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    LevelSideArray(const LevelSideArray& other) = delete;
+    
+    /**
+     * No assignment operator either.
+     */
+    LevelSideArray& operator=(const LevelSideArray& other) = delete;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include "LocateCache.hpp"
+
+LocateCache::LocateCache(size_t entries): slots(), slotCount(0), stats(),
+    hits(stats.counter("locateCache:hits")),
+    misses(stats.counter("locateCache:misses")) {
+
+    resize(entries);
+}
+
+void LocateCache::resize(size_t entries) {
+    // Round down to a power of 2, so rows can be assigned to slots by their
+    // low bits.
+    size_t count = 0;
+    if(entries > 0) {
+        count = (size_t) 1 << (63 - __builtin_clzll(entries));
+    }
+
+    slots.reset(count > 0 ? new Slot[count] : nullptr);
+    for(size_t i = 0; i < count; i++) {
+        // Start out with every slot readable, holding a row that can't be
+        // asked for.
+        slots[i].sequence.store(0, std::memory_order_relaxed);
+        slots[i].row.store(-1, std::memory_order_relaxed);
+        slots[i].text.store(0, std::memory_order_relaxed);
+        slots[i].offset.store(0, std::memory_order_relaxed);
+    }
+    slotCount = count;
+}
@@ -0,0 +1,170 @@
+#ifndef LOCATECACHE_HPP
+#define LOCATECACHE_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include "TextPosition.hpp"
+#include "StatTracker.hpp"
+
+/**
+ * Defines a direct-mapped cache of located BWT rows, for FMDIndex to check
+ * before walking a row back to a suffix array sample. Merge mapping locates
+ * the same rows over and over, and each walk costs many LF steps.
+ *
+ * Each row can only go in one slot, picked by its low bits, and a newly
+ * located row just replaces whatever was there. Slots are guarded by their own
+ * sequence numbers instead of locks: a writer makes the number odd while it
+ * fills the slot in, and a reader only believes what it read if the number
+ * was even and didn't change. A writer that finds a slot already being
+ * written just doesn't cache its row, so nobody ever waits.
+ *
+ * Hits and misses are counted in a StatTracker, as "locateCache:hits" and
+ * "locateCache:misses".
+ */
+class LocateCache {
+
+public:
+    /**
+     * Make a new LocateCache with room for about the given number of rows,
+     * rounded down to a power of 2. A cache with no room caches nothing.
+     */
+    LocateCache(size_t entries = 0);
+
+    /**
+     * If the given row is cached, put its position in found and return true.
+     * Otherwise return false. Thread safe.
+     */
+    inline bool get(int64_t row, TextPosition& found) const {
+        if(slotCount == 0) {
+            return false;
+        }
+
+        const Slot& slot = slots[row & (slotCount - 1)];
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if((before & 1) == 0 &&
+            slot.row.load(std::memory_order_relaxed) == row) {
+
+            size_t text = slot.text.load(std::memory_order_relaxed);
+            size_t offset = slot.offset.load(std::memory_order_relaxed);
+
+            // Make sure the slot wasn't rewritten while we read it.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.sequence.load(std::memory_order_relaxed) == before) {
+                found = TextPosition(text, offset);
+                hits.add(1);
+                return true;
+            }
+        }
+        misses.add(1);
+        return false;
+    }
+
+    /**
+     * Remember the position of the given row, replacing whatever row was in
+     * its slot, unless someone else is writing the slot right now. Thread
+     * safe.
+     */
+    inline void put(int64_t row, const TextPosition& position) const {
+        if(slotCount == 0) {
+            return;
+        }
+
+        Slot& slot = slots[row & (slotCount - 1)];
+        uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        if((sequence & 1) != 0 || !slot.sequence.compare_exchange_strong(
+            sequence, sequence + 1, std::memory_order_acquire)) {
+
+            // Someone else has the slot. Let them have it.
+            return;
+        }
+
+        slot.row.store(row, std::memory_order_relaxed);
+        slot.text.store(position.getText(), std::memory_order_relaxed);
+        slot.offset.store(position.getOffset(), std::memory_order_relaxed);
+
+        // Make the slot readable again.
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * Throw away everything cached, and make room for about the given number
+     * of rows instead. Not thread safe: nothing else can be using the cache.
+     */
+    void resize(size_t entries);
+
+    /**
+     * Get the number of rows there is room for.
+     */
+    inline size_t getEntries() const {
+        return slotCount;
+    }
+
+    /**
+     * Get the number of bytes used by the cache's slots.
+     */
+    inline size_t getMemoryUsage() const {
+        return slotCount * sizeof(Slot);
+    }
+
+    /**
+     * Get the hit and miss counts so far.
+     */
+    inline const StatTracker& getStats() const {
+        return stats;
+    }
+
+protected:
+    /**
+     * One cached row, with the sequence number guarding it. Everything is
+     * atomic so readers racing with writers are well defined, even though
+     * they will throw out what they read.
+     */
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        std::atomic<int64_t> row;
+        std::atomic<size_t> text;
+        std::atomic<size_t> offset;
+    };
+
+    /**
+     * Holds the slots.
+     */
+    std::unique_ptr<Slot[]> slots;
+
+    /**
+     * Holds the number of slots, which is 0 or a power of 2.
+     */
+    size_t slotCount;
+
+    /**
+     * Holds the hit and miss counts.
+     */
+    StatTracker stats;
+
+    /**
+     * Counts lookups that found their row.
+     */
+    StatTracker::Counter hits;
+
+    /**
+     * Counts lookups that didn't.
+     */
+    StatTracker::Counter misses;
+
+private:
+    /**
+     * LocateCaches can't be copied, since their Counters point into their own
+     * StatTrackers.
+     */
+    LocateCache(const LocateCache& other) = delete;
+
+    /**
+     * Or assigned.
+     */
+    LocateCache& operator=(const LocateCache& other) = delete;
+
+};
+
+#endif
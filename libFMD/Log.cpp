@@ -1,13 +1,232 @@
 #include "Log.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 // Set the time format.
 const std::string Log::TIME_FORMAT = "[%m-%d-%Y %H:%M:%S] ";
 
-// Have static initializations of all the streams.
-CRITICAL_STREAM Log::criticalStream;
-ERROR_STREAM Log::errorStream;
-WARNING_STREAM Log::warningStream;
+// Have static initializations of all the streams. The ones for problems are
+// urgent, so they get out even if the program is about to die.
+CRITICAL_STREAM Log::criticalStream(true);
+ERROR_STREAM Log::errorStream(true);
+WARNING_STREAM Log::warningStream(true);
 OUTPUT_STREAM Log::outputStream;
 INFO_STREAM Log::infoStream;
 DEBUG_STREAM Log::debugStream;
 TRACE_STREAM Log::traceStream;
+
+/**
+ * A bounded lock-free queue of lines, which any number of threads can push to
+ * and one thread pops from. Each slot has a sequence number, which is its
+ * position in the queue when it is free to fill, and one more than that once it
+ * holds a line.
+ */
+class LogRing {
+public:
+    /**
+     * Make a ring with room for at least the given number of lines. There are
+     * always at least 2 slots, or a full slot would look free.
+     */
+    LogRing(size_t capacity, bool dropWhenFull): size(2),
+        dropWhenFull(dropWhenFull), slots(), head(0), tail(0) {
+        
+        while(size < capacity) {
+            size *= 2;
+        }
+        slots.reset(new Slot[size]);
+        for(size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    /**
+     * Add a line to the queue. Returns false if it was dropped because the
+     * queue was full.
+     */
+    bool push(std::string&& line) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while(true) {
+            Slot& slot = slots[position & (size - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            
+            if(sequence == position) {
+                // The slot is free. Try to claim it.
+                if(tail.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed)) {
+                    
+                    slot.line = std::move(line);
+                    slot.sequence.store(position + 1,
+                        std::memory_order_release);
+                    return true;
+                }
+                // Otherwise position has been updated for us.
+            } else if((ptrdiff_t) (sequence - position) < 0) {
+                // The slot still holds a line from a lap ago, so we're full.
+                if(dropWhenFull) {
+                    return false;
+                }
+                std::this_thread::yield();
+                position = tail.load(std::memory_order_relaxed);
+            } else {
+                // Someone else claimed it first.
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    /**
+     * Take the oldest line off the queue, if there is one. Only one thread may
+     * call this.
+     */
+    bool pop(std::string& line) {
+        Slot& slot = slots[head & (size - 1)];
+        if(slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            // Not filled in yet.
+            return false;
+        }
+        line = std::move(slot.line);
+        slot.sequence.store(head + size, std::memory_order_release);
+        head++;
+        return true;
+    }
+    
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::string line;
+    };
+    
+    // How many slots are there? Always a power of 2.
+    size_t size;
+    // Should lines be dropped instead of waiting for room?
+    bool dropWhenFull;
+    std::unique_ptr<Slot[]> slots;
+    // Where the next line to pop is. Only the writer touches it.
+    size_t head;
+    // Where the next line will be pushed.
+    std::atomic<size_t> tail;
+};
+
+// Only one thing can write to stdout at a time.
+static std::mutex outputMutex;
+// Only one thing can start or stop the writer at a time.
+static std::mutex asyncMutex;
+// The queue lines go to, if the writer is running.
+static std::atomic<LogRing*> ring(nullptr);
+// How many threads might be using the queue right now?
+static std::atomic<size_t> activeSenders(0);
+// Set when the writer should finish up.
+static std::atomic<bool> stopping(false);
+// How many lines didn't fit?
+static std::atomic<size_t> droppedLines(0);
+// The thread writing out the queue.
+static std::thread writer;
+
+/**
+ * Write out lines from the given queue until stopping is set and it is empty.
+ */
+static void writeLines(LogRing* queue) {
+    std::string line;
+    while(true) {
+        // Check before draining, so we drain once more after being stopped.
+        bool stop = stopping.load();
+        
+        bool wrote = false;
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            while(queue->pop(line)) {
+                std::cout << line;
+                wrote = true;
+            }
+            if(wrote) {
+                std::cout.flush();
+            }
+        }
+        
+        if(stop) {
+            return;
+        }
+        if(!wrote) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void OutStream::sendLine() {
+    std::ostringstream& line = getLine();
+    std::string text = line.str();
+    line.str(std::string());
+    
+    // Say we might be using the queue before looking for it, so it can't be
+    // stopped and deleted out from under us.
+    activeSenders++;
+    LogRing* queue = urgent ? nullptr : ring.load();
+    if(queue != nullptr) {
+        if(!queue->push(std::move(text))) {
+            droppedLines++;
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << text;
+        std::cout.flush();
+    }
+    activeSenders--;
+}
+
+void Log::startAsync(size_t capacity, bool dropWhenFull) {
+    std::lock_guard<std::mutex> lock(asyncMutex);
+    if(ring.load() != nullptr) {
+        return;
+    }
+    
+    LogRing* queue = new LogRing(capacity, dropWhenFull);
+    stopping.store(false);
+    writer = std::thread(writeLines, queue);
+    ring.store(queue);
+}
+
+void Log::stopAsync() {
+    std::unique_lock<std::mutex> lock(asyncMutex);
+    LogRing* queue = ring.exchange(nullptr);
+    if(queue == nullptr) {
+        return;
+    }
+    
+    // Wait for anyone still pushing. New lines are written directly.
+    while(activeSenders.load() != 0) {
+        std::this_thread::yield();
+    }
+    
+    stopping.store(true);
+    writer.join();
+    delete queue;
+    lock.unlock();
+    
+    if(droppedLines.load() > 0) {
+        // Don't go through our own line, since this may be running at exit
+        // after it is gone.
+        std::ostringstream message;
+        message << timestamp << "WARNING: " << droppedLines.load() <<
+            " log lines were dropped because the log was full" << std::endl;
+        std::lock_guard<std::mutex> outputLock(outputMutex);
+        std::cout << message.str();
+    }
+}
+
+size_t Log::getDroppedLines() {
+    return droppedLines.load();
+}
+
+/**
+ * Stops the writer when the program ends, if it is still running, so the last
+ * lines get out.
+ */
+static struct AsyncLogStopper {
+    ~AsyncLogStopper() {
+        Log::stopAsync();
+    }
+} asyncLogStopper;
@@ -13,23 +13,65 @@
 #include <sstream>
 
 
-// Configure log levels to compile in and out. Levels with OutStreams go to
-// stdout, levels with NullStreams go nowhere.
+// Number the log levels, from most to least verbose.
 
+// Trace: Messages that pedantically describe what the program is doing.
+#define LOG_LEVEL_TRACE 0
+// Debug: Messages about the internals of the program.
+#define LOG_LEVEL_DEBUG 1
+// Info: Messages about the operation of the program
+#define LOG_LEVEL_INFO 2
+// Output: Messages the user is supposed to see
+#define LOG_LEVEL_OUTPUT 3
+// Warning: Log messages that indicate something is unlikely.
+#define LOG_LEVEL_WARNING 4
+// Error: Log messages that indicate something is broken
+#define LOG_LEVEL_ERROR 5
 // Critical: Log messages that stop the program.
+#define LOG_LEVEL_CRITICAL 6
+
+// Configure the least important level to compile in. Build with, for example,
+// -DLOG_MIN_LEVEL=LOG_LEVEL_TRACE to get everything.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Levels with OutStreams go to stdout, levels with NullStreams go nowhere.
+#if LOG_MIN_LEVEL <= LOG_LEVEL_CRITICAL
 #define CRITICAL_STREAM OutStream
-// Error: Log messages that indicate something is broken
+#else
+#define CRITICAL_STREAM NullStream
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
 #define ERROR_STREAM OutStream
-// Warning: Log messages that indicate something is unlikely.
+#else
+#define ERROR_STREAM NullStream
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARNING
 #define WARNING_STREAM OutStream
-// Output: Messages the user is supposed to see
+#else
+#define WARNING_STREAM NullStream
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_OUTPUT
 #define OUTPUT_STREAM OutStream
-// Info: Messages about the operation of the program
+#else
+#define OUTPUT_STREAM NullStream
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
 #define INFO_STREAM OutStream
-// Debug: Messages about the internals of the program.
+#else
+#define INFO_STREAM NullStream
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define DEBUG_STREAM OutStream
+#else
 #define DEBUG_STREAM NullStream
-// Trace: Messages that pedantically describe what the program is doing.
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_TRACE
+#define TRACE_STREAM OutStream
+#else
 #define TRACE_STREAM NullStream
+#endif
 
 // Also we have some macros to facilitate lazy logging. If you use these, your
 // things you log are not evaluated unless that log level is enabled.
@@ -45,16 +87,22 @@
 #define LOG_LAZY(exp) (std::function<void(std::stringstream&)>)\
     ([&](std::stringstream& stream) -> void { stream << exp; })
 
-// We also have some log level macros to make that easy. Use like:
+// We also have some log level macros to make that easy, and cheaper: below
+// LOG_MIN_LEVEL they compile to nothing, and the expression is never evaluated.
+// Use them for anything in a hot loop. Use like:
 // LOG_INFO("i is " << i << std::endl);
-// TODO: Make these no-ops early if using NullStream?
-#define LOG_CRITICAL(exp) Log::critical() << LOG_LAZY(exp);
-#define LOG_ERROR(exp) Log::error() << LOG_LAZY(exp);
-#define LOG_WARNING(exp) Log::warning() << LOG_LAZY(exp);
-#define LOG_OUTPUT(exp) Log::output() << LOG_LAZY(exp);
-#define LOG_INFO(exp) Log::info() << LOG_LAZY(exp);
-#define LOG_DEBUG(exp) Log::debug() << LOG_LAZY(exp);
-#define LOG_TRACE(exp) Log::trace() << LOG_LAZY(exp);
+#define LOG_AT_LEVEL(level, stream, exp) do {\
+        if((level) >= LOG_MIN_LEVEL) {\
+            stream << exp;\
+        }\
+    } while(0)
+#define LOG_CRITICAL(exp) LOG_AT_LEVEL(LOG_LEVEL_CRITICAL, Log::critical(), exp)
+#define LOG_ERROR(exp) LOG_AT_LEVEL(LOG_LEVEL_ERROR, Log::error(), exp)
+#define LOG_WARNING(exp) LOG_AT_LEVEL(LOG_LEVEL_WARNING, Log::warning(), exp)
+#define LOG_OUTPUT(exp) LOG_AT_LEVEL(LOG_LEVEL_OUTPUT, Log::output(), exp)
+#define LOG_INFO(exp) LOG_AT_LEVEL(LOG_LEVEL_INFO, Log::info(), exp)
+#define LOG_DEBUG(exp) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, Log::debug(), exp)
+#define LOG_TRACE(exp) LOG_AT_LEVEL(LOG_LEVEL_TRACE, Log::trace(), exp)
 
 /**
  * Define a typedef for the type of ostream manipulators like std::endl. They
@@ -68,11 +116,18 @@ typedef std::ostream& (*OstreamManipulator)(std::ostream&);
  */
 class NullStream {
 public:
+    /**
+     * Make a NullStream. Takes the same arguments as OutStream.
+     */
+    inline NullStream(bool urgent = false) {
+        // Nothing to set up
+    }
+    
     /**
      * Define a template operator that eats anything you try to throw at it.
      */
     template<typename T>
-    NullStream& operator<<(T thing) {
+    NullStream& operator<<(const T& thing) {
         return *this;
     }
     
@@ -98,26 +153,41 @@ public:
 };
 
 /**
- * A stream that sends output to stdout.
+ * A stream that sends output to stdout. Each thread assembles its own line,
+ * which is sent out whole when it is ended with std::endl (or std::flush), so
+ * lines from different threads never interleave. Lines go straight to stdout,
+ * or through the Log's background writer if Log::startAsync() was called.
  */
 class OutStream {
 public:
     /**
-     * Define a template operator that sends everything to standard output.
+     * Make an OutStream. Lines on an urgent stream are always written before
+     * the statement that ends them returns, even if the Log is asynchronous.
+     */
+    inline OutStream(bool urgent = false): urgent(urgent) {
+        // Nothing else to set up
+    }
+    
+    /**
+     * Define a template operator that sends everything to the line.
      */
     template<typename T>
-    OutStream& operator<<(T thing) {
-        std::cout << thing;
+    OutStream& operator<<(const T& thing) {
+        getLine() << thing;
         return *this;
     }
     
     /**
      * Define another function that passes stream manipulators (which are really
-     * functions) on to the underlying stream.
+     * functions) on to the line, and sends the line if they end it.
      */
     inline OutStream& operator<<(OstreamManipulator manipulator) {
-        // Send the manipulator to standard output.
-        std::cout << manipulator;
+        getLine() << manipulator;
+        if(manipulator == (OstreamManipulator) std::endl ||
+            manipulator == (OstreamManipulator) std::flush) {
+            
+            sendLine();
+        }
         return *this;
     }
     
@@ -128,16 +198,32 @@ public:
     inline OutStream& operator<<(
         std::function<void(std::stringstream&)> message) {
         
-        // Send the message to a stringstream and then to the output.
+        // Send the message to a stringstream and then to the line.
         
         std::stringstream stream;
         message(stream);
-        std::cout << stream.str();
+        getLine() << stream.str();
         
         return *this;
     }
-     
     
+private:
+    /**
+     * Get the line this thread is assembling.
+     */
+    static inline std::ostringstream& getLine() {
+        static thread_local std::ostringstream line;
+        return line;
+    }
+    
+    /**
+     * Write out this thread's line, or queue it to be written, and start a new
+     * one.
+     */
+    void sendLine();
+    
+    // Should our lines skip the queue?
+    bool urgent;
 };
 
 /**
@@ -145,6 +231,30 @@ public:
  */
 class Log {
 public:
+    /**
+     * Start writing log lines from a background thread, so threads that log
+     * don't wait on the terminal or pipe. Lines are queued in a lock-free ring
+     * buffer with room for the given number of lines. If dropWhenFull is set,
+     * lines logged while it is full are dropped and counted; otherwise the
+     * threads logging them wait for room. CRITICAL, ERROR and WARNING lines
+     * are still written right away. Does nothing if already started.
+     */
+    static void startAsync(size_t capacity = 1 << 16,
+        bool dropWhenFull = false);
+    
+    /**
+     * Write out all the queued lines, stop the background thread, and go back
+     * to writing lines as they are logged. Reports any dropped lines. Does
+     * nothing if not started.
+     */
+    static void stopAsync();
+    
+    /**
+     * Get the number of lines that have been dropped because the queue was
+     * full.
+     */
+    static size_t getDroppedLines();
+    
     /**
      * Function to get a stream to log CRITICAL-level massages to. Call once per
      * line.
@@ -228,12 +338,14 @@ private:
         time_t globalTime;
         time(&globalTime);
         
-        // This holds the local time
-        struct tm * localTime = localtime(&globalTime);
+        // This holds the local time. Don't use localtime's shared buffer, since
+        // many threads log.
+        struct tm localTime;
+        localtime_r(&globalTime, &localTime);
         
         // This holds the formatted time
         char buffer[TIME_CHARS];
-        if(strftime(buffer, TIME_CHARS, TIME_FORMAT.c_str(), localTime)) {
+        if(strftime(buffer, TIME_CHARS, TIME_FORMAT.c_str(), &localTime)) {
             // Send the time to the stream. It is null-terminated.
             stream << buffer;
         } else {
@@ -0,0 +1,123 @@
+#include "MappedFasta.hpp"
+
+#include <cctype>
+#include <cstring>
+
+/**
+ * Find the next '>' at the start of a line, at or after start and before end.
+ * Returns end if there isn't one. file is where the file starts, which counts
+ * as the start of a line.
+ */
+static const char* findHeader(const char* file, const char* start,
+    const char* end) {
+
+    while(start < end) {
+        const char* found = (const char*) memchr(start, '>', end - start);
+        if(found == NULL) {
+            return end;
+        }
+        if(found == file || found[-1] == '\n') {
+            return found;
+        }
+        // That was a '>' in the middle of a line. Keep looking.
+        start = found + 1;
+    }
+    return end;
+}
+
+/**
+ * Find the next line break at or after start and before end. Returns end if
+ * there isn't one.
+ */
+static const char* findLineEnd(const char* start, const char* end) {
+    const char* found = (const char*) memchr(start, '\n', end - start);
+    return found == NULL ? end : found;
+}
+
+MappedFasta::MappedFasta(const std::string& filename): file(filename),
+    records() {
+
+    const char* data = file.getData();
+    const char* end = data + file.getSize();
+
+    for(const char* header = findHeader(data, data, end); header != end;) {
+        // For each record, find where its header line ends.
+        const char* headerEnd = findLineEnd(header, end);
+
+        Record record;
+
+        // The ID runs from after the '>' to the first comma or whitespace.
+        record.id = header + 1;
+        const char* idEnd = record.id;
+        while(idEnd < headerEnd && *idEnd != ',' &&
+            !isspace((unsigned char) *idEnd)) {
+            idEnd++;
+        }
+        record.idLength = idEnd - record.id;
+
+        // The sequence runs from the next line to the next header, less any
+        // whitespace at the end.
+        record.sequence = headerEnd == end ? end : headerEnd + 1;
+        const char* next = findHeader(data, record.sequence, end);
+        const char* sequenceEnd = next;
+        while(sequenceEnd > record.sequence &&
+            isspace((unsigned char) sequenceEnd[-1])) {
+            sequenceEnd--;
+        }
+        record.sequenceBytes = sequenceEnd - record.sequence;
+
+        // If there are no line breaks left, the sequence can be used in place.
+        // A "\r\n" leaves a '\r' behind, so we look for those too.
+        record.oneLine = findLineEnd(record.sequence, sequenceEnd) ==
+            sequenceEnd && memchr(record.sequence, '\r',
+            record.sequenceBytes) == NULL;
+
+        records.push_back(record);
+        header = next;
+    }
+}
+
+const char* MappedFasta::getSequence(size_t record, size_t& length,
+    std::string& buffer) const {
+
+    const Record& found = records[record];
+    if(found.oneLine) {
+        // Hand it out where it is.
+        length = found.sequenceBytes;
+        return found.sequence;
+    }
+
+    // Otherwise copy the lines one after the other into the buffer, leaving
+    // out the whitespace around them.
+    buffer.clear();
+    const char* end = found.sequence + found.sequenceBytes;
+    for(const char* line = found.sequence; line < end;) {
+        const char* lineEnd = findLineEnd(line, end);
+
+        const char* start = line;
+        while(start < lineEnd && isspace((unsigned char) *start)) {
+            start++;
+        }
+        const char* stop = lineEnd;
+        while(stop > start && isspace((unsigned char) stop[-1])) {
+            stop--;
+        }
+        buffer.append(start, stop - start);
+
+        line = lineEnd + 1;
+    }
+
+    length = buffer.size();
+    return buffer.data();
+}
+
+std::string MappedFasta::getSequence(size_t record) const {
+    std::string buffer;
+    size_t length;
+    const char* sequence = getSequence(record, length, buffer);
+    if(sequence == buffer.data()) {
+        // It got put together in our buffer already.
+        return buffer;
+    }
+    return std::string(sequence, length);
+}
@@ -0,0 +1,109 @@
+#ifndef MAPPEDFASTA_HPP
+#define MAPPEDFASTA_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "MappedFile.hpp"
+
+/**
+ * Defines a FASTA file which is memory-mapped instead of read, and whose
+ * records can be gotten at in any order without being copied. The whole file
+ * is indexed by record in one pass when it is opened, using memchr to jump
+ * from line to line.
+ *
+ * Record IDs end at the first comma or whitespace in the header line, like
+ * Fasta's do. Record sequences are everything up to the next header with the
+ * line breaks taken out. A sequence all on one line is handed out in place;
+ * one broken over several lines is put back together in a buffer the caller
+ * supplies.
+ *
+ * Anything before the first header is ignored. The file must not be modified
+ * while the object exists.
+ */
+class MappedFasta {
+public:
+
+    /**
+     * Map and index the FASTA with the given filename. Throws a
+     * std::runtime_error if the file can't be opened or mapped.
+     */
+    MappedFasta(const std::string& filename);
+
+    /**
+     * Get the number of records in the file.
+     */
+    inline size_t size() const {
+        return records.size();
+    }
+
+    /**
+     * Get the ID of the record with the given number.
+     */
+    inline std::string getID(size_t record) const {
+        return std::string(records[record].id, records[record].idLength);
+    }
+
+    /**
+     * Get the sequence of the record with the given number, without line
+     * breaks. Returns a pointer to the start of the sequence, and puts its
+     * length in length. If the sequence is broken over more than one line, it
+     * is assembled in buffer, and the pointer is only good until buffer is
+     * next changed. Otherwise the pointer is into the mapped file, and buffer
+     * is not touched.
+     */
+    const char* getSequence(size_t record, size_t& length,
+        std::string& buffer) const;
+
+    /**
+     * Get a copy of the sequence of the record with the given number, without
+     * line breaks.
+     */
+    std::string getSequence(size_t record) const;
+
+protected:
+    /**
+     * Where to find a record in the mapped file.
+     */
+    struct Record {
+        /**
+         * Where the ID starts.
+         */
+        const char* id;
+
+        /**
+         * How long the ID is.
+         */
+        size_t idLength;
+
+        /**
+         * Where the sequence lines start.
+         */
+        const char* sequence;
+
+        /**
+         * How many bytes the sequence lines take up, without any trailing
+         * whitespace.
+         */
+        size_t sequenceBytes;
+
+        /**
+         * Is the sequence all on one line, so it can be used in place?
+         */
+        bool oneLine;
+    };
+
+    /**
+     * Holds the mapped file.
+     */
+    MappedFile file;
+
+    /**
+     * Holds where every record is, in file order.
+     */
+    std::vector<Record> records;
+
+};
+
+#endif
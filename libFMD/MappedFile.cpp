@@ -0,0 +1,54 @@
+#include <stdexcept>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "MappedFile.hpp"
+#include "HugePages.hpp"
+
+MappedFile::MappedFile(const std::string& filename): data(NULL), size(0) {
+    // Open the file
+    int fileNumber = open(filename.c_str(), O_RDONLY);
+    
+    if(fileNumber == -1) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    
+    // Work out how big it is
+    struct stat fileStats;
+    if(fstat(fileNumber, &fileStats) == -1) {
+        close(fileNumber);
+        throw std::runtime_error("Could not stat " + filename);
+    }
+    size = fileStats.st_size;
+    
+    if(size > 0) {
+        // Map it all. You can't map 0 bytes.
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fileNumber, 0);
+        
+        if(mapping == MAP_FAILED) {
+            close(fileNumber);
+            throw std::runtime_error("Could not map " + filename);
+        }
+        
+        data = (const char*) mapping;
+        
+        // Big files get random access, so use huge pages if asked. Only some
+        // kernels can do this for files.
+        HugePages::advise(data, size);
+    }
+    
+    // The mapping keeps the file alive, so we don't need the descriptor.
+    close(fileNumber);
+}
+
+MappedFile::~MappedFile() {
+    if(data != NULL) {
+        // Drop the mapping. The pages stay in the page cache for anyone else
+        // using the file.
+        munmap((void*) data, size);
+    }
+}
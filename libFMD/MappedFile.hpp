@@ -0,0 +1,71 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+#include <cstddef>
+
+/**
+ * Represents a whole file memory-mapped read-only, so that large on-disk
+ * arrays can be used in place instead of being read into heap memory. The
+ * pages are shared with the page cache, so several processes mapping the same
+ * index only keep one copy of it in memory between them, and only the parts
+ * that actually get used are ever read from disk.
+ *
+ * The mapping starts on a page boundary, so anything stored at a suitably
+ * aligned offset in the file can be accessed directly. If HugePages are
+ * enabled, the mapping is advised to use them.
+ */
+class MappedFile {
+
+public:
+    /**
+     * Map the file with the given name. Throws a std::runtime_error if the
+     * file can't be opened or mapped.
+     */
+    MappedFile(const std::string& filename);
+    
+    /**
+     * Unmap the file.
+     */
+    ~MappedFile();
+    
+    /**
+     * Get a pointer to the start of the file's contents. Returns NULL if the
+     * file is empty.
+     */
+    inline const char* getData() const {
+        return data;
+    }
+    
+    /**
+     * Get the size of the file in bytes.
+     */
+    inline size_t getSize() const {
+        return size;
+    }
+    
+protected:
+    /**
+     * Holds the start of the mapping, or NULL if there is nothing mapped.
+     */
+    const char* data;
+    
+    /**
+     * Holds the length of the mapping.
+     */
+    size_t size;
+    
+private:
+    /**
+     * MappedFiles cannot be copied.
+     */
+    MappedFile(const MappedFile& other) = delete;
+    
+    /**
+     * MappedFiles cannot be assigned.
+     */
+    MappedFile& operator=(const MappedFile& other) = delete;
+    
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include <iostream>
 #include <utility>
 #include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <limits>
 
 #include "TextPosition.hpp"
 
@@ -118,6 +121,104 @@ public:
     size_t rightMaxContext;
 };
 
+/**
+ * Represents a Mapping in 16 bytes instead of 40, for when a lot of them need
+ * to be stored. The location is a PackedTextPosition, which is unset for
+ * unmapped Mappings, and the contexts are 32 bits each. The range number is not
+ * kept. Convert to and from Mapping at API boundaries.
+ */
+struct PackedMapping
+{
+public:
+    /**
+     * Make an unmapped PackedMapping.
+     */
+    inline PackedMapping(): location(), leftMaxContext(0), rightMaxContext(0) {
+        // Nothing to do
+    }
+    
+    /**
+     * Pack the given Mapping. Throws a std::runtime_error if its location or
+     * contexts don't fit.
+     */
+    inline explicit PackedMapping(const Mapping& mapping): location(
+        mapping.isMapped() ? PackedTextPosition(mapping.getLocation()) :
+        PackedTextPosition()), leftMaxContext(pack(
+        mapping.getLeftMaxContext())), rightMaxContext(pack(
+        mapping.getRightMaxContext())) {
+        
+        // Nothing to do
+    }
+    
+    /**
+     * Unpack back into a full Mapping.
+     */
+    inline Mapping unpack() const {
+        Mapping toReturn;
+        if(isMapped()) {
+            toReturn = Mapping(location.unpack());
+        }
+        toReturn.setMaxContext(leftMaxContext, rightMaxContext);
+        return toReturn;
+    }
+    
+    /**
+     * Is this PackedMapping actually mapped?
+     */
+    inline bool isMapped() const {
+        return location.isSet();
+    }
+    
+    /**
+     * What text and offset is this mapping to? Only valid if mapped.
+     */
+    inline TextPosition getLocation() const {
+        return location.unpack();
+    }
+    
+    /**
+     * Return the amount of context used to map on the left.
+     */
+    inline size_t getLeftMaxContext() const {
+        return leftMaxContext;
+    }
+    
+    /**
+     * Return the amount of context used to map on the right.
+     */
+    inline size_t getRightMaxContext() const {
+        return rightMaxContext;
+    }
+    
+    /**
+     * Provide equality comparison for testing.
+     */
+    inline bool operator==(const PackedMapping& other) const {
+        return location == other.location &&
+            leftMaxContext == other.leftMaxContext &&
+            rightMaxContext == other.rightMaxContext;
+    }
+    
+    // Holds the (text, offset) we are mapped to, or nothing if unmapped.
+    PackedTextPosition location;
+    // And how far could we go on the left?
+    uint32_t leftMaxContext;
+    // And how far could we go on the right?
+    uint32_t rightMaxContext;
+    
+protected:
+    /**
+     * Make sure a context length fits in 32 bits.
+     */
+    static inline uint32_t pack(size_t context) {
+        if(context > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Can't pack context " +
+                std::to_string(context));
+        }
+        return context;
+    }
+};
+
 /**
  * Provide pretty-printing for Mappings. See
  * <http://www.parashift.com/c++-faq/output-operator.html>
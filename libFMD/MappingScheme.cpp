@@ -1,4 +1,23 @@
 #include "MappingScheme.hpp"
+#include "TaskPool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+MappingBatchResult::MappingBatchResult(): mappings(), starts(1, 0) {
+    // Nothing to do!
+}
+
+void MappingBatchResult::reset(const std::vector<std::string>& queries) {
+    starts.resize(1);
+    for(const std::string& query : queries) {
+        starts.push_back(starts.back() + query.size());
+    }
+    
+    // Clearing and refilling doesn't give back any capacity.
+    mappings.clear();
+    mappings.resize(starts.back());
+}
 
 MappingScheme::MappingScheme(FMDIndexView&& view): view(std::move(view)),
     stats() {
@@ -9,3 +28,128 @@ MappingScheme::MappingScheme(FMDIndexView&& view): view(std::move(view)),
 StatTracker MappingScheme::getStats() const {
     return stats;
 }
+
+std::vector<std::pair<std::string, std::string>>
+    MappingScheme::getParameters() const {
+    
+    return {
+        {"queryThreads", std::to_string(queryThreads)},
+        {"minWindowLength", std::to_string(minWindowLength)},
+        {"queryMicroseconds", std::to_string(queryMicroseconds)}
+    };
+}
+
+MappingScheme::QueryTimer::QueryTimer(const MappingScheme& scheme,
+    const std::string& query, const StatTracker::Histogram& histogram):
+    scheme(scheme), query(query), histogram(histogram),
+    start(std::chrono::steady_clock::now()), counters() {
+    
+    // Nothing to do!
+}
+
+MappingScheme::QueryTimer::~QueryTimer() {
+    uint64_t nanoseconds = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+        start).count();
+    histogram.add(nanoseconds);
+    
+    if(scheme.queryTracer != nullptr &&
+        scheme.queryTracer->wouldKeep(nanoseconds)) {
+        
+        // Only bother collecting everything if it might be kept.
+        QueryTracer::Trace trace{nanoseconds, query, scheme.getParameters(),
+            std::move(counters)};
+        scheme.queryTracer->offer(std::move(trace));
+    }
+}
+
+void MappingScheme::mapBatch(const std::vector<std::string>& queries,
+    MappingBatchResult& results) const {
+    
+    results.reset(queries);
+    
+    for(size_t i = 0; i < queries.size(); i++) {
+        map(queries[i], [&](size_t base, TextPosition mappedTo) {
+            // Pack each mapping straight into the arena.
+            results.set(i, base, PackedMapping(Mapping(mappedTo)));
+        });
+    }
+}
+
+void MappingScheme::mapRange(const std::string& query, size_t start,
+    size_t end, std::function<void(size_t, TextPosition)> callback) const {
+    
+    auto context = getRangeContext(query.size(), start, end);
+    
+    map(query.substr(context.first, context.second - context.first),
+        [&](size_t base, TextPosition mappedTo) {
+        
+        // Bases come in relative to the start of the context.
+        base += context.first;
+        if(base >= start && base < end) {
+            callback(base, mappedTo);
+        }
+    });
+}
+
+std::pair<size_t, size_t> MappingScheme::getRangeContext(size_t length,
+    size_t start, size_t end) const {
+    
+    if(start > end || end > length) {
+        throw std::out_of_range("Range " + std::to_string(start) + "-" +
+            std::to_string(end) + " is not in a query of length " +
+            std::to_string(length));
+    }
+    
+    return std::make_pair(start - std::min(start, rangeContext),
+        std::min(end + rangeContext, length));
+}
+
+size_t MappingScheme::countWindows(size_t length) const {
+    // Use a window per thread, but don't make any too short.
+    return std::max((size_t) 1, std::min(queryThreads,
+        length / std::max(minWindowLength, (size_t) 1)));
+}
+
+void MappingScheme::forEachWindow(size_t length,
+    const std::function<void(size_t, size_t)>& function) const {
+    
+    // How many windows should we use?
+    size_t windows = countWindows(length);
+        
+    if(windows == 1) {
+        // Just do it all here.
+        function(0, length);
+        return;
+    }
+    
+    std::vector<std::function<void()>> tasks;
+    for(size_t i = 0; i < windows; i++) {
+        // Split as evenly as we can.
+        size_t start = length * i / windows;
+        size_t end = length * (i + 1) / windows;
+        
+        tasks.push_back([&function, start, end]() {
+            function(start, end);
+        });
+    }
+    
+    runTasks(tasks, true);
+}
+
+void MappingScheme::runTasks(const std::vector<std::function<void()>>& tasks,
+    bool parallel) const {
+    
+    if(!parallel) {
+        // Just do them all here.
+        for(const auto& task : tasks) {
+            task();
+        }
+        return;
+    }
+    
+    // Run them on the shared pool, which rethrows the first exception.
+    parallelFor(tasks.size(), [&](size_t i) {
+        tasks[i]();
+    });
+}
@@ -5,10 +5,74 @@
 #include "FMDIndexView.hpp"
 #include "TextPosition.hpp"
 #include "StatTracker.hpp"
+#include "Mapping.hpp"
+#include "ContextCache.hpp"
+#include "QueryTracer.hpp"
 
 #include <string>
+#include <vector>
 #include <functional>
 #include <map>
+#include <utility>
+#include <chrono>
+
+/**
+ * Holds the results of mapping a batch of queries: a PackedMapping for every
+ * base of every query, all in one arena that keeps its memory when reused for
+ * the next batch.
+ */
+class MappingBatchResult {
+public:
+    /**
+     * Make an empty MappingBatchResult.
+     */
+    MappingBatchResult();
+    
+    /**
+     * Get ready to hold the results for the given queries, with every base
+     * unmapped. Keeps the memory already allocated.
+     */
+    void reset(const std::vector<std::string>& queries);
+    
+    /**
+     * How many queries are there results for?
+     */
+    inline size_t getQueryCount() const {
+        return starts.size() - 1;
+    }
+    
+    /**
+     * How many bases long is the given query?
+     */
+    inline size_t getQueryLength(size_t query) const {
+        return starts[query + 1] - starts[query];
+    }
+    
+    /**
+     * Get the mapping of the given base of the given query.
+     */
+    inline const PackedMapping& get(size_t query, size_t base) const {
+        return mappings[starts[query] + base];
+    }
+    
+    /**
+     * Set the mapping of the given base of the given query.
+     */
+    inline void set(size_t query, size_t base, const PackedMapping& mapping) {
+        mappings[starts[query] + base] = mapping;
+    }
+    
+private:
+    /**
+     * Holds the mappings for all the queries, one after the other.
+     */
+    std::vector<PackedMapping> mappings;
+    
+    /**
+     * Holds where each query's mappings start, and then the total.
+     */
+    std::vector<size_t> starts;
+};
 
 /**
  * Represents a mapping algorithm and its associated parameters. Subclasses
@@ -54,12 +118,215 @@ public:
     virtual void map(const std::string& query,
         std::function<void(size_t, TextPosition)> callback) const = 0;
     
+    /**
+     * Map all the given query strings, and put the results in the given
+     * MappingBatchResult, replacing whatever was there. Bases that don't map
+     * are left unmapped.
+     *
+     * The default implementation calls map() on each query in turn.
+     * Implementations may override it to share scratch space or interleave
+     * index queries across the batch.
+     *
+     * Must be thread-safe, for different results objects.
+     */
+    virtual void mapBatch(const std::vector<std::string>& queries,
+        MappingBatchResult& results) const;
+    
+    /**
+     * Map only bases [start, end) of the given query, using no more than
+     * rangeContext bases of the query on each side of the range as context.
+     * The callback is called with indices into the whole query, and only for
+     * bases in the range. Mappings that depend on context farther away than
+     * that may come out differently than they would when mapping the whole
+     * query, but pieces of a long query can be mapped on their own, and an
+     * edited region remapped, without searching the rest of it.
+     *
+     * The default implementation calls map() on the range and its context.
+     * Implementations may override it to skip the std::function.
+     *
+     * Must be thread-safe.
+     */
+    virtual void mapRange(const std::string& query, size_t start, size_t end,
+        std::function<void(size_t, TextPosition)> callback) const;
+    
+    /**
+     * Get the start and past-the-end positions of the part of a query of the
+     * given length that mapRange() actually maps to map bases [start, end):
+     * the range and up to rangeContext bases on each side. Throws a
+     * std::out_of_range if the range isn't in the query.
+     */
+    std::pair<size_t, size_t> getRangeContext(size_t length, size_t start,
+        size_t end) const;
+    
     /**
      * Get a snapshot of the stats for this mapping scheme.
      */
     StatTracker getStats() const;
     
+    /**
+     * Get the parameters the scheme maps with, as names and values, to record
+     * along with slow queries. Implementations should add their own to the
+     * ones from the class they extend.
+     */
+    virtual std::vector<std::pair<std::string, std::string>>
+        getParameters() const;
+    
+    /**
+     * Get the view that this mapping scheme maps against.
+     */
+    inline const FMDIndexView& getView() const {
+        return view;
+    }
+    
+    /**
+     * How many threads may be used to map a single query? Long queries are
+     * split into windows that are worked on in parallel, and the results are
+     * the same as with a single thread.
+     */
+    size_t queryThreads = 1;
+    
+    /**
+     * Queries are never split into windows shorter than this many bases.
+     */
+    size_t minWindowLength = 100000;
+    
+    /**
+     * How many bases of the query on each side of the range does mapRange()
+     * use as context?
+     */
+    size_t rangeContext = 10000;
+    
+    /**
+     * If set, a cache of k-mer searches, shared by everything mapping against
+     * the same index, that the searches at the ends of queries are taken from.
+     * Not owned by the MappingScheme.
+     */
+    const ContextCache* contextCache = nullptr;
+    
+    /**
+     * If set, every query mapped is timed and offered to this, along with the
+     * scheme's parameters and counters for the query, so the slowest can be
+     * kept. Not owned by the MappingScheme.
+     */
+    QueryTracer* queryTracer = nullptr;
+    
+    /**
+     * How many microseconds may mapping a single query take? Once a query runs
+     * over, bases it hasn't finished with are left unmapped, and counted in the
+     * "overBudgetBases" stat, and the query is counted in "overBudgetQueries".
+     * Unmapped bases are never wrong, so this bounds how long a pathological
+     * query can hold things up without making any mapping worse. 0 means no
+     * limit.
+     */
+    size_t queryMicroseconds = 0;
+    
 protected:
+    /**
+     * Keeps track of the time one query has to map in. Implementations make
+     * one at the top of the code that maps a query, and check it as they go.
+     */
+    class QueryBudget {
+    public:
+        /**
+         * Start the clock on a query that may take the given number of
+         * microseconds, or forever if it is 0.
+         */
+        inline QueryBudget(size_t microseconds): limited(microseconds != 0),
+            deadline(std::chrono::steady_clock::now() +
+            std::chrono::microseconds(microseconds)) {
+            // Nothing to do
+        }
+        
+        /**
+         * Has the query run out of time? Once true, stays true.
+         */
+        inline bool isSpent() const {
+            return limited && std::chrono::steady_clock::now() >= deadline;
+        }
+        
+    private:
+        // Is there a deadline at all?
+        bool limited;
+        
+        // When does the query run out of time?
+        std::chrono::steady_clock::time_point deadline;
+    };
+    
+    /**
+     * Times one query, adding the time to a Histogram, and offers it to the
+     * queryTracer, if there is one and the query was slow enough, when it
+     * goes out of scope. Implementations make one at the top of the code that
+     * maps a query.
+     */
+    class QueryTimer {
+    public:
+        /**
+         * Start timing the given query, mapped by the given scheme, for the
+         * given Histogram. The query must outlive the QueryTimer.
+         */
+        QueryTimer(const MappingScheme& scheme, const std::string& query,
+            const StatTracker::Histogram& histogram);
+        
+        /**
+         * Stop timing, record the time, and offer the query to be traced.
+         */
+        ~QueryTimer();
+        
+        /**
+         * Record the value of a counter for just this query, if it is being
+         * traced. Must only be called from the thread that made the timer.
+         */
+        inline void count(const char* name, size_t value) {
+            if(scheme.queryTracer != nullptr) {
+                counters.emplace_back(name, value);
+            }
+        }
+        
+    private:
+        // What scheme is mapping the query?
+        const MappingScheme& scheme;
+        
+        // What query is being mapped?
+        const std::string& query;
+        
+        // Where should the time go? Histograms are just pointers, so we keep a
+        // copy.
+        StatTracker::Histogram histogram;
+        
+        // When did we start?
+        std::chrono::steady_clock::time_point start;
+        
+        // What was counted for the query?
+        std::vector<std::pair<std::string, size_t>> counters;
+    };
+    
+
+    /**
+     * How many windows would a query of the given length be split into? If
+     * this is more than 1, work on the query may be done in parallel.
+     */
+    size_t countWindows(size_t length) const;
+    
+    /**
+     * Split the range [0, length) of query bases into up to queryThreads
+     * contiguous windows, no shorter than minWindowLength unless there is only
+     * one, and call the given function with the start and past-the-end
+     * positions of each. Windows are run in parallel, so the function must be
+     * thread-safe across windows. If any window throws, one of the exceptions
+     * is rethrown after all the windows finish.
+     */
+    void forEachWindow(size_t length,
+        const std::function<void(size_t, size_t)>& function) const;
+    
+    /**
+     * Run all of the given independent tasks, each on its own thread if
+     * parallel is set, or one after the other here if not. If any task throws,
+     * one of the exceptions is rethrown after all the tasks finish.
+     */
+    void runTasks(const std::vector<std::function<void()>>& tasks,
+        bool parallel) const;
+    
+
     // These configuration parameters are ones that every MappingScheme that
     // uses an FMDIndex (all the ones we care about) will need.
     
@@ -74,6 +341,12 @@ protected:
      * the map method can update it, and it is guaranteed to be thread-safe.
      */
     mutable StatTracker stats;
+    
+    // Counters for queries that ran out of budget, and the bases they left
+    // unmapped because of it.
+    StatTracker::Counter overBudgetQueriesStat =
+        stats.counter("overBudgetQueries");
+    StatTracker::Counter overBudgetBasesStat = stats.counter("overBudgetBases");
 };
  
 
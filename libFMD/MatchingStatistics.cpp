@@ -0,0 +1,300 @@
+#include "MatchingStatistics.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+MatchingStatistics::MatchingStatistics(const FMDIndexView& view,
+    const std::string& query, bool keepContexts, bool findMinMatchings,
+    const ContextCache* cache, const int64_t* rows,
+    const size_t* uniqueLengths):
+    contexts(), maxMatchings(), minMatchings() {
+
+    if(keepContexts) {
+        contexts.resize(query.size());
+    }
+
+    // This gets the search for the given number of query bases starting at
+    // the given base from the base's own row, if we have the rows. The leaf
+    // for the row is the search for the whole rest of its text, so retracting
+    // it gets the shorter pattern.
+    auto searchFromRow = [&](size_t base, size_t length,
+        const FMDPosition& like) {
+
+        FMDPosition found = like;
+        found.setForwardStart(rows[base]);
+        found.setEndOffset(0);
+        view.getIndex().retractRightOnly(found, length);
+        return found;
+    };
+
+    // This is the search for the longest match starting at the current base,
+    // which gets extended on the left and retracted on the right only when it
+    // has to be.
+    FMDPosition longest = view.getIndex().getCoveringPosition();
+    size_t longestLength = 0;
+
+    // This is the search for the shortest unique match starting at the current
+    // base, which gets retracted on the right whenever it stays unique.
+    FMDPosition shortest = longest;
+    size_t shortestLength = 0;
+
+    // Flag that says whether we need to retract the shortest search at least
+    // once before we can find another minimal unique match, since we just
+    // found one ending at a certain place.
+    bool mustRetract = false;
+
+    // Below what base does the longest search need to inchworm?
+    size_t longestFrom = query.size();
+
+    // If we have a k-mer table, we can jump the longest search straight to the
+    // last k-mer of the query, as long as it occurs. When it does, nothing in
+    // between could have failed to extend, so no max matching could start
+    // there, and each base's right context runs to the end of the query. This
+    // only holds without a mask, since masked-out occurrences of shorter
+    // suffixes could make them empty in the view.
+    size_t jump = std::min(view.getIndex().getKmerTableDepth(), query.size());
+    FMDPosition seed;
+    if(view.getMask() == nullptr && jump > 0 && view.getIndex().lookupKmer(
+        query, query.size() - jump, jump, seed) && !seed.isEmpty(view)) {
+
+        if(keepContexts) {
+            for(size_t i = query.size() - jump; i < query.size(); i++) {
+                // Look up each of these positions' contexts.
+                FMDPosition context;
+                view.getIndex().lookupKmer(query, i, query.size() - i,
+                    context);
+
+                // Keep the reverse start we would have had from left-only
+                // extension.
+                context.setReverseStart(longest.getReverseStart());
+
+                contexts[i] = std::make_pair(context, query.size() - i);
+            }
+        }
+
+        // Pick up from the end of the k-mer.
+        seed.setReverseStart(longest.getReverseStart());
+        longest = seed;
+        longestLength = jump;
+        longestFrom = query.size() - jump;
+    }
+
+    // Otherwise, if we have a cache of k-mer searches, we can do the same
+    // thing with the searches it has for the query's last k-mer, under the
+    // same conditions.
+    jump = cache == nullptr ? 0 : cache->getKmerLength();
+    if(longestFrom == query.size() && view.getMask() == nullptr && jump > 0 &&
+        jump <= query.size()) {
+
+        std::shared_ptr<const std::vector<FMDPosition>> searches = cache->get(
+            view, query, query.size() - jump);
+
+        if(!searches->empty()) {
+            // The k-mer occurs, so use the searches for its suffixes.
+            size_t start = query.size() - jump;
+
+            if(keepContexts) {
+                for(size_t i = start; i < query.size(); i++) {
+                    contexts[i] = std::make_pair((*searches)[i - start],
+                        query.size() - i);
+                }
+            }
+
+            // Pick up from the end of the k-mer.
+            longest = searches->front();
+            longestLength = jump;
+            longestFrom = start;
+        }
+    }
+
+    for(size_t i = query.size() - 1; i != (size_t) -1; i--) {
+        // For each position in the query from right to left...
+
+        // Are the two searches on the same string? If so, they can share their
+        // first try at extending.
+        bool shared = (findMinMatchings && i < longestFrom &&
+            shortest == longest);
+        FMDPosition sharedExtension;
+
+        if(i < longestFrom) {
+            // Inchworm the longest search along to here, considering any
+            // maximal unique matches with left endpoints just right of here.
+
+            // We're going to extend backward with this new base.
+            FMDPosition extended;
+            if(rows != nullptr) {
+                extended = searchFromRow(i, longestLength + 1, longest);
+            } else {
+                extended = longest;
+                view.getIndex().extendLeftOnly(extended, query[i]);
+            }
+            sharedExtension = extended;
+
+            if(longest.isUnique(view) && extended.isEmpty(view)) {
+                // We are already a maximal unique match and can't extend any
+                // more. Report ourselves, fixing the left endpoint in the query
+                // as i + 1, where it was last loop. We can only ever do this
+                // once per left endpoint.
+                Matching maxMatching(i + 1, longest.getTextPosition(view),
+                    longestLength);
+                LOG_DEBUG("Found max matching " << maxMatching <<
+                    std::endl);
+                maxMatchings.push_back(maxMatching);
+            }
+
+            while(extended.isEmpty(view)) {
+                // If you can't extend, retract until you can.
+
+                if(longestLength == 0) {
+                    // Not even the base by itself is in the index.
+                    throw std::runtime_error(
+                        "Could not find any results for query base " +
+                        std::string(1, query[i]));
+                }
+
+                if(rows != nullptr) {
+                    // Just retract what we would have extended to.
+                    --longestLength;
+                    view.getIndex().retractRightOnly(extended,
+                        longestLength + 1);
+                    continue;
+                }
+
+                // Retract the character, dropping it from the total pattern
+                // length.
+                FMDPosition retracted = longest;
+                view.getIndex().retractRightOnly(retracted, --longestLength);
+
+                // Try extending again
+                extended = retracted;
+                view.getIndex().extendLeftOnly(extended, query[i]);
+
+                // Say that last step we came from retracted.
+                longest = retracted;
+            }
+
+            // We successfully extended.
+            longest = extended;
+            longestLength++;
+
+            if(keepContexts) {
+                // Save the right context for this base.
+                contexts[i] = std::make_pair(longest, longestLength);
+            }
+        }
+
+        if(!findMinMatchings) {
+            // Only the longest search was asked for.
+            continue;
+        }
+
+        // Now move the shortest search along, retracting on the right until we
+        // can successfully extend on the left without running out of results.
+        FMDPosition extended;
+        if(shared) {
+            extended = sharedExtension;
+        } else if(rows != nullptr) {
+            extended = searchFromRow(i, shortestLength + 1, shortest);
+        } else {
+            extended = shortest;
+            view.getIndex().extendLeftOnly(extended, query[i]);
+        }
+
+        while(extended.isEmpty(view)) {
+
+            if(shortestLength == 0) {
+                // Not even the base by itself is in the index.
+                throw std::runtime_error(
+                    "Could not find any results for query base " +
+                    std::string(1, query[i]));
+            }
+
+            if(rows != nullptr) {
+                // Just retract what we would have extended to.
+                --shortestLength;
+                view.getIndex().retractRightOnly(extended, shortestLength + 1);
+                mustRetract = false;
+                continue;
+            }
+
+            // Retract the character, dropping it from the total pattern length.
+            FMDPosition retracted = shortest;
+            view.getIndex().retractRightOnly(retracted, --shortestLength);
+            mustRetract = false;
+
+            // Try extending again
+            extended = retracted;
+            view.getIndex().extendLeftOnly(extended, query[i]);
+
+            // Say that last step we came from retracted.
+            shortest = retracted;
+        }
+
+        // Extend on the left.
+        shortest = extended;
+        shortestLength++;
+
+        if(uniqueLengths != nullptr && uniqueLengths[i] != 0 &&
+            uniqueLengths[i] < shortestLength) {
+
+            // Everything this long that starts here is only at the query's own
+            // position, and we found something, so we are unique all the way
+            // back to the table's length. Retracting one step at a time would
+            // get there too.
+            shortestLength = uniqueLengths[i];
+            view.getIndex().retractRightOnly(shortest, shortestLength);
+            mustRetract = false;
+        }
+
+        // Retract on the right until the next retraction would make us not
+        // unique, and report a minimal unique match starting at this position.
+        FMDPosition retracted = shortest;
+        view.getIndex().retractRightOnly(retracted, shortestLength - 1);
+
+        while(retracted.isUnique(view)) {
+            // Retract until we would no longer be unique, dropping characters
+            // from the total pattern length.
+            shortest = retracted;
+            view.getIndex().retractRightOnly(retracted,
+                (--shortestLength) - 1);
+            mustRetract = false;
+        }
+
+        if(shortest.isUnique(view) && retracted.isAmbiguous(view) &&
+            !mustRetract) {
+
+            // We found a minimally unique match starting at this position and
+            // ending shortestLength right from here. Just match it up against
+            // any text that's selected. It would be a lot of work to go through
+            // all the texts available to minimal matches, and we don't really
+            // use their locations much anyway.
+            minMatchings.push_back(Matching(i, shortest.getTextPosition(view),
+                shortestLength));
+
+            // We can't find another minimal match until we move the right
+            // endpoint.
+            mustRetract = true;
+        }
+    }
+
+    if(longest.isUnique(view)) {
+        // We are a maximal unique match butted up against the left edge. Report
+        // it.
+        Matching maxMatching(0, longest.getTextPosition(view), longestLength);
+        LOG_DEBUG("Found max matching " << maxMatching << " at left edge"
+            << std::endl);
+        maxMatchings.push_back(maxMatching);
+    }
+
+    // This works for max matchings: if there were a longer unique match on the
+    // right, we would not have retracted. And we explicitly check to see if
+    // there is a longer unique match on the left.
+
+    // And for min matchings: if there were a shorter unique match on the right
+    // starting at a position, we would have retracted to find it. And if there
+    // were a shorter unique match on the left ending at a position, we would
+    // have already reported it and not reported any more until we retracted.
+
+    // Both sets of matchings come out in descending order by left endpoint.
+}
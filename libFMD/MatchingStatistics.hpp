@@ -0,0 +1,100 @@
+#ifndef MATCHINGSTATISTICS_HPP
+#define MATCHINGSTATISTICS_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "FMDIndexView.hpp"
+#include "FMDPosition.hpp"
+#include "Matching.hpp"
+#include "ContextCache.hpp"
+
+/**
+ * Computes matching statistics for a query against an FMDIndexView, in a
+ * single right-to-left sweep over the query. Produces:
+ *
+ * - The right context of every base: the search for the longest substring
+ *   starting there that occurs in the view, with its length.
+ * - The maximal unique matchings, which can't be extended in either direction.
+ * - The minimal unique matchings, which are unique but can't be shortened at
+ *   either end and stay unique.
+ *
+ * The right contexts are found by inchworming along with one search, and the
+ * minimal matchings with another that trails behind it, so the query only has
+ * to be walked once. When the two searches are on the same string they share
+ * their extension.
+ */
+class MatchingStatistics {
+public:
+    /**
+     * Compute matching statistics for the given query against the given view.
+     * Right contexts are only kept if keepContexts is set, since they take a
+     * search per base, and the minimal matchings are only found if
+     * findMinMatchings is set, since they need the second search. Properly
+     * handles merged reference positions.
+     *
+     * If a ContextCache for the view's index is given, the searches for the
+     * query's last k-mer are taken from it, instead of being redone for every
+     * query that ends the same way.
+     *
+     * If the query was taken from the view's index, the BWT rows of the
+     * suffixes of the index's text starting at each of its bases can be given.
+     * Then each search is found by retracting its base's own row up the LCP
+     * array to the length wanted, instead of by extending the search for the
+     * base to its right. The lengths from the index's MinUniqueTable for the
+     * text to the right of each base can also be given, and then a search for
+     * a minimal unique matching that is longer than its base's length jumps
+     * straight back to it, instead of retracting one step at a time.
+     *
+     * Throws std::runtime_error if some base of the query is not in the index
+     * at all.
+     */
+    MatchingStatistics(const FMDIndexView& view, const std::string& query,
+        bool keepContexts = false, bool findMinMatchings = true,
+        const ContextCache* cache = nullptr, const int64_t* rows = nullptr,
+        const size_t* uniqueLengths = nullptr);
+
+    /**
+     * Get the right context search and its length for every base, in the same
+     * order as the query. Only available if keepContexts was set.
+     */
+    inline const std::vector<std::pair<FMDPosition, size_t>>&
+        getContexts() const {
+
+        return contexts;
+    }
+
+    /**
+     * Get the maximal unique matchings, in descending order by left endpoint.
+     */
+    inline const std::vector<Matching>& getMaxMatchings() const {
+        return maxMatchings;
+    }
+
+    /**
+     * Get the minimal unique matchings, in descending order by left endpoint.
+     * Only available if findMinMatchings was set.
+     */
+    inline const std::vector<Matching>& getMinMatchings() const {
+        return minMatchings;
+    }
+
+private:
+    /**
+     * Holds the right contexts, if requested.
+     */
+    std::vector<std::pair<FMDPosition, size_t>> contexts;
+
+    /**
+     * Holds the maximal unique matchings.
+     */
+    std::vector<Matching> maxMatchings;
+
+    /**
+     * Holds the minimal unique matchings.
+     */
+    std::vector<Matching> minMatchings;
+};
+
+#endif
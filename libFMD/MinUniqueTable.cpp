@@ -0,0 +1,200 @@
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+#include "MinUniqueTable.hpp"
+#include "FMDIndex.hpp"
+#include "Log.hpp"
+
+MinUniqueTable::MinUniqueTable(const FMDIndex& index): textStarts(), bytes(),
+    overflowIndices(), overflowValues(), mapping(NULL),
+    numTexts(index.getNumberOfContigs() * 2), numOverflows(0),
+    textStartData(NULL), byteData(NULL), overflowIndexData(NULL),
+    overflowValueData(NULL) {
+
+    Log::info() << "Building minimal unique length table for " << numTexts <<
+        " texts" << std::endl;
+
+    // Lay out the texts, both strands of each contig in turn.
+    textStarts.push_back(0);
+    for(size_t text = 0; text < numTexts; text++) {
+        textStarts.push_back(textStarts.back() +
+            index.getContigLength(text / 2));
+    }
+    bytes.resize(textStarts.back());
+
+    // The first #-of-texts rows in the BWT have a '$' in the F column. Find
+    // which text each one ends.
+    std::vector<int64_t> endRows(numTexts);
+    for(size_t i = 0; i < numTexts; i++) {
+        endRows[index.locate(i).getText()] = i;
+    }
+
+    // Collect the overflows as (index, length) pairs, since we fill each text
+    // from right to left.
+    std::vector<std::pair<size_t, size_t>> overflows;
+
+    for(size_t text = 0; text < numTexts; text++) {
+        // How long is the text?
+        size_t length = textStarts[text + 1] - textStarts[text];
+
+        // Start at the row for the suffix that is just '$'.
+        int64_t row = endRows[text];
+
+        for(size_t suffixLength = 1; suffixLength <= length; suffixLength++) {
+            // LF-map to the row for the suffix one base longer.
+            row = index.getLF(row);
+
+            // The suffix shares this much with its neighbors in the BWT, and
+            // any longer prefix of it is unique.
+            size_t shared = index.getLCP(row);
+            if(row + 1 < index.getBWTLength()) {
+                shared = std::max(shared, index.getLCP(row + 1));
+            }
+
+            // It only counts if it fits before the end of the text.
+            size_t uniqueLength = shared + 1 <= suffixLength ? shared + 1 : 0;
+
+            // Where does this suffix start?
+            size_t entry = textStarts[text] + length - suffixLength;
+
+            if(uniqueLength < ESCAPE) {
+                bytes[entry] = uniqueLength;
+            } else {
+                bytes[entry] = ESCAPE;
+                overflows.push_back(std::make_pair(entry, uniqueLength));
+            }
+        }
+    }
+
+    // Put the overflows in order and split them up.
+    std::sort(overflows.begin(), overflows.end());
+    for(const auto& overflow : overflows) {
+        overflowIndices.push_back(overflow.first);
+        overflowValues.push_back(overflow.second);
+    }
+    numOverflows = overflowIndices.size();
+
+    Log::info() << "Built minimal unique lengths for " << bytes.size() <<
+        " bases with " << numOverflows << " overflows" << std::endl;
+
+    // Queries should look in the vectors.
+    useVectors();
+}
+
+MinUniqueTable::MinUniqueTable(const std::string& filename): textStarts(),
+    bytes(), overflowIndices(), overflowValues(),
+    mapping(new MappedFile(filename)), numTexts(0), numOverflows(0),
+    textStartData(NULL), byteData(NULL), overflowIndexData(NULL),
+    overflowValueData(NULL) {
+
+    // Everything in the file is 8-byte words, except for the bytes at the end.
+    // Since the mapping is page-aligned, the words can all be used in place.
+    // We have the magic number, the text count, and the overflow count, then
+    // the text starts, the overflow indices, the overflow values, and the
+    // bytes.
+    const size_t* words = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+
+    if(wordCount < 3 || words[0] != MAGIC ||
+        wordCount < 4 + words[1] + 2 * words[2] ||
+        mapping->getSize() < (4 + words[1] + 2 * words[2]) * sizeof(size_t) +
+        words[3 + words[1]]) {
+
+        // Don't go reading off the end of a truncated or foreign file.
+        delete mapping;
+        throw std::runtime_error("Bad minimal unique length table " +
+            filename);
+    }
+
+    numTexts = words[1];
+    numOverflows = words[2];
+    textStartData = words + 3;
+    overflowIndexData = textStartData + numTexts + 1;
+    overflowValueData = overflowIndexData + numOverflows;
+    byteData = (const uint8_t*) (overflowValueData + numOverflows);
+}
+
+MinUniqueTable::~MinUniqueTable() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void MinUniqueTable::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    // Save the header words in platform-native byte order.
+    size_t header[3] = {MAGIC, numTexts, numOverflows};
+    file.write((const char*) header, sizeof(header));
+
+    // Then the text starts and overflow table.
+    file.write((const char*) textStartData, (numTexts + 1) * sizeof(size_t));
+    file.write((const char*) overflowIndexData, numOverflows * sizeof(size_t));
+    file.write((const char*) overflowValueData, numOverflows * sizeof(size_t));
+
+    // And finally the bytes.
+    file.write((const char*) byteData, textStartData[numTexts]);
+
+    // Close up the file
+    file.close();
+}
+
+size_t MinUniqueTable::getRightLength(const TextPosition& position) const {
+    return get(position.getText(), position.getOffset());
+}
+
+size_t MinUniqueTable::getLeftLength(const TextPosition& position) const {
+    // The shortest unique string ending here is the reverse complement of the
+    // shortest unique string starting at the same base on the other strand.
+    size_t text = position.getText();
+    size_t length = textStartData[text + 1] - textStartData[text];
+    return get(text ^ 1, length - position.getOffset() - 1);
+}
+
+void MinUniqueTable::getRightLengths(size_t contig, size_t start, size_t end,
+    size_t* out) const {
+
+    for(size_t i = start; i < end; i++) {
+        *out++ = get(contig * 2, i);
+    }
+}
+
+void MinUniqueTable::getLeftLengths(size_t contig, size_t start, size_t end,
+    size_t* out) const {
+
+    for(size_t i = start; i < end; i++) {
+        *out++ = getLeftLength(TextPosition(contig * 2, i));
+    }
+}
+
+size_t MinUniqueTable::get(size_t text, size_t offset) const {
+    if(text >= numTexts ||
+        offset >= textStartData[text + 1] - textStartData[text]) {
+
+        throw std::runtime_error("Position " + std::to_string(offset) +
+            " on text " + std::to_string(text) +
+            " is not in the minimal unique length table");
+    }
+
+    size_t entry = textStartData[text] + offset;
+    uint8_t small = byteData[entry];
+    if(small != ESCAPE) {
+        return small;
+    }
+
+    // Otherwise it's in the overflow table, sorted by index.
+    const size_t* found = std::lower_bound(overflowIndexData,
+        overflowIndexData + numOverflows, entry);
+    return overflowValueData[found - overflowIndexData];
+}
+
+void MinUniqueTable::useVectors() {
+    textStartData = textStarts.data();
+    byteData = bytes.data();
+    overflowIndexData = overflowIndices.data();
+    overflowValueData = overflowValues.data();
+}
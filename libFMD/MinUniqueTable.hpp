@@ -0,0 +1,172 @@
+#ifndef MINUNIQUETABLE_HPP
+#define MINUNIQUETABLE_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "TextPosition.hpp"
+#include "MappedFile.hpp"
+
+// Forward declaration for circular dependencies
+class FMDIndex;
+
+/**
+ * Defines a table holding, for every base of every text in an index, the
+ * length of the shortest substring starting at that base that occurs only once
+ * in the index (counting both strands), and so also the length of the shortest
+ * such substring ending there. When the query is a contig that is already in
+ * the index, as when merging, this answers where its contexts become unique by
+ * lookup, instead of by retracting and extending through the index.
+ *
+ * A length of 0 means the text runs out before any substring starting there
+ * becomes unique.
+ *
+ * Uniqueness is against the whole index. Merging positions together with the
+ * ranges of an FMDIndexView, or masking them out, can only make strings unique
+ * sooner. So for a query taken from the index, a search that is longer than
+ * the stored length and still finds something in a view finds only the
+ * query's own position there, and can be retracted straight to the stored
+ * length and still be unique. The mapping schemes use this to skip most of
+ * the retraction when looking for shortest unique contexts.
+ *
+ * Lengths are stored one byte each, with the rare ones that don't fit in a
+ * byte kept in a sorted overflow table, like in LCPArray. A saved table is
+ * memory-mapped and used in place.
+ */
+class MinUniqueTable {
+
+public:
+    /**
+     * Build a new MinUniqueTable for all the texts in the given index, from
+     * its LCP array, with one LF walk along each text.
+     */
+    MinUniqueTable(const FMDIndex& index);
+
+    /**
+     * Load a MinUniqueTable from the given file. Uses platform-dependent byte
+     * order and size_t size. The file is memory-mapped rather than read, and
+     * must not be modified while the MinUniqueTable exists.
+     */
+    MinUniqueTable(const std::string& filename);
+
+    /**
+     * Get rid of a MinUniqueTable, unmapping its file if it was loaded from
+     * one.
+     */
+    ~MinUniqueTable();
+
+    /**
+     * Save a MinUniqueTable to the given file. Uses platform-dependent byte
+     * order and size_t size.
+     */
+    void save(const std::string& filename) const;
+
+    /**
+     * Get the length of the shortest substring starting at the given position
+     * and going right along its text that is unique in the index, or 0 if
+     * there is none.
+     */
+    size_t getRightLength(const TextPosition& position) const;
+
+    /**
+     * Get the length of the shortest substring ending at the given position
+     * and going left along its text that is unique in the index, or 0 if there
+     * is none.
+     */
+    size_t getLeftLength(const TextPosition& position) const;
+
+    /**
+     * Write the right lengths for the bases of the given contig's forward
+     * strand at each 0-based offset in [start, end) to out, in order, so a
+     * mapping scheme mapping that part of the contig can use them as limits
+     * on how long each base's shortest unique context can be.
+     */
+    void getRightLengths(size_t contig, size_t start, size_t end,
+        size_t* out) const;
+
+    /**
+     * Write the left lengths for the bases of the given contig's forward
+     * strand at each 0-based offset in [start, end) to out, in order.
+     */
+    void getLeftLengths(size_t contig, size_t start, size_t end,
+        size_t* out) const;
+
+    /**
+     * Get the number of texts the table covers.
+     */
+    inline size_t getNumberOfTexts() const {
+        return numTexts;
+    }
+
+    /**
+     * Get the number of bytes the table takes up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return textStarts.capacity() * sizeof(size_t) + bytes.capacity() +
+            (overflowIndices.capacity() + overflowValues.capacity()) *
+            sizeof(size_t) + (mapping != NULL ? mapping->getSize() : 0);
+    }
+
+protected:
+    /**
+     * What byte value says an entry is in the overflow table?
+     */
+    static const uint8_t ESCAPE = 255;
+
+    /**
+     * What word starts a saved table?
+     */
+    static const size_t MAGIC = 0x31534e5543494d55ULL;
+
+    /**
+     * Get the right length for the given offset in the given text.
+     */
+    size_t get(size_t text, size_t offset) const;
+
+    /**
+     * Point the data pointers at the vectors, once they have been filled in.
+     */
+    void useVectors();
+
+    // Store where each text's entries start, plus a past-the-end entry, if we
+    // built the table ourselves.
+    std::vector<size_t> textStarts;
+
+    // Store the lengths of at most 254 as bytes. Larger lengths are replaced
+    // with ESCAPE.
+    std::vector<uint8_t> bytes;
+
+    // Store the indices of the lengths that didn't fit, in order.
+    std::vector<size_t> overflowIndices;
+
+    // And the lengths themselves.
+    std::vector<size_t> overflowValues;
+
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+
+    // How many texts are there?
+    size_t numTexts;
+
+    // How many lengths are in the overflow table?
+    size_t numOverflows;
+
+    // Point to the text starts, bytes, and overflow table, either in the
+    // vectors or in the mapped file.
+    const size_t* textStartData;
+    const uint8_t* byteData;
+    const size_t* overflowIndexData;
+    const size_t* overflowValueData;
+
+private:
+    // MinUniqueTables can't be copied, since they may own a mapping.
+    MinUniqueTable(const MinUniqueTable& other) = delete;
+
+    // Or assigned.
+    MinUniqueTable& operator=(const MinUniqueTable& other) = delete;
+
+};
+
+#endif
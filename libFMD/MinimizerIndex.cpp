@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "MinimizerIndex.hpp"
+#include "FMDIndex.hpp"
+#include "Log.hpp"
+
+MinimizerIndex::MinimizerIndex(const FMDIndex& index, size_t k, size_t w):
+    k(k), w(w), mask(k >= 32 ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * k)) - 1),
+    minimizers() {
+
+    if(k == 0 || k > 32) {
+        throw std::runtime_error("Minimizer k-mer length " +
+            std::to_string(k) + " is not between 1 and 32");
+    }
+    if(w == 0) {
+        throw std::runtime_error("Minimizer windows must hold a k-mer");
+    }
+
+    Log::info() << "Collecting (" << w << ", " << k << ") minimizers of " <<
+        index.getNumberOfContigs() << " contigs" << std::endl;
+
+    // Minimizers are strand-independent, so one strand of each contig is
+    // enough.
+    std::vector<size_t> found;
+    for(size_t contig = 0; contig < index.getNumberOfContigs(); contig++) {
+        std::string sequence = index.displayContig(contig);
+        forEachMinimizer(sequence.data(), sequence.size(),
+            [&](uint64_t minimizer) {
+
+            found.push_back(minimizer);
+            return false;
+        });
+    }
+
+    // Keep one of each.
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    minimizers = EytzingerIndex(found);
+
+    Log::info() << "Found " << minimizers.size() << " distinct minimizers" <<
+        std::endl;
+}
+
+bool MinimizerIndex::hasHit(const std::string& query) const {
+    return forEachMinimizer(query.data(), query.size(),
+        [&](uint64_t minimizer) {
+
+        // It's there if some stored hash is at most it and none are equal.
+        return minimizers.countLess(minimizer) <
+            minimizers.countAtMost(minimizer);
+    });
+}
+
+template<typename Func>
+bool MinimizerIndex::forEachMinimizer(const char* sequence, size_t length,
+    Func&& func) const {
+
+    // Holds the hashes of the last w k-mers, by k-mer number mod w.
+    std::vector<uint64_t> window(w);
+
+    // Keep the forward and reverse complement codes of the current k-mer.
+    uint64_t forward = 0;
+    uint64_t reverse = 0;
+    // How many valid bases have we seen in a row?
+    size_t run = 0;
+
+    // Where in the window is the current minimum, and what is it?
+    size_t minIndex = 0;
+    uint64_t minimum = 0;
+    // What did we last report? Only good if reported is set.
+    uint64_t last = 0;
+    bool reported = false;
+
+    for(size_t i = 0; i < length; i++) {
+        // Encode A, C, G and T as 0 to 3, and anything else as 4.
+        uint8_t code;
+        switch(sequence[i]) {
+        case 'A': case 'a': code = 0; break;
+        case 'C': case 'c': code = 1; break;
+        case 'G': case 'g': code = 2; break;
+        case 'T': case 't': code = 3; break;
+        default: code = 4; break;
+        }
+
+        if(code == 4) {
+            // No k-mer or window can span this, so start over.
+            run = 0;
+            reported = false;
+            continue;
+        }
+
+        forward = ((forward << 2) | code) & mask;
+        reverse = (reverse >> 2) | ((uint64_t) (3 - code) << (2 * (k - 1)));
+        run++;
+        if(run < k) {
+            continue;
+        }
+
+        // Which k-mer in the run is this, and where does it go in the
+        // window?
+        size_t kmer = run - k;
+        size_t slot = kmer % w;
+        window[slot] = hash(std::min(forward, reverse));
+
+        if(kmer == 0 || window[slot] <= minimum) {
+            // The new k-mer is the new minimum.
+            minIndex = slot;
+            minimum = window[slot];
+        } else if(slot == minIndex) {
+            // The minimum just fell out of the window. Find the new one among
+            // the k-mers we have.
+            size_t have = std::min(kmer + 1, w);
+            minIndex = 0;
+            for(size_t j = 1; j < have; j++) {
+                if(window[j] < window[minIndex]) {
+                    minIndex = j;
+                }
+            }
+            minimum = window[minIndex];
+        }
+
+        if(kmer + 1 < w) {
+            // The first window isn't full yet.
+            continue;
+        }
+
+        if(!reported || minimum != last) {
+            if(func(minimum)) {
+                return true;
+            }
+            last = minimum;
+            reported = true;
+        }
+    }
+    return false;
+}
+
+uint64_t MinimizerIndex::hash(uint64_t code) const {
+    // This is Thomas Wang's invertible integer hash, kept within the k-mer
+    // bits so distinct k-mers never collide.
+    code = (~code + (code << 21)) & mask;
+    code = code ^ (code >> 24);
+    code = (code + (code << 3) + (code << 8)) & mask;
+    code = code ^ (code >> 14);
+    code = (code + (code << 2) + (code << 4)) & mask;
+    code = code ^ (code >> 28);
+    code = (code + (code << 31)) & mask;
+    return code;
+}
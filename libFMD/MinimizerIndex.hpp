@@ -0,0 +1,95 @@
+#ifndef MINIMIZERINDEX_HPP
+#define MINIMIZERINDEX_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "EytzingerIndex.hpp"
+
+// Forward declaration for circular dependencies
+class FMDIndex;
+
+/**
+ * Defines the set of (w, k) minimizers of all the contigs in an index, for
+ * throwing out queries that can't map before doing any searching.
+ *
+ * Every window of w consecutive k-mers contributes the smallest hash of any
+ * k-mer in it. K-mers are hashed on whichever strand gives the smaller code,
+ * so a window and its reverse complement have the same minimizer. Windows
+ * with anything other than A, C, G or T in them contribute nothing.
+ *
+ * Any exact match between a query and the index at least getSpan() bases long
+ * covers a whole window, and so shares that window's minimizer. A query with
+ * no minimizer in the set therefore has no exact match that long, on either
+ * strand, in any view of the index.
+ */
+class MinimizerIndex {
+
+public:
+    /**
+     * Collect the minimizers of every contig in the given index, with the
+     * given k-mer length (at most 32) and window size. Throws a
+     * std::runtime_error if either is out of range.
+     */
+    MinimizerIndex(const FMDIndex& index, size_t k = 15, size_t w = 10);
+
+    /**
+     * Does the given query have any minimizer that the index has?
+     */
+    bool hasHit(const std::string& query) const;
+
+    /**
+     * Get the length of the shortest exact match that is sure to share a
+     * minimizer: one window of k-mers.
+     */
+    inline size_t getSpan() const {
+        return k + w - 1;
+    }
+
+    /**
+     * Get the number of distinct minimizers stored.
+     */
+    inline size_t size() const {
+        return minimizers.size();
+    }
+
+protected:
+    /**
+     * Call the given function with the minimizer hash of every window of the
+     * given sequence, skipping repeats of the same minimizer from windows
+     * next to each other. Stops early if the function returns true, and
+     * returns whether it did.
+     */
+    template<typename Func>
+    bool forEachMinimizer(const char* sequence, size_t length,
+        Func&& func) const;
+
+    /**
+     * Mix the bits of the given k-mer code, so minimizers aren't just the
+     * k-mers that come first alphabetically.
+     */
+    uint64_t hash(uint64_t code) const;
+
+    /**
+     * How long are the k-mers?
+     */
+    size_t k;
+
+    /**
+     * How many k-mers are in a window?
+     */
+    size_t w;
+
+    /**
+     * Holds the mask with the low 2k bits set.
+     */
+    uint64_t mask;
+
+    /**
+     * Holds the distinct minimizer hashes of the index, for searching.
+     */
+    EytzingerIndex minimizers;
+};
+
+#endif
@@ -1,294 +1,238 @@
 #include "NaturalMappingScheme.hpp"
 #include "Log.hpp"
+#include "MatchingStatistics.hpp"
 
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdint>
+#include <tuple>
 
-std::vector<Matching> NaturalMappingScheme::findMaxMatchings(
-    const std::string& query) const {
- 
-    Log::info() << "Looking for max matchings" << std::endl;
- 
-    // What matchings have we found?
-    std::vector<Matching> toReturn;
- 
-    // Start with everything selected.
-    FMDPosition results = view.getIndex().getCoveringPosition();
+/**
+ * Run one 64-row block of the bit-parallel edit distance recurrence down one
+ * reference column, given the match mask for the reference base, the block's
+ * vertical delta vectors, and the horizontal delta coming in at the top of the
+ * block (-1, 0, or 1). Updates the vertical deltas, and returns the horizontal
+ * delta coming out at the given bit, which is the block's last row.
+ */
+static inline int advanceBlock(uint64_t equal, uint64_t& positive,
+    uint64_t& negative, int carryIn, uint64_t lastBit) {
+    
+    uint64_t verticalSeen = equal | negative;
+    if(carryIn < 0) {
+        equal |= 1;
+    }
+    uint64_t horizontalSeen = (((equal & positive) + positive) ^ positive) |
+        equal;
     
-    // How many characters are currently searched?
-    size_t patternLength = 0;
+    uint64_t horizontalPositive = negative | ~(horizontalSeen | positive);
+    uint64_t horizontalNegative = positive & horizontalSeen;
     
-    for(size_t i = query.size() - 1; i != (size_t) -1; i--) {
-        // For each position in the query from right to left, we're going to
-        // consider any maximal unique matches with left endpoints here.
-        
-        // We're going to extend backward with this new base.
-        FMDPosition extended = results;
-        view.getIndex().extendLeftOnly(extended, query[i]);
-        
-        if(results.isUnique(view) && extended.isEmpty(view)) {
-            // We are already a maximal unique match and can't extend any more.
-            // Report ourselves.
-            // Note that we can only ever do this once per left endpoint.
-            
-            
-            // Make a Matching to this chosen place. Make sure we fix the left
-            // endpoint in the query as i + 1, since we moved i left already and
-            // we want to talk about where it was last loop.
-            auto maxMatching = Matching(i + 1,  results.getTextPosition(view),
-                patternLength);
-            
-            // Send it off
-            if(i < 100) {
-                Log::info() << "Found max matching " << maxMatching << std::endl;
-            }
-            toReturn.push_back(maxMatching);
-        }
-        
-        
-        while(extended.isEmpty(view)) {
-            // If you can't extend, retract until you can. TODO: Assumes we
-            // can find at least one result for any character.
-            
-            // Retract the character
-            FMDPosition retracted = results;
-            // Make sure to drop characters from the total pattern length.
-            view.getIndex().retractRightOnly(retracted, --patternLength);
-            
-            // Try extending again
-            extended = retracted;
-            view.getIndex().extendLeftOnly(extended, query[i]);
-            
-            // Say that last step we came from retracted.
-            results = retracted;
-        }
-    
-        // We successfully extended.
-        results = extended;
-        // Increment the pattern length since we did actually extedn by 1. 
-        patternLength++;
+    int carryOut = 0;
+    if(horizontalPositive & lastBit) {
+        carryOut = 1;
+    } else if(horizontalNegative & lastBit) {
+        carryOut = -1;
     }
     
-    if(results.isUnique(view)) {
-        Log::info() << "Unique at left edge" << std::endl;
-    
-        // We are a maximal unique match butted up against the left edge. Report
-        // it.
-        // TODO: don't duplicate this code.
-        
-        // Make a Matching to this chosen place.
-        auto maxMatching = Matching(0,  results.getTextPosition(view),
-            patternLength);
-        
-        // Send it off
-        Log::info() << "Found max matching " << maxMatching << std::endl;
-        toReturn.push_back(maxMatching);
-    } else {
-        Log::info() << "Not unique at left edge" << std::endl;
+    horizontalPositive <<= 1;
+    horizontalNegative <<= 1;
+    if(carryIn < 0) {
+        horizontalNegative |= 1;
+    } else if(carryIn > 0) {
+        horizontalPositive |= 1;
     }
     
-    // This works: if there were a longer unique match on the right, we would
-    // not have retracted. And we explicitly check to see if there is a longer
-    // unique match on the left.
+    positive = horizontalNegative | ~(verticalSeen | horizontalPositive);
+    negative = horizontalPositive & verticalSeen;
     
-    return toReturn;
+    return carryOut;
 }
 
-std::vector<Matching>  NaturalMappingScheme::findMinMatchings(
-    const std::string& query) const {
-
-    // What matchings have we found?
-    std::vector<Matching> toReturn;
- 
-    // Start with everything selected.
-    FMDPosition results = view.getIndex().getCoveringPosition();
+/**
+ * Compute the edit distance between the given query bases and the given
+ * reference, with the semantics of NaturalMappingScheme::countEdits, using
+ * Myers' bit-parallel algorithm with Hyyro's blocking for queries longer than
+ * 64 bases. The query runs down the columns, so every reference base costs one
+ * pass over ceil(queryLength / 64) words.
+ *
+ * If threshold is nonnegative, may return it as soon as it is clear the
+ * distance can't be less.
+ */
+static size_t bitParallelEditDistance(const char* query, size_t queryLength,
+    const std::string& reference, int64_t threshold, bool leftJustify,
+    bool rightJustify) {
+    
+    // How many 64-row blocks do we need?
+    size_t blocks = (queryLength + 63) / 64;
+    // What bit in the last block is the last query base?
+    uint64_t lastBit = (uint64_t) 1 << ((queryLength - 1) % 64);
+    
+    // Give each distinct query character a slot with a match mask for each
+    // block. Reference characters not in the query match nothing.
+    int slots[256];
+    std::fill(slots, slots + 256, -1);
+    std::vector<uint64_t> matchMasks;
+    for(size_t i = 0; i < queryLength; i++) {
+        int& slot = slots[(unsigned char) query[i]];
+        if(slot == -1) {
+            slot = matchMasks.size() / blocks;
+            matchMasks.resize(matchMasks.size() + blocks, 0);
+        }
+        matchMasks[slot * blocks + i / 64] |= (uint64_t) 1 << (i % 64);
+    }
     
-    // How many characters are currently searched?
-    size_t patternLength = 0;
-
-    // Flag that says whether we need to retract at least once before we can
-    // find another minimal unique match, since we just found one ending at a
-    // certain place. TODO: Find a cleaner way to do this.
-    bool mustRetract = false;
-    
-    for(size_t i = query.size() - 1; i != (size_t) -1; i--) {
-        // For each position in the query from right to left, we're going to
-        // consider any minimal unique matches with left endpoints here.
-        
-        // Retract on the right until we can successfully extend on the left
-        // without running out of results.
-        
-        // We're going to extend backward with this new base.
-        FMDPosition extended = results;
-        view.getIndex().extendLeftOnly(extended, query[i]);
-        
-        while(extended.isEmpty(view)) {
-            Log::info() << extended << " is empty" << std::endl;
-        
-            if(patternLength <= 1) {
-                // We only work if all bases exist in the index (A and C and G
-                // and T). This is not a difficult requirement to meet, but
-                // somehow we didn't meet it.
-                throw std::runtime_error(
-                    "Could not find any results for a " +
-                        std::to_string(patternLength) + " length pattern!");
-            }
+    // Column 0 goes up by 1 per query base, since unused query bases always
+    // cost.
+    std::vector<uint64_t> positive(blocks, ~(uint64_t) 0);
+    std::vector<uint64_t> negative(blocks, 0);
+    
+    // Track the cost in the last row, and the best we've seen there for when
+    // we aren't right-justifying.
+    size_t cost = queryLength;
+    size_t best = cost;
+    
+    for(size_t j = 0; j < reference.size(); j++) {
+        int slot = slots[(unsigned char) reference[j]];
         
-            // If you can't extend, retract until you can. TODO: Assumes we
-            // can find at least one result for any character.
-            
-            // Retract the character
-            FMDPosition retracted = results;
-            // Make sure to drop characters from the total pattern length.
-            view.getIndex().retractRightOnly(retracted, --patternLength);
-            mustRetract = false;
-            
-            Log::info() << "Retracted to " << patternLength << std::endl;
-            
-            // Try extending again
-            extended = retracted;
-            view.getIndex().extendLeftOnly(extended, query[i]);
-            
-            // Say that last step we came from retracted.
-            results = retracted;
+        // The top row goes up by 1 per reference base only when we are
+        // left-justifying.
+        int carry = leftJustify ? 1 : 0;
+        for(size_t block = 0; block < blocks; block++) {
+            carry = advanceBlock(slot == -1 ? 0 :
+                matchMasks[slot * blocks + block], positive[block],
+                negative[block], carry,
+                block + 1 == blocks ? lastBit : (uint64_t) 1 << 63);
         }
         
-        // Extend on the left.
-        results = extended;
-        patternLength++;
+        // The carry out of the last block is the change in the last row.
+        cost += carry;
+        best = std::min(best, cost);
         
-        // Retract on the right until the next retraction would make us not
-        // unique, and report a minimal unique match starting at this position.
-        FMDPosition retracted = results;
-        view.getIndex().retractRightOnly(retracted, patternLength - 1);
-        
-        while(retracted.isUnique(view)) {
-            // Retract until we would no longer be unique. Make sure to drop
-            // characters from the total pattern length.
-            results = retracted;
-            view.getIndex().retractRightOnly(retracted, (--patternLength) - 1);
-            mustRetract = false;
-        }
-        
-        if(results.isUnique(view) && retracted.isAmbiguous(view) &&
-            !mustRetract) {
-            
-            // We found a minimally unique match starting at this position and
-            // ending patternLength right from here. Just match it up against
-            // any text that's selected. It would be a lot of work to go through
-            // all the texts available to minimal matches, and we don't really
-            // use their locations much anyway.
-            toReturn.push_back(Matching(i,  results.getTextPosition(view),
-                patternLength));
-                
-            // We can't find another minimal match until we move the right
-            // endpoint.
-            mustRetract = true;
+        // Each remaining reference base can bring the last row down by at most
+        // 1.
+        size_t remaining = reference.size() - j - 1;
+        if(threshold >= 0 && cost >= (size_t) threshold + remaining &&
+            (rightJustify || best >= (size_t) threshold)) {
+            
+            // We can't get under the threshold anymore.
+            return threshold;
         }
     }
     
-    // When we get here, we already know we retracted as much as we could for
-    // the leftmost extension, so there are no more results to report.
-    
-    // This works: if there were a shorter unique match on the right starting at
-    // this position, we would have retracted to find it. And if there were a
-    // shorter unique match on the left ending at this position, we would have
-    // already reported it and not reported any more until we retracted.
-    
-    // Results will also come out in descending order by left endpoint.
-    
-    return toReturn;
+    // If we aren't right-justifying, the query can stop before the end of the
+    // reference for free.
+    return rightJustify ? cost : best;
 }
 
-std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
+NaturalMappingScheme::MatchingGraph
     NaturalMappingScheme::generateMaxMatchingGraph(
-    std::vector<Matching> maxMatchings, const std::string& query) const {
-    
-    // Bucket the matchings by text and diagonal. TODO: make this an
-    // unordered_map and provide a way to hash pairs (which really seems like it
-    // ought to be in the STL already...)
-    std::map<std::pair<size_t, int64_t>, std::vector<Matching>> buckets;
-    
-    Log::info() << "Bucketing max matchings" << std::endl;
+    const std::vector<Matching>& maxMatchings, const std::string& query,
+    const QueryBudget& budget) const {
     
-    for(const Matching& matching : maxMatchings) {
-        // Claculate the diagonal: offset between the query and the reference
-        int64_t diagonal = (int64_t) matching.start - 
+    // Get the diagonal of a matching: offset between the query and the
+    // reference.
+    auto diagonalOf = [](const Matching& matching) {
+        return (int64_t) matching.start - 
             (int64_t) matching.location.getOffset();
-            
-        // Look up the vector for that text and that diagonal, and append this
-        // Matching to it. Matchings will stay in query order.
-        buckets[{matching.location.getText(), diagonal}].push_back(matching);
-            
-        // TODO: maybe make the buckets maps on start, end pairs to save some
-        // copying around?
+    };
+    
+    // Bucket the matchings by text and diagonal, by sorting their indices on
+    // text, diagonal, and query start. Each bucket is then a run of matchings
+    // in query order.
+    std::vector<size_t> sorted(maxMatchings.size());
+    for(size_t i = 0; i < sorted.size(); i++) {
+        sorted[i] = i;
     }
     
-    // Index each bucket for preceeding-range queries
-    std::map<std::pair<size_t, int64_t>, IntervalIndex<Matching>> indices;
-    
-    Log::info() << "Indexing " << buckets.size() << " buckets" << std::endl;
-    
-    for(const auto& kv : buckets) {
-        // For each bucket...
+    Log::info() << "Bucketing max matchings" << std::endl;
     
-        // Make start, end keys for all the Matchings
-        std::vector<std::pair<std::pair<size_t, size_t>, Matching>> withKeys;
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) {
+        const Matching& first = maxMatchings[a];
+        const Matching& second = maxMatchings[b];
+        return std::make_tuple(first.location.getText(), diagonalOf(first),
+            first.start) < std::make_tuple(second.location.getText(),
+            diagonalOf(second), second.start);
+    });
+    
+    // Holds the text and diagonal of each bucket, in sorted order.
+    std::vector<std::pair<size_t, int64_t>> bucketKeys;
+    // Holds where each bucket starts in sorted, plus a past-the-end entry.
+    std::vector<size_t> bucketStarts;
+    
+    for(size_t i = 0; i < sorted.size(); i++) {
+        const Matching& matching = maxMatchings[sorted[i]];
+        std::pair<size_t, int64_t> key(matching.location.getText(),
+            diagonalOf(matching));
         
-        for(const Matching& matching : kv.second) {
-            // For each matching, put it in the vector with its start, length
-            // range.
-            withKeys.push_back({{matching.start, matching.length}, matching});
+        if(bucketKeys.empty() || bucketKeys.back() != key) {
+            // This matching starts a new bucket.
+            bucketKeys.push_back(key);
+            bucketStarts.push_back(i);
         }
-    
-        // Make an IntervalIndex from the vector of mappings and keys. This
-        // should be pre-sorted. Store it under the same text and diagonal as
-        // the bucket.
-        indices.emplace(kv.first, IntervalIndex<Matching>(withKeys));
     }
+    bucketStarts.push_back(sorted.size());
+    
+    Log::info() << "Found " << bucketKeys.size() << " buckets" << std::endl;
     
-    // Now we have our index built. We need to turn this into a graph with
-    // costs.
-    std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
-        graph;
+    // Now we have our buckets built. We need to turn this into a graph with
+    // costs. Each matching has at most one edge per nearby diagonal, plus its
+    // self edge.
+    MatchingGraph graph;
+    graph.edgeStarts.reserve(maxMatchings.size() + 1);
+    graph.edges.reserve(maxMatchings.size());
         
     Log::info() << "Building graph" << std::endl;
     
-    for(const Matching& matching : maxMatchings) {
+    for(size_t i = 0; i < maxMatchings.size(); i++) {
         // For each matching
+        const Matching& matching = maxMatchings[i];
+        
+        if(budget.isSpent()) {
+            // Nobody is going to use the graph anyway.
+            break;
+        }
+        
+        // Its edges start here.
+        graph.edgeStarts.push_back(graph.edges.size());
     
         // What are the text and diagonal?
         size_t text = matching.location.getText();
-        int64_t diagonal = (int64_t) matching.start - 
-            (int64_t) matching.location.getOffset();
-    
-        for(int64_t offset = - (int64_t) maxHammingDistance;
-            offset <= (int64_t) maxHammingDistance; offset++) {
-            // Scan the diagonals up and down by maxHammingDistance
-            int64_t otherDiagonal = diagonal + offset;
-
-            if(!indices.count({text, otherDiagonal})) {
-                // Nothing else is on this diagonal.
-                continue;
-            }
-            
-            if(matching.start == 0 || 
-                !indices[{text, otherDiagonal}].hasStartingBefore(
-                matching.start - 1)) {
+        int64_t diagonal = diagonalOf(matching);
+        
+        // Scan the diagonals up and down by maxHammingDistance. Those buckets
+        // are all next to each other, so find the first one and walk along.
+        size_t bucket = std::lower_bound(bucketKeys.begin(), bucketKeys.end(),
+            std::make_pair(text, diagonal - (int64_t) maxHammingDistance)) -
+            bucketKeys.begin();
+    
+        for(; bucket < bucketKeys.size() && bucketKeys[bucket].first == text &&
+            bucketKeys[bucket].second <= diagonal +
+            (int64_t) maxHammingDistance; bucket++) {
+            
+            // How far off our diagonal is this one?
+            int64_t offset = bucketKeys[bucket].second - diagonal;
+            
+            // Find the first matching on this diagonal not starting strictly
+            // before the matching we are interested in. We have to be strict or
+            // we would find this matching before itself on its own diagonal.
+            auto after = std::lower_bound(sorted.begin() +
+                bucketStarts[bucket], sorted.begin() + bucketStarts[bucket + 1],
+                matching.start, [&](size_t other, size_t start) {
                 
+                return maxMatchings[other].start < start;
+            });
+            
+            if(after == sorted.begin() + bucketStarts[bucket]) {
                 // There is no matching on this diagonal starting strictly
-                // before the matching we are interested in. We have to be
-                // strict or we would find this matching before itself on its
-                // own diagonal. TODO: Should we make this a strictly before
-                // method and drop the -1?
+                // before the matching we are interested in.
                 continue;
             }
             
             // Get the last matching starting before this one starts, in the
             // other diagonal.
-            const Matching& previous = indices[{text, 
-                otherDiagonal}].getStartingBefore(matching.start - 1).second;
+            size_t previousIndex = *(after - 1);
+            const Matching& previous = maxMatchings[previousIndex];
             
             // How much are they separated in the query?            
             int64_t queryGapLength = (int64_t) matching.start -
@@ -346,275 +290,299 @@ std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
             
                 // Record an edge from this matching to the previous one with
                 // its cost.
-                graph[matching].push_back({previous, gapCost});
+                graph.edges.emplace_back(previousIndex, gapCost);
                 
             }
         }
         
         // Make sure to have a self edge at cost 0
-        graph[matching].push_back({matching, 0});
+        graph.edges.emplace_back(i, 0);
     }
+    graph.edgeStarts.push_back(graph.edges.size());
     
     // Give back the graph we have made.
     return graph;
 }
 
-std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
-    NaturalMappingScheme::invertGraph(const std::unordered_map<Matching,
-    std::vector<std::pair<Matching, size_t>>>& graph) const {
-    
-    // We need to invert the graph, so we need a new graph.
-    std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>> inverted;
+NaturalMappingScheme::MatchingGraph NaturalMappingScheme::invertGraph(
+    const MatchingGraph& graph) const {
+    
+    // We need to invert the graph, so we need a new graph, with the same
+    // number of nodes and edges.
+    size_t nodes = graph.edgeStarts.size() - 1;
+    MatchingGraph inverted;
+    inverted.edgeStarts.assign(nodes + 1, 0);
+    inverted.edges.resize(graph.edges.size());
+    
+    for(const auto& edge : graph.edges) {
+        // Count up the edges coming into each node.
+        inverted.edgeStarts[edge.first + 1]++;
+    }
+    for(size_t i = 0; i < nodes; i++) {
+        // Sum them up to get where each node's reversed edges start.
+        inverted.edgeStarts[i + 1] += inverted.edgeStarts[i];
+    }
     
-    for(const auto& kv : graph) {
+    // Then drop each edge into the next free slot for its destination, using
+    // a copy of the starts as the cursors.
+    std::vector<size_t> next(inverted.edgeStarts.begin(),
+        inverted.edgeStarts.end() - 1);
+    for(size_t i = 0; i < nodes; i++) {
         // For each source node and its edges
-        for(const auto& edge : kv.second) {
+        for(size_t j = graph.edgeStarts[i]; j < graph.edgeStarts[i + 1]; j++) {
             // For each {dest, cost} pair, add in the reverse edge
-            inverted[edge.first].push_back({kv.first, edge.second});
+            const auto& edge = graph.edges[j];
+            inverted.edges[next[edge.first]++] = {i, edge.second};
         }
     }
     
     return inverted;
 }
 
-const Matching& NaturalMappingScheme::getMaxMatching(
-    const IntervalIndex<Matching>& maxMatchings,
-    const Matching& minMatching) const {
-    
-    // What max matching contains this min matching? It should be the last one
-    // starting before it.
-    
-    if(!maxMatchings.hasStartingBefore(minMatching.start)) {
-        // Somehow we have an orphan min matching.
-        Log::critical() << "Min matching " << minMatching << 
-            " starts too early to be in a max matching!" << std::endl <<
-            std::flush;
-            
-        Log::critical() << "Next starting max matching is " <<
-            maxMatchings.getStartingAfter(minMatching.start).second <<
-            std::endl << std::flush;
-            
-        throw std::runtime_error(
-            "Min matching starts too early");
-    }
-
-    // Find the matching it has to be    
-    const Matching& maxMatching = maxMatchings.getStartingBefore(
-        minMatching.start).second;
-        
-    if(maxMatching.start + maxMatching.length < 
-        minMatching.start + minMatching.length) {
-        
-        // The max matching stops too early.
-        
-        Log::critical() << "Min matching " << minMatching << 
-            " ends too late to be in a max matching!" << std::endl <<
-            std::flush;
-            
-        Log::critical() << "Next ending max matching is " <<
-            maxMatchings.getEndingAfter(minMatching.start +
-            minMatching.length - 1).second << std::endl << std::flush;
-            
-        throw std::runtime_error(
-            "Min matching ends too late");
-    }
-    
-    Log::debug() << "Min matching " << minMatching << " has max matching " <<
-        maxMatching << std::endl;
-    
-    // Return the matching we found.
-    return maxMatching;
-    
-}
-
-std::unordered_map<Matching, IntervalIndex<Matching>> 
-    NaturalMappingScheme::assignMinMatchings(
-    const IntervalIndex<Matching>& maxMatchings,
+std::vector<size_t> NaturalMappingScheme::assignMinMatchings(
+    const std::vector<Matching>& maxMatchings,
     const std::vector<Matching>& minMatchings) const {
 
     // We need to assign the min matchings to max matchings.
     
-    // We keep a map from max matching to vector of min matchings with their
-    // ranges, in ascending order.
-    std::unordered_map<Matching,
-        std::vector<std::pair<std::pair<size_t, size_t>, Matching>>>
-        vectorForMax;
-        
     Log::info() << "Assigning " << minMatchings.size() << 
         " min matchings to " << maxMatchings.size() << " max matchings" <<
         std::endl;
     
-    for(const auto& minMatching : minMatchings) {
-        // For each min matching, find the max matching it belongs to and put it
-        // in that list. They come in in ascending order, so they also go out in
-        // ascending order.
-        
-        // Find the max matching
-        const Matching& maxMatching = getMaxMatching(maxMatchings, minMatching);
-        // Give this min matching to it. TODO: have a helper function to
-        // annotate matchings with their ranges like this, sine we do it in
-        // several places and keep getting it wrong.
-        vectorForMax[maxMatching].push_back({{minMatching.start, 
-            minMatching.length}, minMatching});
-    }
+    // Both lists are in ascending order, so the max matching for each min
+    // matching (the last one starting at or before it) only ever moves right,
+    // and we can find them all in one merge-style pass. Each max matching's
+    // min matchings come out as a run.
+    std::vector<size_t> minsForMax;
+    minsForMax.reserve(maxMatchings.size() + 1);
     
-    // But we really need this map from max matching to IntervalIndex of min
-    // matchings, instead of a map from max matching to vector of min matchings.
-    std::unordered_map<Matching, IntervalIndex<Matching>> minsForMax;
+    // Which max matching are we on? It has had its run start recorded.
+    size_t maxIndex = 0;
+    minsForMax.push_back(0);
     
-    Log::info() << "Indexing " << vectorForMax.size() <<
-        " min matching vectors" << std::endl;
+    for(size_t i = 0; i < minMatchings.size(); i++) {
+        // For each min matching, find the max matching it belongs to.
+        const Matching& minMatching = minMatchings[i];
+        
+        if(i > 0 && minMatching.start < minMatchings[i - 1].start) {
+            throw std::runtime_error("Min matchings out of order");
+        }
+        
+        while(maxIndex + 1 < maxMatchings.size() &&
+            maxMatchings[maxIndex + 1].start <= minMatching.start) {
+            // The next max matching starts at or before this min matching,
+            // so all the runs before it are done.
+            maxIndex++;
+            minsForMax.push_back(i);
+        }
+        
+        if(maxMatchings.empty() || maxMatchings[maxIndex].start >
+            minMatching.start) {
+            
+            // Somehow we have an orphan min matching.
+            Log::critical() << "Min matching " << minMatching << 
+                " starts too early to be in a max matching!" << std::endl <<
+                std::flush;
+                
+            throw std::runtime_error(
+                "Min matching starts too early");
+        }
+        
+        const Matching& maxMatching = maxMatchings[maxIndex];
+        
+        if(maxMatching.start + maxMatching.length < 
+            minMatching.start + minMatching.length) {
+            
+            // The max matching stops too early.
+            
+            Log::critical() << "Min matching " << minMatching << 
+                " ends too late to be in max matching " << maxMatching <<
+                std::endl << std::flush;
+                
+            throw std::runtime_error(
+                "Min matching ends too late");
+        }
+        
+        LOG_DEBUG("Min matching " << minMatching << " has max matching " <<
+            maxMatching << std::endl);
+    }
     
-    // Now we index the mins in each max.
-    for(const auto& kv : vectorForMax) {
-        // Just make an IntervalIndex of each vector.
-        minsForMax.emplace(kv.first, IntervalIndex<Matching>(kv.second));
+    while(minsForMax.size() < maxMatchings.size() + 1) {
+        // Finish off the runs of all the max matchings after the last one we
+        // used, plus the past-the-end entry.
+        minsForMax.push_back(minMatchings.size());
     }
     
     // Give back the assignments.
     return minsForMax;
 }
 
-std::unordered_map<Matching, std::vector<size_t>>
-    NaturalMappingScheme::getMinMatchingChains(const std::unordered_map<
-    Matching, std::vector<std::pair<
-    Matching, size_t>>>& maxMatchingGraph, const std::unordered_map<
-    Matching, IntervalIndex<
-    Matching>>& minsForMax, const std::vector<
-    Matching>& maxMatchings, bool isForward) const {
+std::vector<size_t> NaturalMappingScheme::getMinMatchingChains(
+    const MatchingGraph& maxMatchingGraph,
+    const std::vector<Matching>& maxMatchings,
+    const std::vector<Matching>& minMatchings,
+    const std::vector<size_t>& minsForMax, bool isForward,
+    const QueryBudget& budget) const {
  
     Log::info() << "Constructing min matching chains (forward: " <<
         isForward << ")" << std::endl;
         
-    for(const auto& kv : minsForMax) {
-        Log::debug() << "Max " << kv.first << " has mins:" << std::endl;
+    for(size_t i = 0; i < maxMatchings.size(); i++) {
+        LOG_DEBUG("Max " << maxMatchings[i] << " has mins:" << std::endl);
         
-        for(const auto& kv2 : kv.second) {
-            Log::debug() << "\tMin: " << kv2.second << std::endl;
+        for(size_t j = minsForMax[i]; j < minsForMax[i + 1]; j++) {
+            LOG_DEBUG("\tMin: " << minMatchings[j] << std::endl);
         }
     }
  
     // We have the max matching connectivity graph, the min matching
-    // assignments, and the list of max matchings in order.
+    // assignments, and the lists of max and min matchings in order.
     
     // If we are going backwards, turn the graph around so we can come from max
     // matchings on the right instead.
-    const auto& graph = isForward ? maxMatchingGraph : 
-        invertGraph(maxMatchingGraph);
+    MatchingGraph inverted;
+    if(!isForward) {
+        inverted = invertGraph(maxMatchingGraph);
+    }
+    const MatchingGraph& graph = isForward ? maxMatchingGraph : inverted;
         
     // Make a DP table, storing achievable numbers of non-overlapping min
     // matchings in a chain by min matching and then by mismatch cost (<=
-    // maxHammingDistance).
-    std::unordered_map<Matching, std::vector<size_t>> table;
-    
-    for(size_t i = isForward ? 0 : maxMatchings.size() - 1;
-        isForward ? i < maxMatchings.size() : i != (size_t) -1;
-        isForward ? i++ : i--) {
-        // For each max matching in the order we decided to go in (which would
-        // be a whole lot easier to write if it were possible to decide between
-        // std::vector::begin() and std::vector::rbegin() at runtime, I'll have
-        // you know...)
+    // maxHammingDistance). Every entry starts out with just the min matching
+    // itself.
+    size_t width = maxHammingDistance + 1;
+    std::vector<size_t> table(minMatchings.size() * width, 1);
+    
+    // For each edge out of the max matching we are on, this holds where we are
+    // in the other max matching's run of min matchings. Going forward, the
+    // min matching we can come from is the one before the cursor; going
+    // backward, it's the one at the cursor. As we walk through our own min
+    // matchings in order, the cursors only ever move the same way.
+    std::vector<size_t> cursors;
+    
+    for(size_t step = 0; step < maxMatchings.size(); step++) {
+        // For each max matching in the order we decided to go in
 
-        // Grab the matching
-        const auto& maxMatching = maxMatchings[i];
+        if(budget.isSpent()) {
+            // Nobody is going to use the table anyway.
+            break;
+        }
+        
+        size_t i = isForward ? step : maxMatchings.size() - 1 - step;
 
-        // Get the vector of all the min matchings in the current max matching,
+        // Get the run of all the min matchings in the current max matching,
         // in ascending order.
-        const IntervalIndex<Matching>& mins = minsForMax.at(maxMatching);
+        size_t firstMin = minsForMax[i];
+        size_t pastMin = minsForMax[i + 1];
+        if(firstMin == pastMin) {
+            // Nothing to chain.
+            continue;
+        }
+        
+        size_t firstEdge = graph.edgeStarts[i];
+        size_t pastEdge = graph.edgeStarts[i + 1];
+        
+        // Start each edge's cursor in the right place for our first min
+        // matching in the direction we are going.
+        const Matching& firstVisited = minMatchings[isForward ? firstMin :
+            pastMin - 1];
+        cursors.resize(pastEdge - firstEdge);
+        for(size_t e = firstEdge; e < pastEdge; e++) {
+            size_t prevMax = graph.edges[e].first;
+            auto runStart = minMatchings.begin() + minsForMax[prevMax];
+            auto runEnd = minMatchings.begin() + minsForMax[prevMax + 1];
+            
+            // Find the first min matching in the run that doesn't end before
+            // (going forward) or start after (going backward) ours.
+            auto found = isForward ?
+                std::partition_point(runStart, runEnd,
+                [&](const Matching& other) {
+                    return other.start + other.length <= firstVisited.start;
+                }) :
+                std::partition_point(runStart, runEnd,
+                [&](const Matching& other) {
+                    return other.start < firstVisited.start +
+                        firstVisited.length;
+                });
+            cursors[e - firstEdge] = found - minMatchings.begin();
+        }
 
-        for(size_t j = isForward ? 0 : mins.size() - 1;
-            isForward ? j < mins.size() : j != (size_t) -1;
-            isForward ? j++ : j--) {
-            // For each min matching in it, in the appropriate direction (at
-            // least 1 must exist)
-            const Matching& minMatching = mins[j].second;
-            
-            
-            // Fill its DP table with 1 non-overlapping min match at any cost.
-            table[minMatching] = std::vector<size_t>(maxHammingDistance + 1, 1);
-            
-            Log::debug() << "Initialized DP table for " << minMatching <<
-                std::endl;
+        for(size_t n = 0; n < pastMin - firstMin; n++) {
+            // For each min matching in it, in the appropriate direction
+            size_t j = isForward ? firstMin + n : pastMin - 1 - n;
+            const Matching& minMatching = minMatchings[j];
+            size_t* row = &table[j * width];
             
-            for(const auto& edge : graph.at(maxMatching)) {
+            for(size_t e = firstEdge; e < pastEdge; e++) {
                 // For each max matching we can pull from, and the cost to get
                 // there (at least the self edge must exist)
-                const Matching& prevMax = edge.first;
-                size_t edgeCost = edge.second;
-            
-                // Get the index of all the min matchings in the previous max
-                // matching, in ascending order.
-                const IntervalIndex<Matching>& prevMins = minsForMax.at(
-                    prevMax);
+                size_t prevMax = graph.edges[e].first;
+                size_t edgeCost = graph.edges[e].second;
+                
+                size_t prevFirst = minsForMax[prevMax];
+                size_t prevPast = minsForMax[prevMax + 1];
+                size_t& cursor = cursors[e - firstEdge];
                     
                 // There is only one min matching we need to consider coming
                 // from: the last non-overlapping min matching in that max
                 // matching (if we are going forward), or the first one (if we
                 // are going backwards).
-                
-                // TODO: make hasEndingBefore and friends use open intervals.
+                size_t prevMin;
                 if(isForward) {
                     // We are going forward, so we need to make sure there's
                     // something left of this min matching in that max matching.
-                    
-                    if(minMatching.start == 0) {
-                        Log::debug() << "Nothing in " << prevMax <<
-                            " can end before our start of 0." << std::endl;
+                    while(cursor < prevPast && minMatchings[cursor].start +
+                        minMatchings[cursor].length <= minMatching.start) {
                         
-                        // Skip on to the next graph edge.
-                        continue;
+                        cursor++;
                     }
                     
-                    if(!prevMins.hasEndingBefore(minMatching.start - 1)) {
-                        Log::debug() << "Nothing in " << prevMax <<
-                        " ends at or left of " << minMatching.start - 1 <<
-                        std::endl;
+                    if(cursor == prevFirst) {
+                        LOG_DEBUG("Nothing in " << maxMatchings[prevMax] <<
+                            " ends left of " << minMatching.start <<
+                            std::endl);
                         
                         // Skip on to the next graph edge.
                         continue;
                     }
+                    prevMin = cursor - 1;
                     
                 } else {
                     // We are going backward, so we need to make sure there's
                     // something right of this min matching in that max
                     // matching.
+                    while(cursor > prevFirst &&
+                        minMatchings[cursor - 1].start >=
+                        minMatching.start + minMatching.length) {
+                        
+                        cursor--;
+                    }
                     
-                    if(!prevMins.hasStartingAfter(minMatching.start + 
-                        minMatching.length)) {
-                    
-                        Log::debug() << "Nothing in " << prevMax <<
+                    if(cursor == prevPast) {
+                        LOG_DEBUG("Nothing in " << maxMatchings[prevMax] <<
                             " starts at or right of " << minMatching.start +
-                            minMatching.length << std::endl;
+                            minMatching.length << std::endl);
                         
                         // Skip on to the next graph edge.    
                         continue;
-                    
                     }
-                    
+                    prevMin = cursor;
                 }
-                
-                // Get the min matching that we need to consider coming from.
-                const Matching& prevMin = (isForward ? 
-                    prevMins.getEndingBefore(minMatching.start - 1) : 
-                    prevMins.getStartingAfter(minMatching.start + 
-                    minMatching.length)).second;
             
-                Log::debug() << "Could come to " << minMatching <<
-                    " from " << prevMin << " with cost " << edgeCost <<
-                    std::endl;
-                        
+                LOG_DEBUG("Could come to " << minMatching <<
+                    " from " << minMatchings[prevMin] << " with cost " <<
+                    edgeCost << std::endl);
+                
+                const size_t* prevRow = &table[prevMin * width];
                 for(size_t k = edgeCost; k <= maxHammingDistance; k++) {
                     // Scan the range of our table that we can potentially
                     // fill in from the other table.
                     
                     // How long a run would we get if we incured total cost
                     // i and came from the corresponding place in the
-                    // previous min match's table?
-                    size_t newRunLength = table[prevMin][k - edgeCost] + 1;
-                    
-                    // If the new run is longer, use it.
-                    table[minMatching][k] = std::max(table[minMatching][k],
-                        newRunLength);
+                    // previous min match's table? If the new run is longer,
+                    // use it.
+                    row[k] = std::max(row[k], prevRow[k - edgeCost] + 1);
                         
                     // We will still need to fill in higher-cost entries
                     // later if we don't find anything better at the higher
@@ -633,8 +601,7 @@ std::unordered_map<Matching, std::vector<size_t>>
                 // a lower cost, whichever is greater. And the longest run will
                 // the what it was before or what we find here, whichever is
                 // greater.
-                longestRun = table[minMatching][k] = std::max(
-                    table[minMatching][k], longestRun);
+                longestRun = row[k] = std::max(row[k], longestRun);
             }
         }
     }
@@ -647,7 +614,7 @@ std::set<Matching>
     NaturalMappingScheme::maxMatchingsInSyntenyRuns(
     const std::vector<Matching>& maxMatchings,
     const std::vector<Matching>& minMatchings,
-    const std::string& query) const {
+    const std::string& query, const QueryBudget& budget) const {
 
     // We need to make the connectivity graph, call the two directions of DP,
     // scan through the min matches, integrate the two directions, and flag the
@@ -655,59 +622,52 @@ std::set<Matching>
     // matchings that pass.
     
     // Make the max matching cost graph
-    auto graph = generateMaxMatchingGraph(maxMatchings, query);
-    
-    Log::info() << "Indexing all " << maxMatchings.size() << " max matchings" <<
-        std::endl;
-    
-    // Make a vector of max matchings with their occupied intervals.
-    std::vector<std::pair<std::pair<size_t, size_t>, Matching>> toIndex;
-    for(const Matching& maxMatching : maxMatchings) {
-        // Populate it with the inclusive start, end interval for each max
-        // matching. Make sure we do (start, length) pairs as required.
-        toIndex.push_back({{maxMatching.start, maxMatching.length},
-            maxMatching});
+    auto graph = generateMaxMatchingGraph(maxMatchings, query, budget);
+    if(budget.isSpent()) {
+        // The graph might not even have all its self edges.
+        return {};
     }
     
-    if(toIndex.size() > 0) {
-        Log::info() << "First max matching: " << (*toIndex.begin()).second <<
+    if(maxMatchings.size() > 0) {
+        Log::info() << "First max matching: " << maxMatchings.front() <<
             std::endl;
         
-        Log::info() << "Last max matching: " << (*toIndex.rbegin()).second <<
+        Log::info() << "Last max matching: " << maxMatchings.back() <<
             std::endl;
     }
     
-    // Index the max matchings by interval
-    IntervalIndex<Matching> index(toIndex);
-    
-    // Assign all the min matchings to their max matchings, using the index we
-    // just made.
-    auto minsForMax = assignMinMatchings(index, minMatchings);
-    
-    for(const auto& kv : minsForMax) {
-        Log::debug() << kv.first << " is a max." << std::endl;
-    }
+    // Assign all the min matchings to their max matchings.
+    auto minsForMax = assignMinMatchings(maxMatchings, minMatchings);
     
     // Do the DP looking left
-    auto forwardChains = getMinMatchingChains(graph, minsForMax, maxMatchings,
-        true);
+    auto forwardChains = getMinMatchingChains(graph, maxMatchings,
+        minMatchings, minsForMax, true, budget);
         
     // And looking right
-    auto reverseChains = getMinMatchingChains(graph, minsForMax, maxMatchings,
-        false);
+    auto reverseChains = getMinMatchingChains(graph, maxMatchings,
+        minMatchings, minsForMax, false, budget);
+    
+    if(budget.isSpent()) {
+        // The chains aren't finished.
+        return {};
+    }
         
     // Make the set to return.
     std::set<Matching> toReturn;
     
     Log::info() << "Checking for passing max matchings" << std::endl;
     
-    for(const Matching& maxMatching : maxMatchings) {
+    // How wide is each min matching's row in the chain tables?
+    size_t width = maxHammingDistance + 1;
+    
+    for(size_t i = 0; i < maxMatchings.size(); i++) {
+        const Matching& maxMatching = maxMatchings[i];
     
-        Log::debug() << "Evaluating max matching " << maxMatching << std::endl;
+        LOG_DEBUG("Evaluating max matching " << maxMatching << std::endl);
     
-        for(const auto& minMatchingRecord : minsForMax[maxMatching]) {
-            // For each min matching, which we pull out of its index record...
-            const Matching& minMatching = minMatchingRecord.second;
+        for(size_t j = minsForMax[i]; j < minsForMax[i + 1]; j++) {
+            // For each min matching in it...
+            const Matching& minMatching = minMatchings[j];
             
             // How long of a synteny chain is it in?
             size_t bestChain = 0;
@@ -721,14 +681,13 @@ std::set<Matching>
                 
                 // How long a run can we get on that budget in each direction?
                 // Subtract 1 so we don't double-count this min match.
-                size_t runLength = forwardChains[minMatching][forwardCost] +
-                    reverseChains[minMatching][reverseCost] - 1;
+                size_t forwardRun = forwardChains[j * width + forwardCost];
+                size_t reverseRun = reverseChains[j * width + reverseCost];
+                size_t runLength = forwardRun + reverseRun - 1;
                    
-               Log::debug() << "Cost " << forwardCost << "|" << reverseCost <<
-                    ": chain with " <<
-                    forwardChains[minMatching][forwardCost] << " + " <<
-                    reverseChains[minMatching][reverseCost] << " - 1 = " <<
-                    runLength << " min matchings" << std::endl;
+               LOG_DEBUG("Cost " << forwardCost << "|" << reverseCost <<
+                    ": chain with " << forwardRun << " + " << reverseRun <<
+                    " - 1 = " << runLength << " min matchings" << std::endl);
                     
                 bestChain = std::max(bestChain, runLength);
             }
@@ -739,17 +698,17 @@ std::set<Matching>
                 // enough chain, and is itself sufficiently long, so keep it.
                 toReturn.insert(maxMatching);
                 
-                Log::debug() << "Taking " << maxMatching << " with chain of " <<
-                    bestChain << std::endl;
+                LOG_DEBUG("Taking " << maxMatching << " with chain of " <<
+                    bestChain << std::endl);
                 
                 // Skip the rest of the min matchings.
                 break;
             } else {
                 // We couldn't find a good enough chain through this min
                 // matching.
-                Log::debug() << "Best synteny chain involving " <<
+                LOG_DEBUG("Best synteny chain involving " <<
                     minMatching << " is only " << bestChain << " long" <<
-                    std::endl;
+                    std::endl);
             }
                 
         }
@@ -757,8 +716,8 @@ std::set<Matching>
     }
     
     for(const auto& goodMatch : toReturn) {
-        Log::debug() << goodMatch << " has a good enough synteny chain" <<
-            std::endl;
+        LOG_DEBUG(goodMatch << " has a good enough synteny chain" <<
+            std::endl);
     }
     
     // Give back the set of max matchings that have a min matching in a good
@@ -768,7 +727,8 @@ std::set<Matching>
 }
 
 std::vector<Mapping> NaturalMappingScheme::naturalMap(
-    const std::string& query) const {
+    const std::string& query, const QueryBudget& budget,
+    const int64_t* rows, const size_t* uniqueLengths) const {
     
     // We need to find all the positions that map under the natural mapping
     // scheme without credit.
@@ -789,17 +749,24 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
     // How many bases are unmapped due to conflict?
     size_t unmappedByConflict = 0;
     
-    // Get the min and max matchings.
-    std::vector<Matching> minMatchings = findMinMatchings(query);
-    std::vector<Matching> maxMatchings = findMaxMatchings(query);
+    // Get the min and max matchings, both from one sweep along the query.
+    std::vector<Matching> minMatchings;
+    std::vector<Matching> maxMatchings;
+    {
+        StatTracker::ScopedPhase phase(contextSearchPhase);
+        MatchingStatistics statistics(view, query, false, true, contextCache,
+            rows, uniqueLengths);
+        minMatchings = statistics.getMinMatchings();
+        maxMatchings = statistics.getMaxMatchings();
+    }
     
     // Flip them around to ascending order
     std::reverse(minMatchings.begin(), minMatchings.end());
     std::reverse(maxMatchings.begin(), maxMatchings.end());
     
     for(Matching m : minMatchings) { 
-        Log::trace() << "Min matching: " << m.start << " - " <<
-            m.start + m.length << " (+" << m.length << ")" << std::endl;
+        LOG_TRACE("Min matching: " << m.start << " - " <<
+            m.start + m.length << " (+" << m.length << ")" << std::endl);
     }
     
     Log::info() << maxMatchings.size() << " maximal matchings exist." <<
@@ -811,7 +778,11 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
     // Which maximal matchings contain minimal matchings involved in
     // sufficiently good synteny runs?
     std::set<Matching> goodMaxMatchings = maxMatchingsInSyntenyRuns(
-        maxMatchings, minMatchings, query);
+        maxMatchings, minMatchings, query, budget);
+    if(budget.isSpent()) {
+        // We ran out of time in the DP, or before it.
+        return {};
+    }
     
     // Where will we keep unique matchings by base? We store them as sets of
     // TextPositions to which each base has been matched.
@@ -833,7 +804,7 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
         for(size_t i = matching.start;
             i < matching.start + matching.length; i++) {
             
-            Log::debug() << "Matching " << i << " to " << location << std::endl;
+            LOG_DEBUG("Matching " << i << " to " << location << std::endl);
             
             // For each position it covers, record the matching on that
             // position.
@@ -844,123 +815,59 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
         }
     }
     
-    for(const Matching& matching : maxMatchings) {
-        // For each matching...
-        if(!goodMaxMatchings.count(matching) &&
-            matching.length >= ignoreMatchesBelow) {
+    // Work out which of the other maximal matchings need their bases
+    // blacklisted. Each takes a couple of alignments, which don't depend on
+    // each other, so do them in parallel windows of the query by start
+    // position (the matchings are in order by start). Use chars so the windows
+    // don't share any bytes.
+    std::vector<char> blacklistMatching(maxMatchings.size(), false);
+    forEachWindow(query.size(), [&](size_t windowStart, size_t windowEnd) {
+        // Find the matchings starting in this window.
+        auto startsBefore = [](const Matching& matching, size_t position) {
+            return matching.start < position;
+        };
+        size_t first = std::lower_bound(maxMatchings.begin(),
+            maxMatchings.end(), windowStart, startsBefore) -
+            maxMatchings.begin();
+        size_t last = std::lower_bound(maxMatchings.begin(),
+            maxMatchings.end(), windowEnd, startsBefore) - maxMatchings.begin();
+        
+        for(size_t j = first; j < last && !budget.isSpent(); j++) {
+            // For each matching, while we still have time...
+            const Matching& matching = maxMatchings[j];
             
-            // We can't use it, because it doesn't have a MUS in a good enough
+            // We can't use it if it doesn't have a MUS in a good enough
             // synteny run, but we can't just ignore it.
+            blacklistMatching[j] = !goodMaxMatchings.count(matching) &&
+                matching.length >= ignoreMatchesBelow &&
+                mustBlacklist(query, matching);
+        }
+    });
+    
+    if(budget.isSpent()) {
+        // Some matchings that needed to be blacklisted might not be.
+        return {};
+    }
+    
+    for(size_t j = 0; j < maxMatchings.size(); j++) {
+        if(!blacklistMatching[j]) {
+            continue;
+        }
+        
+        const Matching& matching = maxMatchings[j];
+        
+        for(size_t i = matching.start;
+            i < matching.start + matching.length; i++) {
             
-            // We need to check if it can reach the ends of the query
-            // without too many mismatches, in which case we would need to
-            // blacklist it to preserve stability.
-            
-            // TODO: Split this out into a function?
-            
-            // How many bases on the left of this MUM in the query do we care
-            // about? We'll look up to half the max alignment size, since the
-            // other aligned sequence has to be double this length.
-            size_t leftQueryLength = std::min(matching.start,
-                maxAlignmentSize/2);
-            
-            // Where do I have to start from in the reference for the end of the
-            // query?
-            TextPosition leftReferenceStart = matching.location;
-            
-            // And how many do we care about in the reference? We need 2x the
-            // number in the query, or however many remain on the reference
-            // text, whichever is smaller, in order to be sure of getting the
-            // lowest-possible-cost one-side-justified alignment. TODO: how will
-            // this ever work for graphs???
-            size_t leftReferenceLength = std::min(2 * leftQueryLength,
-                leftReferenceStart.getOffset());
-            
-            // Budge the reference start position over that much.
-            leftReferenceStart.addLocalOffset(-leftReferenceLength);
-            
-            Log::debug() << "Doing alignment 0-" << leftQueryLength <<
-                " against " << leftReferenceStart << " + " <<
-                leftReferenceLength << std::endl;
-            
-            // What's the cost to reach out to the left end of the query? We
-            // right justify the alignment, and we don't care about the exact
-            // value if it's more than our maxHammingDistance.
-            size_t leftEndCost = countEdits(query, 0,  leftQueryLength,
-                leftReferenceStart, leftReferenceLength, maxHammingDistance + 1, 
-                false, true);
-            
-            // TODO: We repeat most of this stuff in the opposite polarity for
-            // the right side. Unify somehow?
-            
-            // Where does the bit after the MUM in the query start?
-            size_t rightQueryStart = matching.start + matching.length;
-            
-            // How many bases on the right of this MUM in the query do we care
-            // about? Again, we need to use double this from the reference, so
-            // we go up to half the max size.
-            size_t rightQueryLength = std::min(query.size() - rightQueryStart,
-                maxAlignmentSize/2);
-                
-            // Where do I have to start from in the reference for the start of the
-            // query?
-            TextPosition rightReferenceStart = matching.location;
-            rightReferenceStart.addLocalOffset(matching.length);
-                
-            // On the right side, we need again either twice the query length,
-            // or however much is available.
-            size_t rightReferenceLength = std::min(2 * rightQueryLength, 
-                view.getIndex().getContigLength(
-                rightReferenceStart.getContigNumber()) -
-                rightReferenceStart.getOffset());
-            
-            Log::debug() << "Doing alignment " << rightQueryStart << "-" << 
-                rightQueryStart + rightQueryLength << " against " <<
-                rightReferenceStart << " + " << rightReferenceLength <<
-                std::endl;
-            
-            // What's the cost to reach out to the right end of the query? We
-            // left justify the alignment, and we don't care about the exact
-            // value if it's more than our maxHammingDistance.
-            size_t rightEndCost = countEdits(query, rightQueryStart, 
-            rightQueryLength, rightReferenceStart, rightReferenceLength,
-            maxHammingDistance + 1, true, false);
-            
-            Log::debug() << matching << " has end costs " << leftEndCost <<
-                " in " << leftQueryLength << "|" << leftReferenceLength <<
-                " bases on the left and " << rightEndCost << " in " <<
-                rightQueryLength << "|" << rightReferenceLength <<
-                " bases on the right" << std::endl;
+            // Blacklist every query position in the matching.
+            blacklist[i] = true;
             
-            // TODO: what if there are plenty of differences, but not in range
-            // given the sizer of the alignment we are willing to do? Should we
-            // check over at the far ends instead or something?
+            LOG_DEBUG("Blacklisting base " << i << 
+                " for participation in max matching " << matching <<
+                std::endl);
             
-            if((!unstable && (leftEndCost <= maxHammingDistance ||
-                rightEndCost <= maxHammingDistance)) ||
-                conflictBelowThreshold) {
-                
-                // There aren't enough mismatches between here and the ends of
-                // the query, or we've opted to blacklist every little MUM that
-                // doesn't pass.
-                
-                
-                
-                for(size_t i = matching.start;
-                    i < matching.start + matching.length; i++) {
-                    
-                    // Blacklist every query position in the matching.
-                    blacklist[i] = true;
-                    
-                    Log::debug() << "Blacklisting base " << i << 
-                        " for participation in max matching " << matching <<
-                        std::endl;
-                    
-                    // TODO: Make this count as conflict if it stops any bases
-                    // from mapping.
-                    
-                }
-            }
+            // TODO: Make this count as conflict if it stops any bases
+            // from mapping.
             
         }
     }
@@ -1023,8 +930,8 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
             // query base.
             mappings[i] = Mapping(*(matchings[i].begin()));
         } else if(matchings[i].size() > 1) {
-            Log::debug() << "Conflict: " << matchings[i].size() <<
-                " matchings for base " << i << std::endl;
+            LOG_DEBUG("Conflict: " << matchings[i].size() <<
+                " matchings for base " << i << std::endl);
             unmappedByConflict++;
         }
     }
@@ -1036,6 +943,98 @@ std::vector<Mapping> NaturalMappingScheme::naturalMap(
     return mappings;
 }
 
+bool NaturalMappingScheme::mustBlacklist(const std::string& query,
+    const Matching& matching) const {
+    
+    // We need to check if it can reach the ends of the query
+    // without too many mismatches, in which case we would need to
+    // blacklist it to preserve stability.
+    
+    // How many bases on the left of this MUM in the query do we care
+    // about? We'll look up to half the max alignment size, since the
+    // other aligned sequence has to be double this length.
+    size_t leftQueryLength = std::min(matching.start,
+        maxAlignmentSize/2);
+    
+    // Where do I have to start from in the reference for the end of the
+    // query?
+    TextPosition leftReferenceStart = matching.location;
+    
+    // And how many do we care about in the reference? We need 2x the
+    // number in the query, or however many remain on the reference
+    // text, whichever is smaller, in order to be sure of getting the
+    // lowest-possible-cost one-side-justified alignment. TODO: how will
+    // this ever work for graphs???
+    size_t leftReferenceLength = std::min(2 * leftQueryLength,
+        leftReferenceStart.getOffset());
+    
+    // Budge the reference start position over that much.
+    leftReferenceStart.addLocalOffset(-leftReferenceLength);
+    
+    LOG_DEBUG("Doing alignment 0-" << leftQueryLength <<
+        " against " << leftReferenceStart << " + " <<
+        leftReferenceLength << std::endl);
+    
+    // What's the cost to reach out to the left end of the query? We
+    // right justify the alignment, and we don't care about the exact
+    // value if it's more than our maxHammingDistance.
+    size_t leftEndCost = countEdits(query, 0,  leftQueryLength,
+        leftReferenceStart, leftReferenceLength, maxHammingDistance + 1, 
+        false, true);
+    
+    // TODO: We repeat most of this stuff in the opposite polarity for
+    // the right side. Unify somehow?
+    
+    // Where does the bit after the MUM in the query start?
+    size_t rightQueryStart = matching.start + matching.length;
+    
+    // How many bases on the right of this MUM in the query do we care
+    // about? Again, we need to use double this from the reference, so
+    // we go up to half the max size.
+    size_t rightQueryLength = std::min(query.size() - rightQueryStart,
+        maxAlignmentSize/2);
+        
+    // Where do I have to start from in the reference for the start of the
+    // query?
+    TextPosition rightReferenceStart = matching.location;
+    rightReferenceStart.addLocalOffset(matching.length);
+        
+    // On the right side, we need again either twice the query length,
+    // or however much is available.
+    size_t rightReferenceLength = std::min(2 * rightQueryLength, 
+        view.getIndex().getContigLength(
+        rightReferenceStart.getContigNumber()) -
+        rightReferenceStart.getOffset());
+    
+    LOG_DEBUG("Doing alignment " << rightQueryStart << "-" << 
+        rightQueryStart + rightQueryLength << " against " <<
+        rightReferenceStart << " + " << rightReferenceLength <<
+        std::endl);
+    
+    // What's the cost to reach out to the right end of the query? We
+    // left justify the alignment, and we don't care about the exact
+    // value if it's more than our maxHammingDistance.
+    size_t rightEndCost = countEdits(query, rightQueryStart, 
+        rightQueryLength, rightReferenceStart, rightReferenceLength,
+        maxHammingDistance + 1, true, false);
+    
+    LOG_DEBUG(matching << " has end costs " << leftEndCost <<
+        " in " << leftQueryLength << "|" << leftReferenceLength <<
+        " bases on the left and " << rightEndCost << " in " <<
+        rightQueryLength << "|" << rightReferenceLength <<
+        " bases on the right" << std::endl);
+    
+    // TODO: what if there are plenty of differences, but not in range
+    // given the sizer of the alignment we are willing to do? Should we
+    // check over at the far ends instead or something?
+    
+    // We need to blacklist if there aren't enough mismatches between here and
+    // the ends of the query, or if we've opted to blacklist every little MUM
+    // that doesn't pass.
+    return (!unstable && (leftEndCost <= maxHammingDistance ||
+        rightEndCost <= maxHammingDistance)) || conflictBelowThreshold;
+}
+
 size_t NaturalMappingScheme::countEdits(const std::string& query,
     size_t queryStart, size_t queryLength, TextPosition referenceStart,
     size_t referenceLength, int64_t threshold, bool leftJustify,
@@ -1045,8 +1044,8 @@ size_t NaturalMappingScheme::countEdits(const std::string& query,
     // DP problem
     if(queryLength == 0) {
         // We have to delete every reference base.
-        Log::debug() << "Alignment is just to delete the reference" <<
-            std::endl; 
+        LOG_DEBUG("Alignment is just to delete the reference" <<
+            std::endl); 
         // This costs 1 per reference base, if we're justifying the query to
         // both ends. If we let the query not make it to one end of the
         // reference, then this is free.
@@ -1054,7 +1053,7 @@ size_t NaturalMappingScheme::countEdits(const std::string& query,
     }
     if(referenceLength == 0) {
         // We have to insert every query base.
-        Log::debug() << "Alignment is just to insert the query" << std::endl; 
+        LOG_DEBUG("Alignment is just to insert the query" << std::endl); 
         return queryLength;
     }
     
@@ -1066,9 +1065,9 @@ size_t NaturalMappingScheme::countEdits(const std::string& query,
         // We are justifying on both ends, and we know the difference in lengths
         // is at least the threshold. In that case, there must be at least
         // threshold edits.
-        Log::debug() << 
+        LOG_DEBUG(
             "Alignment length difference so great we don't have to do it" << 
-            std::endl;
+            std::endl);
         return threshold;
         
     }
@@ -1080,101 +1079,158 @@ size_t NaturalMappingScheme::countEdits(const std::string& query,
         return threshold;
     }
 
-    // Make the DP matrix for aligning these two strings. Indexed by query, then
-    // by reference. Start it full of 0s.
-    std::vector<std::vector<int>> matrix(queryLength + 1);
-    for(std::vector<int>& row : matrix) {
-        for(size_t i = 0; i < referenceLength + 1; i++) {
-            row.push_back(0);
-        }
-    } 
-    
-    // Initialize the first row and column of the matrix with the costs for
-    // reference and query gaps on the left edge.
-    for(size_t i = 0; i < queryLength + 1; i++) {
-        // How much is a gap in the reference at the left (unbused query bases)?
-        // Always 1.
-        matrix[i][0] = i;
-    }
-    for(size_t j = 0; j < referenceLength + 1; j++) {
-        // How much is a gap in the query at the left (unused reference bases)?
-        // Depends on if we're left-justifying or not.
-        matrix[0][j] = leftJustify * j;
+    // Note how big the alignment is, and count the work of doing it.
+    alignmentCellsStat.add(queryLength * referenceLength);
+    StatTracker::ScopedPhase phase(editCountingPhase);
+
+    // Pull out the reference bases once, instead of once per DP cell.
+    std::string reference(referenceLength, 'N');
+    for(size_t j = 0; j < referenceLength; j++) {
+        TextPosition referencePosition = referenceStart;
+        referencePosition.addLocalOffset(j);
+        reference[j] = view.getIndex().displayCached(referencePosition);
     }
     
-    // Now we computew and dump our DP matrix.
-    Log::debug() << "Actually doing alignment" << std::endl;
+    LOG_DEBUG("Actually doing alignment of " <<
+        query.substr(queryStart, queryLength) << " against " << reference <<
+        std::endl);
     
-    auto& headerLine = Log::debug() << std::setw(3) << "#" << std::setw(3) <<
-        "#";
-    for(size_t j = 1; j < referenceLength + 1; j++) {
-        // Dump all the reference characters as a line
-        TextPosition referencePosition = referenceStart;
-        referencePosition.addLocalOffset(j - 1);
-        headerLine << std::setw(3) <<
-        view.getIndex().displayCached(referencePosition);
-    }
-    headerLine << std::endl;
+    size_t cost = bitParallelEditDistance(query.c_str() + queryStart,
+        queryLength, reference, threshold, leftJustify, rightJustify);
+    
+    LOG_DEBUG("Alignment done with cost " << cost << std::endl);
+    
+    return cost;
+}
+
+void NaturalMappingScheme::map(const std::string& query,
+    std::function<void(size_t, TextPosition)> callback) const {
+    
+    // Just send everything through the callback.
+    map<std::function<void(size_t, TextPosition)>&>(query, callback);
+}
+
+void NaturalMappingScheme::mapRange(const std::string& query, size_t start,
+    size_t end, std::function<void(size_t, TextPosition)> callback) const {
     
-    auto& firstRow = Log::debug() << std::setw(3) << "#";
-    for(size_t j = 0; j < referenceLength + 1; j++) {
-        // Dump the first row of the matrix.
-        firstRow << std::setw(3) << matrix[0][j];
+    // Just send everything through the callback.
+    mapRange<std::function<void(size_t, TextPosition)>&>(query, start, end,
+        callback);
+}
+
+void NaturalMappingScheme::mapBatch(const std::vector<std::string>& queries,
+    MappingBatchResult& results) const {
+    
+    if(!repeatFilter || view.getMask() != nullptr ||
+        view.getRanges() != nullptr) {
+        // Everything has to be mapped.
+        MappingScheme::mapBatch(queries, results);
+        return;
     }
-    firstRow << std::endl;
     
-    for(size_t i = 1; i < queryLength + 1; i++) {
+    results.reset(queries);
     
-        auto& matrixLine = Log::debug() << std::setw(3) <<
-            query[queryStart + i - 1] << std::setw(3) << matrix[i][0];  
-        
-        for(size_t j = 1; j < referenceLength + 1; j++) {
-        
-            // For each interior position, see if you should have a gap in one,
-            // a gap in the other, or a match/mismatch
-            
-            // Don't advance in the reference, and pay 1 for a gap.
-            int referenceGapCost = matrix[i - 1][j] + 1;
-            
-            // Don't advance in the query, and pay 1 for a gap.
-            int queryGapCost = matrix[i][j - 1] + 1;
-            
-            if(!rightJustify && i == queryLength) {
-                // Don't charge the +1 for gaps in the query (unused reference
-                // bases) on the right end.
-                queryGapCost = matrix[i][j - 1];
-            }
+    // Search for the queries that are all bases, all at once.
+    std::vector<std::string> searchable;
+    std::vector<size_t> searchableQueries;
+    for(size_t i = 0; i < queries.size(); i++) {
+        if(!queries[i].empty() && std::all_of(queries[i].begin(),
+            queries[i].end(), isBase)) {
             
-            // Advance in both, and pay 1 if this isn't a match.
-            TextPosition referencePosition = referenceStart;
-            referencePosition.addLocalOffset(j - 1);
-            int matchMismatchCost = matrix[i - 1][j - 1] + 
-                (query[queryStart + i - 1] !=
-                view.getIndex().displayCached(referencePosition));
-                
-            // Adopt the cost of whatever the best choice was.
-            matrix[i][j] = std::min(std::min(queryGapCost, referenceGapCost),
-                matchMismatchCost);
-                
-            matrixLine << std::setw(3) << matrix[i][j];
+            searchable.push_back(queries[i]);
+            searchableQueries.push_back(i);
         }
-        matrixLine << std::endl;
+    }
+    std::vector<FMDPosition> found;
+    {
+        StatTracker::ScopedPhase phase(contextSearchPhase);
+        view.getIndex().countBatch(searchable, found);
     }
     
-    Log::debug() << "Alignment done!" << std::endl;
+    std::vector<bool> repeated(queries.size(), false);
+    for(size_t i = 0; i < found.size(); i++) {
+        // Every part of a query that is in more than one place is also in
+        // more than one place, so no part of it is unique.
+        repeated[searchableQueries[i]] = found[i].isAmbiguous(view);
+    }
     
-    // Read off the cost in the lower right
-    return matrix[queryLength][referenceLength];
+    for(size_t i = 0; i < queries.size(); i++) {
+        if(repeated[i]) {
+            // Nothing in it could map.
+            stats.add("repeatFiltered", 1);
+            stats.add("unmapped", queries[i].size());
+            continue;
+        }
+        
+        map(queries[i], [&](size_t base, TextPosition mappedTo) {
+            // Pack each mapping straight into the arena.
+            results.set(i, base, PackedMapping(Mapping(mappedTo)));
+        });
+    }
 }
 
-void NaturalMappingScheme::map(const std::string& query,
-    std::function<void(size_t, TextPosition)> callback) const {
+std::vector<std::pair<std::string, std::string>>
+    NaturalMappingScheme::getParameters() const {
+    
+    auto parameters = MappingScheme::getParameters();
+    parameters.insert(parameters.end(), {
+        {"multContext", std::to_string(multContext)},
+        {"minContext", std::to_string(minContext)},
+        {"conflictBelowThreshold", std::to_string(conflictBelowThreshold)},
+        {"z_max", std::to_string(z_max)},
+        {"credit", std::to_string(credit)},
+        {"ignoreMatchesBelow", std::to_string(ignoreMatchesBelow)},
+        {"minHammingBound", std::to_string(minHammingBound)},
+        {"maxHammingDistance", std::to_string(maxHammingDistance)},
+        {"maxAlignmentSize", std::to_string(maxAlignmentSize)},
+        {"unstable", std::to_string(unstable)},
+        {"repeatFilter", std::to_string(repeatFilter)}
+    });
+    return parameters;
+}
+
+std::vector<Mapping> NaturalMappingScheme::mapAll(
+    const std::string& query, const int64_t* rows,
+    const size_t* uniqueLengths) const {
+    
+    // Time the whole query, and trace it if it's slow.
+    QueryTimer timer(*this, query, queryNanosecondsStat);
     
     // Map using the natural context scheme: get matchings from all the
     // unique-in-the-reference strings that overlap you.
     
+    // Start the clock on the query's budget.
+    QueryBudget budget(queryMicroseconds);
+    
+    if(minimizerIndex != nullptr && minimizerIndex->getSpan() <= minContext &&
+        !minimizerIndex->hasHit(query)) {
+        // No maximal matching can be long enough to use, so nothing can map
+        // naturally or on credit.
+        stats.add("prefiltered", 1);
+        stats.add("unmapped", query.size());
+        timer.count("length", query.size());
+        timer.count("prefiltered", 1);
+        return std::vector<Mapping>(query.size());
+    }
+    
     // Map the query naturally.
-    std::vector<Mapping> naturalMappings = naturalMap(query);
+    std::vector<Mapping> naturalMappings = naturalMap(query, budget, rows,
+        uniqueLengths);
+    
+    if(naturalMappings.size() != query.size()) {
+        // We ran out of time, so leave the whole query unmapped.
+        Log::output() << "Query of " << query.size() <<
+            " bases ran out of budget" << std::endl;
+        overBudgetQueriesStat.add(1);
+        overBudgetBasesStat.add(query.size());
+        stats.add("unmapped", query.size());
+        timer.count("length", query.size());
+        timer.count("overBudget", query.size());
+        return std::vector<Mapping>(query.size());
+    }
+    
+    // This holds the final mappings, natural or on credit.
+    std::vector<Mapping> results(naturalMappings.size());
         
     // How many bases have we mapped or not mapped (credit or not).
     size_t mappedBases = 0;
@@ -1190,18 +1246,16 @@ void NaturalMappingScheme::map(const std::string& query,
         if(naturalMappings[i].isMapped()) {
             // If it actually mapped...
             
-            // Work out where to
-            TextPosition candidate = naturalMappings[i].getLocation();
-            
-            // Dispatch the callback with this query index and this
-            // TextPosition.
-            callback(i, candidate);
+            // Keep it.
+            results[i] = naturalMappings[i];
                 
             mappedBases++;
         }
     }
     
     if(credit) {
+        StatTracker::ScopedPhase phase(creditPhase);
+    
         // Each base zips matching bases inwards until it hits a mismatch,
         // or another mapped base. If zippings disagree, the base is not to
         // be mapped. Only bases between pairs of mapped bases can be
@@ -1261,9 +1315,9 @@ void NaturalMappingScheme::map(const std::string& query,
                     // This is a mismatch
                     mismatchesSeen++;
                     
-                    Log::trace() << view.getIndex().displayCached(implied) << 
+                    LOG_TRACE(view.getIndex().displayCached(implied) << 
                         " at " << implied << " mismatches " << query[i] <<
-                        std::endl;
+                        std::endl);
                 }
                 
                 if(mismatchesSeen <= z_max) {
@@ -1277,8 +1331,8 @@ void NaturalMappingScheme::map(const std::string& query,
                     // at by the credit provider.
                     zippings[i].insert(implied);
                     
-                    Log::debug() << "Right credit zips " << i << " to " <<
-                        implied << " from " << provider << std::endl;
+                    LOG_DEBUG("Right credit zips " << i << " to " <<
+                        implied << " from " << provider << std::endl);
                     
                 }    
             }
@@ -1319,9 +1373,9 @@ void NaturalMappingScheme::map(const std::string& query,
                     // This is a mismatch
                     mismatchesSeen++;
                     
-                    Log::trace() << view.getIndex().displayCached(implied) <<
+                    LOG_TRACE(view.getIndex().displayCached(implied) <<
                         " at " << implied << " mismatches " << query[i] <<
-                        std::endl;
+                        std::endl);
                 }
                 
                 if(mismatchesSeen <= z_max) {
@@ -1335,8 +1389,8 @@ void NaturalMappingScheme::map(const std::string& query,
                     // at by the credit provider.
                     zippings[i].insert(implied);
                     
-                    Log::debug() << "Left credit zips " << i << " to " <<
-                        implied << " from " << provider << std::endl;
+                    LOG_DEBUG("Left credit zips " << i << " to " <<
+                        implied << " from " << provider << std::endl);
                 }    
             }
             
@@ -1349,19 +1403,18 @@ void NaturalMappingScheme::map(const std::string& query,
                 TextPosition candidate = *(zippings[i].begin());
                 
                 if(view.getIndex().displayCached(candidate) == query[i]) {
-                    // Dispatch the callback with this query index and this
-                    // TextPosition.
-                    callback(i, candidate);
+                    // Map this query index to this TextPosition.
+                    results[i] = Mapping(candidate);
                         
-                    Log::debug() << "Credit agrees on " << i << std::endl;
+                    LOG_DEBUG("Credit agrees on " << i << std::endl);
                     
                     mappedBases++;
                     creditBases++;     
                 } else {
                     // Merging to that position would merge mismatching
                     // bases.
-                    Log::debug() << "Credit agrees on " << i <<
-                        " but would merge a mismatch." << std::endl;
+                    LOG_DEBUG("Credit agrees on " << i <<
+                        " but would merge a mismatch." << std::endl);
                 }
                     
                 
@@ -1369,7 +1422,7 @@ void NaturalMappingScheme::map(const std::string& query,
             } else if(zippings[i].size() > 1) {
                 // This base has conflicted credit.
                 
-                Log::debug() << "Credit disagrees on " << i << std::endl;
+                LOG_DEBUG("Credit disagrees on " << i << std::endl);
                 
                 conflictedCredit++;
             }
@@ -1383,7 +1436,15 @@ void NaturalMappingScheme::map(const std::string& query,
     stats.add("credit", creditBases); // Mapped on credit
     stats.add("conflictedCredit", conflictedCredit); // Conflicted on credit
     
+    // And say what happened with this query, in case it was a slow one.
+    timer.count("length", query.size());
+    timer.count("mapped", mappedBases);
+    timer.count("credit", creditBases);
+    timer.count("conflictedCredit", conflictedCredit);
+    
     Log::output() << "Mapped " << mappedBases << " bases, " << 
         creditBases << " on credit, " << conflictedCredit << 
         " bases with conflicting credit." << std::endl;
+    
+    return results;
 }
@@ -3,13 +3,14 @@
 
 #include "MappingScheme.hpp"
 #include "Mapping.hpp"
-#include "IntervalIndex.hpp"
 #include "Log.hpp"
 #include "Matching.hpp"
+#include "MinimizerIndex.hpp"
 
 #include <iomanip>
 
-#include <unordered_map>
+#include <set>
+#include <vector>
 
 /**
  * Mapping scheme implementing Benedict's "natural" mapping scheme. If all
@@ -36,6 +37,55 @@ public:
      */
     virtual void map(const std::string& query,
         std::function<void(size_t, TextPosition)> callback) const override;
+    
+    /**
+     * Map the given query string the same way, but call the given sink (which
+     * takes the query base index and the TextPosition) directly instead of
+     * through a std::function, so it can be inlined. Callers that know they
+     * have a NaturalMappingScheme should use this.
+     *
+     * If the query was taken from the index being mapped to, the BWT rows of
+     * the suffixes of the index's text starting at each query base (see
+     * FMDIndex::getContigRows()) can be given, and the contexts are found from
+     * them instead of by searching. So can the right lengths for its bases
+     * from the index's MinUniqueTable (see MinUniqueTable::getRightLengths()),
+     * which let the shortest unique contexts be found with less retracting.
+     */
+    template<typename Sink>
+    void map(const std::string& query, Sink&& sink,
+        const int64_t* rows = nullptr,
+        const size_t* uniqueLengths = nullptr) const;
+    
+    /**
+     * Map only bases [start, end) of the given query, searching just them and
+     * their context. See MappingScheme::mapRange().
+     */
+    virtual void mapRange(const std::string& query, size_t start, size_t end,
+        std::function<void(size_t, TextPosition)> callback) const override;
+    
+    /**
+     * Map only bases [start, end) of the given query the same way, calling
+     * the given sink directly. Rows and unique lengths, if given, are for the
+     * bases from getRangeContext(), not the whole query.
+     */
+    template<typename Sink>
+    void mapRange(const std::string& query, size_t start, size_t end,
+        Sink&& sink, const int64_t* rows = nullptr,
+        const size_t* uniqueLengths = nullptr) const;
+    
+    /**
+     * Map all the given query strings, and put the results in the given
+     * MappingBatchResult. If repeatFilter is set, first searches for every
+     * whole query at once, and leaves the ones it can rule out unmapped.
+     */
+    virtual void mapBatch(const std::vector<std::string>& queries,
+        MappingBatchResult& results) const override;
+    
+    /**
+     * Get the parameters for mapping.
+     */
+    virtual std::vector<std::pair<std::string, std::string>>
+        getParameters() const override;
         
     
     // Now come the scheme parameters and their default values.
@@ -104,87 +154,129 @@ public:
      */
     bool unstable = false;
     
+    /**
+     * If set, queries sharing no minimizer with the reference are left
+     * unmapped without being searched, and counted in the "prefiltered"
+     * stat. Such a query has no exact match as long as the index's span, so
+     * the index is only used when its span is no more than minContext, and
+     * skipping can't lose any mappings. Not owned by the MappingScheme.
+     */
+    const MinimizerIndex* minimizerIndex = nullptr;
+    
+    /**
+     * If set, mapBatch() searches for every whole query of the batch first,
+     * running the backward searches in lockstep with FMDIndex::countBatch()
+     * so their cache misses overlap, and leaves queries found in more than one
+     * place unmapped without mapping them base by base. They are counted in
+     * the "repeatFiltered" stat. No part of such a query is unique, so
+     * nothing in it could map. This is only guaranteed when every position is
+     * its own range, so views with a mask or ranges are never filtered. Pays
+     * off when many queries are repeats, and costs an extra search otherwise.
+     */
+    bool repeatFilter = false;
+    
 protected:
     /**
-     * Map the given query string, producing a vector of Mappings. Does not
-     * include credit yet.
+     * Map the given query string, producing a vector of Mappings, including
+     * those made on credit. Updates the stats. Takes the query's own BWT
+     * rows and minimal unique lengths, if it has them.
      */
-    std::vector<Mapping> naturalMap(const std::string& query) const;
+    std::vector<Mapping> mapAll(const std::string& query,
+        const int64_t* rows = nullptr,
+        const size_t* uniqueLengths = nullptr) const;
     
     /**
-     * Find all of the maximal unique matchings between query string characters
-     * and the reference, in descending order by left endpoint. Properly handles
-     * merged reference positions.
+     * Map the given query string, producing a vector of Mappings. Does not
+     * include credit yet. Takes the query's own BWT rows and minimal unique
+     * lengths, if it has them.
+     * Skipping the blacklisting of any maximal matching could make the rest
+     * map unstably, so if the query runs out of budget, gives up on all of it
+     * and returns an empty vector instead.
      */
-    std::vector<Matching> findMaxMatchings(const std::string& query) const;
-        
+    std::vector<Mapping> naturalMap(const std::string& query,
+        const QueryBudget& budget, const int64_t* rows = nullptr,
+        const size_t* uniqueLengths = nullptr) const;
+    
     /**
-     * Find all of the minimal unique matchings between query string characters
-     * and the reference, in descending order by left endpoint. Properly handles
-     * merged reference positions.
+     * A directed graph between max matchings, which are identified by their
+     * indices in the ascending vector of max matchings. Stored in compressed
+     * sparse row form: the edges out of matching i are edges[edgeStarts[i]]
+     * up to edges[edgeStarts[i + 1]], as (other matching, mismatch gap cost)
+     * pairs.
      */
-    std::vector<Matching> findMinMatchings(const std::string& query) const;
+    struct MatchingGraph {
+        std::vector<size_t> edgeStarts;
+        std::vector<std::pair<size_t, size_t>> edges;
+    };
     
     /**
      * Produce a graph from each MUM to the MUMs it connects to, with the
      * mismatch gap cost of the connection. Includes self edges at cost 0. Input
      * matchings must not contain each other and must be in ascending order of
      * start position. Note that this is the reverse order of the
-     * mindMaxMatchings method! TODO: Typedef this return type.
+     * MatchingStatistics matching lists! Every edge goes to an earlier
+     * matching, or is a self edge. Stops early, with an incomplete graph, if
+     * the budget is spent.
      */
-    std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
-        generateMaxMatchingGraph(std::vector<Matching> maxMatchings,
-        const std::string& query) const;
+    MatchingGraph generateMaxMatchingGraph(
+        const std::vector<Matching>& maxMatchings, const std::string& query,
+        const QueryBudget& budget) const;
         
     /**
-     * Given a graph from each MUM to the MUMs it connects to, this the mismatch
-     * gap cost of the connection, invert all the directed edges in the graph,
-     * creating a new graph. Edges from a node may be in any order.
+     * Given a graph from each MUM to the MUMs it connects to, with the
+     * mismatch gap cost of the connection, invert all the directed edges in
+     * the graph, creating a new graph. Edges from a node may be in any order.
      */
-    std::unordered_map<Matching, std::vector<std::pair<Matching, size_t>>>
-        invertGraph(const std::unordered_map<Matching,
-        std::vector<std::pair<Matching, size_t>>>& graph) const;
-        
-    /**
-     * Look up the max matching that contains a given min matching.
-     */
-    const Matching& getMaxMatching(const IntervalIndex<Matching>& maxMatchings,
-        const Matching& minMatching) const;
+    MatchingGraph invertGraph(const MatchingGraph& graph) const;
     
     /**
-     * Given an index of max matchings, and a vector of min matchings in
-     * ascending order (opposite of findMinMatchings), produce a map from max
-     * matchings to the indexed min matchings they contain, in ascending order.
+     * Given vectors of max matchings and min matchings, both in ascending order
+     * (opposite of findMinMatchings), assign each min matching to the max
+     * matching that contains it. The min matchings of each max matching are
+     * then a run of the min matching vector, so returns the index in it where
+     * each max matching's run starts, plus a past-the-end entry.
      */
-    std::unordered_map<Matching, IntervalIndex<Matching>> assignMinMatchings(
-        const IntervalIndex<Matching>& maxMatchings,
+    std::vector<size_t> assignMinMatchings(
+        const std::vector<Matching>& maxMatchings,
         const std::vector<Matching>& minMatchings) const;
         
     /**
      * For each min matching, and for each cost value <= maxHammingDistace,
      * calculate the number of nonoverlapping minimal unique matchings that can
      * be chained together, going in a certain direction (forward or reverse).
+     * Returns a table with a row of maxHammingDistance + 1 entries for each
+     * min matching, in the order of the min matching vector.
      *
      * Depends on the graph of max matching connectivity (with edges in any
-     * order), the assignments of min matchings to max matchings (in ascending
-     * order), and the list of max matchings (in ascending order). The graph
-     * should contain self edges at cost 0.
-     */
-    std::unordered_map<Matching, std::vector<size_t>> getMinMatchingChains(
-        const std::unordered_map<Matching, 
-        std::vector<std::pair<Matching, size_t>>>& maxMatchingGraph,
-        const std::unordered_map<Matching, IntervalIndex<Matching>>&
-        minsForMax, const std::vector<Matching>& maxMatchings,
-        bool isForward) const;
+     * order), the list of max matchings (in ascending order), the list of min
+     * matchings (in ascending order), and the runs of min matchings assigned
+     * to each max matching. The graph should contain self edges at cost 0.
+     * Stops early, with an incomplete table, if the budget is spent.
+     */
+    std::vector<size_t> getMinMatchingChains(
+        const MatchingGraph& maxMatchingGraph,
+        const std::vector<Matching>& maxMatchings,
+        const std::vector<Matching>& minMatchings,
+        const std::vector<size_t>& minsForMax, bool isForward,
+        const QueryBudget& budget) const;
         
     /**
      * Given vectors of max and min matchings in ascending order as well as the
      * query, produce a vector of only max matchings that have min matchings in
-     * sufficiently good (>= minHammingBound) synteny runs.
+     * sufficiently good (>= minHammingBound) synteny runs. If the budget is
+     * spent partway through, the result is meaningless.
      */
     std::set<Matching> maxMatchingsInSyntenyRuns(const std::vector<Matching>&
         maxMatchings, const std::vector<Matching>& minMatchings,
-        const std::string& query) const;
+        const std::string& query, const QueryBudget& budget) const;
+    
+    /**
+     * Given a maximal matching on the query that is not being used to map
+     * bases, determine if it can reach either end of the query with few enough
+     * edits that its bases need to be blacklisted to keep mapping stable.
+     */
+    bool mustBlacklist(const std::string& query,
+        const Matching& matching) const;
     
     /**
      * Compute the edit distance between the specified region of the query and
@@ -202,7 +294,52 @@ protected:
         int64_t threshold = -1, bool leftJustify = true,
         bool rightJustify = true) const;
     
+    // Histograms for tuning: how long does each query take to map, and how
+    // many DP cells does each alignment in countEdits() fill?
+    StatTracker::Histogram queryNanosecondsStat =
+        stats.histogram("queryNanoseconds");
+    StatTracker::Histogram alignmentCellsStat =
+        stats.histogram("alignmentCells");
+    
+    // Phases to count hardware events in, if PerfCounters are enabled.
+    StatTracker::Phase contextSearchPhase = stats.phase("contextSearch");
+    StatTracker::Phase editCountingPhase = stats.phase("editCounting");
+    StatTracker::Phase creditPhase = stats.phase("credit");
+    
     
 };
 
+template<typename Sink>
+void NaturalMappingScheme::map(const std::string& query, Sink&& sink,
+    const int64_t* rows, const size_t* uniqueLengths) const {
+    
+    std::vector<Mapping> mappings = mapAll(query, rows, uniqueLengths);
+    
+    for(size_t i = 0; i < mappings.size(); i++) {
+        if(mappings[i].isMapped()) {
+            // Report each mapped base.
+            sink(i, mappings[i].getLocation());
+        }
+    }
+}
+
+template<typename Sink>
+void NaturalMappingScheme::mapRange(const std::string& query, size_t start,
+    size_t end, Sink&& sink, const int64_t* rows,
+    const size_t* uniqueLengths) const {
+    
+    // Only the range and its context get searched.
+    auto context = getRangeContext(query.size(), start, end);
+    std::vector<Mapping> mappings = mapAll(query.substr(context.first,
+        context.second - context.first), rows, uniqueLengths);
+    
+    for(size_t i = start; i < end; i++) {
+        if(mappings[i - context.first].isMapped()) {
+            // Report each mapped base in the range, by where it is in the
+            // whole query.
+            sink(i, mappings[i - context.first].getLocation());
+        }
+    }
+}
+
 #endif
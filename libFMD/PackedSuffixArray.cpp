@@ -0,0 +1,143 @@
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "PackedSuffixArray.hpp"
+#include "FMDIndex.hpp"
+#include "Log.hpp"
+
+PackedSuffixArray::PackedSuffixArray(const FMDIndex& index): textStarts(),
+    words(), mapping(NULL), numTexts(index.getNumberOfContigs() * 2),
+    numRows(index.getBWTLength()), width(1), textStartData(NULL),
+    wordData(NULL) {
+
+    // Lay out the texts, both strands of each contig in turn, each with its
+    // '$'.
+    textStarts.push_back(0);
+    for(size_t text = 0; text < numTexts; text++) {
+        textStarts.push_back(textStarts.back() +
+            index.getContigLength(text / 2) + 1);
+    }
+
+    // Use just enough bits for the last position.
+    while(width < 64 && textStarts.back() > (size_t) 1 << width) {
+        width++;
+    }
+
+    Log::info() << "Building packed suffix array of " << numRows <<
+        " rows at " << width << " bits each" << std::endl;
+
+    words.resize((numRows * width + 63) / 64);
+
+    // The first #-of-texts rows in the BWT have a '$' in the F column. Find
+    // which text each one ends.
+    std::vector<int64_t> endRows(numTexts);
+    for(size_t i = 0; i < numTexts; i++) {
+        endRows[index.locate(i).getText()] = i;
+    }
+
+    for(size_t text = 0; text < numTexts; text++) {
+        // Start at the row for the suffix that is just '$', at the end of the
+        // text, and LF-map back along it to the row for each longer suffix.
+        int64_t row = endRows[text];
+        for(size_t global = textStarts[text + 1] - 1; ; global--) {
+            set(row, global);
+            if(global == textStarts[text]) {
+                break;
+            }
+            row = index.getLF(row);
+        }
+    }
+
+    // Queries should look in the vectors.
+    useVectors();
+}
+
+PackedSuffixArray::PackedSuffixArray(const std::string& filename):
+    textStarts(), words(), mapping(new MappedFile(filename)), numTexts(0),
+    numRows(0), width(0), textStartData(NULL), wordData(NULL) {
+
+    // The file is the magic number, the text count, the row count, and the
+    // entry width, then the text starts and the packed entries, all as 8-byte
+    // words. Since the mapping is page-aligned, they can all be used in place.
+    const size_t* data = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+
+    if(wordCount < 4 || data[0] != MAGIC || data[3] == 0 || data[3] > 64 ||
+        wordCount < 5 + data[1] + (data[2] * data[3] + 63) / 64) {
+
+        // Don't go reading off the end of a truncated or foreign file.
+        delete mapping;
+        throw std::runtime_error("Bad packed suffix array " + filename);
+    }
+
+    numTexts = data[1];
+    numRows = data[2];
+    width = data[3];
+    textStartData = data + 4;
+    wordData = (const uint64_t*) (textStartData + numTexts + 1);
+}
+
+PackedSuffixArray::~PackedSuffixArray() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void PackedSuffixArray::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+
+    // Save the header words in platform-native byte order.
+    size_t header[4] = {MAGIC, numTexts, numRows, width};
+    file.write((const char*) header, sizeof(header));
+
+    // Then the text starts and the packed entries.
+    file.write((const char*) textStartData, (numTexts + 1) * sizeof(size_t));
+    file.write((const char*) wordData,
+        (numRows * width + 63) / 64 * sizeof(uint64_t));
+
+    // Close up the file
+    file.close();
+}
+
+TextPosition PackedSuffixArray::get(int64_t row) const {
+    if(row < 0 || (size_t) row >= numRows) {
+        throw std::runtime_error("Row " + std::to_string(row) +
+            " is not in the packed suffix array");
+    }
+
+    // Pull out the entry, which may run over into the next word.
+    size_t bit = row * width;
+    size_t word = bit / 64;
+    size_t offset = bit % 64;
+    uint64_t global = wordData[word] >> offset;
+    if(offset + width > 64) {
+        global |= wordData[word + 1] << (64 - offset);
+    }
+    if(width < 64) {
+        global &= ((uint64_t) 1 << width) - 1;
+    }
+
+    // Find the text that starts last at or before the position.
+    const size_t* found = std::upper_bound(textStartData,
+        textStartData + numTexts + 1, global) - 1;
+
+    return TextPosition(found - textStartData, global - *found);
+}
+
+void PackedSuffixArray::set(size_t row, size_t value) {
+    size_t bit = row * width;
+    size_t word = bit / 64;
+    size_t offset = bit % 64;
+    words[word] |= (uint64_t) value << offset;
+    if(offset + width > 64) {
+        words[word + 1] |= (uint64_t) value >> (64 - offset);
+    }
+}
+
+void PackedSuffixArray::useVectors() {
+    textStartData = textStarts.data();
+    wordData = words.data();
+}
@@ -0,0 +1,138 @@
+#ifndef PACKEDSUFFIXARRAY_HPP
+#define PACKEDSUFFIXARRAY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "TextPosition.hpp"
+#include "MappedFile.hpp"
+
+// Forward declaration for circular dependencies
+class FMDIndex;
+
+/**
+ * Defines a full suffix array, with an entry for every BWT row, for answering
+ * locate queries without any LF-mapping. Entries are positions in the
+ * concatenation of all the texts, each followed by its '$', packed into just
+ * as many bits as the largest of them needs: 33 bits for a human genome on
+ * both strands, instead of the 8 bytes a libsuffixtools SAElem takes.
+ *
+ * This still takes several times the space of the BWT itself, so it is for
+ * machines with memory to spare and workloads that locate a lot. A saved
+ * array is memory-mapped and used in place.
+ */
+class PackedSuffixArray {
+
+public:
+    /**
+     * Build a new PackedSuffixArray for all the rows of the given index, with
+     * one LF walk along each text.
+     */
+    PackedSuffixArray(const FMDIndex& index);
+
+    /**
+     * Load a PackedSuffixArray from the given file. Uses platform-dependent
+     * byte order and size_t size. The file is memory-mapped rather than read,
+     * and must not be modified while the PackedSuffixArray exists.
+     */
+    PackedSuffixArray(const std::string& filename);
+
+    /**
+     * Get rid of a PackedSuffixArray, unmapping its file if it was loaded from
+     * one.
+     */
+    ~PackedSuffixArray();
+
+    /**
+     * Save a PackedSuffixArray to the given file. Uses platform-dependent byte
+     * order and size_t size.
+     */
+    void save(const std::string& filename) const;
+
+    /**
+     * Get the text position of the suffix in the given BWT row.
+     */
+    TextPosition get(int64_t row) const;
+
+    /**
+     * Get the number of BWT rows the array covers.
+     */
+    inline size_t getSize() const {
+        return numRows;
+    }
+
+    /**
+     * Get the number of texts the array covers.
+     */
+    inline size_t getNumberOfTexts() const {
+        return numTexts;
+    }
+
+    /**
+     * Get the number of bits each entry takes.
+     */
+    inline size_t getWidth() const {
+        return width;
+    }
+
+    /**
+     * Get the number of bytes the array takes up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return (textStarts.capacity() + words.capacity()) * sizeof(size_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
+    }
+
+protected:
+    /**
+     * What word starts a saved array?
+     */
+    static const size_t MAGIC = 0x31415344454b4350ULL;
+
+    /**
+     * Store the given value, which must fit in the entry width, as the entry
+     * for the given row. The entry must not have been set yet.
+     */
+    void set(size_t row, size_t value);
+
+    /**
+     * Point the data pointers at the vectors, once they have been filled in.
+     */
+    void useVectors();
+
+    // Store where each text starts in the concatenation, plus a past-the-end
+    // entry, if we built the array ourselves.
+    std::vector<size_t> textStarts;
+
+    // Store the packed entries, if we built the array ourselves.
+    std::vector<uint64_t> words;
+
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+
+    // How many texts are there?
+    size_t numTexts;
+
+    // How many rows are there?
+    size_t numRows;
+
+    // How many bits does each entry take?
+    size_t width;
+
+    // Point to the text starts and the packed entries, either in the vectors
+    // or in the mapped file.
+    const size_t* textStartData;
+    const uint64_t* wordData;
+
+private:
+    // PackedSuffixArrays can't be copied, since they may own a mapping.
+    PackedSuffixArray(const PackedSuffixArray& other) = delete;
+
+    // Or assigned.
+    PackedSuffixArray& operator=(const PackedSuffixArray& other) = delete;
+
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "PackedText.hpp"
+
+const char PackedText::BASE_CHARS[4] = {'A', 'C', 'G', 'T'};
+
+PackedText::PackedText(): numContigs(0), contigStarts(1, 0), words(),
+    mapping(NULL), contigStartData(NULL), wordData(NULL) {
+    
+    useVectors();
+}
+
+PackedText::PackedText(const std::string& filename): numContigs(0),
+    contigStarts(), words(), mapping(new MappedFile(filename)),
+    contigStartData(NULL), wordData(NULL) {
+    
+    // The file is the number of contigs, the numContigs + 1 contig starts, and
+    // then the packed bases, all as 8-byte words. Since the mapping is page-
+    // aligned, they can all be used in place.
+    const size_t* fileWords = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+    
+    if(wordCount < 2 || wordCount < 2 + fileWords[0] ||
+        wordCount < 2 + fileWords[0] + (fileWords[1 + fileWords[0]] +
+        BASES_PER_WORD - 1) / BASES_PER_WORD) {
+        
+        // Don't go reading off the end of a truncated file.
+        delete mapping;
+        throw std::runtime_error("Truncated packed text " + filename);
+    }
+    
+    numContigs = fileWords[0];
+    contigStartData = fileWords + 1;
+    wordData = (const uint64_t*) (contigStartData + numContigs + 1);
+}
+
+PackedText::~PackedText() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void PackedText::add(const std::string& contig) {
+    if(mapping != NULL) {
+        throw std::runtime_error("Can't add to a loaded packed text!");
+    }
+    
+    // Where do we start adding bases?
+    size_t position = contigStarts.back();
+    
+    // Make room for all the new bases.
+    words.resize((position + contig.size() + BASES_PER_WORD - 1) /
+        BASES_PER_WORD, 0);
+    
+    for(char base : contig) {
+        // Work out the code for each base
+        uint64_t code;
+        switch(base) {
+        case 'A':
+            code = 0;
+            break;
+        case 'C':
+            code = 1;
+            break;
+        case 'G':
+            code = 2;
+            break;
+        case 'T':
+            code = 3;
+            break;
+        default:
+            throw std::runtime_error(std::string("Can't pack base ") + base);
+        }
+        
+        // Put it in
+        words[position / BASES_PER_WORD] |= code <<
+            (2 * (position % BASES_PER_WORD));
+        position++;
+    }
+    
+    // Record where the contig ends
+    contigStarts.push_back(position);
+    numContigs++;
+    
+    // The vectors may have moved.
+    useVectors();
+}
+
+void PackedText::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+    
+    // Save the contig count in platform-native byte order.
+    file.write((const char*) &numContigs, sizeof(size_t));
+    
+    // Then where each contig starts
+    file.write((const char*) contigStartData,
+        (numContigs + 1) * sizeof(size_t));
+    
+    // And then the bases themselves
+    file.write((const char*) wordData, (contigStartData[numContigs] +
+        BASES_PER_WORD - 1) / BASES_PER_WORD * sizeof(uint64_t));
+    
+    // Close up the file
+    file.close();
+}
+
+std::string PackedText::getContig(size_t contig) const {
+    // Make a string to hold all the bases.
+    std::string bases;
+    bases.reserve(getContigLength(contig));
+    
+    for(size_t i = 0; i < getContigLength(contig); i++) {
+        // Unpack each base
+        bases.push_back(get(contig, i));
+    }
+    
+    return bases;
+}
+
+void PackedText::useVectors() {
+    contigStartData = contigStarts.data();
+    wordData = words.data();
+}
@@ -0,0 +1,134 @@
+#ifndef PACKEDTEXT_HPP
+#define PACKEDTEXT_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "MappedFile.hpp"
+
+/**
+ * Defines a store of the forward strands of all the contigs in an index,
+ * packed 2 bits to a base, so that any base can be fetched in constant time
+ * instead of by LF-mapping through the BWT. Saved stores are memory-mapped, so
+ * they are shared between processes and only read in as they are used.
+ *
+ * The contigs are packed one after the other with no padding. Only A, C, G,
+ * and T can be stored.
+ */
+class PackedText {
+
+public:
+    /**
+     * Make a new, empty PackedText to add contigs to.
+     */
+    PackedText();
+    
+    /**
+     * Load a PackedText from the given file. Uses platform-dependent byte
+     * order and size_t size. The file is memory-mapped rather than read, and
+     * must not be modified while the object exists.
+     */
+    PackedText(const std::string& filename);
+    
+    /**
+     * Get rid of a PackedText, unmapping its file if it was loaded from one.
+     */
+    ~PackedText();
+    
+    /**
+     * Add the given contig to the end of the store. Throws a
+     * std::runtime_error if it contains anything other than A, C, G, or T. Can
+     * only be used on a PackedText that wasn't loaded from a file.
+     */
+    void add(const std::string& contig);
+    
+    /**
+     * Save a PackedText to the given file. Uses platform-dependent byte order
+     * and size_t size.
+     */
+    void save(const std::string& filename) const;
+    
+    /**
+     * Get the number of contigs stored.
+     */
+    inline size_t getNumberOfContigs() const {
+        return numContigs;
+    }
+    
+    /**
+     * Get the number of bytes the packed text takes up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return contigStarts.capacity() * sizeof(size_t) +
+            words.capacity() * sizeof(uint64_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
+    }
+    
+    /**
+     * Get the length of the given contig.
+     */
+    inline size_t getContigLength(size_t contig) const {
+        return contigStartData[contig + 1] - contigStartData[contig];
+    }
+    
+    /**
+     * Get the base at the given 0-based offset along the forward strand of the
+     * given contig.
+     */
+    inline char get(size_t contig, size_t offset) const {
+        size_t position = contigStartData[contig] + offset;
+        return BASE_CHARS[(wordData[position / BASES_PER_WORD] >>
+            (2 * (position % BASES_PER_WORD))) & 3];
+    }
+    
+    /**
+     * Get the whole forward strand of the given contig.
+     */
+    std::string getContig(size_t contig) const;
+    
+protected:
+    /**
+     * Point the data pointers at the vectors, once they have been changed.
+     */
+    void useVectors();
+    
+    /**
+     * How many bases fit in each word?
+     */
+    static const size_t BASES_PER_WORD = 32;
+    
+    /**
+     * What characters do the 2-bit codes stand for?
+     */
+    static const char BASE_CHARS[4];
+    
+    // How many contigs are there?
+    size_t numContigs;
+    
+    // Where in the packed bases does each contig start, if we built the store
+    // ourselves? Has an extra past-the-end entry.
+    std::vector<size_t> contigStarts;
+    
+    // Holds the packed bases, if we built the store ourselves.
+    std::vector<uint64_t> words;
+    
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+    
+    // Point to the contig starts and packed bases, either in the vectors or in
+    // the mapped file.
+    const size_t* contigStartData;
+    const uint64_t* wordData;
+    
+private:
+    // PackedTexts can't be copied, since they may own a mapping.
+    PackedText(const PackedText& other) = delete;
+    
+    // Or assigned.
+    PackedText& operator=(const PackedText& other) = delete;
+    
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <cstring>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "PerfCounters.hpp"
+
+const char* const PerfCounters::EVENT_NAMES[NUM_EVENTS] = {"cycles",
+    "instructions", "llcMisses", "branchMisses", "dtlbMisses"};
+
+std::atomic<bool> PerfCounters::enabled(false);
+
+/**
+ * Holds the perf event file descriptors a thread has open, as one group, so
+ * they can all be read with one system call.
+ */
+struct ThreadCounters {
+    // Have we tried opening the counters yet?
+    bool opened = false;
+    // Holds the open descriptors, the first being the group leader.
+    std::vector<int> fds;
+    // Holds which event each open descriptor counts.
+    std::vector<size_t> events;
+    
+    ~ThreadCounters() {
+        for(int fd : fds) {
+            close(fd);
+        }
+    }
+};
+static thread_local ThreadCounters threadCounters;
+
+/**
+ * Open a counter for the calling thread for the given perf event type and
+ * config, in the given group (or -1 to start a group). Returns the descriptor,
+ * or -1 if the kernel won't let us.
+ */
+static int openEvent(uint32_t type, uint64_t config, int group) {
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = type;
+    attributes.size = sizeof(attributes);
+    attributes.config = config;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP;
+    
+    return syscall(__NR_perf_event_open, &attributes, 0, -1, group, 0);
+}
+
+void PerfCounters::enable() {
+    enabled.store(true);
+}
+
+bool PerfCounters::read(uint64_t values[NUM_EVENTS]) {
+    ThreadCounters& counters = threadCounters;
+    
+    if(!counters.opened) {
+        // Open everything we can, in EVENT_NAMES order.
+        counters.opened = true;
+        
+        uint32_t types[NUM_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+        uint64_t configs[NUM_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_LL |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_DTLB |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+            
+        for(size_t i = 0; i < NUM_EVENTS; i++) {
+            int fd = openEvent(types[i], configs[i],
+                counters.fds.empty() ? -1 : counters.fds.front());
+            if(fd != -1) {
+                counters.fds.push_back(fd);
+                counters.events.push_back(i);
+            }
+        }
+    }
+    
+    if(counters.fds.empty()) {
+        // We have nothing to read.
+        return false;
+    }
+    
+    // A group read gives the number of counters and then each value.
+    uint64_t buffer[NUM_EVENTS + 1];
+    ssize_t bytes = ::read(counters.fds.front(), buffer, sizeof(buffer));
+    if(bytes < (ssize_t) sizeof(uint64_t) ||
+        bytes < (ssize_t) ((buffer[0] + 1) * sizeof(uint64_t))) {
+        
+        return false;
+    }
+    
+    for(size_t i = 0; i < NUM_EVENTS; i++) {
+        values[i] = 0;
+    }
+    for(size_t i = 0; i < buffer[0] && i < counters.events.size(); i++) {
+        values[counters.events[i]] = buffer[i + 1];
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Reads hardware performance counters (cycles, instructions, last-level cache
+ * misses, branch misses, and data TLB misses) for the calling thread, through
+ * Linux's perf_event_open. Counting is off until enable() is called, so
+ * nothing is opened unless someone asks for it.
+ *
+ * Each thread opens its own counters the first time it reads them. Counters
+ * the kernel won't give us (as in many containers and VMs) just read as 0.
+ *
+ * StatTracker::ScopedPhase uses these to attribute counts to named phases of
+ * mapping and merging.
+ */
+class PerfCounters {
+
+public:
+    /**
+     * How many events are counted?
+     */
+    static const size_t NUM_EVENTS = 5;
+    
+    /**
+     * What is each event called, in order?
+     */
+    static const char* const EVENT_NAMES[NUM_EVENTS];
+    
+    /**
+     * Turn on counting for the whole program.
+     */
+    static void enable();
+    
+    /**
+     * Is counting turned on?
+     */
+    static inline bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * Read the calling thread's counters into the given array, in the order of
+     * EVENT_NAMES. Returns false, and leaves the array alone, if the thread
+     * has no counters open.
+     */
+    static bool read(uint64_t values[NUM_EVENTS]);
+    
+private:
+    // Is counting on?
+    static std::atomic<bool> enabled;
+    
+    // Don't ever let anyone make a PerfCounters object.
+    PerfCounters();
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "PlainBitVector.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Set the bits in the given words from start up to but not including end.
+ */
+static void setRange(std::vector<uint64_t>& words, size_t start, size_t end) {
+    while(start < end) {
+        // Set as much as fits in the word start is in.
+        size_t bit = start % 64;
+        size_t count = std::min((size_t) 64 - bit, end - start);
+        uint64_t mask = count == 64 ? ~(uint64_t) 0 :
+            (((uint64_t) 1 << count) - 1);
+        words[start / 64] |= mask << bit;
+        start += count;
+    }
+}
+
+PlainBitVector::PlainBitVector(const BitVector& source):
+    size(source.getSize()), items(0), words((size + 63) / 64, 0),
+    blockRanks(), selectBlocks() {
+
+    // Copy over a run of 1s at a time.
+    size_t remaining = source.getNumberOfItems();
+    BitVectorIterator iterator(source);
+    for(bool first = true; remaining > 0; first = false) {
+        // Runs come back as a first position and how many more 1s follow it.
+        auto run = first ? iterator.selectRun(0, remaining) :
+            iterator.selectNextRun(remaining);
+        setRange(words, run.first, run.first + run.second + 1);
+        remaining -= run.second + 1;
+    }
+
+    makeSamples();
+}
+
+PlainBitVector::PlainBitVector(std::ifstream& stream): size(0), items(0),
+    words(), blockRanks(), selectBlocks() {
+
+    stream.read((char*) &size, sizeof(size));
+    words.resize((size + 63) / 64);
+    stream.read((char*) words.data(), words.size() * sizeof(uint64_t));
+
+    if(!stream) {
+        throw std::runtime_error("Could not read PlainBitVector");
+    }
+
+    // The samples are cheap enough to just make again.
+    makeSamples();
+}
+
+void PlainBitVector::writeTo(std::ofstream& stream) const {
+    stream.write((char*) &size, sizeof(size));
+    stream.write((char*) words.data(), words.size() * sizeof(uint64_t));
+}
+
+BitVector* PlainBitVector::toBitVector() const {
+    // Use the same block size GenericBitVector does.
+    BitVectorEncoder encoder(32);
+
+    size_t index = 0;
+    while(index < size) {
+        // Find where the next run of 1s starts, skipping whole words of 0s.
+        uint64_t ones = words[index / 64] >> (index % 64);
+        if(ones == 0) {
+            index += 64 - index % 64;
+            continue;
+        }
+        size_t start = index + __builtin_ctzll(ones);
+
+        // And where it ends, skipping whole words of 1s.
+        index = start;
+        while(index < size) {
+            uint64_t zeros = ~words[index / 64] >> (index % 64);
+            if(zeros == 0) {
+                index += 64 - index % 64;
+                continue;
+            }
+            index += __builtin_ctzll(zeros);
+            break;
+        }
+        // Bits past the end are all 0, so index can't have gone past it.
+        encoder.addRun(start, index - start);
+    }
+
+    encoder.flush();
+    return new BitVector(encoder, size);
+}
+
+size_t PlainBitVector::estimateMemoryUsage(size_t size, size_t items) {
+    size_t wordCount = (size + 63) / 64;
+    size_t blockCount = (wordCount + WORDS_PER_BLOCK - 1) / WORDS_PER_BLOCK;
+    size_t sampleCount = (items + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+    return sizeof(PlainBitVector) + (wordCount + blockCount + 1 +
+        sampleCount) * sizeof(uint64_t);
+}
+
+size_t PlainBitVector::getMemoryUsage() const {
+    return sizeof(*this) + (words.capacity() + blockRanks.capacity() +
+        selectBlocks.capacity()) * sizeof(uint64_t);
+}
+
+size_t PlainBitVector::select(size_t one) const {
+    if(one >= items) {
+        // There's no such 1, so give the past-the-end value like BitVector.
+        return size;
+    }
+
+    // The samples bound which blocks the 1 can be in.
+    size_t sample = one / SELECT_SAMPLE;
+    size_t low = selectBlocks[sample];
+    size_t high = sample + 1 < selectBlocks.size() ?
+        selectBlocks[sample + 1] : blockRanks.size() - 2;
+
+    while(low < high) {
+        // Find the last block with no more than that many 1s before it.
+        size_t middle = (low + high + 1) / 2;
+        if(blockRanks[middle] <= one) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    // Then count through the words in the block.
+    size_t remaining = one - blockRanks[low];
+    for(size_t word = low * WORDS_PER_BLOCK;; word++) {
+        size_t count = __builtin_popcountll(words[word]);
+        if(remaining < count) {
+            // It's in this word. Drop the 1s before it.
+            uint64_t bits = words[word];
+            for(size_t i = 0; i < remaining; i++) {
+                bits &= bits - 1;
+            }
+            return word * 64 + __builtin_ctzll(bits);
+        }
+        remaining -= count;
+    }
+}
+
+void PlainBitVector::makeSamples() {
+    size_t blockCount = (words.size() + WORDS_PER_BLOCK - 1) /
+        WORDS_PER_BLOCK;
+    blockRanks.assign(blockCount + 1, 0);
+    selectBlocks.clear();
+
+    size_t total = 0;
+    for(size_t block = 0; block < blockCount; block++) {
+        blockRanks[block] = total;
+
+        size_t end = std::min(words.size(), (block + 1) * WORDS_PER_BLOCK);
+        for(size_t word = block * WORDS_PER_BLOCK; word < end; word++) {
+            total += __builtin_popcountll(words[word]);
+        }
+
+        while(selectBlocks.size() * SELECT_SAMPLE < total) {
+            // Every sampled 1 up to here is in this block.
+            selectBlocks.push_back(block);
+        }
+    }
+    blockRanks[blockCount] = total;
+    items = total;
+}
@@ -0,0 +1,152 @@
+#ifndef PLAINBITVECTOR_HPP
+#define PLAINBITVECTOR_HPP
+
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "BitVector.hpp"
+
+/**
+ * Defines an uncompressed bit vector, with samples for rank and select, for
+ * bit vectors that are too dense for the delta-coded BitVector to be worth
+ * it. Every block of 512 bits knows how many 1s come before it, and every
+ * SELECT_SAMPLE-th 1 knows which block it is in, so rank is a lookup and a few
+ * popcounts, and select is a short binary search.
+ *
+ * Answers rank and select queries the same way BitVectorIterator does, and is
+ * safe to query from many threads at once.
+ */
+class PlainBitVector {
+public:
+    /**
+     * Make a PlainBitVector holding the same bits as the given BitVector.
+     */
+    explicit PlainBitVector(const BitVector& source);
+
+    /**
+     * Load a PlainBitVector saved with writeTo from the given stream.
+     */
+    explicit PlainBitVector(std::ifstream& stream);
+
+    /**
+     * Save the PlainBitVector to the given stream.
+     */
+    void writeTo(std::ofstream& stream) const;
+
+    /**
+     * Make a new BitVector holding the same bits, which the caller owns.
+     */
+    BitVector* toBitVector() const;
+
+    /**
+     * Get the number of bytes a PlainBitVector of the given length with the
+     * given number of 1s would take up.
+     */
+    static size_t estimateMemoryUsage(size_t size, size_t items);
+
+    /**
+     * Get the number of bytes this PlainBitVector takes up.
+     */
+    size_t getMemoryUsage() const;
+
+    /**
+     * Get the length of the bit vector in bits.
+     */
+    inline size_t getSize() const {
+        return size;
+    }
+
+    /**
+     * Get the number of 1s in the bit vector.
+     */
+    inline size_t getNumberOfItems() const {
+        return items;
+    }
+
+    /**
+     * Returns true if the bit at the given index is set.
+     */
+    inline bool isSet(size_t index) const {
+        if(index >= size) {
+            return false;
+        }
+        return (words[index / 64] >> (index % 64)) & 1;
+    }
+
+    /**
+     * Get the number of 1s at or before the given index, or all of them if the
+     * index is past the end.
+     */
+    inline size_t rank(size_t index) const {
+        if(index >= size) {
+            return items;
+        }
+
+        size_t word = index / 64;
+        size_t total = blockRanks[word / WORDS_PER_BLOCK];
+        for(size_t i = word - word % WORDS_PER_BLOCK; i < word; i++) {
+            // Count up the whole words before ours in the block.
+            total += __builtin_popcountll(words[i]);
+        }
+
+        // Then the bits in our word up to and including ours.
+        uint64_t mask = ~(uint64_t) 0 >> (63 - index % 64);
+        return total + __builtin_popcountll(words[word] & mask);
+    }
+
+    /**
+     * Get the index of the 1 with the given rank (the first 1 has rank 0), or
+     * the length of the bit vector if there aren't that many 1s.
+     */
+    size_t select(size_t one) const;
+
+    /**
+     * How many bits are in a block with its own rank sample?
+     */
+    static const size_t BLOCK_BITS = 512;
+
+    /**
+     * How many 1s apart are the select samples?
+     */
+    static const size_t SELECT_SAMPLE = 1024;
+
+protected:
+    /**
+     * How many words are in a block?
+     */
+    static const size_t WORDS_PER_BLOCK = BLOCK_BITS / 64;
+
+    /**
+     * Fill in the rank and select samples from the words.
+     */
+    void makeSamples();
+
+    /**
+     * How many bits long is the vector?
+     */
+    size_t size;
+
+    /**
+     * How many 1s are in it?
+     */
+    size_t items;
+
+    /**
+     * Holds the bits, with the first bit of each word lowest.
+     */
+    std::vector<uint64_t> words;
+
+    /**
+     * Holds the number of 1s before each block, with an extra entry at the end
+     * holding all of them.
+     */
+    std::vector<uint64_t> blockRanks;
+
+    /**
+     * Holds the number of the block that each SELECT_SAMPLE-th 1 is in.
+     */
+    std::vector<uint64_t> selectBlocks;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "QueryTracer.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+QueryTracer::QueryTracer(size_t keep): keep(keep), slowest(), mutex(),
+    threshold(keep == 0 ? UINT64_MAX : 0) {
+
+    // Nothing to do!
+}
+
+void QueryTracer::offer(Trace&& trace) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(!wouldKeep(trace.nanoseconds)) {
+        // Something else got in first.
+        return;
+    }
+
+    slowest.push(std::move(trace));
+    if(slowest.size() > keep) {
+        // Drop the fastest.
+        slowest.pop();
+    }
+    if(slowest.size() == keep) {
+        // Only things slower than the fastest we have can get in now.
+        threshold.store(slowest.top().nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+std::vector<QueryTracer::Trace> QueryTracer::getSlowest() const {
+    std::vector<Trace> traces;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Copy the queue to take things out of it.
+        auto copy = slowest;
+        while(!copy.empty()) {
+            traces.push_back(copy.top());
+            copy.pop();
+        }
+    }
+
+    // They came out fastest first.
+    std::reverse(traces.begin(), traces.end());
+    return traces;
+}
+
+void QueryTracer::write(const std::string& filename) const {
+    std::ofstream out(filename.c_str());
+
+    std::vector<Trace> traces = getSlowest();
+    for(size_t i = 0; i < traces.size(); i++) {
+        const Trace& trace = traces[i];
+
+        out << ">slow" << i + 1 << " nanoseconds=" << trace.nanoseconds;
+        for(const auto& counter : trace.counters) {
+            out << " " << counter.first << "=" << counter.second;
+        }
+        for(const auto& parameter : trace.parameters) {
+            out << " " << parameter.first << "=" << parameter.second;
+        }
+        out << std::endl << trace.query << std::endl;
+    }
+
+    out.close();
+    if(!out) {
+        throw std::runtime_error("Could not write slow queries to " +
+            filename);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef QUERYTRACER_HPP
+#define QUERYTRACER_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Keeps the slowest queries mapped, so that pathological inputs (usually very
+ * repetitive sequence that runs into the search limits) can be pulled out of a
+ * real run, turned into test cases, and used to tune the limits.
+ *
+ * Each query that is offered comes with how long it took, the parameters of
+ * the MappingScheme that mapped it, and that scheme's counters for just that
+ * query. Only the slowest ones seen so far are kept. Checking whether a query
+ * is slow enough to keep doesn't take a lock, so the fast majority of queries
+ * cost almost nothing to trace.
+ *
+ * Thread safe.
+ */
+class QueryTracer {
+
+public:
+    /**
+     * Holds everything recorded about one query.
+     */
+    struct Trace {
+        // How long did it take?
+        uint64_t nanoseconds;
+        // What was it?
+        std::string query;
+        // What were the mapping scheme's parameters, as name and value?
+        std::vector<std::pair<std::string, std::string>> parameters;
+        // What did the scheme count while mapping it?
+        std::vector<std::pair<std::string, size_t>> counters;
+    };
+
+    /**
+     * Make a new QueryTracer that keeps the given number of slowest queries.
+     */
+    QueryTracer(size_t keep);
+
+    /**
+     * Would a query that took the given time be kept right now? If this is
+     * false, there's no need to offer it.
+     */
+    inline bool wouldKeep(uint64_t nanoseconds) const {
+        return nanoseconds > threshold.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Offer a traced query, to keep if it is among the slowest.
+     */
+    void offer(Trace&& trace);
+
+    /**
+     * Get the queries kept, slowest first.
+     */
+    std::vector<Trace> getSlowest() const;
+
+    /**
+     * Save the queries kept to the given file, slowest first, as a FASTA that
+     * can be mapped again. Each record's header has its rank, and then its
+     * time, counters, and parameters as space-separated name=value pairs.
+     * Throws a std::runtime_error if the file can't be written.
+     */
+    void write(const std::string& filename) const;
+
+protected:
+    /**
+     * Orders Traces so the fastest is on top of a priority queue.
+     */
+    struct Slower {
+        inline bool operator()(const Trace& a, const Trace& b) const {
+            return a.nanoseconds > b.nanoseconds;
+        }
+    };
+
+    // How many queries should we keep?
+    size_t keep;
+
+    // Holds the queries we are keeping, fastest on top so it can be dropped
+    // when something slower comes along.
+    std::priority_queue<Trace, std::vector<Trace>, Slower> slowest;
+
+    // Protects slowest.
+    mutable std::mutex mutex;
+
+    // Queries must take longer than this to be kept. It is the time of the
+    // fastest one kept, once we have as many as we want.
+    std::atomic<uint64_t> threshold;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <functional>
+
+#include "ReadResultCache.hpp"
+
+ReadResultCache::ReadResultCache(size_t maxEntries, size_t numShards):
+    shardEntries(0), shards(), stats(),
+    hitsStat(stats.counter("readCacheHits")),
+    missesStat(stats.counter("readCacheMisses")) {
+
+    // Don't have more shards than entries, or giving each shard room for one
+    // would make the cache bigger than asked for.
+    numShards = std::max(std::min(numShards, maxEntries), (size_t) 1);
+    for(size_t i = 0; i < numShards; i++) {
+        // Make all the shards
+        shards.emplace_back(new Shard());
+    }
+
+    // Each shard gets an even share of the entries, and always at least one.
+    shardEntries = std::max(maxEntries / numShards, (size_t) 1);
+}
+
+ReadResultCache::Shard& ReadResultCache::getShard(
+    const std::string& sequence) const {
+
+    return *shards[std::hash<std::string>()(sequence) % shards.size()];
+}
+
+std::shared_ptr<const std::vector<PackedMapping>> ReadResultCache::get(
+    const std::string& sequence) const {
+
+    Shard& shard = getShard(sequence);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = shard.entries.find(sequence);
+    if(entry == shard.entries.end()) {
+        return nullptr;
+    }
+
+    // Move it to the front of the list, since it was just used.
+    shard.recent.splice(shard.recent.begin(), shard.recent, entry->second);
+    return entry->second->second;
+}
+
+void ReadResultCache::put(const std::string& sequence,
+    std::shared_ptr<const std::vector<PackedMapping>> mappings) const {
+
+    Shard& shard = getShard(sequence);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = shard.entries.find(sequence);
+    if(entry != shard.entries.end()) {
+        // Someone else mapped it while we were. Keep theirs.
+        shard.recent.splice(shard.recent.begin(), shard.recent,
+            entry->second);
+        return;
+    }
+
+    // Put ours in at the front, and throw out the least recently used
+    // sequence if we're over.
+    shard.recent.emplace_front(sequence, std::move(mappings));
+    shard.entries[sequence] = shard.recent.begin();
+    if(shard.recent.size() > shardEntries) {
+        shard.entries.erase(shard.recent.back().first);
+        shard.recent.pop_back();
+    }
+}
+
+void ReadResultCache::mapBatch(const MappingScheme& scheme,
+    const std::vector<std::string>& sequences,
+    MappingBatchResult& results) const {
+
+    // Look everything up, and collect the reads that aren't cached.
+    std::vector<std::shared_ptr<const std::vector<PackedMapping>>> found(
+        sequences.size());
+    std::vector<size_t> missed;
+    for(size_t i = 0; i < sequences.size(); i++) {
+        found[i] = get(sequences[i]);
+        if(found[i] == nullptr) {
+            missed.push_back(i);
+        }
+    }
+
+    // Sort the misses by sequence so copies of the same read end up next to
+    // each other, and keep just one of each to map.
+    std::sort(missed.begin(), missed.end(), [&](size_t a, size_t b) {
+        return sequences[a] < sequences[b] ||
+            (sequences[a] == sequences[b] && a < b);
+    });
+    std::vector<std::string> unique;
+    std::vector<size_t> uniqueNumber(sequences.size());
+    for(size_t i = 0; i < missed.size(); i++) {
+        if(i == 0 || sequences[missed[i]] != sequences[missed[i - 1]]) {
+            unique.push_back(sequences[missed[i]]);
+        }
+        uniqueNumber[missed[i]] = unique.size() - 1;
+    }
+    hitsStat.add(sequences.size() - unique.size());
+    missesStat.add(unique.size());
+
+    // Map each new sequence once, and cache it.
+    std::vector<std::shared_ptr<const std::vector<PackedMapping>>> mapped(
+        unique.size());
+    if(!unique.empty()) {
+        MappingBatchResult uniqueResults;
+        scheme.mapBatch(unique, uniqueResults);
+        for(size_t i = 0; i < unique.size(); i++) {
+            std::vector<PackedMapping>* mappings =
+                new std::vector<PackedMapping>(unique[i].size());
+            for(size_t base = 0; base < unique[i].size(); base++) {
+                (*mappings)[base] = uniqueResults.get(i, base);
+            }
+            mapped[i].reset(mappings);
+            put(unique[i], mapped[i]);
+        }
+    }
+
+    // Fan the results out to every read.
+    results.reset(sequences);
+    for(size_t i = 0; i < sequences.size(); i++) {
+        const std::vector<PackedMapping>& mappings = found[i] != nullptr ?
+            *found[i] : *mapped[uniqueNumber[i]];
+        for(size_t base = 0; base < mappings.size(); base++) {
+            results.set(i, base, mappings[base]);
+        }
+    }
+}
+
+StatTracker ReadResultCache::getStats() const {
+    return stats;
+}
@@ -0,0 +1,137 @@
+#ifndef READRESULTCACHE_HPP
+#define READRESULTCACHE_HPP
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+#include "Mapping.hpp"
+#include "MappingScheme.hpp"
+#include "StatTracker.hpp"
+
+/**
+ * Defines a bounded cache of whole-read mapping results, keyed by read
+ * sequence, so that reads seen before don't have to be mapped again. Real
+ * read sets, and reads shredded from a reference with overlapping windows,
+ * have lots of exact duplicates.
+ *
+ * Sequences are spread over a number of shards, each with its own lock and
+ * its own least-recently-used list, like in ContextCache.
+ *
+ * Results are only valid for the mapping scheme settings and index they were
+ * made with, so a ReadResultCache must only ever be used with mapping schemes
+ * that would all give the same results.
+ */
+class ReadResultCache {
+
+public:
+    /**
+     * Make a new ReadResultCache holding the results for at most about the
+     * given number of sequences, spread across the given number of shards.
+     * Uses fewer shards if there would be more shards than sequences.
+     */
+    ReadResultCache(size_t maxEntries, size_t numShards = DEFAULT_SHARDS);
+
+    /**
+     * Get the mappings for the bases of the given sequence, if it is cached.
+     * Otherwise, returns null. Thread safe.
+     */
+    std::shared_ptr<const std::vector<PackedMapping>> get(
+        const std::string& sequence) const;
+
+    /**
+     * Remember the mappings for the bases of the given sequence. Thread safe.
+     */
+    void put(const std::string& sequence,
+        std::shared_ptr<const std::vector<PackedMapping>> mappings) const;
+
+    /**
+     * Map all the given sequences with the given scheme, and put the results
+     * in the given MappingBatchResult, replacing whatever was there, like
+     * MappingScheme::mapBatch. Only sequences that aren't cached get mapped,
+     * and sequences that occur more than once in the batch only get mapped
+     * once. Everything newly mapped is cached. Thread safe.
+     */
+    void mapBatch(const MappingScheme& scheme,
+        const std::vector<std::string>& sequences,
+        MappingBatchResult& results) const;
+
+    /**
+     * Get a snapshot of the "readCacheHits" and "readCacheMisses" stats. Hits
+     * include reads that were duplicates of earlier reads in the same batch.
+     */
+    StatTracker getStats() const;
+
+    /**
+     * By default, how many shards should there be?
+     */
+    static const size_t DEFAULT_SHARDS = 16;
+
+protected:
+    /**
+     * One independently locked part of the cache.
+     */
+    struct Shard {
+        /**
+         * Holds a lock on everything else in the shard.
+         */
+        std::mutex mutex;
+
+        /**
+         * Holds the cached sequences and their mappings, most recently used
+         * first.
+         */
+        std::list<std::pair<std::string,
+            std::shared_ptr<const std::vector<PackedMapping>>>> recent;
+
+        /**
+         * Finds the entries in the recent list by sequence.
+         */
+        std::unordered_map<std::string, decltype(recent)::iterator> entries;
+    };
+
+    /**
+     * Get the shard that the given sequence belongs in.
+     */
+    Shard& getShard(const std::string& sequence) const;
+
+    /**
+     * How many sequences can each shard hold?
+     */
+    size_t shardEntries;
+
+    /**
+     * Holds all the shards. Shards aren't movable, so they are held by
+     * pointer.
+     */
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    /**
+     * Counts hits and misses.
+     */
+    mutable StatTracker stats;
+
+    /**
+     * Counters for hits and misses in stats, gotten up front.
+     */
+    StatTracker::Counter hitsStat;
+    StatTracker::Counter missesStat;
+
+private:
+    /**
+     * ReadResultCaches can't be copied, since their Counters point into their
+     * own StatTrackers.
+     */
+    ReadResultCache(const ReadResultCache& other) = delete;
+
+    /**
+     * Or assigned.
+     */
+    ReadResultCache& operator=(const ReadResultCache& other) = delete;
+
+};
+
+#endif
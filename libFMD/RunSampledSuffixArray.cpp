@@ -0,0 +1,246 @@
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "RunSampledSuffixArray.hpp"
+
+RunSampledSuffixArray::RunSampledSuffixArray(const SuffixArray& suffixArray,
+    const BWT& bwt, const ReadInfoTable& texts): numTexts(texts.getCount()),
+    numSamples(0), textStarts(), rows(), samples(), phiKeys(), phiValues(),
+    mapping(NULL), textStartData(NULL), rowData(NULL), sampleData(NULL),
+    phiKeyData(NULL), phiValueData(NULL) {
+    
+    layOutTexts(texts);
+    
+    // Holds the concatenation position of the suffix in the row above each
+    // boundary row.
+    std::vector<size_t> above;
+    
+    // What was the character in the last row, and where did its suffix start?
+    char lastCharacter = '\0';
+    size_t lastGlobal = 0;
+    
+    for(size_t i = 0; i < suffixArray.getSize(); i++) {
+        // Scan the BWT for boundary rows.
+        char character = bwt.getChar(i);
+        SAElem element = suffixArray.get(i);
+        size_t global = toGlobal(TextPosition(element.getID(),
+            element.getPos()));
+        
+        if(i == 0 || character != lastCharacter || character == '$') {
+            // This is a boundary row. Sample it.
+            rows.push_back(i);
+            samples.push_back(global);
+            above.push_back(lastGlobal);
+        }
+        
+        lastCharacter = character;
+        lastGlobal = global;
+    }
+    
+    buildPhi(above);
+}
+
+RunSampledSuffixArray::RunSampledSuffixArray(const BWT& bwt,
+    const ReadInfoTable& texts): numTexts(texts.getCount()), numSamples(0),
+    textStarts(), rows(), samples(), phiKeys(), phiValues(), mapping(NULL),
+    textStartData(NULL), rowData(NULL), sampleData(NULL), phiKeyData(NULL),
+    phiValueData(NULL) {
+    
+    layOutTexts(texts);
+    
+    // What was the character in the last row?
+    char lastCharacter = '\0';
+    
+    for(size_t i = 0; i < bwt.getBWLen(); i++) {
+        // Scan the BWT for boundary rows.
+        char character = bwt.getChar(i);
+        
+        if(i == 0 || character != lastCharacter || character == '$') {
+            rows.push_back(i);
+        }
+        
+        lastCharacter = character;
+    }
+    
+    // We need to find the suffixes at the boundary rows and the rows above
+    // them.
+    samples.resize(rows.size());
+    std::vector<size_t> above(rows.size());
+    
+    for(size_t text = 0; text < numTexts; text++) {
+        // Walk each text back from its '$', which comes in text order at the
+        // top of the BWT.
+        int64_t index = text;
+        size_t global = textStartData[text + 1] - 1;
+        
+        while(true) {
+            // Is this row a boundary, or just above one?
+            size_t found = std::lower_bound(rows.begin(), rows.end(),
+                (size_t) index) - rows.begin();
+            if(found < rows.size() && rows[found] == (size_t) index) {
+                samples[found] = global;
+                found++;
+            }
+            if(found < rows.size() && rows[found] == (size_t) index + 1) {
+                above[found] = global;
+            }
+            
+            char c = bwt.getChar(index);
+            if(c == '$') {
+                // We got to the start of the text.
+                break;
+            }
+            
+            // LF-map back to the previous suffix in the text.
+            index = bwt.getPC(c) + bwt.getOcc(c, index - 1);
+            global--;
+        }
+    }
+    
+    buildPhi(above);
+}
+
+RunSampledSuffixArray::RunSampledSuffixArray(const std::string& filename):
+    numTexts(0), numSamples(0), textStarts(), rows(), samples(), phiKeys(),
+    phiValues(), mapping(new MappedFile(filename)), textStartData(NULL),
+    rowData(NULL), sampleData(NULL), phiKeyData(NULL), phiValueData(NULL) {
+    
+    // The file is the number of texts, the number of samples, the numTexts +
+    // 1 text starts, the rows and samples for all the boundary rows, and then
+    // the phi keys and values for all of them but the first, all as 8-byte
+    // words. Since the mapping is page-aligned, they can all be used in place.
+    const size_t* words = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+    
+    if(wordCount < 2 || words[1] == 0 ||
+        wordCount < 3 + words[0] + 4 * words[1] - 2) {
+        
+        // Don't go reading off the end of a truncated file.
+        delete mapping;
+        throw std::runtime_error("Truncated run-sampled suffix array " +
+            filename);
+    }
+    
+    numTexts = words[0];
+    numSamples = words[1];
+    textStartData = words + 2;
+    rowData = textStartData + numTexts + 1;
+    sampleData = rowData + numSamples;
+    phiKeyData = sampleData + numSamples;
+    phiValueData = phiKeyData + numSamples - 1;
+}
+
+RunSampledSuffixArray::~RunSampledSuffixArray() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void RunSampledSuffixArray::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+    
+    // Save the text and sample counts in platform-native byte order.
+    file.write((const char*) &numTexts, sizeof(size_t));
+    file.write((const char*) &numSamples, sizeof(size_t));
+    
+    // Then where each text starts
+    file.write((const char*) textStartData, (numTexts + 1) * sizeof(size_t));
+    
+    // Then the boundary rows and their samples
+    file.write((const char*) rowData, numSamples * sizeof(size_t));
+    file.write((const char*) sampleData, numSamples * sizeof(size_t));
+    
+    // And then the phi function
+    file.write((const char*) phiKeyData, (numSamples - 1) * sizeof(size_t));
+    file.write((const char*) phiValueData, (numSamples - 1) * sizeof(size_t));
+    
+    // Close up the file
+    file.close();
+}
+
+bool RunSampledSuffixArray::getSample(int64_t row,
+    TextPosition& position) const {
+    
+    // Find the boundary row at or after this one.
+    const size_t* found = std::lower_bound(rowData, rowData + numSamples,
+        (size_t) row);
+    
+    if(found == rowData + numSamples || *found != (size_t) row) {
+        // It's not a boundary row.
+        return false;
+    }
+    
+    position = fromGlobal(sampleData[found - rowData]);
+    return true;
+}
+
+TextPosition RunSampledSuffixArray::phi(const TextPosition& position) const {
+    size_t global = toGlobal(position);
+    
+    // Find the last phi key at or before this position. Every text's first
+    // position is the suffix of a boundary row (since its BWT character is
+    // '$'), so this is always in the same text.
+    const size_t* found = std::upper_bound(phiKeyData,
+        phiKeyData + numSamples - 1, global);
+    
+    if(found == phiKeyData) {
+        throw std::runtime_error("Can't apply phi to the first row");
+    }
+    found--;
+    
+    // Phi advances along with the position until the next key.
+    return fromGlobal(phiValueData[found - phiKeyData] + (global - *found));
+}
+
+void RunSampledSuffixArray::layOutTexts(const ReadInfoTable& texts) {
+    // Lay out the texts in the concatenation, each with room for its '$'.
+    textStarts.push_back(0);
+    for(size_t text = 0; text < numTexts; text++) {
+        textStarts.push_back(textStarts.back() + texts.getReadLength(text) +
+            1);
+    }
+    
+    // Point at the text starts so we can use toGlobal.
+    useVectors();
+}
+
+void RunSampledSuffixArray::buildPhi(const std::vector<size_t>& above) {
+    // Pair up the phi keys and values so we can sort them together. Phi at
+    // each boundary row's position goes to the position of the row above,
+    // except for the first row, which has nothing above it.
+    std::vector<std::pair<size_t, size_t>> phiPairs;
+    for(size_t i = 1; i < rows.size(); i++) {
+        phiPairs.push_back(std::make_pair(samples[i], above[i]));
+    }
+    
+    // Sort the phi entries by key, so we can find predecessors.
+    std::sort(phiPairs.begin(), phiPairs.end());
+    for(const auto& pair : phiPairs) {
+        phiKeys.push_back(pair.first);
+        phiValues.push_back(pair.second);
+    }
+    
+    numSamples = rows.size();
+    
+    // Queries should look in the vectors, which may have moved.
+    useVectors();
+}
+
+void RunSampledSuffixArray::useVectors() {
+    textStartData = textStarts.data();
+    rowData = rows.data();
+    sampleData = samples.data();
+    phiKeyData = phiKeys.data();
+    phiValueData = phiValues.data();
+}
+
+TextPosition RunSampledSuffixArray::fromGlobal(size_t global) const {
+    // Find the text that starts last at or before the position.
+    const size_t* found = std::upper_bound(textStartData,
+        textStartData + numTexts + 1, global) - 1;
+    
+    return TextPosition(found - textStartData, global - *found);
+}
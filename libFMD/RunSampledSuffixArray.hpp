@@ -0,0 +1,184 @@
+#ifndef RUNSAMPLEDSUFFIXARRAY_HPP
+#define RUNSAMPLEDSUFFIXARRAY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Depend on the libsuffixtools stuff.
+#include <SuffixArray.h>
+#include <ReadInfoTable.h>
+#include <BWT.h>
+
+#include "MappedFile.hpp"
+#include "TextPosition.hpp"
+
+/**
+ * Defines a suffix array sampled at the boundaries of runs in the BWT, in the
+ * style of the r-index. For a highly repetitive collection, like many near-
+ * identical haplotypes, the BWT has few runs, and this takes space
+ * proportional to the number of runs instead of to the total text length.
+ *
+ * A boundary row is the first row of the BWT, any row whose BWT character is
+ * different from the row above it's, and any row whose BWT character is '$'.
+ * We keep the suffix array value at every boundary row. Any other row has the
+ * same character as the row above it, so LF-mapping from it can never skip
+ * over a boundary without landing on one eventually: walking back to the
+ * start of its text always ends at a '$'.
+ *
+ * Once the suffix array value at one row (a "toehold") is known, the values
+ * at the rows above it can be found without any more LF-mapping, using the
+ * phi function, which maps SA[i] to SA[i - 1]. Phi is determined by its
+ * values at the suffix array values of the boundary rows: for any other text
+ * position, phi of that position is phi of the nearest boundary text position
+ * before it, plus the distance to it.
+ *
+ * Suffix array values are stored as positions in the concatenation of all
+ * the texts, each followed by its '$'.
+ */
+class RunSampledSuffixArray {
+
+public:
+    /**
+     * Build a new RunSampledSuffixArray from the given full suffix array and
+     * BWT, using the given table of text lengths. None of them need to be kept
+     * after the constructor returns.
+     */
+    RunSampledSuffixArray(const SuffixArray& suffixArray, const BWT& bwt,
+        const ReadInfoTable& texts);
+    
+    /**
+     * Build a new RunSampledSuffixArray from the given BWT alone, using the
+     * given table of text lengths. Walks every text back from its '$' to find
+     * the suffixes at the boundary rows, instead of needing the suffix array.
+     * Neither needs to be kept after the constructor returns.
+     */
+    RunSampledSuffixArray(const BWT& bwt, const ReadInfoTable& texts);
+    
+    /**
+     * Load a RunSampledSuffixArray from the given file. Uses platform-
+     * dependent byte order and size_t size. The file is memory-mapped rather
+     * than read, and must not be modified while the object exists.
+     */
+    RunSampledSuffixArray(const std::string& filename);
+    
+    /**
+     * Get rid of a RunSampledSuffixArray, unmapping its file if it was loaded
+     * from one.
+     */
+    ~RunSampledSuffixArray();
+    
+    /**
+     * Save a RunSampledSuffixArray to the given file. Uses platform-dependent
+     * byte order and size_t size.
+     */
+    void save(const std::string& filename) const;
+    
+    /**
+     * Get the number of boundary rows sampled. At most the number of runs in
+     * the BWT plus the number of texts.
+     */
+    inline size_t getSampleCount() const {
+        return numSamples;
+    }
+    
+    /**
+     * Get the number of bytes the samples take up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return (textStarts.capacity() + rows.capacity() + samples.capacity() +
+            phiKeys.capacity() + phiValues.capacity()) * sizeof(size_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
+    }
+    
+    /**
+     * If the given BWT row is a boundary row, put its text position in
+     * position and return true. Otherwise, return false, and the row has the
+     * same BWT character as the row above it, which is not '$'.
+     */
+    bool getSample(int64_t row, TextPosition& position) const;
+    
+    /**
+     * Given the text position of the suffix in some BWT row other than the
+     * first, get the text position of the suffix in the row above it.
+     */
+    TextPosition phi(const TextPosition& position) const;
+
+protected:
+    /**
+     * Lay out where each text starts in the concatenation.
+     */
+    void layOutTexts(const ReadInfoTable& texts);
+    
+    /**
+     * Fill in the phi keys and values from the boundary rows and their
+     * samples, and the concatenation positions of the suffixes in the rows
+     * just above them.
+     */
+    void buildPhi(const std::vector<size_t>& above);
+    
+    /**
+     * Point the data pointers at the vectors, once they have been filled in.
+     */
+    void useVectors();
+    
+    /**
+     * Convert a position in the concatenation of all the texts into a
+     * TextPosition.
+     */
+    TextPosition fromGlobal(size_t global) const;
+    
+    /**
+     * Convert a TextPosition into a position in the concatenation of all the
+     * texts.
+     */
+    inline size_t toGlobal(const TextPosition& position) const {
+        return textStartData[position.getText()] + position.getOffset();
+    }
+    
+    // How many texts are there?
+    size_t numTexts;
+    
+    // How many boundary rows were sampled?
+    size_t numSamples;
+    
+    // Where does each text start in the concatenation, if we built it
+    // ourselves? Has an extra past-the-end entry.
+    std::vector<size_t> textStarts;
+    
+    // The boundary rows, in order, if we built them ourselves.
+    std::vector<size_t> rows;
+    
+    // The concatenation position of the suffix at each boundary row.
+    std::vector<size_t> samples;
+    
+    // The concatenation positions of the suffixes at all the boundary rows but
+    // the first, sorted.
+    std::vector<size_t> phiKeys;
+    
+    // For each of those, the concatenation position of the suffix in the row
+    // above.
+    std::vector<size_t> phiValues;
+    
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+    
+    // Point to all the arrays, either in the vectors or in the mapped file.
+    const size_t* textStartData;
+    const size_t* rowData;
+    const size_t* sampleData;
+    const size_t* phiKeyData;
+    const size_t* phiValueData;
+
+private:
+    // RunSampledSuffixArrays can't be copied, since they may own a mapping.
+    RunSampledSuffixArray(const RunSampledSuffixArray& other) = delete;
+    
+    // Or assigned.
+    RunSampledSuffixArray& operator=(
+        const RunSampledSuffixArray& other) = delete;
+
+};
+
+#endif
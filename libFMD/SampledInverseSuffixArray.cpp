@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "SampledInverseSuffixArray.hpp"
+#include "TaskPool.hpp"
+
+SampledInverseSuffixArray::SampledInverseSuffixArray(
+    const SuffixArray& suffixArray, const ReadInfoTable& texts,
+    size_t sampleRate, size_t threads): sampleRate(sampleRate),
+    numContigs(texts.getCount() / 2), sampleStarts(), samples(),
+    mapping(NULL), sampleStartData(NULL), sampleData(NULL) {
+    
+    if(sampleRate == 0) {
+        throw std::runtime_error("Inverse suffix array sample rate must be "
+            "positive");
+    }
+    
+    layOutSamples(texts);
+    
+    // Every sampled suffix has its own slot, so each thread can scan an equal
+    // run of the suffix array on its own.
+    size_t size = suffixArray.getSize();
+    threads = std::max((size_t) 1, std::min(threads, size));
+    parallelFor(threads, [&](size_t thread) {
+        size_t end = size * (thread + 1) / threads;
+        for(size_t i = size * thread / threads; i < end; i++) {
+            // Scan the suffix array for the suffixes we want to sample.
+            const SAElem& element = suffixArray.get(i);
+            
+            if(element.getID() % 2 != 0 ||
+                element.getPos() % sampleRate != 0 ||
+                element.getPos() >= texts.getReadLength(element.getID())) {
+                
+                // This is a reverse strand, not at a sampled offset, or the
+                // '$' at the end (which FMDIndex already knows about).
+                continue;
+            }
+            
+            // Save the BWT index of this sampled suffix
+            samples[sampleStarts[element.getID() / 2] + element.getPos() /
+                sampleRate] = i;
+        }
+    });
+    
+    // Queries should look in the vectors.
+    useVectors();
+}
+
+SampledInverseSuffixArray::SampledInverseSuffixArray(const BWT& bwt,
+    const ReadInfoTable& texts, size_t sampleRate): sampleRate(sampleRate),
+    numContigs(texts.getCount() / 2), sampleStarts(), samples(),
+    mapping(NULL), sampleStartData(NULL), sampleData(NULL) {
+    
+    if(sampleRate == 0) {
+        throw std::runtime_error("Inverse suffix array sample rate must be "
+            "positive");
+    }
+    
+    layOutSamples(texts);
+    
+    for(size_t contig = 0; contig < numContigs; contig++) {
+        // The '$' suffixes of the texts come first in the BWT, in text order,
+        // so we know where the forward strand's end is.
+        int64_t index = contig * 2;
+        size_t offset = texts.getReadLength(contig * 2);
+        
+        while(offset > 0) {
+            // LF-map back to the previous suffix in the text.
+            char c = bwt.getChar(index);
+            index = bwt.getPC(c) + bwt.getOcc(c, index - 1);
+            offset--;
+            
+            if(offset % sampleRate == 0) {
+                // Save the BWT index of this sampled suffix
+                samples[sampleStarts[contig] + offset / sampleRate] = index;
+            }
+        }
+    }
+    
+    // Queries should look in the vectors.
+    useVectors();
+}
+
+SampledInverseSuffixArray::SampledInverseSuffixArray(
+    const std::string& filename): sampleRate(0), numContigs(0),
+    sampleStarts(), samples(), mapping(new MappedFile(filename)),
+    sampleStartData(NULL), sampleData(NULL) {
+    
+    // The file is the sample rate, the number of contigs, the numContigs + 1
+    // sample starts, and then all the samples, all as 8-byte words. Since the
+    // mapping is page-aligned, they can all be used in place.
+    const size_t* words = (const size_t*) mapping->getData();
+    size_t wordCount = mapping->getSize() / sizeof(size_t);
+    
+    if(wordCount < 3 || wordCount < 3 + words[1] ||
+        wordCount < 3 + words[1] + words[2 + words[1]]) {
+        
+        // Don't go reading off the end of a truncated file.
+        delete mapping;
+        throw std::runtime_error("Truncated inverse suffix array " +
+            filename);
+    }
+    
+    sampleRate = words[0];
+    numContigs = words[1];
+    sampleStartData = words + 2;
+    sampleData = (const int64_t*) (sampleStartData + numContigs + 1);
+}
+
+SampledInverseSuffixArray::~SampledInverseSuffixArray() {
+    if(mapping != NULL) {
+        // Unmap the file we were using.
+        delete mapping;
+    }
+}
+
+void SampledInverseSuffixArray::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+    
+    // Save the sample rate and contig count in platform-native byte order.
+    file.write((const char*) &sampleRate, sizeof(size_t));
+    file.write((const char*) &numContigs, sizeof(size_t));
+    
+    // Then where each contig's samples start
+    file.write((const char*) sampleStartData,
+        (numContigs + 1) * sizeof(size_t));
+    
+    // And then the samples themselves
+    file.write((const char*) sampleData,
+        sampleStartData[numContigs] * sizeof(int64_t));
+    
+    // Close up the file
+    file.close();
+}
+
+void SampledInverseSuffixArray::layOutSamples(const ReadInfoTable& texts) {
+    // Lay out the samples for each contig. Contig i is text 2 * i.
+    sampleStarts.push_back(0);
+    for(size_t contig = 0; contig < numContigs; contig++) {
+        // Sample offset 0, and every sampleRate bases after it that's still in
+        // the contig.
+        size_t length = texts.getReadLength(contig * 2);
+        sampleStarts.push_back(sampleStarts.back() +
+            (length + sampleRate - 1) / sampleRate);
+    }
+    samples.resize(sampleStarts.back());
+}
+
+void SampledInverseSuffixArray::useVectors() {
+    sampleStartData = sampleStarts.data();
+    sampleData = samples.data();
+}
@@ -0,0 +1,141 @@
+#ifndef SAMPLEDINVERSESUFFIXARRAY_HPP
+#define SAMPLEDINVERSESUFFIXARRAY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Depend on the libsuffixtools stuff.
+#include <SuffixArray.h>
+#include <ReadInfoTable.h>
+#include <BWT.h>
+
+#include "MappedFile.hpp"
+
+/**
+ * Defines a sampled inverse suffix array: for every contig, the BWT index of
+ * the suffix of its forward strand starting at every multiple of the sample
+ * rate. From there, any position in the contig can be reached with fewer than
+ * sampleRate LF-mapping steps, instead of walking all the way from the end of
+ * the contig.
+ *
+ * Texts are assumed to come in forward/reverse pairs, as FMDIndexBuilder makes
+ * them, and only the forward strands are sampled.
+ */
+class SampledInverseSuffixArray {
+
+public:
+    /**
+     * Build a new SampledInverseSuffixArray from the given full suffix array,
+     * using the given table of text lengths, sampling every sampleRate bases.
+     * Scans the suffix array with the given number of threads. Neither needs
+     * to be kept after the constructor returns.
+     */
+    SampledInverseSuffixArray(const SuffixArray& suffixArray,
+        const ReadInfoTable& texts, size_t sampleRate, size_t threads = 1);
+    
+    /**
+     * Build a new SampledInverseSuffixArray from the given BWT, using the
+     * given table of text lengths, sampling every sampleRate bases. Walks
+     * each contig's forward strand back from its '$' instead of needing the
+     * suffix array. Neither needs to be kept after the constructor returns.
+     */
+    SampledInverseSuffixArray(const BWT& bwt, const ReadInfoTable& texts,
+        size_t sampleRate);
+    
+    /**
+     * Load a SampledInverseSuffixArray from the given file. Uses platform-
+     * dependent byte order and size_t size. The file is memory-mapped rather
+     * than read, and must not be modified while the object exists.
+     */
+    SampledInverseSuffixArray(const std::string& filename);
+    
+    /**
+     * Get rid of a SampledInverseSuffixArray, unmapping its file if it was
+     * loaded from one.
+     */
+    ~SampledInverseSuffixArray();
+    
+    /**
+     * Save a SampledInverseSuffixArray to the given file. Uses platform-
+     * dependent byte order and size_t size.
+     */
+    void save(const std::string& filename) const;
+    
+    /**
+     * Get the distance between samples.
+     */
+    inline size_t getSampleRate() const {
+        return sampleRate;
+    }
+    
+    /**
+     * Get the number of bytes the samples take up, in memory or mapped.
+     */
+    inline size_t getMemoryUsage() const {
+        return sampleStarts.capacity() * sizeof(size_t) +
+            samples.capacity() * sizeof(int64_t) +
+            (mapping != NULL ? mapping->getSize() : 0);
+    }
+    
+    /**
+     * Get the number of samples taken in the given contig.
+     */
+    inline size_t getSampleCount(size_t contig) const {
+        return sampleStartData[contig + 1] - sampleStartData[contig];
+    }
+    
+    /**
+     * Get the BWT index of the suffix of the given contig's forward strand
+     * that starts at 0-based offset sample * sampleRate.
+     */
+    inline int64_t getSample(size_t contig, size_t sample) const {
+        return sampleData[sampleStartData[contig] + sample];
+    }
+    
+protected:
+    /**
+     * Lay out the sample starts for each contig, and make room for the
+     * samples.
+     */
+    void layOutSamples(const ReadInfoTable& texts);
+    
+    /**
+     * Point the data pointers at the vectors, once they have been filled in.
+     */
+    void useVectors();
+    
+    // How far apart are samples?
+    size_t sampleRate;
+    
+    // How many contigs are there?
+    size_t numContigs;
+    
+    // Where do each contig's samples start in the sample array, if we built it
+    // ourselves? Has an extra past-the-end entry.
+    std::vector<size_t> sampleStarts;
+    
+    // Holds the samples for all the contigs, if we built them ourselves.
+    std::vector<int64_t> samples;
+    
+    // Holds the mapped file we were loaded from, if any. Owned by this object,
+    // if not null.
+    MappedFile* mapping;
+    
+    // Point to the sample starts and samples, either in the vectors or in the
+    // mapped file.
+    const size_t* sampleStartData;
+    const int64_t* sampleData;
+    
+private:
+    // SampledInverseSuffixArrays can't be copied, since they may own a
+    // mapping.
+    SampledInverseSuffixArray(const SampledInverseSuffixArray& other) = delete;
+    
+    // Or assigned.
+    SampledInverseSuffixArray& operator=(
+        const SampledInverseSuffixArray& other) = delete;
+    
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "SearchScheme.hpp"
+#include "FMDIndex.hpp"
+
+SearchScheme::SearchScheme(const std::vector<Search>& searches):
+    searches(searches), parts(0), maxMismatches(0) {
+
+    if(searches.empty()) {
+        throw std::runtime_error("Search scheme has no searches");
+    }
+    parts = searches[0].order.size();
+
+    for(const Search& search : searches) {
+        if(search.order.size() != parts || search.lower.size() != parts ||
+            search.upper.size() != parts || parts == 0) {
+            throw std::runtime_error("Search scheme searches differ in size");
+        }
+
+        // The searched parts must always be one run, grown at either end.
+        size_t first = search.order[0];
+        size_t last = search.order[0];
+        for(size_t i = 0; i < parts; i++) {
+            size_t part = search.order[i];
+            if(i > 0 && part + 1 != first && part != last + 1) {
+                throw std::runtime_error("Search scheme order is not "
+                    "connected");
+            }
+            first = std::min(first, part);
+            last = std::max(last, part);
+
+            if(search.lower[i] > search.upper[i] || (i > 0 &&
+                (search.lower[i] < search.lower[i - 1] ||
+                search.upper[i] < search.upper[i - 1]))) {
+                throw std::runtime_error("Search scheme bounds go down");
+            }
+        }
+        if(first != 0 || last != parts - 1) {
+            throw std::runtime_error("Search scheme order has bad parts");
+        }
+
+        maxMismatches = std::max(maxMismatches, search.upper.back());
+    }
+}
+
+const SearchScheme& SearchScheme::forMismatches(size_t maxMismatches) {
+    if(maxMismatches > MAX_MISMATCHES) {
+        throw std::runtime_error("No search scheme for " +
+            std::to_string(maxMismatches) + " mismatches");
+    }
+
+    // Make all the schemes the first time through. This is thread safe.
+    static const std::vector<SearchScheme> schemes = []() {
+        std::vector<SearchScheme> made;
+        for(size_t k = 0; k <= MAX_MISMATCHES; k++) {
+            if(k == 1) {
+                made.push_back(SearchScheme({
+                    {{0, 1}, {0, 0}, {0, 1}},
+                    {{1, 0}, {0, 1}, {0, 1}}
+                }));
+            } else if(k == 2) {
+                made.push_back(SearchScheme({
+                    {{0, 1, 2}, {0, 0, 0}, {0, 2, 2}},
+                    {{2, 1, 0}, {0, 0, 0}, {0, 1, 2}},
+                    {{1, 0, 2}, {0, 0, 1}, {0, 1, 2}}
+                }));
+            } else {
+                // Of k + 1 parts, one must match exactly. Start from each in
+                // turn, go right, then go left.
+                std::vector<Search> searches;
+                for(size_t start = 0; start <= k; start++) {
+                    Search search;
+                    for(size_t part = start; part <= k; part++) {
+                        search.order.push_back(part);
+                    }
+                    for(size_t part = start; part > 0; part--) {
+                        search.order.push_back(part - 1);
+                    }
+                    search.lower.assign(k + 1, 0);
+                    search.upper.assign(k + 1, k);
+                    search.upper[0] = 0;
+                    searches.push_back(search);
+                }
+                made.push_back(SearchScheme(searches));
+            }
+        }
+        return made;
+    }();
+
+    return schemes[maxMismatches];
+}
+
+std::vector<std::pair<FMDPosition, size_t>> SearchScheme::find(
+    const FMDIndexView& view, const EncodedQuery::View& pattern,
+    size_t limit) const {
+
+    std::map<std::pair<int64_t, int64_t>, std::pair<FMDPosition, size_t>>
+        found;
+    std::vector<Step> steps;
+
+    for(const Search& search : searches) {
+        // Lay out the bases in the order this search visits them. The first
+        // part goes left to right, and the rest grow the searched run on
+        // whichever side they are on.
+        steps.clear();
+        for(size_t i = 0; i < search.order.size(); i++) {
+            size_t part = search.order[i];
+            size_t start = pattern.size() * part / parts;
+            size_t end = pattern.size() * (part + 1) / parts;
+            bool right = i == 0 || part > search.order[0];
+            for(size_t j = start; j < end; j++) {
+                Step step;
+                step.index = right ? j : end - 1 - (j - start);
+                step.right = right;
+                step.bound = i;
+                step.partEnd = j + 1 == end;
+                steps.push_back(step);
+            }
+        }
+
+        SearchState state{view, pattern, search, steps, limit, found};
+        searchFrom(state, 0, FMDPosition(view), 0);
+
+        if(found.size() >= limit) {
+            break;
+        }
+    }
+
+    std::vector<std::pair<FMDPosition, size_t>> toReturn;
+    for(const auto& kv : found) {
+        toReturn.push_back(kv.second);
+    }
+    return toReturn;
+}
+
+void SearchScheme::searchFrom(SearchState& state, size_t step,
+    const FMDPosition& range, size_t mismatches) const {
+
+    if(state.found.size() >= state.limit) {
+        // We have enough already.
+        return;
+    }
+
+    if(step == state.steps.size()) {
+        // We searched the whole pattern. Remember the string we found, unless
+        // we found it with fewer mismatches already.
+        auto key = std::make_pair(range.getForwardStart(),
+            range.getEndOffset());
+        auto existing = state.found.find(key);
+        if(existing == state.found.end()) {
+            state.found.emplace(key, std::make_pair(range, mismatches));
+        } else {
+            existing->second.second = std::min(existing->second.second,
+                mismatches);
+        }
+        return;
+    }
+
+    const Step& here = state.steps[step];
+    uint8_t wanted = state.pattern[here.index];
+    const FMDIndex& index = state.view.getIndex();
+
+    for(uint8_t code = 0; code < 4; code++) {
+        // Try each base, if we can afford it.
+        size_t cost = mismatches + (code != wanted);
+        if(cost > state.search.upper[here.bound] ||
+            (here.partEnd && cost < state.search.lower[here.bound])) {
+            continue;
+        }
+
+        FMDPosition extended = range;
+        if(here.right) {
+            index.extendRight(extended, code);
+        } else {
+            index.extendLeft(extended, code);
+        }
+
+        if(!extended.isEmpty(state.view)) {
+            searchFrom(state, step + 1, extended, cost);
+        }
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef SEARCHSCHEME_HPP
+#define SEARCHSCHEME_HPP
+
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstddef>
+
+#include "FMDPosition.hpp"
+#include "FMDIndexView.hpp"
+#include "EncodedQuery.hpp"
+
+/**
+ * Defines a search scheme, in the sense of Kucherov, Salikhov and Tsur, for
+ * finding all the places a whole pattern occurs with up to some number of
+ * mismatches, using the bidirectional FMDPosition.
+ *
+ * The pattern is cut into equal parts. Each search in the scheme visits the
+ * parts in its own order, starting from one part and growing out to the left
+ * or right one adjacent part at a time, and gives a lower and upper bound on
+ * the total mismatches allowed once each part is searched. Parts that are
+ * visited early get low upper bounds, so the branching on mismatches happens
+ * deep in the search where few ranges survive, instead of at the start where
+ * it blows up on repetitive sequence. Together, the searches of a scheme must
+ * cover every way of spreading the mismatches over the parts.
+ */
+class SearchScheme {
+
+public:
+    /**
+     * One search in a scheme.
+     */
+    struct Search {
+        /**
+         * Which parts to search, in order. The first can be any part, and
+         * each after it must be next to the ones already searched.
+         */
+        std::vector<size_t> order;
+
+        /**
+         * The fewest mismatches allowed once each part in order is searched.
+         */
+        std::vector<size_t> lower;
+
+        /**
+         * The most mismatches allowed while each part in order is searched.
+         */
+        std::vector<size_t> upper;
+    };
+
+    /**
+     * Make a scheme out of the given searches. Throws a std::runtime_error if
+     * they don't all have the same number of parts, or a search's order isn't
+     * connected or doesn't visit every part once, or its bounds go down.
+     */
+    SearchScheme(const std::vector<Search>& searches);
+
+    /**
+     * Get a scheme for finding everything with up to the given number of
+     * mismatches. Uses the optimal schemes of Kianfar et al. for 1 and 2
+     * mismatches, and a plain pigeonhole scheme with a part per mismatch plus
+     * one otherwise. The schemes are made once and shared, and there are only
+     * schemes for up to MAX_MISMATCHES mismatches; asking for more throws a
+     * std::runtime_error.
+     */
+    static const SearchScheme& forMismatches(size_t maxMismatches);
+
+    /**
+     * Find the distinct strings within the allowed number of mismatches of
+     * the given pattern that occur in the given view, and return their
+     * FMDPositions with how many mismatches each has. Anything in the pattern
+     * that isn't a base mismatches everything. Stops once limit strings are
+     * found.
+     */
+    std::vector<std::pair<FMDPosition, size_t>> find(const FMDIndexView& view,
+        const EncodedQuery::View& pattern, size_t limit = (size_t) -1) const;
+
+    /**
+     * Does anything within the allowed number of mismatches of the given
+     * pattern occur in the given view?
+     */
+    inline bool exists(const FMDIndexView& view,
+        const EncodedQuery::View& pattern) const {
+        return !find(view, pattern, 1).empty();
+    }
+
+    /**
+     * Get the most mismatches any search allows.
+     */
+    inline size_t getMaxMismatches() const {
+        return maxMismatches;
+    }
+
+    /**
+     * What's the most mismatches there are premade schemes for?
+     */
+    static const size_t MAX_MISMATCHES = 16;
+
+protected:
+    /**
+     * One base to search, in the order a search visits them.
+     */
+    struct Step {
+        /**
+         * Which base of the pattern is it?
+         */
+        size_t index;
+
+        /**
+         * Is the search extended on the right with it, or on the left?
+         */
+        bool right;
+
+        /**
+         * Which of the search's bounds apply to it?
+         */
+        size_t bound;
+
+        /**
+         * Is it the last base of its part, where the lower bound is checked?
+         */
+        bool partEnd;
+    };
+
+    /**
+     * Holds what a search of one pattern is working with, so the recursion
+     * doesn't have to pass it all along.
+     */
+    struct SearchState {
+        const FMDIndexView& view;
+        const EncodedQuery::View& pattern;
+        const Search& search;
+        const std::vector<Step>& steps;
+        size_t limit;
+
+        /**
+         * Holds the fewest mismatches found for each distinct string, by its
+         * forward start and end offset.
+         */
+        std::map<std::pair<int64_t, int64_t>,
+            std::pair<FMDPosition, size_t>>& found;
+    };
+
+    /**
+     * Search on from the given step, with the given range and number of
+     * mismatches so far.
+     */
+    void searchFrom(SearchState& state, size_t step,
+        const FMDPosition& range, size_t mismatches) const;
+
+    /**
+     * Holds the searches.
+     */
+    std::vector<Search> searches;
+
+    /**
+     * How many parts are patterns cut into?
+     */
+    size_t parts;
+
+    /**
+     * What's the most mismatches any search allows?
+     */
+    size_t maxMismatches;
+};
+
+#endif
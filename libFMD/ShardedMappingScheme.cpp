@@ -0,0 +1,161 @@
+#include "ShardedMappingScheme.hpp"
+#include "util.hpp"
+
+#include <stdexcept>
+
+ShardedMappingScheme::ShardedMappingScheme(
+    const std::vector<const MappingScheme*>& shards):
+    MappingScheme(FMDIndexView(firstView(shards))), shards(shards),
+    textOffsets() {
+
+    // Number each shard's texts after all the texts before it.
+    size_t nextText = 0;
+    for(const MappingScheme* shard : shards) {
+        textOffsets.push_back(nextText);
+        nextText += shard->getView().getIndex().getNumberOfContigs() * 2;
+    }
+}
+
+const FMDIndexView& ShardedMappingScheme::firstView(
+    const std::vector<const MappingScheme*>& shards) {
+
+    if(shards.empty()) {
+        throw std::runtime_error("Can't map to no shards");
+    }
+    return shards.front()->getView();
+}
+
+void ShardedMappingScheme::map(const std::string& query,
+    std::function<void(size_t, TextPosition)> callback) const {
+
+    QueryTimer timer(*this, query, stats.histogram("queryNanoseconds"));
+
+    // Holds where each shard would put each base, and whether it owns it.
+    // Each shard's task only writes its own vectors.
+    std::vector<std::vector<TextPosition>> locations(shards.size(),
+        std::vector<TextPosition>(query.size()));
+    std::vector<std::vector<char>> owned(shards.size(),
+        std::vector<char>(query.size(), false));
+
+    std::vector<std::function<void()>> tasks;
+    for(size_t shard = 0; shard < shards.size(); shard++) {
+        tasks.push_back([&, shard]() {
+            for(size_t i = 0; i < query.size(); i++) {
+                // Own the base if exact context on either side pins it down
+                // to this shard alone.
+                owned[shard][i] = isGloballyUnique(query, i, shard, true,
+                    locations[shard][i]) || isGloballyUnique(query, i, shard,
+                    false, locations[shard][i]);
+            }
+        });
+    }
+    runTasks(tasks, parallelShards);
+
+    // Count up what happened to each base.
+    size_t mappedBases = 0;
+    size_t conflicted = 0;
+
+    for(size_t i = 0; i < query.size(); i++) {
+        // Find the shard that owns this base, if there's only one.
+        size_t owner = shards.size();
+        size_t owners = 0;
+        for(size_t shard = 0; shard < shards.size(); shard++) {
+            if(owned[shard][i]) {
+                owner = shard;
+                owners++;
+            }
+        }
+
+        if(owners == 0) {
+            continue;
+        }
+        if(owners > 1) {
+            // Different contexts put the base in different shards.
+            conflicted++;
+            continue;
+        }
+
+        TextPosition location = locations[owner][i];
+        location.setText(location.getText() + textOffsets[owner]);
+        callback(i, location);
+        mappedBases++;
+    }
+
+    stats.add("mapped", mappedBases);
+    stats.add("unmapped", query.size() - mappedBases);
+    stats.add("conflicted", conflicted);
+    timer.count("conflicted", conflicted);
+}
+
+std::vector<std::pair<std::string, std::string>>
+    ShardedMappingScheme::getParameters() const {
+
+    auto parameters = MappingScheme::getParameters();
+    parameters.push_back({"shards", std::to_string(shards.size())});
+    parameters.push_back({"parallelShards", std::to_string(parallelShards)});
+    return parameters;
+}
+
+bool ShardedMappingScheme::isGloballyUnique(const std::string& query,
+    size_t base, size_t shard, bool leftward, TextPosition& location) const {
+
+    if(!isBase(query[base])) {
+        // Nothing can be found with this in it.
+        return false;
+    }
+
+    // Start out searching for just the base in every shard.
+    std::vector<FMDPosition> ranges;
+    for(const MappingScheme* other : shards) {
+        ranges.push_back(other->getView().getIndex().getCharPosition(
+            query[base]));
+    }
+
+    // Extending the context can only narrow the ranges, so go until the
+    // mapping shard runs out or we run out of query.
+    size_t next = base;
+    while(true) {
+        const FMDIndexView& ownView = shards[shard]->getView();
+        if(ranges[shard].getLength() == 0 ||
+            ranges[shard].isEmpty(ownView)) {
+
+            // The mapping shard doesn't have this context at all.
+            return false;
+        }
+
+        bool othersEmpty = true;
+        for(size_t other = 0; other < shards.size() && othersEmpty; other++) {
+            if(other != shard && ranges[other].getLength() != 0 &&
+                !ranges[other].isEmpty(shards[other]->getView())) {
+
+                othersEmpty = false;
+            }
+        }
+
+        if(othersEmpty && ranges[shard].isUnique(ownView)) {
+            // It's here once and nowhere else. The context starts at the base
+            // when reading right, and ends there when reading left.
+            location = ranges[shard].getTextPosition(ownView);
+            if(leftward) {
+                location.addLocalOffset(base - next);
+            }
+            return true;
+        }
+
+        if((leftward ? next == 0 : next + 1 >= query.size()) ||
+            !isBase(query[leftward ? next - 1 : next + 1])) {
+
+            // No more context to try.
+            return false;
+        }
+        next = leftward ? next - 1 : next + 1;
+
+        for(size_t other = 0; other < shards.size(); other++) {
+            if(ranges[other].getLength() != 0) {
+                // Prepend when going left, and append when going right.
+                ranges[other] = shards[other]->getView().getIndex().extend(
+                    ranges[other], query[next], leftward);
+            }
+        }
+    }
+}
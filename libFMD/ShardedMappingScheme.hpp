@@ -0,0 +1,98 @@
+#ifndef SHARDEDMAPPINGSCHEME_HPP
+#define SHARDEDMAPPINGSCHEME_HPP
+
+#include "MappingScheme.hpp"
+#include "FMDPosition.hpp"
+
+#include <vector>
+
+/**
+ * Mapping scheme for a collection of genomes split across several
+ * independently built FMD indexes (shards), too big to put in one. Each query
+ * is checked against every shard, in parallel, and the results are combined
+ * into global decisions.
+ *
+ * Text numbers are made global by numbering the texts of each shard after
+ * those of all the shards before it, which is how they would be numbered in a
+ * single index built from all the shards' genomes in order.
+ *
+ * Being unique in one shard isn't enough to map a base, since the context that
+ * made it unique may be in another shard too. So a shard owns a base only if,
+ * reading out exactly from the base to the left or to the right, a context is
+ * found that is unique in that shard and absent from all the others, and the
+ * base maps to where that context is. If more than one shard owns a base, it
+ * is conflicted. That makes the scheme conservative: bases that a single index
+ * would map only with contexts spanning both sides of the base, or only
+ * inexactly, are left unmapped, but nothing is mapped that a single index
+ * would call ambiguous. The shards' own schemes supply only their views.
+ */
+class ShardedMappingScheme: public MappingScheme {
+
+public:
+    /**
+     * Make a new ShardedMappingScheme combining the given MappingSchemes, one
+     * per shard, in the order their texts are to be numbered. The schemes are
+     * not owned, and must outlive the ShardedMappingScheme. Throws a
+     * std::runtime_error if no shards are given.
+     */
+    ShardedMappingScheme(const std::vector<const MappingScheme*>& shards);
+
+    /**
+     * Map the given query string against all the shards. When a mapping is
+     * found, the callback function will be called with the query base index,
+     * and the global TextPosition to which it maps in the forward direction.
+     */
+    virtual void map(const std::string& query,
+        std::function<void(size_t, TextPosition)> callback) const override;
+
+    /**
+     * Get the parameters for mapping, including the number of shards.
+     */
+    virtual std::vector<std::pair<std::string, std::string>>
+        getParameters() const override;
+
+    /**
+     * Get the number of shards.
+     */
+    inline size_t getShardCount() const {
+        return shards.size();
+    }
+
+    /**
+     * Get the global number of the first text in the given shard.
+     */
+    inline size_t getTextOffset(size_t shard) const {
+        return textOffsets[shard];
+    }
+
+    /**
+     * Should the shards be mapped against in parallel?
+     */
+    bool parallelShards = true;
+
+protected:
+    /**
+     * Get the view of the first of the given shards, to be the view for the
+     * whole scheme. Throws a std::runtime_error if there are no shards.
+     */
+    static const FMDIndexView& firstView(
+        const std::vector<const MappingScheme*>& shards);
+
+    /**
+     * Return true if, reading out from the given base of the query in the
+     * given direction, a context is found that is unique in the given shard
+     * and absent from all the others, and false otherwise. If true, location
+     * is set to where the base is in the shard, in the shard's own text
+     * numbering.
+     */
+    bool isGloballyUnique(const std::string& query, size_t base, size_t shard,
+        bool leftward, TextPosition& location) const;
+
+    // Holds the scheme to map to each shard with.
+    std::vector<const MappingScheme*> shards;
+
+    // Holds the global number of the first text in each shard.
+    std::vector<size_t> textOffsets;
+};
+
+#endif
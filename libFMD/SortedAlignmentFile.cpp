@@ -0,0 +1,178 @@
+#include <stdexcept>
+
+#include "SortedAlignmentFile.hpp"
+
+SortedAlignmentFile::SortedAlignmentFile(const std::string& filename):
+    file(filename.c_str(), std::ios::binary), referenceNames(), windows(),
+    indexOffset(0), filename(filename) {
+
+    // Pull out the header.
+    uint64_t magic;
+    uint64_t version;
+    uint64_t nameCount;
+    if(!readWord(file, magic) || magic != MAGIC || !readWord(file, version) ||
+        version != VERSION || !readWord(file, nameCount)) {
+
+        throw std::runtime_error("Bad sorted alignment file " + filename);
+    }
+
+    referenceNames.resize(nameCount);
+    for(std::string& name : referenceNames) {
+        if(!readString(file, name)) {
+            throw std::runtime_error("Bad sorted alignment file " + filename);
+        }
+    }
+    std::streamoff recordsOffset = file.tellg();
+
+    // The last word says where the index is.
+    if(!file.seekg(-(std::streamoff) sizeof(uint64_t), std::ios::end) ||
+        !readWord(file, indexOffset) ||
+        indexOffset < (uint64_t) recordsOffset) {
+
+        throw std::runtime_error("Truncated sorted alignment file " +
+            filename);
+    }
+
+    // Load the index windows for each reference.
+    file.seekg(indexOffset);
+    windows.resize(nameCount);
+    for(std::vector<uint64_t>& referenceWindows : windows) {
+        uint64_t windowCount;
+        if(!readWord(file, windowCount)) {
+            throw std::runtime_error("Truncated sorted alignment file " +
+                filename);
+        }
+        referenceWindows.resize(windowCount);
+        if(!file.read((char*) referenceWindows.data(),
+            windowCount * sizeof(uint64_t))) {
+
+            throw std::runtime_error("Truncated sorted alignment file " +
+                filename);
+        }
+    }
+
+    // Get ready to read the records in order.
+    file.seekg(recordsOffset);
+}
+
+size_t SortedAlignmentFile::query(size_t reference, size_t start, size_t end,
+    std::vector<Record>& records) {
+
+    records.clear();
+    if(reference >= windows.size() || start >= end ||
+        start / WINDOW_SIZE >= windows[reference].size()) {
+
+        // Nothing on this reference gets as far as the region.
+        return 0;
+    }
+
+    // Skip right to the first record that might overlap.
+    file.clear();
+    file.seekg(windows[reference][start / WINDOW_SIZE]);
+
+    Record record;
+    while(next(record) && record.reference == reference &&
+        record.start < end) {
+
+        if(record.getEnd() > start) {
+            records.push_back(std::move(record));
+        }
+    }
+
+    return records.size();
+}
+
+bool SortedAlignmentFile::next(Record& record) {
+    if(file.tellg() >= (std::streamoff) indexOffset) {
+        // We're out of records.
+        return false;
+    }
+    return readRecord(file, record, filename);
+}
+
+void SortedAlignmentFile::appendRecord(std::string& out,
+    const Record& record) {
+
+    appendWord(out, record.reference);
+    appendWord(out, record.start);
+    appendWord(out, record.length);
+    appendWord(out, record.backwards);
+    appendWord(out, record.queryStart);
+    appendWord(out, record.readLength);
+    appendString(out, record.name);
+}
+
+bool SortedAlignmentFile::readRecord(std::istream& in, Record& record,
+    const std::string& filename) {
+
+    uint64_t reference;
+    if(!readWord(in, reference)) {
+        // There are no more records.
+        return false;
+    }
+
+    // Now everything else in the record has to be there.
+    if(!readWord(in, record.start) || !readWord(in, record.length) ||
+        !readWord(in, record.backwards) || !readWord(in, record.queryStart) ||
+        !readWord(in, record.readLength) || !readString(in, record.name)) {
+
+        throw std::runtime_error("Truncated sorted alignment file " +
+            filename);
+    }
+    record.reference = reference;
+    return true;
+}
+
+std::string SortedAlignmentFile::makeHeader(
+    const std::vector<std::string>& referenceNames) {
+
+    std::string header;
+    appendWord(header, MAGIC);
+    appendWord(header, VERSION);
+    appendWord(header, referenceNames.size());
+    for(const std::string& name : referenceNames) {
+        appendString(header, name);
+    }
+    return header;
+}
+
+void SortedAlignmentFile::appendIndex(std::string& out,
+    const std::vector<std::vector<uint64_t>>& windows, uint64_t indexOffset) {
+
+    for(const std::vector<uint64_t>& referenceWindows : windows) {
+        appendWord(out, referenceWindows.size());
+        out.append((const char*) referenceWindows.data(),
+            referenceWindows.size() * sizeof(uint64_t));
+    }
+    appendWord(out, indexOffset);
+}
+
+void SortedAlignmentFile::appendWord(std::string& out, uint64_t word) {
+    out.append((const char*) &word, sizeof(word));
+}
+
+void SortedAlignmentFile::appendString(std::string& out,
+    const std::string& text) {
+
+    appendWord(out, text.size());
+    out += text;
+    // Pad out to a word boundary.
+    out.append((sizeof(uint64_t) - text.size() % sizeof(uint64_t)) %
+        sizeof(uint64_t), '\0');
+}
+
+bool SortedAlignmentFile::readWord(std::istream& in, uint64_t& word) {
+    return (bool) in.read((char*) &word, sizeof(word));
+}
+
+bool SortedAlignmentFile::readString(std::istream& in, std::string& text) {
+    uint64_t length;
+    if(!readWord(in, length)) {
+        return false;
+    }
+    size_t padding = (sizeof(uint64_t) - length % sizeof(uint64_t)) %
+        sizeof(uint64_t);
+    text.assign(length, '\0');
+    char zeroes[sizeof(uint64_t)];
+    return in.read(&text[0], length) && in.read(zeroes, padding);
+}
@@ -0,0 +1,186 @@
+#ifndef SORTEDALIGNMENTFILE_HPP
+#define SORTEDALIGNMENTFILE_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+/**
+ * Reads an alignment of reads to a reference saved by SortedAlignmentWriter,
+ * which holds the same mapped segments as an AlignmentFile, but sorted by where
+ * they land on the reference, with an index to find the ones overlapping any
+ * reference region without reading the rest.
+ *
+ * The file starts with a header just like an AlignmentFile's, with its own
+ * magic number: a format version, the number of reference sequence names, and
+ * each name. After that comes a record for each mapped segment: the number of
+ * the reference name, the leftmost reference offset it covers, its length,
+ * whether it is mapped backwards, the read base it starts at, the length of the
+ * read, and the read's name. Records are sorted by reference number and then
+ * leftmost offset.
+ *
+ * After the records comes the index, which is a linear index like that of a
+ * BAI file. For each reference number there is a count of windows of
+ * WINDOW_SIZE bases, and then for each window the file offset of the first
+ * record, in sorted order, that ends past the start of the window. No earlier
+ * record on that reference can overlap the window, so a query starts reading
+ * there. The last word of the file is the file offset of the index.
+ *
+ * Everything is in 64-bit words in platform-native byte order. Strings are
+ * padded with 0s out to a whole number of words.
+ */
+class SortedAlignmentFile {
+
+public:
+    /**
+     * Represents a mapped segment of a read, as stored in the file.
+     */
+    struct Record {
+        // What is the number of the name of the reference sequence it is on?
+        uint64_t reference;
+        // What is the leftmost reference base, 0-based, that it covers?
+        uint64_t start;
+        // How many bases long is it?
+        uint64_t length;
+        // Is it mapped to the reverse strand (1) or not (0)? If so, its first
+        // read base is at the rightmost reference base, not the leftmost.
+        uint64_t backwards;
+        // What read base does it start at, 0-based?
+        uint64_t queryStart;
+        // How long is the read it is part of?
+        uint64_t readLength;
+        // What is that read called?
+        std::string name;
+
+        /**
+         * Get the reference base just past the segment's rightmost base.
+         */
+        inline uint64_t getEnd() const {
+            return start + length;
+        }
+
+        /**
+         * Is this record sorted before the other one?
+         */
+        inline bool operator<(const Record& other) const {
+            return reference < other.reference ||
+                (reference == other.reference && start < other.start);
+        }
+    };
+
+    /**
+     * Open the given sorted alignment file for reading, and load its index.
+     * Throws a std::runtime_error if it isn't a sorted alignment file of this
+     * version.
+     */
+    SortedAlignmentFile(const std::string& filename);
+
+    /**
+     * Get the names of the reference sequences the reads were mapped to, by
+     * number.
+     */
+    inline const std::vector<std::string>& getReferenceNames() const {
+        return referenceNames;
+    }
+
+    /**
+     * Get all the records for segments that overlap the region from start to
+     * just before end on the reference with the given number, in sorted order,
+     * replacing the contents of the given vector. Returns the number found.
+     */
+    size_t query(size_t reference, size_t start, size_t end,
+        std::vector<Record>& records);
+
+    /**
+     * Read the next record, in sorted order, filling in the given record.
+     * Returns false, without touching it, if there are no more records. Starts
+     * at the first record, and after a query() continues from wherever the
+     * query stopped reading.
+     */
+    bool next(Record& record);
+
+    /**
+     * Append a record to the given string in the file's format.
+     */
+    static void appendRecord(std::string& out, const Record& record);
+
+    /**
+     * Read a record saved by appendRecord() from the given stream. Returns
+     * false if the stream is at its end. Throws a std::runtime_error, naming
+     * the given file, if the stream ends in the middle of a record.
+     */
+    static bool readRecord(std::istream& in, Record& record,
+        const std::string& filename);
+
+    /**
+     * Make the header for a file of alignments to reference sequences with the
+     * given names, which records refer to by number.
+     */
+    static std::string makeHeader(
+        const std::vector<std::string>& referenceNames);
+
+    /**
+     * Append the index to the given string, for a file with the given index
+     * windows for each reference, starting at the given file offset.
+     */
+    static void appendIndex(std::string& out,
+        const std::vector<std::vector<uint64_t>>& windows,
+        uint64_t indexOffset);
+
+    /**
+     * What version of the format do we read and write?
+     */
+    static const uint64_t VERSION = 1;
+
+    /**
+     * How many reference bases does each index window cover?
+     */
+    static const uint64_t WINDOW_SIZE = 16384;
+
+protected:
+    /**
+     * What word starts a sorted alignment file?
+     */
+    static const uint64_t MAGIC = 0x314e4c4154524f53ULL;
+
+    /**
+     * Append a word to the given string.
+     */
+    static void appendWord(std::string& out, uint64_t word);
+
+    /**
+     * Append a string, as its length and then its bytes padded out to a whole
+     * number of words, to the given string.
+     */
+    static void appendString(std::string& out, const std::string& text);
+
+    /**
+     * Read a word from the given stream. Returns false if it's at its end.
+     */
+    static bool readWord(std::istream& in, uint64_t& word);
+
+    /**
+     * Read a string saved by appendString() from the given stream. Returns
+     * false if it ends before the string is all there.
+     */
+    static bool readString(std::istream& in, std::string& text);
+
+    // Holds the file we read from.
+    std::ifstream file;
+
+    // Holds the names of the reference sequences.
+    std::vector<std::string> referenceNames;
+
+    // Holds the index windows for each reference.
+    std::vector<std::vector<uint64_t>> windows;
+
+    // Where does the index start, which is where the records end?
+    uint64_t indexOffset;
+
+    // Holds the name of the file, for error messages.
+    std::string filename;
+
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+
+#include "SortedAlignmentWriter.hpp"
+
+SortedAlignmentWriter::SortedAlignmentWriter(const std::string& filename,
+    const std::vector<std::string>& referenceNames, size_t memoryLimit):
+    filename(filename), referenceCount(referenceNames.size()),
+    memoryLimit(memoryLimit), records(), memoryUsed(0), runCount(0), out(),
+    buffer(SortedAlignmentFile::makeHeader(referenceNames)), offset(0),
+    windows(referenceNames.size()), closed(false) {
+
+    // The header waits in the buffer until we write the records after it.
+    offset = buffer.size();
+}
+
+SortedAlignmentWriter::~SortedAlignmentWriter() {
+    if(!closed) {
+        for(size_t run = 0; run < runCount; run++) {
+            std::remove(getRunFilename(run).c_str());
+        }
+    }
+}
+
+void SortedAlignmentWriter::addRead(const std::string& name, size_t length,
+    const std::vector<AlignmentFile::Segment>& segments) {
+
+    for(const AlignmentFile::Segment& segment : segments) {
+        if(segment.length == 0) {
+            // Nothing is mapped, so there is nowhere to sort it to.
+            continue;
+        }
+        if(segment.reference >= referenceCount) {
+            throw std::runtime_error("Segment of " + name +
+                " is on an unknown reference");
+        }
+
+        // Backward segments run leftward from their first read base.
+        uint64_t start = segment.backwards ?
+            segment.referenceOffset + 1 - segment.length :
+            segment.referenceOffset;
+        records.push_back({segment.reference, start, segment.length,
+            segment.backwards, segment.queryStart, length, name});
+        memoryUsed += sizeof(SortedAlignmentFile::Record) + name.size();
+
+        if(memoryUsed >= memoryLimit) {
+            spill();
+        }
+    }
+}
+
+void SortedAlignmentWriter::addReads(const std::string& data) {
+    size_t cursor = 0;
+    std::string name;
+    size_t length;
+    std::vector<AlignmentFile::Segment> segments;
+    while(AlignmentFile::parseRead(data, cursor, name, length, segments)) {
+        addRead(name, length, segments);
+    }
+}
+
+void SortedAlignmentWriter::close() {
+    if(closed) {
+        return;
+    }
+
+    out.open(filename.c_str(), std::ios::binary);
+    if(!out) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+
+    if(runCount == 0) {
+        // Everything fit in memory, so just sort it there.
+        std::stable_sort(records.begin(), records.end());
+        for(const SortedAlignmentFile::Record& record : records) {
+            write(record);
+        }
+    } else {
+        if(!records.empty()) {
+            spill();
+        }
+
+        // Merge the runs, by always taking the smallest next record, and the
+        // one from the earliest run on ties, so ties stay in the order they
+        // were added.
+        std::vector<std::unique_ptr<std::ifstream>> runs;
+        std::vector<SortedAlignmentFile::Record> heads(runCount);
+        auto later = [&](size_t a, size_t b) {
+            return heads[b] < heads[a] || (!(heads[a] < heads[b]) && a > b);
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)>
+            waiting(later);
+
+        for(size_t run = 0; run < runCount; run++) {
+            runs.emplace_back(new std::ifstream(getRunFilename(run).c_str(),
+                std::ios::binary));
+            if(SortedAlignmentFile::readRecord(*runs[run], heads[run],
+                getRunFilename(run))) {
+
+                waiting.push(run);
+            }
+        }
+
+        while(!waiting.empty()) {
+            size_t run = waiting.top();
+            waiting.pop();
+            write(heads[run]);
+            if(SortedAlignmentFile::readRecord(*runs[run], heads[run],
+                getRunFilename(run))) {
+
+                waiting.push(run);
+            }
+        }
+
+        runs.clear();
+        for(size_t run = 0; run < runCount; run++) {
+            std::remove(getRunFilename(run).c_str());
+        }
+        runCount = 0;
+    }
+    records.clear();
+    records.shrink_to_fit();
+
+    // The index goes after all the records.
+    SortedAlignmentFile::appendIndex(buffer, windows, offset);
+    flush();
+    out.close();
+    if(!out) {
+        throw std::runtime_error("Could not write " + filename);
+    }
+    closed = true;
+}
+
+void SortedAlignmentWriter::spill() {
+    std::stable_sort(records.begin(), records.end());
+
+    std::ofstream run(getRunFilename(runCount).c_str(), std::ios::binary);
+    std::string chunk;
+    for(const SortedAlignmentFile::Record& record : records) {
+        SortedAlignmentFile::appendRecord(chunk, record);
+        if(chunk.size() >= OUTPUT_CHUNK) {
+            run.write(chunk.data(), chunk.size());
+            chunk.clear();
+        }
+    }
+    run.write(chunk.data(), chunk.size());
+    run.close();
+    if(!run) {
+        throw std::runtime_error("Could not write " +
+            getRunFilename(runCount));
+    }
+
+    runCount++;
+    records.clear();
+    memoryUsed = 0;
+}
+
+void SortedAlignmentWriter::write(const SortedAlignmentFile::Record& record) {
+    // Every window this record reaches into that no earlier record reached
+    // into starts reading here.
+    std::vector<uint64_t>& referenceWindows = windows[record.reference];
+    size_t lastWindow = (record.getEnd() - 1) /
+        SortedAlignmentFile::WINDOW_SIZE;
+    if(referenceWindows.size() <= lastWindow) {
+        referenceWindows.resize(lastWindow + 1, offset);
+    }
+
+    size_t before = buffer.size();
+    SortedAlignmentFile::appendRecord(buffer, record);
+    offset += buffer.size() - before;
+
+    if(buffer.size() >= OUTPUT_CHUNK) {
+        flush();
+    }
+}
+
+void SortedAlignmentWriter::flush() {
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+std::string SortedAlignmentWriter::getRunFilename(size_t run) const {
+    return filename + ".run" + std::to_string(run);
+}
@@ -0,0 +1,131 @@
+#ifndef SORTEDALIGNMENTWRITER_HPP
+#define SORTEDALIGNMENTWRITER_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "AlignmentFile.hpp"
+#include "SortedAlignmentFile.hpp"
+
+/**
+ * Writes a SortedAlignmentFile from reads' mapped segments given in any order,
+ * using no more than about a fixed amount of memory however many there are.
+ *
+ * Segments are collected in memory until they fill the memory limit, and then
+ * sorted and spilled to a temporary run file next to the output. When the
+ * writer is closed, the runs and whatever is left in memory are merged into the
+ * output, and its index is built as the sorted records go by. Segments that tie
+ * on where they start come out in the order they were added.
+ */
+class SortedAlignmentWriter {
+
+public:
+    /**
+     * Make a writer to save a sorted alignment to the given file, against
+     * reference sequences with the given names, holding up to about the given
+     * number of bytes of segments in memory at once.
+     */
+    SortedAlignmentWriter(const std::string& filename,
+        const std::vector<std::string>& referenceNames, size_t memoryLimit);
+
+    /**
+     * Clean up any run files left by a writer that was never closed.
+     */
+    ~SortedAlignmentWriter();
+
+    /**
+     * Add the mapped segments of a read with the given name and length.
+     */
+    void addRead(const std::string& name, size_t length,
+        const std::vector<AlignmentFile::Segment>& segments);
+
+    /**
+     * Add the segments of all the reads with records in the given string, as
+     * made by AlignmentFile::appendRead(). Throws a std::runtime_error if a
+     * record is cut off.
+     */
+    void addReads(const std::string& records);
+
+    /**
+     * Sort and write out everything added, with the index, and remove the run
+     * files. Nothing may be added afterward.
+     */
+    void close();
+
+protected:
+    /**
+     * Sort the segments in memory and save them as a new run file.
+     */
+    void spill();
+
+    /**
+     * Write a record, which must not sort before the last one written, to the
+     * output, and account for it in the index.
+     */
+    void write(const SortedAlignmentFile::Record& record);
+
+    /**
+     * Write out whatever output is buffered.
+     */
+    void flush();
+
+    /**
+     * Get the name of the run file with the given number.
+     */
+    std::string getRunFilename(size_t run) const;
+
+    /**
+     * How much buffered output should we write out at once?
+     */
+    static const size_t OUTPUT_CHUNK = 1 << 20;
+
+    // What file are we making?
+    std::string filename;
+
+    // How many reference sequences are there?
+    size_t referenceCount;
+
+    // How much memory can we fill with segments before spilling?
+    size_t memoryLimit;
+
+    // Holds the segments that haven't been spilled yet.
+    std::vector<SortedAlignmentFile::Record> records;
+
+    // About how much memory do they use?
+    size_t memoryUsed;
+
+    // How many runs have we spilled?
+    size_t runCount;
+
+    // Holds the output file once we are writing it.
+    std::ofstream out;
+
+    // Holds output waiting to be written.
+    std::string buffer;
+
+    // What file offset is the end of the buffered output at?
+    uint64_t offset;
+
+    // Holds the index windows for each reference, as we fill them in.
+    std::vector<std::vector<uint64_t>> windows;
+
+    // Have we been closed yet?
+    bool closed;
+
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    SortedAlignmentWriter(const SortedAlignmentWriter& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    SortedAlignmentWriter& operator=(
+        const SortedAlignmentWriter& other) = delete;
+
+};
+
+#endif
@@ -1,57 +1,116 @@
 #include "StatTracker.hpp"
 
 #include <fstream>
+#include <vector>
 
-StatTracker::StatTracker(): stats(), statsMutex() {
+std::atomic<size_t> StatTracker::nextShard(0);
+
+StatTracker::StatTracker(): stats(), counters(), histograms(),
+    statsMutex() {
     // Nothing to do
 }
 
 StatTracker& StatTracker::operator+=(const StatTracker& other){
-    std::lock(statsMutex, other.statsMutex);
-    for(auto& pair : other.stats) {
+    // Add up the other StatTracker first, so we never hold both locks.
+    other.statsMutex.lock();
+    std::map<std::string, size_t> otherStats = other.totals();
+    other.statsMutex.unlock();
+    
+    statsMutex.lock();
+    for(auto& pair : otherStats) {
         // For each stat in the other StatTracker, add it into our stats. We
         // don't just forward along to add because we would need a recursive
-        // mutex.
-        if(stats.count(pair.first)) {
-            // We already have something for this stat, so add to it.
-            stats[pair.first] += pair.second;
-        } else {
-            // We had nothing, so start out with this value.
-            stats[pair.first] = pair.second;
-        }
+        // mutex. Stats we don't have yet start out at 0.
+        stats[pair.first] += pair.second;
     }
     statsMutex.unlock();
-    other.statsMutex.unlock();
+    
+    return *this;
 }
 
-void StatTracker::add(const std::string& stat, size_t amount) {
-    // Lock stats so nobody else can use it.
-    statsMutex.lock();
-    if(stats.count(stat)) {
-        // We already have something for this stat, so add to it.
-        stats[stat] += amount;
-    } else {
-        // We had nothing, so start out with this value.
-        stats[stat] = amount;
+StatTracker::Counter StatTracker::counter(const std::string& stat) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    
+    std::unique_ptr<Shard[]>& shards = counters[stat];
+    if(!shards) {
+        // Make the shards for this stat, all starting at 0.
+        shards.reset(new Shard[NUM_SHARDS]);
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            shards[i].value.store(0);
+        }
     }
-    statsMutex.unlock();
+    
+    return Counter(shards.get());
 }
 
-StatTracker::StatTracker(const StatTracker& other) {
-    // Lock both objects
-    std::lock(statsMutex, other.statsMutex);
+StatTracker::Histogram StatTracker::histogram(const std::string& stat) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    
+    std::unique_ptr<HistogramShard[]>& shards = histograms[stat];
+    if(!shards) {
+        // Make the shards for this histogram, all empty.
+        shards.reset(new HistogramShard[NUM_SHARDS]);
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            for(size_t j = 0; j < NUM_BUCKETS; j++) {
+                shards[i].buckets[j].store(0);
+            }
+            shards[i].sum.store(0);
+        }
+    }
+    
+    return Histogram(shards.get());
+}
+
+StatTracker::Phase StatTracker::phase(const std::string& name) {
+    Phase toReturn;
+    toReturn.calls = counter(name + ":calls");
+    for(size_t i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+        toReturn.events[i] = counter(name + ":" +
+            PerfCounters::EVENT_NAMES[i]);
+    }
+    return toReturn;
+}
+
+void StatTracker::add(const std::string& stat, size_t amount) {
+    counter(stat).add(amount);
+}
+
+StatTracker::StatTracker(const StatTracker& other): stats(), counters(),
+    histograms(), statsMutex() {
+    
+    // Lock the source
+    other.statsMutex.lock();
     // Copy over the stats
-    stats = other.stats;  
+    stats = other.totals();
     // Unlock  
-    statsMutex.unlock();
     other.statsMutex.unlock();
 }
 
 StatTracker& StatTracker::operator=(const StatTracker& other) {
+    if(&other == this) {
+        // Locking both would deadlock.
+        return *this;
+    }
+    
     // Lock both objects
     std::lock(statsMutex, other.statsMutex);
     // Copy over the stats
-    stats = other.stats;  
+    stats = other.totals();
+    for(auto& pair : counters) {
+        // Keep our Counters working, but empty them out.
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            pair.second[i].value.store(0);
+        }
+    }
+    for(auto& pair : histograms) {
+        // And our Histograms.
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            for(size_t j = 0; j < NUM_BUCKETS; j++) {
+                pair.second[i].buckets[j].store(0);
+            }
+            pair.second[i].sum.store(0);
+        }
+    }
     // Unlock  
     statsMutex.unlock();
     other.statsMutex.unlock();
@@ -62,10 +121,23 @@ StatTracker& StatTracker::operator=(const StatTracker& other) {
 const size_t StatTracker::operator[](const std::string stat) const {
     statsMutex.lock();
     size_t toReturn = 0;
+    if(counters.count(stat)) {
+        // Add in all the shards.
+        const std::unique_ptr<Shard[]>& shards = counters.at(stat);
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            toReturn += shards[i].value.load(std::memory_order_relaxed);
+        }
+    }
     if(stats.count(stat)) {
-        // We already have something for this stat, so return that. We need to
-        // use at since the map is const.
-        toReturn = stats.at(stat);
+        // We already have something for this stat, so add that. We need to use
+        // at since the map is const.
+        toReturn += stats.at(stat);
+    } else if(!histograms.empty()) {
+        // It may be a histogram bucket, so we have to add everything up.
+        std::map<std::string, size_t> all = totals();
+        if(all.count(stat)) {
+            toReturn = all.at(stat);
+        }
     }
 
     // Unlock and send back the answer.
@@ -79,7 +151,7 @@ void StatTracker::save(const std::string& filename) const {
 
     // Lock the stats so we get a consistent view.
     statsMutex.lock();
-    for(auto& pair : stats) {
+    for(auto& pair : totals()) {
         // For each stat, save the name and value
         file << pair.first << "\t" << pair.second << std::endl;
     }
@@ -89,3 +161,40 @@ void StatTracker::save(const std::string& filename) const {
     // Close the file up and sync it to disk
     file.close();
 }
+
+std::map<std::string, size_t> StatTracker::totals() const {
+    std::map<std::string, size_t> toReturn = stats;
+    for(auto& pair : counters) {
+        // Add each stat's shards in.
+        size_t& total = toReturn[pair.first];
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            total += pair.second[i].value.load(std::memory_order_relaxed);
+        }
+    }
+    for(auto& pair : histograms) {
+        // Add up each histogram's buckets over all its shards.
+        std::vector<size_t> buckets(NUM_BUCKETS, 0);
+        size_t sum = 0;
+        for(size_t i = 0; i < NUM_SHARDS; i++) {
+            for(size_t j = 0; j < NUM_BUCKETS; j++) {
+                buckets[j] += pair.second[i].buckets[j].load(
+                    std::memory_order_relaxed);
+            }
+            sum += pair.second[i].sum.load(std::memory_order_relaxed);
+        }
+        
+        for(size_t j = 0; j < NUM_BUCKETS; j++) {
+            if(buckets[j] == 0) {
+                continue;
+            }
+            // Name each bucket that has anything in it for its range. Bucket j
+            // holds values with highest bit j - 1.
+            size_t low = j == 0 ? 0 : (size_t) 1 << (j - 1);
+            size_t high = j == 0 ? 0 : low + (low - 1);
+            toReturn[pair.first + ":" + std::to_string(low) + "-" +
+                std::to_string(high)] += buckets[j];
+        }
+        toReturn[pair.first + ":sum"] += sum;
+    }
+    return toReturn;
+}
@@ -6,6 +6,11 @@
 #include <map>
 #include <string>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+
+#include "PerfCounters.hpp"
 
 /**
  * A MappingScheme can have an associated StatTracker, for tracking things like
@@ -13,9 +18,228 @@
  * integer stats (defined by string names), with atomic update methods, and can
  * generate a report at the end of the program's execution which can then be
  * merged together across runs.
+ *
+ * Stats that are updated often should be updated through a Counter, gotten
+ * once from counter(). Counters don't lock anything: each stat is split into
+ * per-thread shards on their own cache lines, which are only added up when the
+ * stats are read, copied, or saved.
+ *
+ * A StatTracker can also keep Histograms of values, such as context lengths or
+ * times, in buckets by powers of 2, sharded the same way. When saved, read, or
+ * copied, a histogram named "x" turns into a stat "x:lo-hi" for each bucket
+ * with anything in it, counting the values from lo to hi inclusive, and a stat
+ * "x:sum" holding the total of all the values. Those merge across runs like
+ * any other stat.
+ *
+ * Finally, a StatTracker can count hardware events for named Phases of work,
+ * when PerfCounters are enabled. A phase named "x" makes stats "x:calls",
+ * "x:cycles", "x:instructions", "x:llcMisses", "x:branchMisses", and
+ * "x:dtlbMisses". Phases can nest, and each one counts everything that
+ * happened inside it.
  */
 class StatTracker {
+protected:
+    /**
+     * One thread's share of a stat, alone on its cache line.
+     */
+    struct alignas(64) Shard {
+        std::atomic<size_t> value;
+    };
+    
+    /**
+     * How many buckets does a histogram have? One for 0, and one for each
+     * possible highest set bit.
+     */
+    static const size_t NUM_BUCKETS = 65;
+    
+    /**
+     * One thread's share of a histogram, starting on its own cache line.
+     */
+    struct alignas(64) HistogramShard {
+        std::atomic<size_t> buckets[NUM_BUCKETS];
+        std::atomic<size_t> sum;
+    };
+    
+    /**
+     * Get the shard the calling thread should use. Each thread gets the next
+     * shard the first time it asks.
+     */
+    static inline size_t getShard() {
+        static thread_local size_t shard = nextShard++ % NUM_SHARDS;
+        return shard;
+    }
+
 public:
+    /**
+     * How many shards is each stat split into? Threads beyond this many share
+     * shards.
+     */
+    static const size_t NUM_SHARDS = 64;
+
+    /**
+     * A handle to a stat, for updating it without looking it up by name or
+     * locking. Only valid while the StatTracker it came from exists.
+     */
+    class Counter {
+    public:
+        /**
+         * Make a Counter that isn't attached to any stat yet.
+         */
+        inline Counter(): shards(nullptr) {
+            // Nothing to do
+        }
+        
+        /**
+         * Atomically add an amount to the stat.
+         */
+        inline void add(size_t amount) const {
+            shards[getShard()].value.fetch_add(amount,
+                std::memory_order_relaxed);
+        }
+        
+        /**
+         * Is this Counter attached to a stat?
+         */
+        inline bool isAttached() const {
+            return shards != nullptr;
+        }
+        
+    private:
+        friend class StatTracker;
+        
+        inline Counter(Shard* shards): shards(shards) {
+            // Nothing to do
+        }
+        
+        // Points to the stat's NUM_SHARDS shards.
+        Shard* shards;
+    };
+    
+    /**
+     * A handle to a histogram, for adding values to it without looking it up
+     * by name or locking. Only valid while the StatTracker it came from exists.
+     */
+    class Histogram {
+    public:
+        /**
+         * Make a Histogram that isn't attached to any histogram yet.
+         */
+        inline Histogram(): shards(nullptr) {
+            // Nothing to do
+        }
+        
+        /**
+         * Atomically count a value in the histogram.
+         */
+        inline void add(size_t value) const {
+            HistogramShard& shard = shards[getShard()];
+            shard.buckets[getBucket(value)].fetch_add(1,
+                std::memory_order_relaxed);
+            shard.sum.fetch_add(value, std::memory_order_relaxed);
+        }
+        
+        /**
+         * Which bucket does a value go in? 0 goes in bucket 0, and everything
+         * else goes in 1 more than the index of its highest set bit.
+         */
+        static inline size_t getBucket(size_t value) {
+            return value == 0 ? 0 : 64 - __builtin_clzll(value);
+        }
+        
+    private:
+        friend class StatTracker;
+        
+        inline Histogram(HistogramShard* shards): shards(shards) {
+            // Nothing to do
+        }
+        
+        // Points to the histogram's NUM_SHARDS shards.
+        HistogramShard* shards;
+    };
+    
+    /**
+     * Adds the time from its construction to its destruction, in nanoseconds,
+     * to a Histogram.
+     */
+    class ScopedTimer {
+    public:
+        /**
+         * Start timing, for the given Histogram.
+         */
+        inline ScopedTimer(const Histogram& histogram): histogram(histogram),
+            start(std::chrono::steady_clock::now()) {
+            // Nothing to do
+        }
+        
+        /**
+         * Stop timing and record the time.
+         */
+        inline ~ScopedTimer() {
+            histogram.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        
+    private:
+        // What are we timing for? Histograms are just pointers, so we keep a
+        // copy.
+        Histogram histogram;
+        
+        // When did we start?
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    /**
+     * A handle to the stats for a named phase of work: how many times it ran,
+     * and how many of each PerfCounters event happened in it.
+     */
+    struct Phase {
+        // Counts times the phase ran with counters available.
+        Counter calls;
+        // Counts each event, in PerfCounters::EVENT_NAMES order.
+        Counter events[PerfCounters::NUM_EVENTS];
+    };
+    
+    /**
+     * Adds the hardware events from its construction to its destruction to a
+     * Phase, if PerfCounters are enabled. Otherwise does nothing.
+     */
+    class ScopedPhase {
+    public:
+        /**
+         * Start counting, for the given Phase, which may be unattached, and
+         * must outlive the ScopedPhase.
+         */
+        inline ScopedPhase(const Phase& phase): phase(phase), start(),
+            counting(PerfCounters::isEnabled() && phase.calls.isAttached() &&
+            PerfCounters::read(start)) {
+            // Nothing to do
+        }
+        
+        /**
+         * Stop counting and record the events.
+         */
+        inline ~ScopedPhase() {
+            uint64_t end[PerfCounters::NUM_EVENTS];
+            if(counting && PerfCounters::read(end)) {
+                phase.calls.add(1);
+                for(size_t i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+                    phase.events[i].add(end[i] - start[i]);
+                }
+            }
+        }
+        
+    private:
+        // What are we counting for?
+        const Phase& phase;
+        
+        // What did the counters say when we started? Comes before counting,
+        // which fills it in.
+        uint64_t start[PerfCounters::NUM_EVENTS];
+        
+        // Are we counting?
+        bool counting;
+    };
+
     // We need our own copy constructors and assignment operators because we
     // have a mutex.
     
@@ -25,12 +249,14 @@ public:
     StatTracker();
     
     /**
-     * Copy constructor needs to lock the source before copying.
+     * Copy constructor needs to lock the source before copying. The copy gets
+     * the source's totals, but none of its Counters.
      */
     StatTracker(const StatTracker& other);
     
     /**
-     * Assignment operator needs to lock both source and destination.
+     * Assignment operator needs to lock both source and destination. Counters
+     * already gotten from the destination stay valid.
      */
     StatTracker& operator=(const StatTracker& other);
     
@@ -41,7 +267,26 @@ public:
     StatTracker& operator+=(const StatTracker& other);
     
     /**
-     * Atomically add an amount to a stat.
+     * Get a Counter for the given stat, creating the stat if needed. Takes a
+     * lock, so get Counters once and keep them.
+     */
+    Counter counter(const std::string& stat);
+    
+    /**
+     * Get a Histogram with the given name, creating it if needed. Takes a lock,
+     * so get Histograms once and keep them.
+     */
+    Histogram histogram(const std::string& stat);
+    
+    /**
+     * Get a Phase with the given name, creating its stats if needed. Takes a
+     * lock, so get Phases once and keep them.
+     */
+    Phase phase(const std::string& name);
+    
+    /**
+     * Atomically add an amount to a stat. Has to look the stat up, so prefer a
+     * Counter for anything updated often.
      */
     void add(const std::string& stat, size_t amount);
     
@@ -57,15 +302,36 @@ public:
         
 private:
     /**
-     * Holds all the stat values by name.
+     * Add up the value of every stat. Must be called with the mutex held.
+     */
+    std::map<std::string, size_t> totals() const;
+
+    /**
+     * Holds stat values that didn't come from Counters, from copying or adding
+     * in other StatTrackers, by name.
      */
     std::map<std::string, size_t> stats;
     
     /**
-     * Control access to the stats container. Note that this is non-recursive!
+     * Holds the shards for each stat that has had a Counter made, by name.
+     */
+    std::map<std::string, std::unique_ptr<Shard[]>> counters;
+    
+    /**
+     * Holds the shards for each histogram, by name.
+     */
+    std::map<std::string, std::unique_ptr<HistogramShard[]>> histograms;
+    
+    /**
+     * Control access to the stats containers. Note that this is non-recursive!
      * Needs to be mutable so we can lock a const thing to read from it safely.
      */
     mutable std::mutex statsMutex;
+    
+    /**
+     * What shard should the next thread to use a Counter get?
+     */
+    static std::atomic<size_t> nextShard;
 };
 
 #endif
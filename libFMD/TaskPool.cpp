@@ -0,0 +1,228 @@
+#include "TaskPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+thread_local TaskPool* TaskPool::currentPool = nullptr;
+thread_local size_t TaskPool::currentWorker = 0;
+std::atomic<size_t> TaskPool::globalSize(0);
+
+TaskPool::TaskPool(size_t threads): deques(), queued(0), nextDeque(0),
+    sleepMutex(), wakeup(), stopping(false), workers() {
+
+    threads = std::max(threads, (size_t) 1);
+    for(size_t i = 0; i < threads; i++) {
+        deques.emplace_back(new TaskDeque());
+    }
+    for(size_t i = 0; i < threads; i++) {
+        workers.push_back(std::thread(&TaskPool::work, this, i));
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+TaskPool& TaskPool::global() {
+    // Made the first time through, in a thread safe way.
+    static TaskPool pool(globalSize.load() != 0 ? globalSize.load() :
+        std::max(std::thread::hardware_concurrency(), 1u));
+    return pool;
+}
+
+void TaskPool::setGlobalSize(size_t threads) {
+    globalSize.store(threads);
+}
+
+bool TaskPool::pin(const std::vector<size_t>& cpus) {
+    if(cpus.empty()) {
+        return true;
+    }
+#ifdef __linux__
+    bool pinned = true;
+    for(size_t i = 0; i < workers.size(); i++) {
+        size_t cpu = cpus[i % cpus.size()];
+        if(cpu >= CPU_SETSIZE) {
+            pinned = false;
+            continue;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        pinned &= pthread_setaffinity_np(workers[i].native_handle(),
+            sizeof(set), &set) == 0;
+    }
+    return pinned;
+#else
+    // We don't know how to do it here.
+    return false;
+#endif
+}
+
+void TaskPool::submit(std::function<void()>&& task) {
+    // Workers keep their own tasks, so related work stays on one CPU until
+    // someone steals it.
+    size_t target = currentPool == this ? currentWorker :
+        nextDeque.fetch_add(1, std::memory_order_relaxed) % deques.size();
+
+    {
+        std::lock_guard<std::mutex> lock(deques[target]->mutex);
+        deques[target]->tasks.push_back(std::move(task));
+    }
+
+    {
+        // Count it under the sleep lock, so no worker can decide to sleep
+        // between the count and the notify.
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    wakeup.notify_one();
+}
+
+bool TaskPool::runOne() {
+    if(queued.load() == 0) {
+        return false;
+    }
+
+    std::function<void()> task;
+
+    // Look at our own deque first, and take the newest task there. Then steal
+    // the oldest task from everyone else.
+    size_t start = currentPool == this ? currentWorker : 0;
+    for(size_t i = 0; i < deques.size() && !task; i++) {
+        TaskDeque& deque = *deques[(start + i) % deques.size()];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if(deque.tasks.empty()) {
+            continue;
+        }
+        if(i == 0 && currentPool == this) {
+            task = std::move(deque.tasks.back());
+            deque.tasks.pop_back();
+        } else {
+            task = std::move(deque.tasks.front());
+            deque.tasks.pop_front();
+        }
+    }
+
+    if(!task) {
+        // Someone else got there first.
+        return false;
+    }
+
+    queued--;
+    task();
+    return true;
+}
+
+void TaskPool::work(size_t worker) {
+    currentPool = this;
+    currentWorker = worker;
+
+    while(true) {
+        if(runOne()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeup.wait(lock, [&]() {
+            return stopping || queued.load() != 0;
+        });
+        if(stopping) {
+            return;
+        }
+    }
+}
+
+TaskGroup::TaskGroup(TaskPool& pool): pool(pool), pending(0), mutex(),
+    finished(), error() {
+
+    // Nothing to do!
+}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    pending++;
+    pool.submit([this, task]() {
+        try {
+            task();
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!error) {
+                error = std::current_exception();
+            }
+        }
+
+        // Say we're done under the lock, so the group can't go away while we
+        // are still ringing.
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--pending == 0) {
+            finished.notify_all();
+        }
+    });
+}
+
+void TaskGroup::join() {
+    wait();
+
+    std::exception_ptr thrown;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(thrown, error);
+    }
+    if(thrown) {
+        std::rethrow_exception(thrown);
+    }
+}
+
+void TaskGroup::wait() {
+    while(pending.load() != 0) {
+        // Help out instead of waiting, if there's anything to do.
+        if(pool.runOne()) {
+            continue;
+        }
+
+        // Otherwise sleep until one of our tasks finishes. Wake up now and
+        // then anyway, in case our tasks queued tasks we could be helping
+        // with.
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+            return pending.load() == 0;
+        });
+    }
+
+    // Wait for the last task to let go of the lock.
+    std::lock_guard<std::mutex> lock(mutex);
+}
+
+void parallelFor(size_t tasks, const std::function<void(size_t)>& function) {
+    if(tasks == 1) {
+        // Don't bother with the pool.
+        function(0);
+        return;
+    }
+
+    TaskGroup group;
+    for(size_t i = 0; i < tasks; i++) {
+        group.run([&function, i]() {
+            function(i);
+        });
+    }
+    group.join();
+}
@@ -0,0 +1,210 @@
+#ifndef TASKPOOL_HPP
+#define TASKPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+/**
+ * A fixed set of worker threads that run tasks for everything in the process,
+ * so parallel stages share the machine instead of each starting threads of its
+ * own. Each worker keeps its own deque of tasks: it runs the newest task it
+ * queued itself first, and when it runs out it steals the oldest task from
+ * another worker.
+ *
+ * Tasks are submitted and waited on through a TaskGroup. A thread waiting on a
+ * group runs queued tasks while it waits, so tasks can start groups of their
+ * own without using up the workers.
+ *
+ * Tasks that block waiting on something other than a TaskGroup (like reading
+ * from a ConcurrentQueue that another task fills) can tie up workers for good,
+ * so things like that should keep threads of their own.
+ */
+class TaskPool {
+
+public:
+    /**
+     * Make a new TaskPool with the given number of worker threads (at least
+     * 1).
+     */
+    TaskPool(size_t threads);
+
+    /**
+     * Stop all the workers. Tasks still queued are not run.
+     */
+    ~TaskPool();
+
+    /**
+     * Get the pool shared by the whole process. It is made the first time this
+     * is called, with as many workers as setGlobalSize() asked for, or as many
+     * as there are CPUs otherwise.
+     */
+    static TaskPool& global();
+
+    /**
+     * Set the number of workers for the global pool. Only has an effect before
+     * the global pool is first used.
+     */
+    static void setGlobalSize(size_t threads);
+
+    /**
+     * Get the number of worker threads.
+     */
+    inline size_t getSize() const {
+        return workers.size();
+    }
+
+    /**
+     * Pin the workers to the given CPUs, worker i to CPU i modulo the number
+     * of CPUs. Returns true if it worked for all of them, and false otherwise.
+     */
+    bool pin(const std::vector<size_t>& cpus);
+
+protected:
+    friend class TaskGroup;
+
+    /**
+     * Queue up a task. A worker queues it for itself; anything else hands it
+     * to the workers in turn.
+     */
+    void submit(std::function<void()>&& task);
+
+    /**
+     * Run one queued task on the calling thread, if there is one. Returns true
+     * if a task was run, and false if there was nothing to do.
+     */
+    bool runOne();
+
+    /**
+     * Loop running tasks on the worker with the given number until stopped.
+     */
+    void work(size_t worker);
+
+    /**
+     * Holds the tasks queued by one worker.
+     */
+    struct TaskDeque {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Holds a deque of tasks for each worker.
+    std::vector<std::unique_ptr<TaskDeque>> deques;
+
+    // How many tasks are queued in all the deques?
+    std::atomic<size_t> queued;
+
+    // Which deque gets the next task from outside the pool?
+    std::atomic<size_t> nextDeque;
+
+    // Protects sleeping and waking workers.
+    std::mutex sleepMutex;
+
+    // Rung when there are tasks to do or the workers should stop.
+    std::condition_variable wakeup;
+
+    // Should the workers stop?
+    bool stopping;
+
+    // Holds the worker threads. Comes last so everything is ready when they
+    // start.
+    std::vector<std::thread> workers;
+
+    // Which pool is the current thread a worker for, if any?
+    static thread_local TaskPool* currentPool;
+
+    // And which worker is it?
+    static thread_local size_t currentWorker;
+
+    // How many workers should the global pool have? 0 means one per CPU.
+    static std::atomic<size_t> globalSize;
+
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    TaskPool(const TaskPool& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    TaskPool& operator=(const TaskPool& other) = delete;
+};
+
+/**
+ * A set of tasks to run on a TaskPool and wait for together. If any of them
+ * throws, join() throws the first exception thrown once they are all done.
+ */
+class TaskGroup {
+
+public:
+    /**
+     * Make a new TaskGroup to run tasks on the given pool.
+     */
+    TaskGroup(TaskPool& pool = TaskPool::global());
+
+    /**
+     * Wait for any tasks still running. Exceptions they throw are dropped;
+     * call join() to get them.
+     */
+    ~TaskGroup();
+
+    /**
+     * Queue up a task to run on the pool.
+     */
+    void run(std::function<void()> task);
+
+    /**
+     * Wait for all the tasks run so far to finish, running queued tasks on the
+     * calling thread in the meantime. Rethrows the first exception any of them
+     * threw.
+     */
+    void join();
+
+protected:
+    /**
+     * Wait for the tasks without throwing.
+     */
+    void wait();
+
+    // What pool do we run on?
+    TaskPool& pool;
+
+    // How many of our tasks haven't finished?
+    std::atomic<size_t> pending;
+
+    // Protects error and waiting for tasks.
+    std::mutex mutex;
+
+    // Rung when a task finishes.
+    std::condition_variable finished;
+
+    // Holds the first exception thrown by a task, if any.
+    std::exception_ptr error;
+
+private:
+    /**
+     * No copy constructor is allowed.
+     */
+    TaskGroup(const TaskGroup& other) = delete;
+
+    /**
+     * No assignment operator either.
+     */
+    TaskGroup& operator=(const TaskGroup& other) = delete;
+};
+
+/**
+ * Run the given function on the given number of tasks in the global TaskPool,
+ * passing each its number, and wait for them all. Rethrows the first exception
+ * thrown by any of them. With only one task, just calls the function.
+ */
+void parallelFor(size_t tasks, const std::function<void(size_t)>& function);
+
+#endif
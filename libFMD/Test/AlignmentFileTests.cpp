@@ -0,0 +1,96 @@
+// Test saved binary alignments.
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "../AlignmentFile.hpp"
+#include "../util.hpp"
+
+#include "AlignmentFileTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( AlignmentFileTests );
+
+void AlignmentFileTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void AlignmentFileTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure we get back the reads we saved.
+ */
+void AlignmentFileTests::testRoundTrip() {
+    // Make a 10-base read with bases 0-3 mapped forward to 20-23 on the first
+    // reference and bases 6-8 mapped backward to 50-48 on the second, and an
+    // unmapped read.
+    std::vector<AlignmentFile::Segment> segments = {
+        {0, 0, 20, 0, 4},
+        {6, 1, 50, 1, 3}
+    };
+    
+    std::string data = AlignmentFile::makeHeader({"ref", "chr2"});
+    AlignmentFile::appendRead(data, "read1", 10, segments);
+    AlignmentFile::appendRead(data, "unmapped", 5, {});
+    
+    std::ofstream out(tempDir + "/alignment.bin", std::ios::binary);
+    out << data;
+    out.close();
+    
+    AlignmentFile alignment(tempDir + "/alignment.bin");
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, alignment.getReferenceNames().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("chr2"),
+        alignment.getReferenceNames()[1]);
+    
+    std::string name;
+    size_t length;
+    std::vector<AlignmentFile::Segment> found;
+    
+    CPPUNIT_ASSERT(alignment.next(name, length, found));
+    CPPUNIT_ASSERT_EQUAL(std::string("read1"), name);
+    CPPUNIT_ASSERT_EQUAL((size_t) 10, length);
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, found.size());
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 20, found[0].referenceOffset);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 6, found[1].queryStart);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, found[1].reference);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, found[1].backwards);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 3, found[1].length);
+    
+    CPPUNIT_ASSERT(alignment.next(name, length, found));
+    CPPUNIT_ASSERT_EQUAL(std::string("unmapped"), name);
+    CPPUNIT_ASSERT_EQUAL((size_t) 5, length);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, found.size());
+    
+    CPPUNIT_ASSERT(!alignment.next(name, length, found));
+}
+
+/**
+ * Make sure files that aren't alignments, or are cut short, are rejected.
+ */
+void AlignmentFileTests::testBadFile() {
+    std::ofstream garbage(tempDir + "/garbage.bin");
+    garbage << "This is not an alignment.";
+    garbage.close();
+    CPPUNIT_ASSERT_THROW(AlignmentFile(tempDir + "/garbage.bin"),
+        std::runtime_error);
+    
+    std::string data = AlignmentFile::makeHeader({"ref"});
+    AlignmentFile::appendRead(data, "read1", 10, {{0, 0, 20, 0, 4}});
+    // Cut off the end of the segment.
+    data.resize(data.size() - 8);
+    
+    std::ofstream out(tempDir + "/alignment.bin", std::ios::binary);
+    out << data;
+    out.close();
+    
+    AlignmentFile alignment(tempDir + "/alignment.bin");
+    std::string name;
+    size_t length;
+    std::vector<AlignmentFile::Segment> found;
+    CPPUNIT_ASSERT_THROW(alignment.next(name, length, found),
+        std::runtime_error);
+}
@@ -0,0 +1,29 @@
+#ifndef ALIGNMENTFILETESTS_HPP
+#define ALIGNMENTFILETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for AlignmentFile.
+ */
+class AlignmentFileTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(AlignmentFileTests);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to save alignments in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRoundTrip();
+    void testBadFile();
+};
+
+#endif
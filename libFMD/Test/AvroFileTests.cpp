@@ -0,0 +1,218 @@
+// Test Avro container files.
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "../AvroFile.hpp"
+#include "../AlignmentFile.hpp"
+#include "../GraphFile.hpp"
+#include "../util.hpp"
+
+#include "AvroFileTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( AvroFileTests );
+
+void AvroFileTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void AvroFileTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure values are encoded the way the Avro spec says, and read back.
+ */
+void AvroFileTests::testEncoding() {
+    std::string data;
+    AvroFile::appendLong(data, 0);
+    AvroFile::appendLong(data, -1);
+    AvroFile::appendLong(data, 1);
+    AvroFile::appendLong(data, 64);
+    CPPUNIT_ASSERT_EQUAL(std::string("\x00\x01\x02\x80\x01", 5), data);
+    
+    AvroFile::appendLong(data, -5000000000LL);
+    AvroFile::appendBoolean(data, true);
+    AvroFile::appendString(data, "foo");
+    
+    size_t position = 0;
+    CPPUNIT_ASSERT_EQUAL((int64_t) 0, AvroFile::readLong(data, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) -1, AvroFile::readLong(data, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 1, AvroFile::readLong(data, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 64, AvroFile::readLong(data, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) -5000000000LL,
+        AvroFile::readLong(data, position));
+    CPPUNIT_ASSERT(AvroFile::readBoolean(data, position));
+    CPPUNIT_ASSERT_EQUAL(std::string("foo"),
+        AvroFile::readString(data, position));
+    CPPUNIT_ASSERT_EQUAL(data.size(), position);
+    
+    // Running off the end is an error.
+    CPPUNIT_ASSERT_THROW(AvroFile::readLong(data, position),
+        std::runtime_error);
+}
+
+/**
+ * Make sure we get back the blocks we saved, with and without compression.
+ */
+void AvroFileTests::testRoundTrip() {
+    for(bool deflate : {true, false}) {
+        std::string sync = AvroFile::makeSync();
+        CPPUNIT_ASSERT_EQUAL(AvroFile::SYNC_SIZE, sync.size());
+        
+        // Save a block of 3 longs and a block of 1000 repetitive strings.
+        std::string first;
+        AvroFile::appendLong(first, 1);
+        AvroFile::appendLong(first, 2);
+        AvroFile::appendLong(first, 3);
+        std::string second;
+        for(size_t i = 0; i < 1000; i++) {
+            AvroFile::appendString(second, "GATTACA");
+        }
+        
+        std::string data = AvroFile::makeHeader("\"long\"", sync, deflate);
+        AvroFile::appendBlock(data, 3, first, sync, deflate);
+        AvroFile::appendBlock(data, 1000, second, sync, deflate);
+        // Empty blocks are left out.
+        AvroFile::appendBlock(data, 0, "", sync, deflate);
+        
+        std::ofstream out(tempDir + "/records.avro", std::ios::binary);
+        out << data;
+        out.close();
+        
+        AvroFile file(tempDir + "/records.avro");
+        CPPUNIT_ASSERT_EQUAL(std::string("\"long\""), file.getSchema());
+        CPPUNIT_ASSERT_EQUAL(std::string(deflate ? "deflate" : "null"),
+            file.getCodec());
+        
+        std::string records;
+        size_t count;
+        CPPUNIT_ASSERT(file.nextBlock(records, count));
+        CPPUNIT_ASSERT_EQUAL((size_t) 3, count);
+        CPPUNIT_ASSERT(first == records);
+        CPPUNIT_ASSERT(file.nextBlock(records, count));
+        CPPUNIT_ASSERT_EQUAL((size_t) 1000, count);
+        CPPUNIT_ASSERT(second == records);
+        CPPUNIT_ASSERT(!file.nextBlock(records, count));
+    }
+}
+
+/**
+ * Make sure files that aren't Avro, or are cut short, are rejected.
+ */
+void AvroFileTests::testBadFile() {
+    std::ofstream garbage(tempDir + "/garbage.avro");
+    garbage << "This is not Avro.";
+    garbage.close();
+    CPPUNIT_ASSERT_THROW(AvroFile(tempDir + "/garbage.avro"),
+        std::runtime_error);
+    
+    std::string sync = AvroFile::makeSync();
+    std::string records;
+    AvroFile::appendString(records, "something");
+    std::string data = AvroFile::makeHeader("\"string\"", sync);
+    AvroFile::appendBlock(data, 1, records, sync);
+    // Cut off the sync marker.
+    data.resize(data.size() - 4);
+    
+    std::ofstream out(tempDir + "/records.avro", std::ios::binary);
+    out << data;
+    out.close();
+    
+    AvroFile file(tempDir + "/records.avro");
+    size_t count;
+    CPPUNIT_ASSERT_THROW(file.nextBlock(records, count), std::runtime_error);
+}
+
+/**
+ * Make sure read alignment records have what we put in them.
+ */
+void AvroFileTests::testAlignmentRecords() {
+    std::string records;
+    AlignmentFile::appendAvroRead(records, "read1", 10,
+        {{0, 0, 20, 0, 4}, {6, 1, 50, 1, 3}}, {"ref", "chr2"});
+    AlignmentFile::appendAvroRead(records, "unmapped", 5, {}, {"ref", "chr2"});
+    
+    size_t position = 0;
+    CPPUNIT_ASSERT_EQUAL(std::string("read1"),
+        AvroFile::readString(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 10, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 2, AvroFile::readLong(records, position));
+    
+    // Look at the first segment.
+    CPPUNIT_ASSERT_EQUAL((int64_t) 0, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT_EQUAL(std::string("ref"),
+        AvroFile::readString(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 20, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT(!AvroFile::readBoolean(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 4, AvroFile::readLong(records, position));
+    
+    // And the second.
+    CPPUNIT_ASSERT_EQUAL((int64_t) 6, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT_EQUAL(std::string("chr2"),
+        AvroFile::readString(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 50, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT(AvroFile::readBoolean(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 3, AvroFile::readLong(records, position));
+    
+    // Then the array ends.
+    CPPUNIT_ASSERT_EQUAL((int64_t) 0, AvroFile::readLong(records, position));
+    
+    // The unmapped read just has an empty array.
+    CPPUNIT_ASSERT_EQUAL(std::string("unmapped"),
+        AvroFile::readString(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 5, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT_EQUAL((int64_t) 0, AvroFile::readLong(records, position));
+    CPPUNIT_ASSERT_EQUAL(records.size(), position);
+}
+
+/**
+ * Make sure graph segments saved as Avro come back in order.
+ */
+void AvroFileTests::testGraphRecords() {
+    // Use the same graph as the GraphFile tests, but name the threads 5 and 7.
+    std::vector<GraphFile::Thread> threads = {{5, 10, 0, 3}, {7, 10, 3, 3}};
+    std::vector<GraphFile::Segment> segments = {
+        {0, 1, 2, GraphFile::NONE, 0},
+        {0, 3, 4, 0, 0},
+        {0, 7, 4, GraphFile::NONE, 0},
+        {1, 1, 4, GraphFile::NONE, 0},
+        {1, 5, 4, 0, 1},
+        {1, 9, 2, GraphFile::NONE, 0}
+    };
+    
+    GraphFile::saveAvro(tempDir + "/graph.avro", threads, segments);
+    AvroFile file(tempDir + "/graph.avro");
+    CPPUNIT_ASSERT(file.getSchema() == GraphFile::AVRO_SCHEMA);
+    
+    std::string records;
+    size_t count;
+    CPPUNIT_ASSERT(file.nextBlock(records, count));
+    CPPUNIT_ASSERT_EQUAL((size_t) 6, count);
+    
+    size_t position = 0;
+    for(size_t i = 0; i < segments.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL((int64_t) threads[segments[i].thread].name,
+            AvroFile::readLong(records, position));
+        CPPUNIT_ASSERT_EQUAL((int64_t) segments[i].start,
+            AvroFile::readLong(records, position));
+        CPPUNIT_ASSERT_EQUAL((int64_t) segments[i].length,
+            AvroFile::readLong(records, position));
+        
+        // Unaligned segments take the null branch for their block.
+        bool aligned = segments[i].block != GraphFile::NONE;
+        CPPUNIT_ASSERT_EQUAL((int64_t) aligned,
+            AvroFile::readLong(records, position));
+        if(aligned) {
+            CPPUNIT_ASSERT_EQUAL((int64_t) segments[i].block,
+                AvroFile::readLong(records, position));
+        }
+        CPPUNIT_ASSERT_EQUAL((bool) segments[i].orientation,
+            AvroFile::readBoolean(records, position));
+    }
+    CPPUNIT_ASSERT_EQUAL(records.size(), position);
+    CPPUNIT_ASSERT(!file.nextBlock(records, count));
+}
@@ -0,0 +1,35 @@
+#ifndef AVROFILETESTS_HPP
+#define AVROFILETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for AvroFile, and the Avro records of AlignmentFile and GraphFile.
+ */
+class AvroFileTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(AvroFileTests);
+    CPPUNIT_TEST(testEncoding);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST(testAlignmentRecords);
+    CPPUNIT_TEST(testGraphRecords);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to save files in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testEncoding();
+    void testRoundTrip();
+    void testBadFile();
+    void testAlignmentRecords();
+    void testGraphRecords();
+};
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <ReadTable.h>
 #include <SuffixArray.h>
+#include <RLBWT.h>
+#include <Util.h>
 
 #include "BWTTests.hpp"
 
@@ -44,3 +46,61 @@ void BWTTests::testBWT() {
     delete suffixArray;
 
 }
+
+/**
+ * Make sure counting occurrences at both ends of a range agrees with counting
+ * at each end separately, on a BWT of repetitive text with long runs.
+ */
+void BWTTests::testOccRange() {
+    
+    // Make copies of a repeat with a few differences, both ways around.
+    std::string repeat = "GATTACACATTAGGCCATGACCTAGTTAGCAATCGGA";
+    ReadTable readTable;
+    for(size_t i = 0; i < 8; i++) {
+        std::string text;
+        for(size_t j = 0; j < 20; j++) {
+            text += repeat;
+        }
+        text[i * repeat.size() + 5] = 'T';
+        
+        SeqItem forward;
+        forward.id = "text" + std::to_string(i) + "F";
+        forward.seq = text;
+        readTable.addRead(forward);
+        
+        SeqItem reverse;
+        reverse.id = "text" + std::to_string(i) + "R";
+        reverse.seq = reverseComplement(text);
+        readTable.addRead(reverse);
+    }
+    
+    SuffixArray suffixArray(&readTable, 1);
+    RLBWT bwt(&suffixArray, &readTable);
+    
+    size_t length = bwt.getBWLen();
+    // It should be long enough to have several markers.
+    CPPUNIT_ASSERT(length > 4 * RLBWT::DEFAULT_SAMPLE_RATE_SMALL);
+    
+    for(size_t lo = 0; lo < length; lo++) {
+        AlphaCount64 expectedLo = bwt.getFullOcc(lo);
+        // Try ends in the same run, near by, and far enough off to restart.
+        for(size_t hi = lo; hi < length &&
+            hi <= lo + 3 * RLBWT::DEFAULT_SAMPLE_RATE_SMALL; hi++) {
+            
+            AlphaCount64 occLo;
+            AlphaCount64 occHi;
+            bwt.getOccRange(lo, hi, occLo, occHi);
+            CPPUNIT_ASSERT(occLo == expectedLo);
+            CPPUNIT_ASSERT(occHi == bwt.getFullOcc(hi));
+        }
+    }
+    
+    // Ranges starting at the very beginning count nothing before it.
+    for(size_t hi = 0; hi < length; hi++) {
+        AlphaCount64 occLo;
+        AlphaCount64 occHi;
+        bwt.getOccRange((size_t) -1, hi, occLo, occHi);
+        CPPUNIT_ASSERT(occLo == AlphaCount64());
+        CPPUNIT_ASSERT(occHi == bwt.getFullOcc(hi));
+    }
+}
@@ -9,6 +9,7 @@
 class BWTTests : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(BWTTests);
     CPPUNIT_TEST(testBWT);
+    CPPUNIT_TEST(testOccRange);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -19,6 +20,7 @@ public:
     void tearDown();
 
     void testBWT();
+    void testOccRange();
 };
 
 #endif
@@ -0,0 +1,99 @@
+// Test the bounded contig cache.
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "../ContigCache.hpp"
+
+#include "ContigCacheTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( ContigCacheTests );
+
+void ContigCacheTests::setUp() {
+}
+
+
+void ContigCacheTests::tearDown() {
+}
+
+/**
+ * Make a fake 100-base contig for the given contig number.
+ */
+static std::string makeContig(size_t contig) {
+    return std::string(100, "ACGT"[contig % 4]);
+}
+
+/**
+ * Make sure the cache stays within its budget, and that evicted contigs stay
+ * valid for whoever still has them.
+ */
+void ContigCacheTests::testEviction() {
+    // Room for 3 contigs in a single shard.
+    ContigCache cache(300, 1);
+    
+    // Count how many times we had to make a contig.
+    size_t loads = 0;
+    auto load = [&](size_t contig) {
+        loads++;
+        return makeContig(contig);
+    };
+    
+    // Fill it up
+    auto first = cache.get(0, load);
+    cache.get(1, load);
+    cache.get(2, load);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, loads);
+    CPPUNIT_ASSERT_EQUAL((size_t) 300, cache.getCachedBytes());
+    
+    // Use 1 and 0 again so 2 is the oldest, and make sure they don't need
+    // loads.
+    cache.get(1, load);
+    CPPUNIT_ASSERT(*cache.get(0, load) == makeContig(0));
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, loads);
+    
+    // Adding another should throw out 2 but not 0 or 1.
+    cache.get(3, load);
+    CPPUNIT_ASSERT_EQUAL((size_t) 300, cache.getCachedBytes());
+    cache.get(0, load);
+    cache.get(1, load);
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, loads);
+    cache.get(2, load);
+    CPPUNIT_ASSERT_EQUAL((size_t) 5, loads);
+    
+    // Shrinking the budget keeps only the most recent contig.
+    cache.setByteBudget(0);
+    CPPUNIT_ASSERT_EQUAL((size_t) 100, cache.getCachedBytes());
+    
+    // But what we held onto is still good.
+    CPPUNIT_ASSERT(*first == makeContig(0));
+}
+
+/**
+ * Make sure lots of threads can use the cache at once.
+ */
+void ContigCacheTests::testThreads() {
+    // Room for 8 contigs over 4 shards
+    ContigCache cache(800, 4);
+    
+    std::atomic<size_t> errors(0);
+    std::vector<std::thread> threads;
+    for(size_t thread = 0; thread < 8; thread++) {
+        threads.emplace_back([&, thread]() {
+            for(size_t i = 0; i < 2000; i++) {
+                // Walk over more contigs than fit, revisiting each a few times.
+                size_t contig = (i / 3 + thread) % 20;
+                if(*cache.get(contig, makeContig) != makeContig(contig)) {
+                    errors++;
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, errors.load());
+    CPPUNIT_ASSERT(cache.getCachedBytes() <= 800);
+}
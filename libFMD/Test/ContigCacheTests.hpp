@@ -0,0 +1,23 @@
+#ifndef CONTIGCACHETESTS_HPP
+#define CONTIGCACHETESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for ContigCache.
+ */
+class ContigCacheTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ContigCacheTests);
+    CPPUNIT_TEST(testEviction);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testEviction();
+    void testThreads();
+};
+
+#endif
@@ -58,7 +58,7 @@ void CreditStrategyTests::setUp() {
         // Set every other bit
         ranges->addBit(i);
         
-        Log::debug() << index->locate(i) << " should own " << i/2 << std::endl;
+        LOG_DEBUG(index->locate(i) << " should own " << i/2 << std::endl);
         
         if(i % 3 == 0) {
             // And record it owned by the appropriate base. Only do this for
@@ -186,4 +186,34 @@ void CreditStrategyTests::testCreditOverMismatches() {
     
 }
 
+/**
+ * Make sure credit gets applied in every unmapped run of a query.
+ */
+void CreditStrategyTests::testCreditInSeveralRuns() {
 
+    // Grab all of the duplicated contig.
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    // Make a vector of mappings saying everything is unmapped.
+    std::vector<Mapping> mappings(query.size(), Mapping());
+    
+    // Map the first base, a base in the middle, and the last base to their
+    // places on contig 0, forward strand.
+    for(size_t i : {(size_t) 0, (size_t) 17, query.size() - 1}) {
+        mappings[i] = Mapping(TextPosition(0, i));
+    }
+    
+    // Apply credit and update the mappings
+    credit->applyCredit(query, mappings);
+    
+    for(size_t i = 0; i < mappings.size(); i++) {
+        // Make sure every base is mapped
+        CPPUNIT_ASSERT(mappings[i].isMapped());
+        
+        // Make sure it is mapped to the right place on text 0 (contig 0 strand
+        // 0).
+        auto mappedTo = mappings[i].getLocation();
+        CPPUNIT_ASSERT_EQUAL((size_t) 0, mappedTo.getText());
+        CPPUNIT_ASSERT_EQUAL(i, mappedTo.getOffset());
+    }
+}
@@ -11,6 +11,7 @@ class CreditStrategyTests : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(CreditStrategyTests);
     CPPUNIT_TEST(testCredit);
     CPPUNIT_TEST(testCreditOverMismatches);
+    CPPUNIT_TEST(testCreditInSeveralRuns);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -42,6 +43,7 @@ public:
 
     void testCredit();
     void testCreditOverMismatches();
+    void testCreditInSeveralRuns();
 };
 
 #endif
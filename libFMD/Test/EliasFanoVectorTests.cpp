@@ -0,0 +1,82 @@
+// Test Elias-Fano encoded sequences.
+
+#include <random>
+#include <algorithm>
+
+#include "../EliasFanoVector.hpp"
+
+#include "EliasFanoVectorTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( EliasFanoVectorTests );
+
+void EliasFanoVectorTests::setUp() {
+}
+
+
+void EliasFanoVectorTests::tearDown() {
+}
+
+/**
+ * Make a sorted random sequence of the given length, with values spread over
+ * about the given range, including some repeats.
+ */
+static std::vector<size_t> makeValues(size_t length, size_t range) {
+    std::mt19937 generator(length + range);
+    std::vector<size_t> values;
+    for(size_t i = 0; i < length; i++) {
+        values.push_back(generator() % range);
+        if(i % 7 == 0 && !values.empty()) {
+            // Throw in a duplicate
+            values.push_back(values.back());
+        }
+    }
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+/**
+ * Make sure we get back what we put in.
+ */
+void EliasFanoVectorTests::testAccess() {
+    for(size_t length : {0, 1, 10, 300, 2000}) {
+        for(size_t range : {1, 100, 100000, 1000000000}) {
+            std::vector<size_t> values = makeValues(length, range);
+            EliasFanoVector encoded(values);
+            CPPUNIT_ASSERT_EQUAL(values.size(), encoded.size());
+            for(size_t i = 0; i < values.size(); i++) {
+                CPPUNIT_ASSERT_EQUAL(values[i], encoded[i]);
+            }
+        }
+    }
+    
+    // Values that go down should be rejected
+    CPPUNIT_ASSERT_THROW(EliasFanoVector(std::vector<size_t>{5, 3}),
+        std::runtime_error);
+}
+
+/**
+ * Make sure counting values less than or equal to things works.
+ */
+void EliasFanoVectorTests::testRank() {
+    // An empty vector has nothing before anything.
+    EliasFanoVector empty;
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, empty.rank(0));
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, empty.rank(100));
+    
+    for(size_t length : {1, 10, 300, 2000}) {
+        for(size_t range : {1, 100, 100000}) {
+            std::vector<size_t> values = makeValues(length, range);
+            EliasFanoVector encoded(values);
+            
+            for(size_t query = 0; query < range + 5; query +=
+                std::max((size_t) 1, range / 500)) {
+                
+                // Count the right answer the slow way.
+                size_t expected = std::upper_bound(values.begin(),
+                    values.end(), query) - values.begin();
+                CPPUNIT_ASSERT_EQUAL(expected, encoded.rank(query));
+            }
+        }
+    }
+}
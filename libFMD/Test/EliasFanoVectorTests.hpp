@@ -0,0 +1,23 @@
+#ifndef ELIASFANOVECTORTESTS_HPP
+#define ELIASFANOVECTORTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for EliasFanoVector.
+ */
+class EliasFanoVectorTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(EliasFanoVectorTests);
+    CPPUNIT_TEST(testAccess);
+    CPPUNIT_TEST(testRank);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testAccess();
+    void testRank();
+};
+
+#endif
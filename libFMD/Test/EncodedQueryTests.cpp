@@ -0,0 +1,74 @@
+// Test the 2-bit encoded query.
+
+#include "../EncodedQuery.hpp"
+#include "../util.hpp"
+
+#include "EncodedQueryTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( EncodedQueryTests );
+
+void EncodedQueryTests::setUp() {
+}
+
+
+void EncodedQueryTests::tearDown() {
+}
+
+/**
+ * Make sure bases of either case get the right codes, and everything else gets
+ * marked as not a base.
+ */
+void EncodedQueryTests::testEncode() {
+    EncodedQuery query("ACGTacgtN-");
+    EncodedQuery::View view = query.forward();
+
+    CPPUNIT_ASSERT_EQUAL((size_t) 10, view.size());
+    for(size_t i = 0; i < 8; i++) {
+        CPPUNIT_ASSERT_EQUAL((int) (i % 4), (int) view[i]);
+    }
+    CPPUNIT_ASSERT_EQUAL((int) EncodedQuery::NOT_A_BASE, (int) view[8]);
+    CPPUNIT_ASSERT_EQUAL((int) EncodedQuery::NOT_A_BASE, (int) view[9]);
+
+    CPPUNIT_ASSERT_EQUAL(std::string("ACGTACGTNN"), view.toString());
+}
+
+/**
+ * Make sure the reverse strand reads the same as a reverse complemented copy.
+ */
+void EncodedQueryTests::testReverseComplement() {
+    std::string sequence = "GATTACANCCGGTA";
+    EncodedQuery query(sequence);
+
+    CPPUNIT_ASSERT_EQUAL(reverseComplement(sequence),
+        query.reverseComplement().toString());
+
+    // Flipping twice gets us back where we started.
+    CPPUNIT_ASSERT_EQUAL(sequence,
+        query.reverseComplement().reverseComplement().toString());
+}
+
+/**
+ * Make sure views of stretches of either strand read the same as substring
+ * copies.
+ */
+void EncodedQueryTests::testSubstr() {
+    std::string sequence = "GATTACANCCGGTA";
+    std::string reverse = reverseComplement(sequence);
+    EncodedQuery query(sequence);
+
+    for(size_t start = 0; start < sequence.size(); start++) {
+        for(size_t length = 0; start + length <= sequence.size(); length++) {
+            CPPUNIT_ASSERT_EQUAL(sequence.substr(start, length),
+                query.forward().substr(start, length).toString());
+            CPPUNIT_ASSERT_EQUAL(reverse.substr(start, length),
+                query.reverseComplement().substr(start, length).toString());
+
+            // And flipping a stretch of the forward strand gets the matching
+            // stretch of the reverse strand.
+            CPPUNIT_ASSERT_EQUAL(reverseComplement(sequence.substr(start,
+                length)), query.forward().substr(start,
+                length).reverseComplement().toString());
+        }
+    }
+}
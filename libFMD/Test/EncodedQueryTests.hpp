@@ -0,0 +1,25 @@
+#ifndef ENCODEDQUERYTESTS_HPP
+#define ENCODEDQUERYTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for EncodedQuery.
+ */
+class EncodedQueryTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(EncodedQueryTests);
+    CPPUNIT_TEST(testEncode);
+    CPPUNIT_TEST(testReverseComplement);
+    CPPUNIT_TEST(testSubstr);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+    void testEncode();
+    void testReverseComplement();
+    void testSubstr();
+};
+
+#endif
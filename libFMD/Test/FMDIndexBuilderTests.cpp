@@ -1,5 +1,7 @@
 // Test the BWT generation.
 
+#include <fstream>
+
 #include <boost/filesystem.hpp>
 
 #include <ReadTable.h>
@@ -43,6 +45,12 @@ void FMDIndexBuilderTests::testBuild() {
     // Finish the index.
     FMDIndex* index = builder.build();
     
+    // It should have saved how long the build stages took.
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir +
+        "/index.basename.profile.tsv"));
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir +
+        "/index.basename.profile.json"));
+    
     // Don't leak 
     delete index;
 }
@@ -86,3 +94,320 @@ void FMDIndexBuilderTests::testGenomes() {
     // Don't leak the index
     delete index;
 }
+
+/**
+ * Make sure building in external memory, in batches, gets the same index as
+ * building in memory.
+ */
+void FMDIndexBuilderTests::testExternalMemory() {
+    
+    // Build in memory, with two genomes.
+    FMDIndexBuilder memoryBuilder(tempDir + "/memory.basename");
+    memoryBuilder.add(filename);
+    memoryBuilder.add(filename);
+    FMDIndex* memoryIndex = memoryBuilder.build();
+    
+    // And with a budget so small that every text gets its own batch, sampling
+    // runs so that comes from the BWT too.
+    FMDIndexBuilder diskBuilder(tempDir + "/disk.basename", 64, 0, false,
+        true, true, 1);
+    diskBuilder.add(filename);
+    diskBuilder.add(filename);
+    FMDIndex* diskIndex = diskBuilder.build();
+    CPPUNIT_ASSERT(diskIndex->hasRunSampledSuffixArray());
+    CPPUNIT_ASSERT(diskIndex->hasGenomeMatrix());
+    
+    CPPUNIT_ASSERT_EQUAL(memoryIndex->getBWTLength(),
+        diskIndex->getBWTLength());
+    for(int64_t i = 0; i < memoryIndex->getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(memoryIndex->display(i), diskIndex->display(i));
+        CPPUNIT_ASSERT(memoryIndex->locate(i) == diskIndex->locate(i));
+        CPPUNIT_ASSERT_EQUAL(memoryIndex->getLCP(i), diskIndex->getLCP(i));
+        for(size_t genome = 0; genome < 2; genome++) {
+            CPPUNIT_ASSERT_EQUAL(memoryIndex->isInGenome(i, genome),
+                diskIndex->isInGenome(i, genome));
+        }
+    }
+    
+    for(size_t contig = 0; contig < memoryIndex->getNumberOfContigs();
+        contig++) {
+        
+        CPPUNIT_ASSERT_EQUAL(memoryIndex->getContigEndIndex(contig),
+            diskIndex->getContigEndIndex(contig));
+        for(size_t offset = 1; offset <= memoryIndex->getContigLength(contig);
+            offset++) {
+            
+            // Random access through the inverse suffix array should agree.
+            CPPUNIT_ASSERT_EQUAL(memoryIndex->display(contig, offset),
+                diskIndex->display(contig, offset));
+        }
+    }
+    
+    delete memoryIndex;
+    delete diskIndex;
+}
+
+/**
+ * Make sure appending genomes to an existing index gets the same index as
+ * building with all the genomes at once.
+ */
+void FMDIndexBuilderTests::testAppend() {
+    
+    // Build everything at once, with three genomes.
+    FMDIndexBuilder fullBuilder(tempDir + "/full.basename", 64, 0, false,
+        true);
+    fullBuilder.add(filename);
+    fullBuilder.add("Test/haplotypes2.fa");
+    fullBuilder.add(filename);
+    FMDIndex* fullIndex = fullBuilder.build();
+    
+    // Build just the first genome.
+    FMDIndexBuilder oldBuilder(tempDir + "/old.basename");
+    oldBuilder.add(filename);
+    delete oldBuilder.build();
+    
+    // And then append the other two.
+    FMDIndexBuilder appendBuilder(tempDir + "/appended.basename", 64, 0, true,
+        true);
+    FMDIndex* appendedIndex = appendBuilder.append(tempDir + "/old.basename",
+        {"Test/haplotypes2.fa", filename});
+    CPPUNIT_ASSERT(appendedIndex->hasGenomeMatrix());
+    
+    CPPUNIT_ASSERT_EQUAL(fullIndex->getNumberOfGenomes(),
+        appendedIndex->getNumberOfGenomes());
+    CPPUNIT_ASSERT_EQUAL(fullIndex->getBWTLength(),
+        appendedIndex->getBWTLength());
+    for(int64_t i = 0; i < fullIndex->getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(fullIndex->display(i), appendedIndex->display(i));
+        CPPUNIT_ASSERT(fullIndex->locate(i) == appendedIndex->locate(i));
+        CPPUNIT_ASSERT_EQUAL(fullIndex->getLCP(i), appendedIndex->getLCP(i));
+        for(size_t genome = 0; genome < 3; genome++) {
+            CPPUNIT_ASSERT_EQUAL(fullIndex->isInGenome(i, genome),
+                appendedIndex->isInGenome(i, genome));
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(fullIndex->getNumberOfContigs(),
+        appendedIndex->getNumberOfContigs());
+    for(size_t contig = 0; contig < fullIndex->getNumberOfContigs();
+        contig++) {
+        
+        CPPUNIT_ASSERT_EQUAL(fullIndex->getContigName(contig),
+            appendedIndex->getContigName(contig));
+        CPPUNIT_ASSERT_EQUAL(fullIndex->getContigGenome(contig),
+            appendedIndex->getContigGenome(contig));
+        CPPUNIT_ASSERT_EQUAL(fullIndex->getContigEndIndex(contig),
+            appendedIndex->getContigEndIndex(contig));
+        
+        // The packed text should have the old contigs as well as the new.
+        CPPUNIT_ASSERT_EQUAL(fullIndex->displayContig(contig),
+            appendedIndex->displayContig(contig));
+    }
+    
+    delete fullIndex;
+    delete appendedIndex;
+}
+
+/**
+ * Make sure sorting suffixes in parallel gets the same index as sorting them
+ * in one thread.
+ */
+void FMDIndexBuilderTests::testThreads() {
+    
+    FMDIndexBuilder serialBuilder(tempDir + "/serial.basename");
+    serialBuilder.add(filename);
+    serialBuilder.add("Test/haplotypes2.fa");
+    FMDIndex* serialIndex = serialBuilder.build();
+    
+    FMDIndexBuilder parallelBuilder(tempDir + "/parallel.basename", 64, 0,
+        false, false, false, 0, 4);
+    parallelBuilder.add(filename);
+    parallelBuilder.add("Test/haplotypes2.fa");
+    FMDIndex* parallelIndex = parallelBuilder.build();
+    
+    CPPUNIT_ASSERT_EQUAL(serialIndex->getBWTLength(),
+        parallelIndex->getBWTLength());
+    for(int64_t i = 0; i < serialIndex->getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(serialIndex->display(i), parallelIndex->display(i));
+        CPPUNIT_ASSERT(serialIndex->locate(i) == parallelIndex->locate(i));
+        CPPUNIT_ASSERT_EQUAL(serialIndex->getLCP(i), parallelIndex->getLCP(i));
+    }
+    
+    delete serialIndex;
+    delete parallelIndex;
+}
+
+/**
+ * Make sure building the BWT with ropebwt or BCR gets the same index as
+ * sorting all the suffixes.
+ */
+void FMDIndexBuilderTests::testBWTAlgorithms() {
+    
+    // Ropebwt can take contigs of different lengths, but BCR can only take
+    // contigs all of the same length, like the ones in our main FASTA.
+    std::vector<std::pair<BWTAlgorithm, std::vector<std::string>>> cases {
+        {BWT_ROPEBWT, {filename, "Test/haplotypes2.fa"}},
+        {BWT_BCR, {filename}}
+    };
+    
+    for(auto& algorithmAndFastas : cases) {
+        // Build each case in its own place.
+        std::string name = std::to_string(algorithmAndFastas.first);
+        FMDIndexBuilder sortBuilder(tempDir + "/sort" + name + ".basename");
+        FMDIndexBuilder builder(tempDir + "/other" + name + ".basename", 64, 0,
+            false, false, false, 0, 1, algorithmAndFastas.first);
+        for(const std::string& fasta : algorithmAndFastas.second) {
+            sortBuilder.add(fasta);
+            builder.add(fasta);
+        }
+        FMDIndex* sortIndex = sortBuilder.build();
+        FMDIndex* index = builder.build();
+        
+        CPPUNIT_ASSERT_EQUAL(sortIndex->getBWTLength(), index->getBWTLength());
+        for(int64_t i = 0; i < sortIndex->getBWTLength(); i++) {
+            CPPUNIT_ASSERT_EQUAL(sortIndex->display(i), index->display(i));
+            CPPUNIT_ASSERT(sortIndex->locate(i) == index->locate(i));
+            CPPUNIT_ASSERT_EQUAL(sortIndex->getLCP(i), index->getLCP(i));
+            for(size_t genome = 0; genome < algorithmAndFastas.second.size();
+                genome++) {
+                
+                CPPUNIT_ASSERT_EQUAL(sortIndex->isInGenome(i, genome),
+                    index->isInGenome(i, genome));
+            }
+        }
+        
+        delete index;
+        delete sortIndex;
+    }
+    
+    // BCR on contigs of different lengths should be refused, and not take the
+    // whole program down.
+    FMDIndexBuilder mixedBuilder(tempDir + "/mixed.basename", 64, 0, false,
+        false, false, 0, 1, BWT_BCR);
+    mixedBuilder.add(filename);
+    mixedBuilder.add("Test/haplotypes2.fa");
+    CPPUNIT_ASSERT_THROW(mixedBuilder.build(), std::runtime_error);
+    
+    CPPUNIT_ASSERT_EQUAL(BWT_ROPEBWT,
+        FMDIndexBuilder::parseBWTAlgorithm("ropebwt"));
+    CPPUNIT_ASSERT_THROW(FMDIndexBuilder::parseBWTAlgorithm("nope"),
+        std::runtime_error);
+}
+
+/**
+ * Make sure adding FASTAs in parallel numbers the contigs and genomes the same
+ * as adding them one at a time.
+ */
+void FMDIndexBuilderTests::testAddAll() {
+    
+    FMDIndexBuilder serialBuilder(tempDir + "/serial.basename");
+    serialBuilder.add(filename);
+    serialBuilder.add("Test/haplotypes2.fa");
+    serialBuilder.add(filename);
+    FMDIndex* serialIndex = serialBuilder.build();
+    
+    FMDIndexBuilder parallelBuilder(tempDir + "/parallel.basename", 64, 0,
+        false, false, false, 0, 2);
+    parallelBuilder.addAll({filename, "Test/haplotypes2.fa", filename});
+    FMDIndex* parallelIndex = parallelBuilder.build();
+    
+    CPPUNIT_ASSERT_EQUAL(serialIndex->getNumberOfContigs(),
+        parallelIndex->getNumberOfContigs());
+    for(size_t contig = 0; contig < serialIndex->getNumberOfContigs();
+        contig++) {
+        
+        CPPUNIT_ASSERT_EQUAL(serialIndex->getContigName(contig),
+            parallelIndex->getContigName(contig));
+        CPPUNIT_ASSERT_EQUAL(serialIndex->getContigStart(contig),
+            parallelIndex->getContigStart(contig));
+        CPPUNIT_ASSERT_EQUAL(serialIndex->getContigGenome(contig),
+            parallelIndex->getContigGenome(contig));
+        CPPUNIT_ASSERT_EQUAL(serialIndex->displayContig(contig),
+            parallelIndex->displayContig(contig));
+    }
+    
+    CPPUNIT_ASSERT_EQUAL(serialIndex->getBWTLength(),
+        parallelIndex->getBWTLength());
+    for(int64_t i = 0; i < serialIndex->getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(serialIndex->display(i), parallelIndex->display(i));
+    }
+    
+    delete serialIndex;
+    delete parallelIndex;
+}
+
+/**
+ * Make sure an interrupted build picks up from its last finished stage, and
+ * gets the same index as building from scratch.
+ */
+void FMDIndexBuilderTests::testResume() {
+    
+    std::string basename = tempDir + "/resume.basename";
+    
+    FMDIndexBuilder firstBuilder(basename);
+    firstBuilder.add(filename);
+    FMDIndex* firstIndex = firstBuilder.build();
+    delete firstIndex;
+    
+    // Pretend the build died while sampling the suffix array, leaving a
+    // partial file, and damage the LCP so it has to be redone.
+    boost::filesystem::remove(basename + ".ssa");
+    boost::filesystem::remove(basename + ".isa");
+    std::ofstream(basename + ".ssa.partial") << "junk";
+    std::ofstream(basename + ".lcp", std::ios::app) << "junk";
+    
+    FMDIndexBuilder resumeBuilder(basename);
+    resumeBuilder.add(filename);
+    FMDIndex* resumedIndex = resumeBuilder.build();
+    
+    FMDIndexBuilder freshBuilder(tempDir + "/fresh.basename");
+    freshBuilder.add(filename);
+    FMDIndex* freshIndex = freshBuilder.build();
+    
+    CPPUNIT_ASSERT_EQUAL(freshIndex->getBWTLength(),
+        resumedIndex->getBWTLength());
+    for(int64_t i = 0; i < freshIndex->getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(freshIndex->display(i), resumedIndex->display(i));
+        CPPUNIT_ASSERT(freshIndex->locate(i) == resumedIndex->locate(i));
+        CPPUNIT_ASSERT_EQUAL(freshIndex->getLCP(i), resumedIndex->getLCP(i));
+        CPPUNIT_ASSERT_EQUAL(freshIndex->isInGenome(i, 0),
+            resumedIndex->isInGenome(i, 0));
+    }
+    
+    delete resumedIndex;
+    delete freshIndex;
+}
+
+/**
+ * Make sure haplotypes from a phased VCF are indexed as one genome each, with
+ * their variants applied to the reference.
+ */
+void FMDIndexBuilderTests::testHaplotypes() {
+    
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.addHaplotypes(filename, "Test/haplotypes.vcf");
+    FMDIndex* index = builder.build();
+    
+    // The reference, and the variants the VCF gives the haplotypes.
+    std::string seq1 = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    std::string seq2 = "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA";
+    std::string inserted = "CATGCTTCGGAACGATTCGACGCTCATCTGCGACTCT";
+    std::string substituted = "CAGGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    std::string deleted = "CGGGCATCGCTATTATTTCTTTCTCTTTTCACA";
+    
+    // Each haplotype gets both records, and the symbolic allele the second
+    // sample's second haplotype has is left as the reference.
+    std::vector<std::string> expected = {inserted, seq2, substituted,
+        deleted, substituted, deleted, substituted, seq2};
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, index->getNumberOfGenomes());
+    CPPUNIT_ASSERT_EQUAL(expected.size(), index->getNumberOfContigs());
+    for(size_t contig = 0; contig < expected.size(); contig++) {
+        CPPUNIT_ASSERT_EQUAL(contig / 2, index->getContigGenome(contig));
+        CPPUNIT_ASSERT_EQUAL(std::string(contig % 2 ? "seq2" : "seq1"),
+            index->getContigName(contig));
+        CPPUNIT_ASSERT_EQUAL(expected[contig], index->displayContig(contig));
+    }
+    
+    delete index;
+}
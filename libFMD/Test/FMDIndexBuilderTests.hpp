@@ -11,6 +11,13 @@ class FMDIndexBuilderTests : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(FMDIndexBuilderTests);
     CPPUNIT_TEST(testBuild);
     CPPUNIT_TEST(testGenomes);
+    CPPUNIT_TEST(testExternalMemory);
+    CPPUNIT_TEST(testAppend);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testBWTAlgorithms);
+    CPPUNIT_TEST(testAddAll);
+    CPPUNIT_TEST(testResume);
+    CPPUNIT_TEST(testHaplotypes);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -25,6 +32,13 @@ public:
 
     void testBuild();
     void testGenomes();
+    void testExternalMemory();
+    void testAppend();
+    void testThreads();
+    void testBWTAlgorithms();
+    void testAddAll();
+    void testResume();
+    void testHaplotypes();
     
 };
 
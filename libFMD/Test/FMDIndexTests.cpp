@@ -2,13 +2,18 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
 
 #include <ReadTable.h>
 #include <SuffixArray.h>
 
 #include "../FMDIndex.hpp"
 #include "../FMDIndexBuilder.hpp"
+#include "../FMDIndexView.hpp"
 #include "../util.hpp"
 
 #include "FMDIndexTests.hpp"
@@ -363,14 +368,814 @@ void FMDIndexTests::testRetract() {
     
 }
 
+/**
+ * Test extending a batch of searches at once.
+ */
+void FMDIndexTests::testExtendBatch() {
+
+    // Some patterns to search, all of the same length.
+    std::vector<std::string> patterns {"TCTTTT", "AAAAGA", "GATTAC", "TTCGCA"};
+    
+    for(bool backward : {true, false}) {
+        // Try it in both directions.
+    
+        // Start all the searches everywhere.
+        std::vector<FMDPosition> ranges(patterns.size(),
+            index->getCoveringPosition());
+        
+        for(size_t i = 0; i < patterns[0].size(); i++) {
+            // Collect the next character for each search. We go from the end
+            // of the pattern when searching backward.
+            std::string chars;
+            for(auto& pattern : patterns) {
+                chars.push_back(backward ? pattern[pattern.size() - 1 - i] :
+                    pattern[i]);
+            }
+            
+            // Extend them all at once.
+            index->extendBatch(ranges, chars.c_str(), backward);
+        }
+        
+        for(size_t i = 0; i < patterns.size(); i++) {
+            // Each one must match a normal search. Empty results can end up
+            // in different places, since count stops early.
+            FMDPosition expected = index->count(patterns[i]);
+            if(expected.getLength() == 0) {
+                CPPUNIT_ASSERT_EQUAL((size_t) 0, ranges[i].getLength());
+            } else {
+                CPPUNIT_ASSERT(ranges[i] == expected);
+            }
+        }
+    }
+}
+
+/**
+ * Test counting a batch of patterns at once.
+ */
+void FMDIndexTests::testCountBatch() {
+
+    // Get more patterns than there are lanes, of all different lengths, some
+    // of which aren't there.
+    std::vector<std::string> patterns;
+    for(size_t i = 0; i < 5; i++) {
+        for(std::string pattern : {"", "T", "TTC", "TCTTTT", "AAAAGA",
+            "GATTACA", "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA"}) {
+            
+            if(i <= pattern.size()) {
+                // Use each suffix that exists.
+                patterns.push_back(pattern.substr(i));
+            }
+        }
+    }
+    
+    std::vector<FMDPosition> results;
+    index->countBatch(patterns, results);
+    CPPUNIT_ASSERT_EQUAL(patterns.size(), results.size());
+    
+    for(size_t i = 0; i < patterns.size(); i++) {
+        // Each one must match a normal count exactly.
+        CPPUNIT_ASSERT(results[i] == index->count(patterns[i]));
+    }
+}
+
+/**
+ * Test extending by all the bases at once.
+ */
+void FMDIndexTests::testExtendAll() {
+
+    for(std::string pattern : {"", "T", "TTC", "CGGGCG", "GATTACA"}) {
+        // Start from a few places, some of which don't exist.
+        FMDPosition start = index->count(pattern);
+        
+        for(bool backward : {true, false}) {
+            // Extend with everything at once in each direction.
+            FMDPosition children[NUM_BASES];
+            index->extendAll(start, backward, children);
+        
+            for(size_t base = 0; base < NUM_BASES; base++) {
+                // Each child must be what we would get one at a time.
+                FMDPosition expected = start;
+                index->extendFast(expected, BASES[base], backward);
+                CPPUNIT_ASSERT(children[base] == expected);
+            }
+        }
+        
+        // Also extend on the left only.
+        FMDPosition leftChildren[NUM_BASES];
+        index->extendLeftOnlyAll(start, leftChildren);
+        
+        for(size_t base = 0; base < NUM_BASES; base++) {
+            // Each child must be what we would get one at a time.
+            FMDPosition expected = start;
+            index->extendLeftOnly(expected, BASES[base]);
+            CPPUNIT_ASSERT(leftChildren[base] == expected);
+        }
+    }
+}
+
+/**
+ * Make sure the compile-time and 2-bit code extension kernels agree with plain
+ * extension, which flips the range around to go forward.
+ */
+void FMDIndexTests::testExtendKernels() {
+
+    for(std::string pattern : {"", "T", "TTC", "CGGGCG", "GATTACA"}) {
+        // Start from a few places, some of which don't exist.
+        FMDPosition start = index->count(pattern);
+        
+        for(size_t code = 0; code < NUM_BASES; code++) {
+            // Try each base by its code.
+            char base = ALPHABETICAL_BASES[code];
+            
+            FMDPosition left = start;
+            index->extendLeft(left, (uint8_t) code);
+            CPPUNIT_ASSERT(left == index->extend(start, base, true));
+            
+            FMDPosition right = start;
+            index->extendRight(right, (uint8_t) code);
+            CPPUNIT_ASSERT(right == index->extend(start, base, false));
+        }
+        
+        // And with a base baked in at compile time.
+        FMDPosition left = start;
+        index->extendLeft<'G'>(left);
+        CPPUNIT_ASSERT(left == index->extend(start, 'G', true));
+        
+        FMDPosition right = start;
+        index->extendRight<'C'>(right);
+        CPPUNIT_ASSERT(right == index->extend(start, 'C', false));
+    }
+}
+
+/**
+ * Test looking up k-mers in a k-mer table.
+ */
+void FMDIndexTests::testKmerTable() {
+    
+    // Make a table
+    KmerTable table(*index, 3);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, table.getDepth());
+    
+    for(size_t depth = 1; depth <= 3; depth++) {
+        for(auto i = index->begin(depth); i != index->end(depth); ++i) {
+            // Everything that's there should be in the table the same.
+            FMDPosition found;
+            CPPUNIT_ASSERT(table.lookup((*i).first, 0, depth, found));
+            CPPUNIT_ASSERT(found == (*i).second);
+        }
+    }
+    
+    // Things that aren't there should be empty
+    FMDPosition found;
+    CPPUNIT_ASSERT(table.lookup("GATTACA", 1, 3, found));
+    CPPUNIT_ASSERT_EQUAL(index->count("ATT").getLength(), found.getLength());
+    
+    // And things that are too long or not bases shouldn't be found.
+    CPPUNIT_ASSERT(!table.lookup("GATTACA", 0, 4, found));
+    CPPUNIT_ASSERT(!table.lookup("GATNACA", 1, 3, found));
+    
+    // Save and load the table, and make counting use it.
+    table.save(tempDir + "/index.basename.kmi");
+    FMDIndex tableIndex(tempDir + "/index.basename");
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, tableIndex.getKmerTableDepth());
+    
+    for(std::string pattern : {"T", "TTC", "TCTTTT", "AAAAGA", "GATTACA",
+        "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA"}) {
+        // Counting must give the same results.
+        FMDPosition expected = index->count(pattern);
+        FMDPosition got = tableIndex.count(pattern);
+        CPPUNIT_ASSERT_EQUAL(expected.getLength(), got.getLength());
+        if(expected.getLength() > 0) {
+            CPPUNIT_ASSERT(expected == got);
+        }
+    }
+}
+
+/**
+ * Make sure the minimal unique length table agrees with counting.
+ */
+void FMDIndexTests::testMinUniqueTable() {
+    
+    // Make a table, save it, and load it with the index.
+    MinUniqueTable(*index).save(tempDir + "/index.basename.mus");
+    FMDIndex tableIndex(tempDir + "/index.basename");
+    CPPUNIT_ASSERT(tableIndex.getMinUniqueTable() != NULL);
+    const MinUniqueTable& table = *tableIndex.getMinUniqueTable();
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        std::string bases = index->displayContig(contig);
+        
+        for(size_t offset = 0; offset < bases.size(); offset++) {
+            TextPosition position(contig * 2, offset);
+            
+            // The string starting here should be unique right at that length.
+            size_t right = table.getRightLength(position);
+            if(right == 0) {
+                CPPUNIT_ASSERT(index->count(bases.substr(offset))
+                    .getLength() > 1);
+            } else {
+                CPPUNIT_ASSERT_EQUAL((size_t) 1, index->count(
+                    bases.substr(offset, right)).getLength());
+                CPPUNIT_ASSERT(index->count(bases.substr(offset, right - 1))
+                    .getLength() > 1);
+            }
+            
+            // And so should the string ending here.
+            size_t left = table.getLeftLength(position);
+            if(left == 0) {
+                CPPUNIT_ASSERT(index->count(bases.substr(0, offset + 1))
+                    .getLength() > 1);
+            } else {
+                CPPUNIT_ASSERT_EQUAL((size_t) 1, index->count(
+                    bases.substr(offset + 1 - left, left)).getLength());
+                CPPUNIT_ASSERT(index->count(bases.substr(offset + 2 - left,
+                    left - 1)).getLength() > 1);
+            }
+        }
+    }
+}
+
+/**
+ * Make sure a memory-mapped LCP array survives being saved back out and mapped
+ * in again.
+ */
+void FMDIndexTests::testMappedLCP() {
+    
+    // Map the index's own LCP array, save a copy, and map that.
+    LCPArray original(tempDir + "/index.basename.lcp");
+    original.save(tempDir + "/copy.lcp");
+    LCPArray copy(tempDir + "/copy.lcp");
+    
+    for(int64_t i = 0; i < index->getBWTLength(); i++) {
+        // Everything should agree with the index.
+        CPPUNIT_ASSERT_EQUAL(index->getLCP(i), copy[i]);
+        CPPUNIT_ASSERT_EQUAL(index->getLCPPSV(i), copy.getPSV(i));
+        CPPUNIT_ASSERT_EQUAL(index->getLCPNSV(i), copy.getNSV(i));
+    }
+    
+    // Mapping something that isn't there should fail.
+    CPPUNIT_ASSERT_THROW(LCPArray(tempDir + "/nonexistent.lcp"),
+        std::runtime_error);
+}
+
+/**
+ * Make sure the genome masks and LCP array are only loaded when used.
+ */
+void FMDIndexTests::testLazyComponents() {
+    
+    // Counting doesn't need either.
+    FMDIndex fresh(tempDir + "/index.basename");
+    CPPUNIT_ASSERT(fresh.count("A").getLength() > 0);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, fresh.getMemoryUsage()["genomeMasks"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, fresh.getMemoryUsage()["lcpArray"]);
+    
+    // Asking about genomes loads the masks.
+    CPPUNIT_ASSERT_EQUAL(index->getNumberOfGenomes(),
+        fresh.getNumberOfGenomes());
+    CPPUNIT_ASSERT(fresh.getMemoryUsage()["genomeMasks"] > 0);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, fresh.getMemoryUsage()["lcpArray"]);
+    for(size_t genome = 0; genome < fresh.getNumberOfGenomes(); genome++) {
+        CPPUNIT_ASSERT(index->getGenomeContigs(genome) ==
+            fresh.getGenomeContigs(genome));
+    }
+    
+    // And asking about LCPs loads the LCP array.
+    for(int64_t i = 0; i < fresh.getBWTLength(); i++) {
+        CPPUNIT_ASSERT_EQUAL(index->getLCP(i), fresh.getLCP(i));
+    }
+    CPPUNIT_ASSERT(fresh.getMemoryUsage()["lcpArray"] > 0);
+}
+
+/**
+ * Make sure random access to contigs works through the sampled inverse suffix
+ * array, and without it.
+ */
+void FMDIndexTests::testDisplayOffset() {
+    
+    // Build an index with samples close together, so we actually start from
+    // the samples.
+    FMDIndexBuilder builder(tempDir + "/sampled.basename", 4);
+    builder.add(filename);
+    delete builder.build();
+    
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir + "/sampled.basename.isa"));
+    FMDIndex sampledIndex(tempDir + "/sampled.basename");
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        std::string bases = index->displayContig(contig);
+        for(size_t i = 0; i < bases.size(); i++) {
+            // Every base must come out the same as in the whole contig.
+            CPPUNIT_ASSERT_EQUAL(bases[i], sampledIndex.display(contig, i + 1));
+        }
+    }
+    
+    // Now take the samples away and make sure we can still walk from the ends.
+    boost::filesystem::remove(tempDir + "/sampled.basename.isa");
+    FMDIndex unsampledIndex(tempDir + "/sampled.basename");
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        std::string bases = index->displayContig(contig);
+        for(size_t i = 0; i < bases.size(); i++) {
+            CPPUNIT_ASSERT_EQUAL(bases[i],
+                unsampledIndex.display(contig, i + 1));
+        }
+    }
+}
+
+/**
+ * Make sure displaying from a packed text store agrees with the BWT.
+ */
+void FMDIndexTests::testPackedText() {
+    
+    // Build an index with a packed text
+    FMDIndexBuilder builder(tempDir + "/packed.basename", 64, 0, true);
+    builder.add(filename);
+    delete builder.build();
+    
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir + "/packed.basename.txt"));
+    FMDIndex packedIndex(tempDir + "/packed.basename");
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        // Whole contigs should come out the same
+        std::string bases = index->displayContig(contig);
+        CPPUNIT_ASSERT_EQUAL(bases, packedIndex.displayContig(contig));
+        
+        for(size_t i = 0; i < bases.size(); i++) {
+            // So should individual bases
+            CPPUNIT_ASSERT_EQUAL(bases[i], packedIndex.display(contig, i + 1));
+            
+            // On both strands
+            TextPosition forward(contig * 2, i);
+            TextPosition reverse(contig * 2 + 1, i);
+            CPPUNIT_ASSERT_EQUAL(index->displayCached(forward),
+                packedIndex.displayCached(forward));
+            CPPUNIT_ASSERT_EQUAL(index->displayCached(reverse),
+                packedIndex.displayCached(reverse));
+        }
+    }
+    
+    // Rebuilding without the packed text should get rid of it.
+    FMDIndexBuilder rebuilder(tempDir + "/packed.basename");
+    rebuilder.add(filename);
+    delete rebuilder.build();
+    CPPUNIT_ASSERT(!boost::filesystem::exists(tempDir +
+        "/packed.basename.txt"));
+}
+
+/**
+ * Make sure the contig end indices saved by the builder match the ones found
+ * by locating every text end.
+ */
+void FMDIndexTests::testSavedEndIndices() {
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir + "/index.basename.end"));
+    
+    // Make the index find them itself.
+    boost::filesystem::remove(tempDir + "/index.basename.end");
+    FMDIndex locatedIndex(tempDir + "/index.basename");
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        CPPUNIT_ASSERT_EQUAL(locatedIndex.getContigEndIndex(contig),
+            index->getContigEndIndex(contig));
+    }
+}
 
+/**
+ * Make sure the binary contig metadata loads the same as the text version.
+ */
+void FMDIndexTests::testBinaryContigs() {
+    CPPUNIT_ASSERT(boost::filesystem::exists(tempDir +
+        "/index.basename.contigs.bin"));
+    
+    // Make the index parse the text version.
+    boost::filesystem::remove(tempDir + "/index.basename.contigs.bin");
+    FMDIndex textIndex(tempDir + "/index.basename");
+    
+    CPPUNIT_ASSERT_EQUAL(textIndex.getNumberOfContigs(),
+        index->getNumberOfContigs());
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        CPPUNIT_ASSERT_EQUAL(textIndex.getContigName(contig),
+            index->getContigName(contig));
+        CPPUNIT_ASSERT_EQUAL(textIndex.getContigStart(contig),
+            index->getContigStart(contig));
+        CPPUNIT_ASSERT_EQUAL(textIndex.getContigLength(contig),
+            index->getContigLength(contig));
+        CPPUNIT_ASSERT_EQUAL(textIndex.getContigGenome(contig),
+            index->getContigGenome(contig));
+    }
+    CPPUNIT_ASSERT_EQUAL(textIndex.getTotalLength(), index->getTotalLength());
+}
 
+/**
+ * Make sure base IDs can be turned back into contigs and offsets.
+ */
+void FMDIndexTests::testBaseIDs() {
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        for(size_t offset = 1; offset <= index->getContigLength(contig);
+            offset++) {
+            
+            // Go to a base ID and back on each strand.
+            TextPosition forward = index->getTextPosition(
+                std::make_pair(std::make_pair(contig, offset), false));
+            TextPosition reverse = index->getTextPosition(
+                std::make_pair(std::make_pair(contig, offset), true));
+            
+            CPPUNIT_ASSERT(index->getContigAndOffset(index->getBaseID(
+                forward)) == std::make_pair(contig, offset));
+            CPPUNIT_ASSERT(index->getContigAndOffset(index->getBaseID(
+                reverse)) == std::make_pair(contig, offset));
+        }
+    }
+}
 
+/**
+ * Make sure counting genomes in ranges with a wavelet matrix agrees with the
+ * genome masks.
+ */
+void FMDIndexTests::testGenomeMatrix() {
+    
+    // Build an index with two genomes and a wavelet matrix.
+    FMDIndexBuilder builder(tempDir + "/genomes.basename", 64, 0, false, true);
+    builder.add(filename);
+    builder.add(filename);
+    delete builder.build();
+    FMDIndex matrixIndex(tempDir + "/genomes.basename");
+    CPPUNIT_ASSERT(matrixIndex.hasGenomeMatrix());
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, matrixIndex.getNumberOfGenomes());
+    
+    // And the same index answering from masks.
+    boost::filesystem::remove(tempDir + "/genomes.basename.gwm");
+    FMDIndex maskIndex(tempDir + "/genomes.basename");
+    CPPUNIT_ASSERT(!maskIndex.hasGenomeMatrix());
+    
+    int64_t length = matrixIndex.getBWTLength();
+    for(int64_t start = 0; start < length; start += 7) {
+        for(int64_t end = start; end <= length; end += 11) {
+            for(size_t genome = 0; genome < 2; genome++) {
+                CPPUNIT_ASSERT_EQUAL(maskIndex.countInGenome(start, end,
+                    genome), matrixIndex.countInGenome(start, end, genome));
+            }
+            CPPUNIT_ASSERT_EQUAL((size_t) (end - start),
+                matrixIndex.countInGenomes(start, end, {0, 1}));
+            CPPUNIT_ASSERT(maskIndex.getGenomesInRange(start, end) ==
+                matrixIndex.getGenomesInRange(start, end));
+        }
+    }
+}
 
+/**
+ * Make sure batch and range locates agree with locating one at a time.
+ */
+void FMDIndexTests::testLocateBatch() {
+    
+    // Locate the whole BWT as a range.
+    std::vector<TextPosition> located;
+    index->locateRange(0, index->getBWTLength(), std::back_inserter(located));
+    CPPUNIT_ASSERT_EQUAL((size_t) index->getBWTLength(), located.size());
+    
+    for(int64_t i = 0; i < index->getBWTLength(); i++) {
+        CPPUNIT_ASSERT(index->locate(i) == located[i]);
+    }
+    
+    // Locate a scattered batch, out of order and with repeats.
+    std::vector<int64_t> indices;
+    for(int64_t i = index->getBWTLength() - 1; i >= 0; i -= 3) {
+        indices.push_back(i);
+        indices.push_back(i / 2);
+    }
+    std::vector<TextPosition> batch(indices.size());
+    index->locateBatch(indices.data(), indices.size(), batch.data());
+    
+    for(size_t i = 0; i < indices.size(); i++) {
+        CPPUNIT_ASSERT(index->locate(indices[i]) == batch[i]);
+    }
+}
 
+/**
+ * Make sure locating with suffix array samples at BWT run boundaries agrees
+ * with the full suffix array.
+ */
+void FMDIndexTests::testRunSampledLocate() {
+    
+    // Build a repetitive index with run boundary samples. What the builder
+    // hands back still has the full suffix array.
+    FMDIndexBuilder builder(tempDir + "/runs.basename", 64, 0, false, false,
+        true);
+    builder.add(filename);
+    builder.add(filename);
+    FMDIndex* fullIndex = builder.build();
+    FMDIndex runIndex(tempDir + "/runs.basename");
+    CPPUNIT_ASSERT(runIndex.hasRunSampledSuffixArray());
+    
+    int64_t length = runIndex.getBWTLength();
+    for(int64_t i = 0; i < length; i++) {
+        // Walking to a boundary should work everywhere.
+        CPPUNIT_ASSERT(fullIndex->locate(i) == runIndex.locate(i));
+    }
+    
+    // Locating ranges uses phi.
+    std::vector<TextPosition> located;
+    runIndex.locateRange(0, length, std::back_inserter(located));
+    CPPUNIT_ASSERT_EQUAL((size_t) length, located.size());
+    for(int64_t i = 0; i < length; i++) {
+        CPPUNIT_ASSERT(fullIndex->locate(i) == located[i]);
+    }
+    
+    // And batches run in lockstep.
+    std::vector<int64_t> indices;
+    for(int64_t i = length - 1; i >= 0; i -= 5) {
+        indices.push_back(i);
+    }
+    std::vector<TextPosition> batch(indices.size());
+    runIndex.locateBatch(indices.data(), indices.size(), batch.data());
+    for(size_t i = 0; i < indices.size(); i++) {
+        CPPUNIT_ASSERT(fullIndex->locate(indices[i]) == batch[i]);
+    }
+    
+    delete fullIndex;
+}
 
+/**
+ * Make sure parallel traversal finds the same nodes as iterating.
+ */
+void FMDIndexTests::testForEachNode() {
+    for(size_t depth = 0; depth <= 6; depth++) {
+        // Get what the iterator finds.
+        std::map<std::string, FMDPosition> expected;
+        if(depth == 0) {
+            expected[""] = index->getCoveringPosition();
+        } else {
+            for(auto i = index->begin(depth); i != index->end(depth); ++i) {
+                expected[(*i).first] = (*i).second;
+            }
+        }
+        
+        for(size_t threads : {1, 3}) {
+            std::map<std::string, FMDPosition> found;
+            std::mutex foundMutex;
+            
+            index->forEachNode(depth, [&](const std::string& pattern,
+                const FMDPosition& position) {
+                
+                std::lock_guard<std::mutex> lock(foundMutex);
+                // Nothing should be visited twice.
+                CPPUNIT_ASSERT(!found.count(pattern));
+                found[pattern] = position;
+            }, threads);
+            
+            CPPUNIT_ASSERT_EQUAL(expected.size(), found.size());
+            for(auto& kv : expected) {
+                CPPUNIT_ASSERT(found.count(kv.first));
+                CPPUNIT_ASSERT(found[kv.first] == kv.second);
+            }
+        }
+    }
+}
 
+/**
+ * Make sure counting ranges with a limit agrees with listing them, with and
+ * without a mask and merged ranges.
+ */
+void FMDIndexTests::testCountRangesUpTo() {
+    size_t length = index->getBWTLength();
+    
+    // Mask in every other position.
+    GenericBitVector mask;
+    for(size_t i = 0; i < length; i += 2) {
+        mask.addBit(i);
+    }
+    mask.finish(length);
+    
+    // Make ranges of 4 positions, so each has something masked in.
+    GenericBitVector ranges;
+    for(size_t i = 0; i < length; i += 4) {
+        ranges.addBit(i);
+    }
+    ranges.finish(length);
+    
+    std::vector<FMDIndexView> views = {
+        FMDIndexView(*index),
+        FMDIndexView(*index, &mask),
+        FMDIndexView(*index, nullptr, &ranges),
+        FMDIndexView(*index, &mask, &ranges)
+    };
+    
+    std::vector<size_t> rangeNumbers;
+    std::vector<TextPosition> positions;
+    for(const FMDIndexView& view : views) {
+        for(size_t start = 0; start < length; start += 7) {
+            for(size_t intervalLength : {0, 1, 2, 5, 13, 40}) {
+                if(start + intervalLength > length) {
+                    continue;
+                }
+                
+                // List all the ranges the slow way.
+                positions.clear();
+                view.appendTextPositions(start, intervalLength, rangeNumbers,
+                    positions);
+                
+                for(size_t limit : {0, 1, 3, 10, 100}) {
+                    CPPUNIT_ASSERT_EQUAL(std::min(rangeNumbers.size(),
+                        limit + 1), view.countRangesUpTo(start,
+                        intervalLength, limit));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Make sure we can find the BWT rows of runs of contig bases, with and without
+ * inverse suffix array samples.
+ */
+void FMDIndexTests::testContigRows() {
+    
+    // Build an index with samples close together, so we actually start from
+    // the samples.
+    FMDIndexBuilder builder(tempDir + "/sampled.basename", 4);
+    builder.add(filename);
+    delete builder.build();
+    FMDIndex sampledIndex(tempDir + "/sampled.basename");
+    
+    for(const FMDIndex* toTest : {index, (const FMDIndex*) &sampledIndex}) {
+        for(size_t contig = 0; contig < toTest->getNumberOfContigs();
+            contig++) {
+            
+            size_t length = toTest->getContigLength(contig);
+            for(auto range : {std::make_pair((size_t) 0, length),
+                std::make_pair((size_t) 3, (size_t) 10),
+                std::make_pair(length - 5, length),
+                std::make_pair((size_t) 7, (size_t) 8)}) {
+                
+                std::vector<int64_t> rows(range.second - range.first);
+                toTest->getContigRows(contig, range.first, range.second,
+                    rows.data());
+                
+                for(size_t i = 0; i < rows.size(); i++) {
+                    // Each row has to be the suffix of the forward strand
+                    // starting at its base.
+                    TextPosition found = toTest->locate(rows[i]);
+                    CPPUNIT_ASSERT_EQUAL(contig * 2, found.getText());
+                    CPPUNIT_ASSERT_EQUAL(range.first + i, found.getOffset());
+                }
+            }
+        }
+    }
+}
 
+/**
+ * Make sure a packed full suffix array locates the same as the sampled one,
+ * once saved and loaded with the index.
+ */
+void FMDIndexTests::testPackedSuffixArray() {
+    int64_t length = index->getBWTLength();
+    
+    // Every entry should come out right before saving.
+    PackedSuffixArray array(*index);
+    CPPUNIT_ASSERT_EQUAL((size_t) length, array.getSize());
+    CPPUNIT_ASSERT(array.getWidth() < 64);
+    for(int64_t i = 0; i < length; i++) {
+        CPPUNIT_ASSERT(index->locate(i) == array.get(i));
+    }
+    
+    // And after loading.
+    array.save(tempDir + "/index.basename.psa");
+    FMDIndex packedIndex(tempDir + "/index.basename");
+    CPPUNIT_ASSERT(packedIndex.getPackedSuffixArray() != NULL);
+    for(int64_t i = 0; i < length; i++) {
+        CPPUNIT_ASSERT(index->locate(i) == packedIndex.locate(i));
+    }
+    
+    // Batches and ranges use it too.
+    std::vector<int64_t> indices;
+    for(int64_t i = length - 1; i >= 0; i -= 3) {
+        indices.push_back(i);
+    }
+    std::vector<TextPosition> batch(indices.size());
+    packedIndex.locateBatch(indices.data(), indices.size(), batch.data());
+    for(size_t i = 0; i < indices.size(); i++) {
+        CPPUNIT_ASSERT(index->locate(indices[i]) == batch[i]);
+    }
+    
+    std::vector<TextPosition> located;
+    packedIndex.locateRange(0, length, std::back_inserter(located));
+    CPPUNIT_ASSERT_EQUAL((size_t) length, located.size());
+    for(int64_t i = 0; i < length; i++) {
+        CPPUNIT_ASSERT(index->locate(i) == located[i]);
+    }
+}
 
+/**
+ * Get the code for the given k-mer, made of only bases.
+ */
+static uint64_t kmerCode(const std::string& kmer) {
+    uint64_t code = 0;
+    for(char base : kmer) {
+        code = (code << 2) | EncodedQuery::encode(base);
+    }
+    return code;
+}
 
+/**
+ * Make sure k-mer filters never rule out k-mers in the index, are exact for
+ * short k-mers, and get loaded with the index.
+ */
+void FMDIndexTests::testKmerFilter() {
+    // Short k-mers get one bit each, so the filter should be right about all
+    // of them.
+    KmerFilter exact(*index, 4);
+    std::string missing;
+    for(uint64_t code = 0; code < 256; code++) {
+        std::string kmer;
+        for(size_t i = 0; i < 4; i++) {
+            kmer.push_back("ACGT"[(code >> (2 * (3 - i))) & 3]);
+        }
+        bool found = index->count(kmer).getLength() > 0;
+        CPPUNIT_ASSERT_EQUAL(found, exact.mayContain(code));
+        if(!found) {
+            missing = kmer;
+        }
+    }
+    
+    // Anything with a missing k-mer in it should be ruled out.
+    CPPUNIT_ASSERT(!missing.empty());
+    CPPUNIT_ASSERT(!exact.mayContainAll(EncodedQuery("NNC" + missing + "N")
+        .forward()));
+    
+    // Longer k-mers go in a Bloom filter, which must still have every k-mer
+    // of every contig, on both strands.
+    KmerFilter bloom(*index, 20);
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        std::string bases = index->displayContig(contig);
+        for(size_t offset = 0; offset + 20 <= bases.size(); offset++) {
+            std::string kmer = bases.substr(offset, 20);
+            CPPUNIT_ASSERT(bloom.mayContain(kmerCode(kmer)));
+            CPPUNIT_ASSERT(bloom.mayContain(kmerCode(reverseComplement(
+                kmer))));
+        }
+        
+        // Whole contigs should pass, but not with a k-mer that isn't there.
+        EncodedQuery encoded(bases);
+        CPPUNIT_ASSERT(bloom.mayContainAll(encoded.forward()));
+        CPPUNIT_ASSERT(bloom.mayContainAll(encoded.reverseComplement()));
+    }
+    
+    // Save it and make sure it comes back with the index, giving the same
+    // answers.
+    bloom.save(tempDir + "/index.basename.kmf");
+    FMDIndex filterIndex(tempDir + "/index.basename");
+    CPPUNIT_ASSERT(filterIndex.getKmerFilter() != NULL);
+    const KmerFilter& loaded = *filterIndex.getKmerFilter();
+    CPPUNIT_ASSERT_EQUAL((size_t) 20, loaded.getK());
+    std::string bases = index->displayContig(0);
+    for(size_t offset = 0; offset + 20 <= bases.size(); offset++) {
+        CPPUNIT_ASSERT(loaded.mayContain(kmerCode(bases.substr(offset, 20))));
+    }
+    
+    CPPUNIT_ASSERT_THROW(KmerFilter(*index, 33), std::runtime_error);
+}
 
+/**
+ * Make sure contigs split at Ns are grouped back into their scaffolds.
+ */
+void FMDIndexTests::testScaffolds() {
+    
+    // The fixture has one genome of two scaffolds with one contig each.
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, index->getNumberOfScaffolds());
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, index->getContigScaffold(1));
+    CPPUNIT_ASSERT(index->getGenomeScaffolds(0) == std::make_pair(
+        (size_t) 0, (size_t) 2));
+    
+    std::string gappedFile = tempDir + "/gapped.fa";
+    std::ofstream gapped(gappedFile.c_str());
+    gapped << ">chr1" << std::endl << "ACGTACGGTNNNNNCATTAGNNACGGAT" <<
+        std::endl << ">chr2" << std::endl << "GATTACA" << std::endl;
+    gapped.close();
+    
+    // Add it twice, so scaffolds with the same name in different genomes are
+    // kept apart.
+    FMDIndexBuilder builder(tempDir + "/gapped.basename");
+    builder.add(gappedFile);
+    builder.add(gappedFile);
+    FMDIndex* gappedIndex = builder.build();
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, gappedIndex->getNumberOfContigs());
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, gappedIndex->getNumberOfScaffolds());
+    
+    std::vector<size_t> scaffolds = {0, 0, 0, 1, 2, 2, 2, 3};
+    for(size_t contig = 0; contig < scaffolds.size(); contig++) {
+        CPPUNIT_ASSERT_EQUAL(scaffolds[contig],
+            gappedIndex->getContigScaffold(contig));
+        CPPUNIT_ASSERT_EQUAL(std::string(contig % 4 == 3 ? "chr2" : "chr1"),
+            gappedIndex->getContigName(contig));
+    }
+    CPPUNIT_ASSERT(gappedIndex->getScaffoldContigs(2) == std::make_pair(
+        (size_t) 4, (size_t) 7));
+    CPPUNIT_ASSERT(gappedIndex->getGenomeScaffolds(1) == std::make_pair(
+        (size_t) 2, (size_t) 4));
+    
+    // The gaps are still there in the contig coordinates.
+    CPPUNIT_ASSERT_EQUAL((size_t) 14, gappedIndex->getContigStart(1));
+    CPPUNIT_ASSERT_EQUAL((size_t) 22, gappedIndex->getContigStart(2));
+    
+    delete gappedIndex;
+}
@@ -18,6 +18,28 @@ class FMDIndexTests : public CppUnit::TestFixture {
     CPPUNIT_TEST(testIterate);
     CPPUNIT_TEST(testLCP);
     CPPUNIT_TEST(testRetract);
+    CPPUNIT_TEST(testExtendBatch);
+    CPPUNIT_TEST(testCountBatch);
+    CPPUNIT_TEST(testExtendAll);
+    CPPUNIT_TEST(testExtendKernels);
+    CPPUNIT_TEST(testKmerTable);
+    CPPUNIT_TEST(testMinUniqueTable);
+    CPPUNIT_TEST(testMappedLCP);
+    CPPUNIT_TEST(testLazyComponents);
+    CPPUNIT_TEST(testDisplayOffset);
+    CPPUNIT_TEST(testPackedText);
+    CPPUNIT_TEST(testSavedEndIndices);
+    CPPUNIT_TEST(testBinaryContigs);
+    CPPUNIT_TEST(testBaseIDs);
+    CPPUNIT_TEST(testGenomeMatrix);
+    CPPUNIT_TEST(testLocateBatch);
+    CPPUNIT_TEST(testRunSampledLocate);
+    CPPUNIT_TEST(testForEachNode);
+    CPPUNIT_TEST(testCountRangesUpTo);
+    CPPUNIT_TEST(testContigRows);
+    CPPUNIT_TEST(testPackedSuffixArray);
+    CPPUNIT_TEST(testKmerFilter);
+    CPPUNIT_TEST(testScaffolds);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -46,6 +68,28 @@ public:
     void testIterate();
     void testLCP();
     void testRetract();
+    void testExtendBatch();
+    void testCountBatch();
+    void testExtendAll();
+    void testExtendKernels();
+    void testKmerTable();
+    void testMinUniqueTable();
+    void testMappedLCP();
+    void testLazyComponents();
+    void testDisplayOffset();
+    void testPackedText();
+    void testSavedEndIndices();
+    void testBinaryContigs();
+    void testBaseIDs();
+    void testGenomeMatrix();
+    void testLocateBatch();
+    void testRunSampledLocate();
+    void testForEachNode();
+    void testCountRangesUpTo();
+    void testContigRows();
+    void testPackedSuffixArray();
+    void testKmerFilter();
+    void testScaffolds();
     
 };
 
@@ -0,0 +1,91 @@
+// Test the flat BWT backend.
+
+#include <boost/filesystem.hpp>
+
+#include "../FlatBWT.hpp"
+#include "../FMDIndex.hpp"
+#include "../FMDIndexBuilder.hpp"
+#include "../util.hpp"
+
+#include "FlatBWTTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( FlatBWTTests );
+
+// Define constants
+const std::string FlatBWTTests::filename = "Test/haplotypes.fa";
+
+void FlatBWTTests::setUp() {
+    // Set up a temporary directory to put the index in.
+    tempDir = make_tempdir();
+    
+    // Build an index, with more than one block's worth of BWT.
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+}
+
+
+void FlatBWTTests::tearDown() {
+    // Get rid of the temporary index directory
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure a FlatBWT answers occurrence queries the same as the RLBWT it came
+ * from.
+ */
+void FlatBWTTests::testOcc() {
+    
+    // Load the BWT both ways.
+    RLBWT runLength(tempDir + "/index.basename.bwt");
+    FlatBWT flat(runLength);
+    
+    CPPUNIT_ASSERT_EQUAL(runLength.getBWLen(), flat.getBWLen());
+    
+    for(size_t i = 0; i < ALPHABET_SIZE; i++) {
+        // C arrays need to match
+        CPPUNIT_ASSERT_EQUAL(runLength.getPC(RANK_ALPHABET[i]),
+            flat.getPC(RANK_ALPHABET[i]));
+    }
+    
+    for(size_t index = (size_t) -1; index + 1 <= runLength.getBWLen();
+        index++) {
+        // Check every position, including the empty prefix.
+        
+        if(index != (size_t) -1) {
+            // Actual positions have characters.
+            CPPUNIT_ASSERT_EQUAL(runLength.getChar(index), flat.getChar(index));
+            CPPUNIT_ASSERT_EQUAL(runLength.getF(index), flat.getF(index));
+        }
+        
+        AlphaCount64 expected = runLength.getFullOcc(index);
+        AlphaCount64 got = flat.getFullOcc(index);
+        
+        for(size_t i = 0; i < ALPHABET_SIZE; i++) {
+            // Each character must have the same count both ways.
+            CPPUNIT_ASSERT_EQUAL(expected.getByIdx(i), got.getByIdx(i));
+            CPPUNIT_ASSERT_EQUAL(expected.getByIdx(i),
+                flat.getOcc(RANK_ALPHABET[i], index));
+        }
+    }
+}
+
+/**
+ * Make sure an FMDIndex searches the same with a FlatBWT.
+ */
+void FlatBWTTests::testSearch() {
+    FMDIndex normal(tempDir + "/index.basename");
+    FMDIndex flat(tempDir + "/index.basename", NULL, true);
+    
+    for(auto i = normal.begin(4); i != normal.end(4); ++i) {
+        // Everything we can find in one should be found the same in the other.
+        CPPUNIT_ASSERT(flat.count((*i).first) == (*i).second);
+    }
+    
+    // Including things that aren't there
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, flat.count("GATTACA").getLength());
+    
+    // Display should work too.
+    CPPUNIT_ASSERT_EQUAL(normal.displayContig(0), flat.displayContig(0));
+}
@@ -0,0 +1,31 @@
+#ifndef FLATBWTTESTS_HPP
+#define FLATBWTTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "../FMDIndex.hpp"
+
+/**
+ * Tests for the FlatBWT.
+ */
+class FlatBWTTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(FlatBWTTests);
+    CPPUNIT_TEST(testOcc);
+    CPPUNIT_TEST(testSearch);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes to test with.
+    static const std::string filename;
+    
+    // Also we need an index temp directory
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testOcc();
+    void testSearch();
+    
+};
+
+#endif
@@ -1,5 +1,13 @@
 // Test GenericBitVector objects.
 
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
 #include "../GenericBitVector.hpp"
 
 #include "GenericBitVectorTests.hpp"
@@ -167,3 +175,212 @@ void GenericBitVectorTests::testStartsEmpty() {
 
 }
 
+
+/**
+ * Make sure lots of threads can query the same bitvector at once and all get
+ * the right answers.
+ */
+void GenericBitVectorTests::testConcurrentQueries() {
+
+    // Set every third bit.
+    GenericBitVector v;
+    for(size_t i = 0; i < 30000; i += 3) {
+        v.addBit(i);
+    }
+    v.finish(30000);
+    
+    // Count up the wrong answers from all the threads.
+    std::atomic<size_t> errors(0);
+    
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < 8; t++) {
+        threads.emplace_back([&v, &errors, t]() {
+            // Each thread walks the vector from a different place.
+            for(size_t j = 0; j < 30000; j++) {
+                size_t i = (j + t * 3571) % 30000;
+                if(v.isSet(i) != (i % 3 == 0) || v.rank(i) != i / 3 + 1 ||
+                    v.select(i / 3) != i - i % 3) {
+                    
+                    errors++;
+                }
+            }
+        });
+    }
+    
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, errors.load());
+
+}
+
+/**
+ * Make a bitvector of the given length with runs of 1s of random lengths
+ * starting at random places, and fill in a plain vector of bools to match.
+ */
+static GenericBitVector* makeRunVector(size_t length, size_t seed,
+    std::vector<bool>& bits) {
+    
+    std::mt19937 generator(seed);
+    bits.assign(length, false);
+    
+    GenericBitVector* v = new GenericBitVector();
+    size_t i = generator() % 50;
+    while(i < length) {
+        // Lay down a run of up to 100 1s.
+        size_t runLength = generator() % 100 + 1;
+        for(size_t j = i; j < std::min(length, i + runLength); j++) {
+            bits[j] = true;
+            v->addBit(j);
+        }
+        
+        // Then skip up to 200 0s.
+        i += runLength + generator() % 200;
+    }
+    v->finish(length);
+    return v;
+}
+
+/**
+ * Make sure copying, union, n-way union, and intersection all get the right
+ * bits.
+ */
+void GenericBitVectorTests::testSetOperations() {
+    
+    std::vector<std::vector<bool>> bits(4);
+    std::vector<GenericBitVector*> vectors;
+    for(size_t i = 0; i < bits.size(); i++) {
+        // Use different lengths so some vectors run past the ends of others.
+        vectors.push_back(makeRunVector(20000 + i * 1000, i, bits[i]));
+    }
+    
+    // Check a copy.
+    GenericBitVector copy(*vectors[0]);
+    CPPUNIT_ASSERT_EQUAL(vectors[0]->getSize(), copy.getSize());
+    for(size_t i = 0; i < bits[0].size(); i++) {
+        CPPUNIT_ASSERT_EQUAL((bool) bits[0][i], copy.isSet(i));
+    }
+    
+    // Check a two-way union and intersection.
+    GenericBitVector* both = vectors[0]->createUnion(*vectors[1]);
+    GenericBitVector* common = vectors[0]->createIntersection(*vectors[1]);
+    CPPUNIT_ASSERT_EQUAL(bits[1].size(), both->getSize());
+    for(size_t i = 0; i < bits[1].size(); i++) {
+        bool first = i < bits[0].size() && bits[0][i];
+        CPPUNIT_ASSERT_EQUAL(first || bits[1][i], both->isSet(i));
+        CPPUNIT_ASSERT_EQUAL(first && bits[1][i], common->isSet(i));
+    }
+    delete both;
+    delete common;
+    
+    // Check an n-way union.
+    GenericBitVector* all = GenericBitVector::createUnionOf(
+        std::vector<const GenericBitVector*>(vectors.begin(), vectors.end()));
+    CPPUNIT_ASSERT_EQUAL(bits.back().size(), all->getSize());
+    size_t ones = 0;
+    for(size_t i = 0; i < bits.back().size(); i++) {
+        bool any = false;
+        for(auto& vectorBits : bits) {
+            any = any || (i < vectorBits.size() && vectorBits[i]);
+        }
+        CPPUNIT_ASSERT_EQUAL(any, all->isSet(i));
+        ones += any;
+        CPPUNIT_ASSERT_EQUAL(ones, all->rank(i));
+    }
+    delete all;
+    
+    for(auto vector : vectors) {
+        delete vector;
+    }
+}
+
+/**
+ * Make sure dense bitvectors get stored plain and sparse ones don't, and that
+ * both kinds answer queries like BitVector and survive being saved and loaded.
+ */
+void GenericBitVectorTests::testEncodingChoice() {
+    
+    std::mt19937 generator(1);
+    
+    for(size_t oneIn : {2, 10000}) {
+        // Make a dense and then a sparse vector, and a BitVector to match.
+        size_t length = 1000000;
+        GenericBitVector v;
+        BitVectorEncoder encoder(32);
+        for(size_t i = 0; i < length; i++) {
+            if(generator() % oneIn == 0) {
+                v.addBit(i);
+                encoder.addBit(i);
+            }
+        }
+        v.finish(length);
+        encoder.flush();
+        BitVector truth(encoder, length);
+        
+        CPPUNIT_ASSERT_EQUAL(oneIn == 2, v.isPlain());
+        
+        // Save it and load it again.
+        std::string filename = "Test/encodingChoice.bv";
+        {
+            std::ofstream out(filename, std::ios::binary);
+            v.writeTo(out);
+        }
+        GenericBitVector loaded(filename);
+        std::remove(filename.c_str());
+        CPPUNIT_ASSERT_EQUAL(v.isPlain(), loaded.isPlain());
+        
+        BitVectorIterator iterator(truth);
+        for(size_t i = 0; i < length; i += 7) {
+            CPPUNIT_ASSERT_EQUAL(iterator.isSet(i), loaded.isSet(i));
+            CPPUNIT_ASSERT_EQUAL(iterator.rank(i), loaded.rank(i));
+        }
+        for(size_t one = 0; one <= truth.getNumberOfItems(); one += 3) {
+            // Including the past-the-end 1.
+            CPPUNIT_ASSERT_EQUAL(iterator.select(one), loaded.select(one));
+        }
+    }
+}
+
+/**
+ * Make sure building bitvectors from sorted indices, serially and in parallel,
+ * gets the same bits as adding them one at a time.
+ */
+void GenericBitVectorTests::testFromSorted() {
+    
+    std::mt19937 generator(2);
+    
+    for(size_t oneIn : {3, 100}) {
+        // Make enough indices that the parallel build really splits them up,
+        // with some long runs to be split between pieces.
+        size_t length = 2000000;
+        std::vector<size_t> indices;
+        GenericBitVector truth;
+        for(size_t i = 0; i < length; i++) {
+            if(generator() % oneIn == 0 || (i / 1000) % 100 == 0) {
+                indices.push_back(i);
+                truth.addBit(i);
+            }
+        }
+        truth.finish(length);
+        
+        GenericBitVector* serial = GenericBitVector::fromSorted(
+            indices.begin(), indices.end(), length);
+        GenericBitVector* parallel = GenericBitVector::fromSortedParallel(
+            indices, length, 4);
+        
+        for(GenericBitVector* v : {serial, parallel}) {
+            CPPUNIT_ASSERT_EQUAL(length, v->getSize());
+            for(size_t i = 0; i < length; i += 5) {
+                CPPUNIT_ASSERT_EQUAL(truth.isSet(i), v->isSet(i));
+                CPPUNIT_ASSERT_EQUAL(truth.rank(i), v->rank(i));
+            }
+            for(size_t k = 0; k < indices.size(); k += 11) {
+                CPPUNIT_ASSERT_EQUAL(indices[k], v->select(k));
+            }
+        }
+        
+        delete serial;
+        delete parallel;
+    }
+}
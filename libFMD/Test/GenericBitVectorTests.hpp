@@ -18,6 +18,10 @@ class GenericBitVectorTests : public CppUnit::TestFixture {
     CPPUNIT_TEST(testValueBefore);
     CPPUNIT_TEST(testValueAfter);
     CPPUNIT_TEST(testStartsEmpty);
+    CPPUNIT_TEST(testConcurrentQueries);
+    CPPUNIT_TEST(testSetOperations);
+    CPPUNIT_TEST(testEncodingChoice);
+    CPPUNIT_TEST(testFromSorted);
     CPPUNIT_TEST_SUITE_END();
     
 public:
@@ -31,6 +35,10 @@ public:
     void testValueAfter();
     
     void testStartsEmpty();
+    void testConcurrentQueries();
+    void testSetOperations();
+    void testEncodingChoice();
+    void testFromSorted();
     
     std::pair<GenericBitVector*, BitVector*> makeTestData();
 };
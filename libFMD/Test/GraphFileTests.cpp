@@ -0,0 +1,82 @@
+// Test saved binary graphs.
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "../GraphFile.hpp"
+#include "../util.hpp"
+
+#include "GraphFileTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( GraphFileTests );
+
+void GraphFileTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void GraphFileTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure we get back the graph we saved.
+ */
+void GraphFileTests::testRoundTrip() {
+    // Make two threads of 10 bases, where bases 3-6 of the first are aligned
+    // backward to bases 5-8 of the second.
+    std::vector<GraphFile::Thread> threads = {{0, 10, 0, 3}, {1, 10, 3, 3}};
+    std::vector<GraphFile::Segment> segments = {
+        {0, 1, 2, GraphFile::NONE, 0},
+        {0, 3, 4, 0, 0},
+        {0, 7, 4, GraphFile::NONE, 0},
+        {1, 1, 4, GraphFile::NONE, 0},
+        {1, 5, 4, 0, 1},
+        {1, 9, 2, GraphFile::NONE, 0}
+    };
+    std::vector<GraphFile::Block> blocks = {{4, 0, 2}};
+    std::vector<uint64_t> members = {1, 4};
+    
+    GraphFile::save(tempDir + "/graph.bin", threads, segments, blocks,
+        members);
+    GraphFile graph(tempDir + "/graph.bin");
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, graph.getNumberOfThreads());
+    CPPUNIT_ASSERT_EQUAL((size_t) 6, graph.getNumberOfSegments());
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, graph.getNumberOfBlocks());
+    
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, graph.getThread(1).name);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 3, graph.getThread(1).firstSegment);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 5, graph.getSegment(4).start);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, graph.getSegment(4).orientation);
+    CPPUNIT_ASSERT_EQUAL(GraphFile::NONE, graph.getSegment(5).block);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 2, graph.getBlock(0).degree);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, graph.getMember(0, 0));
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 4, graph.getMember(0, 1));
+    
+    // Adjacencies stop at the ends of threads.
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, graph.getNextSegment(0));
+    CPPUNIT_ASSERT_EQUAL(GraphFile::NONE, graph.getNextSegment(2));
+    CPPUNIT_ASSERT_EQUAL(GraphFile::NONE, graph.getPreviousSegment(3));
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 3, graph.getPreviousSegment(4));
+}
+
+/**
+ * Make sure files that aren't graphs, or are cut short, are rejected.
+ */
+void GraphFileTests::testBadFile() {
+    std::ofstream garbage(tempDir + "/garbage.bin");
+    garbage << "This is not a graph.";
+    garbage.close();
+    CPPUNIT_ASSERT_THROW(GraphFile(tempDir + "/garbage.bin"),
+        std::runtime_error);
+    
+    GraphFile::save(tempDir + "/graph.bin", {{0, 10, 0, 1}},
+        {{0, 1, 10, GraphFile::NONE, 0}}, {}, {});
+    boost::filesystem::resize_file(tempDir + "/graph.bin",
+        boost::filesystem::file_size(tempDir + "/graph.bin") - 8);
+    CPPUNIT_ASSERT_THROW(GraphFile(tempDir + "/graph.bin"),
+        std::runtime_error);
+}
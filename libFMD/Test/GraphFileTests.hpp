@@ -0,0 +1,29 @@
+#ifndef GRAPHFILETESTS_HPP
+#define GRAPHFILETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for GraphFile.
+ */
+class GraphFileTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(GraphFileTests);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to save graphs in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRoundTrip();
+    void testBadFile();
+};
+
+#endif
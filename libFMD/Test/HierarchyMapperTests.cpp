@@ -0,0 +1,166 @@
+// Test mapping to every level of a hierarchy with one search.
+
+#include <vector>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../FMDIndexView.hpp"
+#include "../HierarchyMapper.hpp"
+#include "../MatchingStatistics.hpp"
+#include "../util.hpp"
+
+#include "HierarchyMapperTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( HierarchyMapperTests );
+
+// Define constants
+const std::string HierarchyMapperTests::filename = "Test/haplotypes.fa";
+
+void HierarchyMapperTests::setUp() {
+    // Build an index of the haplotypes in a temporary directory.
+    tempDir = make_tempdir();
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    // Load it without the full SA.
+    index = new FMDIndex(tempDir + "/index.basename");
+    
+    // Lump every 4 BWT positions together.
+    ranges = new GenericBitVector();
+    for(size_t i = 0; i < index->getBWTLength(); i += 4) {
+        ranges->addBit(i);
+    }
+    ranges->finish(index->getBWTLength());
+}
+
+
+void HierarchyMapperTests::tearDown() {
+    delete ranges;
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure mapping to all the levels at once gives the same Mappings as
+ * searching each level by itself.
+ */
+void HierarchyMapperTests::testMatchesEachLevel() {
+    FMDIndexView bottom(*index);
+    FMDIndexView merged(*index, nullptr, ranges);
+    std::vector<const FMDIndexView*> levels = {&bottom, &merged};
+    
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    auto mappings = HierarchyMapper::mapHierarchy(query, levels);
+    CPPUNIT_ASSERT_EQUAL(levels.size(), mappings.size());
+    
+    for(size_t level = 0; level < levels.size(); level++) {
+        CPPUNIT_ASSERT_EQUAL(query.size(), mappings[level].size());
+        
+        // Do the search again on just this level.
+        MatchingStatistics statistics(*levels[level], query, true, false);
+        const auto& contexts = statistics.getContexts();
+        
+        for(size_t i = 0; i < query.size(); i++) {
+            const FMDPosition& context = contexts[i].first;
+            if(context.isUnique(*levels[level])) {
+                CPPUNIT_ASSERT(mappings[level][i].isMapped());
+                CPPUNIT_ASSERT_EQUAL(context.getTextPosition(*levels[level]),
+                    mappings[level][i].getLocation());
+                CPPUNIT_ASSERT_EQUAL(contexts[i].second,
+                    mappings[level][i].getRightMaxContext());
+            } else {
+                CPPUNIT_ASSERT(!mappings[level][i].isMapped());
+            }
+        }
+    }
+    
+    // The bottom level maps the middle of the first contig.
+    CPPUNIT_ASSERT(mappings[0][10].isMapped());
+    CPPUNIT_ASSERT_EQUAL(TextPosition(0, 10), mappings[0][10].getLocation());
+}
+
+/**
+ * Make sure bases without enough context don't map on any level.
+ */
+void HierarchyMapperTests::testMinContext() {
+    FMDIndexView bottom(*index);
+    FMDIndexView merged(*index, nullptr, ranges);
+    std::vector<const FMDIndexView*> levels = {&bottom, &merged};
+    
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    auto all = HierarchyMapper::mapHierarchy(query, levels);
+    auto some = HierarchyMapper::mapHierarchy(query, levels, 20);
+    
+    for(size_t level = 0; level < levels.size(); level++) {
+        for(size_t i = 0; i < query.size(); i++) {
+            if(all[level][i].isMapped() &&
+                all[level][i].getRightMaxContext() >= 20) {
+                
+                CPPUNIT_ASSERT(some[level][i] == all[level][i]);
+            } else {
+                CPPUNIT_ASSERT(!some[level][i].isMapped());
+            }
+        }
+    }
+    
+    // Nothing near the end of the query has 20 bases of context.
+    CPPUNIT_ASSERT(!some[0][query.size() - 1].isMapped());
+}
+
+/**
+ * Make sure levels that would need different searches are refused.
+ */
+void HierarchyMapperTests::testMismatchedMasks() {
+    // Mask in every other position.
+    GenericBitVector mask;
+    for(size_t i = 0; i < index->getBWTLength(); i += 2) {
+        mask.addBit(i);
+    }
+    mask.finish(index->getBWTLength());
+    
+    FMDIndexView bottom(*index);
+    FMDIndexView masked(*index, &mask);
+    std::vector<const FMDIndexView*> levels = {&bottom, &masked};
+    
+    CPPUNIT_ASSERT_THROW(HierarchyMapper::mapHierarchy("CATGCTTCGG", levels),
+        std::runtime_error);
+}
+
+/**
+ * Make sure packed Sides come out level by level, and agree with the Mappings.
+ */
+void HierarchyMapperTests::testMapSides() {
+    // Map to the bottom level twice.
+    HierarchyMapper mapper(*index, {"", ""});
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, mapper.getNumberOfLevels());
+    
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    std::vector<long long> sides(query.size() * 2);
+    size_t mapped = mapper.mapSides(query, sides.data(), sides.size());
+    
+    FMDIndexView bottom(*index);
+    auto mappings = HierarchyMapper::mapHierarchy(query, {&bottom});
+    
+    size_t expectedMapped = 0;
+    for(size_t i = 0; i < query.size(); i++) {
+        if(mappings[0][i].isMapped()) {
+            // Forward strand bases map to their left faces.
+            CPPUNIT_ASSERT_EQUAL((long long) index->getBaseID(
+                mappings[0][i].getLocation()) << 1, sides[i]);
+            expectedMapped++;
+        } else {
+            CPPUNIT_ASSERT_EQUAL(-1LL, sides[i]);
+        }
+        // Both levels are the same.
+        CPPUNIT_ASSERT_EQUAL(sides[i], sides[query.size() + i]);
+    }
+    CPPUNIT_ASSERT_EQUAL(expectedMapped * 2, mapped);
+    
+    // There has to be room for every level.
+    CPPUNIT_ASSERT_THROW(mapper.mapSides(query, sides.data(), query.size()),
+        std::runtime_error);
+}
@@ -0,0 +1,44 @@
+#ifndef HIERARCHYMAPPERTESTS_HPP
+#define HIERARCHYMAPPERTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+#include "../GenericBitVector.hpp"
+
+/**
+ * Tests for HierarchyMapper.
+ */
+class HierarchyMapperTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(HierarchyMapperTests);
+    CPPUNIT_TEST(testMatchesEachLevel);
+    CPPUNIT_TEST(testMinContext);
+    CPPUNIT_TEST(testMismatchedMasks);
+    CPPUNIT_TEST(testMapSides);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes to test with.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index to map to.
+    FMDIndex const* index;
+    
+    // Holds merged ranges of 4 BWT positions each, for an upper level.
+    GenericBitVector* ranges;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testMatchesEachLevel();
+    void testMinContext();
+    void testMismatchedMasks();
+    void testMapSides();
+};
+
+#endif
@@ -0,0 +1,51 @@
+// Test asking for huge pages.
+
+#include <vector>
+
+#include "../HugePages.hpp"
+
+#include "HugePagesTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( HugePagesTests );
+
+void HugePagesTests::setUp() {
+    // Huge pages can't be turned off again, but they don't change how anything
+    // works.
+    HugePages::enable();
+}
+
+
+void HugePagesTests::tearDown() {
+    // Nothing to do
+}
+
+/**
+ * Make sure memory too small to hold a huge page isn't advised.
+ */
+void HugePagesTests::testAdviseSmall() {
+    std::vector<char> memory(4096);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, HugePages::advise(memory.data(),
+        memory.size()));
+}
+
+/**
+ * Make sure only whole huge pages inside big memory are advised, and that they
+ * are counted.
+ */
+void HugePagesTests::testAdviseLarge() {
+    std::vector<char> memory(8 * 1024 * 1024);
+    
+    size_t before = HugePages::getAdvisedBytes();
+    size_t advised = HugePages::advise(memory.data(), memory.size());
+    
+    // The kernel may not have huge pages at all, but if it does at least one
+    // whole one fits.
+    CPPUNIT_ASSERT(advised <= memory.size());
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, advised % (2 * 1024 * 1024));
+    CPPUNIT_ASSERT_EQUAL(before + advised, HugePages::getAdvisedBytes());
+    
+    // The memory still works the same.
+    memory[memory.size() - 1] = 'A';
+    CPPUNIT_ASSERT_EQUAL('A', memory.back());
+}
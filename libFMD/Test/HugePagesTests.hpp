@@ -0,0 +1,23 @@
+#ifndef HUGEPAGESTESTS_HPP
+#define HUGEPAGESTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for backing memory with huge pages.
+ */
+class HugePagesTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(HugePagesTests);
+    CPPUNIT_TEST(testAdviseSmall);
+    CPPUNIT_TEST(testAdviseLarge);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testAdviseSmall();
+    void testAdviseLarge();
+};
+
+#endif
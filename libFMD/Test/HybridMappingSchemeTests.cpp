@@ -0,0 +1,163 @@
+// Test mapping exactly first and with mismatches after.
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../HybridMappingScheme.hpp"
+#include "../ZipMappingScheme.hpp"
+#include "../util.hpp"
+
+#include "HybridMappingSchemeTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( HybridMappingSchemeTests );
+
+// Define constants
+const std::string HybridMappingSchemeTests::filename = "Test/duplicated.fa";
+
+void HybridMappingSchemeTests::setUp() {
+    // Build an index in a temporary directory, and load it without the full
+    // SA.
+    tempDir = make_tempdir();
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    index = new FMDIndex(tempDir + "/index.basename");
+    
+    // Only map to the second copy, so everything can be unique.
+    mask = new GenericBitVector();
+    for(size_t i = 0; i < index->getBWTLength(); i++) {
+        if(index->locate(i).getContigNumber() == 1) {
+            mask->addBit(i);
+        }
+    }
+    mask->finish(index->getBWTLength());
+}
+
+
+void HybridMappingSchemeTests::tearDown() {
+    delete mask;
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make a hybrid of exact and mismatch-tolerant zip mapping to the masked-in
+ * contig.
+ */
+static HybridMappingScheme* makeHybrid(const FMDIndex& index,
+    const GenericBitVector* mask) {
+    
+    auto fallback = new ZipMappingScheme<FMDPositionGroup>(FMDIndexView(index,
+        mask));
+    fallback->mismatchTolerance = 1;
+    fallback->minUniqueStrings = 2;
+    
+    return new HybridMappingScheme(
+        new ZipMappingScheme<FMDPosition>(FMDIndexView(index, mask)),
+        fallback);
+}
+
+/**
+ * Make sure a query that maps exactly maps the same way, without the fallback
+ * scheme.
+ */
+void HybridMappingSchemeTests::testExactOnly() {
+    std::unique_ptr<HybridMappingScheme> hybrid(makeHybrid(*index, mask));
+    
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    size_t mappedBases = 0;
+    hybrid->map(query, [&](size_t i, TextPosition mappedTo) {
+        CPPUNIT_ASSERT_EQUAL((size_t) 2, mappedTo.getText());
+        CPPUNIT_ASSERT_EQUAL(i, mappedTo.getOffset());
+        mappedBases++;
+    });
+    CPPUNIT_ASSERT_EQUAL(query.size(), mappedBases);
+    
+    // The fallback scheme never got used.
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, hybrid->getStats()["fallbackBases"]);
+    CPPUNIT_ASSERT_EQUAL(query.size(), hybrid->getStats()["exactMapped"]);
+}
+
+/**
+ * Make sure bases that don't map exactly get mapped with mismatches, and bases
+ * that do keep their exact mappings.
+ */
+void HybridMappingSchemeTests::testFallback() {
+    std::unique_ptr<HybridMappingScheme> hybrid(makeHybrid(*index, mask));
+    
+    // Introduce mismatches at 6 and 31.
+    //                         v                        v
+    std::string query = "CATGCTCCGGCGATTCGACGCTCATCTGCGAATCT";
+    
+    // See what each scheme does on its own.
+    std::map<size_t, TextPosition> exact;
+    hybrid->getExact().map(query, [&](size_t i, TextPosition mappedTo) {
+        exact[i] = mappedTo;
+    });
+    std::map<size_t, TextPosition> fallback;
+    hybrid->getFallback().map(query, [&](size_t i, TextPosition mappedTo) {
+        fallback[i] = mappedTo;
+    });
+    
+    // The query is shorter than the fallback context, so the fallback scheme
+    // sees all of it, and every base it maps that didn't map exactly should
+    // map the same way.
+    std::map<size_t, TextPosition> expected = exact;
+    expected.insert(fallback.begin(), fallback.end());
+    
+    std::map<size_t, TextPosition> found;
+    hybrid->map(query, [&](size_t i, TextPosition mappedTo) {
+        found[i] = mappedTo;
+    });
+    
+    CPPUNIT_ASSERT(found == expected);
+    CPPUNIT_ASSERT(exact.size() < found.size());
+    CPPUNIT_ASSERT_EQUAL(found.size() - exact.size(),
+        hybrid->getStats()["fallbackMapped"]);
+}
+
+/**
+ * Make sure the fallback scheme only searches near the bases that didn't map.
+ */
+void HybridMappingSchemeTests::testWindows() {
+    std::unique_ptr<HybridMappingScheme> hybrid(makeHybrid(*index, mask));
+    hybrid->fallbackContext = 2;
+    
+    // Only one base is off.
+    //                         v
+    std::string query = "CATGCTCCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    size_t exactBases = 0;
+    hybrid->getExact().map(query, [&](size_t i, TextPosition mappedTo) {
+        exactBases++;
+    });
+    CPPUNIT_ASSERT(exactBases < query.size());
+    
+    size_t mappedBases = 0;
+    hybrid->map(query, [&](size_t i, TextPosition mappedTo) {
+        mappedBases++;
+    });
+    CPPUNIT_ASSERT(mappedBases >= exactBases);
+    
+    // The unmapped bases, and context around them, got searched, but not the
+    // whole query.
+    size_t searched = hybrid->getStats()["fallbackBases"];
+    CPPUNIT_ASSERT(searched >= query.size() - exactBases);
+    CPPUNIT_ASSERT(searched < query.size());
+}
+
+/**
+ * Make sure we can't make a hybrid without both schemes.
+ */
+void HybridMappingSchemeTests::testNoSchemes() {
+    CPPUNIT_ASSERT_THROW(HybridMappingScheme(nullptr, nullptr),
+        std::runtime_error);
+    CPPUNIT_ASSERT_THROW(HybridMappingScheme(
+        new ZipMappingScheme<FMDPosition>(FMDIndexView(*index)), nullptr),
+        std::runtime_error);
+}
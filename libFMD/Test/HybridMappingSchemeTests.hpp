@@ -0,0 +1,44 @@
+#ifndef HYBRIDMAPPINGSCHEMETESTS_HPP
+#define HYBRIDMAPPINGSCHEMETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+#include "../GenericBitVector.hpp"
+
+/**
+ * Tests for mapping exactly first and with mismatches after.
+ */
+class HybridMappingSchemeTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(HybridMappingSchemeTests);
+    CPPUNIT_TEST(testExactOnly);
+    CPPUNIT_TEST(testFallback);
+    CPPUNIT_TEST(testWindows);
+    CPPUNIT_TEST(testNoSchemes);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the sequences to test with.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index.
+    FMDIndex const* index;
+    
+    // Holds a mask selecting only the second copy of the duplicated contig.
+    GenericBitVector* mask;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testExactOnly();
+    void testFallback();
+    void testWindows();
+    void testNoSchemes();
+};
+
+#endif
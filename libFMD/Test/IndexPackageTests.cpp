@@ -0,0 +1,126 @@
+// Test packing index directories into single files.
+
+#include <fstream>
+#include <sstream>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "../IndexPackage.hpp"
+#include "../util.hpp"
+
+#include "IndexPackageTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( IndexPackageTests );
+
+/**
+ * Save the given data to the given file.
+ */
+static void writeFile(const std::string& filename, const std::string& data) {
+    std::ofstream file(filename, std::ios::binary);
+    file << data;
+}
+
+/**
+ * Load the whole of the given file.
+ */
+static std::string readFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    std::stringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+void IndexPackageTests::setUp() {
+    tempDir = make_tempdir();
+    
+    // Make an index directory with a file that compresses, one that doesn't,
+    // and an empty one, all of which span blocks differently.
+    boost::filesystem::create_directory(tempDir + "/index");
+    
+    std::string repetitive;
+    while(repetitive.size() < IndexPackage::BLOCK_SIZE * 2 + 1000) {
+        repetitive += "GATTACA";
+    }
+    writeFile(tempDir + "/index/index.basename.lcp", repetitive);
+    
+    std::mt19937 random(1);
+    std::string noise(IndexPackage::BLOCK_SIZE + 10, '\0');
+    for(char& c : noise) {
+        c = (char) random();
+    }
+    writeFile(tempDir + "/index/index.basename.bwt", noise);
+    
+    writeFile(tempDir + "/index/index.basename.end", "");
+    
+    // Subdirectories don't go in the package.
+    boost::filesystem::create_directory(tempDir + "/index/checkpoint");
+}
+
+
+void IndexPackageTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure we get back the files we packed, and that the package is smaller.
+ */
+void IndexPackageTests::testRoundTrip() {
+    IndexPackage::pack(tempDir + "/index", tempDir + "/index.pack");
+    
+    std::vector<std::string> names = IndexPackage::list(tempDir +
+        "/index.pack");
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, names.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("index.basename.bwt"), names[0]);
+    CPPUNIT_ASSERT_EQUAL(std::string("index.basename.lcp"), names[2]);
+    
+    // The repetitive file should have shrunk a lot, and the noise not grown.
+    CPPUNIT_ASSERT(boost::filesystem::file_size(tempDir + "/index.pack") <
+        IndexPackage::BLOCK_SIZE * 3 / 2);
+    
+    IndexPackage::unpack(tempDir + "/index.pack", tempDir + "/unpacked");
+    for(const std::string& name : names) {
+        CPPUNIT_ASSERT(readFile(tempDir + "/index/" + name) ==
+            readFile(tempDir + "/unpacked/" + name));
+    }
+    CPPUNIT_ASSERT(!boost::filesystem::exists(tempDir +
+        "/unpacked/checkpoint"));
+    
+    // Packing again into the directory itself leaves the old package out.
+    IndexPackage::pack(tempDir + "/unpacked", tempDir + "/unpacked/pack");
+    IndexPackage::pack(tempDir + "/unpacked", tempDir + "/unpacked/pack");
+    CPPUNIT_ASSERT_EQUAL((size_t) 3,
+        IndexPackage::list(tempDir + "/unpacked/pack").size());
+}
+
+/**
+ * Make sure damage to a block is noticed when unpacking.
+ */
+void IndexPackageTests::testDamaged() {
+    IndexPackage::pack(tempDir + "/index", tempDir + "/index.pack");
+    
+    // Flip a bit in the first block, which is raw noise.
+    std::string data = readFile(tempDir + "/index.pack");
+    data[100] ^= 1;
+    writeFile(tempDir + "/index.pack", data);
+    
+    CPPUNIT_ASSERT_THROW(IndexPackage::unpack(tempDir + "/index.pack",
+        tempDir + "/unpacked"), std::runtime_error);
+}
+
+/**
+ * Make sure files that aren't packages, or are cut short, are rejected.
+ */
+void IndexPackageTests::testBadFile() {
+    writeFile(tempDir + "/garbage.pack", "This is not an index package.");
+    CPPUNIT_ASSERT_THROW(IndexPackage::list(tempDir + "/garbage.pack"),
+        std::runtime_error);
+    
+    IndexPackage::pack(tempDir + "/index", tempDir + "/index.pack");
+    std::string data = readFile(tempDir + "/index.pack");
+    data.resize(data.size() - 100);
+    writeFile(tempDir + "/index.pack", data);
+    CPPUNIT_ASSERT_THROW(IndexPackage::unpack(tempDir + "/index.pack",
+        tempDir + "/unpacked"), std::runtime_error);
+}
@@ -0,0 +1,31 @@
+#ifndef INDEXPACKAGETESTS_HPP
+#define INDEXPACKAGETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for IndexPackage.
+ */
+class IndexPackageTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(IndexPackageTests);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testDamaged);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to pack and unpack in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRoundTrip();
+    void testDamaged();
+    void testBadFile();
+};
+
+#endif
@@ -0,0 +1,68 @@
+// Test warming up index files.
+
+#include <fstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "../IndexWarmer.hpp"
+#include "../util.hpp"
+
+#include "IndexWarmerTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( IndexWarmerTests );
+
+void IndexWarmerTests::setUp() {
+    tempDir = make_tempdir();
+    
+    // Make a file that takes a few reads, and one that takes none.
+    std::ofstream big(tempDir + "/index.basename.lcp", std::ios::binary);
+    std::vector<char> data(IndexWarmer::READ_SIZE * 2 + 100, 'A');
+    big.write(data.data(), data.size());
+    std::ofstream empty(tempDir + "/index.basename.mus", std::ios::binary);
+}
+
+
+void IndexWarmerTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure every byte of every file gets read.
+ */
+void IndexWarmerTests::testWarmAll() {
+    IndexWarmer warmer({tempDir + "/index.basename.mus",
+        tempDir + "/index.basename.lcp"});
+    warmer.join();
+    
+    CPPUNIT_ASSERT(warmer.isDone());
+    CPPUNIT_ASSERT_EQUAL(IndexWarmer::READ_SIZE * 2 + 100,
+        warmer.getTotalBytes());
+    CPPUNIT_ASSERT_EQUAL(warmer.getTotalBytes(), warmer.getWarmedBytes());
+}
+
+/**
+ * Make sure files that aren't there are skipped.
+ */
+void IndexWarmerTests::testSkipMissing() {
+    IndexWarmer warmer({tempDir + "/nonexistent",
+        tempDir + "/index.basename.lcp"});
+    warmer.join();
+    
+    CPPUNIT_ASSERT(warmer.isDone());
+    CPPUNIT_ASSERT_EQUAL(IndexWarmer::READ_SIZE * 2 + 100,
+        warmer.getWarmedBytes());
+}
+
+/**
+ * Make sure only the index files that exist are found, in priority order.
+ */
+void IndexWarmerTests::testIndexFiles() {
+    std::vector<std::string> files = IndexWarmer::getIndexFiles(tempDir +
+        "/index.basename");
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, files.size());
+    CPPUNIT_ASSERT_EQUAL(tempDir + "/index.basename.mus", files[0]);
+    CPPUNIT_ASSERT_EQUAL(tempDir + "/index.basename.lcp", files[1]);
+}
@@ -0,0 +1,30 @@
+#ifndef INDEXWARMERTESTS_HPP
+#define INDEXWARMERTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for warming up index files.
+ */
+class IndexWarmerTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(IndexWarmerTests);
+    CPPUNIT_TEST(testWarmAll);
+    CPPUNIT_TEST(testSkipMissing);
+    CPPUNIT_TEST(testIndexFiles);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Holds a temporary directory to put files in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testWarmAll();
+    void testSkipMissing();
+    void testIndexFiles();
+};
+
+#endif
@@ -6,6 +6,8 @@
 
 #include <vector>
 #include <string>
+#include <random>
+#include <stdexcept>
 
 // We want string literals! Unfortunately they're in c++14. So we make our own.
 std::string operator""_s(const char* string, size_t len) {
@@ -180,3 +182,159 @@ void IntervalIndexTests::testLookupEndingBefore() {
     // And we can go off the end
     CPPUNIT_ASSERT_EQUAL("Corey"_s, index.getEndingBefore(100).second);
 }
+
+/**
+ * Make sure the Eytzinger and binary search layouts and the batch queries all
+ * agree on lots of random intervals.
+ */
+void IntervalIndexTests::testLayoutsAgree() {
+    std::mt19937 generator(1);
+    
+    std::vector<std::pair<std::pair<size_t, size_t>, size_t>> data;
+    for(size_t i = 0; i < 1000; i++) {
+        // Make intervals with repeated starts and ends.
+        data.push_back({{generator() % 5000, generator() % 20 + 1}, i});
+    }
+    
+    IntervalIndex<size_t> eytzinger(data, true);
+    IntervalIndex<size_t> sorted(data, false);
+    
+    // Query every position, and some off the end.
+    std::vector<size_t> queries;
+    for(size_t i = 0; i < 5100; i++) {
+        queries.push_back(i);
+    }
+    
+    auto startingBefore = eytzinger.getStartingBefore(queries);
+    auto endingBefore = eytzinger.getEndingBefore(queries);
+    auto startingAfter = eytzinger.getStartingAfter(queries);
+    auto endingAfter = eytzinger.getEndingAfter(queries);
+    
+    for(size_t i : queries) {
+        CPPUNIT_ASSERT_EQUAL(sorted.hasStartingBefore(i),
+            eytzinger.hasStartingBefore(i));
+        CPPUNIT_ASSERT_EQUAL(eytzinger.hasStartingBefore(i),
+            startingBefore[i] != NULL);
+        if(startingBefore[i] != NULL) {
+            CPPUNIT_ASSERT(sorted.getStartingBefore(i) ==
+                eytzinger.getStartingBefore(i));
+            CPPUNIT_ASSERT(*startingBefore[i] == eytzinger.getStartingBefore(i));
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(sorted.hasEndingBefore(i),
+            eytzinger.hasEndingBefore(i));
+        CPPUNIT_ASSERT_EQUAL(eytzinger.hasEndingBefore(i),
+            endingBefore[i] != NULL);
+        if(endingBefore[i] != NULL) {
+            CPPUNIT_ASSERT(sorted.getEndingBefore(i) ==
+                eytzinger.getEndingBefore(i));
+            CPPUNIT_ASSERT(*endingBefore[i] == eytzinger.getEndingBefore(i));
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(sorted.hasStartingAfter(i),
+            eytzinger.hasStartingAfter(i));
+        CPPUNIT_ASSERT_EQUAL(eytzinger.hasStartingAfter(i),
+            startingAfter[i] != NULL);
+        if(startingAfter[i] != NULL) {
+            CPPUNIT_ASSERT(sorted.getStartingAfter(i) ==
+                eytzinger.getStartingAfter(i));
+            CPPUNIT_ASSERT(*startingAfter[i] == eytzinger.getStartingAfter(i));
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(sorted.hasEndingAfter(i),
+            eytzinger.hasEndingAfter(i));
+        CPPUNIT_ASSERT_EQUAL(eytzinger.hasEndingAfter(i),
+            endingAfter[i] != NULL);
+        if(endingAfter[i] != NULL) {
+            CPPUNIT_ASSERT(sorted.getEndingAfter(i) ==
+                eytzinger.getEndingAfter(i));
+            CPPUNIT_ASSERT(*endingAfter[i] == eytzinger.getEndingAfter(i));
+        }
+    }
+    
+    // Unsorted batches aren't allowed.
+    CPPUNIT_ASSERT_THROW(eytzinger.getStartingBefore(
+        std::vector<size_t>{5, 3}), std::runtime_error);
+}
+
+/**
+ * Make sure indexes of every size up to past where the Eytzinger trees start
+ * being used answer queries the same as looking through all the intervals.
+ */
+void IntervalIndexTests::testSmallIndexes() {
+    std::mt19937 generator(2);
+    
+    for(size_t size = 0; size < IntervalIndex<size_t>::EYTZINGER_MIN_SIZE + 10;
+        size += 7) {
+        
+        std::vector<std::pair<std::pair<size_t, size_t>, size_t>> data;
+        for(size_t i = 0; i < size; i++) {
+            data.push_back({{generator() % 500, generator() % 10 + 1}, i});
+        }
+        
+        // Build one from a copy and one by moving.
+        IntervalIndex<size_t> copied(data);
+        auto toMove = data;
+        IntervalIndex<size_t> moved(std::move(toMove));
+        CPPUNIT_ASSERT_EQUAL(size, copied.size());
+        CPPUNIT_ASSERT_EQUAL(size, moved.size());
+        
+        for(size_t i = 0; i < 520; i++) {
+            // Work out where the answers ought to start and end.
+            bool startBefore = false;
+            bool endBefore = false;
+            bool startAfter = false;
+            bool endAfter = false;
+            size_t latestStart = 0;
+            size_t latestEnd = 0;
+            size_t earliestStart = 0;
+            size_t earliestEnd = 0;
+            for(const auto& record : data) {
+                size_t start = record.first.first;
+                size_t end = start + record.first.second - 1;
+                if(start <= i && (!startBefore || start > latestStart)) {
+                    startBefore = true;
+                    latestStart = start;
+                }
+                if(end <= i && (!endBefore || end > latestEnd)) {
+                    endBefore = true;
+                    latestEnd = end;
+                }
+                if(start >= i && (!startAfter || start < earliestStart)) {
+                    startAfter = true;
+                    earliestStart = start;
+                }
+                if(end >= i && (!endAfter || end < earliestEnd)) {
+                    endAfter = true;
+                    earliestEnd = end;
+                }
+            }
+            
+            for(const IntervalIndex<size_t>* index : {&copied, &moved}) {
+                CPPUNIT_ASSERT_EQUAL(startBefore, index->hasStartingBefore(i));
+                CPPUNIT_ASSERT_EQUAL(endBefore, index->hasEndingBefore(i));
+                CPPUNIT_ASSERT_EQUAL(startAfter, index->hasStartingAfter(i));
+                CPPUNIT_ASSERT_EQUAL(endAfter, index->hasEndingAfter(i));
+                
+                if(startBefore) {
+                    CPPUNIT_ASSERT_EQUAL(latestStart,
+                        index->getStartingBefore(i).first.first);
+                }
+                if(endBefore) {
+                    const auto& found = index->getEndingBefore(i);
+                    CPPUNIT_ASSERT_EQUAL(latestEnd,
+                        found.first.first + found.first.second - 1);
+                }
+                if(startAfter) {
+                    CPPUNIT_ASSERT_EQUAL(earliestStart,
+                        index->getStartingAfter(i).first.first);
+                }
+                if(endAfter) {
+                    const auto& found = index->getEndingAfter(i);
+                    CPPUNIT_ASSERT_EQUAL(earliestEnd,
+                        found.first.first + found.first.second - 1);
+                }
+            }
+        }
+    }
+}
@@ -15,6 +15,8 @@ class IntervalIndexTests : public CppUnit::TestFixture {
     CPPUNIT_TEST(testLookupStartingAfter);
     CPPUNIT_TEST(testLookupEndingAfter);
     CPPUNIT_TEST(testLookupEndingBefore);
+    CPPUNIT_TEST(testLayoutsAgree);
+    CPPUNIT_TEST(testSmallIndexes);
     CPPUNIT_TEST_SUITE_END();
     
 public:
@@ -26,6 +28,8 @@ public:
     void testLookupStartingAfter();
     void testLookupEndingAfter();
     void testLookupEndingBefore();
+    void testLayoutsAgree();
+    void testSmallIndexes();
 };
 
 #endif
@@ -0,0 +1,229 @@
+// Test the compressed LCP array.
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <random>
+#include <set>
+#include <tuple>
+
+#include "../LCPArray.hpp"
+#include "../util.hpp"
+
+#include "LCPArrayTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( LCPArrayTests );
+
+void LCPArrayTests::setUp() {
+}
+
+
+void LCPArrayTests::tearDown() {
+}
+
+/**
+ * Make some LCP-like values, with long runs and some too big for a byte.
+ */
+static std::vector<size_t> makeValues(size_t length) {
+    std::mt19937 generator(length);
+    std::vector<size_t> values;
+    for(size_t i = 0; i < length; i++) {
+        switch(generator() % 4) {
+        case 0:
+            // Small values
+            values.push_back(generator() % 10);
+            break;
+        case 1:
+            // Big values
+            values.push_back(200 + generator() % 1000);
+            break;
+        default:
+            // Climbs, so smaller values are far away.
+            values.push_back(i == 0 ? 1 : values.back() + 1);
+            break;
+        }
+    }
+    return values;
+}
+
+/**
+ * Make sure previous and next smaller values are found right.
+ */
+void LCPArrayTests::testSmallerValues() {
+    for(size_t length : {1, 2, 63, 64, 65, 1000, 5000}) {
+        std::vector<size_t> values = makeValues(length);
+        LCPArray lcp(values);
+        CPPUNIT_ASSERT_EQUAL(length, lcp.getSize());
+        
+        for(size_t i = 0; i < length; i++) {
+            CPPUNIT_ASSERT_EQUAL(values[i], lcp[i]);
+            
+            // Find the PSV and NSV the slow way.
+            size_t psv = 0;
+            for(size_t j = i - 1; j != (size_t) -1; j--) {
+                if(values[j] < values[i]) {
+                    psv = j;
+                    break;
+                }
+            }
+            size_t nsv = length;
+            for(size_t j = i + 1; j < length; j++) {
+                if(values[j] < values[i]) {
+                    nsv = j;
+                    break;
+                }
+            }
+            
+            CPPUNIT_ASSERT_EQUAL(psv, lcp.getPSV(i));
+            CPPUNIT_ASSERT_EQUAL(nsv, lcp.getNSV(i));
+        }
+    }
+}
+
+/**
+ * Make sure LCP arrays can be saved and loaded, in both the current and the
+ * old uncompressed format.
+ */
+void LCPArrayTests::testSaveLoad() {
+    std::string tempDir = make_tempdir();
+    std::vector<size_t> values = makeValues(3000);
+    
+    // Save and reload in the current format.
+    LCPArray(values).save(tempDir + "/new.lcp");
+    LCPArray loaded(tempDir + "/new.lcp");
+    
+    // Write out the old format by hand: size, values, PSVs, and NSVs. The
+    // PSVs and NSVs are ignored, so they don't need to be right.
+    std::ofstream oldFile(tempDir + "/old.lcp", std::ofstream::binary);
+    size_t length = values.size();
+    oldFile.write((const char*) &length, sizeof(size_t));
+    for(size_t copy = 0; copy < 3; copy++) {
+        oldFile.write((const char*) values.data(), length * sizeof(size_t));
+    }
+    oldFile.close();
+    LCPArray converted(tempDir + "/old.lcp");
+    
+    LCPArray original(values);
+    for(size_t i = 0; i < length; i++) {
+        CPPUNIT_ASSERT_EQUAL(values[i], loaded[i]);
+        CPPUNIT_ASSERT_EQUAL(values[i], converted[i]);
+        CPPUNIT_ASSERT_EQUAL(original.getPSV(i), loaded.getPSV(i));
+        CPPUNIT_ASSERT_EQUAL(original.getNSV(i), loaded.getNSV(i));
+        CPPUNIT_ASSERT_EQUAL(original.getPSV(i), converted.getPSV(i));
+        CPPUNIT_ASSERT_EQUAL(original.getNSV(i), converted.getNSV(i));
+    }
+    
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure building from the BWT alone gets the same values as building from
+ * the suffix array and texts.
+ */
+void LCPArrayTests::testFromBWT() {
+    std::string tempDir = make_tempdir();
+    
+    // Make some texts with long shared stretches, including an exact repeat
+    // of a whole text, so some LCPs don't fit in a byte. Make them long
+    // enough that building from the BWT in several threads actually uses
+    // them.
+    std::mt19937 generator(0);
+    std::string random;
+    for(size_t i = 0; i < 6000; i++) {
+        random.push_back(ALPHABETICAL_BASES[generator() % 4]);
+    }
+    std::string mutated = random;
+    mutated[3000] = (mutated[3000] == 'A') ? 'C' : 'A';
+    
+    ReadTable texts;
+    for(const std::string& sequence : {random, mutated,
+        random.substr(100, 50), random}) {
+        
+        SeqItem item;
+        item.id = "text";
+        item.seq = sequence;
+        texts.addRead(item);
+    }
+    
+    // Make the suffix array and BWT.
+    SuffixArray suffixArray(&texts, 1, true);
+    suffixArray.writeBWT(tempDir + "/texts.bwt", &texts);
+    BWT bwt(tempDir + "/texts.bwt");
+    
+    LCPArray fromSuffixArray(suffixArray, texts);
+    LCPArray fromBWT(bwt);
+    LCPArray fromBWTThreaded(bwt, 4);
+    
+    CPPUNIT_ASSERT_EQUAL(fromSuffixArray.getSize(), fromBWT.getSize());
+    CPPUNIT_ASSERT_EQUAL(fromSuffixArray.getSize(), fromBWTThreaded.getSize());
+    for(size_t i = 0; i < fromSuffixArray.getSize(); i++) {
+        CPPUNIT_ASSERT_EQUAL(fromSuffixArray[i], fromBWT[i]);
+        CPPUNIT_ASSERT_EQUAL(fromSuffixArray.getNSV(i), fromBWT.getNSV(i));
+        CPPUNIT_ASSERT_EQUAL(fromSuffixArray[i], fromBWTThreaded[i]);
+    }
+    
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure the bottom-up scan finds every LCP interval, with the right
+ * children.
+ */
+void LCPArrayTests::testIntervals() {
+    for(size_t length : {1, 2, 63, 64, 65, 300}) {
+        std::vector<size_t> values = makeValues(length);
+        LCPArray lcp(values);
+        
+        typedef std::tuple<size_t, size_t, size_t, std::vector<size_t>>
+            Interval;
+        
+        // Find all the intervals.
+        std::set<Interval> found;
+        size_t lastEnd = 0;
+        lcp.forEachInterval([&](const LCPInterval& interval) {
+            // Nothing should come up twice.
+            CPPUNIT_ASSERT(found.insert(Interval(interval.depth,
+                interval.start, interval.end, interval.childStarts)).second);
+            lastEnd = interval.end;
+        });
+        
+        // The root must come last.
+        CPPUNIT_ASSERT_EQUAL(length - 1, lastEnd);
+        
+        // Find them the slow way. Every run of at least two suffixes that
+        // can't be extended without dropping the shared value is one.
+        std::set<Interval> expected;
+        for(size_t start = 0; start < length; start++) {
+            size_t depth = (size_t) -1;
+            for(size_t end = start + 1; end < length; end++) {
+                depth = std::min(depth, values[end]);
+                if((start > 0 && values[start] >= depth) ||
+                    (end + 1 < length && values[end + 1] >= depth)) {
+                    
+                    continue;
+                }
+                std::vector<size_t> childStarts = {start};
+                for(size_t i = start + 1; i <= end; i++) {
+                    if(values[i] == depth) {
+                        childStarts.push_back(i);
+                    }
+                }
+                expected.insert(Interval(depth, start, end, childStarts));
+            }
+        }
+        
+        bool haveRoot = false;
+        for(const Interval& interval : expected) {
+            if(std::get<0>(interval) == 0 && std::get<1>(interval) == 0 &&
+                std::get<2>(interval) == length - 1) {
+                haveRoot = true;
+            }
+        }
+        if(!haveRoot) {
+            // Everything shares something, but there's still a root.
+            expected.insert(Interval(0, 0, length - 1, {0}));
+        }
+        
+        CPPUNIT_ASSERT(found == expected);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef LCPARRAYTESTS_HPP
+#define LCPARRAYTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for the LCPArray.
+ */
+class LCPArrayTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LCPArrayTests);
+    CPPUNIT_TEST(testSmallerValues);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testFromBWT);
+    CPPUNIT_TEST(testIntervals);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testSmallerValues();
+    void testSaveLoad();
+    void testFromBWT();
+    void testIntervals();
+};
+
+#endif
@@ -0,0 +1,147 @@
+// Test saving and loading merged levels.
+
+#include <fstream>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../FMDIndexView.hpp"
+#include "../LevelIndex.hpp"
+#include "../LevelSideArray.hpp"
+#include "../util.hpp"
+
+#include "LevelIndexTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( LevelIndexTests );
+
+// Define constants
+const std::string LevelIndexTests::filename = "Test/duplicated.fa";
+
+void LevelIndexTests::setUp() {
+    // Set up a temporary directory to put the index in.
+    tempDir = make_tempdir();
+    
+    // Build an index and load it back without the full SA.
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    index = new FMDIndex(tempDir + "/index.basename");
+    
+    // Declare every 2 adjacent positions to be a range.
+    ranges = new GenericBitVector();
+    for(size_t i = 0; i < index->getBWTLength(); i += 2) {
+        ranges->addBit(i);
+    }
+    ranges->finish(index->getBWTLength());
+}
+
+
+void LevelIndexTests::tearDown() {
+    delete ranges;
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure a view over a saved level finds the same positions as the view it
+ * was saved from.
+ */
+void LevelIndexTests::testRoundTrip() {
+    // Assign only some ranges explicitly, so the rest have to be filled in.
+    std::map<size_t, TextPosition> owners;
+    for(size_t i = 0; i + 1 < index->getBWTLength(); i += 6) {
+        owners[i / 2] = index->locate(i + 1);
+    }
+    FMDIndexView original(*index, nullptr, ranges, owners);
+    
+    original.saveLevelIndex(tempDir + "/level.bin");
+    LevelIndex level(tempDir + "/level.bin");
+    CPPUNIT_ASSERT(level.hasInvertedPositions());
+    CPPUNIT_ASSERT_EQUAL(index->getBWTLength(), level.getBWTLength());
+    
+    FMDIndexView loaded(*index, nullptr, level);
+    
+    for(size_t i = 0; i < ranges->rank(ranges->getSize()); i++) {
+        // Every range has the same position and the same BWT interval.
+        CPPUNIT_ASSERT(original.rangeToTextPosition(i) ==
+            loaded.rangeToTextPosition(i));
+        CPPUNIT_ASSERT(original.getRangeByNumber(i) ==
+            loaded.getRangeByNumber(i));
+        
+        // And can be found from its position.
+        TextPosition position = original.rangeToTextPosition(i);
+        CPPUNIT_ASSERT(original.textPositionToRanges(position) ==
+            loaded.textPositionToRanges(position));
+    }
+    
+    // Copies of the loaded view work the same, sharing the level's positions.
+    FMDIndexView copy(loaded);
+    CPPUNIT_ASSERT(loaded.rangeToTextPosition(3) ==
+        copy.rangeToTextPosition(3));
+}
+
+/**
+ * Make sure a level saved without its inverted positions gets them rebuilt.
+ */
+void LevelIndexTests::testWithoutInverse() {
+    std::vector<TextPosition> owners;
+    for(size_t i = 0; i < index->getBWTLength(); i += 2) {
+        owners.push_back(index->locate(i));
+    }
+    FMDIndexView original(*index, nullptr, ranges, std::move(owners));
+    
+    original.saveLevelIndex(tempDir + "/level.bin", false);
+    LevelIndex level(tempDir + "/level.bin");
+    CPPUNIT_ASSERT(!level.hasInvertedPositions());
+    
+    FMDIndexView loaded(*index, nullptr, level);
+    TextPosition position = original.rangeToTextPosition(2);
+    CPPUNIT_ASSERT(original.textPositionToRanges(position) ==
+        loaded.textPositionToRanges(position));
+}
+
+/**
+ * Make sure files that aren't level indexes, or are cut short, are rejected.
+ */
+void LevelIndexTests::testBadFile() {
+    std::ofstream garbage(tempDir + "/garbage.bin");
+    garbage << "This is not a level index, but it is long enough to have a "
+        "header's worth of bytes in it.";
+    garbage.close();
+    CPPUNIT_ASSERT_THROW(LevelIndex(tempDir + "/garbage.bin"),
+        std::runtime_error);
+    
+    FMDIndexView view(*index, nullptr, ranges, std::vector<TextPosition>(
+        ranges->rank(ranges->getSize()), TextPosition(0, 0)));
+    view.saveLevelIndex(tempDir + "/level.bin");
+    boost::filesystem::resize_file(tempDir + "/level.bin",
+        boost::filesystem::file_size(tempDir + "/level.bin") - 8);
+    CPPUNIT_ASSERT_THROW(LevelIndex(tempDir + "/level.bin"),
+        std::runtime_error);
+}
+
+/**
+ * Make sure Sides looked up in a saved level match the positions it was saved
+ * with, and lookups past the end are refused.
+ */
+void LevelIndexTests::testSideArray() {
+    std::vector<TextPosition> owners;
+    for(size_t i = 0; i < index->getBWTLength(); i += 2) {
+        owners.push_back(index->locate(i));
+    }
+    FMDIndexView original(*index, nullptr, ranges, std::move(owners));
+    original.saveLevelIndex(tempDir + "/level.bin");
+    
+    LevelSideArray sides(*index, tempDir + "/level.bin");
+    CPPUNIT_ASSERT_EQUAL(ranges->rank(ranges->getSize()), sides.getLength());
+    
+    for(size_t i = 0; i < sides.getLength(); i++) {
+        TextPosition position = original.rangeToTextPosition(i);
+        CPPUNIT_ASSERT_EQUAL(((long long) index->getBaseID(position) << 1) |
+            (index->getStrand(position) ? 1 : 0), sides.get(i));
+    }
+    
+    CPPUNIT_ASSERT_THROW(sides.get(sides.getLength()), std::out_of_range);
+}
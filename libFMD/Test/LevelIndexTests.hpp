@@ -0,0 +1,44 @@
+#ifndef LEVELINDEXTESTS_HPP
+#define LEVELINDEXTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+#include "../GenericBitVector.hpp"
+
+/**
+ * Tests for saving and loading merged levels as LevelIndexes.
+ */
+class LevelIndexTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LevelIndexTests);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testWithoutInverse);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST(testSideArray);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the sequences to test with.
+    static const std::string filename;
+    
+    // Holds the temporary directory for the index and level indexes.
+    std::string tempDir;
+    
+    // Keep a pointer to the index.
+    FMDIndex* index;
+    
+    // And a ranges bitvector merging some positions.
+    GenericBitVector* ranges;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRoundTrip();
+    void testWithoutInverse();
+    void testBadFile();
+    void testSideArray();
+};
+
+#endif
@@ -0,0 +1,157 @@
+// Test mapping whole queries to packed Sides.
+
+#include <vector>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../LevelMapper.hpp"
+#include "../util.hpp"
+
+#include "LevelMapperTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( LevelMapperTests );
+
+// Define constants
+const std::string LevelMapperTests::filename = "Test/haplotypes.fa";
+
+void LevelMapperTests::setUp() {
+    // Build an index of the haplotypes in a temporary directory.
+    tempDir = make_tempdir();
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    // Load it without the full SA.
+    index = new FMDIndex(tempDir + "/index.basename");
+}
+
+
+void LevelMapperTests::tearDown() {
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure both strands of a contig map to its own Sides, with the right
+ * faces, and that the rest is left unmapped.
+ */
+void LevelMapperTests::testMapSides() {
+    LevelMapper mapper(*index);
+    
+    // Grab all of the first contig, with room to spare.
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    std::vector<long long> sides(query.size() + 1, 0);
+    
+    // The same bases map as with the NaturalMappingScheme by itself.
+    CPPUNIT_ASSERT_EQUAL(query.size() - 4 - 4,
+        mapper.mapSides(query, sides.data(), sides.size()));
+    
+    for(size_t i = 0; i < query.size(); i++) {
+        if(i < 4 || i >= query.size() - 4) {
+            CPPUNIT_ASSERT_EQUAL(-1LL, sides[i]);
+        } else {
+            // Forward strand bases map to their left faces.
+            CPPUNIT_ASSERT_EQUAL((long long) index->getBaseID(
+                TextPosition(0, i)) << 1, sides[i]);
+        }
+    }
+    // Nothing past the query is touched.
+    CPPUNIT_ASSERT_EQUAL(0LL, sides[query.size()]);
+    
+    // The reverse strand maps to the right faces.
+    std::string query2 = "AGAGTCGCAGATGAGCGTCGAATCGCCGAAGCATG";
+    mapper.mapSides(query2, sides.data(), sides.size());
+    for(size_t i = 4; i < query2.size() - 4; i++) {
+        CPPUNIT_ASSERT_EQUAL(((long long) index->getBaseID(
+            TextPosition(1, i)) << 1) | 1, sides[i]);
+    }
+}
+
+/**
+ * Make sure a query too long for the array is refused.
+ */
+void LevelMapperTests::testNoRoom() {
+    LevelMapper mapper(*index);
+    
+    std::vector<long long> sides(3);
+    CPPUNIT_ASSERT_THROW(mapper.mapSides("CATGCTTCGG", sides.data(),
+        sides.size()), std::runtime_error);
+}
+
+/**
+ * Make sure mapping a batch of queries run together gives the same Sides as
+ * mapping them one at a time.
+ */
+void LevelMapperTests::testMapBatch() {
+    LevelMapper mapper(*index);
+    
+    std::vector<std::string> queries = {
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "",
+        "AGAGTCGCAGATGAGCGTCGAATCGCCGAAGCATG",
+        "GATTACA"
+    };
+    
+    std::string bases;
+    std::vector<long long> offsets;
+    for(auto& query : queries) {
+        offsets.push_back(bases.size());
+        bases += query;
+    }
+    offsets.push_back(bases.size());
+    
+    std::vector<long long> sides(bases.size(), 0);
+    size_t mapped = mapper.mapBatch(bases.data(), bases.size(), offsets.data(),
+        offsets.size(), sides.data(), sides.size());
+    
+    size_t expectedMapped = 0;
+    for(size_t i = 0; i < queries.size(); i++) {
+        std::vector<long long> expected(queries[i].size());
+        expectedMapped += mapper.mapSides(queries[i], expected.data(),
+            expected.size());
+        for(size_t j = 0; j < expected.size(); j++) {
+            CPPUNIT_ASSERT_EQUAL(expected[j], sides[offsets[i] + j]);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(expectedMapped, mapped);
+}
+
+/**
+ * Make sure offsets that go backward or off the end are refused.
+ */
+void LevelMapperTests::testBadOffsets() {
+    LevelMapper mapper(*index);
+    
+    std::string bases = "CATGCTTCGG";
+    std::vector<long long> sides(bases.size());
+    
+    std::vector<long long> backward = {0, 6, 4, 10};
+    CPPUNIT_ASSERT_THROW(mapper.mapBatch(bases.data(), bases.size(),
+        backward.data(), backward.size(), sides.data(), sides.size()),
+        std::runtime_error);
+    
+    std::vector<long long> pastEnd = {0, 11};
+    CPPUNIT_ASSERT_THROW(mapper.mapBatch(bases.data(), bases.size(),
+        pastEnd.data(), pastEnd.size(), sides.data(), sides.size()),
+        std::runtime_error);
+}
+
+/**
+ * Make sure opening the same index twice gets the same shared LevelMapper,
+ * which maps like one made directly.
+ */
+void LevelMapperTests::testOpenShared() {
+    LevelMapper& shared = LevelMapper::open(tempDir + "/index.basename");
+    CPPUNIT_ASSERT(&shared == &LevelMapper::open(tempDir + "/index.basename"));
+    
+    LevelMapper mapper(*index);
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    std::vector<long long> expected(query.size());
+    std::vector<long long> sides(query.size());
+    mapper.mapSides(query, expected.data(), expected.size());
+    shared.mapSides(query, sides.data(), sides.size());
+    CPPUNIT_ASSERT(expected == sides);
+}
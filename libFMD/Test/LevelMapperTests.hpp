@@ -0,0 +1,42 @@
+#ifndef LEVELMAPPERTESTS_HPP
+#define LEVELMAPPERTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+
+/**
+ * Tests for LevelMapper.
+ */
+class LevelMapperTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LevelMapperTests);
+    CPPUNIT_TEST(testMapSides);
+    CPPUNIT_TEST(testNoRoom);
+    CPPUNIT_TEST(testMapBatch);
+    CPPUNIT_TEST(testBadOffsets);
+    CPPUNIT_TEST(testOpenShared);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes to test with.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index to map to.
+    FMDIndex const* index;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testMapSides();
+    void testNoRoom();
+    void testMapBatch();
+    void testBadOffsets();
+    void testOpenShared();
+};
+
+#endif
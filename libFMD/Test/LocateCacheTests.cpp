@@ -0,0 +1,115 @@
+// Test the direct-mapped locate cache.
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "../LocateCache.hpp"
+
+#include "LocateCacheTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( LocateCacheTests );
+
+void LocateCacheTests::setUp() {
+}
+
+
+void LocateCacheTests::tearDown() {
+}
+
+/**
+ * Make a fake position for the given row, that can be told apart from the
+ * positions of all the other rows.
+ */
+static TextPosition makePosition(int64_t row) {
+    return TextPosition(row % 7, row * 3 + 1);
+}
+
+/**
+ * Make sure rows can be found once they are put in, until another row in the
+ * same slot replaces them, and that hits and misses get counted.
+ */
+void LocateCacheTests::testHitsAndMisses() {
+    // Room gets rounded down to 8 rows.
+    LocateCache cache(10);
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, cache.getEntries());
+
+    // Nothing is there to start with.
+    TextPosition found;
+    CPPUNIT_ASSERT(!cache.get(0, found));
+    CPPUNIT_ASSERT(!cache.get(5, found));
+
+    cache.put(5, makePosition(5));
+    CPPUNIT_ASSERT(cache.get(5, found));
+    CPPUNIT_ASSERT(found == makePosition(5));
+
+    // A row in a different slot doesn't disturb it.
+    cache.put(6, makePosition(6));
+    CPPUNIT_ASSERT(cache.get(5, found));
+    CPPUNIT_ASSERT(found == makePosition(5));
+
+    // But one in the same slot replaces it.
+    cache.put(13, makePosition(13));
+    CPPUNIT_ASSERT(!cache.get(5, found));
+    CPPUNIT_ASSERT(cache.get(13, found));
+    CPPUNIT_ASSERT(found == makePosition(13));
+
+    CPPUNIT_ASSERT_EQUAL((size_t) 3,
+        cache.getStats()["locateCache:hits"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3,
+        cache.getStats()["locateCache:misses"]);
+
+    // Resizing throws everything out.
+    cache.resize(16);
+    CPPUNIT_ASSERT_EQUAL((size_t) 16, cache.getEntries());
+    CPPUNIT_ASSERT(!cache.get(13, found));
+}
+
+/**
+ * Make sure a cache with no room never finds anything.
+ */
+void LocateCacheTests::testDisabled() {
+    LocateCache cache;
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, cache.getEntries());
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, cache.getMemoryUsage());
+
+    cache.put(0, makePosition(0));
+    TextPosition found;
+    CPPUNIT_ASSERT(!cache.get(0, found));
+}
+
+/**
+ * Make sure that threads fighting over a few slots never see a row with the
+ * wrong position.
+ */
+void LocateCacheTests::testThreads() {
+    LocateCache cache(4);
+
+    std::atomic<size_t> wrong(0);
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            for(int64_t i = 0; i < 100000; i++) {
+                // Each thread works through the rows in its own order.
+                int64_t row = (i * (t + 1)) % 8;
+                TextPosition found;
+                if(cache.get(row, found)) {
+                    if(!(found == makePosition(row))) {
+                        wrong++;
+                    }
+                } else {
+                    cache.put(row, makePosition(row));
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, wrong.load());
+    CPPUNIT_ASSERT_EQUAL((size_t) 400000,
+        cache.getStats()["locateCache:hits"] +
+        cache.getStats()["locateCache:misses"]);
+}
@@ -0,0 +1,25 @@
+#ifndef LOCATECACHETESTS_HPP
+#define LOCATECACHETESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for LocateCache.
+ */
+class LocateCacheTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LocateCacheTests);
+    CPPUNIT_TEST(testHitsAndMisses);
+    CPPUNIT_TEST(testDisabled);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+    void testHitsAndMisses();
+    void testDisabled();
+    void testThreads();
+};
+
+#endif
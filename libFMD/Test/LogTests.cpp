@@ -0,0 +1,104 @@
+// Test the Log.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Log.hpp"
+
+#include "LogTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( LogTests );
+
+void LogTests::setUp() {
+}
+
+
+void LogTests::tearDown() {
+    // Don't leave the writer running for other tests.
+    Log::stopAsync();
+}
+
+/**
+ * Log the given number of numbered lines from each of the given number of
+ * threads at once, and return everything written to standard output.
+ */
+static std::string logFromThreads(size_t threadCount, size_t lineCount) {
+    std::stringstream captured;
+    std::streambuf* original = std::cout.rdbuf(captured.rdbuf());
+    
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([t, lineCount]() {
+            for(size_t i = 0; i < lineCount; i++) {
+                Log::output() << "thread " << t << " line " << i << std::endl;
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    // Make sure everything is written before we stop capturing it.
+    Log::stopAsync();
+    std::cout.rdbuf(original);
+    return captured.str();
+}
+
+/**
+ * Make sure lines logged through the background writer all come out whole, in
+ * the order each thread logged them.
+ */
+void LogTests::testAsyncLines() {
+    // Use a tiny queue, so threads have to wait for room.
+    Log::startAsync(4);
+    // Starting again does nothing.
+    Log::startAsync(4);
+    std::stringstream output(logFromThreads(4, 1000));
+    
+    std::vector<size_t> nextLines(4, 0);
+    std::string line;
+    while(std::getline(output, line)) {
+        size_t found = line.find("OUTPUT: thread ");
+        CPPUNIT_ASSERT(found != std::string::npos);
+        CPPUNIT_ASSERT_EQUAL('[', line[0]);
+        
+        std::stringstream message(line.substr(found + 15));
+        size_t thread;
+        std::string word;
+        size_t number;
+        message >> thread >> word >> number;
+        CPPUNIT_ASSERT_EQUAL(std::string("line"), word);
+        CPPUNIT_ASSERT(thread < nextLines.size());
+        CPPUNIT_ASSERT_EQUAL(nextLines[thread], number);
+        nextLines[thread]++;
+    }
+    
+    for(size_t count : nextLines) {
+        CPPUNIT_ASSERT_EQUAL((size_t) 1000, count);
+    }
+}
+
+/**
+ * Make sure every line is either written or counted as dropped when the queue
+ * is allowed to drop lines.
+ */
+void LogTests::testAsyncDrop() {
+    size_t droppedBefore = Log::getDroppedLines();
+    Log::startAsync(1, true);
+    std::stringstream output(logFromThreads(4, 1000));
+    
+    size_t written = 0;
+    std::string line;
+    while(std::getline(output, line)) {
+        if(line.find("OUTPUT: thread ") != std::string::npos) {
+            written++;
+        }
+    }
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 4000,
+        written + Log::getDroppedLines() - droppedBefore);
+}
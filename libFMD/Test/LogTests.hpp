@@ -0,0 +1,23 @@
+#ifndef LOGTESTS_HPP
+#define LOGTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for the Log, and its background writer.
+ */
+class LogTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(LogTests);
+    CPPUNIT_TEST(testAsyncLines);
+    CPPUNIT_TEST(testAsyncDrop);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testAsyncLines();
+    void testAsyncDrop();
+};
+
+#endif
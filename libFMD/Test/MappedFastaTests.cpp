@@ -0,0 +1,73 @@
+// Test memory-mapped FASTA reading.
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "../MappedFasta.hpp"
+#include "../util.hpp"
+
+#include "MappedFastaTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( MappedFastaTests );
+
+void MappedFastaTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void MappedFastaTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure we get the right IDs and sequences out, whether the sequences are
+ * on one line or several.
+ */
+void MappedFastaTests::testRecords() {
+    std::ofstream out(tempDir + "/test.fa");
+    out << ">one description here\nGATTACA\n";
+    out << ">two,more\r\nGAT\r\nTA>CA\r\n\r\nCAT\r\n";
+    out << ">three\n\n";
+    out << ">four\nACGT";
+    out.close();
+    
+    MappedFasta fasta(tempDir + "/test.fa");
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, fasta.size());
+    
+    CPPUNIT_ASSERT_EQUAL(std::string("one"), fasta.getID(0));
+    CPPUNIT_ASSERT_EQUAL(std::string("two"), fasta.getID(1));
+    CPPUNIT_ASSERT_EQUAL(std::string("three"), fasta.getID(2));
+    CPPUNIT_ASSERT_EQUAL(std::string("four"), fasta.getID(3));
+    
+    // One-line sequences come straight out of the file.
+    std::string buffer = "untouched";
+    size_t length;
+    const char* sequence = fasta.getSequence(0, length, buffer);
+    CPPUNIT_ASSERT_EQUAL(std::string("GATTACA"),
+        std::string(sequence, length));
+    CPPUNIT_ASSERT_EQUAL(std::string("untouched"), buffer);
+    
+    // Ones on several lines get put together in the buffer.
+    sequence = fasta.getSequence(1, length, buffer);
+    CPPUNIT_ASSERT(sequence == buffer.data());
+    CPPUNIT_ASSERT_EQUAL(std::string("GATTA>CACAT"),
+        std::string(sequence, length));
+    
+    CPPUNIT_ASSERT_EQUAL(std::string(""), fasta.getSequence(2));
+    CPPUNIT_ASSERT_EQUAL(std::string("ACGT"), fasta.getSequence(3));
+}
+
+/**
+ * Make sure files with no records have no records.
+ */
+void MappedFastaTests::testEmpty() {
+    std::ofstream(tempDir + "/empty.fa").close();
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, MappedFasta(tempDir + "/empty.fa").size());
+    
+    std::ofstream out(tempDir + "/junk.fa");
+    out << "no headers here\n";
+    out.close();
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, MappedFasta(tempDir + "/junk.fa").size());
+}
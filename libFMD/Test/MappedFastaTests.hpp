@@ -0,0 +1,29 @@
+#ifndef MAPPEDFASTATESTS_HPP
+#define MAPPEDFASTATESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for MappedFasta.
+ */
+class MappedFastaTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(MappedFastaTests);
+    CPPUNIT_TEST(testRecords);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to write FASTAs in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRecords();
+    void testEmpty();
+};
+
+#endif
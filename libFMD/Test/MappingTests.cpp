@@ -0,0 +1,64 @@
+// Test Mapping and TextPosition objects.
+
+#include <stdexcept>
+
+#include "../Mapping.hpp"
+#include "../TextPosition.hpp"
+
+#include "MappingTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( MappingTests );
+
+void MappingTests::setUp() {
+}
+
+
+void MappingTests::tearDown() {
+}
+
+/**
+ * Make sure TextPositions survive packing, and sort the same way packed.
+ */
+void MappingTests::testPackTextPosition() {
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, sizeof(PackedTextPosition));
+
+    TextPosition small(3, 17);
+    TextPosition big(3, (size_t) 1 << 35);
+    TextPosition later(4, 0);
+    
+    CPPUNIT_ASSERT(PackedTextPosition(small).unpack() == small);
+    CPPUNIT_ASSERT(PackedTextPosition(big).unpack() == big);
+    CPPUNIT_ASSERT(PackedTextPosition(later).unpack() == later);
+    
+    CPPUNIT_ASSERT(PackedTextPosition(small) < PackedTextPosition(big));
+    CPPUNIT_ASSERT(PackedTextPosition(big) < PackedTextPosition(later));
+    
+    CPPUNIT_ASSERT(PackedTextPosition(small).isSet());
+    CPPUNIT_ASSERT(!PackedTextPosition().isSet());
+    
+    // Things that don't fit should be refused.
+    CPPUNIT_ASSERT_THROW(PackedTextPosition(TextPosition(0, (size_t) 1 << 36)),
+        std::runtime_error);
+    CPPUNIT_ASSERT_THROW(PackedTextPosition(TextPosition((1 << 28) - 1, 0)),
+        std::runtime_error);
+}
+
+/**
+ * Make sure Mappings survive packing, mapped or not.
+ */
+void MappingTests::testPackMapping() {
+    CPPUNIT_ASSERT_EQUAL((size_t) 16, sizeof(PackedMapping));
+
+    Mapping mapped(TextPosition(5, 100), 12, 34);
+    CPPUNIT_ASSERT(PackedMapping(mapped).isMapped());
+    CPPUNIT_ASSERT(PackedMapping(mapped).unpack() == mapped);
+    
+    // Unmapped mappings can still have contexts.
+    Mapping unmapped;
+    unmapped.setMaxContext(7, 8);
+    CPPUNIT_ASSERT(!PackedMapping(unmapped).isMapped());
+    CPPUNIT_ASSERT(PackedMapping(unmapped).unpack() == unmapped);
+    
+    CPPUNIT_ASSERT(PackedMapping().unpack() == Mapping());
+}
@@ -0,0 +1,23 @@
+#ifndef MAPPINGTESTS_HPP
+#define MAPPINGTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for Mapping and TextPosition, and their packed versions.
+ */
+class MappingTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(MappingTests);
+    CPPUNIT_TEST(testPackTextPosition);
+    CPPUNIT_TEST(testPackMapping);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testPackTextPosition();
+    void testPackMapping();
+};
+
+#endif
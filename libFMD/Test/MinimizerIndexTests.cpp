@@ -0,0 +1,115 @@
+// Test skipping queries with no minimizers in common with the reference.
+
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../MinimizerIndex.hpp"
+#include "../NaturalMappingScheme.hpp"
+#include "../util.hpp"
+
+#include "MinimizerIndexTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( MinimizerIndexTests );
+
+// Define constants
+const std::string MinimizerIndexTests::filename = "Test/haplotypes.fa";
+
+void MinimizerIndexTests::setUp() {
+    // Build an index in a temporary directory.
+    tempDir = make_tempdir();
+    
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    index = new FMDIndex(tempDir + "/index.basename");
+}
+
+
+void MinimizerIndexTests::tearDown() {
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure pieces of the reference hit on either strand, and things that
+ * can't match well enough don't.
+ */
+void MinimizerIndexTests::testHits() {
+    MinimizerIndex minimizers(*index, 5, 4);
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, minimizers.getSpan());
+    CPPUNIT_ASSERT(minimizers.size() > 0);
+    
+    // A piece of the first contig hits, and so does its reverse complement.
+    std::string piece = "GCGATTCGACGC";
+    CPPUNIT_ASSERT(minimizers.hasHit(piece));
+    CPPUNIT_ASSERT(minimizers.hasHit(reverseComplement(piece)));
+    
+    // So does a whole contig, in lower case.
+    CPPUNIT_ASSERT(minimizers.hasHit("cgggcgcatcgctattatttctttctcttttcaca"));
+    
+    // Things shorter than a window never hit.
+    CPPUNIT_ASSERT(!minimizers.hasHit("GCGATTC"));
+    
+    // Neither do things that aren't bases, or that aren't in the reference.
+    CPPUNIT_ASSERT(!minimizers.hasHit("NNNNNNNNNNNN"));
+    CPPUNIT_ASSERT(!minimizers.hasHit("AAAAAAAAAAAA"));
+    
+    // Ns break windows up, so a piece that hits doesn't once an N leaves
+    // too few bases on each side for a window.
+    CPPUNIT_ASSERT(minimizers.hasHit("GCGATTCGACGCTCA"));
+    CPPUNIT_ASSERT(!minimizers.hasHit("GCGATTCNACGCTCA"));
+}
+
+/**
+ * Make sure k-mers that don't fit and empty windows are refused.
+ */
+void MinimizerIndexTests::testBadParameters() {
+    CPPUNIT_ASSERT_THROW(MinimizerIndex(*index, 0, 4), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(MinimizerIndex(*index, 33, 4), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(MinimizerIndex(*index, 5, 0), std::runtime_error);
+}
+
+/**
+ * Make sure the natural mapping scheme only skips queries when that can't
+ * lose anything, and otherwise maps the same.
+ */
+void MinimizerIndexTests::testPrefilter() {
+    MinimizerIndex minimizers(*index, 5, 4);
+    
+    NaturalMappingScheme scheme{FMDIndexView(*index)};
+    scheme.minimizerIndex = &minimizers;
+    
+    // With no minimum context, nothing can be skipped.
+    size_t mapped = 0;
+    scheme.map("AAAAAAAAAAAA", [&](size_t i, TextPosition position) {
+        mapped++;
+    });
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, scheme.getStats()["prefiltered"]);
+    
+    // Once maximal matchings have to cover a window, it is skipped.
+    scheme.minContext = minimizers.getSpan();
+    scheme.map("AAAAAAAAAAAA", [&](size_t i, TextPosition position) {
+        mapped++;
+    });
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, scheme.getStats()["prefiltered"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, mapped);
+    
+    // A real contig still maps the same as without the prefilter.
+    NaturalMappingScheme unfiltered{FMDIndexView(*index)};
+    unfiltered.minContext = scheme.minContext;
+    std::string query = "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA";
+    std::vector<TextPosition> expected(query.size());
+    std::vector<TextPosition> got(query.size());
+    unfiltered.map(query, [&](size_t i, TextPosition position) {
+        expected[i] = position;
+    });
+    scheme.map(query, [&](size_t i, TextPosition position) {
+        got[i] = position;
+    });
+    CPPUNIT_ASSERT(expected == got);
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, scheme.getStats()["prefiltered"]);
+}
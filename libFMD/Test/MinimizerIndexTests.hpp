@@ -0,0 +1,38 @@
+#ifndef MINIMIZERINDEXTESTS_HPP
+#define MINIMIZERINDEXTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+
+/**
+ * Tests for the minimizer prefilter.
+ */
+class MinimizerIndexTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(MinimizerIndexTests);
+    CPPUNIT_TEST(testHits);
+    CPPUNIT_TEST(testBadParameters);
+    CPPUNIT_TEST(testPrefilter);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index to collect minimizers from.
+    FMDIndex const* index;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testHits();
+    void testBadParameters();
+    void testPrefilter();
+};
+
+#endif
@@ -3,12 +3,14 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <iostream>
+#include <map>
 
 #include <ReadTable.h>
 #include <SuffixArray.h>
 
 #include "../FMDIndex.hpp"
 #include "../FMDIndexBuilder.hpp"
+#include "../MinUniqueTable.hpp"
 #include "../util.hpp"
 
 #include "NaturalMappingSchemeTests.hpp"
@@ -288,11 +290,287 @@ void NaturalMappingSchemeTests::testSkipAll() {
     CPPUNIT_ASSERT_EQUAL(query.size() - 4 - 4 - 2, mappedBases);   
 }
 
+/**
+ * Make sure mapping a batch gets the same results as mapping each query.
+ */
+void NaturalMappingSchemeTests::testMapBatch() {
+    std::vector<std::string> queries = {
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "",
+        "GCGATTCGACGCTCAT",
+        "AAAAAAAAAA"
+    };
+    
+    MappingBatchResult results;
+    
+    // Use the results twice, to make sure they get reset.
+    for(size_t round = 0; round < 2; round++) {
+        scheme->mapBatch(queries, results);
+        
+        CPPUNIT_ASSERT_EQUAL(queries.size(), results.getQueryCount());
+        for(size_t q = 0; q < queries.size(); q++) {
+            CPPUNIT_ASSERT_EQUAL(queries[q].size(), results.getQueryLength(q));
+            
+            std::vector<Mapping> expected(queries[q].size());
+            scheme->map(queries[q], [&](size_t i, TextPosition mappedTo) {
+                expected[i] = Mapping(mappedTo);
+            });
+            
+            for(size_t i = 0; i < queries[q].size(); i++) {
+                CPPUNIT_ASSERT(results.get(q, i).unpack() == expected[i]);
+            }
+        }
+        
+        // Try a smaller batch in the same results.
+        queries.pop_back();
+    }
+}
 
+/**
+ * Make sure mapping indexed contigs, and pieces of them, with their minimal
+ * unique lengths gives the same mappings as finding them by retracting.
+ */
+void NaturalMappingSchemeTests::testMapWithMinUniqueLengths() {
+    
+    // Work out how long every base's unique strings are.
+    MinUniqueTable table(*index);
+    
+    for(size_t contig = 0; contig < index->getNumberOfContigs(); contig++) {
+        std::string contigString = index->displayContig(contig);
+        
+        for(auto range : {std::make_pair((size_t) 0, contigString.size()),
+            std::make_pair((size_t) 5, contigString.size() - 5)}) {
+            
+            std::string query = contigString.substr(range.first,
+                range.second - range.first);
+            std::vector<size_t> lengths(query.size());
+            table.getRightLengths(contig, range.first, range.second,
+                lengths.data());
+            
+            // Map both ways, and collect what maps where.
+            std::map<size_t, TextPosition> expected;
+            scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                expected[i] = mappedTo;
+            });
+            
+            std::map<size_t, TextPosition> got;
+            scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                got[i] = mappedTo;
+            }, nullptr, lengths.data());
+            
+            // Something should map, and it all has to agree.
+            CPPUNIT_ASSERT(!expected.empty());
+            CPPUNIT_ASSERT(expected == got);
+        }
+    }
+}
 
+/**
+ * Make sure mapping with a ContextCache gets the same results as without.
+ */
+void NaturalMappingSchemeTests::testContextCache() {
+    std::vector<std::string> queries = {
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "GCGATTCGACGCTCAT",
+        "AAAAAAAAAA",
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "ACG"
+    };
+    
+    // Get the mappings without the cache.
+    std::vector<std::vector<Mapping>> expected;
+    for(const std::string& query : queries) {
+        expected.emplace_back(query.size());
+        scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+            expected.back()[i] = Mapping(mappedTo);
+        });
+    }
+    
+    // Then with it.
+    ContextCache cache(5);
+    scheme->contextCache = &cache;
+    
+    for(size_t q = 0; q < queries.size(); q++) {
+        std::vector<Mapping> found(queries[q].size());
+        scheme->map(queries[q], [&](size_t i, TextPosition mappedTo) {
+            found[i] = Mapping(mappedTo);
+        });
+        
+        for(size_t i = 0; i < queries[q].size(); i++) {
+            CPPUNIT_ASSERT(found[i] == expected[q][i]);
+        }
+    }
+    
+    scheme->contextCache = nullptr;
+    
+    // The repeated query should have hit, and the one shorter than a k-mer
+    // should not have used the cache at all.
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, cache.getStats()["contextCacheHits"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, cache.getStats()["contextCacheMisses"]);
+}
 
+/**
+ * Make sure mapping a piece of an indexed contig from its own BWT rows, and
+ * with its minimal unique lengths, gives the same mappings as searching for it.
+ */
+void NaturalMappingSchemeTests::testSelfQuery() {
+    
+    // Work out how long every base's unique strings are.
+    MinUniqueTable table(*index);
+    
+    // Try it with and without a (trivial) mask, since searches in masked
+    // views can't start from k-mer lookups.
+    for(const GenericBitVector* mask : {(const GenericBitVector*) nullptr,
+        &index->getGenomeMask(0)}) {
+        
+        delete scheme;
+        scheme = new NaturalMappingScheme(FMDIndexView(*index, mask));
+        
+        for(size_t contig = 0; contig < index->getNumberOfContigs();
+            contig++) {
+            
+            std::string bases = index->displayContig(contig);
+            for(auto range : {std::make_pair((size_t) 0, bases.size()),
+                std::make_pair((size_t) 2, bases.size() - 3)}) {
+                
+                std::string query = bases.substr(range.first,
+                    range.second - range.first);
+                std::vector<int64_t> rows(query.size());
+                index->getContigRows(contig, range.first, range.second,
+                    rows.data());
+                std::vector<size_t> lengths(query.size());
+                table.getRightLengths(contig, range.first, range.second,
+                    lengths.data());
+                
+                // Map all the ways, and collect what maps where.
+                std::vector<std::pair<size_t, TextPosition>> searched;
+                scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                    searched.push_back(std::make_pair(i, mappedTo));
+                });
+                std::vector<std::vector<std::pair<size_t, TextPosition>>>
+                    others(3);
+                scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                    others[0].push_back(std::make_pair(i, mappedTo));
+                }, rows.data());
+                scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                    others[1].push_back(std::make_pair(i, mappedTo));
+                }, rows.data(), lengths.data());
+                scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+                    others[2].push_back(std::make_pair(i, mappedTo));
+                }, nullptr, lengths.data());
+                
+                // Something should map, and it all has to agree.
+                CPPUNIT_ASSERT(!searched.empty());
+                for(const auto& other : others) {
+                    CPPUNIT_ASSERT_EQUAL(searched.size(), other.size());
+                    for(size_t i = 0; i < searched.size(); i++) {
+                        CPPUNIT_ASSERT_EQUAL(searched[i].first,
+                            other[i].first);
+                        CPPUNIT_ASSERT(searched[i].second == other[i].second);
+                    }
+                }
+            }
+        }
+    }
+}
 
+/**
+ * Make sure mapping part of a query maps it the same as mapping the whole query
+ * when there is enough context, and the same as mapping just the range and its
+ * context when there isn't, with or without the range's own BWT rows.
+ */
+void NaturalMappingSchemeTests::testMapRange() {
+    std::string query = index->displayContig(0);
+    
+    std::map<size_t, TextPosition> whole;
+    scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+        whole[i] = mappedTo;
+    });
+    CPPUNIT_ASSERT(!whole.empty());
+    
+    for(auto range : {std::make_pair((size_t) 0, query.size()),
+        std::make_pair((size_t) 5, (size_t) 20), std::make_pair((size_t) 7,
+        (size_t) 7)}) {
+        
+        // With the default context, the range should map like the whole
+        // query, through the base class too.
+        std::map<size_t, TextPosition> got;
+        ((const MappingScheme*) scheme)->mapRange(query, range.first,
+            range.second, [&](size_t i, TextPosition mappedTo) {
+            
+            got[i] = mappedTo;
+        });
+        std::map<size_t, TextPosition> expected(
+            whole.lower_bound(range.first), whole.lower_bound(range.second));
+        CPPUNIT_ASSERT(expected == got);
+        
+        // With less, it should map like the piece with its context.
+        scheme->rangeContext = 3;
+        auto context = scheme->getRangeContext(query.size(), range.first,
+            range.second);
+        expected.clear();
+        scheme->map(query.substr(context.first,
+            context.second - context.first),
+            [&](size_t i, TextPosition mappedTo) {
+            
+            if(i + context.first >= range.first &&
+                i + context.first < range.second) {
+                
+                expected[i + context.first] = mappedTo;
+            }
+        });
+        
+        // Try it searching and starting from the context's own rows.
+        std::vector<int64_t> rows(context.second - context.first);
+        index->getContigRows(0, context.first, context.second, rows.data());
+        for(const int64_t* given : {(const int64_t*) nullptr,
+            (const int64_t*) rows.data()}) {
+            
+            got.clear();
+            scheme->mapRange(query, range.first, range.second,
+                [&](size_t i, TextPosition mappedTo) {
+                
+                got[i] = mappedTo;
+            }, given);
+            CPPUNIT_ASSERT(expected == got);
+        }
+        scheme->rangeContext = 10000;
+    }
+    
+    // Ranges have to be in the query.
+    CPPUNIT_ASSERT_THROW(scheme->mapRange(query, 10, query.size() + 1,
+        [](size_t, TextPosition) {}), std::out_of_range);
+}
 
-
-
-
+/**
+ * Make sure filtering out repeated queries in a batch doesn't change any
+ * mappings, and does skip the repeats.
+ */
+void NaturalMappingSchemeTests::testRepeatFilter() {
+    std::vector<std::string> queries = {
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "",
+        "GCGATTCGACGCTCAT",
+        "CG",
+        "AAAAAAAAAA",
+        "CGGGCGCATCGNTATTATTTC"
+    };
+    
+    MappingBatchResult expected;
+    scheme->mapBatch(queries, expected);
+    
+    scheme->repeatFilter = true;
+    MappingBatchResult results;
+    scheme->mapBatch(queries, results);
+    scheme->repeatFilter = false;
+    
+    for(size_t q = 0; q < queries.size(); q++) {
+        for(size_t i = 0; i < queries[q].size(); i++) {
+            CPPUNIT_ASSERT(results.get(q, i).unpack() ==
+                expected.get(q, i).unpack());
+        }
+    }
+    
+    // "CG" is all over, and should have been skipped.
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, scheme->getStats()["repeatFiltered"]);
+}
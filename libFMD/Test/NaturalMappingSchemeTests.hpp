@@ -15,6 +15,12 @@ class NaturalMappingSchemeTests : public CppUnit::TestFixture {
     CPPUNIT_TEST(testSkipInserts);
     CPPUNIT_TEST(testSkipDeletes);
     CPPUNIT_TEST(testSkipAll);
+    CPPUNIT_TEST(testMapBatch);
+    CPPUNIT_TEST(testMapWithMinUniqueLengths);
+    CPPUNIT_TEST(testContextCache);
+    CPPUNIT_TEST(testSelfQuery);
+    CPPUNIT_TEST(testMapRange);
+    CPPUNIT_TEST(testRepeatFilter);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -43,6 +49,12 @@ public:
     void testSkipInserts();
     void testSkipDeletes();
     void testSkipAll();
+    void testMapBatch();
+    void testMapWithMinUniqueLengths();
+    void testContextCache();
+    void testSelfQuery();
+    void testMapRange();
+    void testRepeatFilter();
     
 };
 
@@ -0,0 +1,88 @@
+// Test keeping the slowest queries.
+
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "../QueryTracer.hpp"
+#include "../util.hpp"
+
+#include "QueryTracerTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( QueryTracerTests );
+
+void QueryTracerTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void QueryTracerTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure only the slowest queries offered from several threads are kept,
+ * slowest first.
+ */
+void QueryTracerTests::testKeepsSlowest() {
+    QueryTracer tracer(3);
+    
+    // Everything gets in until we have enough.
+    CPPUNIT_ASSERT(tracer.wouldKeep(1));
+    
+    std::vector<std::thread> threads;
+    for(size_t thread = 0; thread < 4; thread++) {
+        threads.emplace_back([&tracer, thread]() {
+            for(uint64_t i = thread; i < 100; i += 4) {
+                if(tracer.wouldKeep(i)) {
+                    tracer.offer({i, std::to_string(i), {}, {}});
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    std::vector<QueryTracer::Trace> slowest = tracer.getSlowest();
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, slowest.size());
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 99, slowest[0].nanoseconds);
+    CPPUNIT_ASSERT_EQUAL(std::string("98"), slowest[1].query);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 97, slowest[2].nanoseconds);
+    
+    // Now only slower ones get in.
+    CPPUNIT_ASSERT(!tracer.wouldKeep(97));
+    CPPUNIT_ASSERT(tracer.wouldKeep(98));
+    
+    // And a tracer that keeps nothing takes nothing.
+    QueryTracer none(0);
+    CPPUNIT_ASSERT(!none.wouldKeep(1000000));
+}
+
+/**
+ * Make sure the slow queries are saved as a FASTA with their details in the
+ * headers.
+ */
+void QueryTracerTests::testWrite() {
+    QueryTracer tracer(2);
+    tracer.offer({5, "GATTACA", {{"credit", "1"}}, {{"mapped", 4}}});
+    tracer.offer({10, "CAT", {}, {}});
+    
+    tracer.write(tempDir + "/slow.fa");
+    
+    std::ifstream in(tempDir + "/slow.fa");
+    std::string line;
+    std::getline(in, line);
+    CPPUNIT_ASSERT_EQUAL(std::string(">slow1 nanoseconds=10"), line);
+    std::getline(in, line);
+    CPPUNIT_ASSERT_EQUAL(std::string("CAT"), line);
+    std::getline(in, line);
+    CPPUNIT_ASSERT_EQUAL(std::string(">slow2 nanoseconds=5 mapped=4 credit=1"),
+        line);
+    std::getline(in, line);
+    CPPUNIT_ASSERT_EQUAL(std::string("GATTACA"), line);
+    CPPUNIT_ASSERT(!std::getline(in, line));
+}
@@ -0,0 +1,29 @@
+#ifndef QUERYTRACERTESTS_HPP
+#define QUERYTRACERTESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for QueryTracer.
+ */
+class QueryTracerTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(QueryTracerTests);
+    CPPUNIT_TEST(testKeepsSlowest);
+    CPPUNIT_TEST(testWrite);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to save slow queries in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testKeepsSlowest();
+    void testWrite();
+};
+
+#endif
@@ -0,0 +1,126 @@
+// Test caching whole-read mapping results.
+
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../ReadResultCache.hpp"
+#include "../util.hpp"
+
+#include "ReadResultCacheTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( ReadResultCacheTests );
+
+// Define constants
+const std::string ReadResultCacheTests::filename = "Test/haplotypes.fa";
+
+void ReadResultCacheTests::setUp() {
+    // Build an index in a temporary directory.
+    tempDir = make_tempdir();
+    
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    index = new FMDIndex(tempDir + "/index.basename");
+    scheme = new NaturalMappingScheme(FMDIndexView(*index));
+}
+
+
+void ReadResultCacheTests::tearDown() {
+    delete scheme;
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure what goes in comes back out, and nothing else does.
+ */
+void ReadResultCacheTests::testGetPut() {
+    ReadResultCache cache(10);
+    
+    CPPUNIT_ASSERT(cache.get("GATTACA") == nullptr);
+    
+    std::shared_ptr<const std::vector<PackedMapping>> mappings(
+        new std::vector<PackedMapping>(3,
+        PackedMapping(Mapping(TextPosition(1, 5)))));
+    cache.put("CAT", mappings);
+    
+    CPPUNIT_ASSERT(cache.get("CAT") == mappings);
+    CPPUNIT_ASSERT(cache.get("ATG") == nullptr);
+}
+
+/**
+ * Make sure the cache stays bounded and throws out the least recently used
+ * sequence.
+ */
+void ReadResultCacheTests::testEviction() {
+    // Use one shard so we know where everything goes.
+    ReadResultCache cache(2, 1);
+    
+    std::shared_ptr<const std::vector<PackedMapping>> mappings(
+        new std::vector<PackedMapping>(1));
+    cache.put("A", mappings);
+    cache.put("C", mappings);
+    
+    // Use A so C is the oldest.
+    CPPUNIT_ASSERT(cache.get("A") != nullptr);
+    
+    cache.put("G", mappings);
+    CPPUNIT_ASSERT(cache.get("A") != nullptr);
+    CPPUNIT_ASSERT(cache.get("C") == nullptr);
+    CPPUNIT_ASSERT(cache.get("G") != nullptr);
+    
+    // A cache smaller than its number of shards should still only hold as
+    // many sequences as asked for.
+    ReadResultCache tinyCache(1);
+    tinyCache.put("A", mappings);
+    tinyCache.put("C", mappings);
+    CPPUNIT_ASSERT(tinyCache.get("A") == nullptr);
+    CPPUNIT_ASSERT(tinyCache.get("C") != nullptr);
+}
+
+/**
+ * Make sure mapping through the cache gives the same results as mapping
+ * directly, and only maps each sequence once.
+ */
+void ReadResultCacheTests::testMapBatch() {
+    // Use one shard so nothing we need gets evicted.
+    ReadResultCache cache(10, 1);
+    
+    // Use the second contig, a piece of it, and something not in the index,
+    // with some of them repeated.
+    std::string contig = "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA";
+    std::string piece = "GCTATTATTTCTTT";
+    std::string missing = "AAAAAAAAAAAAAA";
+    std::vector<std::string> batch {contig, piece, contig, missing, piece};
+    
+    MappingBatchResult expected;
+    scheme->mapBatch(batch, expected);
+    
+    MappingBatchResult results;
+    cache.mapBatch(*scheme, batch, results);
+    
+    CPPUNIT_ASSERT_EQUAL(batch.size(), results.getQueryCount());
+    for(size_t i = 0; i < batch.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL(batch[i].size(), results.getQueryLength(i));
+        for(size_t base = 0; base < batch[i].size(); base++) {
+            CPPUNIT_ASSERT(results.get(i, base).unpack() ==
+                expected.get(i, base).unpack());
+        }
+    }
+    
+    // Three distinct sequences got mapped, and the other two were duplicates.
+    StatTracker stats = cache.getStats();
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, stats["readCacheMisses"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, stats["readCacheHits"]);
+    
+    // Doing it again should map nothing.
+    cache.mapBatch(*scheme, batch, results);
+    stats = cache.getStats();
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, stats["readCacheMisses"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 7, stats["readCacheHits"]);
+    CPPUNIT_ASSERT(results.get(0, 0).unpack() == expected.get(0, 0).unpack());
+}
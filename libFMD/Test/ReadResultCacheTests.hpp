@@ -0,0 +1,42 @@
+#ifndef READRESULTCACHETESTS_HPP
+#define READRESULTCACHETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+#include "../NaturalMappingScheme.hpp"
+
+/**
+ * Tests for the cache of whole-read mapping results.
+ */
+class ReadResultCacheTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ReadResultCacheTests);
+    CPPUNIT_TEST(testGetPut);
+    CPPUNIT_TEST(testEviction);
+    CPPUNIT_TEST(testMapBatch);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index to map to.
+    FMDIndex const* index;
+    
+    // Holds a mapping scheme for it.
+    NaturalMappingScheme* scheme;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testGetPut();
+    void testEviction();
+    void testMapBatch();
+};
+
+#endif
@@ -0,0 +1,147 @@
+// Test finding patterns with mismatches using search schemes.
+
+#include <set>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../FMDIndexView.hpp"
+#include "../SearchScheme.hpp"
+#include "../util.hpp"
+
+#include "SearchSchemeTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( SearchSchemeTests );
+
+// Define constants
+const std::string SearchSchemeTests::filename = "Test/haplotypes.fa";
+
+void SearchSchemeTests::setUp() {
+    // Build an index in a temporary directory.
+    tempDir = make_tempdir();
+    
+    FMDIndexBuilder builder(tempDir + "/index.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    index = new FMDIndex(tempDir + "/index.basename");
+}
+
+
+void SearchSchemeTests::tearDown() {
+    delete index;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Find everything within the given number of mismatches of the given pattern
+ * the slow way, extending left with every base at every step. Adds the
+ * forward start and end offset of each string found to the given set.
+ */
+static void bruteForce(const FMDIndexView& view,
+    const EncodedQuery::View& pattern, size_t index, FMDPosition range,
+    size_t mismatchesLeft, std::set<std::pair<int64_t, int64_t>>& found) {
+    
+    if(index == 0) {
+        found.insert(std::make_pair(range.getForwardStart(),
+            range.getEndOffset()));
+        return;
+    }
+    
+    for(uint8_t code = 0; code < 4; code++) {
+        bool mismatch = code != pattern[index - 1];
+        if(mismatch && mismatchesLeft == 0) {
+            continue;
+        }
+        FMDPosition extended = range;
+        view.getIndex().extendLeft(extended, code);
+        if(!extended.isEmpty(view)) {
+            bruteForce(view, pattern, index - 1, extended,
+                mismatchesLeft - mismatch, found);
+        }
+    }
+}
+
+/**
+ * Make sure the schemes find exactly what trying every mismatch finds.
+ */
+void SearchSchemeTests::testMatchesBruteForce() {
+    FMDIndexView view(*index);
+    
+    // Use pieces of the contigs, some with mismatches, and something that
+    // isn't there.
+    std::vector<std::string> patterns {
+        "GCGATTCGACGC",
+        "GCGATTGGACGC",
+        "CGCTATTATTTCTTTC",
+        "CGCTATAATTTCATTC",
+        "CAAGCAT",
+        "TTTTTTTTTTTT",
+        "GCGANTCGACGC",
+        "AC"
+    };
+    
+    for(size_t k = 0; k <= 4; k++) {
+        const SearchScheme& scheme = SearchScheme::forMismatches(k);
+        CPPUNIT_ASSERT_EQUAL(k, scheme.getMaxMismatches());
+        
+        for(const std::string& pattern : patterns) {
+            EncodedQuery encoded(pattern);
+            
+            std::set<std::pair<int64_t, int64_t>> expected;
+            bruteForce(view, encoded.forward(), pattern.size(),
+                FMDPosition(view), k, expected);
+            
+            std::set<std::pair<int64_t, int64_t>> got;
+            for(const auto& result : scheme.find(view, encoded.forward())) {
+                CPPUNIT_ASSERT(result.second <= k);
+                got.insert(std::make_pair(result.first.getForwardStart(),
+                    result.first.getEndOffset()));
+            }
+            
+            CPPUNIT_ASSERT(expected == got);
+        }
+    }
+}
+
+/**
+ * Make sure existence checks agree with finding.
+ */
+void SearchSchemeTests::testExists() {
+    FMDIndexView view(*index);
+    
+    EncodedQuery there("GCGATTCGACGC");
+    EncodedQuery near("GCGATTGGACGC");
+    EncodedQuery far("NNNGATTACNNN");
+    
+    CPPUNIT_ASSERT(SearchScheme::forMismatches(0).exists(view,
+        there.forward()));
+    CPPUNIT_ASSERT(SearchScheme::forMismatches(0).exists(view,
+        there.reverseComplement()));
+    CPPUNIT_ASSERT(!SearchScheme::forMismatches(0).exists(view,
+        near.forward()));
+    CPPUNIT_ASSERT(SearchScheme::forMismatches(1).exists(view,
+        near.forward()));
+    CPPUNIT_ASSERT(!SearchScheme::forMismatches(2).exists(view,
+        far.forward()));
+    
+    CPPUNIT_ASSERT_THROW(SearchScheme::forMismatches(
+        SearchScheme::MAX_MISMATCHES + 1), std::runtime_error);
+}
+
+/**
+ * Make sure schemes that can't work are refused.
+ */
+void SearchSchemeTests::testBadSchemes() {
+    // Parts 0 and 2 aren't next to each other.
+    CPPUNIT_ASSERT_THROW(SearchScheme({{{0, 2, 1}, {0, 0, 0}, {0, 1, 1}}}),
+        std::runtime_error);
+    // Bounds can't go down.
+    CPPUNIT_ASSERT_THROW(SearchScheme({{{0, 1}, {0, 0}, {1, 0}}}),
+        std::runtime_error);
+    // Every part has to be searched.
+    CPPUNIT_ASSERT_THROW(SearchScheme({{{0, 0}, {0, 0}, {0, 1}}}),
+        std::runtime_error);
+}
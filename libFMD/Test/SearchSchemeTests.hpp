@@ -0,0 +1,38 @@
+#ifndef SEARCHSCHEMETESTS_HPP
+#define SEARCHSCHEMETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+
+/**
+ * Tests for search schemes.
+ */
+class SearchSchemeTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SearchSchemeTests);
+    CPPUNIT_TEST(testMatchesBruteForce);
+    CPPUNIT_TEST(testExists);
+    CPPUNIT_TEST(testBadSchemes);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep a string saying where to get the haplotypes.
+    static const std::string filename;
+    
+    // Holds the temporary directory with the index in it.
+    std::string tempDir;
+    
+    // Holds the index to search.
+    FMDIndex const* index;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testMatchesBruteForce();
+    void testExists();
+    void testBadSchemes();
+};
+
+#endif
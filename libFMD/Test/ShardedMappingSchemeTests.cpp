@@ -0,0 +1,158 @@
+// Test mapping against several shards of an index.
+
+#include <map>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../FMDIndexBuilder.hpp"
+#include "../ShardedMappingScheme.hpp"
+#include "../util.hpp"
+
+#include "ShardedMappingSchemeTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( ShardedMappingSchemeTests );
+
+// Define constants
+const std::string ShardedMappingSchemeTests::filename = "Test/haplotypes.fa";
+const std::string ShardedMappingSchemeTests::filename2 =
+    "Test/duplicated.fa";
+
+void ShardedMappingSchemeTests::setUp() {
+    // Build an index for each shard, and one of everything, in a temporary
+    // directory.
+    tempDir = make_tempdir();
+    
+    FMDIndexBuilder builder(tempDir + "/shard0.basename");
+    builder.add(filename);
+    delete builder.build();
+    
+    FMDIndexBuilder builder2(tempDir + "/shard1.basename");
+    builder2.add(filename2);
+    delete builder2.build();
+    
+    FMDIndexBuilder combinedBuilder(tempDir + "/combined.basename");
+    combinedBuilder.add(filename);
+    combinedBuilder.add(filename2);
+    delete combinedBuilder.build();
+    
+    // Load them without the full SAs.
+    index = new FMDIndex(tempDir + "/shard0.basename");
+    index2 = new FMDIndex(tempDir + "/shard1.basename");
+    combined = new FMDIndex(tempDir + "/combined.basename");
+    
+    scheme = new NaturalMappingScheme(FMDIndexView(*index));
+    scheme2 = new NaturalMappingScheme(FMDIndexView(*index2));
+}
+
+
+void ShardedMappingSchemeTests::tearDown() {
+    delete scheme;
+    delete scheme2;
+    delete index;
+    delete index2;
+    delete combined;
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure each shard's texts are numbered after the ones before it.
+ */
+void ShardedMappingSchemeTests::testTextOffsets() {
+    ShardedMappingScheme sharded({scheme, scheme2});
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, sharded.getShardCount());
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, sharded.getTextOffset(0));
+    CPPUNIT_ASSERT_EQUAL(index->getNumberOfContigs() * 2,
+        sharded.getTextOffset(1));
+}
+
+/**
+ * Make sure a query found in only one shard maps where it would in a single
+ * index of everything.
+ */
+void ShardedMappingSchemeTests::testMatchesSingleIndex() {
+    ShardedMappingScheme sharded({scheme, scheme2});
+    
+    // One shard of everything applies the same ownership rule to a single
+    // index.
+    NaturalMappingScheme combinedScheme{FMDIndexView(*combined)};
+    ShardedMappingScheme single({&combinedScheme});
+    
+    // Grab all of the second contig, which only the first shard has, both
+    // ways around, and then the start of it running into the first contig,
+    // which the second shard has twice.
+    std::string contig = "CGGGCGCATCGCTATTATTTCTTTCTCTTTTCACA";
+    for(std::string query : {contig, reverseComplement(contig),
+        std::string("CGGGCGCATCGCTATTATTTCTTTCTCATGCTTCGGCGATTCG")}) {
+        
+        std::map<size_t, TextPosition> expected;
+        single.map(query, [&](size_t i, TextPosition mappedTo) {
+            expected[i] = mappedTo;
+        });
+        
+        std::map<size_t, TextPosition> got;
+        sharded.map(query, [&](size_t i, TextPosition mappedTo) {
+            got[i] = mappedTo;
+        });
+        
+        // Exact context unique to one shard is unique in the single index,
+        // and the other way around, so the same bases map to the same places.
+        CPPUNIT_ASSERT(!got.empty());
+        CPPUNIT_ASSERT(expected == got);
+        
+        // Everything the natural scheme maps on the single index has such
+        // context, so it maps the same way here.
+        combinedScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            CPPUNIT_ASSERT(got.count(i));
+            CPPUNIT_ASSERT(got[i] == mappedTo);
+        });
+    }
+    
+    // Where the query runs into the duplicated contig, nothing maps.
+    std::string query = "CGGGCGCATCGCTATTATTTCTTTCTCATGCTTCGGCGATTCG";
+    sharded.map(query, [&](size_t i, TextPosition mappedTo) {
+        CPPUNIT_ASSERT(i < 27);
+    });
+}
+
+/**
+ * Make sure a query that only one shard can map doesn't map if another shard
+ * has it too.
+ */
+void ShardedMappingSchemeTests::testFoundElsewhere() {
+    ShardedMappingScheme sharded({scheme, scheme2});
+    
+    // Grab all of the first contig, which the first shard has once and the
+    // second shard has twice.
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    // Only the first shard can map it by itself.
+    size_t shardMapped = 0;
+    scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+        shardMapped++;
+    });
+    CPPUNIT_ASSERT(shardMapped > 0);
+    
+    shardMapped = 0;
+    scheme2->map(query, [&](size_t i, TextPosition mappedTo) {
+        shardMapped++;
+    });
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, shardMapped);
+    
+    // But no context of it is in the first shard and not the second.
+    size_t mappedBases = 0;
+    sharded.map(query, [&](size_t i, TextPosition mappedTo) {
+        mappedBases++;
+    });
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, mappedBases);
+}
+
+/**
+ * Make sure there has to be at least one shard.
+ */
+void ShardedMappingSchemeTests::testNoShards() {
+    CPPUNIT_ASSERT_THROW(ShardedMappingScheme(
+        std::vector<const MappingScheme*>()), std::runtime_error);
+}
@@ -0,0 +1,50 @@
+#ifndef SHARDEDMAPPINGSCHEMETESTS_HPP
+#define SHARDEDMAPPINGSCHEMETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../FMDIndex.hpp"
+#include "../NaturalMappingScheme.hpp"
+
+/**
+ * Tests for mapping against several shards of an index at once.
+ */
+class ShardedMappingSchemeTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(ShardedMappingSchemeTests);
+    CPPUNIT_TEST(testTextOffsets);
+    CPPUNIT_TEST(testMatchesSingleIndex);
+    CPPUNIT_TEST(testFoundElsewhere);
+    CPPUNIT_TEST(testNoShards);
+    CPPUNIT_TEST_SUITE_END();
+    
+    // Keep strings saying where to get the haplotypes for each shard.
+    static const std::string filename;
+    static const std::string filename2;
+    
+    // Holds the temporary directory with the indexes in it.
+    std::string tempDir;
+    
+    // Holds the index for each shard.
+    FMDIndex const* index;
+    FMDIndex const* index2;
+    
+    // Holds an index of both shards' haplotypes together.
+    FMDIndex const* combined;
+    
+    // Holds a mapping scheme for each shard.
+    NaturalMappingScheme* scheme;
+    NaturalMappingScheme* scheme2;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testTextOffsets();
+    void testMatchesSingleIndex();
+    void testFoundElsewhere();
+    void testNoShards();
+};
+
+#endif
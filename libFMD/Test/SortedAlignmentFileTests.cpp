@@ -0,0 +1,142 @@
+// Test sorted, indexed alignments.
+
+#include <fstream>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "../SortedAlignmentFile.hpp"
+#include "../SortedAlignmentWriter.hpp"
+#include "../util.hpp"
+
+#include "SortedAlignmentFileTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( SortedAlignmentFileTests );
+
+void SortedAlignmentFileTests::setUp() {
+    tempDir = make_tempdir();
+}
+
+
+void SortedAlignmentFileTests::tearDown() {
+    boost::filesystem::remove_all(tempDir);
+}
+
+/**
+ * Make sure segments come out sorted and can be found by region.
+ */
+void SortedAlignmentFileTests::testQuery() {
+    SortedAlignmentWriter writer(tempDir + "/sorted.bin", {"ref", "chr2"},
+        1 << 20);
+    
+    // Bases 0-3 of read1 go forward to 100-103 on chr2, and bases 6-8 go
+    // backward to 50-48 on ref. Read2 goes to 20-24 on ref, and read3 goes
+    // way out past the first index window on ref. Send the last ones as
+    // mapReads would, as binary alignment records.
+    writer.addRead("read1", 10, {{0, 1, 100, 0, 4}, {6, 0, 50, 1, 3}});
+    std::string data;
+    AlignmentFile::appendRead(data, "unmapped", 5, {});
+    AlignmentFile::appendRead(data, "read2", 5, {{0, 0, 20, 0, 5}});
+    AlignmentFile::appendRead(data, "read3", 2, {{0, 0, 40000, 0, 2}});
+    writer.addReads(data);
+    writer.close();
+    
+    SortedAlignmentFile alignment(tempDir + "/sorted.bin");
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, alignment.getReferenceNames().size());
+    CPPUNIT_ASSERT_EQUAL(std::string("chr2"),
+        alignment.getReferenceNames()[1]);
+    
+    // Everything should come out in order.
+    SortedAlignmentFile::Record record;
+    CPPUNIT_ASSERT(alignment.next(record));
+    CPPUNIT_ASSERT_EQUAL(std::string("read2"), record.name);
+    CPPUNIT_ASSERT(alignment.next(record));
+    CPPUNIT_ASSERT_EQUAL(std::string("read1"), record.name);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 48, record.start);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, record.backwards);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 6, record.queryStart);
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 10, record.readLength);
+    CPPUNIT_ASSERT(alignment.next(record));
+    CPPUNIT_ASSERT_EQUAL(std::string("read3"), record.name);
+    CPPUNIT_ASSERT(alignment.next(record));
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 1, record.reference);
+    CPPUNIT_ASSERT(!alignment.next(record));
+    
+    std::vector<SortedAlignmentFile::Record> found;
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, alignment.query(0, 24, 49, found));
+    CPPUNIT_ASSERT_EQUAL(std::string("read2"), found[0].name);
+    CPPUNIT_ASSERT_EQUAL(std::string("read1"), found[1].name);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, alignment.query(0, 25, 48, found));
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, alignment.query(0, 40001, 50000, found));
+    CPPUNIT_ASSERT_EQUAL(std::string("read3"), found[0].name);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, alignment.query(0, 90000, 90010, found));
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, alignment.query(1, 0, 1000, found));
+    CPPUNIT_ASSERT_EQUAL((uint64_t) 100, found[0].start);
+}
+
+/**
+ * Make sure spilling to disk and merging back finds the same segments as
+ * looking through them all.
+ */
+void SortedAlignmentFileTests::testSpill() {
+    // Use so little memory that almost every read spills.
+    SortedAlignmentWriter writer(tempDir + "/sorted.bin", {"a", "b", "c"},
+        1000);
+    
+    std::mt19937 random(1);
+    std::vector<SortedAlignmentFile::Record> all;
+    for(size_t i = 0; i < 2000; i++) {
+        std::string name = "read" + std::to_string(i);
+        uint64_t reference = random() % 3;
+        uint64_t start = random() % 100000;
+        uint64_t length = 1 + random() % 300;
+        writer.addRead(name, 400, {{5, reference, start, 0, length}});
+        all.push_back({reference, start, length, 0, 5, 400, name});
+    }
+    writer.close();
+    
+    // The runs should be cleaned up.
+    CPPUNIT_ASSERT(!boost::filesystem::exists(tempDir + "/sorted.bin.run0"));
+    
+    SortedAlignmentFile alignment(tempDir + "/sorted.bin");
+    std::vector<SortedAlignmentFile::Record> found;
+    for(size_t i = 0; i < 200; i++) {
+        uint64_t reference = random() % 3;
+        uint64_t start = random() % 100000;
+        uint64_t end = start + 1 + random() % 40000;
+        
+        size_t expected = 0;
+        for(const SortedAlignmentFile::Record& record : all) {
+            if(record.reference == reference && record.start < end &&
+                record.getEnd() > start) {
+                expected++;
+            }
+        }
+        
+        CPPUNIT_ASSERT_EQUAL(expected, alignment.query(reference, start, end,
+            found));
+        for(size_t j = 1; j < found.size(); j++) {
+            CPPUNIT_ASSERT(!(found[j] < found[j - 1]));
+        }
+    }
+}
+
+/**
+ * Make sure files that aren't sorted alignments, or are cut short, are
+ * rejected.
+ */
+void SortedAlignmentFileTests::testBadFile() {
+    std::ofstream garbage(tempDir + "/garbage.bin");
+    garbage << "This is not an alignment.";
+    garbage.close();
+    CPPUNIT_ASSERT_THROW(SortedAlignmentFile(tempDir + "/garbage.bin"),
+        std::runtime_error);
+    
+    // A header with no index after it is cut short.
+    std::ofstream truncated(tempDir + "/truncated.bin", std::ios::binary);
+    truncated << SortedAlignmentFile::makeHeader({"ref"});
+    truncated.close();
+    CPPUNIT_ASSERT_THROW(SortedAlignmentFile(tempDir + "/truncated.bin"),
+        std::runtime_error);
+}
@@ -0,0 +1,31 @@
+#ifndef SORTEDALIGNMENTFILETESTS_HPP
+#define SORTEDALIGNMENTFILETESTS_HPP
+
+#include <string>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for SortedAlignmentFile and SortedAlignmentWriter.
+ */
+class SortedAlignmentFileTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SortedAlignmentFileTests);
+    CPPUNIT_TEST(testQuery);
+    CPPUNIT_TEST(testSpill);
+    CPPUNIT_TEST(testBadFile);
+    CPPUNIT_TEST_SUITE_END();
+    
+private:
+    // Holds the temporary directory to save alignments in.
+    std::string tempDir;
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testQuery();
+    void testSpill();
+    void testBadFile();
+};
+
+#endif
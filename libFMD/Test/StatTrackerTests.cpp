@@ -0,0 +1,121 @@
+// Test the sharded stat tracker.
+
+#include <thread>
+#include <vector>
+
+#include "../StatTracker.hpp"
+
+#include "StatTrackerTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( StatTrackerTests );
+
+void StatTrackerTests::setUp() {
+}
+
+
+void StatTrackerTests::tearDown() {
+}
+
+/**
+ * Make sure Counters used from lots of threads at once add up, along with
+ * updates by name.
+ */
+void StatTrackerTests::testCounters() {
+    StatTracker stats;
+    StatTracker::Counter counter = stats.counter("counted");
+    
+    std::vector<std::thread> threads;
+    for(size_t thread = 0; thread < 8; thread++) {
+        threads.emplace_back([&]() {
+            for(size_t i = 0; i < 10000; i++) {
+                counter.add(1);
+            }
+            stats.add("named", 2);
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 80000, stats["counted"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 16, stats["named"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, stats["missing"]);
+    
+    // Getting the Counter again should get the same stat.
+    stats.counter("counted").add(5);
+    CPPUNIT_ASSERT_EQUAL((size_t) 80005, stats["counted"]);
+}
+
+/**
+ * Make sure copying, assigning, and adding StatTrackers carries the Counters'
+ * values along, and leaves Counters working.
+ */
+void StatTrackerTests::testCopy() {
+    StatTracker stats;
+    StatTracker::Counter counter = stats.counter("counted");
+    counter.add(3);
+    
+    StatTracker copy(stats);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, copy["counted"]);
+    
+    // The copy has its own value.
+    counter.add(1);
+    CPPUNIT_ASSERT_EQUAL((size_t) 3, copy["counted"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, stats["counted"]);
+    
+    copy += stats;
+    CPPUNIT_ASSERT_EQUAL((size_t) 7, copy["counted"]);
+    
+    // Assigning replaces what the Counter had counted.
+    stats = copy;
+    CPPUNIT_ASSERT_EQUAL((size_t) 7, stats["counted"]);
+    counter.add(1);
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, stats["counted"]);
+}
+
+/**
+ * Make sure Histograms count values in the right power-of-2 buckets, and show
+ * up as stats for those buckets.
+ */
+void StatTrackerTests::testHistogram() {
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, StatTracker::Histogram::getBucket(0));
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, StatTracker::Histogram::getBucket(1));
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, StatTracker::Histogram::getBucket(3));
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, StatTracker::Histogram::getBucket(8));
+    CPPUNIT_ASSERT_EQUAL((size_t) 64,
+        StatTracker::Histogram::getBucket((size_t) -1));
+
+    StatTracker stats;
+    StatTracker::Histogram histogram = stats.histogram("lengths");
+    
+    std::vector<std::thread> threads;
+    for(size_t thread = 0; thread < 4; thread++) {
+        threads.emplace_back([&]() {
+            histogram.add(0);
+            histogram.add(5);
+            histogram.add(7);
+            histogram.add(100);
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, stats["lengths:0-0"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 8, stats["lengths:4-7"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, stats["lengths:64-127"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, stats["lengths:8-15"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 448, stats["lengths:sum"]);
+    
+    // Buckets merge like any other stat.
+    StatTracker copy(stats);
+    copy += stats;
+    CPPUNIT_ASSERT_EQUAL((size_t) 16, copy["lengths:4-7"]);
+    
+    {
+        // Time something
+        StatTracker::ScopedTimer timer(stats.histogram("time"));
+    }
+    CPPUNIT_ASSERT(stats["time:sum"] > 0);
+}
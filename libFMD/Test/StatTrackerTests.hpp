@@ -0,0 +1,25 @@
+#ifndef STATTRACKERTESTS_HPP
+#define STATTRACKERTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for StatTracker.
+ */
+class StatTrackerTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(StatTrackerTests);
+    CPPUNIT_TEST(testCounters);
+    CPPUNIT_TEST(testCopy);
+    CPPUNIT_TEST(testHistogram);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testCounters();
+    void testCopy();
+    void testHistogram();
+};
+
+#endif
@@ -0,0 +1,90 @@
+// Test the shared task pool.
+
+#include <atomic>
+#include <stdexcept>
+
+#include "../TaskPool.hpp"
+
+#include "TaskPoolTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( TaskPoolTests );
+
+void TaskPoolTests::setUp() {
+}
+
+
+void TaskPoolTests::tearDown() {
+}
+
+/**
+ * Make sure every task in a group runs exactly once.
+ */
+void TaskPoolTests::testRunsAll() {
+    TaskPool pool(3);
+    
+    std::atomic<size_t> total(0);
+    TaskGroup group(pool);
+    for(size_t i = 0; i < 1000; i++) {
+        group.run([&total, i]() {
+            total += i;
+        });
+    }
+    group.join();
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 999 * 1000 / 2, total.load());
+}
+
+/**
+ * Make sure tasks can wait on groups of their own, even when there are more
+ * of them than workers.
+ */
+void TaskPoolTests::testNested() {
+    TaskPool pool(2);
+    
+    std::atomic<size_t> total(0);
+    TaskGroup outer(pool);
+    for(size_t i = 0; i < 8; i++) {
+        outer.run([&, i]() {
+            TaskGroup inner(pool);
+            for(size_t j = 0; j < 8; j++) {
+                inner.run([&, i, j]() {
+                    total += i * 8 + j;
+                });
+            }
+            inner.join();
+        });
+    }
+    outer.join();
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 63 * 64 / 2, total.load());
+}
+
+/**
+ * Make sure an exception in a task comes out of join(), after the other tasks
+ * have run.
+ */
+void TaskPoolTests::testException() {
+    TaskPool pool(2);
+    
+    std::atomic<size_t> ran(0);
+    TaskGroup group(pool);
+    group.run([]() {
+        throw std::runtime_error("Task failed");
+    });
+    for(size_t i = 0; i < 10; i++) {
+        group.run([&ran]() {
+            ran++;
+        });
+    }
+    
+    CPPUNIT_ASSERT_THROW(group.join(), std::runtime_error);
+    CPPUNIT_ASSERT_EQUAL((size_t) 10, ran.load());
+    
+    // The group can be used again, and doesn't throw the same thing twice.
+    group.run([&ran]() {
+        ran++;
+    });
+    group.join();
+    CPPUNIT_ASSERT_EQUAL((size_t) 11, ran.load());
+}
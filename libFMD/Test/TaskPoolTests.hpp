@@ -0,0 +1,25 @@
+#ifndef TASKPOOLTESTS_HPP
+#define TASKPOOLTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for TaskPool and TaskGroup.
+ */
+class TaskPoolTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TaskPoolTests);
+    CPPUNIT_TEST(testRunsAll);
+    CPPUNIT_TEST(testNested);
+    CPPUNIT_TEST(testException);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testRunsAll();
+    void testNested();
+    void testException();
+};
+
+#endif
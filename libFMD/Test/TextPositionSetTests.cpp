@@ -0,0 +1,79 @@
+// Test TextPositionSet objects.
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "../TextPositionSet.hpp"
+
+#include "TextPositionSetTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( TextPositionSetTests );
+
+void TextPositionSetTests::setUp() {
+}
+
+
+void TextPositionSetTests::tearDown() {
+}
+
+/**
+ * Make sure a set with only a few positions sorts and de-duplicates them.
+ */
+void TextPositionSetTests::testInline() {
+    TextPositionSet set;
+    CPPUNIT_ASSERT(set.empty());
+    CPPUNIT_ASSERT(set.begin() == set.end());
+    
+    CPPUNIT_ASSERT(set.insert(TextPosition(3, 5)));
+    CPPUNIT_ASSERT(set.insert(TextPosition(1, 7)));
+    CPPUNIT_ASSERT(!set.insert(TextPosition(3, 5)));
+    CPPUNIT_ASSERT_EQUAL((size_t) 2, set.size());
+    CPPUNIT_ASSERT(*set.begin() == TextPosition(1, 7));
+    CPPUNIT_ASSERT(*(set.begin() + 1) == TextPosition(3, 5));
+    CPPUNIT_ASSERT_EQUAL((size_t) 1, set.count(TextPosition(1, 7)));
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, set.count(TextPosition(1, 8)));
+    
+    // Sets made from lists should match.
+    CPPUNIT_ASSERT(set == TextPositionSet({TextPosition(3, 5),
+        TextPosition(1, 7), TextPosition(1, 7)}));
+    CPPUNIT_ASSERT(set != TextPositionSet({TextPosition(3, 5)}));
+    
+    set.clear();
+    CPPUNIT_ASSERT(set.empty());
+    CPPUNIT_ASSERT(set == TextPositionSet());
+}
+
+/**
+ * Make sure sets that grow past their inline storage, and copies of them,
+ * hold the same positions as a std::set.
+ */
+void TextPositionSetTests::testAgreesWithSet() {
+    std::mt19937 generator(7);
+    
+    for(size_t trial = 0; trial < 100; trial++) {
+        TextPositionSet set;
+        std::set<TextPosition> truth;
+        
+        size_t inserts = generator() % 20;
+        for(size_t i = 0; i < inserts; i++) {
+            TextPosition position(generator() % 4, generator() % 4);
+            CPPUNIT_ASSERT_EQUAL(truth.insert(position).second,
+                set.insert(position));
+        }
+        
+        // Copy it, so the copy has to get the right storage.
+        TextPositionSet copy(set);
+        for(const TextPositionSet* check : {&set, &copy}) {
+            CPPUNIT_ASSERT_EQUAL(truth.size(), check->size());
+            CPPUNIT_ASSERT(std::equal(truth.begin(), truth.end(),
+                check->begin()));
+        }
+        
+        // Clearing and refilling it should work too.
+        set.clear();
+        set.insert(truth.begin(), truth.end());
+        CPPUNIT_ASSERT(set == copy);
+    }
+}
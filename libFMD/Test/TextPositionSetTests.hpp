@@ -0,0 +1,23 @@
+#ifndef TEXTPOSITIONSETTESTS_HPP
+#define TEXTPOSITIONSETTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for TextPositionSet.
+ */
+class TextPositionSetTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(TextPositionSetTests);
+    CPPUNIT_TEST(testInline);
+    CPPUNIT_TEST(testAgreesWithSet);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testInline();
+    void testAgreesWithSet();
+};
+
+#endif
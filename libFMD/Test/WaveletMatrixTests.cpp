@@ -0,0 +1,99 @@
+// Test the wavelet matrix.
+
+#include <boost/filesystem.hpp>
+#include <random>
+#include <map>
+
+#include "../WaveletMatrix.hpp"
+#include "../util.hpp"
+
+#include "WaveletMatrixTests.hpp"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( WaveletMatrixTests );
+
+void WaveletMatrixTests::setUp() {
+}
+
+
+void WaveletMatrixTests::tearDown() {
+}
+
+/**
+ * Make sure access, rank, set rank, and distinct all agree with a plain scan.
+ */
+void WaveletMatrixTests::testQueries() {
+    for(size_t alphabetSize : {1, 2, 3, 7, 100}) {
+        std::mt19937 generator(alphabetSize);
+        std::vector<WaveletMatrix::Value> values;
+        for(size_t i = 0; i < 1500; i++) {
+            values.push_back(generator() % alphabetSize);
+        }
+        WaveletMatrix matrix(values, alphabetSize);
+        CPPUNIT_ASSERT_EQUAL(values.size(), matrix.size());
+        
+        for(size_t i = 0; i < values.size(); i++) {
+            CPPUNIT_ASSERT_EQUAL((size_t) values[i], matrix[i]);
+        }
+        
+        for(size_t start = 0; start < values.size(); start += 97) {
+            for(size_t end = start; end <= values.size(); end += 131) {
+                // Count everything in the range the slow way.
+                std::map<size_t, size_t> counts;
+                for(size_t i = start; i < end; i++) {
+                    counts[values[i]]++;
+                }
+                
+                for(size_t value = 0; value < alphabetSize; value++) {
+                    CPPUNIT_ASSERT_EQUAL(counts[value],
+                        matrix.rank(value, start, end));
+                }
+                
+                // Count a set of values, with a repeat and an impossible one.
+                std::vector<size_t> set = {0, alphabetSize / 2,
+                    alphabetSize - 1, 0, alphabetSize + 5};
+                size_t expected = counts[0];
+                if(alphabetSize / 2 != 0) {
+                    expected += counts[alphabetSize / 2];
+                }
+                if(alphabetSize - 1 != 0 &&
+                    alphabetSize - 1 != alphabetSize / 2) {
+                    expected += counts[alphabetSize - 1];
+                }
+                CPPUNIT_ASSERT_EQUAL(expected, matrix.rank(set, start, end));
+                
+                // Find the distinct values
+                std::vector<std::pair<size_t, size_t>> expectedDistinct;
+                for(auto& entry : counts) {
+                    if(entry.second > 0) {
+                        expectedDistinct.push_back(entry);
+                    }
+                }
+                CPPUNIT_ASSERT(expectedDistinct == matrix.distinct(start, end));
+            }
+        }
+    }
+}
+
+/**
+ * Make sure a saved wavelet matrix loads back the same.
+ */
+void WaveletMatrixTests::testSaveLoad() {
+    std::string tempDir = make_tempdir();
+    
+    std::vector<WaveletMatrix::Value> values;
+    for(size_t i = 0; i < 1000; i++) {
+        values.push_back((i * i) % 13);
+    }
+    WaveletMatrix(values, 13).save(tempDir + "/test.gwm");
+    WaveletMatrix loaded(tempDir + "/test.gwm");
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 13, loaded.getAlphabetSize());
+    for(size_t i = 0; i < values.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL((size_t) values[i], loaded[i]);
+    }
+    CPPUNIT_ASSERT_EQUAL(WaveletMatrix(values, 13).rank(4, 100, 900),
+        loaded.rank(4, 100, 900));
+    
+    boost::filesystem::remove_all(tempDir);
+}
@@ -0,0 +1,23 @@
+#ifndef WAVELETMATRIXTESTS_HPP
+#define WAVELETMATRIXTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for WaveletMatrix.
+ */
+class WaveletMatrixTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(WaveletMatrixTests);
+    CPPUNIT_TEST(testQueries);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST_SUITE_END();
+    
+public:
+    void setUp();
+    void tearDown();
+
+    void testQueries();
+    void testSaveLoad();
+};
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "../FMDIndex.hpp"
 #include "../FMDIndexBuilder.hpp"
+#include "../MinUniqueTable.hpp"
 #include "../util.hpp"
 
 #include "ZipMappingSchemeTests.hpp"
@@ -281,3 +282,360 @@ void ZipMappingSchemeTests::testMapWithMismatches() {
     CPPUNIT_ASSERT_EQUAL(query.size() - 2, mappedBases);    
 }
 
+/**
+ * Make sure mapping with a k-mer table gets the same results as without.
+ */
+void ZipMappingSchemeTests::testMapWithKmerTable() {
+    // Save a k-mer table next to the index, and load a copy of the index that
+    // will find it.
+    KmerTable(*index, 4).save(tempDir + "/index.basename.kmi");
+    FMDIndex tableIndex(tempDir + "/index.basename");
+    CPPUNIT_ASSERT_EQUAL((size_t) 4, tableIndex.getKmerTableDepth());
+    
+    // Make a scheme just like the normal one on it.
+    ZipMappingScheme<FMDPosition> tableScheme(FMDIndexView(tableIndex, nullptr,
+        ranges));
+    
+    for(std::string query : {"CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "AGAGTCGCAGATGAGCGTCGAATCGCCGAAGCATG", "CATGCTTCGGCGATTCGACG", "ACT",
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGAAAAA"}) {
+        
+        // Map each query both ways
+        std::map<size_t, TextPosition> expected;
+        scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+            expected[i] = mappedTo;
+        });
+        
+        std::map<size_t, TextPosition> got;
+        tableScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            got[i] = mappedTo;
+        });
+        
+        // Make sure we got the same mappings.
+        CPPUNIT_ASSERT(expected == got);
+    }
+}
+
+/**
+ * Make sure splitting queries into windows on multiple threads gives the same
+ * mappings as doing them all at once.
+ */
+void ZipMappingSchemeTests::testMapInWindows() {
+    // Make a scheme that splits even short queries into windows.
+    ZipMappingScheme<FMDPosition> windowScheme(FMDIndexView(*index, nullptr,
+        ranges));
+    windowScheme.queryThreads = 4;
+    windowScheme.minWindowLength = 4;
+    
+    for(std::string query : {"CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+        "AGAGTCGCAGATGAGCGTCGAATCGCCGAAGCATG", "CATGCTTCGGCGATTCGACG", "ACT",
+        "CATGCTTCGGCGATTCGACGCTCATCTGCGAAAAA"}) {
+        
+        // Map each query both ways
+        std::map<size_t, TextPosition> expected;
+        scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+            expected[i] = mappedTo;
+        });
+        
+        std::map<size_t, TextPosition> got;
+        windowScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            got[i] = mappedTo;
+        });
+        
+        // Make sure we got the same mappings.
+        CPPUNIT_ASSERT(expected == got);
+    }
+}
+
+/**
+ * Make sure running out of budget only ever leaves bases unmapped, and counts
+ * them.
+ */
+void ZipMappingSchemeTests::testMapOverBudget() {
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    std::map<size_t, TextPosition> expected;
+    scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+        expected[i] = mappedTo;
+    });
+    
+    // Only let each base run one retraction task.
+    ZipMappingScheme<FMDPosition> taskScheme(FMDIndexView(*index, nullptr,
+        ranges));
+    taskScheme.maxRetractionTasks = 1;
+    
+    std::map<size_t, TextPosition> got;
+    taskScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+        got[i] = mappedTo;
+    });
+    
+    for(const auto& kv : got) {
+        // Anything that did map has to map the same as with no budget.
+        CPPUNIT_ASSERT(expected.count(kv.first));
+        CPPUNIT_ASSERT(expected.at(kv.first) == kv.second);
+    }
+    // And anything that didn't must have been given up on.
+    CPPUNIT_ASSERT(expected.size() - got.size() <=
+        taskScheme.getStats()["overBudgetBases"]);
+    
+    // Give a whole query so little time that it has to run out before any
+    // base is done.
+    ZipMappingScheme<FMDPosition> timeScheme(FMDIndexView(*index, nullptr,
+        ranges));
+    timeScheme.queryMicroseconds = 1;
+    
+    size_t mappedBases = 0;
+    timeScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+        mappedBases++;
+    });
+    
+    CPPUNIT_ASSERT_EQUAL((size_t) 0, mappedBases);
+    CPPUNIT_ASSERT_EQUAL(query.size(),
+        timeScheme.getStats()["overBudgetBases"]);
+    CPPUNIT_ASSERT_EQUAL((size_t) 1,
+        timeScheme.getStats()["overBudgetQueries"]);
+}
+
+/**
+ * Make sure working on several bases at once gives the same mappings as doing
+ * them one at a time, with and without interpolation.
+ */
+void ZipMappingSchemeTests::testMapInterleaved() {
+    for(size_t margin : {0, 2}) {
+        // Make schemes that differ only in how many bases they do at once.
+        ZipMappingScheme<FMDPosition> serialScheme(FMDIndexView(*index,
+            nullptr, ranges));
+        serialScheme.interpolationMargin = margin;
+        
+        ZipMappingScheme<FMDPosition> interleavedScheme(FMDIndexView(*index,
+            nullptr, ranges));
+        interleavedScheme.interpolationMargin = margin;
+        interleavedScheme.interleavedBases = 5;
+        
+        for(std::string query : {"CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT",
+            "AGAGTCGCAGATGAGCGTCGAATCGCCGAAGCATG", "CATGCTTCGGCGATTCGACG",
+            "ACT", "CATGCTTCGGCGATTCGACGCTCATCTGCGAAAAA"}) {
+            
+            // Map each query both ways
+            std::map<size_t, TextPosition> expected;
+            serialScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+                expected[i] = mappedTo;
+            });
+            
+            std::map<size_t, TextPosition> got;
+            interleavedScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+                got[i] = mappedTo;
+            });
+            
+            // Make sure we got the same mappings.
+            CPPUNIT_ASSERT(expected == got);
+        }
+        
+        // And the same amount of work.
+        CPPUNIT_ASSERT_EQUAL(serialScheme.getStats()["basesAttempted"],
+            interleavedScheme.getStats()["basesAttempted"]);
+        CPPUNIT_ASSERT_EQUAL(serialScheme.getStats()["basesInterpolated"],
+            interleavedScheme.getStats()["basesInterpolated"]);
+    }
+}
+
+/**
+ * Make sure bases are interpolated inside an exact match only when they have
+ * more than the interpolation margin of context on both sides.
+ */
+void ZipMappingSchemeTests::testMapInterpolated() {
+    // The duplicated contig, which matches itself exactly all the way along.
+    std::string contig = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    // Where in the contig do our queries start?
+    size_t start = 10;
+    
+    for(size_t margin : {5, 7, 9}) {
+        ZipMappingScheme<FMDPosition> interpolatingScheme(FMDIndexView(*index,
+            nullptr, ranges));
+        interpolatingScheme.interpolationMargin = margin;
+        
+        // In a query of 2 * margin + 1 bases, only the middle base has more
+        // than margin bases of context on both sides (counting itself). It
+        // should be filled in from the base before it.
+        std::string query = contig.substr(start, 2 * margin + 1);
+        
+        std::map<size_t, TextPosition> mappings;
+        interpolatingScheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            mappings[i] = mappedTo;
+        });
+        
+        CPPUNIT_ASSERT_EQUAL((size_t) 1,
+            interpolatingScheme.getStats()["basesInterpolated"]);
+        
+        // It still needs to go to the right place, one past the base before.
+        CPPUNIT_ASSERT(mappings.count(margin));
+        CPPUNIT_ASSERT(mappings.count(margin - 1));
+        CPPUNIT_ASSERT_EQUAL(start + margin, mappings[margin].getOffset());
+        CPPUNIT_ASSERT_EQUAL(mappings[margin - 1].getText(),
+            mappings[margin].getText());
+        
+        // It should match what we get with no interpolation at all.
+        std::map<size_t, TextPosition> expected;
+        scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+            expected[i] = mappedTo;
+        });
+        CPPUNIT_ASSERT(expected == mappings);
+        
+        // One base shorter, and the middle bases are each just beyond the
+        // margin on one side, so nothing should be filled in.
+        std::string shortQuery = contig.substr(start, 2 * margin);
+        
+        size_t mappedBases = 0;
+        interpolatingScheme.map(shortQuery, [&](size_t i,
+            TextPosition mappedTo) {
+            
+            CPPUNIT_ASSERT_EQUAL(start + i, mappedTo.getOffset());
+            mappedBases++;
+        });
+        
+        // Nothing new was interpolated, but the bases were still all looked
+        // up and mapped.
+        CPPUNIT_ASSERT_EQUAL((size_t) 1,
+            interpolatingScheme.getStats()["basesInterpolated"]);
+        CPPUNIT_ASSERT_EQUAL(shortQuery.size(), mappedBases);
+    }
+}
+
+/**
+ * Make sure mapping part of a query maps it the same as mapping the whole query
+ * when there is enough context, and the same as mapping just the range and its
+ * context when there isn't.
+ */
+void ZipMappingSchemeTests::testMapRange() {
+    std::string query = "CATGCTTCGGCGATTCGACGCTCATCTGCGACTCT";
+    
+    std::map<size_t, TextPosition> whole;
+    scheme->map(query, [&](size_t i, TextPosition mappedTo) {
+        whole[i] = mappedTo;
+    });
+    
+    // Make a scheme that only looks a few bases past the range.
+    ZipMappingScheme<FMDPosition> rangeScheme(FMDIndexView(*index, nullptr,
+        ranges));
+    rangeScheme.rangeContext = 3;
+    
+    for(auto range : {std::make_pair((size_t) 0, query.size()),
+        std::make_pair((size_t) 5, (size_t) 20), std::make_pair((size_t) 30,
+        query.size()), std::make_pair((size_t) 7, (size_t) 7)}) {
+        
+        // With the default context, the range should map like the whole query.
+        std::map<size_t, TextPosition> got;
+        scheme->mapRange(query, range.first, range.second,
+            [&](size_t i, TextPosition mappedTo) {
+            
+            got[i] = mappedTo;
+        });
+        std::map<size_t, TextPosition> expected(
+            whole.lower_bound(range.first), whole.lower_bound(range.second));
+        CPPUNIT_ASSERT(expected == got);
+        
+        // With less, it should map like the piece with its context.
+        auto context = rangeScheme.getRangeContext(query.size(), range.first,
+            range.second);
+        CPPUNIT_ASSERT_EQUAL(range.first - std::min(range.first, (size_t) 3),
+            context.first);
+        CPPUNIT_ASSERT_EQUAL(std::min(range.second + 3, query.size()),
+            context.second);
+        expected.clear();
+        rangeScheme.map(query.substr(context.first,
+            context.second - context.first),
+            [&](size_t i, TextPosition mappedTo) {
+            
+            if(i + context.first >= range.first &&
+                i + context.first < range.second) {
+                
+                expected[i + context.first] = mappedTo;
+            }
+        });
+        got.clear();
+        rangeScheme.mapRange(query, range.first, range.second,
+            [&](size_t i, TextPosition mappedTo) {
+            
+            got[i] = mappedTo;
+        });
+        CPPUNIT_ASSERT(expected == got);
+    }
+    
+    // Ranges have to be in the query.
+    CPPUNIT_ASSERT_THROW(scheme->mapRange(query, 10, query.size() + 1,
+        [](size_t, TextPosition) {}), std::out_of_range);
+    CPPUNIT_ASSERT_THROW(scheme->mapRange(query, 10, 5,
+        [](size_t, TextPosition) {}), std::out_of_range);
+}
+
+/**
+ * Map every contig of the given index against it with the given scheme, with
+ * and without the contig's minimal unique lengths from the given table, and
+ * make sure the mappings are the same. Returns the number of bases mapped.
+ */
+template<typename SearchType>
+static size_t checkMinUniqueLengths(const FMDIndex& index,
+    const MinUniqueTable& table,
+    const ZipMappingScheme<SearchType>& scheme) {
+    
+    size_t mapped = 0;
+    for(size_t contig = 0; contig < index.getNumberOfContigs(); contig++) {
+        std::string query = index.displayContig(contig);
+        
+        std::vector<size_t> leftLengths(query.size());
+        table.getLeftLengths(contig, 0, query.size(), leftLengths.data());
+        std::vector<size_t> rightLengths(query.size());
+        table.getRightLengths(contig, 0, query.size(), rightLengths.data());
+        
+        std::map<size_t, TextPosition> expected;
+        scheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            expected[i] = mappedTo;
+        });
+        
+        std::map<size_t, TextPosition> got;
+        scheme.map(query, [&](size_t i, TextPosition mappedTo) {
+            got[i] = mappedTo;
+        }, leftLengths.data(), rightLengths.data());
+        
+        CPPUNIT_ASSERT(expected == got);
+        mapped += expected.size();
+    }
+    return mapped;
+}
+
+/**
+ * Make sure mapping indexed contigs with their minimal unique lengths gives the
+ * same mappings as finding them by retracting, when they are needed to count
+ * unique strings. Tries every number of unique strings up to where nothing
+ * maps, since getting the lengths wrong only shows at the edge.
+ */
+void ZipMappingSchemeTests::testMapWithMinUniqueLengths() {
+    // Our duplicated contigs have no unique strings at all, so index some that
+    // do.
+    std::string uniqueDir = make_tempdir();
+    FMDIndexBuilder builder(uniqueDir + "/index.basename");
+    builder.add("Test/haplotypes.fa");
+    delete builder.build();
+    FMDIndex uniqueIndex(uniqueDir + "/index.basename");
+    MinUniqueTable table(uniqueIndex);
+    
+    ZipMappingScheme<FMDPosition> exactScheme{FMDIndexView(uniqueIndex)};
+    ZipMappingScheme<FMDPositionGroup> groupScheme{FMDIndexView(uniqueIndex)};
+    
+    for(size_t strings = 1; strings < 12; strings++) {
+        exactScheme.minUniqueStrings = strings;
+        size_t mapped = checkMinUniqueLengths(uniqueIndex, table, exactScheme);
+        
+        groupScheme.minUniqueStrings = strings;
+        CPPUNIT_ASSERT_EQUAL(mapped, checkMinUniqueLengths(uniqueIndex, table,
+            groupScheme));
+        
+        if(strings == 1) {
+            // Something should map when only one unique string is needed.
+            CPPUNIT_ASSERT(mapped > 0);
+        }
+    }
+    
+    boost::filesystem::remove_all(uniqueDir);
+}
@@ -14,6 +14,13 @@ class ZipMappingSchemeTests : public CppUnit::TestFixture {
     CPPUNIT_TEST(testMapWithMaskAndRanges);
     CPPUNIT_TEST(testMapWithGroups);
     CPPUNIT_TEST(testMapWithMismatches);
+    CPPUNIT_TEST(testMapWithKmerTable);
+    CPPUNIT_TEST(testMapInWindows);
+    CPPUNIT_TEST(testMapOverBudget);
+    CPPUNIT_TEST(testMapInterleaved);
+    CPPUNIT_TEST(testMapInterpolated);
+    CPPUNIT_TEST(testMapRange);
+    CPPUNIT_TEST(testMapWithMinUniqueLengths);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -45,6 +52,14 @@ public:
     void testMapWithMaskAndRanges();
     void testMapWithGroups();
     void testMapWithMismatches();
+    void testMapWithKmerTable();
+    void testMapInWindows();
+    void testMapOverBudget();
+    void testMapInterleaved();
+    void testMapInterpolated();
+    void testMapRange();
+    void testMapWithMinUniqueLengths();
+    
 };
 
 #endif
@@ -2,6 +2,9 @@
 #define TEXTPOSITION_HPP
 
 #include <utility>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
 
 /**
  * Represents a (text, offset) pair. Every contig ends up as two sequential
@@ -152,4 +155,109 @@ protected:
     size_t offset;
 }; 
 
+/**
+ * Represents a TextPosition packed into a single 64-bit word, for when a lot of
+ * them need to be stored. The text goes in the high TEXT_BITS bits and the
+ * offset in the rest, so packed positions sort the same way TextPositions do.
+ * Convert to and from TextPosition at API boundaries.
+ *
+ * The all-1s word is reserved to mean "no position", so the last possible text
+ * number can't be packed.
+ */
+class PackedTextPosition {
+public:
+    /**
+     * How many bits hold the text number? This allows for about 134 million
+     * contigs (at 2 texts each), and leaves room for offsets up to 2^36.
+     */
+    static const size_t TEXT_BITS = 28;
+    
+    /**
+     * How many bits hold the offset?
+     */
+    static const size_t OFFSET_BITS = 64 - TEXT_BITS;
+    
+    /**
+     * What word means "no position"?
+     */
+    static const uint64_t NONE = ~(uint64_t) 0;
+
+    /**
+     * Make a PackedTextPosition holding no position.
+     */
+    inline PackedTextPosition(): value(NONE) {
+        // Nothing to do!
+    }
+    
+    /**
+     * Pack the given TextPosition. Throws a std::runtime_error if its text or
+     * offset doesn't fit.
+     */
+    inline explicit PackedTextPosition(const TextPosition& position) {
+        if(position.getText() >= ((uint64_t) 1 << TEXT_BITS) - 1 ||
+            position.getOffset() >= ((uint64_t) 1 << OFFSET_BITS)) {
+            
+            throw std::runtime_error("Can't pack text " +
+                std::to_string(position.getText()) + " offset " +
+                std::to_string(position.getOffset()));
+        }
+        
+        value = ((uint64_t) position.getText() << OFFSET_BITS) |
+            position.getOffset();
+    }
+    
+    /**
+     * Is this actually holding a position?
+     */
+    inline bool isSet() const {
+        return value != NONE;
+    }
+    
+    /**
+     * Get the text number.
+     */
+    inline size_t getText() const {
+        return value >> OFFSET_BITS;
+    }
+    
+    /**
+     * Get the 0-based offset in the text.
+     */
+    inline size_t getOffset() const {
+        return value & (((uint64_t) 1 << OFFSET_BITS) - 1);
+    }
+    
+    /**
+     * Unpack back into a full TextPosition.
+     */
+    inline TextPosition unpack() const {
+        return TextPosition(getText(), getOffset());
+    }
+    
+    /**
+     * Provide equality comparison.
+     */
+    inline bool operator==(const PackedTextPosition& other) const {
+        return value == other.value;
+    }
+    
+    /**
+     * Provide inequality comparison.
+     */
+    inline bool operator!=(const PackedTextPosition& other) const {
+        return value != other.value;
+    }
+    
+    /**
+     * Provide less-than comparison for sets. Agrees with TextPosition.
+     */
+    inline bool operator<(const PackedTextPosition& other) const {
+        return value < other.value;
+    }
+    
+protected:
+    // Holds the text and offset.
+    uint64_t value;
+};
+
 #endif
@@ -0,0 +1,164 @@
+#ifndef TEXTPOSITIONSET_HPP
+#define TEXTPOSITIONSET_HPP
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "TextPosition.hpp"
+
+/**
+ * A sorted set of TextPositions, without duplicates, stored flat. The first
+ * INLINE_CAPACITY positions are kept in the object itself, and only a set that
+ * grows past that allocates. Almost every BWT interval looked at while mapping
+ * selects 0, 1, or 2 positions, so collecting them in one of these and checking
+ * if there is exactly one never touches the heap, unlike a std::set.
+ *
+ * Iterators are pointers, and are invalidated by any insert.
+ */
+class TextPositionSet {
+
+public:
+    typedef TextPosition value_type;
+    typedef const TextPosition* const_iterator;
+    typedef const_iterator iterator;
+
+    /**
+     * How many positions can the set hold without allocating?
+     */
+    static const size_t INLINE_CAPACITY = 2;
+
+    /**
+     * Make an empty set.
+     */
+    inline TextPositionSet(): numPositions(0) {
+        // Nothing to do
+    }
+
+    /**
+     * Make a set of the given positions, which need not be sorted or unique.
+     */
+    inline TextPositionSet(std::initializer_list<TextPosition> positions):
+        TextPositionSet() {
+
+        insert(positions.begin(), positions.end());
+    }
+
+    /**
+     * Add a position to the set, if it isn't there already. Returns true if it
+     * was added.
+     */
+    inline bool insert(const TextPosition& position) {
+        TextPosition* start = data();
+        TextPosition* past = start + numPositions;
+        TextPosition* found = std::lower_bound(start, past, position);
+        if(found != past && *found == position) {
+            // Already have it.
+            return false;
+        }
+        size_t index = found - start;
+
+        if(numPositions < INLINE_CAPACITY) {
+            // Shift everything after it up in the inline storage.
+            std::copy_backward(inlineItems + index, inlineItems + numPositions,
+                inlineItems + numPositions + 1);
+            inlineItems[index] = position;
+        } else {
+            if(numPositions == INLINE_CAPACITY) {
+                // Move out to the heap, keeping any capacity we had before.
+                overflow.assign(inlineItems, inlineItems + numPositions);
+            }
+            overflow.insert(overflow.begin() + index, position);
+        }
+        numPositions++;
+        return true;
+    }
+
+    /**
+     * Add all the positions in the given range, in any order.
+     */
+    template<typename Iterator>
+    inline void insert(Iterator first, Iterator last) {
+        for(; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    /**
+     * Return 1 if the given position is in the set, and 0 otherwise.
+     */
+    inline size_t count(const TextPosition& position) const {
+        return std::binary_search(begin(), end(), position) ? 1 : 0;
+    }
+
+    /**
+     * Get the number of positions in the set.
+     */
+    inline size_t size() const {
+        return numPositions;
+    }
+
+    /**
+     * Return true if the set has no positions in it.
+     */
+    inline bool empty() const {
+        return numPositions == 0;
+    }
+
+    /**
+     * Remove all the positions, keeping any memory allocated.
+     */
+    inline void clear() {
+        numPositions = 0;
+        overflow.clear();
+    }
+
+    /**
+     * Get an iterator to the first (smallest) position.
+     */
+    inline const_iterator begin() const {
+        return data();
+    }
+
+    /**
+     * Get an iterator to past the last position.
+     */
+    inline const_iterator end() const {
+        return data() + numPositions;
+    }
+
+    /**
+     * Return true if the two sets have the same positions.
+     */
+    inline bool operator==(const TextPositionSet& other) const {
+        return numPositions == other.numPositions &&
+            std::equal(begin(), end(), other.begin());
+    }
+
+    inline bool operator!=(const TextPositionSet& other) const {
+        return !(*this == other);
+    }
+
+protected:
+    /**
+     * Get where the positions live right now.
+     */
+    inline TextPosition* data() {
+        return numPositions <= INLINE_CAPACITY ? inlineItems : overflow.data();
+    }
+
+    inline const TextPosition* data() const {
+        return numPositions <= INLINE_CAPACITY ? inlineItems : overflow.data();
+    }
+
+    // How many positions are in the set?
+    size_t numPositions;
+
+    // Holds the positions while there are at most INLINE_CAPACITY of them.
+    TextPosition inlineItems[INLINE_CAPACITY];
+
+    // Holds all the positions once there are more than that.
+    std::vector<TextPosition> overflow;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "WaveletMatrix.hpp"
+
+WaveletMatrix::WaveletMatrix(const std::vector<Value>& values,
+    size_t alphabetSize): length(values.size()), alphabetSize(alphabetSize),
+    levels() {
+    
+    if(alphabetSize > (size_t) UINT32_MAX + 1) {
+        throw std::runtime_error("Alphabet too big for wavelet matrix");
+    }
+    
+    // How many bits do we need? Always use at least one.
+    size_t bitCount = 1;
+    while(((size_t) 1 << bitCount) < alphabetSize) {
+        bitCount++;
+    }
+    levels.resize(bitCount);
+    
+    // Partition copies of the values down the levels.
+    std::vector<Value> current(values);
+    std::vector<Value> zeros;
+    std::vector<Value> ones;
+    for(size_t level = 0; level < bitCount; level++) {
+        size_t shift = bitCount - 1 - level;
+        Level& bits = levels[level];
+        bits.bits.assign(length / 64 + 1, 0);
+        
+        zeros.clear();
+        ones.clear();
+        for(size_t i = 0; i < length; i++) {
+            if(current[i] >= alphabetSize) {
+                throw std::runtime_error("Value too big for wavelet matrix");
+            }
+            
+            if((current[i] >> shift) & 1) {
+                bits.bits[i / 64] |= (uint64_t) 1 << (i % 64);
+                ones.push_back(current[i]);
+            } else {
+                zeros.push_back(current[i]);
+            }
+        }
+        bits.index(length);
+        
+        // The next level sees all the 0s then all the 1s.
+        current.swap(zeros);
+        current.insert(current.end(), ones.begin(), ones.end());
+    }
+}
+
+void WaveletMatrix::Level::index(size_t length) {
+    // Count up 1s before each block, including a block past the end.
+    blockRanks.assign(length / 512 + 1, 0);
+    size_t total = 0;
+    for(size_t word = 0; word < bits.size(); word++) {
+        if(word % 8 == 0) {
+            blockRanks[word / 8] = total;
+        }
+        total += __builtin_popcountll(bits[word]);
+    }
+    zeros = length - total;
+}
+
+WaveletMatrix::WaveletMatrix(const std::string& filename): length(0),
+    alphabetSize(0), levels() {
+    
+    // Make a binary input stream.
+    std::ifstream file(filename, std::ifstream::binary);
+    
+    if(!file.good()) {
+        throw std::runtime_error("Could not open wavelet matrix " + filename);
+    }
+    
+    // Read the length, alphabet size, and level count.
+    size_t header[3];
+    file.read((char*) header, sizeof(header));
+    length = header[0];
+    alphabetSize = header[1];
+    levels.resize(header[2]);
+    
+    for(Level& level : levels) {
+        // Read each level's bits and work out its rank support again.
+        level.bits.resize(length / 64 + 1);
+        file.read((char*) level.bits.data(),
+            level.bits.size() * sizeof(uint64_t));
+        level.index(length);
+    }
+    
+    if(!file.good()) {
+        throw std::runtime_error("Truncated wavelet matrix " + filename);
+    }
+}
+
+void WaveletMatrix::save(const std::string& filename) const {
+    // Make a binary output stream.
+    std::ofstream file(filename, std::ios::out | std::ofstream::binary);
+    
+    // Save the length, alphabet size, and level count.
+    size_t header[3] = {length, alphabetSize, levels.size()};
+    file.write((const char*) header, sizeof(header));
+    
+    for(const Level& level : levels) {
+        // Then all the bits of every level.
+        file.write((const char*) level.bits.data(),
+            level.bits.size() * sizeof(uint64_t));
+    }
+    
+    // Close up the file
+    file.close();
+}
+
+size_t WaveletMatrix::operator[](size_t index) const {
+    size_t value = 0;
+    for(const Level& level : levels) {
+        // Read off each bit and follow the value down.
+        bool bit = level.get(index);
+        value = (value << 1) | bit;
+        index = bit ? level.zeros + level.rankOne(index) :
+            level.rankZero(index);
+    }
+    return value;
+}
+
+size_t WaveletMatrix::rank(size_t value, size_t start, size_t end) const {
+    if(value >= alphabetSize) {
+        // That can't be there.
+        return 0;
+    }
+    
+    for(size_t level = 0; level < levels.size() && start < end; level++) {
+        // Narrow the range down to those values that match on each bit.
+        const Level& bits = levels[level];
+        if((value >> (levels.size() - 1 - level)) & 1) {
+            start = bits.zeros + bits.rankOne(start);
+            end = bits.zeros + bits.rankOne(end);
+        } else {
+            start = bits.rankZero(start);
+            end = bits.rankZero(end);
+        }
+    }
+    return end - start;
+}
+
+size_t WaveletMatrix::rank(const std::vector<size_t>& values, size_t start,
+    size_t end) const {
+    
+    // Sort the values and drop duplicates and values too big to be there, so
+    // values sharing a prefix are next to each other.
+    std::vector<size_t> sorted;
+    for(size_t value : values) {
+        if(value < alphabetSize) {
+            sorted.push_back(value);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    
+    return rank(sorted.data(), sorted.data() + sorted.size(), 0, start, end);
+}
+
+size_t WaveletMatrix::rank(const size_t* valuesStart, const size_t* valuesEnd,
+    size_t level, size_t start, size_t end) const {
+    
+    if(valuesStart == valuesEnd || start >= end) {
+        // Nothing to count.
+        return 0;
+    }
+    
+    if(level == levels.size()) {
+        // We've matched all the bits of the (one) value left.
+        return end - start;
+    }
+    
+    // Split the values on this level's bit. They're sorted, so all the ones
+    // with a 0 come first.
+    size_t shift = levels.size() - 1 - level;
+    const size_t* split = valuesStart;
+    while(split != valuesEnd && !((*split >> shift) & 1)) {
+        split++;
+    }
+    
+    const Level& bits = levels[level];
+    return rank(valuesStart, split, level + 1, bits.rankZero(start),
+        bits.rankZero(end)) + rank(split, valuesEnd, level + 1,
+        bits.zeros + bits.rankOne(start), bits.zeros + bits.rankOne(end));
+}
+
+std::vector<std::pair<size_t, size_t>> WaveletMatrix::distinct(size_t start,
+    size_t end) const {
+    
+    std::vector<std::pair<size_t, size_t>> found;
+    distinct(0, 0, start, end, found);
+    return found;
+}
+
+void WaveletMatrix::distinct(size_t level, size_t prefix, size_t start,
+    size_t end, std::vector<std::pair<size_t, size_t>>& found) const {
+    
+    if(start >= end) {
+        // Nothing with this prefix occurs.
+        return;
+    }
+    
+    if(level == levels.size()) {
+        // This prefix is a whole value.
+        found.push_back(std::make_pair(prefix, end - start));
+        return;
+    }
+    
+    // Look for values with a 0 and then a 1 next.
+    const Level& bits = levels[level];
+    distinct(level + 1, prefix << 1, bits.rankZero(start), bits.rankZero(end),
+        found);
+    distinct(level + 1, (prefix << 1) | 1, bits.zeros + bits.rankOne(start),
+        bits.zeros + bits.rankOne(end), found);
+}
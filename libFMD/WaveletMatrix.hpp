@@ -0,0 +1,173 @@
+#ifndef WAVELETMATRIX_HPP
+#define WAVELETMATRIX_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Defines a wavelet matrix over a sequence of small integers (like the genome
+ * each BWT row belongs to), answering access, rank, and range-distinct queries
+ * in time proportional to the number of bits per value.
+ *
+ * Each level holds one bit of every value, most significant first, in the
+ * order that a stable partition on all the higher bits leaves them in. Each
+ * level has rank support from a count of 1s before every 512-bit block.
+ */
+class WaveletMatrix {
+
+public:
+    /**
+     * The type values are built from. It is narrow so that a value for every
+     * BWT row can be held while building without costing a word each.
+     */
+    typedef uint32_t Value;
+
+    /**
+     * Build a WaveletMatrix over the given values, which must all be less
+     * than the given alphabet size.
+     */
+    WaveletMatrix(const std::vector<Value>& values, size_t alphabetSize);
+    
+    /**
+     * Load a WaveletMatrix from the given file. Uses platform-dependent byte
+     * order and size_t size.
+     */
+    WaveletMatrix(const std::string& filename);
+    
+    /**
+     * Save a WaveletMatrix to the given file. Uses platform-dependent byte
+     * order and size_t size.
+     */
+    void save(const std::string& filename) const;
+    
+    /**
+     * Get the number of values stored.
+     */
+    inline size_t size() const {
+        return length;
+    }
+    
+    /**
+     * Get the number of distinct values that could be stored.
+     */
+    inline size_t getAlphabetSize() const {
+        return alphabetSize;
+    }
+    
+    /**
+     * Get the number of bytes the levels take up.
+     */
+    inline size_t getMemoryUsage() const {
+        size_t total = levels.capacity() * sizeof(Level);
+        for(const Level& level : levels) {
+            total += level.bits.capacity() * sizeof(uint64_t) +
+                level.blockRanks.capacity() * sizeof(size_t);
+        }
+        return total;
+    }
+    
+    /**
+     * Get the value at the given index.
+     */
+    size_t operator[](size_t index) const;
+    
+    /**
+     * Count the occurrences of the given value in the range [start, end).
+     */
+    size_t rank(size_t value, size_t start, size_t end) const;
+    
+    /**
+     * Count the occurrences of all the given values in the range [start, end).
+     * Values in the set that share high bits are counted together, so this is
+     * never slower than counting them one at a time.
+     */
+    size_t rank(const std::vector<size_t>& values, size_t start,
+        size_t end) const;
+    
+    /**
+     * Get all the distinct values that occur in the range [start, end), in
+     * order, paired with how many times each occurs.
+     */
+    std::vector<std::pair<size_t, size_t>> distinct(size_t start,
+        size_t end) const;
+    
+protected:
+    /**
+     * One bit from every value, with rank support.
+     */
+    struct Level {
+        // The bits, packed
+        std::vector<uint64_t> bits;
+        
+        // The number of 1s before each block of 8 words
+        std::vector<size_t> blockRanks;
+        
+        // The number of 0s in the whole level
+        size_t zeros;
+        
+        /**
+         * Get the bit at the given index.
+         */
+        inline bool get(size_t index) const {
+            return (bits[index / 64] >> (index % 64)) & 1;
+        }
+        
+        /**
+         * Count the 1s before the given index.
+         */
+        inline size_t rankOne(size_t index) const {
+            size_t block = index / 512;
+            size_t total = blockRanks[block];
+            for(size_t word = block * 8; word < index / 64; word++) {
+                total += __builtin_popcountll(bits[word]);
+            }
+            if(index % 64 != 0) {
+                total += __builtin_popcountll(bits[index / 64] &
+                    (((uint64_t) 1 << (index % 64)) - 1));
+            }
+            return total;
+        }
+        
+        /**
+         * Count the 0s before the given index.
+         */
+        inline size_t rankZero(size_t index) const {
+            return index - rankOne(index);
+        }
+        
+        /**
+         * Fill in the block ranks and zero count, once the bits are set.
+         */
+        void index(size_t length);
+    };
+    
+    /**
+     * Count the values in the given sorted, duplicate-free range of the given
+     * set that occur in the given range of the given level. All the values
+     * share the bits above that level, which have already been used to get
+     * the range.
+     */
+    size_t rank(const size_t* valuesStart, const size_t* valuesEnd,
+        size_t level, size_t start, size_t end) const;
+    
+    /**
+     * Recursively find the distinct values in the given range at the given
+     * level, whose higher bits are the given prefix.
+     */
+    void distinct(size_t level, size_t prefix, size_t start, size_t end,
+        std::vector<std::pair<size_t, size_t>>& found) const;
+    
+    // How many values are there?
+    size_t length;
+    
+    // How many values could there be?
+    size_t alphabetSize;
+    
+    // The levels, most significant bit first
+    std::vector<Level> levels;
+    
+};
+
+#endif
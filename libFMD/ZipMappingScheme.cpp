@@ -1,6 +1,8 @@
 #include "ZipMappingScheme.hpp"
 #include "Log.hpp"
 #include "util.hpp"
+#include "MatchingStatistics.hpp"
+#include "SearchScheme.hpp"
 
 #include <vector>
 #include <map>
@@ -13,11 +15,22 @@
 
 template<>
 bool ZipMappingScheme<FMDPosition>::canExtendThrough(FMDPosition context,
-    const std::string& opposingQuery) const {
-    
-    Log::debug() << "Trying to extend " << context << " through " << 
-        opposingQuery.size() << " opposing context" << std::endl;
-    stats.add("extendThroughAttampts", 1);
+    const EncodedQuery::View& opposingQuery) const {
+    
+    LOG_DEBUG("Trying to extend " << context << " through " << 
+        opposingQuery.size() << " opposing context" << std::endl);
+    extendThroughAttamptsStat.add(1);
+    
+    const KmerFilter* filter = view.getIndex().getKmerFilter();
+    if(filter != NULL && opposingQuery.size() > 1 &&
+        !filter->mayContainAll(opposingQuery.substr(0,
+        opposingQuery.size() - 1))) {
+        // Everything but the shared base gets added to the pattern, and some
+        // k-mer of it isn't anywhere in the index, so we can't get through.
+        LOG_DEBUG("Extension ruled out by k-mer filter" << std::endl);
+        extendThroughFilteredStat.add(1);
+        return false;
+    }
         
     // We're going to retract it until it's no longer unique, then go
     // back and retract it one less.
@@ -40,31 +53,54 @@ bool ZipMappingScheme<FMDPosition>::canExtendThrough(FMDPosition context,
         // process of mapping) because that's already searched, and we keep
         // going until we run out of results or we make it all the way through.
         
-        Log::trace() << "Extending with " << opposingQuery[i] << std::endl;
+        LOG_TRACE("Extending with " << opposingQuery.getBase(i) <<
+            std::endl);
         
-        barelyUnique.extendLeftOnly(view, opposingQuery[i]);
+        barelyUnique.extendLeftOnly(view, opposingQuery.getBase(i));
     }
     
     if(!barelyUnique.isEmpty(view)) {
         // We extended through!
-        stats.add("extendThroughSuccesses", 1);
+        extendThroughSuccessesStat.add(1);
         return true;
     } else {
         // We didn't get any results upon extending through
-        Log::debug() << "Extension failed" << std::endl;
+        LOG_DEBUG("Extension failed" << std::endl);
         return false;
     }
 }
 
 template<>
 bool ZipMappingScheme<FMDPositionGroup>::canExtendThrough(
-    FMDPositionGroup context, const std::string& opposingQuery) const {
+    FMDPositionGroup context, const EncodedQuery::View& opposingQuery) const {
     
     // Now we need to make sure to allow the right number of mismatches.
     
-    Log::debug() << "Trying to extend " << context << " through " << 
-        opposingQuery.size() << " opposing context" << std::endl;
-    stats.add("extendThroughAttampts", 1);
+    LOG_DEBUG("Trying to extend " << context << " through " << 
+        opposingQuery.size() << " opposing context" << std::endl);
+    extendThroughAttamptsStat.add(1);
+    
+    const KmerFilter* filter = view.getIndex().getKmerFilter();
+    if(mismatchTolerance == 0 && filter != NULL && opposingQuery.size() > 1 &&
+        !filter->mayContainAll(opposingQuery.substr(0,
+        opposingQuery.size() - 1))) {
+        // With no mismatches to spend, a k-mer missing from the index stops
+        // us just like it would for a single FMDPosition.
+        LOG_DEBUG("Extension ruled out by k-mer filter" << std::endl);
+        extendThroughFilteredStat.add(1);
+        return false;
+    }
+    
+    if(mismatchTolerance > 0 && opposingQuery.size() > 1 &&
+        !SearchScheme::forMismatches(mismatchTolerance).exists(view,
+        opposingQuery.substr(0, opposingQuery.size() - 1))) {
+        // Whatever we extend through to has to be within the tolerance of
+        // the bases we extend with, and a search scheme can rule that out
+        // much faster than growing every mismatch along the way.
+        LOG_DEBUG("Extension ruled out by search scheme" << std::endl);
+        extendThroughFilteredStat.add(1);
+        return false;
+    }
         
     // We're going to retract it until it's no longer unique, then go
     // back and retract it one less.
@@ -87,29 +123,30 @@ bool ZipMappingScheme<FMDPositionGroup>::canExtendThrough(
         // process of mapping) because that's already searched, and we keep
         // going until we run out of results or we make it all the way through.
         
-        Log::trace() << "Extending with " << opposingQuery[i] <<
-            " up to " << mismatchTolerance << " mismatches" << std::endl;
+        LOG_TRACE("Extending with " << opposingQuery.getBase(i) <<
+            " up to " << mismatchTolerance << " mismatches" << std::endl);
         
         // Do the extension allowing for mismatches
-        barelyUnique.extendFull(view, opposingQuery[i], mismatchTolerance);
+        barelyUnique.extendFull(view, opposingQuery.getBase(i),
+            mismatchTolerance);
     }
     
     if(!barelyUnique.isEmpty(view)) {
         // We extended through!
-        stats.add("extendThroughSuccesses", 1);
+        extendThroughSuccessesStat.add(1);
         return true;
     } else {
         // We didn't get any results upon extending through
-        Log::debug() << "Extension failed" << std::endl;
+        LOG_DEBUG("Extension failed" << std::endl);
         return false;
     }
 }
 
 template<>
-std::pair<bool, std::set<TextPosition>>
+std::pair<bool, TextPositionSet>
     ZipMappingScheme<FMDPosition>::exploreRetraction(
     const typename DPTable::DPTask& task, DPTable& table,
-    const std::string& query, size_t queryBase) const {
+    const EncodedQuery& query, size_t queryBase) const {
     
     // Get the left and right SideRetractionEntries. Also computes any
     // uncomputed retractions and enumerates any sufficiently small sets.
@@ -118,9 +155,9 @@ std::pair<bool, std::set<TextPosition>>
     const typename DPTable::SideRetractionEntry& right = table.getRetraction(
         true, task.rightIndex, view, maxRangeCount);
     
-    Log::debug() << "Exploring " << left.selection << " (" <<
+    LOG_DEBUG("Exploring " << left.selection << " (" <<
         left.contextLength << ") left, " << right.selection << " (" <<
-        right.contextLength << ") right" << std::endl;
+        right.contextLength << ") right" << std::endl);
     
     // How many bases are searched total (accounting for the 1-base central
     // overlap)?
@@ -128,8 +165,8 @@ std::pair<bool, std::set<TextPosition>>
     if(totalContext < minContextLength) {
         // If we have too little total context, we would ignore any results we
         // found, so say we have no results but should still map.
-        Log::debug() << "Skipping task due to too little context." <<
-            std::endl;
+        LOG_DEBUG("Skipping task due to too little context." <<
+            std::endl);
             
         return {true, {}};
     }
@@ -147,13 +184,13 @@ std::pair<bool, std::set<TextPosition>>
         // We will try extending the left through the right.
         triedLeftExtend = true;
         
-        if(canExtendThrough(left.selection, reverseComplement(query.substr(
-            queryBase, right.contextLength)))) {
+        if(canExtendThrough(left.selection, query.forward().substr(
+            queryBase, right.contextLength).reverseComplement())) {
             // We tried to extend the left context through the (reverse
             // complemented) right context and succeeded.
             
-            Log::debug() << "Successfully extended left through right" <<
-                std::endl;
+            LOG_DEBUG("Successfully extended left through right" <<
+                std::endl);
             
             // We can now cheat and return the one-element set of whatever the
             // left context selects, flipped.
@@ -162,7 +199,7 @@ std::pair<bool, std::set<TextPosition>>
                 matchedTo.getContigNumber()));
             return {true, {matchedTo}};
         } else {
-            Log::debug() << "Failed to extend left though right" << std::endl;
+            LOG_DEBUG("Failed to extend left though right" << std::endl);
         }
         
         // If we don't succeed, we still need to check for set overlap.
@@ -173,20 +210,20 @@ std::pair<bool, std::set<TextPosition>>
         // We will try extending the right through the left.
         triedRightExtend = true;
         
-        if(canExtendThrough(right.selection, query.substr(
+        if(canExtendThrough(right.selection, query.forward().substr(
             queryBase - (left.contextLength - 1), left.contextLength))) {
             // We tried to extend the right context through the left context and
             // succeeded
             
-            Log::debug() << "Successfully extended right through left" <<
-                std::endl;
+            LOG_DEBUG("Successfully extended right through left" <<
+                std::endl);
             
             // We can now cheat and return the one-element set of whatever the
             // right context selects.
             TextPosition matchedTo = right.selection.getTextPosition(view);
             return {true, {matchedTo}};
         } else {
-            Log::debug() << "Failed to extend right though left" << std::endl;
+            LOG_DEBUG("Failed to extend right though left" << std::endl);
         }
         
         // If we don't succeed, we still need to check for set overlap.
@@ -207,21 +244,21 @@ std::pair<bool, std::set<TextPosition>>
         // If we retracted on the right, use the old positions from the left.
         // Otherwise (if we retracted on the left or are a root), use the old
         // positions from the right
-        const std::set<TextPosition>& oldPositions = task.retractedRight ? 
+        const std::vector<TextPosition>& oldPositions = task.retractedRight ? 
             left.selected : right.selected;
             
         // If we retracted on the right, bang the new right positions against
         // the old positions. Otherwise bang the new left positions.
-        const std::set<TextPosition>& newPositions = task.retractedRight ?
+        const std::vector<TextPosition>& newPositions = task.retractedRight ?
             right.newlySelected : left.newlySelected;
             
-        Log::debug() << "Banging " << newPositions.size() <<
+        LOG_DEBUG("Banging " << newPositions.size() <<
             " new positions against " << oldPositions.size() << " old ones" <<
-            std::endl;
+            std::endl);
         
         // This is going to hold the TextPositiuons in both sets, in right
         // orientation.
-        std::set<TextPosition> shared;
+        TextPositionSet shared;
         
         // TODO: scan the smaller set always?
         for(auto result : newPositions) {
@@ -231,7 +268,8 @@ std::pair<bool, std::set<TextPosition>>
             flipped.flip(view.getIndex().getContigLength(
                 flipped.getContigNumber()));
                 
-            if(oldPositions.count(flipped)) {
+            if(std::binary_search(oldPositions.begin(), oldPositions.end(),
+                flipped)) {
                 // We found it!
                 if(task.retractedRight) {
                     // We're going through right contexts.
@@ -244,8 +282,8 @@ std::pair<bool, std::set<TextPosition>>
                 
                 if(shared.size() > 1) {
                     
-                    Log::debug() << "Found multiple shared new results" <<
-                        std::endl;
+                    LOG_DEBUG("Found multiple shared new results" <<
+                        std::endl);
                 
                     // We can short circuit now because we found multiple
                     // shared TextPositions.
@@ -259,17 +297,17 @@ std::pair<bool, std::set<TextPosition>>
             // We found results, but didn't terminate the loop early due to
             // having 2 or more. So there must be just 1.
             
-            Log::debug() << "Found " << shared.size() <<
-                " shared new results" << std::endl;
+            LOG_DEBUG("Found " << shared.size() <<
+                " shared new results" << std::endl);
         
             // If we found any overlap at all, say we found something.
             return {true, shared};
         }
     
-        Log::debug() << "Could look at result sets but found no overlap" <<
-            std::endl;
+        LOG_DEBUG("Could look at result sets but found no overlap" <<
+            std::endl);
     } else {
-        Log::debug() << "Result set(s) would be too big!" << std::endl;
+        LOG_DEBUG("Result set(s) would be too big!" << std::endl);
     }
     
     // Make a task that we can retract to make child tasks, if needed.
@@ -280,7 +318,7 @@ std::pair<bool, std::set<TextPosition>>
         // just tried to extend the right through the left and failed.
         
         // Retract on the left and enqueue that child task.
-        Log::debug() << "Queueing retraction on the left" << std::endl;
+        LOG_DEBUG("Queueing retraction on the left" << std::endl);
         table.taskQueue.push(toRetract.retract(false));
     }
     
@@ -293,13 +331,13 @@ std::pair<bool, std::set<TextPosition>>
         // right). TODO: Am I going to duplicate work here? I think I really do
         // need to approach some retractions from this side to make things work.
         
-        Log::debug() << "Queueing retraction on the right" << std::endl;
+        LOG_DEBUG("Queueing retraction on the right" << std::endl);
         // Also retract on the right, if the task we just did never retracted on
         // the left.
         table.taskQueue.push(toRetract.retract(true));
     }
     
-    Log::debug() << "Found no shared results" << std::endl;
+    LOG_DEBUG("Found no shared results" << std::endl);
     
     // Report whether we got too many results to think about, and say we found
     // no overlaps.
@@ -309,10 +347,10 @@ std::pair<bool, std::set<TextPosition>>
 
 
 template<>
-std::pair<bool, std::set<TextPosition>>
+std::pair<bool, TextPositionSet>
     ZipMappingScheme<FMDPositionGroup>::exploreRetraction(
     const typename DPTable::DPTask& task, DPTable& table,
-    const std::string& query, size_t queryBase) const {
+    const EncodedQuery& query, size_t queryBase) const {
     
     // Get the left and right SideRetractionEntries. Also computes any
     // uncomputed retractions and enumerates any sufficiently small sets.
@@ -321,9 +359,9 @@ std::pair<bool, std::set<TextPosition>>
     const typename DPTable::SideRetractionEntry& right = table.getRetraction(
         true, task.rightIndex, view, maxRangeCount);
         
-    Log::debug() << "Exploring " << left.selection << " (" <<
+    LOG_DEBUG("Exploring " << left.selection << " (" <<
         left.contextLength << ") left, " << right.selection << " (" <<
-        right.contextLength << ") right" << std::endl;
+        right.contextLength << ") right" << std::endl);
     
     // We need to look at the searches in both directions at this level of
     // retraction, and determine if they can agree. They can only agree if they
@@ -344,8 +382,8 @@ std::pair<bool, std::set<TextPosition>>
     if(totalContext < minContextLength) {
         // If we have too little total context, we would ignore any results we
         // found, so say we have no results but should still map.
-        Log::debug() << "Skipping task due to too little context." <<
-            std::endl;
+        LOG_DEBUG("Skipping task due to too little context." <<
+            std::endl);
             
         return {true, {}};
     }
@@ -363,14 +401,14 @@ std::pair<bool, std::set<TextPosition>>
         // We will try extending the left through the right.
         triedLeftExtend = true;
         
-        if(canExtendThrough(left.selection, reverseComplement(query.substr(
-            queryBase, right.contextLength)))) {
+        if(canExtendThrough(left.selection, query.forward().substr(
+            queryBase, right.contextLength).reverseComplement())) {
             // We tried to extend the left context through the (reverse
             // complemented) right context and succeeded. This accounts for
             // total mismatches.
             
-            Log::debug() << "Successfully extended left through right" <<
-                std::endl;
+            LOG_DEBUG("Successfully extended left through right" <<
+                std::endl);
             
             // We can now cheat and return the one-element set of whatever the
             // left context selects, flipped.
@@ -379,7 +417,7 @@ std::pair<bool, std::set<TextPosition>>
                 matchedTo.getContigNumber()));
             return {true, {matchedTo}};
         } else {
-            Log::debug() << "Failed to extend left though right" << std::endl;
+            LOG_DEBUG("Failed to extend left though right" << std::endl);
         }
         
         // If we don't succeed, we still need to check for set overlap.
@@ -390,20 +428,20 @@ std::pair<bool, std::set<TextPosition>>
         // We will try extending the right through the left.
         triedRightExtend = true;
         
-        if(canExtendThrough(right.selection, query.substr(
+        if(canExtendThrough(right.selection, query.forward().substr(
             queryBase - (left.contextLength - 1), left.contextLength))) {
             // We tried to extend the right context through the left context and
             // succeeded. This accounts for total mismatches.
             
-            Log::debug() << "Successfully extended right through left" <<
-                std::endl;
+            LOG_DEBUG("Successfully extended right through left" <<
+                std::endl);
             
             // We can now cheat and return the one-element set of whatever the
             // right context selects.
             TextPosition matchedTo = right.selection.getTextPosition(view);
             return {true, {matchedTo}};
         } else {
-            Log::debug() << "Failed to extend right though left" << std::endl;
+            LOG_DEBUG("Failed to extend right though left" << std::endl);
         }
         
         // If we don't succeed, we still need to check for set overlap.
@@ -446,20 +484,20 @@ std::pair<bool, std::set<TextPosition>>
         
             // This is going to hold the TextPositions in both sets, in right
             // orientation.
-            std::set<TextPosition> shared;
+            TextPositionSet shared;
         
             if(lastMismatchesUsed > mismatchTolerance) {
                 // This is the first retraction that has few enough mismatches.
         
                 if(lastMismatchesUsed == -1) {
-                    Log::debug() << "Only " << mismatchesUsed << 
+                    LOG_DEBUG("Only " << mismatchesUsed << 
                         " mismatches; comparing entire result sets." <<
-                        std::endl;
+                        std::endl);
                 } else {
-                    Log::debug() << "Only " << mismatchesUsed << 
+                    LOG_DEBUG("Only " << mismatchesUsed << 
                         " mismatches, down from from " << lastMismatchesUsed << 
                         " mismatches; comparing entire result sets." <<
-                        std::endl;
+                        std::endl);
                 }
             
                 // We can accept overlaps because not too many mismatches are
@@ -479,7 +517,8 @@ std::pair<bool, std::set<TextPosition>>
                     flipped.flip(view.getIndex().getContigLength(
                         flipped.getContigNumber()));
                         
-                    if(right.selected.count(flipped)) {
+                    if(std::binary_search(right.selected.begin(),
+                        right.selected.end(), flipped)) {
                         // We found it!
                         
                         // We're going through left contexts, so insert the
@@ -488,9 +527,9 @@ std::pair<bool, std::set<TextPosition>>
                         
                         if(shared.size() > 1) {
                             
-                            Log::debug() <<
+                            LOG_DEBUG(
                                 "Found multiple shared new results" <<
-                                std::endl;
+                                std::endl);
                         
                             // We can short circuit now because we found
                             // multiple shared TextPositions.
@@ -510,19 +549,19 @@ std::pair<bool, std::set<TextPosition>>
                 // If we retracted on the right, use the old positions from the
                 // left. Otherwise (if we retracted on the left or are a root),
                 // use the old positions from the right
-                const std::set<TextPosition>& oldPositions = 
+                const std::vector<TextPosition>& oldPositions = 
                     task.retractedRight ? left.selected : right.selected;
                     
                 // If we retracted on the right, bang the new right positions
                 // against the old positions. Otherwise bang the new left
                 // positions.
-                const std::set<TextPosition>& newPositions =
+                const std::vector<TextPosition>& newPositions =
                     task.retractedRight ? right.newlySelected :
                     left.newlySelected;
                     
-                Log::debug() << "Comparing " << newPositions.size() <<
+                LOG_DEBUG("Comparing " << newPositions.size() <<
                     " new positions against " << oldPositions.size() << 
-                    " old ones" << std::endl;
+                    " old ones" << std::endl);
                 
                 // TODO: scan the smaller set always?
                 for(auto result : newPositions) {
@@ -533,7 +572,8 @@ std::pair<bool, std::set<TextPosition>>
                     flipped.flip(view.getIndex().getContigLength(
                         flipped.getContigNumber()));
                         
-                    if(oldPositions.count(flipped)) {
+                    if(std::binary_search(oldPositions.begin(),
+                        oldPositions.end(), flipped)) {
                         // We found it!
                         if(task.retractedRight) {
                             // We're going through right contexts.
@@ -546,9 +586,9 @@ std::pair<bool, std::set<TextPosition>>
                         
                         if(shared.size() > 1) {
                             
-                            Log::debug() <<
+                            LOG_DEBUG(
                                 "Found multiple shared new results" <<
-                                std::endl;
+                                std::endl);
                         
                             // We can short circuit now because we found
                             // multiple shared TextPositions.
@@ -563,25 +603,25 @@ std::pair<bool, std::set<TextPosition>>
                 // We found results, but didn't terminate the loop early due to
                 // having 2 or more. So there must be just 1.
                 
-                Log::debug() << "Found " << shared.size() <<
-                    " shared results" << std::endl;
+                LOG_DEBUG("Found " << shared.size() <<
+                    " shared results" << std::endl);
             
                 // If we found any overlap at all, say we found something.
                 return {true, shared};
             }
         
-            Log::debug() << "Found no overlap" << std::endl;
+            LOG_DEBUG("Found no overlap" << std::endl);
         } else {
             // We used too many mismatches to accept an overlap. Try after
             // retracting.
-            Log::debug() << "Skipping for too many mismatches: " <<
-                mismatchesUsed << std::endl;
+            LOG_DEBUG("Skipping for too many mismatches: " <<
+                mismatchesUsed << std::endl);
                 
             // We need to retract more.
         }
         
     } else {
-        Log::debug() << "Result set(s) would be too big!" << std::endl;
+        LOG_DEBUG("Result set(s) would be too big!" << std::endl);
     }
     
     // Make a task that we can retract to make child tasks, if needed.
@@ -592,7 +632,7 @@ std::pair<bool, std::set<TextPosition>>
         // just tried to extend the right through the left and failed.
         
         // Retract on the left and enqueue that child task.
-        Log::debug() << "Queueing retraction on the left" << std::endl;
+        LOG_DEBUG("Queueing retraction on the left" << std::endl);
         table.taskQueue.push(toRetract.retract(false));
     }
     
@@ -605,13 +645,13 @@ std::pair<bool, std::set<TextPosition>>
         // right). TODO: Am I going to duplicate work here? I think I really do
         // need to approach some retractions from this side to make things work.
         
-        Log::debug() << "Queueing retraction on the right" << std::endl;
+        LOG_DEBUG("Queueing retraction on the right" << std::endl);
         // Also retract on the right, if the task we just did never retracted on
         // the left.
         table.taskQueue.push(toRetract.retract(true));
     }
     
-    Log::debug() << "Found no shared results" << std::endl;
+    LOG_DEBUG("Found no shared results" << std::endl);
     
     // Report whether we got too many results to think about, and say we found
     // no overlaps.
@@ -624,57 +664,17 @@ std::vector<std::pair<FMDPosition, size_t>>
     ZipMappingScheme<FMDPosition>::findRightContexts(const std::string& query,
     bool reverse) const {
  
-    // This will hold the right context of every position.
-    std::vector<std::pair<FMDPosition, size_t>> toReturn(query.size());
- 
-    // Start with everything selected.
-    FMDPosition results(view);
-    
-    // How many characters are currently searched?
-    size_t patternLength = 0;
-    
-    for(size_t i = query.size() - 1; i != (size_t) -1; i--) {
-        // For each position in the query from right to left, we're going to
-        // inchworm along and get the search that is extended out right as
-        // far as possible while still having results.
-        
-        // We're going to extend left with this new base.
-        FMDPosition extended = results;
-        extended.extendLeftOnly(view, query[i]);
-        
-        while(extended.isEmpty(view)) {
-            // If you couldn't extend, retract until you can. TODO: Assumes we
-            // can find at least one result for any character.
-            
-            // Retract the character
-            FMDPosition retracted = results;
-            // Make sure to drop characters from the total pattern length.
-            retracted.retractRightOnly(view, --patternLength);
-            
-            // Try extending again
-            extended = retracted;
-            extended.extendLeftOnly(view, query[i]);
-            
-            // Say that last step we came from retracted.
-            results = retracted;
-        }
-    
-        // We successfully extended (if only with the base itself).
-        results = extended;
-        // Increment the pattern length since we did actually extedn by 1. 
-        patternLength++;
-        
-        Log::trace() << "Index " << i << " has " << query[i] << " + " << 
-            patternLength - 1 << " selecting " << results << std::endl;
-        
-        // Save the search results to the appropriate location, depending on if
-        // we want to reverse the results or not.
-        toReturn[reverse ? toReturn.size() - i - 1 : i] = std::make_pair(
-            results, patternLength);
+    // Inchworm from right to left, retracting only when necessary, to get the
+    // search that is extended out right as far as possible while still having
+    // results for every position. We don't need the minimal matchings.
+    std::vector<std::pair<FMDPosition, size_t>> toReturn = MatchingStatistics(
+        view, query, true, false, contextCache).getContexts();
+    
+    if(reverse) {
+        // Put the results in the order of the reverse strand.
+        std::reverse(toReturn.begin(), toReturn.end());
     }
-
-    // Now we have inchwormed all the way from right to left, retracting only
-    // when necessary. Return all the results.    
+    
     return toReturn;
 }
 
@@ -746,8 +746,8 @@ std::vector<std::pair<FMDPositionGroup, size_t>>
         // Increment the pattern length since we did actually extend by 1. 
         patternLength++;
         
-        Log::trace() << "Index " << i << " has " << query[i] << " + " << 
-            patternLength - 1 << " selecting " << results << std::endl;
+        LOG_TRACE("Index " << i << " has " << query[i] << " + " << 
+            patternLength - 1 << " selecting " << results << std::endl);
         
         // Save the search results to the appropriate location, depending on if
         // we want to reverse the results or not.
@@ -7,10 +7,13 @@
 #include "Log.hpp"
 #include "Matching.hpp"
 #include "CreditStrategy.hpp"
+#include "EncodedQuery.hpp"
+#include "TextPositionSet.hpp"
 
 #include <iomanip>
-#include <queue>
+#include <algorithm>
 #include <unordered_map>
+#include <atomic>
 
 /**
  * Mapping scheme supporting mapping to graphs, where you zip together maximal
@@ -39,6 +42,44 @@ public:
      */
     virtual void map(const std::string& query,
         std::function<void(size_t, TextPosition)> callback) const override;
+    
+    /**
+     * Map the given query string the same way, but call the given sink (which
+     * takes the query base index and the TextPosition) directly instead of
+     * through a std::function, so it can be inlined. Callers that know they
+     * have a ZipMappingScheme should use this.
+     *
+     * If the query was taken from the index being mapped to, the left and
+     * right lengths for its bases from the index's MinUniqueTable (see
+     * MinUniqueTable::getLeftLengths() and getRightLengths()) can be given,
+     * and then the shortest unique contexts are found with less retracting.
+     * They are only used when no mismatches are tolerated.
+     */
+    template<typename Sink>
+    void map(const std::string& query, Sink&& sink,
+        const size_t* leftLengths = nullptr,
+        const size_t* rightLengths = nullptr) const;
+    
+    /**
+     * Map only bases [start, end) of the given query, searching just them and
+     * their context. See MappingScheme::mapRange().
+     */
+    virtual void mapRange(const std::string& query, size_t start, size_t end,
+        std::function<void(size_t, TextPosition)> callback) const override;
+    
+    /**
+     * Map only bases [start, end) of the given query the same way, calling
+     * the given sink directly.
+     */
+    template<typename Sink>
+    void mapRange(const std::string& query, size_t start, size_t end,
+        Sink&& sink) const;
+    
+    /**
+     * Get the parameters for mapping, including the credit ones.
+     */
+    virtual std::vector<std::pair<std::string, std::string>>
+        getParameters() const override;
         
         
     // Mapping scheme parameters
@@ -87,6 +128,35 @@ public:
      */
     size_t mismatchTolerance = 0;
     
+    /**
+     * If nonzero, don't work out every base inside a long exact match on its
+     * own. A base whose left context is one longer and whose right context is
+     * one shorter than the last base's, with more than this many bases of
+     * context on each side, just takes the last base's mapping shifted over by
+     * one. This skips the retraction search and locate for most bases when
+     * mapping closely related genomes, but isn't guaranteed to give the same
+     * answer as the full search, which might find a conflicting placement for
+     * a shorter retraction.
+     */
+    size_t interpolationMargin = 0;
+    
+    /**
+     * If nonzero, how many retraction tasks may be run for a single base? A
+     * base that needs more is left unmapped and counted in "overBudgetBases",
+     * so a few pathologically repetitive bases can't run on for minutes. The
+     * per-query queryMicroseconds budget is also checked between tasks.
+     */
+    size_t maxRetractionTasks = 0;
+
+    /**
+     * How many bases should each thread work on at once? If more than 1, the
+     * bases in each group take turns running one retraction task each, and
+     * prefetch what their next task will need before giving up their turn, so
+     * a thread isn't always waiting on memory for one base. Gives the same
+     * mappings as doing one base at a time.
+     */
+    size_t interleavedBases = 1;
+
     // We need to define this with a new; otherwise our inhereted constructor
     // gets deleted, since it can't default-construct the CreditStrategy without
     // an FMDIndexView. This is to work around a compiler bug
@@ -113,6 +183,54 @@ public:
     
 protected:
     
+    // Counters for the stats we update while mapping, gotten once up front so
+    // updating them doesn't have to look them up or lock anything.
+    StatTracker::Counter activitySelectionRunsStat =
+        stats.counter("activitySelectionRuns");
+    StatTracker::Counter activitiesSelectedStat =
+        stats.counter("activitiesSelected");
+    StatTracker::Counter basesAttemptedStat = stats.counter("basesAttempted");
+    StatTracker::Counter retractionCoveredStat =
+        stats.counter("retractionCovered");
+    StatTracker::Counter tooHardRetractionStat =
+        stats.counter("tooHardRetraction");
+    StatTracker::Counter ambiguousStat = stats.counter("ambiguous");
+    StatTracker::Counter unambiguousStat = stats.counter("unambiguous");
+    StatTracker::Counter basesInterpolatedStat =
+        stats.counter("basesInterpolated");
+    StatTracker::Counter filterFailStat = stats.counter("filterFail");
+    StatTracker::Counter filterPassStat = stats.counter("filterPass");
+    StatTracker::Counter extendThroughAttamptsStat =
+        stats.counter("extendThroughAttampts");
+    StatTracker::Counter extendThroughSuccessesStat =
+        stats.counter("extendThroughSuccesses");
+    StatTracker::Counter extendThroughFilteredStat =
+        stats.counter("extendThroughFiltered");
+    
+    // And histograms, for tuning the search limits. How long does each query
+    // take to map? How many retraction tasks does each base run? How much
+    // context, left and right together, does each mapped base use?
+    StatTracker::Histogram queryNanosecondsStat =
+        stats.histogram("queryNanoseconds");
+    StatTracker::Histogram retractionTasksStat =
+        stats.histogram("retractionTasks");
+    StatTracker::Histogram contextLengthStat = stats.histogram("contextLength");
+    
+    // And phases to count hardware events in, if PerfCounters are enabled.
+    StatTracker::Phase contextSearchPhase = stats.phase("contextSearch");
+    StatTracker::Phase retractionPhase = stats.phase("retraction");
+    StatTracker::Phase locatePhase = stats.phase("locate");
+    StatTracker::Phase creditPhase = stats.phase("credit");
+    
+    /**
+     * Map the given query string, producing a vector of Mappings that have
+     * passed all the filters, including any made on credit. Takes the
+     * query's minimal unique lengths, if it has them.
+     */
+    std::vector<Mapping> mapAll(const std::string& query,
+        const size_t* leftLengths = nullptr,
+        const size_t* rightLengths = nullptr) const;
+    
     /**
      * Represents an entire DP job for evaluating all the retractions of a left
      * and a right context.
@@ -140,12 +258,15 @@ protected:
             bool setsValid = true;
             /**
              * What positions are selected in total by the current search?
+             * Kept sorted and de-duplicated, so it can be searched like a set
+             * without allocating tree nodes.
              */
-            std::set<TextPosition> selected;
+            std::vector<TextPosition> selected;
             /**
-             * Of the above, which are from newly selected ranges?
+             * Of the above, which are from newly selected ranges? Also sorted
+             * and de-duplicated.
              */
-            std::set<TextPosition> newlySelected;
+            std::vector<TextPosition> newlySelected;
             
             /**
              * Default constructor that leaves all the sets empty.
@@ -155,19 +276,39 @@ protected:
             }
             
             /**
-             * Start out with an entry reflecting no retraction at all.
-             * Fills in the sets if possible.
+             * Sort and de-duplicate a vector of positions in place, so it can
+             * be used as a set.
+             */
+            static inline void makeSet(std::vector<TextPosition>& positions) {
+                std::sort(positions.begin(), positions.end());
+                positions.erase(std::unique(positions.begin(),
+                    positions.end()), positions.end());
+            }
+            
+            /**
+             * Replace the contents of this entry with one reflecting no
+             * retraction at all. Fills in the sets if possible, using the
+             * given range number vector as scratch space, and counting the
+             * locating in the given Phase.
              */
-            inline SideRetractionEntry(const SearchType& unretracted,
+            inline void reset(const SearchType& unretracted,
                 size_t contextLength, const FMDIndexView& view,
-                size_t maxRangeCount): selection(unretracted), 
-                contextLength(contextLength) {
+                size_t maxRangeCount, std::vector<size_t>& ranges,
+                const StatTracker::Phase& locatePhase) {
                 
-                if(selection.getApproximateNumberOfRanges(view) <=
+                selection = unretracted;
+                this->contextLength = contextLength;
+                
+                if(selection.countRangesUpTo(view, maxRangeCount) <=
                     maxRangeCount) {
                 
                     // We can visit everything we have selected
-                    selected = selection.getTextPositions(view);
+                    selected.clear();
+                    {
+                        StatTracker::ScopedPhase phase(locatePhase);
+                        selection.appendTextPositions(view, ranges, selected);
+                    }
+                    makeSet(selected);
                     // Copy it all to the newly selected set too.
                     newlySelected = selected;
                     // And say our sets we just made are valid.
@@ -175,61 +316,71 @@ protected:
                 } else {
                     // We can't afford to fill in our sets.
                     setsValid = false;
+                    selected.clear();
+                    newlySelected.clear();
                 }
             }
             
             /**
-             * Create an entry from this one after retracting to the next place
-             * where more results are to be had under the given view. TODO:
-             * assumes such a place actually exists.
+             * Fill in the given entry (which must not be this one) with this
+             * one after retracting to the next place where more results are to
+             * be had under the given view. Reuses the given entry's storage
+             * from whatever it held before. TODO: assumes such a place actually
+             * exists.
              *
              * Gives up on sets if it would need to visit more than
-             * maxRangeCount ranges.
+             * maxRangeCount ranges. Uses the given range number vector as
+             * scratch space, and counts the locating in the given Phase.
              */
-            inline SideRetractionEntry retract(const FMDIndexView& view,
-                size_t maxRangeCount) {
+            inline void retractInto(SideRetractionEntry& toReturn,
+                const FMDIndexView& view, size_t maxRangeCount,
+                std::vector<size_t>& ranges,
+                const StatTracker::Phase& locatePhase) const {
                 
-                Log::debug() << "Retracting a SideRetractionEntry" << std::endl;
+                LOG_DEBUG("Retracting a SideRetractionEntry" << std::endl);
                 
                 // Copy and retract our current search
-                SearchType retracted = selection;
-                size_t retractedContext = retracted.retractRightOnly(view);
-                
-                // Make a new entry
-                SideRetractionEntry toReturn;
-                toReturn.selection = retracted;
-                toReturn.contextLength = retractedContext;
+                toReturn.selection = selection;
+                SearchType& retracted = toReturn.selection;
+                toReturn.contextLength = retracted.retractRightOnly(view);
                 
                 toReturn.setsValid = setsValid;
                 if(setsValid) {
                     // We have sets we can build on, but we need to see if we've
-                    // selected too much more stuff.
+                    // selected too much more stuff. Stop counting as soon as
+                    // we know we have.
                     
-                    size_t newRanges =
-                        retracted.getApproximateNumberOfNewRanges(view,
-                        selection);
+                    size_t newRanges = retracted.countNewRangesUpTo(view,
+                        selection, maxRangeCount);
                         
-                    Log::debug() << "Will have " << newRanges <<
-                        " new ranges" << std::endl;
+                    LOG_DEBUG("Will have " << newRanges <<
+                        " new ranges" << std::endl);
                         
                     if(newRanges <= maxRangeCount) {
                         // We can safely look at all the newly selected stuff.
                         // TODO: replace this with some sort of multi-level set,
                         // or just find a way not to use the old retraction ever
-                        // again, so we don't have to do a copy here.
+                        // again, so we don't have to do a copy here. The copy
+                        // reuses the storage toReturn already has.
                         toReturn.selected = selected;
                         
                         // Go find what is newly selected and save it
-                        toReturn.newlySelected = retracted.getNewTextPositions(
-                            view, selection);
-                            
-                        Log::debug() << toReturn.newlySelected.size() <<
-                            " new positions found" << std::endl;
-                            
-                        for(const auto& item : toReturn.newlySelected) {
-                            // Copy it all to the selected set too.
-                            toReturn.selected.insert(item);
+                        toReturn.newlySelected.clear();
+                        {
+                            StatTracker::ScopedPhase phase(locatePhase);
+                            retracted.appendNewTextPositions(view, selection,
+                                ranges, toReturn.newlySelected);
                         }
+                        makeSet(toReturn.newlySelected);
+                            
+                        LOG_DEBUG(toReturn.newlySelected.size() <<
+                            " new positions found" << std::endl);
+                        
+                        // Copy it all to the selected set too.
+                        toReturn.selected.insert(toReturn.selected.end(),
+                            toReturn.newlySelected.begin(),
+                            toReturn.newlySelected.end());
+                        makeSet(toReturn.selected);
                         
                     } else {
                         // We can't fill in the sets on the new retraction.
@@ -237,8 +388,11 @@ protected:
                     }
                 }
                 
-                // We've populated the retraction. Return it.
-                return toReturn;
+                if(!toReturn.setsValid) {
+                    // Don't leave anything from before in the sets.
+                    toReturn.selected.clear();
+                    toReturn.newlySelected.clear();
+                }
             }
                 
         };
@@ -298,17 +452,112 @@ protected:
         }; 
         
         /**
-         * Holds the retraction data for the left side.
+         * Holds the retraction data for the left side. Entries past
+         * leftRetractionCount are left over from earlier bases, and are kept
+         * so their storage can be reused.
          */
         std::vector<SideRetractionEntry> leftRetractions;
         /**
-         * Holds the retraction data for the right side.
+         * Holds the retraction data for the right side, with the same reuse
+         * scheme.
          */
         std::vector<SideRetractionEntry> rightRetractions;
+        /**
+         * How many left retractions are actually computed for this base?
+         */
+        size_t leftRetractionCount = 0;
+        /**
+         * How many right retractions are actually computed for this base?
+         */
+        size_t rightRetractionCount = 0;
+        /**
+         * A first-in, first-out queue of DPTasks, kept in a vector that keeps
+         * its storage when emptied, unlike a std::queue.
+         */
+        struct TaskQueue {
+            /**
+             * Holds the tasks. Those before head have already been popped.
+             */
+            std::vector<DPTask> tasks;
+            /**
+             * Where is the next task to pop?
+             */
+            size_t head = 0;
+            
+            inline void push(const DPTask& task) {
+                tasks.push_back(task);
+            }
+            
+            inline const DPTask& front() const {
+                return tasks[head];
+            }
+            
+            inline void pop() {
+                head++;
+                if(head == tasks.size()) {
+                    // Start over at the beginning of the storage.
+                    clear();
+                }
+            }
+            
+            inline size_t size() const {
+                return tasks.size() - head;
+            }
+            
+            inline bool empty() const {
+                return size() == 0;
+            }
+            
+            inline void clear() {
+                tasks.clear();
+                head = 0;
+            }
+        };
+        
         /**
          * Holds the DPTasks that need to be done.
          */
-        std::queue<DPTask> taskQueue;
+        TaskQueue taskQueue;
+        
+        /**
+         * Scratch space for range numbers, for filling in the sets.
+         */
+        std::vector<size_t> rangeScratch;
+        
+        /**
+         * Phase to count locating positions for the sets in. Unattached
+         * unless the owner sets it.
+         */
+        StatTracker::Phase locatePhase;
+        
+        /**
+         * How many retraction tasks have been run, over all the bases the
+         * table has been used for? Kept for tracing queries.
+         */
+        size_t totalTasksRun = 0;
+        
+        /**
+         * And how many times have retractions been too hard?
+         */
+        size_t totalTooHard = 0;
+        
+        /**
+         * If set, the time budget of the query the table is being used for,
+         * checked between retraction tasks.
+         */
+        const QueryBudget* budget = nullptr;
+        
+        /**
+         * How many bases have been given up on for running over budget?
+         */
+        size_t totalOverBudget = 0;
+        
+        /**
+         * Make an empty DP table, which needs to be reset before use.
+         */
+        inline DPTable() {
+            // Nothing to do!
+        }
         
         /**
          * Initialize the DP table with the first left and right retractions.
@@ -317,11 +566,36 @@ protected:
             const SearchType& right, size_t patternLengthRight,
             const FMDIndexView& view, size_t maxRangeCount) {
             
-            leftRetractions.push_back(SideRetractionEntry(left,
-                patternLengthLeft, view, maxRangeCount));
-                
-            rightRetractions.push_back(SideRetractionEntry(right,
-                patternLengthRight, view, maxRangeCount));
+            reset(left, patternLengthLeft, right, patternLengthRight, view,
+                maxRangeCount);
+        }
+        
+        /**
+         * Start the DP over for a new base, with the given first left and right
+         * retractions. Keeps all the storage from the last base, so mapping a
+         * run of bases with one table doesn't allocate fresh retraction
+         * entries for each.
+         */
+        inline void reset(const SearchType& left, size_t patternLengthLeft,
+            const SearchType& right, size_t patternLengthRight,
+            const FMDIndexView& view, size_t maxRangeCount) {
+            
+            if(leftRetractions.empty()) {
+                leftRetractions.emplace_back();
+            }
+            leftRetractions[0].reset(left, patternLengthLeft, view,
+                maxRangeCount, rangeScratch, locatePhase);
+            leftRetractionCount = 1;
+            
+            if(rightRetractions.empty()) {
+                rightRetractions.emplace_back();
+            }
+            rightRetractions[0].reset(right, patternLengthRight, view,
+                maxRangeCount, rangeScratch, locatePhase);
+            rightRetractionCount = 1;
+            
+            // Drop any tasks left over from an early finish.
+            taskQueue.clear();
                 
             // Make sure to start at the root
             taskQueue.push(DPTask());
@@ -340,18 +614,119 @@ protected:
             
             // Figure out what side to look at
             auto& retractions = isRight ? rightRetractions : leftRetractions;
+            size_t& count = isRight ? rightRetractionCount :
+                leftRetractionCount;
             
-            while(retractions.size() <= retractionNumber) {
+            while(count <= retractionNumber) {
                 // Until we are out to that retraction, do all the required
-                // retractions.
-                retractions.push_back(
-                    retractions[retractions.size() - 1].retract(view, 
-                    maxRangeCount));
+                // retractions, reusing entries from earlier bases if we have
+                // them.
+                if(retractions.size() <= count) {
+                    retractions.emplace_back();
+                }
+                retractions[count - 1].retractInto(retractions[count], view,
+                    maxRangeCount, rangeScratch, locatePhase);
+                count++;
             }
             
             // Now we know it's computed, so return it.
             return retractions[retractionNumber];
         }
+
+        /**
+         * Prefetch what running the given task is going to need from the
+         * index. Retractions that aren't computed yet will be computed from
+         * the last ones that are, so those are what get prefetched.
+         */
+        inline void prefetch(const DPTask& task,
+            const FMDIndexView& view) const {
+
+            leftRetractions[std::min(task.leftIndex,
+                leftRetractionCount - 1)].selection.prefetch(view);
+            rightRetractions[std::min(task.rightIndex,
+                rightRetractionCount - 1)].selection.prefetch(view);
+        }
+    };
+
+    /**
+     * Holds where exploring the retractions for one base has gotten to, so it
+     * can be stopped after any retraction task and picked up again later, in
+     * the same way as a coroutine. This lets one thread take turns working on
+     * several bases.
+     */
+    struct BaseExploration {
+        /**
+         * The left context search for the base.
+         */
+        const SearchType* left = nullptr;
+        /**
+         * How long the left context is.
+         */
+        size_t patternLengthLeft = 0;
+        /**
+         * The right context search for the base.
+         */
+        const SearchType* right = nullptr;
+        /**
+         * How long the right context is.
+         */
+        size_t patternLengthRight = 0;
+        /**
+         * Which base is being explored?
+         */
+        size_t queryBase = 0;
+        /**
+         * The DP table to do the work in, which no other unfinished
+         * BaseExploration may be using.
+         */
+        DPTable* table = nullptr;
+        /**
+         * Has the DP table been set up for this base yet?
+         */
+        bool started = false;
+        /**
+         * Is the exploration done, with its answer in result?
+         */
+        bool done = false;
+        /**
+         * The mapping found for the base, once done.
+         */
+        Mapping result;
+        /**
+         * The unique TextPosition found so far, or more than one if the base
+         * is ambiguous. Holds TextPositions for right contexts.
+         */
+        TextPositionSet found;
+        /**
+         * What are the max left and right contexts that were used to map the
+         * base anywhere so far?
+         */
+        size_t maxLeftContext = 0;
+        size_t maxRightContext = 0;
+        /**
+         * How many retraction tasks have been run for the base?
+         */
+        size_t tasksRun = 0;
+        /**
+         * The minimum right context we will ever have to explore for any left
+         * context this size or smaller.
+         */
+        std::map<size_t, size_t> minRightContext;
+
+        /**
+         * Make a BaseExploration that will explore the retractions of the
+         * given left and right contexts for the given base, in the given
+         * DPTable, the first time it is stepped.
+         */
+        inline BaseExploration(const SearchType& left,
+            size_t patternLengthLeft, const SearchType& right,
+            size_t patternLengthRight, size_t queryBase, DPTable& table):
+            left(&left), patternLengthLeft(patternLengthLeft), right(&right),
+            patternLengthRight(patternLengthRight), queryBase(queryBase),
+            table(&table) {
+
+            // Nothing to do!
+        }
     };
 
     
@@ -369,12 +744,18 @@ protected:
         
     /**
      * Returns true if the given unique search result can be extended through
-     * the given context string on the other side. That string must end with
+     * the given view of the context on the other side. That view must end with
      * the base shared with the search result set (which is not used to extend
      * again), and is extended through right to left.
+     *
+     * If the index has a KmerFilter, and no mismatches are allowed, first
+     * checks that every k-mer of the bases to extend through could be in the
+     * index, and gives up without searching if one can't. If mismatches are
+     * allowed, first checks with a SearchScheme that the bases to extend
+     * through occur anywhere within the tolerance.
      */
     bool canExtendThrough(SearchType context,
-        const std::string& opposingQuery) const;
+        const EncodedQuery::View& opposingQuery) const;
         
     /**
      * Do the "Activity Selection Problem". Given a vector of [start, end]
@@ -394,10 +775,18 @@ protected:
      * ending unique context that starts at or after that base. By looking up
      * your range start, going to 1 later than that position, doing the lookup
      * again, and so on, you can do activity selection fairly easily.
+     *
+     * Apart from the retractions to find the shortest unique contexts, takes
+     * time linear in the query length, and allocates only the index.
+     *
+     * If the query's minimal unique lengths from a MinUniqueTable are given,
+     * contexts longer than them are retracted straight to them first.
      */
     std::vector<size_t> createUniqueContextIndex(
         const std::vector<std::pair<SearchType, size_t>>& leftContexts,
-        const std::vector<std::pair<SearchType, size_t>>& rightContexts) const;
+        const std::vector<std::pair<SearchType, size_t>>& rightContexts,
+        const size_t* leftLengths = nullptr,
+        const size_t* rightLengths = nullptr) const;
     
     /**
      * Do activity selection using an index from createUniqueContextIndex. Given
@@ -421,9 +810,9 @@ protected:
      * Is not responsible for deciding whether a finding of results by one
      * DPTask means that other DPTasks do not need to be executed.
      */
-    std::pair<bool, std::set<TextPosition>> exploreRetraction(
+    std::pair<bool, TextPositionSet> exploreRetraction(
         const typename DPTable::DPTask& task, DPTable& table,
-        const std::string& query, size_t queryBase) const;
+        const EncodedQuery& query, size_t queryBase) const;
     
     /**
      * Explore all retractions of the two searches. Return either an empty
@@ -431,12 +820,33 @@ protected:
      * the two sides), a Mapping with its TextPosition and context lengths set
      * (if we find exactly one such overlap), or an empty Mapping (if we find
      * multiple overlaps).
+     *
+     * Does its work in the given DPTable, which is reset first, so that
+     * storage can be reused from the last base the table was used for.
      */
     Mapping exploreRetractions(const SearchType& left,
         size_t patternLengthLeft, const SearchType& right,
-        size_t patternLengthRight, const std::string& query,
-        size_t queryBase) const;    
-    
+        size_t patternLengthRight, const EncodedQuery& query,
+        size_t queryBase, DPTable& table) const;
+
+    /**
+     * Do the next bit of the given BaseExploration: set up its DP table if
+     * that hasn't been done yet, and then try to run one retraction task.
+     * Returns true, with the exploration's result filled in, if it is done.
+     */
+    bool stepExploration(BaseExploration& exploration,
+        const EncodedQuery& query) const;
+
+    /**
+     * Explore the retractions for all the given bases at once, taking turns
+     * running one retraction task for each. After each turn, prefetches what
+     * the base's next task will need, so the memory reads happen while the
+     * other bases have their turns. Each exploration must have its own
+     * DPTable.
+     */
+    void exploreInterleaved(std::vector<BaseExploration>& explorations,
+        const EncodedQuery& query) const;
+
 };
 
 // Now we have to do all the template definitions, since they need to be in the
@@ -446,7 +856,7 @@ template<typename SearchType>
 size_t ZipMappingScheme<SearchType>::selectActivities(
     std::vector<std::pair<size_t, size_t>> ranges) const {
     
-    stats.add("activitySelectionRuns", 1);
+    activitySelectionRunsStat.add(1);
     
     // First we have to sort the ranges by end, ascending.
     std::sort(ranges.begin(), ranges.end(), [](std::pair<size_t, size_t> a,
@@ -465,19 +875,19 @@ size_t ZipMappingScheme<SearchType>::selectActivities(
     size_t nextFree = 0;
     
     for(const auto& range : ranges) {
-        Log::trace() << "Have " << range.first << " - " << range.second <<
-            std::endl;
+        LOG_TRACE("Have " << range.first << " - " << range.second <<
+            std::endl);
         // For each range (starting with those that end soonest)...
         if(range.first >= nextFree) {
             // Take it if it starts late enough
             
-            Log::trace() << "Taking " << range.first << " - " << range.second <<
-                std::endl;
+            LOG_TRACE("Taking " << range.first << " - " << range.second <<
+                std::endl);
             
             nextFree = range.second + 1;
             found++;
             
-            stats.add("activitiesSelected", 1);
+            activitiesSelectedStat.add(1);
         }
     }
 
@@ -487,176 +897,90 @@ size_t ZipMappingScheme<SearchType>::selectActivities(
 template<typename SearchType>
 std::vector<size_t> ZipMappingScheme<SearchType>::createUniqueContextIndex(
     const std::vector<std::pair<SearchType, size_t>>& leftContexts,
-    const std::vector<std::pair<SearchType, size_t>>& rightContexts) const {
+    const std::vector<std::pair<SearchType, size_t>>& rightContexts,
+    const size_t* leftLengths, const size_t* rightLengths) const {
     
-    // Create vectors of the minimum unique left and right context lengths, or
-    // (size_t) -1 if no such lenght exists.
-    std::vector<size_t> minUniqueLeftContexts;
-    std::vector<size_t> minUniqueRightContexts;
+    if(mismatchTolerance != 0) {
+        // Contexts with mismatches in them can be ambiguous longer than the
+        // query's own string is.
+        leftLengths = nullptr;
+        rightLengths = nullptr;
+    }
     
-    for(const auto& rangeAndLength : leftContexts) {
-        // Find the min unique lengths for the left contexts.
+    // Find the min unique length of a context by retracting it until it might
+    // not be unique, or (size_t) -1 if it was never unique at all. If we know
+    // how long the context's string has to be to be unique in the whole index,
+    // and the context is longer and found something, it is unique back to
+    // there, so jump there first.
+    auto getMinUniqueLength = [&](
+        const std::pair<SearchType, size_t>& rangeAndLength,
+        size_t knownLength) -> size_t {
         
         SearchType position = rangeAndLength.first;
-        size_t length = rangeAndLength.second;
         
-        // What's the min unique length for this base? We haven't found any yet.
+        // We haven't found any unique length yet.
         size_t minUniqueLength = (size_t) -1;
         
+        if(knownLength != 0 && knownLength < rangeAndLength.second &&
+            position.isUnique(view)) {
+            
+            position.retractRightOnly(view, knownLength);
+            minUniqueLength = knownLength;
+        }
+        
         while(position.isUnique(view)) {
-            // Retract to a point where we may not be unique
-            length = position.retractRightOnly(view);
-            // We know we are unique at 1 more character than that
-            minUniqueLength = length + 1;
+            // Retract to a point where we may not be unique. We know we are
+            // unique at 1 more character than that.
+            minUniqueLength = position.retractRightOnly(view) + 1;
         }
         
         if(minUniqueLength == 0) {
             throw std::runtime_error("Too much retracting!");
         }
         
-        minUniqueLeftContexts.push_back(minUniqueLength);
-        
-        Log::trace() << "Min left context " <<
-            minUniqueLeftContexts.size() - 1 << " is " << minUniqueLength <<
-            " vs " << length << " selecting " <<
-            position.getTextPositions(view).size() << std::endl;
-        
-    }
-    
-    for(const auto& rangeAndLength : rightContexts) {
-        // And again for the right contexts. TODO: make a function to not repeat
-        // all this code.
-        
-        SearchType position = rangeAndLength.first;
-        size_t length = rangeAndLength.second;
-        
-        // What's the min unique length for this base? We haven't found any yet.
-        size_t minUniqueLength = (size_t) -1;
-        
-        while(position.isUnique(view)) {
-            // Retract to a point where we may not be unique
-            length = position.retractRightOnly(view);
-            // We know we are unique at 1 more character than that
-            minUniqueLength = length + 1;
-        }
-        
-        minUniqueRightContexts.push_back(minUniqueLength);
-    }
+        return minUniqueLength;
+    };
     
-    // Now we're going to make a sorted list of (start, end) pairs for these
-    // one-sided MUSes
-    std::vector<std::pair<size_t, size_t>> uniqueContexts;
+    // This holds, for each query base, the end position of the soonest-ending
+    // unique context that starts at or after it, or (size_t) -1 if there isn't
+    // one. First we fill in just the contexts that start at each base.
+    std::vector<size_t> endOfBestActivity(leftContexts.size(), (size_t) -1);
     
-    for(size_t i = 0; i < minUniqueLeftContexts.size(); i++) {
-        // For every base
+    for(size_t i = 0; i < leftContexts.size(); i++) {
+        // For every base, its one-sided MUSes end at or start at it.
         
-        if(minUniqueLeftContexts[i] != (size_t) -1) {
-            // If it has a left context,  Save this one-sided MUS
-            uniqueContexts.emplace_back(
-                i - minUniqueLeftContexts[i] + 1, i);
-      
-            if(minUniqueLeftContexts[i] == 0) {
-                throw std::runtime_error("Left context runs backwards!");
+        size_t leftLength = getMinUniqueLength(leftContexts[i],
+            leftLengths != nullptr ? leftLengths[i] : 0);
+        if(leftLength != (size_t) -1) {
+            if(leftLength > i + 1) {
+                throw std::runtime_error("Left context runs off the query!");
             }
+            
+            // The left context starts back here and ends at the base.
+            size_t& best = endOfBestActivity[i - leftLength + 1];
+            best = std::min(best, i);
         }
         
-        if(minUniqueRightContexts[i] != (size_t) -1) {
-            // If it has a right context, save this one-sided MUS
-            uniqueContexts.emplace_back(i,
-                i + minUniqueRightContexts[i] - 1);
-                
-            if(minUniqueRightContexts[i] == 0) {
-                throw std::runtime_error("Right context runs backwards!");
-            }
+        size_t rightLength = getMinUniqueLength(rightContexts[i],
+            rightLengths != nullptr ? rightLengths[i] : 0);
+        if(rightLength != (size_t) -1) {
+            // The right context starts at the base.
+            endOfBestActivity[i] = std::min(endOfBestActivity[i],
+                i + rightLength - 1);
         }
-    }
-    
-    // The "first" range is the one that ends earliest.
-    auto order = ([](std::pair<size_t, size_t> a, 
-        std::pair<size_t, size_t> b) -> bool {
         
-        // We'll give true if the first range ends before the second.
-        // We also return true if there's a tie but a starts first.
-        return (a.second < b.second) || (a.second == b.second &&
-            a.first < b.first);
-        
-    });
-    
-    // Sort the unique contexts by start, descending, so we can pop stuff off
-    // the front when we reach its start position.
-    std::sort(uniqueContexts.begin(), uniqueContexts.end(),
-        [](std::pair<size_t, size_t> a, std::pair<size_t, size_t> b) -> bool {
-            // Define a total ordering
-            return (a.first > b.first) || (a.first == b.first &&
-                a.second > b.second);
-    });
-    
-    // Go through the unique contexts from right to left, and save for each base
-    // the end position of the earliest-ending unique context that starts at or
-    // after it.
-    std::vector<size_t> endOfBestActivity(leftContexts.size());
-    
-    // We're going to iterate through the unique contexts in order of decreasing
-    // start index.
-    auto nextActivity = uniqueContexts.begin();
-    
-    // We'll keep an iterator to the one that starts here or to the right and
-    // ends soonest, but for now that's nothing.
-    auto bestActivity = uniqueContexts.end();
-    
-    // We go from right to left. We have a current best (i.e. earliest-ending)
-    // interval. When we reach the start point of an interval, we see if that
-    // interval ends before our current best one. If so we replace the best
-    // interval. If not we keep it and ignore the new interval.
+        LOG_TRACE("Min contexts for base " << i << " are " << leftLength <<
+            " left and " << rightLength << " right" << std::endl);
+    }
     
-    for(size_t i = leftContexts.size() - 1; i != (size_t) -1; i--) {
-        // For each base from right to left
-        
-        while(nextActivity != uniqueContexts.end() && 
-            (*nextActivity).first >= i) {
-            // For every activity starting at or after here
-            
-            Log::trace() << "Considering activity " << (*nextActivity).first <<
-                "-" << (*nextActivity).second << " which starts at or after " <<
-                i << std::endl;
-            
-            // This activity starts here or later
-            if(bestActivity == uniqueContexts.end() ||
-                (*nextActivity).second < (*bestActivity).second) {
-                
-                // This is a sooner-ending activity than any we have so far.
-                // Take it.
-                bestActivity = nextActivity;
-                
-                Log::trace() << "It is the soonest ending" << std::endl;
-                
-            }
-            // We accepted or rejected this activity, so go on to the next
-            // lefter one to consider.
-            ++nextActivity;
-        }
-        
-        // Now bestActivity points to the soonest-ending activity that starts
-        // here or later.
-        if(bestActivity == uniqueContexts.end()) {
-            // There is no such activity. Use (size_t) -1 as a no-such-value
-            // value.
-            endOfBestActivity[i] = (size_t) -1;
-            
-            Log::trace() << "No soonest ending activity starting at or after " <<
-                i << std::endl;
-        } else {
-            // We found such an activity, so record its endpoint. We can go one
-            // right from there and look up the end of the non-overlapping
-            // activity that we would chain with.
-            endOfBestActivity[i] = (*bestActivity).second;
-            
-            Log::trace() << "Soonest ending activity starting at or after " <<
-                i << " ends at " << endOfBestActivity[i] << std::endl;
-        }
+    // Then go from right to left carrying along the soonest end seen, so each
+    // base gets the soonest end of everything starting at or after it.
+    for(size_t i = endOfBestActivity.size(); i > 1; i--) {
+        endOfBestActivity[i - 2] = std::min(endOfBestActivity[i - 2],
+            endOfBestActivity[i - 1]);
     }
     
-    // Giev back the index vector we made, which simplifies activity selection
+    // Give back the index vector we made, which simplifies activity selection
     // problems immensely.
     return endOfBestActivity;
 }
@@ -699,35 +1023,47 @@ size_t ZipMappingScheme<SearchType>::selectActivitiesIndexed(size_t start,
 template<typename SearchType>
 Mapping ZipMappingScheme<SearchType>::exploreRetractions(
     const SearchType& left, size_t patternLengthLeft, const SearchType& right,
-    size_t patternLengthRight, const std::string& query,
-    size_t queryBase) const {
+    size_t patternLengthRight, const EncodedQuery& query,
+    size_t queryBase, DPTable& table) const {
 
-    stats.add("basesAttempted", 1);
+    StatTracker::ScopedPhase phase(retractionPhase);
 
-    // List the unique TextPosition we found, if we found one. Holds more than
-    // one TextPosition (though not necessarily all of them) if we're ambiguous,
-    // and none if we have no results. Holds TextPositions for right contexts.
-    std::set<TextPosition> found;
-    
-    // What are the max left and right contexts that were used to map the base
-    // anywhere? Note that they may not be part of the same string that maps the
-    // base there, but they would have to be if we accounted for crossover.
-    size_t maxLeftContext = 0;
-    size_t maxRightContext = 0;
+    // Run the whole exploration without stopping.
+    BaseExploration exploration(left, patternLengthLeft, right,
+        patternLengthRight, queryBase, table);
+    while(!stepExploration(exploration, query)) {
+        // Keep going until it's done.
+    }
+    return exploration.result;
+}
 
-    // Make a DP table for this base. TODO: make DPTable remember the extra
-    // parameters.
-    DPTable table(left, patternLengthLeft, right, patternLengthRight,
-        view, maxRangeCount);
+template<typename SearchType>
+bool ZipMappingScheme<SearchType>::stepExploration(
+    BaseExploration& exploration, const EncodedQuery& query) const {
+
+    DPTable& table = *exploration.table;
+    size_t queryBase = exploration.queryBase;
+    
+    if(!exploration.started) {
+        basesAttemptedStat.add(1);
+    
+        // Set up the DP table for this base. TODO: make DPTable remember the
+        // extra parameters.
+        table.reset(*exploration.left, exploration.patternLengthLeft,
+            *exploration.right, exploration.patternLengthRight, view,
+            maxRangeCount);
+        exploration.started = true;
+    }
         
     // I can do my DP by always considering retracting on the left from a state,
     // and only considering retracting on the right on the very edge of the
     // space (i.e. if the left is still full-length).
-        
-    // Make a map of the minimum right context (r) we will ever have to explore
-    // for any left context (l) this size or smaller. We can use lower_bound for
-    // the lookups so we only have to insert l,r pairs where we have overlap.
-    std::map<size_t, size_t> minRightContext;
+    
+    // We use the map of the minimum right context (r) we will ever have to
+    // explore for any left context (l) this size or smaller. We can use
+    // lower_bound for the lookups so we only have to insert l,r pairs where we
+    // have overlap.
+    std::map<size_t, size_t>& minRightContext = exploration.minRightContext;
         
     // A function to see if we need to text a certain combination of left and
     // right context lengths, or if it's a more general context of one we
@@ -756,13 +1092,13 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
             // found results for (on the left it's a lower bound, and we just
             // saw it's a lower bound on the right).
             
-            Log::debug() << "Skipping " << left.contextLength << ", " <<
+            LOG_DEBUG("Skipping " << left.contextLength << ", " <<
                 right.contextLength << " as it is covered by " <<
                 (*minRightIterator).first << ", " <<
-                (*minRightIterator).second << std::endl;
+                (*minRightIterator).second << std::endl);
             
             // Note that there was a covered retraction.
-            stats.add("retractionCovered", 1);
+            retractionCoveredStat.add(1);
             
             return false;
         }
@@ -770,11 +1106,34 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
         // We do need to process this retraction.
         return true;
     };
+    
+    // Say the exploration is done with the given result.
+    auto finish = [&](const Mapping& result) {
+        retractionTasksStat.add(exploration.tasksRun);
+        exploration.result = result;
+        exploration.done = true;
+        return true;
+    };
+    
+    TextPositionSet& found = exploration.found;
         
     while(table.taskQueue.size() > 0) {
     
-        // Grab the task in the table
-        const typename DPTable::DPTask& task = table.taskQueue.front();
+        if((maxRetractionTasks != 0 &&
+            exploration.tasksRun >= maxRetractionTasks) ||
+            (table.budget != nullptr && table.budget->isSpent())) {
+            
+            // We've spent too long on this base. Leave it unmapped, which is
+            // never wrong, and let the other bases have a turn.
+            LOG_DEBUG("Giving up on base " << queryBase << " after " <<
+                exploration.tasksRun << " retraction tasks" << std::endl);
+            table.totalOverBudget++;
+            return finish(Mapping());
+        }
+    
+        // Grab the task in the table. Copy it, since running it can add more
+        // tasks and move the queue's storage.
+        const typename DPTable::DPTask task = table.taskQueue.front();
     
         if(!needToTest(task)) {
             // Skip queued tasks that have becomne redundant.
@@ -796,13 +1155,17 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
         
         // Which we in turn need to calculate the max left and right context
         // lengths observed for the base.
-        maxLeftContext = std::max(maxLeftContext, leftContext);
-        maxRightContext = std::max(maxRightContext, rightContext);
+        exploration.maxLeftContext = std::max(exploration.maxLeftContext,
+            leftContext);
+        exploration.maxRightContext = std::max(exploration.maxRightContext,
+            rightContext);
     
         // Run the first task in the queue, possibly adding more, and getting
         // some results.
         auto flagAndSet = exploreRetraction(task, table, 
             query, queryBase);
+        exploration.tasksRun++;
+        table.totalTasksRun++;
             
         // Drop that task we just did. We can't use task anymore now, or left or
         // right.
@@ -810,16 +1173,17 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
         
         if(!flagAndSet.first) {
             // We encountered something too hard to do.
-            stats.add("tooHardRetraction", 1);
+            tooHardRetractionStat.add(1);
+            table.totalTooHard++;
             
             if(giveUpIfHard) {
                 // We have to abort mapping.
-                Log::debug() << "Aborting mapping base " << queryBase <<
-                    " because it is too hard." << std::endl;
+                LOG_DEBUG("Aborting mapping base " << queryBase <<
+                    " because it is too hard." << std::endl);
                 // Return an empty mapping.
-                return Mapping();
+                return finish(Mapping());
             } else {
-                Log::debug() << "Ignoring hard task" << std::endl;
+                LOG_DEBUG("Ignoring hard task" << std::endl);
             }
         }
         
@@ -830,10 +1194,10 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
         
         if(found.size() > 1) {
             // We're already ambiguous. Short circuit.
-            Log::debug() << "Already ambiguous, not retracting any more" <<
-                std::endl;
-            stats.add("ambiguous", 1);
-            return Mapping();
+            LOG_DEBUG("Already ambiguous, not retracting any more" <<
+                std::endl);
+            ambiguousStat.add(1);
+            return finish(Mapping());
         }
         
         if(!useRetraction) {
@@ -842,45 +1206,181 @@ Mapping ZipMappingScheme<SearchType>::exploreRetractions(
             break;
         }
         
+        if(table.taskQueue.size() > 0) {
+            // We ran a task and there's more to do, so give up our turn.
+            return false;
+        }
+        
     }
     
-    Log::debug() << "Found " << found.size() << " locations" << std::endl;
-    Log::debug() << "Used " << maxLeftContext << ", " << maxRightContext <<
-        " context" << std::endl;
+    LOG_DEBUG("Found " << found.size() << " locations" << std::endl);
+    LOG_DEBUG("Used " << exploration.maxLeftContext << ", " <<
+        exploration.maxRightContext << " context" << std::endl);
         
     if(found.size() == 1) {
         // We mapped to one place, on these contexts.
-        stats.add("unambiguous", 1);
-        return Mapping(*(found.begin()), maxLeftContext, maxRightContext);
+        unambiguousStat.add(1);
+        contextLengthStat.add(exploration.maxLeftContext +
+            exploration.maxRightContext);
+        return finish(Mapping(*(found.begin()), exploration.maxLeftContext,
+            exploration.maxRightContext));
     } else {
         // We mapped to nowhere, because we're ambiguous. TODO: log
         // ambiguousness.
-        stats.add("ambiguous", 1);
-        return Mapping();
+        ambiguousStat.add(1);
+        return finish(Mapping());
     }
 } 
 
+template<typename SearchType>
+void ZipMappingScheme<SearchType>::exploreInterleaved(
+    std::vector<BaseExploration>& explorations,
+    const EncodedQuery& query) const {
+    
+    StatTracker::ScopedPhase phase(retractionPhase);
+    
+    for(const auto& exploration : explorations) {
+        // Get the contexts on their way in before anyone starts.
+        exploration.left->prefetch(view);
+        exploration.right->prefetch(view);
+    }
+    
+    // How many explorations still need turns?
+    size_t running = explorations.size();
+    
+    while(running > 0) {
+        for(auto& exploration : explorations) {
+            if(exploration.done) {
+                continue;
+            }
+            
+            if(stepExploration(exploration, query)) {
+                // This one is finished.
+                running--;
+            } else {
+                // Start getting what its next task needs while the others
+                // have their turns.
+                const DPTable& table = *exploration.table;
+                table.prefetch(table.taskQueue.front(), view);
+            }
+        }
+    }
+}
+
 template<typename SearchType>
 void ZipMappingScheme<SearchType>::map(const std::string& query,
     std::function<void(size_t, TextPosition)> callback) const {
     
-    // Get the right contexts
-    Log::info() << "Looking for right contexts..." << std::endl << std::flush;
-    auto rightContexts = findRightContexts(query, false);
+    // Just send everything through the callback.
+    map<std::function<void(size_t, TextPosition)>&>(query, callback);
+}
+
+template<typename SearchType>
+void ZipMappingScheme<SearchType>::mapRange(const std::string& query,
+    size_t start, size_t end,
+    std::function<void(size_t, TextPosition)> callback) const {
+    
+    // Just send everything through the callback.
+    mapRange<std::function<void(size_t, TextPosition)>&>(query, start, end,
+        callback);
+}
+
+template<typename SearchType>
+std::vector<std::pair<std::string, std::string>>
+    ZipMappingScheme<SearchType>::getParameters() const {
     
-    // And the left contexts (which is the reverse of the contexts for the
-    // reverse complement, which we can produce in backwards order already).
-    Log::info() << "Flipping query..." << std::endl << std::flush;
-    std::string complement = reverseComplement(query);
+    auto parameters = MappingScheme::getParameters();
+    parameters.insert(parameters.end(), {
+        {"useRetraction", std::to_string(useRetraction)},
+        {"giveUpIfHard", std::to_string(giveUpIfHard)},
+        {"minContextLength", std::to_string(minContextLength)},
+        {"maxRangeCount", std::to_string(maxRangeCount)},
+        {"maxExtendThrough", std::to_string(maxExtendThrough)},
+        {"minUniqueStrings", std::to_string(minUniqueStrings)},
+        {"mismatchTolerance", std::to_string(mismatchTolerance)},
+        {"interpolationMargin", std::to_string(interpolationMargin)},
+        {"maxRetractionTasks", std::to_string(maxRetractionTasks)},
+        {"interleavedBases", std::to_string(interleavedBases)},
+        {"credit", std::to_string(credit.enabled)},
+        {"creditMaxMismatches", std::to_string(credit.maxMismatches)}
+    });
+    return parameters;
+}
+
+template<typename SearchType>
+template<typename Sink>
+void ZipMappingScheme<SearchType>::map(const std::string& query,
+    Sink&& sink, const size_t* leftLengths, const size_t* rightLengths) const {
     
-    Log::info() << "Looking for left contexts..." << std::endl << std::flush;
-    auto leftContexts = findRightContexts(complement, true);
+    std::vector<Mapping> filtered = mapAll(query, leftLengths, rightLengths);
+    
+    for(size_t i = 0; i < filtered.size(); i++) {
+        if(filtered[i].isMapped()) {
+            // Send everything that passed the filter to the sink.
+            sink(i, filtered[i].getLocation());
+        }
+    }
+}
+
+template<typename SearchType>
+template<typename Sink>
+void ZipMappingScheme<SearchType>::mapRange(const std::string& query,
+    size_t start, size_t end, Sink&& sink) const {
+    
+    // Only the range and its context get searched.
+    auto context = getRangeContext(query.size(), start, end);
+    std::vector<Mapping> filtered = mapAll(query.substr(context.first,
+        context.second - context.first));
+    
+    for(size_t i = start; i < end; i++) {
+        if(filtered[i - context.first].isMapped()) {
+            // Send everything in the range that passed the filter to the
+            // sink, by where it is in the whole query.
+            sink(i, filtered[i - context.first].getLocation());
+        }
+    }
+}
+
+template<typename SearchType>
+std::vector<Mapping> ZipMappingScheme<SearchType>::mapAll(
+    const std::string& query, const size_t* leftLengths,
+    const size_t* rightLengths) const {
+    
+    // Time the whole query, and trace it if it's slow.
+    QueryTimer timer(*this, query, queryNanosecondsStat);
+    
+    // And start the clock on its budget.
+    QueryBudget budget(queryMicroseconds);
+    
+    // Encode the query once, so extending through the opposing contexts can
+    // read any stretch of either strand without copying it.
+    EncodedQuery encoded(query);
+    
+    // Get the right contexts, and the left contexts (which are the reverse of
+    // the contexts for the reverse complement, which we can produce in
+    // backwards order already). The two sweeps are independent, so if the
+    // query is long enough to split up, do them at the same time.
+    std::vector<std::pair<SearchType, size_t>> rightContexts;
+    std::vector<std::pair<SearchType, size_t>> leftContexts;
+    
+    Log::info() << "Looking for left and right contexts..." << std::endl <<
+        std::flush;
+    runTasks({
+        [&]() {
+            StatTracker::ScopedPhase phase(contextSearchPhase);
+            rightContexts = findRightContexts(query, false);
+        },
+        [&]() {
+            StatTracker::ScopedPhase phase(contextSearchPhase);
+            leftContexts = findRightContexts(reverseComplement(query), true);
+        }
+    }, countWindows(query.size()) > 1);
     
     // This is going to hold, for each query base, the endpoint of the soonest-
     // ending minimally unique context that starts at or after that base.
-    Log::debug() << "Creating unique context index" << std::endl << std::flush;
+    LOG_DEBUG("Creating unique context index" << std::endl << std::flush);
     auto uniqueContextIndex = createUniqueContextIndex(leftContexts,
-        rightContexts);
+        rightContexts, leftLengths, rightLengths);
     
     
     Log::info() << "Exploring retractions..." << std::endl;
@@ -888,37 +1388,153 @@ void ZipMappingScheme<SearchType>::map(const std::string& query,
     // We're going to store up all the potential mappings, and then filter them
     // down. This stores true and the mapped-to TextPosition if a base would map
     // before filtering, and false and an undefined TextPosition otherwise.
-    std::vector<Mapping> mappings;
-    
-    // For each pair, figure out if the forward and reverse searches select
-    // one single consistent TextPosition.
-    for(size_t i = 0; i < query.size(); i++) {
-    
-        Log::debug() << "Base " << i << " = " << query[i] << " (+" << 
-            leftContexts[i].second << "|+" << rightContexts[i].second << 
-            ") selects " << leftContexts[i].first << " and " << 
-            rightContexts[i].first << std::endl;
-            
-        // Go look at these two contexts in opposite directions, and all their
-        // (reasonable to think about) retractions, and see whether this base
-        // belongs to 0, 1, or multiple TextPositions.
-        Mapping mapping = exploreRetractions(
-            leftContexts[i].first, leftContexts[i].second,
-            rightContexts[i].first, rightContexts[i].second, query, i);
-        
-        // TODO: If we can't find anything, try retracting a few bases on one or
-        // both sides until we get a shared result.
-        
-        if(mapping.isMapped()) {
-            // We map!
-            Log::debug() << "Index " << i << " maps to " << mapping << std::endl;
-        } else {
-            // Too few results until we retracted back to too many
-            Log::debug() << "Index " << i << " is not mapped." << std::endl;
-       }
-       // Save the mapping
-       mappings.push_back(mapping);
+    // They're packed, since there's one per query base.
+    std::vector<PackedMapping> mappings(query.size());
+    
+    // Count the work the windows do, for tracing the query.
+    std::atomic<size_t> tasksRun(0);
+    std::atomic<size_t> tooHard(0);
+    std::atomic<size_t> interpolated(0);
+    std::atomic<size_t> overBudget(0);
+    
+    // Each base only looks at its own contexts, so long queries can be done in
+    // parallel windows.
+    forEachWindow(query.size(), [&](size_t windowStart, size_t windowEnd) {
+    
+        // Neighboring bases need about the same number of retractions, so
+        // keep DP tables for the whole window and reuse their storage. We need
+        // one for each base we work on at once.
+        std::vector<DPTable> tables(std::max(interleavedBases, (size_t) 1));
+        for(auto& table : tables) {
+            table.locatePhase = locatePhase;
+            table.budget = &budget;
+        }
+        
+        // How many bases in the window did we interpolate?
+        size_t windowInterpolated = 0;
+    
+        // Keep the last base's mapping, so bases inside long exact matches can
+        // be placed relative to it.
+        Mapping last;
+        
+        // Is the base with the given index well inside the same exact match as
+        // the last base, so it can be placed relative to it if that mapped?
+        auto continuesMatch = [&](size_t i) {
+            return interpolationMargin > 0 && i > windowStart &&
+                leftContexts[i].second == leftContexts[i - 1].second + 1 &&
+                rightContexts[i].second + 1 == rightContexts[i - 1].second &&
+                leftContexts[i].second > interpolationMargin &&
+                rightContexts[i].second > interpolationMargin;
+        };
         
+        // Holds the explorations for the bases we work on at once.
+        std::vector<BaseExploration> explorations;
+    
+        // Go through the window in groups of bases to work on at once, which
+        // are single bases unless we are interleaving.
+        for(size_t groupStart = windowStart; groupStart < windowEnd;
+            groupStart += tables.size()) {
+    
+            if(budget.isSpent()) {
+                // The query is out of time, so leave the rest of the window
+                // unmapped.
+                tables[0].totalOverBudget += windowEnd - groupStart;
+                break;
+            }
+            
+            size_t groupEnd = std::min(windowEnd, groupStart + tables.size());
+            
+            if(tables.size() > 1) {
+                // Explore all the bases in the group that we can't be sure we
+                // will interpolate together, each in its own table.
+                explorations.clear();
+                for(size_t i = groupStart; i < groupEnd; i++) {
+                    if(!continuesMatch(i)) {
+                        explorations.emplace_back(leftContexts[i].first,
+                            leftContexts[i].second, rightContexts[i].first,
+                            rightContexts[i].second, i,
+                            tables[explorations.size()]);
+                    }
+                }
+                exploreInterleaved(explorations, encoded);
+            }
+            
+            // Which exploration is for the next base that was explored?
+            size_t nextExploration = 0;
+    
+            // For each pair, figure out if the forward and reverse searches
+            // select one single consistent TextPosition.
+            for(size_t i = groupStart; i < groupEnd; i++) {
+    
+                LOG_DEBUG("Base " << i << " = " << query[i] << " (+" << 
+                    leftContexts[i].second << "|+" <<
+                    rightContexts[i].second << ") selects " <<
+                    leftContexts[i].first << " and " <<
+                    rightContexts[i].first << std::endl);
+                
+                if(continuesMatch(i) && last.isMapped()) {
+                    // We're well inside the same exact match as the last base,
+                    // so just go one base further along from where it went.
+                    TextPosition next = last.getLocation();
+                    next.addLocalOffset(1);
+                    last = Mapping(next, last.getLeftMaxContext() + 1,
+                        last.getRightMaxContext() - 1);
+                    
+                    basesInterpolatedStat.add(1);
+                    windowInterpolated++;
+                    mappings[i] = PackedMapping(last);
+                    continue;
+                }
+                
+                Mapping mapping;
+                if(tables.size() > 1 && !continuesMatch(i)) {
+                    // We already explored this base along with the rest of the
+                    // group.
+                    mapping = explorations[nextExploration].result;
+                    nextExploration++;
+                } else {
+                    // Go look at these two contexts in opposite directions, and
+                    // all their (reasonable to think about) retractions, and
+                    // see whether this base belongs to 0, 1, or multiple
+                    // TextPositions.
+                    mapping = exploreRetractions(
+                        leftContexts[i].first, leftContexts[i].second,
+                        rightContexts[i].first, rightContexts[i].second,
+                        encoded, i, tables[0]);
+                }
+            
+                // TODO: If we can't find anything, try retracting a few bases
+                // on one or both sides until we get a shared result.
+            
+                if(mapping.isMapped()) {
+                    // We map!
+                    LOG_DEBUG("Index " << i << " maps to " << mapping <<
+                        std::endl);
+                } else {
+                    // Too few results until we retracted back to too many
+                    LOG_DEBUG("Index " << i << " is not mapped." <<
+                        std::endl);
+                }
+                // Save the mapping
+                mappings[i] = PackedMapping(mapping);
+                last = mapping;
+            
+            }
+        }
+        
+        for(const auto& table : tables) {
+            tasksRun += table.totalTasksRun;
+            tooHard += table.totalTooHard;
+            overBudget += table.totalOverBudget;
+        }
+        interpolated += windowInterpolated;
+    
+    });
+    
+    if(overBudget > 0) {
+        // Count the bases we gave up on, and the query, once.
+        overBudgetBasesStat.add(overBudget);
+        overBudgetQueriesStat.add(1);
     }
     
     Log::info() << "Applying filter..." << std::endl << std::flush;
@@ -926,15 +1542,18 @@ void ZipMappingScheme<SearchType>::map(const std::string& query,
     // We're going to filter everything first and then do the callbacks.
     std::vector<Mapping> filtered;
     
+    // How many bases did the filter drop?
+    size_t filterFailed = 0;
+    
     for(size_t i = 0; i < mappings.size(); i++) {
         // Now we have to filter the mappings
         
         // Grab the mapping for this query index.
-        const Mapping& mapping = mappings[i];
+        const PackedMapping& mapping = mappings[i];
         
         if(!mapping.isMapped()) {
             // Skip unmapped query bases
-            filtered.push_back(mapping);
+            filtered.push_back(mapping.unpack());
             continue;
         }
         
@@ -947,16 +1566,17 @@ void ZipMappingScheme<SearchType>::map(const std::string& query,
             uniqueContextIndex, minUniqueStrings);
             
         if(nonOverlapping < minUniqueStrings) {
-            Log::debug() <<
+            LOG_DEBUG(
                 "Dropping mapping " << i <<
-                " due to having too few unique strings." << std::endl;
+                " due to having too few unique strings." << std::endl);
             // Report a non-mapping Mapping
-            stats.add("filterFail", 1);
+            filterFailStat.add(1);
+            filterFailed++;
             filtered.push_back(Mapping());
         } else {
             // Report all the mappings that pass.
-            stats.add("filterPass", 1);
-            filtered.push_back(mapping);
+            filterPassStat.add(1);
+            filtered.push_back(mapping.unpack());
         }
         
     }
@@ -966,17 +1586,23 @@ void ZipMappingScheme<SearchType>::map(const std::string& query,
         // ness is in the CreditStrategy itself, but no point running it if it's
         // going to do nothing.
         Log::info() << "Applying credit..." << std::endl;
+        StatTracker::ScopedPhase phase(creditPhase);
         credit.applyCredit(query, filtered);
     }
     
-    Log::info() << "Sending callbacks..." << std::endl << std::flush;
-    for(size_t i = 0; i < filtered.size(); i++) {
-        if(filtered[i].isMapped()) {
-            // Send a callback for everything that passed the filter.
-            callback(i, filtered[i].getLocation());
-        }
+    if(queryTracer != nullptr) {
+        // Say what happened with this query, in case it was a slow one.
+        timer.count("length", query.size());
+        timer.count("retractionTasks", tasksRun);
+        timer.count("tooHardRetractions", tooHard);
+        timer.count("interpolated", interpolated);
+        timer.count("filterFailed", filterFailed);
+        timer.count("overBudget", overBudget);
+        timer.count("mapped", std::count_if(filtered.begin(), filtered.end(),
+            [](const Mapping& mapping) { return mapping.isMapped(); }));
     }
     
+    return filtered;
 }
 
 #endif
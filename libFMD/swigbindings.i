@@ -19,6 +19,10 @@
 // Also bring in the typemaps library
 %include "typemaps.i"
 
+// And the one for passing Java arrays in and out, so whole queries can be done
+// in one call.
+%include "arrays_java.i"
+
 // Java can't handle these operator names.
 %rename(operatorLeftShift) operator<<;
 %rename(operatorEquals) operator==;
@@ -28,6 +32,8 @@
 %exception {
   try {
     $action
+  } catch (const std::out_of_range& e) {
+    SWIG_exception(SWIG_IndexError, e.what());
   } catch (const std::exception& e) {
     SWIG_exception(SWIG_RuntimeError, e.what());
   }
@@ -89,6 +95,47 @@ using CSA::BitVectorEncoder;
 %}
 %include "FMDIndexBuilder.hpp"
 
+// LevelMapper fills in a Java long[] of packed Sides for a whole query at once.
+%apply long long[] {long long* sides};
+
+// For batches, it works on direct NIO buffers in place, with no copying. Each
+// buffer comes with its length in elements.
+%define DIRECT_BUFFER(CTYPE, NAME, LENGTH, JTYPE)
+%typemap(jni) (CTYPE NAME, size_t LENGTH) "jobject"
+%typemap(jtype) (CTYPE NAME, size_t LENGTH) "JTYPE"
+%typemap(jstype) (CTYPE NAME, size_t LENGTH) "JTYPE"
+%typemap(javain) (CTYPE NAME, size_t LENGTH) "$javainput"
+%typemap(in) (CTYPE NAME, size_t LENGTH) {
+  $1 = ($1_ltype) jenv->GetDirectBufferAddress($input);
+  if($1 == NULL) {
+    SWIG_JavaThrowException(jenv, SWIG_JavaIllegalArgumentException,
+      "Buffer must be direct");
+    return $null;
+  }
+  $2 = (size_t) jenv->GetDirectBufferCapacity($input);
+}
+%enddef
+
+DIRECT_BUFFER(const char*, bases, basesLength, java.nio.ByteBuffer)
+DIRECT_BUFFER(const long long*, offsets, offsetsLength, java.nio.LongBuffer)
+DIRECT_BUFFER(long long*, sides, sidesLength, java.nio.LongBuffer)
+%{
+  #include "LevelMapper.hpp"
+%}
+%include "LevelMapper.hpp"
+
+// HierarchyMapper does the same for every level of a hierarchy at once.
+%{
+  #include "HierarchyMapper.hpp"
+%}
+%include "HierarchyMapper.hpp"
+
+// LevelSideArray looks up Sides in a memory-mapped merged level.
+%{
+  #include "LevelSideArray.hpp"
+%}
+%include "LevelSideArray.hpp"
+
 %{
   using namespace CSA;
 %}
@@ -106,6 +153,9 @@ void fclose(FILE* file);
 // method when working on ranges.
 %template(IntVector) std::vector<long long>;
 
+// HierarchyMapper takes the filenames of its levels as a vector of strings.
+%template(StringVector) std::vector<std::string>;
+
 %template(IntPair) std::pair<int64_t, size_t>;
 %template(sizePair) std::pair<size_t, size_t>;
 %template(building) std::pair<int64_t, std::pair<size_t, size_t>>;
@@ -92,3 +92,16 @@ void BWTWriterBinary::finalize()
     m_stage = IOS_DONE;
 }
 
+//
+void BWTWriterBinary::write(const RLBWT* pRLBWT)
+{
+    writeHeader(pRLBWT->m_numStrings, pRLBWT->m_numSymbols, BWF_NOFMI);
+
+    // The runs are already in the on-disk format
+    const RLVector& runs = pRLBWT->m_rlString;
+    if(!runs.empty())
+        m_pWriter->write(reinterpret_cast<const char*>(&runs[0]), runs.size() * sizeof(RLUnit));
+    m_numRuns = runs.size();
+
+    finalize();
+}
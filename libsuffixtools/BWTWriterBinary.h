@@ -31,6 +31,10 @@ class BWTWriterBinary : public IBWTWriter
         virtual void writeBWChar(char b);
         virtual void finalize(); // this method must be called after writing the BW string
 
+        // Write a whole RLBWT, with all its runs in one write, and finalize
+        void write(const RLBWT* pRLBWT);
+        using IBWTWriter::write;
+
     private:
 
         void writeRun(RLUnit& unit);
@@ -10,29 +10,32 @@
 #include "Timer.h"
 #include "BWTReader.h"
 #include "BWTWriter.h"
+#include "BWTWriterBinary.h"
 #include "BWTReader.h"
 #include <istream>
 #include <queue>
 #include <inttypes.h>
+#include <functional>
+#include <thread>
 
 // macros
 #define OCC(c,i) m_occurrence.get(m_bwStr, (c), (i))
 #define PRED(c) m_predCount.get((c))
 
 // Parse a BWT from a file
-RLBWT::RLBWT(const std::string& filename, int sampleRate) : m_numStrings(0), 
+RLBWT::RLBWT(const std::string& filename, int sampleRate, int numThreads) : m_numStrings(0), 
                                                             m_numSymbols(0), 
                                                             m_largeSampleRate(DEFAULT_SAMPLE_RATE_LARGE),
                                                             m_smallSampleRate(sampleRate)
 {
     IBWTReader* pReader = BWTReader::createReader(filename);
     pReader->read(this);
-    initializeFMIndex();
+    initializeFMIndex(numThreads);
     delete pReader;
 }
 
 // Construct the BWT from a suffix array
-RLBWT::RLBWT(const SuffixArray* pSA, const ReadTable* pRT)
+RLBWT::RLBWT(const SuffixArray* pSA, const ReadTable* pRT, int numThreads)
 {
     // Set up BWT state
     size_t n = pSA->getSize();
@@ -79,7 +82,14 @@ RLBWT::RLBWT(const SuffixArray* pSA, const ReadTable* pRT)
     if(currRun.isInitialized())
         m_rlString.push_back(currRun);
     
-    initializeFMIndex();
+    initializeFMIndex(numThreads);
+}
+
+// Write the BWT to a file
+void RLBWT::write(const std::string& filename) const
+{
+    BWTWriterBinary writer(filename);
+    writer.write(this);
 }
 
 //
@@ -105,8 +115,25 @@ void RLBWT::append(char b)
     ++m_numSymbols;
 }
 
+// Run the function once for each of the given number of threads, each on its
+// own thread, and wait for them all
+static void runThreads(size_t threads, const std::function<void(size_t)>& function)
+{
+    if(threads == 1)
+    {
+        function(0);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t)
+        workers.push_back(std::thread(function, t));
+    for(size_t t = 0; t < threads; ++t)
+        workers[t].join();
+}
+
 // Fill in the FM-index data structures
-void RLBWT::initializeFMIndex()
+void RLBWT::initializeFMIndex(int numThreads)
 {
     m_smallShiftValue = Occurrence::calculateShiftValue(m_smallSampleRate);
     m_largeShiftValue = Occurrence::calculateShiftValue(m_largeSampleRate);
@@ -121,28 +148,64 @@ void RLBWT::initializeFMIndex()
     m_largeMarkers.resize(num_large_markers);
     m_smallMarkers.resize(num_small_markers);
 
-    // Fill in the marker values
-    // We wish to place markers every sampleRate symbols however since a run may
-    // not end exactly on sampleRate boundaries, we place the markers AFTER
-    // the run crossing the boundary ends
-
     // Place a blank markers at the start of the data
     m_largeMarkers[0].unitIndex = 0;
     m_smallMarkers[0].unitCount = 0;
 
-    // State variables for the number of markers placed,
-    // the next marker to place, etc
-    size_t curr_large_marker_index = 1;
-    size_t curr_small_marker_index = 1;
+    // Give each thread an equal stretch of the runs
+    size_t threads = numThreads < 1 ? 1 : numThreads;
+    if(threads > m_rlString.size())
+        threads = m_rlString.empty() ? 1 : m_rlString.size();
 
-    size_t next_small_marker = m_smallSampleRate;
-    size_t next_large_marker = m_largeSampleRate;
+    std::vector<size_t> firstUnit(threads + 1);
+    for(size_t t = 0; t <= threads; ++t)
+        firstUnit[t] = m_rlString.size() * t / threads;
 
-    size_t prev_small_marker_unit_index = 0;
-    size_t running_total = 0;
-    AlphaCount64 running_ac;
+    // Count up the symbols in each stretch, so each knows the counts before it
+    std::vector<AlphaCount64> startCounts(threads + 1);
+    runThreads(threads, [&](size_t t)
+    {
+        for(size_t i = firstUnit[t]; i < firstUnit[t + 1]; ++i)
+            startCounts[t + 1].add(m_rlString[i].getChar(), m_rlString[i].getCount());
+    });
+    for(size_t t = 1; t <= threads; ++t)
+        startCounts[t] += startCounts[t - 1];
+
+    // The small markers count from the large markers, which may be in an
+    // earlier stretch, so all the large markers have to be placed first.
+    runThreads(threads, [&](size_t t)
+    {
+        placeLargeMarkers(firstUnit[t], firstUnit[t + 1], startCounts[t]);
+    });
+    runThreads(threads, [&](size_t t)
+    {
+        placeSmallMarkers(firstUnit[t], firstUnit[t + 1], startCounts[t]);
+    });
 
-    for(size_t i = 0; i < m_rlString.size(); ++i)
+    // Initialize C(a)
+    const AlphaCount64& running_ac = startCounts[threads];
+    m_predCount.set('$', 0);
+    m_predCount.set('A', running_ac.get('$')); 
+    m_predCount.set('C', m_predCount.get('A') + running_ac.get('A'));
+    m_predCount.set('G', m_predCount.get('C') + running_ac.get('C'));
+    m_predCount.set('T', m_predCount.get('G') + running_ac.get('G'));
+}
+
+//
+void RLBWT::placeLargeMarkers(size_t first, size_t last, AlphaCount64 running_ac)
+{
+    // We wish to place markers every sampleRate symbols however since a run may
+    // not end exactly on sampleRate boundaries, we place the markers AFTER
+    // the run crossing the boundary ends
+    size_t num_large_markers = m_largeMarkers.size();
+
+    // Pick up where the runs before this stretch left off, with a marker
+    // placed for every full sample's worth of symbols
+    size_t running_total = running_ac.getSum();
+    size_t curr_large_marker_index = running_total / m_largeSampleRate + 1;
+    size_t next_large_marker = curr_large_marker_index * m_largeSampleRate;
+
+    for(size_t i = first; i < last; ++i)
     {
         // Update the count and advance the running total
         RLUnit& unit = m_rlString[i];
@@ -152,7 +215,6 @@ void RLBWT::initializeFMIndex()
         running_ac.add(symbol, run_len);
         running_total += run_len;
 
-        size_t curr_unit_index = i + 1;
         bool last_symbol = i == m_rlString.size() - 1;
 
         // Check whether to place a new large marker
@@ -168,6 +230,7 @@ void RLBWT::initializeFMIndex()
             assert((running_total - expected_marker_pos) <= RL_FULL_COUNT || place_last_large_marker);
             assert(curr_large_marker_index < num_large_markers);
             assert(running_ac.getSum() == running_total);
+            (void)expected_marker_pos;
 
             LargeMarker& marker = m_largeMarkers[curr_large_marker_index];
             marker.unitIndex = i + 1;
@@ -177,6 +240,49 @@ void RLBWT::initializeFMIndex()
             curr_large_marker_index += 1;
             place_last_large_marker = last_symbol && curr_large_marker_index < num_large_markers;
         }    
+    }
+
+    assert(last != m_rlString.size() || curr_large_marker_index == num_large_markers);
+}
+
+//
+void RLBWT::placeSmallMarkers(size_t first, size_t last, AlphaCount64 running_ac)
+{
+    size_t num_small_markers = m_smallMarkers.size();
+
+    // Pick up where the runs before this stretch left off, like for the large
+    // markers
+    size_t running_total = running_ac.getSum();
+    size_t curr_small_marker_index = running_total / m_smallSampleRate + 1;
+    size_t next_small_marker = curr_small_marker_index * m_smallSampleRate;
+
+    // Find the unit the last small marker was placed after: the first one
+    // that took the running total up to its position
+    size_t prev_small_marker_unit_index = 0;
+    size_t prev_marker_pos = (curr_small_marker_index - 1) * m_smallSampleRate;
+    if(prev_marker_pos > 0)
+    {
+        prev_small_marker_unit_index = first;
+        size_t prev_total = running_total;
+        while(prev_total - m_rlString[prev_small_marker_unit_index - 1].getCount() >= prev_marker_pos)
+        {
+            prev_total -= m_rlString[prev_small_marker_unit_index - 1].getCount();
+            --prev_small_marker_unit_index;
+        }
+    }
+
+    for(size_t i = first; i < last; ++i)
+    {
+        // Update the count and advance the running total
+        RLUnit& unit = m_rlString[i];
+
+        char symbol = unit.getChar();
+        uint8_t run_len = unit.getCount();
+        running_ac.add(symbol, run_len);
+        running_total += run_len;
+
+        size_t curr_unit_index = i + 1;
+        bool last_symbol = i == m_rlString.size() - 1;
 
         // Check whether to place a new small marker
         bool place_last_small_marker = last_symbol && curr_small_marker_index < num_small_markers;
@@ -206,7 +312,7 @@ void RLBWT::initializeFMIndex()
             // This is generally the most previously placed large block except it might 
             // be the second-previous in the case that we placed the last large marker.
             size_t large_marker_index = expected_marker_pos >> m_largeShiftValue;
-            assert(large_marker_index < curr_large_marker_index); // ensure the last has ben placed
+            assert(large_marker_index < m_largeMarkers.size());
             LargeMarker& prev_large_marker = m_largeMarkers[large_marker_index];
 
             // Set the 8bit AlphaCounts as the sum since the last large (superblock) marker
@@ -236,15 +342,21 @@ void RLBWT::initializeFMIndex()
         }    
     }
 
-    assert(curr_small_marker_index == num_small_markers);
-    assert(curr_large_marker_index == num_large_markers);
+    assert(last != m_rlString.size() || curr_small_marker_index == num_small_markers);
+}
 
-    // Initialize C(a)
-    m_predCount.set('$', 0);
-    m_predCount.set('A', running_ac.get('$')); 
-    m_predCount.set('C', m_predCount.get('A') + running_ac.get('A'));
-    m_predCount.set('G', m_predCount.get('C') + running_ac.get('C'));
-    m_predCount.set('T', m_predCount.get('G') + running_ac.get('G'));
+// Advise the runs and both marker arrays separately, since each is its own
+// allocation
+size_t RLBWT::adviseHugePages() const
+{
+    size_t advised = 0;
+    if(!m_rlString.empty())
+        advised += ::adviseHugePages(m_rlString.data(), getRunBytes());
+    if(!m_largeMarkers.empty())
+        advised += ::adviseHugePages(m_largeMarkers.data(), m_largeMarkers.capacity() * sizeof(LargeMarker));
+    if(!m_smallMarkers.empty())
+        advised += ::adviseHugePages(m_smallMarkers.data(), m_smallMarkers.capacity() * sizeof(SmallMarker));
+    return advised;
 }
 
 // get the number of markers required to cover the n symbols at sample rate of d
@@ -30,11 +30,16 @@ class RLBWT
     public:
     
         // Constructors
-        RLBWT(const std::string& filename, int sampleRate = DEFAULT_SAMPLE_RATE_SMALL);
-        RLBWT(const SuffixArray* pSA, const ReadTable* pRT);
+        // Both compute the markers using the given number of threads
+        RLBWT(const std::string& filename, int sampleRate = DEFAULT_SAMPLE_RATE_SMALL, int numThreads = 1);
+        RLBWT(const SuffixArray* pSA, const ReadTable* pRT, int numThreads = 1);
 
-        //    
-        void initializeFMIndex();
+        // Place the markers, with each thread placing them over its own
+        // stretch of runs
+        void initializeFMIndex(int numThreads = 1);
+
+        // Write the BWT to a file in the binary format, all the runs at once
+        void write(const std::string& filename) const;
 
         // Append a symbol to the bw string
         void append(char b);
@@ -160,6 +165,106 @@ class RLBWT
             return running_count;
         }
 
+        // Return the number of times each symbol in the alphabet appears in
+        // bwt[0, idx0] and bwt[0, idx1]. Uses getOccRange when idx0 <= idx1,
+        // as it is for the two ends of a search interval.
+        inline void getFullOccPair(size_t idx0, size_t idx1, AlphaCount64& occ0, AlphaCount64& occ1) const
+        {
+            // Compare as getOccRange will see them, since idx0 may be -1 for
+            // an interval starting at 0.
+            if(idx1 + 1 < idx0 + 1)
+            {
+                // No sharing to be had.
+                occ0 = getFullOcc(idx0);
+                occ1 = getFullOcc(idx1);
+                return;
+            }
+            getOccRange(idx0, idx1, occ0, occ1);
+        }
+
+        // Return the number of times each symbol in the alphabet appears in
+        // bwt[0, lo] and bwt[0, hi], for lo <= hi, where lo may be -1 to count
+        // nothing at all. Only lo is decoded from its marker. If hi is in the
+        // same run as lo, its counts come straight from lo's, and if it is
+        // within a small sample of lo the walk carries on from lo's run
+        // instead of restarting from hi's own marker. If both are behind lo's
+        // marker, the walk back stops at hi on the way to lo.
+        inline void getOccRange(size_t lo, size_t hi, AlphaCount64& occLo, AlphaCount64& occHi) const
+        {
+#ifdef RLBWT_VALIDATE
+            assert(lo + 1 <= hi + 1);
+#endif
+            // The counts in the marker are not inclusive, so we increment the
+            // indices by 1, as in getFullOcc.
+            ++lo;
+            ++hi;
+
+            const LargeMarker marker = getNearestMarker(lo);
+            size_t current_position = marker.getActualPosition();
+            size_t symbol_index = marker.unitIndex;
+            AlphaCount64 running_count = marker.counts;
+
+            if(current_position <= lo)
+            {
+                // Walk up to the run lo is in.
+                accumulateWholeForwards(running_count, symbol_index, current_position, lo);
+                occLo = running_count;
+                addPartialForwards(occLo, symbol_index, current_position, lo);
+
+                if(symbol_index < m_rlString.size() && hi <= current_position + m_rlString[symbol_index].getCount())
+                {
+                    // hi is in the same run, so only that run's symbol
+                    // differs.
+                    occHi = occLo;
+                    occHi.add(m_rlString[symbol_index].getChar(), hi - lo);
+                    return;
+                }
+            }
+            else if(current_position >= hi)
+            {
+                // Both are behind the marker. Stop at hi on the way to lo.
+                accumulateWholeBackwards(running_count, symbol_index, current_position, hi);
+                occHi = running_count;
+                subtractPartialBackwards(occHi, symbol_index, current_position, hi);
+                accumulateWholeBackwards(running_count, symbol_index, current_position, lo);
+                occLo = running_count;
+                subtractPartialBackwards(occLo, symbol_index, current_position, lo);
+                return;
+            }
+            else
+            {
+                // The marker is between them. Walk back to lo from a copy, and
+                // go on to hi from the marker.
+                occLo = running_count;
+                accumulateBackwards(occLo, symbol_index, current_position, lo);
+            }
+
+            if(hi - current_position > m_smallSampleRate)
+            {
+                // hi is far enough off that its own marker is closer.
+                occHi = getFullOcc(hi - 1);
+                return;
+            }
+
+            // Carry on from where the walk to lo left off.
+            accumulateWholeForwards(running_count, symbol_index, current_position, hi);
+            occHi = running_count;
+            addPartialForwards(occHi, symbol_index, current_position, hi);
+        }
+
+        // Issue a software prefetch for the markers that a later getFullOcc(idx)
+        // or getOcc(b, idx) call will read, without blocking on them. This lets
+        // callers with many independent queries overlap their cache misses.
+        inline void prefetchOcc(size_t idx) const
+        {
+            // Same index adjustment and marker choice as getFullOcc
+            ++idx;
+            size_t small_idx = getNearestMarkerIdx(idx, m_smallSampleRate, m_smallShiftValue);
+            size_t large_idx = (small_idx << m_smallShiftValue) >> m_largeShiftValue;
+            __builtin_prefetch(&m_smallMarkers[small_idx]);
+            __builtin_prefetch(&m_largeMarkers[large_idx]);
+        }
+
         // Adds to the count of symbol b in the range [targetPosition, currentPosition)
         // Precondition: currentPosition <= targetPosition
         inline void accumulateBackwards(AlphaCount64& running_count, size_t currentUnitIndex, size_t currentPosition, const size_t targetPosition) const
@@ -229,16 +334,74 @@ class RLBWT
             }
         }
 
+        // Add whole runs to running_count, moving currentUnitIndex and
+        // currentPosition forwards until the next run would go past
+        // targetPosition.
+        // Precondition: currentPosition <= targetPosition
+        inline void accumulateWholeForwards(AlphaCount64& running_count, size_t& currentUnitIndex, size_t& currentPosition, const size_t targetPosition) const
+        {
+            while(currentPosition != targetPosition)
+            {
+                const RLUnit& curr_unit = m_rlString[currentUnitIndex];
+                size_t count = curr_unit.getCount();
+                if(currentPosition + count > targetPosition)
+                    break;
+                running_count.add(curr_unit.getChar(), count);
+                currentPosition += count;
+                ++currentUnitIndex;
+            }
+        }
+
+        // Add the part of the run at currentUnitIndex before targetPosition,
+        // after accumulateWholeForwards has stopped there.
+        inline void addPartialForwards(AlphaCount64& running_count, size_t currentUnitIndex, size_t currentPosition, const size_t targetPosition) const
+        {
+            if(currentPosition != targetPosition)
+                running_count.add(m_rlString[currentUnitIndex].getChar(), targetPosition - currentPosition);
+        }
+
+        // Subtract whole runs from running_count, moving currentUnitIndex and
+        // currentPosition backwards until the previous run would go past
+        // targetPosition.
+        // Precondition: targetPosition <= currentPosition
+        inline void accumulateWholeBackwards(AlphaCount64& running_count, size_t& currentUnitIndex, size_t& currentPosition, const size_t targetPosition) const
+        {
+            while(currentPosition != targetPosition)
+            {
+                const RLUnit& curr_unit = m_rlString[currentUnitIndex - 1];
+                size_t count = curr_unit.getCount();
+                if(currentPosition - count < targetPosition)
+                    break;
+                running_count.subtract(curr_unit.getChar(), count);
+                currentPosition -= count;
+                --currentUnitIndex;
+            }
+        }
+
+        // Subtract the part of the run before currentUnitIndex at or after
+        // targetPosition, after accumulateWholeBackwards has stopped there.
+        inline void subtractPartialBackwards(AlphaCount64& running_count, size_t currentUnitIndex, size_t currentPosition, const size_t targetPosition) const
+        {
+            if(currentPosition != targetPosition)
+                running_count.subtract(m_rlString[currentUnitIndex - 1].getChar(), currentPosition - targetPosition);
+        }
+
         // Return the number of times each symbol in the alphabet appears ins bwt[idx0, idx1]
         inline AlphaCount64 getOccDiff(size_t idx0, size_t idx1) const 
         { 
-            return getFullOcc(idx1) - getFullOcc(idx0); 
+            AlphaCount64 occ0;
+            AlphaCount64 occ1;
+            getFullOccPair(idx0, idx1, occ0, occ1);
+            return occ1 - occ0;
         }
 
         inline size_t getNumStrings() const { return m_numStrings; } 
         inline size_t getBWLen() const { return m_numSymbols; }
         inline size_t getNumRuns() const { return m_rlString.size(); }
 
+        // Return the run-length unit with the given index
+        inline const RLUnit& getRun(size_t idx) const { return m_rlString[idx]; }
+
         // Return the first letter of the suffix starting at idx
         inline char getF(size_t idx) const
         {
@@ -249,6 +412,18 @@ class RLBWT
             return RANK_ALPHABET[ci - 1];
         }
 
+        // Return the bytes taken up by the runs, and by the markers
+        inline size_t getRunBytes() const { return m_rlString.capacity() * sizeof(RLUnit); }
+        inline size_t getMarkerBytes() const
+        {
+            return m_smallMarkers.capacity() * sizeof(SmallMarker) +
+                m_largeMarkers.capacity() * sizeof(LargeMarker);
+        }
+
+        // Back the runs and markers with huge pages where possible, and
+        // return the number of bytes advised
+        size_t adviseHugePages() const;
+
         // Print the size of the BWT
         void printInfo() const;
         void print() const;
@@ -273,6 +448,12 @@ class RLBWT
         // Calculate the number of markers to place
         size_t getNumRequiredMarkers(size_t n, size_t d) const;
 
+        // Place the markers that fall in units [first, last), given the
+        // counts of the symbols before first. All the large markers must be
+        // placed before any of the small markers.
+        void placeLargeMarkers(size_t first, size_t last, AlphaCount64 running_ac);
+        void placeSmallMarkers(size_t first, size_t last, AlphaCount64 running_ac);
+
         // The C(a) array
         AlphaCount64 m_predCount;
         
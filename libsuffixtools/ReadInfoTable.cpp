@@ -102,3 +102,10 @@ void ReadInfoTable::clear()
     m_ids.clear();
 }
 
+//
+void ReadInfoTable::addReadInfo(const std::string& id, size_t length)
+{
+    m_lengths.push_back(length);
+    if(!m_numericIDs)
+        m_ids.push_back(id);
+}
@@ -33,7 +33,7 @@ class ReadInfoTable
 {
     public:
         //
-        ReadInfoTable() {}
+        ReadInfoTable() : m_numericIDs(false) {}
 
         // Load the table using the read in filename
         // If num_expected > 0, reserve room in the table for num_expected reads
@@ -48,6 +48,9 @@ class ReadInfoTable
         size_t countSumLengths() const;
         void clear();
 
+        // Add an entry for a read that was not loaded from a file
+        void addReadInfo(const std::string& id, size_t length);
+
     private:
 
         std::vector<int> m_lengths;
@@ -0,0 +1,321 @@
+//-----------------------------------------------
+// Released under the GPL
+//-----------------------------------------------
+//
+// SACAPrefixDoubling algorithm
+//
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "SACAPrefixDoubling.h"
+
+// A half-open range of suffix array positions
+typedef std::pair<size_t, size_t> SARange;
+
+// Groups at least this big are sorted by all the threads together, instead of
+// being handed to one thread along with other groups
+static const size_t MIN_PARALLEL_GROUP = 1 << 16;
+
+// Orders concatenation positions by the rank of the position some
+// offset after them
+struct OffsetRankCompare
+{
+    OffsetRankCompare(const std::vector<size_t>& r, size_t o) : rank(r), offset(o) {}
+
+    bool operator()(size_t a, size_t b) const
+    {
+        return rank[a + offset] < rank[b + offset];
+    }
+
+    const std::vector<size_t>& rank;
+    size_t offset;
+};
+
+// Run the function once in each of numThreads threads, passing the thread
+// number, and wait for them all to finish
+static void runThreads(size_t numThreads, const std::function<void(size_t)>& function)
+{
+    if(numThreads <= 1)
+    {
+        function(0);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < numThreads; ++t)
+        threads.push_back(std::thread(function, t));
+    for(size_t t = 0; t < numThreads; ++t)
+        threads[t].join();
+}
+
+// Get where the t-th of numThreads even pieces of [start, end) starts
+static inline size_t splitPoint(size_t start, size_t end, size_t t, size_t numThreads)
+{
+    return start + (end - start) * t / numThreads;
+}
+
+// Sort a range with all the threads, by sorting a piece in each and then
+// merging neighbouring pieces in parallel
+static void parallelSort(size_t* data, size_t n, const OffsetRankCompare& compare, size_t numThreads)
+{
+    runThreads(numThreads, [&](size_t t) {
+        std::sort(data + splitPoint(0, n, t, numThreads),
+                  data + splitPoint(0, n, t + 1, numThreads), compare);
+    });
+
+    for(size_t width = 1; width < numThreads; width *= 2)
+    {
+        size_t numMerges = (numThreads + 2 * width - 1) / (2 * width);
+        runThreads(numMerges, [&](size_t m) {
+            size_t first = m * 2 * width;
+            size_t middle = std::min(first + width, numThreads);
+            size_t last = std::min(first + 2 * width, numThreads);
+            std::inplace_merge(data + splitPoint(0, n, first, numThreads),
+                               data + splitPoint(0, n, middle, numThreads),
+                               data + splitPoint(0, n, last, numThreads), compare);
+        });
+    }
+}
+
+// Record the head of the new group for every position in a sorted group, and
+// save the new groups that are still unfinished
+static void rankGroup(const std::vector<size_t>& sa, std::vector<size_t>& heads,
+                      const SARange& group, const OffsetRankCompare& compare,
+                      std::vector<SARange>& unfinished)
+{
+    size_t head = group.first;
+    for(size_t i = group.first; i < group.second; ++i)
+    {
+        if(i > group.first && compare(sa[i - 1], sa[i]))
+        {
+            // This suffix sorts after the last one, so it starts a new group
+            if(i - head > 1)
+                unfinished.push_back(SARange(head, i));
+            head = i;
+        }
+        heads[i] = head;
+    }
+
+    if(group.second - head > 1)
+        unfinished.push_back(SARange(head, group.second));
+}
+
+// Do the same as rankGroup, for one big group, with all the threads. The heads
+// only go up, so each thread can fill in its piece with a running maximum of
+// the heads it sees, and then bring it up to the last head before its piece.
+static void rankGroupParallel(const std::vector<size_t>& sa, std::vector<size_t>& heads,
+                              const SARange& group, const OffsetRankCompare& compare,
+                              size_t numThreads, std::vector<SARange>& unfinished)
+{
+    std::vector<size_t> pieceHeads(numThreads, group.first);
+    runThreads(numThreads, [&](size_t t) {
+        size_t head = group.first;
+        for(size_t i = splitPoint(group.first, group.second, t, numThreads);
+            i < splitPoint(group.first, group.second, t + 1, numThreads); ++i)
+        {
+            if(i > group.first && compare(sa[i - 1], sa[i]))
+                head = i;
+            heads[i] = head;
+        }
+        pieceHeads[t] = head;
+    });
+
+    std::vector<size_t> carried(numThreads, group.first);
+    for(size_t t = 1; t < numThreads; ++t)
+        carried[t] = std::max(carried[t - 1], pieceHeads[t - 1]);
+
+    runThreads(numThreads, [&](size_t t) {
+        for(size_t i = splitPoint(group.first, group.second, t, numThreads);
+            i < splitPoint(group.first, group.second, t + 1, numThreads); ++i)
+        {
+            heads[i] = std::max(heads[i], carried[t]);
+        }
+    });
+
+    // Each thread finds the unfinished groups that start in its piece, even if
+    // they run past the end of it
+    std::vector<std::vector<SARange>> found(numThreads);
+    runThreads(numThreads, [&](size_t t) {
+        for(size_t i = splitPoint(group.first, group.second, t, numThreads);
+            i < splitPoint(group.first, group.second, t + 1, numThreads); ++i)
+        {
+            if(heads[i] != i)
+                continue;
+            size_t end = i + 1;
+            while(end < group.second && heads[end] == i)
+                ++end;
+            if(end - i > 1)
+                found[t].push_back(SARange(i, end));
+        }
+    });
+
+    for(size_t t = 0; t < numThreads; ++t)
+        unfinished.insert(unfinished.end(), found[t].begin(), found[t].end());
+}
+
+// Get the cumulative sizes of the groups, with an extra past-the-end entry
+static std::vector<size_t> groupOffsets(const std::vector<SARange>& groups)
+{
+    std::vector<size_t> offsets(1, 0);
+    for(size_t g = 0; g < groups.size(); ++g)
+        offsets.push_back(offsets.back() + groups[g].second - groups[g].first);
+    return offsets;
+}
+
+// Sort the suffixes of all the reads in the table, using numThreads threads.
+// The '$' at the end of each read sorts before all the bases, and '$'s
+// sort by read index, so the result is the same as from saca_induced_copying.
+void saca_prefix_doubling(SuffixArray* pSA, const ReadTable* pRT, int numThreads, bool silent)
+{
+    size_t threads = numThreads < 1 ? 1 : numThreads;
+    size_t num_strings = pRT->getCount();
+
+    // Lay out all the reads, with their '$'s, in one concatenation
+    std::vector<size_t> starts(1, 0);
+    for(size_t i = 0; i < num_strings; ++i)
+        starts.push_back(starts.back() + pRT->getReadLength(i) + 1);
+    size_t n = starts.back();
+
+    if(!silent)
+        std::cout << "[saca] prefix doubling on " << n << " suffixes using " << threads << " threads\n";
+
+    // The concatenation positions in suffix array order
+    std::vector<size_t> sa(n);
+
+    // The suffix array position of the start of the group each concatenation
+    // position is in, so far
+    std::vector<size_t> rank(n);
+
+    // Give each thread a run of reads, about the same length as the others
+    std::vector<size_t> firstRead(threads + 1, num_strings);
+    for(size_t t = 0; t < threads; ++t)
+        firstRead[t] = std::lower_bound(starts.begin(), starts.end() - 1,
+                                        splitPoint(0, n, t, threads)) - starts.begin();
+
+    // Radix sort by first character. The '$'s go first, each in a group of its
+    // own, and then a bucket for every base.
+    const size_t NUM_BUCKETS = 256;
+    std::vector<std::vector<size_t>> counts(threads, std::vector<size_t>(NUM_BUCKETS, 0));
+    runThreads(threads, [&](size_t t) {
+        for(size_t i = firstRead[t]; i < firstRead[t + 1]; ++i)
+            for(size_t j = 0; j < pRT->getReadLength(i); ++j)
+                ++counts[t][(unsigned char)pRT->getChar(i, j)];
+    });
+
+    std::vector<SARange> groups;
+    std::vector<size_t> bucketStarts(NUM_BUCKETS);
+    size_t next = num_strings;
+    for(size_t c = 0; c < NUM_BUCKETS; ++c)
+    {
+        bucketStarts[c] = next;
+        for(size_t t = 0; t < threads; ++t)
+        {
+            // Each thread fills in its own part of each bucket
+            size_t count = counts[t][c];
+            counts[t][c] = next;
+            next += count;
+        }
+        if(next - bucketStarts[c] > 1)
+            groups.push_back(SARange(bucketStarts[c], next));
+    }
+
+    runThreads(threads, [&](size_t t) {
+        for(size_t i = firstRead[t]; i < firstRead[t + 1]; ++i)
+        {
+            size_t len = pRT->getReadLength(i);
+            for(size_t j = 0; j < len; ++j)
+            {
+                unsigned char c = pRT->getChar(i, j);
+                sa[counts[t][c]++] = starts[i] + j;
+                rank[starts[i] + j] = bucketStarts[c];
+            }
+            sa[i] = starts[i] + len;
+            rank[starts[i] + len] = i;
+        }
+    });
+
+    // Holds the new group heads while groups are being sorted, since the old
+    // ranks are still needed
+    std::vector<size_t> heads(n);
+
+    // After sorting by offset h, groups are sorted by their first 2h
+    // characters. No unfinished group reaches its '$' in the first h
+    // characters, since the '$'s are all different, so p + h is always in the
+    // same read as p.
+    size_t rounds = 0;
+    for(size_t h = 1; !groups.empty(); h *= 2)
+    {
+        OffsetRankCompare compare(rank, h);
+        std::vector<size_t> offsets = groupOffsets(groups);
+        size_t total = offsets.back();
+
+        // Big groups get all the threads at once
+        std::vector<SARange> smallGroups;
+        std::vector<SARange> unfinished;
+        for(size_t g = 0; g < groups.size(); ++g)
+        {
+            size_t size = groups[g].second - groups[g].first;
+            if(threads > 1 && size >= MIN_PARALLEL_GROUP && size > total / threads)
+            {
+                parallelSort(&sa[groups[g].first], size, compare, threads);
+                rankGroupParallel(sa, heads, groups[g], compare, threads, unfinished);
+            }
+            else
+            {
+                smallGroups.push_back(groups[g]);
+            }
+        }
+
+        // The rest get split up among the threads, about evenly by size
+        std::vector<size_t> smallOffsets = groupOffsets(smallGroups);
+        std::vector<std::vector<SARange>> found(threads);
+        runThreads(threads, [&](size_t t) {
+            size_t g = std::lower_bound(smallOffsets.begin(), smallOffsets.end() - 1,
+                                        splitPoint(0, smallOffsets.back(), t, threads)) - smallOffsets.begin();
+            size_t last = std::lower_bound(smallOffsets.begin(), smallOffsets.end() - 1,
+                                           splitPoint(0, smallOffsets.back(), t + 1, threads)) - smallOffsets.begin();
+            for(; g < last; ++g)
+            {
+                std::sort(sa.begin() + smallGroups[g].first, sa.begin() + smallGroups[g].second, compare);
+                rankGroup(sa, heads, smallGroups[g], compare, found[t]);
+            }
+        });
+        for(size_t t = 0; t < threads; ++t)
+            unfinished.insert(unfinished.end(), found[t].begin(), found[t].end());
+
+        // Now that nothing needs the old ranks, move to the new ones
+        runThreads(threads, [&](size_t t) {
+            size_t i = splitPoint(0, total, t, threads);
+            size_t end = splitPoint(0, total, t + 1, threads);
+            size_t g = std::upper_bound(offsets.begin(), offsets.end(), i) - offsets.begin() - 1;
+            for(; i < end; ++i)
+            {
+                while(i >= offsets[g + 1])
+                    ++g;
+                size_t index = groups[g].first + (i - offsets[g]);
+                rank[sa[index]] = heads[index];
+            }
+        });
+
+        groups.swap(unfinished);
+        ++rounds;
+    }
+
+    if(!silent)
+        std::cout << "[saca] prefix doubling finished after " << rounds << " rounds\n";
+
+    // Free the working space before making the real suffix array
+    std::vector<size_t>().swap(rank);
+    std::vector<size_t>().swap(heads);
+
+    pSA->initialize(n, num_strings);
+    runThreads(threads, [&](size_t t) {
+        for(size_t i = splitPoint(0, n, t, threads); i < splitPoint(0, n, t + 1, threads); ++i)
+        {
+            size_t read = std::upper_bound(starts.begin(), starts.end(), sa[i]) - starts.begin() - 1;
+            pSA->set(i, SAElem(read, sa[i] - starts[read]));
+        }
+    });
+}
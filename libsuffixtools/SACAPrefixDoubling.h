@@ -0,0 +1,22 @@
+//-----------------------------------------------
+// Released under the GPL license
+//-----------------------------------------------
+//
+// SACAPrefixDoubling - Multi-threaded construction
+// of a generalized suffix array by prefix doubling,
+// after Manber and Myers (1993), sorting only the
+// unfinished groups as in Larsson and Sadakane (2007).
+//
+// Produces the same suffix array as
+// saca_induced_copying, but every pass is split
+// across threads. Uses about 24 bytes per suffix
+// while sorting, which is more than induced copying.
+//
+#ifndef SACA_PREFIX_DOUBLING_H
+#define SACA_PREFIX_DOUBLING_H
+#include "SuffixArray.h"
+#include "ReadTable.h"
+
+void saca_prefix_doubling(SuffixArray* pSA, const ReadTable* pRT, int numThreads, bool silent = false);
+
+#endif
@@ -42,8 +42,8 @@ class SAReader
 
         // Read the file into a vector of unsigned ints storing
         // the read indices. This is a more compact representation
-        // than storing the full SAElems but only works up to 2**32 values
-        void readElems(std::vector<uint32_t>& outVector);
+        // than storing the full SAElems.
+        void readElems(std::vector<uint64_t>& outVector);
 
         // Read a single element
         SAElem readElem();
@@ -104,6 +104,18 @@ struct SAElem
             return other.m_val != m_val;
         }
 
+        // The biggest string ID and position an SAElem can hold. Longer
+        // strings or bigger collections would silently wrap around.
+        static inline uint64_t getMaxID()
+        {
+            return HIGH_MASK >> POS_BITS;
+        }
+
+        static inline uint64_t getMaxPos()
+        {
+            return LOW_MASK;
+        }
+
         // Input/Output
         friend std::istream& operator>>(std::istream& in, SAElem& s);
         friend std::ostream& operator<<(std::ostream& out, const SAElem& s);
@@ -117,7 +129,7 @@ struct SAElem
         // Masks
         static const uint8_t ID_BITS = 36; // Allows up to 68 billion IDs
         static const uint8_t POS_BITS = 64 - ID_BITS;
-        static const uint64_t HIGH_MASK = ~0 << POS_BITS;
+        static const uint64_t HIGH_MASK = ~(uint64_t)0 << POS_BITS;
         static const uint64_t LOW_MASK = ~HIGH_MASK;
 };
 
@@ -12,12 +12,16 @@
 #include "SampledSuffixArray.h"
 #include "SAReader.h"
 #include "SAWriter.h"
+#include <thread>
 
 #if HAVE_OPENMP
 #include <omp.h>
 #endif
 
+// Each file format version has its own magic number. Version 1 stores the
+// lexicographic index with 32-bit entries, and version 2 with 64-bit ones.
 static const uint32_t SSA_MAGIC_NUMBER = 12412;
+static const uint32_t SSA_MAGIC_NUMBER_V2 = 12413;
 #define SSA_READ(x) pReader->read(reinterpret_cast<char*>(&(x)), sizeof((x)));
 #define SSA_READ_N(x,n) pReader->read(reinterpret_cast<char*>(&(x)), (n));
 
@@ -85,30 +89,84 @@ size_t SampledSuffixArray::lookupLexoRank(size_t r) const
     return m_saLexoIndex[r];
 }
 
-// 
-void SampledSuffixArray::build(const BWT* pBWT, const ReadInfoTable* pRIT, int sampleRate)
+//
+void SampledSuffixArray::checkLimits(const ReadInfoTable* pRIT) const
 {
-    m_sampleRate = sampleRate;
-
     size_t numStrings = pRIT->getCount();
-    m_saLexoIndex.resize(numStrings);
-
-    size_t MAX_ELEMS = std::numeric_limits<SSA_INT_TYPE>::max();
+    size_t MAX_ELEMS = SAElem::getMaxID();
     if(numStrings > MAX_ELEMS)
     {
         std::cerr << "Error: Only " << MAX_ELEMS << " reads are allowed in the sampled suffix array\n";
         std::cerr << "Number of reads in your index: " << numStrings << "\n";
-        std::cerr << "Contact sga-users@googlegroups.com for help\n";
         exit(EXIT_FAILURE);
     }
 
+    for(size_t i = 0; i < numStrings; ++i)
+    {
+        if(pRIT->getReadLength(i) > SAElem::getMaxPos())
+        {
+            std::cerr << "Error: Only reads of up to " << SAElem::getMaxPos() << " bases are allowed in the sampled suffix array\n";
+            std::cerr << "Read " << i << " has length " << pRIT->getReadLength(i) << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// 
+void SampledSuffixArray::build(const BWT* pBWT, const ReadInfoTable* pRIT, int sampleRate, int num_threads)
+{
+    m_sampleRate = sampleRate;
+
+    size_t numStrings = pRIT->getCount();
+    m_saLexoIndex.resize(numStrings);
+    checkLimits(pRIT);
+
     // Set the size of the sampled vector
     size_t numElems = (pBWT->getBWLen() / m_sampleRate) + 1;
     m_saSamples.resize(numElems);
 
+    // Give each thread a run of reads with about the same total length, since
+    // a walk takes one step per base.
+    size_t threads = num_threads < 1 ? 1 : num_threads;
+    if(threads > numStrings)
+        threads = numStrings < 1 ? 1 : numStrings;
+
+    std::vector<size_t> firstRead(threads + 1, numStrings);
+    firstRead[0] = 0;
+    size_t totalLength = pBWT->getBWLen();
+    size_t seen = 0;
+    size_t run = 1;
+    for(size_t i = 0; i < numStrings && run < threads; ++i)
+    {
+        // Start the next run once this one has its share of the text
+        while(run < threads && seen >= totalLength * run / threads)
+            firstRead[run++] = i;
+        seen += pRIT->getReadLength(i) + 1;
+    }
+
+    if(threads == 1)
+    {
+        sampleReads(pBWT, pRIT, 0, numStrings);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t)
+        workers.push_back(std::thread(&SampledSuffixArray::sampleReads, this, pBWT, pRIT,
+                                      firstRead[t], firstRead[t + 1]));
+    for(size_t t = 0; t < threads; ++t)
+        workers[t].join();
+}
+
+//
+void SampledSuffixArray::sampleReads(const BWT* pBWT, const ReadInfoTable* pRIT, size_t first, size_t last)
+{
+    // The samples and the lexicographic index are already sized, and each
+    // slot is written by only one walk, so no locking is needed.
+
     // For each read, start from the end of the read and backtrack through the suffix array/BWT.
     // For every idx that is divisible by the sample rate, store the calculate SAElem
-    for(size_t i = 0; i < numStrings; ++i)
+    for(size_t i = first; i < last; ++i)
     {
         // The suffix array positions for the ends of reads are ordered
         // by their position in the read information table, therefore
@@ -139,9 +197,7 @@ void SampledSuffixArray::build(const BWT* pBWT, const ReadInfoTable* pRIT, int s
                     std::cout << "elem: " << elem << " i: " << i << "\n";
 
                 assert(elem.getPos() == 0);
-                size_t id = elem.getID();
-                assert(id < MAX_ELEMS);
-                m_saLexoIndex[idx] = id;
+                m_saLexoIndex[idx] = elem.getID();
                 break; // done;
             }
             else
@@ -158,8 +214,7 @@ void SampledSuffixArray::buildLexicoIndex(const BWT* pBWT, int num_threads)
 {
     int64_t numStrings = pBWT->getNumStrings();
     m_saLexoIndex.resize(numStrings);
-    int64_t MAX_ELEMS = std::numeric_limits<SSA_INT_TYPE>::max();
-    assert(numStrings < MAX_ELEMS);
+    assert((uint64_t)numStrings <= SAElem::getMaxID());
 
     (void)num_threads;
     // Parallelize this computaiton using openmp, if the compiler supports it
@@ -188,6 +243,60 @@ void SampledSuffixArray::buildLexicoIndex(const BWT* pBWT, int num_threads)
     }
 }
 
+//
+void SampledSuffixArray::build(const SuffixArray* pSA, const ReadInfoTable* pRIT, int sampleRate, int num_threads)
+{
+    m_sampleRate = sampleRate;
+    checkLimits(pRIT);
+
+    size_t numRows = pSA->getSize();
+    m_saSamples.resize((numRows / m_sampleRate) + 1);
+
+    // Give each thread an equal run of rows
+    size_t threads = num_threads < 1 ? 1 : num_threads;
+    if(threads > numRows)
+        threads = numRows < 1 ? 1 : numRows;
+
+    std::vector<std::vector<SSA_INT_TYPE> > readStarts(threads);
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t)
+        workers.push_back(std::thread(&SampledSuffixArray::sampleRows, this, pSA,
+                                      numRows * t / threads, numRows * (t + 1) / threads,
+                                      &readStarts[t]));
+    for(size_t t = 0; t < threads; ++t)
+        workers[t].join();
+
+    // The full-length suffixes come in lexicographic order of their reads,
+    // so the runs' read starts together make the lexicographic index.
+    m_saLexoIndex.clear();
+    m_saLexoIndex.reserve(pRIT->getCount());
+    for(size_t t = 0; t < threads; ++t)
+        m_saLexoIndex.insert(m_saLexoIndex.end(), readStarts[t].begin(), readStarts[t].end());
+    assert(m_saLexoIndex.size() == pRIT->getCount());
+}
+
+//
+void SampledSuffixArray::sampleRows(const SuffixArray* pSA, size_t first, size_t last,
+                                    std::vector<SSA_INT_TYPE>* readStarts)
+{
+    for(size_t idx = first; idx < last; ++idx)
+    {
+        const SAElem& elem = pSA->get(idx);
+        if(idx % m_sampleRate == 0)
+        {
+            // store this SAElem
+            m_saSamples[idx / m_sampleRate] = elem;
+        }
+
+        if(elem.getPos() == 0)
+        {
+            // This is the whole read, so its row is the read's place in the
+            // lexicographic index.
+            readStarts->push_back(elem.getID());
+        }
+    }
+}
+
 // Validate the sampled suffix array values are correct
 void SampledSuffixArray::validate(const std::string filename, const BWT* pBWT)
 {
@@ -220,8 +329,20 @@ void SampledSuffixArray::writeSSA(std::string filename)
 {
     std::ostream* pWriter = createWriter(filename, std::ios::out | std::ios::binary);
     
-    // Write a magic number
-    SSA_WRITE(SSA_MAGIC_NUMBER)
+    // Use the old 32-bit format when every read ID fits, so older readers
+    // can still load the file, and the 64-bit one otherwise
+    bool wide = false;
+    for(size_t i = 0; i < m_saLexoIndex.size(); ++i)
+    {
+        if(m_saLexoIndex[i] > std::numeric_limits<uint32_t>::max())
+        {
+            wide = true;
+            break;
+        }
+    }
+
+    // Write a magic number, which says which version this is
+    SSA_WRITE(wide ? SSA_MAGIC_NUMBER_V2 : SSA_MAGIC_NUMBER)
 
     // Write sample rate
     SSA_WRITE(m_sampleRate)
@@ -231,7 +352,18 @@ void SampledSuffixArray::writeSSA(std::string filename)
     SSA_WRITE(n)
 
     // Write lexo index
-    SSA_WRITE_N(m_saLexoIndex.front(), sizeof(SSA_INT_TYPE) * n)
+    if(wide)
+    {
+        SSA_WRITE_N(m_saLexoIndex.front(), sizeof(SSA_INT_TYPE) * n)
+    }
+    else
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            uint32_t id = m_saLexoIndex[i];
+            SSA_WRITE(id)
+        }
+    }
     
     // Write number of samples
     n = m_saSamples.size();
@@ -261,10 +393,14 @@ void SampledSuffixArray::readSSA(std::string filename)
 {
     std::istream* pReader = createReader(filename, std::ios::binary);
     
-    // Write a magic number
+    // Read the magic number, which says which version this is
     uint32_t magic = 0;
     SSA_READ(magic)
-    assert(magic == SSA_MAGIC_NUMBER);
+    if(magic != SSA_MAGIC_NUMBER && magic != SSA_MAGIC_NUMBER_V2)
+    {
+        std::cerr << "Error: " << filename << " is not a sampled suffix array file this program can read\n";
+        exit(EXIT_FAILURE);
+    }
 
     // Read sample rate
     SSA_READ(m_sampleRate)
@@ -275,7 +411,20 @@ void SampledSuffixArray::readSSA(std::string filename)
     m_saLexoIndex.resize(n);
 
     // Read lexo index
-    SSA_READ_N(m_saLexoIndex.front(), sizeof(SSA_INT_TYPE) * n)
+    if(magic == SSA_MAGIC_NUMBER_V2)
+    {
+        SSA_READ_N(m_saLexoIndex.front(), sizeof(SSA_INT_TYPE) * n)
+    }
+    else
+    {
+        // Widen the old 32-bit entries as they come in
+        for(size_t i = 0; i < n; ++i)
+        {
+            uint32_t id = 0;
+            SSA_READ(id)
+            m_saLexoIndex[i] = id;
+        }
+    }
     
     // Read number of samples
     n = 0;
@@ -301,6 +450,15 @@ void SampledSuffixArray::readSAI(std::string filename)
     m_sampleRate = 0;
 }
 
+// The lexicographic index is only used at the ends of texts, so just the
+// samples are worth advising
+size_t SampledSuffixArray::adviseHugePages() const
+{
+    if(m_saSamples.empty())
+        return 0;
+    return ::adviseHugePages(m_saSamples.data(), m_saSamples.capacity() * sizeof(SAElem));
+}
+
 // Print memory usage information
 void SampledSuffixArray::printInfo() const
 {
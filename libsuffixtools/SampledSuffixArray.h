@@ -16,7 +16,7 @@
 #include "BWT.h"
 #include "ReadInfoTable.h"
 
-typedef uint32_t SSA_INT_TYPE;
+typedef uint64_t SSA_INT_TYPE;
 
 enum SSAFileType
 {
@@ -37,8 +37,32 @@ class SampledSuffixArray
         // Returns the ID of the read with lexicographic rank r
         size_t lookupLexoRank(size_t r) const;
 
-        // Construct the sampled SA using the bwt of a set of reads and their lengths
-        void build(const BWT* pBWT, const ReadInfoTable* pRIT, int sampleRate = DEFAULT_SA_SAMPLE_RATE);
+        // If a sample is stored for the given index, put it in elem and
+        // return true. Otherwise return false. This is the check calcSA
+        // makes before each backtracking step, for callers that want to run
+        // several backtracking walks at once.
+        inline bool getSample(int64_t idx, SAElem& elem) const
+        {
+            if(m_sampleRate > 0 && idx % m_sampleRate == 0 &&
+                !m_saSamples[idx / m_sampleRate].isEmpty())
+            {
+                elem = m_saSamples[idx / m_sampleRate];
+                return true;
+            }
+            return false;
+        }
+
+        // Construct the sampled SA using the bwt of a set of reads and their lengths.
+        // The reads are split into runs of about equal total length, and each
+        // run is walked back through the BWT by its own thread.
+        void build(const BWT* pBWT, const ReadInfoTable* pRIT, int sampleRate = DEFAULT_SA_SAMPLE_RATE,
+                   int num_threads = 1);
+
+        // Construct the sampled SA by picking the samples straight out of the
+        // full suffix array, which needs no backtracking. The suffix array is
+        // split into equal runs of rows, each scanned by its own thread.
+        void build(const SuffixArray* pSA, const ReadInfoTable* pRIT, int sampleRate = DEFAULT_SA_SAMPLE_RATE,
+                   int num_threads = 1);
 
         // Construct the lexicographic index (.sai) from the BWT
         void buildLexicoIndex(const BWT* pBWT, int num_threads);
@@ -47,6 +71,17 @@ class SampledSuffixArray
         void validate(std::string readsFile, const BWT* pBWT);
         void printInfo() const;
 
+        // Return the bytes taken up by the samples and the lexicographic index
+        inline size_t getMemoryUsage() const
+        {
+            return m_saSamples.capacity() * sizeof(SAElem) +
+                m_saLexoIndex.capacity() * sizeof(SSA_INT_TYPE);
+        }
+
+        // Back the samples with huge pages where possible, and return the
+        // number of bytes advised
+        size_t adviseHugePages() const;
+
         // I/O
         void writeLexicoIndex(const std::string& filename);
         void writeSSA(std::string filename);
@@ -55,15 +90,30 @@ class SampledSuffixArray
 
     private:
 
+        // Make sure every read ID and position fits in an SAElem, instead of
+        // letting them wrap around into each other
+        void checkLimits(const ReadInfoTable* pRIT) const;
+
+        // Walk reads [first, last) back from their ends, storing samples and
+        // lexicographic index entries. Every BWT row is visited by exactly one
+        // read, so walks of different reads can run concurrently.
+        void sampleReads(const BWT* pBWT, const ReadInfoTable* pRIT, size_t first, size_t last);
+
+        // Store the samples for suffix array rows [first, last), and append
+        // the IDs of the reads starting in those rows, in order, to
+        // readStarts. Each row has its own sample slot, so runs of rows can be
+        // scanned concurrently.
+        void sampleRows(const SuffixArray* pSA, size_t first, size_t last,
+                        std::vector<SSA_INT_TYPE>* readStarts);
+
         // Unsigned integers indicating the start of every read in the
         // sequence collection. These elements are in lexicographic order
         // based on the whole read sequence. Tracing a read backwards through
         // the suffix array necessarily ends at one of these positions. These
         // are nominally SAElems representing the full length suffix but
-        // we store them here as unsigned integers to save 4 bytes per entry.
-        // This limits the SampledSuffixArray to represent at most 2**32 strings.
-        // To improve this we could use a polymorphic vector with a runtime-determined
-        // size.
+        // we store them here as plain read IDs. They are 64 bits wide in
+        // memory, so collections with more than 2**32 strings work; on disk
+        // they are written 32 bits wide whenever every ID fits.
         std::vector<SSA_INT_TYPE> m_saLexoIndex;
 
         static const int DEFAULT_SA_SAMPLE_RATE = 64;
@@ -1,5 +1,8 @@
 // Test the SampledSuffixArray's ability to build a Sampled Suffix Array.
 
+#include <cstdio>
+#include <fstream>
+
 #include "../ReadTable.h"
 #include "../SuffixArray.h"
 #include "../SampledSuffixArray.h"
@@ -12,6 +15,9 @@ CPPUNIT_TEST_SUITE_REGISTRATION( SampledSuffixArrayTests );
 // Define constants
 const std::string SampledSuffixArrayTests::filename = "Test/haplotypes.fa";
 
+// Where should saved sampled suffix arrays go?
+static const std::string ssaFilename = "Test/haplotypes.ssa";
+
 void SampledSuffixArrayTests::setUp() {
     // Set up the basic suffix array
     readTable = new ReadTable(filename);
@@ -58,4 +64,133 @@ void SampledSuffixArrayTests::testConstruction() {
     
     
 
+}
+
+/**
+ * Test building a sampled suffix array with several threads.
+ */
+void SampledSuffixArrayTests::testParallelConstruction() {
+    
+    BWT* bwt = new BWT(suffixArray, readTable);
+    
+    // Ask for more threads than there are reads, which should be cut down to
+    // one thread per read
+    SampledSuffixArray* sampled = new SampledSuffixArray();
+    sampled->build(bwt, infoTable, 5, infoTable->getCount() + 3);
+    
+    // It should come out the same as a serial build
+    sampled->validate(filename, bwt);
+    
+    delete sampled;
+    delete bwt;
+}
+
+/**
+ * Test building a sampled suffix array straight from the full suffix array.
+ */
+void SampledSuffixArrayTests::testConstructionFromSuffixArray() {
+    
+    BWT* bwt = new BWT(suffixArray, readTable);
+    
+    SampledSuffixArray* walked = new SampledSuffixArray();
+    walked->build(bwt, infoTable, 5);
+    
+    // Split the rows over several threads
+    SampledSuffixArray* sampled = new SampledSuffixArray();
+    sampled->build(suffixArray, infoTable, 5, 3);
+    
+    for(size_t i = 0; i < infoTable->getCount(); i++) {
+        // The lexicographic index should match the one from walking the BWT
+        CPPUNIT_ASSERT_EQUAL(walked->lookupLexoRank(i),
+            sampled->lookupLexoRank(i));
+    }
+    
+    // And so should all the suffix array entries
+    sampled->validate(filename, bwt);
+    
+    delete sampled;
+    delete walked;
+    delete bwt;
+}
+
+/**
+ * Test saving a sampled suffix array and loading it back.
+ */
+void SampledSuffixArrayTests::testSaveLoad() {
+    
+    BWT* bwt = new BWT(suffixArray, readTable);
+    
+    SampledSuffixArray* sampled = new SampledSuffixArray();
+    sampled->build(bwt, infoTable, 5);
+    sampled->writeSSA(ssaFilename);
+    
+    // Every read ID fits in 32 bits, so it should be in the old format, with
+    // 4 bytes per lexicographic index entry.
+    std::ifstream file(ssaFilename.c_str(), std::ios::binary);
+    uint32_t magic = 0;
+    file.read((char*) &magic, sizeof(magic));
+    CPPUNIT_ASSERT_EQUAL((uint32_t) 12412, magic);
+    file.close();
+    
+    SampledSuffixArray* loaded = new SampledSuffixArray(ssaFilename);
+    std::remove(ssaFilename.c_str());
+    
+    for(size_t i = 0; i < infoTable->getCount(); i++) {
+        // The lexicographic index should come back the same
+        CPPUNIT_ASSERT_EQUAL(sampled->lookupLexoRank(i),
+            loaded->lookupLexoRank(i));
+    }
+    
+    // And so should all the suffix array entries
+    loaded->validate(filename, bwt);
+    
+    delete loaded;
+    delete sampled;
+    delete bwt;
+}
+
+/**
+ * Test loading a sampled suffix array saved with 64-bit lexicographic index
+ * entries, as it would be for a collection with more than 2**32 reads.
+ */
+void SampledSuffixArrayTests::testLoadWide() {
+    
+    BWT* bwt = new BWT(suffixArray, readTable);
+    
+    SampledSuffixArray* sampled = new SampledSuffixArray();
+    sampled->build(bwt, infoTable, 5);
+    
+    // Save just the lexicographic index, with a sample rate of zero, in the
+    // 64-bit format.
+    std::ofstream file(ssaFilename.c_str(), std::ios::binary);
+    uint32_t magic = 12413;
+    file.write((const char*) &magic, sizeof(magic));
+    int sampleRate = 0;
+    file.write((const char*) &sampleRate, sizeof(sampleRate));
+    size_t n = infoTable->getCount();
+    file.write((const char*) &n, sizeof(n));
+    for(size_t i = 0; i < n; i++) {
+        uint64_t id = sampled->lookupLexoRank(i);
+        file.write((const char*) &id, sizeof(id));
+    }
+    size_t numSamples = 1;
+    file.write((const char*) &numSamples, sizeof(numSamples));
+    SAElem empty;
+    file.write((const char*) &empty, sizeof(empty));
+    file.close();
+    
+    SampledSuffixArray* loaded = new SampledSuffixArray(ssaFilename);
+    std::remove(ssaFilename.c_str());
+    
+    for(size_t i = 0; i < n; i++) {
+        CPPUNIT_ASSERT_EQUAL(sampled->lookupLexoRank(i),
+            loaded->lookupLexoRank(i));
+    }
+    
+    // With no samples, everything has to come from the lexicographic index.
+    loaded->validate(filename, bwt);
+    
+    delete loaded;
+    delete sampled;
+    delete bwt;
 }
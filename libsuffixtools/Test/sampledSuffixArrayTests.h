@@ -9,6 +9,10 @@
 class SampledSuffixArrayTests : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(SampledSuffixArrayTests);
     CPPUNIT_TEST(testConstruction);
+    CPPUNIT_TEST(testParallelConstruction);
+    CPPUNIT_TEST(testConstructionFromSuffixArray);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testLoadWide);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -25,6 +29,10 @@ public:
     void tearDown();
 
     void testConstruction();
+    void testParallelConstruction();
+    void testConstructionFromSuffixArray();
+    void testSaveLoad();
+    void testLoadWide();
 };
 
 #endif
@@ -1,7 +1,15 @@
 // Test the SuffixArray.
 
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
 #include "../ReadTable.h"
 #include "../SuffixArray.h"
+#include "../BWT.h"
+#include "../SACAPrefixDoubling.h"
 
 #include "suffixArrayTests.h"
 
@@ -44,3 +52,89 @@ void SuffixArrayTests::testBWT() {
     delete suffixArray;
 
 }
+
+/**
+ * Test saving a BWT built in memory and loading it back with its markers
+ * placed by several threads.
+ */
+void SuffixArrayTests::testBWTSaveLoad() {
+    
+    ReadTable readTable(filename);
+    SuffixArray suffixArray(&readTable, 1);
+    BWT built(&suffixArray, &readTable);
+    
+    // The bulk write should make the same file as writing a character at a
+    // time.
+    std::string bulkFilename = "Test/bulk.bwt";
+    std::string streamedFilename = "Test/streamed.bwt";
+    built.write(bulkFilename);
+    suffixArray.writeBWT(streamedFilename, &readTable);
+    
+    std::ifstream bulk(bulkFilename.c_str(), std::ios::binary);
+    std::ifstream streamed(streamedFilename.c_str(), std::ios::binary);
+    std::string bulkBytes((std::istreambuf_iterator<char>(bulk)),
+        std::istreambuf_iterator<char>());
+    std::string streamedBytes((std::istreambuf_iterator<char>(streamed)),
+        std::istreambuf_iterator<char>());
+    CPPUNIT_ASSERT(bulkBytes == streamedBytes);
+    
+    for(int threads : {1, 3, 8}) {
+        BWT loaded(bulkFilename, BWT::DEFAULT_SAMPLE_RATE_SMALL, threads);
+        
+        CPPUNIT_ASSERT_EQUAL(built.getBWLen(), loaded.getBWLen());
+        for(size_t i = 0; i < built.getBWLen(); i++) {
+            // Every character and occurrence count should come back the same.
+            CPPUNIT_ASSERT_EQUAL(built.getChar(i), loaded.getChar(i));
+            for(char c : {'$', 'A', 'C', 'G', 'T'}) {
+                CPPUNIT_ASSERT_EQUAL(built.getOcc(c, i), loaded.getOcc(c, i));
+            }
+        }
+    }
+    
+    std::remove(bulkFilename.c_str());
+    std::remove(streamedFilename.c_str());
+}
+
+/**
+ * Make sure prefix doubling sorts suffixes the same way as induced copying, in
+ * one thread and in several.
+ */
+void SuffixArrayTests::testPrefixDoubling() {
+    
+    // Make some reads long enough that several threads have to sort buckets
+    // together. Use repeats so it takes several rounds, and a copy of a read
+    // so ties have to be broken at the '$'s.
+    ReadTable readTable;
+    std::string bases = "ACGT";
+    std::string sequence;
+    srand(1);
+    for(size_t i = 0; i < 100000; i++) {
+        sequence.push_back(bases[rand() % 4]);
+    }
+    
+    for(size_t i = 0; i < 4; i++) {
+        SeqItem item;
+        item.id = "read" + std::to_string(i);
+        item.seq = (i == 3) ? sequence.substr(0, 1000) :
+            sequence + sequence.substr(i * 500, 5000);
+        readTable.addRead(item);
+    }
+    SeqItem copy;
+    copy.id = "copy";
+    copy.seq = sequence.substr(0, 1000);
+    readTable.addRead(copy);
+    
+    SuffixArray truth(&readTable, 1, true);
+    
+    for(int threads : {1, 8}) {
+        SuffixArray doubled;
+        saca_prefix_doubling(&doubled, &readTable, threads, true);
+        
+        CPPUNIT_ASSERT_EQUAL(truth.getSize(), doubled.getSize());
+        CPPUNIT_ASSERT_EQUAL(truth.getNumStrings(), doubled.getNumStrings());
+        for(size_t i = 0; i < truth.getSize(); i++) {
+            CPPUNIT_ASSERT_EQUAL(truth.get(i).getID(), doubled.get(i).getID());
+            CPPUNIT_ASSERT_EQUAL(truth.get(i).getPos(), doubled.get(i).getPos());
+        }
+    }
+}
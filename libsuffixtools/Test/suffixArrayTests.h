@@ -9,6 +9,8 @@
 class SuffixArrayTests : public CppUnit::TestFixture {
     CPPUNIT_TEST_SUITE(SuffixArrayTests);
     CPPUNIT_TEST(testBWT);
+    CPPUNIT_TEST(testBWTSaveLoad);
+    CPPUNIT_TEST(testPrefixDoubling);
     CPPUNIT_TEST_SUITE_END();
     
     // Keep a string saying where to get the haplotypes to test with.
@@ -19,6 +21,8 @@ public:
     void tearDown();
 
     void testBWT();
+    void testBWTSaveLoad();
+    void testPrefixDoubling();
 };
 
 #endif
@@ -0,0 +1,84 @@
+// Test the word-at-a-time sequence operations.
+
+#include <string>
+
+#include "../Util.h"
+
+#include "utilTests.h"
+
+// Register the fixture to be run.
+CPPUNIT_TEST_SUITE_REGISTRATION( UtilTests );
+
+/**
+ * Complement a base the slow way, to check against.
+ */
+static char slowComplement(char base) {
+    switch(base) {
+    case 'A':
+        return 'T';
+    case 'C':
+        return 'G';
+    case 'G':
+        return 'C';
+    case 'T':
+        return 'A';
+    default:
+        return 'N';
+    }
+}
+
+/**
+ * Make a sequence of the given length that isn't too repetitive, with some Ns.
+ */
+static std::string makeSequence(size_t length) {
+    std::string sequence;
+    for(size_t i = 0; i < length; i++) {
+        sequence.push_back("ACGTN"[(i * 7 + i / 3) % 5]);
+    }
+    return sequence;
+}
+
+void UtilTests::setUp() {
+}
+
+void UtilTests::tearDown() {
+}
+
+/**
+ * Make sure reverse complementing whole words and leftover bases, into a
+ * buffer or in place, agrees with doing it one base at a time.
+ */
+void UtilTests::testReverseComplement() {
+    for(size_t length = 0; length < 40; length++) {
+        std::string sequence = makeSequence(length);
+        std::string expected(sequence.rbegin(), sequence.rend());
+        for(char& base : expected) {
+            base = slowComplement(base);
+        }
+
+        CPPUNIT_ASSERT_EQUAL(expected, reverseComplement(sequence));
+
+        std::string inPlace = sequence;
+        reverseComplementInPlace(inPlace);
+        CPPUNIT_ASSERT_EQUAL(expected, inPlace);
+    }
+}
+
+/**
+ * Make sure complementing agrees with doing it one base at a time.
+ */
+void UtilTests::testComplement() {
+    for(size_t length = 0; length < 40; length++) {
+        std::string sequence = makeSequence(length);
+        std::string expected = sequence;
+        for(char& base : expected) {
+            base = slowComplement(base);
+        }
+
+        CPPUNIT_ASSERT_EQUAL(expected, complement(sequence));
+
+        std::string inPlace = sequence;
+        complementInPlace(inPlace);
+        CPPUNIT_ASSERT_EQUAL(expected, inPlace);
+    }
+}
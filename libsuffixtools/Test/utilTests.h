@@ -0,0 +1,23 @@
+#ifndef UTILTESTS_HPP
+#define UTILTESTS_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/**
+ * Tests for the sequence operations in Util.
+ */
+class UtilTests : public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(UtilTests);
+    CPPUNIT_TEST(testReverseComplement);
+    CPPUNIT_TEST(testComplement);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+    void testReverseComplement();
+    void testComplement();
+};
+
+#endif
@@ -11,6 +11,8 @@
 #define TIMER_H
 
 #include <string>
+#include <cstdio>
+#include <ctime>
 #include <sys/time.h>
 
 class Timer
@@ -11,20 +11,112 @@
 #include <map>
 #include "Util.h"
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 //
 // Sequence operations
 //
 
+// Complement 8 bases packed into a word, if they are all A, C, G, T or N.
+// Returns false, leaving word alone, if any of them is anything else, so the
+// caller can complement them one at a time and complain about the bad one.
+static inline bool complementWord(uint64_t& word)
+{
+    // Every byte of these has the same value.
+    const uint64_t ONES = 0x0101010101010101ULL;
+    const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+    const uint64_t LOW_BITS = 0x7F7F7F7F7F7F7F7FULL;
+
+    // Find the bytes equal to a character, as the high bits of the zero bytes
+    // of the word XORed with all that character.
+    auto matches = [&](char c) {
+        uint64_t difference = word ^ (ONES * (uint8_t)c);
+        return ~(((difference & LOW_BITS) + LOW_BITS) | difference) &
+            HIGH_BITS;
+    };
+
+    uint64_t isAT = matches('A') | matches('T');
+    uint64_t isCG = matches('C') | matches('G');
+    if((isAT | isCG | matches('N')) != HIGH_BITS)
+    {
+        return false;
+    }
+
+    // A ^ T is 0x15 and C ^ G is 0x04, so XOR each base with the one for its
+    // pair. Ns get 0 and stay Ns.
+    word ^= (isAT >> 7) * 0x15 | (isCG >> 7) * 0x04;
+    return true;
+}
+
+// Reverse complement a sequence into a buffer
+void reverseComplement(const char* seq, size_t length, char* out)
+{
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, seq + i, sizeof(word));
+        if(complementWord(word))
+        {
+            // Reverse the bytes of the little-endian word to reverse the
+            // bases, and put them at the other end.
+            word = __builtin_bswap64(word);
+            memcpy(out + length - i - 8, &word, sizeof(word));
+        }
+        else
+        {
+            for(size_t j = i; j < i + 8; ++j)
+                out[length - 1 - j] = complement(seq[j]);
+        }
+    }
+
+    // Do the last few one at a time.
+    for(; i < length; ++i)
+        out[length - 1 - i] = complement(seq[i]);
+}
+
 // Reverse complement a sequence
 std::string reverseComplement(const std::string& seq)
 {
     std::string out(seq.length(), 'A');
-    size_t last_pos = seq.length() - 1;
-    for(int i = last_pos; i >= 0; --i)
+    reverseComplement(seq.data(), seq.length(), &out[0]);
+    return out;
+}
+
+// Reverse complement a sequence where it is
+void reverseComplementInPlace(std::string& seq)
+{
+    // Swap words from the two ends in towards the middle.
+    size_t left = 0;
+    size_t right = seq.length();
+    for(; right - left >= 16; left += 8, right -= 8)
     {
-        out[last_pos - i] = complement(seq[i]);
+        uint64_t leftWord;
+        uint64_t rightWord;
+        memcpy(&leftWord, &seq[left], sizeof(leftWord));
+        memcpy(&rightWord, &seq[right - 8], sizeof(rightWord));
+        if(!complementWord(leftWord) || !complementWord(rightWord))
+        {
+            // Do the rest one at a time.
+            break;
+        }
+        leftWord = __builtin_bswap64(leftWord);
+        rightWord = __builtin_bswap64(rightWord);
+        memcpy(&seq[left], &rightWord, sizeof(rightWord));
+        memcpy(&seq[right - 8], &leftWord, sizeof(leftWord));
     }
-    return out;
+
+    // Then swap the middle one pair at a time.
+    for(; right - left >= 2; ++left, --right)
+    {
+        char leftBase = complement(seq[left]);
+        seq[left] = complement(seq[right - 1]);
+        seq[right - 1] = leftBase;
+    }
+    if(right - left == 1)
+        seq[left] = complement(seq[left]);
 }
 
 // Reverse complement a sequence using the full iupac alphabet
@@ -45,16 +137,43 @@ std::string reverse(const std::string& seq)
     return std::string(seq.rbegin(), seq.rend());
 }
 
+// Complement a sequence into a buffer
+void complement(const char* seq, size_t length, char* out)
+{
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, seq + i, sizeof(word));
+        if(complementWord(word))
+        {
+            memcpy(out + i, &word, sizeof(word));
+        }
+        else
+        {
+            for(size_t j = i; j < i + 8; ++j)
+                out[j] = complement(seq[j]);
+        }
+    }
+    for(; i < length; ++i)
+        out[i] = complement(seq[i]);
+}
+
 // Complement a sequence
 std::string complement(const std::string& seq)
 {
     std::string out(seq.length(), 'A');
-    size_t l = seq.length();
-    for(size_t i = 0; i < l; ++i)
-        out[i] = complement(seq[i]);
+    complement(seq.data(), seq.length(), &out[0]);
     return out;
 }
 
+// Complement a sequence where it is
+void complementInPlace(std::string& seq)
+{
+    // Reading and writing the same word is fine.
+    complement(seq.data(), seq.length(), &seq[0]);
+}
+
 // Complement a sequence over the IUPAC alphabet
 std::string complementIUPAC(const std::string& seq)
 {
@@ -264,6 +383,34 @@ std::ifstream::pos_type getFilesize(const std::string& filename)
     return in.tellg();
 }
 
+// Huge pages are this big on everything we run on
+static const uintptr_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t adviseHugePages(const void* data, size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // Only whole huge pages inside the range can be advised
+    uintptr_t start = ((uintptr_t)data + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)data + bytes) & ~(HUGE_PAGE_SIZE - 1);
+    if(data == NULL || end <= start)
+        return 0;
+
+    if(madvise((void*)start, end - start, MADV_HUGEPAGE) != 0)
+        return 0;
+
+#ifdef MADV_COLLAPSE
+    // Pages loaded before the advice would otherwise wait for khugepaged.
+    // Not every kernel can do this, and that's fine.
+    madvise((void*)start, end - start, MADV_COLLAPSE);
+#endif
+    return end - start;
+#else
+    (void)data;
+    (void)bytes;
+    return 0;
+#endif
+}
+
 // Open a file that may or may not be gzipped for reading
 // The caller is responsible for freeing the handle
 std::istream* createReader(const std::string& filename, std::ios_base::openmode mode)
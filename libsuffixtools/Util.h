@@ -126,6 +126,12 @@ bool isGzip(const std::string& filename);
 bool isFastq(const std::string& filename);
 std::ifstream::pos_type getFilesize(const std::string& filename);
 
+// Ask for the whole 2 MB pages inside the given memory to be backed by
+// transparent huge pages, collapsing pages already touched where the kernel
+// can. Returns the number of bytes advised, which is 0 if the memory is too
+// small or huge pages aren't available. The memory works the same either way.
+size_t adviseHugePages(const void* data, size_t bytes);
+
 // Write out a fasta record
 void writeFastaRecord(std::ostream* pWriter, const std::string& id, const std::string& seq, size_t maxLength = 80);
 
@@ -196,6 +202,17 @@ std::string reverseComplement(const std::string& seq);
 std::string complement(const std::string& seq);
 std::string reverse(const std::string& seq);
 
+// Reverse complement or complement length bases from seq into out, which
+// must have room for them. out must not overlap seq, except that complement
+// can work on seq itself. These don't allocate, and work a word of 8 bases at
+// a time.
+void reverseComplement(const char* seq, size_t length, char* out);
+void complement(const char* seq, size_t length, char* out);
+
+// Reverse complement or complement a sequence where it is.
+void reverseComplementInPlace(std::string& seq);
+void complementInPlace(std::string& seq);
+
 // Reverse/complement functions, allowing a full IUPAC alphabet
 std::string reverseComplementIUPAC(const std::string& seq);
 std::string complementIUPAC(const std::string& seq);
@@ -0,0 +1,102 @@
+#!/usr/bin/env python2.7
+"""
+compareBenchmarks.py: compare two JSON result files from libFMD's mappingBench
+(make bench-mapping), such as from before and after a change. Prints the
+throughput change for each scheme and thread count, and exits with a failure
+status if anything got slower by more than the tolerance, or mapped a different
+number of bases.
+
+"""
+
+import argparse, sys, json
+
+def parse_args(args):
+    """
+    Takes in the command-line arguments list (args), and returns a nice argparse
+    result with fields for all the options.
+
+    Borrows heavily from the argparse documentation examples:
+    <http://docs.python.org/library/argparse.html>
+    """
+
+    # Construct the parser (which is stored in parser)
+    # Module docstring lives in __doc__
+    # See http://python-forum.com/pythonforum/viewtopic.php?f=3&t=36847
+    # And a formatter class so our examples in the docstring look good. Isn't it
+    # convenient how we already wrapped it to 80 characters?
+    # See http://docs.python.org/library/argparse.html#formatter-class
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+
+    # General options
+    parser.add_argument("old", type=argparse.FileType("r"),
+        help="benchmark results to compare against")
+    parser.add_argument("new", type=argparse.FileType("r"),
+        help="benchmark results to check")
+    parser.add_argument("--tolerance", type=float, default=0.05,
+        help="fraction of throughput that may be lost without failing")
+
+    # The command line arguments start with the program name, which we don't
+    # want to treat as an argument for argparse. So we remove it.
+    args = args[1:]
+
+    return parser.parse_args(args)
+
+def load_runs(stream):
+    """
+    Load a benchmark results file from the given stream, and return a dict of
+    runs by (scheme, threads).
+
+    """
+
+    results = json.load(stream)
+
+    return {(run["scheme"], run["threads"]): run for run in results["runs"]}
+
+def main(args):
+    """
+    Parses command line arguments and do the work of the program.
+    "args" specifies the program arguments, with args[0] being the executable
+    name. The return value should be used as the program's exit code.
+    """
+
+    options = parse_args(args) # This holds the nicely-parsed options object
+
+    old_runs = load_runs(options.old)
+    new_runs = load_runs(options.new)
+
+    # Did anything get worse?
+    failed = False
+
+    for key in sorted(set(old_runs.keys()) | set(new_runs.keys())):
+        if key not in old_runs or key not in new_runs:
+            # We can't compare runs that only happened once.
+            print("{}\t{} threads\tonly in one file".format(*key))
+            continue
+
+        old = old_runs[key]
+        new = new_runs[key]
+
+        # How much faster did we get?
+        ratio = float(new["basesPerSecond"]) / old["basesPerSecond"]
+
+        notes = []
+        if ratio < 1 - options.tolerance:
+            notes.append("SLOWER")
+            failed = True
+        if new["mappedBases"] != old["mappedBases"]:
+            # The benchmark maps the same reads every time, so this means the
+            # mapping itself changed.
+            notes.append("MAPPED {} -> {}".format(old["mappedBases"],
+                new["mappedBases"]))
+            failed = True
+
+        print("{}\t{} threads\t{:.0f} -> {:.0f} bases/s\t{:+.1%}\t"
+            "{} -> {} KB peak RSS\t{}".format(key[0], key[1],
+            old["basesPerSecond"], new["basesPerSecond"], ratio - 1,
+            old["peakRSSKB"], new["peakRSSKB"], " ".join(notes)))
+
+    return 1 if failed else 0
+
+if __name__ == "__main__" :
+    sys.exit(main(sys.argv))
@@ -1,7 +1,8 @@
 package edu.ucsc.genome
 import scala.collection.immutable.HashMap
 import scala.collection.mutable.{ArrayBuilder, ArrayBuffer}
-import org.ga4gh.{FMDUtil, BitVector, BitVectorIterator, FMDIndex, Mapping}
+import org.ga4gh.{FMDUtil, BitVector, BitVectorIterator, FMDIndex, Mapping,
+    LevelMapper}
 import scala.collection.JavaConversions._
 import java.io.File
 import java.nio.file._
@@ -121,34 +122,26 @@ class StringReferenceStructure(index: FMDIndex) extends ReferenceStructure {
                 mapFace(pattern.reverseComplement, Face.LEFT, 
                     minContext).reverse
             case Face.LEFT =>
-                // Get the MappingVector for mapping to all genomes with the
-                // given minimum context.
-                val mappings = getIndex.mapLeft(pattern, -1, minContext)
-                
-                // Make an ArrayBuffer of all the mappings, to which we can
-                // efficiently append
-                var mappingSeq: ArrayBuffer[Mapping] = new ArrayBuffer()
-                
-                for(i <- 0L until mappings.size()) {
-                    mappingSeq += mappings.get(i.toInt)
+                // Map the whole pattern in one native call, getting a packed
+                // Side (or -1) for every base.
+                val mapper = new LevelMapper(index)
+                mapper.setMinContext(minContext)
+                val sides = new Array[Long](pattern.size)
+                try {
+                    mapper.mapSides(pattern, sides, sides.size)
+                } finally {
+                    // Free the native mapper now instead of at finalization.
+                    mapper.delete
                 }
                 
-                // Grab the Sides that the mappings correspond to, or None.
-                mappingSeq.map { mapping =>
-                    if(mapping.getIs_mapped) {
-                        // Go get the ID for this base, and match the
-                        // appropriate Face. 
-                        Some(new Side(index.getBaseID(mapping.getLocation), 
-                            index.getStrand(mapping.getLocation) match { 
-                                // Remember that the "true" strand is the
-                                // reverse one.
-                                case true => Face.RIGHT
-                                case false => Face.LEFT
-                            }))
-                    } else {
-                        // Didn't map anywhere.
-                        None
-                    }
+                // Unpack the Sides the same way a SideArray does. Remember that
+                // the reverse strand, with the low bit set, is the right face.
+                sides.toSeq.map {
+                    case -1 => None
+                    case side => Some(new Side(side >> 1, side & 1 match {
+                        case 0 => Face.LEFT
+                        case 1 => Face.RIGHT
+                    }))
                 }
         }
     }
@@ -10,6 +10,10 @@ import org.apache.spark.graphx._
 import org.apache.spark.Partitioner
 
 import java.io.{ByteArrayInputStream, ByteArrayOutputStream}
+import java.nio.{ByteBuffer, ByteOrder}
+
+// We map with the native FMD index library
+import org.ga4gh.LevelMapper
 
 // Import parquet
 import parquet.hadoop.{ParquetOutputFormat, ParquetInputFormat}
@@ -396,5 +400,65 @@ object SparkUtil {
         }.cache
         
     }
+    
+    /**
+     * Map each read in the given RDD against the FMD index with the given
+     * basename, or against the merged level saved in the given file over it,
+     * and pair it with a packed Side (or -1) for each of its bases, as
+     * LevelMapper produces them. The index files must be at the same paths on
+     * every node.
+     *
+     * Each executor JVM loads the index only once, into a native LevelMapper
+     * that all its tasks share, and each batch of up to the given number of
+     * reads is mapped with one native call that reads and writes direct
+     * buffers in place.
+     */
+    def mapReads(reads: RDD[String], indexBasename: String,
+        levelFilename: String = "", batchSize: Int = 10000):
+        RDD[(String, Array[Long])] = {
+        
+        reads.mapPartitions { iterator =>
+            // Get the mapper for this JVM, loading the index if no task here
+            // has yet.
+            val mapper = LevelMapper.open(indexBasename, levelFilename)
+            
+            // Keep the buffers for bases and Sides between batches, and only
+            // make them bigger when a batch doesn't fit.
+            var bases = ByteBuffer.allocateDirect(0)
+            var sides = ByteBuffer.allocateDirect(0).asLongBuffer
+            
+            iterator.grouped(batchSize).flatMap { batch =>
+                val totalBases = batch.map(_.size).sum
+                if(bases.capacity < totalBases) {
+                    bases = ByteBuffer.allocateDirect(totalBases)
+                    sides = ByteBuffer.allocateDirect(totalBases * 8)
+                        .order(ByteOrder.nativeOrder).asLongBuffer
+                }
+                
+                // The native side reads every offset there is room for, so
+                // this has to be exactly the right size.
+                val offsets = ByteBuffer.allocateDirect((batch.size + 1) * 8)
+                    .order(ByteOrder.nativeOrder).asLongBuffer
+                
+                // Run all the reads together.
+                bases.clear
+                for(read <- batch) {
+                    offsets.put(bases.position)
+                    bases.put(read.getBytes("US-ASCII"))
+                }
+                offsets.put(bases.position)
+                
+                mapper.mapBatch(bases, offsets, sides)
+                
+                // Pull out each read's Sides.
+                batch.zipWithIndex.map { case (read, i) =>
+                    val readSides = new Array[Long](read.size)
+                    sides.position(offsets.get(i).toInt)
+                    sides.get(readSides)
+                    (read, readSides)
+                }
+            }
+        }
+    }
 
 }